@@ -19,20 +19,74 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "client.h"
 #include "cmd.h"
 #include "console.h"
+#include "fisheye.h"
 #include "host.h"
 #include "net.h"
 #include "protocol.h"
 #include "quakedef.h"
+#include "sound.h"
 #include "sys.h"
 #include "zone.h"
 
 static void CL_FinishTimeDemo(void);
 
+/*
+ * A timedemo matrix replays the demo once for each configuration (a line of
+ * console commands, e.g. "f_lens panini; f_globe cube; f_fov 180"), waiting
+ * for the fisheye lens to be built before timing each pass.
+ */
+#define TD_MAX_CONFIGS 64
+#define TD_MAX_FRAMES 32768
+
+typedef struct {
+    char config[256];
+    int frames;
+    float time;
+    float p50, p95, p99;	// frame times in ms
+} td_pass_t;
+
+static struct {
+    qboolean active;
+    qboolean pending;		// the next pass is queued in the command buffer
+    char demo[MAX_QPATH];
+    td_pass_t passes[TD_MAX_CONFIGS];
+    int numpasses;
+    int pass;
+} td_matrix;
+
+static float td_frametimes[TD_MAX_FRAMES];
+static int td_numframetimes;
+static double td_lastrealtime;
+
+/*
+ * The index of a demo being played, made the first time it is seeked in.
+ * It holds the offset of the first message each second, by the server time
+ * at the start of the message.
+ */
+#define DEMO_INDEX_STEP 1.0f
+
+typedef struct {
+    float time;
+    long offset;
+} demomark_t;
+
+static struct {
+    long start;			// offset of the first message
+    qboolean built;
+    demomark_t *marks;
+    int nummarks, maxmarks;
+    float target;		// server time being seeked to
+    qboolean seeking;
+} demo_index;
+
 /*
 ==============================================================================
 
@@ -64,8 +118,13 @@ CL_StopPlayback(void)
     cls.demofile = NULL;
     cls.state = ca_disconnected;
 
+    free(demo_index.marks);
+    memset(&demo_index, 0, sizeof(demo_index));
+
     if (cls.timedemo)
 	CL_FinishTimeDemo();
+    if (fisheye_capturing)
+	F_StopCapture();
 }
 
 /*
@@ -83,13 +142,34 @@ CL_WriteDemoMessage(void)
     float f;
 
     len = LittleLong(net_message.cursize);
-    fwrite(&len, 4, 1, cls.demofile);
+    COM_StreamWrite(&len, 4);
     for (i = 0; i < 3; i++) {
 	f = LittleFloat(cl.viewangles[i]);
-	fwrite(&f, 4, 1, cls.demofile);
+	COM_StreamWrite(&f, 4);
     }
-    fwrite(net_message.data, net_message.cursize, 1, cls.demofile);
-    fflush(cls.demofile);
+    COM_StreamWrite(net_message.data, net_message.cursize);
+}
+
+/*
+====================
+CL_DemoSeeking
+
+True while demo messages should be read without waiting, to get to the
+time being seeked to.  Once it's reached, the clock is moved up to it.
+====================
+*/
+static qboolean
+CL_DemoSeeking(void)
+{
+    if (!demo_index.seeking)
+	return false;
+    if (cl.mtime[0] < demo_index.target)
+	return true;
+
+    demo_index.seeking = false;
+    cl.time = cl.oldtime = cl.mtime[0];
+
+    return false;
 }
 
 /*
@@ -108,8 +188,21 @@ CL_GetMessage(void)
     if (cls.demoplayback) {
 	// decide if it is time to grab the next message
 	// always grab until fully connected
-	if (cls.state == ca_active) {
+	if (cls.state == ca_active && CL_DemoSeeking()) {
+	    // read straight through to the seek time
+	} else if (cls.state == ca_active) {
+	    // hold a captured demo while its lens is built
+	    if (fisheye_capturing && !F_LensReady())
+		return 0;
+
 	    if (cls.timedemo) {
+		// hold the demo until the fisheye lens is built, so the
+		// build doesn't count either
+		if (!F_LensReady()) {
+		    cls.td_startframe = host_framecount;
+		    return 0;
+		}
+
 		if (host_framecount == cls.td_lastframe)
 		    return 0;	// already read this frame's message
 
@@ -117,8 +210,13 @@ CL_GetMessage(void)
 
 		// if this is the second frame, grab the real td_starttime
 		// so the bogus time on the first frame doesn't count
-		if (host_framecount == cls.td_startframe + 1)
+		if (host_framecount == cls.td_startframe + 1) {
 		    cls.td_starttime = realtime;
+		    td_numframetimes = 0;
+		} else if (td_numframetimes < TD_MAX_FRAMES) {
+		    td_frametimes[td_numframetimes++] = realtime - td_lastrealtime;
+		}
+		td_lastrealtime = realtime;
 	    } else if (cl.time <= cl.mtime[0]) {
 		// don't need another message yet
 		return 0;
@@ -187,8 +285,7 @@ CL_Stop_f(void)
     CL_WriteDemoMessage();
 
 // finish up
-    fclose(cls.demofile);
-    cls.demofile = NULL;
+    COM_CloseStream();
     cls.demorecording = false;
     Con_Printf("Completed demo\n");
 }
@@ -204,7 +301,7 @@ void
 CL_Record_f(void)
 {
     int c, track, length, err;
-    char name[MAX_OSPATH];
+    char name[MAX_OSPATH], trackline[16];
 
     if (cmd_source != src_command)
 	return;
@@ -250,14 +347,14 @@ CL_Record_f(void)
 
     /* open the demo file */
     Con_Printf("recording to %s.\n", name);
-    cls.demofile = fopen(name, "wb");
-    if (!cls.demofile) {
+    if (!COM_OpenStream(name, cl_democompress.value)) {
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
 
     cls.forcetrack = track;
-    fprintf(cls.demofile, "%i\n", cls.forcetrack);
+    snprintf(trackline, sizeof(trackline), "%i\n", cls.forcetrack);
+    COM_StreamWrite(trackline, strlen(trackline));
 
     cls.demorecording = true;
 }
@@ -273,7 +370,7 @@ void
 CL_PlayDemo_f(void)
 {
     char name[MAX_QPATH], forcetrack[12];
-    int i, c, err;
+    int i, c, err, length;
 
     if (cmd_source != src_command)
 	return;
@@ -298,7 +395,9 @@ CL_PlayDemo_f(void)
     }
 
     Con_Printf("Playing demo from %s.\n", name);
-    COM_FOpenFile(name, &cls.demofile);
+    length = COM_FOpenFile(name, &cls.demofile);
+    if (cls.demofile)
+	cls.demofile = COM_Uncompress(cls.demofile, length);
     if (!cls.demofile) {
 	Con_Printf("ERROR: couldn't open.\n");
 	cls.demonum = -1;	/* stop demo loop */
@@ -336,6 +435,7 @@ CL_PlayDemo_f(void)
     /* Continue with demo playback */
     cls.demoplayback = true;
     cls.state = ca_connected;
+    demo_index.start = ftell(cls.demofile);
     return;
 
  error_out:
@@ -344,6 +444,123 @@ CL_PlayDemo_f(void)
     cls.demonum = -1;
 }
 
+/*
+====================
+CL_BuildDemoIndex
+
+Reads through the messages to note where each second starts
+====================
+*/
+static void
+CL_BuildDemoIndex(void)
+{
+    demomark_t *marks;
+    long pos, offset;
+    int length;
+    byte head[5];
+    float time, next;
+
+    pos = ftell(cls.demofile);
+    fseek(cls.demofile, demo_index.start, SEEK_SET);
+
+    next = -1;
+    demo_index.nummarks = 0;
+    for (;;) {
+	offset = ftell(cls.demofile);
+	if (fread(&length, 4, 1, cls.demofile) != 1)
+	    break;
+	length = LittleLong(length);
+	if (length < 0 || length > MAX_MSGLEN)
+	    break;
+	if (fseek(cls.demofile, 12, SEEK_CUR))
+	    break;
+	if (length < (int)sizeof(head)) {
+	    if (fseek(cls.demofile, length, SEEK_CUR))
+		break;
+	    continue;
+	}
+	if (fread(head, sizeof(head), 1, cls.demofile) != 1)
+	    break;
+	if (fseek(cls.demofile, length - sizeof(head), SEEK_CUR))
+	    break;
+	if (head[0] != svc_time)
+	    continue;
+
+	memcpy(&time, head + 1, sizeof(time));
+	time = LittleFloat(time);
+	if (time < next)
+	    continue;
+	next = time + DEMO_INDEX_STEP;
+
+	if (demo_index.nummarks == demo_index.maxmarks) {
+	    int maxmarks = demo_index.maxmarks ? demo_index.maxmarks * 2 : 256;
+	    marks = realloc(demo_index.marks, maxmarks * sizeof(*marks));
+	    if (!marks)
+		break;
+	    demo_index.marks = marks;
+	    demo_index.maxmarks = maxmarks;
+	}
+	marks = &demo_index.marks[demo_index.nummarks++];
+	marks->time = time;
+	marks->offset = offset;
+    }
+
+    clearerr(cls.demofile);
+    fseek(cls.demofile, pos, SEEK_SET);
+    demo_index.built = true;
+}
+
+/*
+====================
+CL_DemoSeek_f
+
+demo_seek [seconds]
+
+Plays forward through the demo without waiting, starting it again
+first if the time is behind.
+====================
+*/
+void
+CL_DemoSeek_f(void)
+{
+    float start, length, target;
+
+    if (cmd_source != src_command)
+	return;
+
+    if (!cls.demoplayback || cls.timedemo) {
+	Con_Printf("Not playing a demo.\n");
+	return;
+    }
+
+    if (!demo_index.built)
+	CL_BuildDemoIndex();
+    if (!demo_index.nummarks) {
+	Con_Printf("Demo has no timed messages to seek to.\n");
+	return;
+    }
+
+    start = demo_index.marks[0].time;
+    length = demo_index.marks[demo_index.nummarks - 1].time - start;
+    if (Cmd_Argc() != 2) {
+	Con_Printf("demo_seek <seconds> : at %.1f of %.1f seconds\n",
+		   qmax((float)cl.mtime[0] - start, 0.0f), length);
+	return;
+    }
+
+    target = qclamp((float)atof(Cmd_Argv(1)), 0.0f, length);
+    demo_index.target = start + target;
+    demo_index.seeking = true;
+
+    // go back to the start, the messages will set everything up again
+    if (cls.state != ca_active || demo_index.target < cl.mtime[0]) {
+	S_StopAllSounds(true);
+	fseek(cls.demofile, demo_index.start, SEEK_SET);
+	cls.state = ca_connected;
+	cls.signon = 0;
+    }
+}
+
 struct stree_root *
 CL_Demo_Arg_f(const char *arg)
 {
@@ -359,6 +576,67 @@ CL_Demo_Arg_f(const char *arg)
     return root;
 }
 
+static int
+CL_CompareFrameTimes(const void *a, const void *b)
+{
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+====================
+CL_FrameTimePercentile
+
+The frame time (in ms) that a percentage of the timed frames fit within
+====================
+*/
+static float
+CL_FrameTimePercentile(int percent)
+{
+    if (!td_numframetimes)
+	return 0;
+    return 1000 * td_frametimes[(td_numframetimes - 1) * percent / 100];
+}
+
+/*
+====================
+CL_StartTimeDemoPass
+
+Queue the configuration of the next pass of the matrix, then the demo
+====================
+*/
+static void
+CL_StartTimeDemoPass(void)
+{
+    td_matrix.pending = true;
+    Cbuf_AddText("%s\ntimedemo %s\n", td_matrix.passes[td_matrix.pass].config,
+		 td_matrix.demo);
+}
+
+/*
+====================
+CL_FinishTimeDemoMatrix
+
+====================
+*/
+static void
+CL_FinishTimeDemoMatrix(void)
+{
+    const td_pass_t *pass;
+    int i;
+
+    td_matrix.active = false;
+
+    Con_Printf("    fps    p50    p95    p99  configuration\n");
+    for (i = 0; i < td_matrix.numpasses; i++) {
+	pass = &td_matrix.passes[i];
+	Con_Printf("%7.1f %6.2f %6.2f %6.2f  %s\n", pass->frames / pass->time,
+		   pass->p50, pass->p95, pass->p99, pass->config);
+    }
+}
+
 /*
 ====================
 CL_FinishTimeDemo
@@ -370,6 +648,7 @@ CL_FinishTimeDemo(void)
 {
     int frames;
     float time;
+    td_pass_t *pass;
 
     cls.timedemo = false;
 
@@ -380,6 +659,141 @@ CL_FinishTimeDemo(void)
 	time = 1;
     Con_Printf("%i frames %5.1f seconds %5.1f fps\n", frames, time,
 	       frames / time);
+
+    if (!td_matrix.active)
+	return;
+
+    qsort(td_frametimes, td_numframetimes, sizeof(td_frametimes[0]),
+	  CL_CompareFrameTimes);
+    pass = &td_matrix.passes[td_matrix.pass];
+    pass->frames = frames;
+    pass->time = time;
+    pass->p50 = CL_FrameTimePercentile(50);
+    pass->p95 = CL_FrameTimePercentile(95);
+    pass->p99 = CL_FrameTimePercentile(99);
+    Con_Printf("frame times %.2f ms p50, %.2f ms p95, %.2f ms p99\n",
+	       pass->p50, pass->p95, pass->p99);
+
+    if (++td_matrix.pass < td_matrix.numpasses)
+	CL_StartTimeDemoPass();
+    else
+	CL_FinishTimeDemoMatrix();
+}
+
+/*
+====================
+CL_AddTimeDemoConfig
+
+====================
+*/
+static void
+CL_AddTimeDemoConfig(const char *fmt, ...)
+{
+    va_list argptr;
+
+    if (td_matrix.numpasses == TD_MAX_CONFIGS)
+	return;
+
+    va_start(argptr, fmt);
+    vsnprintf(td_matrix.passes[td_matrix.numpasses].config,
+	      sizeof(td_matrix.passes[0].config), fmt, argptr);
+    va_end(argptr);
+    td_matrix.numpasses++;
+}
+
+/*
+====================
+CL_LoadTimeDemoConfigs
+
+One configuration per line of the cfg file, skipping blank and // lines
+====================
+*/
+static void
+CL_LoadTimeDemoConfigs(const char *filename)
+{
+    char *data, *line, *end;
+
+    data = COM_LoadTempFile(filename);
+    if (!data) {
+	Con_Printf("couldn't load %s\n", filename);
+	return;
+    }
+
+    for (line = data; *line; line = end) {
+	end = strchr(line, '\n');
+	if (end)
+	    *end++ = 0;
+	else
+	    end = line + strlen(line);
+	while (*line == ' ' || *line == '\t')
+	    line++;
+	if (*line && *line != '\r' && strncmp(line, "//", 2))
+	    CL_AddTimeDemoConfig("%s", line);
+    }
+}
+
+/*
+====================
+CL_NextListItem
+
+Copy the first item of a comma separated list, and return the rest
+====================
+*/
+static const char *
+CL_NextListItem(const char *list, char *item, int size)
+{
+    int len = strcspn(list, ",");
+
+    snprintf(item, size, "%.*s", len, list);
+    return list[len] ? list + len + 1 : list + len;
+}
+
+/*
+====================
+CL_AddSetting
+
+Append "command value" to a line of commands, unless the value is "-"
+====================
+*/
+static void
+CL_AddSetting(char *config, int size, const char *command, const char *value)
+{
+    int len = strlen(config);
+
+    if (!strcmp(value, "-"))
+	return;
+    snprintf(config + len, size - len, "%s%s %s", len ? "; " : "", command,
+	     value);
+}
+
+/*
+====================
+CL_ListTimeDemoConfigs
+
+Every combination of the comma separated lenses, globes and FOVs
+====================
+*/
+static void
+CL_ListTimeDemoConfigs(const char *lenses, const char *globes,
+		       const char *fovs)
+{
+    char lens[64], globe[64], fov[64], config[256];
+    const char *l, *g, *f;
+
+    for (l = lenses; *l;) {
+	l = CL_NextListItem(l, lens, sizeof(lens));
+	for (g = globes; *g;) {
+	    g = CL_NextListItem(g, globe, sizeof(globe));
+	    for (f = fovs; *f;) {
+		f = CL_NextListItem(f, fov, sizeof(fov));
+		config[0] = 0;
+		CL_AddSetting(config, sizeof(config), "f_lens", lens);
+		CL_AddSetting(config, sizeof(config), "f_globe", globe);
+		CL_AddSetting(config, sizeof(config), "f_fov", fov);
+		CL_AddTimeDemoConfig("%s", config);
+	    }
+	}
+    }
 }
 
 /*
@@ -387,6 +801,8 @@ CL_FinishTimeDemo(void)
 CL_TimeDemo_f
 
 timedemo [demoname]
+timedemo [demoname] [cfgname]
+timedemo [demoname] [lens,..] [globe,..] [fov,..]
 ====================
 */
 void
@@ -395,14 +811,46 @@ CL_TimeDemo_f(void)
     if (cmd_source != src_command)
 	return;
 
-    if (Cmd_Argc() != 2) {
+    if (Cmd_Argc() != 2 && Cmd_Argc() != 3 && Cmd_Argc() != 5) {
 	Con_Printf("timedemo <demoname> : gets demo speeds\n");
+	Con_Printf("timedemo <demoname> <cfgname> : "
+		   "for each line of console commands in the cfg\n");
+	Con_Printf("timedemo <demoname> <lens,..> <globe,..> <fov,..> : "
+		   "for each combination (- = current)\n");
+	return;
+    }
+
+    if (Cmd_Argc() > 2) {
+	td_matrix.numpasses = 0;
+	if (Cmd_Argc() == 3)
+	    CL_LoadTimeDemoConfigs(Cmd_Argv(2));
+	else
+	    CL_ListTimeDemoConfigs(Cmd_Argv(2), Cmd_Argv(3), Cmd_Argv(4));
+	if (!td_matrix.numpasses) {
+	    Con_Printf("no configurations to time\n");
+	    return;
+	}
+	snprintf(td_matrix.demo, sizeof(td_matrix.demo), "%s", Cmd_Argv(1));
+	td_matrix.active = true;
+	td_matrix.pass = 0;
+	CL_StartTimeDemoPass();
 	return;
     }
 
+    // a plain timedemo ends the matrix, unless it is its next pass
+    if (td_matrix.pending)
+	td_matrix.pending = false;
+    else
+	td_matrix.active = false;
+    if (td_matrix.active)
+	Con_Printf("timedemo pass %d/%d: %s\n", td_matrix.pass + 1,
+		   td_matrix.numpasses, td_matrix.passes[td_matrix.pass].config);
+
     CL_PlayDemo_f();
-    if (!cls.demofile)
+    if (!cls.demofile) {
+	td_matrix.active = false;
 	return;
+    }
 
 // cls.td_starttime will be grabbed at the second frame of the demo, so
 // all the loading time doesn't get counted
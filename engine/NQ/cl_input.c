@@ -557,6 +557,12 @@ CL_SendMove(usercmd_t *cmd)
     MSG_WriteByte(&buf, in_impulse);
     in_impulse = 0;
 
+    /* only a server that sent deltas gets acknowledgements */
+    if (cl.deltavalid) {
+	MSG_WriteByte(&buf, clc_deltaack);
+	MSG_WriteByte(&buf, cl.deltasequence);
+    }
+
     if (cls.demoplayback)
 	return;
 
@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.h"
 #include "console.h"
 #include "cvar.h"
+#include "fisheye.h"
 #include "host.h"
 #include "input.h"
 #include "model.h"
@@ -42,7 +43,9 @@ cvar_t cl_name = { "_cl_name", "player", true };
 cvar_t cl_color = { "_cl_color", "0", true };
 
 cvar_t cl_shownet = { "cl_shownet", "0" };	// can be 0, 1, or 2
+cvar_t cl_democompress = { "cl_democompress", "0", true };
 cvar_t cl_nolerp = { "cl_nolerp", "0" };
+cvar_t cl_deltas = { "cl_deltas", "1", true };	// ask for svc_deltapacket
 
 cvar_t lookspring = { "lookspring", "0", true };
 cvar_t lookstrafe = { "lookstrafe", "0", true };
@@ -230,6 +233,11 @@ CL_SignonReply(void)
 
     switch (cls.signon) {
     case 1:
+	/* servers that don't know the command ignore it */
+	if (cl_deltas.value) {
+	    MSG_WriteByte(&cls.message, clc_stringcmd);
+	    MSG_WriteStringf(&cls.message, "deltas %d", DELTA_VERSION);
+	}
 	MSG_WriteByte(&cls.message, clc_stringcmd);
 	MSG_WriteString(&cls.message, "prespawn");
 	break;
@@ -504,7 +512,9 @@ CL_LerpPoint(void)
 
     f = cl.mtime[0] - cl.mtime[1];
 
-    if (!f || cl_nolerp.value || cls.timedemo || sv.active) {
+    /* a local server in fixed tics is drawn between them like a remote one */
+    if (!f || cl_nolerp.value || cls.timedemo
+	|| (sv.active && !host_fixedtic.value)) {
 	cl.time = cl.mtime[0];
 	return 1;
     }
@@ -778,6 +788,8 @@ CL_SendCmd(void)
 
 	// allow mice or other external controllers to add to the move
 	IN_Move(&cmd);
+	if (fisheye_enabled)
+	    F_AddLateMove(&cmd);	// (mouse moves read while drawing)
 
 	// send the unreliable message
 	CL_SendMove(&cmd);
@@ -830,7 +842,9 @@ CL_Init(void)
     Cvar_RegisterVariable(&cl_anglespeedkey);
     Cvar_RegisterVariable(&cl_run);
     Cvar_RegisterVariable(&cl_shownet);
+    Cvar_RegisterVariable(&cl_democompress);
     Cvar_RegisterVariable(&cl_nolerp);
+    Cvar_RegisterVariable(&cl_deltas);
     Cvar_RegisterVariable(&lookspring);
     Cvar_RegisterVariable(&lookstrafe);
     Cvar_RegisterVariable(&sensitivity);
@@ -850,6 +864,7 @@ CL_Init(void)
     Cmd_SetCompletion("playdemo", CL_Demo_Arg_f);
     Cmd_AddCommand("timedemo", CL_TimeDemo_f);
     Cmd_SetCompletion("timedemo", CL_Demo_Arg_f);
+    Cmd_AddCommand("demo_seek", CL_DemoSeek_f);
     Cmd_AddCommand("mcache", Mod_Print);
 
     Cmd_AddCommand("name", CL_Name_f);
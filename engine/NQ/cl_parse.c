@@ -96,6 +96,7 @@ static const char *svc_strings[] = {
     "",				// 47
     "",				// 48
     "",				// 49
+    "svc_deltapacket",
 };
 
 //=============================================================================
@@ -158,7 +159,6 @@ CL_ParseStartSoundPacket(void)
     int volume;
     int field_mask;
     float attenuation;
-    int i;
 
     field_mask = MSG_ReadByte();
 
@@ -185,8 +185,7 @@ CL_ParseStartSoundPacket(void)
     if (ent > MAX_EDICTS)
 	Host_Error("CL_ParseStartSoundPacket: ent = %i", ent);
 
-    for (i = 0; i < 3; i++)
-	pos[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(pos);
 
     S_StartSound(ent, channel, cl.sound_precache[sound_num], pos,
 		 volume / 255.0, attenuation);
@@ -348,6 +347,15 @@ CL_ParseServerInfo(void)
     mapname = COM_SkipPath(model_precache[1]);
     COM_StripExtension(mapname, cl.mapname, sizeof(cl.mapname));
 
+//
+// read the brush models ahead while the rest load (they're never cached,
+// and a local server has just loaded them anyway)
+//
+    if (!sv.active)
+	for (i = 1; i < nummodels; i++)
+	    if (COM_CheckExtension(model_precache[i], ".bsp"))
+		COM_PreloadFile(model_precache[i]);
+
 //
 // now we try to load everything else until a cache allocation fails
 //
@@ -422,51 +430,103 @@ CL_ReadModelFrame(unsigned int bits)
 
 /*
 ==================
-CL_ParseUpdate
+CL_ReadEntityState
 
-Parse an entity update message from the server
-If an entities model or origin changes from frame to frame, it must be
-relinked.  Other attributes can change without relinking.
+Read the fields of an entity update that bits says are there, over the state
+they default to: the baseline, or for a delta packet, what the client had.
 ==================
 */
-
-void
-CL_ParseUpdate(unsigned int bits)
+static void
+CL_ReadEntityState(unsigned int bits, const entity_state_t *from,
+		   entity_state_t *to)
 {
-    int i;
-    model_t *model;
-    int modnum;
-    qboolean forcelink;
-    entity_t *ent;
-    int num;
+    *to = *from;
 
-    // FIXME - do this cleanly...
-#ifdef GLQUAKE
-    int skin;
-#endif
+    if (bits & U_MODEL)
+	to->modelindex = CL_ReadModelIndex(0);
+    if (bits & U_FRAME)
+	to->frame = MSG_ReadByte();
+    if (bits & U_COLORMAP)
+	to->colormap = MSG_ReadByte();
+    if (bits & U_SKIN)
+	to->skinnum = MSG_ReadByte();
+    if (bits & U_EFFECTS)
+	to->effects = MSG_ReadByte();
 
-    if (cls.state == ca_firstupdate) {
-	// first update is the final signon stage
-	cls.signon = SIGNONS;
-	CL_SignonReply();
-    }
+    if (bits & U_ORIGIN1)
+	to->origin[0] = MSG_ReadCoord();
+    if (bits & U_ANGLE1)
+	to->angles[0] = MSG_ReadAngle();
+    if (bits & U_ORIGIN2)
+	to->origin[1] = MSG_ReadCoord();
+    if (bits & U_ANGLE2)
+	to->angles[1] = MSG_ReadAngle();
+    if (bits & U_ORIGIN3)
+	to->origin[2] = MSG_ReadCoord();
+    if (bits & U_ANGLE3)
+	to->angles[2] = MSG_ReadAngle();
 
-    if (bits & U_MOREBITS) {
-	i = MSG_ReadByte();
-	bits |= (i << 8);
+    if (cl.protocol == PROTOCOL_VERSION_FITZ) {
+	if (bits & U_NOLERP) {
+	    // FIXME - TODO (called U_STEP in FQ)
+	}
+	if (bits & U_FITZ_ALPHA) {
+	    MSG_ReadByte(); // FIXME - TODO
+	}
+	if (bits & U_FITZ_FRAME2)
+	    to->frame = (to->frame & 0xFF) | (MSG_ReadByte() << 8);
+	if (bits & U_FITZ_MODEL2)
+	    to->modelindex = (to->modelindex & 0xFF) | (MSG_ReadByte() << 8);
+	if (bits & U_FITZ_LERPFINISH) {
+	    MSG_ReadByte(); // FIXME - TODO
+	}
     }
 
+    if (to->modelindex >= max_models(cl.protocol))
+	Host_Error("CL_ParseModel: bad modnum");
+}
+
+/*
+==================
+CL_ReadUpdateHeader
+
+Read the update bits and entity number that start an entity update, the
+first byte of which has been read already
+==================
+*/
+static int
+CL_ReadUpdateHeader(unsigned int *bits)
+{
+    if (*bits & U_MOREBITS)
+	*bits |= MSG_ReadByte() << 8;
+
     if (cl.protocol == PROTOCOL_VERSION_FITZ) {
-	if (bits & U_FITZ_EXTEND1)
-	    bits |= MSG_ReadByte() << 16;
-	if (bits & U_FITZ_EXTEND2)
-	    bits |= MSG_ReadByte() << 24;
+	if (*bits & U_FITZ_EXTEND1)
+	    *bits |= MSG_ReadByte() << 16;
+	if (*bits & U_FITZ_EXTEND2)
+	    *bits |= MSG_ReadByte() << 24;
     }
 
-    if (bits & U_LONGENTITY)
-	num = MSG_ReadShort();
-    else
-	num = MSG_ReadByte();
+    if (*bits & U_LONGENTITY)
+	return MSG_ReadShort();
+    return MSG_ReadByte();
+}
+
+/*
+==================
+CL_SetEntityState
+
+Put an entity in the state the server sent for it this message.
+If an entities model or origin changes from frame to frame, it must be
+relinked.  Other attributes can change without relinking.
+==================
+*/
+static void
+CL_SetEntityState(int num, const entity_state_t *state, qboolean nolerp)
+{
+    model_t *model;
+    qboolean forcelink;
+    entity_t *ent;
 
     ent = CL_EntityNum(num);
 
@@ -477,17 +537,7 @@ CL_ParseUpdate(unsigned int bits)
 
     ent->msgtime = cl.mtime[0];
 
-    if (bits & U_MODEL) {
-	modnum = CL_ReadModelIndex(0);
-	if (modnum >= max_models(cl.protocol))
-	    Host_Error("CL_ParseModel: bad modnum");
-    } else
-	modnum = ent->baseline.modelindex;
-
-    if (bits & U_FRAME)
-	ent->frame = MSG_ReadByte();
-    else
-	ent->frame = ent->baseline.frame;
+    ent->frame = state->frame;
 
     /* ANIMATION LERPING INFO */
     if (ent->currentframe != ent->frame) {
@@ -499,89 +549,33 @@ CL_ParseUpdate(unsigned int bits)
 	ent->currentframetime = cl.time;
     }
 
-    if (bits & U_COLORMAP)
-	i = MSG_ReadByte();
-    else
-	i = ent->baseline.colormap;
-    if (!i)
+    if (!state->colormap)
 	ent->colormap = vid.colormap;
     else {
-	if (i > cl.maxclients)
+	if (state->colormap > cl.maxclients)
 	    Sys_Error("i >= cl.maxclients");
-	ent->colormap = cl.players[i - 1].translations;
+	ent->colormap = cl.players[state->colormap - 1].translations;
     }
 
 #ifdef GLQUAKE
-    if (bits & U_SKIN)
-	skin = MSG_ReadByte();
-    else
-	skin = ent->baseline.skinnum;
-    if (skin != ent->skinnum) {
-	ent->skinnum = skin;
+    if (state->skinnum != ent->skinnum) {
+	ent->skinnum = state->skinnum;
 	if (num > 0 && num <= cl.maxclients)
 	    R_TranslatePlayerSkin(num - 1);
     }
 #else
-
-    if (bits & U_SKIN)
-	ent->skinnum = MSG_ReadByte();
-    else
-	ent->skinnum = ent->baseline.skinnum;
+    ent->skinnum = state->skinnum;
 #endif
 
-    if (bits & U_EFFECTS)
-	ent->effects = MSG_ReadByte();
-    else
-	ent->effects = ent->baseline.effects;
+    ent->effects = state->effects;
 
 // shift the known values for interpolation
     VectorCopy(ent->msg_origins[0], ent->msg_origins[1]);
     VectorCopy(ent->msg_angles[0], ent->msg_angles[1]);
+    VectorCopy(state->origin, ent->msg_origins[0]);
+    VectorCopy(state->angles, ent->msg_angles[0]);
 
-    if (bits & U_ORIGIN1)
-	ent->msg_origins[0][0] = MSG_ReadCoord();
-    else
-	ent->msg_origins[0][0] = ent->baseline.origin[0];
-    if (bits & U_ANGLE1)
-	ent->msg_angles[0][0] = MSG_ReadAngle();
-    else
-	ent->msg_angles[0][0] = ent->baseline.angles[0];
-
-    if (bits & U_ORIGIN2)
-	ent->msg_origins[0][1] = MSG_ReadCoord();
-    else
-	ent->msg_origins[0][1] = ent->baseline.origin[1];
-    if (bits & U_ANGLE2)
-	ent->msg_angles[0][1] = MSG_ReadAngle();
-    else
-	ent->msg_angles[0][1] = ent->baseline.angles[1];
-
-    if (bits & U_ORIGIN3)
-	ent->msg_origins[0][2] = MSG_ReadCoord();
-    else
-	ent->msg_origins[0][2] = ent->baseline.origin[2];
-    if (bits & U_ANGLE3)
-	ent->msg_angles[0][2] = MSG_ReadAngle();
-    else
-	ent->msg_angles[0][2] = ent->baseline.angles[2];
-
-    if (cl.protocol == PROTOCOL_VERSION_FITZ) {
-	if (bits & U_NOLERP) {
-	    // FIXME - TODO (called U_STEP in FQ)
-	}
-	if (bits & U_FITZ_ALPHA) {
-	    MSG_ReadByte(); // FIXME - TODO
-	}
-	if (bits & U_FITZ_FRAME2)
-	    ent->frame = (ent->frame & 0xFF) | (MSG_ReadByte() << 8);
-	if (bits & U_FITZ_MODEL2)
-	    modnum = (modnum & 0xFF)| (MSG_ReadByte() << 8);
-	if (bits & U_FITZ_LERPFINISH) {
-	    MSG_ReadByte(); // FIXME - TODO
-	}
-    }
-
-    model = cl.model_precache[modnum];
+    model = cl.model_precache[state->modelindex];
     if (model != ent->model) {
 	ent->model = model;
 	// automatic animation (torches, etc) can be either all together
@@ -624,7 +618,7 @@ CL_ParseUpdate(unsigned int bits)
 	ent->currentanglestime = cl.mtime[0];
     }
 
-    if (bits & U_NOLERP)
+    if (nolerp)
 	ent->forcelink = true;
 
     if (forcelink) {		// didn't have an update last message
@@ -636,6 +630,154 @@ CL_ParseUpdate(unsigned int bits)
     }
 }
 
+/*
+==================
+CL_ParseUpdate
+
+Parse an entity update message from the server
+==================
+*/
+void
+CL_ParseUpdate(unsigned int bits)
+{
+    entity_state_t state;
+    int num;
+
+    if (cls.state == ca_firstupdate) {
+	// first update is the final signon stage
+	cls.signon = SIGNONS;
+	CL_SignonReply();
+    }
+
+    num = CL_ReadUpdateHeader(&bits);
+    CL_ReadEntityState(bits, &CL_EntityNum(num)->baseline, &state);
+    CL_SetEntityState(num, &state, bits & U_NOLERP);
+}
+
+/*
+==================
+CL_ReadDeltaHeader
+
+Returns the entity number of the next update in a delta packet, or 0 at the
+end of them
+==================
+*/
+static int
+CL_ReadDeltaHeader(unsigned int *bits)
+{
+    int first, num;
+
+    first = MSG_ReadByte();
+    if (first <= 0)
+	return 0;
+
+    *bits = first;
+    num = CL_ReadUpdateHeader(bits);
+    if (num < 1)
+	Host_Error("%s: bad entity number %d", __func__, num);
+
+    return num;
+}
+
+/*
+==================
+CL_ParseDeltaPacket
+
+The entities as they've changed since an earlier frame, see svc_deltapacket.
+A frame deltaed from one the client doesn't have any more is read past and
+dropped, and isn't acknowledged, so the server keeps deltaing from the last
+one that was until a frame gets through.
+==================
+*/
+static void
+CL_ParseDeltaPacket(void)
+{
+    static deltaframe_t dropped;
+    unsigned short removed[DELTA_MAXENTS];
+    const deltaframe_t *from;
+    deltaframe_t *to;
+    unsigned int bits;
+    int sequence, back, num, oldnum, numremoved, i, j;
+    qboolean valid;
+
+    if (cls.state == ca_firstupdate) {
+	// first update is the final signon stage
+	cls.signon = SIGNONS;
+	CL_SignonReply();
+    }
+
+    /* widen the sequence to count on from the last one received */
+    sequence = MSG_ReadByte();
+    back = MSG_ReadByte();
+    if (cl.deltavalid)
+	sequence = cl.deltasequence
+	    + (signed char)((sequence - cl.deltasequence) & 255);
+    else
+	sequence += 256;
+
+    from = NULL;
+    valid = true;
+    if (back) {
+	from = &cl.deltaframes[(sequence - back) & (DELTA_FRAMES - 1)];
+	if (back >= DELTA_FRAMES || !cl.deltavalid
+	    || from->sequence != sequence - back) {
+	    from = NULL;
+	    valid = false;
+	}
+    }
+    to = valid ? &cl.deltaframes[sequence & (DELTA_FRAMES - 1)] : &dropped;
+
+    numremoved = 0;
+    while ((num = MSG_ReadShort()) > 0) {
+	if (numremoved == DELTA_MAXENTS)
+	    Host_Error("%s: too many removals", __func__);
+	removed[numremoved++] = num;
+    }
+
+    /* merge what's left of the old frame with the updates, in order */
+    to->numents = 0;
+    num = CL_ReadDeltaHeader(&bits);
+    i = j = 0;
+    for (;;) {
+	oldnum = 0x10000;
+	if (from && j < from->numents) {
+	    while (i < numremoved && removed[i] < from->nums[j])
+		i++;
+	    if (i < numremoved && removed[i] == from->nums[j]) {
+		j++;
+		continue;
+	    }
+	    oldnum = from->nums[j];
+	}
+	if (!num && oldnum == 0x10000)
+	    break;
+	if (to->numents == DELTA_MAXENTS)
+	    Host_Error("%s: too many entities", __func__);
+
+	if (num && num <= oldnum) {
+	    to->nums[to->numents] = num;
+	    CL_ReadEntityState(bits, num == oldnum ? &from->states[j++]
+			       : &CL_EntityNum(num)->baseline,
+			       &to->states[to->numents]);
+	    if (valid)
+		CL_SetEntityState(num, &to->states[to->numents],
+				  bits & U_NOLERP);
+	    num = CL_ReadDeltaHeader(&bits);
+	} else {
+	    to->nums[to->numents] = oldnum;
+	    to->states[to->numents] = from->states[j++];
+	    CL_SetEntityState(oldnum, &to->states[to->numents], false);
+	}
+	to->numents++;
+    }
+
+    if (valid) {
+	to->sequence = sequence;
+	cl.deltasequence = sequence;
+	cl.deltavalid = true;
+    }
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -904,10 +1046,8 @@ CL_ParseStaticSound(void)
 {
     vec3_t org;
     int sound_num, vol, atten;
-    int i;
 
-    for (i = 0; i < 3; i++)
-	org[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(org);
     sound_num = CL_ReadSoundNum_Static();
     vol = MSG_ReadByte();
     atten = MSG_ReadByte();
@@ -921,10 +1061,8 @@ CL_ParseFitzStaticSound2(void)
 {
     vec3_t org;
     int sound_num, vol, atten;
-    int i;
 
-    for (i = 0; i < 3; i++)
-	org[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(org);
     sound_num = MSG_ReadShort();
     vol = MSG_ReadByte();
     atten = MSG_ReadByte();
@@ -997,6 +1135,10 @@ CL_ParseServerMessage(void)
 	case svc_nop:
 	    break;
 
+	case svc_deltapacket:
+	    CL_ParseDeltaPacket();
+	    break;
+
 	case svc_time:
 	    cl.mtime[1] = cl.mtime[0];
 	    cl.mtime[0] = MSG_ReadFloat();
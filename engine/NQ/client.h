@@ -213,6 +213,11 @@ typedef struct {
 
     int protocol;		/* Active network protocol version */
 
+// entity deltas (see CL_ParseDeltaPacket)
+    deltaframe_t deltaframes[DELTA_FRAMES];
+    qboolean deltavalid;	// deltasequence has been received
+    int deltasequence;		// last frame received, acknowledged with moves
+
 } client_state_t;
 
 
@@ -239,7 +244,9 @@ extern cvar_t cl_run;
 extern cvar_t cl_autofire;
 
 extern cvar_t cl_shownet;
+extern cvar_t cl_democompress;
 extern cvar_t cl_nolerp;
+extern cvar_t cl_deltas;
 
 extern cvar_t cl_pitchdriftspeed;
 extern cvar_t lookspring;
@@ -347,6 +354,7 @@ void CL_Record_f(void);
 
 void CL_TimeDemo_f(void);
 void CL_PlayDemo_f(void);
+void CL_DemoSeek_f(void);
 struct stree_root *CL_Demo_Arg_f(const char *arg);
 
 //
@@ -19,11 +19,18 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // host.c -- coordinates spawning and killing of local servers
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "cdaudio.h"
 #include "cmd.h"
 #include "console.h"
 #include "draw.h"
 #include "fisheye.h"
+#include "imgwrite.h"
 #include "host.h"
 #include "input.h"
 #include "keys.h"
@@ -36,7 +43,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "screen.h"
 #include "server.h"
 #include "sound.h"
+#include "sv_metrics.h"
+#include "sv_profile.h"
 #include "sys.h"
+#include "trace.h"
 #include "view.h"
 #include "wad.h"
 
@@ -103,6 +113,185 @@ cvar_t pausable = { "pausable", "1" };
 
 cvar_t temp1 = { "temp1", "0" };
 
+/* run the local server on its own thread while the client renders */
+cvar_t host_pipeline = { "host_pipeline", "0", true };
+
+/* run the local server in fixed tics of sys_ticrate (see Host_RunServer) */
+cvar_t host_fixedtic = { "host_fixedtic", "0", true };
+
+/*
+==============================================================================
+
+SERVER THREAD
+
+With host_pipeline set, the local server's frame runs on a second thread
+while the main thread draws the client's view and mixes sound.  The two only
+talk through the loopback messages: the client reads what the server sent
+last frame before the server is kicked off again, and the main thread waits
+for the server at the end of the frame.  Console prints from the server are
+held back and printed when it's done, and a Host_Error on the server thread
+is passed back to be raised on the main thread.
+
+==============================================================================
+*/
+
+static struct {
+    qboolean started;
+    qboolean quit;
+    qboolean run;		// a server frame is wanted or running
+    qboolean failed;		// the last frame ended in Host_Error
+    char error[MAX_PRINTMSG];
+    jmp_buf abort;
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} pipeline;
+
+static __thread qboolean on_server_thread;
+
+#ifdef _WIN32
+#define PIPE_Lock()	EnterCriticalSection(&pipeline.lock)
+#define PIPE_Unlock()	LeaveCriticalSection(&pipeline.lock)
+#define PIPE_Wait()	SleepConditionVariableCS(&pipeline.changed, &pipeline.lock, INFINITE)
+#define PIPE_Signal()	WakeAllConditionVariable(&pipeline.changed)
+#else
+#define PIPE_Lock()	pthread_mutex_lock(&pipeline.lock)
+#define PIPE_Unlock()	pthread_mutex_unlock(&pipeline.lock)
+#define PIPE_Wait()	pthread_cond_wait(&pipeline.changed, &pipeline.lock)
+#define PIPE_Signal()	pthread_cond_broadcast(&pipeline.changed)
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI
+Host_ServerThread(LPVOID arg)
+#else
+static void *
+Host_ServerThread(void *arg)
+#endif
+{
+    on_server_thread = true;
+    Con_DeferPrints(true);
+
+    PIPE_Lock();
+    for (;;) {
+	while (!pipeline.run && !pipeline.quit)
+	    PIPE_Wait();
+	if (pipeline.quit)
+	    break;
+	PIPE_Unlock();
+
+	if (!setjmp(pipeline.abort))
+	    Host_ServerFrame();
+
+	PIPE_Lock();
+	pipeline.run = false;
+	PIPE_Signal();
+    }
+    PIPE_Unlock();
+
+    return 0;
+}
+
+static qboolean
+Host_StartPipeline(void)
+{
+    if (pipeline.started)
+	return true;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&pipeline.lock);
+    InitializeConditionVariable(&pipeline.changed);
+    pipeline.thread = CreateThread(NULL, 0, Host_ServerThread, NULL, 0, NULL);
+    if (!pipeline.thread) {
+	DeleteCriticalSection(&pipeline.lock);
+	Con_Printf("%s: couldn't start the server thread\n", __func__);
+	Cvar_SetValue("host_pipeline", 0);
+	return false;
+    }
+#else
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+    if (pthread_create(&pipeline.thread, NULL, Host_ServerThread, NULL)) {
+	pthread_cond_destroy(&pipeline.changed);
+	pthread_mutex_destroy(&pipeline.lock);
+	Con_Printf("%s: couldn't start the server thread\n", __func__);
+	Cvar_SetValue("host_pipeline", 0);
+	return false;
+    }
+#endif
+    pipeline.quit = false;
+    pipeline.started = true;
+
+    return true;
+}
+
+/* Kick off a server frame on the server thread */
+static void
+Host_BeginServerFrame(void)
+{
+    PIPE_Lock();
+    pipeline.failed = false;
+    pipeline.run = true;
+    PIPE_Signal();
+    PIPE_Unlock();
+}
+
+/*
+ * Wait for the server frame, if one is running, and print whatever it said.
+ * Returns false if the frame ended in an error, which is left in
+ * pipeline.error.
+ */
+static qboolean
+Host_FinishServerFrame(void)
+{
+    qboolean failed;
+
+    if (!pipeline.started || on_server_thread)
+	return true;
+
+    PIPE_Lock();
+    while (pipeline.run)
+	PIPE_Wait();
+    failed = pipeline.failed;
+    pipeline.failed = false;
+    PIPE_Unlock();
+
+    Con_FlushDeferred();
+
+    return !failed;
+}
+
+static void
+Host_StopPipeline(void)
+{
+    if (!pipeline.started)
+	return;
+
+    Host_FinishServerFrame();
+
+    PIPE_Lock();
+    pipeline.quit = true;
+    PIPE_Signal();
+    PIPE_Unlock();
+
+#ifdef _WIN32
+    WaitForSingleObject(pipeline.thread, INFINITE);
+    CloseHandle(pipeline.thread);
+    DeleteCriticalSection(&pipeline.lock);
+#else
+    pthread_join(pipeline.thread, NULL);
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.lock);
+#endif
+    pipeline.started = false;
+}
+
 
 /*
 ================
@@ -118,6 +307,14 @@ Host_EndGame(const char *message, ...)
     va_start(argptr, message);
     vsnprintf(string, sizeof(string), message, argptr);
     va_end(argptr);
+
+    if (on_server_thread) {
+	snprintf(pipeline.error, sizeof(pipeline.error), "%s", string);
+	pipeline.failed = true;
+	longjmp(pipeline.abort, 1);
+    }
+    Host_FinishServerFrame();
+
     Con_DPrintf("%s: %s\n", __func__, string);
 
     if (sv.active)
@@ -148,6 +345,15 @@ Host_Error(const char *error, ...)
     char string[MAX_PRINTMSG];
     static qboolean inerror = false;
 
+    /* let the main thread deal with it once the server frame is done */
+    if (on_server_thread) {
+	va_start(argptr, error);
+	vsnprintf(pipeline.error, sizeof(pipeline.error), error, argptr);
+	va_end(argptr);
+	pipeline.failed = true;
+	longjmp(pipeline.abort, 1);
+    }
+
     if (inerror)
 	Sys_Error("%s: recursively entered", __func__);
     inerror = true;
@@ -159,6 +365,7 @@ Host_Error(const char *error, ...)
     va_end(argptr);
     Con_Printf("%s: %s\n", __func__, string);
 
+    Host_FinishServerFrame();
     if (sv.active)
 	Host_ShutdownServer(false);
 
@@ -222,6 +429,122 @@ Host_FindMaxClients(void)
 }
 
 
+/*
+==============================================================================
+
+FRAME PACING
+
+Frames are started no more often than host_maxfps a second (or the display
+refresh rate with host_refreshsync).  While waiting, the host sleeps until
+it's within HOST_SPIN_MARGIN of the deadline and lets the main loop spin
+through the rest, so the deadline is met closely without burning a core.
+Every frame's length goes into a histogram for host_framehist.
+
+==============================================================================
+*/
+
+#define HOST_SPIN_MARGIN	0.002	// sleeps can overshoot by this much
+#define FRAMEHIST_BUCKETS	100	// one per millisecond, the last for longer
+
+cvar_t host_maxfps = { "host_maxfps", "72", true };
+cvar_t host_refreshsync = { "host_refreshsync", "0", true };
+cvar_t host_sleep = { "host_sleep", "1", true };
+
+static struct {
+    unsigned counts[FRAMEHIST_BUCKETS];
+    unsigned frames;
+    double total;
+    double longest;
+} framehist;
+
+static double
+Host_FrameInterval(void)
+{
+    float fps;
+
+    fps = host_refreshsync.value ? Cvar_VariableValue("vid_refreshrate") : 0;
+    if (fps <= 0)
+	fps = host_maxfps.value;
+
+    return fps > 0 ? 1.0 / fps : 0;
+}
+
+static void
+Host_RecordFrameTime(double time)
+{
+    int bucket;
+
+    bucket = qmin((int)(time * 1000), FRAMEHIST_BUCKETS - 1);
+    framehist.counts[bucket]++;
+    framehist.frames++;
+    framehist.total += time;
+    if (time > framehist.longest)
+	framehist.longest = time;
+}
+
+/* The frame time, in milliseconds, that the given fraction of frames beat */
+static int
+Host_FramePercentile(float fraction)
+{
+    unsigned count, wanted;
+    int bucket;
+
+    wanted = framehist.frames * fraction;
+    count = 0;
+    for (bucket = 0; bucket < FRAMEHIST_BUCKETS - 1; bucket++) {
+	count += framehist.counts[bucket];
+	if (count > wanted)
+	    break;
+    }
+
+    return bucket + 1;
+}
+
+/*
+ * host_framehist [reset]
+ * Prints a histogram of frame times since the last reset
+ */
+static void
+Host_FrameHist_f(void)
+{
+    unsigned most;
+    int bucket, first, last, width;
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset")) {
+	memset(&framehist, 0, sizeof(framehist));
+	return;
+    }
+    if (!framehist.frames) {
+	Con_Printf("No frames recorded\n");
+	return;
+    }
+
+    most = 0;
+    first = FRAMEHIST_BUCKETS;
+    last = 0;
+    for (bucket = 0; bucket < FRAMEHIST_BUCKETS; bucket++) {
+	if (!framehist.counts[bucket])
+	    continue;
+	most = qmax(most, framehist.counts[bucket]);
+	first = qmin(first, bucket);
+	last = bucket;
+    }
+
+    for (bucket = first; bucket <= last; bucket++) {
+	width = framehist.counts[bucket] * 40 / most;
+	Con_Printf("%s%3d ms %7u %.*s\n",
+		   bucket == FRAMEHIST_BUCKETS - 1 ? ">" : " ", bucket,
+		   framehist.counts[bucket], width,
+		   "========================================");
+    }
+    Con_Printf("%u frames, mean %.2f ms, longest %.2f ms\n", framehist.frames,
+	       framehist.total * 1000 / framehist.frames,
+	       framehist.longest * 1000);
+    Con_Printf("50%% under %d ms, 95%% under %d ms, 99%% under %d ms\n",
+	       Host_FramePercentile(0.5f), Host_FramePercentile(0.95f),
+	       Host_FramePercentile(0.99f));
+}
+
 /*
 =======================
 Host_InitLocal
@@ -250,6 +573,12 @@ Host_InitLocal(void)
     Cvar_RegisterVariable(&pausable);
 
     Cvar_RegisterVariable(&temp1);
+    Cvar_RegisterVariable(&host_pipeline);
+    Cvar_RegisterVariable(&host_fixedtic);
+    Cvar_RegisterVariable(&host_maxfps);
+    Cvar_RegisterVariable(&host_refreshsync);
+    Cvar_RegisterVariable(&host_sleep);
+    Cmd_AddCommand("host_framehist", Host_FrameHist_f);
 
     Cvar_RegisterVariable(&developer);
     if (COM_CheckParm("-developer"))
@@ -389,6 +718,12 @@ SV_DropClient(client_t *client, qboolean crash)
     client->netconnection = NULL;
 
     /* free the client (the body stays around) */
+    free(client->delta_frames);
+    client->delta_frames = NULL;
+    free(client->phs);
+    client->phs = NULL;
+    client->leaf = NULL;
+    client->deltas = false;
     client->active = false;
     client->name[0] = 0;
     client->old_frags = -999999;
@@ -427,6 +762,7 @@ Host_ShutdownServer(qboolean crash)
     byte message[4];
     double start;
 
+    Host_FinishServerFrame();
     if (!sv.active)
 	return;
 
@@ -513,12 +849,24 @@ Returns false if the time is too short to run a frame
 qboolean
 Host_FilterTime(float time)
 {
+    double interval, remaining;
+
     realtime += time;
 
-    if (!cls.timedemo && realtime - oldrealtime < 1.0 / 72.0)
-	return false;		// framerate is too high
+    // (demo captures run every frame, at a fixed host_framerate)
+    if (!cls.timedemo && !fisheye_capturing) {
+	interval = Host_FrameInterval();
+	remaining = oldrealtime + interval - realtime;
+	if (remaining > 0) {
+	    /* framerate is too high; sleep off most of the wait */
+	    if (host_sleep.value && remaining > HOST_SPIN_MARGIN)
+		Sys_Sleep();
+	    return false;
+	}
+    }
 
     host_frametime = realtime - oldrealtime;
+    Host_RecordFrameTime(host_frametime);
     oldrealtime = realtime;
 
     if (host_framerate.value > 0)
@@ -584,6 +932,8 @@ Host_ServerFrame(void)
     float save_host_frametime;
     float temp_host_frametime;
 
+    SV_ProfileStartFrame();
+
 // run the world state
     pr_global_struct->frametime = host_frametime;
 
@@ -605,7 +955,12 @@ Host_ServerFrame(void)
     host_frametime = save_host_frametime;
 
 // send all messages to the clients
+    SV_ProfileBegin(SVP_SEND);
     SV_SendClientMessages();
+    SV_ProfileEnd();
+
+    SV_ProfileEndFrame();
+    SV_MetricsFrame();
 }
 
 #else
@@ -613,6 +968,8 @@ Host_ServerFrame(void)
 void
 Host_ServerFrame(void)
 {
+    SV_ProfileStartFrame();
+
     /* run the world state */
     pr_global_struct->frametime = host_frametime;
 
@@ -623,21 +980,72 @@ Host_ServerFrame(void)
     SV_CheckForNewClients();
 
     /* read client messages */
+    SV_ProfileBegin(SVP_READ);
     SV_RunClients();
+    SV_ProfileEnd();
 
     /*
      * Move things around and think. Always pause in single player if in
      * console or menus
      */
-    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game))
+    if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game)) {
+	SV_ProfileBegin(SVP_MOVE);
 	SV_Physics();
+	SV_ProfileEnd();
+    }
 
     /* send all messages to the clients */
+    SV_ProfileBegin(SVP_SEND);
     SV_SendClientMessages();
+    SV_ProfileEnd();
+
+    SV_ProfileEndFrame();
+    SV_MetricsFrame();
 }
 
 #endif
 
+/*
+==================
+Host_RunServer
+
+With host_fixedtic set, the local server only runs whole tics of
+sys_ticrate, as many as the frame times have added up to, so its cost and
+its physics don't depend on the frame rate.  The client interpolates between
+the states sent at the end of each tic (see CL_LerpPoint).
+==================
+*/
+#define HOST_MAXTICS 4		// per frame; a longer stall isn't caught up
+
+static void
+Host_RunServer(void)
+{
+    static double pending;
+    double frametime, tic;
+    int tics;
+
+    if (!host_fixedtic.value) {
+	pending = 0;
+	Host_ServerFrame();
+	return;
+    }
+
+    tic = qclamp(sys_ticrate.value, 0.001f, 0.1f);
+    pending += host_frametime;
+    tics = pending / tic;
+    if (tics > HOST_MAXTICS) {
+	tics = HOST_MAXTICS;
+	pending = tics * tic;
+    }
+    pending -= tics * tic;
+
+    frametime = host_frametime;
+    host_frametime = tic;
+    while (tics--)
+	Host_ServerFrame();
+    host_frametime = frametime;
+}
+
 
 /*
 ==================
@@ -653,6 +1061,7 @@ _Host_Frame(float time)
     static double time2 = 0;
     static double time3 = 0;
     int pass1, pass2, pass3;
+    qboolean pipelined;
 
     /* something bad happened, or the server disconnected */
     if (setjmp(host_abort))
@@ -674,6 +1083,9 @@ _Host_Frame(float time)
     /* allow mice or other external controllers to add commands */
     IN_Commands();
 
+    /* pick up after background jobs */
+    COM_RunFinishedJobs();
+
     /* process console commands */
     Cbuf_Execute();
 
@@ -692,8 +1104,23 @@ _Host_Frame(float time)
     /* check for commands typed to the host */
     Host_GetConsoleCommands();
 
-    if (sv.active)
-	Host_ServerFrame();
+    /*
+     * With the pipeline, the client takes what the server sent last frame
+     * and the server runs this frame while the view is drawn.  Fixed tics
+     * change host_frametime under the client, so they run here instead.
+     */
+    pipelined = sv.active && host_pipeline.value && !host_fixedtic.value
+	&& cls.state != ca_dedicated && Host_StartPipeline();
+    if (pipelined) {
+	host_time += host_frametime;
+	if (cls.state >= ca_connected) {
+	    TR_Begin("CL_ReadFromServer");
+	    CL_ReadFromServer();
+	    TR_End("CL_ReadFromServer");
+	}
+	Host_BeginServerFrame();
+    } else if (sv.active)
+	Host_RunServer();
 
 //-------------------
 //
@@ -708,31 +1135,43 @@ _Host_Frame(float time)
     if (!sv.active)
 	CL_SendCmd();
 
-    host_time += host_frametime;
+    if (!pipelined) {
+	host_time += host_frametime;
 
-    /* fetch results from server */
-    if (cls.state >= ca_connected)
-	CL_ReadFromServer();
+	/* fetch results from server */
+	if (cls.state >= ca_connected) {
+	    TR_Begin("CL_ReadFromServer");
+	    CL_ReadFromServer();
+	    TR_End("CL_ReadFromServer");
+	}
+    }
 
     /* update video */
     if (host_speeds.value)
 	time1 = Sys_DoubleTime();
 
+    TR_Begin("SCR_UpdateScreen");
     SCR_UpdateScreen();
+    TR_End("SCR_UpdateScreen");
     CL_RunParticles();
 
     if (host_speeds.value)
 	time2 = Sys_DoubleTime();
 
     /* update audio */
+    TR_Begin("S_Update");
     if (cls.state == ca_active) {
 	S_Update(r_origin, vpn, vright, vup);
 	CL_DecayLights();
     } else
 	S_Update(vec3_origin, vec3_origin, vec3_origin, vec3_origin);
+    TR_End("S_Update");
 
     CDAudio_Update();
 
+    if (pipelined && !Host_FinishServerFrame())
+	Host_Error("%s", pipeline.error);
+
     if (host_speeds.value) {
 	pass1 = (time1 - time3) * 1000;
 	time3 = Sys_DoubleTime();
@@ -755,12 +1194,16 @@ Host_Frame(float time)
     int i, c, m;
 
     if (!serverprofile.value) {
+	TR_Begin("Host_Frame");
 	_Host_Frame(time);
+	TR_End("Host_Frame");
 	return;
     }
 
     time1 = Sys_DoubleTime();
+    TR_Begin("Host_Frame");
     _Host_Frame(time);
+    TR_End("Host_Frame");
     time2 = Sys_DoubleTime();
 
     timetotal += time2 - time1;
@@ -806,27 +1249,33 @@ Host_Init(quakeparms_t *parms)
 
     com_argc = parms->argc;
     com_argv = parms->argv;
+    COM_StartTrace("start");
 
     Memory_Init(parms->membase, parms->memsize);
     Cbuf_Init();
     Cmd_Init();
     V_Init();
     Chase_Init();
+    COM_StartTrace("memory, commands");
     COM_Init();
     Host_InitLocal();
+    COM_StartTrace("filesystem");
     W_LoadWadFile(&host_gfx, "gfx.wad");
     Key_Init();
     Con_Init();
     M_Init();
+    COM_StartTrace("wad, console, menu");
     PR_Init();
     Mod_Init(R_ModelLoader());
     NET_Init();
     SV_Init();
+    COM_StartTrace("progs, net, server");
 
     Con_Printf("Exe: " __TIME__ " " __DATE__ "\n");
     Con_Printf("%4.1f megabyte heap\n", parms->memsize / (1024 * 1024.0));
 
     R_InitTextures();		// needed even for dedicated servers
+    COM_StartTrace("textures");
 
     if (cls.state != ca_dedicated) {
 	host_basepal = COM_LoadHunkFile("gfx/palette.lmp");
@@ -837,20 +1286,25 @@ Host_Init(quakeparms_t *parms)
 	    Sys_Error("Couldn't load gfx/colormap.lmp");
 
 	VID_Init(host_basepal);
+	COM_StartTrace("video");
 
 	Draw_Init();
 	SCR_Init();
 	R_Init();
+	COM_StartTrace("draw, screen, render");
 
 	S_Init();
 	CDAudio_Init();
+	COM_StartTrace("sound, cd");
 
 	Sbar_Init();
 	CL_Init();
 
 	IN_Init();
+	COM_StartTrace("client, input");
 
 	F_Init();
+	COM_StartTrace("fisheye");
     }
     Mod_InitAliasCache();
 
@@ -865,6 +1319,7 @@ Host_Init(quakeparms_t *parms)
 	Cbuf_InsertText("exec quake.rc\n");
 	Cbuf_Execute();
     }
+    COM_StartTrace("quake.rc");
 }
 
 
@@ -892,13 +1347,18 @@ Host_Shutdown(void)
 
     Host_WriteConfiguration();
 
+    Host_StopPipeline();
     CDAudio_Shutdown();
     NET_Shutdown();
     S_Shutdown();
     F_Shutdown();
+    IMG_Shutdown();
+    COM_PreloadShutdown();
+    COM_ParallelShutdown();
     IN_Shutdown();
 
     if (cls.state != ca_dedicated) {
 	VID_Shutdown();
     }
+    Con_Shutdown();
 }
@@ -32,6 +32,7 @@ extern wad_t host_gfx; /* "gfx.wad" */
 extern quakeparms_t host_parms;
 
 extern cvar_t sys_ticrate;
+extern cvar_t host_fixedtic;
 extern cvar_t sys_nostdout;
 extern cvar_t developer;
 
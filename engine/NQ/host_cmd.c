@@ -240,6 +240,9 @@ LOAD / SAVE GAME
 */
 
 #define	SAVEGAME_VERSION	5
+#define	SAVEGAME_VERSION_BINARY	6	// same header, then ED_SaveBinary
+
+static cvar_t sv_savebinary = { "sv_savebinary", "0", true };
 
 /*
 ===============
@@ -268,6 +271,41 @@ Host_SavegameComment(char *text)
 }
 
 
+/*
+===============
+Host_SavegameBinary
+
+Takes a copy of the game to write out in the background
+===============
+*/
+static void
+Host_SavegameBinary(const char *name)
+{
+    char header[SAVEGAME_COMMENT_LENGTH + MAX_LIGHTSTYLES * (MAX_STYLESTRING + 1)
+		+ NUM_SPAWN_PARMS * 64 + 1024];
+    char comment[SAVEGAME_COMMENT_LENGTH + 1];
+    const char *style;
+    int i, length;
+    void *data;
+
+    Host_SavegameComment(comment);
+    length = snprintf(header, sizeof(header), "%i\n%s\n",
+		      SAVEGAME_VERSION_BINARY, comment);
+    for (i = 0; i < NUM_SPAWN_PARMS; i++)
+	length += snprintf(header + length, sizeof(header) - length, "%f\n",
+			   svs.clients->spawn_parms[i]);
+    length += snprintf(header + length, sizeof(header) - length,
+		       "%d\n%s\n%f\n", current_skill, sv.name, sv.time);
+    for (i = 0; i < MAX_LIGHTSTYLES; i++) {
+	style = sv.lightstyles[i] ? sv.lightstyles[i] : "m";
+	length += snprintf(header + length, sizeof(header) - length, "%s\n",
+			   style);
+    }
+
+    data = ED_SaveBinary(header, &length);
+    COM_WriteFileInBackground(name, data, length);
+}
+
 /*
 ===============
 Host_Savegame_f
@@ -324,6 +362,13 @@ Host_Savegame_f(void)
     }
 
     Con_Printf("Saving game to %s...\n", name);
+    if (sv_savebinary.value) {
+	Host_SavegameBinary(name);
+	Con_Printf("done.\n");
+	return;
+    }
+
+    COM_FinishWrites();
     f = fopen(name, "w");
     if (!f) {
 	Con_Printf("ERROR: couldn't open.\n");
@@ -359,6 +404,99 @@ Host_Savegame_f(void)
 }
 
 
+/*
+===============
+Host_LoadgameText
+
+Reads the globals and edicts that follow the header of a text savegame
+===============
+*/
+static void
+Host_LoadgameText(FILE *f)
+{
+    char str[32768];
+    const char *start;
+    int i, r;
+    edict_t *ent;
+    int entnum;
+
+// load the edicts out of the savegame file
+    entnum = -1;		// -1 is the globals
+    while (!feof(f)) {
+	for (i = 0; i < sizeof(str) - 1; i++) {
+	    r = fgetc(f);
+	    if (r == EOF || !r)
+		break;
+	    str[i] = r;
+	    if (r == '}') {
+		i++;
+		break;
+	    }
+	}
+	if (i == sizeof(str) - 1)
+	    Sys_Error("Loadgame buffer overflow");
+	str[i] = 0;
+	start = COM_Parse(str);
+	if (!com_token[0])
+	    break;		// end of file
+	if (strcmp(com_token, "{"))
+	    Sys_Error("First token isn't a brace");
+
+	if (entnum == -1) {	// parse the global vars
+	    ED_ParseGlobals(start);
+	} else {		// parse an edict
+
+	    ent = EDICT_NUM(entnum);
+	    memset(&ent->v, 0, progs->entityfields * 4);
+	    ent->free = false;
+	    ED_ParseEdict(start, ent);
+
+	    // link it into the bsp tree
+	    if (!ent->free)
+		SV_LinkEdict(ent, false);
+	}
+
+	entnum++;
+    }
+
+    sv.num_edicts = entnum;
+}
+
+/*
+===============
+Host_LoadgameBinary
+
+Reads the edicts and globals that follow the header of a binary savegame
+===============
+*/
+static void
+Host_LoadgameBinary(FILE *f)
+{
+    long start, end;
+    void *data;
+    qboolean ok;
+
+    start = ftell(f);
+    fseek(f, 0, SEEK_END);
+    end = ftell(f);
+    fseek(f, start, SEEK_SET);
+    if (start < 0 || end < start) {
+	fclose(f);
+	Host_Error("%s: couldn't read savegame", __func__);
+    }
+
+    data = malloc(end - start + 1);
+    if (!data)
+	Sys_Error("%s: out of memory", __func__);
+    ok = fread(data, 1, end - start, f) == end - start
+	&& ED_LoadBinary(data, end - start);
+    free(data);
+    if (!ok) {
+	fclose(f);
+	Host_Error("%s: bad savegame", __func__);
+    }
+}
+
 /*
 ===============
 Host_Loadgame_f
@@ -373,10 +511,7 @@ Host_Loadgame_f(void)
     float time, tfloat;
     char str[32768];
     char *lightstyle;
-    const char *start;
-    int i, r, length, err;
-    edict_t *ent;
-    int entnum;
+    int i, length, err;
     int version;
     float spawn_parms[NUM_SPAWN_PARMS];
 
@@ -402,14 +537,15 @@ Host_Loadgame_f(void)
 //      SCR_BeginLoadingPlaque();
 
     Con_Printf("Loading game from %s...\n", name);
-    f = fopen(name, "r");
+    COM_FinishWrites();
+    f = fopen(name, "rb");
     if (!f) {
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
 
     fscanf(f, "%i\n", &version);
-    if (version != SAVEGAME_VERSION) {
+    if (version != SAVEGAME_VERSION && version != SAVEGAME_VERSION_BINARY) {
 	fclose(f);
 	Con_Printf("Savegame is version %i, not %i\n", version,
 		   SAVEGAME_VERSION);
@@ -450,47 +586,12 @@ Host_Loadgame_f(void)
 	sv.lightstyles[i] = lightstyle;
     }
 
-// load the edicts out of the savegame file
-    entnum = -1;		// -1 is the globals
-    while (!feof(f)) {
-	for (i = 0; i < sizeof(str) - 1; i++) {
-	    r = fgetc(f);
-	    if (r == EOF || !r)
-		break;
-	    str[i] = r;
-	    if (r == '}') {
-		i++;
-		break;
-	    }
-	}
-	if (i == sizeof(str) - 1)
-	    Sys_Error("Loadgame buffer overflow");
-	str[i] = 0;
-	start = COM_Parse(str);
-	if (!com_token[0])
-	    break;		// end of file
-	if (strcmp(com_token, "{"))
-	    Sys_Error("First token isn't a brace");
-
-	if (entnum == -1) {	// parse the global vars
-	    ED_ParseGlobals(start);
-	} else {		// parse an edict
-
-	    ent = EDICT_NUM(entnum);
-	    memset(&ent->v, 0, progs->entityfields * 4);
-	    ent->free = false;
-	    ED_ParseEdict(start, ent);
-
-	    // link it into the bsp tree
-	    if (!ent->free)
-		SV_LinkEdict(ent, false);
-	}
-
-	entnum++;
-    }
-
-    sv.num_edicts = entnum;
+    if (version == SAVEGAME_VERSION_BINARY)
+	Host_LoadgameBinary(f);
+    else
+	Host_LoadgameText(f);
     sv.time = time;
+    ED_ResetFreeList();
 
     fclose(f);
 
@@ -748,6 +849,7 @@ Host_InitCommands(void)
 
     Cmd_AddCommand("load", Host_Loadgame_f);
     Cmd_AddCommand("save", Host_Savegame_f);
+    Cvar_RegisterVariable(&sv_savebinary);
 
     Cmd_AddCommand("startdemos", Host_Startdemos_f);
     Cmd_AddCommand("demos", Host_Demos_f);
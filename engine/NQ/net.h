@@ -175,6 +175,8 @@ typedef struct net_landriver_s {
     int (*CloseSocket)(int socket);
     int (*CheckNewConnections)(void);
     int (*Read)(int socket, void *buf, int len, netadr_t *addr);
+    /* optional: points buf at the packet instead of copying it out */
+    int (*ReadDirect)(int socket, const void **buf, netadr_t *addr);
     int (*Write)(int socket, const void *buf, int len, const netadr_t *addr);
     int (*Broadcast)(int socket, const void *buf, int len);
     int (*GetSocketAddr)(int socket, netadr_t *addr);
@@ -218,6 +220,14 @@ extern int messagesReceived;
 extern int unreliableMessagesSent;
 extern int unreliableMessagesReceived;
 
+/* everything read from and handed to the socket, for sv_metrics */
+typedef struct {
+    unsigned long long packets_in, bytes_in;
+    unsigned long long packets_out, bytes_out;
+} netstats_t;
+
+extern netstats_t net_stats;
+
 qsocket_t *NET_NewQSocket(void);
 void NET_FreeQSocket(qsocket_t *);
 double SetNetTime(void);
@@ -71,6 +71,7 @@ net_landriver_t net_landrivers[] = {
 	.CloseSocket		= UDP_CloseSocket,
 	.CheckNewConnections	= UDP_CheckNewConnections,
 	.Read			= UDP_Read,
+	.ReadDirect		= UDP_ReadDirect,
 	.Write			= UDP_Write,
 	.Broadcast		= UDP_Broadcast,
 	.GetSocketAddr		= UDP_GetSocketAddr,
@@ -136,6 +136,8 @@ SendPacket(qsocket_t *sock)
 
     sock->lastSendTime = net_time;
     packetsSent++;
+    net_stats.packets_out++;
+    net_stats.bytes_out += packetLen;
 
     return 1;
 }
@@ -219,6 +221,8 @@ Datagram_SendUnreliableMessage(qsocket_t *sock, const sizebuf_t *data)
 	return -1;
 
     packetsSent++;
+    net_stats.packets_out++;
+    net_stats.bytes_out += packetLen;
     return 1;
 }
 
@@ -232,23 +236,37 @@ Datagram_GetMessage(qsocket_t *sock)
     netadr_t readaddr;
     unsigned int sequence;
     unsigned int count;
+    unsigned int header[2];
+    const byte *packet, *data;
+    int received;
 
     if (!sock->canSend)
 	if ((net_time - sock->lastSendTime) > 1.0)
 	    ReSendMessage(sock);
 
     while (1) {
-	length = sock->landriver->Read(sock->socket, &packetBuffer,
-				       NET_MESSAGESIZE, &readaddr);
+	/*
+	 * Where the driver can, parse the packet where it was received
+	 * rather than copying it to packetBuffer first.
+	 */
+	if (sock->landriver->ReadDirect) {
+	    received = sock->landriver->ReadDirect(sock->socket,
+						   (const void **)&packet,
+						   &readaddr);
+	} else {
+	    received = sock->landriver->Read(sock->socket, &packetBuffer,
+					     NET_MESSAGESIZE, &readaddr);
+	    packet = (const byte *)&packetBuffer;
+	}
 #if 0
 	/* for testing packet loss effects */
 	if ((rand() & 255) > 220)
 	    continue;
 #endif
-	if (length == 0)
+	if (received == 0)
 	    break;
 
-	if (length == -1) {
+	if (received == -1) {
 	    Con_Printf("Read error\n");
 	    return -1;
 	}
@@ -262,20 +280,31 @@ Datagram_GetMessage(qsocket_t *sock)
 	    continue;
 	}
 
-	if (length < NET_HEADERSIZE) {
+	if (received < NET_HEADERSIZE) {
 	    shortPacketCount++;
 	    continue;
 	}
 
-	length = BigLong(packetBuffer.length);
+	memcpy(header, packet, NET_HEADERSIZE);
+	length = BigLong(header[0]);
 	flags = length & (~NETFLAG_LENGTH_MASK);
 	length &= NETFLAG_LENGTH_MASK;
+	data = packet + NET_HEADERSIZE;
 
 	if (flags & NETFLAG_CTL)
 	    continue;
 
-	sequence = BigLong(packetBuffer.sequence);
+	/* don't trust the header to stay inside the packet */
+	if (length < NET_HEADERSIZE || length > received
+	    || length > NET_MESSAGESIZE) {
+	    shortPacketCount++;
+	    continue;
+	}
+
+	sequence = BigLong(header[1]);
 	packetsReceived++;
+	net_stats.packets_in++;
+	net_stats.bytes_in += received;
 
 	if (flags & NETFLAG_UNRELIABLE) {
 	    if (sequence < sock->unreliableReceiveSequence) {
@@ -293,7 +322,7 @@ Datagram_GetMessage(qsocket_t *sock)
 	    length -= NET_HEADERSIZE;
 
 	    SZ_Clear(&net_message);
-	    SZ_Write(&net_message, packetBuffer.data, length);
+	    SZ_Write(&net_message, data, length);
 
 	    ret = 2;
 	    break;
@@ -325,9 +354,9 @@ Datagram_GetMessage(qsocket_t *sock)
 	}
 
 	if (flags & NETFLAG_DATA) {
-	    packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
-	    packetBuffer.sequence = BigLong(sequence);
-	    sock->landriver->Write(sock->socket, &packetBuffer, NET_HEADERSIZE,
+	    header[0] = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
+	    header[1] = BigLong(sequence);
+	    sock->landriver->Write(sock->socket, header, NET_HEADERSIZE,
 				   &readaddr);
 
 	    if (sequence != sock->receiveSequence) {
@@ -338,11 +367,17 @@ Datagram_GetMessage(qsocket_t *sock)
 
 	    length -= NET_HEADERSIZE;
 
+	    if (sock->receiveMessageLength + length > NET_MAXMESSAGE) {
+		sock->receiveMessageLength = 0;
+		shortPacketCount++;
+		continue;
+	    }
+
 	    if (flags & NETFLAG_EOM) {
 		SZ_Clear(&net_message);
 		SZ_Write(&net_message, sock->receiveMessage,
 			 sock->receiveMessageLength);
-		SZ_Write(&net_message, packetBuffer.data, length);
+		SZ_Write(&net_message, data, length);
 		sock->receiveMessageLength = 0;
 
 		ret = 1;
@@ -350,7 +385,7 @@ Datagram_GetMessage(qsocket_t *sock)
 	    }
 
 	    memcpy(sock->receiveMessage + sock->receiveMessageLength,
-		   packetBuffer.data, length);
+		   data, length);
 	    sock->receiveMessageLength += length;
 	    continue;
 	}
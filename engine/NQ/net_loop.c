@@ -30,6 +30,98 @@ qboolean localconnectpending = false;
 qsocket_t *loop_client = NULL;
 qsocket_t *loop_server = NULL;
 
+/*
+ * Messages on their way through the loop wait in buffers from a small pool,
+ * queued for the receiving socket.  The sender's sizebuf is copied in once,
+ * and the receiver gets the buffer itself as net_message rather than a copy,
+ * giving it back when it asks for the next message.  The client and server
+ * only take turns with the loop, even with the server on its own thread, so
+ * none of this is locked.
+ */
+#define LOOP_MAXBUFFERS 32
+
+typedef struct loopbuf_s {
+    struct loopbuf_s *next;
+    int type;			// 1 reliable, 2 unreliable
+    int length;
+    byte data[NET_MAXMESSAGE];
+} loopbuf_t;
+
+typedef struct {
+    loopbuf_t *head;
+    loopbuf_t **tail;
+} loopqueue_t;
+
+static struct {
+    loopbuf_t *free;
+    int numbuffers;
+    loopbuf_t *lent;		// now the data of net_message
+    byte *netdata;		// net_message's own buffer
+    loopqueue_t queues[2];	// for the client and server sockets
+} loop;
+
+static loopbuf_t *
+Loop_GetBuffer(void)
+{
+    loopbuf_t *buf = loop.free;
+
+    if (buf) {
+	loop.free = buf->next;
+	return buf;
+    }
+    if (loop.numbuffers == LOOP_MAXBUFFERS)
+	return NULL;
+    buf = malloc(sizeof(*buf));
+    if (buf)
+	loop.numbuffers++;
+
+    return buf;
+}
+
+static void
+Loop_FreeBuffer(loopbuf_t *buf)
+{
+    buf->next = loop.free;
+    loop.free = buf;
+}
+
+/* Take back the buffer lent out as net_message, if any */
+static void
+Loop_Reclaim(void)
+{
+    if (!loop.lent)
+	return;
+    if (net_message.data == loop.lent->data)
+	net_message.data = loop.netdata;
+    Loop_FreeBuffer(loop.lent);
+    loop.lent = NULL;
+}
+
+static loopqueue_t *
+Loop_Queue(qsocket_t *sock)
+{
+    loopqueue_t *queue = &loop.queues[sock == loop_server];
+
+    if (!queue->tail)
+	queue->tail = &queue->head;
+
+    return queue;
+}
+
+static void
+Loop_ClearQueue(qsocket_t *sock)
+{
+    loopqueue_t *queue = Loop_Queue(sock);
+    loopbuf_t *buf;
+
+    while ((buf = queue->head)) {
+	queue->head = buf->next;
+	Loop_FreeBuffer(buf);
+    }
+    queue->tail = &queue->head;
+    sock->receiveMessageLength = 0;
+}
+
 int
 Loop_Init(void)
 {
@@ -42,6 +134,14 @@ Loop_Init(void)
 void
 Loop_Shutdown(void)
 {
+    loopbuf_t *buf;
+
+    Loop_Reclaim();
+    while ((buf = loop.free)) {
+	loop.free = buf->next;
+	free(buf);
+	loop.numbuffers--;
+    }
 }
 
 
@@ -85,7 +185,7 @@ Loop_Connect(const char *host)
 	}
 	strcpy(loop_client->address, "localhost");
     }
-    loop_client->receiveMessageLength = 0;
+    Loop_ClearQueue(loop_client);
     loop_client->sendMessageLength = 0;
     loop_client->canSend = true;
     loop_client->mtu = Loop_GetDefaultMTU();
@@ -97,7 +197,7 @@ Loop_Connect(const char *host)
 	}
 	strcpy(loop_server->address, "LOCAL");
     }
-    loop_server->receiveMessageLength = 0;
+    Loop_ClearQueue(loop_server);
     loop_server->sendMessageLength = 0;
     loop_server->canSend = true;
     loop_server->mtu = Loop_GetDefaultMTU();
@@ -117,81 +217,83 @@ Loop_CheckNewConnections(void)
 
     localconnectpending = false;
     loop_server->sendMessageLength = 0;
-    loop_server->receiveMessageLength = 0;
+    Loop_ClearQueue(loop_server);
     loop_server->canSend = true;
     loop_client->sendMessageLength = 0;
-    loop_client->receiveMessageLength = 0;
+    Loop_ClearQueue(loop_client);
     loop_client->canSend = true;
     return loop_server;
 }
 
 
-static int
-IntAlign(int value)
-{
-    return (value + (sizeof(int) - 1)) & (~(sizeof(int) - 1));
-}
-
-
 int
 Loop_GetMessage(qsocket_t *sock)
 {
+    loopqueue_t *queue;
+    loopbuf_t *buf;
     int ret;
-    int length;
-
-    if (sock->receiveMessageLength == 0)
-	return 0;
-
-    ret = sock->receiveMessage[0];
-    length = sock->receiveMessage[1] + (sock->receiveMessage[2] << 8);
-    // alignment byte skipped here
-    SZ_Clear(&net_message);
-    SZ_Write(&net_message, &sock->receiveMessage[4], length);
 
-    length = IntAlign(length + 4);
-    sock->receiveMessageLength -= length;
-
-    if (sock->receiveMessageLength)
-	memmove(sock->receiveMessage, &sock->receiveMessage[length],
-	       sock->receiveMessageLength);
+    Loop_Reclaim();
 
+    queue = Loop_Queue(sock);
+    buf = queue->head;
+    if (!buf)
+	return 0;
+    queue->head = buf->next;
+    if (!queue->head)
+	queue->tail = &queue->head;
+    sock->receiveMessageLength -= buf->length;
+
+    /* lend the buffer out as the message */
+    loop.netdata = net_message.data;
+    net_message.data = buf->data;
+    net_message.cursize = buf->length;
+    net_message.overflowed = false;
+    loop.lent = buf;
+
+    ret = buf->type;
     if (sock->driverdata && ret == 1)
 	((qsocket_t *)sock->driverdata)->canSend = true;
 
     return ret;
 }
 
+static qboolean
+Loop_QueueMessage(qsocket_t *sock, const sizebuf_t *data, int type)
+{
+    qsocket_t *receiver = sock->driverdata;
+    loopqueue_t *queue;
+    loopbuf_t *buf;
+
+    /* as much as the old receive buffer held */
+    if (receiver->receiveMessageLength + data->cursize > NET_MAXMESSAGE)
+	return false;
+    buf = Loop_GetBuffer();
+    if (!buf)
+	return false;
+
+    buf->next = NULL;
+    buf->type = type;
+    buf->length = data->cursize;
+    memcpy(buf->data, data->data, data->cursize);
+
+    queue = Loop_Queue(receiver);
+    *queue->tail = buf;
+    queue->tail = &buf->next;
+    receiver->receiveMessageLength += data->cursize;
+
+    return true;
+}
 
 int
 Loop_SendMessage(qsocket_t *sock, const sizebuf_t *data)
 {
-    byte *buffer;
-    int *bufferLength;
-
     if (!sock->driverdata)
 	return -1;
 
-    bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-    if ((*bufferLength + data->cursize + 4) > NET_MAXMESSAGE)
+    if (!Loop_QueueMessage(sock, data, 1))
 	Sys_Error("%s: overflow", __func__);
 
-    buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-    // message type
-    *buffer++ = 1;
-
-    // length
-    *buffer++ = data->cursize & 0xff;
-    *buffer++ = data->cursize >> 8;
-
-    // align
-    buffer++;
-
-    // message
-    memcpy(buffer, data->data, data->cursize);
-    *bufferLength = IntAlign(*bufferLength + data->cursize + 4);
-
     sock->canSend = false;
     return 1;
 }
@@ -200,34 +302,10 @@ Loop_SendMessage(qsocket_t *sock, const sizebuf_t *data)
 int
 Loop_SendUnreliableMessage(qsocket_t *sock, const sizebuf_t *data)
 {
-    byte *buffer;
-    int *bufferLength;
-
     if (!sock->driverdata)
 	return -1;
 
-    bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
-
-    if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) >
-	NET_MAXMESSAGE)
-	return 0;
-
-    buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
-
-    // message type
-    *buffer++ = 2;
-
-    // length
-    *buffer++ = data->cursize & 0xff;
-    *buffer++ = data->cursize >> 8;
-
-    // align
-    buffer++;
-
-    // message
-    memcpy(buffer, data->data, data->cursize);
-    *bufferLength = IntAlign(*bufferLength + data->cursize + 4);
-    return 1;
+    return Loop_QueueMessage(sock, data, 2) ? 1 : 0;
 }
 
 
@@ -252,7 +330,7 @@ Loop_Close(qsocket_t *sock)
 {
     if (sock->driverdata)
 	((qsocket_t *)sock->driverdata)->driverdata = NULL;
-    sock->receiveMessageLength = 0;
+    Loop_ClearQueue(sock);
     sock->sendMessageLength = 0;
     sock->canSend = true;
     if (sock == loop_client)
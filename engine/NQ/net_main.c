@@ -66,6 +66,7 @@ int messagesSent = 0;
 int messagesReceived = 0;
 int unreliableMessagesSent = 0;
 int unreliableMessagesReceived = 0;
+netstats_t net_stats;
 
 cvar_t net_messagetimeout = { "net_messagetimeout", "300" };
 cvar_t hostname = { "hostname", "UNNAMED" };
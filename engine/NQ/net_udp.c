@@ -18,6 +18,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* for recvmmsg */
+#define NET_BATCHED
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -60,6 +65,56 @@ static netadr_t localAddr;
 static netadr_t bindAddr;
 static char ifname[IFNAMSIZ];
 
+#ifdef NET_BATCHED
+/*
+ * Reads are done in batches with recvmmsg, for one socket at a time.  The
+ * rest of the batch is handed out by the following reads on that socket.
+ * Reads of other sockets go straight to recvfrom until it's used up.
+ */
+#define UDP_BATCH 16
+
+static struct {
+    int socket;			// -1 if not holding any packets
+    int count, next;
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovecs[UDP_BATCH];
+    struct sockaddr_in addrs[UDP_BATCH];
+    byte data[UDP_BATCH][NET_MESSAGESIZE];
+} udp_recv = { .socket = -1 };
+
+static qboolean
+UDP_Holding(int socket)
+{
+    return udp_recv.socket == socket && udp_recv.next < udp_recv.count;
+}
+
+static int
+UDP_ReadBatch(int socket)
+{
+    int i, ret;
+
+    for (i = 0; i < UDP_BATCH; i++) {
+	udp_recv.iovecs[i].iov_base = udp_recv.data[i];
+	udp_recv.iovecs[i].iov_len = sizeof(udp_recv.data[i]);
+	memset(&udp_recv.msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	udp_recv.msgs[i].msg_hdr.msg_name = &udp_recv.addrs[i];
+	udp_recv.msgs[i].msg_hdr.msg_namelen = sizeof(udp_recv.addrs[i]);
+	udp_recv.msgs[i].msg_hdr.msg_iov = &udp_recv.iovecs[i];
+	udp_recv.msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    udp_recv.socket = -1;
+    udp_recv.count = udp_recv.next = 0;
+    ret = recvmmsg(socket, udp_recv.msgs, UDP_BATCH, 0, NULL);
+    if (ret > 0) {
+	udp_recv.socket = socket;
+	udp_recv.count = ret;
+    }
+
+    return ret;
+}
+#endif
+
 
 static void
 NetadrToSockadr(const netadr_t *a, struct sockaddr_in *s)
@@ -233,6 +288,21 @@ UDP_Listen(qboolean state)
     net_acceptsocket = -1;
 }
 
+/*
+ * The socket new connections arrive on, for a dedicated server to sleep on
+ * while nobody is connected (-1 if not listening).  Sets *pending if packets
+ * already read from it are waiting to be handed out, so there is no sleeping.
+ */
+int
+UDP_AcceptSocket(qboolean *pending)
+{
+    *pending = false;
+#ifdef NET_BATCHED
+    *pending = UDP_Holding(net_acceptsocket);
+#endif
+    return net_acceptsocket;
+}
+
 
 int
 UDP_OpenSocket(int port)
@@ -268,6 +338,12 @@ UDP_CloseSocket(int socket)
 {
     if (socket == net_broadcastsocket)
 	net_broadcastsocket = 0;
+#ifdef NET_BATCHED
+    if (socket == udp_recv.socket) {
+	udp_recv.socket = -1;
+	udp_recv.count = udp_recv.next = 0;
+    }
+#endif
     return close(socket);
 }
 
@@ -283,6 +359,10 @@ UDP_CheckNewConnections(void)
     if (net_acceptsocket == -1)
 	return -1;
 
+#ifdef NET_BATCHED
+    if (UDP_Holding(net_acceptsocket))
+	return net_acceptsocket;
+#endif
     if (ioctl(net_acceptsocket, FIONREAD, &available) == -1)
 	Sys_Error("%s: ioctlsocket (FIONREAD) failed", __func__);
     if (available)
@@ -300,6 +380,27 @@ UDP_Read(int socket, void *buf, int len, netadr_t *addr)
     socklen_t addrlen = sizeof(saddr);
     int ret;
 
+#ifdef NET_BATCHED
+    if (UDP_Holding(socket) || udp_recv.next == udp_recv.count) {
+	int i;
+
+	if (!UDP_Holding(socket)) {
+	    ret = UDP_ReadBatch(socket);
+	    if (ret == -1 && (errno == EWOULDBLOCK || errno == ECONNREFUSED))
+		return 0;
+	    if (ret <= 0)
+		return ret;
+	}
+	i = udp_recv.next++;
+	ret = udp_recv.msgs[i].msg_len;
+	if (ret > len)
+	    ret = len;
+	memcpy(buf, udp_recv.data[i], ret);
+	SockadrToNetadr(&udp_recv.addrs[i], addr);
+	return ret;
+    }
+#endif
+
     ret = recvfrom(socket, buf, len, 0, (struct sockaddr *)&saddr, &addrlen);
     SockadrToNetadr(&saddr, addr);
     if (ret == -1 && (errno == EWOULDBLOCK || errno == ECONNREFUSED))
@@ -308,6 +409,41 @@ UDP_Read(int socket, void *buf, int len, netadr_t *addr)
 }
 
 
+/*
+ * Like UDP_Read, but returns a pointer to the packet where it was received,
+ * which stays valid until the next read.
+ */
+int
+UDP_ReadDirect(int socket, const void **buf, netadr_t *addr)
+{
+    int ret;
+#ifdef NET_BATCHED
+    int i;
+
+    if (UDP_Holding(socket) || udp_recv.next == udp_recv.count) {
+	if (!UDP_Holding(socket)) {
+	    ret = UDP_ReadBatch(socket);
+	    if (ret == -1 && (errno == EWOULDBLOCK || errno == ECONNREFUSED))
+		return 0;
+	    if (ret <= 0)
+		return ret;
+	}
+	i = udp_recv.next++;
+	*buf = udp_recv.data[i];
+	SockadrToNetadr(&udp_recv.addrs[i], addr);
+	return udp_recv.msgs[i].msg_len;
+    }
+#endif
+    {
+	static byte packet[NET_MESSAGESIZE];
+
+	ret = UDP_Read(socket, packet, sizeof(packet), addr);
+	*buf = packet;
+	return ret;
+    }
+}
+
+
 static int
 UDP_MakeSocketBroadcastCapable(int socket)
 {
@@ -28,10 +28,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 int UDP_Init(void);
 void UDP_Shutdown(void);
 void UDP_Listen(qboolean state);
+int UDP_AcceptSocket(qboolean *pending);
 int UDP_OpenSocket(int port);
 int UDP_CloseSocket(int socket);
 int UDP_CheckNewConnections(void);
 int UDP_Read(int socket, void *buf, int len, netadr_t *addr);
+int UDP_ReadDirect(int socket, const void **buf, netadr_t *addr);
 int UDP_Write(int socket, const void *buf, int len, const netadr_t *addr);
 int UDP_Broadcast(int socket, const void *buf, int len);
 int UDP_GetSocketAddr(int socket, netadr_t *addr);
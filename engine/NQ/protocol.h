@@ -94,6 +94,26 @@ max_sounds_dynamic(int protocol)
     }
 }
 
+/*
+ * Sounds carry the entity number in 13 bits, other than with the FitzQuake
+ * protocol's large entity flag.  Updates carry it in a short.
+ */
+static inline int
+max_edicts(int protocol)
+{
+    switch (protocol) {
+    case PROTOCOL_VERSION_NQ:
+    case PROTOCOL_VERSION_BJP:
+    case PROTOCOL_VERSION_BJP2:
+    case PROTOCOL_VERSION_BJP3:
+	return 8192;
+    case PROTOCOL_VERSION_FITZ:
+	return 32768;
+    default:
+	return 0;
+    }
+}
+
 static inline int
 max_sounds(int p)
 {
@@ -245,6 +265,22 @@ max_sounds(int p)
 #define svc_fitz_spawnstatic2	43
 #define svc_fitz_spawnstaticsound2 44
 
+/*
+ * Entity deltas, for clients that ask with the "deltas <version>" command
+ * during signon.  Instead of fast updates against the baselines, each
+ * datagram carries one svc_deltapacket against the last frame the client
+ * acknowledged with clc_deltaack:
+ *
+ *   [byte] sequence
+ *   [byte] frames back to delta from (0 = from the baselines)
+ *   [short]... entities left out since then, ending with 0
+ *   <fast update>... entities added or changed since then, ending with 0
+ *
+ * Entities in the old frame that aren't mentioned are unchanged.
+ */
+#define svc_deltapacket		50
+#define DELTA_VERSION		1
+
 //
 // client to server
 //
@@ -253,6 +289,7 @@ max_sounds(int p)
 #define	clc_disconnect	2
 #define	clc_move	3	// [usercmd_t]
 #define	clc_stringcmd	4	// [string] message
+#define	clc_deltaack	5	// [byte] sequence of the last svc_deltapacket
 
 
 //
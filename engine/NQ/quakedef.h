@@ -71,7 +71,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // per-level limits
 //
 //#define       MAX_EDICTS      600     // FIXME: ouch! ouch! ouch!
-#define	MAX_EDICTS	4096	// FIXME: Arbitrary increase, make dynamic?
+#define	MAX_EDICTS	4096	// default, sv_maxedicts can raise it
 #define	MAX_LIGHTSTYLES	64
 /*
  * Model and sound limits depend on the net protocol version being used
@@ -191,6 +191,17 @@ typedef struct {
     int effects;
 } entity_state_t;
 
+/* The entities in one svc_deltapacket, sorted by number */
+#define DELTA_FRAMES	16	// kept by both ends, a power of two
+#define DELTA_MAXENTS	512	// per frame
+
+typedef struct {
+    int sequence;
+    int numents;
+    unsigned short nums[DELTA_MAXENTS];
+    entity_state_t states[DELTA_MAXENTS];
+} deltaframe_t;
+
 
 //=============================================================================
 
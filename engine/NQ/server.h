@@ -42,6 +42,8 @@ typedef struct {
     char name[64];		// map name
 
     char modelname[64];		// maps/<name>.bsp, for model_precache[0]
+    eval_t *nextmap;		// progs global, to read the next map ahead
+    string_t nextmap_read;
     brushmodel_t *worldmodel;
     const char *model_precache[MAX_MODELS];	// NULL terminated
     model_t *models[MAX_MODELS];
@@ -52,6 +54,7 @@ typedef struct {
     edict_t *edicts;		/* can NOT be array indexed, because
 				   edict_t is variable sized, but can
 				   be used to reference the world ent */
+    edhot_t *edhot;		// [max_edicts], see progs.h
     server_state_t state;	// some actions are only valid during load
 
     sizebuf_t datagram;
@@ -64,6 +67,8 @@ typedef struct {
     byte signon_buf[MAX_MSGLEN];
 
     int protocol;		/* Active network protocol version */
+
+    entity_state_t *states;	// [max_edicts], for this frame's deltas
 } server_t;
 
 
@@ -99,6 +104,17 @@ typedef struct client_s {
 
 // client known data for deltas
     int old_frags;
+
+// entity deltas (see SV_WriteDeltaEntities)
+    qboolean deltas;		// asked for svc_deltapacket updates
+    int delta_sequence;		// of the last frame sent
+    int delta_acked;		// last frame the client has, 0 for none
+    deltaframe_t *delta_frames;	// [DELTA_FRAMES], malloc'd
+
+// what the client can hear (see SV_ClientPHS)
+    const mleaf_t *leaf;	// where phs was built for, NULL if not found
+    vec3_t leaforigin;		// edict origin leaf was found for
+    leafbits_t *phs;		// malloc'd
 } client_t;
 
 
@@ -183,6 +199,8 @@ extern cvar_t timelimit;
 extern cvar_t pausable;
 
 extern cvar_t sv_maxvelocity;
+extern cvar_t sv_physthreads;
+extern cvar_t sv_touchstats;
 extern cvar_t sv_gravity;
 extern cvar_t sv_nostep;
 extern cvar_t sv_friction;
@@ -192,6 +210,7 @@ extern cvar_t sv_maxspeed;
 extern cvar_t sv_accelerate;
 extern cvar_t sv_idealpitchscale;
 extern cvar_t sv_aim;
+extern cvar_t sv_deltas;
 
 extern server_static_t svs;	// persistant server info
 extern server_t sv;		// local server
@@ -201,6 +220,7 @@ extern double host_time;
 //===========================================================
 
 void SV_Init(void);
+double SV_IdleTime(void);
 
 void SV_StartParticle(vec3_t org, vec3_t dir, int color, int count);
 void SV_StartSound(edict_t *entity, int channel, const char *sample,
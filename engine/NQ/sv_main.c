@@ -31,12 +31,24 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "screen.h"
 #include "server.h"
 #include "sound.h"
+#include "sv_metrics.h"
+#include "sv_profile.h"
 #include "sys.h"
 #include "world.h"
 
 server_t sv;
 server_static_t svs;
 
+/* send svc_deltapacket updates to clients that ask for them */
+cvar_t sv_deltas = { "sv_deltas", "1" };
+
+/* only send sounds and temp entities to the clients that can hear them */
+cvar_t sv_phs = { "sv_phs", "1" };
+
+/* let a dedicated server sleep while nobody is on it */
+static cvar_t sv_idle = { "sv_idle", "0" };
+#define MAX_IDLE_SECONDS 3600
+
 /* inline model names for precache */
 #define MODSTRLEN (sizeof("*" stringify(MAX_MODELS)) / sizeof(char))
 static char localmodels[MAX_MODELS][MODSTRLEN];
@@ -142,6 +154,8 @@ SV_Init(void)
     int i;
 
     Cvar_RegisterVariable(&sv_maxvelocity);
+    Cvar_RegisterVariable(&sv_physthreads);
+    Cvar_RegisterVariable(&sv_touchstats);
     Cvar_RegisterVariable(&sv_gravity);
     Cvar_RegisterVariable(&sv_friction);
     Cvar_RegisterVariable(&sv_edgefriction);
@@ -151,8 +165,15 @@ SV_Init(void)
     Cvar_RegisterVariable(&sv_idealpitchscale);
     Cvar_RegisterVariable(&sv_aim);
     Cvar_RegisterVariable(&sv_nostep);
+    Cvar_RegisterVariable(&sv_deltas);
+    Cvar_RegisterVariable(&sv_phs);
+    Cvar_RegisterVariable(&sv_idle);
+
+    SV_ProfileInit();
+    SV_MetricsInit();
 
     Cmd_AddCommand("sv_protocol", SV_Protocol_f);
+    Cmd_AddCommand("areastats", SV_AreaStats_f);
     Cmd_SetCompletion("sv_protocol", SV_Protocol_Arg_f);
 
     for (i = 0; i < MAX_MODELS; i++)
@@ -187,9 +208,7 @@ SV_StartParticle(vec3_t org, vec3_t dir, int color, int count)
 	return;
 
     MSG_WriteByte(&sv.datagram, svc_particle);
-    MSG_WriteCoord(&sv.datagram, org[0]);
-    MSG_WriteCoord(&sv.datagram, org[1]);
-    MSG_WriteCoord(&sv.datagram, org[2]);
+    MSG_WriteCoords3(&sv.datagram, org);
     for (i = 0; i < 3; i++) {
 	v = dir[i] * 16;
 	if (v > 127)
@@ -226,6 +245,20 @@ SV_WriteSoundNum(sizebuf_t *sb, int c, unsigned int bits)
     }
 }
 
+static int
+SV_SoundNumSize(unsigned int bits)
+{
+    switch (sv.protocol) {
+    case PROTOCOL_VERSION_BJP2:
+    case PROTOCOL_VERSION_BJP3:
+	return 2;
+    case PROTOCOL_VERSION_FITZ:
+	return (bits & SND_FITZ_LARGESOUND) ? 2 : 1;
+    default:
+	return 1;
+    }
+}
+
 /*
 ==================
 SV_StartSound
@@ -377,6 +410,9 @@ SV_SendServerinfo(client_t *client)
 
     client->sendsignon = true;
     client->spawned = false;	// need prespawn, spawn, etc
+
+    /* the baselines are new, so the client has to ask for deltas again */
+    client->deltas = false;
 }
 
 /*
@@ -410,6 +446,8 @@ SV_ConnectClient(int clientnum)
 
     if (sv.loadgame)
 	memcpy(spawn_parms, client->spawn_parms, sizeof(spawn_parms));
+    free(client->delta_frames);
+    free(client->phs);
     memset(client, 0, sizeof(*client));
     client->netconnection = netconnection;
 
@@ -471,6 +509,31 @@ SV_CheckForNewClients(void)
 }
 
 
+/*
+===================
+SV_IdleTime
+
+With sv_idle set and nobody on the server, how long a dedicated server may
+sleep waiting for a packet or console input.  The world waits while the
+server is empty, and there is no master to send heartbeats to, so nothing
+else is due.  Returns 0 while tics have to keep coming: with clients on the
+server or commands waiting in the buffer.
+===================
+*/
+double
+SV_IdleTime(void)
+{
+    int i;
+
+    if (!sv_idle.value || Cbuf_Pending())
+	return 0;
+    for (i = 0; i < svs.maxclients; i++)
+	if (svs.clients[i].active)
+	    return 0;
+
+    return MAX_IDLE_SECONDS;
+}
+
 
 /*
 ===============================================================================
@@ -494,30 +557,122 @@ SV_ClearDatagram(void)
 
 //=============================================================================
 
-void
-SV_WriteModelIndex(sizebuf_t *sb, int c, unsigned int bits)
+static byte *
+SV_PutModelIndex(byte *p, int c, unsigned int bits)
 {
     switch (sv.protocol) {
     case PROTOCOL_VERSION_NQ:
-	MSG_WriteByte(sb, c);
-	break;
+	return MSG_PutByte(p, c);
     case PROTOCOL_VERSION_BJP:
     case PROTOCOL_VERSION_BJP2:
     case PROTOCOL_VERSION_BJP3:
-	MSG_WriteShort(sb, c);
-	break;
+	return MSG_PutShort(p, c);
     case PROTOCOL_VERSION_FITZ:
 	if (bits & B_FITZ_LARGEMODEL)
-	    MSG_WriteShort(sb, c);
-	else
-	    MSG_WriteByte(sb, c);
-	break;
+	    return MSG_PutShort(p, c);
+	return MSG_PutByte(p, c);
     default:
 	Host_Error("%s: Unknown protocol version (%d)\n", __func__,
 		   sv.protocol);
     }
 }
 
+void
+SV_WriteModelIndex(sizebuf_t *sb, int c, unsigned int bits)
+{
+    byte *start = MSG_BeginGroup(sb, 2);
+
+    MSG_EndGroup(sb, start, SV_PutModelIndex(start, c, bits));
+}
+
+/*
+=============
+SV_WriteEntityUpdate
+
+The fast update of entity num with the fields in bits, all in one go
+=============
+*/
+#define MAX_UPDATE_SIZE 23
+
+static void
+SV_WriteEntityUpdate(sizebuf_t *msg, int num, unsigned int bits,
+		     const entity_state_t *to)
+{
+    byte *start, *p;
+
+    start = p = MSG_BeginGroup(msg, MAX_UPDATE_SIZE);
+    p = MSG_PutByte(p, bits | U_SIGNAL);
+    if (bits & U_MOREBITS)
+	p = MSG_PutByte(p, bits >> 8);
+    if (bits & U_FITZ_EXTEND1)
+	p = MSG_PutByte(p, bits >> 16);
+    if (bits & U_FITZ_EXTEND2)
+	p = MSG_PutByte(p, bits >> 24);
+
+    if (bits & U_LONGENTITY)
+	p = MSG_PutShort(p, num);
+    else
+	p = MSG_PutByte(p, num);
+
+    if (bits & U_MODEL)
+	p = SV_PutModelIndex(p, to->modelindex, 0);
+    if (bits & U_FRAME)
+	p = MSG_PutByte(p, to->frame);
+    if (bits & U_COLORMAP)
+	p = MSG_PutByte(p, to->colormap);
+    if (bits & U_SKIN)
+	p = MSG_PutByte(p, to->skinnum);
+    if (bits & U_EFFECTS)
+	p = MSG_PutByte(p, to->effects);
+    if (bits & U_ORIGIN1)
+	p = MSG_PutCoord(p, to->origin[0]);
+    if (bits & U_ANGLE1)
+	p = MSG_PutAngle(p, to->angles[0]);
+    if (bits & U_ORIGIN2)
+	p = MSG_PutCoord(p, to->origin[1]);
+    if (bits & U_ANGLE2)
+	p = MSG_PutAngle(p, to->angles[1]);
+    if (bits & U_ORIGIN3)
+	p = MSG_PutCoord(p, to->origin[2]);
+    if (bits & U_ANGLE3)
+	p = MSG_PutAngle(p, to->angles[2]);
+#if 0 /* FIXME */
+    if (bits & U_FITZ_ALPHA)
+	p = MSG_PutByte(p, ent->alpha);
+#endif
+    if (bits & U_FITZ_FRAME2)
+	p = MSG_PutByte(p, to->frame >> 8);
+    if (bits & U_FITZ_MODEL2)
+	p = MSG_PutByte(p, to->modelindex >> 8);
+#if 0 /* FIXME */
+    if (bits & U_FITZ_LERPFINISH)
+	p = MSG_PutByte(p, (byte)floorf(((ent->v.nextthink - sv.time) * 255.0f) + 0.5f));
+#endif
+    MSG_EndGroup(msg, start, p);
+}
+
+/*
+=============
+SV_EdictInPVS
+
+The hot copy holds the leaf of an edict in only one, so those are checked
+without reading the edict itself.
+=============
+*/
+static qboolean
+SV_EdictInPVS(const edict_t *ent, const edhot_t *hot, const leafbits_t *pvs)
+{
+    int i;
+
+    if (hot->num_leafs == 1)
+	return Mod_TestLeafBit(pvs, hot->leafnum);
+    for (i = 0; i < hot->num_leafs; i++)
+	if (Mod_TestLeafBit(pvs, ent->leafnums[i]))
+	    return true;
+
+    return false;
+}
+
 /*
 =============
 SV_WriteEntitiesToClient
@@ -533,6 +688,7 @@ SV_WriteEntitiesToClient(edict_t *clent, sizebuf_t *msg)
     vec3_t org;
     float miss;
     edict_t *ent;
+    entity_state_t state;
 
 // find the client's PVS
     VectorAdd(clent->v.origin, clent->v.view_ofs, org);
@@ -544,17 +700,15 @@ SV_WriteEntitiesToClient(edict_t *clent, sizebuf_t *msg)
 
 // clent is ALWAYS sent
 	if (ent != clent) {
+	    if (sv.edhot[e].free || !sv.edhot[e].num_leafs)
+		continue;	// not visible
 
 // ignore ents without visible models
 	    if (!ent->v.modelindex || !*PR_GetString(ent->v.model))
 		continue;
 
 // ignore if not touching a PV leaf
-	    for (i = 0; i < ent->num_leafs; i++)
-		if (Mod_TestLeafBit(pvs, ent->leafnums[i]))
-		    break;
-
-	    if (i == ent->num_leafs)
+	    if (!SV_EdictInPVS(ent, &sv.edhot[e], pvs))
 		continue;	// not visible
 	}
 
@@ -621,55 +775,238 @@ SV_WriteEntitiesToClient(edict_t *clent, sizebuf_t *msg)
 	//
 	// write the message
 	//
-	MSG_WriteByte(msg, bits | U_SIGNAL);
+	VectorCopy(ent->v.origin, state.origin);
+	VectorCopy(ent->v.angles, state.angles);
+	state.modelindex = ent->v.modelindex;
+	state.frame = ent->v.frame;
+	state.colormap = ent->v.colormap;
+	state.skinnum = ent->v.skin;
+	state.effects = ent->v.effects;
+	SV_WriteEntityUpdate(msg, e, bits, &state);
+     }
+}
+
+/*
+=============
+SV_BuildEntityStates
 
-	if (bits & U_MOREBITS)
-	    MSG_WriteByte(msg, bits >> 8);
-	if (bits & U_FITZ_EXTEND1)
-	    MSG_WriteByte(msg, bits >> 16);
-	if (bits & U_FITZ_EXTEND2)
-	    MSG_WriteByte(msg, bits >> 24);
+The state of every entity as the clients taking deltas are sent it, once a
+frame for all of them.  Entities without a model to send have modelindex 0.
+=============
+*/
+static void
+SV_BuildEntityStates(void)
+{
+    entity_state_t *state;
+    edict_t *ent;
+    int e;
 
-	if (bits & U_LONGENTITY)
-	    MSG_WriteShort(msg, e);
+    state = sv.states + 1;
+    ent = NEXT_EDICT(sv.edicts);
+    for (e = 1; e < sv.num_edicts; e++, ent = NEXT_EDICT(ent), state++) {
+	VectorCopy(ent->v.origin, state->origin);
+	VectorCopy(ent->v.angles, state->angles);
+	if (ent->v.modelindex && *PR_GetString(ent->v.model))
+	    state->modelindex = ent->v.modelindex;
 	else
-	    MSG_WriteByte(msg, e);
-
-	if (bits & U_MODEL)
-	    SV_WriteModelIndex(msg, ent->v.modelindex, 0);
-	if (bits & U_FRAME)
-	    MSG_WriteByte(msg, ent->v.frame);
-	if (bits & U_COLORMAP)
-	    MSG_WriteByte(msg, ent->v.colormap);
-	if (bits & U_SKIN)
-	    MSG_WriteByte(msg, ent->v.skin);
-	if (bits & U_EFFECTS)
-	    MSG_WriteByte(msg, ent->v.effects);
-	if (bits & U_ORIGIN1)
-	    MSG_WriteCoord(msg, ent->v.origin[0]);
-	if (bits & U_ANGLE1)
-	    MSG_WriteAngle(msg, ent->v.angles[0]);
-	if (bits & U_ORIGIN2)
-	    MSG_WriteCoord(msg, ent->v.origin[1]);
-	if (bits & U_ANGLE2)
-	    MSG_WriteAngle(msg, ent->v.angles[1]);
-	if (bits & U_ORIGIN3)
-	    MSG_WriteCoord(msg, ent->v.origin[2]);
-	if (bits & U_ANGLE3)
-	    MSG_WriteAngle(msg, ent->v.angles[2]);
-#if 0 /* FIXME */
-	if (bits & U_FITZ_ALPHA)
-	    MSG_WriteByte(msg, ent->alpha);
-#endif
-	if (bits & U_FITZ_FRAME2)
-	    MSG_WriteByte(msg, (int)ent->v.frame >> 8);
-	if (bits & U_FITZ_MODEL2)
-	    MSG_WriteByte(msg, (int)ent->v.modelindex >> 8);
-#if 0 /* FIXME */
-	if (bits & U_FITZ_LERPFINISH)
-	    MSG_WriteByte(msg, (byte)floorf(((ent->v.nextthink - sv.time) * 255.0f) + 0.5f));
-#endif
-     }
+	    state->modelindex = 0;
+	state->frame = ent->v.frame;
+	state->colormap = ent->v.colormap;
+	state->skinnum = ent->v.skin;
+	state->effects = ent->v.effects;
+    }
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+Write what has changed of entity num since from as a fast update, and fill
+in sent with the state the client ends up with.  With force, the update is
+written even if nothing has changed, so that the client knows it's there.
+Returns false if nothing was written.
+=============
+*/
+static qboolean
+SV_WriteDeltaEntity(sizebuf_t *msg, int num, const entity_state_t *from,
+		    const entity_state_t *to, qboolean force, qboolean nolerp,
+		    entity_state_t *sent)
+{
+    unsigned int bits;
+    float miss;
+    int i;
+
+    *sent = *from;
+    bits = 0;
+
+    for (i = 0; i < 3; i++) {
+	miss = to->origin[i] - from->origin[i];
+	if (miss < -0.1 || miss > 0.1) {
+	    bits |= U_ORIGIN1 << i;
+	    sent->origin[i] = to->origin[i];
+	}
+    }
+    if (to->angles[0] != from->angles[0])
+	bits |= U_ANGLE1;
+    if (to->angles[1] != from->angles[1])
+	bits |= U_ANGLE2;
+    if (to->angles[2] != from->angles[2])
+	bits |= U_ANGLE3;
+    if (to->colormap != from->colormap)
+	bits |= U_COLORMAP;
+    if (to->skinnum != from->skinnum)
+	bits |= U_SKIN;
+    if (to->frame != from->frame)
+	bits |= U_FRAME;
+    if (to->effects != from->effects)
+	bits |= U_EFFECTS;
+    if (to->modelindex != from->modelindex)
+	bits |= U_MODEL;
+
+    if (!bits && !force)
+	return false;
+
+    VectorCopy(to->angles, sent->angles);
+    sent->modelindex = to->modelindex;
+    sent->frame = to->frame;
+    sent->colormap = to->colormap;
+    sent->skinnum = to->skinnum;
+    sent->effects = to->effects;
+
+    if (nolerp)
+	bits |= U_NOLERP;	// don't mess up the step animation
+
+    if (sv.protocol == PROTOCOL_VERSION_FITZ) {
+	if ((bits & U_FRAME) && (to->frame & 0xff00))
+	    bits |= U_FITZ_FRAME2;
+	if ((bits & U_MODEL) && (to->modelindex & 0xff00))
+	    bits |= U_FITZ_MODEL2;
+	if (bits & 0x00ff0000)
+	    bits |= U_FITZ_EXTEND1;
+	if (bits & 0xff000000)
+	    bits |= U_FITZ_EXTEND2;
+    }
+    if (num >= 256)
+	bits |= U_LONGENTITY;
+    if (bits >= 256)
+	bits |= U_MOREBITS;
+
+    SV_WriteEntityUpdate(msg, num, bits, to);
+
+    return true;
+}
+
+/*
+=============
+SV_WriteDeltaEntities
+
+The entities the client can see, as a svc_deltapacket against the last
+frame it acknowledged, or against the baselines if that has been lost.
+Each frame sent is kept as the client will rebuild it, which is only what
+fits in the message: an entity that doesn't fit keeps its old state if the
+client has one, or is left out until the next frame.
+=============
+*/
+#define DELTA_MAXUPDATE 32	// longest update, with the end marker
+
+static void
+SV_WriteDeltaEntities(client_t *client, sizebuf_t *msg)
+{
+    unsigned short visible[DELTA_MAXENTS];
+    const deltaframe_t *from;
+    deltaframe_t *to;
+    const entity_state_t *ref;
+    const leafbits_t *pvs;
+    edict_t *clent, *ent;
+    vec3_t org;
+    int e, i, j, numvisible, removals, sequence;
+    qboolean written;
+
+// find the client's PVS
+    clent = client->edict;
+    VectorAdd(clent->v.origin, clent->v.view_ofs, org);
+    pvs = Mod_FatPVS(sv.worldmodel, org);
+
+// the entities touching it, and the client's own, always
+    numvisible = 0;
+    ent = NEXT_EDICT(sv.edicts);
+    for (e = 1; e < sv.num_edicts && numvisible < DELTA_MAXENTS;
+	 e++, ent = NEXT_EDICT(ent)) {
+	if (ent != clent) {
+	    if (!sv.states[e].modelindex)
+		continue;
+	    if (!SV_EdictInPVS(ent, &sv.edhot[e], pvs))
+		continue;
+	}
+	visible[numvisible++] = e;
+    }
+
+// delta from the last frame the client has, if it's still kept
+    sequence = client->delta_sequence + 1;
+    from = NULL;
+    if (client->delta_acked && sequence - client->delta_acked < DELTA_FRAMES)
+	from = &client->delta_frames[client->delta_acked & (DELTA_FRAMES - 1)];
+
+    removals = 0;
+    if (from) {
+	for (i = j = 0; j < from->numents; j++) {
+	    while (i < numvisible && visible[i] < from->nums[j])
+		i++;
+	    if (i == numvisible || visible[i] != from->nums[j])
+		removals++;
+	}
+	if (msg->maxsize - msg->cursize < 5 + removals * 2 + DELTA_MAXUPDATE)
+	    from = NULL;
+    }
+    if (msg->maxsize - msg->cursize < 5 + DELTA_MAXUPDATE) {
+	Con_Printf("packet overflow\n");
+	return;
+    }
+
+    client->delta_sequence = sequence;
+    to = &client->delta_frames[sequence & (DELTA_FRAMES - 1)];
+    to->sequence = sequence;
+    to->numents = 0;
+
+    MSG_WriteByte(msg, svc_deltapacket);
+    MSG_WriteByte(msg, sequence);
+    MSG_WriteByte(msg, from ? sequence - from->sequence : 0);
+
+    if (from) {
+	for (i = j = 0; j < from->numents; j++) {
+	    while (i < numvisible && visible[i] < from->nums[j])
+		i++;
+	    if (i == numvisible || visible[i] != from->nums[j])
+		MSG_WriteShort(msg, from->nums[j]);
+	}
+    }
+    MSG_WriteShort(msg, 0);
+
+    for (i = j = 0; i < numvisible; i++) {
+	e = visible[i];
+	ent = EDICT_NUM(e);
+	while (from && j < from->numents && from->nums[j] < e)
+	    j++;
+	if (from && j < from->numents && from->nums[j] == e)
+	    ref = &from->states[j];
+	else
+	    ref = NULL;
+
+	if (msg->maxsize - msg->cursize < DELTA_MAXUPDATE) {
+	    if (!ref)
+		continue;
+	    to->states[to->numents] = *ref;
+	} else {
+	    written = SV_WriteDeltaEntity(msg, e, ref ? ref : &ent->baseline,
+					  &sv.states[e], !ref,
+					  ent->v.movetype == MOVETYPE_STEP,
+					  &to->states[to->numents]);
+	    if (!written)
+		to->states[to->numents] = *ref;
+	}
+	to->nums[to->numents++] = e;
+    }
+    MSG_WriteByte(msg, 0);
 }
 
 /*
@@ -749,7 +1086,7 @@ SV_WriteClientdataToMessage(edict_t *player, sizebuf_t *msg)
 // stuff the sigil bits into the high bits of items for sbar, or else
 // mix in items2
     items = player->v.items;
-    items2 = GetEdictFieldValue(player, "items2");
+    items2 = GetEdictField(player, pr_extfields.items2);
     if (items2)
 	items |= (int)items2->_float << 23;
     else
@@ -883,6 +1220,233 @@ SV_WriteClientdataToMessage(edict_t *player, sizebuf_t *msg)
 #endif
 }
 
+/*
+==============================================================================
+
+SOUND AND EFFECT CULLING
+
+Sounds, particles and temp entities all go into sv.datagram.  Once a frame
+SV_FindDatagramEvents splits it up into messages and finds where each one
+comes from, then each client only gets the ones it could hear: those from
+within its PHS (Potentially Hearable Set) or 1024 units, as with
+SV_Multicast in qwsv.  The PHS row is built for the leaf the client is in,
+rather than for each leaf a sound comes from, and only again once the
+client moves to another leaf.  Vis is close enough to symmetric that it's
+the same set.
+
+Anything else in the datagram, or anything after a message the progs wrote
+that isn't a temp entity, goes to everyone.
+
+==============================================================================
+*/
+
+typedef struct {
+    int start;
+    int length;
+    const mleaf_t *leaf;	// NULL if everyone gets it
+    vec3_t origin;
+} dgevent_t;
+
+/* the shortest message with an origin is a temp entity, 8 bytes */
+static dgevent_t dgevents[MAX_DATAGRAM / 8 + 1];
+static int numdgevents;
+
+/*
+ * Returns the length of the message at data and finds where it comes from,
+ * or returns 0 if the message isn't one that can be culled.
+ */
+static int
+SV_DatagramEventLength(const byte *data, int length, vec3_t origin)
+{
+    const byte *p = data + 1;
+    int bits, extra;
+
+    extra = 0;
+    switch (data[0]) {
+    case svc_sound:
+	if (length < 2)
+	    return 0;
+	bits = *p++;
+	if (bits & SND_VOLUME)
+	    p++;
+	if (bits & SND_ATTENUATION) {
+	    /* attenuation 0 is heard everywhere */
+	    if (p - data >= length || !*p)
+		return 0;
+	    p++;
+	}
+	p += (bits & SND_FITZ_LARGEENTITY) ? 3 : 2;
+	p += SV_SoundNumSize(bits);
+	break;
+    case svc_particle:
+	extra = 3 + 2;		// direction, count and color
+	break;
+    case svc_temp_entity:
+	if (length < 2)
+	    return 0;
+	switch (*p++) {
+	case TE_LIGHTNING1:
+	case TE_LIGHTNING2:
+	case TE_LIGHTNING3:
+	case TE_BEAM:
+	    p += 2;		// entity, then heard from the start
+	    extra = 6;
+	    break;
+	case TE_EXPLOSION2:
+	    extra = 2;		// colors
+	    break;
+	case TE_SPIKE:
+	case TE_SUPERSPIKE:
+	case TE_GUNSHOT:
+	case TE_EXPLOSION:
+	case TE_TAREXPLOSION:
+	case TE_WIZSPIKE:
+	case TE_KNIGHTSPIKE:
+	case TE_LAVASPLASH:
+	case TE_TELEPORT:
+	    break;
+	default:
+	    return 0;
+	}
+	break;
+    default:
+	return 0;
+    }
+    if (p - data + 6 + extra > length)
+	return 0;
+
+    origin[0] = MSG_GetCoord(p);
+    origin[1] = MSG_GetCoord(p + 2);
+    origin[2] = MSG_GetCoord(p + 4);
+
+    return p - data + 6 + extra;
+}
+
+static void
+SV_FindDatagramEvents(void)
+{
+    const byte *data = sv.datagram.data;
+    const int cursize = sv.datagram.cursize;
+    dgevent_t *event = NULL;
+    const mleaf_t *leaf;
+    vec3_t origin;
+    int start, length;
+
+    numdgevents = 0;
+    for (start = 0; start < cursize; start += length) {
+	leaf = NULL;
+	length = 0;
+	if (sv_phs.value)
+	    length = SV_DatagramEventLength(data + start, cursize - start,
+					    origin);
+	if (length) {
+	    leaf = Mod_PointInLeaf(sv.worldmodel, origin);
+	    if (leaf == sv.worldmodel->leafs)
+		leaf = NULL;	// in solid, let everyone have it
+	} else {
+	    length = cursize - start;
+	}
+
+	/* runs of messages for everyone are sent as one */
+	if (!leaf && event && !event->leaf) {
+	    event->length += length;
+	    continue;
+	}
+	event = &dgevents[numdgevents++];
+	event->start = start;
+	event->length = length;
+	event->leaf = leaf;
+	if (leaf)
+	    VectorCopy(origin, event->origin);
+    }
+}
+
+/*
+ * Returns the PHS row for the leaf the client is in, or NULL if the client
+ * is outside the world and should hear everything.
+ */
+static const leafbits_t *
+SV_ClientPHS(client_t *client)
+{
+    static leafbits_t *pvs;
+    static size_t pvssize;
+    const brushmodel_t *world = sv.worldmodel;
+    const float *origin = client->edict->v.origin;
+    const mleaf_t *leaf;
+    leafbits_t *phs;
+    leafblock_t check;
+    size_t size;
+    int visleaf;
+
+    if (client->leaf && VectorCompare(origin, client->leaforigin))
+	return client->leaf != world->leafs ? client->phs : NULL;
+
+    VectorCopy(origin, client->leaforigin);
+    leaf = Mod_PointInLeaf(world, origin);
+    if (!leaf)
+	leaf = world->leafs;
+    if (leaf == client->leaf)
+	return leaf != world->leafs ? client->phs : NULL;
+    client->leaf = leaf;
+    if (leaf == world->leafs)
+	return NULL;
+
+    size = Mod_LeafbitsSize(world->numleafs);
+    if (!client->phs || client->phs->numleafs != world->numleafs) {
+	phs = realloc(client->phs, size);
+	if (!phs)
+	    Sys_Error("%s: out of memory", __func__);
+	client->phs = phs;
+    }
+    if (pvssize < size) {
+	phs = realloc(pvs, size);
+	if (!phs)
+	    Sys_Error("%s: out of memory", __func__);
+	pvs = phs;
+	pvssize = size;
+    }
+
+    /* a copy, as looking up the other rows can evict it from the cache */
+    memcpy(pvs, Mod_LeafPVS(world, leaf), size);
+    memcpy(client->phs, pvs, size);
+    foreach_leafbit(pvs, visleaf, check) {
+	/* index is +1 because pvs is 1 based */
+	if (visleaf + 1 >= world->numleafs)
+	    continue;
+	Mod_AddLeafBits(client->phs,
+			Mod_LeafPVS(world, world->leafs + visleaf + 1));
+    }
+
+    return client->phs;
+}
+
+/* copies in what the client can hear of the server datagram, if there's room */
+static void
+SV_WriteDatagramEvents(client_t *client, sizebuf_t *msg)
+{
+    const leafbits_t *phs = NULL;
+    const dgevent_t *event;
+    qboolean found = false;
+    vec3_t delta;
+    int i, leafnum;
+
+    for (i = 0, event = dgevents; i < numdgevents; i++, event++) {
+	if (event->leaf) {
+	    if (!found) {
+		phs = SV_ClientPHS(client);
+		found = true;
+	    }
+	    VectorSubtract(event->origin, client->edict->v.origin, delta);
+	    leafnum = event->leaf - sv.worldmodel->leafs - 1;
+	    if (phs && DotProduct(delta, delta) > 1024 * 1024
+		&& !Mod_TestLeafBit(phs, leafnum))
+		continue;
+	}
+	if (msg->cursize + event->length < msg->maxsize)
+	    SZ_Write(msg, sv.datagram.data + event->start, event->length);
+    }
+}
+
 /*
 =======================
 SV_SendClientDatagram
@@ -904,14 +1468,20 @@ SV_SendClientDatagram(client_t *client)
 
 // add the client specific data to the datagram
     SV_WriteClientdataToMessage(client->edict, &msg);
-    SV_WriteEntitiesToClient(client->edict, &msg);
+    SV_ProfileBegin(SVP_ENTITIES);
+    if (client->deltas)
+	SV_WriteDeltaEntities(client, &msg);
+    else
+	SV_WriteEntitiesToClient(client->edict, &msg);
+    SV_ProfileEnd();
 
-// copy the server datagram if there is space
-    if (msg.cursize + sv.datagram.cursize < msg.maxsize)
-	SZ_Write(&msg, sv.datagram.data, sv.datagram.cursize);
+// copy in the sounds and effects the client can hear
+    SV_WriteDatagramEvents(client, &msg);
 
 // send the datagram
+    SV_ProfileBegin(SVP_NETWRITE);
     err = NET_SendUnreliableMessage(client->netconnection, &msg);
+    SV_ProfileEnd();
     /* if the message couldn't send, kick the client off */
     if (err == -1) {
 	SV_DropClient(client, true);
@@ -980,7 +1550,9 @@ SV_SendNop(client_t *client)
 
     MSG_WriteChar(&msg, svc_nop);
 
+    SV_ProfileBegin(SVP_NETWRITE);
     err = NET_SendUnreliableMessage(client->netconnection, &msg);
+    SV_ProfileEnd();
     /* if the message couldn't send, kick the client off */
     if (err == -1)
 	SV_DropClient(client, true);
@@ -1001,6 +1573,18 @@ SV_SendClientMessages(void)
     /* update frags, names, etc */
     SV_UpdateToReliableMessages();
 
+    /* split up the datagram once for everyone */
+    SV_FindDatagramEvents();
+
+    /* the entity states all the delta clients are sent from */
+    client = svs.clients;
+    for (i = 0; i < svs.maxclients; i++, client++) {
+	if (client->active && client->spawned && client->deltas) {
+	    SV_BuildEntityStates();
+	    break;
+	}
+    }
+
     /* build individual updates */
     client = svs.clients;
     for (i = 0; i < svs.maxclients; i++, client++) {
@@ -1046,7 +1630,9 @@ SV_SendClientMessages(void)
 	    continue;
 	}
 
+	SV_ProfileBegin(SVP_NETWRITE);
 	err = NET_SendMessage(client->netconnection, &client->message);
+	SV_ProfileEnd();
 	if (err == -1)
 	    SV_DropClient(client, true);
 
@@ -1281,10 +1867,12 @@ SV_SpawnServer(char *server)
 
 // load progs to get entity field count
     PR_LoadProgs();
+    sv.nextmap = PR_FindGlobal("nextmap", ev_string);
 
 // allocate server memory
-    sv.max_edicts = MAX_EDICTS;
-    sv.edicts = Hunk_AllocName(sv.max_edicts * pr_edict_size, "edicts");
+    ED_InitEdicts();
+    sv.states = Hunk_AllocName(sv.max_edicts * sizeof(entity_state_t),
+			       "entstates");
 
     sv.datagram.maxsize = sizeof(sv.datagram_buf);
     sv.datagram.cursize = 0;
@@ -1303,6 +1891,7 @@ SV_SpawnServer(char *server)
     for (i = 0; i < svs.maxclients; i++) {
 	ent = EDICT_NUM(i + 1);
 	svs.clients[i].edict = ent;
+	svs.clients[i].leaf = NULL;
     }
 
     sv.state = ss_loading;
@@ -1127,6 +1127,32 @@ SV_Tell_f(client_t *client)
     }
 }
 
+/*
+ * The client can take svc_deltapacket updates.  Only asked for during
+ * signon, so the frames all start from the baselines of the current map.
+ */
+static void
+SV_Deltas_f(client_t *client)
+{
+    int i;
+
+    if (client->spawned || !sv_deltas.value || Cmd_Argc() != 2)
+	return;
+    if (atoi(Cmd_Argv(1)) != DELTA_VERSION)
+	return;
+
+    if (!client->delta_frames) {
+	client->delta_frames = malloc(DELTA_FRAMES * sizeof(deltaframe_t));
+	if (!client->delta_frames)
+	    return;
+    }
+    for (i = 0; i < DELTA_FRAMES; i++)
+	client->delta_frames[i].sequence = 0;
+    client->delta_sequence = 0;
+    client->delta_acked = 0;
+    client->deltas = true;
+}
+
 /* ------------------------------------------------------------------------ */
 
 typedef struct {
@@ -1154,6 +1180,7 @@ static client_command_t client_commands[] = {
     { "prespawn", SV_PreSpawn_f },
     { "spawn", SV_Spawn_f },
     { "begin", SV_Begin_f },
+    { "deltas", SV_Deltas_f },
     { NULL, NULL },
 };
 
@@ -1172,6 +1199,34 @@ SV_ExecuteClientCommand(const char *command_string, client_t *client)
     }
 }
 
+/*
+===================
+SV_ReadDeltaAck
+
+The last svc_deltapacket the client has, to delta the next one from
+===================
+*/
+static void
+SV_ReadDeltaAck(client_t *client)
+{
+    int sequence;
+
+    sequence = MSG_ReadByte();
+    if (!client->deltas)
+	return;
+
+    /* widen it to the last frame sent with the same low byte */
+    sequence = client->delta_sequence
+	- ((client->delta_sequence - sequence) & 255);
+    if (sequence <= client->delta_acked
+	|| client->delta_sequence - sequence >= DELTA_FRAMES)
+	return;
+    if (client->delta_frames[sequence & (DELTA_FRAMES - 1)].sequence != sequence)
+	return;
+
+    client->delta_acked = sequence;
+}
+
 /*
 ===================
 SV_ReadClientMessage
@@ -1232,6 +1287,10 @@ SV_ReadClientMessage(client_t *client)
 	    case clc_move:
 		SV_ReadClientMove(client, &client->cmd);
 		break;
+
+	    case clc_deltaack:
+		SV_ReadDeltaAck(client);
+		break;
 	    }
 	}
     } while (ret == 1);
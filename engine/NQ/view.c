@@ -29,6 +29,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "host.h"
 #include "quakedef.h"
 #include "screen.h"
+#include "trace.h"
 #include "view.h"
 
 /*
@@ -321,7 +322,6 @@ V_ParseDamage(void)
 {
     int armor, blood;
     vec3_t from;
-    int i;
     vec3_t forward, right, up;
     const entity_t *ent;
     float side;
@@ -329,8 +329,7 @@ V_ParseDamage(void)
 
     armor = MSG_ReadByte();
     blood = MSG_ReadByte();
-    for (i = 0; i < 3; i++)
-	from[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(from);
 
     count = blood * 0.5 + armor * 0.5;
     if (count < 10)
@@ -945,7 +944,9 @@ V_RenderView(void)
     }
 
     if (fisheye_enabled) {
+        TR_Begin("F_RenderView");
         F_RenderView();
+        TR_End("F_RenderView");
     }
     else {
         R_PushDlights();
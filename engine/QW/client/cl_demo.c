@@ -24,11 +24,32 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "console.h"
 #include "pmove.h"
 #include "quakedef.h"
+#include "sound.h"
 #include "sys.h"
 #include "zone.h"
 
 static void CL_FinishTimeDemo(void);
 
+/*
+ * The index of a demo being played, made the first time it is seeked in.
+ * It holds the offset of the first record each second, by the time stamp
+ * the record was written with.
+ */
+#define DEMO_INDEX_STEP 1.0f
+
+typedef struct {
+    float time;
+    long offset;
+} demomark_t;
+
+static struct {
+    qboolean built;
+    demomark_t *marks;
+    int nummarks, maxmarks;
+    float target;		// demo time being seeked to
+    qboolean seeking;
+} demo_index;
+
 /*
 ==============================================================================
 
@@ -60,6 +81,9 @@ CL_StopPlayback(void)
     cls.state = ca_disconnected;
     cls.demoplayback = false;
 
+    free(demo_index.marks);
+    memset(&demo_index, 0, sizeof(demo_index));
+
     if (cls.timedemo)
 	CL_FinishTimeDemo();
 }
@@ -86,10 +110,10 @@ CL_WriteDemoCmd(usercmd_t *pcmd)
 //Con_Printf("write: %ld bytes, %4.4f\n", msg->cursize, realtime);
 
     fl = LittleFloat((float)realtime);
-    fwrite(&fl, sizeof(fl), 1, cls.demofile);
+    COM_StreamWrite(&fl, sizeof(fl));
 
     c = dem_cmd;
-    fwrite(&c, sizeof(c), 1, cls.demofile);
+    COM_StreamWrite(&c, sizeof(c));
 
     // correct for byte order, bytes don't matter
     cmd = *pcmd;
@@ -100,14 +124,12 @@ CL_WriteDemoCmd(usercmd_t *pcmd)
     cmd.sidemove = LittleShort(cmd.sidemove);
     cmd.upmove = LittleShort(cmd.upmove);
 
-    fwrite(&cmd, sizeof(cmd), 1, cls.demofile);
+    COM_StreamWrite(&cmd, sizeof(cmd));
 
     for (i = 0; i < 3; i++) {
 	fl = LittleFloat(cl.viewangles[i]);
-	fwrite(&fl, 4, 1, cls.demofile);
+	COM_StreamWrite(&fl, 4);
     }
-
-    fflush(cls.demofile);
 }
 
 /*
@@ -130,16 +152,14 @@ CL_WriteDemoMessage(sizebuf_t *msg)
 	return;
 
     fl = LittleFloat((float)realtime);
-    fwrite(&fl, sizeof(fl), 1, cls.demofile);
+    COM_StreamWrite(&fl, sizeof(fl));
 
     c = dem_read;
-    fwrite(&c, sizeof(c), 1, cls.demofile);
+    COM_StreamWrite(&c, sizeof(c));
 
     len = LittleLong(msg->cursize);
-    fwrite(&len, 4, 1, cls.demofile);
-    fwrite(msg->data, msg->cursize, 1, cls.demofile);
-
-    fflush(cls.demofile);
+    COM_StreamWrite(&len, 4);
+    COM_StreamWrite(msg->data, msg->cursize);
 }
 
 /*
@@ -162,8 +182,13 @@ CL_GetDemoMessage(void)
     fread(&demotime, sizeof(demotime), 1, cls.demofile);
     demotime = LittleFloat(demotime);
 
+    if (demo_index.seeking && demotime >= demo_index.target)
+	demo_index.seeking = false;
+
 // decide if it is time to grab the next message
-    if (cls.timedemo) {
+    if (demo_index.seeking) {
+	realtime = demotime;	// read straight through to the seek time
+    } else if (cls.timedemo) {
 	if (cls.td_lastframe < 0)
 	    cls.td_lastframe = demotime;
 	else if (demotime > cls.td_lastframe) {
@@ -300,8 +325,7 @@ CL_Stop_f(void)
     CL_WriteDemoMessage(&net_message);
 
 // finish up
-    fclose(cls.demofile);
-    cls.demofile = NULL;
+    COM_CloseStream();
     cls.demorecording = false;
     Con_Printf("Completed demo\n");
 }
@@ -328,21 +352,19 @@ CL_WriteRecordDemoMessage(sizebuf_t *msg, int seq)
 	return;
 
     fl = LittleFloat((float)realtime);
-    fwrite(&fl, sizeof(fl), 1, cls.demofile);
+    COM_StreamWrite(&fl, sizeof(fl));
 
     c = dem_read;
-    fwrite(&c, sizeof(c), 1, cls.demofile);
+    COM_StreamWrite(&c, sizeof(c));
 
     len = LittleLong(msg->cursize + 8);
-    fwrite(&len, 4, 1, cls.demofile);
+    COM_StreamWrite(&len, 4);
 
     i = LittleLong(seq);
-    fwrite(&i, 4, 1, cls.demofile);
-    fwrite(&i, 4, 1, cls.demofile);
+    COM_StreamWrite(&i, 4);
+    COM_StreamWrite(&i, 4);
 
-    fwrite(msg->data, msg->cursize, 1, cls.demofile);
-
-    fflush(cls.demofile);
+    COM_StreamWrite(msg->data, msg->cursize);
 }
 
 
@@ -359,17 +381,15 @@ CL_WriteSetDemoMessage(void)
 	return;
 
     fl = LittleFloat((float)realtime);
-    fwrite(&fl, sizeof(fl), 1, cls.demofile);
+    COM_StreamWrite(&fl, sizeof(fl));
 
     c = dem_set;
-    fwrite(&c, sizeof(c), 1, cls.demofile);
+    COM_StreamWrite(&c, sizeof(c));
 
     len = LittleLong(cls.netchan.outgoing_sequence);
-    fwrite(&len, 4, 1, cls.demofile);
+    COM_StreamWrite(&len, 4);
     len = LittleLong(cls.netchan.incoming_sequence);
-    fwrite(&len, 4, 1, cls.demofile);
-
-    fflush(cls.demofile);
+    COM_StreamWrite(&len, 4);
 }
 
 
@@ -418,8 +438,7 @@ CL_Record_f(void)
     }
 
     /* open the demo file */
-    cls.demofile = fopen(name, "wb");
-    if (!cls.demofile) {
+    if (!COM_OpenStream(name, cl_democompress.value)) {
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
@@ -698,8 +717,7 @@ CL_ReRecord_f(void)
     }
 
     /* open the demo file */
-    cls.demofile = fopen(name, "wb");
-    if (!cls.demofile) {
+    if (!COM_OpenStream(name, cl_democompress.value)) {
 	Con_Printf("ERROR: couldn't open.\n");
 	return;
     }
@@ -722,7 +740,7 @@ play [demoname]
 void
 CL_PlayDemo_f(void)
 {
-    int err;
+    int err, length;
     char name[MAX_QPATH];
 
     if (Cmd_Argc() != 2) {
@@ -743,7 +761,9 @@ CL_PlayDemo_f(void)
 
     /* open the demo file */
     Con_Printf("Playing demo from %s.\n", name);
-    COM_FOpenFile(name, &cls.demofile);
+    length = COM_FOpenFile(name, &cls.demofile);
+    if (cls.demofile)
+	cls.demofile = COM_Uncompress(cls.demofile, length);
     if (!cls.demofile) {
 	Con_Printf("ERROR: couldn't open.\n");
 	cls.demonum = -1;	/* stop demo loop */
@@ -756,6 +776,126 @@ CL_PlayDemo_f(void)
     realtime = 0;
 }
 
+/*
+====================
+CL_BuildDemoIndex
+
+Reads through the records to note where each second starts
+====================
+*/
+static void
+CL_BuildDemoIndex(void)
+{
+    demomark_t *marks;
+    long pos, offset, skip;
+    float time, next;
+    int length;
+    byte c;
+
+    pos = ftell(cls.demofile);
+    fseek(cls.demofile, 0, SEEK_SET);
+
+    next = -1;
+    demo_index.nummarks = 0;
+    for (;;) {
+	offset = ftell(cls.demofile);
+	if (fread(&time, sizeof(time), 1, cls.demofile) != 1)
+	    break;
+	if (fread(&c, sizeof(c), 1, cls.demofile) != 1)
+	    break;
+	switch (c) {
+	case dem_cmd:
+	    skip = sizeof(usercmd_t) + 12;
+	    break;
+	case dem_read:
+	    if (fread(&length, 4, 1, cls.demofile) != 1)
+		goto done;
+	    skip = LittleLong(length);
+	    if (skip < 0 || skip > MAX_MSGLEN)
+		goto done;
+	    break;
+	case dem_set:
+	    skip = 8;
+	    break;
+	default:
+	    goto done;
+	}
+	if (fseek(cls.demofile, skip, SEEK_CUR))
+	    break;
+
+	time = LittleFloat(time);
+	if (time < next)
+	    continue;
+	next = time + DEMO_INDEX_STEP;
+
+	if (demo_index.nummarks == demo_index.maxmarks) {
+	    int maxmarks = demo_index.maxmarks ? demo_index.maxmarks * 2 : 256;
+	    marks = realloc(demo_index.marks, maxmarks * sizeof(*marks));
+	    if (!marks)
+		break;
+	    demo_index.marks = marks;
+	    demo_index.maxmarks = maxmarks;
+	}
+	marks = &demo_index.marks[demo_index.nummarks++];
+	marks->time = time;
+	marks->offset = offset;
+    }
+
+ done:
+    clearerr(cls.demofile);
+    fseek(cls.demofile, pos, SEEK_SET);
+    demo_index.built = true;
+}
+
+/*
+====================
+CL_DemoSeek_f
+
+demo_seek [seconds]
+
+Plays forward through the demo without waiting, starting it again
+first if the time is behind.
+====================
+*/
+void
+CL_DemoSeek_f(void)
+{
+    float start, length, target;
+
+    if (!cls.demoplayback || cls.timedemo) {
+	Con_Printf("Not playing a demo.\n");
+	return;
+    }
+
+    if (!demo_index.built)
+	CL_BuildDemoIndex();
+    if (!demo_index.nummarks) {
+	Con_Printf("Demo has nothing to seek to.\n");
+	return;
+    }
+
+    start = demo_index.marks[0].time;
+    length = demo_index.marks[demo_index.nummarks - 1].time - start;
+    if (Cmd_Argc() != 2) {
+	Con_Printf("demo_seek <seconds> : at %.1f of %.1f seconds\n",
+		   qmax((float)realtime - start, 0.0f), length);
+	return;
+    }
+
+    target = qclamp((float)atof(Cmd_Argv(1)), 0.0f, length);
+    demo_index.target = start + target;
+    demo_index.seeking = true;
+
+    // go back to the start, the messages will set everything up again
+    if (demo_index.target < realtime) {
+	S_StopAllSounds(true);
+	fseek(cls.demofile, 0, SEEK_SET);
+	cls.state = ca_demostart;
+	Netchan_Setup(&cls.netchan, net_from, 0);
+	realtime = 0;
+    }
+}
+
 struct stree_root *
 CL_Demo_Arg_f(const char *arg)
 {
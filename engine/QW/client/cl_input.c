@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.h"
 #include "cmd.h"
 #include "console.h"
+#include "fisheye.h"
 #include "input.h"
 #include "quakedef.h"
 
@@ -571,7 +572,7 @@ void
 CL_SendCmd(const physent_stack_t *pestack)
 {
     sizebuf_t buf;
-    byte data[128];
+    byte data[256];
     int i;
     usercmd_t *cmd, *oldcmd;
     int checksumIndex;
@@ -595,6 +596,8 @@ CL_SendCmd(const physent_stack_t *pestack)
 
     // allow mice or other external controllers to add to the move
     IN_Move(cmd);
+    if (fisheye_enabled)
+	F_AddLateMove(cmd);	// (mouse moves read while drawing)
 
     // if we are spectator, try autocam
     if (cl.spectator)
@@ -606,7 +609,7 @@ CL_SendCmd(const physent_stack_t *pestack)
 
 // send this and the previous cmds in the message, so
 // if the last packet was dropped, it can be recovered
-    buf.maxsize = 128;
+    buf.maxsize = sizeof(data);
     buf.cursize = 0;
     buf.data = data;
 
@@ -656,6 +659,8 @@ CL_SendCmd(const physent_stack_t *pestack)
     if (cls.demorecording)
 	CL_WriteDemoCmd(cmd);
 
+    CL_WriteDownloadAcks(&buf);
+
 //
 // deliver the message
 //
@@ -35,6 +35,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.h"
 #include "console.h"
 #include "draw.h"
+#include "fisheye.h"
+#include "imgwrite.h"
 #include "input.h"
 #include "keys.h"
 #include "menu.h"
@@ -44,6 +46,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sbar.h"
 #include "screen.h"
 #include "sys.h"
+#include "trace.h"
 #include "view.h"
 #include "wad.h"
 
@@ -74,6 +77,7 @@ cvar_t rcon_address = { "rcon_address", "" };
 cvar_t cl_timeout = { "cl_timeout", "60" };
 
 cvar_t cl_shownet = { "cl_shownet", "0" };	// can be 0, 1, or 2
+cvar_t cl_democompress = { "cl_democompress", "0", true };
 
 cvar_t cl_sbar = { "cl_sbar", "0", true };
 cvar_t cl_hudswap = { "cl_hudswap", "0", true };
@@ -379,6 +383,7 @@ CL_ClearState(void)
 	Hunk_FreeToLowMark(host_hunklevel);
 
     CL_ClearTEnts();
+    CL_ResetPrediction();
 
 // wipe the entire cl structure
     memset(&cl, 0, sizeof(cl));
@@ -439,10 +444,7 @@ CL_Disconnect(void)
     }
     Cam_Reset();
 
-    if (cls.download) {
-	fclose(cls.download);
-	cls.download = NULL;
-    }
+    CL_CloseDownload();
 
     CL_StopUpload();
     cl.intermission = 0; /* FIXME - for SCR_UpdateScreen */
@@ -1063,6 +1065,7 @@ CL_Init(void)
     Cvar_RegisterVariable(&cl_anglespeedkey);
     Cvar_RegisterVariable(&cl_run);
     Cvar_RegisterVariable(&cl_shownet);
+    Cvar_RegisterVariable(&cl_democompress);
     Cvar_RegisterVariable(&cl_sbar);
     Cvar_RegisterVariable(&cl_hudswap);
     Cvar_RegisterVariable(&cl_maxfps);
@@ -1120,6 +1123,7 @@ CL_Init(void)
     Cmd_SetCompletion("playdemo", CL_Demo_Arg_f);
     Cmd_AddCommand("timedemo", CL_TimeDemo_f);
     Cmd_SetCompletion("timedemo", CL_Demo_Arg_f);
+    Cmd_AddCommand("demo_seek", CL_DemoSeek_f);
 
     Cmd_AddCommand("skins", Skin_Skins_f);
     Cmd_AddCommand("allskins", Skin_AllSkins_f);
@@ -1245,6 +1249,8 @@ Host_WriteConfiguration(void)
 	Key_WriteBindings(f);
 	Cvar_WriteVariables(f);
 
+	F_WriteConfig(f);
+
 	fclose(f);
     }
 }
@@ -1298,8 +1304,10 @@ Host_Frame(float time)
     physent_stack_t pestack;
 
     /* something bad happened, or the server disconnected */
-    if (setjmp(host_abort))
+    if (setjmp(host_abort)) {
+	TR_End("Host_Frame");
 	return;
+    }
 
     // decide the simulation time
     realtime += time;
@@ -1317,17 +1325,27 @@ Host_Frame(float time)
     if (host_frametime > 0.2)
 	host_frametime = 0.2;
 
+    TR_Begin("Host_Frame");
+
     // get new key events
     Sys_SendKeyEvents();
 
     /* allow mice or other external controllers to add commands */
     IN_Commands();
 
+    /* pick up after background jobs */
+    COM_RunFinishedJobs();
+
     /* process console commands */
     Cbuf_Execute();
 
     // fetch results from server
+    TR_Begin("CL_ReadPackets");
     CL_ReadPackets();
+    TR_End("CL_ReadPackets");
+
+    /* take in any skins that have finished loading */
+    Skin_Poll();
 
     /* Set the pmove physents based on current state... */
     CL_SetSolidEntities(&pestack);
@@ -1355,18 +1373,22 @@ Host_Frame(float time)
     if (host_speeds.value)
 	time1 = Sys_DoubleTime();
 
+    TR_Begin("SCR_UpdateScreen");
     SCR_UpdateScreen();
+    TR_End("SCR_UpdateScreen");
     CL_RunParticles();
 
     if (host_speeds.value)
 	time2 = Sys_DoubleTime();
 
     /* update audio */
+    TR_Begin("S_Update");
     if (cls.state == ca_active) {
 	S_Update(r_origin, vpn, vright, vup);
 	CL_DecayLights();
     } else
 	S_Update(vec3_origin, vec3_origin, vec3_origin, vec3_origin);
+    TR_End("S_Update");
 
     CDAudio_Update();
 
@@ -1381,6 +1403,8 @@ Host_Frame(float time)
 
     host_framecount++;
     fps_count++;
+
+    TR_End("Host_Frame");
 }
 
 //============================================================================
@@ -1396,6 +1420,7 @@ Host_Init(quakeparms_t *parms)
     COM_InitArgv(parms->argc, parms->argv);
     COM_AddParm("-game");
     COM_AddParm("qw");
+    COM_StartTrace("start");
 
     Sys_mkdir("qw");
 
@@ -1413,8 +1438,10 @@ Host_Init(quakeparms_t *parms)
     Cbuf_Init();
     Cmd_Init();
     V_Init();
+    COM_StartTrace("memory, commands");
 
     COM_Init();
+    COM_StartTrace("filesystem");
 
     NET_Init(PORT_CLIENT);
     Netchan_Init();
@@ -1424,11 +1451,13 @@ Host_Init(quakeparms_t *parms)
     Con_Init();
     M_Init();
     Mod_Init(R_ModelLoader());
+    COM_StartTrace("net, wad, console, menu");
 
 //      Con_Printf ("Exe: "__TIME__" "__DATE__"\n");
     Con_Printf("%4.1f megs RAM used.\n", parms->memsize / (1024 * 1024.0));
 
     R_InitTextures();
+    COM_StartTrace("textures");
 
     host_basepal = COM_LoadHunkFile("gfx/palette.lmp");
     if (!host_basepal)
@@ -1438,17 +1467,23 @@ Host_Init(quakeparms_t *parms)
 	Sys_Error("Couldn't load gfx/colormap.lmp");
 
     VID_Init(host_basepal);
+    COM_StartTrace("video");
     Draw_Init();
     SCR_Init();
     R_Init();
     Sbar_Init();
+    COM_StartTrace("draw, screen, render");
 
     cls.state = ca_disconnected;
 
     S_Init();
     CDAudio_Init();
+    COM_StartTrace("sound, cd");
     CL_Init();
     IN_Init();
+    COM_StartTrace("client, input");
+    F_Init();
+    COM_StartTrace("fisheye");
     Mod_InitAliasCache();
 
     Hunk_AllocName(0, "-HOST_HUNKLEVEL-");
@@ -1464,6 +1499,7 @@ Host_Init(quakeparms_t *parms)
 	Cbuf_InsertText("exec quake.rc\n");
 	Cbuf_Execute();
     }
+    COM_StartTrace("quake.rc");
 
     Cbuf_AddText("echo Type connect <internet address> or use GameSpy to "
 		 "connect to a game.\n");
@@ -1495,7 +1531,12 @@ Host_Shutdown(void)
     CDAudio_Shutdown();
     NET_Shutdown();
     S_Shutdown();
+    F_Shutdown();
+    IMG_Shutdown();
+    COM_PreloadShutdown();
+    Skin_Shutdown();
     IN_Shutdown();
     if (host_basepal)
 	VID_Shutdown();
+    Con_Shutdown();
 }
@@ -207,8 +207,12 @@ CL_CheckOrDownloadFile(char *filename)
 	return true;
     }
 
+    /* old servers take no notice of the "chunked" */
     MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
-    MSG_WriteStringf(&cls.netchan.message, "download %s", cls.downloadname);
+    MSG_WriteStringf(&cls.netchan.message, "download %s chunked",
+		     cls.downloadname);
+    cls.downloadchunked = true;
+    cls.downloadserial = -1;
 
     cls.downloadnumber++;
 
@@ -240,6 +244,11 @@ Model_NextDownload(void)
 	    return;		// started a download
     }
 
+    // read the brush models ahead while the rest load (they're never cached)
+    for (i = 1; i < MAX_MODELS && cl.model_name[i][0]; i++)
+	if (COM_CheckExtension(cl.model_name[i], ".bsp"))
+	    COM_PreloadFile(cl.model_name[i]);
+
     for (i = 1; i < MAX_MODELS; i++) {
 	if (!cl.model_name[i][0])
 	    break;
@@ -293,11 +302,13 @@ Sound_NextDownload(void)
 	    return;		// started a download
     }
 
+    S_BeginPrecaching();
     for (i = 1; i < MAX_SOUNDS; i++) {
 	if (!cl.sound_name[i][0])
 	    break;
 	cl.sound_precache[i] = S_PrecacheSound(cl.sound_name[i]);
     }
+    S_EndPrecaching();
 
     // done with sounds, request models now
     memset(cl.model_precache, 0, sizeof(cl.model_precache));
@@ -335,6 +346,190 @@ CL_RequestNextDownload(void)
     }
 }
 
+/*
+=====================
+CL_CloseDownload
+=====================
+*/
+void
+CL_CloseDownload(void)
+{
+    if (cls.download) {
+	fclose(cls.download);
+	cls.download = NULL;
+    }
+    free(cls.downloadchunks);
+    cls.downloadchunks = NULL;
+    cls.downloadchunked = false;
+    cls.numdownloadacks = 0;
+}
+
+static qboolean
+CL_OpenDownload(void)
+{
+    char name[1024];
+
+    if (strncmp(cls.downloadtempname, "skins/", 6))
+	sprintf(name, "%s/%s", com_gamedir, cls.downloadtempname);
+    else
+	sprintf(name, "qw/%s", cls.downloadtempname);
+
+    COM_CreatePath(name);
+
+    cls.download = fopen(name, "wb");
+    if (!cls.download) {
+	Con_Printf("Failed to open %s\n", cls.downloadtempname);
+	return false;
+    }
+
+    return true;
+}
+
+static void
+CL_FinishDownload(void)
+{
+    char oldn[MAX_OSPATH];
+    char newn[MAX_OSPATH];
+    int r;
+
+#if 0
+    Con_Printf("100%%\n");
+#endif
+
+    fclose(cls.download);
+    cls.download = NULL;
+
+    // rename the temp file to it's final name
+    if (strcmp(cls.downloadtempname, cls.downloadname)) {
+	if (strncmp(cls.downloadtempname, "skins/", 6)) {
+	    sprintf(oldn, "%s/%s", com_gamedir, cls.downloadtempname);
+	    sprintf(newn, "%s/%s", com_gamedir, cls.downloadname);
+	} else {
+	    sprintf(oldn, "qw/%s", cls.downloadtempname);
+	    sprintf(newn, "qw/%s", cls.downloadname);
+	}
+	r = rename(oldn, newn);
+	if (r)
+	    Con_Printf("failed to rename.\n");
+    }
+
+    if (cls.downloadchunked) {
+	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
+	MSG_WriteString(&cls.netchan.message, "stopdl");
+    }
+    CL_CloseDownload();
+    cls.downloadpercent = 0;
+
+    // get another file if needed
+
+    CL_RequestNextDownload();
+}
+
+/*
+=====================
+CL_WriteDownloadAcks
+
+Acks the chunks received since the last packet, in the unreliable part of
+the next one.  Any that don't fit wait for the one after.
+=====================
+*/
+void
+CL_WriteDownloadAcks(sizebuf_t *buf)
+{
+    char text[128];
+    int i, length, count;
+
+    if (!cls.numdownloadacks)
+	return;
+
+    length = snprintf(text, sizeof(text), "dlack %d", cls.downloadserial);
+    for (count = 0; count < cls.numdownloadacks; count++) {
+	i = snprintf(text + length, sizeof(text) - length, " %d",
+		     cls.downloadacks[count]);
+	if (i >= sizeof(text) - length)
+	    break;
+	length += i;
+    }
+    text[length] = 0;
+    if (buf->cursize + length + 2 > buf->maxsize)
+	return;
+
+    MSG_WriteByte(buf, clc_stringcmd);
+    MSG_WriteString(buf, text);
+    cls.numdownloadacks -= count;
+    memmove(cls.downloadacks, cls.downloadacks + count,
+	    cls.numdownloadacks * sizeof(cls.downloadacks[0]));
+}
+
+static void
+CL_StartChunkedDownload(int serial, int size)
+{
+    int numchunks;
+
+    if (!cls.downloadchunked || cls.download) {
+	Con_DPrintf("Unexpected chunked download\n");
+	return;
+    }
+    if (!CL_OpenDownload()) {
+	CL_CloseDownload();
+	CL_RequestNextDownload();
+	return;
+    }
+    numchunks = (size + DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+    cls.downloadchunks = calloc(numchunks + 1, 1);
+    if (!cls.downloadchunks)
+	Sys_Error("%s: out of memory", __func__);
+    cls.downloadserial = serial;
+    cls.downloadsize = size;
+    cls.downloadreceived = 0;
+    cls.numdownloadacks = 0;
+
+    if (!numchunks)
+	CL_FinishDownload();
+}
+
+static void
+CL_ParseDownloadChunk(int serial)
+{
+    const byte *data;
+    int chunk, length, numchunks;
+
+    chunk = MSG_ReadLong();
+    length = MSG_ReadShort();
+    if (length < 0 || msg_readcount + length > net_message.cursize) {
+	msg_badread = true;
+	return;
+    }
+    data = net_message.data + msg_readcount;
+    msg_readcount += length;
+
+    /* left over from an earlier download, or sent before the start */
+    if (cls.demoplayback || !cls.downloadchunks
+	|| serial != cls.downloadserial)
+	return;
+
+    numchunks = (cls.downloadsize + DOWNLOAD_CHUNK - 1) / DOWNLOAD_CHUNK;
+    if (chunk < 0 || chunk >= numchunks
+	|| length != qmin(cls.downloadsize - chunk * DOWNLOAD_CHUNK,
+			  DOWNLOAD_CHUNK))
+	return;
+
+    /* ack it even if it's a repeat, the server missed the last ack */
+    if (cls.numdownloadacks < DOWNLOAD_ACKS)
+	cls.downloadacks[cls.numdownloadacks++] = chunk;
+    if (cls.downloadchunks[chunk])
+	return;
+
+    fseek(cls.download, chunk * DOWNLOAD_CHUNK, SEEK_SET);
+    fwrite(data, 1, length, cls.download);
+    cls.downloadchunks[chunk] = 1;
+    cls.downloadreceived++;
+    cls.downloadpercent = cls.downloadreceived * 100 / numchunks;
+
+    if (cls.downloadreceived == numchunks)
+	CL_FinishDownload();
+}
+
 /*
 =====================
 CL_ParseDownload
@@ -346,14 +541,23 @@ static void
 CL_ParseDownload(void)
 {
     int size, percent;
-    char name[1024];
-    int r;
 
 
     // read the data
     size = MSG_ReadShort();
     percent = MSG_ReadByte();
 
+    if (size == DL_CHUNK) {
+	CL_ParseDownloadChunk(percent);
+	return;
+    }
+    if (size == DL_CHUNKED) {
+	size = MSG_ReadLong();
+	if (!cls.demoplayback)
+	    CL_StartChunkedDownload(percent, size);
+	return;
+    }
+
     if (cls.demoplayback) {
 	if (size > 0)
 	    msg_readcount += size;
@@ -367,27 +571,22 @@ CL_ParseDownload(void)
 	    fclose(cls.download);
 	    cls.download = NULL;
 	}
+	CL_CloseDownload();
 	CL_RequestNextDownload();
 	return;
     }
     // open the file if not opened yet
     if (!cls.download) {
-	if (strncmp(cls.downloadtempname, "skins/", 6))
-	    sprintf(name, "%s/%s", com_gamedir, cls.downloadtempname);
-	else
-	    sprintf(name, "qw/%s", cls.downloadtempname);
-
-	COM_CreatePath(name);
-
-	cls.download = fopen(name, "wb");
-	if (!cls.download) {
+	if (!CL_OpenDownload()) {
 	    msg_readcount += size;
-	    Con_Printf("Failed to open %s\n", cls.downloadtempname);
 	    CL_RequestNextDownload();
 	    return;
 	}
     }
 
+    /* the server sends blocks the old way, don't let chunks in too */
+    cls.downloadchunked = false;
+
     fwrite(net_message.data + msg_readcount, 1, size, cls.download);
     msg_readcount += size;
 
@@ -406,35 +605,7 @@ CL_ParseDownload(void)
 	MSG_WriteByte(&cls.netchan.message, clc_stringcmd);
 	MSG_WriteString(&cls.netchan.message, "nextdl");
     } else {
-	char oldn[MAX_OSPATH];
-	char newn[MAX_OSPATH];
-
-#if 0
-	Con_Printf("100%%\n");
-#endif
-
-	fclose(cls.download);
-
-	// rename the temp file to it's final name
-	if (strcmp(cls.downloadtempname, cls.downloadname)) {
-	    if (strncmp(cls.downloadtempname, "skins/", 6)) {
-		sprintf(oldn, "%s/%s", com_gamedir, cls.downloadtempname);
-		sprintf(newn, "%s/%s", com_gamedir, cls.downloadname);
-	    } else {
-		sprintf(oldn, "qw/%s", cls.downloadtempname);
-		sprintf(newn, "qw/%s", cls.downloadname);
-	    }
-	    r = rename(oldn, newn);
-	    if (r)
-		Con_Printf("failed to rename.\n");
-	}
-
-	cls.download = NULL;
-	cls.downloadpercent = 0;
-
-	// get another file if needed
-
-	CL_RequestNextDownload();
+	CL_FinishDownload();
     }
 }
 
@@ -771,10 +942,8 @@ CL_ParseStaticSound(void)
 {
     vec3_t org;
     int sound_num, vol, atten;
-    int i;
 
-    for (i = 0; i < 3; i++)
-	org[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(org);
     sound_num = MSG_ReadByte();
     vol = MSG_ReadByte();
     atten = MSG_ReadByte();
@@ -805,7 +974,6 @@ CL_ParseStartSoundPacket(void)
     int sound_num;
     int volume;
     float attenuation;
-    int i;
 
     channel = MSG_ReadShort();
 
@@ -821,8 +989,7 @@ CL_ParseStartSoundPacket(void)
 
     sound_num = MSG_ReadByte();
 
-    for (i = 0; i < 3; i++)
-	pos[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(pos);
 
     ent = (channel >> 3) & 1023;
     channel &= 7;
@@ -1293,8 +1460,7 @@ CL_ParseServerMessage(void)
 	    cl.intermission = 1;
 	    cl.completed_time = realtime;
 	    vid.recalc_refdef = true;	// go to full screen
-	    for (i = 0; i < 3; i++)
-		cl.simorg[i] = MSG_ReadCoord();
+	    MSG_ReadCoords3(cl.simorg);
 	    for (i = 0; i < 3; i++)
 		cl.simangles[i] = MSG_ReadAngle();
 	    VectorCopy(vec3_origin, cl.simvel);
@@ -33,6 +33,24 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 cvar_t cl_nopred = { "cl_nopred", "0" };
 cvar_t cl_pushlatency = { "pushlatency", "-999" };
 
+/*
+ * The player states predicted on earlier frames, kept so that only the
+ * moves made since then need to be run again.  They stay good for as long
+ * as the server keeps agreeing with where we thought we would be and the
+ * things we clip against are the same.
+ */
+static struct {
+    qboolean valid;
+    int base;			/* the server frame predicted from */
+    int last;			/* the last sequence predicted */
+    int playernum;
+    qboolean dead;
+    qboolean spectator;
+    movevars_t movevars;
+    physent_stack_t pestack;
+    player_state_t states[UPDATE_BACKUP];
+} prediction;
+
 static void
 CL_PlayerMove(const player_state_t *from, player_state_t *to,
 	      const usercmd_t *cmd, const physent_stack_t *pestack,
@@ -49,6 +67,8 @@ CL_PlayerMove(const player_state_t *from, player_state_t *to,
     pmove.dead = cl.stats[STAT_HEALTH] <= 0;
     pmove.spectator = spectator;
     pmove.cmd = cmd;
+    pmove.maxspeed = movevars.maxspeed;
+    pmove.entgravity = movevars.entgravity;
 
     PlayerMove(&pmove, pestack);
 
@@ -87,6 +107,112 @@ CL_PredictUsercmd(const player_state_t *from, player_state_t *to,
     CL_PlayerMove(from, to, cmd, pestack, spectator);
 }
 
+/*
+==============
+CL_ResetPrediction
+==============
+*/
+void
+CL_ResetPrediction(void)
+{
+    prediction.valid = false;
+}
+
+static qboolean
+CL_SamePhysents(const physent_stack_t *a, const physent_stack_t *b)
+{
+    const physent_t *pa, *pb;
+    int i;
+
+    if (a->numphysent != b->numphysent)
+	return false;
+
+    pa = a->physents;
+    pb = b->physents;
+    for (i = 0; i < a->numphysent; i++, pa++, pb++) {
+	if (pa->brushmodel != pb->brushmodel)
+	    return false;
+	if (!VectorCompare(pa->origin, pb->origin))
+	    return false;
+	if (pa->brushmodel)
+	    continue;
+	if (!VectorCompare(pa->mins, pb->mins))
+	    return false;
+	if (!VectorCompare(pa->maxs, pb->maxs))
+	    return false;
+    }
+
+    return true;
+}
+
+/*
+ * The server only sends the origin in eighths of a unit and the velocity
+ * in whole units, so that is as closely as we can tell if our prediction
+ * for this frame was right.
+ */
+static qboolean
+CL_PredictionHeld(const player_state_t *predicted, const player_state_t *state)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	if ((int)(predicted->origin[i] * (1 << 3)) * (1.0 / (1 << 3))
+	    != state->origin[i])
+	    return false;
+	if ((short)predicted->velocity[i] != state->velocity[i])
+	    return false;
+    }
+
+    return true;
+}
+
+/*
+==============
+CL_CheckPrediction
+
+Works out how many of the previously predicted frames can be used again,
+returning the last sequence that doesn't need to be run through pmove.
+==============
+*/
+static int
+CL_CheckPrediction(const physent_stack_t *pestack, int base)
+{
+    const player_state_t *state;
+    qboolean dead;
+
+    dead = cl.stats[STAT_HEALTH] <= 0;
+
+    if (prediction.valid
+	&& prediction.playernum == cl.playernum
+	&& prediction.dead == dead
+	&& prediction.spectator == cl.spectator
+	&& !memcmp(&prediction.movevars, &movevars, sizeof(movevars))
+	&& CL_SamePhysents(&prediction.pestack, pestack)) {
+	if (base == prediction.base)
+	    return prediction.last;
+	if (base > prediction.base && base <= prediction.last) {
+	    state = &cl.frames[base & UPDATE_MASK].playerstate[cl.playernum];
+	    if (CL_PredictionHeld(&prediction.states[base & UPDATE_MASK], state)) {
+		prediction.base = base;
+		return prediction.last;
+	    }
+	}
+    }
+
+    prediction.valid = true;
+    prediction.base = base;
+    prediction.last = base;
+    prediction.playernum = cl.playernum;
+    prediction.dead = dead;
+    prediction.spectator = cl.spectator;
+    prediction.movevars = movevars;
+    prediction.pestack.numphysent = pestack->numphysent;
+    memcpy(prediction.pestack.physents, pestack->physents,
+	   pestack->numphysent * sizeof(pestack->physents[0]));
+
+    return base;
+}
+
 /*
 ==============
 CL_PredictMove
@@ -101,7 +227,7 @@ CL_PredictMove(physent_stack_t *pestack)
     const player_state_t *fromstate;
     frame_t *to;
     player_state_t *tostate;
-    int oldphysent;
+    int oldphysent, sequence, predicted;
 
     if (cl_pushlatency.value > 0)
 	Cvar_Set("pushlatency", "0");
@@ -152,12 +278,22 @@ CL_PredictMove(physent_stack_t *pestack)
     tostate = NULL;
     oldphysent = pestack->numphysent;
     CL_SetSolidPlayers(pestack, cl.playernum);
+    predicted = CL_CheckPrediction(pestack, cls.netchan.incoming_sequence);
 
     for (i = 1; i < UPDATE_BACKUP - 1 && cls.netchan.incoming_sequence + i <
 	 cls.netchan.outgoing_sequence; i++) {
-	to = &cl.frames[(cls.netchan.incoming_sequence + i) & UPDATE_MASK];
+	sequence = cls.netchan.incoming_sequence + i;
+	to = &cl.frames[sequence & UPDATE_MASK];
 	tostate = &to->playerstate[cl.playernum];
-	CL_PredictUsercmd(fromstate, tostate, &to->cmd, pestack, cl.spectator);
+	if (sequence <= predicted) {
+	    *tostate = prediction.states[sequence & UPDATE_MASK];
+	    tostate->weaponframe = fromstate->weaponframe;
+	} else {
+	    CL_PredictUsercmd(fromstate, tostate, &to->cmd, pestack,
+			      cl.spectator);
+	    prediction.states[sequence & UPDATE_MASK] = *tostate;
+	    prediction.last = sequence;
+	}
 	if (to->senttime >= cl.time)
 	    break;
 	from = to;
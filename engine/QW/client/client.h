@@ -38,7 +38,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 typedef struct {
     char name[16];
     qboolean failedload;	// the name isn't a valid skin
-    cache_user_t cache;
+    unsigned request;		// the load in progress, 0 if none
+    unsigned serial;		// unique to each load, 0 until loaded
+    byte *pixels;		// 320x200, NULL until loaded
 } skin_t;
 
 #define	MAX_DLIGHTS	32
@@ -156,6 +158,8 @@ typedef enum {
     dl_single
 } dltype_t;			// download type
 
+#define DOWNLOAD_ACKS 64	// chunks received and not acked yet
+
 //
 // the client_static_t structure is persistant through an arbitrary number
 // of server connections
@@ -181,6 +185,15 @@ typedef struct {
     dltype_t downloadtype;
     int downloadpercent;
 
+    /* chunked downloads (cl_parse.c) */
+    qboolean downloadchunked;	// asked for the file in chunks
+    int downloadserial;		// the server's, -1 until it starts
+    int downloadsize;
+    int downloadreceived;	// chunks
+    byte *downloadchunks;	// a flag for each chunk received
+    int downloadacks[DOWNLOAD_ACKS];
+    int numdownloadacks;
+
 // demo loop control
     int demonum;		// -1 = don't play demos
     char demos[MAX_DEMOS][MAX_DEMONAME];	// when not playing
@@ -310,6 +323,7 @@ extern cvar_t cl_anglespeedkey;
 extern cvar_t cl_run;
 
 extern cvar_t cl_shownet;
+extern cvar_t cl_democompress;
 extern cvar_t cl_sbar;
 extern cvar_t cl_hudswap;
 
@@ -427,6 +441,7 @@ void CL_ReRecord_f(void);
 
 void CL_PlayDemo_f(void);
 void CL_TimeDemo_f(void);
+void CL_DemoSeek_f(void);
 struct stree_root *CL_Demo_Arg_f(const char *arg);
 
 //
@@ -438,6 +453,8 @@ extern int packet_latency[NET_TIMINGS];
 int CL_CalcNet(void);
 void CL_ParseServerMessage(void);
 qboolean CL_CheckOrDownloadFile(char *filename);
+void CL_CloseDownload(void);
+void CL_WriteDownloadAcks(sizebuf_t *buf);
 qboolean CL_IsUploading(void);
 void CL_NextUpload(void);
 void CL_StartUpload(byte *data, int size);
@@ -479,6 +496,7 @@ void CL_ParsePlayerinfo(void);
 //
 void CL_InitPrediction(void);
 void CL_PredictMove(physent_stack_t *pestack);
+void CL_ResetPrediction(void);
 void CL_PredictUsercmd(const player_state_t *from, player_state_t *to,
 		       const usercmd_t *cmd, const physent_stack_t *pestack,
 		       qboolean spectator);
@@ -525,6 +543,8 @@ byte *Skin_Cache(skin_t * skin);
 void Skin_Skins_f(void);
 void Skin_AllSkins_f(void);
 void Skin_NextDownload(void);
+void Skin_Poll(void);
+void Skin_Shutdown(void);
 
 #define RSSHOT_WIDTH 320
 #define RSSHOT_HEIGHT 200
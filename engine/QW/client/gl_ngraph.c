@@ -118,6 +118,7 @@ R_NetGraph(void)
     Draw_String(8, y, st);
     y += 8;
 
+    Draw_FlushBatch();
     GL_Bind(netgraphtexture);
 
     glTexImage2D(GL_TEXTURE_2D, 0, gl_alpha_format,
@@ -46,11 +46,23 @@ extern cvar_t hostname;
 
 extern int net_socket;
 
+/* everything read from and handed to the socket, for sv_metrics */
+typedef struct {
+    unsigned long long packets_in, bytes_in;
+    unsigned long long packets_out, bytes_out;
+} netstats_t;
+
+extern netstats_t net_stats;
+
 void NET_Init(int port);
 void NET_Shutdown(void);
 qboolean NET_GetPacket(void);
 void NET_SendPacket(int length, void *data, netadr_t to);
 
+/* Sends in between are queued up and sent together when flushed */
+void NET_BeginPackets(void);
+void NET_FlushPackets(void);
+
 qboolean NET_CompareAdr(netadr_t a, netadr_t b);
 qboolean NET_CompareBaseAdr(netadr_t a, netadr_t b);
 const char *NET_AdrToString(netadr_t a);
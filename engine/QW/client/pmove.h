@@ -54,6 +54,9 @@ typedef struct {
 
     // input
     const usercmd_t *cmd;
+    float maxspeed;		// the player's own, not the ones in movevars
+    float entgravity;
+    float frametime;		// set by PlayerMove, from the command
 
     // results
 #ifdef SERVERONLY
@@ -135,6 +135,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define svc_serverinfo		52	// serverinfo
 #define svc_updatepl		53	// [byte] [byte]
 
+/*
+ * An svc_download size below zero isn't a block of the file.  -1 means the
+ * file isn't there.  A client that asks for "download <name> chunked" is
+ * sent DL_CHUNKED [byte] serial [long] filesize, reliably, then the file in
+ * DOWNLOAD_CHUNK pieces as DL_CHUNK [byte] serial [long] chunk [short]
+ * length [length bytes], unreliably and in any order.  It acks each piece
+ * with a "dlack <serial> <chunk>..." command and sends "stopdl" when it has
+ * them all.
+ */
+#define DL_CHUNKED		-2
+#define DL_CHUNK		-3
+#define DOWNLOAD_CHUNK		512
+
 
 //==============================================
 
@@ -208,6 +221,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // a sound with no channel is a local only sound
 // the sound field has bits 0-2: channel, 3-12: entity
+#define	MAX_NET_EDICTS	1024	// most edicts sounds can be sent from
 #define	SND_VOLUME	(1<<15)	// a byte
 #define	SND_ATTENUATION	(1<<14)	// a byte
 
@@ -282,4 +296,36 @@ typedef struct usercmd_s {
     byte impulse;
 } usercmd_t;
 
+/*
+==========================================================
+
+  SERVER DEMOS
+
+A server demo starts with MVD_MAGIC and a long MVD_VERSION, then holds
+blocks of [float time] [byte type] [long length] [length bytes]:
+
+mvd_signon	the messages a connecting client gets, starting with
+		svc_serverdata written for player 0
+mvd_baselines	[short entnum] and the body of an svc_spawnbaseline,
+		repeated, for every entity with a baseline
+mvd_all		messages that went to every client
+mvd_frame	[byte count] that many svc_playerinfo messages, as sent to
+		other players, with PF_WEAPONFRAME when it isn't 0
+		[byte count] that many [byte player] [long changed] with
+		a long for each bit set in changed, the player's stats
+		then every entity in the server's snapshot, coded as in
+		svc_deltapacketentities against the previous frame (new
+		ones against their baseline), ending with a short 0
+
+==========================================================
+*/
+
+#define MVD_MAGIC	"QWMV"
+#define MVD_VERSION	1
+
+#define mvd_signon	0
+#define mvd_baselines	1
+#define mvd_all		2
+#define mvd_frame	3
+
 #endif /* PROTOCOL_H */
@@ -18,6 +18,16 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "client.h"
 #include "console.h"
 #include "cmd.h"
@@ -34,6 +44,380 @@ static char allskins[128];
 static skin_t skins[MAX_CACHED_SKINS];
 static int numskins;
 
+/*
+==============================================================================
+
+SKIN LOADER
+
+Skins are read and decoded on a thread of their own, so a server full of
+new players doesn't stall the frame they join in.  The main thread finds
+where each skin's file is (only it may walk the search path) and queues the
+pak or loose file, offset and length; the loader reads and decodes the PCX
+into a buffer of its own and marks the job done.  Skin_Poll hands finished
+skins over each frame.  Until then Skin_Cache returns NULL, and the player
+is drawn with the model's own skin.
+
+The jobs are done in the order queued, so those between head and loaded
+are finished and those between loaded and tail are waiting.  A skin that's
+flushed while its job is out has its request cleared, and whatever the job
+brings back is thrown away.
+
+==============================================================================
+*/
+
+#define SKIN_QUEUE	64
+#define SKIN_WIDTH	320
+#define SKIN_HEIGHT	200
+
+typedef enum {
+    skinload_ok,
+    skinload_unreadable,
+    skinload_bad,
+    skinload_malformed
+} skinload_t;
+
+typedef struct {
+    skin_t *skin;
+    unsigned request;
+    char name[MAX_QPATH];	// as found, for messages
+    char path[MAX_OSPATH];
+    size_t offset;
+    size_t length;		// 0 is up to the end of the file
+    byte *pixels;		// set by the loader if it worked
+    skinload_t result;
+} skinjob_t;
+
+static struct {
+    qboolean started;
+    qboolean quit;
+    skinjob_t queue[SKIN_QUEUE];
+    int head, loaded, tail;
+    unsigned requests;
+    unsigned serials;
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} skinloader;
+
+#ifdef _WIN32
+#define SKIN_Lock()	EnterCriticalSection(&skinloader.lock)
+#define SKIN_Unlock()	LeaveCriticalSection(&skinloader.lock)
+#define SKIN_Wait()	SleepConditionVariableCS(&skinloader.changed, &skinloader.lock, INFINITE)
+#define SKIN_Signal()	WakeAllConditionVariable(&skinloader.changed)
+#else
+#define SKIN_Lock()	pthread_mutex_lock(&skinloader.lock)
+#define SKIN_Unlock()	pthread_mutex_unlock(&skinloader.lock)
+#define SKIN_Wait()	pthread_cond_wait(&skinloader.changed, &skinloader.lock)
+#define SKIN_Signal()	pthread_cond_broadcast(&skinloader.changed)
+#endif
+
+static skinload_t
+Skin_Decode(const byte *data, size_t size, byte *out)
+{
+    const pcx_t *pcx = (const pcx_t *)data;
+    const byte *raw, *end;
+    byte *pix;
+    int x, y;
+    int dataByte;
+    int runLength;
+
+    if (size < sizeof(*pcx)
+	|| pcx->manufacturer != 0x0a
+	|| pcx->version != 5
+	|| pcx->encoding != 1
+	|| pcx->bits_per_pixel != 8 || pcx->xmax >= 320 || pcx->ymax >= 200)
+	return skinload_bad;
+
+    raw = &pcx->data;
+    end = data + size;
+    pix = out;
+    memset(out, 0, SKIN_WIDTH * SKIN_HEIGHT);
+
+    for (y = 0; y < pcx->ymax; y++, pix += SKIN_WIDTH) {
+	for (x = 0; x <= pcx->xmax;) {
+	    if (raw >= end)
+		return skinload_malformed;
+
+	    dataByte = *raw++;
+
+	    if ((dataByte & 0xC0) == 0xC0) {
+		runLength = dataByte & 0x3F;
+		if (raw >= end)
+		    return skinload_malformed;
+
+		dataByte = *raw++;
+	    } else
+		runLength = 1;
+
+	    // skin sanity check
+	    if (runLength + x > pcx->xmax + 2)
+		return skinload_malformed;
+
+	    while (runLength-- > 0)
+		pix[x++] = dataByte;
+	}
+
+    }
+
+    return skinload_ok;
+}
+
+static void
+Skin_Load(skinjob_t *job)
+{
+    byte *data;
+    size_t size;
+    long end;
+    FILE *f;
+
+    job->pixels = NULL;
+    job->result = skinload_unreadable;
+
+    f = fopen(job->path, "rb");
+    if (!f)
+	return;
+    size = job->length;
+    if (!size && !fseek(f, 0, SEEK_END)) {
+	end = ftell(f);
+	size = end > 0 ? end : 0;
+    }
+    data = size ? malloc(size) : NULL;
+    if (!data || fseek(f, job->offset, SEEK_SET)
+	|| fread(data, 1, size, f) != size) {
+	free(data);
+	fclose(f);
+	return;
+    }
+    fclose(f);
+
+    job->pixels = malloc(SKIN_WIDTH * SKIN_HEIGHT);
+    if (job->pixels) {
+	job->result = Skin_Decode(data, size, job->pixels);
+	if (job->result != skinload_ok) {
+	    free(job->pixels);
+	    job->pixels = NULL;
+	}
+    }
+    free(data);
+}
+
+static void
+Skin_RunLoader(void)
+{
+    skinjob_t *job;
+
+    SKIN_Lock();
+    for (;;) {
+	if (skinloader.quit)
+	    break;
+	if (skinloader.loaded == skinloader.tail) {
+	    SKIN_Wait();
+	    continue;
+	}
+	job = &skinloader.queue[skinloader.loaded];
+	SKIN_Unlock();
+
+	/* the main thread leaves queued jobs alone, so no need to lock */
+	Skin_Load(job);
+
+	SKIN_Lock();
+	skinloader.loaded = (skinloader.loaded + 1) % SKIN_QUEUE;
+    }
+    SKIN_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+Skin_LoaderMain(LPVOID arg)
+{
+    Skin_RunLoader();
+    return 0;
+}
+#else
+static void *
+Skin_LoaderMain(void *arg)
+{
+    Skin_RunLoader();
+    return NULL;
+}
+#endif
+
+static qboolean
+Skin_StartLoader(void)
+{
+    static qboolean failed;
+
+    if (skinloader.started)
+	return true;
+    if (failed)
+	return false;
+
+    skinloader.quit = false;
+    skinloader.head = skinloader.loaded = skinloader.tail = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&skinloader.lock);
+    InitializeConditionVariable(&skinloader.changed);
+    skinloader.thread = CreateThread(NULL, 0, Skin_LoaderMain, NULL, 0, NULL);
+    skinloader.started = skinloader.thread != NULL;
+#else
+    pthread_mutex_init(&skinloader.lock, NULL);
+    pthread_cond_init(&skinloader.changed, NULL);
+    skinloader.started =
+	!pthread_create(&skinloader.thread, NULL, Skin_LoaderMain, NULL);
+#endif
+    failed = !skinloader.started;
+
+    return skinloader.started;
+}
+
+/* hand a finished job's pixels to its skin, if it still wants them */
+static void
+Skin_Finish(skinjob_t *job)
+{
+    skin_t *skin = job->skin;
+#ifdef GLQUAKE
+    int i;
+#endif
+
+    if (skin->request != job->request) {
+	free(job->pixels);
+	return;
+    }
+    skin->request = 0;
+
+    switch (job->result) {
+    case skinload_ok:
+	skin->pixels = job->pixels;
+	skin->serial = ++skinloader.serials;
+#ifdef GLQUAKE
+	/* have the player textures translated again, now there's a skin */
+	for (i = 0; i < MAX_CLIENTS; i++)
+	    if (cl.players[i].skin == skin)
+		cl.players[i].skin = NULL;
+#endif
+	return;
+    case skinload_unreadable:
+	Con_Printf("Couldn't read skin %s\n", job->name);
+	break;
+    case skinload_bad:
+	Con_Printf("Bad skin %s\n", job->name);
+	break;
+    case skinload_malformed:
+	Con_Printf("Skin %s was malformed.  You should delete it.\n",
+		   job->name);
+	break;
+    }
+    skin->failedload = true;
+}
+
+/*
+================
+Skin_Queue
+
+Finds the skin's file and starts it loading.  Loads it straight away if
+there's no loader thread; if the queue is full, leaves it for another try.
+================
+*/
+static void
+Skin_Queue(skin_t *skin)
+{
+    skinjob_t *job, now;
+    int next = 0;
+
+    if (skinloader.started || Skin_StartLoader()) {
+	next = (skinloader.tail + 1) % SKIN_QUEUE;
+	if (next == skinloader.head)
+	    return;
+	job = &skinloader.queue[skinloader.tail];
+    } else {
+	job = &now;
+    }
+
+    snprintf(job->name, sizeof(job->name), "skins/%s.pcx", skin->name);
+    if (!COM_FindFile(job->name, job->path, sizeof(job->path),
+		      &job->offset, &job->length)) {
+	Con_Printf("Couldn't load skin %s\n", job->name);
+	snprintf(job->name, sizeof(job->name), "skins/%s.pcx",
+		 baseskin.string);
+	if (!COM_FindFile(job->name, job->path, sizeof(job->path),
+			  &job->offset, &job->length)) {
+	    skin->failedload = true;
+	    return;
+	}
+    }
+    job->skin = skin;
+    job->request = ++skinloader.requests;
+    if (!job->request)
+	job->request = ++skinloader.requests;
+    skin->request = job->request;
+
+    if (job == &now) {
+	Skin_Load(job);
+	Skin_Finish(job);
+	return;
+    }
+
+    SKIN_Lock();
+    skinloader.tail = next;
+    SKIN_Signal();
+    SKIN_Unlock();
+}
+
+/*
+================
+Skin_Poll
+
+Takes in the skins the loader has finished
+================
+*/
+void
+Skin_Poll(void)
+{
+    int loaded;
+
+    if (!skinloader.started)
+	return;
+
+    SKIN_Lock();
+    loaded = skinloader.loaded;
+    SKIN_Unlock();
+
+    while (skinloader.head != loaded) {
+	Skin_Finish(&skinloader.queue[skinloader.head]);
+	skinloader.head = (skinloader.head + 1) % SKIN_QUEUE;
+    }
+}
+
+/*
+================
+Skin_Shutdown
+================
+*/
+void
+Skin_Shutdown(void)
+{
+    if (!skinloader.started)
+	return;
+
+    SKIN_Lock();
+    skinloader.quit = true;
+    SKIN_Signal();
+    SKIN_Unlock();
+#ifdef _WIN32
+    WaitForSingleObject(skinloader.thread, INFINITE);
+    CloseHandle(skinloader.thread);
+#else
+    pthread_join(skinloader.thread, NULL);
+#endif
+    skinloader.started = false;
+}
+
 /*
 ================
 Skin_Find
@@ -88,101 +472,28 @@ Skin_Find(player_info_t *player)
 ==========
 Skin_Cache
 
-Returns a pointer to the skin bitmap, or NULL to use the default
+Returns a pointer to the skin bitmap, or NULL to use the default.  A skin
+not loaded yet is started loading, and is NULL until it's ready.
 ==========
 */
 byte *
 Skin_Cache(skin_t * skin)
 {
-    char name[MAX_QPATH];
-    byte *raw, *out, *pix;
-    pcx_t *pcx;
-    int x, y;
-    int dataByte;
-    int runLength;
-
     if (cls.downloadtype == dl_skin)
 	return NULL;		// use base until downloaded
 
     if (noskins.value == 1)	// JACK: So NOSKINS > 1 will show skins, but
 	return NULL;		// not download new ones.
 
+    if (skin->pixels)
+	return skin->pixels;
     if (skin->failedload)
 	return NULL;
 
-    out = Cache_Check(&skin->cache);
-    if (out)
-	return out;
-
-//
-// load the pic from disk
-//
-    snprintf(name, sizeof(name), "skins/%s.pcx", skin->name);
-    pcx = COM_LoadTempFile(name);
-    if (!pcx) {
-	Con_Printf("Couldn't load skin %s\n", name);
-	snprintf(name, sizeof(name), "skins/%s.pcx", baseskin.string);
-	pcx = COM_LoadTempFile(name);
-	if (!pcx)
-	    goto Fail;
-    }
-//
-// parse the PCX file
-//
-    if (pcx->manufacturer != 0x0a
-	|| pcx->version != 5
-	|| pcx->encoding != 1
-	|| pcx->bits_per_pixel != 8 || pcx->xmax >= 320 || pcx->ymax >= 200) {
-	Con_Printf("Bad skin %s\n", name);
-	goto Fail;
-    }
-
-    out = Cache_Alloc(&skin->cache, 320 * 200, skin->name);
-    if (!out)
-	Sys_Error("Skin_Cache: couldn't allocate");
+    if (!skin->request)
+	Skin_Queue(skin);
 
-    raw = &pcx->data;
-    pix = out;
-    memset(out, 0, 320 * 200);
-
-    for (y = 0; y < pcx->ymax; y++, pix += 320) {
-	for (x = 0; x <= pcx->xmax;) {
-	    if (raw - (byte *)pcx > com_filesize)
-		goto Fail_Malformed;
-
-	    dataByte = *raw++;
-
-	    if ((dataByte & 0xC0) == 0xC0) {
-		runLength = dataByte & 0x3F;
-		if (raw - (byte *)pcx > com_filesize)
-		    goto Fail_Malformed;
-
-		dataByte = *raw++;
-	    } else
-		runLength = 1;
-
-	    // skin sanity check
-	    if (runLength + x > pcx->xmax + 2)
-		goto Fail_Malformed;
-
-	    while (runLength-- > 0)
-		pix[x++] = dataByte;
-	}
-
-    }
-
-    if (raw - (byte *)pcx > com_filesize)
-	goto Fail_Malformed;
-
-    skin->failedload = false;
-    return out;
-
- Fail_Malformed:
-    Con_Printf("Skin %s was malformed.  You should delete it.\n", name);
-    Cache_Free(&skin->cache);
- Fail:
-    skin->failedload = true;
-    return NULL;
+    return skin->pixels;
 }
 
 
@@ -245,9 +556,11 @@ Skin_Skins_f(void)
 {
     int i;
 
+    /* whatever the loader brings back for these gets thrown away */
     for (i = 0; i < numskins; i++) {
-	if (skins[i].cache.data)
-	    Cache_Free(&skins[i].cache);
+	free(skins[i].pixels);
+	skins[i].pixels = NULL;
+	skins[i].request = 0;
     }
     numskins = 0;
 
@@ -22,9 +22,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.h"
 #include "cmd.h"
 #include "draw.h"
+#include "fisheye.h"
 #include "pmove.h"
 #include "quakedef.h"
 #include "screen.h"
+#include "trace.h"
 #include "view.h"
 
 /*
@@ -322,15 +324,13 @@ V_ParseDamage(void)
 {
     int armor, blood;
     vec3_t from;
-    int i;
     vec3_t forward, right, up;
     float side;
     float count;
 
     armor = MSG_ReadByte();
     blood = MSG_ReadByte();
-    for (i = 0; i < 3; i++)
-	from[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(from);
 
     count = blood * 0.5 + armor * 0.5;
     if (count < 10)
@@ -936,8 +936,15 @@ V_RenderView(void)
 	V_CalcRefdef();
     }
 
-    R_PushDlights();
-    R_RenderView();
+    if (fisheye_enabled) {
+        TR_Begin("F_RenderView");
+        F_RenderView();
+        TR_End("F_RenderView");
+    }
+    else {
+        R_PushDlights();
+        R_RenderView();
+    }
 
 #ifndef GLQUAKE
     if (crosshair.value)
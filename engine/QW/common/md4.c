@@ -95,8 +95,9 @@ static unsigned char PADDING[64] = {
 };
 
 /* F, G and H are basic MD4 functions. */
-#define F(x, y, z) (((x) & (y)) | ((~x) & (z)))
-#define G(x, y, z) (((x) & (y)) | ((x) & (z)) | ((y) & (z)))
+/* (F and G rewritten as a select and a majority with fewer operations) */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
 #define H(x, y, z) ((x) ^ (y) ^ (z))
 
 /* ROTATE_LEFT rotates x left n bits. */
@@ -253,8 +254,7 @@ MD4Transform(UINT4 state[4], unsigned char block[64])
     state[2] += c;
     state[3] += d;
 
-    /* Zeroize sensitive information. */
-    memset((POINTER) x, 0, sizeof(x));
+    /* (no zeroizing, only checksums of game data pass through here) */
 }
 
 
@@ -277,12 +277,17 @@ Encode(unsigned char *output, UINT4 * input, unsigned int len)
 static void
 Decode(UINT4 * output, unsigned char *input, unsigned int len)
 {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* the words are already in order, only maybe unaligned */
+    memcpy(output, input, len);
+#else
     unsigned int i, j;
 
     for (i = 0, j = 0; j < len; i++, j += 4)
 	output[i] =
 	    ((UINT4) input[j]) | (((UINT4) input[j + 1]) << 8) |
 	    (((UINT4) input[j + 2]) << 16) | (((UINT4) input[j + 3]) << 24);
+#endif
 }
 
 //===================================================================
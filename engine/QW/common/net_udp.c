@@ -18,6 +18,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE		/* for recvmmsg and sendmmsg */
+#define NET_BATCHED
+#endif
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -39,10 +44,32 @@ netadr_t net_local_adr;
 netadr_t net_from;
 sizebuf_t net_message;
 int net_socket;
+netstats_t net_stats;
 
 #define	MAX_UDP_PACKET	8192
 static byte net_message_buffer[MAX_UDP_PACKET];
 
+#ifdef NET_BATCHED
+/*
+ * Packets are read in batches with recvmmsg and handed out from the batch
+ * one at a time.  Between NET_BeginPackets and NET_FlushPackets, sends are
+ * queued up and go out together with sendmmsg.
+ */
+#define NET_BATCH 32
+
+typedef struct {
+    int count, next;
+    struct mmsghdr msgs[NET_BATCH];
+    struct iovec iovecs[NET_BATCH];
+    struct sockaddr_in addrs[NET_BATCH];
+    byte data[NET_BATCH][MAX_UDP_PACKET];
+} netbatch_t;
+
+static netbatch_t net_recv;
+static netbatch_t net_send;
+static qboolean net_queueing;
+#endif
+
 
 static void
 NetadrToSockadr(netadr_t *a, struct sockaddr_in *s)
@@ -141,6 +168,107 @@ NET_StringToAdr(const char *s, netadr_t *a)
 }
 
 
+#ifdef NET_BATCHED
+static qboolean
+NET_ReadBatch(void)
+{
+    int i, ret;
+
+    for (i = 0; i < NET_BATCH; i++) {
+	net_recv.iovecs[i].iov_base = net_recv.data[i];
+	net_recv.iovecs[i].iov_len = MAX_UDP_PACKET;
+	memset(&net_recv.msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+	net_recv.msgs[i].msg_hdr.msg_name = &net_recv.addrs[i];
+	net_recv.msgs[i].msg_hdr.msg_namelen = sizeof(net_recv.addrs[i]);
+	net_recv.msgs[i].msg_hdr.msg_iov = &net_recv.iovecs[i];
+	net_recv.msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    net_recv.count = net_recv.next = 0;
+    ret = recvmmsg(net_socket, net_recv.msgs, NET_BATCH, 0, NULL);
+    if (ret == -1) {
+	if (errno == EWOULDBLOCK)
+	    return false;
+	if (errno == ECONNREFUSED)
+	    return false;
+	Sys_Printf("%s: %s\n", __func__, strerror(errno));
+	return false;
+    }
+    net_recv.count = ret;
+
+    return ret > 0;
+}
+
+qboolean
+NET_GetPacket(void)
+{
+    int i;
+
+    if (net_recv.next == net_recv.count && !NET_ReadBatch())
+	return false;
+
+    i = net_recv.next++;
+    net_message.data = net_recv.data[i];
+    net_message.cursize = net_recv.msgs[i].msg_len;
+    SockadrToNetadr(&net_recv.addrs[i], &net_from);
+    net_stats.packets_in++;
+    net_stats.bytes_in += net_message.cursize;
+
+    return net_message.cursize;
+}
+
+void
+NET_BeginPackets(void)
+{
+    net_queueing = true;
+}
+
+void
+NET_FlushPackets(void)
+{
+    int sent, ret;
+
+    net_queueing = false;
+
+    sent = 0;
+    while (sent < net_send.count) {
+	ret = sendmmsg(net_socket, net_send.msgs + sent,
+		       net_send.count - sent, 0);
+	if (ret == -1) {
+	    if (errno != EWOULDBLOCK && errno != ECONNREFUSED)
+		Sys_Printf("%s: %s\n", __func__, strerror(errno));
+	    ret = 1;		// drop the packet it stopped at
+	}
+	sent += ret;
+    }
+    net_send.count = 0;
+}
+
+static void
+NET_QueuePacket(int length, const void *data, netadr_t to)
+{
+    struct mmsghdr *msg;
+    int i;
+
+    if (net_send.count == NET_BATCH) {
+	NET_FlushPackets();
+	net_queueing = true;
+    }
+
+    i = net_send.count++;
+    memcpy(net_send.data[i], data, length);
+    net_send.iovecs[i].iov_base = net_send.data[i];
+    net_send.iovecs[i].iov_len = length;
+    NetadrToSockadr(&to, &net_send.addrs[i]);
+
+    msg = &net_send.msgs[i];
+    memset(&msg->msg_hdr, 0, sizeof(msg->msg_hdr));
+    msg->msg_hdr.msg_name = &net_send.addrs[i];
+    msg->msg_hdr.msg_namelen = sizeof(net_send.addrs[i]);
+    msg->msg_hdr.msg_iov = &net_send.iovecs[i];
+    msg->msg_hdr.msg_iovlen = 1;
+}
+#else
 qboolean
 NET_GetPacket(void)
 {
@@ -163,10 +291,16 @@ NET_GetPacket(void)
 
     net_message.cursize = ret;
     SockadrToNetadr(&from, &net_from);
+    net_stats.packets_in++;
+    net_stats.bytes_in += ret;
 
     return ret;
 }
 
+void NET_BeginPackets(void) { }
+void NET_FlushPackets(void) { }
+#endif /* NET_BATCHED */
+
 
 void
 NET_SendPacket(int length, void *data, netadr_t to)
@@ -174,6 +308,16 @@ NET_SendPacket(int length, void *data, netadr_t to)
     int ret;
     struct sockaddr_in addr;
 
+    net_stats.packets_out++;
+    net_stats.bytes_out += length;
+
+#ifdef NET_BATCHED
+    if (net_queueing && length <= MAX_UDP_PACKET) {
+	NET_QueuePacket(length, data, to);
+	return;
+    }
+#endif
+
     NetadrToSockadr(&to, &addr);
 
     ret = sendto(net_socket, data, length, 0, (struct sockaddr *)&addr,
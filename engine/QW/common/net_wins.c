@@ -30,6 +30,7 @@ netadr_t net_local_adr;
 netadr_t net_from;
 sizebuf_t net_message;
 int net_socket;
+netstats_t net_stats;
 
 #define	MAX_UDP_PACKET	(MAX_MSGLEN*2)	/* one more than msg + header */
 static byte net_message_buffer[MAX_UDP_PACKET];
@@ -167,6 +168,8 @@ NET_GetPacket(void)
     }
 
     net_message.cursize = ret;
+    net_stats.packets_in++;
+    net_stats.bytes_in += ret;
     if (ret == sizeof(net_message_buffer)) {
 	Con_Printf("Oversize packet from %s\n", NET_AdrToString(net_from));
 	return false;
@@ -176,12 +179,18 @@ NET_GetPacket(void)
 }
 
 
+/* Sends aren't batched here */
+void NET_BeginPackets(void) { }
+void NET_FlushPackets(void) { }
+
 void
 NET_SendPacket(int length, void *data, netadr_t to)
 {
     int ret;
     struct sockaddr_in addr;
 
+    net_stats.packets_out++;
+    net_stats.bytes_out += length;
     NetadrToSockadr(&to, &addr);
 
     ret =
@@ -28,8 +28,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 movevars_t movevars;
 
-static float frametime;
-
 const vec3_t player_mins = { -16, -16, -24 };
 const vec3_t player_maxs = { 16, 16, 32 };
 
@@ -121,7 +119,7 @@ PM_FlyMove(playermove_t *pmove, const physent_stack_t *pestack)
     VectorCopy(pmove->velocity, primal_velocity);
     numplanes = 0;
 
-    time_left = frametime;
+    time_left = pmove->frametime;
 
     for (bumpcount = 0; bumpcount < numbumps; bumpcount++) {
 	for (i = 0; i < 3; i++)
@@ -234,8 +232,8 @@ PM_GroundMove(playermove_t *pmove, const physent_stack_t *pestack)
 	return;
 
     // first try just moving to the destination
-    dest[0] = pmove->origin[0] + pmove->velocity[0] * frametime;
-    dest[1] = pmove->origin[1] + pmove->velocity[1] * frametime;
+    dest[0] = pmove->origin[0] + pmove->velocity[0] * pmove->frametime;
+    dest[1] = pmove->origin[1] + pmove->velocity[1] * pmove->frametime;
     dest[2] = pmove->origin[2];
 
     // first try moving directly to the next spot
@@ -346,11 +344,12 @@ PM_Friction(playermove_t *pmove, const physent_stack_t *pestack)
 
     if (pmove->waterlevel >= 2) {
 	/* apply water friction */
-	drop += speed * movevars.waterfriction * pmove->waterlevel * frametime;
+	drop += speed * movevars.waterfriction * pmove->waterlevel
+	    * pmove->frametime;
     } else if (pmove->onground) {
 	/* apply ground friction */
 	control = speed < movevars.stopspeed ? movevars.stopspeed : speed;
-	drop += control * friction * frametime;
+	drop += control * friction * pmove->frametime;
     }
 
     /* scale the velocity */
@@ -385,7 +384,7 @@ PM_Accelerate(playermove_t *pmove, vec3_t wishdir, float wishspeed, float accel)
     addspeed = wishspeed - currentspeed;
     if (addspeed <= 0)
 	return;
-    accelspeed = accel * frametime * wishspeed;
+    accelspeed = accel * pmove->frametime * wishspeed;
     if (accelspeed > addspeed)
 	accelspeed = addspeed;
 
@@ -411,7 +410,7 @@ PM_AirAccelerate(playermove_t *pmove, vec3_t wishdir, float wishspeed,
     addspeed = wishspd - currentspeed;
     if (addspeed <= 0)
 	return;
-    accelspeed = accel * wishspeed * frametime;
+    accelspeed = accel * wishspeed * pmove->frametime;
     if (accelspeed > addspeed)
 	accelspeed = addspeed;
 
@@ -451,9 +450,9 @@ PM_WaterMove(playermove_t *pmove, const physent_stack_t *pestack)
     VectorCopy(wishvel, wishdir);
     wishspeed = VectorNormalize(wishdir);
 
-    if (wishspeed > movevars.maxspeed) {
-	VectorScale(wishvel, movevars.maxspeed / wishspeed, wishvel);
-	wishspeed = movevars.maxspeed;
+    if (wishspeed > pmove->maxspeed) {
+	VectorScale(wishvel, pmove->maxspeed / wishspeed, wishvel);
+	wishspeed = pmove->maxspeed;
     }
     wishspeed *= 0.7;
 
@@ -465,7 +464,7 @@ PM_WaterMove(playermove_t *pmove, const physent_stack_t *pestack)
     /*
      * assume it is a stair or a slope, so press down from stepheight above
      */
-    VectorMA(pmove->origin, frametime, pmove->velocity, dest);
+    VectorMA(pmove->origin, pmove->frametime, pmove->velocity, dest);
     VectorCopy(dest, start);
     start[2] += STEPSIZE + 1;
     PM_PlayerMove(start, dest, pestack, &trace);
@@ -513,16 +512,16 @@ PM_AirMove(playermove_t *pmove, const physent_stack_t *pestack)
     /*
      * clamp to server defined max speed
      */
-    if (wishspeed > movevars.maxspeed) {
-	VectorScale(wishvel, movevars.maxspeed / wishspeed, wishvel);
-	wishspeed = movevars.maxspeed;
+    if (wishspeed > pmove->maxspeed) {
+	VectorScale(wishvel, pmove->maxspeed / wishspeed, wishvel);
+	wishspeed = pmove->maxspeed;
     }
 
     if (pmove->onground) {
 	pmove->velocity[2] = 0;
 	PM_Accelerate(pmove, wishdir, wishspeed, movevars.accelerate);
 	pmove->velocity[2] -=
-	    movevars.entgravity * movevars.gravity * frametime;
+	    pmove->entgravity * movevars.gravity * pmove->frametime;
 	PM_GroundMove(pmove, pestack);
     } else {
 	/* not on ground, so little effect on velocity */
@@ -530,7 +529,7 @@ PM_AirMove(playermove_t *pmove, const physent_stack_t *pestack)
 
 	/* add gravity */
 	pmove->velocity[2] -=
-	    movevars.entgravity * movevars.gravity * frametime;
+	    pmove->entgravity * movevars.gravity * pmove->frametime;
 
 	PM_FlyMove(pmove, pestack);
     }
@@ -618,7 +617,7 @@ JumpButton(playermove_t *pmove)
     }
 
     if (pmove->waterjumptime) {
-	pmove->waterjumptime -= frametime;
+	pmove->waterjumptime -= pmove->frametime;
 	if (pmove->waterjumptime < 0)
 	    pmove->waterjumptime = 0;
 	return;
@@ -760,7 +759,7 @@ SpectatorMove(playermove_t *pmove)
 
 	friction = movevars.friction * 1.5;	/* extra friction */
 	control = speed < movevars.stopspeed ? movevars.stopspeed : speed;
-	drop += control * friction * frametime;
+	drop += control * friction * pmove->frametime;
 
 	/* scale the velocity */
 	newspeed = speed - drop;
@@ -795,14 +794,14 @@ SpectatorMove(playermove_t *pmove)
     addspeed = wishspeed - currentspeed;
     if (addspeed <= 0)
 	return;
-    accelspeed = movevars.accelerate * frametime * wishspeed;
+    accelspeed = movevars.accelerate * pmove->frametime * wishspeed;
     if (accelspeed > addspeed)
 	accelspeed = addspeed;
 
     VectorMA(pmove->velocity, accelspeed, wishdir, pmove->velocity);
 
     /* Move */
-    VectorMA(pmove->origin, frametime, pmove->velocity, pmove->origin);
+    VectorMA(pmove->origin, pmove->frametime, pmove->velocity, pmove->origin);
 }
 
 /*
@@ -818,7 +817,7 @@ were contacted during the move.
 void
 PlayerMove(playermove_t *pmove, const physent_stack_t *pestack)
 {
-    frametime = pmove->cmd->msec * 0.001;
+    pmove->frametime = pmove->cmd->msec * 0.001;
 #ifdef SERVERONLY
     pmove->numtouch = 0;
 #endif
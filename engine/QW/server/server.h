@@ -22,9 +22,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define SERVER_SERVER_H
 
 #include "bothdefs.h"
+#include "conlog.h"
 #include "model.h"
 #include "net.h"
 #include "progs.h"
+#include "sys.h"
 
 // server.h
 
@@ -61,18 +63,23 @@ typedef struct {
 
     char name[64];		// map name
     char modelname[MAX_QPATH];	// maps/<name>.bsp, for model_precache[0]
+    eval_t *nextmap;		// progs global, to read the next map ahead
+    string_t nextmap_read;
     brushmodel_t *worldmodel;
     const char *model_precache[MAX_MODELS];	// NULL terminated
     const char *sound_precache[MAX_SOUNDS];	// NULL terminated
     const char *lightstyles[MAX_LIGHTSTYLES];
     model_t *models[MAX_MODELS];
 
-    int num_edicts;		// increases towards MAX_EDICTS
+    int num_edicts;		// increases towards max_edicts
+    int max_edicts;
     edict_t *edicts;		// can NOT be array indexed, because
     // edict_t is variable sized, but can
     // be used to reference the world ent
+    edhot_t *edhot;		// [max_edicts], see progs.h
 
     leafbits_t **pvs, **phs;	// fully expanded and decompressed
+    byte *phs_built;		// phs rows are only filled in when first used
 
     // added to every client's unreliable buffer each frame, then cleared
     sizebuf_t datagram;
@@ -146,6 +153,9 @@ typedef struct client_s {
     float entgravity;		// localized ent gravity
 
     edict_t *edict;		// EDICT_NUM(clientnum+1)
+    int leafspawn;		// svs.spawncount when leafnum was found
+    vec3_t leaforigin;		// edict origin leafnum was found for
+    int leafnum;		// pvs row of the edict's leaf, -1 for none
     char name[32];		// for printing to other people
     // extracted from userinfo
     int messagelevel;		// for filtering printed messages
@@ -174,10 +184,14 @@ typedef struct client_s {
 
 
     client_frame_t frames[UPDATE_BACKUP];	// updates can be deltad from here
+    double ent_senttime[MAX_NET_EDICTS];	// realtime each entity last went out
 
-    FILE *download;		// file being downloaded
+    FILE *download;		// file being downloaded, unless mapped
+    const byte *downloaddata;	// file being downloaded, if mapped
+    sys_mapping_t downloadmapping;
     int downloadsize;		// total bytes
     int downloadcount;		// bytes sent
+    struct chunkeddl_s *chunkeddl;	// pieces in flight, if chunked
 
     int spec_track;		// entnum of player tracking
 
@@ -194,6 +208,7 @@ typedef struct client_s {
 
 //===== NETWORK ============
     int chokecount;
+    int choketotal;		// frames choked since connecting
     int delta_sequence;		// -1 = no compression
     netchan_t netchan;
 } client_t;
@@ -320,6 +335,9 @@ typedef struct {
 //============================================================================
 
 extern cvar_t sv_maxvelocity;
+extern cvar_t sv_physthreads;
+extern cvar_t sv_touchstats;
+extern cvar_t sv_physentstats;
 extern cvar_t sv_gravity;
 extern cvar_t sv_aim;
 extern cvar_t sv_stopspeed;
@@ -349,6 +367,8 @@ extern cvar_t allow_download_sounds;
 extern cvar_t allow_download_maps;
 
 extern cvar_t sv_highchars;
+extern cvar_t sv_sendthreads;
+extern cvar_t sv_relayspectators;
 extern cvar_t sv_phs;
 
 extern server_static_t svs;	// persistant server info
@@ -357,7 +377,7 @@ extern server_t sv;		// local server
 extern char localinfo[MAX_LOCALINFO_STRING + 1];
 
 extern int host_hunklevel;
-extern FILE *sv_logfile;
+extern conlog_t *sv_logfile;
 extern FILE *sv_fraglogfile;
 
 extern int sv_nailmodel;
@@ -376,6 +396,7 @@ extern int file_from_pak;
 //
 void SV_Shutdown(void);
 void SV_Frame(float time);
+double SV_IdleTime(void);
 void SV_FinalMessage(const char *message);
 void SV_DropClient(client_t *drop);
 void SV_FullClientUpdateToClient(client_t *client, client_t *cl);
@@ -400,6 +421,7 @@ void SV_ExtractFromUserinfo(client_t *cl);
 //
 void SV_ModelInit(void);
 void SV_SpawnServer(const char *server);
+const leafbits_t *SV_LeafPHS(int leafnum);
 void SV_FlushSignon(void);
 
 
@@ -442,13 +464,50 @@ void SV_FindModelNumbers(void);
 // sv_user.c
 //
 void SV_ExecuteClientMessage(client_t *cl);
+void SV_RunQueuedMoves(void);
 void SV_UserInit(void);
+void SV_CloseDownload(client_t *client);
+void SV_WriteDownloadChunks(client_t *client, sizebuf_t *msg);
 void SV_TogglePause(const char *msg);
 
 //
 // sv_ents.c
 //
-void SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg);
+// because there can be a lot of nails, there is a special
+// network protocol for them
+#define	MAX_NAILS	32
+
+/*
+ * The snapshot entities visible from one PVS, which can be found once
+ * and shared by all the clients looking from the same place.
+ */
+typedef struct {
+    int numvisible;
+    short visible[MAX_NET_EDICTS];	// indices into the snapshot
+    int numnails;
+    edict_t *nails[MAX_NAILS];
+} entview_t;
+
+void SV_BuildEntitySnapshot(void);
+int SV_NumSnapshotEntities(void);
+const entity_state_t *SV_SnapshotEntity(int index);
+int SV_PlayerInfoFlags(const client_t *cl);
+void SV_WritePlayerInfo(const client_t *cl, int pflags, sizebuf_t *msg);
+void SV_WriteDelta(const entity_state_t *from, const entity_state_t *to,
+		   sizebuf_t *msg, qboolean force);
+void SV_FindVisibleEntities(const leafbits_t *pvs, entview_t *view);
+void SV_WriteEntitiesToClient(client_t *client, const leafbits_t *pvs,
+			      const entview_t *view, sizebuf_t *msg);
+
+//
+// sv_demo.c
+//
+void SV_DemoInit(void);
+void SV_DemoSignon(void);
+void SV_DemoWrite(const void *data, int length);
+void SV_DemoWriteString(int command, int c, const char *string);
+void SV_DemoFrame(void);
+void SV_DemoStop(void);
 
 //
 // sv_nchan.c
@@ -105,14 +105,14 @@ SV_Logfile_f(void)
 
     if (sv_logfile) {
 	Con_Printf("File logging off.\n");
-	fclose(sv_logfile);
+	Log_Close(sv_logfile);
 	sv_logfile = NULL;
 	return;
     }
 
     sprintf(name, "%s/qconsole.log", com_gamedir);
     Con_Printf("Logging text to %s.\n", name);
-    sv_logfile = fopen(name, "w");
+    sv_logfile = Log_Open(name, false);
     if (!sv_logfile)
 	Con_Printf("failed.\n");
 }
@@ -0,0 +1,454 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_demo.c -- server side demos of every player at once
+
+#include <string.h>
+
+#include "cmd.h"
+#include "console.h"
+#include "pmove.h"
+#include "qwsvdef.h"
+#include "server.h"
+
+/*
+==============================================================================
+
+SERVER DEMOS
+
+mvdrecord writes one demo of the whole game, without taking a client slot.
+Each frame adds the players, their stats and the entity snapshot the server
+already built for its clients, as one delta against the frame before, so
+recording costs the same however many people will watch it later.  Messages
+that went to every client are kept too.  The file goes out through the
+streamed writer, on a thread of its own.
+
+A demo holds every player's view; tyr-mvdpov picks one of them out into a
+.qwd the client can play (the format is described in protocol.h).
+
+==============================================================================
+*/
+
+#define DEMO_MAXENTS 512	// entity numbers an update can carry
+
+static struct {
+    qboolean recording;
+    sizebuf_t all;		// messages for everyone, not yet written
+    byte all_buf[MAX_MSGLEN - 8];
+    sizebuf_t frame;
+    byte frame_buf[0x10000];
+    int numstates;
+    entity_state_t states[DEMO_MAXENTS];	// as of the last frame
+    int stats[MAX_CLIENTS][MAX_CL_STATS];
+} demo;
+
+static void
+SV_DemoBlock(int type, const sizebuf_t *msg)
+{
+    union {
+	float f;
+	int l;
+    } time;
+    byte header[9], *p;
+
+    time.f = realtime;
+    p = MSG_PutLong(header, time.l);
+    p = MSG_PutByte(p, type);
+    MSG_PutLong(p, msg->cursize);
+    COM_StreamWrite(header, sizeof(header));
+    COM_StreamWrite(msg->data, msg->cursize);
+}
+
+static void
+SV_DemoFlushAll(void)
+{
+    if (demo.all.cursize) {
+	SV_DemoBlock(mvd_all, &demo.all);
+	SZ_Clear(&demo.all);
+    }
+}
+
+/*
+==================
+SV_DemoWrite
+
+Adds messages every client got to the demo
+==================
+*/
+void
+SV_DemoWrite(const void *data, int length)
+{
+    if (!demo.recording || length > demo.all.maxsize)
+	return;
+    if (demo.all.cursize + length > demo.all.maxsize)
+	SV_DemoFlushAll();
+    SZ_Write(&demo.all, data, length);
+}
+
+/* a print or a lightstyle, anything that's a byte and a string */
+void
+SV_DemoWriteString(int command, int c, const char *string)
+{
+    byte buf[MAX_MSGLEN - 8];
+    sizebuf_t msg;
+    int length;
+
+    if (!demo.recording)
+	return;
+
+    length = strlen(string);
+    if (3 + length > sizeof(buf))
+	return;
+    memset(&msg, 0, sizeof(msg));
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+    MSG_WriteByte(&msg, command);
+    MSG_WriteByte(&msg, c);
+    MSG_WriteString(&msg, string);
+    SV_DemoWrite(msg.data, msg.cursize);
+}
+
+static void
+SV_DemoFlushSignon(sizebuf_t *msg, int type, int room)
+{
+    if (msg->cursize && msg->cursize + room > msg->maxsize) {
+	SV_DemoBlock(type, msg);
+	SZ_Clear(msg);
+    }
+}
+
+/*
+==================
+SV_DemoSignon
+
+Everything a client gets connecting to the current map
+==================
+*/
+void
+SV_DemoSignon(void)
+{
+    byte buf[MAX_MSGLEN - 8];
+    sizebuf_t msg;
+    const char *gamedir;
+    const char **name;
+    const edict_t *ent;
+    client_t *cl;
+    int i, j;
+
+    if (!demo.recording)
+	return;
+
+    SV_DemoFlushAll();
+    memset(&msg, 0, sizeof(msg));
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+
+    gamedir = Info_ValueForKey(svs.info, "*gamedir");
+    if (!gamedir[0])
+	gamedir = "qw";
+
+    MSG_WriteByte(&msg, svc_serverdata);
+    MSG_WriteLong(&msg, PROTOCOL_VERSION);
+    MSG_WriteLong(&msg, svs.spawncount);
+    MSG_WriteString(&msg, gamedir);
+    MSG_WriteByte(&msg, 0);
+    MSG_WriteString(&msg, PR_GetString(sv.edicts->v.message));
+    MSG_WriteFloat(&msg, movevars.gravity);
+    MSG_WriteFloat(&msg, movevars.stopspeed);
+    MSG_WriteFloat(&msg, movevars.maxspeed);
+    MSG_WriteFloat(&msg, movevars.spectatormaxspeed);
+    MSG_WriteFloat(&msg, movevars.accelerate);
+    MSG_WriteFloat(&msg, movevars.airaccelerate);
+    MSG_WriteFloat(&msg, movevars.wateraccelerate);
+    MSG_WriteFloat(&msg, movevars.friction);
+    MSG_WriteFloat(&msg, movevars.waterfriction);
+    MSG_WriteFloat(&msg, movevars.entgravity);
+
+    MSG_WriteByte(&msg, svc_cdtrack);
+    MSG_WriteByte(&msg, sv.edicts->v.sounds);
+
+    MSG_WriteByte(&msg, svc_stufftext);
+    MSG_WriteStringf(&msg, "fullserverinfo \"%s\"\n", svs.info);
+    SV_DemoBlock(mvd_signon, &msg);
+    SZ_Clear(&msg);
+
+    /* the lists are split the way SV_Soundlist_f and SV_Modellist_f do */
+    MSG_WriteByte(&msg, svc_soundlist);
+    MSG_WriteByte(&msg, 0);
+    for (i = 0, name = sv.sound_precache + 1; *name; i++, name++) {
+	MSG_WriteString(&msg, *name);
+	if (msg.cursize >= MAX_MSGLEN / 2 && name[1]) {
+	    MSG_WriteByte(&msg, 0);
+	    MSG_WriteByte(&msg, i + 1);
+	    SV_DemoBlock(mvd_signon, &msg);
+	    SZ_Clear(&msg);
+	    MSG_WriteByte(&msg, svc_soundlist);
+	    MSG_WriteByte(&msg, i + 1);
+	}
+    }
+    MSG_WriteByte(&msg, 0);
+    MSG_WriteByte(&msg, 0);
+    SV_DemoBlock(mvd_signon, &msg);
+    SZ_Clear(&msg);
+
+    MSG_WriteByte(&msg, svc_modellist);
+    MSG_WriteByte(&msg, 0);
+    for (i = 0, name = sv.model_precache + 1; *name; i++, name++) {
+	MSG_WriteString(&msg, *name);
+	if (msg.cursize >= MAX_MSGLEN / 2 && name[1]) {
+	    MSG_WriteByte(&msg, 0);
+	    MSG_WriteByte(&msg, i + 1);
+	    SV_DemoBlock(mvd_signon, &msg);
+	    SZ_Clear(&msg);
+	    MSG_WriteByte(&msg, svc_modellist);
+	    MSG_WriteByte(&msg, i + 1);
+	}
+    }
+    MSG_WriteByte(&msg, 0);
+    MSG_WriteByte(&msg, 0);
+    SV_DemoBlock(mvd_signon, &msg);
+    SZ_Clear(&msg);
+
+    /* baselines, statics and static sounds, as a client would get them */
+    for (i = 0; i < sv.num_signon_buffers; i++) {
+	if (!sv.signon_buffer_size[i])
+	    continue;
+	msg.data = sv.signon_buffers[i];
+	msg.cursize = sv.signon_buffer_size[i];
+	SV_DemoBlock(mvd_signon, &msg);
+    }
+    msg.data = buf;
+    SZ_Clear(&msg);
+
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	SV_DemoFlushSignon(&msg, mvd_signon, 24 + MAX_INFO_STRING);
+	SV_FullClientUpdate(cl, &msg);
+    }
+    for (i = 0; i < MAX_LIGHTSTYLES; i++) {
+	SV_DemoFlushSignon(&msg, mvd_signon, 3 + MAX_STYLESTRING);
+	MSG_WriteByte(&msg, svc_lightstyle);
+	MSG_WriteByte(&msg, i);
+	MSG_WriteString(&msg, sv.lightstyles[i]);
+    }
+    SV_DemoFlushSignon(&msg, mvd_signon, 8);
+    MSG_WriteByte(&msg, svc_stufftext);
+    MSG_WriteString(&msg, "skins\n");
+    SV_DemoBlock(mvd_signon, &msg);
+    SZ_Clear(&msg);
+
+    /* the baselines again, for picking a view back out */
+    for (i = MAX_CLIENTS + 1; i < sv.num_edicts && i < DEMO_MAXENTS; i++) {
+	ent = EDICT_NUM(i);
+	if (!ent->baseline.modelindex)
+	    continue;
+	SV_DemoFlushSignon(&msg, mvd_baselines, 2 + 4 + 9);
+	MSG_WriteShort(&msg, i);
+	MSG_WriteByte(&msg, ent->baseline.modelindex);
+	MSG_WriteByte(&msg, ent->baseline.frame);
+	MSG_WriteByte(&msg, ent->baseline.colormap);
+	MSG_WriteByte(&msg, ent->baseline.skinnum);
+	for (j = 0; j < 3; j++) {
+	    MSG_WriteCoord(&msg, ent->baseline.origin[j]);
+	    MSG_WriteAngle(&msg, ent->baseline.angles[j]);
+	}
+    }
+    if (msg.cursize)
+	SV_DemoBlock(mvd_baselines, &msg);
+
+    demo.numstates = 0;
+    memset(demo.stats, 0, sizeof(demo.stats));
+}
+
+/*
+==================
+SV_DemoFrame
+
+Adds the players and the entity snapshot of this frame to the demo
+==================
+*/
+void
+SV_DemoFrame(void)
+{
+    sizebuf_t *msg = &demo.frame;
+    const entity_state_t *state;
+    client_t *cl;
+    unsigned changed;
+    int i, j, count, countpos;
+    int newindex, oldindex, newnum, oldnum, numnew;
+
+    if (!demo.recording || sv.state != ss_active)
+	return;
+
+    SV_DemoFlushAll();
+    SZ_Clear(msg);
+
+    countpos = msg->cursize;
+    MSG_WriteByte(msg, 0);
+    count = 0;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	if (cl->state != cs_spawned || cl->spectator)
+	    continue;
+	j = SV_PlayerInfoFlags(cl);
+	if (cl->edict->v.weaponframe)
+	    j |= PF_WEAPONFRAME;
+	SV_WritePlayerInfo(cl, j, msg);
+	count++;
+    }
+    msg->data[countpos] = count;
+
+    countpos = msg->cursize;
+    MSG_WriteByte(msg, 0);
+    count = 0;
+    for (i = 0, cl = svs.clients; i < MAX_CLIENTS; i++, cl++) {
+	if (cl->state != cs_spawned || cl->spectator)
+	    continue;
+	changed = 0;
+	for (j = 0; j < MAX_CL_STATS; j++)
+	    if (cl->stats[j] != demo.stats[i][j])
+		changed |= 1U << j;
+	if (!changed)
+	    continue;
+	MSG_WriteByte(msg, i);
+	MSG_WriteLong(msg, changed);
+	for (j = 0; j < MAX_CL_STATS; j++)
+	    if (changed & (1U << j)) {
+		MSG_WriteLong(msg, cl->stats[j]);
+		demo.stats[i][j] = cl->stats[j];
+	    }
+	count++;
+    }
+    msg->data[countpos] = count;
+
+    /* the snapshot is in entity order, like the states kept from before */
+    numnew = SV_NumSnapshotEntities();
+    for (i = 0; i < numnew; i++)
+	if (SV_SnapshotEntity(i)->number >= DEMO_MAXENTS)
+	    break;
+    numnew = i;
+
+    newindex = oldindex = 0;
+    while (newindex < numnew || oldindex < demo.numstates) {
+	newnum = newindex < numnew ?
+	    SV_SnapshotEntity(newindex)->number : DEMO_MAXENTS;
+	oldnum = oldindex < demo.numstates ?
+	    demo.states[oldindex].number : DEMO_MAXENTS;
+	if (newnum == oldnum) {
+	    state = SV_SnapshotEntity(newindex++);
+	    SV_WriteDelta(&demo.states[oldindex++], state, msg, false);
+	} else if (newnum < oldnum) {
+	    state = SV_SnapshotEntity(newindex++);
+	    SV_WriteDelta(&EDICT_NUM(newnum)->baseline, state, msg, true);
+	} else {
+	    MSG_WriteShort(msg, oldnum | U_REMOVE);
+	    oldindex++;
+	}
+    }
+    MSG_WriteShort(msg, 0);
+
+    for (i = 0; i < numnew; i++)
+	demo.states[i] = *SV_SnapshotEntity(i);
+    demo.numstates = numnew;
+
+    SV_DemoBlock(mvd_frame, msg);
+}
+
+/*
+==================
+SV_DemoStop
+==================
+*/
+void
+SV_DemoStop(void)
+{
+    if (!demo.recording)
+	return;
+
+    SV_DemoFlushAll();
+    COM_CloseStream();
+    demo.recording = false;
+}
+
+/*
+==================
+SV_MVDRecord_f
+
+mvdrecord <demoname>
+==================
+*/
+static void
+SV_MVDRecord_f(void)
+{
+    char name[MAX_OSPATH];
+    byte header[8];
+    int length;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("mvdrecord <demoname>\n");
+	return;
+    }
+    if (sv.state != ss_active) {
+	Con_Printf("No map running.\n");
+	return;
+    }
+
+    SV_DemoStop();
+
+    length = snprintf(name, sizeof(name), "%s/%s", com_gamedir, Cmd_Argv(1));
+    if (length >= sizeof(name)
+	|| COM_DefaultExtension(name, ".qwm", name, sizeof(name))) {
+	Con_Printf("ERROR: couldn't open demo, filename too long.\n");
+	return;
+    }
+    if (!COM_OpenStream(name, false)) {
+	Con_Printf("ERROR: couldn't open %s.\n", name);
+	return;
+    }
+
+    memcpy(header, MVD_MAGIC, 4);
+    MSG_PutLong(header + 4, MVD_VERSION);
+    COM_StreamWrite(header, sizeof(header));
+
+    Con_Printf("recording to %s.\n", name);
+    demo.recording = true;
+    SZ_Clear(&demo.all);
+    SV_DemoSignon();
+}
+
+static void
+SV_MVDStop_f(void)
+{
+    if (!demo.recording) {
+	Con_Printf("Not recording a demo.\n");
+	return;
+    }
+    SV_DemoStop();
+    Con_Printf("Completed demo\n");
+}
+
+void
+SV_DemoInit(void)
+{
+    demo.all.data = demo.all_buf;
+    demo.all.maxsize = sizeof(demo.all_buf);
+    demo.frame.data = demo.frame_buf;
+    demo.frame.maxsize = sizeof(demo.frame_buf);
+
+    Cmd_AddCommand("mvdrecord", SV_MVDRecord_f);
+    Cmd_AddCommand("mvdstop", SV_MVDStop_f);
+}
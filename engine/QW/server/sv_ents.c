@@ -24,27 +24,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "server.h"
 #include "sys.h"
 
-// because there can be a lot of nails, there is a special
-// network protocol for them
-#define	MAX_NAILS	32
-edict_t *nails[MAX_NAILS];
-int numnails;
-
-qboolean
-SV_AddNailUpdate(edict_t *ent)
-{
-    if (ent->v.modelindex != sv_nailmodel
-	&& ent->v.modelindex != sv_supernailmodel)
-	return false;
-    if (numnails == MAX_NAILS)
-	return true;
-    nails[numnails] = ent;
-    numnails++;
-    return true;
-}
-
-void
-SV_EmitNailUpdate(sizebuf_t *msg)
+static void
+SV_EmitNailUpdate(sizebuf_t *msg, edict_t *const *nails, int numnails)
 {
     byte bits[6];		// [48 bits] xyzpy 12 12 12 4 8
     int n, i;
@@ -89,12 +70,13 @@ Can delta from either a baseline or a previous packet_entity
 ==================
 */
 void
-SV_WriteDelta(entity_state_t *from, entity_state_t *to, sizebuf_t *msg,
-	      qboolean force)
+SV_WriteDelta(const entity_state_t *from, const entity_state_t *to,
+	      sizebuf_t *msg, qboolean force)
 {
     int bits;
     int i;
     float miss;
+    byte *start, *p;
 
 // send an update
     bits = 0;
@@ -148,32 +130,33 @@ SV_WriteDelta(entity_state_t *from, entity_state_t *to, sizebuf_t *msg,
     i = to->number | (bits & ~511);
     if (i & U_REMOVE)
 	Sys_Error("%s: U_REMOVE", __func__);
-    MSG_WriteShort(msg, i);
-
+    start = p = MSG_BeginGroup(msg, 17);
+    p = MSG_PutShort(p, i);
     if (bits & U_MOREBITS)
-	MSG_WriteByte(msg, bits & 255);
+	p = MSG_PutByte(p, bits & 255);
     if (bits & U_MODEL)
-	MSG_WriteByte(msg, to->modelindex);
+	p = MSG_PutByte(p, to->modelindex);
     if (bits & U_FRAME)
-	MSG_WriteByte(msg, to->frame);
+	p = MSG_PutByte(p, to->frame);
     if (bits & U_COLORMAP)
-	MSG_WriteByte(msg, to->colormap);
+	p = MSG_PutByte(p, to->colormap);
     if (bits & U_SKIN)
-	MSG_WriteByte(msg, to->skinnum);
+	p = MSG_PutByte(p, to->skinnum);
     if (bits & U_EFFECTS)
-	MSG_WriteByte(msg, to->effects);
+	p = MSG_PutByte(p, to->effects);
     if (bits & U_ORIGIN1)
-	MSG_WriteCoord(msg, to->origin[0]);
+	p = MSG_PutCoord(p, to->origin[0]);
     if (bits & U_ANGLE1)
-	MSG_WriteAngle(msg, to->angles[0]);
+	p = MSG_PutAngle(p, to->angles[0]);
     if (bits & U_ORIGIN2)
-	MSG_WriteCoord(msg, to->origin[1]);
+	p = MSG_PutCoord(p, to->origin[1]);
     if (bits & U_ANGLE2)
-	MSG_WriteAngle(msg, to->angles[1]);
+	p = MSG_PutAngle(p, to->angles[1]);
     if (bits & U_ORIGIN3)
-	MSG_WriteCoord(msg, to->origin[2]);
+	p = MSG_PutCoord(p, to->origin[2]);
     if (bits & U_ANGLE3)
-	MSG_WriteAngle(msg, to->angles[2]);
+	p = MSG_PutAngle(p, to->angles[2]);
+    MSG_EndGroup(msg, start, p);
 }
 
 /*
@@ -248,6 +231,100 @@ SV_EmitPacketEntities(client_t *client, packet_entities_t * to,
     MSG_WriteShort(msg, 0);	// end of packetentities
 }
 
+/*
+=============
+SV_PlayerInfoFlags
+
+What a playerinfo message for cl would carry to anyone else
+=============
+*/
+int
+SV_PlayerInfoFlags(const client_t *cl)
+{
+    const edict_t *ent = cl->edict;
+    int i, pflags;
+
+    pflags = PF_MSEC | PF_COMMAND;
+
+    if (ent->v.modelindex != sv_playermodel)
+	pflags |= PF_MODEL;
+    for (i = 0; i < 3; i++)
+	if (ent->v.velocity[i])
+	    pflags |= PF_VELOCITY1 << i;
+    if (ent->v.effects)
+	pflags |= PF_EFFECTS;
+    if (ent->v.skin)
+	pflags |= PF_SKINNUM;
+    if (ent->v.health <= 0)
+	pflags |= PF_DEAD;
+    if (ent->v.mins[2] != -24)
+	pflags |= PF_GIB;
+
+    return pflags;
+}
+
+/*
+=============
+SV_WritePlayerInfo
+
+Writes a playerinfo message for cl with the fields in pflags
+=============
+*/
+void
+SV_WritePlayerInfo(const client_t *cl, int pflags, sizebuf_t *msg)
+{
+    const edict_t *ent = cl->edict;
+    int i, msec;
+    usercmd_t cmd;
+    byte *start, *p;
+
+    start = p = MSG_BeginGroup(msg, 11);
+    p = MSG_PutByte(p, svc_playerinfo);
+    p = MSG_PutByte(p, cl - svs.clients);
+    p = MSG_PutShort(p, pflags);
+    p = MSG_PutCoords3(p, ent->v.origin);
+    p = MSG_PutByte(p, ent->v.frame);
+    MSG_EndGroup(msg, start, p);
+
+    if (pflags & PF_MSEC) {
+	msec = 1000 * (sv.time - cl->localtime);
+	if (msec > 255)
+	    msec = 255;
+	MSG_WriteByte(msg, msec);
+    }
+
+    if (pflags & PF_COMMAND) {
+	cmd = cl->lastcmd;
+
+	if (ent->v.health <= 0) {	// don't show the corpse looking around...
+	    cmd.angles[0] = 0;
+	    cmd.angles[1] = ent->v.angles[1];
+	    cmd.angles[0] = 0;
+	}
+
+	cmd.buttons = 0;	// never send buttons
+	cmd.impulse = 0;	// never send impulses
+
+	MSG_WriteDeltaUsercmd(msg, &nullcmd, &cmd);
+    }
+
+    for (i = 0; i < 3; i++)
+	if (pflags & (PF_VELOCITY1 << i))
+	    MSG_WriteShort(msg, ent->v.velocity[i]);
+
+    if (pflags & PF_MODEL)
+	MSG_WriteByte(msg, ent->v.modelindex);
+
+    if (pflags & PF_SKINNUM)
+	MSG_WriteByte(msg, ent->v.skin);
+
+    if (pflags & PF_EFFECTS)
+	MSG_WriteByte(msg, ent->v.effects);
+
+    if (pflags & PF_WEAPONFRAME)
+	MSG_WriteByte(msg, ent->v.weaponframe);
+}
+
 /*
 =============
 SV_WritePlayersToClient
@@ -261,8 +338,6 @@ SV_WritePlayersToClient(client_t *client, edict_t *clent,
     int i, j;
     client_t *cl;
     edict_t *ent;
-    int msec;
-    usercmd_t cmd;
     int pflags;
 
     for (j = 0, cl = svs.clients; j < MAX_CLIENTS; j++, cl++) {
@@ -285,21 +360,7 @@ SV_WritePlayersToClient(client_t *client, edict_t *clent,
 		continue;	// not visible
 	}
 
-	pflags = PF_MSEC | PF_COMMAND;
-
-	if (ent->v.modelindex != sv_playermodel)
-	    pflags |= PF_MODEL;
-	for (i = 0; i < 3; i++)
-	    if (ent->v.velocity[i])
-		pflags |= PF_VELOCITY1 << i;
-	if (ent->v.effects)
-	    pflags |= PF_EFFECTS;
-	if (ent->v.skin)
-	    pflags |= PF_SKINNUM;
-	if (ent->v.health <= 0)
-	    pflags |= PF_DEAD;
-	if (ent->v.mins[2] != -24)
-	    pflags |= PF_GIB;
+	pflags = SV_PlayerInfoFlags(cl);
 
 	if (cl->spectator) {	// only sent origin and velocity to spectators
 	    pflags &= PF_VELOCITY1 | PF_VELOCITY2 | PF_VELOCITY3;
@@ -313,55 +374,264 @@ SV_WritePlayersToClient(client_t *client, edict_t *clent,
 	    ent->v.weaponframe)
 	    pflags |= PF_WEAPONFRAME;
 
-	MSG_WriteByte(msg, svc_playerinfo);
-	MSG_WriteByte(msg, j);
-	MSG_WriteShort(msg, pflags);
+	SV_WritePlayerInfo(cl, pflags, msg);
+    }
+}
 
-	for (i = 0; i < 3; i++)
-	    MSG_WriteCoord(msg, ent->v.origin[i]);
 
-	MSG_WriteByte(msg, ent->v.frame);
+/*
+ * The entities that could be sent to anyone this frame, with their state
+ * already built and their leafs folded into PVS blocks.  Built once per
+ * frame so each client only has to test a few bitmask words per entity.
+ */
+typedef struct {
+    edict_t *ent;
+    qboolean nail;
+    qboolean urgent;		// missiles and bodies go first
+    vec3_t center;
+    float radius;
+    int numblocks;
+    int blocknums[MAX_ENT_LEAFS];
+    leafblock_t blocks[MAX_ENT_LEAFS];
+    entity_state_t state;
+} visent_t;
+
+static visent_t *visents;
+static int num_visents;
+static int max_visents;
 
-	if (pflags & PF_MSEC) {
-	    msec = 1000 * (sv.time - cl->localtime);
-	    if (msec > 255)
-		msec = 255;
-	    MSG_WriteByte(msg, msec);
-	}
+/*
+=============
+SV_BuildEntitySnapshot
 
-	if (pflags & PF_COMMAND) {
-	    cmd = cl->lastcmd;
+Gathers the entities with visible models once for all clients.
+=============
+*/
+void
+SV_BuildEntitySnapshot(void)
+{
+    int e, i, j, block;
+    leafblock_t bit;
+    vec3_t size;
+    edict_t *ent;
+    visent_t *visent;
+    entity_state_t *state;
 
-	    if (ent->v.health <= 0) {	// don't show the corpse looking around...
-		cmd.angles[0] = 0;
-		cmd.angles[1] = ent->v.angles[1];
-		cmd.angles[0] = 0;
-	    }
+    if (max_visents < sv.max_edicts) {
+	visent = realloc(visents, sv.max_edicts * sizeof(*visents));
+	if (!visent)
+	    SV_Error("%s: out of memory", __func__);
+	visents = visent;
+	max_visents = sv.max_edicts;
+    }
 
-	    cmd.buttons = 0;	// never send buttons
-	    cmd.impulse = 0;	// never send impulses
+    num_visents = 0;
+    for (e = MAX_CLIENTS + 1, ent = EDICT_NUM(e); e < sv.num_edicts;
+	 e++, ent = NEXT_EDICT(ent)) {
+	if (sv.edhot[e].free || !sv.edhot[e].num_leafs)
+	    continue;		// never visible
+	// ignore ents without visible models
+	if (!ent->v.modelindex || !*PR_GetString(ent->v.model))
+	    continue;
 
-	    MSG_WriteDeltaUsercmd(msg, &nullcmd, &cmd);
+	visent = &visents[num_visents++];
+	visent->ent = ent;
+	visent->nail = ent->v.modelindex == sv_nailmodel
+	    || ent->v.modelindex == sv_supernailmodel;
+	visent->urgent = ent->v.movetype == MOVETYPE_FLYMISSILE
+	    || ent->v.movetype == MOVETYPE_TOSS
+	    || ent->v.movetype == MOVETYPE_BOUNCE
+	    || ent->v.modelindex == sv_playermodel;
+	VectorAdd(ent->v.absmin, ent->v.absmax, visent->center);
+	VectorScale(visent->center, 0.5, visent->center);
+	VectorSubtract(ent->v.absmax, ent->v.absmin, size);
+	visent->radius = 0.5 * Length(size);
+
+	visent->numblocks = 0;
+	for (i = 0; i < ent->num_leafs; i++) {
+	    block = ent->leafnums[i] >> LEAFSHIFT;
+	    bit = 1UL << (ent->leafnums[i] & LEAFMASK);
+	    for (j = 0; j < visent->numblocks; j++)
+		if (visent->blocknums[j] == block)
+		    break;
+	    if (j == visent->numblocks) {
+		visent->blocknums[j] = block;
+		visent->blocks[j] = 0;
+		visent->numblocks++;
+	    }
+	    visent->blocks[j] |= bit;
 	}
 
-	for (i = 0; i < 3; i++)
-	    if (pflags & (PF_VELOCITY1 << i))
-		MSG_WriteShort(msg, ent->v.velocity[i]);
+	state = &visent->state;
+	state->number = e;
+	state->flags = 0;
+	VectorCopy(ent->v.origin, state->origin);
+	VectorCopy(ent->v.angles, state->angles);
+	state->modelindex = ent->v.modelindex;
+	state->frame = ent->v.frame;
+	state->colormap = ent->v.colormap;
+	state->skinnum = ent->v.skin;
+	state->effects = ent->v.effects;
+    }
+}
+
+/*
+=============
+SV_NumSnapshotEntities
+SV_SnapshotEntity
+
+The snapshot entities' states, in entity order, for the server demo
+=============
+*/
+int
+SV_NumSnapshotEntities(void)
+{
+    return num_visents;
+}
+
+const entity_state_t *
+SV_SnapshotEntity(int index)
+{
+    return &visents[index].state;
+}
+
+static inline qboolean
+SV_VisentInPVS(const visent_t *visent, const leafbits_t *pvs)
+{
+    int i;
+
+    for (i = 0; i < visent->numblocks; i++)
+	if (pvs->bits[visent->blocknums[i]] & visent->blocks[i])
+	    return true;
+
+    return false;
+}
+
+/*
+==============================================================================
+
+PRIORITIZED PACKET ENTITIES
 
-	if (pflags & PF_MODEL)
-	    MSG_WriteByte(msg, ent->v.modelindex);
+When the visible entities won't all fit in MAX_PACKET_ENTITIES or the
+client's share of bandwidth, the most important ones are sent first:
+big or near ones, missiles and bodies, and whatever has gone longest
+without being sent.  The rest wait for a later packet, getting more
+important the longer they wait.  The budget is a tenth of a second of the
+client's rate, and never more than the room left in the datagram.
 
-	if (pflags & PF_SKINNUM)
-	    MSG_WriteByte(msg, ent->v.skin);
+==============================================================================
+*/
+
+#define ENT_MIN_BUDGET 256	// bytes, so very low rates still get updates
+#define ENT_MAX_WAIT 2.0f	// seconds of waiting that still add priority
+
+typedef struct {
+    const visent_t *visent;
+    const entity_state_t *from;	// state the client has, or NULL
+    int cost;			// bytes to send it
+    float score;
+    qboolean chosen;
+} entcandidate_t;
+
+static int
+SV_DeltaCost(const entity_state_t *from, const entity_state_t *to,
+	     qboolean force)
+{
+    byte buf[64];
+    sizebuf_t msg;
 
-	if (pflags & PF_EFFECTS)
-	    MSG_WriteByte(msg, ent->v.effects);
+    memset(&msg, 0, sizeof(msg));
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+    SV_WriteDelta(from, to, &msg, force);
+
+    return msg.cursize;
+}
+
+static int
+SV_CompareCandidates(const void *a, const void *b)
+{
+    const entcandidate_t *c1 = *(const entcandidate_t *const *)a;
+    const entcandidate_t *c2 = *(const entcandidate_t *const *)b;
+
+    if (c1->score > c2->score)
+	return -1;
+    if (c1->score < c2->score)
+	return 1;
+    return c1->visent->state.number - c2->visent->state.number;
+}
+
+/*
+=============
+SV_ChooseEntities
+
+Picks which of the candidates go in the packet, in order of priority.
+=============
+*/
+static void
+SV_ChooseEntities(client_t *client, entcandidate_t *cands, int numcands,
+		  int spent, int budget)
+{
+    entcandidate_t *order[MAX_NET_EDICTS];
+    const visent_t *visent;
+    entcandidate_t *cand;
+    vec3_t org, delta;
+    float wait;
+    int i, chosen;
+
+    VectorAdd(client->edict->v.origin, client->edict->v.view_ofs, org);
+    for (i = 0, cand = cands; i < numcands; i++, cand++) {
+	visent = cand->visent;
+	VectorSubtract(visent->center, org, delta);
+	wait = realtime - client->ent_senttime[visent->state.number];
+	wait = qclamp(wait, 0.0f, ENT_MAX_WAIT);
+	cand->score = (visent->radius + 16) / (Length(delta) + 64);
+	if (visent->urgent)
+	    cand->score *= 2;
+	cand->score *= 1 + 4 * wait;
+	order[i] = cand;
+    }
+    qsort(order, numcands, sizeof(order[0]), SV_CompareCandidates);
 
-	if (pflags & PF_WEAPONFRAME)
-	    MSG_WriteByte(msg, ent->v.weaponframe);
+    chosen = 0;
+    for (i = 0; i < numcands && chosen < MAX_PACKET_ENTITIES; i++) {
+	cand = order[i];
+	if (spent + cand->cost > budget)
+	    continue;
+	cand->chosen = true;
+	spent += cand->cost;
+	chosen++;
     }
 }
 
+/*
+=============
+SV_FindVisibleEntities
+
+Picks out the snapshot entities in the PVS, splitting off the nails
+=============
+*/
+void
+SV_FindVisibleEntities(const leafbits_t *pvs, entview_t *view)
+{
+    const visent_t *visent;
+    int i;
+
+    view->numvisible = 0;
+    view->numnails = 0;
+    for (i = 0, visent = visents; i < num_visents; i++, visent++) {
+	if (!SV_VisentInPVS(visent, pvs))
+	    continue;		// not visible
+
+	if (visent->nail) {
+	    if (view->numnails < MAX_NAILS)
+		view->nails[view->numnails++] = visent->ent;
+	    continue;		// added to the special update list
+	}
+	if (view->numvisible < MAX_NET_EDICTS)
+	    view->visible[view->numvisible++] = i;
+    }
+}
 
 /*
 =============
@@ -371,70 +641,94 @@ Encodes the current state of the world as
 a svc_packetentities messages and possibly
 a svc_nails message and
 svc_playerinfo messages
+
+Only reads the snapshot and the client's own
+state, so clients can be written in parallel.
+If a view is given, it was already found from
+the same PVS and is shared with other clients.
 =============
 */
 void
-SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
+SV_WriteEntitiesToClient(client_t *client, const leafbits_t *pvs,
+			 const entview_t *view, sizebuf_t *msg)
 {
-    int e, i;
-    const leafbits_t *pvs;
-    vec3_t org;
-    edict_t *ent;
+    int i, oldindex, oldmax, budget, spent;
     packet_entities_t *pack;
+    const packet_entities_t *from;
     edict_t *clent;
     client_frame_t *frame;
-    entity_state_t *state;
+    const visent_t *visent;
+    const entity_state_t *state;
+    entcandidate_t cands[MAX_NET_EDICTS];
+    entcandidate_t *cand;
+    int numcands;
+    entview_t ownview;
 
     // this is the frame we are creating
     frame = &client->frames[client->netchan.incoming_sequence & UPDATE_MASK];
 
-    // find the client's PVS
-    clent = client->edict;
-    VectorAdd(clent->v.origin, clent->v.view_ofs, org);
-    pvs = Mod_FatPVS(sv.worldmodel, org);
-
     // send over the players in the PVS
+    clent = client->edict;
     SV_WritePlayersToClient(client, clent, pvs, msg);
 
-    // put other visible entities into either a packet_entities or a nails message
-    pack = &frame->entities;
-    pack->num_entities = 0;
-
-    numnails = 0;
-
-    for (e = MAX_CLIENTS + 1, ent = EDICT_NUM(e); e < sv.num_edicts;
-	 e++, ent = NEXT_EDICT(ent)) {
-	// ignore ents without visible models
-	if (!ent->v.modelindex || !*PR_GetString(ent->v.model))
-	    continue;
-
-	// ignore if not touching a PV leaf
-	for (i = 0; i < ent->num_leafs; i++)
-	    if (Mod_TestLeafBit(pvs, ent->leafnums[i]))
-		break;
-
-	if (i == ent->num_leafs)
-	    continue;		// not visible
+    // the frame the client will delta from, if any
+    from = NULL;
+    oldmax = 0;
+    if (client->delta_sequence != -1) {
+	from = &client->frames[client->delta_sequence & UPDATE_MASK].entities;
+	oldmax = from->num_entities;
+    }
 
-	if (SV_AddNailUpdate(ent))
-	    continue;		// added to the special update list
+    // what fits: the packet header and end, plus a removal for
+    // everything the client has, refunded for what is sent again
+    budget = 0.1 / client->netchan.rate;
+    budget = qmax(budget, ENT_MIN_BUDGET);
+    budget = qmin(budget, msg->maxsize - msg->cursize - client->datagram.cursize
+		  - (2 + MAX_NAILS * 6));
+    spent = 4 + 2 * oldmax;
 
-	// add to the packetentities
-	if (pack->num_entities == MAX_PACKET_ENTITIES)
-	    continue;		// all full
+    // put other visible entities into either a packet_entities or a nails message
+    if (!view) {
+	SV_FindVisibleEntities(pvs, &ownview);
+	view = &ownview;
+    }
+    numcands = 0;
+    oldindex = 0;
+    for (i = 0; i < view->numvisible; i++) {
+	visent = &visents[view->visible[i]];
+	state = &visent->state;
+	cand = &cands[numcands++];
+	cand->visent = visent;
+	cand->chosen = false;
+	while (oldindex < oldmax && from->entities[oldindex].number < state->number)
+	    oldindex++;
+	if (oldindex < oldmax && from->entities[oldindex].number == state->number) {
+	    cand->from = &from->entities[oldindex];
+	    cand->cost = SV_DeltaCost(cand->from, state, false) - 2;
+	} else {
+	    cand->from = NULL;
+	    cand->cost = SV_DeltaCost(&visent->ent->baseline, state, true);
+	}
+	spent += cand->cost;
+    }
 
-	state = &pack->entities[pack->num_entities];
-	pack->num_entities++;
+    if (numcands <= MAX_PACKET_ENTITIES && spent <= budget) {
+	for (i = 0; i < numcands; i++)
+	    cands[i].chosen = true;
+    } else {
+	spent = 4 + 2 * oldmax;
+	SV_ChooseEntities(client, cands, numcands, spent, budget);
+    }
 
-	state->number = e;
-	state->flags = 0;
-	VectorCopy(ent->v.origin, state->origin);
-	VectorCopy(ent->v.angles, state->angles);
-	state->modelindex = ent->v.modelindex;
-	state->frame = ent->v.frame;
-	state->colormap = ent->v.colormap;
-	state->skinnum = ent->v.skin;
-	state->effects = ent->v.effects;
+    // add the chosen ones to the packetentities, in entity order
+    pack = &frame->entities;
+    pack->num_entities = 0;
+    for (i = 0, cand = cands; i < numcands; i++, cand++) {
+	if (!cand->chosen)
+	    continue;
+	state = &cand->visent->state;
+	pack->entities[pack->num_entities++] = *state;
+	client->ent_senttime[state->number] = realtime;
     }
 
     // encode the packet entities as a delta from the
@@ -443,5 +737,5 @@ SV_WriteEntitiesToClient(client_t *client, sizebuf_t *msg)
     SV_EmitPacketEntities(client, pack, msg);
 
     // now add the specialized nail update
-    SV_EmitNailUpdate(msg);
+    SV_EmitNailUpdate(msg, view->nails, view->numnails);
 }
@@ -190,12 +190,51 @@ SV_SaveSpawnparms(void)
     }
 }
 
+/*
+================
+SV_LeafPHS
+
+Returns a row of the PHS (Potentially Hearable Set), filling it in from
+the PVS rows the first time it is asked for.
+================
+*/
+const leafbits_t *
+SV_LeafPHS(int leafnum)
+{
+    int numleafs, visleaf;
+    const leafbits_t *pvs;
+    leafbits_t *phs;
+    leafblock_t check;
+
+    phs = sv.phs[leafnum];
+    if (sv.phs_built[leafnum])
+	return phs;
+
+    numleafs = sv.worldmodel->numleafs;
+    pvs = sv.pvs[leafnum];
+    memcpy(phs, pvs, Mod_LeafbitsSize(numleafs));
+    if (leafnum) {
+	foreach_leafbit(pvs, visleaf, check) {
+	    /*
+	     * OR each visible pvs row into the phs
+	     * index is +1 because pvs is 1 based
+	     */
+	    if (visleaf + 1 >= numleafs)
+		continue;
+	    Mod_AddLeafBits(phs, sv.pvs[visleaf + 1]);
+	}
+    }
+    sv.phs_built[leafnum] = 1;
+
+    return phs;
+}
+
 /*
 ================
 SV_CalcPHS
 
-Expands the PVS and calculates the PHS
-(Potentially Hearable Set)
+Expands the PVS and makes room for the PHS, whose
+rows are built on demand by SV_LeafPHS
 ================
 */
 void
@@ -203,11 +242,10 @@ SV_CalcPHS(void)
 {
     int numleafs;
     size_t leafmem, pvsmem, phsmem;
-    int i, leafnum;
-    int vcount, hcount;
+    int i;
+    int vcount;
     const leafbits_t *leafbits;
-    leafbits_t *pvs, *phs;
-    leafblock_t check;
+    leafbits_t *pvs;
 
     Con_Printf("Building PHS...\n");
 
@@ -222,6 +260,7 @@ SV_CalcPHS(void)
     phsmem = (sizeof(leafbits_t *) + leafmem) * numleafs;
     sv.pvs = Hunk_AllocName(pvsmem, "pvs");
     sv.phs = Hunk_AllocName(phsmem, "phs");
+    sv.phs_built = Hunk_AllocName(numleafs, "phsbuilt");
     for (i = 0; i < numleafs + 1; i++) {
 	int offset = sizeof(leafbits_t *) * (numleafs + 1) + leafmem * i;
 	sv.pvs[i] = (leafbits_t *)((byte *)sv.pvs + offset);
@@ -242,29 +281,8 @@ SV_CalcPHS(void)
 	vcount += Mod_CountLeafBits(pvs);
     }
 
-    hcount = 0;
-    for (i = 0; i < numleafs; i++) {
-	pvs = sv.pvs[i];
-	phs = sv.phs[i];
-	memcpy(phs, pvs, leafmem);
-	if (!i)
-	    continue;
-
-	foreach_leafbit(pvs, leafnum, check) {
-	    /*
-	     * OR each visible pvs row into the phs
-	     * index is +1 because pvs is 1 based
-	     */
-	    if (leafnum + 1 >= numleafs)
-		continue;
-	    leafbits = sv.pvs[leafnum + 1];
-	    Mod_AddLeafBits(phs, leafbits);
-	}
-	hcount += Mod_CountLeafBits(phs);
-    }
-
-    Con_Printf("Average leafs visible / hearable / total: %i / %i / %i\n",
-	       vcount / numleafs, hcount / numleafs, numleafs);
+    Con_Printf("Average leafs visible / total: %i / %i\n",
+	       vcount / numleafs, numleafs);
 }
 
 static unsigned
@@ -272,12 +290,17 @@ SV_CheckModel(const char *mdl)
 {
     byte stackbuf[1024];	// avoid dirtying the cache heap
     const byte *buf;
-    unsigned short crc;
+    unsigned checksum;
+
+    /* (not even loaded again if it hasn't changed) */
+    if (COM_GetFileChecksum(mdl, CHECKSUM_CRC, &checksum))
+	return checksum;
 
     buf = COM_LoadStackFile(mdl, stackbuf, sizeof(stackbuf), NULL);
-    crc = CRC_Block(buf, com_filesize);
+    checksum = CRC_Block(buf, com_filesize);
+    COM_SetFileChecksum(mdl, CHECKSUM_CRC, checksum);
 
-    return crc;
+    return checksum;
 }
 
 /*
@@ -334,9 +357,10 @@ SV_SpawnServer(const char *server)
     // load progs to get entity field count
     // which determines how big each edict is
     PR_LoadProgs();
+    sv.nextmap = PR_FindGlobal("nextmap", ev_string);
 
     // allocate edicts
-    sv.edicts = Hunk_AllocName(MAX_EDICTS * pr_edict_size, "edicts");
+    ED_InitEdicts();
 
     // leave slots at start for clients only
     sv.num_edicts = MAX_CLIENTS + 1;
@@ -419,5 +443,6 @@ SV_SpawnServer(const char *server)
     sv.signon_buffer_size[sv.num_signon_buffers - 1] = sv.signon.cursize;
 
     Info_SetValueForKey(svs.info, "map", sv.name, MAX_SERVERINFO_STRING);
+    SV_DemoSignon();
     Con_DPrintf("Server spawned.\n");
 }
@@ -25,7 +25,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "pmove.h"
 #include "qwsvdef.h"
 #include "server.h"
+#include "sv_metrics.h"
+#include "sv_profile.h"
 #include "sys.h"
+#include "world.h"
 #include "zone.h"
 
 quakeparms_t host_parms;
@@ -47,6 +50,7 @@ cvar_t developer = { "developer", "0" };	// show extra messages
 static cvar_t timeout = { "timeout", "65" };	// seconds without any message
 static cvar_t zombietime = { "zombietime", "2" }; // seconds to sink messages
 						// after disconnect
+static cvar_t sv_idle = { "sv_idle", "0" };	// sleep while nobody is on
 
 static cvar_t rcon_password = { "rcon_password", "" };	// for remote commands
 static cvar_t password = { "password", "" };	// for entering the game
@@ -60,6 +64,8 @@ cvar_t allow_download_maps = { "allow_download_maps", "1" };
 
 cvar_t sv_highchars = { "sv_highchars", "1" };
 cvar_t sv_phs = { "sv_phs", "1" };
+cvar_t sv_sendthreads = { "sv_sendthreads", "0" };
+cvar_t sv_relayspectators = { "sv_relayspectators", "0" };
 cvar_t pausable = { "pausable", "1" };
 
 //
@@ -77,7 +83,7 @@ cvar_t watervis = { "watervis", "0", false, true };
 
 cvar_t hostname = { "hostname", "unnamed", false, true };
 
-FILE *sv_logfile;
+conlog_t *sv_logfile;
 FILE *sv_fraglogfile;
 
 static void Master_Heartbeat(void);
@@ -103,13 +109,16 @@ SV_Shutdown(void)
 {
     Master_Shutdown();
     if (sv_logfile) {
-	fclose(sv_logfile);
+	Log_Close(sv_logfile);
 	sv_logfile = NULL;
     }
     if (sv_fraglogfile) {
 	fclose(sv_fraglogfile);
 	sv_logfile = NULL;
     }
+    SV_DemoStop();
+    COM_PreloadShutdown();
+    COM_ParallelShutdown();
     NET_Shutdown();
 }
 
@@ -210,10 +219,7 @@ SV_DropClient(client_t *drop)
     else
 	Con_Printf("Client %s removed\n", drop->name);
 
-    if (drop->download) {
-	fclose(drop->download);
-	drop->download = NULL;
-    }
+    SV_CloseDownload(drop);
     if (drop->upload) {
 	fclose(drop->upload);
 	drop->upload = NULL;
@@ -1131,6 +1137,8 @@ SV_ReadPackets(void)
 	//      Con_Printf ("%s:sequenced packet without connection\n"
 	// ,NET_AdrToString(net_from));
     }
+
+    SV_RunQueuedMoves();
 }
 
 /*
@@ -1241,6 +1249,7 @@ SV_Frame(float time)
 
     start = Sys_DoubleTime();
     svs.stats.idle += start - end;
+    SV_ProfileStartFrame();
 
 // keep the random time dependent
     rand();
@@ -1253,15 +1262,23 @@ SV_Frame(float time)
 // check timeouts
     SV_CheckTimeouts();
 
+// pick up after background jobs
+    COM_RunFinishedJobs();
+
 // toggle the log buffer if full
     SV_CheckLog();
 
 // move autonomous things around if enough time has passed
-    if (!sv.paused)
+    if (!sv.paused) {
+	SV_ProfileBegin(SVP_MOVE);
 	SV_Physics();
+	SV_ProfileEnd();
+    }
 
 // get packets
+    SV_ProfileBegin(SVP_READ);
     SV_ReadPackets();
+    SV_ProfileEnd();
 
 // check for commands typed to the host
     SV_GetConsoleCommands();
@@ -1272,12 +1289,18 @@ SV_Frame(float time)
     SV_CheckVars();
 
 // send messages back to the clients that had packets read this frame
+    SV_ProfileBegin(SVP_SEND);
     SV_SendClientMessages();
+    SV_ProfileEnd();
 
 // send a heartbeat to the master if needed
     Master_Heartbeat();
 
+    SV_PhysentStats();
+
 // collect timing statistics
+    SV_ProfileEndFrame();
+    SV_MetricsFrame();
     end = Sys_DoubleTime();
     svs.stats.active += end - start;
     if (++svs.stats.count == STATFRAMES) {
@@ -1302,6 +1325,9 @@ SV_InitLocal(void)
     SV_InitOperatorCommands();
     SV_ModelInit();
     SV_UserInit();
+    SV_ProfileInit();
+    SV_MetricsInit();
+    SV_DemoInit();
 
     Cvar_RegisterVariable(&rcon_password);
     Cvar_RegisterVariable(&password);
@@ -1323,8 +1349,12 @@ SV_InitLocal(void)
 
     Cvar_RegisterVariable(&timeout);
     Cvar_RegisterVariable(&zombietime);
+    Cvar_RegisterVariable(&sv_idle);
 
     Cvar_RegisterVariable(&sv_maxvelocity);
+    Cvar_RegisterVariable(&sv_physthreads);
+    Cvar_RegisterVariable(&sv_touchstats);
+    Cvar_RegisterVariable(&sv_physentstats);
     Cvar_RegisterVariable(&sv_gravity);
     Cvar_RegisterVariable(&sv_stopspeed);
     Cvar_RegisterVariable(&sv_maxspeed);
@@ -1348,6 +1378,8 @@ SV_InitLocal(void)
     Cvar_RegisterVariable(&sv_highchars);
 
     Cvar_RegisterVariable(&sv_phs);
+    Cvar_RegisterVariable(&sv_sendthreads);
+    Cvar_RegisterVariable(&sv_relayspectators);
 
     Cvar_RegisterVariable(&pausable);
 
@@ -1359,6 +1391,7 @@ SV_InitLocal(void)
     Cmd_AddCommand("removeip", SV_RemoveIP_f);
     Cmd_AddCommand("listip", SV_ListIP_f);
     Cmd_AddCommand("writeip", SV_WriteIP_f);
+    Cmd_AddCommand("areastats", SV_AreaStats_f);
 
     Info_SetValueForStarKey(svs.info, "*version",
 			    va("TyrQuake-%s", stringify(TYR_VERSION)),
@@ -1423,6 +1456,33 @@ Master_Heartbeat(void)
 	}
 }
 
+/*
+================
+SV_IdleTime
+
+With sv_idle set and nobody on the server, how long the main loop may sleep
+waiting for a packet or console input, until the next heartbeat is due.  The
+world waits while the server is empty.  Returns 0 while frames have to keep
+coming: with clients connected or sinking their last messages, or commands
+waiting in the buffer.
+================
+*/
+double
+SV_IdleTime(void)
+{
+    double next;
+    int i;
+
+    if (!sv_idle.value || Cbuf_Pending())
+	return 0;
+    for (i = 0; i < MAX_CLIENTS; i++)
+	if (svs.clients[i].state != cs_free)
+	    return 0;
+
+    next = svs.last_heartbeat + HEARTBEAT_SECONDS - realtime;
+    return next > 0 ? next : 0;
+}
+
 /*
 =================
 Master_Shutdown
@@ -1574,6 +1634,8 @@ SV_ExtractFromUserinfo(client_t *cl)
 SV_InitNet
 ====================
 */
+static int sv_netport;
+
 static void
 SV_InitNet(void)
 {
@@ -1587,6 +1649,7 @@ SV_InitNet(void)
 	Con_Printf("Port: %i\n", port);
     }
     NET_Init(port);
+    sv_netport = port;
 
     Netchan_Init();
 
@@ -1595,6 +1658,49 @@ SV_InitNet(void)
 //      NET_StringToAdr ("192.246.40.70:27000", &idmaster_adr);
 }
 
+/*
+====================
+SV_StartInstances
+
+With -instances <n>, the server splits into n copies once the first map is
+up, each after the first on the next port along.  They keep sharing the
+memory of what was loaded before the split (the pak directories, the map
+and the progs) until one of them changes or replaces it.  Each copy execs
+instance<n>.cfg if there is one.
+====================
+*/
+static void
+SV_StartInstances(void)
+{
+    char cfgname[MAX_QPATH];
+    int p, count, instance;
+    FILE *f;
+
+    p = COM_CheckParm("-instances");
+    if (!p || p >= com_argc - 1)
+	return;
+    count = atoi(com_argv[p + 1]);
+    if (count < 2)
+	return;
+
+    COM_ParallelShutdown();	// threads don't survive the split
+    instance = Sys_ForkInstances(count);
+    if (!instance)
+	return;
+
+    NET_Shutdown();
+    NET_Init(sv_netport + instance);
+    svs.last_heartbeat = -99999;
+    Con_Printf("Instance %d, port %d\n", instance, sv_netport + instance);
+
+    snprintf(cfgname, sizeof(cfgname), "instance%d.cfg", instance);
+    if (COM_FOpenFile(cfgname, &f) >= 0) {
+	fclose(f);
+	Cbuf_InsertText(va("exec %s\n", cfgname));
+	Cbuf_Execute();
+    }
+}
+
 /*
  * Model Loader Functions
  */
@@ -1658,4 +1764,6 @@ SV_Init(quakeparms_t *parms)
 	Cmd_ExecuteString("map start");
     if (sv.state == ss_dead)
 	SV_Error("Couldn't spawn a server");
+
+    SV_StartInstances();
 }
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "model.h"
 #include "qwsvdef.h"
 #include "server.h"
+#include "sv_profile.h"
 #include "sys.h"
 
 #define CHAN_AUTO   0
@@ -124,7 +125,7 @@ Con_Printf(const char *fmt, ...)
 
     Sys_Printf("%s", msg);	// also echo to debugging console
     if (sv_logfile)
-	fprintf(sv_logfile, "%s", msg);
+	Log_Print(sv_logfile, msg);
 }
 
 /*
@@ -219,6 +220,7 @@ SV_BroadcastPrintf(int level, const char *fmt, ...)
 
 	SV_PrintToClient(cl, level, string);
     }
+    SV_DemoWriteString(svc_print, level, string);
 }
 
 /*
@@ -245,6 +247,33 @@ SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+/*
+=================
+SV_ClientLeaf
+
+Returns the pvs row for the leaf the client's edict is in, or -1.
+Only looked up again once the edict has moved.
+=================
+*/
+static int
+SV_ClientLeaf(client_t *client)
+{
+    const float *origin = client->edict->v.origin;
+    mleaf_t *leaf;
+
+    if (client->leafspawn == svs.spawncount
+	&& VectorCompare(origin, client->leaforigin))
+	return client->leafnum;
+
+    leaf = Mod_PointInLeaf(sv.worldmodel, origin);
+    // -1 is because pvs rows are 1 based, not 0 based like leafs
+    client->leafnum = leaf ? leaf - sv.worldmodel->leafs - 1 : -1;
+    client->leafspawn = svs.spawncount;
+    VectorCopy(origin, client->leaforigin);
+
+    return client->leafnum;
+}
+
 /*
 =================
 SV_Multicast
@@ -282,7 +311,7 @@ SV_Multicast(vec3_t origin, int to)
     case MULTICAST_PHS:
 	if (leaf == sv.worldmodel->leafs)
 	    return;		/* should never happen */
-	mask = sv.phs[leaf - sv.worldmodel->leafs - 1];
+	mask = SV_LeafPHS(leaf - sv.worldmodel->leafs - 1);
 	break;
 
     case MULTICAST_PVS_R:
@@ -309,10 +338,8 @@ SV_Multicast(vec3_t origin, int to)
 		goto inrange;
 	}
 
-	leaf = Mod_PointInLeaf(sv.worldmodel, client->edict->v.origin);
-	if (leaf) {
-	    // -1 is because pvs rows are 1 based, not 0 based like leafs
-	    leafnum = leaf - sv.worldmodel->leafs - 1;
+	leafnum = SV_ClientLeaf(client);
+	if (leafnum >= 0) {
 	    if (!Mod_TestLeafBit(mask, leafnum)) {
 //		Con_Printf ("supressed multicast\n");
 		continue;
@@ -328,6 +355,7 @@ SV_Multicast(vec3_t origin, int to)
 	    SZ_Write(&client->datagram, sv.multicast.data,
 		     sv.multicast.cursize);
     }
+    SV_DemoWrite(sv.multicast.data, sv.multicast.cursize);
 
     SZ_Clear(&sv.multicast);
 }
@@ -417,8 +445,7 @@ SV_StartSound(edict_t *entity, int channel, const char *sample, int volume,
     if (channel & SND_ATTENUATION)
 	MSG_WriteByte(&sv.multicast, attenuation * 64);
     MSG_WriteByte(&sv.multicast, sound_num);
-    for (i = 0; i < 3; i++)
-	MSG_WriteCoord(&sv.multicast, origin[i]);
+    MSG_WriteCoords3(&sv.multicast, origin);
 
     if (use_phs)
 	SV_Multicast(origin, reliable ? MULTICAST_PHS_R : MULTICAST_PHS);
@@ -555,51 +582,200 @@ SV_UpdateClientStats(client_t *client)
 	}
 }
 
+/*
+ * The datagrams going out this frame.  They are built from the world and
+ * each client's own state only, so with sv_sendthreads above 1 they're
+ * filled in across that many threads and then sent in client order.
+ */
+typedef struct {
+    client_t *client;
+    const leafbits_t *pvs;	// copy of the client's fat pvs
+    const entview_t *view;	// shared visible entities, or NULL
+    qboolean datagram_overflowed;
+    sizebuf_t msg;
+    byte buf[MAX_DATAGRAM];
+} clientsend_t;
+
+/*
+ * With sv_relayspectators, spectators tracking a player all see from that
+ * player's eyes, so the PVS and the entities in it are found once for each
+ * tracked player and shared by everyone watching them.
+ */
+typedef struct {
+    int target;			// client number being tracked
+    leafbits_t *pvs;
+    entview_t ents;
+} sendview_t;
+
+static clientsend_t sv_sends[MAX_CLIENTS];
+static int sv_numsends;
+static sendview_t sv_views[MAX_CLIENTS];
+static int sv_numviews;
+static byte *sv_sendpvs;
+static size_t sv_sendpvs_size;
+
 /*
 =======================
-SV_SendClientDatagram
+SV_SpectatorView
+
+Finds or makes the shared view from the player a spectator is tracking
 =======================
 */
-static qboolean
-SV_SendClientDatagram(client_t *client)
+static const sendview_t *
+SV_SpectatorView(const client_t *client, size_t pvssize)
 {
-    byte buf[MAX_DATAGRAM];
-    sizebuf_t msg;
+    const client_t *target;
+    sendview_t *view;
+    vec3_t org;
+    int i;
 
-    msg.data = buf;
-    msg.maxsize = sizeof(buf);
-    msg.cursize = 0;
-    msg.allowoverflow = true;
-    msg.overflowed = false;
+    if (!client->spectator || client->spec_track <= 0)
+	return NULL;
+    target = &svs.clients[client->spec_track - 1];
+    if (target->state != cs_spawned || target->spectator)
+	return NULL;
+
+    for (i = 0, view = sv_views; i < sv_numviews; i++, view++)
+	if (view->target == client->spec_track - 1)
+	    return view;
+
+    view = &sv_views[sv_numviews];
+    view->target = client->spec_track - 1;
+    view->pvs = (leafbits_t *)(sv_sendpvs + pvssize * (MAX_CLIENTS + sv_numviews));
+    sv_numviews++;
+
+    VectorAdd(target->edict->v.origin, target->edict->v.view_ofs, org);
+    memcpy(view->pvs, Mod_FatPVS(sv.worldmodel, org), pvssize);
+    SV_FindVisibleEntities(view->pvs, &view->ents);
+
+    return view;
+}
+
+/*
+=======================
+SV_QueueClientDatagram
+
+Find the client's PVS here, since the PVS caches can't be shared
+=======================
+*/
+static void
+SV_QueueClientDatagram(client_t *client)
+{
+    clientsend_t *send;
+    const sendview_t *view;
+    leafbits_t *pvs;
+    vec3_t org;
+    size_t pvssize;
+    byte *pvsmem;
+
+    // room for each client's pvs and each shared view's
+    pvssize = Mod_LeafbitsSize(sv.worldmodel->numleafs);
+    if (sv_sendpvs_size < pvssize * MAX_CLIENTS * 2) {
+	pvsmem = realloc(sv_sendpvs, pvssize * MAX_CLIENTS * 2);
+	if (!pvsmem)
+	    SV_Error("%s: out of memory", __func__);
+	sv_sendpvs = pvsmem;
+	sv_sendpvs_size = pvssize * MAX_CLIENTS * 2;
+    }
+
+    send = &sv_sends[sv_numsends];
+    send->client = client;
+
+    view = NULL;
+    if (sv_relayspectators.value)
+	view = SV_SpectatorView(client, pvssize);
+    if (view) {
+	send->pvs = view->pvs;
+	send->view = &view->ents;
+    } else {
+	pvs = (leafbits_t *)(sv_sendpvs + pvssize * sv_numsends);
+	VectorAdd(client->edict->v.origin, client->edict->v.view_ofs, org);
+	memcpy(pvs, Mod_FatPVS(sv.worldmodel, org), pvssize);
+	send->pvs = pvs;
+	send->view = NULL;
+    }
+    sv_numsends++;
+}
+
+/*
+=======================
+SV_BuildClientDatagram
+=======================
+*/
+static void
+SV_BuildClientDatagram(void *data, int index)
+{
+    clientsend_t *send = (clientsend_t *)data + index;
+    client_t *client = send->client;
+    sizebuf_t *msg = &send->msg;
+
+    msg->data = send->buf;
+    msg->maxsize = sizeof(send->buf);
+    msg->cursize = 0;
+    msg->allowoverflow = true;
+    msg->overflowed = false;
 
     // add the client specific data to the datagram
-    SV_WriteClientdataToMessage(client, &msg);
+    SV_WriteClientdataToMessage(client, msg);
 
     // send over all the objects that are in the PVS
     // this will include clients, a packetentities, and
     // possibly a nails update
-    SV_WriteEntitiesToClient(client, &msg);
+    SV_WriteEntitiesToClient(client, send->pvs, send->view, msg);
 
     // copy the accumulated multicast datagram
     // for this client out to the message
-    if (client->datagram.overflowed)
-	Con_Printf("WARNING: datagram overflowed for %s\n", client->name);
-    else
-	SZ_Write(&msg, client->datagram.data, client->datagram.cursize);
+    send->datagram_overflowed = client->datagram.overflowed;
+    if (!send->datagram_overflowed)
+	SZ_Write(msg, client->datagram.data, client->datagram.cursize);
     SZ_Clear(&client->datagram);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+=======================
+*/
+static void
+SV_SendClientDatagram(clientsend_t *send)
+{
+    client_t *client = send->client;
+
+    if (send->datagram_overflowed)
+	Con_Printf("WARNING: datagram overflowed for %s\n", client->name);
 
     // send deltas over reliable stream
     if (Netchan_CanReliable(&client->netchan))
 	SV_UpdateClientStats(client);
 
-    if (msg.overflowed) {
+    if (send->msg.overflowed) {
 	Con_Printf("WARNING: msg overflowed for %s\n", client->name);
-	SZ_Clear(&msg);
+	SZ_Clear(&send->msg);
     }
+    SV_WriteDownloadChunks(client, &send->msg);
+
     // send the datagram
-    Netchan_Transmit(&client->netchan, msg.cursize, buf);
+    Netchan_Transmit(&client->netchan, send->msg.cursize, send->buf);
+}
+
+/*
+=======================
+SV_SendDownloadDatagram
+
+Only the reliable data and any download goes to a client not in the game
+=======================
+*/
+static void
+SV_SendDownloadDatagram(client_t *client)
+{
+    byte buf[MAX_DATAGRAM];
+    sizebuf_t msg;
 
-    return true;
+    memset(&msg, 0, sizeof(msg));
+    msg.data = buf;
+    msg.maxsize = sizeof(buf);
+    SV_WriteDownloadChunks(client, &msg);
+    Netchan_Transmit(&client->netchan, msg.cursize, buf);
 }
 
 /*
@@ -637,17 +813,20 @@ SV_UpdateToReliableMessages(void)
 		ClientReliableWrite_Byte(recipient, i);
 		ClientReliableWrite_Short(recipient, player->v.frags);
 	    }
+	    SV_DemoWrite((byte[]) { svc_updatefrags, i,
+			 (int)player->v.frags & 0xff,
+			 ((int)player->v.frags >> 8) & 0xff }, 4);
 	    client->old_frags = player->v.frags;
 	}
 
 	/* maxspeed/entgravity changes */
-	val = GetEdictFieldValue(player, "gravity");
+	val = GetEdictField(player, pr_extfields.gravity);
 	if (val && client->entgravity != val->_float) {
 	    client->entgravity = val->_float;
 	    ClientReliableWrite_Begin(client, svc_entgravity, 5);
 	    ClientReliableWrite_Float(client, client->entgravity);
 	}
-	val = GetEdictFieldValue(player, "maxspeed");
+	val = GetEdictField(player, pr_extfields.maxspeed);
 	if (val && client->maxspeed != val->_float) {
 	    client->maxspeed = val->_float;
 	    ClientReliableWrite_Begin(client, svc_maxspeed, 5);
@@ -675,6 +854,9 @@ SV_UpdateToReliableMessages(void)
 	SZ_Write(&recipient->datagram, sv.datagram.data, sv.datagram.cursize);
     }
 
+    SV_DemoWrite(sv.reliable_datagram.data, sv.reliable_datagram.cursize);
+    SV_DemoWrite(sv.datagram.data, sv.datagram.cursize);
+
     SZ_Clear(&sv.reliable_datagram);
     SZ_Clear(&sv.datagram);
 }
@@ -688,12 +870,19 @@ SV_SendClientMessages
 void
 SV_SendClientMessages(void)
 {
-    int i, j;
+    int i, j, numthreads;
     client_t *c;
 
+    NET_BeginPackets();
+
 // update frags, names, etc
     SV_UpdateToReliableMessages();
 
+// gather what can be seen once, each client picks out its own
+    SV_BuildEntitySnapshot();
+    sv_numsends = 0;
+    sv_numviews = 0;
+
 // build individual updates
     for (i = 0, c = svs.clients; i < MAX_CLIENTS; i++, c++) {
 	if (!c->state)
@@ -752,15 +941,38 @@ SV_SendClientMessages(void)
 	c->send_message = false;	// try putting this after choke?
 	if (!sv.paused && !Netchan_CanPacket(&c->netchan)) {
 	    c->chokecount++;
+	    c->choketotal++;
 	    continue;		// bandwidth choke
 	}
 
 	if (c->state == cs_spawned)
-	    SV_SendClientDatagram(c);
+	    SV_QueueClientDatagram(c);
+	else if (c->chunkeddl)
+	    SV_SendDownloadDatagram(c);
 	else
 	    Netchan_Transmit(&c->netchan, 0, NULL);	// just update reliable
 
     }
+
+// build the datagrams, then send them in order
+    SV_ProfileBegin(SVP_ENTITIES);
+    numthreads = sv_sendthreads.value;
+    if (numthreads > 1 && sv_numsends > 1)
+	COM_ParallelFor(numthreads, SV_BuildClientDatagram, sv_sends,
+			sv_numsends);
+    else
+	for (i = 0; i < sv_numsends; i++)
+	    SV_BuildClientDatagram(sv_sends, i);
+    SV_ProfileEnd();
+
+    SV_ProfileBegin(SVP_NETWRITE);
+    for (i = 0; i < sv_numsends; i++)
+	SV_SendClientDatagram(&sv_sends[i]);
+
+    NET_FlushPackets();
+    SV_ProfileEnd();
+
+    SV_DemoFrame();
 }
 
 
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "pmove.h"
 #include "qwsvdef.h"
 #include "server.h"
+#include "sv_profile.h"
 #include "sys.h"
 #include "world.h"
 
@@ -348,11 +349,11 @@ SV_Spawn_f(client_t *client)
     player->v.netname = PR_SetString(client->name);
 
     client->entgravity = 1.0;
-    val = GetEdictFieldValue(player, "gravity");
+    val = GetEdictField(player, pr_extfields.gravity);
     if (val)
 	val->_float = 1.0;
     client->maxspeed = sv_maxspeed.value;
-    val = GetEdictFieldValue(player, "maxspeed");
+    val = GetEdictField(player, pr_extfields.maxspeed);
     if (val)
 	val->_float = sv_maxspeed.value;
 
@@ -499,6 +500,80 @@ SV_Begin_f(client_t *client)
 
 //=============================================================================
 
+/*
+==============================================================================
+
+CHUNKED DOWNLOADS
+
+The old way sends one block of the file over the reliable channel for each
+"nextdl" the client sends back, so a download crawls along at a block per
+round trip.  A client that asks for it gets the file in DOWNLOAD_CHUNK
+pieces instead, put into the unreliable part of whatever packets it's being
+sent anyway, with up to DOWNLOAD_WINDOW of them out at once.  The client
+acks each piece it gets with "dlack", and a piece that isn't acked within
+a couple of round trips goes out again.  The pieces only go in packets the
+netchan lets through, so the download keeps to the client's rate.
+
+Either way, the file is served from a view of the pak or loose file mapped
+into memory when it can be, rather than read a block at a time.
+
+==============================================================================
+*/
+
+#define DOWNLOAD_WINDOW	32
+
+typedef struct chunkeddl_s {
+    int serial;
+    int numchunks;
+    int nextchunk;		// the first never sent
+    int left;			// not acked yet
+    byte *acked;		// a flag for each chunk
+    double rtt;			// smoothed, from the acks
+    int numinflight;
+    struct {
+	int chunk;
+	double senttime;
+	qboolean resent;
+    } inflight[DOWNLOAD_WINDOW];
+} chunkeddl_t;
+
+/*
+==================
+SV_CloseDownload
+==================
+*/
+void
+SV_CloseDownload(client_t *client)
+{
+    if (client->download) {
+	fclose(client->download);
+	client->download = NULL;
+    }
+    if (client->downloaddata) {
+	Sys_UnmapFile(&client->downloadmapping);
+	client->downloaddata = NULL;
+    }
+    if (client->chunkeddl) {
+	free(client->chunkeddl->acked);
+	free(client->chunkeddl);
+	client->chunkeddl = NULL;
+    }
+}
+
+/* copies length bytes of the download from offset, if not mapped */
+static const byte *
+SV_DownloadBytes(client_t *client, int offset, int length, byte *buffer)
+{
+    if (client->downloaddata)
+	return client->downloaddata + offset;
+
+    if (fseek(client->download, offset, SEEK_SET)
+	|| fread(buffer, 1, length, client->download) != length)
+	memset(buffer, 0, length);
+
+    return buffer;
+}
+
 /*
 ==================
 SV_NextDownload_f
@@ -508,17 +583,20 @@ static void
 SV_NextDownload_f(client_t *client)
 {
     byte buffer[1024];
+    const byte *data;
     int r;
     int percent;
     int size;
 
-    if (!client->download)
+    if (!client->download && !client->downloaddata)
+	return;
+    if (client->chunkeddl)
 	return;
 
     r = client->downloadsize - client->downloadcount;
     if (r > 768)
 	r = 768;
-    r = fread(buffer, 1, r, client->download);
+    data = SV_DownloadBytes(client, client->downloadcount, r, buffer);
     ClientReliableWrite_Begin(client, svc_download, 6 + r);
     ClientReliableWrite_Short(client, r);
 
@@ -528,14 +606,160 @@ SV_NextDownload_f(client_t *client)
 	size = 1;
     percent = client->downloadcount * 100 / size;
     ClientReliableWrite_Byte(client, percent);
-    ClientReliableWrite_SZ(client, buffer, r);
+    ClientReliableWrite_SZ(client, (void *)data, r);
 
     if (client->downloadcount != client->downloadsize)
 	return;
 
-    fclose(client->download);
-    client->download = NULL;
+    SV_CloseDownload(client);
+}
+
+static void
+SV_StartChunkedDownload(client_t *client)
+{
+    static int serial;
+    chunkeddl_t *dl;
+
+    dl = calloc(1, sizeof(*dl));
+    if (dl) {
+	dl->numchunks = (client->downloadsize + DOWNLOAD_CHUNK - 1)
+	    / DOWNLOAD_CHUNK;
+	dl->acked = calloc(dl->numchunks + 1, 1);
+	if (!dl->acked) {
+	    free(dl);
+	    dl = NULL;
+	}
+    }
+    if (!dl) {
+	SV_NextDownload_f(client);	// the old way will have to do
+	return;
+    }
+    dl->serial = serial++ & 0xff;
+    dl->left = dl->numchunks;
+    dl->rtt = 0.25;
+    client->chunkeddl = dl;
+
+    ClientReliableWrite_Begin(client, svc_download, 8);
+    ClientReliableWrite_Short(client, DL_CHUNKED);
+    ClientReliableWrite_Byte(client, dl->serial);
+    ClientReliableWrite_Long(client, client->downloadsize);
+}
+
+/* returns false if there's no room left for it */
+static qboolean
+SV_WriteDownloadChunk(client_t *client, sizebuf_t *msg, int room, int chunk)
+{
+    byte buffer[DOWNLOAD_CHUNK];
+    const byte *data;
+    int offset, length;
+
+    offset = chunk * DOWNLOAD_CHUNK;
+    length = qmin(client->downloadsize - offset, DOWNLOAD_CHUNK);
+    if (msg->cursize + 10 + length > room)
+	return false;
+
+    data = SV_DownloadBytes(client, offset, length, buffer);
+    MSG_WriteByte(msg, svc_download);
+    MSG_WriteShort(msg, DL_CHUNK);
+    MSG_WriteByte(msg, client->chunkeddl->serial);
+    MSG_WriteLong(msg, chunk);
+    MSG_WriteShort(msg, length);
+    SZ_Write(msg, data, length);
+
+    return true;
+}
+
+/*
+==================
+SV_WriteDownloadChunks
+
+Adds what pieces of a chunked download will fit to the datagram about to
+go to the client: any not acked in time, then new ones while the window
+has room.  Leaves space for whatever reliable data may go out with it.
+==================
+*/
+void
+SV_WriteDownloadChunks(client_t *client, sizebuf_t *msg)
+{
+    chunkeddl_t *dl = client->chunkeddl;
+    double timeout;
+    int i, room;
+
+    if (!dl)
+	return;
+
+    room = MAX_MSGLEN - qmax(client->netchan.reliable_length,
+			     client->netchan.message.cursize);
+    room = qmin(room, msg->maxsize);
 
+    timeout = dl->rtt * 2 + 0.05;
+    for (i = 0; i < dl->numinflight; i++) {
+	if (realtime - dl->inflight[i].senttime < timeout)
+	    continue;
+	if (!SV_WriteDownloadChunk(client, msg, room, dl->inflight[i].chunk))
+	    return;
+	dl->inflight[i].senttime = realtime;
+	dl->inflight[i].resent = true;
+    }
+
+    while (dl->numinflight < DOWNLOAD_WINDOW && dl->nextchunk < dl->numchunks) {
+	if (!SV_WriteDownloadChunk(client, msg, room, dl->nextchunk))
+	    return;
+	i = dl->numinflight++;
+	dl->inflight[i].chunk = dl->nextchunk++;
+	dl->inflight[i].senttime = realtime;
+	dl->inflight[i].resent = false;
+    }
+}
+
+/*
+==================
+SV_DownloadAck_f
+
+The pieces of a chunked download the client has got
+==================
+*/
+static void
+SV_DownloadAck_f(client_t *client)
+{
+    chunkeddl_t *dl = client->chunkeddl;
+    int i, j, chunk;
+
+    if (!dl || atoi(Cmd_Argv(1)) != dl->serial)
+	return;			// left over from an earlier download
+
+    for (i = 2; i < Cmd_Argc(); i++) {
+	chunk = atoi(Cmd_Argv(i));
+	if (chunk < 0 || chunk >= dl->nextchunk || dl->acked[chunk])
+	    continue;
+	dl->acked[chunk] = 1;
+	dl->left--;
+
+	for (j = 0; j < dl->numinflight; j++) {
+	    if (dl->inflight[j].chunk != chunk)
+		continue;
+	    /* only a piece sent once says for sure how long the trip took */
+	    if (!dl->inflight[j].resent)
+		dl->rtt += (realtime - dl->inflight[j].senttime - dl->rtt) * 0.125;
+	    dl->inflight[j] = dl->inflight[--dl->numinflight];
+	    break;
+	}
+    }
+
+    if (!dl->left)
+	SV_CloseDownload(client);
+}
+
+/*
+==================
+SV_StopDownload_f
+==================
+*/
+static void
+SV_StopDownload_f(client_t *client)
+{
+    if (client->chunkeddl)
+	SV_CloseDownload(client);
 }
 
 static void
@@ -632,7 +856,8 @@ SV_BeginDownload_f
 static void
 SV_BeginDownload_f(client_t *client)
 {
-    char name[MAX_OSPATH], *p;
+    char name[MAX_OSPATH], path[MAX_OSPATH], *p;
+    size_t offset, length;
 
     /* Lowercase name (needed for casesen file systems) */
     snprintf(name, sizeof(name), "%s", Cmd_Argv(1));
@@ -661,10 +886,7 @@ SV_BeginDownload_f(client_t *client)
 	return;
     }
 
-    if (client->download) {
-	fclose(client->download);
-	client->download = NULL;
-    }
+    SV_CloseDownload(client);
 
     client->downloadsize = COM_FOpenFile(name, &client->download);
     client->downloadcount = 0;
@@ -673,10 +895,7 @@ SV_BeginDownload_f(client_t *client)
 	// special check for maps, if it came from a pak file, don't allow
 	// download  ZOID
 	|| (strncmp(name, "maps/", 5) == 0 && file_from_pak)) {
-	if (client->download) {
-	    fclose(client->download);
-	    client->download = NULL;
-	}
+	SV_CloseDownload(client);
 
 	Sys_Printf("Couldn't upload %s to %s\n", name, client->name);
 	ClientReliableWrite_Begin(client, svc_download, 4);
@@ -685,7 +904,20 @@ SV_BeginDownload_f(client_t *client)
 	return;
     }
 
-    SV_NextDownload_f(client);
+    /* serve it from memory if it can be mapped */
+    if (COM_FindFile(name, path, sizeof(path), &offset, &length)) {
+	client->downloaddata = Sys_MapFile(path, offset, client->downloadsize,
+					   &client->downloadmapping);
+	if (client->downloaddata) {
+	    fclose(client->download);
+	    client->download = NULL;
+	}
+    }
+
+    if (!strcmp(Cmd_Argv(2), "chunked"))
+	SV_StartChunkedDownload(client);
+    else
+	SV_NextDownload_f(client);
     Sys_Printf("Uploading %s to %s\n", name, client->name);
 }
 
@@ -1137,6 +1369,8 @@ static ucmd_t ucmds[] = {
 
     { "download", SV_BeginDownload_f },
     { "nextdl", SV_NextDownload_f },
+    { "dlack", SV_DownloadAck_f },
+    { "stopdl", SV_StopDownload_f },
 
     { "ptrack", SV_PTrack_f },	//ZOID - used with autocam
 
@@ -1214,70 +1448,13 @@ V_CalcRoll(vec3_t angles, vec3_t velocity)
 
 //============================================================================
 
-/*
-================
-AddAllEntsToPhysents
-
-For debugging
-================
-*/
-#if 0
-static void
-AddAllEntsToPhysents(const edict_t *player,
-		     const vec3_t mins, const vec3_t maxs,
-		     physent_stack_t *pestack)
-{
-    int i, entity, playernum;
-    edict_t *check, *next;
-    physent_t *physent;
-
-    playernum = EDICT_TO_PROG(player);
-    check = NEXT_EDICT(sv.edicts);
-    physent = pestack->physents + pestack->numphysents;
-    for (entity = 1; entity < sv.num_edicts; entity++, check = next) {
-	next = NEXT_EDICT(check);
-	if (check->free)
-	    continue;
-	if (check->v.owner == playernum)
-	    continue;
-	if (check->v.solid == SOLID_BSP
-	    || check->v.solid == SOLID_BBOX
-	    || check->v.solid == SOLID_SLIDEBOX) {
-	    if (check == player)
-		continue;
-
-	    for (i = 0; i < 3; i++)
-		if (check->v.absmin[i] > maxs[i]
-		    || check->v.absmax[i] < mins[i])
-		    break;
-	    if (i != 3)
-		continue;
-
-	    if (physent - pestack->physents == MAX_PHYSENTS)
-		break;
-	    VectorCopy(check->v.origin, physent->origin);
-	    physent->info = entity;
-	    if (check->v.solid == SOLID_BSP)
-		physent->model = sv.models[(int)(check->v.modelindex)];
-	    else {
-		physent->model = NULL;
-		VectorCopy(check->v.mins, physent->mins);
-		VectorCopy(check->v.maxs, physent->maxs);
-	    }
-	    physent++;
-	}
-    }
-    pestack->numphysents = physent - pestack->physents;
-}
-#endif
-
 /*
 ===========
 SV_PreRunCmd
 ===========
 Done before running a player command.  Clears the touch array
 */
-static byte playertouch[(MAX_EDICTS + 7) / 8];
+static byte playertouch[(MAX_NET_EDICTS + 7) / 8];
 
 static void
 SV_PreRunCmd(void)
@@ -1285,15 +1462,11 @@ SV_PreRunCmd(void)
     memset(playertouch, 0, sizeof(playertouch));
 }
 
+/* Takes the command's angles and buttons, and runs the prethink */
 static void
-SV_PlayerMove(client_t *client, const usercmd_t *cmd)
+SV_PlayerPreMove(client_t *client, const usercmd_t *cmd)
 {
     edict_t *player = client->edict;
-    playermove_t pmove;
-    physent_stack_t pestack;
-    vec3_t mins, maxs;
-    edict_t *entity;
-    int i;
 
     if (!player->v.fixangle)
 	VectorCopy(cmd->angles, player->v.v_angle);
@@ -1324,101 +1497,132 @@ SV_PlayerMove(client_t *client, const usercmd_t *cmd)
 
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(player);
+	SV_ProfileBegin(SVP_THINK);
 	PR_ExecuteProgram(pr_global_struct->PlayerPreThink);
+	SV_ProfileEnd();
 
 	SV_RunThink(player);
     }
+}
+
+/* Sets up the move from the player and gathers what they can run into */
+static void
+SV_PlayerMoveSetup(client_t *client, const usercmd_t *cmd,
+		   playermove_t *pmove, physent_stack_t *pestack)
+{
+    edict_t *player = client->edict;
+    vec3_t mins, maxs;
+    int i;
 
     for (i = 0; i < 3; i++)
-	pmove.origin[i] =
+	pmove->origin[i] =
 	    player->v.origin[i] + (player->v.mins[i] - player_mins[i]);
-    VectorCopy(player->v.velocity, pmove.velocity);
-    VectorCopy(player->v.v_angle, pmove.angles);
-
-    pmove.spectator = client->spectator;
-    pmove.waterjumptime = player->v.teleport_time;
-    pmove.cmd = cmd;
-    pmove.dead = player->v.health <= 0;
-    pmove.oldbuttons = client->oldbuttons;
+    VectorCopy(player->v.velocity, pmove->velocity);
+    VectorCopy(player->v.v_angle, pmove->angles);
 
-    movevars.entgravity = client->entgravity;
-    movevars.maxspeed = client->maxspeed;
+    pmove->spectator = client->spectator;
+    pmove->waterjumptime = player->v.teleport_time;
+    pmove->cmd = cmd;
+    pmove->dead = player->v.health <= 0;
+    pmove->oldbuttons = client->oldbuttons;
+    pmove->entgravity = client->entgravity;
+    pmove->maxspeed = client->maxspeed;
 
     /* Init the world's physent */
-    memset(&pestack.physents[0], 0, sizeof(pestack.physents[0]));
-    pestack.physents[0].brushmodel = ConstBrushModel(&sv.worldmodel->model);
-    pestack.numphysent = 1;
+    memset(&pestack->physents[0], 0, sizeof(pestack->physents[0]));
+    pestack->physents[0].brushmodel = ConstBrushModel(&sv.worldmodel->model);
+    pestack->numphysent = 1;
 
     for (i = 0; i < 3; i++) {
-	mins[i] = pmove.origin[i] - 256;
-	maxs[i] = pmove.origin[i] + 256;
+	mins[i] = pmove->origin[i] - 256;
+	maxs[i] = pmove->origin[i] + 256;
     }
-#if 1
-    SV_AddLinksToPhysents(player, mins, maxs, &pestack);
-#else
-    AddAllEntsToPmove(player, mins, maxs, &pestack);
-#endif
-
-#if 0
-    {
-	int before, after;
-
-	before = PM_TestPlayerPosition(pmove.origin);
-	PlayerMove(&pmove, &pestack);
-	after = PM_TestPlayerPosition(pmove.origin);
+    SV_AddLinksToPhysents(player, mins, maxs, pestack);
+}
 
-	if (player->v.health > 0 && before && !after)
-	    Con_Printf("player %s got stuck in playermove!!!!\n",
-		       client->name);
-    }
-#else
-    PlayerMove(&pmove, &pestack);
-#endif
+/*
+ * Takes the result of the move back into the player, links them and runs
+ * the touches, each entity once for the touched bits given.
+ */
+static void
+SV_PlayerMoveEnd(client_t *client, const playermove_t *pmove, byte *touched)
+{
+    edict_t *player = client->edict;
+    edict_t *entity;
+    int i;
 
-    client->oldbuttons = pmove.oldbuttons;
-    player->v.teleport_time = pmove.waterjumptime;
-    player->v.waterlevel = pmove.waterlevel;
-    player->v.watertype = pmove.watertype;
-    if (pmove.onground) {
-	const int entitynum = pmove.onground->entitynum;
+    client->oldbuttons = pmove->oldbuttons;
+    player->v.teleport_time = pmove->waterjumptime;
+    player->v.waterlevel = pmove->waterlevel;
+    player->v.watertype = pmove->watertype;
+    if (pmove->onground) {
+	const int entitynum = pmove->onground->entitynum;
 	player->v.groundentity = EDICT_TO_PROG(EDICT_NUM(entitynum));
 	player->v.flags = (int)player->v.flags | FL_ONGROUND;
     } else
 	player->v.flags = (int)player->v.flags & ~FL_ONGROUND;
     for (i = 0; i < 3; i++)
 	player->v.origin[i] =
-	    pmove.origin[i] - (player->v.mins[i] - player_mins[i]);
+	    pmove->origin[i] - (player->v.mins[i] - player_mins[i]);
 
 #if 0
     // truncate velocity the same way the net protocol will
     for (i = 0; i < 3; i++)
-	player->v.velocity[i] = (int)pmove.velocity[i];
+	player->v.velocity[i] = (int)pmove->velocity[i];
 #else
-    VectorCopy(pmove.velocity, player->v.velocity);
+    VectorCopy(pmove->velocity, player->v.velocity);
 #endif
 
-    VectorCopy(pmove.angles, player->v.v_angle);
+    VectorCopy(pmove->angles, player->v.v_angle);
 
     if (!client->spectator) {
 	// link into place and touch triggers
 	SV_LinkEdict(player, true);
 
 	// touch other objects
-	for (i = 0; i < pmove.numtouch; i++) {
-	    const int entitynum = pmove.touch[i]->entitynum;
+	for (i = 0; i < pmove->numtouch; i++) {
+	    const int entitynum = pmove->touch[i]->entitynum;
 	    entity = EDICT_NUM(entitynum);
 	    if (!entity->v.touch)
 		continue;
-	    if (playertouch[entitynum / 8] & (1 << (entitynum % 8)))
+	    if (touched[entitynum / 8] & (1 << (entitynum % 8)))
 		continue;
 	    pr_global_struct->self = EDICT_TO_PROG(entity);
 	    pr_global_struct->other = EDICT_TO_PROG(player);
+	    SV_ProfileBegin(SVP_TOUCH);
 	    PR_ExecuteProgram(entity->v.touch);
-	    playertouch[entitynum / 8] |= 1 << (entitynum % 8);
+	    SV_ProfileEnd();
+	    touched[entitynum / 8] |= 1 << (entitynum % 8);
 	}
     }
 }
 
+static void
+SV_PlayerMove(client_t *client, const usercmd_t *cmd)
+{
+    playermove_t pmove;
+    physent_stack_t pestack;
+
+    SV_PlayerPreMove(client, cmd);
+    SV_PlayerMoveSetup(client, cmd, &pmove, &pestack);
+#if 0
+    {
+	int before, after;
+
+	before = PM_TestPlayerPosition(pmove.origin);
+	PlayerMove(&pmove, &pestack);
+	after = PM_TestPlayerPosition(pmove.origin);
+
+	if (client->edict->v.health > 0 && before && !after)
+	    Con_Printf("player %s got stuck in playermove!!!!\n",
+		       client->name);
+    }
+#else
+    PlayerMove(&pmove, &pestack);
+#endif
+    SV_PlayerMoveEnd(client, &pmove, playertouch);
+}
+
 /*
 ===========
 SV_RunCmd
@@ -1455,12 +1659,175 @@ SV_PostRunCmd(client_t *client)
     if (!client->spectator) {
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(player);
+	SV_ProfileBegin(SVP_THINK);
 	PR_ExecuteProgram(pr_global_struct->PlayerPostThink);
+	SV_ProfileEnd();
 	SV_RunNewmis();
     } else if (SpectatorThink) {
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(player);
+	SV_ProfileBegin(SVP_THINK);
 	PR_ExecuteProgram(SpectatorThink);
+	SV_ProfileEnd();
+    }
+}
+
+
+/*
+==============================================================================
+
+PARALLEL PLAYER MOVES
+
+With sv_physthreads above 1, the moves in the packets read in a frame are
+queued rather than run as each packet is read.  Once all the packets are in,
+they are run in rounds, the first command of every queued client, then the
+second of those with more, and so on.  In each round the prethinks run and
+the physents are gathered in client order, then the moves themselves run
+together across the threads, then the results are applied and the touches
+run in client order, and once all the rounds are done the postthinks.
+
+So the players in a round move against where the others were before it, and
+all of their prethinks come before any of their touches.  If a player is
+moved by anything run before their turn to finish, they are moved again
+from scratch.  A second packet from a client already queued runs what is
+queued first.
+
+==============================================================================
+*/
+
+/* 20 commands for a dropped packet, each split in up to 8 */
+#define MAX_QUEUED_CMDS 160
+
+typedef struct {
+    qboolean queued;
+    int numcmds;
+    usercmd_t cmds[MAX_QUEUED_CMDS];
+    byte touched[(MAX_NET_EDICTS + 7) / 8];
+    /* the move of the current round, and what it was set up from */
+    playermove_t pmove;
+    physent_stack_t pestack;
+    vec3_t origin, velocity;
+} movequeue_t;
+
+static movequeue_t sv_movequeues[MAX_CLIENTS];
+static qboolean sv_movesqueued;
+
+static void
+SV_QueueCmd(movequeue_t *queue, const usercmd_t *cmd)
+{
+    /* split up very long moves, as SV_RunCmd does */
+    if (cmd->msec > 50) {
+	usercmd_t split = *cmd;
+
+	split.msec /= 2;
+	SV_QueueCmd(queue, &split);
+	split.impulse = 0;
+	SV_QueueCmd(queue, &split);
+	return;
+    }
+    if (queue->numcmds < MAX_QUEUED_CMDS)
+	queue->cmds[queue->numcmds++] = *cmd;
+}
+
+static void
+SV_QueueMoves(client_t *client, int drop, const usercmd_t *oldest,
+	      const usercmd_t *oldcmd, const usercmd_t *newcmd)
+{
+    movequeue_t *queue = &sv_movequeues[client - svs.clients];
+
+    if (queue->queued)
+	SV_RunQueuedMoves();
+
+    queue->queued = true;
+    queue->numcmds = 0;
+    memset(queue->touched, 0, sizeof(queue->touched));
+    sv_movesqueued = true;
+
+    if (drop < 20) {
+	while (drop > 2) {
+	    SV_QueueCmd(queue, &client->lastcmd);
+	    drop--;
+	}
+	if (drop > 1)
+	    SV_QueueCmd(queue, oldest);
+	if (drop > 0)
+	    SV_QueueCmd(queue, oldcmd);
+    }
+    SV_QueueCmd(queue, newcmd);
+}
+
+/* Run on the worker threads, so only reads the world and the physents */
+static void
+SV_QueuedPlayerMove(void *data, int index)
+{
+    movequeue_t *queue = ((movequeue_t **)data)[index];
+
+    PlayerMove(&queue->pmove, &queue->pestack);
+}
+
+/*
+===================
+SV_RunQueuedMoves
+
+Runs the moves queued from the packets read so far
+===================
+*/
+void
+SV_RunQueuedMoves(void)
+{
+    movequeue_t *moving[MAX_CLIENTS], *queue;
+    client_t *client;
+    int i, round, nummoving;
+
+    if (!sv_movesqueued)
+	return;
+    sv_movesqueued = false;
+
+    for (round = 0; ; round++) {
+	nummoving = 0;
+	queue = sv_movequeues;
+	client = svs.clients;
+	for (i = 0; i < MAX_CLIENTS; i++, queue++, client++) {
+	    if (!queue->queued || round >= queue->numcmds)
+		continue;
+	    if (client->state != cs_spawned)
+		continue;
+	    SV_PlayerPreMove(client, &queue->cmds[round]);
+	    SV_PlayerMoveSetup(client, &queue->cmds[round], &queue->pmove,
+			       &queue->pestack);
+	    VectorCopy(client->edict->v.origin, queue->origin);
+	    VectorCopy(client->edict->v.velocity, queue->velocity);
+	    moving[nummoving++] = queue;
+	}
+	if (!nummoving)
+	    break;
+
+	Mod_SetTraceThreaded(true);
+	COM_ParallelFor(sv_physthreads.value, SV_QueuedPlayerMove, moving,
+			nummoving);
+	Mod_SetTraceThreaded(false);
+
+	for (i = 0; i < nummoving; i++) {
+	    queue = moving[i];
+	    client = &svs.clients[queue - sv_movequeues];
+	    if (!VectorCompare(client->edict->v.origin, queue->origin)
+		|| !VectorCompare(client->edict->v.velocity, queue->velocity)) {
+		SV_PlayerMoveSetup(client, &queue->cmds[round], &queue->pmove,
+				   &queue->pestack);
+		PlayerMove(&queue->pmove, &queue->pestack);
+	    }
+	    SV_PlayerMoveEnd(client, &queue->pmove, queue->touched);
+	}
+    }
+
+    queue = sv_movequeues;
+    client = svs.clients;
+    for (i = 0; i < MAX_CLIENTS; i++, queue++, client++) {
+	if (!queue->queued)
+	    continue;
+	queue->queued = false;
+	if (client->state == cs_spawned)
+	    SV_PostRunCmd(client);
     }
 }
 
@@ -1565,7 +1932,9 @@ SV_ExecuteClientMessage(client_t *client)
 		return;
 	    }
 
-	    if (!sv.paused) {
+	    if (!sv.paused && sv_physthreads.value > 1) {
+		SV_QueueMoves(client, net_drop, &oldest, &oldcmd, &newcmd);
+	    } else if (!sv.paused) {
 		SV_PreRunCmd();
 
 		if (net_drop < 20) {
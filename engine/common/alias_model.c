@@ -18,10 +18,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
 #include "crc.h"
+#include "mathlib.h"
 #include "model.h"
 #include "sys.h"
 
@@ -276,6 +279,7 @@ Mod_AliasCRC(const model_t *model, const byte *buffer, int bufferlen)
 {
 #ifdef QW_HACK
     unsigned short crc;
+    unsigned checksum;
     const char *crcmodel = NULL;
 
     if (!strcmp(model->name, "progs/player.mdl"))
@@ -284,7 +288,11 @@ Mod_AliasCRC(const model_t *model, const byte *buffer, int bufferlen)
 	crcmodel = "emodel";
 
     if (crcmodel) {
-	crc = CRC_Block(buffer, bufferlen);
+	if (!COM_GetFileChecksum(model->name, CHECKSUM_CRC, &checksum)) {
+	    checksum = CRC_Block(buffer, bufferlen);
+	    COM_SetFileChecksum(model->name, CHECKSUM_CRC, checksum);
+	}
+	crc = checksum;
 	Info_SetValueForKey(cls.userinfo, crcmodel, va("%d", (int)crc),
 			    MAX_INFO_STRING);
 	if (cls.state >= ca_connected) {
@@ -342,6 +350,10 @@ Mod_AliasLoaderAlloc(const mdl_t *mdl, alias_meshdata_t *meshdata,
     meshdata->stverts = Hunk_Alloc(numverts * sizeof(*meshdata->stverts));
     meshdata->triangles = Hunk_Alloc(count * sizeof(*meshdata->triangles));
 
+    /* Each lod has at most three quarters of the triangles of the last */
+    meshdata->numlods = 0;
+    meshdata->lodtriangles[0] = Hunk_Alloc(count * 2 * sizeof(mtriangle_t));
+
     /* Expand frame groups to get total pose count */
     count = 0;
     numframes = LittleLong(mdl->numframes);
@@ -467,13 +479,366 @@ Mod_LoadAliasModel(const model_loader_t *loader, model_t *model, void *buffer)
     Hunk_FreeToLowMark(lowmark);
 }
 
+/*
+==============================================================================
+
+ALIAS MODEL LODS
+
+Each simplified mesh is made from the one before by collapsing edges, the
+shortest first, until it has half the triangles.  An edge is measured by the
+furthest its ends get apart over a few poses spread through the animation,
+so parts that move apart aren't joined up.  Vertices on the skin seam or on
+a hole in the mesh are never collapsed away, so the skin still lines up, and
+a collapse that would turn a triangle over is passed up.  The triangles keep
+the original vertex numbers and facesfront, so the drivers can draw them
+from the same pose and s/t data as the full mesh.
+
+==============================================================================
+*/
+
+#define LOD_MINTRIS	32	/* smaller meshes aren't simplified */
+#define LOD_SAMPLES	8	/* poses the edges are measured in */
+#define LOD_FULLPIXELS	128.0f	/* drawn at full detail above this size */
+
+typedef struct {
+    int numtris;		/* not yet collapsed away */
+    int numsamples;
+    mtriangle_t *tris;		/* collapsed ones have vertindex[0] = -1 */
+    int *first;			/* vertex -> first corner using it, or -1 */
+    int *next;			/* corner -> next corner at the same vertex */
+    byte *locked;
+    vec3_t *points;		/* numsamples * numverts */
+} lodmesh_t;
+
+static int
+LOD_CompareEdges(const void *a, const void *b)
+{
+    const int *edge1 = a;
+    const int *edge2 = b;
+
+    if (edge1[0] != edge2[0])
+	return edge1[0] - edge2[0];
+    return edge1[1] - edge2[1];
+}
+
+/*
+ * Vertices on an edge that doesn't have exactly two triangles are on a hole
+ * or where the mesh is pinched; either way they stay put.
+ */
+static void
+LOD_LockEdges(lodmesh_t *mesh, const aliashdr_t *hdr)
+{
+    int (*edges)[2];
+    int i, j, count, a, b;
+
+    edges = malloc(hdr->numtris * 3 * sizeof(*edges));
+    if (!edges)
+	Sys_Error("%s: out of memory", __func__);
+    for (i = 0; i < hdr->numtris; i++) {
+	for (j = 0; j < 3; j++) {
+	    a = mesh->tris[i].vertindex[j];
+	    b = mesh->tris[i].vertindex[(j + 1) % 3];
+	    edges[i * 3 + j][0] = qmin(a, b);
+	    edges[i * 3 + j][1] = qmax(a, b);
+	}
+    }
+    qsort(edges, hdr->numtris * 3, sizeof(*edges), LOD_CompareEdges);
+
+    for (i = 0; i < hdr->numtris * 3; i += count) {
+	for (count = 1; i + count < hdr->numtris * 3; count++)
+	    if (LOD_CompareEdges(edges[i], edges[i + count]))
+		break;
+	if (count != 2)
+	    mesh->locked[edges[i][0]] = mesh->locked[edges[i][1]] = true;
+    }
+    free(edges);
+}
+
+static void
+LOD_InitMesh(lodmesh_t *mesh, const aliashdr_t *hdr,
+	     const alias_meshdata_t *meshdata,
+	     const alias_posedata_t *posedata)
+{
+    const trivertx_t *verts;
+    vec_t *point;
+    int i, j, corner;
+
+    mesh->numtris = hdr->numtris;
+    mesh->numsamples = qmin(posedata->numposes, LOD_SAMPLES);
+    mesh->tris = malloc(hdr->numtris * sizeof(*mesh->tris));
+    mesh->first = malloc(hdr->numverts * sizeof(*mesh->first));
+    mesh->next = malloc(hdr->numtris * 3 * sizeof(*mesh->next));
+    mesh->locked = malloc(hdr->numverts * sizeof(*mesh->locked));
+    mesh->points = malloc(mesh->numsamples * hdr->numverts
+			  * sizeof(*mesh->points));
+    if (!mesh->tris || !mesh->first || !mesh->next || !mesh->locked
+	|| !mesh->points)
+	Sys_Error("%s: out of memory", __func__);
+
+    memcpy(mesh->tris, meshdata->triangles,
+	   hdr->numtris * sizeof(*mesh->tris));
+    for (i = 0; i < hdr->numverts; i++) {
+	mesh->first[i] = -1;
+	mesh->locked[i] = meshdata->stverts[i].onseam;
+    }
+    for (corner = hdr->numtris * 3 - 1; corner >= 0; corner--) {
+	i = mesh->tris[corner / 3].vertindex[corner % 3];
+	mesh->next[corner] = mesh->first[i];
+	mesh->first[i] = corner;
+    }
+    LOD_LockEdges(mesh, hdr);
+
+    for (i = 0; i < mesh->numsamples; i++) {
+	verts = posedata->verts[i * posedata->numposes / mesh->numsamples];
+	point = mesh->points[i * hdr->numverts];
+	for (j = 0; j < hdr->numverts; j++, verts++, point += 3) {
+	    point[0] = verts->v[0] * hdr->scale[0];
+	    point[1] = verts->v[1] * hdr->scale[1];
+	    point[2] = verts->v[2] * hdr->scale[2];
+	}
+    }
+}
+
+static void
+LOD_FreeMesh(lodmesh_t *mesh)
+{
+    free(mesh->tris);
+    free(mesh->first);
+    free(mesh->next);
+    free(mesh->locked);
+    free(mesh->points);
+}
+
+static float
+LOD_EdgeCost(const lodmesh_t *mesh, int numverts, int u, int v)
+{
+    const vec3_t *points = mesh->points;
+    float cost, length;
+    vec3_t edge;
+    int i;
+
+    cost = 0;
+    for (i = 0; i < mesh->numsamples; i++, points += numverts) {
+	VectorSubtract(points[u], points[v], edge);
+	length = DotProduct(edge, edge);
+	cost = qmax(cost, length);
+    }
+
+    return cost;
+}
+
+static void
+LOD_TriangleNormal(const lodmesh_t *mesh, const mtriangle_t *tri,
+		   int u, int v, vec3_t normal)
+{
+    const vec_t *corners[3];
+    vec3_t edge1, edge2;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	const int vert = tri->vertindex[i];
+	corners[i] = mesh->points[vert == u ? v : vert];
+    }
+    VectorSubtract(corners[1], corners[0], edge1);
+    VectorSubtract(corners[2], corners[0], edge2);
+    CrossProduct(edge1, edge2, normal);
+}
+
+/* Would moving u onto v turn over any triangle left standing? */
+static qboolean
+LOD_CollapseFlips(const lodmesh_t *mesh, int u, int v)
+{
+    const mtriangle_t *tri;
+    vec3_t before, after;
+    int corner;
+
+    for (corner = mesh->first[u]; corner >= 0; corner = mesh->next[corner]) {
+	tri = &mesh->tris[corner / 3];
+	if (tri->vertindex[0] < 0)
+	    continue;
+	if (tri->vertindex[0] == v || tri->vertindex[1] == v
+	    || tri->vertindex[2] == v)
+	    continue;
+	LOD_TriangleNormal(mesh, tri, u, u, before);
+	LOD_TriangleNormal(mesh, tri, u, v, after);
+	if (DotProduct(before, after) <= 0)
+	    return true;
+    }
+
+    return false;
+}
+
+static void
+LOD_Collapse(lodmesh_t *mesh, int u, int v)
+{
+    mtriangle_t *tri;
+    int corner, last;
+
+    last = -1;
+    for (corner = mesh->first[u]; corner >= 0; corner = mesh->next[corner]) {
+	last = corner;
+	tri = &mesh->tris[corner / 3];
+	if (tri->vertindex[0] < 0)
+	    continue;
+	tri->vertindex[corner % 3] = v;
+	if (tri->vertindex[0] == tri->vertindex[1]
+	    || tri->vertindex[1] == tri->vertindex[2]
+	    || tri->vertindex[2] == tri->vertindex[0]) {
+	    tri->vertindex[0] = -1;
+	    mesh->numtris--;
+	}
+    }
+
+    /* u's corners are v's now */
+    if (last >= 0) {
+	mesh->next[last] = mesh->first[v];
+	mesh->first[v] = mesh->first[u];
+	mesh->first[u] = -1;
+    }
+}
+
+static qboolean
+LOD_CollapseShortest(lodmesh_t *mesh, const aliashdr_t *hdr)
+{
+    const mtriangle_t *tri;
+    int i, j, u, v, bestu, bestv;
+    float cost, bestcost;
+
+    bestu = bestv = -1;
+    bestcost = 0;
+    for (i = 0, tri = mesh->tris; i < hdr->numtris; i++, tri++) {
+	if (tri->vertindex[0] < 0)
+	    continue;
+	/* each edge, both ways round */
+	for (j = 0; j < 6; j++) {
+	    u = tri->vertindex[j % 3];
+	    v = tri->vertindex[(j < 3) ? (j + 1) % 3 : (j + 2) % 3];
+	    if (mesh->locked[u])
+		continue;
+	    cost = LOD_EdgeCost(mesh, hdr->numverts, u, v);
+	    if (bestu >= 0 && cost >= bestcost)
+		continue;
+	    if (LOD_CollapseFlips(mesh, u, v))
+		continue;
+	    bestu = u;
+	    bestv = v;
+	    bestcost = cost;
+	}
+    }
+    if (bestu < 0)
+	return false;
+
+    LOD_Collapse(mesh, bestu, bestv);
+
+    return true;
+}
+
+/*
+=================
+Mod_AliasSimplify
+=================
+*/
+void
+Mod_AliasSimplify(const aliashdr_t *hdr, alias_meshdata_t *meshdata,
+		  const alias_posedata_t *posedata)
+{
+    const mtriangle_t *tri;
+    mtriangle_t *out;
+    lodmesh_t mesh;
+    int i, lastnumtris;
+
+    meshdata->numlods = 0;
+    if (hdr->numtris < LOD_MINTRIS)
+	return;
+
+    LOD_InitMesh(&mesh, hdr, meshdata, posedata);
+    out = meshdata->lodtriangles[0];
+    lastnumtris = hdr->numtris;
+    while (meshdata->numlods < MAXALIASLODS && lastnumtris >= LOD_MINTRIS) {
+	while (mesh.numtris > lastnumtris / 2)
+	    if (!LOD_CollapseShortest(&mesh, hdr))
+		break;
+
+	/* not worth a level if there's little left to take out */
+	if (mesh.numtris > lastnumtris * 3 / 4)
+	    break;
+
+	meshdata->lodtriangles[meshdata->numlods] = out;
+	meshdata->lodnumtris[meshdata->numlods] = mesh.numtris;
+	meshdata->numlods++;
+	for (i = 0, tri = mesh.tris; i < hdr->numtris; i++, tri++)
+	    if (tri->vertindex[0] >= 0)
+		*out++ = *tri;
+	lastnumtris = mesh.numtris;
+    }
+    LOD_FreeMesh(&mesh);
+}
+
+/*
+=================
+Mod_AliasLOD
+
+Each level down is for half the size on screen, r_lodbias levels sooner
+=================
+*/
+int
+Mod_AliasLOD(const aliashdr_t *hdr, float pixels, float bias)
+{
+    float level;
+
+    if (!hdr->numlods)
+	return 0;
+
+    level = log2f(LOD_FULLPIXELS / qmax(pixels, 1.0f)) + bias + 1.0f;
+    level = qclamp(level, 0.0f, (float)hdr->numlods);
+
+    return (int)level;
+}
+
+/*
+=================
+Mod_AliasFrameRadius
+
+The radius about the model's origin that bounds the frame in any rotation
+=================
+*/
+float
+Mod_AliasFrameRadius(const aliashdr_t *hdr, int frame)
+{
+    const maliasframedesc_t *framedesc;
+    float radius, low, high;
+    int i;
+
+    if (frame < 0 || frame >= hdr->numframes)
+	frame = 0;
+    framedesc = &hdr->frames[frame];
+
+    radius = 0;
+    for (i = 0; i < 3; i++) {
+	low = framedesc->bboxmin.v[i] * hdr->scale[i] + hdr->scale_origin[i];
+	high = framedesc->bboxmax.v[i] * hdr->scale[i] + hdr->scale_origin[i];
+	low = qmax(fabsf(low), fabsf(high));
+	radius += low * low;
+    }
+
+    return sqrtf(radius);
+}
+
 /* Alias model cache */
+#define MCACHE_HASH_SIZE 512	/* must be a power of two */
 static struct {
     model_t free;
     model_t used;
     model_t overflow;
+    model_t *hash[MCACHE_HASH_SIZE];	/* used and overflow, by name */
 } mcache;
 
+static model_t **
+Mod_AliasBucket(const char *name)
+{
+    return &mcache.hash[COM_HashFileName(name) & (MCACHE_HASH_SIZE - 1)];
+}
+
 void
 Mod_InitAliasCache(void)
 {
@@ -486,6 +851,7 @@ Mod_InitAliasCache(void)
      * level loads. If it fills up, put extras on the overflow list...
      */
     mcache.used.next = mcache.overflow.next = NULL;
+    memset(mcache.hash, 0, sizeof(mcache.hash));
     mcache.free.next = Hunk_AllocName(MAX_MCACHE * sizeof(model_t), "mcache");
 
     model = mcache.free.next;
@@ -499,21 +865,17 @@ Mod_FindAliasName(const char *name)
 {
     model_t *model;
 
-    for (model = mcache.used.next; model; model = model->next)
-	if (!strcmp(model->name, name))
-	    return model;
-
-    for (model = mcache.overflow.next; model; model = model->next)
+    for (model = *Mod_AliasBucket(name); model; model = model->hashnext)
 	if (!strcmp(model->name, name))
 	    return model;
 
-    return model;
+    return NULL;
 }
 
 model_t *
-Mod_NewAliasModel(void)
+Mod_NewAliasModel(const char *name)
 {
-    model_t *model;
+    model_t *model, **bucket;
 
     model = mcache.free.next;
     if (model) {
@@ -527,21 +889,31 @@ Mod_NewAliasModel(void)
 	mcache.overflow.next = model;
     }
 
+    snprintf(model->name, sizeof(model->name), "%s", name);
+    bucket = Mod_AliasBucket(model->name);
+    model->hashnext = *bucket;
+    *bucket = model;
+
     return model;
 }
 
 void
 Mod_ClearAlias(void)
 {
-    model_t *model;
+    model_t *model, **link;
 
     /*
      * For now, only need to worry about overflow above the host
      * hunklevel which will disappear.
      */
-    for (model = mcache.overflow.next; model; model = model->next)
+    for (model = mcache.overflow.next; model; model = model->next) {
 	if (model->cache.data)
 	    Cache_Free(&model->cache);
+	link = Mod_AliasBucket(model->name);
+	while (*link != model)
+	    link = &(*link)->hashnext;
+	*link = model->hashnext;
+    }
     mcache.overflow.next = NULL;
 }
 
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // cmd.c -- Quake script command processing module
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "client.h"
@@ -80,10 +81,30 @@ Cmd_Wait_f(void)
 =============================================================================
 */
 
-static sizebuf_t cmd_text;
-#ifdef QW_HACK
-static byte cmd_text_buf[8192];
-#endif
+/*
+ * The text waits in a ring, so taking a command off the front or inserting
+ * one there doesn't move the rest of the text.
+ */
+#define CMD_TEXT_SIZE	8192	// a power of two
+#define CMD_TEXT_MASK	(CMD_TEXT_SIZE - 1)
+
+static struct {
+    char data[CMD_TEXT_SIZE];
+    int head;			// where the next command starts
+    int cursize;
+} cmd_text;
+
+/* Copies text into the ring at the given position, wrapping as needed */
+static void
+Cbuf_Write(int pos, const char *text, int len)
+{
+    int first;
+
+    pos &= CMD_TEXT_MASK;
+    first = qmin(len, CMD_TEXT_SIZE - pos);
+    memcpy(cmd_text.data + pos, text, first);
+    memcpy(cmd_text.data, text + first, len - first);
+}
 
 /*
 ============
@@ -93,14 +114,8 @@ Cbuf_Init
 void
 Cbuf_Init(void)
 {
-#ifdef NQ_HACK
-    SZ_Alloc(&cmd_text, 8192);
-#endif
-#ifdef QW_HACK
-    cmd_text.data = cmd_text_buf;
-    cmd_text.maxsize = sizeof(cmd_text_buf);
+    cmd_text.head = 0;
     cmd_text.cursize = 0;
-#endif
 }
 
 
@@ -114,19 +129,19 @@ Adds command text at the end of the buffer
 void
 Cbuf_AddText(const char *fmt, ...)
 {
+    static char buf[CMD_TEXT_SIZE];
     va_list ap;
     int len, maxlen;
-    char *buf;
 
-    buf = (char *)cmd_text.data + cmd_text.cursize;
-    maxlen = cmd_text.maxsize - cmd_text.cursize;
+    maxlen = CMD_TEXT_SIZE - cmd_text.cursize;
     va_start(ap, fmt);
     len = vsnprintf(buf, maxlen, fmt, ap);
     va_end(ap);
 
-    if (cmd_text.cursize + len < cmd_text.maxsize)
+    if (cmd_text.cursize + len < CMD_TEXT_SIZE) {
+	Cbuf_Write(cmd_text.head + cmd_text.cursize, buf, len);
 	cmd_text.cursize += len;
-    else
+    } else
 	Con_Printf("%s: overflow\n", __func__);
 }
 
@@ -146,13 +161,13 @@ Cbuf_InsertText(const char *text)
 
     len = strlen(text);
     if (cmd_text.cursize) {
-	if (cmd_text.cursize + len + 1 > cmd_text.maxsize)
+	if (cmd_text.cursize + len + 1 > CMD_TEXT_SIZE)
 	    Sys_Error("%s: overflow", __func__);
 
-	/* move any commands still remaining in the exec buffer */
-	memmove(cmd_text.data + len + 1, cmd_text.data, cmd_text.cursize);
-	memcpy(cmd_text.data, text, len);
-	cmd_text.data[len] = '\n';
+	/* go in front of any commands still remaining in the exec buffer */
+	cmd_text.head = (cmd_text.head - len - 1) & CMD_TEXT_MASK;
+	Cbuf_Write(cmd_text.head, text, len);
+	cmd_text.data[(cmd_text.head + len) & CMD_TEXT_MASK] = '\n';
 	cmd_text.cursize += len + 1;
     } else {
 	Cbuf_AddText("%s\n", text);
@@ -167,43 +182,42 @@ Cbuf_Execute
 void
 Cbuf_Execute(void)
 {
-    int len, maxlen;
-    char *text;
-    char line[1024];
+    int len, maxlen, first;
+    char c, line[1024];
     int quotes;
 
     while (cmd_text.cursize) {
 	/* find a \n or ; line break */
-	text = (char *)cmd_text.data;
-
 	quotes = 0;
 	maxlen = qmin(cmd_text.cursize, (int)sizeof(line));
 	for (len = 0; len < maxlen; len++) {
-	    if (text[len] == '"')
+	    c = cmd_text.data[(cmd_text.head + len) & CMD_TEXT_MASK];
+	    if (c == '"')
 		quotes++;
-	    if (!(quotes & 1) && text[len] == ';')
+	    if (!(quotes & 1) && c == ';')
 		break;		/* don't break if inside a quoted string */
-	    if (text[len] == '\n')
+	    if (c == '\n')
 		break;
 	}
 	if (len == sizeof(line)) {
 	    Con_Printf("%s: command truncated\n", __func__);
 	    len--;
 	}
-	memcpy(line, text, len);
+	first = qmin(len, CMD_TEXT_SIZE - cmd_text.head);
+	memcpy(line, cmd_text.data + cmd_text.head, first);
+	memcpy(line + first, cmd_text.data, len - first);
 	line[len] = 0;
 
 	/*
-	 * delete the text from the command buffer and move remaining commands
-	 * down this is necessary because commands (exec, alias) can insert
-	 * data at the beginning of the text buffer
+	 * take the text off the command buffer before running it, as commands
+	 * (exec, alias) can insert text at the front of the buffer
 	 */
 	if (len == cmd_text.cursize)
 	    cmd_text.cursize = 0;
 	else {
 	    len++; /* skip the terminating character */
 	    cmd_text.cursize -= len;
-	    memmove(text, text + len, cmd_text.cursize);
+	    cmd_text.head = (cmd_text.head + len) & CMD_TEXT_MASK;
 	}
 
 	/* execute the command line */
@@ -225,6 +239,19 @@ Cbuf_Execute(void)
     }
 }
 
+/*
+============
+Cbuf_Pending
+
+True while text is left in the buffer for a later frame, after a wait
+============
+*/
+qboolean
+Cbuf_Pending(void)
+{
+    return cmd_text.cursize > 0;
+}
+
 /*
 ==============================================================================
 
@@ -457,6 +484,16 @@ static const char *cmd_argv[MAX_ARGS];
 static const char *cmd_null_string = "";
 static const char *cmd_args = NULL;
 
+/*
+ * The tokens are kept one after another in a buffer which only ever grows,
+ * so tokenizing doesn't allocate once it's big enough.
+ */
+static struct {
+    char *data;
+    int size;
+    int offsets[MAX_ARGS];
+} cmd_argbuf;
+
 #ifdef NQ_HACK
 cmd_source_t cmd_source;
 #endif
@@ -530,15 +567,11 @@ Parses the given string into command line tokens.
 void
 Cmd_TokenizeString(const char *text)
 {
-    int i;
-    char *arg;
-
-// clear the args from the last string
-    for (i = 0; i < cmd_argc; i++)
-	Z_Free(cmd_argv[i]);
+    int i, len, used;
 
     cmd_argc = 0;
     cmd_args = NULL;
+    used = 0;
 
     while (1) {
 // skip whitespace up to a /n
@@ -546,28 +579,35 @@ Cmd_TokenizeString(const char *text)
 	    text++;
 	}
 
-	if (*text == '\n') {	// a newline seperates commands in the buffer
-	    text++;
+	if (*text == '\n')	// a newline seperates commands in the buffer
 	    break;
-	}
-
 	if (!*text)
-	    return;
+	    break;
 
 	if (cmd_argc == 1)
 	    cmd_args = text;
 
 	text = COM_Parse(text);
 	if (!text)
-	    return;
+	    break;
 
 	if (cmd_argc < MAX_ARGS) {
-	    arg = Z_Malloc(strlen(com_token) + 1);
-	    strcpy(arg, com_token);
-	    cmd_argv[cmd_argc] = arg;
-	    cmd_argc++;
+	    len = strlen(com_token) + 1;
+	    if (used + len > cmd_argbuf.size) {
+		cmd_argbuf.size = qmax(used + len, cmd_argbuf.size * 2);
+		cmd_argbuf.data = realloc(cmd_argbuf.data, cmd_argbuf.size);
+		if (!cmd_argbuf.data)
+		    Sys_Error("%s: out of memory", __func__);
+	    }
+	    memcpy(cmd_argbuf.data + used, com_token, len);
+	    cmd_argbuf.offsets[cmd_argc++] = used;
+	    used += len;
 	}
     }
+
+    /* the buffer may have moved as it grew */
+    for (i = 0; i < cmd_argc; i++)
+	cmd_argv[i] = cmd_argbuf.data + cmd_argbuf.offsets[i];
 }
 
 static struct cmd_function_s *
@@ -26,6 +26,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <string.h>
 #include <sys/types.h>
 
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef NQ_HACK
 #include "quakedef.h"
 #include "host.h"
@@ -48,6 +52,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "net.h"
 #include "shell.h"
 #include "sys.h"
+#include "trace.h"
 #include "zone.h"
 
 #define NUM_SAFE_ARGVS 7
@@ -189,8 +194,9 @@ InsertLinkAfter(link_t *l, link_t *after)
 static char *
 COM_GetStrBuf(void)
 {
-    static char buffers[4][COM_STRBUF_LEN];
-    static int index;
+    /* per thread, so va() is safe off the main thread */
+    static __thread char buffers[4][COM_STRBUF_LEN];
+    static __thread int index;
     return buffers[3 & ++index];
 }
 
@@ -533,6 +539,24 @@ MSG_WriteAngle16(sizebuf_t *sb, float f)
     MSG_WriteShort(sb, (int)floorf((f * 65536 / 360) + 0.5f) & 65535);
 }
 
+void
+MSG_WriteCoords3(sizebuf_t *sb, const float *v)
+{
+    MSG_PutCoords3(SZ_GetSpace(sb, 6), v);
+}
+
+/*
+ * Where MSG_BeginGroup puts a group that doesn't fit, for MSG_EndGroup to
+ * write out.  One per thread, as servers and clients write at the same time.
+ */
+byte *
+MSG_SpillGroup(void)
+{
+    static __thread byte spill[MSG_MAXGROUP];
+
+    return spill;
+}
+
 #ifdef QW_HACK
 void
 MSG_WriteDeltaUsercmd(sizebuf_t *buf, const usercmd_t *from,
@@ -623,91 +647,31 @@ MSG_GetReadCount(void)
 }
 #endif
 
-// returns -1 and sets msg_badread if no more characters are available
-int
-MSG_ReadChar(void)
+/* the slow path of MSG_ReadGroup, for a group that runs off the end */
+const byte *
+MSG_ReadShortGroup(int length)
 {
-    int c;
+    static const byte zeros[MSG_MAXGROUP];
 
-    if (msg_readcount + 1 > net_message.cursize) {
-	msg_badread = true;
-	return -1;
-    }
-
-    c = (signed char)net_message.data[msg_readcount];
-    msg_readcount++;
-
-    return c;
-}
+    if (length > MSG_MAXGROUP)
+	Sys_Error("%s: %d byte group", __func__, length);
+    msg_badread = true;
+    msg_readcount = net_message.cursize;
 
-int
-MSG_ReadByte(void)
-{
-    int c;
-
-    if (msg_readcount + 1 > net_message.cursize) {
-	msg_badread = true;
-	return -1;
-    }
-
-    c = (unsigned char)net_message.data[msg_readcount];
-    msg_readcount++;
-
-    return c;
-}
-
-int
-MSG_ReadShort(void)
-{
-    int c;
-
-    if (msg_readcount + 2 > net_message.cursize) {
-	msg_badread = true;
-	return -1;
-    }
-
-    c = (short)(net_message.data[msg_readcount]
-		+ (net_message.data[msg_readcount + 1] << 8));
-
-    msg_readcount += 2;
-
-    return c;
-}
-
-int
-MSG_ReadLong(void)
-{
-    int c;
-
-    if (msg_readcount + 4 > net_message.cursize) {
-	msg_badread = true;
-	return -1;
-    }
-
-    c = net_message.data[msg_readcount]
-	+ (net_message.data[msg_readcount + 1] << 8)
-	+ (net_message.data[msg_readcount + 2] << 16)
-	+ (net_message.data[msg_readcount + 3] << 24);
-
-    msg_readcount += 4;
-
-    return c;
+    return zeros;
 }
 
 float
 MSG_ReadFloat(void)
 {
+    const byte *p = MSG_ReadGroup(4);
     union {
 	byte b[4];
 	float f;
 	int l;
     } dat;
 
-    dat.b[0] = net_message.data[msg_readcount];
-    dat.b[1] = net_message.data[msg_readcount + 1];
-    dat.b[2] = net_message.data[msg_readcount + 2];
-    dat.b[3] = net_message.data[msg_readcount + 3];
-    msg_readcount += 4;
+    memcpy(dat.b, p, 4);
 
     dat.l = LittleLong(dat.l);
 
@@ -756,28 +720,6 @@ MSG_ReadStringLine(void)
 }
 #endif
 
-float
-MSG_ReadCoord(void)
-{
-    /*
-     * Co-ords are send as shorts, with the low 3 bits being the fractional
-     * component
-     */
-    return MSG_ReadShort() * (1.0 / (1 << 3));
-}
-
-float
-MSG_ReadAngle(void)
-{
-    return MSG_ReadChar() * (360.0 / 256);
-}
-
-float
-MSG_ReadAngle16(void)
-{
-    return MSG_ReadShort() * (360.0 / 65536);
-}
-
 #ifdef QW_HACK
 void
 MSG_ReadDeltaUsercmd(const usercmd_t *from, usercmd_t *move)
@@ -1168,6 +1110,34 @@ COM_CheckParm(const char *parm)
     return 0;
 }
 
+/*
+================
+COM_StartTrace
+
+With -starttrace, prints the wall time taken by each phase of startup:
+the time since the last call, and since the first.
+================
+*/
+void
+COM_StartTrace(const char *phase)
+{
+    static int enabled = -1;
+    static double start, last;
+    double now;
+
+    if (enabled < 0) {
+	enabled = COM_CheckParm("-starttrace") != 0;
+	start = last = Sys_DoubleTime();
+    }
+    if (!enabled)
+	return;
+
+    now = Sys_DoubleTime();
+    Sys_Printf("starttrace: %-20s %8.2f ms %8.2f ms total\n", phase,
+	       (now - last) * 1000.0, (now - start) * 1000.0);
+    last = now;
+}
+
 /*
 ================
 COM_CheckRegistered
@@ -1332,6 +1302,9 @@ COM_Init(void)
 	LittleFloat = FloatSwap;
     }
 
+    Trace_Init();
+    COM_ParallelInit();
+
     Cvar_RegisterVariable(&registered);
 #ifdef NQ_HACK
     Cvar_RegisterVariable(&cmdline);
@@ -1394,6 +1367,9 @@ typedef struct pack_s {
     char filename[MAX_OSPATH];
     int numfiles;
     packfile_t *files;
+    int hashmask;		// number of hash buckets - 1
+    int *hashbuckets;		// first file in each bucket, -1 if none
+    int *hashnext;		// the next file in the same bucket
 } pack_t;
 
 //
@@ -1537,6 +1513,36 @@ COM_CreatePath(const char *path)
     }
 }
 
+unsigned
+COM_HashFileName(const char *name)
+{
+    unsigned hash = 2166136261u;
+
+    while (*name) {
+	hash ^= (unsigned char)*name++;
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Finds a file in the pak from the hash of its name.  The files are chained
+ * in order, so the first of several with the same name is found, as before.
+ */
+static const packfile_t *
+COM_FindPackFile(const pack_t *pak, const char *filename)
+{
+    int i;
+
+    i = pak->hashbuckets[COM_HashFileName(filename) & pak->hashmask];
+    for (; i >= 0; i = pak->hashnext[i])
+	if (!strcmp(pak->files[i].name, filename))
+	    return &pak->files[i];
+
+    return NULL;
+}
+
 /*
 ===========
 COM_FOpenFile
@@ -1555,8 +1561,7 @@ COM_FOpenFile(const char *filename, FILE **file)
     searchpath_t *search;
     char path[MAX_OSPATH];
     pack_t *pak;
-    int i;
-    int findtime;
+    const packfile_t *packfile;
 
     file_from_pak = 0;
 
@@ -1566,19 +1571,18 @@ COM_FOpenFile(const char *filename, FILE **file)
     for (search = com_searchpaths; search; search = search->next) {
 	// is the element a pak file?
 	if (search->pack) {
-	    // look through all the pak file elements
 	    pak = search->pack;
-	    for (i = 0; i < pak->numfiles; i++)
-		if (!strcmp(pak->files[i].name, filename)) {	// found it!
-		    // open a new file on the pakfile
-		    *file = fopen(pak->filename, "rb");
-		    if (!*file)
-			Sys_Error("Couldn't reopen %s", pak->filename);
-		    fseek(*file, pak->files[i].filepos, SEEK_SET);
-		    com_filesize = pak->files[i].filelen;
-		    file_from_pak = 1;
-		    return com_filesize;
-		}
+	    packfile = COM_FindPackFile(pak, filename);
+	    if (packfile) {
+		// open a new file on the pakfile
+		*file = fopen(pak->filename, "rb");
+		if (!*file)
+		    Sys_Error("Couldn't reopen %s", pak->filename);
+		fseek(*file, packfile->filepos, SEEK_SET);
+		com_filesize = packfile->filelen;
+		file_from_pak = 1;
+		return com_filesize;
+	    }
 	} else {
 	    // check a file in the directory tree
 	    if (!static_registered) {
@@ -1586,12 +1590,12 @@ COM_FOpenFile(const char *filename, FILE **file)
 		if (strchr(filename, '/') || strchr(filename, '\\'))
 		    continue;
 	    }
+	    /* (just try to open it, a stat first would be a second syscall) */
 	    snprintf(path, sizeof(path), "%s/%s", search->filename, filename);
-	    findtime = Sys_FileTime(path);
-	    if (findtime == -1)
+	    *file = fopen(path, "rb");
+	    if (!*file)
 		continue;
 
-	    *file = fopen(path, "rb");
 	    com_filesize = COM_filelength(*file);
 	    return com_filesize;
 	}
@@ -1604,6 +1608,288 @@ COM_FOpenFile(const char *filename, FILE **file)
     return -1;
 }
 
+/*
+===========
+COM_Uncompress
+
+Swaps a gzip compressed file, as written by COM_OpenStream, for a temporary
+file holding what it inflates to, so it can be read and seeked in as
+usual.  Other files are left as they are.  Returns NULL, with the file
+closed, if it can't be read.
+===========
+*/
+FILE *
+COM_Uncompress(FILE *file, int length)
+{
+    byte magic[2];
+    long start;
+
+    start = ftell(file);
+    if (length < 2 || fread(magic, 1, 2, file) != 2
+	|| magic[0] != 0x1f || magic[1] != 0x8b) {
+	fseek(file, start, SEEK_SET);
+	return file;
+    }
+#ifdef USE_ZLIB
+    {
+	byte in[0x4000], out[0x4000];
+	z_stream stream;
+	FILE *inflated;
+	int count, err;
+
+	inflated = tmpfile();
+	memset(&stream, 0, sizeof(stream));
+	if (!inflated || inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+	    if (inflated)
+		fclose(inflated);
+	    fclose(file);
+	    return NULL;
+	}
+	fseek(file, start, SEEK_SET);
+
+	err = Z_OK;
+	while (err == Z_OK && length > 0) {
+	    count = fread(in, 1, qmin(length, (int)sizeof(in)), file);
+	    if (count <= 0)
+		break;
+	    length -= count;
+	    stream.next_in = in;
+	    stream.avail_in = count;
+	    do {
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		err = inflate(&stream, Z_NO_FLUSH);
+		if (err != Z_OK && err != Z_STREAM_END)
+		    break;
+		count = sizeof(out) - stream.avail_out;
+		if (fwrite(out, 1, count, inflated) != count)
+		    err = Z_ERRNO;
+	    } while (err == Z_OK && !stream.avail_out);
+	}
+	inflateEnd(&stream);
+	fclose(file);
+
+	if (err != Z_STREAM_END) {
+	    fclose(inflated);
+	    return NULL;
+	}
+	rewind(inflated);
+	return inflated;
+    }
+#else
+    Con_Printf("Can't read compressed files without zlib\n");
+    fclose(file);
+    return NULL;
+#endif
+}
+
+/*
+===========
+COM_FindFile
+
+Finds where the file's data is, without opening it: the pak or loose file
+to read and the offset and length in it (a length of 0 means up to the end
+of the file).  Returns false if the file can't be found.
+===========
+*/
+qboolean
+COM_FindFile(const char *filename, char *path, size_t pathsize,
+	     size_t *offset, size_t *length)
+{
+    searchpath_t *search;
+    const packfile_t *packfile;
+
+    for (search = com_searchpaths; search; search = search->next) {
+	if (search->pack) {
+	    packfile = COM_FindPackFile(search->pack, filename);
+	    if (!packfile)
+		continue;
+	    snprintf(path, pathsize, "%s", search->pack->filename);
+	    *offset = packfile->filepos;
+	    *length = packfile->filelen;
+	    return true;
+	}
+	if (!static_registered) {
+	    if (strchr(filename, '/') || strchr(filename, '\\'))
+		continue;
+	}
+	snprintf(path, pathsize, "%s/%s", search->filename, filename);
+	if (Sys_FileTime(path) != -1) {
+	    *offset = 0;
+	    *length = 0;
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+/*
+ * The file checksums kept, replaced oldest first once they're all used
+ */
+#define MAX_FILE_CHECKSUMS 64
+
+typedef struct {
+    char path[MAX_OSPATH];
+    size_t offset, length;
+    int mtime;
+    checksumkind_t kind;
+    unsigned checksum;
+} filechecksum_t;
+
+static filechecksum_t com_filechecksums[MAX_FILE_CHECKSUMS];
+static int com_numfilechecksums;
+static int com_nextfilechecksum;
+
+/*
+===========
+COM_FileChecksumKey
+
+Where the file's data is now, to key its checksums on
+===========
+*/
+static qboolean
+COM_FileChecksumKey(const char *filename, checksumkind_t kind,
+		    filechecksum_t *key)
+{
+    FILE *f;
+
+    if (!COM_FindFile(filename, key->path, sizeof(key->path), &key->offset,
+		      &key->length))
+	return false;
+    key->mtime = Sys_FileTime(key->path);
+    if (key->mtime == -1)
+	return false;
+
+    /* a loose file's length isn't known until it's opened */
+    if (!key->length) {
+	f = fopen(key->path, "rb");
+	if (!f)
+	    return false;
+	key->length = COM_filelength(f);
+	fclose(f);
+    }
+    key->kind = kind;
+
+    return true;
+}
+
+static filechecksum_t *
+COM_FindFileChecksum(const filechecksum_t *key)
+{
+    filechecksum_t *entry;
+    int i;
+
+    for (i = 0, entry = com_filechecksums; i < com_numfilechecksums;
+	 i++, entry++) {
+	if (entry->kind == key->kind && entry->offset == key->offset
+	    && entry->length == key->length && entry->mtime == key->mtime
+	    && !strcmp(entry->path, key->path))
+	    return entry;
+    }
+
+    return NULL;
+}
+
+/*
+===========
+COM_GetFileChecksum
+
+Returns false if the checksum of the file as it is now isn't known
+===========
+*/
+qboolean
+COM_GetFileChecksum(const char *filename, checksumkind_t kind,
+		    unsigned *checksum)
+{
+    filechecksum_t key;
+    const filechecksum_t *entry;
+
+    if (!COM_FileChecksumKey(filename, kind, &key))
+	return false;
+    entry = COM_FindFileChecksum(&key);
+    if (!entry)
+	return false;
+    *checksum = entry->checksum;
+
+    return true;
+}
+
+/*
+===========
+COM_SetFileChecksum
+===========
+*/
+void
+COM_SetFileChecksum(const char *filename, checksumkind_t kind,
+		    unsigned checksum)
+{
+    filechecksum_t key;
+    filechecksum_t *entry;
+
+    if (!COM_FileChecksumKey(filename, kind, &key))
+	return;
+    entry = COM_FindFileChecksum(&key);
+    if (!entry) {
+	entry = &com_filechecksums[com_nextfilechecksum];
+	com_nextfilechecksum = (com_nextfilechecksum + 1) % MAX_FILE_CHECKSUMS;
+	if (com_numfilechecksums < MAX_FILE_CHECKSUMS)
+	    com_numfilechecksums++;
+    }
+    *entry = key;
+    entry->checksum = checksum;
+}
+
+/*
+===========
+COM_MapFile
+
+Maps a file that lives in a pak straight into memory, without reading it.
+Returns NULL if the file is loose in a directory (or not found, or can't
+be mapped), in which case the caller should load it the usual way.  The
+view is private, so the caller may change the data; Sys_UnmapFile it when
+done.  Sets com_filesize.
+===========
+*/
+void *
+COM_MapFile(const char *filename, size_t *size, sys_mapping_t *mapping)
+{
+    searchpath_t *search;
+    char path[MAX_OSPATH];
+    const packfile_t *packfile;
+    void *data;
+
+    mapping->base = NULL;
+    mapping->size = 0;
+
+    for (search = com_searchpaths; search; search = search->next) {
+	if (search->pack) {
+	    packfile = COM_FindPackFile(search->pack, filename);
+	    if (!packfile)
+		continue;
+	    data = Sys_MapFile(search->pack->filename, packfile->filepos,
+			       packfile->filelen, mapping);
+	    if (!data)
+		return NULL;
+	    com_filesize = packfile->filelen;
+	    file_from_pak = 1;
+	    if (size)
+		*size = packfile->filelen;
+	    return data;
+	}
+	if (!static_registered) {
+	    if (strchr(filename, '/') || strchr(filename, '\\'))
+		continue;
+	}
+	/* a loose file shadows the paks further down the path */
+	snprintf(path, sizeof(path), "%s/%s", search->filename, filename);
+	if (Sys_FileTime(path) != -1)
+	    return NULL;
+    }
+
+    return NULL;
+}
+
 static void
 COM_ScanDirDir(struct stree_root *root, DIR *dir, const char *pfx,
 	       const char *ext, qboolean stripext)
@@ -1741,6 +2027,8 @@ COM_LoadFile(const char *path, int usehunk, size_t *size)
     if (size)
 	*size = len;
 
+    TR_Begin("COM_LoadFile");
+
 // extract the filename base name for hunk tag
     COM_FileBase(path, base, sizeof(base));
 
@@ -1774,6 +2062,8 @@ COM_LoadFile(const char *path, int usehunk, size_t *size)
     Draw_EndDisc();
 #endif
 
+    TR_End("COM_LoadFile");
+
     return buf;
 }
 
@@ -1828,7 +2118,8 @@ COM_LoadPackFile(const char *packfile)
     dpackfile_t *dfiles;
     packfile_t *mfiles;
     pack_t *pack;
-    int i, numfiles;
+    int i, numfiles, numbuckets, bucket;
+    int *hashbuckets;
     unsigned short crc;
 
     if (COM_FileOpenRead(packfile, &packhandle) == -1)
@@ -1846,13 +2137,21 @@ COM_LoadPackFile(const char *packfile)
     if (numfiles != ID1_PAK0_COUNT)
 	com_modified = true;	// not the original file
 
+    /* at least one bucket per file */
+    numbuckets = 1;
+    while (numbuckets < numfiles)
+	numbuckets <<= 1;
+
 #ifdef NQ_HACK
     mfiles = Hunk_AllocName(numfiles * sizeof(*mfiles), "packfile");
+    hashbuckets =
+	Hunk_AllocName((numbuckets + numfiles) * sizeof(int), "packfile");
     int mark = Hunk_LowMark();
     dfiles = Hunk_AllocName(numfiles * sizeof(*dfiles), "packfile");
 #endif
 #ifdef QW_HACK
     mfiles = Z_Malloc(numfiles * sizeof(*mfiles));
+    hashbuckets = Z_Malloc((numbuckets + numfiles) * sizeof(int));
     dfiles = Z_Malloc(numfiles * sizeof(*dfiles));
 #endif
 
@@ -1896,12 +2195,47 @@ COM_LoadPackFile(const char *packfile)
     pack->numfiles = numfiles;
     pack->files = mfiles;
 
+    /* chain the files backwards so each bucket starts with its first file */
+    pack->hashmask = numbuckets - 1;
+    pack->hashbuckets = hashbuckets;
+    pack->hashnext = hashbuckets + numbuckets;
+    for (i = 0; i < numbuckets; i++)
+	pack->hashbuckets[i] = -1;
+    for (i = numfiles - 1; i >= 0; i--) {
+	bucket = COM_HashFileName(mfiles[i].name) & pack->hashmask;
+	pack->hashnext[i] = pack->hashbuckets[bucket];
+	pack->hashbuckets[bucket] = i;
+    }
+
     Con_Printf("Added packfile %s (%i files)\n", packfile, numfiles);
 
     return pack;
 }
 
 
+/*
+================
+COM_AddPackFile
+
+Adds a pak file from outside of the game directories to the head of the
+path, if it is there
+================
+*/
+static void
+COM_AddPackFile(const char *pakfile)
+{
+    searchpath_t *search;
+    pack_t *pak;
+
+    pak = COM_LoadPackFile(pakfile);
+    if (!pak)
+	return;
+    search = Hunk_Alloc(sizeof(searchpath_t));
+    search->pack = pak;
+    search->next = com_searchpaths;
+    com_searchpaths = search;
+}
+
 /*
 ================
 COM_AddGameDirectory
@@ -1987,6 +2321,7 @@ COM_Gamedir(const char *dir)
     while (com_searchpaths != com_base_searchpaths) {
 	if (com_searchpaths->pack) {
 	    Z_Free(com_searchpaths->pack->files);
+	    Z_Free(com_searchpaths->pack->hashbuckets);
 	    Z_Free(com_searchpaths->pack);
 	}
 	next = com_searchpaths->next;
@@ -2054,6 +2389,12 @@ COM_InitFilesystem(void)
     else
 	strcpy(com_basedir, host_parms.basedir);
 
+//
+// the lensmaps baked from the lens scripts, if there are any (see
+// tools/lensbake.c), searched after everything else
+//
+    COM_AddPackFile(va("%s/lua-scripts/lenscache.pak", com_basedir));
+
 //
 // start up with id1 by default
 //
@@ -0,0 +1,321 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// conlog.c -- console logs written in the background
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include "common.h"
+#include "conlog.h"
+
+/*
+==============================================================================
+
+CONSOLE LOG
+
+Printing to a log only copies the text into a queue.  A writer thread takes
+it from there to the file, waking every LOG_FLUSH_MSEC or once the queue is
+half full, and flushes the file after each batch, so a crash loses at most
+a moment of output.  When the queue is full the text is dropped and counted,
+and a note of how much went missing goes into the log when there's room.
+
+A line printed again straight after itself isn't queued again; the log gets
+a count of the repeats before the next different line instead, so something
+printing the same complaint every frame can't flood the queue.
+
+==============================================================================
+*/
+
+#define LOG_QUEUE	65536	// a power of two
+#define LOG_LASTLINE	256	// longest line checked for repeats
+#define LOG_FLUSH_MSEC	250
+
+struct conlog_s {
+    FILE *file;
+    qboolean started;		// false if writing straight to the file
+    qboolean quit;
+
+    char queue[LOG_QUEUE];
+    unsigned head;		// bytes queued, ever
+    unsigned tail;		// bytes taken by the writer
+
+    qboolean linestart;		// the last print ended a line
+    char lastline[LOG_LASTLINE];
+    int lastlength;		// 0 if there's no line to repeat
+    int repeats;
+    int dropped;		// prints that didn't fit in the queue
+
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+};
+
+#ifdef _WIN32
+#define LOG_Lock(log)	EnterCriticalSection(&(log)->lock)
+#define LOG_Unlock(log)	LeaveCriticalSection(&(log)->lock)
+#define LOG_Signal(log)	WakeAllConditionVariable(&(log)->changed)
+
+static void
+LOG_Wait(conlog_t *log)
+{
+    SleepConditionVariableCS(&log->changed, &log->lock, LOG_FLUSH_MSEC);
+}
+#else
+#define LOG_Lock(log)	pthread_mutex_lock(&(log)->lock)
+#define LOG_Unlock(log)	pthread_mutex_unlock(&(log)->lock)
+#define LOG_Signal(log)	pthread_cond_broadcast(&(log)->changed)
+
+static void
+LOG_Wait(conlog_t *log)
+{
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LOG_FLUSH_MSEC * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+	until.tv_sec++;
+	until.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&log->changed, &log->lock, &until);
+}
+#endif
+
+/* caller holds the lock */
+static qboolean
+LOG_Queue(conlog_t *log, const char *text, int length)
+{
+    unsigned start, first;
+
+    if (!log->started) {
+	fwrite(text, 1, length, log->file);
+	return true;
+    }
+    if (LOG_QUEUE - (log->head - log->tail) < length)
+	return false;
+
+    start = log->head & (LOG_QUEUE - 1);
+    first = qmin((unsigned)length, LOG_QUEUE - start);
+    memcpy(log->queue + start, text, first);
+    memcpy(log->queue, text + first, length - first);
+    log->head += length;
+    if (log->head - log->tail > LOG_QUEUE / 2)
+	LOG_Signal(log);
+
+    return true;
+}
+
+/* caller holds the lock */
+static void
+LOG_QueueNotes(conlog_t *log)
+{
+    char note[64];
+    int length;
+
+    if (log->repeats) {
+	length = snprintf(note, sizeof(note), "(repeated %d more time%s)\n",
+			  log->repeats, log->repeats > 1 ? "s" : "");
+	if (LOG_Queue(log, note, length))
+	    log->repeats = 0;
+    }
+    if (log->dropped) {
+	length = snprintf(note, sizeof(note),
+			  "(%d prints lost, the log fell behind)\n",
+			  log->dropped);
+	if (LOG_Queue(log, note, length))
+	    log->dropped = 0;
+    }
+}
+
+static void
+LOG_RunWriter(conlog_t *log)
+{
+    unsigned start, count;
+    qboolean written = false;
+
+    LOG_Lock(log);
+    for (;;) {
+	if (log->head != log->tail) {
+	    start = log->tail & (LOG_QUEUE - 1);
+	    count = qmin(log->head - log->tail, LOG_QUEUE - start);
+	    LOG_Unlock(log);
+
+	    /* the printers don't touch queued text, so no need to lock */
+	    fwrite(log->queue + start, 1, count, log->file);
+	    written = true;
+
+	    LOG_Lock(log);
+	    log->tail += count;
+	    continue;
+	}
+	if (written) {
+	    LOG_Unlock(log);
+	    fflush(log->file);
+	    written = false;
+	    LOG_Lock(log);
+	    continue;
+	}
+	if (log->quit)
+	    break;
+	LOG_Wait(log);
+    }
+    LOG_Unlock(log);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+LOG_WriterMain(LPVOID arg)
+{
+    LOG_RunWriter(arg);
+    return 0;
+}
+#else
+static void *
+LOG_WriterMain(void *arg)
+{
+    LOG_RunWriter(arg);
+    return NULL;
+}
+#endif
+
+/*
+==============
+Log_Open
+
+Returns NULL if the file couldn't be opened
+==============
+*/
+conlog_t *
+Log_Open(const char *path, qboolean append)
+{
+    conlog_t *log;
+
+    log = calloc(1, sizeof(*log));
+    if (!log)
+	return NULL;
+    log->file = fopen(path, append ? "a" : "w");
+    if (!log->file) {
+	free(log);
+	return NULL;
+    }
+    log->linestart = true;
+
+#ifdef _WIN32
+    InitializeCriticalSection(&log->lock);
+    InitializeConditionVariable(&log->changed);
+    log->thread = CreateThread(NULL, 0, LOG_WriterMain, log, 0, NULL);
+    log->started = log->thread != NULL;
+#else
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->changed, NULL);
+    log->started = !pthread_create(&log->thread, NULL, LOG_WriterMain, log);
+#endif
+
+    return log;
+}
+
+/*
+==============
+Log_Print
+==============
+*/
+void
+Log_Print(conlog_t *log, const char *msg)
+{
+    int length = strlen(msg);
+    qboolean line;
+
+    if (!length)
+	return;
+
+    LOG_Lock(log);
+
+    /* a whole line, not just a newline, can be counted as a repeat */
+    line = log->linestart && length > 1 && msg[length - 1] == '\n';
+    if (line && length == log->lastlength
+	&& !memcmp(msg, log->lastline, length)) {
+	log->repeats++;
+	LOG_Unlock(log);
+	return;
+    }
+
+    /* nothing goes in ahead of a note that's still waiting for room */
+    LOG_QueueNotes(log);
+    if (log->repeats || log->dropped || !LOG_Queue(log, msg, length)) {
+	log->dropped++;
+	log->lastlength = 0;
+    } else if (line && length < LOG_LASTLINE) {
+	memcpy(log->lastline, msg, length);
+	log->lastlength = length;
+    } else {
+	log->lastlength = 0;
+    }
+    log->linestart = msg[length - 1] == '\n';
+    LOG_Unlock(log);
+}
+
+/*
+==============
+Log_Close
+==============
+*/
+void
+Log_Close(conlog_t *log)
+{
+    if (!log)
+	return;
+
+    LOG_Lock(log);
+    LOG_QueueNotes(log);
+    log->quit = true;
+    LOG_Signal(log);
+    LOG_Unlock(log);
+
+    if (log->started) {
+#ifdef _WIN32
+	WaitForSingleObject(log->thread, INFINITE);
+	CloseHandle(log->thread);
+#else
+	pthread_join(log->thread, NULL);
+#endif
+    }
+#ifdef _WIN32
+    DeleteCriticalSection(&log->lock);
+#else
+    pthread_cond_destroy(&log->changed);
+    pthread_mutex_destroy(&log->lock);
+#endif
+
+    fclose(log->file);
+    free(log);
+}
@@ -19,10 +19,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // console.c
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "client.h"
 #include "cmd.h"
+#include "conlog.h"
 #include "console.h"
 #include "draw.h"
 #include "keys.h"
@@ -62,7 +64,10 @@ static cvar_t con_notifytime = { "con_notifytime", "3" };	//seconds
 static float con_times[NUM_CON_TIMES];	// realtime time the line was generated
 					// for transparent notify lines
 
+/* -condebug; the log follows the game directory if it changes */
 static qboolean debuglog;
+static conlog_t *con_log;
+static char con_logdir[MAX_OSPATH];
 
 qboolean con_initialized;
 
@@ -296,6 +301,73 @@ Con_Print(const char *txt)
 }
 
 
+/*
+ * Held back prints, one after the other with their terminators
+ */
+static __thread qboolean con_deferring;
+static struct {
+    char *text;
+    size_t length;
+    size_t size;
+} con_deferred;
+
+void
+Con_DeferPrints(qboolean defer)
+{
+    con_deferring = defer;
+}
+
+static void
+Con_Defer(const char *msg)
+{
+    size_t length = strlen(msg) + 1;
+    size_t size;
+    char *text;
+
+    if (con_deferred.length + length > con_deferred.size) {
+	size = qmax(con_deferred.size * 2, con_deferred.length + length);
+	text = realloc(con_deferred.text, size);
+	if (!text)
+	    return;
+	con_deferred.text = text;
+	con_deferred.size = size;
+    }
+    memcpy(con_deferred.text + con_deferred.length, msg, length);
+    con_deferred.length += length;
+}
+
+void
+Con_FlushDeferred(void)
+{
+    size_t offset;
+
+    for (offset = 0; offset < con_deferred.length;
+	 offset += strlen(con_deferred.text + offset) + 1)
+	Con_Printf("%s", con_deferred.text + offset);
+    con_deferred.length = 0;
+}
+
+static void
+Con_Log(const char *msg)
+{
+    char path[MAX_OSPATH];
+
+    if (!con_log || strcmp(con_logdir, com_gamedir)) {
+	Log_Close(con_log);
+	con_log = NULL;
+	snprintf(con_logdir, sizeof(con_logdir), "%s", com_gamedir);
+	if (snprintf(path, sizeof(path), "%s/qconsole.log", com_gamedir)
+	    < sizeof(path))
+	    con_log = Log_Open(path, true);
+	if (!con_log) {
+	    debuglog = false;
+	    Sys_Printf("Couldn't open %s, not logging\n", path);
+	    return;
+	}
+    }
+    Log_Print(con_log, msg);
+}
+
 /*
 ================
 Con_Printf
@@ -314,12 +386,17 @@ Con_Printf(const char *fmt, ...)
     vsnprintf(msg, sizeof(msg), fmt, argptr);
     va_end(argptr);
 
+    if (con_deferring) {
+	Con_Defer(msg);
+	return;
+    }
+
 // also echo to debugging console
     Sys_Printf("%s", msg);	// also echo to debugging console
 
 // log all messages to file
     if (debuglog)
-	Sys_DebugLog(va("%s/qconsole.log", com_gamedir), "%s", msg);
+	Con_Log(msg);
 
     if (!con_initialized)
 	return;
@@ -375,7 +452,7 @@ Con_DPrintf(const char *fmt, ...)
 	    va_start(argptr, fmt);
 	    vsnprintf(msg + 7, sizeof(msg) - 7, fmt, argptr);
 	    va_end(argptr);
-	    Sys_DebugLog(va("%s/qconsole.log", com_gamedir), "%s", msg);
+	    Con_Log(msg);
 	}
 	return;
     }
@@ -578,6 +655,8 @@ Con_DrawConsole(int lines)
     int rows;
     char *text;
     int row;
+    char arrows[MAXCMDLINE];
+    int rowlength;
 
     if (lines <= 0)
 	return;
@@ -593,8 +672,10 @@ Con_DrawConsole(int lines)
 // draw from the bottom up
     if (con->display != con->current) {
 	// draw arrows to show the buffer is backscrolled
-	for (x = 0; x < con_linewidth; x += 4)
-	    Draw_Character((x + 1) << 3, y, '^');
+	rowlength = qmin(con_linewidth, (int)sizeof(arrows));
+	for (x = 0; x < rowlength; x++)
+	    arrows[x] = (x & 3) ? ' ' : '^';
+	Draw_ConsoleLine(y, arrows, rowlength);
 	y -= 8;
 	rows--;
     }
@@ -607,8 +688,7 @@ Con_DrawConsole(int lines)
 	    break;		// past scrollback wrap point
 
 	text = con->text + (row % con_totallines) * con_linewidth;
-	for (x = 0; x < con_linewidth; x++)
-	    Draw_Character((x + 1) << 3, y, text[x]);
+	Draw_ConsoleLine(y, text, con_linewidth);
     }
 
     // draw the download bar, if needed
@@ -762,6 +842,21 @@ Con_Maplist_f()
 }
 
 
+/*
+================
+Con_Shutdown
+
+Writes out the rest of the log
+================
+*/
+void
+Con_Shutdown(void)
+{
+    Log_Close(con_log);
+    con_log = NULL;
+    debuglog = false;
+}
+
 /*
 ================
 Con_Init
@@ -0,0 +1,299 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_band.c: threads that draw the span lists in horizontal screen bands
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "console.h"
+#include "cvar.h"
+#include "d_local.h"
+#include "quakedef.h"
+
+/*
+ * d_bandthreads is the number of threads drawing spans besides the main
+ * thread (-1 = one per extra core, 0 = main thread only).  The assembly span
+ * drawers keep their state in shared globals, so they always draw on the
+ * main thread.
+ */
+static cvar_t d_bandthreads = { "d_bandthreads", "-1", true };
+
+#define MAX_BAND_THREADS 16
+
+static struct {
+    int numthreads;		// running, besides the main thread
+    qboolean started;
+
+    void (*draw)(int band);
+    int numbands;
+    int nextband;		// taken with an atomic add
+
+    int generation;
+    int numdone;
+    qboolean quit;
+
+#ifdef _WIN32
+    HANDLE threads[MAX_BAND_THREADS];
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE start;
+    CONDITION_VARIABLE done;
+#else
+    pthread_t threads[MAX_BAND_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+#endif
+} d_bands;
+
+#ifdef _WIN32
+#define D_BandLock()	EnterCriticalSection(&d_bands.lock)
+#define D_BandUnlock()	LeaveCriticalSection(&d_bands.lock)
+#define D_BandWait(c)	SleepConditionVariableCS(&d_bands.c, &d_bands.lock, INFINITE)
+#define D_BandSignal(c)	WakeAllConditionVariable(&d_bands.c)
+#else
+#define D_BandLock()	pthread_mutex_lock(&d_bands.lock)
+#define D_BandUnlock()	pthread_mutex_unlock(&d_bands.lock)
+#define D_BandWait(c)	pthread_cond_wait(&d_bands.c, &d_bands.lock)
+#define D_BandSignal(c)	pthread_cond_broadcast(&d_bands.c)
+#endif
+
+static int
+D_CpuCount(void)
+{
+    int count;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    count = info.dwNumberOfProcessors;
+#else
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count < 1 ? 1 : count;
+}
+
+/* draw bands until there are none left (on every thread) */
+static void
+D_DrawBandsLeft(void)
+{
+    int band;
+
+    while ((band = __sync_fetch_and_add(&d_bands.nextband, 1)) <
+	   d_bands.numbands)
+	d_bands.draw(band);
+}
+
+static void
+D_RunBandThread(void)
+{
+    int generation = 0;
+
+    for (;;) {
+	D_BandLock();
+	while (d_bands.generation == generation && !d_bands.quit)
+	    D_BandWait(start);
+	if (d_bands.quit) {
+	    D_BandUnlock();
+	    return;
+	}
+	generation = d_bands.generation;
+	D_BandUnlock();
+
+	D_DrawBandsLeft();
+
+	D_BandLock();
+	if (++d_bands.numdone == d_bands.numthreads)
+	    D_BandSignal(done);
+	D_BandUnlock();
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+D_BandThreadMain(LPVOID arg)
+{
+    D_RunBandThread();
+    return 0;
+}
+#else
+static void *
+D_BandThreadMain(void *arg)
+{
+    D_RunBandThread();
+    return NULL;
+}
+#endif
+
+static void
+D_StartBandThreads(int count)
+{
+    int i;
+
+    d_bands.quit = false;
+    d_bands.generation = 0;
+    d_bands.numthreads = 0;
+    d_bands.started = true;
+    for (i = 0; i < count && i < MAX_BAND_THREADS; i++) {
+#ifdef _WIN32
+	d_bands.threads[i] = CreateThread(NULL, 0, D_BandThreadMain, NULL, 0,
+					  NULL);
+	if (!d_bands.threads[i])
+	    break;
+#else
+	if (pthread_create(&d_bands.threads[i], NULL, D_BandThreadMain, NULL))
+	    break;
+#endif
+	d_bands.numthreads++;
+    }
+    if (d_bands.numthreads < count)
+	Con_Printf("Started only %d of %d band threads\n",
+		   d_bands.numthreads, count);
+}
+
+static void
+D_StopBandThreads(void)
+{
+    int i;
+
+    if (!d_bands.started)
+	return;
+
+    D_BandLock();
+    d_bands.quit = true;
+    D_BandSignal(start);
+    D_BandUnlock();
+
+    for (i = 0; i < d_bands.numthreads; i++) {
+#ifdef _WIN32
+	WaitForSingleObject(d_bands.threads[i], INFINITE);
+	CloseHandle(d_bands.threads[i]);
+#else
+	pthread_join(d_bands.threads[i], NULL);
+#endif
+    }
+    d_bands.numthreads = 0;
+    d_bands.started = false;
+}
+
+/*
+===============
+D_InitBands
+===============
+*/
+void
+D_InitBands(void)
+{
+    Cvar_RegisterVariable(&d_bandthreads);
+
+#ifdef _WIN32
+    InitializeCriticalSection(&d_bands.lock);
+    InitializeConditionVariable(&d_bands.start);
+    InitializeConditionVariable(&d_bands.done);
+#else
+    pthread_mutex_init(&d_bands.lock, NULL);
+    pthread_cond_init(&d_bands.start, NULL);
+    pthread_cond_init(&d_bands.done, NULL);
+#endif
+}
+
+/*
+===============
+D_SetupBands
+
+Start or stop band threads to match d_bandthreads, once per frame
+===============
+*/
+void
+D_SetupBands(void)
+{
+    int count;
+
+#ifdef USE_X86_ASM
+    count = 0;
+#else
+    count = d_bandthreads.value;
+    if (count < 0)
+	count = D_CpuCount() - 1;
+    if (count > MAX_BAND_THREADS)
+	count = MAX_BAND_THREADS;
+#endif
+
+    if (d_bands.started && d_bands.numthreads == count)
+	return;
+    if (!d_bands.started && !count)
+	return;
+
+    D_StopBandThreads();
+    if (count)
+	D_StartBandThreads(count);
+}
+
+/*
+===============
+D_BandThreads
+
+Threads drawing bands, counting the main thread
+===============
+*/
+int
+D_BandThreads(void)
+{
+    return d_bands.numthreads + 1;
+}
+
+/*
+===============
+D_DrawBands
+
+Call draw for each band, on the band threads and this one, and return once
+all of them are drawn
+===============
+*/
+void
+D_DrawBands(void (*draw)(int band), int numbands)
+{
+    if (!d_bands.numthreads) {
+	int band;
+
+	for (band = 0; band < numbands; band++)
+	    draw(band);
+	return;
+    }
+
+    D_BandLock();
+    d_bands.draw = draw;
+    d_bands.numbands = numbands;
+    d_bands.nextband = 0;
+    d_bands.numdone = 0;
+    d_bands.generation++;
+    D_BandSignal(start);
+    D_BandUnlock();
+
+    D_DrawBandsLeft();
+
+    D_BandLock();
+    while (d_bands.numdone < d_bands.numthreads)
+	D_BandWait(done);
+    D_BandUnlock();
+}
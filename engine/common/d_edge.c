@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "d_local.h"
 #include "quakedef.h"
@@ -31,6 +33,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static int miplevel;
 static vec3_t transformed_modelorg;
 
+/* set while a fisheye plate's sky is left to its lens (see fisheye.c) */
+extern byte *fisheye_sky_mask;
+extern qboolean fisheye_sky_drawn;
+
 float scale_for_mip;
 int screenwidth;
 int ubasestep, errorterm, erroradjustup, erroradjustdown;
@@ -70,14 +76,13 @@ D_DrawSolidSurface
 // FIXME: clean this up
 
 static void
-D_DrawSolidSurface(surf_t *surf, int color)
+D_DrawSolidSurface(espan_t *span, int color)
 {
-    espan_t *span;
     byte *pdest;
     int u, u2, pix;
 
     pix = (color << 24) | (color << 16) | (color << 8) | color;
-    for (span = surf->spans; span; span = span->pnext) {
+    for (; span; span = span->pnext) {
 	pdest = (byte *)d_viewbuffer + screenwidth * span->v;
 	u = span->u;
 	u2 = span->u + span->count - 1;
@@ -150,147 +155,415 @@ D_CalcGradients(msurface_t *pface)
 }
 
 
+/*
+ * A surface's drawing state, saved once it is prepared so that its spans can
+ * be drawn later, on any thread
+ */
+typedef enum { DS_SOLID, DS_SKY, DS_TURB, DS_SPANS } dsurfkind_t;
+
+typedef struct {
+    dsurfkind_t kind;
+    int color;			// DS_SOLID
+    espan_t *spans;
+    float sdivzstepu, tdivzstepu, zistepu;
+    float sdivzstepv, tdivzstepv, zistepv;
+    float sdivzorigin, tdivzorigin, ziorigin;
+    fixed16_t sadjust, tadjust, bbextents, bbextentt;
+    pixel_t *cacheblock;
+    int cachewidth;
+} dsurfstate_t;
+
+static vec3_t world_transformed_modelorg;
+
 /*
 ==============
-D_DrawSurfaces
+D_PrepareSurface
+
+Everything about drawing a surface that has to happen on the main thread:
+the surface cache, the sky, and the bmodel rotation the gradients need
 ==============
 */
-void
-D_DrawSurfaces(void)
+static void
+D_PrepareSurface(surf_t *s, dsurfstate_t *state)
 {
     const entity_t *e;
-    surf_t *s;
     msurface_t *pface;
     surfcache_t *pcurrentcache;
-    vec3_t world_transformed_modelorg;
     vec3_t local_modelorg;
 
-    e = &r_worldentity;
-    TransformVector(modelorg, transformed_modelorg);
-    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+    d_zistepu = s->d_zistepu;
+    d_zistepv = s->d_zistepv;
+    d_ziorigin = s->d_ziorigin;
 
 // TODO: could preset a lot of this at mode set time
     if (r_drawflat.value) {
-	for (s = &surfaces[1]; s < surface_p; s++) {
-	    if (!s->spans)
-		continue;
+	state->kind = DS_SOLID;
+	state->color = (intptr_t)s->data & 0xFF;
+    } else if (s->flags & SURF_DRAWSKY) {
+	r_drawnpolycount++;
+	if (fisheye_sky_mask)
+	    fisheye_sky_drawn = true;
+	else if (!r_skymade)
+	    R_MakeSky();
+	state->kind = DS_SKY;
+    } else if (s->flags & SURF_DRAWBACKGROUND) {
+	r_drawnpolycount++;
+
+	// set up a gradient for the background surface that places it
+	// effectively at infinity distance from the viewpoint
+	d_zistepu = 0;
+	d_zistepv = 0;
+	d_ziorigin = -0.9;
+
+	state->kind = DS_SOLID;
+	state->color = (int)r_clearcolor.value & 0xFF;
+    } else {
+	r_drawnpolycount++;
+
+	e = &r_worldentity;
+	if (s->insubmodel) {
+	    // FIXME: we don't want to do all this for every polygon!
+	    // TODO: store once at start of frame
+	    e = s->entity;	//FIXME: make this passed in to
+	    // R_RotateBmodel ()
+	    VectorSubtract(r_origin, e->origin, local_modelorg);
+	    TransformVector(local_modelorg, transformed_modelorg);
+
+	    R_RotateBmodel(e);	// FIXME: don't mess with the frustum,
+	    // make entity passed in
+	}
+
+	pface = s->data;
+	if (s->flags & SURF_DRAWTURB) {
+	    miplevel = 0;
+	    cacheblock = (pixel_t *)
+		((byte *)pface->texinfo->texture +
+		 pface->texinfo->texture->offsets[0]);
+	    cachewidth = 64;
+	    state->kind = DS_TURB;
+	} else {
+	    miplevel = D_MipLevelForScale(s->nearzi * scale_for_mip
+					  * pface->texinfo->mipadjust);
 
-	    d_zistepu = s->d_zistepu;
-	    d_zistepv = s->d_zistepv;
-	    d_ziorigin = s->d_ziorigin;
+	    // FIXME: make this passed in to D_CacheSurface
+	    pcurrentcache = D_CacheSurface(e, pface, miplevel);
 
-	    D_DrawSolidSurface(s, (intptr_t)s->data & 0xFF);
-	    D_DrawZSpans(s->spans);
+	    cacheblock = (pixel_t *)pcurrentcache->data;
+	    cachewidth = pcurrentcache->width;
+	    state->kind = DS_SPANS;
 	}
-    } else {
-	for (s = &surfaces[1]; s < surface_p; s++) {
-	    if (!s->spans)
-		continue;
 
-	    r_drawnpolycount++;
+	D_CalcGradients(pface);
+
+	if (s->insubmodel) {
+	    //
+	    // restore the old drawing state
+	    // FIXME: we don't want to do this every time!
+	    // TODO: speed up
+	    //
+	    VectorCopy(world_transformed_modelorg, transformed_modelorg);
+	    VectorCopy(base_vpn, vpn);
+	    VectorCopy(base_vup, vup);
+	    VectorCopy(base_vright, vright);
+	    VectorCopy(base_modelorg, modelorg);
+	    R_TransformFrustum();
+	}
+    }
 
-	    d_zistepu = s->d_zistepu;
-	    d_zistepv = s->d_zistepv;
-	    d_ziorigin = s->d_ziorigin;
+    state->spans = s->spans;
+    state->sdivzstepu = d_sdivzstepu;
+    state->tdivzstepu = d_tdivzstepu;
+    state->zistepu = d_zistepu;
+    state->sdivzstepv = d_sdivzstepv;
+    state->tdivzstepv = d_tdivzstepv;
+    state->zistepv = d_zistepv;
+    state->sdivzorigin = d_sdivzorigin;
+    state->tdivzorigin = d_tdivzorigin;
+    state->ziorigin = d_ziorigin;
+    state->sadjust = sadjust;
+    state->tadjust = tadjust;
+    state->bbextents = bbextents;
+    state->bbextentt = bbextentt;
+    state->cacheblock = cacheblock;
+    state->cachewidth = cachewidth;
+}
 
-	    if (s->flags & SURF_DRAWSKY) {
-		if (!r_skymade) {
-		    R_MakeSky();
-		}
 
-		D_DrawSkyScans8(s->spans);
-		D_DrawZSpans(s->spans);
-	    } else if (s->flags & SURF_DRAWBACKGROUND) {
-		// set up a gradient for the background surface that places it
-		// effectively at infinity distance from the viewpoint
-		d_zistepu = 0;
-		d_zistepv = 0;
-		d_ziorigin = -0.9;
-
-		D_DrawSolidSurface(s, (int)r_clearcolor.value & 0xFF);
-		D_DrawZSpans(s->spans);
-	    } else if (s->flags & SURF_DRAWTURB) {
-		pface = s->data;
-		miplevel = 0;
-		cacheblock = (pixel_t *)
-		    ((byte *)pface->texinfo->texture +
-		     pface->texinfo->texture->offsets[0]);
-		cachewidth = 64;
-
-		if (s->insubmodel) {
-		    // FIXME: we don't want to do all this for every polygon!
-		    // TODO: store once at start of frame
-		    e = s->entity;	//FIXME: make this passed in to
-		    // R_RotateBmodel ()
-		    VectorSubtract(r_origin, e->origin, local_modelorg);
-		    TransformVector(local_modelorg, transformed_modelorg);
-
-		    R_RotateBmodel(e);	// FIXME: don't mess with the frustum,
-		    // make entity passed in
-		}
+/*
+==============
+D_DrawSurfaceSpans
 
-		D_CalcGradients(pface);
-		Turbulent8(s->spans);
-		D_DrawZSpans(s->spans);
-
-		if (s->insubmodel) {
-		    //
-		    // restore the old drawing state
-		    // FIXME: we don't want to do this every time!
-		    // TODO: speed up
-		    //
-		    e = &r_worldentity;
-		    VectorCopy(world_transformed_modelorg,
-			       transformed_modelorg);
-		    VectorCopy(base_vpn, vpn);
-		    VectorCopy(base_vup, vup);
-		    VectorCopy(base_vright, vright);
-		    VectorCopy(base_modelorg, modelorg);
-		    R_TransformFrustum();
-		}
-	    } else {
-		if (s->insubmodel) {
-		    // FIXME: we don't want to do all this for every polygon!
-		    // TODO: store once at start of frame
-		    e = s->entity;	//FIXME: make this passed in to
-		    // R_RotateBmodel ()
-		    VectorSubtract(r_origin, e->origin, local_modelorg);
-		    TransformVector(local_modelorg, transformed_modelorg);
-
-		    R_RotateBmodel(e);	// FIXME: don't mess with the frustum,
-		    // make entity passed in
-		}
+Draw spans of a prepared surface, with this thread's drawing state
+==============
+*/
+static void
+D_DrawSurfaceSpans(const dsurfstate_t *state, espan_t *spans)
+{
+    d_sdivzstepu = state->sdivzstepu;
+    d_tdivzstepu = state->tdivzstepu;
+    d_zistepu = state->zistepu;
+    d_sdivzstepv = state->sdivzstepv;
+    d_tdivzstepv = state->tdivzstepv;
+    d_zistepv = state->zistepv;
+    d_sdivzorigin = state->sdivzorigin;
+    d_tdivzorigin = state->tdivzorigin;
+    d_ziorigin = state->ziorigin;
+    sadjust = state->sadjust;
+    tadjust = state->tadjust;
+    bbextents = state->bbextents;
+    bbextentt = state->bbextentt;
+    cacheblock = state->cacheblock;
+    cachewidth = state->cachewidth;
+
+    switch (state->kind) {
+    case DS_SOLID:
+	D_DrawSolidSurface(spans, state->color);
+	break;
+    case DS_SKY:
+	if (fisheye_sky_mask)
+	    D_DrawSkyMask(spans, fisheye_sky_mask);
+	else
+	    D_DrawSkyScans8(spans);
+	break;
+    case DS_TURB:
+	Turbulent8(spans);
+	break;
+    default:
+	D_DrawSpans(spans);
+	break;
+    }
+    D_DrawZSpans(spans);
+}
+
+
+/*
+ * With band threads, the surfaces are prepared in a batch on the main thread,
+ * then each surface's span list (which runs bottom up) is cut where it
+ * crosses into the next band, and the pieces are sorted by band.  The band
+ * threads draw every piece in their bands, which never share a pixel.
+ *
+ * The batch ends before the surfaces built for it could fill the surface
+ * cache, so that none of them are evicted before they are drawn.
+ */
+#define MAX_BANDS		64
+#define BANDS_PER_THREAD	4	// to even out busier bands
+#define MIN_BAND_ROWS		4
+#define SC_MAXBLOCK	(int)(sizeof(surfcache_t) + 0x10000 + 256)
+
+typedef struct {
+    int band;
+    const dsurfstate_t *state;
+    espan_t *spans;
+} dbandspans_t;
+
+static struct {
+    dsurfstate_t *states;
+    int maxstates;
+
+    dbandspans_t *pieces;	// in surface order
+    dbandspans_t *sorted;	// by band, then surface order
+    int numpieces;
+    int maxpieces;
+
+    int first[MAX_BANDS + 1];	// each band's first sorted piece
+    byte bandofrow[MAXHEIGHT];
+} d_bandsurfs;
+
+static qboolean
+D_ReserveBandSpans(int numpieces)
+{
+    dbandspans_t *pieces, *sorted;
+
+    if (numpieces <= d_bandsurfs.maxpieces)
+	return true;
+
+    pieces = realloc(d_bandsurfs.pieces, numpieces * sizeof(*pieces));
+    if (pieces)
+	d_bandsurfs.pieces = pieces;
+    sorted = realloc(d_bandsurfs.sorted, numpieces * sizeof(*sorted));
+    if (sorted)
+	d_bandsurfs.sorted = sorted;
+    if (!pieces || !sorted)
+	return false;
+    d_bandsurfs.maxpieces = numpieces;
+
+    return true;
+}
+
+static void
+D_AddBandSpans(int band, const dsurfstate_t *state, espan_t *spans)
+{
+    dbandspans_t *piece;
+
+    piece = &d_bandsurfs.pieces[d_bandsurfs.numpieces++];
+    piece->band = band;
+    piece->state = state;
+    piece->spans = spans;
+    d_bandsurfs.first[band + 1]++;
+}
+
+static void
+D_DrawBand(int band)
+{
+    const dbandspans_t *piece, *end;
+
+    piece = &d_bandsurfs.sorted[d_bandsurfs.first[band]];
+    end = &d_bandsurfs.sorted[d_bandsurfs.first[band + 1]];
+    for (; piece < end; piece++)
+	D_DrawSurfaceSpans(piece->state, piece->spans);
+}
 
-		pface = s->data;
-		miplevel = D_MipLevelForScale(s->nearzi * scale_for_mip
-					      * pface->texinfo->mipadjust);
-
-		// FIXME: make this passed in to D_CacheSurface
-		pcurrentcache = D_CacheSurface(e, pface, miplevel);
-
-		cacheblock = (pixel_t *)pcurrentcache->data;
-		cachewidth = pcurrentcache->width;
-
-		D_CalcGradients(pface);
-		D_DrawSpans(s->spans);
-		D_DrawZSpans(s->spans);
-
-		if (s->insubmodel) {
-		    //
-		    // restore the old drawing state
-		    // FIXME: we don't want to do this every time!
-		    // TODO: speed up
-		    //
-		    e = &r_worldentity;
-		    VectorCopy(world_transformed_modelorg,
-			       transformed_modelorg);
-		    VectorCopy(base_vpn, vpn);
-		    VectorCopy(base_vup, vup);
-		    VectorCopy(base_vright, vright);
-		    VectorCopy(base_modelorg, modelorg);
-		    R_TransformFrustum();
+/*
+==============
+D_DrawBandBatch
+
+Draw the first numstates prepared surfaces in bands
+==============
+*/
+static void
+D_DrawBandBatch(int numstates)
+{
+    dsurfstate_t *state, *end;
+    espan_t *span, *prev;
+    int top, bottom, numrows, numbands, numpieces, band, v, i;
+
+    if (!numstates)
+	return;
+    end = &d_bandsurfs.states[numstates];
+
+    // span lists run bottom up
+    top = MAXHEIGHT;
+    bottom = 0;
+    for (state = d_bandsurfs.states; state < end; state++) {
+	span = state->spans;
+	if (span->v > bottom)
+	    bottom = span->v;
+	while (span->pnext)
+	    span = span->pnext;
+	if (span->v < top)
+	    top = span->v;
+    }
+    numrows = bottom - top + 1;
+
+    numbands = D_BandThreads() * BANDS_PER_THREAD;
+    if (numbands > MAX_BANDS)
+	numbands = MAX_BANDS;
+    if (numbands > numrows / MIN_BAND_ROWS)
+	numbands = numrows / MIN_BAND_ROWS;
+    for (v = top; v <= bottom; v++)
+	d_bandsurfs.bandofrow[v] = (v - top) * numbands / numrows;
+
+    numpieces = 0;
+    if (numbands > 1) {
+	for (state = d_bandsurfs.states; state < end; state++) {
+	    band = -1;
+	    for (span = state->spans; span; span = span->pnext) {
+		if (d_bandsurfs.bandofrow[span->v] != band) {
+		    band = d_bandsurfs.bandofrow[span->v];
+		    numpieces++;
 		}
 	    }
 	}
     }
+    if (numbands < 2 || !D_ReserveBandSpans(numpieces)) {
+	for (state = d_bandsurfs.states; state < end; state++)
+	    D_DrawSurfaceSpans(state, state->spans);
+	return;
+    }
+
+    d_bandsurfs.numpieces = 0;
+    memset(d_bandsurfs.first, 0, sizeof(d_bandsurfs.first));
+    for (state = d_bandsurfs.states; state < end; state++) {
+	band = -1;
+	prev = NULL;
+	for (span = state->spans; span; prev = span, span = span->pnext) {
+	    if (d_bandsurfs.bandofrow[span->v] == band)
+		continue;
+	    band = d_bandsurfs.bandofrow[span->v];
+	    D_AddBandSpans(band, state, span);
+	    if (prev)
+		prev->pnext = NULL;
+	}
+    }
+
+    for (band = 0; band < numbands; band++)
+	d_bandsurfs.first[band + 1] += d_bandsurfs.first[band];
+    for (i = 0; i < d_bandsurfs.numpieces; i++) {
+	band = d_bandsurfs.pieces[i].band;
+	d_bandsurfs.sorted[d_bandsurfs.first[band]++] = d_bandsurfs.pieces[i];
+    }
+    for (band = numbands; band > 0; band--)
+	d_bandsurfs.first[band] = d_bandsurfs.first[band - 1];
+    d_bandsurfs.first[0] = 0;
+
+    D_DrawBands(D_DrawBand, numbands);
+}
+
+/*
+==============
+D_DrawSurfacesInBands
+==============
+*/
+static qboolean
+D_DrawSurfacesInBands(void)
+{
+    dsurfstate_t *states;
+    surf_t *s;
+    unsigned batchstart;
+    int numstates, limit;
+
+    limit = sc_size - 2 * SC_MAXBLOCK;
+    if (limit <= 0)
+	return false;
+
+    if (d_bandsurfs.maxstates < surface_p - surfaces) {
+	states = realloc(d_bandsurfs.states,
+			 (surface_p - surfaces) * sizeof(*states));
+	if (!states)
+	    return false;
+	d_bandsurfs.states = states;
+	d_bandsurfs.maxstates = surface_p - surfaces;
+    }
+
+    numstates = 0;
+    batchstart = sc_allocated;
+    for (s = &surfaces[1]; s < surface_p; s++) {
+	if (!s->spans)
+	    continue;
+	if (sc_allocated - batchstart >= (unsigned)limit) {
+	    D_DrawBandBatch(numstates);
+	    numstates = 0;
+	    batchstart = sc_allocated;
+	}
+	D_PrepareSurface(s, &d_bandsurfs.states[numstates++]);
+    }
+    D_DrawBandBatch(numstates);
+
+    return true;
+}
+
+
+/*
+==============
+D_DrawSurfaces
+==============
+*/
+void
+D_DrawSurfaces(void)
+{
+    surf_t *s;
+    dsurfstate_t state;
+
+    TransformVector(modelorg, transformed_modelorg);
+    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+
+    if (D_BandThreads() > 1 && D_DrawSurfacesInBands())
+	return;
+
+    for (s = &surfaces[1]; s < surface_p; s++) {
+	if (!s->spans)
+	    continue;
+	D_PrepareSurface(s, &state);
+	D_DrawSurfaceSpans(&state, s->spans);
+    }
 }
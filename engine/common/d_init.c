@@ -27,6 +27,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static cvar_t d_subdiv16 = { "d_subdiv16", "1" };
 static cvar_t d_mipcap = { "d_mipcap", "0" };
 static cvar_t d_mipscale = { "d_mipscale", "1" };
+static cvar_t d_simd = { "d_simd", "1", true };
 
 surfcache_t *d_initial_rover;
 qboolean d_roverwrapped;
@@ -36,6 +37,7 @@ float d_scalemip[NUM_MIPS - 1];
 static float basemip[NUM_MIPS - 1] = { 1.0, 0.5 * 0.8, 0.25 * 0.8 };
 
 void (*D_DrawSpans)(espan_t *pspan);
+const dsimdkernels_t *d_simdkernels;
 
 /*
 ===============
@@ -51,6 +53,8 @@ D_Init(void)
     Cvar_RegisterVariable(&d_subdiv16);
     Cvar_RegisterVariable(&d_mipcap);
     Cvar_RegisterVariable(&d_mipscale);
+    Cvar_RegisterVariable(&d_simd);
+    D_InitBands();
 
     r_recursiveaffinetriangles = true;
     r_pixbytes = 1;
@@ -138,8 +142,15 @@ D_SetupFrame(void)
     else if (d_minmip < 0)
 	d_minmip = 0;
 
+    // fisheye plates that the lens shrinks can use smaller mips
+    extern qboolean fisheye_enabled;
+    extern float fisheye_plate_mipscale;
+    float mipscale = d_mipscale.value;
+    if (fisheye_enabled)
+	mipscale *= fisheye_plate_mipscale;
+
     for (i = 0; i < (NUM_MIPS - 1); i++)
-	d_scalemip[i] = basemip[i] * d_mipscale.value;
+	d_scalemip[i] = basemip[i] * mipscale;
 
 #ifdef USE_X86_ASM
     if (d_subdiv16.value)
@@ -147,8 +158,14 @@ D_SetupFrame(void)
     else
 	D_DrawSpans = D_DrawSpans8;
 #else
-    D_DrawSpans = D_DrawSpans8;
+    d_simdkernels = d_simd.value ? D_SIMDKernels() : NULL;
+    if (d_simdkernels)
+	D_DrawSpans = d_subdiv16.value ? D_DrawSpansSIMD16 : D_DrawSpansSIMD8;
+    else
+	D_DrawSpans = d_subdiv16.value ? D_DrawSpans16 : D_DrawSpans8;
 #endif
+
+    D_SetupBands();
 }
 
 
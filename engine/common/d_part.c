@@ -47,46 +47,48 @@ D_StartParticles(void)
 }
 
 
-#ifndef USE_X86_ASM
+#ifdef USE_X86_ASM
 
 /*
 ==============
-D_DrawParticle
+D_DrawParticles
+
+D_DrawParticle (d_parta.S) still projects one particle at a time
 ==============
 */
 void
-D_DrawParticle(particle_t *pparticle)
+D_DrawParticles(const particlegroup_t *group)
 {
-    vec3_t local, transformed;
-    float zi;
-    byte *pdest;
-    short *pz;
-    int i, izi, pix, count, u, v;
-
-// transform point
-    VectorSubtract(pparticle->org, r_origin, local);
-
-    transformed[0] = DotProduct(local, r_pright);
-    transformed[1] = DotProduct(local, r_pup);
-    transformed[2] = DotProduct(local, r_ppn);
-
-    if (transformed[2] < PARTICLE_Z_CLIP)
-	return;
+    particle_t p;
+    int i;
+
+    for (i = 0; i < group->count; i++) {
+	if (r_viewbits && !(group->viewbits[i] & r_viewbits))
+	    continue;		// binned away from this view (see R_BinScene)
+	p.org[0] = group->org[0][i];
+	p.org[1] = group->org[1][i];
+	p.org[2] = group->org[2][i];
+	p.color = group->color[i];
+	D_DrawParticle(&p);
+    }
+}
 
-// project the point
-// FIXME: preadjust xcenter and ycenter
-    zi = 1.0 / transformed[2];
-    u = (int)(xcenter + zi * transformed[0] + 0.5);
-    v = (int)(ycenter - zi * transformed[1] + 0.5);
+#else
 
-    if ((v > d_vrectbottom_particle) ||
-	(u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx)) {
-	return;
-    }
+/*
+==============
+D_DrawParticlePixels
+==============
+*/
+static void
+D_DrawParticlePixels(int u, int v, int izi, byte color)
+{
+    byte *pdest;
+    short *pz;
+    int i, pix, count;
 
     pz = d_pzbuffer + (d_zwidth * v) + u;
     pdest = d_viewbuffer + d_scantable[v] + u;
-    izi = (int)(zi * 0x8000);
 
     pix = izi >> d_pix_shift;
 
@@ -102,7 +104,7 @@ D_DrawParticle(particle_t *pparticle)
 	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
 	    if (pz[0] <= izi) {
 		pz[0] = izi;
-		pdest[0] = pparticle->color;
+		pdest[0] = color;
 	    }
 	}
 	break;
@@ -113,12 +115,12 @@ D_DrawParticle(particle_t *pparticle)
 	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
 	    if (pz[0] <= izi) {
 		pz[0] = izi;
-		pdest[0] = pparticle->color;
+		pdest[0] = color;
 	    }
 
 	    if (pz[1] <= izi) {
 		pz[1] = izi;
-		pdest[1] = pparticle->color;
+		pdest[1] = color;
 	    }
 	}
 	break;
@@ -129,17 +131,17 @@ D_DrawParticle(particle_t *pparticle)
 	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
 	    if (pz[0] <= izi) {
 		pz[0] = izi;
-		pdest[0] = pparticle->color;
+		pdest[0] = color;
 	    }
 
 	    if (pz[1] <= izi) {
 		pz[1] = izi;
-		pdest[1] = pparticle->color;
+		pdest[1] = color;
 	    }
 
 	    if (pz[2] <= izi) {
 		pz[2] = izi;
-		pdest[2] = pparticle->color;
+		pdest[2] = color;
 	    }
 	}
 	break;
@@ -150,22 +152,22 @@ D_DrawParticle(particle_t *pparticle)
 	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
 	    if (pz[0] <= izi) {
 		pz[0] = izi;
-		pdest[0] = pparticle->color;
+		pdest[0] = color;
 	    }
 
 	    if (pz[1] <= izi) {
 		pz[1] = izi;
-		pdest[1] = pparticle->color;
+		pdest[1] = color;
 	    }
 
 	    if (pz[2] <= izi) {
 		pz[2] = izi;
-		pdest[2] = pparticle->color;
+		pdest[2] = color;
 	    }
 
 	    if (pz[3] <= izi) {
 		pz[3] = izi;
-		pdest[3] = pparticle->color;
+		pdest[3] = color;
 	    }
 	}
 	break;
@@ -177,7 +179,7 @@ D_DrawParticle(particle_t *pparticle)
 	    for (i = 0; i < pix; i++) {
 		if (pz[i] <= izi) {
 		    pz[i] = izi;
-		    pdest[i] = pparticle->color;
+		    pdest[i] = color;
 		}
 	    }
 	}
@@ -185,4 +187,63 @@ D_DrawParticle(particle_t *pparticle)
     }
 }
 
+
+#define PARTICLE_BATCH 256
+
+/*
+==============
+D_DrawParticles
+
+Transform and project a group's particles a batch at a time, in straight
+loops over the coordinate arrays, then draw the ones that land on screen
+==============
+*/
+void
+D_DrawParticles(const particlegroup_t *group)
+{
+    float tx[PARTICLE_BATCH], ty[PARTICLE_BATCH], tz[PARTICLE_BATCH];
+    int u[PARTICLE_BATCH], v[PARTICLE_BATCH], izi[PARTICLE_BATCH];
+    const float zclip = PARTICLE_Z_CLIP;
+    const float *x, *y, *z;
+    float lx, ly, lz, zi;
+    int i, first, count;
+
+    for (first = 0; first < group->count; first += PARTICLE_BATCH) {
+	count = qmin(group->count - first, PARTICLE_BATCH);
+	x = group->org[0] + first;
+	y = group->org[1] + first;
+	z = group->org[2] + first;
+
+	// transform points
+	for (i = 0; i < count; i++) {
+	    lx = x[i] - r_origin[0];
+	    ly = y[i] - r_origin[1];
+	    lz = z[i] - r_origin[2];
+	    tx[i] = lx * r_pright[0] + ly * r_pright[1] + lz * r_pright[2];
+	    ty[i] = lx * r_pup[0] + ly * r_pup[1] + lz * r_pup[2];
+	    tz[i] = lx * r_ppn[0] + ly * r_ppn[1] + lz * r_ppn[2];
+	}
+
+	// project them; the clipped ones are skipped below
+	for (i = 0; i < count; i++) {
+	    zi = 1.0f / (tz[i] < zclip ? zclip : tz[i]);
+	    u[i] = (int)(xcenter + zi * tx[i] + 0.5);
+	    v[i] = (int)(ycenter - zi * ty[i] + 0.5);
+	    izi[i] = (int)(zi * 0x8000);
+	}
+
+	for (i = 0; i < count; i++) {
+	    if (tz[i] < zclip)
+		continue;
+	    if (r_viewbits && !(group->viewbits[first + i] & r_viewbits))
+		continue;	// binned away from this view (see R_BinScene)
+	    if ((v[i] > d_vrectbottom_particle) ||
+		(u[i] > d_vrectright_particle) ||
+		(v[i] < d_vrecty) || (u[i] < d_vrectx))
+		continue;
+	    D_DrawParticlePixels(u[i], v[i], izi[i], group->color[first + i]);
+	}
+    }
+}
+
 #endif /* USE_X86_ASM */
@@ -585,7 +585,26 @@ D_PolysetDrawSpans8(spanpackage_t *pspanpackage)
 	    d_aspancount += ubasestep;
 	}
 
-	if (lcount) {
+	if (lcount && d_simdkernels) {
+	    dpolypixels_t pixels;
+
+	    pixels.pdest = pspanpackage->pdest;
+	    pixels.pz = pspanpackage->pz;
+	    pixels.ptex = pspanpackage->ptex;
+	    pixels.colormap = acolormap;
+	    pixels.count = lcount;
+	    pixels.sfrac = pspanpackage->sfrac;
+	    pixels.tfrac = pspanpackage->tfrac;
+	    pixels.light = pspanpackage->light;
+	    pixels.zi = pspanpackage->zi;
+	    pixels.zistep = r_zistepx;
+	    pixels.lightstep = r_lstepx;
+	    pixels.ststepwhole = a_ststepxwhole;
+	    pixels.sstepfrac = a_sstepxfrac;
+	    pixels.tstepfrac = a_tstepxfrac;
+	    pixels.skinwidth = r_affinetridesc.skinwidth;
+	    d_simdkernels->polysetpixels(&pixels);
+	} else if (lcount) {
 	    lpdest = pspanpackage->pdest;
 	    lptex = pspanpackage->ptex;
 	    lpz = pspanpackage->pz;
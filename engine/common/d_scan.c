@@ -26,10 +26,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "d_local.h"
 
-unsigned char *r_turb_pbase, *r_turb_pdest;
-fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
-int *r_turb_turb;
-int r_turb_spancount;
+D_THREADVAR unsigned char *r_turb_pbase, *r_turb_pdest;
+D_THREADVAR fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
+D_THREADVAR int *r_turb_turb;
+D_THREADVAR int r_turb_spancount;
 
 void D_DrawTurbulent8Span(void);
 
@@ -256,32 +256,41 @@ Turbulent8(espan_t *pspan)
 
 /*
 =============
-D_DrawSpans8
+D_DrawSpansSubdiv
+
+Perspective correct every 1 << shift pixels, affine in between.  The
+pixels are drawn by the C loop, or with kernels passed the subspans of a
+whole span at a time.
 =============
 */
-void
-D_DrawSpans8(espan_t *pspan)
+static inline void
+D_DrawSpansSubdiv(espan_t *pspan, const int shift,
+		  const dsimdkernels_t *kernels)
 {
-    int count, spancount;
+    const int subdiv = 1 << shift;
+    dsubspan_t subspans[MAXWIDTH / 8 + 1];
+    int count, spancount, numsub, numpixels;
     unsigned char *pbase, *pdest;
     fixed16_t s, t, snext, tnext, sstep, tstep;
     float sdivz, tdivz, zi, z, du, dv, spancountminus1;
-    float sdivz8stepu, tdivz8stepu, zi8stepu;
+    float sdivzstepu, tdivzstepu, zistepu;
 
     sstep = 0;			// keep compiler happy
     tstep = 0;			// ditto
 
     pbase = (unsigned char *)cacheblock;
 
-    sdivz8stepu = d_sdivzstepu * 8;
-    tdivz8stepu = d_tdivzstepu * 8;
-    zi8stepu = d_zistepu * 8;
+    sdivzstepu = d_sdivzstepu * subdiv;
+    tdivzstepu = d_tdivzstepu * subdiv;
+    zistepu = d_zistepu * subdiv;
 
     do {
 	pdest = (unsigned char *)((byte *)d_viewbuffer +
 				  (screenwidth * pspan->v) + pspan->u);
 
 	count = pspan->count;
+	numsub = 0;
+	numpixels = 0;
 
 	// calculate the initial s/z, t/z, 1/z, s, and t and clamp
 	du = (float)pspan->u;
@@ -306,8 +315,8 @@ D_DrawSpans8(espan_t *pspan)
 
 	do {
 	    // calculate s and t at the far end of the span
-	    if (count >= 8)
-		spancount = 8;
+	    if (count >= subdiv)
+		spancount = subdiv;
 	    else
 		spancount = count;
 
@@ -316,27 +325,27 @@ D_DrawSpans8(espan_t *pspan)
 	    if (count) {
 		// calculate s/z, t/z, zi->fixed s and t at far end of span,
 		// calculate s and t steps across span by shifting
-		sdivz += sdivz8stepu;
-		tdivz += tdivz8stepu;
-		zi += zi8stepu;
+		sdivz += sdivzstepu;
+		tdivz += tdivzstepu;
+		zi += zistepu;
 		z = (float)0x10000 / zi;	// prescale to 16.16 fixed-point
 
 		snext = (int)(sdivz * z) + sadjust;
 		if (snext > bbextents)
 		    snext = bbextents;
-		else if (snext < 8)
-		    snext = 8;	// prevent round-off error on <0 steps from
+		else if (snext < subdiv)
+		    snext = subdiv;	// prevent round-off error on <0 steps
 		//  from causing overstepping & running off the
 		//  edge of the texture
 
 		tnext = (int)(tdivz * z) + tadjust;
 		if (tnext > bbextentt)
 		    tnext = bbextentt;
-		else if (tnext < 8)
-		    tnext = 8;	// guard against round-off error on <0 steps
+		else if (tnext < subdiv)
+		    tnext = subdiv;	// guard against round-off error on <0 steps
 
-		sstep = (snext - s) >> 3;
-		tstep = (tnext - t) >> 3;
+		sstep = (snext - s) >> shift;
+		tstep = (tnext - t) >> shift;
 	    } else {
 		// calculate s/z, t/z, zi->fixed s and t at last pixel in span (so
 		// can't step off polygon), clamp, calculate s and t steps across
@@ -350,16 +359,16 @@ D_DrawSpans8(espan_t *pspan)
 		snext = (int)(sdivz * z) + sadjust;
 		if (snext > bbextents)
 		    snext = bbextents;
-		else if (snext < 8)
-		    snext = 8;	// prevent round-off error on <0 steps from
+		else if (snext < subdiv)
+		    snext = subdiv;	// prevent round-off error on <0 steps
 		//  from causing overstepping & running off the
 		//  edge of the texture
 
 		tnext = (int)(tdivz * z) + tadjust;
 		if (tnext > bbextentt)
 		    tnext = bbextentt;
-		else if (tnext < 8)
-		    tnext = 8;	// guard against round-off error on <0 steps
+		else if (tnext < subdiv)
+		    tnext = subdiv;	// guard against round-off error on <0 steps
 
 		if (spancount > 1) {
 		    sstep = (snext - s) / (spancount - 1);
@@ -367,20 +376,82 @@ D_DrawSpans8(espan_t *pspan)
 		}
 	    }
 
-	    do {
-		*pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
-		s += sstep;
-		t += tstep;
-	    } while (--spancount > 0);
+	    if (kernels) {
+		subspans[numsub].s = s;
+		subspans[numsub].t = t;
+		subspans[numsub].sstep = sstep;
+		subspans[numsub].tstep = tstep;
+		subspans[numsub].count = spancount;
+		numpixels += spancount;
+		if (++numsub == ARRAY_SIZE(subspans)) {
+		    kernels->spanpixels(pdest, pbase, cachewidth, subspans,
+					numsub);
+		    pdest += numpixels;
+		    numsub = numpixels = 0;
+		}
+	    } else {
+		do {
+		    *pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+		    s += sstep;
+		    t += tstep;
+		} while (--spancount > 0);
+	    }
 
 	    s = snext;
 	    t = tnext;
 
 	} while (count > 0);
 
+	if (kernels && numsub)
+	    kernels->spanpixels(pdest, pbase, cachewidth, subspans, numsub);
+
     } while ((pspan = pspan->pnext) != NULL);
 }
 
+/*
+=============
+D_DrawSpans8
+=============
+*/
+void
+D_DrawSpans8(espan_t *pspan)
+{
+    D_DrawSpansSubdiv(pspan, 3, NULL);
+}
+
+/*
+=============
+D_DrawSpans16
+=============
+*/
+void
+D_DrawSpans16(espan_t *pspan)
+{
+    D_DrawSpansSubdiv(pspan, 4, NULL);
+}
+
+/*
+=============
+D_DrawSpansSIMD8
+=============
+*/
+void
+D_DrawSpansSIMD8(espan_t *pspan)
+{
+    D_DrawSpansSubdiv(pspan, 3, d_simdkernels);
+}
+
+/*
+=============
+D_DrawSpansSIMD16
+=============
+*/
+void
+D_DrawSpansSIMD16(espan_t *pspan)
+{
+    D_DrawSpansSubdiv(pspan, 4, d_simdkernels);
+}
+
 #endif
 
 
@@ -418,6 +489,11 @@ D_DrawZSpans(espan_t *pspan)
 	// we count on FP exceptions being turned off to avoid range problems
 	izi = (int)(zi * 0x8000 * 0x10000);
 
+	if (d_simdkernels) {
+	    d_simdkernels->zspan(pdest, izi, izistep, count);
+	    continue;
+	}
+
 	if ((intptr_t)pdest & 0x02) {
 	    *pdest++ = (short)(izi >> 16);
 	    izi += izistep;
@@ -0,0 +1,1291 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_simd.c: SSE2, AVX2 and NEON pixel loops for the C span, polyset and
+// surface block drawers, vertex loops for the alias models and the palette
+// conversion for the video drivers
+
+/*
+ * The drawers in d_scan.c and d_polyse.c still do the per-span setup (the
+ * perspective divides and edge stepping), then hand whole rows of pixels to
+ * one of these; r_surf.c hands over whole 16x16 and 8x8 surface blocks and
+ * r_alias.c whole frames of model vertices.  Every kernel steps its values
+ * exactly as the C loop does, so all of them draw the same pixels.
+ *
+ * SSE2 is always there on x86-64 and NEON on arm64.  The AVX2 kernels are
+ * built with target attributes and only picked if the cpu has AVX2, so the
+ * rest of the engine is built as usual.  The AVX2 gathers read 4 bytes at
+ * each texel, up to 3 bytes past the last one; the surface cache keeps a
+ * guard after its last block and textures, skins and colormaps all live in
+ * the hunk, so those bytes are always there.
+ */
+
+#include <string.h>
+
+#include "d_local.h"
+#include "quakedef.h"
+
+#ifdef D_SIMD_X86
+#include <immintrin.h>
+#endif
+#ifdef D_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(D_SIMD_X86) || defined(D_SIMD_NEON)
+
+/*
+ * The alias vertex kernels transform, light and project a fixed batch of
+ * vertices at a time; the last partial batch goes through zero padded copies
+ * so the batch loads never read past the model's arrays.
+ */
+typedef void (*dvertbatch_t)(const daliasxform_t *xform,
+			     const trivertx_t *verts, const stvert_t *stverts,
+			     finalvert_t *fv, float (*aux)[3]);
+
+#define D_MAXVERTBATCH 8
+
+static inline void
+D_AliasVertBatches(dvertbatch_t batch, int size, const daliasxform_t *xform,
+		   const trivertx_t *verts, const stvert_t *stverts,
+		   finalvert_t *fv, float (*aux)[3], int numverts)
+{
+    trivertx_t tailverts[D_MAXVERTBATCH];
+    stvert_t tailstverts[D_MAXVERTBATCH];
+    finalvert_t tailfv[D_MAXVERTBATCH];
+    float tailaux[D_MAXVERTBATCH][3];
+    int i, count;
+
+    for (i = 0; i + size <= numverts; i += size)
+	batch(xform, verts + i, stverts + i, fv + i, aux ? aux + i : NULL);
+
+    count = numverts - i;
+    if (!count)
+	return;
+    memset(tailverts, 0, sizeof(tailverts));
+    memset(tailstverts, 0, sizeof(tailstverts));
+    memcpy(tailverts, verts + i, count * sizeof(*verts));
+    memcpy(tailstverts, stverts + i, count * sizeof(*stverts));
+    batch(xform, tailverts, tailstverts, tailfv, aux ? tailaux : NULL);
+    memcpy(fv + i, tailfv, count * sizeof(*fv));
+    if (aux)
+	memcpy(aux + i, tailaux, count * sizeof(*aux));
+}
+
+/* the pose blend for the vertices after the last whole batch */
+static inline void
+D_BlendPosesTail(trivertx_t *out, const trivertx_t *pose0,
+		 const trivertx_t *pose1, const trivertx_t *normals,
+		 int blend0, int blend1, int numverts)
+{
+    int i, j;
+
+    for (i = 0; i < numverts; i++) {
+	for (j = 0; j < 3; j++)
+	    out[i].v[j] = (pose0[i].v[j] * blend0 + pose1[i].v[j] * blend1)
+		>> D_POSEBLEND_SHIFT;
+	out[i].lightnormalindex = normals[i].lightnormalindex;
+    }
+}
+
+/*
+ * 8-bit to 32-bit palette conversion.  Only AVX2 can gather from a 256 entry
+ * table of words, so SSE2 and NEON make do with the lookups unrolled.
+ */
+static void
+D_Palette32Unrolled(unsigned *dest, const byte *src, const unsigned *palette,
+		    int count)
+{
+    for (; count >= 8; count -= 8, src += 8, dest += 8) {
+	dest[0] = palette[src[0]];
+	dest[1] = palette[src[1]];
+	dest[2] = palette[src[2]];
+	dest[3] = palette[src[3]];
+	dest[4] = palette[src[4]];
+	dest[5] = palette[src[5]];
+	dest[6] = palette[src[6]];
+	dest[7] = palette[src[7]];
+    }
+    while (count-- > 0)
+	*dest++ = palette[*src++];
+}
+
+/*
+==============================================================================
+
+SSE2
+
+==============================================================================
+*/
+
+#ifdef D_SIMD_X86
+
+/*
+ * (s >> 16) + (t >> 16) * cachewidth for four texels: the integer parts are
+ * paired up as 16-bit values ((t >> 16) fits, as a cached block has at most
+ * 64k texels) and multiplied by (1, cachewidth) with pmaddwd.
+ */
+static inline __m128i
+D_TexelOffsetsSSE2(__m128i s, __m128i t, __m128i mul)
+{
+    const __m128i high = _mm_set1_epi32(0xFFFF0000);
+    __m128i st = _mm_or_si128(_mm_srli_epi32(s, 16), _mm_and_si128(t, high));
+
+    return _mm_madd_epi16(st, mul);
+}
+
+static void
+D_SpanPixelsSSE2(byte *pdest, const byte *pbase, int cachewidth,
+		 const dsubspan_t *sub, int numsub)
+{
+    const __m128i mul = _mm_set1_epi32((cachewidth << 16) | 1);
+    int offsets[16] __attribute__((aligned(16)));
+    __m128i s, t, s4, t4;
+    int i, count;
+
+    for (; numsub > 0; numsub--, sub++) {
+	count = sub->count;
+	s = _mm_setr_epi32(sub->s, sub->s + sub->sstep,
+			   sub->s + sub->sstep * 2, sub->s + sub->sstep * 3);
+	t = _mm_setr_epi32(sub->t, sub->t + sub->tstep,
+			   sub->t + sub->tstep * 2, sub->t + sub->tstep * 3);
+	s4 = _mm_set1_epi32(sub->sstep * 4);
+	t4 = _mm_set1_epi32(sub->tstep * 4);
+	for (i = 0; i < count; i += 4) {
+	    _mm_store_si128((__m128i *)&offsets[i],
+			    D_TexelOffsetsSSE2(s, t, mul));
+	    s = _mm_add_epi32(s, s4);
+	    t = _mm_add_epi32(t, t4);
+	}
+	for (i = 0; i < count; i++)
+	    pdest[i] = pbase[offsets[i]];
+	pdest += count;
+    }
+}
+
+static void
+D_ZSpanSSE2(short *pdest, int izi, int izistep, int count)
+{
+    __m128i a, b, step;
+
+    a = _mm_setr_epi32(izi, izi + izistep, izi + izistep * 2,
+		       izi + izistep * 3);
+    step = _mm_set1_epi32(izistep * 4);
+    for (; count >= 8; count -= 8, pdest += 8) {
+	b = _mm_add_epi32(a, step);
+	_mm_storeu_si128((__m128i *)pdest,
+			 _mm_packs_epi32(_mm_srai_epi32(a, 16),
+					 _mm_srai_epi32(b, 16)));
+	a = _mm_add_epi32(b, step);
+	izi += izistep * 8;
+    }
+    for (; count > 0; count--) {
+	*pdest++ = (short)(izi >> 16);
+	izi += izistep;
+    }
+}
+
+/*
+ * The texel offsets of four polyset pixels.  The fractions only ever carry
+ * one at a time in the C loop, so the offset of pixel i works out as
+ * i * whole + ((sfrac + i * sstep) >> 16) + ((tfrac + i * tstep) >> 16) *
+ * skinwidth, with the t carries (small) multiplied by pmaddwd.
+ */
+static inline __m128i
+D_PolysetOffsetsSSE2(__m128i whole, __m128i sfrac, __m128i tfrac, __m128i mul)
+{
+    __m128i scarry = _mm_srli_epi32(sfrac, 16);
+    __m128i tcarry = _mm_madd_epi16(_mm_srli_epi32(tfrac, 16), mul);
+
+    return _mm_add_epi32(whole, _mm_add_epi32(scarry, tcarry));
+}
+
+static void
+D_PolysetPixelsSSE2(const dpolypixels_t *pp)
+{
+    const __m128i mul = _mm_set1_epi32(pp->skinwidth);
+    int offsets[4] __attribute__((aligned(16)));
+    int lights[4] __attribute__((aligned(16)));
+    int zis[4] __attribute__((aligned(16)));
+    __m128i whole, sfrac, tfrac, light, zi;
+    __m128i wholestep, sfracstep, tfracstep, lightstep, zistep;
+    byte *pdest = pp->pdest;
+    short *pz = pp->pz;
+    const byte *ptex = pp->ptex;
+    int i, n, count;
+
+    whole = _mm_setr_epi32(0, pp->ststepwhole, pp->ststepwhole * 2,
+			   pp->ststepwhole * 3);
+    sfrac = _mm_setr_epi32(pp->sfrac, pp->sfrac + pp->sstepfrac,
+			   pp->sfrac + pp->sstepfrac * 2,
+			   pp->sfrac + pp->sstepfrac * 3);
+    tfrac = _mm_setr_epi32(pp->tfrac, pp->tfrac + pp->tstepfrac,
+			   pp->tfrac + pp->tstepfrac * 2,
+			   pp->tfrac + pp->tstepfrac * 3);
+    light = _mm_setr_epi32(pp->light, pp->light + pp->lightstep,
+			   pp->light + pp->lightstep * 2,
+			   pp->light + pp->lightstep * 3);
+    zi = _mm_setr_epi32(pp->zi, pp->zi + pp->zistep, pp->zi + pp->zistep * 2,
+			pp->zi + pp->zistep * 3);
+    wholestep = _mm_set1_epi32(pp->ststepwhole * 4);
+    sfracstep = _mm_set1_epi32(pp->sstepfrac * 4);
+    tfracstep = _mm_set1_epi32(pp->tstepfrac * 4);
+    lightstep = _mm_set1_epi32(pp->lightstep * 4);
+    zistep = _mm_set1_epi32(pp->zistep * 4);
+
+    for (count = pp->count; count > 0; count -= 4) {
+	_mm_store_si128((__m128i *)offsets,
+			D_PolysetOffsetsSSE2(whole, sfrac, tfrac, mul));
+	_mm_store_si128((__m128i *)lights, light);
+	_mm_store_si128((__m128i *)zis, _mm_srai_epi32(zi, 16));
+
+	n = count < 4 ? count : 4;
+	for (i = 0; i < n; i++) {
+	    if (zis[i] >= pz[i]) {
+		pdest[i] = pp->colormap[ptex[offsets[i]] +
+					(lights[i] & 0xFF00)];
+		pz[i] = zis[i];
+	    }
+	}
+	pdest += 4;
+	pz += 4;
+
+	whole = _mm_add_epi32(whole, wholestep);
+	sfrac = _mm_add_epi32(sfrac, sfracstep);
+	tfrac = _mm_add_epi32(tfrac, tfracstep);
+	light = _mm_add_epi32(light, lightstep);
+	zi = _mm_add_epi32(zi, zistep);
+    }
+}
+
+/*
+ * A whole surface block: the light down the left and right edges steps a
+ * row at a time and across each row from right to left, as in the C block
+ * drawers.  Only the low 16 bits of the light pick the colormap row, so the
+ * row is done in 16-bit lanes.  The indices for the block are built first
+ * and looked up in one pass.
+ */
+static void
+D_SurfaceBlockSSE2(const dsurfblock_t *block)
+{
+    unsigned short index[16 * 16] __attribute__((aligned(16)));
+    const __m128i mask = _mm_set1_epi16((short)0xFF00);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ramp[2] = {
+	block->size == 16 ? _mm_setr_epi16(15, 14, 13, 12, 11, 10, 9, 8)
+			  : _mm_setr_epi16(7, 6, 5, 4, 3, 2, 1, 0),
+	_mm_setr_epi16(7, 6, 5, 4, 3, 2, 1, 0),
+    };
+    const byte *psource = block->psource;
+    const byte *colormap = block->colormap;
+    unsigned short *pindex;
+    byte *pdest;
+    __m128i lights, pix, right, step;
+    int lightleft, lightright, size, i, b;
+
+    size = block->size;
+    lightleft = block->lightleft;
+    lightright = block->lightright;
+    pindex = index;
+    for (i = 0; i < size; i++) {
+	right = _mm_set1_epi16(lightright);
+	step = _mm_set1_epi16((lightleft - lightright) >> block->shift);
+	for (b = 0; b < size; b += 8) {
+	    lights = _mm_add_epi16(right, _mm_mullo_epi16(ramp[b >> 3], step));
+	    pix = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(psource + b)),
+				    zero);
+	    _mm_store_si128((__m128i *)(pindex + b),
+			    _mm_or_si128(_mm_and_si128(lights, mask), pix));
+	}
+	pindex += size;
+	psource += block->sourcerowbytes;
+	lightleft += block->lightleftstep;
+	lightright += block->lightrightstep;
+    }
+
+    pdest = block->pdest;
+    pindex = index;
+    for (i = 0; i < size; i++) {
+	for (b = 0; b < size; b++)
+	    pdest[b] = colormap[pindex[b]];
+	pindex += size;
+	pdest += block->destrowbytes;
+    }
+}
+
+/*
+ * Transform, light and project four alias vertices, as
+ * R_AliasTransformAndProjectFinalVerts() does for unclipped models and
+ * R_AliasPreparePoints() for the rest.  The sums are added in the same order
+ * and 1/z is a true divide, so the results match the C code (bit for bit,
+ * unless -ffast-math reorders the C sums).
+ */
+static void
+D_AliasVerts4SSE2(const daliasxform_t *xform, const trivertx_t *verts,
+		  const stvert_t *stverts, finalvert_t *fv, float (*aux)[3])
+{
+    const __m128i low = _mm_set1_epi32(0xFF);
+    const __m128i raw = _mm_loadu_si128((const __m128i *)verts);
+    const float *n[4];
+    __m128 in[3], out[3], lightcos, zi, dark;
+    __m128i ambient, light, u, v, zscaled, flags, zero;
+    __m128 rows[8];
+    float outvals[3][4] __attribute__((aligned(16)));
+    int i;
+
+    in[0] = _mm_cvtepi32_ps(_mm_and_si128(raw, low));
+    in[1] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(raw, 8), low));
+    in[2] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(raw, 16), low));
+    for (i = 0; i < 3; i++) {
+	const float *m = xform->transform[i];
+	out[i] = _mm_add_ps(_mm_mul_ps(in[0], _mm_set1_ps(m[0])),
+			    _mm_mul_ps(in[1], _mm_set1_ps(m[1])));
+	out[i] = _mm_add_ps(out[i], _mm_mul_ps(in[2], _mm_set1_ps(m[2])));
+	out[i] = _mm_add_ps(out[i], _mm_set1_ps(m[3]));
+    }
+
+    for (i = 0; i < 4; i++)
+	n[i] = xform->normals[verts[i].lightnormalindex];
+    lightcos = _mm_add_ps(
+	_mm_mul_ps(_mm_setr_ps(n[0][0], n[1][0], n[2][0], n[3][0]),
+		   _mm_set1_ps(xform->lightvec[0])),
+	_mm_mul_ps(_mm_setr_ps(n[0][1], n[1][1], n[2][1], n[3][1]),
+		   _mm_set1_ps(xform->lightvec[1])));
+    lightcos = _mm_add_ps(lightcos,
+	_mm_mul_ps(_mm_setr_ps(n[0][2], n[1][2], n[2][2], n[3][2]),
+		   _mm_set1_ps(xform->lightvec[2])));
+    zero = _mm_setzero_si128();
+    ambient = _mm_set1_epi32(xform->ambientlight);
+    light = _mm_add_epi32(ambient, _mm_cvttps_epi32(
+	_mm_mul_ps(_mm_set1_ps(xform->shadelight), lightcos)));
+    light = _mm_andnot_si128(_mm_cmplt_epi32(light, zero), light);
+    dark = _mm_cmplt_ps(lightcos, _mm_setzero_ps());
+    light = _mm_or_si128(_mm_and_si128(_mm_castps_si128(dark), light),
+			 _mm_andnot_si128(_mm_castps_si128(dark), ambient));
+
+    flags = _mm_setr_epi32(stverts[0].onseam, stverts[1].onseam,
+			   stverts[2].onseam, stverts[3].onseam);
+    zi = _mm_div_ps(_mm_set1_ps(1.0f), out[2]);
+    if (!aux) {
+	zscaled = _mm_cvttps_epi32(zi);
+	u = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(out[0], zi),
+					_mm_set1_ps(xform->xcenter)));
+	v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(out[1], zi),
+					_mm_set1_ps(xform->ycenter)));
+    } else {
+	__m128i clip, zclip;
+
+	zscaled = _mm_cvttps_epi32(_mm_mul_ps(zi,
+					      _mm_set1_ps(xform->ziscale)));
+	u = _mm_cvttps_epi32(_mm_add_ps(
+	    _mm_mul_ps(_mm_mul_ps(out[0], _mm_set1_ps(xform->xscale)), zi),
+	    _mm_set1_ps(xform->xcenter)));
+	v = _mm_cvttps_epi32(_mm_add_ps(
+	    _mm_mul_ps(_mm_mul_ps(out[1], _mm_set1_ps(xform->yscale)), zi),
+	    _mm_set1_ps(xform->ycenter)));
+
+	clip = _mm_and_si128(_mm_cmplt_epi32(u, _mm_set1_epi32(xform->vrect[0])),
+			     _mm_set1_epi32(ALIAS_LEFT_CLIP));
+	clip = _mm_or_si128(clip, _mm_and_si128(
+	    _mm_cmplt_epi32(v, _mm_set1_epi32(xform->vrect[1])),
+	    _mm_set1_epi32(ALIAS_TOP_CLIP)));
+	clip = _mm_or_si128(clip, _mm_and_si128(
+	    _mm_cmpgt_epi32(u, _mm_set1_epi32(xform->vrect[2])),
+	    _mm_set1_epi32(ALIAS_RIGHT_CLIP)));
+	clip = _mm_or_si128(clip, _mm_and_si128(
+	    _mm_cmpgt_epi32(v, _mm_set1_epi32(xform->vrect[3])),
+	    _mm_set1_epi32(ALIAS_BOTTOM_CLIP)));
+	zclip = _mm_castps_si128(_mm_cmplt_ps(out[2],
+					      _mm_set1_ps(xform->zclip)));
+	clip = _mm_or_si128(_mm_andnot_si128(zclip, clip),
+			    _mm_and_si128(zclip, _mm_set1_epi32(ALIAS_Z_CLIP)));
+	flags = _mm_or_si128(flags, clip);
+
+	_mm_store_ps(outvals[0], out[0]);
+	_mm_store_ps(outvals[1], out[1]);
+	_mm_store_ps(outvals[2], out[2]);
+	for (i = 0; i < 4; i++) {
+	    aux[i][0] = outvals[0][i];
+	    aux[i][1] = outvals[1][i];
+	    aux[i][2] = outvals[2][i];
+	}
+    }
+
+    /* (u, v, s, t) and (l, 1/z, flags, 0) for each vertex */
+    rows[0] = _mm_castsi128_ps(u);
+    rows[1] = _mm_castsi128_ps(v);
+    rows[2] = _mm_castsi128_ps(_mm_setr_epi32(stverts[0].s, stverts[1].s,
+					      stverts[2].s, stverts[3].s));
+    rows[3] = _mm_castsi128_ps(_mm_setr_epi32(stverts[0].t, stverts[1].t,
+					      stverts[2].t, stverts[3].t));
+    rows[4] = _mm_castsi128_ps(light);
+    rows[5] = _mm_castsi128_ps(zscaled);
+    rows[6] = _mm_castsi128_ps(flags);
+    rows[7] = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+    _MM_TRANSPOSE4_PS(rows[4], rows[5], rows[6], rows[7]);
+    for (i = 0; i < 4; i++) {
+	_mm_storeu_ps((float *)&fv[i].v[0], rows[i]);
+	_mm_storeu_ps((float *)&fv[i].v[4], rows[i + 4]);
+    }
+}
+
+static void
+D_AliasVertsSSE2(const daliasxform_t *xform, const trivertx_t *verts,
+		 const stvert_t *stverts, finalvert_t *fv, float (*aux)[3],
+		 int numverts)
+{
+    D_AliasVertBatches(D_AliasVerts4SSE2, 4, xform, verts, stverts, fv, aux,
+		       numverts);
+}
+
+/* the low 32 bits of a * b, which SSE2 only has for unsigned pairs */
+static inline __m128i
+D_MulLo32SSE2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			      _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*
+ * Blend four vertices at a time; each byte is widened to its own 32-bit lane
+ * (the blend does not fit 16 bits) and the light normal byte is then taken
+ * from the normals pose.
+ */
+static void
+D_BlendPosesSSE2(trivertx_t *out, const trivertx_t *pose0,
+		 const trivertx_t *pose1, const trivertx_t *normals,
+		 int blend0, int blend1, int numverts)
+{
+    const __m128i w0 = _mm_set1_epi32(blend0);
+    const __m128i w1 = _mm_set1_epi32(blend1);
+    const __m128i indexbyte = _mm_set1_epi32(0xFF000000);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a, b, a16[2], b16[2], r[4], blended;
+    int i, j;
+
+    for (i = 0; i + 4 <= numverts; i += 4) {
+	a = _mm_loadu_si128((const __m128i *)(pose0 + i));
+	b = _mm_loadu_si128((const __m128i *)(pose1 + i));
+	a16[0] = _mm_unpacklo_epi8(a, zero);
+	a16[1] = _mm_unpackhi_epi8(a, zero);
+	b16[0] = _mm_unpacklo_epi8(b, zero);
+	b16[1] = _mm_unpackhi_epi8(b, zero);
+	for (j = 0; j < 4; j++) {
+	    a = (j & 1) ? _mm_unpackhi_epi16(a16[j >> 1], zero)
+			: _mm_unpacklo_epi16(a16[j >> 1], zero);
+	    b = (j & 1) ? _mm_unpackhi_epi16(b16[j >> 1], zero)
+			: _mm_unpacklo_epi16(b16[j >> 1], zero);
+	    r[j] = _mm_add_epi32(D_MulLo32SSE2(a, w0), D_MulLo32SSE2(b, w1));
+	    r[j] = _mm_srli_epi32(r[j], D_POSEBLEND_SHIFT);
+	}
+	blended = _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]),
+				   _mm_packs_epi32(r[2], r[3]));
+	blended = _mm_or_si128(_mm_andnot_si128(indexbyte, blended),
+		_mm_and_si128(indexbyte,
+			      _mm_loadu_si128((const __m128i *)(normals + i))));
+	_mm_storeu_si128((__m128i *)(out + i), blended);
+    }
+    D_BlendPosesTail(out + i, pose0 + i, pose1 + i, normals + i, blend0,
+		     blend1, numverts - i);
+}
+
+static const dsimdkernels_t d_sse2kernels = {
+    "SSE2",
+    D_SpanPixelsSSE2,
+    D_ZSpanSSE2,
+    D_PolysetPixelsSSE2,
+    D_SurfaceBlockSSE2,
+    D_AliasVertsSSE2,
+    D_BlendPosesSSE2,
+    D_Palette32Unrolled,
+};
+
+/*
+==============================================================================
+
+AVX2
+
+==============================================================================
+*/
+
+/* keep the low byte of each 32-bit lane, in the low 8 bytes */
+#define AVX2_PACK_LOW_BYTES(v) ({					\
+	const __m256i shuf = _mm256_setr_epi8(				\
+	    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,	\
+	    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);	\
+	__m256i packed = _mm256_shuffle_epi8((v), shuf);			\
+	packed = _mm256_permutevar8x32_epi32(packed,			\
+		     _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1));		\
+	_mm256_castsi256_si128(packed);					\
+})
+
+/* all ones in the lanes below n */
+#define AVX2_LANES(ramp, n) _mm256_cmpgt_epi32(_mm256_set1_epi32(n), (ramp))
+
+__attribute__((target("avx2")))
+static void
+D_SpanPixelsAVX2(byte *pdest, const byte *pbase, int cachewidth,
+		 const dsubspan_t *sub, int numsub)
+{
+    const __m256i ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i mul = _mm256_set1_epi32((cachewidth << 16) | 1);
+    const __m256i high = _mm256_set1_epi32(0xFFFF0000);
+    __m256i s, t, s8, t8, offsets, texels;
+    byte pixels[8];
+    int i, count;
+
+    for (; numsub > 0; numsub--, sub++) {
+	count = sub->count;
+	s = _mm256_add_epi32(_mm256_set1_epi32(sub->s),
+			     _mm256_mullo_epi32(ramp,
+						_mm256_set1_epi32(sub->sstep)));
+	t = _mm256_add_epi32(_mm256_set1_epi32(sub->t),
+			     _mm256_mullo_epi32(ramp,
+						_mm256_set1_epi32(sub->tstep)));
+	s8 = _mm256_set1_epi32(sub->sstep * 8);
+	t8 = _mm256_set1_epi32(sub->tstep * 8);
+	for (i = 0; i < count; i += 8) {
+	    offsets = _mm256_madd_epi16(_mm256_or_si256(_mm256_srli_epi32(s, 16),
+							_mm256_and_si256(t, high)),
+					mul);
+	    if (count - i >= 8) {
+		texels = _mm256_i32gather_epi32((const int *)pbase, offsets, 1);
+		_mm_storel_epi64((__m128i *)(pdest + i),
+				 AVX2_PACK_LOW_BYTES(texels));
+	    } else {
+		// the lanes past the end would step off the texture
+		texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+						     (const int *)pbase, offsets,
+						     AVX2_LANES(ramp, count - i),
+						     1);
+		_mm_storel_epi64((__m128i *)pixels,
+				 AVX2_PACK_LOW_BYTES(texels));
+		memcpy(pdest + i, pixels, count - i);
+	    }
+	    s = _mm256_add_epi32(s, s8);
+	    t = _mm256_add_epi32(t, t8);
+	}
+	pdest += count;
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+D_PolysetPixelsAVX2(const dpolypixels_t *pp)
+{
+    const __m256i ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lightmask = _mm256_set1_epi32(0xFF00);
+    const __m256i bytemask = _mm256_set1_epi32(0xFF);
+    const __m256i skinwidth = _mm256_set1_epi32(pp->skinwidth);
+    __m256i whole, sfrac, tfrac, light, zi;
+    __m256i offsets, texels, index, colors, z, izi, draw, lanes;
+    int drawn[8] __attribute__((aligned(32)));
+    int zis[8] __attribute__((aligned(32)));
+    byte pixels[8];
+    byte *pdest = pp->pdest;
+    short *pz = pp->pz;
+    const byte *ptex = pp->ptex;
+    int i, n, count;
+
+#define AVX2_RAMP(base, step) \
+    _mm256_add_epi32(_mm256_set1_epi32(base), \
+		     _mm256_mullo_epi32(ramp, _mm256_set1_epi32(step)))
+    whole = AVX2_RAMP(0, pp->ststepwhole);
+    sfrac = AVX2_RAMP(pp->sfrac, pp->sstepfrac);
+    tfrac = AVX2_RAMP(pp->tfrac, pp->tstepfrac);
+    light = AVX2_RAMP(pp->light, pp->lightstep);
+    zi = AVX2_RAMP(pp->zi, pp->zistep);
+#undef AVX2_RAMP
+
+    for (count = pp->count; count > 0; count -= 8) {
+	n = count < 8 ? count : 8;
+
+	offsets = _mm256_add_epi32(whole, _mm256_srli_epi32(sfrac, 16));
+	offsets = _mm256_add_epi32(offsets,
+				   _mm256_mullo_epi32(_mm256_srli_epi32(tfrac, 16),
+						      skinwidth));
+	lanes = AVX2_LANES(ramp, n);
+	texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+					     (const int *)ptex, offsets,
+					     lanes, 1);
+	texels = _mm256_and_si256(texels, bytemask);
+	index = _mm256_add_epi32(texels, _mm256_and_si256(light, lightmask));
+	colors = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+					     (const int *)pp->colormap, index,
+					     lanes, 1);
+
+	// the z test: (zi >> 16) >= *pz
+	izi = _mm256_srai_epi32(zi, 16);
+	if (n == 8) {
+	    z = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)pz));
+	} else {
+	    short zbuf[8] = { 0 };
+	    memcpy(zbuf, pz, n * sizeof(short));
+	    z = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)zbuf));
+	}
+	draw = _mm256_cmpgt_epi32(z, izi);	// not drawn
+	_mm256_store_si256((__m256i *)drawn, draw);
+	_mm256_store_si256((__m256i *)zis, izi);
+	_mm_storel_epi64((__m128i *)pixels, AVX2_PACK_LOW_BYTES(colors));
+
+	for (i = 0; i < n; i++) {
+	    if (!drawn[i]) {
+		pdest[i] = pixels[i];
+		pz[i] = zis[i];
+	    }
+	}
+	pdest += 8;
+	pz += 8;
+
+	whole = _mm256_add_epi32(whole, _mm256_set1_epi32(pp->ststepwhole * 8));
+	sfrac = _mm256_add_epi32(sfrac, _mm256_set1_epi32(pp->sstepfrac * 8));
+	tfrac = _mm256_add_epi32(tfrac, _mm256_set1_epi32(pp->tstepfrac * 8));
+	light = _mm256_add_epi32(light, _mm256_set1_epi32(pp->lightstep * 8));
+	zi = _mm256_add_epi32(zi, _mm256_set1_epi32(pp->zistep * 8));
+    }
+}
+
+/*
+ * The 16-bit indices are widened for the colormap gathers, so a 16 texel
+ * row takes two.
+ */
+__attribute__((target("avx2")))
+static void
+D_SurfaceBlockAVX2(const dsurfblock_t *block)
+{
+    const __m256i ramp16 = _mm256_setr_epi16(15, 14, 13, 12, 11, 10, 9, 8,
+					     7, 6, 5, 4, 3, 2, 1, 0);
+    const __m128i ramp8 = _mm_setr_epi16(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m256i mask16 = _mm256_set1_epi16((short)0xFF00);
+    const __m128i mask8 = _mm_set1_epi16((short)0xFF00);
+    const byte *psource = block->psource;
+    const int *colormap = (const int *)block->colormap;
+    byte *pdest = block->pdest;
+    __m256i lights, pix, index, colorslo, colorshi;
+    __m128i lights8, index8;
+    int lightleft, lightright, step, i;
+
+    lightleft = block->lightleft;
+    lightright = block->lightright;
+    for (i = 0; i < block->size; i++) {
+	step = (lightleft - lightright) >> block->shift;
+	if (block->size == 16) {
+	    lights = _mm256_add_epi16(_mm256_set1_epi16(lightright),
+				      _mm256_mullo_epi16(ramp16,
+							 _mm256_set1_epi16(step)));
+	    pix = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)psource));
+	    index = _mm256_or_si256(_mm256_and_si256(lights, mask16), pix);
+	    colorslo = _mm256_i32gather_epi32(colormap,
+			   _mm256_cvtepu16_epi32(_mm256_castsi256_si128(index)),
+			   1);
+	    colorshi = _mm256_i32gather_epi32(colormap,
+			   _mm256_cvtepu16_epi32(_mm256_extracti128_si256(index, 1)),
+			   1);
+	    _mm_storel_epi64((__m128i *)pdest, AVX2_PACK_LOW_BYTES(colorslo));
+	    _mm_storel_epi64((__m128i *)(pdest + 8),
+			     AVX2_PACK_LOW_BYTES(colorshi));
+	} else {
+	    lights8 = _mm_add_epi16(_mm_set1_epi16(lightright),
+				    _mm_mullo_epi16(ramp8, _mm_set1_epi16(step)));
+	    index8 = _mm_or_si128(_mm_and_si128(lights8, mask8),
+				  _mm_cvtepu8_epi16(_mm_loadl_epi64(
+					(const __m128i *)psource)));
+	    colorslo = _mm256_i32gather_epi32(colormap,
+					      _mm256_cvtepu16_epi32(index8), 1);
+	    _mm_storel_epi64((__m128i *)pdest, AVX2_PACK_LOW_BYTES(colorslo));
+	}
+	psource += block->sourcerowbytes;
+	pdest += block->destrowbytes;
+	lightleft += block->lightleftstep;
+	lightright += block->lightrightstep;
+    }
+}
+
+/* the same as D_AliasVerts4SSE2(), eight vertices at a time */
+__attribute__((target("avx2")))
+static void
+D_AliasVerts8AVX2(const daliasxform_t *xform, const trivertx_t *verts,
+		  const stvert_t *stverts, finalvert_t *fv, float (*aux)[3])
+{
+    const __m256i low = _mm256_set1_epi32(0xFF);
+    const __m256i raw = _mm256_loadu_si256((const __m256i *)verts);
+    const __m256i stindex = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const int *stbase = (const int *)stverts;
+    const float *nbase = xform->normals[0];
+    __m256 in[3], out[3], lightcos, zi, dark, t[8], s[8];
+    __m256i nindex, ambient, light, u, v, zscaled, flags, zero;
+    __m256 rows[8];
+    float outvals[3][8] __attribute__((aligned(32)));
+    int i;
+
+    in[0] = _mm256_cvtepi32_ps(_mm256_and_si256(raw, low));
+    in[1] = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(raw, 8),
+						low));
+    in[2] = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(raw, 16),
+						low));
+    for (i = 0; i < 3; i++) {
+	const float *m = xform->transform[i];
+	out[i] = _mm256_add_ps(_mm256_mul_ps(in[0], _mm256_set1_ps(m[0])),
+			       _mm256_mul_ps(in[1], _mm256_set1_ps(m[1])));
+	out[i] = _mm256_add_ps(out[i],
+			       _mm256_mul_ps(in[2], _mm256_set1_ps(m[2])));
+	out[i] = _mm256_add_ps(out[i], _mm256_set1_ps(m[3]));
+    }
+
+    nindex = _mm256_mullo_epi32(_mm256_srli_epi32(raw, 24),
+				_mm256_set1_epi32(3));
+    lightcos = _mm256_add_ps(
+	_mm256_mul_ps(_mm256_i32gather_ps(nbase, nindex, 4),
+		      _mm256_set1_ps(xform->lightvec[0])),
+	_mm256_mul_ps(_mm256_i32gather_ps(nbase + 1, nindex, 4),
+		      _mm256_set1_ps(xform->lightvec[1])));
+    lightcos = _mm256_add_ps(lightcos,
+	_mm256_mul_ps(_mm256_i32gather_ps(nbase + 2, nindex, 4),
+		      _mm256_set1_ps(xform->lightvec[2])));
+    zero = _mm256_setzero_si256();
+    ambient = _mm256_set1_epi32(xform->ambientlight);
+    light = _mm256_add_epi32(ambient, _mm256_cvttps_epi32(
+	_mm256_mul_ps(_mm256_set1_ps(xform->shadelight), lightcos)));
+    light = _mm256_max_epi32(light, zero);
+    dark = _mm256_cmp_ps(lightcos, _mm256_setzero_ps(), _CMP_LT_OQ);
+    light = _mm256_blendv_epi8(ambient, light, _mm256_castps_si256(dark));
+
+    flags = _mm256_i32gather_epi32(stbase, stindex, 4);
+    zi = _mm256_div_ps(_mm256_set1_ps(1.0f), out[2]);
+    if (!aux) {
+	zscaled = _mm256_cvttps_epi32(zi);
+	u = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(out[0], zi),
+					      _mm256_set1_ps(xform->xcenter)));
+	v = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(out[1], zi),
+					      _mm256_set1_ps(xform->ycenter)));
+    } else {
+	__m256i clip, zclip;
+
+	zscaled = _mm256_cvttps_epi32(
+	    _mm256_mul_ps(zi, _mm256_set1_ps(xform->ziscale)));
+	u = _mm256_cvttps_epi32(_mm256_add_ps(
+	    _mm256_mul_ps(_mm256_mul_ps(out[0],
+					_mm256_set1_ps(xform->xscale)), zi),
+	    _mm256_set1_ps(xform->xcenter)));
+	v = _mm256_cvttps_epi32(_mm256_add_ps(
+	    _mm256_mul_ps(_mm256_mul_ps(out[1],
+					_mm256_set1_ps(xform->yscale)), zi),
+	    _mm256_set1_ps(xform->ycenter)));
+
+	clip = _mm256_and_si256(
+	    _mm256_cmpgt_epi32(_mm256_set1_epi32(xform->vrect[0]), u),
+	    _mm256_set1_epi32(ALIAS_LEFT_CLIP));
+	clip = _mm256_or_si256(clip, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(_mm256_set1_epi32(xform->vrect[1]), v),
+	    _mm256_set1_epi32(ALIAS_TOP_CLIP)));
+	clip = _mm256_or_si256(clip, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(u, _mm256_set1_epi32(xform->vrect[2])),
+	    _mm256_set1_epi32(ALIAS_RIGHT_CLIP)));
+	clip = _mm256_or_si256(clip, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(v, _mm256_set1_epi32(xform->vrect[3])),
+	    _mm256_set1_epi32(ALIAS_BOTTOM_CLIP)));
+	zclip = _mm256_castps_si256(_mm256_cmp_ps(out[2],
+		    _mm256_set1_ps(xform->zclip), _CMP_LT_OQ));
+	clip = _mm256_blendv_epi8(clip, _mm256_set1_epi32(ALIAS_Z_CLIP),
+				  zclip);
+	flags = _mm256_or_si256(flags, clip);
+
+	_mm256_store_ps(outvals[0], out[0]);
+	_mm256_store_ps(outvals[1], out[1]);
+	_mm256_store_ps(outvals[2], out[2]);
+	for (i = 0; i < 8; i++) {
+	    aux[i][0] = outvals[0][i];
+	    aux[i][1] = outvals[1][i];
+	    aux[i][2] = outvals[2][i];
+	}
+    }
+
+    /* transpose to (u, v, s, t, l, 1/z, flags, 0) for each vertex */
+    rows[0] = _mm256_castsi256_ps(u);
+    rows[1] = _mm256_castsi256_ps(v);
+    rows[2] = _mm256_castsi256_ps(_mm256_i32gather_epi32(stbase + 1,
+							 stindex, 4));
+    rows[3] = _mm256_castsi256_ps(_mm256_i32gather_epi32(stbase + 2,
+							 stindex, 4));
+    rows[4] = _mm256_castsi256_ps(light);
+    rows[5] = _mm256_castsi256_ps(zscaled);
+    rows[6] = _mm256_castsi256_ps(flags);
+    rows[7] = _mm256_setzero_ps();
+    for (i = 0; i < 8; i += 2) {
+	t[i] = _mm256_unpacklo_ps(rows[i], rows[i + 1]);
+	t[i + 1] = _mm256_unpackhi_ps(rows[i], rows[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+	s[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+	s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+	s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3],
+				     _MM_SHUFFLE(1, 0, 1, 0));
+	s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3],
+				     _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (i = 0; i < 4; i++) {
+	_mm256_storeu_ps((float *)fv[i].v,
+			 _mm256_permute2f128_ps(s[i], s[i + 4], 0x20));
+	_mm256_storeu_ps((float *)fv[i + 4].v,
+			 _mm256_permute2f128_ps(s[i], s[i + 4], 0x31));
+    }
+}
+
+static void
+D_AliasVertsAVX2(const daliasxform_t *xform, const trivertx_t *verts,
+		 const stvert_t *stverts, finalvert_t *fv, float (*aux)[3],
+		 int numverts)
+{
+    D_AliasVertBatches(D_AliasVerts8AVX2, 8, xform, verts, stverts, fv, aux,
+		       numverts);
+}
+
+/* the same as D_BlendPosesSSE2(), eight vertices at a time */
+__attribute__((target("avx2")))
+static void
+D_BlendPosesAVX2(trivertx_t *out, const trivertx_t *pose0,
+		 const trivertx_t *pose1, const trivertx_t *normals,
+		 int blend0, int blend1, int numverts)
+{
+    const __m256i w0 = _mm256_set1_epi32(blend0);
+    const __m256i w1 = _mm256_set1_epi32(blend1);
+    const __m256i indexbyte = _mm256_set1_epi32(0xFF000000);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i a, b, a16[2], b16[2], r[4], blended;
+    int i, j;
+
+    for (i = 0; i + 8 <= numverts; i += 8) {
+	a = _mm256_loadu_si256((const __m256i *)(pose0 + i));
+	b = _mm256_loadu_si256((const __m256i *)(pose1 + i));
+	a16[0] = _mm256_unpacklo_epi8(a, zero);
+	a16[1] = _mm256_unpackhi_epi8(a, zero);
+	b16[0] = _mm256_unpacklo_epi8(b, zero);
+	b16[1] = _mm256_unpackhi_epi8(b, zero);
+	for (j = 0; j < 4; j++) {
+	    a = (j & 1) ? _mm256_unpackhi_epi16(a16[j >> 1], zero)
+			: _mm256_unpacklo_epi16(a16[j >> 1], zero);
+	    b = (j & 1) ? _mm256_unpackhi_epi16(b16[j >> 1], zero)
+			: _mm256_unpacklo_epi16(b16[j >> 1], zero);
+	    r[j] = _mm256_add_epi32(_mm256_mullo_epi32(a, w0),
+				    _mm256_mullo_epi32(b, w1));
+	    r[j] = _mm256_srli_epi32(r[j], D_POSEBLEND_SHIFT);
+	}
+	/* the packs undo the unpacks within each 128-bit lane */
+	blended = _mm256_packus_epi16(_mm256_packs_epi32(r[0], r[1]),
+				      _mm256_packs_epi32(r[2], r[3]));
+	blended = _mm256_blendv_epi8(blended,
+		_mm256_loadu_si256((const __m256i *)(normals + i)), indexbyte);
+	_mm256_storeu_si256((__m256i *)(out + i), blended);
+    }
+    D_BlendPosesTail(out + i, pose0 + i, pose1 + i, normals + i, blend0,
+		     blend1, numverts - i);
+}
+
+__attribute__((target("avx2")))
+static void
+D_Palette32AVX2(unsigned *dest, const byte *src, const unsigned *palette,
+		int count)
+{
+    __m256i indices0, indices1;
+
+    for (; count >= 16; count -= 16, src += 16, dest += 16) {
+	indices0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)src));
+	indices1 = _mm256_cvtepu8_epi32(
+		       _mm_loadl_epi64((const __m128i *)(src + 8)));
+	_mm256_storeu_si256((__m256i *)dest,
+		_mm256_i32gather_epi32((const int *)palette, indices0, 4));
+	_mm256_storeu_si256((__m256i *)(dest + 8),
+		_mm256_i32gather_epi32((const int *)palette, indices1, 4));
+    }
+    D_Palette32Unrolled(dest, src, palette, count);
+}
+
+static const dsimdkernels_t d_avx2kernels = {
+    "AVX2",
+    D_SpanPixelsAVX2,
+    D_ZSpanSSE2,
+    D_PolysetPixelsAVX2,
+    D_SurfaceBlockAVX2,
+    D_AliasVertsAVX2,
+    D_BlendPosesAVX2,
+    D_Palette32AVX2,
+};
+
+#endif /* D_SIMD_X86 */
+
+/*
+==============================================================================
+
+NEON
+
+==============================================================================
+*/
+
+#ifdef D_SIMD_NEON
+
+#define NEON_RAMP(base, step) \
+    vmlaq_n_s32(vdupq_n_s32(base), d_neonramp, (step))
+
+static const int32_t d_neonrampvals[4] = { 0, 1, 2, 3 };
+#define d_neonramp vld1q_s32(d_neonrampvals)
+
+static void
+D_SpanPixelsNEON(byte *pdest, const byte *pbase, int cachewidth,
+		 const dsubspan_t *sub, int numsub)
+{
+    uint32_t offsets[16] __attribute__((aligned(16)));
+    const uint32x4_t width = vdupq_n_u32(cachewidth);
+    uint32x4_t s, t, s4, t4;
+    int i, count;
+
+    for (; numsub > 0; numsub--, sub++) {
+	count = sub->count;
+	s = vreinterpretq_u32_s32(NEON_RAMP(sub->s, sub->sstep));
+	t = vreinterpretq_u32_s32(NEON_RAMP(sub->t, sub->tstep));
+	s4 = vdupq_n_u32(sub->sstep * 4);
+	t4 = vdupq_n_u32(sub->tstep * 4);
+	for (i = 0; i < count; i += 4) {
+	    vst1q_u32(&offsets[i], vmlaq_u32(vshrq_n_u32(s, 16),
+					      vshrq_n_u32(t, 16), width));
+	    s = vaddq_u32(s, s4);
+	    t = vaddq_u32(t, t4);
+	}
+	for (i = 0; i < count; i++)
+	    pdest[i] = pbase[offsets[i]];
+	pdest += count;
+    }
+}
+
+static void
+D_ZSpanNEON(short *pdest, int izi, int izistep, int count)
+{
+    int32x4_t a, b, step;
+
+    a = NEON_RAMP(izi, izistep);
+    step = vdupq_n_s32(izistep * 4);
+    for (; count >= 8; count -= 8, pdest += 8) {
+	b = vaddq_s32(a, step);
+	vst1q_s16(pdest, vcombine_s16(vshrn_n_s32(a, 16), vshrn_n_s32(b, 16)));
+	a = vaddq_s32(b, step);
+	izi += izistep * 8;
+    }
+    for (; count > 0; count--) {
+	*pdest++ = (short)(izi >> 16);
+	izi += izistep;
+    }
+}
+
+static void
+D_PolysetPixelsNEON(const dpolypixels_t *pp)
+{
+    int32_t offsets[4] __attribute__((aligned(16)));
+    int32_t lights[4] __attribute__((aligned(16)));
+    int32_t zis[4] __attribute__((aligned(16)));
+    int32x4_t whole, sfrac, tfrac, light, zi, off;
+    byte *pdest = pp->pdest;
+    short *pz = pp->pz;
+    const byte *ptex = pp->ptex;
+    int i, n, count;
+
+    whole = NEON_RAMP(0, pp->ststepwhole);
+    sfrac = NEON_RAMP(pp->sfrac, pp->sstepfrac);
+    tfrac = NEON_RAMP(pp->tfrac, pp->tstepfrac);
+    light = NEON_RAMP(pp->light, pp->lightstep);
+    zi = NEON_RAMP(pp->zi, pp->zistep);
+
+    for (count = pp->count; count > 0; count -= 4) {
+	off = vaddq_s32(whole, vshrq_n_s32(sfrac, 16));
+	off = vmlaq_n_s32(off, vshrq_n_s32(tfrac, 16), pp->skinwidth);
+	vst1q_s32(offsets, off);
+	vst1q_s32(lights, light);
+	vst1q_s32(zis, vshrq_n_s32(zi, 16));
+
+	n = count < 4 ? count : 4;
+	for (i = 0; i < n; i++) {
+	    if (zis[i] >= pz[i]) {
+		pdest[i] = pp->colormap[ptex[offsets[i]] +
+					(lights[i] & 0xFF00)];
+		pz[i] = zis[i];
+	    }
+	}
+	pdest += 4;
+	pz += 4;
+
+	whole = vaddq_s32(whole, vdupq_n_s32(pp->ststepwhole * 4));
+	sfrac = vaddq_s32(sfrac, vdupq_n_s32(pp->sstepfrac * 4));
+	tfrac = vaddq_s32(tfrac, vdupq_n_s32(pp->tstepfrac * 4));
+	light = vaddq_s32(light, vdupq_n_s32(pp->lightstep * 4));
+	zi = vaddq_s32(zi, vdupq_n_s32(pp->zistep * 4));
+    }
+}
+
+static void
+D_SurfaceBlockNEON(const dsurfblock_t *block)
+{
+    static const int16_t rampvals[16] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+    };
+    uint16_t index[16 * 16] __attribute__((aligned(16)));
+    const uint16x8_t mask = vdupq_n_u16(0xFF00);
+    const int16x8_t ramp[2] = {
+	vld1q_s16(rampvals + (block->size == 16 ? 0 : 8)),
+	vld1q_s16(rampvals + 8),
+    };
+    const byte *psource = block->psource;
+    const byte *colormap = block->colormap;
+    uint16_t *pindex;
+    byte *pdest;
+    int16x8_t lights;
+    uint16x8_t pix;
+    int lightleft, lightright, step, size, i, b;
+
+    size = block->size;
+    lightleft = block->lightleft;
+    lightright = block->lightright;
+    pindex = index;
+    for (i = 0; i < size; i++) {
+	step = (lightleft - lightright) >> block->shift;
+	for (b = 0; b < size; b += 8) {
+	    lights = vmlaq_n_s16(vdupq_n_s16(lightright), ramp[b >> 3], step);
+	    pix = vmovl_u8(vld1_u8(psource + b));
+	    vst1q_u16(pindex + b,
+		      vorrq_u16(vandq_u16(vreinterpretq_u16_s16(lights), mask),
+				pix));
+	}
+	pindex += size;
+	psource += block->sourcerowbytes;
+	lightleft += block->lightleftstep;
+	lightright += block->lightrightstep;
+    }
+
+    pdest = block->pdest;
+    pindex = index;
+    for (i = 0; i < size; i++) {
+	for (b = 0; b < size; b++)
+	    pdest[b] = colormap[pindex[b]];
+	pindex += size;
+	pdest += block->destrowbytes;
+    }
+}
+
+/* 1/z in each lane; armv7 NEON has only the reciprocal estimate */
+static inline float32x4_t
+D_ReciprocalNEON(float32x4_t z)
+{
+#ifdef __aarch64__
+    return vdivq_f32(vdupq_n_f32(1.0f), z);
+#else
+    float vals[4] __attribute__((aligned(16)));
+    int i;
+
+    vst1q_f32(vals, z);
+    for (i = 0; i < 4; i++)
+	vals[i] = 1.0f / vals[i];
+    return vld1q_f32(vals);
+#endif
+}
+
+/* the same as D_AliasVerts4SSE2(), the rows are scattered with plain stores */
+static void
+D_AliasVerts4NEON(const daliasxform_t *xform, const trivertx_t *verts,
+		  const stvert_t *stverts, finalvert_t *fv, float (*aux)[3])
+{
+    const uint32x4_t low = vdupq_n_u32(0xFF);
+    const uint32x4_t raw = vld1q_u32((const uint32_t *)verts);
+    float32x4_t in[3], out[3], lightcos, zi;
+    float normals[3][4] __attribute__((aligned(16)));
+    float outvals[3][4] __attribute__((aligned(16)));
+    int32_t rows[7][4] __attribute__((aligned(16)));
+    int32x4_t ambient, light, u, v, flags;
+    uint32x4_t dark;
+    int i, j;
+
+    in[0] = vcvtq_f32_u32(vandq_u32(raw, low));
+    in[1] = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(raw, 8), low));
+    in[2] = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(raw, 16), low));
+    for (i = 0; i < 3; i++) {
+	const float *m = xform->transform[i];
+	out[i] = vaddq_f32(vmulq_n_f32(in[0], m[0]),
+			   vmulq_n_f32(in[1], m[1]));
+	out[i] = vaddq_f32(out[i], vmulq_n_f32(in[2], m[2]));
+	out[i] = vaddq_f32(out[i], vdupq_n_f32(m[3]));
+    }
+
+    for (i = 0; i < 4; i++) {
+	const float *n = xform->normals[verts[i].lightnormalindex];
+	for (j = 0; j < 3; j++)
+	    normals[j][i] = n[j];
+	rows[2][i] = stverts[i].s;
+	rows[3][i] = stverts[i].t;
+	rows[6][i] = stverts[i].onseam;
+    }
+    lightcos = vaddq_f32(vmulq_n_f32(vld1q_f32(normals[0]),
+				     xform->lightvec[0]),
+			 vmulq_n_f32(vld1q_f32(normals[1]),
+				     xform->lightvec[1]));
+    lightcos = vaddq_f32(lightcos, vmulq_n_f32(vld1q_f32(normals[2]),
+					       xform->lightvec[2]));
+    ambient = vdupq_n_s32(xform->ambientlight);
+    light = vaddq_s32(ambient, vcvtq_s32_f32(vmulq_n_f32(lightcos,
+							 xform->shadelight)));
+    light = vmaxq_s32(light, vdupq_n_s32(0));
+    dark = vcltq_f32(lightcos, vdupq_n_f32(0.0f));
+    light = vbslq_s32(dark, light, ambient);
+
+    zi = D_ReciprocalNEON(out[2]);
+    flags = vld1q_s32(rows[6]);
+    if (!aux) {
+	vst1q_s32(rows[5], vcvtq_s32_f32(zi));
+	u = vcvtq_s32_f32(vaddq_f32(vmulq_f32(out[0], zi),
+				    vdupq_n_f32(xform->xcenter)));
+	v = vcvtq_s32_f32(vaddq_f32(vmulq_f32(out[1], zi),
+				    vdupq_n_f32(xform->ycenter)));
+    } else {
+	uint32x4_t clip;
+
+	vst1q_s32(rows[5], vcvtq_s32_f32(vmulq_n_f32(zi, xform->ziscale)));
+	u = vcvtq_s32_f32(vaddq_f32(
+	    vmulq_f32(vmulq_n_f32(out[0], xform->xscale), zi),
+	    vdupq_n_f32(xform->xcenter)));
+	v = vcvtq_s32_f32(vaddq_f32(
+	    vmulq_f32(vmulq_n_f32(out[1], xform->yscale), zi),
+	    vdupq_n_f32(xform->ycenter)));
+
+	clip = vandq_u32(vcltq_s32(u, vdupq_n_s32(xform->vrect[0])),
+			 vdupq_n_u32(ALIAS_LEFT_CLIP));
+	clip = vorrq_u32(clip, vandq_u32(
+	    vcltq_s32(v, vdupq_n_s32(xform->vrect[1])),
+	    vdupq_n_u32(ALIAS_TOP_CLIP)));
+	clip = vorrq_u32(clip, vandq_u32(
+	    vcgtq_s32(u, vdupq_n_s32(xform->vrect[2])),
+	    vdupq_n_u32(ALIAS_RIGHT_CLIP)));
+	clip = vorrq_u32(clip, vandq_u32(
+	    vcgtq_s32(v, vdupq_n_s32(xform->vrect[3])),
+	    vdupq_n_u32(ALIAS_BOTTOM_CLIP)));
+	clip = vbslq_u32(vcltq_f32(out[2], vdupq_n_f32(xform->zclip)),
+			 vdupq_n_u32(ALIAS_Z_CLIP), clip);
+	flags = vorrq_s32(flags, vreinterpretq_s32_u32(clip));
+
+	vst1q_f32(outvals[0], out[0]);
+	vst1q_f32(outvals[1], out[1]);
+	vst1q_f32(outvals[2], out[2]);
+	for (i = 0; i < 4; i++) {
+	    aux[i][0] = outvals[0][i];
+	    aux[i][1] = outvals[1][i];
+	    aux[i][2] = outvals[2][i];
+	}
+    }
+
+    vst1q_s32(rows[0], u);
+    vst1q_s32(rows[1], v);
+    vst1q_s32(rows[4], light);
+    vst1q_s32(rows[6], flags);
+    for (i = 0; i < 4; i++) {
+	for (j = 0; j < 6; j++)
+	    fv[i].v[j] = rows[j][i];
+	fv[i].flags = rows[6][i];
+    }
+}
+
+static void
+D_AliasVertsNEON(const daliasxform_t *xform, const trivertx_t *verts,
+		 const stvert_t *stverts, finalvert_t *fv, float (*aux)[3],
+		 int numverts)
+{
+    D_AliasVertBatches(D_AliasVerts4NEON, 4, xform, verts, stverts, fv, aux,
+		       numverts);
+}
+
+/* the same as D_BlendPosesSSE2(), with widening multiplies */
+static void
+D_BlendPosesNEON(trivertx_t *out, const trivertx_t *pose0,
+		 const trivertx_t *pose1, const trivertx_t *normals,
+		 int blend0, int blend1, int numverts)
+{
+    const uint8x16_t indexbyte = vreinterpretq_u8_u32(vdupq_n_u32(0xFF000000));
+    uint16x8_t a16[2], b16[2];
+    uint16x4_t r16[4];
+    uint32x4_t r;
+    uint8x16_t a, b;
+    int i, j;
+
+    for (i = 0; i + 4 <= numverts; i += 4) {
+	a = vld1q_u8((const uint8_t *)(pose0 + i));
+	b = vld1q_u8((const uint8_t *)(pose1 + i));
+	a16[0] = vmovl_u8(vget_low_u8(a));
+	a16[1] = vmovl_u8(vget_high_u8(a));
+	b16[0] = vmovl_u8(vget_low_u8(b));
+	b16[1] = vmovl_u8(vget_high_u8(b));
+	for (j = 0; j < 4; j++) {
+	    uint16x4_t a4 = (j & 1) ? vget_high_u16(a16[j >> 1])
+				    : vget_low_u16(a16[j >> 1]);
+	    uint16x4_t b4 = (j & 1) ? vget_high_u16(b16[j >> 1])
+				    : vget_low_u16(b16[j >> 1]);
+	    r = vmulq_n_u32(vmovl_u16(a4), blend0);
+	    r = vmlaq_n_u32(r, vmovl_u16(b4), blend1);
+	    r16[j] = vmovn_u32(vshrq_n_u32(r, D_POSEBLEND_SHIFT));
+	}
+	a = vcombine_u8(vmovn_u16(vcombine_u16(r16[0], r16[1])),
+			vmovn_u16(vcombine_u16(r16[2], r16[3])));
+	a = vbslq_u8(indexbyte, vld1q_u8((const uint8_t *)(normals + i)), a);
+	vst1q_u8((uint8_t *)(out + i), a);
+    }
+    D_BlendPosesTail(out + i, pose0 + i, pose1 + i, normals + i, blend0,
+		     blend1, numverts - i);
+}
+
+static const dsimdkernels_t d_neonkernels = {
+    "NEON",
+    D_SpanPixelsNEON,
+    D_ZSpanNEON,
+    D_PolysetPixelsNEON,
+    D_SurfaceBlockNEON,
+    D_AliasVertsNEON,
+    D_BlendPosesNEON,
+    D_Palette32Unrolled,
+};
+
+#endif /* D_SIMD_NEON */
+
+#endif /* D_SIMD_X86 || D_SIMD_NEON */
+
+/*
+===============
+D_SIMDKernels
+
+The best kernels for this cpu, or NULL for the plain C loops
+===============
+*/
+const dsimdkernels_t *
+D_SIMDKernels(void)
+{
+#if defined(D_SIMD_X86)
+    if (__builtin_cpu_supports("avx2"))
+	return &d_avx2kernels;
+    return &d_sse2kernels;
+#elif defined(D_SIMD_NEON)
+    return &d_neonkernels;
+#else
+    return NULL;
+#endif
+}
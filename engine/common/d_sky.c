@@ -35,16 +35,28 @@ D_Sky_uv_To_st
 static void
 D_Sky_uv_To_st(int u, int v, fixed16_t *s, fixed16_t *t)
 {
-    float wu, wv, temp;
+    float wu, wv, temp, cu, cv;
     vec3_t end;
 
-    if (r_refdef.vrect.width >= r_refdef.vrect.height)
+    cu = (float)((int)vid.width >> 1);
+    cv = (float)((int)vid.height >> 1);
+
+    /*
+     * fisheye plates are square and smaller than the screen, and vrect may
+     * be scissored to part of one, so go by the projection instead
+     */
+    extern qboolean fisheye_enabled;
+    if (fisheye_enabled) {
+	temp = xscale * r_refdef.horizontalFieldOfView;
+	cu = xcenter;
+	cv = ycenter;
+    } else if (r_refdef.vrect.width >= r_refdef.vrect.height)
 	temp = (float)r_refdef.vrect.width;
     else
 	temp = (float)r_refdef.vrect.height;
 
-    wu = 8192.0 * (float)(u - ((int)vid.width >> 1)) / temp;
-    wv = 8192.0 * (float)(((int)vid.height >> 1) - v) / temp;
+    wu = 8192.0 * ((float)u - cu) / temp;
+    wv = 8192.0 * (cv - (float)v) / temp;
 
     end[0] = 4096 * vpn[0] + wu * vright[0] + wv * vup[0];
     end[1] = 4096 * vpn[1] + wu * vright[1] + wv * vup[1];
@@ -130,3 +142,20 @@ D_DrawSkyScans8(espan_t *pspan)
 
     } while ((pspan = pspan->pnext) != NULL);
 }
+
+
+/*
+=================
+D_DrawSkyMask
+
+Marks the sky spans of a fisheye plate in a mask laid out like the plate,
+for the lens to draw the sky from its own rays instead
+=================
+*/
+void
+D_DrawSkyMask(espan_t *pspan, byte *mask)
+{
+    do {
+	memset(mask + screenwidth * pspan->v + pspan->u, 1, pspan->count);
+    } while ((pspan = pspan->pnext) != NULL);
+}
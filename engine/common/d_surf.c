@@ -20,8 +20,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 /* rasterization driver surface heap manager */
 
+#include <limits.h>
 #include <stdint.h>
 
+#include "client.h"
 #include "console.h"
 #include "d_local.h"
 #include "quakedef.h"
@@ -37,6 +39,13 @@ qboolean r_cache_thrash;	// set if surface cache is thrashing
 
 int sc_size;
 surfcache_t *sc_rover, *sc_base;
+unsigned sc_allocated;		// bytes the rover has handed out (wraps)
+
+static void *sc_vidbuffer;	// the cache given to D_InitCaches
+static int sc_vidsize;
+
+int c_surfhits;			// surfaces found in the cache
+int c_surfevicted;		// surfaces thrown out to make room
 
 #define GUARDSIZE       4
 
@@ -91,12 +100,9 @@ D_InitCaches
 
 ================
 */
-void
-D_InitCaches(void *buffer, int size)
+static void
+D_SetupCache(void *buffer, int size)
 {
-    if (!msg_suppress_1)
-	Con_Printf("%ik surface cache\n", size / 1024);
-
     sc_size = size - GUARDSIZE;
     sc_base = (surfcache_t *)buffer;
     sc_rover = sc_base;
@@ -108,6 +114,39 @@ D_InitCaches(void *buffer, int size)
     D_ClearCacheGuard();
 }
 
+void
+D_InitCaches(void *buffer, int size)
+{
+    if (!msg_suppress_1)
+	Con_Printf("%ik surface cache\n", size / 1024);
+
+    sc_vidbuffer = buffer;
+    sc_vidsize = size;
+    D_SetupCache(buffer, size);
+}
+
+/*
+================
+D_SetCache
+
+Switch to another surface cache, for views needing more than the video
+mode's (NULL = back to the one given to D_InitCaches)
+================
+*/
+void
+D_SetCache(void *buffer, int size)
+{
+    if (!buffer) {
+	buffer = sc_vidbuffer;
+	size = sc_vidsize;
+    }
+    if (!buffer || ((void *)sc_base == buffer && sc_size == size - GUARDSIZE))
+	return;
+
+    D_FlushCaches();
+    D_SetupCache(buffer, size);
+}
+
 
 /*
 ==================
@@ -166,16 +205,20 @@ D_SCAlloc(int width, int size)
     }
 // colect and free surfcache_t blocks until the rover block is large enough
     new = sc_rover;
-    if (sc_rover->owner)
+    if (sc_rover->owner) {
 	*sc_rover->owner = NULL;
+	c_surfevicted++;
+    }
 
     while (new->size < size) {
 	// free another
 	sc_rover = sc_rover->next;
 	if (!sc_rover)
 	    Sys_Error("%s: hit the end of memory", __func__);
-	if (sc_rover->owner)
+	if (sc_rover->owner) {
 	    *sc_rover->owner = NULL;
+	    c_surfevicted++;
+	}
 
 	new->size += sc_rover->size;
 	new->next = sc_rover->next;
@@ -193,6 +236,7 @@ D_SCAlloc(int width, int size)
     } else
 	sc_rover = new->next;
 
+    sc_allocated += new->size;
     new->width = width;
 // DEBUG
     if (width > 0)
@@ -227,6 +271,8 @@ D_SCDump(void)
 	    Sys_Printf("ROVER:\n");
 	printf("%p : %i bytes     %i width\n", test, test->size, test->width);
     }
+    printf("%i hits, %i built, %i evicted\n", c_surfhits, c_surf,
+	   c_surfevicted);
 }
 
 //=============================================================================
@@ -261,6 +307,43 @@ D_log2(int num)
 
 //=============================================================================
 
+static surfdlight_t d_dlights[MAX_DLIGHTS];
+static unsigned d_dlightkey;
+static int d_dlightrect[4];
+
+/*
+================
+D_SurfaceDlights
+
+The dynamic lights that reach the surface this frame, with their key and
+the lightmap samples they cover between them
+================
+*/
+static void
+D_SurfaceDlights(const msurface_t *surface)
+{
+    const surfdlight_t *light;
+    int i;
+
+    r_drawsurf.dlights = d_dlights;
+    r_drawsurf.numdlights = 0;
+    d_dlightkey = 0;
+    d_dlightrect[0] = d_dlightrect[1] = INT_MAX;
+    d_dlightrect[2] = d_dlightrect[3] = -1;
+
+    if (surface->dlightframe != r_dlightframecount)
+	return;
+
+    r_drawsurf.numdlights = R_SurfaceDlights(surface, d_dlights, &d_dlightkey);
+    for (i = 0; i < r_drawsurf.numdlights; i++) {
+	light = &d_dlights[i];
+	d_dlightrect[0] = qmin(d_dlightrect[0], light->smin);
+	d_dlightrect[1] = qmin(d_dlightrect[1], light->tmin);
+	d_dlightrect[2] = qmax(d_dlightrect[2], light->smax);
+	d_dlightrect[3] = qmax(d_dlightrect[3], light->tmax);
+    }
+}
+
 /*
 ================
 D_CacheSurface
@@ -285,13 +368,41 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
 //
     cache = surface->cachespots[miplevel];
 
-    if (cache && !cache->dlight && surface->dlightframe != r_framecount
-	&& cache->texture == r_drawsurf.texture
+    /*
+     * Views of a shared scene all see the same dynamic lights, so a
+     * surface lit for one of them is good for the rest.
+     */
+    if (cache && cache->texture == r_drawsurf.texture
 	&& cache->lightadj[0] == r_drawsurf.lightadj[0]
 	&& cache->lightadj[1] == r_drawsurf.lightadj[1]
 	&& cache->lightadj[2] == r_drawsurf.lightadj[2]
-	&& cache->lightadj[3] == r_drawsurf.lightadj[3])
-	return cache;
+	&& cache->lightadj[3] == r_drawsurf.lightadj[3]) {
+	if (r_sharedscene && cache->dlightframe == r_dlightframecount) {
+	    c_surfhits++;
+	    return cache;
+	}
+	D_SurfaceDlights(surface);
+	cache->dlightframe = r_dlightframecount;
+	if (d_dlightkey == cache->dlightkey) {
+	    c_surfhits++;
+	    return cache;
+	}
+
+	/*
+	 * Only the dynamic lights changed, so just redraw where they were
+	 * and where they are now.
+	 */
+	r_drawsurf.lightrect[0] = qmin(cache->dlightrect[0], d_dlightrect[0]);
+	r_drawsurf.lightrect[1] = qmin(cache->dlightrect[1], d_dlightrect[1]);
+	r_drawsurf.lightrect[2] = qmax(cache->dlightrect[2], d_dlightrect[2]);
+	r_drawsurf.lightrect[3] = qmax(cache->dlightrect[3], d_dlightrect[3]);
+    } else {
+	D_SurfaceDlights(surface);
+	r_drawsurf.lightrect[0] = 0;
+	r_drawsurf.lightrect[1] = 0;
+	r_drawsurf.lightrect[2] = surface->extents[0] >> 4;
+	r_drawsurf.lightrect[3] = surface->extents[1] >> 4;
+    }
 
 //
 // determine shape of surface
@@ -314,10 +425,12 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
 	cache->mipscale = surfscale;
     }
 
-    if (surface->dlightframe == r_framecount)
-	cache->dlight = 1;
-    else
-	cache->dlight = 0;
+    cache->dlightkey = d_dlightkey;
+    cache->dlightrect[0] = d_dlightrect[0];
+    cache->dlightrect[1] = d_dlightrect[1];
+    cache->dlightrect[2] = d_dlightrect[2];
+    cache->dlightrect[3] = d_dlightrect[3];
+    cache->dlightframe = r_dlightframecount;
 
     r_drawsurf.surfdat = (pixel_t *)cache->data;
 
@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "mathlib.h"
 #include "quakedef.h"
+#include "r_shared.h"
 #include "vid.h"
 
 // all global and static refresh variables are collected in a contiguous block
@@ -35,14 +36,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // FIXME: make into one big structure, like cl or sv
 // FIXME: do separately for refresh engine and driver
 
-float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+D_THREADVAR float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+D_THREADVAR float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+D_THREADVAR float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-fixed16_t sadjust, tadjust, bbextents, bbextentt;
+D_THREADVAR fixed16_t sadjust, tadjust, bbextents, bbextentt;
 
-pixel_t *cacheblock;
-int cachewidth;
+D_THREADVAR pixel_t *cacheblock;
+D_THREADVAR int cachewidth;
 pixel_t *d_viewbuffer;
 short *d_pzbuffer;
 unsigned int d_zrowbytes;
@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // vid buffer
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "console.h"
@@ -691,6 +693,99 @@ Draw_ConbackString(const qpic8_t *conback, byte *pixels, const char *str)
 }
 
 
+/*
+ * The console background is scaled to the console size once, and each line
+ * of console text is kept drawn over its strip of the background, so while
+ * the console is down its lines are just copied to the screen.  As the
+ * console slides, its background and text move together, so the strip
+ * under a line doesn't change.  A line is drawn again when its text does.
+ */
+typedef struct {
+    int row;			// of the scaled background, -1 if unused
+    int generation;
+    int length;
+    char *text;
+    byte *pixels;
+} constrip_t;
+
+static struct {
+    const byte *source;		// the conback pixels it was scaled from
+    int width, height;
+    byte *pixels;
+    int generation;		// bumped each time it's scaled
+    int lines;			// of the console being drawn
+    int textlength;		// the most characters a strip holds
+    int numstrips;
+    constrip_t *strips;
+} draw_con;
+
+static void
+Draw_ScaleConback(const qpic8_t *conback)
+{
+    const int width = vid.conwidth;
+    const int height = vid.conheight;
+    const byte *src;
+    byte *dest, *strip;
+    int x, y, i, f, fstep;
+
+    if (draw_con.pixels && draw_con.source == conback->pixels
+	&& draw_con.width == width && draw_con.height == height)
+	return;
+
+    free(draw_con.pixels);
+    free(draw_con.strips);
+    draw_con.source = conback->pixels;
+    draw_con.width = width;
+    draw_con.height = height;
+    draw_con.generation++;
+    draw_con.textlength = width / CHAR_WIDTH;
+    draw_con.numstrips = height / CHAR_HEIGHT + 1;
+    draw_con.pixels = malloc(width * height);
+    draw_con.strips = malloc(draw_con.numstrips * (sizeof(constrip_t)
+		+ draw_con.textlength + width * CHAR_HEIGHT));
+    if (!draw_con.pixels || !draw_con.strips)
+	Sys_Error("%s: out of memory", __func__);
+
+    strip = (byte *)(draw_con.strips + draw_con.numstrips);
+    for (i = 0; i < draw_con.numstrips; i++) {
+	draw_con.strips[i].row = -1;
+	draw_con.strips[i].text = (char *)strip;
+	strip += draw_con.textlength;
+	draw_con.strips[i].pixels = strip;
+	strip += width * CHAR_HEIGHT;
+    }
+
+    fstep = conback->width * 0x10000 / width;
+    for (y = 0, dest = draw_con.pixels; y < height; y++, dest += width) {
+	src = conback->pixels + y * conback->height / height * conback->width;
+	for (x = 0, f = 0; x < width; x++, f += fstep)
+	    dest[x] = src[f >> 16];
+    }
+}
+
+/* Copies rows of the scaled background or a strip to the screen */
+static void
+Draw_ConsoleRows(const byte *src, int y, int rows)
+{
+    const int width = draw_con.width;
+    int x;
+
+    if (r_pixbytes == 1) {
+	byte *dest = vid.conbuffer + y * vid.conrowbytes;
+
+	for (; rows > 0; rows--, src += width, dest += vid.conrowbytes)
+	    memcpy(dest, src, width);
+    } else {
+	uint16_t *pusdest = (uint16_t *)(vid.conbuffer + y * vid.conrowbytes);
+
+	for (; rows > 0; rows--, src += width) {
+	    for (x = 0; x < width; x++)
+		pusdest[x] = d_8to16table[src[x]];
+	    pusdest += vid.conrowbytes / 2;
+	}
+    }
+}
+
 /*
 ================
 Draw_ConsoleBackground
@@ -700,59 +795,70 @@ Draw_ConsoleBackground
 void
 Draw_ConsoleBackground(int lines)
 {
-    const qpic8_t *conback;
-    const byte *src;
-    int x, y, v;
-    int f, fstep;
+    Draw_ScaleConback(Draw_CacheConback());
+    draw_con.lines = lines;
 
-    conback = Draw_CacheConback();
+    Draw_ConsoleRows(draw_con.pixels
+		     + (vid.conheight - lines) * draw_con.width, 0, lines);
+}
 
-    /* draw the pic */
-    if (r_pixbytes == 1) {
-	byte *dest = vid.conbuffer;
-
-	for (y = 0; y < lines; y++, dest += vid.conrowbytes) {
-	    v = (vid.conheight - lines + y) * conback->height / vid.conheight;
-	    src = conback->pixels + v * conback->width;
-	    if (vid.conwidth == conback->width)
-		memcpy(dest, src, vid.conwidth);
-	    else {
-		f = 0;
-		fstep = conback->width * 0x10000 / vid.conwidth;
-		for (x = 0; x < vid.conwidth; x += 4) {
-		    dest[x] = src[f >> 16];
-		    f += fstep;
-		    dest[x + 1] = src[f >> 16];
-		    f += fstep;
-		    dest[x + 2] = src[f >> 16];
-		    f += fstep;
-		    dest[x + 3] = src[f >> 16];
-		    f += fstep;
-		}
-	    }
-	}
-    } else {
-	uint16_t *pusdest = (uint16_t *)vid.conbuffer;
-
-	for (y = 0; y < lines; y++, pusdest += vid.conrowbytes / 2) {
-	    // FIXME: pre-expand to native format?
-	    // FIXME: does the endian switching go away in production?
-	    v = (vid.conheight - lines + y) * conback->height / vid.conheight;
-	    src = conback->pixels + v * conback->width;
-	    f = 0;
-	    fstep = conback->width * 0x10000 / vid.conwidth;
-	    for (x = 0; x < vid.conwidth; x += 4) {
-		pusdest[x] = d_8to16table[src[f >> 16]];
-		f += fstep;
-		pusdest[x + 1] = d_8to16table[src[f >> 16]];
-		f += fstep;
-		pusdest[x + 2] = d_8to16table[src[f >> 16]];
-		f += fstep;
-		pusdest[x + 3] = d_8to16table[src[f >> 16]];
-		f += fstep;
-	    }
+static void
+Draw_ConsoleStrip(constrip_t *strip, const char *text, int length)
+{
+    const byte *source;
+    byte *dest;
+    int i, x, y, num;
+
+    memcpy(strip->pixels, draw_con.pixels + strip->row * draw_con.width,
+	   draw_con.width * CHAR_HEIGHT);
+    for (i = 0; i < length; i++) {
+	num = (byte)text[i];
+	source = draw_chars + ((num >> 4) << 10) + ((num & 15) << 3);
+	dest = strip->pixels + (i + 1) * CHAR_WIDTH;
+	for (y = 0; y < CHAR_HEIGHT; y++) {
+	    for (x = 0; x < CHAR_WIDTH; x++)
+		if (source[x])
+		    dest[x] = source[x];
+	    source += 128;
+	    dest += draw_con.width;
 	}
     }
+    memcpy(strip->text, text, length);
+    strip->length = length;
+    strip->generation = draw_con.generation;
+}
+
+/*
+================
+Draw_ConsoleLine
+
+Draws a line of console text, one character in from the left, over the
+background drawn by the last Draw_ConsoleBackground
+================
+*/
+void
+Draw_ConsoleLine(int y, const char *text, int length)
+{
+    constrip_t *strip;
+    int row, x;
+
+    row = vid.conheight - draw_con.lines + y;
+    if (y < 0 || y > vid.height - CHAR_HEIGHT || row < 0
+	|| row > draw_con.height - CHAR_HEIGHT
+	|| length >= draw_con.textlength) {
+	/* clipped, so draw it the slow way */
+	for (x = 0; x < length; x++)
+	    Draw_Character((x + 1) << 3, y, text[x]);
+	return;
+    }
+
+    strip = &draw_con.strips[row / CHAR_HEIGHT];
+    if (strip->row != row || strip->generation != draw_con.generation
+	|| strip->length != length || memcmp(strip->text, text, length)) {
+	strip->row = row;
+	Draw_ConsoleStrip(strip, text, length);
+    }
+    Draw_ConsoleRows(strip->pixels, y, CHAR_HEIGHT);
 }
 
 
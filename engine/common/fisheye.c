@@ -0,0 +1,11275 @@
+/*
+
+FISHEYE.C
+=========
+
+   This is a fisheye addon based on Fisheye Quake.  It renders up to 6 camera views
+   per frame, and melds them together to allow a Field of View (FoV) greater than 180 degrees:
+
+             ---------
+             |       |
+             | UP    |                          -----------------------------
+             |       |                          |\--         UP          --/|
+             ---------                          |   \---             ---/   |
+   --------- --------- --------- ---------      |       \-----------/       |
+   |       | |       | |       | |       |      |        |         |        |
+   | LEFT  | | FRONT | | RIGHT | | BACK  | ---> |  LEFT  |  FRONT  | RIGHT  |
+   |       | |       | |       | |       |      |        |         |        |
+   --------- --------- --------- ---------      |       /-----------\       |
+          ^  ---------                          |   /---             ---\   |
+          |  |       |                          |/--        DOWN         --\|
+         90º | DOWN  |                          -----------------------------
+          |  |       |                          <---------- +180º ---------->
+          v  ---------
+             <--90º-->
+
+         (a GLOBE controls the separate             (a LENS controls how the
+          camera views to render)                  views are melded together)
+
+
+   To enable this fisheye rendering, enter the command:
+   ```
+   ] fisheye 1
+   ```
+
+   To resume the standard view, enter the command:
+   ```
+   ] fisheye 0
+   ```
+
+GLOBES
+------
+
+   The multiple camera views are controlled by a "globe" script.  It contains a
+   "plates" array, with each element containing a single camera's forward vector,
+   up vector, and fov. Together, the plates should form a complete globe around
+   the player.
+
+   Coordinate System:
+      
+               +Y = up
+                  ^
+                  |
+                  |
+                  |    / +Z = forward
+                  |   /
+                  |  /
+                  | /
+                  0------------------> +X = right
+
+   NOTE: Plate coordinates are relative to the camera's frame.  They are NOT absolute coordinates.
+
+   For example, this is the default globe (globes/cube.lua):
+
+   ```
+   plates = {
+      { { 0, 0, 1 }, { 0, 1, 0 }, 90 }, -- front
+      { { 1, 0, 0 }, { 0, 1, 0 }, 90 }, -- right
+      { { -1, 0, 0 }, { 0, 1, 0 }, 90 }, -- left
+      { { 0, 0, -1 }, { 0, 1, 0 }, 90 }, -- back
+      { { 0, 1, 0 }, { 0, 0, -1 }, 90 }, -- top
+      { { 0, -1, 0 }, { 0, 0, 1 }, 90 } -- bottom
+   }
+   ```
+             ---------
+             |       |
+             | UP    |
+             |       |
+             ---------
+   --------- --------- --------- ---------
+   |       | |       | |       | |       |
+   | LEFT  | | FRONT | | RIGHT | | BACK  |
+   |       | |       | |       | |       |
+   --------- --------- --------- ---------
+          ^  ---------
+          |  |       |
+         90º | DOWN  |
+          |  |       |
+          v  ---------
+             <--90º-->
+
+   To use this globe, enter the command:
+
+   ```
+   ] f_globe cube
+   ```
+
+   There are other included globes:
+
+   - trism: a triangular prism with 5 views
+   - tetra: a tetrahedron with 4 views
+   - fast:  2 overlaid views in the same direction (90 and 160 degrees)
+
+LENSES
+------
+
+   The camera views are melded together by a "lens" script.
+   This is done with either a "forward" or "inverse" mapping.
+
+             ---------
+             |       |
+             |       |                              -----------------------------
+             |       |                              |\--                     --/|
+             ---------                      FORWARD |   \---             ---/   |
+   --------- --------- --------- ---------  ------> |       \-----------/       |
+   |       | |       | |       | |       |          |        |         |        |
+   |       | |       | |       | |       |          |        |         |        |
+   |       | |       | |       | |       |          |        |         |        |
+   --------- --------- --------- ---------  <------ |       /-----------\       |
+             ---------                      INVERSE |   /---             ---\   |
+             |       |                              |/--                     --\|
+             |       |                              -----------------------------
+             |       |
+             ---------
+
+   A "FORWARD" mapping does GLOBE -> LENS.
+   An "INVERSE" mapping does LENS -> GLOBE (this is faster!).
+
+   GLOBE COORDINATES:
+
+      (you can use any of the following coord systems to get a globe pixel):
+
+      - direction vector
+
+               +Y = up
+                  ^
+                  |
+                  |
+                  |    / +Z = forward
+                  |   /
+                  |  /
+                  | /
+                  0------------------> +X = right
+
+      - latitude/longitude (spherical degrees)
+
+               +latitude (degrees up)
+                  ^
+                  |
+                  |
+                  |
+                  |
+                  |
+                  |
+                  0------------------> +longitude (degrees right)
+
+      - plate index & uv (e.g. plate=1, u=0.5, v=0.5 to get the center pixel of plate 1)
+
+                  0----------> +u (max 1)
+                  | ---------
+                  | |       |
+                  | |       |
+                  | |       |
+                  | ---------
+                  V
+                  +v (max 1)
+
+   LENS COORDINATES:
+
+                 +Y
+                  ^
+                  |
+                  |
+                  |
+                  |
+                  |
+                  |
+                  0----------------> +X
+
+ZOOMING
+-------
+
+   To control how much of the resulting lens image we can see on screen,
+   we scale it such that the screen aligns with certain points on the lens' axes.
+
+   For example, suppose we have a LENS image below.
+   The (X) corresponds to the point at longitude=(FOV/2)º latitude=0º.
+   We flush the screen edge to this point to achieve the desired FOV zoom.
+
+   -------------------------------------------------------------------------
+   | LENS IMAGE                        ^                                   |
+   |                                   |                                   |
+   |                                   |                                   |
+   |                 ------------------|-------------------                |
+   |                 | SCREEN          |                  |                |
+   |                 | (90º FOV)       |                  |                |
+   |                 |                 |                  |                |
+   |                 |                 0------------------X--------------> |
+   |                 |                                    |\               |
+   |                 |                                    | \              |
+   |                 |                                    |  \ point at    |
+   |                 --------------------------------------    lon = 45º   |
+   |                                                           lat = 0º    |
+   |                                                                       |
+   |                                                                       |
+   -------------------------------------------------------------------------
+
+   The process is similar when we want a vertical FOV:
+
+   -------------------------------------------------------------------------
+   | LENS IMAGE                        ^                                   |
+   |                                   |                                   |
+   |                                   |                                   |
+   |                 ------------------X-------------------                |
+   |                 | SCREEN          |\   point at      |                |
+   |                 | (90º vertical)  | \  lon = 0º      |                |
+   |                 |                 |    lat = 45º     |                |
+   |                 |                 0---------------------------------> |
+   |                 |                                    |                |
+   |                 |                                    |                |
+   |                 |                                    |                |
+   |                 --------------------------------------                |
+   |                                                                       |
+   |                                                                       |
+   |                                                                       |
+   -------------------------------------------------------------------------
+
+   We can also zoom the lens image such that its BOUNDARIES are flush with the screen.
+
+
+LUA DETAILS
+-----------
+   
+   Variables/Functions you provide:
+
+      Globe:
+      - plates (array of [forward, up, fov, vfov] objects, vfov is optional
+        and makes the plate a rectangle instead of a square)
+      - globe_plate (function (x,y,z) -> index)
+
+      Lens:
+
+         MAPPING FUNCTIONS
+         - lens_forward (function (x,y,z) -> (x,y))
+         - lens_inverse (function (x,y) -> (x,y,z))
+         - lens_inverse_row (optional function (y,x0,dx,n) -> (xs,ys,zs))
+         - lens_forward_many (optional function (xs,ys,zs,n) -> (xs,ys))
+           (built with USE_LUAJIT, lenses without lens_inverse_row have their
+            lens_inverse looped over a row in Lua and the rays written
+            through the FFI, so there's less reason to write one)
+
+         BOUNDARIES
+         - lens_width (double)
+         - lens_height (double)
+         - max_fov (int)
+         - max_vfov (int)
+
+         OUTLINE (optional, for lenses whose image does not fill the screen,
+         so that only the pixels inside it are evaluated)
+         - lens_outline (function (y) -> halfwidth, or nil if the image
+           misses that row, for an image centered on x = 0)
+         - outline (string, "search" to find where each row enters and
+           leaves the image with lens_inverse, for an image that each row
+           crosses once, through x = 0)
+
+         (optional command to be called when lens is loaded)
+         - onload (string)
+
+   Variables/Functions provided to you:
+   
+      - numplates (int)
+      - latlon_to_ray (function (lat,lon) -> (x,y,z))
+      - ray_to_latlon (function (x,y,z) -> (lat,lon))
+      - plate_to_ray (function (i,u,v) -> (x,y,z))
+
+*/
+
+#include "bspfile.h"
+#include "client.h"
+#include "cmd.h"
+#include "console.h"
+#include "cvar.h"
+#include "draw.h"
+#include "fisheye.h"
+#include "imgwrite.h"
+#include "input.h"
+#include "keys.h"
+#include "mathlib.h"
+#include "palette.h"
+#include "quakedef.h"
+#include "screen.h"
+#include "sys.h"
+#include "trace.h"
+#include "view.h"
+
+#ifdef NQ_HACK
+#include "host.h"
+#endif
+
+#ifdef GLQUAKE
+#include "glquake.h"
+#else
+#include "d_local.h"
+#include "r_local.h"
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+// Built with USE_LUAJIT, the scripts run on LuaJIT, which has the Lua 5.1
+// C API.  These are the few 5.2 calls used here, spelled the 5.1 way.
+#if LUA_VERSION_NUM < 502
+#define lua_pushglobaltable(L) lua_pushvalue(L, LUA_GLOBALSINDEX)
+#define lua_rawlen(L, i) lua_objlen(L, i)
+#endif
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// AVX2 gathers are picked at runtime, so the rest of the file is built as usual
+#if defined(__GNUC__) && defined(__x86_64__)
+#define FISHEYE_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                             VARIABLES                                        |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// This is a globally accessible variable that determines if these fisheye features
+// should be on.  It is used by other files for modifying behaviors that fisheye 
+// depends on (e.g. square refdef, disabling water warp, hooking renderer).
+qboolean fisheye_enabled;
+
+// True while f_capture plays a demo, which runs frames as fast as they can be
+// drawn and holds the demo for lenses to build (see Host_FilterTime).
+qboolean fisheye_capturing;
+
+qboolean shortcutkeys_enabled;
+
+// This is a globally accessible variable that is used to set the fov of each
+// camera view that we render.
+double fisheye_plate_fov;
+
+// The part of the plate being rendered that the lens actually reads (NULL =
+// all of it).  The renderer clips to it without changing the projection.
+vrect_t *fisheye_plate_scissor;
+
+// The size of the plate being rendered (0 = as large as the screen allows),
+// and its height if it is not square (0 = square).
+int fisheye_plate_size;
+int fisheye_plate_height;
+
+// How much sooner the plate being rendered drops to smaller texture mips
+// (scales d_mipscale), for plates that the lens shrinks on screen.
+float fisheye_plate_mipscale = 1;
+
+// The globe pixels that the plate is being rendered straight into (see
+// render_plate), so that plates do not have to fit on the screen.
+byte *fisheye_plate_target;
+
+// Where the sky spans of the plate being rendered are marked instead of
+// drawn, and whether there were any (see lens_sky).
+byte *fisheye_sky_mask;
+qboolean fisheye_sky_drawn;
+
+// a plate corner mapped to the screen by a forward lens, in pixels
+typedef struct {
+   double x, y;
+   qboolean valid; // (false if the lens does not show it)
+   int owner;      // the plate whose part of the globe it is in
+} lens_point_t;
+
+// Lens computation is slow, so we don't want to block the game while its busy.
+// Normally it is spread over worker threads (see lens_workers below).  Without
+// threads (f_threads 0), we are just limiting the time that the lens builder
+// can work each frame.  It keeps track of its work between frames so it can
+// resume without problems.  Its slice of the frame is what the rest of the
+// frame leaves of the target frame time (f_buildbudget, in frames per second).
+// The last finished lensmap stays on screen until
+// the new one is done (see lens_front), unless f_lensswap is 0, which allows
+// the user to watch the lens pixels become visible as they are calculated.
+static struct _lens_builder
+{
+   qboolean working;
+   qboolean failed;
+   double start_time;
+   double seconds_per_frame;
+
+   // when the last frame began, the builder's time in it, and the smoothed
+   // time of the rest of the frame
+   double frame_time;
+   double build_time;
+   double other_time;
+
+   // keep showing the last finished lensmap while building a new one
+   // (f_lensswap, 0 = show the new lensmap as it is built)
+   qboolean swap;
+
+   // cell size (in pixels) of the coarse grid that the inverse lens is
+   // evaluated on before interpolating (f_lensgrid, 0 or 1 = every pixel)
+   int grid;
+
+   struct _inverse_state
+   {
+      int ly; // row, or band of rows when using a grid (see lens_grid_size)
+   } inverse_state;
+
+   // coarse passes over an inverse lens, shown while there is no finished
+   // lensmap on screen (each evaluates the lens once per step*step block of
+   // pixels and fills the block with it, see resume_lens_preview)
+   struct _preview_state
+   {
+      int step; // (0 = no pass left)
+      int ly;   // next block row of the pass
+      qboolean drawn; // the full build must clear the blocks it does not set
+   } preview_state;
+   struct _forward_state
+   {
+      lens_point_t *top;
+      lens_point_t *bot;
+      int plate_index;
+      int py;
+   } forward_state;
+} lens_builder;
+
+// the Lua state pointer
+// (thread local, since each lens builder worker has its own Lua state)
+static __thread lua_State *lua;
+
+// lua reference indexes (for reference lua functions)
+static __thread struct _lua_refs {
+   int lens_forward;
+   int lens_inverse;
+   int globe_plate;
+
+   // optional batched versions of lens_inverse and lens_forward
+   int lens_inverse_row;
+   int lens_forward_many;
+
+   // lens_inverse over a row through the FFI (LuaJIT only, else -1)
+   int lens_inverse_ffi;
+} lua_refs;
+
+// A lens script may set itself up from the globe's globals while it loads
+// (e.g. "lens_width = numplates" in debug.lua), so it used to be run again
+// whenever the lensmap was rebuilt.  Now the globals it reads while loading,
+// before setting them itself, are noted through a proxy for its globals, and
+// it is only run again when one of their values has changed.
+static struct _lens_inputs {
+
+   #define MAX_LENS_INPUTS 32
+   char names[MAX_LENS_INPUTS][32];
+   int count;
+
+   // more were read than could be noted (the lens is always run again)
+   qboolean overflow;
+
+   // hash of their values after the lens was loaded
+   unsigned hash;
+
+} lens_inputs;
+
+// With f_hotreload, the scripts of the lens and globe in use are checked
+// for changes every so often, and reloaded when their contents have changed
+// (not just their modification times).
+static struct _script_watch {
+
+   qboolean enabled;
+   double next_check;
+   #define SCRIPT_WATCH_INTERVAL 0.5 // seconds
+
+   struct _watched_script {
+      char name[50];   // of the lens or globe when last checked
+      time_t mtime;
+      unsigned hash;
+   } lens, globe;
+
+} script_watch;
+
+
+// A native lens or globe is a C implementation of one of the stock scripts.
+// A script selects one by declaring e.g. native = "panini".  The script still
+// provides its Lua functions (used as the fallback) and its boundaries
+// (max_fov, lens_width, ...), but the per-pixel mapping no longer goes through Lua.
+typedef struct {
+   const char *name;
+   int (*inverse)(double x, double y, vec3_t ray);     // same contract as lens_inverse
+   int (*forward)(vec3_t ray, double *x, double *y);   // same contract as lens_forward
+} native_lens_t;
+
+typedef struct {
+   const char *name;
+   int (*plate)(vec3_t ray, int *plate);               // same contract as globe_plate
+} native_globe_t;
+
+static struct _globe {
+
+   // name of the current globe
+   char name[50];
+
+   // indicates if the current globe is valid
+   qboolean valid;
+
+   // indiciates if the lens has changed and needs updating
+   qboolean changed;
+
+   // the environment map
+   // a large array of pixels that hold all rendered views
+   byte *pixels;  
+   // (allocated with a few spare bytes at the end, since the gather kernels
+   //  read 4 bytes at a time)
+   #define GLOBE_PADDING 4
+   // retrieves the offset of a pixel in the platemap
+   #define GLOBEOFFSET(plate,x,y) ((plate)*(globe.platesize)*(globe.platesize) + (x) + (y)*(globe.platesize))
+   // retrieves a pointer to a pixel in the platemap
+   #define GLOBEPIXEL(plate,x,y) (globe.pixels + GLOBEOFFSET(plate,x,y))
+
+   // depth buffer for rendering a plate (platesize*platesize)
+   short *zbuffer;
+
+   // the depth buffer of every plate, kept for lens_reproject and laid out
+   // like pixels (NULL while reprojection is off)
+   short *depth;
+
+   // 1 for each globe pixel left for the lens to draw sky in, laid out like
+   // pixels (see lens_sky)
+   byte *skymask;
+
+   // globe plates
+   #define MAX_PLATES 6
+   struct _plate {
+      vec3_t forward;
+      vec3_t right;
+      vec3_t up;
+      vec_t fov;
+      vec_t dist;
+      // fov given by the globe (fov may be fitted down to the lens, see fit_plate_fovs)
+      vec_t max_fov;
+      byte palette[256];
+      int display;
+
+      // bounding box of the plate pixels read by the lensmap
+      // (the whole plate until the lensmap is finished)
+      vrect_t scissor;
+
+      // height of the plate over its width, from the globe's vfov
+      // (1 = square; the plate's FOV is across its width)
+      vec_t aspect;
+
+      // size of this plate (at most platesize, see calc_plate_sizes), and
+      // its height in pixels (see set_plate_size)
+      int size;
+      int height;
+   } plates[MAX_PLATES];
+
+   // number of plates used by the current globe
+   int numplates;
+
+   // native globe_plate implementation (NULL = use Lua)
+   const native_globe_t *native;
+
+   // largest size of a rendered square plate
+   // (each plate has platesize*platesize pixels reserved in the globe,
+   //  but may only be using the top left size*size of them)
+   // (plates are rendered straight into the globe, so this is only limited
+   //  by the renderer, not the screen)
+#ifdef GLQUAKE
+   #define MAX_PLATESIZE 2048
+#else
+   #define MAX_PLATESIZE MAXHEIGHT
+#endif
+   int platesize;
+
+   // how plates are sized from the density the lens samples them at
+   // (f_platequality, 0 = all plates are platesize)
+   struct {
+      double scale;
+      int min_size;
+      int max_size; // (0 = the smaller side of the screen)
+
+      // largest mip scale for plates the lens shrinks (f_mipbias, 1 = none)
+      double max_mipscale;
+
+      // narrow each plate to the part of it the lens uses, plus a margin
+      // (f_platefit, in units of the used half-width)
+      qboolean fit;
+      double fit_margin;
+   } quality;
+
+   // true once the plate sizes (and fitted FOVs) have been chosen for the current lens,
+   // and resized when they changed so much that the lensmap must be rebuilt
+   qboolean sized;
+   qboolean resized;
+
+   // "f_globe auto": the globe is chosen from how the lens samples each of
+   // the candidates (see choose_globe)
+   struct {
+      qboolean enabled;
+
+      // fewest plate pixels per lens pixel the chosen globe may sample at
+      double floor;
+
+      // the ray field the choice was made for
+      // (a new lens or zoom changes its key)
+      qboolean chosen;
+      unsigned key;
+   } choice;
+
+   // set when we want to save each globe plate
+   // (make sure they are visible (i.e. current lens is using all plates))
+   struct {
+      qboolean should;
+      int with_margins;
+      char name[32];
+   } save;
+
+} globe;
+
+// A coarse cube map of ray directions that stores the plate owning each cell,
+// so that ray_to_plate_index does not have to search the plates (or call Lua)
+// for every ray.  Cells that a plate boundary passes through are marked, and
+// rays falling in them still get the exact answer.
+#define PLATELUT_SIZE 64
+#define PLATELUT_NONE 254     // no plate sees this cell
+#define PLATELUT_BOUNDARY 255 // plates disagree within this cell
+
+static struct _plate_lut {
+   qboolean ready;
+   byte cells[6][PLATELUT_SIZE][PLATELUT_SIZE];
+} plate_lut;
+
+#ifdef _WIN32
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+#define mutex_init(m)    InitializeCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#define mutex_lock(m)    EnterCriticalSection(m)
+#define mutex_unlock(m)  LeaveCriticalSection(m)
+typedef CONDITION_VARIABLE cond_t;
+#define cond_init(c)      InitializeConditionVariable(c)
+#define cond_destroy(c)
+#define cond_wait(c,m)    SleepConditionVariableCS(c, m, INFINITE)
+#define cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+#define mutex_init(m)    pthread_mutex_init(m, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m)    pthread_mutex_lock(m)
+#define mutex_unlock(m)  pthread_mutex_unlock(m)
+typedef pthread_cond_t cond_t;
+#define cond_init(c)      pthread_cond_init(c, NULL)
+#define cond_destroy(c)   pthread_cond_destroy(c)
+#define cond_wait(c,m)    pthread_cond_wait(c, m)
+#define cond_broadcast(c) pthread_cond_broadcast(c)
+#endif
+
+// The lens builder can also be run on a pool of worker threads (see f_threads).
+// Each worker loads the current lens and globe scripts into its own Lua state,
+// then claims rows (inverse map) or plates (forward map) until none are left.
+// Workers never touch the visible lensmap: inverse rows are written into a
+// staging lensmap, and forward plates record their pixel writes so they can be
+// replayed in plate order.  The main thread publishes the result once every
+// worker is done.
+#define MAX_LENS_WORKERS 16
+
+typedef struct {
+   int index;     // lens pixel index
+   unsigned pixel; // plate pixel offset
+} pixel_write_t;
+
+static struct _lens_workers {
+
+   // number of worker threads to use (0 = build on the main thread)
+   int count;
+
+   // number of workers started for the current build
+   int numthreads;
+
+   qboolean running;
+   volatile qboolean cancel;
+
+   // protects next_task and numdone
+   mutex_t lock;
+   int next_task;
+   int numtasks;
+   int numdone;
+
+   // snapshot of the build settings
+   int map_type;
+   char lens_name[50];
+   char globe_name[50];
+
+   // staging lensmap for inverse maps
+   unsigned *pixels;
+
+   // recorded pixel writes of each plate for forward maps
+   struct {
+      pixel_write_t *writes;
+      int count;
+      int size;
+   } plate_writes[MAX_PLATES];
+
+   struct _lens_worker {
+      thread_t thread;
+      int plate_index;
+      int display[MAX_PLATES];
+      qboolean failed;
+      char error[256];
+   } workers[MAX_LENS_WORKERS];
+
+} lens_workers;
+
+// the worker running on the current thread (NULL on the main thread)
+static __thread struct _lens_worker *lens_worker;
+
+// Drawing the lensmap to the screen is split over a second pool of threads
+// (see f_drawthreads), which stay alive between frames.  Each frame every
+// drawer draws an interleaved slice of the rows, while the main thread draws
+// the first slice, then waits for the rest.  The drawers only read the globe
+// and the lensmap, which do not change until they are done.
+static struct _lens_drawers {
+
+   // number of drawer threads wanted besides the main thread
+   int count;
+
+   // number of drawer threads running
+   int numthreads;
+   qboolean started;
+
+   // protects generation, numdone and quit
+   mutex_t lock;
+   cond_t start;
+   cond_t done;
+   int generation;
+   int numdone;
+   qboolean quit;
+
+   // rows drawn by a slice (first row, every n rows)
+   void (*draw)(int first, int step);
+   double m[3][3]; // view rotation for render_lensmap_latched_rows
+
+   thread_t threads[MAX_LENS_WORKERS];
+
+} lens_drawers;
+
+static struct _lens {
+
+   // boolean signaling if the lens is properly loaded
+   qboolean valid;
+
+   // boolean signaling if the lens has changed and needs updating
+   qboolean changed;
+
+   // name of the current lens
+   char name[50];
+
+   // the type of map projection (inverse/forward)
+   enum { MAP_NONE, MAP_INVERSE, MAP_FORWARD } map_type;
+
+   // native mapping functions (NULL = use Lua)
+   const native_lens_t *native;
+
+   // symmetry declared by the lens script (symmetry = "x", "y", "xy" or "radial"),
+   // so that inverse lenses only have to be evaluated over part of the screen
+   #define SYMMETRY_X      1 // ray(-x,y) is ray(x,y) with its x negated
+   #define SYMMETRY_Y      2 // ray(x,-y) is ray(x,y) with its y negated
+   #define SYMMETRY_RADIAL 4 // the ray angle only depends on the distance from the center
+   int symmetry;
+
+   // outline of the lens image declared by the lens script (see image_spans)
+   enum { OUTLINE_NONE, OUTLINE_FUNCTION, OUTLINE_SEARCH } outline;
+
+   // size of the lens image in its arbitrary units
+   double width, height;
+
+   // controls the zoom of the lens image
+   // (scale = units per pixel)
+   double scale;
+
+   // pixel size of the lens view (it is equal to the screen size below):
+   //    ------------------
+   //    |                |
+   //    |   ---------- ^ |
+   //    |   |        | | |
+   //    |   | screen | h |
+   //    |   |        | | |
+   //    |   ---------- v |
+   //    |   <---w---->   |
+   //    |----------------|
+   //    |   status bar   |
+   //    |----------------|
+   int width_px, height_px;
+
+   // array of offsets (*) into the globe pixels
+   // (the view constructed by the lens)
+   // (32-bit offsets instead of pointers keep this table small, and stay
+   //  valid when globe.pixels is reallocated)
+   //
+   //    **************************    ^
+   //    **************************    |
+   //    **************************    |
+   //    **************************  height_px
+   //    **************************    |
+   //    **************************    |
+   //    **************************    v
+   // 
+   //    <------- width_px ------->
+   // 
+   unsigned *pixels;
+
+   // offset value of lens pixels that are not mapped to the globe
+   // (all bytes 0xff, so the lensmap can be cleared with memset)
+   #define LENSPIXEL_NONE 0xffffffff
+
+   // retrieves a pointer to a lens pixel
+   #define LENSPIXEL(x,y) (lens.pixels + (x) + (y)*lens.width_px)
+
+} lens;
+
+// The last finished lensmap.  New lensmaps are built into lens.pixels while
+// this one stays on screen, and the two are swapped once the new one is done
+// (see show_lensmap), so changing the lens or globe doesn't black out the view.
+static struct _lens_front {
+
+   // true when there is a finished lensmap to show
+   qboolean valid;
+
+   // same layout as lens.pixels
+   unsigned *pixels;
+
+   // a color tint index (i) for each pixel (255 = no filter)
+   // (new color = plates[i].palette[old color])
+   // (used for displaying transparent colored overlays over certain pixels)
+   // (only allocated while f_rubix is on, and made from the plate pixel of
+   //  each lens pixel, see update_rubix_tints)
+   //
+   //    iiiiiiiiiiiiiiiiiiiiiiiiii    ^
+   //    iiiiiiiiiiiiiiiiiiiiiiiiii    |
+   //    iiiiiiiiiiiiiiiiiiiiiiiiii  height_px
+   //    iiiiiiiiiiiiiiiiiiiiiiiiii    |
+   //    iiiiiiiiiiiiiiiiiiiiiiiiii    v
+   // 
+   //    <------- width_px ------->
+   // 
+   byte *pixel_tints;
+
+   // the steps from the plate pixel of each lens pixel to its filter taps,
+   // which are at +-steps[0] +-steps[1] (only allocated while f_lensfilter
+   // is on, see update_lens_filter)
+   int *filter_steps;
+
+   // the plates it was built for
+   // (the globe may have changed or its plates been resized since)
+   struct _plate plates[MAX_PLATES];
+   int numplates;
+
+   // number of lens pixels read from each plate
+   int coverage[MAX_PLATES];
+
+   // mip scale of each plate, from how many of its pixels fall on each lens
+   // pixel (see show_lensmap)
+   float mipscale[MAX_PLATES];
+
+} lens_front;
+
+#ifdef GLQUAKE
+// In GL the globe is always a cubemap texture, whatever the globe script, with
+// each face rendered in the corner of the back buffer and copied into it.  The
+// lens is drawn as a grid of quads over the screen, with the ray of the lensmap
+// at each corner as its texture coordinate, so the card picks the face and texel
+// of every pixel in between.
+#define GL_LENSGRID 4 // pixels between grid vertices
+
+static struct _gl_globe {
+
+   GLuint texture;
+   int size; // of each face (0 = not created yet)
+
+   // grid vertices
+   int cols, rows;
+   float *verts; // screen position (x,y)
+   float *rays;  // cubemap coordinate (x,y,z)
+
+   // the quads of the grid with a ray at all four corners
+   GLuint *indices;
+   int numindices;
+
+   // the faces that the grid looks into
+   qboolean faces[6];
+
+   // true when the grid is built
+   qboolean ready;
+
+   // true when the grid came straight from the lens function rather than
+   // from lens_front (see build_gl_lens_grid)
+   qboolean direct;
+
+} gl_globe;
+#endif
+
+// Plates that the lens hardly uses do not need rendering every frame.  Each
+// plate is rendered every "rate" frames (f_platerate), but always as soon as
+// the view has turned or moved too far since it was last rendered.
+static struct _plate_schedule {
+
+   // render every rate frames (0 = from how much of the lens reads it)
+   int rate[MAX_PLATES];
+   #define PLATERATE_MAX_AUTO 4
+
+   // frames since each plate was rendered (-1 = render it next frame)
+   int age[MAX_PLATES];
+
+   // the view each plate was last rendered from
+   vec3_t angles[MAX_PLATES];
+   vec3_t origin[MAX_PLATES];
+   #define PLATERATE_MAX_TURN 5  // degrees
+   #define PLATERATE_MAX_MOVE 32 // units
+
+   // plates rendered this frame, and the running average
+   int renders;
+   double renders_per_frame;
+
+   // While the game is paused, in a menu or at an intermission and the scene
+   // has not changed since the last frame, nothing is rendered again: the
+   // lens drawn from the plates is copied back to the screen under the 2D
+   // overlay (see is_scene_still).  The plates are still rendered again now
+   // and then, in case a setting has changed what they would show.
+   unsigned scene;        // hash of the scene last frame
+   qboolean still;        // the plates and the copy show that scene
+   double still_time;     // when they were rendered
+   byte *still_pixels;    // the lens as it was drawn then
+   #define PLATERATE_STILL_REFRESH 0.5 // seconds
+
+} plate_schedule;
+
+// When a lensmap is finished, each of its rows is compressed into spans so
+// that render_lensmap can copy many pixels at once instead of looking up every
+// one.  Unmapped pixels are not covered by any span.
+//
+//    SPAN_RUN:       consecutive globe pixels (copied with memcpy)
+//    SPAN_STRIDED:   globe pixels a constant step apart
+//    SPAN_SCATTERED: anything else (looked up from the lensmap)
+#define SPAN_MIN_RUN 4
+
+static struct _lens_spans {
+
+   // true when the spans match the current lensmap
+   qboolean ready;
+
+   struct _lens_span {
+      enum { SPAN_RUN, SPAN_STRIDED, SPAN_SCATTERED } kind;
+      int x;          // first lens column
+      int len;        // number of pixels
+      int stride;     // globe offset step between pixels (SPAN_STRIDED)
+      unsigned start; // globe offset of the first pixel (SPAN_RUN, SPAN_STRIDED)
+   } *spans;
+   int numspans;
+   int maxspans;
+
+   // the spans of row y are spans[rows[y]] up to spans[rows[y+1]-1]
+   int *rows;
+
+   // number of pixels covered by each kind of span (for f_lensstats)
+   int counts[3];
+
+   // runs of lens pixels that no span covers, which are cleared instead of
+   // the whole screen (the gaps of row y are gaps[gaprows[y]] up to
+   // gaps[gaprows[y+1]-1])
+   struct _lens_gap {
+      int x, len;
+   } *gaps;
+   int numgaps;
+   int maxgaps;
+   int *gaprows;
+   int gapcount; // (pixels)
+
+} lens_spans;
+
+// With f_lenstiles, the finished lensmap is drawn in square screen tiles
+// instead of whole rows, ordered by the first globe offset that each tile
+// reads.  Neighbouring lens pixels tend to read neighbouring plate texels, so
+// a tile touches far fewer cache lines of a large plate than a row crossing
+// the lens does, and tiles reading the same part of a plate are drawn one
+// after another (each drawer takes a run of consecutive tiles).  Tiles that
+// read nothing are left out.
+#define MAX_LENS_TILESIZE 256
+
+static struct _lens_tiles {
+
+   // tile width and height in pixels (0 = draw in rows)
+   int size;
+
+   // true when the tiles match the current spans
+   qboolean ready;
+
+   struct _lens_tile {
+      int x, y;       // top left lens pixel
+      unsigned key;   // lowest globe offset read by the tile
+   } *tiles;
+   int numtiles;
+
+   // first span of row y that reaches tile column c, at starts[y*numcols + c]
+   int *starts;
+   int numcols;
+
+   // pending "f_lenstiles compare" repeat count
+   int compare;
+
+} lens_tiles;
+
+// With f_lensfilter, each lens pixel is the mean of four plate pixels spread
+// over the part of the plate that it covers (a 2x2 supersample), so parts of
+// the lens that shrink the plates do not shimmer as the view moves.  The
+// four taps are found once per lensmap from the plate pixels of the next lens
+// pixels over and down (pixels covering about a plate pixel or less keep one
+// tap), and are blended in palette space, a pair at a time, through a table
+// of the palette colour nearest the mean of each pair of colours.
+static struct _lens_filter {
+
+   qboolean enabled;
+
+   // true when lens_front.filter_steps are those of the lensmap on screen
+   qboolean ready;
+
+   // average[a][b] = palette colour nearest the mean of colours a and b
+   // (made the first time the filter is used)
+   qboolean average_ready;
+   byte average[256][256];
+
+} lens_filter;
+
+// Under water (with r_waterwarp), the lens is drawn with the sine warp of
+// D_WarpScreen: each lens pixel is read from a little way along its row and
+// column, by offsets cycling with time, from rows and columns squeezed just
+// enough that none is read from past the edges.  Warping the lens instead of
+// each plate costs one more table read per pixel and leaves no seams where
+// the plates meet.
+static struct _lens_warp {
+
+   // lens size the tables were made for
+   int width, height;
+
+   // lens column, and offset of the lens row, read for each column and row
+   // plus its offset (which is up to TURB_SCREEN_AMP*2)
+   int *cols;
+   int *rows;
+
+   // offset of each row and column this frame (from intsintable)
+   const int *turb;
+
+} lens_warp;
+
+// With f_lenssky, the plates only mark where they see sky, and the lens
+// draws the sky itself from the ray of each lens pixel (or, for lenses whose
+// rays are not kept, of the plate pixel it shows), mapped to the two sky
+// layers the way D_Sky_uv_To_st does.  The sky spans are not drawn for each
+// plate, and the sky has no seams where the plates meet.  The plates draw
+// their own sky while something else reads them (saving, capturing, late
+// latching, the rubix, the filter or the warp).
+static struct _lens_sky {
+
+   qboolean enabled;
+
+   // true while the plates rendered this frame leave their sky to the lens
+   qboolean active;
+
+   // plates whose skymask has any sky
+   qboolean plate_has_sky[MAX_PLATES];
+
+   // view vectors and sky scroll for this frame
+   vec3_t forward, right, up;
+   float scroll;
+
+} lens_sky;
+
+// With f_stereo, each plate is rendered twice in a row, from eyes half the
+// separation to either side of the view, into the globe for the left eye and
+// a second globe for the right.  Both eyes share the scene set up once for
+// the frame (see R_BeginScene and R_BinScene), and the second render finds
+// the plate's part of the world still in the caches.  Both globes are read
+// through the same lensmap in one pass, drawn side by side (each eye half the
+// screen wide) or blended into a red/cyan anaglyph through a table of the
+// palette colour nearest each pair of colours.
+static struct _stereo {
+
+   enum { STEREO_OFF, STEREO_SIDE, STEREO_ANAGLYPH } mode;
+
+   // distance between the eyes, in world units
+   double separation;
+
+   // the right eye's globe (made the first time it is drawn)
+   byte *pixels;
+
+   // anaglyph[a][b] = palette colour nearest the red of a and the green and
+   // blue of b (made the first time it is used)
+   qboolean anaglyph_ready;
+   byte anaglyph[256][256];
+
+} stereo;
+
+// An inverse lensmap is built in two stages: first the light ray of each lens
+// pixel is found with lens_inverse, then the globe pixel seen by each ray.
+// Only the first stage is slow, and it does not depend on the globe, so its
+// rays are kept here.  Changing the globe then only redoes the second stage.
+static struct _ray_field {
+
+   // octahedral encoded unit ray of each lens pixel
+   unsigned *rays;
+
+   // ray of a lens pixel that the lens does not map
+   #define RAYFIELD_NONE 0xffffffff
+
+   int width, height;
+
+   // identifies the lens, zoom and resolution the rays belong to
+   unsigned key;
+
+   // true when every ray has been found
+   qboolean complete;
+
+   // true while the current build is recording rays
+   // (false while it is replaying them)
+   qboolean filling;
+
+   // true when they are the rays of the lensmap on screen (see lens_latch)
+   qboolean current;
+
+   // The last rays found by running the lens, kept (with the lens scale they
+   // were found at) when the screen size or zoom changes.  If they still
+   // cover the new view, the new rays are resampled from them instead of
+   // running the lens again, and the exact rays are built in the background
+   // once the size has stopped changing.
+   unsigned *master;
+   int master_width, master_height;
+   double master_scale;
+   unsigned master_key; // (see calc_ray_master_key)
+
+   // true when the rays were resampled, and the time they were
+   qboolean resampled;
+   double resampled_time;
+
+   // true while the exact rays of a resampled field are being found
+   qboolean refining;
+
+} ray_field;
+
+// seconds that the size must stay the same before exact rays are built, and
+// the angle between neighbouring rays beyond which they are not blended
+#define RAYFIELD_SETTLE 0.5
+#define RAYFIELD_MAX_BLEND_COS 0.996
+
+// The rays of a radially symmetric lens, sampled along the positive x axis.
+// Every lens pixel is then found by turning the ray at its distance from the
+// center, instead of evaluating the lens.
+static struct _radial_table {
+
+   qboolean ready;
+
+   // lens units between samples (the nth sample is at (n+0.5)*step)
+   double step;
+   int count;
+
+   // the (x,z) of the ray at each sample (its y is 0)
+   double (*rays)[2];
+   byte *valid;
+
+} radial_table;
+
+// The columns of each lens row that can be inside the lens image, for lenses
+// that give their outline, so that an oval or circular image is built without
+// evaluating the lens over the rest of the screen only to be told it is
+// outside.
+static struct _image_spans {
+
+   qboolean ready;
+
+   // first and last column of each row (first > last if the row misses the
+   // image), height_px of them
+   int *first, *last;
+   int height;
+
+} image_spans;
+
+// Finished lensmaps are also kept in memory, most recently used first, so that
+// switching back to one of them is instant (see load_lens_lru).
+#define MAX_LENS_LRU 16
+static struct _lens_lru {
+
+   // memory budget in megabytes (f_lenscache_mb, 0 = keep none)
+   int budget_mb;
+
+   int count;
+   struct _lens_lru_entry {
+      unsigned key; // (see calc_lenscache_key)
+      int width_px, height_px;
+      int numplates;
+      int display[MAX_PLATES];
+      unsigned *pixels;
+   } entries[MAX_LENS_LRU];
+
+} lens_lru;
+
+// Once the current lens is finished, the lenses bound to the shortcut keys are
+// built in the background (into lens.pixels, which is free while lens_front is
+// on screen) and kept in lens_lru, so pressing their keys shows them at once.
+// The current lens is swapped out while a shortcut lens is being built.
+static struct _lens_prefetch {
+
+   // true while lens.name is a shortcut lens being built for the cache
+   qboolean working;
+
+   // index of the next shortcut lens to try
+   // (starts over whenever the lens, globe, zoom or screen size changes)
+   int next;
+
+   // the current lens, and its state that the prefetched lens replaces
+   char active[50];
+   int sizes[MAX_PLATES];
+   qboolean ray_field_complete;
+
+} lens_prefetch;
+
+// The plates take a long time to render, so the view has turned a little by
+// the time they are drawn through the lens.  With late latching (f_latelatch),
+// the mouse is read again just before the lensmap is drawn, and the rays of
+// the lens (see ray_field) are turned by the difference to find their plate
+// pixels.  This needs every plate rendered in full, so it is best used with a
+// globe that covers the whole sphere, like "cube".
+static struct _lens_latch {
+
+   qboolean enabled;
+
+   // the view angles that the plates were rendered with,
+   // and the client angles they came from
+   vec3_t angles;
+   vec3_t base;
+
+   // movement from the late mouse reads, for the next command sent
+   // (see F_AddLateMove)
+   usercmd_t cmd;
+
+} lens_latch;
+
+// Rendering the plates is most of the cost of a frame, so with reprojection
+// (f_reproject) the globe is only rendered every few frames, and the frames
+// between are drawn from the last one as it would look from the new view.
+// Each ray of the lens (see ray_field) starts out as the same direction from
+// the old view, finds how far away the globe saw things there, and is moved
+// onto that point as seen from the new view, a few times over.  Like late
+// latching, this needs every plate rendered in full, and a globe that covers
+// the whole sphere.  Things uncovered by the move show what was behind them.
+static struct _lens_reproject {
+
+   // frames drawn from the globe after each one it is rendered for (0 = off)
+   int frames;
+
+   // frames drawn from the globe since it was rendered (-1 = render next frame)
+   int age;
+
+   // true while the plates being rendered keep their depth (see globe.depth)
+   qboolean storing;
+
+   // the view the globe was rendered from
+   vec3_t origin;
+   vec3_t angles;
+   #define REPROJECT_MAX_MOVE 64 // units (further, render the globe again)
+   #define REPROJECT_STEPS 3
+
+   // for render_lensmap_reprojected_rows: the rotation from the new view to
+   // the old one (like lens_drawers.m), and the move, in the old view's axes
+   double m[3][3];
+   double move[3];
+
+} lens_reproject;
+
+static struct _zoom {
+
+   qboolean changed;
+
+   enum { ZOOM_NONE, ZOOM_FOV, ZOOM_VFOV, ZOOM_COVER, ZOOM_CONTAIN } type;
+
+   // desired FOV in degrees
+   int fov;
+
+   // maximum FOV width and height of the current lens in degrees
+   int max_vfov, max_fov;
+
+} zoom;
+
+static struct _rubix {
+
+   // boolean signaling if rubix should be drawn
+   qboolean enabled;
+
+   int numcells;
+   double cell_size;
+   double pad_size;
+
+   // true when lens_front.pixel_tints are those of the lensmap on screen
+   // and the current grid
+   qboolean tints_ready;
+
+   // We color a plate like the side of a rubix cube so we
+   // can see how the lens distorts the plates. (indicatrix)
+   //
+   // EXAMPLE:
+   //
+   //    numcells  = 3
+   //    cell_size = 2
+   //    pad_size  = 1
+   //
+   //  A globe plate is split into a grid of "units"
+   //  The squares that are colored below are called "cells".
+   //  You can see below that there are 3x3 colored cells,
+   //  since numcells=3.
+   //
+   //  You can see below that each cell is 2x2 units large,
+   //  since cell_size=2.
+   //
+   //  Finally, you can see the cells have 1 unit of padding,
+   //  since pad_size=1.
+   //
+   //    ---------------------------------------------------
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|XXXXXXXXX|----|XXXXXXXXX|----|XXXXXXXXX|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|XXXXXXXXX|----|XXXXXXXXX|----|XXXXXXXXX|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|XXXXXXXXX|----|XXXXXXXXX|----|XXXXXXXXX|----|
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |    |XXXXXXXXX|    |XXXXXXXXX|    |XXXXXXXXX|    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    ---------------------------------------------------
+
+} rubix;
+
+// A sweep of lenses, globes and FOVs (see f_benchmark), building each
+// combination from scratch and timing its rendering, one CSV row apiece.
+#define BENCH_MAX 16
+enum { BENCH_INVERSE, BENCH_FORWARD, BENCH_GLOBE_PLATE, BENCH_NUMCALLS };
+static struct _benchmark {
+
+   qboolean active;
+   FILE *file;
+
+   // the combinations, numlenses*numglobes*numfovs of them
+   // (index runs through the FOVs fastest)
+   char lenses[BENCH_MAX][50];
+   char globes[BENCH_MAX][50];
+   int fovs[BENCH_MAX];
+   int numlenses, numglobes, numfovs;
+   int index;
+
+   // frames to time each combination for
+   int frames;
+
+   enum { BENCH_APPLY, BENCH_BUILD, BENCH_RENDER, BENCH_NEXT } phase;
+
+   // build measurements
+   double start;
+   double build_time;
+   qboolean valid;
+   int plates;
+
+   // calls into the lens and globe scripts while building
+   // (made from the lens builder workers too)
+   int lua_calls[BENCH_NUMCALLS];
+
+   // render measurements over the timed frames
+   int frame;
+   double plate_time;
+   int plate_renders;
+   long long texels;
+   double lensmap_time;
+
+   // what to put back when done
+   struct _benchmark_saved {
+      char lens[50];
+      char globe[50];
+      qboolean choice;
+      double floor;
+      int zoom_type;
+      int zoom_fov;
+   } saved;
+
+} benchmark;
+
+// Lensmaps built ahead of time for the lens cache (see F_BakeLensmap)
+static struct {
+   qboolean active;
+   int count;
+
+   // told the name of each lens cache file written
+   void (*saved)(const char *filename);
+} lens_bake;
+
+// Time spent in each stage of the fisheye frame, over the last frames (shown
+// by f_speeds, see F_DrawSpeeds).
+static cvar_t f_speeds = { "f_speeds", "0" };
+
+// frame rate to keep while building a lens (0 = a fixed 1/60 s slice)
+static cvar_t f_buildbudget = { "f_buildbudget", "60", true };
+#define MIN_BUILD_SLICE 0.002
+
+// Streamed lenses (f_streamlens, software only).  A lens with a native
+// inverse is evaluated while it is drawn, every frame, by the drawer threads,
+// instead of being kept in a lensmap: no lensmap memory, and a new lens or
+// zoom is on screen at once, for a fixed cost each frame.  Lenses only in Lua,
+// and globes choosing their plates in Lua, are not safe off the main thread
+// and still build a lensmap.  The plates are rendered whole, not knowing which
+// parts the lens uses.
+static cvar_t f_streamlens = { "f_streamlens", "0", true };
+static struct {
+   // the lens on screen is streamed
+   qboolean active;
+
+   // and can be shown at this zoom
+   qboolean ready;
+} lens_stream;
+
+// Dynamic resolution (f_dynres, a frame rate to hold, 0 = off).  The plates
+// are what the lens scales up to the screen, so the plate quality is stepped
+// down while frames take longer than the target and back up when there is
+// plenty of time left, never below f_dynres_min of f_platequality's scale.
+// Going down needs a short run of slow frames and going up a long run of
+// fast ones, so it settles instead of rebuilding the lens back and forth.
+static cvar_t f_dynres = { "f_dynres", "0", true };
+static cvar_t f_dynres_min = { "f_dynres_min", "0.25", true };
+static struct _dynres {
+
+   // steps down from full quality (each one DYNRES_STEP of the last)
+   int level;
+   #define DYNRES_STEP 0.8
+
+   // how long frames have been too slow or fast enough to step up
+   double over;
+   double under;
+   #define DYNRES_SLOW 1.05      // of the target frame time
+   #define DYNRES_FAST 0.75
+   #define DYNRES_DOWN_TIME 0.5  // seconds
+   #define DYNRES_UP_TIME 3.0
+
+   // when the last frame was judged
+   double last;
+
+} dynres;
+enum {
+   SPEED_BUILD,   // lens builder slice (or prefetch)
+   SPEED_SCENE,   // lights and entities set up for all plates
+   SPEED_PLATES,  // all the plates below
+   SPEED_COPY,    // copying the GL faces out of the back buffer
+   SPEED_CLEAR,   // Draw_TileClear
+   SPEED_LENSMAP, // drawing the lens
+   SPEED_PLATE0,  // each plate's render
+   NUM_SPEEDS = SPEED_PLATE0 + MAX_PLATES
+};
+#define SPEED_FRAMES 128
+static struct _speeds {
+
+   // the stages of the frame being rendered
+   double frame[NUM_SPEEDS];
+
+   // ring of the last finished frames
+   double samples[NUM_SPEEDS][SPEED_FRAMES];
+   int next, count;
+
+} speeds;
+
+// Demo capture (see f_capture).  The lens is drawn into a frame of its own
+// size instead of the screen, and each frame is copied into a bounded queue
+// of slots that writer threads encode and write, so capturing is only as
+// slow as rendering.
+#define CAPTURE_QUEUE 8
+#define MAX_CAPTURE_WRITERS 4
+static struct _capture {
+
+   qboolean active;
+   qboolean failed;     // a frame could not be written
+   qboolean quit_after; // quit the game when the demo is done
+
+   // output frames, and the plate size to render them from (0 = as usual)
+   int width, height;
+   int platesize;
+   double fps;
+   float saved_framerate;
+
+   enum { CAPTURE_PNG, CAPTURE_PPM, CAPTURE_PIPE } format;
+   char path[MAX_OSPATH]; // output directory, or the encoder command
+   FILE *pipe;
+
+   // the frame being drawn, and the number of frames captured
+   byte *pixels;
+   int frame;
+
+   // tiled frames (f_capture ... tiled), for sizes far beyond the screen:
+   // the lensmap is only built at a proxy size of the same shape, and each
+   // frame is drawn a band of rows at a time from the globe offsets of its
+   // own pixels, which are found once per lens and streamed through a
+   // temporary file (see render_capture_tiles)
+   qboolean tiled;
+   struct {
+      FILE *file;
+      qboolean written; // the file holds every band of the current lensmap
+      unsigned *map;    // globe offsets of the band being drawn
+      int rows;         // rows in a band
+   } tiles;
+
+   struct _capture_slot {
+      enum { SLOT_FREE, SLOT_QUEUED, SLOT_WRITING } state;
+      byte *pixels;
+      byte palette[768];
+      int number;
+   } slots[CAPTURE_QUEUE];
+   int numslots; // (fewer for tiled frames, to bound the memory they take)
+
+   mutex_t lock;
+   cond_t changed; // a slot changed state
+   qboolean quit;  // the writers stop once the queue is empty
+   thread_t writers[MAX_CAPTURE_WRITERS];
+   int numwriters;
+
+} capture;
+
+// Every fisheye buffer is allocated with fmem_alloc into one of these pools,
+// so that f_meminfo can show where the memory goes.  With a ceiling
+// (f_memlimit_mb), plates are made smaller and fewer lensmaps are cached to
+// stay under it, and running out of memory makes the plates smaller instead
+// of quitting.
+#define MIN_FIT_PLATESIZE 64
+enum { FMEM_GLOBE, FMEM_LENSMAP, FMEM_BUILDER, FMEM_CACHE, FMEM_CAPTURE, FMEM_GL, FMEM_OTHER, NUM_FMEM };
+static const char *fmem_names[NUM_FMEM] = {
+   "plates", "lensmaps", "lens builder", "lens cache", "capture", "gl lens grid", "other"
+};
+
+static struct _fmem {
+
+   // memory ceiling in megabytes (0 = none)
+   int limit_mb;
+
+   // largest plate size that could be allocated (0 = no failure yet)
+   int failed_platesize;
+
+   // plate size wanted, before fitting it under the ceiling
+   int wanted_platesize;
+
+   // (updated from the builder threads too)
+   long long bytes[NUM_FMEM];
+   long long peak[NUM_FMEM];
+   int count[NUM_FMEM];
+   long long total;
+   long long peak_total;
+
+   // big buffers by the pages behind them
+   long long pages[SYS_NUMPAGES];
+
+} fmem;
+
+// allocations are prefixed with their size and pool, taking a cache line so
+// that big buffers, which come straight from the system (huge pages where it
+// has them), start on one
+#define FMEM_LARGE (1 << 20)
+typedef union {
+   struct {
+      size_t size;
+      int pool;
+      sys_largebuf_t large;  // (base is NULL if malloced)
+   } h;
+   char align[64];
+} fmem_header_t;
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                      FUNCTION DECLARATIONS                                   |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// public main functions
+void F_Init(void);
+void F_Shutdown(void);
+void F_WriteConfig(FILE* f);
+void F_RenderView(void);
+void F_AddLateMove(usercmd_t *cmd);
+void F_DrawSpeeds(void);
+qboolean F_LensReady(void);
+void F_StopCapture(void);
+void F_Bench(void (*report)(const char *name, int ops, double seconds));
+int F_BakeLensmap(const char *lensname, const char *globename, int width, int height,
+      void (*saved)(const char *filename));
+
+// memory accounting functions
+static void *fmem_alloc(int pool, size_t size);
+static void *fmem_realloc(int pool, void *ptr, size_t size);
+static void fmem_free(void *ptr);
+static void fmem_count(int pool, long long size, int count);
+static double fmem_limit(void);
+static int fit_platesize(int platesize, int area);
+static double lens_lru_budget(void);
+
+// console commands
+static void cmd_fisheye(void);
+static void cmd_help(void);
+static void cmd_lens(void);
+static void cmd_globe(void);
+static void cmd_fov(void);
+static void cmd_vfov(void);
+static void cmd_dumppal(void);
+static void cmd_rubix(void);
+static void cmd_rubixgrid(void);
+static void cmd_cover(void);
+static void cmd_contain(void);
+static void cmd_saveglobe(void);
+static void cmd_shortcutkeys(void);
+static void cmd_threads(void);
+static void cmd_drawthreads(void);
+static void cmd_lensgrid(void);
+static void cmd_lensstats(void);
+static void cmd_lenstiles(void);
+static void cmd_lensfilter(void);
+static void cmd_lenssky(void);
+static void cmd_stereo(void);
+static void cmd_hotreload(void);
+static void cmd_platequality(void);
+static void cmd_mipbias(void);
+static void cmd_platefit(void);
+static void cmd_lensswap(void);
+static void cmd_lenscache_mb(void);
+static void cmd_latelatch(void);
+static void cmd_reproject(void);
+static void cmd_platerate(void);
+static void cmd_benchmark(void);
+static void cmd_capture(void);
+static void cmd_meminfo(void);
+static void cmd_memlimit_mb(void);
+
+// console autocomplete helpers
+static struct stree_root * cmdarg_lens(const char *arg);
+static struct stree_root * cmdarg_globe(const char *arg);
+
+// lensmap cache functions
+static unsigned hash_bytes(unsigned hash, const void *data, size_t len);
+static qboolean hash_file(unsigned *hash, const char *filename);
+static qboolean calc_lenscache_key(unsigned *key);
+static void lenscache_filename(char *filename, size_t len, unsigned key);
+static qboolean load_lenscache(void);
+static void save_lenscache(void);
+static int find_lens_lru(unsigned key);
+static void touch_lens_lru(int index);
+static void trim_lens_lru(void);
+static qboolean load_lens_lru(void);
+static void save_lens_lru(void);
+
+// shortcut lens prefetch functions
+static void start_lens_prefetch(void);
+static void stop_lens_prefetch(void);
+
+// lensmap span functions
+static qboolean add_lens_span(int kind, int x, int len, int stride, unsigned start);
+static void build_lensmap_spans(void);
+static qboolean add_lens_gap(int x, int len);
+static int compare_lens_tiles(const void *a, const void *b);
+static void build_lens_tiles(const unsigned *pixels);
+static void calc_plate_scissors(void);
+static qboolean fit_plate_fovs(double *stretch);
+static qboolean calc_plate_sizes(const double *stretch);
+static void finalize_lensmap(void);
+static void show_lensmap(void);
+static void calc_plate_mipscales(void);
+static void hide_lensmap(void);
+static qboolean can_stream_lens(void);
+static qboolean start_lens_stream(void);
+static void print_lens_sampling(const char *heatmap);
+
+// globe chooser functions
+static qboolean measure_globe(int *numplates, double *sampling);
+static void choose_globe(void);
+
+// benchmark functions
+static int split_benchmark_list(const char *arg, char names[][50], int max);
+static void end_benchmark(void);
+static void write_benchmark_row(void);
+static void step_benchmark(void);
+static void time_benchmark_plate(double start, int texels);
+static void time_benchmark_lensmap(double start);
+
+// frame profiler functions
+static double add_speed(int stage, double start);
+static void end_speeds_frame(void);
+static int compare_speeds(const void *a, const void *b);
+
+// demo capture functions
+#if defined(NQ_HACK) && !defined(GLQUAKE)
+static void write_capture_frame(struct _capture_slot *slot);
+static void run_capture_writer(void);
+static void queue_capture_frame(void);
+static int capture_pixel_to_ray(int cx, int cy, vec3_t ray);
+static qboolean build_capture_band(int y0, int rows);
+static qboolean render_capture_tiles(void);
+static qboolean start_capture_writers(void);
+#endif
+#ifndef GLQUAKE
+static void render_capture_frame(qboolean latching);
+#endif
+
+// plate scheduler functions
+static int plate_rate(int plate_index);
+static void refresh_all_plates(void);
+static qboolean is_entity_lerping(const entity_t *e);
+static unsigned hash_scene(void);
+static qboolean is_scene_still(qboolean latching);
+#ifndef GLQUAKE
+static qboolean should_render_plate(int plate_index);
+static void save_still_lens(void);
+static void restore_still_lens(void);
+#endif
+
+// ray field functions
+static unsigned encode_ray(vec3_t ray);
+static void decode_ray(unsigned code, vec3_t ray);
+static qboolean calc_ray_field_key(unsigned *key);
+static void prepare_ray_field(void);
+static qboolean ray_field_matches(void);
+static qboolean build_lensmap_row_from_rays(int ly);
+static qboolean calc_ray_master_key(unsigned *key);
+static void keep_ray_master(void);
+static qboolean resample_ray_field(void);
+static qboolean lensmap_is_resampled(void);
+static void refine_ray_field(void);
+
+// lens builder timing functions
+static void update_lens_builder_budget(double now);
+static double plate_quality_scale(void);
+static void step_dynres(double now);
+static void start_lens_builder_clock(void);
+static qboolean is_lens_builder_time_up(void);
+static qboolean should_pause_lens_builder(void);
+
+// lens builder worker functions
+static int get_cpu_count(void);
+static void lens_error(const char *fmt, ...) __attribute__((format(printf,1,2)));
+static qboolean load_worker_scripts(void);
+static void run_lens_worker(struct _lens_worker *worker);
+static qboolean start_lens_workers(void);
+static void join_lens_workers(void);
+static void free_lens_workers(void);
+static void stop_lens_workers(void);
+static qboolean finish_lens_workers(void);
+static void record_worker_pixel(int lx, int ly, unsigned pixel, int plate_index);
+
+// palette functions
+static void create_palmap(void);
+
+// lua initializer
+static void init_lua(void);
+static lua_State *create_lua_state(void);
+
+// c->lua (c functions for use in lua)
+static int CtoLUA_latlon_to_ray(lua_State *L);
+static int CtoLUA_ray_to_latlon(lua_State *L);
+static int CtoLUA_plate_to_ray(lua_State *L);
+
+// lua->c (lua functions for use in c)
+static int LUAtoC_lens_inverse(double x, double y, vec3_t ray);
+static int LUAtoC_lens_forward(vec3_t ray, double *x, double *y);
+static int LUAtoC_globe_plate(vec3_t ray, int *plate);
+static int LUAtoC_lens_inverse_row(double y, double x0, double dx, int n, vec3_t *rays, byte *valid);
+static int LUAtoC_lens_inverse_ffi(double y, double x0, double dx, int n, vec3_t *rays, byte *valid);
+static int LUAtoC_lens_forward_many(int n, vec3_t *rays, double *xy, byte *valid);
+static int LUAtoC_lens_outline(double y, double *halfwidth);
+
+// native lens and globe functions
+static void load_native_params(void);
+static const native_lens_t *find_native_lens(void);
+static const native_globe_t *find_native_globe(void);
+static int map_lens_inverse(double x, double y, vec3_t ray);
+static int map_lens_forward(vec3_t ray, double *x, double *y);
+static qboolean has_lens_forward(void);
+
+// functions to manage the data and functions in the Lua interpreter state
+static qboolean LUA_load_lens(void);
+static qboolean LUA_load_globe(void);
+static void LUA_clear_lens(void);
+static void LUA_clear_globe(void);
+static int CtoLUA_lens_env_index(lua_State *L);
+static int CtoLUA_lens_env_newindex(lua_State *L);
+static void push_lens_env(void);
+static void set_chunk_env(int idx);
+static void restore_chunk_env(int idx);
+static unsigned hash_lens_inputs(void);
+
+// script hot reload functions
+static qboolean reload_lens(void);
+static qboolean reload_globe(void);
+static qboolean check_watched_script(struct _watched_script *script, const char *kind, const char *name);
+static void check_watched_scripts(void);
+
+// lua helpers
+static qboolean lua_func_exists(const char* name);
+static void LUA_get_lens_batch_refs(void);
+
+// zoom functions
+static qboolean calc_zoom(void);
+static void zoom_error(const char *fmt, ...);
+static void clear_zoom(void);
+static void print_zoom(void);
+
+// lens pixel setters
+static void set_lensmap_from_plate(int lx, int ly, int px, int py, int plate_index);
+static void set_lensmap_from_plate_uv(int lx, int ly, double u, double v, int plate_index);
+static void set_lensmap_from_ray(int lx, int ly, double sx, double sy, double sz);
+static void set_lensmap_pixel_from_ray(int lx, int ly, vec3_t ray);
+
+// lens symmetry helpers
+static int lens_mirror_symmetry(void);
+static int mirror_col(int lx);
+static int mirror_row(int ly);
+static qboolean is_mirrored_col(int lx);
+static qboolean is_mirrored_row(int ly);
+static qboolean build_radial_table(void);
+static int radial_pixel_to_ray(double x, double y, vec3_t ray);
+static int search_image_edge(int ly, int inside, int outside);
+static void build_image_spans(void);
+static qboolean get_image_span(int y0, int y1, int *first, int *last);
+
+// globe plate getters
+static int ray_to_plate_index(vec3_t ray);
+static int ray_to_plate_index_exact(vec3_t ray);
+static void plate_lut_ray(int face, double s, double t, vec3_t ray);
+static void build_plate_lut(void);
+static qboolean ray_to_plate_uv(int plate_index, vec3_t ray, double *u, double *v);
+
+// pure coordinate convertors
+static void latlon_to_ray(double lat, double lon, vec3_t ray);
+static void ray_to_latlon(vec3_t ray, double *lat, double *lon);
+static void plate_uv_to_ray(int plate_index, double u, double v, vec3_t ray);
+static void set_plate_size(struct _plate *plate, int size);
+
+// forward map getter/setter helpers
+static int ray_to_screen(vec3_t ray, double *sx, double *sy);
+static int uv_to_screen(int plate_index, double u, double v, lens_point_t *p);
+static int uv_row_to_screen(int plate_index, double v, lens_point_t *row);
+static qboolean draw_texel_forward(const lens_point_t *top, const lens_point_t *bot, int plate_index, int px, int py);
+
+// lens builder resumers
+static void resume_lensmap(void);
+static qboolean resume_lensmap_inverse(void);
+static qboolean resume_lensmap_forward(void);
+static qboolean build_lensmap_row_inverse(int ly);
+static int lens_grid_size(void);
+static int num_inverse_tasks(void);
+static int lens_pixel_to_ray(int lx, int ly, vec3_t ray);
+static qboolean build_lensmap_block_exact(int x0, int y0, int x1, int y1);
+static qboolean build_lensmap_cell(int x0, int y0, int size, vec3_t r[4], int st[4]);
+static qboolean build_lensmap_band_inverse(int band);
+static void clear_lensmap_band(int band);
+static void start_lens_preview(void);
+static void resume_lens_preview(void);
+static int build_lensmap_rows_forward(int plate_index, lens_point_t **ptop, lens_point_t **pbot, int *py);
+
+// lens creators
+static void create_lensmap_inverse(void);
+static void create_lensmap_forward(void);
+static qboolean start_lensmap(void);
+static void end_lensmap(void);
+static void create_lensmap(void);
+
+// renderers
+#ifndef GLQUAKE
+static void start_lens_drawers(void);
+#endif
+static void stop_lens_drawers(void);
+static void gather_pixels_c(byte *out, const byte *src, const unsigned *offsets, int len);
+#ifdef FISHEYE_AVX2
+static void gather_pixels_avx2(byte *out, const byte *src, const unsigned *offsets, int len);
+#endif
+static void (*gather_pixels)(byte *out, const byte *src, const unsigned *offsets, int len);
+#ifndef GLQUAKE
+static void draw_lensmap_slices(void (*draw)(int first, int step));
+static void clear_lensmap_gaps(void);
+static void render_lensmap(void);
+static void render_lensmap_rows(int first, int step);
+static void render_lensmap_tiles(int first, int step);
+static void render_lensmap_pixels(void);
+static double count_cache_misses(qboolean tiled, int kb);
+static double time_lensmap_draws(void (*draw)(int first, int step), int repeats);
+static void compare_lensmap_orders(void);
+static void set_view_rotation(vec3_t from, vec3_t to, double m[3][3]);
+static qboolean latch_view_rotation(double m[3][3]);
+static unsigned find_globe_pixel(vec3_t ray, double *z);
+static qboolean reproject_globe(qboolean reprojecting);
+static void render_lensmap_reprojected_rows(int first, int step);
+static void render_lensmap_latched(double m[3][3]);
+static void render_lensmap_latched_rows(int first, int step);
+static void render_lensmap_streamed_rows(int first, int step);
+static qboolean update_lens_warp(void);
+static void render_lensmap_warped_rows(int first, int step);
+static qboolean is_view_under_water(void);
+static qboolean lens_has_sky(void);
+static byte get_sky_pixel(vec3_t ray);
+static void render_lens_sky_rows(int first, int step);
+static qboolean update_stereo(void);
+static void render_stereo_plate(int plate_index, const struct _plate *plate, vec3_t forward, vec3_t right, vec3_t up, vec3_t eye);
+static void render_stereo_rows(int first, int step);
+static qboolean is_rubix_line(int p, int platesize);
+static byte get_lens_pixel_tint(unsigned pixel, const struct _plate *plates);
+static void update_rubix_tints(void);
+static void create_lens_filter_average(void);
+static qboolean lens_filter_delta(unsigned pixel, int nx, int ny, int *du, int *dv);
+static void lens_filter_axis(unsigned pixel, int x, int y, int sx, int sy, int *hu, int *hv);
+static void update_lens_filter(void);
+static void gather_pixels_filtered(byte *out, const byte *src, const unsigned *offsets, const int *steps, int len);
+static void render_lensmap_filtered(int first, int step);
+static void gather_pixels_tinted(byte *out, const byte *src, const unsigned *offsets, const byte *tints, const struct _plate *plates, int len);
+static void stride_pixels(byte *out, const byte *src, int stride, int len);
+static void render_plate(int plate_index, const struct _plate *plate, vec3_t forward, vec3_t right, vec3_t up);
+static void set_plate_surfcache(const struct _plate *plates, int numplates);
+static void bin_plate_scene(const struct _plate *plates, int numplates, vec3_t forward, vec3_t right, vec3_t up, float margin);
+static void cull_plate_scene(const struct _plate *plates, int numplates, const qboolean *due, vec3_t forward, vec3_t right, vec3_t up);
+static void free_plate_surfcache(void);
+
+// globe saver functions
+static void save_plate(const char *filename, int plate_index, int with_margins, imgformat_t format);
+static void save_globe(void);
+#else
+static qboolean lensmap_pixel_to_ray(unsigned pixel, vec3_t ray);
+static qboolean build_gl_lens_grid(qboolean direct);
+static void render_globe_gl(vec3_t forward, vec3_t right, vec3_t up);
+static void render_lens_gl(void);
+#endif
+
+// retrieves a pointer to a pixel in the video buffer
+#define VBUFFER(x,y) (vid.buffer + (x) + (y)*vid.rowbytes)
+
+// run a console command now (QW commands have no source)
+#ifdef NQ_HACK
+#define exec_command(text) Cmd_ExecuteString(text, src_command)
+#else
+#define exec_command(text) Cmd_ExecuteString(text)
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                        PUBLIC MAIN FUNCTIONS                                 |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_Init(void)
+{
+   int i;
+
+   lens_builder.working = false;
+   lens_builder.seconds_per_frame = 1.0f / 60;
+   lens_builder.grid = 8;
+   lens_builder.swap = true;
+   lens_lru.budget_mb = 64;
+   for (i=0; i<MAX_PLATES; ++i) {
+      plate_schedule.rate[i] = 1;
+   }
+   refresh_all_plates();
+
+   globe.quality.scale = 1;
+   globe.quality.min_size = 64;
+   globe.quality.max_size = 0;
+   globe.quality.max_mipscale = 4;
+   globe.quality.fit = false;
+   globe.quality.fit_margin = 0.02;
+   globe.choice.floor = 0.5;
+
+   rubix.enabled = false;
+   lens_sky.enabled = true;
+   stereo.separation = 2;
+
+   mutex_init(&lens_workers.lock);
+   lens_workers.count = get_cpu_count();
+
+   mutex_init(&lens_drawers.lock);
+   cond_init(&lens_drawers.start);
+   cond_init(&lens_drawers.done);
+   mutex_init(&capture.lock);
+   cond_init(&capture.changed);
+   lens_drawers.count = get_cpu_count() - 1;
+
+#ifdef FISHEYE_AVX2
+   if (__builtin_cpu_supports("avx2")) {
+      gather_pixels = gather_pixels_avx2;
+   }
+#endif
+
+   init_lua();
+
+   Cmd_AddCommand("fisheye", cmd_fisheye);
+   Cmd_AddCommand("f_help", cmd_help);
+   Cmd_AddCommand("f_dumppal", cmd_dumppal);
+   Cmd_AddCommand("f_rubix", cmd_rubix);
+   Cmd_AddCommand("f_rubixgrid", cmd_rubixgrid);
+   Cmd_AddCommand("f_cover", cmd_cover);
+   Cmd_AddCommand("f_contain", cmd_contain);
+   Cmd_AddCommand("f_fov", cmd_fov);
+   Cmd_AddCommand("f_vfov", cmd_vfov);
+   Cmd_AddCommand("f_lens", cmd_lens);
+   Cmd_SetCompletion("f_lens", cmdarg_lens);
+   Cmd_AddCommand("f_globe", cmd_globe);
+   Cmd_SetCompletion("f_globe", cmdarg_globe);
+   Cmd_AddCommand("f_saveglobe", cmd_saveglobe);
+   Cmd_AddCommand("f_shortcutkeys", cmd_shortcutkeys);
+   Cmd_AddCommand("f_threads", cmd_threads);
+   Cmd_AddCommand("f_drawthreads", cmd_drawthreads);
+   Cmd_AddCommand("f_lensgrid", cmd_lensgrid);
+   Cmd_AddCommand("f_lensstats", cmd_lensstats);
+   Cmd_AddCommand("f_lenstiles", cmd_lenstiles);
+   Cmd_AddCommand("f_lensfilter", cmd_lensfilter);
+   Cmd_AddCommand("f_lenssky", cmd_lenssky);
+   Cmd_AddCommand("f_stereo", cmd_stereo);
+   Cmd_AddCommand("f_hotreload", cmd_hotreload);
+   Cmd_AddCommand("f_platequality", cmd_platequality);
+   Cmd_AddCommand("f_mipbias", cmd_mipbias);
+   Cmd_AddCommand("f_platefit", cmd_platefit);
+   Cmd_AddCommand("f_lensswap", cmd_lensswap);
+   Cmd_AddCommand("f_lenscache_mb", cmd_lenscache_mb);
+   Cmd_AddCommand("f_latelatch", cmd_latelatch);
+   Cmd_AddCommand("f_reproject", cmd_reproject);
+   Cmd_AddCommand("f_platerate", cmd_platerate);
+   Cmd_AddCommand("f_benchmark", cmd_benchmark);
+   Cmd_AddCommand("f_capture", cmd_capture);
+   Cmd_AddCommand("f_meminfo", cmd_meminfo);
+   Cmd_AddCommand("f_memlimit_mb", cmd_memlimit_mb);
+
+   Cvar_RegisterVariable(&f_speeds);
+   Cvar_RegisterVariable(&f_buildbudget);
+   Cvar_RegisterVariable(&f_streamlens);
+   Cvar_RegisterVariable(&f_dynres);
+   Cvar_RegisterVariable(&f_dynres_min);
+
+   // defaults
+   exec_command("fisheye 1");
+   exec_command("f_globe cube");
+   exec_command("f_lens panini");
+   exec_command("f_fov 180");
+   exec_command("f_rubixgrid 10 4 1");
+
+   // create palette maps
+   create_palmap();
+}
+
+void F_Shutdown(void)
+{
+   F_StopCapture();
+   mutex_destroy(&capture.lock);
+   cond_destroy(&capture.changed);
+   stop_lens_workers();
+   mutex_destroy(&lens_workers.lock);
+   stop_lens_drawers();
+#ifndef GLQUAKE
+   free_plate_surfcache();
+#endif
+   cond_destroy(&lens_drawers.done);
+   cond_destroy(&lens_drawers.start);
+   mutex_destroy(&lens_drawers.lock);
+   lua_close(lua);
+}
+
+void F_WriteConfig(FILE* f)
+{
+   // (do not save the name of a lens that is only being prefetched)
+   stop_lens_prefetch();
+
+   fprintf(f,"fisheye %d\n", fisheye_enabled);
+   fprintf(f,"f_lens \"%s\"\n", lens.name);
+   if (globe.choice.enabled) {
+      fprintf(f,"f_globe auto %f\n", globe.choice.floor);
+   }
+   else {
+      fprintf(f,"f_globe \"%s\"\n", globe.name);
+   }
+   fprintf(f,"f_rubixgrid %d %f %f\n", rubix.numcells, rubix.cell_size, rubix.pad_size);
+   fprintf(f,"f_threads %d\n", lens_workers.count);
+   fprintf(f,"f_drawthreads %d\n", lens_drawers.count);
+   fprintf(f,"f_lensgrid %d\n", lens_builder.grid);
+   fprintf(f,"f_lenstiles %d\n", lens_tiles.size);
+   fprintf(f,"f_lensfilter %d\n", lens_filter.enabled);
+   fprintf(f,"f_lenssky %d\n", lens_sky.enabled);
+   fprintf(f,"f_stereo %s %f\n", stereo.mode == STEREO_SIDE ? "side" : stereo.mode == STEREO_ANAGLYPH ? "anaglyph" : "off", stereo.separation);
+   fprintf(f,"f_hotreload %d\n", script_watch.enabled);
+   fprintf(f,"f_platequality %f %d %d\n", globe.quality.scale, globe.quality.min_size, globe.quality.max_size);
+   fprintf(f,"f_mipbias %f\n", globe.quality.max_mipscale);
+   fprintf(f,"f_platefit %d %f\n", globe.quality.fit, globe.quality.fit_margin);
+   fprintf(f,"f_lensswap %d\n", lens_builder.swap);
+   fprintf(f,"f_lenscache_mb %d\n", lens_lru.budget_mb);
+   fprintf(f,"f_memlimit_mb %d\n", fmem.limit_mb);
+   fprintf(f,"f_latelatch %d\n", lens_latch.enabled);
+   fprintf(f,"f_reproject %d\n", lens_reproject.frames);
+   int i;
+   for (i=1; i<MAX_PLATES && plate_schedule.rate[i] == plate_schedule.rate[0]; ++i);
+   if (i == MAX_PLATES) {
+      fprintf(f,"f_platerate %d\n", plate_schedule.rate[0]);
+   }
+   else {
+      for (i=0; i<MAX_PLATES; ++i) {
+         fprintf(f,"f_platerate %d %d\n", plate_schedule.rate[i], i);
+      }
+   }
+   switch (zoom.type) {
+      case ZOOM_FOV:     fprintf(f,"f_fov %d\n", zoom.fov); break;
+      case ZOOM_VFOV:    fprintf(f,"f_vfov %d\n", zoom.fov); break;
+      case ZOOM_COVER:   fprintf(f,"f_cover\n"); break;
+      case ZOOM_CONTAIN: fprintf(f,"f_contain\n"); break;
+      default: break;
+   }
+}
+
+// add the movement of the late mouse reads to the command being sent
+void F_AddLateMove(usercmd_t *cmd)
+{
+   cmd->forwardmove += lens_latch.cmd.forwardmove;
+   cmd->sidemove += lens_latch.cmd.sidemove;
+   cmd->upmove += lens_latch.cmd.upmove;
+   memset(&lens_latch.cmd, 0, sizeof(lens_latch.cmd));
+}
+
+// true when the lens on screen is finished and nothing is about to rebuild it
+// (timedemo waits for this before timing, see CL_GetMessage)
+qboolean F_LensReady(void)
+{
+   if (!fisheye_enabled) {
+      return true;
+   }
+   if (globe.choice.enabled && ray_field.current &&
+         (!globe.choice.chosen || globe.choice.key != ray_field.key)) {
+      return false;
+   }
+   return !lens_builder.working && !globe.resized &&
+      !lens.changed && !globe.changed && !zoom.changed;
+}
+
+// size the buffers for a lens.width_px x lens.height_px lensmap on plates of
+// the given size, and start, continue or finish building it
+// (returns false if there was not enough memory for the buffers)
+static qboolean step_lens_builder(int platesize)
+{
+   static struct {
+      int width, height, platesize;
+      qboolean stream;
+   } sized = { -1, -1, -1, false };
+
+   int area = lens.width_px * lens.height_px;
+   fmem.wanted_platesize = platesize;
+   platesize = globe.platesize = fit_platesize(platesize, area);
+
+   // (captured, baked and benchmarked lenses always have a lensmap)
+#ifdef GLQUAKE
+   qboolean stream = false;
+#else
+   qboolean stream = f_streamlens.value && !capture.active && !lens_bake.active && !benchmark.active;
+#endif
+   int sizechange = (sized.width!=lens.width_px) || (sized.height!=lens.height_px) || (sized.platesize!=platesize) ||
+      (sized.stream!=stream);
+
+   if (benchmark.active) {
+      step_benchmark();
+   }
+   step_dynres(Sys_DoubleTime());
+
+   // pick a globe once the rays of a new lens or zoom are known
+   if (globe.choice.enabled && ray_field.current &&
+         (!globe.choice.chosen || globe.choice.key != ray_field.key)) {
+      choose_globe();
+   }
+
+   // (after a resize)
+   if (!sizechange && !zoom.changed && !lens.changed && !globe.changed) {
+      refine_ray_field();
+   }
+
+   // builder workers must not be running while we replace what they read
+   if (sizechange || zoom.changed || lens.changed || globe.changed) {
+      stop_lens_prefetch();
+      stop_lens_workers();
+   }
+
+   // allocate new buffers if size changes
+   if(sizechange)
+   {
+      if(globe.pixels) fmem_free(globe.pixels);
+      if(lens.pixels) fmem_free(lens.pixels);
+      if(lens_front.pixels) fmem_free(lens_front.pixels);
+      fmem_free(lens_front.pixel_tints);
+      lens_front.pixel_tints = NULL;
+      rubix.tints_ready = false;
+      fmem_free(lens_front.filter_steps);
+      lens_front.filter_steps = NULL;
+      lens_filter.ready = false;
+      fmem_free(plate_schedule.still_pixels);
+      plate_schedule.still_pixels = NULL;
+      if(globe.zbuffer) fmem_free(globe.zbuffer);
+      fmem_free(globe.depth);
+      globe.depth = NULL;
+      lens_reproject.age = -1;
+      fmem_free(globe.skymask);
+      globe.skymask = NULL;
+      fmem_free(stereo.pixels);
+      stereo.pixels = NULL;
+      hide_lensmap();
+      refresh_all_plates();
+
+      globe.pixels = (byte*)fmem_alloc(FMEM_GLOBE, platesize*platesize*MAX_PLATES*sizeof(byte) + GLOBE_PADDING);
+      globe.zbuffer = (short*)fmem_alloc(FMEM_GLOBE, platesize*platesize*sizeof(short));
+#ifndef GLQUAKE
+      // (without a skymask the plates just draw their own sky)
+      globe.skymask = (byte*)fmem_alloc(FMEM_GLOBE, platesize*platesize*MAX_PLATES);
+      if (globe.skymask) {
+         memset(globe.skymask, 0, platesize*platesize*MAX_PLATES);
+      }
+#endif
+      // (streamed lenses have no lensmap, see below for those that can't be)
+      lens.pixels = lens_front.pixels = NULL;
+      if (!stream) {
+         lens.pixels = (unsigned*)fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+         lens_front.pixels = (unsigned*)fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+      }
+
+      // out of memory: drop the cached lensmaps, then try smaller plates
+      // next frame, and only give up on the fisheye below the smallest
+      if(!globe.pixels || !globe.zbuffer || (!stream && (!lens.pixels || !lens_front.pixels))) {
+         fmem_free(globe.pixels);
+         fmem_free(globe.zbuffer);
+         fmem_free(lens.pixels);
+         fmem_free(lens_front.pixels);
+         fmem_free(globe.skymask);
+         globe.pixels = NULL;
+         globe.zbuffer = NULL;
+         globe.skymask = NULL;
+         lens.pixels = lens_front.pixels = NULL;
+         sized.width = -1;
+         if (lens_lru.count > 0) {
+            while (lens_lru.count > 0) {
+               fmem_free(lens_lru.entries[--lens_lru.count].pixels);
+            }
+            Con_Printf("Quake-Lenses: not enough memory, emptied the lens cache\n");
+         }
+         else if (platesize > MIN_FIT_PLATESIZE) {
+            fmem.failed_platesize = platesize/2 > MIN_FIT_PLATESIZE ? platesize/2 : MIN_FIT_PLATESIZE;
+            Con_Printf("Quake-Lenses: not enough memory for plates of %d, trying %d\n", platesize, fmem.failed_platesize);
+         }
+         else {
+            Con_Printf("Quake-Lenses: not enough memory, turning the fisheye off\n");
+            exec_command("fisheye 0");
+         }
+         return false;
+      }
+
+      // the cached lensmaps get what the new buffers leave under the ceiling
+      trim_lens_lru();
+   }
+
+   // recalculate lens
+   double start = Sys_DoubleTime();
+   update_lens_builder_budget(start);
+   TR_Begin("lens_builder");
+   if (sizechange || zoom.changed || lens.changed || globe.changed) {
+      // start with full size plates at the globe's FOVs, then measure how
+      // big and wide they need to be
+      int i;
+      for (i=0; i<MAX_PLATES; ++i) {
+         set_plate_size(&globe.plates[i], platesize);
+         if (globe.plates[i].max_fov > 0) {
+            globe.plates[i].fov = globe.plates[i].max_fov;
+            globe.plates[i].dist = 0.5/tan(globe.plates[i].fov/2);
+         }
+      }
+      globe.sized = plate_quality_scale() <= 0 && !globe.quality.fit;
+      globe.resized = false;
+      lens_prefetch.next = 0;
+
+      if (lens.pixels) {
+         memset(lens.pixels, 0xff, area*sizeof(unsigned));
+      }
+
+      // load the lens again if it was set up from globals that have changed
+      // since (see lens_inputs)
+      if (!lens.valid || lens_inputs.overflow || hash_lens_inputs() != lens_inputs.hash) {
+         lens.valid = LUA_load_lens();
+      }
+      if (!lens.valid) {
+         strcpy(lens.name,"");
+         Con_Printf("not a valid lens\n");
+      }
+
+      // a streamed lens gives back the lensmap of the last lens, and a lens
+      // that can't be streamed gets one
+      lens_stream.active = stream && can_stream_lens();
+      if (lens_stream.active && lens.pixels) {
+         hide_lensmap();
+         fmem_free(lens.pixels);
+         fmem_free(lens_front.pixels);
+         lens.pixels = lens_front.pixels = NULL;
+      }
+      else if (!lens_stream.active && !lens.pixels) {
+         lens.pixels = (unsigned*)fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+         lens_front.pixels = (unsigned*)fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+         if (!lens.pixels || !lens_front.pixels) {
+            fmem_free(lens.pixels);
+            fmem_free(lens_front.pixels);
+            lens.pixels = lens_front.pixels = NULL;
+            Con_Printf("Quake-Lenses: not enough memory for the lensmap of %s, turning f_streamlens off\n", lens.name);
+            exec_command("f_streamlens 0");
+            TR_End("lens_builder");
+            return false;
+         }
+         memset(lens.pixels, 0xff, area*sizeof(unsigned));
+      }
+
+      if (lens_stream.active) {
+         lens_stream.ready = start_lens_stream();
+      }
+      else {
+         create_lensmap();
+      }
+
+#ifdef GLQUAKE
+      // inverse lenses can be shown before their lensmap is built
+      gl_globe.direct = lens.valid && lens.map_type == MAP_INVERSE && lens.scale > 0 &&
+         build_gl_lens_grid(true);
+#endif
+   }
+   else if (globe.resized) {
+      // rebuild the lensmap now that its plates have their own sizes
+      globe.resized = false;
+      memset(lens.pixels, 0xff, area*sizeof(unsigned));
+      create_lensmap();
+   }
+   else if (lens_builder.working) {
+      resume_lensmap();
+   }
+   else {
+      start_lens_prefetch();
+   }
+   TR_End("lens_builder");
+   lens_builder.build_time = add_speed(SPEED_BUILD, start) - start;
+
+   // store current values for change detection
+   sized.width = lens.width_px;
+   sized.height = lens.height_px;
+   sized.platesize = platesize;
+   sized.stream = stream;
+   return true;
+}
+
+void F_RenderView(void)
+{
+   // pick up edits to the lens and globe scripts
+   check_watched_scripts();
+
+   // update screen size
+   // (or the size of the frames being captured)
+   lens.width_px = capture.active ? capture.width : scr_vrect.width;
+   lens.height_px = capture.active ? capture.height : scr_vrect.height;
+   if (stereo.mode == STEREO_SIDE && !capture.active) {
+      // (one lens for each eye, side by side)
+      lens.width_px /= 2;
+   }
+   #define MIN(a,b) ((a) < (b) ? (a) : (b))
+   int platesize = globe.quality.max_size > 0 ? globe.quality.max_size : MIN(lens.height_px, lens.width_px);
+   if (capture.active && capture.tiled) {
+      // (tiled frames only build a lensmap of their shape that fits the
+      //  screen, with plates as big as they can be)
+      double fit = MIN((double)scr_vrect.width / capture.width, (double)scr_vrect.height / capture.height);
+      fit = MIN(fit, 1);
+      lens.width_px = (int)(capture.width*fit + 0.5);
+      lens.height_px = (int)(capture.height*fit + 0.5);
+      if (lens.width_px < 1) lens.width_px = 1;
+      if (lens.height_px < 1) lens.height_px = 1;
+      platesize = MAX_PLATESIZE;
+   }
+   if (capture.active && capture.platesize > 0) {
+      platesize = capture.platesize;
+   }
+   platesize = MIN(platesize, MAX_PLATESIZE);
+   if (!step_lens_builder(platesize)) {
+      end_speeds_frame();
+      return;
+   }
+   double start;
+
+   // get the orientations required to render the plates
+   vec3_t forward, right, up;
+   AngleVectors(r_refdef.viewangles, forward, right, up);
+   VectorCopy(r_refdef.viewangles, lens_latch.angles);
+   VectorCopy(cl.viewangles, lens_latch.base);
+
+   // do not do this every frame?
+   extern int sb_lines;
+   extern vrect_t scr_vrect;
+   vrect_t vrect;
+   vrect.x = 0;
+   vrect.y = 0;
+   vrect.width = vid.width;
+   vrect.height = vid.height;
+   R_SetVrect(&vrect, &scr_vrect, sb_lines);
+
+#ifdef GLQUAKE
+   if (globe.save.should) {
+      Con_Printf("f_saveglobe is not supported in GL\n");
+      globe.save.should = false;
+   }
+   // (the cube faces are kept while the scene is still)
+   qboolean still = is_scene_still(false);
+   if (!still || !plate_schedule.still) {
+      render_globe_gl(forward, right, up);
+      plate_schedule.still = still;
+      plate_schedule.still_time = Sys_DoubleTime();
+   }
+   // (GL times are what the CPU spends issuing the draws, not the GPU's)
+   start = Sys_DoubleTime();
+   render_lens_gl();
+   add_speed(SPEED_LENSMAP, start);
+   time_benchmark_lensmap(start);
+#else
+   // (a stereo frame renders every plate it draws for both eyes, and draws
+   //  no other way)
+   qboolean eyes = stereo.mode != STEREO_OFF && !capture.active && !globe.save.should && update_stereo();
+   vec3_t eye;
+   VectorScale(right, eyes ? stereo.separation/2 : 0, eye);
+
+   // a late latched view may turn toward any part of any plate
+   qboolean latching = lens_latch.enabled && lens_front.valid && ray_field.current && !eyes;
+
+   // a scene that has just stopped changing has all its plates rendered once,
+   // then nothing is rendered until it changes
+   qboolean still = !eyes && is_scene_still(latching);
+   qboolean reuse = still && plate_schedule.still;
+   if (still && !plate_schedule.still) {
+      refresh_all_plates();
+   }
+
+   // a reprojected frame is drawn from the last globe without rendering it
+   qboolean reprojecting = lens_reproject.frames > 0 && lens_front.valid && ray_field.current &&
+      !eyes && !capture.active && !globe.save.should && !rubix.enabled;
+   qboolean reprojected = !reuse && reproject_globe(reprojecting);
+   lens_reproject.storing = reprojecting && !reprojected;
+
+   // render the plates of the lensmap on screen
+   // (the one being built until there is a finished one)
+   struct _plate *plates = lens_front.valid ? lens_front.plates : globe.plates;
+   int numplates = lens_front.valid ? lens_front.numplates : globe.numplates;
+   int i;
+   plate_schedule.renders = 0;
+   if (!reuse && !reprojected) {
+      set_plate_surfcache(plates, numplates);
+      start = Sys_DoubleTime();
+      R_BeginScene();
+      bin_plate_scene(plates, numplates, forward, right, up, eyes ? stereo.separation/2 : 0);
+
+      // (a tiled capture frame may read any plate, in full, and so may the
+      //  frames reprojected from this one, which need all of it up to date)
+      qboolean whole = (capture.active && capture.tiled) || lens_reproject.storing;
+      qboolean due[MAX_PLATES];
+      for (i=0; i<numplates; ++i) {
+         due[i] = (plates[i].display || latching || whole) &&
+            (should_render_plate(i) || lens_reproject.storing);
+      }
+      // (the eyes of a stereo frame each walk the world in their own order)
+      if (!eyes) {
+         cull_plate_scene(plates, numplates, due, forward, right, up);
+      }
+      add_speed(SPEED_SCENE, start);
+      lens_sky.active = lens_sky.enabled && globe.skymask && lens_front.valid && !eyes &&
+         !capture.active && !latching && !reprojecting && !globe.save.should && !rubix.enabled &&
+         !lens_filter.enabled && !is_view_under_water();
+      VectorCopy(forward, lens_sky.forward);
+      VectorCopy(right, lens_sky.right);
+      VectorCopy(up, lens_sky.up);
+      for (i=0; i<numplates; ++i)
+      {
+         if (due[i]) {
+            r_viewbits = 1u << i;
+
+            // set view to change plate FOV
+            // (only rendering the part of the plate the lens uses, unless the
+            //  whole plate is about to be saved)
+            fisheye_plate_fov = plates[i].fov;
+            fisheye_plate_size = plates[i].size;
+            fisheye_plate_height = plates[i].height;
+            fisheye_plate_scissor = globe.save.should || latching || whole ? NULL : &plates[i].scissor;
+            fisheye_plate_mipscale = lens_front.valid && !globe.save.should && !whole ? lens_front.mipscale[i] : 1;
+
+            // compute absolute view vectors
+            // right = x
+            // top = y
+            // forward = z
+
+            vec3_t r = { 0,0,0};
+            VectorMA(r, plates[i].right[0], right, r);
+            VectorMA(r, plates[i].right[1], up, r);
+            VectorMA(r, plates[i].right[2], forward, r);
+
+            vec3_t u = { 0,0,0};
+            VectorMA(u, plates[i].up[0], right, u);
+            VectorMA(u, plates[i].up[1], up, u);
+            VectorMA(u, plates[i].up[2], forward, u);
+
+            vec3_t f = { 0,0,0};
+            VectorMA(f, plates[i].forward[0], right, f);
+            VectorMA(f, plates[i].forward[1], up, f);
+            VectorMA(f, plates[i].forward[2], forward, f);
+
+            start = Sys_DoubleTime();
+            TR_Begin("render_plate");
+            if (eyes) {
+               render_stereo_plate(i, &plates[i], f, r, u, eye);
+            }
+            else {
+               render_plate(i, &plates[i], f, r, u);
+            }
+            TR_End("render_plate");
+            add_speed(SPEED_PLATE0 + i, start);
+            time_benchmark_plate(start, fisheye_plate_scissor ?
+                  fisheye_plate_scissor->width * fisheye_plate_scissor->height : plates[i].size * plates[i].height);
+         }
+      }
+      R_EndScene();
+      lens_reproject.storing = false;
+      fisheye_plate_scissor = NULL;
+      fisheye_plate_size = 0;
+      fisheye_plate_height = 0;
+      fisheye_plate_mipscale = 1;
+
+      // point the renderer back at the screen
+      R_ViewChanged(&vrect, sb_lines, vid.aspect);
+   }
+   plate_schedule.renders_per_frame = 0.95*plate_schedule.renders_per_frame + 0.05*plate_schedule.renders;
+
+   // save plates upon request from the "saveglobe" command
+   if (globe.save.should) {
+      save_globe();
+   }
+
+   // render our view
+   // (or the frame being captured)
+   if (capture.active) {
+      render_capture_frame(latching);
+   }
+   else if (eyes) {
+      start = Sys_DoubleTime();
+      clear_lensmap_gaps();
+      start = add_speed(SPEED_CLEAR, start);
+      if (lens_front.valid && lens_spans.ready) {
+         draw_lensmap_slices(render_stereo_rows);
+      }
+      else {
+         render_lensmap();
+      }
+      add_speed(SPEED_LENSMAP, start);
+      time_benchmark_lensmap(start);
+   }
+   else if (reuse) {
+      start = Sys_DoubleTime();
+      restore_still_lens();
+      add_speed(SPEED_LENSMAP, start);
+   }
+   else {
+      // (turned, moved or warped rays may land on other pixels, so those clear all)
+      double m[3][3];
+      qboolean latched = !reprojected && latching && latch_view_rotation(m);
+      qboolean warped = !reprojected && !latched && update_lens_warp();
+      start = Sys_DoubleTime();
+      if (reprojected || latched || warped) {
+         Draw_TileClear(0, 0, vid.width, vid.height);
+      }
+      else {
+         clear_lensmap_gaps();
+      }
+      start = add_speed(SPEED_CLEAR, start);
+      if (lens_tiles.compare) {
+         compare_lensmap_orders();
+         start = Sys_DoubleTime();
+      }
+      if (reprojected) {
+         draw_lensmap_slices(render_lensmap_reprojected_rows);
+      }
+      else if (latched) {
+         render_lensmap_latched(m);
+      }
+      else if (warped) {
+         draw_lensmap_slices(render_lensmap_warped_rows);
+      }
+      else {
+         render_lensmap();
+         if (lens_sky.active && lens_has_sky()) {
+            draw_lensmap_slices(render_lens_sky_rows);
+         }
+      }
+      add_speed(SPEED_LENSMAP, start);
+      time_benchmark_lensmap(start);
+      if (still) {
+         save_still_lens();
+      }
+   }
+#endif
+   end_speeds_frame();
+
+   // reset change flags
+   lens.changed = globe.changed = zoom.changed = false;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                        LENS BUILD TIMING FUNCTIONS                           |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// give the builder what the rest of the last frames leaves of the target
+// frame time (always a little, so that it finishes)
+static void update_lens_builder_budget(double now)
+{
+   if (lens_builder.frame_time > 0) {
+      double other = now - lens_builder.frame_time - lens_builder.build_time;
+      if (other < 0) other = 0;
+      lens_builder.other_time = 0.9*lens_builder.other_time + 0.1*other;
+   }
+   lens_builder.frame_time = now;
+   lens_builder.build_time = 0;
+
+   if (f_buildbudget.value <= 0) {
+      lens_builder.seconds_per_frame = 1.0 / 60;
+      return;
+   }
+   double slice = 1.0 / f_buildbudget.value - lens_builder.other_time;
+   lens_builder.seconds_per_frame = slice > MIN_BUILD_SLICE ? slice : MIN_BUILD_SLICE;
+}
+
+// plate pixels per lens pixel wanted by f_platequality, less the steps
+// taken by f_dynres (0 = full size plates)
+static double plate_quality_scale(void)
+{
+   double scale = globe.quality.scale;
+   if (capture.active && capture.tiled) {
+      return 0;
+   }
+   if (f_dynres.value <= 0 || dynres.level == 0) {
+      return scale;
+   }
+   if (scale <= 0) {
+      scale = 1;
+   }
+   return scale * pow(DYNRES_STEP, dynres.level);
+}
+
+// step the plate quality toward the f_dynres frame rate
+// (judged on the smoothed frame time without the lens builder, and not
+//  while a lens is being built, since that is what a step costs)
+static void step_dynres(double now)
+{
+   double elapsed = dynres.last > 0 ? now - dynres.last : 0;
+   dynres.last = now;
+   if (elapsed > 0.1) elapsed = 0.1; // (a pause is not a slow frame)
+
+   if (f_dynres.value <= 0) {
+      if (dynres.level) {
+         dynres.level = 0;
+         lens.changed = true;
+      }
+      dynres.over = dynres.under = 0;
+      return;
+   }
+   if (lens_builder.working || globe.resized || !lens_front.valid ||
+         capture.active || benchmark.active) {
+      dynres.over = dynres.under = 0;
+      return;
+   }
+
+   double target = 1.0 / f_dynres.value;
+   double frame = lens_builder.other_time;
+   if (frame > target * DYNRES_SLOW) {
+      dynres.over += elapsed;
+      dynres.under = 0;
+   }
+   else if (frame < target * DYNRES_FAST) {
+      dynres.under += elapsed;
+      dynres.over = 0;
+   }
+   else {
+      dynres.over = dynres.under = 0;
+   }
+
+   double min = f_dynres_min.value > 0 && f_dynres_min.value < 1 ? f_dynres_min.value : 1;
+   int max_level = (int)floor(log(min) / log(DYNRES_STEP) + 0.001);
+   int level = dynres.level;
+   if (dynres.over >= DYNRES_DOWN_TIME && level < max_level) {
+      level++;
+   }
+   else if (dynres.under >= DYNRES_UP_TIME && level > 0) {
+      level--;
+   }
+   if (level > max_level) {
+      level = max_level;
+   }
+   if (level != dynres.level) {
+      dynres.level = level;
+      dynres.over = dynres.under = 0;
+      lens.changed = true;
+   }
+}
+
+// (wall time, the process also runs the workers, drawers and sound)
+static void start_lens_builder_clock(void) {
+   lens_builder.start_time = Sys_DoubleTime();
+}
+static qboolean is_lens_builder_time_up(void) {
+   return Sys_DoubleTime() - lens_builder.start_time >= lens_builder.seconds_per_frame;
+}
+
+// workers run until the build is cancelled, the main thread only until its time is up
+static qboolean should_pause_lens_builder(void) {
+   if (lens_worker) {
+      return lens_workers.cancel;
+   }
+   return is_lens_builder_time_up();
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           PALLETE FUNCTIONS                                  |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void create_palmap(void)
+{
+   int i,j;
+   int percent = 256/6;
+   int tint[3];
+   palsearch_t search;
+
+   Pal_InitSearch(&search, host_basepal, 3);
+
+   for (j=0; j<MAX_PLATES; ++j)
+   {
+      tint[0] = tint[1] = tint[2] = 0;
+      switch (j)
+      {
+         case 0:
+            tint[0] = tint[1] = tint[2] = 255;
+            break;
+         case 1:
+            tint[2] = 255;
+            break;
+         case 2:
+            tint[0] = 255;
+            break;
+         case 3:
+            tint[0] = tint[1] = 255;
+            break;
+         case 4:
+            tint[0] = tint[2] = 255;
+            break;
+         case 5:
+            tint[1] = tint[2] = 255;
+            break;
+      }
+   
+      byte* pal = host_basepal;
+      for (i=0; i<256; ++i)
+      {
+         int r = pal[0];
+         int g = pal[1];
+         int b = pal[2];
+
+         r += percent * (tint[0] - r) >> 8;
+         g += percent * (tint[1] - g) >> 8;
+         b += percent * (tint[2] - b) >> 8;
+
+         if (r < 0) r=0; if (r > 255) r=255;
+         if (g < 0) g=0; if (g > 255) g=255;
+         if (b < 0) b=0; if (b > 255) b=255;
+
+         globe.plates[j].palette[i] = Pal_FindClosest(&search,r,g,b);
+
+         pal += 3;
+      }
+   }
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           CONSOLE COMMANDS                                   |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void cmd_dumppal(void)
+{
+   int i;
+   byte *pal = host_basepal;
+   FILE *pFile = fopen("palette","w");
+   if (NULL == pFile) {
+      Con_Printf("could not open \"palette\" for writing\n");
+      return;
+   }
+   for (i=0; i<256; ++i) {
+      fprintf(pFile, "%d, %d, %d,\n",
+            pal[0],pal[1],pal[2]);
+      pal+=3;
+   }
+   fclose(pFile);
+}
+
+static void cmd_rubix(void)
+{
+   rubix.enabled = !rubix.enabled;
+   Con_Printf("Rubix is %s\n", rubix.enabled ? "ON" : "OFF");
+}
+
+static void cmd_rubixgrid(void)
+{
+   if (Cmd_Argc() == 4) {
+      rubix.numcells = Q_atof(Cmd_Argv(1));
+      rubix.cell_size = Q_atof(Cmd_Argv(2));
+      rubix.pad_size = Q_atof(Cmd_Argv(3));
+      rubix.tints_ready = false; // (the tints are made again from the lensmap)
+   }
+   else {
+      Con_Printf("RubixGrid <numcells> <cellsize> <padsize>\n");
+      Con_Printf("   numcells (default 10) = %d\n", rubix.numcells);
+      Con_Printf("   cellsize (default  4) = %f\n", rubix.cell_size);
+      Con_Printf("   padsize  (default  1) = %f\n", rubix.pad_size);
+   }
+}
+
+static void cmd_cover(void)
+{
+   clear_zoom();
+   zoom.type = ZOOM_COVER;
+}
+
+static void cmd_contain(void)
+{
+   clear_zoom();
+   zoom.type = ZOOM_CONTAIN;
+}
+
+static void cmd_fisheye(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("Currently: ");
+      Con_Printf("fisheye %d\n", fisheye_enabled);
+      Con_Printf("\nTry F_HELP for more options and commands.\n");
+      return;
+   }
+   fisheye_enabled = Q_atoi(Cmd_Argv(1)); // will return 0 if not valid
+   vid.recalc_refdef = true;
+#ifndef GLQUAKE
+   if (!fisheye_enabled) {
+      free_plate_surfcache();
+   }
+#endif
+}
+
+// lenses bound to the keys 1-9 by f_shortcutkeys (also prefetched, see lens_prefetch)
+static const char *shortcut_lenses[] = {
+   "panini", "stereographic", "hammer", "winkeltripel", "fisheye1",
+   "mercator", "quincuncial", "cube", "debug",
+};
+#define NUM_SHORTCUT_LENSES ((int)(sizeof(shortcut_lenses)/sizeof(shortcut_lenses[0])))
+
+static void cmd_shortcutkeys(void)
+{
+   shortcutkeys_enabled = !shortcutkeys_enabled;
+   if (shortcutkeys_enabled) {
+      Con_Printf("Enabled Fisheye shortcut keys: 1-9 = Lenses, Y,U,I,O,P = Globes\n");
+      int i;
+      for (i=0; i<NUM_SHORTCUT_LENSES; ++i) {
+         char bind[64];
+         snprintf(bind, sizeof(bind), "bind %d \"f_lens %s\"", i+1, shortcut_lenses[i]);
+         exec_command(bind);
+      }
+      exec_command("bind y \"f_globe cube\"");
+      exec_command("bind u \"f_globe cube_edge\"");
+      exec_command("bind i \"f_globe trism\"");
+      exec_command("bind o \"f_globe tetra\"");
+      exec_command("bind p \"f_globe fast\"");
+   }
+   else {
+      Con_Printf("Disabled Fisheye shortcut keys\n");
+      exec_command("bind 1 \"impulse 1\"");
+      exec_command("bind 2 \"impulse 2\"");
+      exec_command("bind 3 \"impulse 3\"");
+      exec_command("bind 4 \"impulse 4\"");
+      exec_command("bind 5 \"impulse 5\"");
+      exec_command("bind 6 \"impulse 6\"");
+      exec_command("bind 7 \"impulse 7\"");
+      exec_command("bind 8 \"impulse 8\"");
+      exec_command("unbind 9");
+      exec_command("unbind y");
+      exec_command("unbind u");
+      exec_command("unbind i");
+      exec_command("unbind o");
+      exec_command("unbind p");
+   }
+}
+
+static void cmd_threads(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_threads <count>: number of lens builder threads (0 = main thread only)\n");
+      Con_Printf("Currently: %d\n", lens_workers.count);
+      return;
+   }
+
+   int count = Q_atoi(Cmd_Argv(1));
+   if (count < 0) count = 0;
+   if (count > MAX_LENS_WORKERS) count = MAX_LENS_WORKERS;
+
+   stop_lens_workers();
+   lens_workers.count = count;
+   lens.changed = true; // rebuild with the new thread count
+}
+
+static void cmd_drawthreads(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_drawthreads <count>: number of threads helping to draw the lens (0 = main thread only)\n");
+      Con_Printf("Currently: %d (%d running)\n", lens_drawers.count, lens_drawers.numthreads);
+      return;
+   }
+
+   int count = Q_atoi(Cmd_Argv(1));
+   if (count < 0) count = 0;
+   if (count > MAX_LENS_WORKERS) count = MAX_LENS_WORKERS;
+
+   // (restarted on the next frame)
+   stop_lens_drawers();
+   lens_drawers.count = count;
+}
+
+static void cmd_lensgrid(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lensgrid <size>: evaluate the lens every <size> pixels and interpolate (0 = every pixel)\n");
+      Con_Printf("Currently: %d\n", lens_builder.grid);
+      return;
+   }
+
+   int size = Q_atoi(Cmd_Argv(1));
+   if (size < 0) size = 0;
+   if (size > 64) size = 64;
+
+   // cells are split in half until they are accurate, so keep to powers of two
+   int grid = 1;
+   while (grid*2 <= size) grid *= 2;
+
+   stop_lens_workers();
+   lens_builder.grid = size == 0 ? 0 : grid;
+   lens.changed = true;
+}
+
+static void cmd_platequality(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_platequality <scale> [min] [max]: plate pixels per lens pixel (0 = full size plates)\n");
+      Con_Printf("   (max 0 = the smaller side of the screen; plates may be larger than the screen)\n");
+      Con_Printf("Currently: %f %d %d\n", globe.quality.scale, globe.quality.min_size, globe.quality.max_size);
+      int i;
+      for (i=0; i<globe.numplates; ++i) {
+         Con_Printf("   plate %d: %dx%d\n", i, globe.plates[i].size, globe.plates[i].height);
+      }
+      return;
+   }
+
+   globe.quality.scale = Q_atof(Cmd_Argv(1));
+   if (Cmd_Argc() >= 3) {
+      globe.quality.min_size = Q_atoi(Cmd_Argv(2));
+   }
+   if (Cmd_Argc() >= 4) {
+      globe.quality.max_size = Q_atoi(Cmd_Argv(3));
+   }
+   lens.changed = true;
+}
+
+static void cmd_mipbias(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_mipbias <max>: let plates the lens shrinks use smaller texture mips, up to <max> times sooner (1 = off)\n");
+      Con_Printf("Currently: %f\n", globe.quality.max_mipscale);
+      int i;
+      for (i=0; lens_front.valid && i<lens_front.numplates; ++i) {
+         Con_Printf("   plate %d: %f\n", i, lens_front.mipscale[i]);
+      }
+      return;
+   }
+
+   double max = Q_atof(Cmd_Argv(1));
+   globe.quality.max_mipscale = max < 1 ? 1 : max;
+   if (lens_front.valid) {
+      calc_plate_mipscales();
+   }
+}
+
+static void cmd_platefit(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_platefit <0|1> [margin]: narrow each plate's FOV to the part the lens uses\n");
+      Con_Printf("   (margin is a fraction of that part's half-width)\n");
+      Con_Printf("Currently: %d %f\n", globe.quality.fit, globe.quality.fit_margin);
+      int i;
+      for (i=0; i<globe.numplates; ++i) {
+         Con_Printf("   plate %d: %f of %f degrees\n", i,
+            globe.plates[i].fov * 180 / M_PI, globe.plates[i].max_fov * 180 / M_PI);
+      }
+      return;
+   }
+
+   globe.quality.fit = Q_atoi(Cmd_Argv(1)) != 0;
+   if (Cmd_Argc() >= 3) {
+      double margin = Q_atof(Cmd_Argv(2));
+      globe.quality.fit_margin = margin < 0 ? 0 : margin;
+   }
+   lens.changed = true;
+}
+
+static void cmd_lensswap(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lensswap <0|1>: keep showing the old lens until the new one is built (0 = show it as it is built)\n");
+      Con_Printf("Currently: %d\n", lens_builder.swap);
+      return;
+   }
+
+   lens_builder.swap = Q_atoi(Cmd_Argv(1)) != 0;
+}
+
+static void cmd_lenscache_mb(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lenscache_mb <megabytes>: memory for keeping finished lensmaps (0 = none)\n");
+      Con_Printf("Currently: %d (%d lensmaps kept)\n", lens_lru.budget_mb, lens_lru.count);
+      return;
+   }
+
+   lens_lru.budget_mb = Q_atoi(Cmd_Argv(1));
+   if (lens_lru.budget_mb < 0) lens_lru.budget_mb = 0;
+   trim_lens_lru();
+}
+
+static void cmd_memlimit_mb(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_memlimit_mb <mb>: keep the fisheye buffers under this, with smaller plates and fewer cached lenses (0 = no limit)\n");
+      Con_Printf("Currently: %d\n", fmem.limit_mb);
+      return;
+   }
+
+   fmem.limit_mb = Q_atoi(Cmd_Argv(1));
+   if (fmem.limit_mb < 0) fmem.limit_mb = 0;
+
+   // (try the wanted plate size again)
+   fmem.failed_platesize = 0;
+   trim_lens_lru();
+}
+
+static void cmd_meminfo(void)
+{
+   const double mb = 1024.0 * 1024.0;
+   int i;
+
+   Con_Printf("fisheye memory: %.1f MB (peak %.1f MB)", fmem.total / mb, fmem.peak_total / mb);
+   if (fmem.limit_mb > 0) {
+      Con_Printf(", limit %d MB", fmem.limit_mb);
+   }
+   Con_Printf("\n");
+   for (i=0; i<NUM_FMEM; ++i) {
+      Con_Printf("  %-12s %7.1f MB in %3d buffers (peak %.1f MB)\n", fmem_names[i],
+            fmem.bytes[i] / mb, fmem.count[i], fmem.peak[i] / mb);
+   }
+   for (i=0; i<SYS_NUMPAGES; ++i) {
+      if (fmem.pages[i]) {
+         Con_Printf("  %7.1f MB of big buffers on %s\n", fmem.pages[i] / mb, sys_pagenames[i]);
+      }
+   }
+   Con_Printf("%d lensmaps cached, budget %.1f MB\n", lens_lru.count, lens_lru_budget() / mb);
+   Con_Printf("plates of %d", globe.platesize);
+   if (globe.platesize < fmem.wanted_platesize) {
+      Con_Printf(" (%d wanted, %s)", fmem.wanted_platesize,
+            fmem.failed_platesize ? "out of memory" : "limited by f_memlimit_mb");
+   }
+   Con_Printf("\n");
+}
+
+static void cmd_platerate(void)
+{
+   int i;
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_platerate <frames> [plate]: render plates every <frames> frames (0 = by lens usage)\n");
+      for (i=0; i<globe.numplates; ++i) {
+         Con_Printf("   plate %d: %d (every %d)\n", i, plate_schedule.rate[i], plate_rate(i));
+      }
+      Con_Printf("%.2f plates rendered per frame\n", plate_schedule.renders_per_frame);
+      return;
+   }
+
+   int rate = Q_atoi(Cmd_Argv(1));
+   if (rate < 0) rate = 0;
+   if (Cmd_Argc() >= 3) {
+      i = Q_atoi(Cmd_Argv(2));
+      if (i < 0 || i >= MAX_PLATES) {
+         Con_Printf("plate must be from 0 to %d\n", MAX_PLATES-1);
+         return;
+      }
+      plate_schedule.rate[i] = rate;
+   }
+   else {
+      for (i=0; i<MAX_PLATES; ++i) {
+         plate_schedule.rate[i] = rate;
+      }
+   }
+   refresh_all_plates();
+}
+
+static void cmd_benchmark(void)
+{
+   if (Cmd_Argc() >= 2 && !strcmp(Cmd_Argv(1), "stop")) {
+      if (benchmark.active) {
+         end_benchmark();
+      }
+      return;
+   }
+   if (Cmd_Argc() < 4) {
+      Con_Printf("f_benchmark <lens,..> <globe,..> <fov,..> [frames=100]: build and time each\n");
+      Con_Printf("   combination at this resolution, written to benchmark.csv\n");
+      Con_Printf("f_benchmark stop: end the benchmark early\n");
+      return;
+   }
+   if (benchmark.active) {
+      Con_Printf("f_benchmark is already running\n");
+      return;
+   }
+   if (!fisheye_enabled) {
+      Con_Printf("f_benchmark needs fisheye 1\n");
+      return;
+   }
+
+   int i;
+   char fovs[BENCH_MAX][50];
+   benchmark.numlenses = split_benchmark_list(Cmd_Argv(1), benchmark.lenses, BENCH_MAX);
+   benchmark.numglobes = split_benchmark_list(Cmd_Argv(2), benchmark.globes, BENCH_MAX);
+   benchmark.numfovs = split_benchmark_list(Cmd_Argv(3), fovs, BENCH_MAX);
+   for (i=0; i<benchmark.numfovs; ++i) {
+      benchmark.fovs[i] = Q_atoi(fovs[i]);
+   }
+   benchmark.frames = Cmd_Argc() >= 5 ? Q_atoi(Cmd_Argv(4)) : 100;
+   if (benchmark.frames < 1) benchmark.frames = 1;
+   if (!benchmark.numlenses || !benchmark.numglobes || !benchmark.numfovs) {
+      Con_Printf("f_benchmark needs at least one lens, globe and FOV\n");
+      return;
+   }
+
+   char filename[MAX_OSPATH];
+   snprintf(filename, sizeof(filename), "%s/benchmark.csv", com_gamedir);
+   benchmark.file = fopen(filename, "w");
+   if (!benchmark.file) {
+      Con_Printf("f_benchmark: could not open %s\n", filename);
+      return;
+   }
+   fprintf(benchmark.file, "lens,globe,fov,width,height,valid,build_ms,lua_inverse,lua_forward,lua_globe_plate,plates,texels,plate_ms,lensmap_ms\n");
+
+   strcpy(benchmark.saved.lens, lens.name);
+   strcpy(benchmark.saved.globe, globe.name);
+   benchmark.saved.choice = globe.choice.enabled;
+   benchmark.saved.floor = globe.choice.floor;
+   benchmark.saved.zoom_type = zoom.type;
+   benchmark.saved.zoom_fov = zoom.fov;
+
+   stop_lens_prefetch();
+   benchmark.index = 0;
+   benchmark.phase = BENCH_APPLY;
+   benchmark.active = true;
+}
+
+static void cmd_latelatch(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_latelatch <0|1>: turn the lens by the mouse movement made while the plates were rendered\n");
+      Con_Printf("Currently: %d\n", lens_latch.enabled);
+      return;
+   }
+
+   lens_latch.enabled = Q_atoi(Cmd_Argv(1)) != 0;
+   refresh_all_plates();
+}
+
+static void cmd_reproject(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_reproject <frames>: draw this many frames from the last globe, moved to the new view, between renders of it (0 = off)\n");
+      Con_Printf("Currently: %d\n", lens_reproject.frames);
+      return;
+   }
+
+   int frames = Q_atoi(Cmd_Argv(1));
+   lens_reproject.frames = frames > 0 ? frames : 0;
+   lens_reproject.age = -1;
+   if (!lens_reproject.frames) {
+      fmem_free(globe.depth);
+      globe.depth = NULL;
+   }
+   refresh_all_plates();
+}
+
+static void cmd_lensstats(void)
+{
+   if (Cmd_Argc() > 1 && (strcmp(Cmd_Argv(1), "heatmap") || Cmd_Argc() < 3)) {
+      Con_Printf("f_lensstats [heatmap <name>]: show how the lensmap samples the plates, and how well it compresses into spans\n");
+      Con_Printf("   (heatmap saves the lens pixels per plate pixel as <name><plate>.pcx)\n");
+      return;
+   }
+
+   if (!lens_front.valid) {
+      Con_Printf("The lensmap is not finished yet\n");
+      return;
+   }
+
+   print_lens_sampling(Cmd_Argc() > 2 ? Cmd_Argv(2) : NULL);
+
+   if (!lens_spans.ready) {
+      return;
+   }
+
+   int *counts = lens_spans.counts;
+   int total = counts[SPAN_RUN] + counts[SPAN_STRIDED] + counts[SPAN_SCATTERED];
+   if (total == 0 || lens_spans.numspans == 0) {
+      return;
+   }
+
+   Con_Printf("%d spans, %.1f pixels per span\n", lens_spans.numspans, (double)total / lens_spans.numspans);
+   Con_Printf("  contiguous: %5.1f%%\n", 100.0 * counts[SPAN_RUN] / total);
+   Con_Printf("  strided:    %5.1f%%\n", 100.0 * counts[SPAN_STRIDED] / total);
+   Con_Printf("  scattered:  %5.1f%%\n", 100.0 * counts[SPAN_SCATTERED] / total);
+   Con_Printf("%.1f%% of the lens unmapped (cleared each frame) in %d gaps\n",
+         100.0 * lens_spans.gapcount / (total + lens_spans.gapcount), lens_spans.numgaps);
+}
+
+// print how many lens pixels fall on each plate pixel of the lens on screen,
+// and save them as images if a name is given
+//    (the heatmap is black for plate pixels that are rendered but never
+//     shown, brighter for more lens pixels, and masked outside the scissor)
+static void print_lens_sampling(const char *heatmap)
+{
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+   int area = lens.width_px * lens.height_px;
+   int i, x, y;
+
+   unsigned short *hits = fmem_alloc(FMEM_OTHER, lens_front.numplates * platearea * sizeof(unsigned short));
+   if (!hits) {
+      Con_Printf("f_lensstats: not enough memory\n");
+      return;
+   }
+   memset(hits, 0, lens_front.numplates * platearea * sizeof(unsigned short));
+
+   int unmapped = 0;
+   for (i=0; i<area; ++i) {
+      unsigned pixel = lens_front.pixels[i];
+      if (pixel == LENSPIXEL_NONE) {
+         ++unmapped;
+      }
+      else if (pixel < (unsigned)(lens_front.numplates * platearea) && hits[pixel] < 0xffff) {
+         ++hits[pixel];
+      }
+   }
+
+   long long rendered_total = 0;
+   Con_Printf("plate  rendered      used  pixels/texel (min mean max)\n");
+   for (i=0; i<lens_front.numplates; ++i) {
+      const struct _plate *plate = &lens_front.plates[i];
+      const vrect_t *rect = &plate->scissor;
+      const unsigned short *h = hits + i*platearea;
+      int used = 0, lo = 0, hi = 0;
+      long long sum = 0;
+
+      if (!plate->display) {
+         Con_Printf("%5d  %8s\n", i, "unused");
+         continue;
+      }
+      for (y=rect->y; y<rect->y+rect->height; ++y) {
+         for (x=rect->x; x<rect->x+rect->width; ++x) {
+            int n = h[x + y*platesize];
+            if (n) {
+               if (!used || n < lo) lo = n;
+               if (n > hi) hi = n;
+               sum += n;
+               ++used;
+            }
+         }
+      }
+
+      int rendered = rect->width * rect->height;
+      rendered_total += rendered;
+      Con_Printf("%5d  %8d  %8d  %4d %6.2f %4d  (%.0f%% used)\n", i, rendered, used,
+            lo, used ? (double)sum / used : 0.0, hi, rendered ? 100.0 * used / rendered : 0.0);
+
+      if (heatmap) {
+         byte *pixels = fmem_alloc(FMEM_OTHER, plate->size * plate->height);
+         if (!pixels) {
+            Con_Printf("f_lensstats: not enough memory for the heatmap\n");
+            heatmap = NULL;
+            continue;
+         }
+         for (y=0; y<plate->height; ++y) {
+            for (x=0; x<plate->size; ++x) {
+               int n = h[x + y*platesize];
+               qboolean inside = x >= rect->x && x < rect->x+rect->width && y >= rect->y && y < rect->y+rect->height;
+               // (the first row of the palette is a gray ramp)
+               pixels[x + y*plate->size] = !inside ? 0xFE : n == 0 ? 0 : n >= 12 ? 15 : 3 + n;
+            }
+         }
+         char filename[MAX_OSPATH];
+         snprintf(filename, sizeof(filename), "%s%d.pcx", heatmap, i);
+         IMG_SaveAsync(filename, IMG_PCX, pixels, plate->size, plate->height, plate->size, 1, host_basepal, false);
+         fmem_free(pixels);
+      }
+   }
+
+   int shown = area - unmapped;
+   Con_Printf("%.1f%% of the lens unmapped\n", area ? 100.0 * unmapped / area : 0.0);
+   Con_Printf("%lld plate pixels rendered for %d lens pixels shown (%.2f per lens pixel)\n",
+         rendered_total, shown, shown ? (double)rendered_total / shown : 0.0);
+
+   fmem_free(hits);
+}
+
+static void cmd_lensfilter(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lensfilter <0|1>: blend four plate pixels into each lens pixel where the lens shrinks the plates\n");
+      Con_Printf("Currently: %d\n", lens_filter.enabled);
+      return;
+   }
+
+   lens_filter.enabled = Q_atoi(Cmd_Argv(1)) != 0;
+   plate_schedule.still = false;
+#ifdef GLQUAKE
+   Con_Printf("f_lensfilter only affects the software renderer\n");
+#endif
+}
+
+static void cmd_lenssky(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lenssky <0|1>: draw the sky from the lens rays instead of in each plate\n");
+      Con_Printf("Currently: %d\n", lens_sky.enabled);
+      return;
+   }
+
+   lens_sky.enabled = Q_atoi(Cmd_Argv(1)) != 0;
+   refresh_all_plates();
+#ifdef GLQUAKE
+   Con_Printf("f_lenssky only affects the software renderer\n");
+#endif
+}
+
+static void cmd_stereo(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_stereo <off|side|anaglyph> [separation]: render a globe for each eye, drawn side by side or red/cyan\n");
+      Con_Printf("Currently: %s %f\n", stereo.mode == STEREO_SIDE ? "side" : stereo.mode == STEREO_ANAGLYPH ? "anaglyph" : "off", stereo.separation);
+      return;
+   }
+
+   const char *mode = Cmd_Argv(1);
+   if (!strcmp(mode, "side")) {
+      stereo.mode = STEREO_SIDE;
+   }
+   else if (!strcmp(mode, "anaglyph")) {
+      stereo.mode = STEREO_ANAGLYPH;
+   }
+   else {
+      stereo.mode = STEREO_OFF;
+   }
+   if (Cmd_Argc() > 2) {
+      stereo.separation = Q_atof(Cmd_Argv(2));
+   }
+   if (stereo.mode == STEREO_OFF) {
+      fmem_free(stereo.pixels);
+      stereo.pixels = NULL;
+   }
+   refresh_all_plates();
+#ifdef GLQUAKE
+   stereo.mode = STEREO_OFF;
+   Con_Printf("f_stereo is only supported in the software renderer\n");
+#endif
+}
+
+static void cmd_hotreload(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_hotreload <0|1>: reload the lens and globe scripts when their contents change\n");
+      Con_Printf("Currently: %d\n", script_watch.enabled);
+      return;
+   }
+
+   script_watch.enabled = Q_atoi(Cmd_Argv(1)) != 0;
+
+   // (the scripts as they are now are the ones in use)
+   memset(&script_watch.lens, 0, sizeof(script_watch.lens));
+   memset(&script_watch.globe, 0, sizeof(script_watch.globe));
+   script_watch.next_check = 0;
+}
+
+static void cmd_lenstiles(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_lenstiles <size>: draw the lens in size x size tiles ordered by the plate pixels they read (0 = in rows)\n");
+      Con_Printf("f_lenstiles compare [repeats]: time both orders and estimate their cache misses\n");
+      Con_Printf("Currently: %d\n", lens_tiles.size);
+      return;
+   }
+
+   if (!strcmp(Cmd_Argv(1), "compare")) {
+#ifdef GLQUAKE
+      Con_Printf("f_lenstiles only affects the software renderer\n");
+#else
+      if (!lens_spans.ready) {
+         Con_Printf("The lensmap is not finished yet\n");
+         return;
+      }
+      // (run on the next frame, when the plates are ready to draw)
+      lens_tiles.compare = Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 20;
+      if (lens_tiles.compare < 1) lens_tiles.compare = 1;
+#endif
+      return;
+   }
+
+   int size = Q_atoi(Cmd_Argv(1));
+   if (size < 0) size = 0;
+   if (size > MAX_LENS_TILESIZE) size = MAX_LENS_TILESIZE;
+   lens_tiles.size = size;
+
+   // the lensmap on screen keeps its spans, only its tiles change
+   if (lens_spans.ready && lens_front.valid) {
+      build_lens_tiles(lens_front.pixels);
+   }
+}
+
+static void cmd_help(void)
+{
+   Con_Printf("-----------------------------\n");
+   Con_Printf("Welcome to the FISHEYE ADDON!\n");
+   Con_Printf("-> fisheye 1    (ENABLE)\n");
+   Con_Printf("-> fisheye 0    (DISABLE)\n");
+   Con_Printf("\n");
+   Con_Printf("-> f_lens <tab>    (CHANGE LENS)\n");
+   Con_Printf("-> f_fov <degrees> (SET FOV)\n");
+   Con_Printf("\n");
+   Con_Printf("-> f_<tab>         (MORE COMMANDS)\n");
+   Con_Printf("-----------------------------\n");
+}
+
+static void cmd_fov(void)
+{
+   if (Cmd_Argc() < 2) { // no fov given
+      Con_Printf("f_fov <degrees>: set horizontal FOV\n");
+      print_zoom();
+      return;
+   }
+
+   clear_zoom();
+
+   zoom.type = ZOOM_FOV;
+   zoom.fov = (int)Q_atof(Cmd_Argv(1)); // will return 0 if not valid
+}
+
+static void cmd_vfov(void)
+{
+   if (Cmd_Argc() < 2) { // no fov given
+      Con_Printf("f_vfov <degrees>: set vertical FOV\n");
+      print_zoom();
+      return;
+   }
+
+   clear_zoom();
+
+   zoom.type = ZOOM_VFOV;
+   zoom.fov = (int)Q_atof(Cmd_Argv(1)); // will return 0 if not valid
+}
+
+// lens command
+static void cmd_lens(void)
+{
+   // put the current lens back if a shortcut lens is being prefetched
+   stop_lens_prefetch();
+
+   if (Cmd_Argc() < 2) { // no lens name given
+      Con_Printf("f_lens <name>: use a new lens\n");
+      Con_Printf("Currently: %s\n", lens.name);
+      return;
+   }
+
+   // get name
+   strcpy(lens.name, Cmd_Argv(1));
+
+   // Display name
+   Con_Printf("f_lens %s", lens.name);
+
+   // load lens
+   reload_lens();
+
+   // execute the lens' onload command string if given
+   // (this is to provide a user-friendly default view of the lens (e.g. "f_fov 180"))
+   lua_getglobal(lua, "onload");
+   if (lua_isstring(lua, -1))
+   {
+      const char* onload = lua_tostring(lua, -1);
+      exec_command(onload);
+
+      // display onload
+      Con_Printf("; %s\n", onload);
+   }
+   else {
+      // fail silently for now, resulting from two cases:
+      // 1. onload is nil (undefined)
+      // 2. onload is not a string
+      Con_Printf("\n");
+   }
+   lua_pop(lua, 1); // pop "onload"
+}
+
+// load the lens named in lens.name and rebuild its lensmap
+static qboolean reload_lens(void)
+{
+   // trigger change
+   lens.changed = true;
+   stop_lens_workers();
+
+   lens.valid = LUA_load_lens();
+   if (!lens.valid) {
+      strcpy(lens.name,"");
+      Con_Printf("not a valid lens\n");
+   }
+   return lens.valid;
+}
+
+// autocompletion for lens names
+static struct stree_root * cmdarg_lens(const char *arg)
+{
+   struct stree_root *root;
+
+   root = Z_Malloc(sizeof(struct stree_root));
+   if (root) {
+      *root = STREE_ROOT;
+
+      STree_AllocInit();
+      COM_ScanDir(root, "../lua-scripts/lenses", arg, ".lua", true);
+   }
+   return root;
+}
+
+static void cmd_saveglobe(void)
+{
+   if (Cmd_Argc() < 2) { // no file name given
+      Con_Printf("f_saveglobe <name> [full flag=0]: screenshot the globe plates\n");
+      return;
+   }
+
+   strncpy(globe.save.name, Cmd_Argv(1), 32);
+
+   if (Cmd_Argc() >= 3) {
+      globe.save.with_margins = Q_atoi(Cmd_Argv(2));
+   }
+   else {
+      globe.save.with_margins = 0;
+   }
+   globe.save.should = true;
+}
+
+static void cmd_globe(void)
+{
+   if (Cmd_Argc() < 2) { // no globe name given
+      Con_Printf("f_globe <name>: use a new globe\n");
+      Con_Printf("f_globe auto [floor]: use the globe rendering the fewest plates\n");
+      Con_Printf("   that still gives [floor] plate pixels per screen pixel (default 0.5)\n");
+      Con_Printf("Currently: %s%s\n", globe.choice.enabled ? "auto, " : "", globe.name);
+      return;
+   }
+
+   if (!strcmp(Cmd_Argv(1), "auto")) {
+      globe.choice.enabled = true;
+      globe.choice.chosen = false;
+      if (Cmd_Argc() > 2 && Q_atof(Cmd_Argv(2)) > 0) {
+         globe.choice.floor = Q_atof(Cmd_Argv(2));
+      }
+      Con_Printf("f_globe auto %g\n", globe.choice.floor);
+
+      // the lens is built on the current globe until its rays are known
+      if (globe.valid) {
+         return;
+      }
+      exec_command("f_globe cube");
+      globe.choice.enabled = true;
+      return;
+   }
+   globe.choice.enabled = false;
+
+   // get name
+   strcpy(globe.name, Cmd_Argv(1));
+
+   // display name
+   Con_Printf("f_globe %s\n", globe.name);
+
+   // load globe
+   reload_globe();
+}
+
+// load the globe named in globe.name and rebuild the lensmap on it
+static qboolean reload_globe(void)
+{
+   // trigger change
+   globe.changed = true;
+   stop_lens_workers();
+
+   plate_lut.ready = false;
+   globe.valid = LUA_load_globe();
+   if (!globe.valid) {
+      strcpy(globe.name,"");
+      Con_Printf("not a valid globe\n");
+   }
+   else {
+      build_plate_lut();
+   }
+   return globe.valid;
+}
+
+// autocompletion for globe names
+static struct stree_root * cmdarg_globe(const char *arg)
+{
+   struct stree_root *root;
+
+   root = Z_Malloc(sizeof(struct stree_root));
+   if (root) {
+      *root = STREE_ROOT;
+
+      STree_AllocInit();
+      COM_ScanDir(root, "../lua-scripts/globes", arg, ".lua", true);
+   }
+   return root;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                    PURE COORDINATE CONVERTERS                                |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void latlon_to_ray(double lat, double lon, vec3_t ray)
+{
+   double clat = cos(lat);
+   ray[0] = sin(lon)*clat;
+   ray[1] = sin(lat);
+   ray[2] = cos(lon)*clat;
+}
+
+static void ray_to_latlon(vec3_t ray, double *lat, double *lon)
+{
+   *lon = atan2(ray[0], ray[2]);
+   *lat = atan2(ray[1], sqrt(ray[0]*ray[0]+ray[2]*ray[2]));
+}
+
+static void plate_uv_to_ray(int plate_index, double u, double v, vec3_t ray)
+{
+   // transform to image coordinates
+   u -= 0.5;
+   v -= 0.5;
+   v = -v;
+
+   // clear ray
+   ray[0] = ray[1] = ray[2] = 0;
+
+   // get euclidean coordinate from texture uv
+   VectorMA(ray, globe.plates[plate_index].dist, globe.plates[plate_index].forward, ray);
+   VectorMA(ray, u, globe.plates[plate_index].right, ray);
+   VectorMA(ray, v * globe.plates[plate_index].aspect, globe.plates[plate_index].up, ray);
+
+   VectorNormalize(ray);
+}
+
+// give a plate a width, and the height its aspect makes, that fit in the
+// platesize*platesize pixels reserved for it in the globe
+static void set_plate_size(struct _plate *plate, int size)
+{
+   if (plate->aspect <= 0) {
+      plate->aspect = 1;
+   }
+   if (size * plate->aspect > globe.platesize) {
+      size = (int)(globe.platesize / plate->aspect);
+   }
+   if (size < 1) {
+      size = 1;
+   }
+   plate->size = size;
+   plate->height = (int)(size * plate->aspect + 0.5);
+   if (plate->height < 1) plate->height = 1;
+   if (plate->height > globe.platesize) plate->height = globe.platesize;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LUA INITIALIZER                                    |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+#ifdef USE_LUAJIT
+// lens_inverse over a row of pixels, for lenses without a lens_inverse_row.
+// The loop runs in Lua, where the JIT compiles it along with lens_inverse,
+// and the rays go straight into the caller's vec3_t (three floats) array
+// through the FFI, rather than back over the stack three numbers at a time.
+// Returns 0, or the (1-based) pixel lens_inverse gave something odd for.
+static const char *lens_inverse_ffi_source =
+   "local ffi = require('ffi')\n"
+   "local type = type\n"
+   "return function(f, y, x0, dx, n, rays, valid)\n"
+   "   rays = ffi.cast('float *', rays)\n"
+   "   valid = ffi.cast('unsigned char *', valid)\n"
+   "   for i = 0, n-1 do\n"
+   "      local rx, ry, rz = f(x0 + i*dx, y)\n"
+   "      if rx == nil then\n"
+   "         valid[i] = 0\n"
+   "      elseif type(rx) == 'number' and type(ry) == 'number' and type(rz) == 'number' then\n"
+   "         rays[3*i], rays[3*i+1], rays[3*i+2] = rx, ry, rz\n"
+   "         valid[i] = 1\n"
+   "      else\n"
+   "         return i+1\n"
+   "      end\n"
+   "   end\n"
+   "   return 0\n"
+   "end\n";
+#endif
+
+static void init_lua(void)
+{
+   lua = create_lua_state();
+}
+
+// create a Lua state with our aliases and C functions
+static lua_State *create_lua_state(void)
+{
+   // create Lua state
+   lua_State *lua = luaL_newstate();
+
+   // open Lua standard libraries
+   luaL_openlibs(lua);
+
+   char *aliases = 
+      "cos = math.cos\n"
+      "sin = math.sin\n"
+      "tan = math.tan\n"
+      "asin = math.asin\n"
+      "acos = math.acos\n"
+      "atan = math.atan\n"
+      "atan2 = math.atan2\n"
+      "sinh = math.sinh\n"
+      "cosh = math.cosh\n"
+      "tanh = math.tanh\n"
+      "log = math.log\n"
+      "log10 = math.log10\n"
+      "abs = math.abs\n"
+      "sqrt = math.sqrt\n"
+      "exp = math.exp\n"
+      "pi = math.pi\n"
+      "tau = math.pi*2\n"
+      "pow = math.pow\n";
+
+   int error = luaL_loadbuffer(lua, aliases, strlen(aliases), "aliases") ||
+      lua_pcall(lua, 0, 0, 0);
+   if (error) {
+      fprintf(stderr, "%s", lua_tostring(lua, -1));
+      lua_pop(lua, 1);  // pop error message from the stack
+   }
+
+   lua_pushcfunction(lua, CtoLUA_latlon_to_ray);
+   lua_setglobal(lua, "latlon_to_ray");
+
+   lua_pushcfunction(lua, CtoLUA_ray_to_latlon);
+   lua_setglobal(lua, "ray_to_latlon");
+
+   lua_pushcfunction(lua, CtoLUA_plate_to_ray);
+   lua_setglobal(lua, "plate_to_ray");
+
+   // (the state is made on the thread that will use it, so its refs are ours)
+   lua_refs.lens_inverse_ffi = -1;
+#ifdef USE_LUAJIT
+   error = luaL_loadbuffer(lua, lens_inverse_ffi_source, strlen(lens_inverse_ffi_source), "lens_inverse_ffi") ||
+      lua_pcall(lua, 0, 1, 0);
+   if (error) {
+      fprintf(stderr, "%s", lua_tostring(lua, -1));
+      lua_pop(lua, 1);  // pop error message from the stack
+   }
+   else {
+      lua_refs.lens_inverse_ffi = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+#endif
+
+   return lua;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           ZOOM FUNCTIONS                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void clear_zoom(void)
+{
+   zoom.type = ZOOM_NONE;
+   zoom.fov = 0;
+   zoom.changed = true; // trigger change
+}
+
+static void print_zoom(void)
+{
+   Con_Printf("Zoom currently: ");
+   switch (zoom.type) {
+      case ZOOM_FOV:     Con_Printf("f_fov %d", zoom.fov); break;
+      case ZOOM_VFOV:    Con_Printf("f_vfov %d", zoom.fov); break;
+      case ZOOM_COVER:   Con_Printf("f_cover"); break;
+      case ZOOM_CONTAIN: Con_Printf("f_contain"); break;
+      default:           Con_Printf("none");
+   }
+   Con_Printf("\n");
+}
+
+// print why the lens can not be zoomed
+// (quietly, for lenses that are only being prefetched)
+static void zoom_error(const char *fmt, ...)
+{
+   va_list argptr;
+   char msg[256];
+
+   if (lens_prefetch.working) {
+      return;
+   }
+
+   va_start(argptr, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, argptr);
+   va_end(argptr);
+   Con_Printf("%s", msg);
+}
+
+static qboolean calc_zoom(void)
+{
+   // clear lens scale
+   lens.scale = -1;
+
+   if (zoom.type == ZOOM_FOV || zoom.type == ZOOM_VFOV)
+   {
+      // check FOV limits
+      if (zoom.max_fov <= 0 || zoom.max_vfov <= 0)
+      {
+         zoom_error("max_fov & max_vfov not specified, try \"f_cover\"\n");
+         return false;
+      }
+      else if (zoom.type == ZOOM_FOV && zoom.fov > zoom.max_fov) {
+         zoom_error("fov must be less than %d\n", zoom.max_fov);
+         return false;
+      }
+      else if (zoom.type == ZOOM_VFOV && zoom.fov > zoom.max_vfov) {
+         zoom_error("vfov must be less than %d\n", zoom.max_vfov);
+         return false;
+      }
+
+      // try to scale based on FOV using the forward map
+      if (has_lens_forward()) {
+         vec3_t ray;
+         double x,y;
+         double fovr = zoom.fov * M_PI / 180;
+         if (zoom.type == ZOOM_FOV) {
+            latlon_to_ray(0,fovr*0.5,ray);
+            if (map_lens_forward(ray,&x,&y)) {
+               lens.scale = x / (lens.width_px * 0.5);
+            }
+            else {
+               zoom_error("ray_to_xy did not return a valid r value for determining FOV scale\n");
+               return false;
+            }
+         }
+         else if (zoom.type == ZOOM_VFOV) {
+            latlon_to_ray(fovr*0.5,0,ray);
+            if (map_lens_forward(ray,&x,&y)) {
+               lens.scale = y / (lens.height_px * 0.5);
+            }
+            else {
+               zoom_error("ray_to_xy did not return a valid r value for determining FOV scale\n");
+               return false;
+            }
+         }
+      }
+      else
+      {
+         zoom_error("Please specify a forward mapping function in your script for FOV scaling\n");
+         return false;
+      }
+   }
+   else if (zoom.type == ZOOM_CONTAIN || zoom.type == ZOOM_COVER) { // scale based on fitting
+
+      double fit_width_scale = lens.width / lens.width_px;
+      double fit_height_scale = lens.height / lens.height_px;
+
+      qboolean width_provided = (lens.width > 0);
+      qboolean height_provided = (lens.height > 0);
+
+      if (!width_provided && height_provided) {
+         lens.scale = fit_height_scale;
+      }
+      else if (width_provided && !height_provided) {
+         lens.scale = fit_width_scale;
+      }
+      else if (!width_provided && !height_provided) {
+         zoom_error("neither lens_height nor lens_width are valid/specified.  Try f_fov instead.\n");
+         return false;
+      }
+      else {
+         double lens_aspect = lens.width / lens.height;
+         double screen_aspect = (double)lens.width_px / lens.height_px;
+         qboolean lens_wider = lens_aspect > screen_aspect;
+
+         if (zoom.type == ZOOM_CONTAIN) {
+            lens.scale = lens_wider ? fit_width_scale : fit_height_scale;
+         }
+         else if (zoom.type == ZOOM_COVER) {
+            lens.scale = lens_wider ? fit_height_scale : fit_width_scale;
+         }
+      }
+   }
+
+   // validate scale
+   if (lens.scale <= 0) {
+      zoom_error("init returned a scale of %f, which is  <= 0\n", lens.scale);
+      return false;
+   }
+
+   return true;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           GLOBE SAVER FUNCTIONS                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+#ifndef GLQUAKE
+
+// copy a plate, masking its margins unless they are wanted, and queue it
+// to be written in the background
+static void save_plate(const char *filename, int plate_index, int with_margins, imgformat_t format)
+{
+   int width = globe.plates[plate_index].size;
+   int height = globe.plates[plate_index].height;
+   byte *data = GLOBEPIXEL(plate_index,0,0);
+   byte *pixels, *out;
+   int i, j;
+
+   pixels = fmem_alloc(FMEM_OTHER, width * height);
+   if (!pixels) {
+      Con_Printf("save_plate: not enough memory\n");
+      return;
+   }
+
+   out = pixels;
+   for (i=0; i<height; ++i) {
+      double v = ((double)i)/height;
+      for (j=0; j<width; ++j) {
+         double u = ((double)j)/width;
+         vec3_t ray;
+         plate_uv_to_ray(plate_index, u, v, ray);
+         *out++ = with_margins || plate_index == ray_to_plate_index(ray) ? data[j] : 0xFE;
+      }
+      data += globe.platesize;
+   }
+
+   IMG_SaveAsync(filename, format, pixels, width, height, width, 1, host_basepal, false);
+   fmem_free(pixels);
+}
+
+static void save_globe(void)
+{
+   int i;
+   char name[32];
+   imgformat_t format = SCR_ShotFormat();
+
+   globe.save.should = false;
+
+    D_EnableBackBufferAccess();	// enable direct drawing of console to back
+
+   for (i=0; i<globe.numplates; ++i) 
+   {
+      snprintf(name, 32, "%s%d.%s", globe.save.name, i, IMG_Extension(format));
+      save_plate(name, i, globe.save.with_margins, format);
+   }
+
+    D_DisableBackBufferAccess();	// for adapters that can't stay mapped in
+    //  for linear writes all the time
+}
+
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |              C->Lua (c functions for use in lua)                             |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static int CtoLUA_latlon_to_ray(lua_State *L)
+{
+   double lat = luaL_checknumber(L,1);
+   double lon = luaL_checknumber(L,2);
+   vec3_t ray;
+   latlon_to_ray(lat,lon,ray);
+   lua_pushnumber(L, ray[0]);
+   lua_pushnumber(L, ray[1]);
+   lua_pushnumber(L, ray[2]);
+   return 3;
+}
+
+static int CtoLUA_ray_to_latlon(lua_State *L)
+{
+   double rx = luaL_checknumber(L, 1);
+   double ry = luaL_checknumber(L, 2);
+   double rz = luaL_checknumber(L, 3);
+
+   vec3_t ray = {rx,ry,rz};
+   double lat,lon;
+   ray_to_latlon(ray,&lat,&lon);
+
+   lua_pushnumber(L, lat);
+   lua_pushnumber(L, lon);
+   return 2;
+}
+
+static int CtoLUA_plate_to_ray(lua_State *L)
+{
+   int plate_index = luaL_checknumber(L,1);
+   double u = luaL_checknumber(L,2);
+   double v = luaL_checknumber(L,3);
+   vec3_t ray;
+   if (plate_index < 0 || plate_index >= globe.numplates) {
+      lua_pushnil(L);
+      return 1;
+   }
+
+   plate_uv_to_ray(plate_index,u,v,ray);
+   lua_pushnumber(L, ray[0]);
+   lua_pushnumber(L, ray[1]);
+   lua_pushnumber(L, ray[2]);
+   return 3;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                 Lua->C (lua functions for use in c)                          |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static int LUAtoC_lens_inverse(double x, double y, vec3_t ray)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_INVERSE], 1);
+   }
+   int top = lua_gettop(lua);
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_inverse);
+   lua_pushnumber(lua, x);
+   lua_pushnumber(lua, y);
+   lua_call(lua, 2, LUA_MULTRET);
+
+   int numret = lua_gettop(lua) - top;
+   int status;
+
+   switch(numret) {
+      case 3:
+         if (lua_isnumber(lua,-3) && lua_isnumber(lua,-2) && lua_isnumber(lua,-1)) {
+            ray[0] = lua_tonumber(lua, -3);
+            ray[1] = lua_tonumber(lua, -2);
+            ray[2] = lua_tonumber(lua, -1);
+            VectorNormalize(ray);
+            status = 1;
+         }
+         else {
+            lens_error("lens_inverse returned a non-number value for x,y,z\n");
+            status = -1;
+         }
+         break;
+
+      case 1:
+         if (lua_isnil(lua,-1)) {
+            status = 0;
+         }
+         else {
+            status = -1;
+            lens_error("lens_inverse returned a single non-nil value\n");
+         }
+         break;
+
+      default:
+         lens_error("lens_inverse returned %d values instead of 3\n", numret);
+         status = -1;
+   }
+
+   lua_pop(lua, numret);
+   return status;
+}
+
+// calls lens_outline(y), which returns the half width of the image at y
+// (or nil if it misses that row), returns -1 on error
+static int LUAtoC_lens_outline(double y, double *halfwidth)
+{
+   int top = lua_gettop(lua);
+   lua_getglobal(lua, "lens_outline");
+   lua_pushnumber(lua, y);
+   lua_call(lua, 1, LUA_MULTRET);
+
+   int numret = lua_gettop(lua) - top;
+   int status;
+
+   if (numret == 1 && lua_isnumber(lua,-1)) {
+      *halfwidth = lua_tonumber(lua,-1);
+      status = 1;
+   }
+   else if (numret == 1 && lua_isnil(lua,-1)) {
+      status = 0;
+   }
+   else {
+      lens_error("lens_outline must return a number or nil\n");
+      status = -1;
+   }
+
+   lua_pop(lua, numret);
+   return status;
+}
+
+static int LUAtoC_lens_forward(vec3_t ray, double *x, double *y)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_FORWARD], 1);
+   }
+   int top = lua_gettop(lua);
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_forward);
+   lua_pushnumber(lua,ray[0]);
+   lua_pushnumber(lua,ray[1]);
+   lua_pushnumber(lua,ray[2]);
+   lua_call(lua, 3, LUA_MULTRET);
+
+   int numret = lua_gettop(lua) - top;
+   int status;
+
+   switch (numret) {
+      case 2:
+         if (lua_isnumber(lua,-2) && lua_isnumber(lua,-1)) {
+            *x = lua_tonumber(lua, -2);
+            *y = lua_tonumber(lua, -1);
+            status = 1;
+         }
+         else {
+            lens_error("lens_forward returned a non-number value for x,y\n");
+            status = -1;
+         }
+         break;
+
+      case 1:
+         if (lua_isnil(lua,-1)) {
+            status = 0;
+         }
+         else {
+            status = -1;
+            lens_error("lens_forward returned a single non-nil value\n");
+         }
+         break;
+
+      default:
+         lens_error("lens_forward returned %d values instead of 2\n", numret);
+         status = -1;
+   }
+
+   lua_pop(lua,numret);
+   return status;
+}
+
+static int LUAtoC_globe_plate(vec3_t ray, int *plate)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_GLOBE_PLATE], 1);
+   }
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.globe_plate);
+   lua_pushnumber(lua, ray[0]);
+   lua_pushnumber(lua, ray[1]);
+   lua_pushnumber(lua, ray[2]);
+   lua_call(lua, 3, LUA_MULTRET);
+
+   if (!lua_isnumber(lua, -1))
+   {
+      lua_pop(lua,1);
+      return 0;
+   }
+
+   *plate = lua_tointeger(lua,-1);
+   lua_pop(lua,1);
+   return 1;
+}
+
+// calls lens_inverse_row(y, x0, dx, n), which returns three arrays xs, ys, zs
+// holding the rays of the n pixels x0, x0+dx, ... (a nil x means no ray)
+static int LUAtoC_lens_inverse_row(double y, double x0, double dx, int n, vec3_t *rays, byte *valid)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_INVERSE], 1);
+   }
+   int top = lua_gettop(lua);
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_inverse_row);
+   lua_pushnumber(lua, y);
+   lua_pushnumber(lua, x0);
+   lua_pushnumber(lua, dx);
+   lua_pushinteger(lua, n);
+   lua_call(lua, 4, LUA_MULTRET);
+
+   int numret = lua_gettop(lua) - top;
+   if (numret != 3 || !lua_istable(lua,-3) || !lua_istable(lua,-2) || !lua_istable(lua,-1)) {
+      lens_error("lens_inverse_row must return 3 arrays\n");
+      lua_pop(lua, numret);
+      return -1;
+   }
+
+   int i, j;
+   for (i=0; i<n; ++i) {
+      // no ray for this pixel
+      lua_rawgeti(lua, -3, i+1);
+      valid[i] = !lua_isnil(lua,-1);
+      lua_pop(lua,1);
+      if (!valid[i]) {
+         continue;
+      }
+
+      // array j is at stack index j-3
+      for (j=0; j<3; ++j) {
+         lua_rawgeti(lua, j-3, i+1);
+         if (!lua_isnumber(lua,-1)) {
+            lens_error("lens_inverse_row returned a non-number value for pixel %d\n", i+1);
+            lua_pop(lua, 1+numret);
+            return -1;
+         }
+         rays[i][j] = lua_tonumber(lua,-1);
+         lua_pop(lua,1);
+      }
+      VectorNormalize(rays[i]);
+   }
+
+   lua_pop(lua, numret);
+   return 1;
+}
+
+// calls lens_inverse for the n pixels x0, x0+dx, ... of a row, through the
+// FFI helper made in create_lua_state
+static int LUAtoC_lens_inverse_ffi(double y, double x0, double dx, int n, vec3_t *rays, byte *valid)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_INVERSE], 1);
+   }
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_inverse_ffi);
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_inverse);
+   lua_pushnumber(lua, y);
+   lua_pushnumber(lua, x0);
+   lua_pushnumber(lua, dx);
+   lua_pushinteger(lua, n);
+   lua_pushlightuserdata(lua, rays);
+   lua_pushlightuserdata(lua, valid);
+   lua_call(lua, 7, 1);
+
+   int bad = lua_tointeger(lua, -1);
+   lua_pop(lua, 1);
+   if (bad) {
+      lens_error("lens_inverse returned a non-number value for pixel %d\n", bad);
+      return -1;
+   }
+
+   int i;
+   for (i=0; i<n; ++i) {
+      if (valid[i]) {
+         VectorNormalize(rays[i]);
+      }
+   }
+   return 1;
+}
+
+// calls lens_forward_many(xs, ys, zs, n) with n rays, which returns two arrays
+// xs, ys holding the image coordinates of each ray (a nil x means no point)
+static int LUAtoC_lens_forward_many(int n, vec3_t *rays, double *xy, byte *valid)
+{
+   if (benchmark.active) {
+      __sync_fetch_and_add(&benchmark.lua_calls[BENCH_FORWARD], 1);
+   }
+   int i, j;
+   int top = lua_gettop(lua);
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lua_refs.lens_forward_many);
+   for (j=0; j<3; ++j) {
+      lua_createtable(lua, n, 0);
+      for (i=0; i<n; ++i) {
+         lua_pushnumber(lua, rays[i][j]);
+         lua_rawseti(lua, -2, i+1);
+      }
+   }
+   lua_pushinteger(lua, n);
+   lua_call(lua, 4, LUA_MULTRET);
+
+   int numret = lua_gettop(lua) - top;
+   if (numret != 2 || !lua_istable(lua,-2) || !lua_istable(lua,-1)) {
+      lens_error("lens_forward_many must return 2 arrays\n");
+      lua_pop(lua, numret);
+      return -1;
+   }
+
+   for (i=0; i<n; ++i) {
+      lua_rawgeti(lua, -2, i+1);
+      lua_rawgeti(lua, -2, i+1);
+      valid[i] = lua_isnumber(lua,-2) && lua_isnumber(lua,-1);
+      if (valid[i]) {
+         xy[2*i] = lua_tonumber(lua,-2);
+         xy[2*i+1] = lua_tonumber(lua,-1);
+      }
+      else if (!lua_isnil(lua,-2)) {
+         lens_error("lens_forward_many returned a non-number value for point %d\n", i+1);
+         lua_pop(lua, 2+numret);
+         return -1;
+      }
+      lua_pop(lua,2);
+   }
+
+   lua_pop(lua, numret);
+   return 1;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                      NATIVE LENSES AND GLOBES                                |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// script variables used by the native implementations
+// (read once when the script is loaded)
+static struct _native_params {
+   double panini_d;          // "d" in panini.lua
+   double stereo_scale;      // "angleScale" in stereographic.lua
+   double fast_big_fov;      // "big_fov" in fast.lua
+} native_params;
+
+static double get_lua_number(const char *name, double def)
+{
+   lua_getglobal(lua, name);
+   double value = lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : def;
+   lua_pop(lua,1);
+   return value;
+}
+
+static void load_native_params(void)
+{
+   native_params.panini_d = get_lua_number("d", 1);
+   native_params.stereo_scale = get_lua_number("angleScale", 0.5);
+   native_params.fast_big_fov = get_lua_number("big_fov", 160);
+}
+
+// radial lenses map the angle from the forward axis (theta) to a radius
+static int radial_inverse(double x, double y, double theta, vec3_t ray)
+{
+   double r = sqrt(x*x+y*y);
+   if (r == 0) {
+      ray[0] = ray[1] = 0;
+      ray[2] = 1;
+      return 1;
+   }
+   double s = sin(theta);
+   ray[0] = x/r*s;
+   ray[1] = y/r*s;
+   ray[2] = cos(theta);
+   return 1;
+}
+
+static int radial_forward(vec3_t ray, double r, double *x, double *y)
+{
+   double len = sqrt(ray[0]*ray[0]+ray[1]*ray[1]);
+   if (len == 0) {
+      *x = *y = 0;
+      return 1;
+   }
+   double c = r/len;
+   *x = ray[0]*c;
+   *y = ray[1]*c;
+   return 1;
+}
+
+static int latlon_inverse(double lat, double lon, vec3_t ray)
+{
+   latlon_to_ray(lat,lon,ray);
+   return 1;
+}
+
+// rectilinear.lua
+static int rectilinear_inverse(double x, double y, vec3_t ray)
+{
+   return radial_inverse(x, y, atan(sqrt(x*x+y*y)), ray);
+}
+static int rectilinear_forward(vec3_t ray, double *x, double *y)
+{
+   return radial_forward(ray, tan(acos(ray[2])), x, y);
+}
+
+// panini.lua
+static int panini_inverse(double x, double y, vec3_t ray)
+{
+   double d = native_params.panini_d;
+   double k = x*x/((d+1)*(d+1));
+   double dscr = k*k*d*d - (k+1)*(k*d*d-1);
+   double clon = (-k*d+sqrt(dscr))/(k+1);
+   double S = (d+1)/(d+clon);
+   return latlon_inverse(atan2(y,S), atan2(x,S*clon), ray);
+}
+static int panini_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   double S = (native_params.panini_d+1)/(native_params.panini_d+cos(lon));
+   *x = S*sin(lon);
+   *y = S*tan(lat);
+   return 1;
+}
+
+// stereographic.lua
+static int stereographic_inverse(double x, double y, vec3_t ray)
+{
+   return radial_inverse(x, y, atan(sqrt(x*x+y*y))/native_params.stereo_scale, ray);
+}
+static int stereographic_forward(vec3_t ray, double *x, double *y)
+{
+   return radial_forward(ray, tan(acos(ray[2])*native_params.stereo_scale), x, y);
+}
+
+// fisheye1.lua (equidistant)
+static int fisheye1_inverse(double x, double y, vec3_t ray)
+{
+   double r = sqrt(x*x+y*y);
+   if (r > M_PI) {
+      return 0;
+   }
+   return radial_inverse(x, y, r, ray);
+}
+static int fisheye1_forward(vec3_t ray, double *x, double *y)
+{
+   return radial_forward(ray, acos(ray[2]), x, y);
+}
+
+// fisheye2.lua (equisolid)
+static int fisheye2_inverse(double x, double y, vec3_t ray)
+{
+   double r = sqrt(x*x+y*y);
+   if (r > 2) {
+      return 0;
+   }
+   return radial_inverse(x, y, 2*asin(r*0.5), ray);
+}
+static int fisheye2_forward(vec3_t ray, double *x, double *y)
+{
+   return radial_forward(ray, 2*sin(acos(ray[2])*0.5), x, y);
+}
+
+// equirect.lua
+static int equirect_inverse(double x, double y, vec3_t ray)
+{
+   if (fabs(y) > M_PI/2 || fabs(x) > M_PI) {
+      return 0;
+   }
+   return latlon_inverse(y, x, ray);
+}
+static int equirect_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   *x = lon;
+   *y = lat;
+   return 1;
+}
+
+// cylinder.lua
+static int cylinder_inverse(double x, double y, vec3_t ray)
+{
+   if (fabs(x) > M_PI) {
+      return 0;
+   }
+   return latlon_inverse(atan(y), x, ray);
+}
+static int cylinder_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   *x = lon;
+   *y = tan(lat);
+   return 1;
+}
+
+// mercator.lua
+static int mercator_inverse(double x, double y, vec3_t ray)
+{
+   if (fabs(x) > M_PI) {
+      return 0;
+   }
+   return latlon_inverse(atan(sinh(y)), x, ray);
+}
+static int mercator_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   *x = lon;
+   *y = log(tan(M_PI*0.25+lat*0.5));
+   return 1;
+}
+
+// miller.lua
+static int miller_inverse(double x, double y, vec3_t ray)
+{
+   double maxy = 1.25*log(tan(0.25*M_PI+0.4*M_PI*0.5));
+   if (fabs(y) > maxy || fabs(x) > M_PI) {
+      return 0;
+   }
+   return latlon_inverse(5.0/4*atan(sinh(4.0/5*y)), x, ray);
+}
+static int miller_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   *x = lon;
+   *y = 1.25*log(tan(0.25*M_PI+0.4*lat));
+   return 1;
+}
+
+// sinusoidal.lua (forward only)
+static int sinusoidal_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   *x = lon*cos(lat);
+   *y = lat;
+   return 1;
+}
+
+// mollweide.lua
+static int mollweide_inverse(double x, double y, vec3_t ray)
+{
+   if (x*x/8 + y*y/2 > 1) {
+      return 0;
+   }
+   double t = asin(y/M_SQRT2);
+   double lon = M_PI*x/(2*M_SQRT2*cos(t));
+   double lat = asin((2*t+sin(2*t))/M_PI);
+   return latlon_inverse(lat, lon, ray);
+}
+static int mollweide_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+
+   // same iteration as solveTheta in the script
+   double t = lat;
+   double dt;
+   do {
+      dt = -(t + sin(t) - M_PI*sin(lat))/(1+cos(t));
+      t = t+dt;
+   } while (!(dt < 0.001));
+   t /= 2;
+
+   *x = 2*M_SQRT2/M_PI*lon*cos(t);
+   *y = M_SQRT2*sin(t);
+   return 1;
+}
+
+// hammer.lua
+static int hammer_inverse(double x, double y, vec3_t ray)
+{
+   if (x*x/8+y*y/2 > 1) {
+      return 0;
+   }
+   double z = sqrt(1-0.0625*x*x-0.25*y*y);
+   double lon = 2*atan(z*x/(2*(2*z*z-1)));
+   double lat = asin(z*y);
+   return latlon_inverse(lat, lon, ray);
+}
+static int hammer_forward(vec3_t ray, double *x, double *y)
+{
+   double lat, lon;
+   ray_to_latlon(ray,&lat,&lon);
+   double d = sqrt(1+cos(lat)*cos(lon*0.5));
+   *x = 2*M_SQRT2*cos(lat)*sin(lon*0.5) / d;
+   *y = M_SQRT2*sin(lat) / d;
+   return 1;
+}
+
+static const native_lens_t native_lenses[] = {
+   { "rectilinear",   rectilinear_inverse,   rectilinear_forward },
+   { "panini",        panini_inverse,        panini_forward },
+   { "stereographic", stereographic_inverse, stereographic_forward },
+   { "fisheye1",      fisheye1_inverse,      fisheye1_forward },
+   { "fisheye2",      fisheye2_inverse,      fisheye2_forward },
+   { "equirect",      equirect_inverse,      equirect_forward },
+   { "cylinder",      cylinder_inverse,      cylinder_forward },
+   { "mercator",      mercator_inverse,      mercator_forward },
+   { "miller",        miller_inverse,        miller_forward },
+   { "sinusoidal",    NULL,                  sinusoidal_forward },
+   { "mollweide",     mollweide_inverse,     mollweide_forward },
+   { "hammer",        hammer_inverse,        hammer_forward },
+};
+
+// fast.lua
+static int fast_plate(vec3_t ray, int *plate)
+{
+   if (ray[2] <= 0) {
+      return 0;
+   }
+
+   double dist = 0.5 / tan(native_params.fast_big_fov*M_PI/180/2);
+   double size = 2*dist*tan(M_PI/4);
+   double u = ray[0]/ray[2]*dist;
+   double v = ray[1]/ray[2]*dist;
+
+   *plate = (fabs(u) < size/2 && fabs(v) < size/2) ? 0 : 1;
+   return 1;
+}
+
+static const native_globe_t native_globes[] = {
+   { "fast", fast_plate },
+};
+
+// get the native implementation requested by the "native" script variable
+static const char *get_native_name(void)
+{
+   static char name[32];
+   lua_getglobal(lua, "native");
+   if (!lua_isstring(lua, -1)) {
+      lua_pop(lua, 1);
+      return NULL;
+   }
+   snprintf(name, sizeof(name), "%s", lua_tostring(lua, -1));
+   lua_pop(lua, 1);
+   return name;
+}
+
+static const native_lens_t *find_native_lens(void)
+{
+   const char *name = get_native_name();
+   int i;
+   if (!name) {
+      return NULL;
+   }
+   for (i=0; i<sizeof(native_lenses)/sizeof(native_lenses[0]); ++i) {
+      if (!strcmp(native_lenses[i].name, name)) {
+         load_native_params();
+         return &native_lenses[i];
+      }
+   }
+   Con_Printf("unknown native lens \"%s\", using Lua\n", name);
+   return NULL;
+}
+
+static const native_globe_t *find_native_globe(void)
+{
+   const char *name = get_native_name();
+   int i;
+   if (!name) {
+      return NULL;
+   }
+   for (i=0; i<sizeof(native_globes)/sizeof(native_globes[0]); ++i) {
+      if (!strcmp(native_globes[i].name, name)) {
+         load_native_params();
+         return &native_globes[i];
+      }
+   }
+   Con_Printf("unknown native globe \"%s\", using Lua\n", name);
+   return NULL;
+}
+
+// lens mapping, using the native implementation when we have one
+static int map_lens_inverse(double x, double y, vec3_t ray)
+{
+   if (lens.native && lens.native->inverse) {
+      return lens.native->inverse(x, y, ray);
+   }
+   return LUAtoC_lens_inverse(x, y, ray);
+}
+
+static int map_lens_forward(vec3_t ray, double *x, double *y)
+{
+   if (lens.native && lens.native->forward) {
+      return lens.native->forward(ray, x, y);
+   }
+   return LUAtoC_lens_forward(ray, x, y);
+}
+
+static qboolean has_lens_forward(void)
+{
+   return (lens.native && lens.native->forward) || lua_refs.lens_forward != -1;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                    Lua state management functions                            |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean LUA_load_lens(void)
+{
+   // clear Lua variables
+   LUA_clear_lens();
+   lens.native = NULL;
+
+   // set full filename
+   char filename[100];
+   sprintf(filename,"%s/lua-scripts/lenses/%s.lua", com_basedir, lens.name);
+
+   // check if loaded correctly
+   int errcode = 0;
+   if ((errcode=luaL_loadfile(lua, filename))) {
+      Con_Printf("could not loadfile (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+      lua_pop(lua,1); // pop error message
+      return false;
+   }
+   else {
+      // run it with its globals behind the proxy, then give it (and the
+      // functions it made, which share its _ENV) the real globals back
+      lens_inputs.count = 0;
+      lens_inputs.overflow = false;
+      push_lens_env();
+      set_chunk_env(-2);
+      lua_pushvalue(lua, -1);
+      errcode = lua_pcall(lua, 0, 0, 0);
+      restore_chunk_env(errcode ? -2 : -1);
+      if (errcode) {
+         Con_Printf("could not pcall (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+         lua_pop(lua,2); // pop error message and chunk
+         return false;
+      }
+      lua_pop(lua,1); // pop chunk
+      lens_inputs.hash = hash_lens_inputs();
+   }
+
+   // clear current maps
+   lens.map_type = MAP_NONE;
+   lua_refs.lens_forward = lua_refs.lens_inverse = -1;
+
+   // check if the inverse map function is provided
+   lua_getglobal(lua, "lens_inverse");
+   if (!lua_isfunction(lua,-1)) {
+      // Con_Printf("lens_inverse is not found\n");
+      lua_pop(lua,1); // pop lens_inverse
+   }
+   else {
+      lua_refs.lens_inverse = luaL_ref(lua, LUA_REGISTRYINDEX);
+      lens.map_type = MAP_INVERSE;
+   }
+
+   // check if the forward map function is provided
+   lua_getglobal(lua, "lens_forward");
+   if (!lua_isfunction(lua,-1)) {
+      // Con_Printf("lens_forward is not found\n");
+      lua_pop(lua,1); // pop lens_forward
+   }
+   else {
+      lua_refs.lens_forward = luaL_ref(lua, LUA_REGISTRYINDEX);
+      if (lens.map_type == MAP_NONE) {
+         lens.map_type = MAP_FORWARD;
+      }
+   }
+
+   // check for the batched map functions
+   LUA_get_lens_batch_refs();
+
+   // get map function preference if provided
+   lua_getglobal(lua, "map");
+   if (lua_isstring(lua, -1))
+   {
+      // get desired map function name
+      const char* funcname = lua_tostring(lua, -1);
+
+      // check for valid map function name
+      if (!strcmp(funcname, "lens_inverse")) {
+         lens.map_type = MAP_INVERSE;
+      }
+      else if (!strcmp(funcname, "lens_forward")) {
+         lens.map_type = MAP_FORWARD;
+      }
+      else {
+         Con_Printf("Unsupported map function: %s\n", funcname);
+         lua_pop(lua, 1); // pop map
+         return false;
+      }
+   }
+   lua_pop(lua,1); // pop map
+
+   // use a native implementation if the script asks for one
+   lens.native = find_native_lens();
+
+   // get the symmetry of the lens if provided
+   lens.symmetry = 0;
+   lua_getglobal(lua, "symmetry");
+   if (lua_isstring(lua, -1)) {
+      const char *symmetry = lua_tostring(lua, -1);
+      if (!strcmp(symmetry, "x")) {
+         lens.symmetry = SYMMETRY_X;
+      }
+      else if (!strcmp(symmetry, "y")) {
+         lens.symmetry = SYMMETRY_Y;
+      }
+      else if (!strcmp(symmetry, "xy")) {
+         lens.symmetry = SYMMETRY_X | SYMMETRY_Y;
+      }
+      else if (!strcmp(symmetry, "radial")) {
+         lens.symmetry = SYMMETRY_X | SYMMETRY_Y | SYMMETRY_RADIAL;
+      }
+      else {
+         Con_Printf("Unsupported symmetry: %s\n", symmetry);
+      }
+   }
+   lua_pop(lua, 1); // pop symmetry
+
+   // get the outline of the lens image if provided
+   lens.outline = OUTLINE_NONE;
+   if (lua_func_exists("lens_outline")) {
+      lens.outline = OUTLINE_FUNCTION;
+   }
+   else {
+      lua_getglobal(lua, "outline");
+      if (lua_isstring(lua, -1)) {
+         if (!strcmp(lua_tostring(lua, -1), "search")) {
+            lens.outline = OUTLINE_SEARCH;
+         }
+         else {
+            Con_Printf("Unsupported outline: %s\n", lua_tostring(lua, -1));
+         }
+      }
+      lua_pop(lua, 1); // pop outline
+   }
+
+   lua_getglobal(lua, "max_fov");
+   zoom.max_fov = (int)lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
+   lua_pop(lua,1); // pop max_fov
+
+   lua_getglobal(lua, "max_vfov");
+   zoom.max_vfov = (int)lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
+   lua_pop(lua,1); // pop max_vfov
+
+   lua_getglobal(lua, "lens_width");
+   lens.width = lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
+   lua_pop(lua,1); // pop lens_width
+
+   lua_getglobal(lua, "lens_height");
+   lens.height = lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
+   lua_pop(lua,1); // pop lens_height
+
+   return true;
+}
+
+static qboolean LUA_load_globe(void)
+{
+   // clear Lua variables
+   LUA_clear_globe();
+   globe.native = NULL;
+
+   // set full filename
+   char filename[100];
+   sprintf(filename, "%s/lua-scripts/globes/%s.lua",com_basedir,globe.name);
+
+   // check if loaded correctly
+   int errcode = 0;
+   if ((errcode=luaL_loadfile(lua, filename))) {
+      Con_Printf("could not loadfile (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+      lua_pop(lua,1); // pop error message
+      return false;
+   }
+   else {
+      if ((errcode=lua_pcall(lua, 0, 0, 0))) {
+         Con_Printf("could not pcall (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+         lua_pop(lua,1); // pop error message
+         return false;
+      }
+   }
+
+   // use a native implementation if the script asks for one
+   globe.native = find_native_globe();
+
+   // check for the globe_plate function
+   lua_refs.globe_plate = -1;
+   if (lua_func_exists("globe_plate"))
+   {
+      lua_getglobal(lua, "globe_plate");
+      lua_refs.globe_plate = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+
+   // load plates array
+   lua_getglobal(lua, "plates");
+   if (!lua_istable(lua,-1) || lua_rawlen(lua,-1) < 1)
+   {
+      Con_Printf("plates must be an array of one or more elements\n");
+      lua_pop(lua, 1); // pop plates
+      return false;
+   }
+
+   // iterate plates
+   int i = 0;
+   int j;
+   for (lua_pushnil(lua); lua_next(lua,-2); lua_pop(lua,1), ++i)
+   {
+      // get forward vector
+      lua_rawgeti(lua, -1, 1);
+
+      // verify table of length 3
+      if (!lua_istable(lua,-1) || lua_rawlen(lua,-1) != 3 )
+      {
+         Con_Printf("plate %d: forward vector is not a 3d vector\n", i+1);
+         lua_pop(lua, 3); // pop forward vector, plate, and plates
+         return false;
+      }
+
+      // get forward vector elements
+      for (j=0; j<3; ++j) {
+         lua_rawgeti(lua, -1, j+1);
+         if (!lua_isnumber(lua,-1))
+         {
+            Con_Printf("plate %d: forward vector: element %d not a number\n", i+1, j+1);
+            lua_pop(lua, 4); // pop element, vector, plate, and plates
+            return false;
+         }
+         globe.plates[i].forward[j] = lua_tonumber(lua,-1);
+         lua_pop(lua, 1); // pop element
+      }
+      lua_pop(lua,1); // pop forward vector
+
+      // get up vector
+      lua_rawgeti(lua, -1, 2);
+
+      // verify table of length 3
+      if (!lua_istable(lua,-1) || lua_rawlen(lua,-1) != 3 )
+      {
+         Con_Printf("plate %d: up vector is not a 3d vector\n", i+1);
+         lua_pop(lua, 3); // pop forward vector, plate, and plates
+         return false;
+      }
+
+      // get up vector elements
+      for (j=0; j<3; ++j) {
+         lua_rawgeti(lua, -1, j+1);
+         if (!lua_isnumber(lua,-1))
+         {
+            Con_Printf("plate %d: up vector: element %d not a number\n", i+1, j+1);
+            lua_pop(lua, 4); // pop element, vector, plate, and plates
+            return false;
+         }
+         globe.plates[i].up[j] = lua_tonumber(lua,-1);
+         lua_pop(lua,1); // pop element
+      }
+      lua_pop(lua, 1); // pop up vector
+
+      // calculate right vector (and correct up vector)
+      CrossProduct(globe.plates[i].up, globe.plates[i].forward, globe.plates[i].right);
+      CrossProduct(globe.plates[i].forward, globe.plates[i].right, globe.plates[i].up);
+
+      // get fov
+      lua_rawgeti(lua,-1,3);
+      if (!lua_isnumber(lua,-1))
+      {
+         Con_Printf("plate %d: fov not a number\n", i+1);
+      }
+      globe.plates[i].fov = lua_tonumber(lua,-1) * M_PI / 180;
+      lua_pop(lua, 1); // pop fov
+
+      if (globe.plates[i].fov <= 0 || globe.plates[i].fov >= M_PI)
+      {
+         Con_Printf("plate %d: fov must be between 0 and 180\n", i+1);
+         return false;
+      }
+
+      // get the optional vertical fov
+      globe.plates[i].aspect = 1;
+      lua_rawgeti(lua,-1,4);
+      if (!lua_isnil(lua,-1))
+      {
+         double vfov = lua_tonumber(lua,-1) * M_PI / 180;
+         if (!lua_isnumber(lua,-1) || vfov <= 0 || vfov >= M_PI)
+         {
+            Con_Printf("plate %d: vfov must be a number between 0 and 180\n", i+1);
+            lua_pop(lua, 2); // pop vfov and plates
+            return false;
+         }
+         globe.plates[i].aspect = tan(vfov/2) / tan(globe.plates[i].fov/2);
+      }
+      lua_pop(lua, 1); // pop vfov
+
+      // calculate distance to camera
+      globe.plates[i].dist = 0.5/tan(globe.plates[i].fov/2);
+      globe.plates[i].max_fov = globe.plates[i].fov;
+   }
+   lua_pop(lua, 1); // pop plates
+
+   globe.numplates = i;
+
+   // (the lens may read it while loading, see lens_inputs)
+   lua_pushinteger(lua, globe.numplates);
+   lua_setglobal(lua, "numplates");
+
+   return true;
+}
+
+#define CLEARVAR(var) lua_pushnil(lua); lua_setglobal(lua, var);
+
+// used to clear the state when switching lenses
+static void LUA_clear_lens(void)
+{
+   CLEARVAR("map");
+   CLEARVAR("max_fov");
+   CLEARVAR("max_vfov");
+   CLEARVAR("lens_width");
+   CLEARVAR("lens_height");
+   CLEARVAR("lens_inverse");
+   CLEARVAR("lens_forward");
+   CLEARVAR("lens_inverse_row");
+   CLEARVAR("lens_forward_many");
+   CLEARVAR("onload");
+   CLEARVAR("native");
+   CLEARVAR("symmetry");
+   CLEARVAR("lens_outline");
+   CLEARVAR("outline");
+
+   // set "numplates" var
+   lua_pushinteger(lua, globe.numplates);
+   lua_setglobal(lua, "numplates");
+}
+
+// used to clear the state when switching globes
+static void LUA_clear_globe(void)
+{
+   CLEARVAR("plates");
+   CLEARVAR("globe_plate");
+   CLEARVAR("native");
+
+   globe.numplates = 0;
+}
+
+#undef CLEARVAR
+
+// __index of the lens script's globals: note a global read before the lens
+// has set it, then read it
+// (upvalue 1 is the table of the globals the lens has set)
+static int CtoLUA_lens_env_index(lua_State *L)
+{
+   if (lua_type(L, 2) == LUA_TSTRING) {
+      lua_pushvalue(L, 2);
+      lua_rawget(L, lua_upvalueindex(1));
+      qboolean own = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+
+      const char *name = lua_tostring(L, 2);
+      int i;
+      for (i=0; i<lens_inputs.count && strcmp(lens_inputs.names[i], name); ++i);
+      if (!own && i == lens_inputs.count) {
+         if (i < MAX_LENS_INPUTS && strlen(name) < sizeof(lens_inputs.names[i])) {
+            strcpy(lens_inputs.names[i], name);
+            lens_inputs.count++;
+         }
+         else {
+            lens_inputs.overflow = true;
+         }
+      }
+   }
+
+   lua_pushglobaltable(L);
+   lua_pushvalue(L, 2);
+   lua_rawget(L, -2);
+   return 1;
+}
+
+// __newindex of the lens script's globals: note that the lens set it, then
+// set it
+static int CtoLUA_lens_env_newindex(lua_State *L)
+{
+   lua_pushvalue(L, 2);
+   lua_pushboolean(L, 1);
+   lua_rawset(L, lua_upvalueindex(1));
+
+   lua_pushglobaltable(L);
+   lua_pushvalue(L, 2);
+   lua_pushvalue(L, 3);
+   lua_rawset(L, -3);
+   return 0;
+}
+
+// push an empty table whose reads and writes go to the globals, through the
+// two functions above
+static void push_lens_env(void)
+{
+   lua_newtable(lua); // proxy
+   lua_newtable(lua); // its metatable
+   lua_newtable(lua); // the names set by the lens
+   lua_pushvalue(lua, -1);
+   lua_pushcclosure(lua, CtoLUA_lens_env_index, 1);
+   lua_setfield(lua, -3, "__index");
+   lua_pushcclosure(lua, CtoLUA_lens_env_newindex, 1);
+   lua_setfield(lua, -2, "__newindex");
+   lua_setmetatable(lua, -2);
+}
+
+// make the table on top of the stack the globals of the chunk at idx (below
+// it), and pop it
+static void set_chunk_env(int idx)
+{
+#if LUA_VERSION_NUM >= 502
+   lua_setupvalue(lua, idx, 1);
+#else
+   lua_setfenv(lua, idx);
+#endif
+}
+
+// give the chunk at idx, and the functions it made, the real globals back
+static void restore_chunk_env(int idx)
+{
+#if LUA_VERSION_NUM >= 502
+   // the functions share the chunk's _ENV upvalue
+   lua_pushglobaltable(lua);
+   lua_setupvalue(lua, idx < 0 ? idx-1 : idx, 1);
+#else
+   // each function took the chunk's environment when it was made, so the
+   // proxy stays, but now passes straight through to the globals (a table
+   // __index the JIT can follow, rather than a C function)
+   lua_getfenv(lua, idx);
+   lua_getmetatable(lua, -1);
+   lua_pushglobaltable(lua);
+   lua_setfield(lua, -2, "__index");
+   lua_pushglobaltable(lua);
+   lua_setfield(lua, -2, "__newindex");
+   lua_pop(lua, 2); // pop metatable and proxy
+#endif
+}
+
+// hash the values of the globals the lens read while loading
+// (tables and functions by identity, so a reloaded globe's differ)
+static unsigned hash_lens_inputs(void)
+{
+   unsigned hash = 2166136261u;
+   int i;
+   for (i=0; i<lens_inputs.count; ++i) {
+      lua_getglobal(lua, lens_inputs.names[i]);
+      int type = lua_type(lua, -1);
+      hash = hash_bytes(hash, &type, sizeof(type));
+      if (type == LUA_TNUMBER) {
+         lua_Number n = lua_tonumber(lua, -1);
+         hash = hash_bytes(hash, &n, sizeof(n));
+      }
+      else if (type == LUA_TSTRING) {
+         size_t len;
+         const char *str = lua_tolstring(lua, -1, &len);
+         hash = hash_bytes(hash, str, len);
+      }
+      else if (type == LUA_TBOOLEAN) {
+         int b = lua_toboolean(lua, -1);
+         hash = hash_bytes(hash, &b, sizeof(b));
+      }
+      else {
+         const void *ptr = lua_topointer(lua, -1);
+         hash = hash_bytes(hash, &ptr, sizeof(ptr));
+      }
+      lua_pop(lua, 1);
+   }
+   return hash;
+}
+
+static qboolean lua_func_exists(const char* name)
+{
+   lua_getglobal(lua, name);
+   int exists = lua_isfunction(lua,-1);
+   lua_pop(lua, 1); // pop name
+   return exists;
+}
+
+static void LUA_get_lens_batch_refs(void)
+{
+   lua_refs.lens_inverse_row = lua_refs.lens_forward_many = -1;
+   if (lua_func_exists("lens_inverse_row")) {
+      lua_getglobal(lua, "lens_inverse_row");
+      lua_refs.lens_inverse_row = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+   if (lua_func_exists("lens_forward_many")) {
+      lua_getglobal(lua, "lens_forward_many");
+      lua_refs.lens_forward_many = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+}
+
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS PIXEL SETTERS                                 |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// set a pixel on the lensmap from plate coordinates
+static void set_lensmap_from_plate(int lx, int ly, int px, int py, int plate_index)
+{
+   // check valid lens coordinates
+   if (lx < 0 || lx >= lens.width_px || ly < 0 || ly >= lens.height_px) {
+      return;
+   }
+
+   // check valid plate coordinates
+   if (px <0 || px >= globe.plates[plate_index].size || py < 0 || py >= globe.plates[plate_index].height) {
+      return;
+   }
+
+   unsigned pixel = GLOBEOFFSET(plate_index,px,py);
+
+   // workers cannot write to the visible lensmap
+   if (lens_worker) {
+      record_worker_pixel(lx,ly,pixel,plate_index);
+      return;
+   }
+
+   // increase the number of times this side is used
+   globe.plates[plate_index].display = 1;
+
+   // map the lens pixel to this cubeface pixel
+   *LENSPIXEL(lx,ly) = pixel;
+}
+
+// set a pixel on the lensmap from plate uv coordinates
+static void set_lensmap_from_plate_uv(int lx, int ly, double u, double v, int plate_index)
+{
+   // convert to plate coordinates
+   int px = (int)(u*globe.plates[plate_index].size);
+   int py = (int)(v*globe.plates[plate_index].height);
+   
+   set_lensmap_from_plate(lx,ly,px,py,plate_index);
+}
+
+// set the (lx,ly) pixel on the lensmap to the (sx,sy,sz) view vector
+static void set_lensmap_from_ray(int lx, int ly, double sx, double sy, double sz)
+{
+   vec3_t ray = {sx,sy,sz};
+   int sym = lens_mirror_symmetry();
+
+   if (!sym) {
+      set_lensmap_pixel_from_ray(lx,ly,ray);
+      return;
+   }
+
+   // mirrored pixels are set from their mirror images
+   if ((sym & SYMMETRY_X && is_mirrored_col(lx)) || (sym & SYMMETRY_Y && is_mirrored_row(ly))) {
+      return;
+   }
+   set_lensmap_pixel_from_ray(lx,ly,ray);
+
+   int mx = mirror_col(lx);
+   int my = mirror_row(ly);
+   qboolean has_mx = sym & SYMMETRY_X && mx != lx && mx >= 0 && mx < lens.width_px;
+   qboolean has_my = sym & SYMMETRY_Y && my != ly && my >= 0 && my < lens.height_px;
+   if (has_mx) {
+      vec3_t mirrored = {-sx, sy, sz};
+      set_lensmap_pixel_from_ray(mx,ly,mirrored);
+   }
+   if (has_my) {
+      vec3_t mirrored = {sx, -sy, sz};
+      set_lensmap_pixel_from_ray(lx,my,mirrored);
+   }
+   if (has_mx && has_my) {
+      vec3_t mirrored = {-sx, -sy, sz};
+      set_lensmap_pixel_from_ray(mx,my,mirrored);
+   }
+}
+
+// set the (lx,ly) pixel on the lensmap to the given view vector
+static void set_lensmap_pixel_from_ray(int lx, int ly, vec3_t ray)
+{
+   // remember the ray in case the globe changes
+   // (each lens pixel is only ever set by one thread)
+   if (ray_field.filling) {
+      ray_field.rays[lx + ly*ray_field.width] = encode_ray(ray);
+   }
+
+   // get plate index
+   int plate_index = ray_to_plate_index(ray);
+   if (plate_index < 0) {
+      return;
+   }
+
+   // get texture coordinates
+   double u,v;
+   if (!ray_to_plate_uv(plate_index, ray, &u, &v)) {
+      return;
+   }
+
+   // map lens pixel to plate pixel
+   set_lensmap_from_plate_uv(lx,ly,u,v,plate_index);
+}
+
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           GLOBE PIXEL GETTERS                                |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// retrieves the plate closest to the given ray
+static int ray_to_plate_index(vec3_t ray)
+{
+   // native globes are as quick as the table
+   if (plate_lut.ready && !globe.native) {
+      double ax = fabs(ray[0]), ay = fabs(ray[1]), az = fabs(ray[2]);
+      int face;
+      double s, t;
+      if (ax >= ay && ax >= az) {
+         if (ax == 0) return -1;
+         face = ray[0] > 0 ? 0 : 1;
+         s = ray[1] / ax;
+         t = ray[2] / ax;
+      }
+      else if (ay >= az) {
+         face = ray[1] > 0 ? 2 : 3;
+         s = ray[0] / ay;
+         t = ray[2] / ay;
+      }
+      else {
+         face = ray[2] > 0 ? 4 : 5;
+         s = ray[0] / az;
+         t = ray[1] / az;
+      }
+
+      int i = (int)((s + 1) * 0.5 * PLATELUT_SIZE);
+      int j = (int)((t + 1) * 0.5 * PLATELUT_SIZE);
+      if (i >= PLATELUT_SIZE) i = PLATELUT_SIZE-1;
+      if (j >= PLATELUT_SIZE) j = PLATELUT_SIZE-1;
+
+      int cell = plate_lut.cells[face][j][i];
+      if (cell == PLATELUT_NONE) {
+         return -1;
+      }
+      else if (cell != PLATELUT_BOUNDARY) {
+         return cell;
+      }
+   }
+
+   return ray_to_plate_index_exact(ray);
+}
+
+// the ray direction at (s,t) in [-1,1] on a face of the plate table
+// (the inverse of the face projection in ray_to_plate_index)
+static void plate_lut_ray(int face, double s, double t, vec3_t ray)
+{
+   double sign = face % 2 == 0 ? 1 : -1;
+   switch (face / 2) {
+      case 0: ray[0] = sign; ray[1] = s; ray[2] = t; break;
+      case 1: ray[0] = s; ray[1] = sign; ray[2] = t; break;
+      default: ray[0] = s; ray[1] = t; ray[2] = sign; break;
+   }
+   VectorNormalize(ray);
+}
+
+// fill the plate table from the exact plate of each cell's corners and center
+static void build_plate_lut(void)
+{
+   int face, i, j;
+   int n = PLATELUT_SIZE + 1;
+   int *corners = fmem_alloc(FMEM_BUILDER, n*n*sizeof(int));
+
+   plate_lut.ready = false;
+   if (!corners) {
+      return;
+   }
+
+   for (face=0; face<6; ++face) {
+      vec3_t ray;
+      for (j=0; j<n; ++j) {
+         for (i=0; i<n; ++i) {
+            plate_lut_ray(face, 2.0*i/PLATELUT_SIZE - 1, 2.0*j/PLATELUT_SIZE - 1, ray);
+            corners[i + j*n] = ray_to_plate_index_exact(ray);
+         }
+      }
+
+      for (j=0; j<PLATELUT_SIZE; ++j) {
+         for (i=0; i<PLATELUT_SIZE; ++i) {
+            int c = corners[i + j*n];
+            plate_lut_ray(face, 2.0*(i+0.5)/PLATELUT_SIZE - 1, 2.0*(j+0.5)/PLATELUT_SIZE - 1, ray);
+            qboolean same =
+               corners[i+1 + j*n] == c &&
+               corners[i + (j+1)*n] == c &&
+               corners[i+1 + (j+1)*n] == c &&
+               ray_to_plate_index_exact(ray) == c;
+            plate_lut.cells[face][j][i] = !same ? PLATELUT_BOUNDARY : c < 0 ? PLATELUT_NONE : c;
+         }
+      }
+   }
+
+   fmem_free(corners);
+   plate_lut.ready = true;
+}
+
+// retrieves the plate closest to the given ray, without the plate table
+static int ray_to_plate_index_exact(vec3_t ray)
+{
+   int plate_index = 0;
+
+   if (globe.native) {
+      if (globe.native->plate(ray, &plate_index)) {
+         return plate_index;
+      }
+      return -1;
+   }
+
+   if (lua_refs.globe_plate != -1) {
+      // use user-defined plate selection function
+      if (LUAtoC_globe_plate(ray, &plate_index)) {
+         return plate_index;
+      }
+      return -1;
+   }
+
+   // maximum dotproduct 
+   //  = minimum acos(dotproduct) 
+   //  = minimum angle between vectors
+   double max_dp = -2;
+
+   int i;
+   for (i=0; i<globe.numplates; ++i) {
+      double dp = DotProduct(ray, globe.plates[i].forward);
+      if (dp > max_dp) {
+         max_dp = dp;
+         plate_index = i;
+      }
+   }
+
+   return plate_index;
+}
+
+static qboolean ray_to_plate_uv(int plate_index, vec3_t ray, double *u, double *v)
+{
+   // get ray in the plate's relative view frame
+   double x = DotProduct(globe.plates[plate_index].right, ray);
+   double y = DotProduct(globe.plates[plate_index].up, ray);
+   double z = DotProduct(globe.plates[plate_index].forward, ray);
+
+   // project ray to the texture
+   double dist = 0.5 / tan(globe.plates[plate_index].fov/2);
+   *u = x/z*dist + 0.5;
+   *v = -y/z*dist/globe.plates[plate_index].aspect + 0.5;
+
+   // return true if valid texture coordinates
+   return *u>=0 && *u<=1 && *v>=0 && *v<=1;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS BUILDER RESUMERS                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void resume_lensmap(void)
+{
+   if (lens_workers.running) {
+      // (the workers build into a buffer of their own, so the preview can
+      //  be drawn on the main thread while they work)
+      lens_builder.working = !finish_lens_workers();
+      if (lens_builder.working) {
+         resume_lens_preview();
+      }
+   }
+   else if (lens.map_type == MAP_FORWARD) {
+      lens_builder.working = resume_lensmap_forward();
+   }
+   else if (lens.map_type == MAP_INVERSE && lens_builder.preview_state.step) {
+      resume_lens_preview();
+      lens_builder.working = true;
+   }
+   else if (lens.map_type == MAP_INVERSE) {
+      lens_builder.working = resume_lensmap_inverse();
+   }
+
+   // keep the finished lensmap so we never have to build it again
+   if (!lens_builder.working && !lens_builder.failed) {
+      if (ray_field.filling) {
+         ray_field.complete = true;
+         keep_ray_master();
+      }
+      // (approximate lensmaps are not worth keeping)
+      if (!benchmark.active && !lensmap_is_resampled()) {
+         save_lenscache();
+      }
+      end_lensmap();
+   }
+   if (!lens_builder.working) {
+      ray_field.filling = false;
+      stop_lens_prefetch(); // (if it failed)
+   }
+}
+
+// calculate all the pixels in a lens row (returns false on error)
+static qboolean build_lensmap_row_inverse(int ly)
+{
+   // image coordinates
+   double y;
+
+   // lens coordinates
+   int lx;
+
+   y = -(ly-lens.height_px/2) * lens.scale;
+
+   // rows below the mirror are filled in from the rows above it
+   int sym = lens_mirror_symmetry();
+   if (sym & SYMMETRY_Y && is_mirrored_row(ly)) {
+      return true;
+   }
+
+   // evaluate the whole row with one Lua call if the script lets us, or
+   // LuaJIT can loop over lens_inverse for us
+   // (only right of the mirror, plus the first column if it has no mirror image)
+   qboolean by_row = lua_refs.lens_inverse_row != -1;
+   qboolean by_ffi = !by_row && lua_refs.lens_inverse_ffi != -1 && lua_refs.lens_inverse != -1;
+   // (only the part of the row inside the lens image, if it gives its outline)
+   int first, last;
+   if (!get_image_span(ly, ly, &first, &last)) {
+      return true;
+   }
+
+   if (!(lens.native && lens.native->inverse) && !radial_table.ready && (by_row || by_ffi)) {
+      int x0 = sym & SYMMETRY_X ? lens.width_px/2 : 0;
+      if (x0 < first) x0 = first;
+      int n = last+1 - x0;
+      if (n <= 0) {
+         return true;
+      }
+      vec3_t *rays = fmem_alloc(FMEM_BUILDER, n*sizeof(vec3_t));
+      byte *valid = fmem_alloc(FMEM_BUILDER, n);
+      qboolean ok = rays && valid;
+      if (!ok) {
+         lens_error("could not allocate lens builder memory\n");
+      }
+      else if ((by_row ? LUAtoC_lens_inverse_row : LUAtoC_lens_inverse_ffi)(y, (x0-lens.width_px/2) * lens.scale, lens.scale, n, rays, valid) == -1) {
+         ok = false;
+      }
+      else {
+         for(lx = 0;lx<n;++lx) {
+            if (valid[lx]) {
+               set_lensmap_from_ray(x0+lx,ly,rays[lx][0],rays[lx][1],rays[lx][2]);
+            }
+         }
+      }
+      fmem_free(rays);
+      fmem_free(valid);
+      if (ok && x0 > 0 && first == 0 && !is_mirrored_col(0)) {
+         ok = build_lensmap_block_exact(0, ly, 1, ly+1);
+      }
+      return ok;
+   }
+
+   for(lx = first;lx<=last;++lx)
+   {
+      if (sym & SYMMETRY_X && is_mirrored_col(lx)) {
+         continue;
+      }
+
+      // determine which light ray to follow
+      vec3_t ray;
+      int status = lens_pixel_to_ray(lx,ly,ray);
+      if (status == 0) {
+         continue;
+      }
+      else if (status == -1) {
+         return false;
+      }
+
+      // get the pixel belonging to the light ray
+      set_lensmap_from_ray(lx,ly,ray[0],ray[1],ray[2]);
+   }
+
+   return true;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS SYMMETRY                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// the mirrors to use for the current build
+// (not needed when replaying rays or using a radial table, and native lenses
+//  are cheap enough to evaluate everywhere)
+static int lens_mirror_symmetry(void)
+{
+   if (ray_field.complete || radial_table.ready || (lens.native && lens.native->inverse)) {
+      return 0;
+   }
+   return lens.symmetry & (SYMMETRY_X | SYMMETRY_Y);
+}
+
+// the column at -x, and the row at -y
+static int mirror_col(int lx) { return 2*(lens.width_px/2) - lx; }
+static int mirror_row(int ly) { return 2*(lens.height_px/2) - ly; }
+
+// true if a pixel is left of the x mirror and has a mirror image on screen
+static qboolean is_mirrored_col(int lx)
+{
+   return lx < lens.width_px/2 && mirror_col(lx) < lens.width_px;
+}
+
+// true if a pixel is below the y mirror (it always has a mirror image)
+static qboolean is_mirrored_row(int ly)
+{
+   return ly > lens.height_px/2;
+}
+
+// sample the lens along the positive x axis, out to the screen corners
+// (samples are a quarter of a pixel apart)
+static qboolean build_radial_table(void)
+{
+   double hw = lens.width_px/2 + 1;
+   double hh = lens.height_px/2 + 1;
+   double step = lens.scale / 4;
+   int count = (int)(sqrt(hw*hw + hh*hh) * 4) + 2;
+   int i;
+
+   fmem_free(radial_table.rays);
+   fmem_free(radial_table.valid);
+   radial_table.rays = fmem_alloc(FMEM_BUILDER, count*sizeof(double[2]));
+   radial_table.valid = fmem_alloc(FMEM_BUILDER, count);
+   if (!radial_table.rays || !radial_table.valid) {
+      return false;
+   }
+   radial_table.step = step;
+   radial_table.count = count;
+
+   for (i=0; i<count; ++i) {
+      vec3_t ray;
+      int status = map_lens_inverse((i+0.5)*step, 0, ray);
+      if (status == -1) {
+         return false;
+      }
+      radial_table.valid[i] = status == 1;
+      radial_table.rays[i][0] = status == 1 ? ray[0] : 0;
+      radial_table.rays[i][1] = status == 1 ? ray[2] : 0;
+   }
+   return true;
+}
+
+// the ray at (x,y) from the radial table (returns 1 if valid, 0 if none)
+static int radial_pixel_to_ray(double x, double y, vec3_t ray)
+{
+   double r = sqrt(x*x + y*y);
+   double t = r / radial_table.step - 0.5;
+   int i = (int)floor(t);
+   if (i < 0) {
+      i = 0;
+      t = 0;
+   }
+   if (i+1 >= radial_table.count || !radial_table.valid[i] || !radial_table.valid[i+1]) {
+      return 0;
+   }
+
+   // interpolate the ray in the x-z plane, then turn it towards (x,y)
+   double f = t - i;
+   double s = radial_table.rays[i][0] + (radial_table.rays[i+1][0] - radial_table.rays[i][0]) * f;
+   double c = radial_table.rays[i][1] + (radial_table.rays[i+1][1] - radial_table.rays[i][1]) * f;
+   if (r > 0) {
+      ray[0] = s * x / r;
+      ray[1] = s * y / r;
+   }
+   else {
+      ray[0] = ray[1] = 0;
+   }
+   ray[2] = c;
+   VectorNormalize(ray);
+   return 1;
+}
+
+// the column where a row leaves the lens image, searching from the inside
+// column toward the outside one (-2 on error)
+static int search_image_edge(int ly, int inside, int outside)
+{
+   vec3_t ray;
+   while (abs(outside - inside) > 1) {
+      int mid = (inside + outside) / 2;
+      int status = lens_pixel_to_ray(mid, ly, ray);
+      if (status == -1) {
+         return -2;
+      }
+      if (status == 1) {
+         inside = mid;
+      }
+      else {
+         outside = mid;
+      }
+   }
+   return inside;
+}
+
+// find the columns of each row that can be inside the lens image
+// (one column either side to spare, since the outline is only as good as
+//  the pixel it lands in; without it every row is built in full)
+static void build_image_spans(void)
+{
+   image_spans.ready = false;
+   if (lens.outline == OUTLINE_NONE || ray_field.complete) {
+      return;
+   }
+
+   if (image_spans.height != lens.height_px) {
+      fmem_free(image_spans.first);
+      fmem_free(image_spans.last);
+      image_spans.first = fmem_alloc(FMEM_BUILDER, lens.height_px*sizeof(int));
+      image_spans.last = fmem_alloc(FMEM_BUILDER, lens.height_px*sizeof(int));
+      image_spans.height = lens.height_px;
+      if (!image_spans.first || !image_spans.last) {
+         fmem_free(image_spans.first);
+         fmem_free(image_spans.last);
+         image_spans.first = image_spans.last = NULL;
+         image_spans.height = 0;
+         return;
+      }
+   }
+
+   int cx = lens.width_px/2;
+   int ly;
+   for (ly=0; ly<lens.height_px; ++ly) {
+      int first = 0, last = lens.width_px-1;
+
+      // (rows below the mirror are not built)
+      if (lens_mirror_symmetry() & SYMMETRY_Y && is_mirrored_row(ly)) {
+         image_spans.first[ly] = first;
+         image_spans.last[ly] = last;
+         continue;
+      }
+
+      if (lens.outline == OUTLINE_FUNCTION) {
+         double halfwidth;
+         int status = LUAtoC_lens_outline(-(ly-lens.height_px/2) * lens.scale, &halfwidth);
+         if (status == -1) {
+            return;
+         }
+         else if (status == 0) {
+            first = 0;
+            last = -1;
+         }
+         else if (halfwidth / lens.scale < cx + 1) {
+            int r = (int)ceil(halfwidth / lens.scale) + 1;
+            first = cx - r;
+            last = cx + r;
+         }
+      }
+      else {
+         vec3_t ray;
+         int status = lens_pixel_to_ray(cx, ly, ray);
+         if (status == -1) {
+            return;
+         }
+         else if (status == 0) {
+            first = 0;
+            last = -1;
+         }
+         else {
+            int left = search_image_edge(ly, cx, -1);
+            int right = search_image_edge(ly, cx, lens.width_px);
+            if (left == -2 || right == -2) {
+               return;
+            }
+            first = left - 1;
+            last = right + 1;
+         }
+      }
+
+      image_spans.first[ly] = first > 0 ? first : 0;
+      image_spans.last[ly] = last < lens.width_px-1 ? last : lens.width_px-1;
+   }
+   image_spans.ready = true;
+}
+
+// the columns of rows y0 to y1 that can be inside the lens image (all of
+// them unless the lens gives its outline), returns false if there are none
+static qboolean get_image_span(int y0, int y1, int *first, int *last)
+{
+   *first = 0;
+   *last = lens.width_px-1;
+   if (!image_spans.ready) {
+      return true;
+   }
+
+   if (y0 < 0) y0 = 0;
+   if (y1 > lens.height_px-1) y1 = lens.height_px-1;
+   *first = lens.width_px;
+   *last = -1;
+   int ly;
+   for (ly=y0; ly<=y1; ++ly) {
+      if (image_spans.first[ly] > image_spans.last[ly]) {
+         continue;
+      }
+      if (image_spans.first[ly] < *first) *first = image_spans.first[ly];
+      if (image_spans.last[ly] > *last) *last = image_spans.last[ly];
+   }
+   return *first <= *last;
+}
+
+// grid interpolation is only used when the lens is evaluated by a script,
+// since native lenses are already cheaper than the interpolation
+static int lens_grid_size(void)
+{
+   if (lens.native && lens.native->inverse) {
+      return 1;
+   }
+   return lens_builder.grid > 1 ? lens_builder.grid : 1;
+}
+
+// the inverse builder works on bands of rows, one grid cell tall
+static int num_inverse_tasks(void)
+{
+   int g = ray_field.complete ? 1 : lens_grid_size();
+   return (lens.height_px + g-1) / g;
+}
+
+// determine the light ray for a lens pixel (returns 1 if valid, 0 if none, -1 on error)
+static int lens_pixel_to_ray(int lx, int ly, vec3_t ray)
+{
+   double x = (lx-lens.width_px/2) * lens.scale;
+   double y = -(ly-lens.height_px/2) * lens.scale;
+   if (radial_table.ready) {
+      return radial_pixel_to_ray(x,y,ray);
+   }
+   return map_lens_inverse(x,y,ray);
+}
+
+// calculate every pixel in a block of the lens, clipped to the screen (returns false on error)
+static qboolean build_lensmap_block_exact(int x0, int y0, int x1, int y1)
+{
+   int lx,ly;
+   if (x1 > lens.width_px) x1 = lens.width_px;
+   if (y1 > lens.height_px) y1 = lens.height_px;
+
+   for (ly=y0; ly<y1; ++ly) {
+      for (lx=x0; lx<x1; ++lx) {
+         vec3_t ray;
+         int status = lens_pixel_to_ray(lx,ly,ray);
+         if (status == -1) {
+            return false;
+         }
+         else if (status == 1) {
+            set_lensmap_from_ray(lx,ly,ray[0],ray[1],ray[2]);
+         }
+      }
+   }
+   return true;
+}
+
+// maximum distance (in plate pixels) that an interpolated ray may drift from
+// the real one before we split its grid cell
+#define LENSGRID_TOLERANCE 0.25
+
+// fill a square grid cell from the rays at its corners (0=top left, 1=top
+// right, 2=bottom left, 3=bottom right), splitting it in four wherever the
+// interpolation is not good enough (returns false on error)
+static qboolean build_lensmap_cell(int x0, int y0, int size, vec3_t r[4], int st[4])
+{
+   int i,j;
+   int x1 = x0 + size;
+   int y1 = y0 + size;
+
+   // corners may lie past the screen edge, but the cell must not
+   if (x0 >= lens.width_px || y0 >= lens.height_px) {
+      return true;
+   }
+
+   // skip cells that will be filled in from their mirror images
+   int sym = lens_mirror_symmetry();
+   int xl = (x1 < lens.width_px ? x1 : lens.width_px) - 1;
+   int yl = (y1 < lens.height_px ? y1 : lens.height_px) - 1;
+   if ((sym & SYMMETRY_X && is_mirrored_col(x0) && is_mirrored_col(xl)) ||
+       (sym & SYMMETRY_Y && is_mirrored_row(y0) && is_mirrored_row(yl))) {
+      return true;
+   }
+
+   if (size <= 2) {
+      return build_lensmap_block_exact(x0,y0,x1,y1);
+   }
+
+   // cells with an invalid corner or that straddle plates must be split
+   qboolean smooth = true;
+   int plate_index = -1;
+   for (i=0; i<4 && smooth; ++i) {
+      if (st[i] != 1) {
+         smooth = false;
+      }
+      else {
+         int p = ray_to_plate_index(r[i]);
+         if (p < 0 || (plate_index != -1 && p != plate_index)) {
+            smooth = false;
+         }
+         plate_index = p;
+      }
+   }
+
+   // spot-check the interpolation at the center of the cell
+   int h = size/2;
+   vec3_t center;
+   int center_st = lens_pixel_to_ray(x0+h, y0+h, center);
+   if (center_st == -1) {
+      return false;
+   }
+   if (smooth) {
+      vec3_t guess;
+      double u0,v0,u1,v1;
+      for (i=0; i<3; ++i) {
+         guess[i] = 0.25f * (r[0][i] + r[1][i] + r[2][i] + r[3][i]);
+      }
+      VectorNormalize(guess);
+      smooth = center_st == 1 &&
+         ray_to_plate_index(center) == plate_index &&
+         ray_to_plate_index(guess) == plate_index &&
+         ray_to_plate_uv(plate_index, center, &u0, &v0) &&
+         ray_to_plate_uv(plate_index, guess, &u1, &v1) &&
+         fabs(u1-u0)*globe.plates[plate_index].size <= LENSGRID_TOLERANCE &&
+         fabs(v1-v0)*globe.plates[plate_index].height <= LENSGRID_TOLERANCE;
+   }
+
+   if (smooth) {
+      int lx,ly;
+      int xe = x1 < lens.width_px ? x1 : lens.width_px;
+      int ye = y1 < lens.height_px ? y1 : lens.height_px;
+      for (ly=y0; ly<ye; ++ly) {
+         double fy = (double)(ly-y0) / size;
+         for (lx=x0; lx<xe; ++lx) {
+            double fx = (double)(lx-x0) / size;
+            vec3_t ray;
+            for (i=0; i<3; ++i) {
+               double top = r[0][i] + (r[1][i]-r[0][i])*fx;
+               double bot = r[2][i] + (r[3][i]-r[2][i])*fx;
+               ray[i] = top + (bot-top)*fy;
+            }
+            VectorNormalize(ray);
+            set_lensmap_from_ray(lx,ly,ray[0],ray[1],ray[2]);
+         }
+      }
+      return true;
+   }
+
+   // evaluate the edge midpoints and split into quadrants
+   // (laid out as a 3x3 grid of rays, row-major)
+   vec3_t g[9];
+   int gs[9];
+   VectorCopy(r[0], g[0]); gs[0] = st[0];
+   VectorCopy(r[1], g[2]); gs[2] = st[1];
+   VectorCopy(r[2], g[6]); gs[6] = st[2];
+   VectorCopy(r[3], g[8]); gs[8] = st[3];
+   VectorCopy(center, g[4]); gs[4] = center_st;
+   gs[1] = lens_pixel_to_ray(x0+h, y0, g[1]);
+   gs[3] = lens_pixel_to_ray(x0, y0+h, g[3]);
+   gs[5] = lens_pixel_to_ray(x1, y0+h, g[5]);
+   gs[7] = lens_pixel_to_ray(x0+h, y1, g[7]);
+   if (gs[1] == -1 || gs[3] == -1 || gs[5] == -1 || gs[7] == -1) {
+      return false;
+   }
+
+   for (j=0; j<2; ++j) {
+      for (i=0; i<2; ++i) {
+         int k = j*3 + i;
+         vec3_t qr[4];
+         int qs[4] = { gs[k], gs[k+1], gs[k+3], gs[k+4] };
+         VectorCopy(g[k], qr[0]);
+         VectorCopy(g[k+1], qr[1]);
+         VectorCopy(g[k+3], qr[2]);
+         VectorCopy(g[k+4], qr[3]);
+         if (!build_lensmap_cell(x0+i*h, y0+j*h, h, qr, qs)) {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+// calculate all the pixels in a band of lens rows, one grid cell tall
+// (returns false on error)
+static qboolean build_lensmap_band_inverse(int band)
+{
+   // only the globe has changed since the rays were found
+   if (ray_field.complete) {
+      return build_lensmap_row_from_rays(band);
+   }
+
+   int g = lens_grid_size();
+   if (g <= 1) {
+      return build_lensmap_row_inverse(band);
+   }
+
+   int y0 = band * g;
+   int ncols = (lens.width_px + g-1) / g + 1;
+
+   // bands below the mirror are filled in from the bands above it
+   // (the mirrored rows are the bottom ones, so checking the first row is enough)
+   if (lens_mirror_symmetry() & SYMMETRY_Y && is_mirrored_row(y0)) {
+      return true;
+   }
+
+   // (only the cells that the lens image reaches, if it gives its outline)
+   int first, last;
+   if (!get_image_span(y0, y0+g, &first, &last)) {
+      return true;
+   }
+   int c0 = first / g;
+   int c1 = last / g + 1;
+
+   vec3_t *top = fmem_alloc(FMEM_BUILDER, ncols*sizeof(vec3_t));
+   vec3_t *bot = fmem_alloc(FMEM_BUILDER, ncols*sizeof(vec3_t));
+   int *top_st = fmem_alloc(FMEM_BUILDER, ncols*sizeof(int));
+   int *bot_st = fmem_alloc(FMEM_BUILDER, ncols*sizeof(int));
+   qboolean ok = top && bot && top_st && bot_st;
+   int i;
+
+   if (!ok) {
+      lens_error("could not allocate lens builder memory\n");
+   }
+
+   // evaluate the grid points along the top and bottom of the band
+   for (i=c0; ok && i<=c1 && i<ncols; ++i) {
+      top_st[i] = lens_pixel_to_ray(i*g, y0, top[i]);
+      bot_st[i] = lens_pixel_to_ray(i*g, y0+g, bot[i]);
+      ok = top_st[i] != -1 && bot_st[i] != -1;
+   }
+
+   for (i=c0; ok && i<c1 && i<ncols-1; ++i) {
+      vec3_t r[4];
+      int st[4] = { top_st[i], top_st[i+1], bot_st[i], bot_st[i+1] };
+      VectorCopy(top[i], r[0]);
+      VectorCopy(top[i+1], r[1]);
+      VectorCopy(bot[i], r[2]);
+      VectorCopy(bot[i+1], r[3]);
+      ok = build_lensmap_cell(i*g, y0, g, r, st);
+   }
+
+   fmem_free(top);
+   fmem_free(bot);
+   fmem_free(top_st);
+   fmem_free(bot_st);
+   return ok;
+}
+
+static qboolean resume_lensmap_inverse(void)
+{
+   int *ly;
+
+   start_lens_builder_clock();
+   for(ly = &(lens_builder.inverse_state.ly); *ly >= 0; --(*ly))
+   {
+      // pause building if we have exceeded time allowed per frame
+      if (is_lens_builder_time_up()) {
+         return true; 
+      }
+
+      if (lens_builder.preview_state.drawn) {
+         clear_lensmap_band(*ly);
+      }
+      if (!build_lensmap_band_inverse(*ly)) {
+         lens_builder.failed = true;
+         return false;
+      }
+   }
+
+   // done building lens
+   return false;
+}
+
+// clear the rows of a band of the inverse builder
+// (so that preview blocks lying outside the lens do not survive the full build)
+static void clear_lensmap_band(int band)
+{
+   int g = ray_field.complete ? 1 : lens_grid_size();
+   int y0 = band * g;
+   int y1 = y0 + g < lens.height_px ? y0 + g : lens.height_px;
+   int area = (y1 - y0) * lens.width_px;
+   if (area > 0) {
+      memset(LENSPIXEL(0,y0), 0xff, area*sizeof(unsigned));
+   }
+}
+
+// block sizes of the preview passes, coarsest first
+static const int preview_steps[] = { 16, 4 };
+#define NUM_PREVIEW_STEPS ((int)(sizeof(preview_steps)/sizeof(*preview_steps)))
+
+// plan the preview passes of a new inverse build
+// (only when the screen would otherwise be empty, and only the passes that
+//  evaluate the lens less often than the full build does)
+static void start_lens_preview(void)
+{
+   int i;
+   lens_builder.preview_state.step = 0;
+   lens_builder.preview_state.ly = 0;
+   lens_builder.preview_state.drawn = false;
+
+   if (lens_front.valid || lens_prefetch.working || ray_field.complete) {
+      return;
+   }
+   for (i=0; i<NUM_PREVIEW_STEPS; ++i) {
+      if (preview_steps[i] > lens_grid_size()) {
+         lens_builder.preview_state.step = preview_steps[i];
+         return;
+      }
+   }
+}
+
+// draw more of the preview passes, until the frame's time is up
+static void resume_lens_preview(void)
+{
+   struct _preview_state *state = &lens_builder.preview_state;
+
+   start_lens_builder_clock();
+   while (state->step && !is_lens_builder_time_up()) {
+      int step = state->step;
+      int y0 = state->ly * step;
+      int lx, x, y;
+
+      if (y0 >= lens.height_px) {
+         // go on to the next finer pass, if it is still cheaper than the build
+         int i;
+         state->step = 0;
+         state->ly = 0;
+         for (i=0; i<NUM_PREVIEW_STEPS-1; ++i) {
+            if (preview_steps[i] == step && preview_steps[i+1] > lens_grid_size()) {
+               state->step = preview_steps[i+1];
+            }
+         }
+         continue;
+      }
+
+      // evaluate the middle of each block of the row
+      int cy = y0 + step/2 < lens.height_px ? y0 + step/2 : lens.height_px-1;
+      int y1 = y0 + step < lens.height_px ? y0 + step : lens.height_px;
+      for (lx=0; lx<lens.width_px; lx+=step) {
+         int cx = lx + step/2 < lens.width_px ? lx + step/2 : lens.width_px-1;
+         int x1 = lx + step < lens.width_px ? lx + step : lens.width_px;
+         vec3_t ray;
+
+         *LENSPIXEL(cx,cy) = LENSPIXEL_NONE;
+         int status = lens_pixel_to_ray(cx,cy,ray);
+         if (status == -1) {
+            // (the full build reports the error)
+            state->step = 0;
+            return;
+         }
+         // (not through set_lensmap_pixel_from_ray, the ray field is only
+         //  for the rays of the full build)
+         int plate_index = status == 1 ? ray_to_plate_index(ray) : -1;
+         double u, v;
+         if (plate_index >= 0 && ray_to_plate_uv(plate_index, ray, &u, &v)) {
+            set_lensmap_from_plate_uv(cx,cy,u,v,plate_index);
+         }
+
+         unsigned pixel = *LENSPIXEL(cx,cy);
+         for (y=y0; y<y1; ++y) {
+            for (x=lx; x<x1; ++x) {
+               *LENSPIXEL(x,y) = pixel;
+            }
+         }
+      }
+      state->drawn = true;
+      state->ly++;
+   }
+}
+
+// draw the texture rows of a plate from *py down to 0 using the forward map
+// (returns 1 if paused, 0 if done, -1 on error)
+static int build_lensmap_rows_forward(int plate_index, lens_point_t **ptop, lens_point_t **pbot, int *py)
+{
+   lens_point_t *top = *ptop;
+   lens_point_t *bot = *pbot;
+   int width = globe.plates[plate_index].size;
+   int height = globe.plates[plate_index].height;
+   int px;
+
+   for (; *py >=0; --(*py)) {
+
+      // pause building if we have exceeded time allowed per frame
+      if (should_pause_lens_builder()) {
+         return 1;
+      }
+
+      // FIND ALL DESTINATION SCREEN COORDINATES FOR THIS TEXTURE ROW ********************
+
+      // compute lower points
+      if (*py == height-1) {
+         if (uv_row_to_screen(plate_index, (double)(*py + 1) / height, bot) == -1) {
+            return -1;
+         }
+      }
+      else {
+         // swap references so that the previous bottom becomes our current top
+         // (stored back so we can resume on the right rows)
+         lens_point_t *temp = top;
+         top = *ptop = bot;
+         bot = *pbot = temp;
+      }
+
+      // compute upper points
+      if (uv_row_to_screen(plate_index, (double)*py / height, top) == -1) {
+         return -1;
+      }
+
+      // DRAW TWO TRIANGLES FOR EACH PIXEL IN THIS TEXTURE ROW **************************
+
+      for (px = 0; px < width; ++px) {
+
+         // skip the texels that are wholly in another plate's part of the globe
+         // (drawing those touching the plate's part leaves no gaps between plates)
+         if (top[px].owner != plate_index && top[px+1].owner != plate_index &&
+               bot[px].owner != plate_index && bot[px+1].owner != plate_index) {
+            continue;
+         }
+
+         if (!draw_texel_forward(top+px, bot+px, plate_index, px, *py)) {
+            return -1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+static qboolean resume_lensmap_forward(void)
+{
+   lens_point_t **top = &lens_builder.forward_state.top;
+   lens_point_t **bot = &lens_builder.forward_state.bot;
+   int *py = &(lens_builder.forward_state.py);
+   int *plate_index = &(lens_builder.forward_state.plate_index);
+
+   start_lens_builder_clock();
+   for (; *plate_index < globe.numplates; ++(*plate_index))
+   {
+      int status = build_lensmap_rows_forward(*plate_index, top, bot, py);
+      if (status == 1) {
+         return true;
+      }
+      else if (status == -1) {
+         lens_builder.failed = true;
+         return false;
+      }
+
+      // reset row position
+      // (we have to do it here because it cannot be reset until it is done iterating)
+      // (we cannot do it at the beginning because the function could be resumed at some middle row)
+      if (*plate_index+1 < globe.numplates) {
+         *py = globe.plates[*plate_index+1].height-1;
+      }
+   }
+
+   fmem_free(*top);
+   fmem_free(*bot);
+
+   // done building lens
+   return false;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                  FORWARD MAP GETTER/SETTER HELPERS                           |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// convenience function for forward map calculation:
+//    maps a ray to a screen position, in pixels (pixel centers are at +0.5)
+static int ray_to_screen(vec3_t ray, double *sx, double *sy)
+{
+   // map ray to image coordinates
+   double x,y;
+   int status = map_lens_forward(ray,&x,&y);
+   if (status == 0 || status == -1) { return status; }
+
+   // map image to screen coordinates
+   *sx = x/lens.scale + lens.width_px/2;
+   *sy = -y/lens.scale + lens.height_px/2;
+
+   return status;
+}
+
+// maps uv coordinate on a texture to a screen position
+static int uv_to_screen(int plate_index, double u, double v, lens_point_t *p)
+{
+   vec3_t ray;
+   plate_uv_to_ray(plate_index, u, v, ray);
+
+   int status = ray_to_screen(ray, &p->x, &p->y);
+   p->valid = status == 1;
+   return status;
+}
+
+// maps the pixel corners along a texture row to screen positions
+//    row[i] is the corner at u = i/platesize, along with the plate owning it
+// (returns -1 on error)
+static int uv_row_to_screen(int plate_index, double v, lens_point_t *row)
+{
+   int platesize = globe.plates[plate_index].size;
+   int n = platesize+1;
+   int px;
+
+   // map the whole row with one Lua call if the script lets us
+   if (!(lens.native && lens.native->forward) && lua_refs.lens_forward_many != -1) {
+      vec3_t *rays = fmem_alloc(FMEM_BUILDER, n*sizeof(vec3_t));
+      double *xy = fmem_alloc(FMEM_BUILDER, n*sizeof(double[2]));
+      byte *valid = fmem_alloc(FMEM_BUILDER, n);
+      int status = rays && xy && valid ? 1 : -1;
+      if (status == -1) {
+         lens_error("could not allocate lens builder memory\n");
+      }
+      else {
+         for (px = 0; px < n; ++px) {
+            plate_uv_to_ray(plate_index, (double)px / platesize, v, rays[px]);
+            row[px].owner = ray_to_plate_index(rays[px]);
+         }
+         status = LUAtoC_lens_forward_many(n, rays, xy, valid);
+      }
+      if (status == 1) {
+         for (px = 0; px < n; ++px) {
+            row[px].valid = valid[px];
+            row[px].x = xy[2*px]/lens.scale + lens.width_px/2;
+            row[px].y = -xy[2*px+1]/lens.scale + lens.height_px/2;
+         }
+      }
+      fmem_free(rays);
+      fmem_free(xy);
+      fmem_free(valid);
+      return status;
+   }
+
+   for (px = 0; px < n; ++px) {
+      vec3_t ray;
+      plate_uv_to_ray(plate_index, (double)px / platesize, v, ray);
+      row[px].owner = ray_to_plate_index(ray);
+      int status = ray_to_screen(ray, &row[px].x, &row[px].y);
+      if (status == -1) return -1;
+      row[px].valid = status == 1;
+   }
+
+   return 1;
+}
+
+// Each texel is drawn as two triangles between the screen positions of its
+// corners.  A triangle whose edges cross a seam of the lens (e.g. the back of
+// a panorama) or the edge of its image has corners that are far apart on
+// screen, or missing.  Those are split into four at the midpoints of their
+// edges, down to FORWARD_MAX_DEPTH, and the pieces that land on one side are
+// drawn.  An edge longer than FORWARD_CHECK_EDGE pixels is only trusted if
+// the lens maps its midpoint near the middle of its ends.
+#define FORWARD_MAX_DEPTH 3
+#define FORWARD_CHECK_EDGE 8
+#define FORWARD_SUBPIXEL_BITS 8
+#define FORWARD_MAX_COORD (1<<20)
+
+typedef struct {
+   double u, v;   // on the plate
+   lens_point_t p; // on the screen
+} forward_vertex_t;
+
+// fills the lens pixels whose centers are inside the triangle with the texel
+// (edges use the top-left rule, so triangles sharing an edge never draw the
+//  same pixel and leave no gap between them)
+static void fill_triangle_forward(const lens_point_t *a, const lens_point_t *b, const lens_point_t *c,
+      int plate_index, int px, int py)
+{
+   const double one = 1 << FORWARD_SUBPIXEL_BITS;
+   const long long half = 1 << (FORWARD_SUBPIXEL_BITS-1);
+   const lens_point_t *v[3] = { a, b, c };
+   long long x[3], y[3];
+   int i;
+
+   // snap to fixed point so that shared edges are tested the same way
+   for (i=0; i<3; ++i) {
+      if (fabs(v[i]->x) > FORWARD_MAX_COORD || fabs(v[i]->y) > FORWARD_MAX_COORD) {
+         return;
+      }
+      x[i] = (long long)floor(v[i]->x * one + 0.5);
+      y[i] = (long long)floor(v[i]->y * one + 0.5);
+   }
+
+   // make the winding clockwise on screen (the lens may mirror the plate)
+   long long area = (x[1]-x[0])*(y[2]-y[0]) - (y[1]-y[0])*(x[2]-x[0]);
+   if (area == 0) {
+      return;
+   }
+   if (area < 0) {
+      long long t;
+      t = x[1]; x[1] = x[2]; x[2] = t;
+      t = y[1]; y[1] = y[2]; y[2] = t;
+   }
+
+   // pixel bounds of the triangle, clipped to the lens
+   long long minx = x[0], maxx = x[0], miny = y[0], maxy = y[0];
+   for (i=1; i<3; ++i) {
+      if (x[i] < minx) minx = x[i];
+      if (x[i] > maxx) maxx = x[i];
+      if (y[i] < miny) miny = y[i];
+      if (y[i] > maxy) maxy = y[i];
+   }
+   int x0 = (int)((minx - half + (1<<FORWARD_SUBPIXEL_BITS) - 1) >> FORWARD_SUBPIXEL_BITS);
+   int x1 = (int)((maxx - half) >> FORWARD_SUBPIXEL_BITS);
+   int y0 = (int)((miny - half + (1<<FORWARD_SUBPIXEL_BITS) - 1) >> FORWARD_SUBPIXEL_BITS);
+   int y1 = (int)((maxy - half) >> FORWARD_SUBPIXEL_BITS);
+   if (x0 < 0) x0 = 0;
+   if (y0 < 0) y0 = 0;
+   if (x1 >= lens.width_px) x1 = lens.width_px-1;
+   if (y1 >= lens.height_px) y1 = lens.height_px-1;
+   if (x0 > x1 || y0 > y1) {
+      return;
+   }
+
+   // edge functions at the center of the first pixel, and their steps
+   long long row[3], dx[3], dy[3];
+   long long cx = ((long long)x0 << FORWARD_SUBPIXEL_BITS) + half;
+   long long cy = ((long long)y0 << FORWARD_SUBPIXEL_BITS) + half;
+   for (i=0; i<3; ++i) {
+      int j = (i+1) % 3;
+      long long ex = x[j] - x[i];
+      long long ey = y[j] - y[i];
+      row[i] = ex*(cy - y[i]) - ey*(cx - x[i]);
+      dx[i] = -ey << FORWARD_SUBPIXEL_BITS;
+      dy[i] = ex << FORWARD_SUBPIXEL_BITS;
+
+      // pixels exactly on an edge belong to it if it is a top or left edge
+      qboolean topleft = ey < 0 || (ey == 0 && ex > 0);
+      if (!topleft) {
+         row[i] -= 1;
+      }
+   }
+
+   int lx, ly;
+   for (ly = y0; ly <= y1; ++ly) {
+      long long e0 = row[0], e1 = row[1], e2 = row[2];
+      for (lx = x0; lx <= x1; ++lx) {
+         if ((e0 | e1 | e2) >= 0) {
+            set_lensmap_from_plate(lx,ly,px,py,plate_index);
+         }
+         e0 += dx[0];
+         e1 += dx[1];
+         e2 += dx[2];
+      }
+      row[0] += dy[0];
+      row[1] += dy[1];
+      row[2] += dy[2];
+   }
+}
+
+// the vertex halfway between a and b on the plate
+// (returns -1 on error)
+static int forward_midpoint(int plate_index, const forward_vertex_t *a, const forward_vertex_t *b,
+      forward_vertex_t *m)
+{
+   m->u = (a->u + b->u) / 2;
+   m->v = (a->v + b->v) / 2;
+   return uv_to_screen(plate_index, m->u, m->v, &m->p);
+}
+
+// draws a triangle of a texel, splitting it where the lens breaks it up
+// (returns false on error)
+static qboolean draw_triangle_forward(const forward_vertex_t *a, const forward_vertex_t *b,
+      const forward_vertex_t *c, int plate_index, int px, int py, int depth)
+{
+   const forward_vertex_t *v[3] = { a, b, c };
+   forward_vertex_t mid[3];   // of the edges ab, bc and ca
+   qboolean mapped[3] = { false, false, false };
+   qboolean whole = a->p.valid && b->p.valid && c->p.valid;
+   int i;
+
+   // nothing of the lens image can be in here
+   if (!a->p.valid && !b->p.valid && !c->p.valid) {
+      return true;
+   }
+
+   // check that the long edges are unbroken
+   for (i=0; i<3 && whole; ++i) {
+      const lens_point_t *p = &v[i]->p, *q = &v[(i+1)%3]->p;
+      double ex = q->x - p->x, ey = q->y - p->y;
+      double len2 = ex*ex + ey*ey;
+      if (len2 <= FORWARD_CHECK_EDGE*FORWARD_CHECK_EDGE) {
+         continue;
+      }
+      if (forward_midpoint(plate_index, v[i], v[(i+1)%3], &mid[i]) == -1) {
+         return false;
+      }
+      mapped[i] = true;
+      double mx = mid[i].p.x - (p->x + q->x)/2;
+      double my = mid[i].p.y - (p->y + q->y)/2;
+      if (!mid[i].p.valid || mx*mx + my*my > len2/16) {
+         whole = false;
+      }
+   }
+
+   if (whole) {
+      fill_triangle_forward(&a->p, &b->p, &c->p, plate_index, px, py);
+      return true;
+   }
+   if (depth == FORWARD_MAX_DEPTH) {
+      return true;
+   }
+
+   for (i=0; i<3; ++i) {
+      if (!mapped[i] && forward_midpoint(plate_index, v[i], v[(i+1)%3], &mid[i]) == -1) {
+         return false;
+      }
+   }
+   return
+      draw_triangle_forward(a, &mid[0], &mid[2], plate_index, px, py, depth+1) &&
+      draw_triangle_forward(&mid[0], b, &mid[1], plate_index, px, py, depth+1) &&
+      draw_triangle_forward(&mid[2], &mid[1], c, plate_index, px, py, depth+1) &&
+      draw_triangle_forward(&mid[0], &mid[1], &mid[2], plate_index, px, py, depth+1);
+}
+
+// fills the screen footprint of a texel on the lensmap, given its top corners
+// top[0..1] and bottom corners bot[0..1]
+// (returns false on error)
+static qboolean draw_texel_forward(const lens_point_t *top, const lens_point_t *bot,
+      int plate_index, int px, int py)
+{
+   int width = globe.plates[plate_index].size;
+   int height = globe.plates[plate_index].height;
+   double u0 = (double)px / width, u1 = (double)(px+1) / width;
+   double v0 = (double)py / height, v1 = (double)(py+1) / height;
+   forward_vertex_t tl = { u0, v0, top[0] };
+   forward_vertex_t tr = { u1, v0, top[1] };
+   forward_vertex_t bl = { u0, v1, bot[0] };
+   forward_vertex_t br = { u1, v1, bot[1] };
+
+   return
+      draw_triangle_forward(&tl, &tr, &br, plate_index, px, py, 0) &&
+      draw_triangle_forward(&tl, &br, &bl, plate_index, px, py, 0);
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS CREATORS                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void create_lensmap_inverse(void)
+{
+   // (prefetched lenses leave the rays of the current lens alone)
+   if (!lens_prefetch.working) {
+      prepare_ray_field();
+   }
+
+   // radially symmetric lenses are only evaluated along one line
+   // (not needed if we are replaying the rays, or for native lenses)
+   radial_table.ready = false;
+   if (lens.symmetry & SYMMETRY_RADIAL && !ray_field.complete && !(lens.native && lens.native->inverse)) {
+      radial_table.ready = build_radial_table();
+   }
+
+   // find where the rows cross the lens image, if the lens gives its outline
+   build_image_spans();
+
+   // show a coarse lens within a few frames if the screen would be empty
+   start_lens_preview();
+
+   if (lens_workers.count > 0 && start_lens_workers()) {
+      return;
+   }
+
+   // initialize progress state
+   lens_builder.inverse_state.ly = num_inverse_tasks()-1;
+
+   resume_lensmap();
+}
+
+static void create_lensmap_forward(void)
+{
+   if (lens_workers.count > 0 && start_lens_workers()) {
+      return;
+   }
+
+   // initialize progress state
+   lens_point_t *rowa = fmem_alloc(FMEM_BUILDER, (globe.platesize+1)*sizeof(lens_point_t));
+   lens_point_t *rowb = fmem_alloc(FMEM_BUILDER, (globe.platesize+1)*sizeof(lens_point_t));
+   lens_builder.forward_state.top = rowa;
+   lens_builder.forward_state.bot = rowb;
+   lens_builder.forward_state.py = globe.plates[0].height-1;
+   lens_builder.forward_state.plate_index = 0;
+
+   resume_lensmap();
+}
+
+static void create_lensmap(void)
+{
+   // show the new lensmap as it is built, if asked to
+   if (!lens_builder.swap) {
+      hide_lensmap();
+   }
+
+   // render nothing if current lens or globe is invalid
+   if (!start_lensmap()) {
+      hide_lensmap();
+   }
+}
+
+// start building the lensmap of the current lens and globe
+// (returns false if they can not make one)
+static qboolean start_lensmap(void)
+{
+   stop_lens_workers();
+   lens_builder.working = false;
+   lens_builder.failed = false;
+   ray_field.filling = false;
+   radial_table.ready = false;
+   if (!lens_prefetch.working) {
+      ray_field.current = false;
+   }
+
+   if (!lens.valid || !globe.valid)
+      return false;
+
+   // test if this lens can support the current fov
+   if (!calc_zoom()) {
+      //Con_Printf("This lens could not be initialized.\n");
+      return false;
+   }
+
+   // clear the side counts, and render whole plates until we know better
+   int i;
+   for (i=0; i<globe.numplates; i++) {
+      globe.plates[i].display = 0;
+      globe.plates[i].scissor.x = globe.plates[i].scissor.y = 0;
+      globe.plates[i].scissor.width = globe.plates[i].size;
+      globe.plates[i].scissor.height = globe.plates[i].height;
+   }
+
+   // skip the lens evaluation entirely if we have built this lensmap before
+   // (unless benchmarking or baking, which build every lensmap)
+   if (!benchmark.active && !lens_bake.active && (load_lens_lru() || load_lenscache())) {
+      end_lensmap();
+      return true;
+   }
+
+   // create lensmap
+   if (lens.map_type == MAP_FORWARD) {
+      create_lensmap_forward();
+   }
+   else if (lens.map_type == MAP_INVERSE) {
+      create_lensmap_inverse();
+   }
+   else { // MAP_NONE
+      Con_Printf("no inverse or forward map being used\n");
+      return false;
+   }
+   return true;
+}
+
+// the lensmap has been built or loaded
+static void end_lensmap(void)
+{
+   if (!benchmark.active && !lensmap_is_resampled()) {
+      save_lens_lru();
+   }
+
+   // a prefetched lensmap is only kept for later
+   if (lens_prefetch.working) {
+      stop_lens_prefetch();
+      return;
+   }
+   finalize_lensmap();
+}
+
+// true if the current lens can be drawn straight from its native inverse
+// (see f_streamlens; the drawer threads can't call into Lua)
+static qboolean can_stream_lens(void)
+{
+   return lens.valid && lens.map_type == MAP_INVERSE && lens.native && lens.native->inverse &&
+      (globe.native || lua_refs.globe_plate == -1);
+}
+
+// set up the current lens to be streamed, which has no lensmap to build
+// (returns false if it can not be shown at this zoom)
+static qboolean start_lens_stream(void)
+{
+   stop_lens_workers();
+   lens_builder.working = false;
+   lens_builder.failed = false;
+   ray_field.filling = false;
+   ray_field.current = false;
+   radial_table.ready = false;
+   hide_lensmap();
+
+   if (!globe.valid || !calc_zoom()) {
+      return false;
+   }
+
+   // not knowing which parts of the plates the lens uses, they are rendered whole
+   int i;
+   for (i=0; i<globe.numplates; i++) {
+      globe.plates[i].display = 1;
+      globe.plates[i].scissor.x = globe.plates[i].scissor.y = 0;
+      globe.plates[i].scissor.width = globe.plates[i].size;
+      globe.plates[i].scissor.height = globe.plates[i].height;
+   }
+   return true;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS BUILDER WORKERS                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static int get_cpu_count(void)
+{
+   int count;
+#ifdef _WIN32
+   SYSTEM_INFO info;
+   GetSystemInfo(&info);
+   count = info.dwNumberOfProcessors;
+#else
+   count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (count < 1) count = 1;
+   if (count > MAX_LENS_WORKERS) count = MAX_LENS_WORKERS;
+   return count;
+}
+
+// print a lens error (workers keep their first error until the main thread prints it)
+static void lens_error(const char *fmt, ...)
+{
+   va_list argptr;
+   char msg[256];
+
+   va_start(argptr, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, argptr);
+   va_end(argptr);
+
+   if (!lens_worker) {
+      Con_Printf("%s", msg);
+   }
+   else if (!lens_worker->error[0]) {
+      strcpy(lens_worker->error, msg);
+   }
+}
+
+// load the lens and globe scripts into the worker's own Lua state
+static qboolean load_worker_scripts(void)
+{
+   char filename[MAX_OSPATH];
+
+   lua_refs.lens_forward = lua_refs.lens_inverse = lua_refs.globe_plate = -1;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/globes/%s.lua", com_basedir, lens_workers.globe_name);
+   if (luaL_loadfile(lua, filename) || lua_pcall(lua, 0, 0, 0)) {
+      lens_error("could not load globe\nERROR: %s", lua_tostring(lua,-1));
+      return false;
+   }
+   if (lua_func_exists("globe_plate")) {
+      lua_getglobal(lua, "globe_plate");
+      lua_refs.globe_plate = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+
+   lua_pushinteger(lua, globe.numplates);
+   lua_setglobal(lua, "numplates");
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua", com_basedir, lens_workers.lens_name);
+   if (luaL_loadfile(lua, filename) || lua_pcall(lua, 0, 0, 0)) {
+      lens_error("could not load lens\nERROR: %s", lua_tostring(lua,-1));
+      return false;
+   }
+   if (lua_func_exists("lens_inverse")) {
+      lua_getglobal(lua, "lens_inverse");
+      lua_refs.lens_inverse = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+   if (lua_func_exists("lens_forward")) {
+      lua_getglobal(lua, "lens_forward");
+      lua_refs.lens_forward = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+   LUA_get_lens_batch_refs();
+
+   return true;
+}
+
+static void run_lens_worker(struct _lens_worker *worker)
+{
+   lens_worker = worker;
+   lua = create_lua_state();
+
+   lens_point_t *top = NULL, *bot = NULL;
+   if (lens_workers.map_type == MAP_FORWARD) {
+      top = fmem_alloc(FMEM_BUILDER, (globe.platesize+1)*sizeof(lens_point_t));
+      bot = fmem_alloc(FMEM_BUILDER, (globe.platesize+1)*sizeof(lens_point_t));
+   }
+
+   qboolean ok = load_worker_scripts();
+   while (ok && !lens_workers.cancel)
+   {
+      // claim the next row or plate
+      mutex_lock(&lens_workers.lock);
+      int task = lens_workers.next_task++;
+      mutex_unlock(&lens_workers.lock);
+      if (task >= lens_workers.numtasks) {
+         break;
+      }
+
+      if (lens_workers.map_type == MAP_INVERSE) {
+         ok = build_lensmap_band_inverse(task);
+      }
+      else {
+         int py = globe.plates[task].height-1;
+         worker->plate_index = task;
+         ok = build_lensmap_rows_forward(task, &top, &bot, &py) != -1;
+      }
+   }
+
+   if (!ok) {
+      worker->failed = true;
+      lens_workers.cancel = true;
+   }
+
+   fmem_free(top);
+   fmem_free(bot);
+   lua_close(lua);
+   lua = NULL;
+
+   mutex_lock(&lens_workers.lock);
+   lens_workers.numdone++;
+   mutex_unlock(&lens_workers.lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI lens_worker_main(LPVOID arg)
+{
+   run_lens_worker(arg);
+   return 0;
+}
+#else
+static void *lens_worker_main(void *arg)
+{
+   run_lens_worker(arg);
+   return NULL;
+}
+#endif
+
+static qboolean start_lens_workers(void)
+{
+   int i;
+   int area = lens.width_px * lens.height_px;
+
+   lens_workers.map_type = lens.map_type;
+   strcpy(lens_workers.lens_name, lens.name);
+   strcpy(lens_workers.globe_name, globe.name);
+   lens_workers.numtasks = lens.map_type == MAP_INVERSE ? num_inverse_tasks() : globe.numplates;
+   lens_workers.next_task = 0;
+   lens_workers.numdone = 0;
+   lens_workers.cancel = false;
+
+   if (lens.map_type == MAP_INVERSE) {
+      lens_workers.pixels = fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+      if (!lens_workers.pixels) {
+         Con_Printf("Quake-Lenses: not enough memory for the lens workers, building on the main thread\n");
+         return false;
+      }
+      memset(lens_workers.pixels, 0xff, area*sizeof(unsigned));
+   }
+
+   lens_workers.numthreads = 0;
+   for (i=0; i<lens_workers.count; ++i) {
+      struct _lens_worker *worker = &lens_workers.workers[i];
+      memset(worker, 0, sizeof(*worker));
+#ifdef _WIN32
+      worker->thread = CreateThread(NULL, 0, lens_worker_main, worker, 0, NULL);
+      if (!worker->thread) break;
+#else
+      if (pthread_create(&worker->thread, NULL, lens_worker_main, worker)) break;
+#endif
+      lens_workers.numthreads++;
+   }
+
+   lens_workers.running = true;
+   lens_builder.working = true;
+   return true;
+}
+
+static void join_lens_workers(void)
+{
+   int i;
+   for (i=0; i<lens_workers.numthreads; ++i) {
+#ifdef _WIN32
+      WaitForSingleObject(lens_workers.workers[i].thread, INFINITE);
+      CloseHandle(lens_workers.workers[i].thread);
+#else
+      pthread_join(lens_workers.workers[i].thread, NULL);
+#endif
+   }
+   lens_workers.running = false;
+}
+
+static void free_lens_workers(void)
+{
+   int i;
+   fmem_free(lens_workers.pixels);
+   lens_workers.pixels = NULL;
+   for (i=0; i<MAX_PLATES; ++i) {
+      fmem_free(lens_workers.plate_writes[i].writes);
+      lens_workers.plate_writes[i].writes = NULL;
+      lens_workers.plate_writes[i].count = lens_workers.plate_writes[i].size = 0;
+   }
+}
+
+// abandon the current threaded build
+static void stop_lens_workers(void)
+{
+   if (!lens_workers.running) {
+      return;
+   }
+   lens_workers.cancel = true;
+   join_lens_workers();
+   free_lens_workers();
+   lens_builder.working = false;
+}
+
+// publish the threaded build once all workers have finished
+// (returns false if the workers are still busy)
+static qboolean finish_lens_workers(void)
+{
+   int i, j;
+
+   mutex_lock(&lens_workers.lock);
+   qboolean done = lens_workers.numdone == lens_workers.numthreads;
+   mutex_unlock(&lens_workers.lock);
+   if (!done) {
+      return false;
+   }
+
+   join_lens_workers();
+
+   if (lens_workers.numthreads == 0) {
+      Con_Printf("could not start lens builder threads\n");
+      lens_builder.failed = true;
+   }
+
+   for (i=0; i<lens_workers.numthreads; ++i) {
+      struct _lens_worker *worker = &lens_workers.workers[i];
+      if (worker->error[0]) {
+         Con_Printf("%s", worker->error);
+      }
+      if (worker->failed) {
+         lens_builder.failed = true;
+      }
+      for (j=0; j<globe.numplates; ++j) {
+         if (worker->display[j]) {
+            globe.plates[j].display = 1;
+         }
+      }
+   }
+
+   int area = lens.width_px * lens.height_px;
+   if (lens_workers.map_type == MAP_INVERSE) {
+      memcpy(lens.pixels, lens_workers.pixels, area*sizeof(unsigned));
+   }
+   else {
+      // replay in plate order so overlapping quads resolve like a serial build
+      for (i=0; i<globe.numplates; ++i) {
+         pixel_write_t *w = lens_workers.plate_writes[i].writes;
+         for (j=0; j<lens_workers.plate_writes[i].count; ++j, ++w) {
+            lens.pixels[w->index] = w->pixel;
+         }
+      }
+   }
+
+   free_lens_workers();
+   return true;
+}
+
+// called by set_lensmap_from_plate on worker threads
+static void record_worker_pixel(int lx, int ly, unsigned pixel, int plate_index)
+{
+   int index = lx + ly*lens.width_px;
+
+   lens_worker->display[plate_index] = 1;
+
+   // rows are claimed by a single worker, so it can write its own pixels
+   if (lens_workers.map_type == MAP_INVERSE) {
+      lens_workers.pixels[index] = pixel;
+      return;
+   }
+
+   // plates are claimed by a single worker, so it owns its write list
+   int p = lens_worker->plate_index;
+   if (lens_workers.plate_writes[p].count == lens_workers.plate_writes[p].size) {
+      int size = lens_workers.plate_writes[p].size ? lens_workers.plate_writes[p].size*2 : 4096;
+      pixel_write_t *writes = fmem_realloc(FMEM_BUILDER, lens_workers.plate_writes[p].writes, size*sizeof(pixel_write_t));
+      if (!writes) {
+         lens_error("could not allocate lens builder memory\n");
+         lens_worker->failed = true;
+         lens_workers.cancel = true;
+         return;
+      }
+      lens_workers.plate_writes[p].writes = writes;
+      lens_workers.plate_writes[p].size = size;
+   }
+   pixel_write_t *w = &lens_workers.plate_writes[p].writes[lens_workers.plate_writes[p].count++];
+   w->index = index;
+   w->pixel = pixel;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           RAY FIELD                                          |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// Rays are stored as two 16-bit coordinates on an octahedron, which is accurate
+// to a small fraction of a plate pixel at any sensible plate size.
+#define RAYFIELD_MAX 65534  // (never produces RAYFIELD_NONE)
+
+static unsigned encode_ray(vec3_t ray)
+{
+   double l1 = fabs(ray[0]) + fabs(ray[1]) + fabs(ray[2]);
+   if (l1 == 0) {
+      return RAYFIELD_NONE;
+   }
+   double u = ray[0] / l1;
+   double v = ray[1] / l1;
+
+   // fold the back half of the octahedron over the front
+   if (ray[2] < 0) {
+      double t = u;
+      u = (1 - fabs(v)) * (t >= 0 ? 1 : -1);
+      v = (1 - fabs(t)) * (v >= 0 ? 1 : -1);
+   }
+
+   unsigned iu = (unsigned)floor((u*0.5 + 0.5) * RAYFIELD_MAX + 0.5);
+   unsigned iv = (unsigned)floor((v*0.5 + 0.5) * RAYFIELD_MAX + 0.5);
+   return iu | (iv << 16);
+}
+
+static void decode_ray(unsigned code, vec3_t ray)
+{
+   double u = (code & 0xffff) * 2.0 / RAYFIELD_MAX - 1;
+   double v = (code >> 16) * 2.0 / RAYFIELD_MAX - 1;
+   double z = 1 - fabs(u) - fabs(v);
+
+   if (z < 0) {
+      double t = u;
+      u = (1 - fabs(v)) * (t >= 0 ? 1 : -1);
+      v = (1 - fabs(t)) * (v >= 0 ? 1 : -1);
+   }
+
+   ray[0] = u;
+   ray[1] = v;
+   ray[2] = z;
+   VectorNormalize(ray);
+}
+
+static qboolean calc_ray_field_key(unsigned *key)
+{
+   char filename[MAX_OSPATH];
+   unsigned hash = 2166136261u;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua", com_basedir, lens.name);
+   if (!hash_file(&hash, filename)) {
+      return false;
+   }
+
+   int params[] = { zoom.type, zoom.fov, lens.width_px, lens.height_px, lens_grid_size() };
+   hash = hash_bytes(hash, params, sizeof(params));
+   hash = hash_bytes(hash, &lens.scale, sizeof(lens.scale));
+
+   *key = hash;
+   return true;
+}
+
+// reuse the rays of the last build if they belong to the current lens,
+// otherwise get ready to record them
+static void prepare_ray_field(void)
+{
+   unsigned key;
+   if (!calc_ray_field_key(&key)) {
+      ray_field.complete = ray_field.filling = false;
+      return;
+   }
+
+   if (ray_field.complete && ray_field.key == key &&
+         ray_field.width == lens.width_px && ray_field.height == lens.height_px) {
+      ray_field.filling = false;
+      return;
+   }
+
+   // (unless the exact rays are wanted now)
+   qboolean refining = ray_field.refining;
+   ray_field.refining = false;
+   if (!refining && resample_ray_field()) {
+      ray_field.key = key;
+      return;
+   }
+   ray_field.resampled = false;
+
+   int area = lens.width_px * lens.height_px;
+   if (ray_field.width * ray_field.height != area) {
+      fmem_free(ray_field.rays);
+      ray_field.rays = fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+   }
+   ray_field.complete = false;
+   ray_field.filling = ray_field.rays != NULL;
+   ray_field.width = ray_field.rays ? lens.width_px : 0;
+   ray_field.height = ray_field.rays ? lens.height_px : 0;
+   ray_field.key = key;
+   if (ray_field.rays) {
+      memset(ray_field.rays, 0xff, area*sizeof(unsigned));
+   }
+}
+
+// true if the stored rays are complete and belong to the current lens
+static qboolean ray_field_matches(void)
+{
+   unsigned key;
+   return ray_field.complete && calc_ray_field_key(&key) && ray_field.key == key &&
+      ray_field.width == lens.width_px && ray_field.height == lens.height_px;
+}
+
+// calculate all the pixels in a lens row from the stored rays
+static qboolean build_lensmap_row_from_rays(int ly)
+{
+   unsigned *code = ray_field.rays + ly*ray_field.width;
+   int lx;
+   for (lx=0; lx<ray_field.width; ++lx) {
+      if (code[lx] != RAYFIELD_NONE) {
+         vec3_t ray;
+         decode_ray(code[lx], ray);
+         set_lensmap_from_ray(lx,ly,ray[0],ray[1],ray[2]);
+      }
+   }
+   return true;
+}
+
+// identifies the lens that the master rays belong to, at any size or zoom
+static qboolean calc_ray_master_key(unsigned *key)
+{
+   char filename[MAX_OSPATH];
+   unsigned hash = 2166136261u;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua", com_basedir, lens.name);
+   if (!hash_file(&hash, filename)) {
+      return false;
+   }
+   int grid = lens_grid_size();
+   *key = hash_bytes(hash, &grid, sizeof(grid));
+   return true;
+}
+
+// keep the rays just found by running the lens for later resizes
+static void keep_ray_master(void)
+{
+   unsigned key;
+   if (!calc_ray_master_key(&key)) {
+      return;
+   }
+   int area = ray_field.width * ray_field.height;
+   if (!ray_field.master || ray_field.master_width * ray_field.master_height != area) {
+      fmem_free(ray_field.master);
+      ray_field.master = fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+      if (!ray_field.master) {
+         return;
+      }
+   }
+   memcpy(ray_field.master, ray_field.rays, area*sizeof(unsigned));
+   ray_field.master_width = ray_field.width;
+   ray_field.master_height = ray_field.height;
+   ray_field.master_scale = lens.scale;
+   ray_field.master_key = key;
+}
+
+// find the rays of the current size and zoom from the master rays, blending
+// the four nearest where they agree (returns false if the master rays do not
+// belong to this lens or do not cover the whole view)
+static qboolean resample_ray_field(void)
+{
+   unsigned key;
+   if (!ray_field.master || lens.scale <= 0 || ray_field.master_scale <= 0 ||
+         !calc_ray_master_key(&key) || key != ray_field.master_key) {
+      return false;
+   }
+
+   int w = lens.width_px, h = lens.height_px;
+   int w0 = ray_field.master_width, h0 = ray_field.master_height;
+   if (w0 < 2 || h0 < 2) {
+      return false;
+   }
+
+   // master pixel under lens pixel (lx,ly), see lens_pixel_to_ray
+   double k = lens.scale / ray_field.master_scale;
+   double fx0 = (0 - w/2) * k + w0/2, fx1 = (w-1 - w/2) * k + w0/2;
+   double fy0 = (0 - h/2) * k + h0/2, fy1 = (h-1 - h/2) * k + h0/2;
+   if (fx0 < -0.5 || fy0 < -0.5 || fx1 > w0-0.5 || fy1 > h0-0.5) {
+      return false;
+   }
+
+   int area = w * h;
+   if (ray_field.width * ray_field.height != area || !ray_field.rays) {
+      fmem_free(ray_field.rays);
+      ray_field.rays = fmem_alloc(FMEM_LENSMAP, area*sizeof(unsigned));
+      if (!ray_field.rays) {
+         ray_field.width = ray_field.height = 0;
+         return false;
+      }
+   }
+
+   int lx, ly, i;
+   for (ly=0; ly<h; ++ly) {
+      double fy = (ly - h/2) * k + h0/2;
+      if (fy < 0) fy = 0;
+      if (fy > h0-1) fy = h0-1;
+      int iy = (int)fy < h0-1 ? (int)fy : h0-2;
+      double ty = fy - iy;
+      unsigned *out = ray_field.rays + ly*w;
+      for (lx=0; lx<w; ++lx) {
+         double fx = (lx - w/2) * k + w0/2;
+         if (fx < 0) fx = 0;
+         if (fx > w0-1) fx = w0-1;
+         int ix = (int)fx < w0-1 ? (int)fx : w0-2;
+         double tx = fx - ix;
+
+         const unsigned *m = ray_field.master + ix + iy*w0;
+         unsigned c[4] = { m[0], m[1], m[w0], m[w0+1] };
+         unsigned nearest = c[(tx >= 0.5) + 2*(ty >= 0.5)];
+
+         // the edge of the lens, or a seam in it, takes the nearest ray
+         vec3_t r[4];
+         qboolean blend = true;
+         for (i=0; i<4 && blend; ++i) {
+            if (c[i] == RAYFIELD_NONE) {
+               blend = false;
+            }
+            else {
+               decode_ray(c[i], r[i]);
+               blend = i == 0 || DotProduct(r[0], r[i]) > RAYFIELD_MAX_BLEND_COS;
+            }
+         }
+         if (!blend) {
+            out[lx] = nearest;
+            continue;
+         }
+
+         vec3_t ray;
+         for (i=0; i<3; ++i) {
+            ray[i] = (1-ty) * ((1-tx)*r[0][i] + tx*r[1][i]) + ty * ((1-tx)*r[2][i] + tx*r[3][i]);
+         }
+         VectorNormalize(ray);
+         out[lx] = encode_ray(ray);
+      }
+   }
+
+   ray_field.width = w;
+   ray_field.height = h;
+   ray_field.complete = true;
+   ray_field.filling = false;
+   ray_field.resampled = true;
+   ray_field.resampled_time = Sys_DoubleTime();
+   return true;
+}
+
+// true if the lensmap being built comes from resampled rays
+static qboolean lensmap_is_resampled(void)
+{
+   return lens.map_type == MAP_INVERSE && ray_field.resampled && ray_field_matches();
+}
+
+// once the size has settled, build the exact rays of a resampled lensmap,
+// showing the resampled one until they are done
+static void refine_ray_field(void)
+{
+   if (!ray_field.resampled || lens_builder.working || lens_prefetch.working || benchmark.active ||
+         Sys_DoubleTime() - ray_field.resampled_time < RAYFIELD_SETTLE || !lensmap_is_resampled()) {
+      return;
+   }
+   ray_field.resampled = false;
+   ray_field.complete = false;
+   ray_field.refining = true;
+   lens.changed = true;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENSMAP CACHE                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// Finished lensmaps are saved to "<gamedir>/lenscache/<key>.lmap" so that
+// switching back to a lens (or restarting the game) does not require running
+// the lens script for every pixel again.  The key is a hash of everything
+// that affects the lensmap: the lens and globe scripts, the zoom, the rubix
+// grid, and the lens and plate sizes.  Lensmaps not in the gamedir are looked
+// for in the paks too, where tyr-lensbake puts the ones for the shipped lenses.
+//
+// File layout:
+//    header
+//    byte  plate[area]        (plate index of each lens pixel, 255 = no pixel)
+//    byte  offsets[packed]    (pixel offset inside the plate of each pixel
+//                              that has one, as the zigzag varint of its
+//                              difference from the one before, which is
+//                              mostly a single byte along a row)
+
+#define LENSCACHE_DIR "lenscache"
+#define LENSCACHE_VERSION 3
+
+typedef struct {
+   char magic[4];
+   int version;
+   unsigned key;
+   int width_px, height_px;
+   int platesize;
+   int numplates;
+   int display[MAX_PLATES];
+   int packed;
+} lenscache_header_t;
+
+// 32-bit FNV-1a
+static unsigned hash_bytes(unsigned hash, const void *data, size_t len)
+{
+   const byte *p = data;
+   while (len--) {
+      hash ^= *p++;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+static qboolean hash_file(unsigned *hash, const char *filename)
+{
+   byte buf[4096];
+   size_t len;
+   FILE *f = fopen(filename, "rb");
+   if (!f) {
+      return false;
+   }
+   while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+      *hash = hash_bytes(*hash, buf, len);
+   }
+   fclose(f);
+   return true;
+}
+
+static qboolean calc_lenscache_key(unsigned *key)
+{
+   char filename[MAX_OSPATH];
+   unsigned hash = 2166136261u;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua", com_basedir, lens.name);
+   if (!hash_file(&hash, filename)) {
+      return false;
+   }
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/globes/%s.lua", com_basedir, globe.name);
+   if (!hash_file(&hash, filename)) {
+      return false;
+   }
+
+   int params[] = { zoom.type, zoom.fov, lens.width_px, lens.height_px, globe.platesize, globe.numplates, lens_grid_size() };
+   hash = hash_bytes(hash, params, sizeof(params));
+
+   int i;
+   for (i=0; i<globe.numplates; ++i) {
+      hash = hash_bytes(hash, &globe.plates[i].size, sizeof(int));
+      hash = hash_bytes(hash, &globe.plates[i].fov, sizeof(vec_t));
+      hash = hash_bytes(hash, &globe.plates[i].aspect, sizeof(vec_t));
+   }
+
+   *key = hash;
+   return true;
+}
+
+static void lenscache_filename(char *filename, size_t len, unsigned key)
+{
+   snprintf(filename, len, "%s/%s/%08x.lmap", com_gamedir, LENSCACHE_DIR, key);
+}
+
+// fill the lensmap from the cache, returns false if there is no usable entry
+static qboolean load_lenscache(void)
+{
+   unsigned key;
+   if (!calc_lenscache_key(&key)) {
+      return false;
+   }
+
+   char filename[MAX_OSPATH];
+   lenscache_filename(filename, sizeof(filename), key);
+   FILE *f = fopen(filename, "rb");
+   if (!f) {
+      // (a baked lensmap, see tools/lensbake.c)
+      size_t offset, length;
+      if (!COM_FindFile(va("%s/%08x.lmap", LENSCACHE_DIR, key), filename, sizeof(filename), &offset, &length) ||
+            !(f = fopen(filename, "rb"))) {
+         return false;
+      }
+      fseek(f, offset, SEEK_SET);
+   }
+
+   int area = lens.width_px * lens.height_px;
+   int platearea = globe.platesize * globe.platesize;
+   byte *plates = fmem_alloc(FMEM_CACHE, area);
+   byte *packed = fmem_alloc(FMEM_CACHE, area*5);
+   qboolean ok = false;
+
+   lenscache_header_t header;
+   if (plates && packed &&
+         fread(&header, sizeof(header), 1, f) == 1 &&
+         !memcmp(header.magic, "LMAP", 4) &&
+         header.version == LENSCACHE_VERSION &&
+         header.key == key &&
+         header.width_px == lens.width_px &&
+         header.height_px == lens.height_px &&
+         header.platesize == globe.platesize &&
+         header.numplates == globe.numplates &&
+         header.packed >= 0 && header.packed <= area*5 &&
+         fread(plates, 1, area, f) == area &&
+         fread(packed, 1, header.packed, f) == header.packed)
+   {
+      ok = true;
+      int i, next = 0, offset = 0;
+      for (i=0; i<area && ok; ++i) {
+         if (plates[i] == 255) {
+            lens.pixels[i] = LENSPIXEL_NONE;
+            continue;
+         }
+         unsigned zigzag = 0;
+         int shift = 0;
+         while (next < header.packed && shift < 32) {
+            byte b = packed[next++];
+            zigzag |= (unsigned)(b & 0x7f) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+               break;
+            }
+         }
+         offset += (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+         if (plates[i] < globe.numplates && offset >= 0 && offset < platearea) {
+            lens.pixels[i] = GLOBEOFFSET(plates[i], 0, 0) + offset;
+         }
+         else {
+            ok = false;
+         }
+      }
+      for (i=0; i<globe.numplates; ++i) {
+         globe.plates[i].display = header.display[i];
+      }
+   }
+
+   // do not leave a half-loaded lensmap behind
+   if (!ok) {
+      memset(lens.pixels, 0xff, area*sizeof(unsigned));
+   }
+
+   fmem_free(plates);
+   fmem_free(packed);
+   fclose(f);
+   return ok;
+}
+
+static void save_lenscache(void)
+{
+   unsigned key;
+   if (!calc_lenscache_key(&key)) {
+      return;
+   }
+
+   int area = lens.width_px * lens.height_px;
+   int platearea = globe.platesize * globe.platesize;
+   byte *plates = fmem_alloc(FMEM_CACHE, area);
+   byte *packed = fmem_alloc(FMEM_CACHE, area*5);
+   if (!plates || !packed) {
+      fmem_free(plates);
+      fmem_free(packed);
+      return;
+   }
+
+   int i, numpacked = 0, prev = 0;
+   for (i=0; i<area; ++i) {
+      if (lens.pixels[i] != LENSPIXEL_NONE) {
+         int offset = lens.pixels[i] % platearea;
+         plates[i] = lens.pixels[i] / platearea;
+         int delta = offset - prev;
+         unsigned zigzag = ((unsigned)delta << 1) ^ (unsigned)(delta >> 31);
+         while (zigzag >= 0x80) {
+            packed[numpacked++] = (zigzag & 0x7f) | 0x80;
+            zigzag >>= 7;
+         }
+         packed[numpacked++] = zigzag;
+         prev = offset;
+      }
+      else {
+         plates[i] = 255;
+      }
+   }
+
+   lenscache_header_t header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, "LMAP", 4);
+   header.version = LENSCACHE_VERSION;
+   header.key = key;
+   header.width_px = lens.width_px;
+   header.height_px = lens.height_px;
+   header.platesize = globe.platesize;
+   header.numplates = globe.numplates;
+   for (i=0; i<globe.numplates; ++i) {
+      header.display[i] = globe.plates[i].display;
+   }
+   header.packed = numpacked;
+
+   char filename[MAX_OSPATH];
+   snprintf(filename, sizeof(filename), "%s/%s", com_gamedir, LENSCACHE_DIR);
+   Sys_mkdir(filename);
+   lenscache_filename(filename, sizeof(filename), key);
+
+   FILE *f = fopen(filename, "wb");
+   if (f) {
+      fwrite(&header, sizeof(header), 1, f);
+      fwrite(plates, 1, area, f);
+      fwrite(packed, 1, numpacked, f);
+      fclose(f);
+      if (lens_bake.active) {
+         ++lens_bake.count;
+         lens_bake.saved(filename);
+      }
+   }
+   else {
+      Con_Printf("could not write lens cache %s\n", filename);
+   }
+
+   fmem_free(plates);
+   fmem_free(packed);
+}
+
+static int find_lens_lru(unsigned key)
+{
+   int i;
+   for (i=0; i<lens_lru.count; ++i) {
+      struct _lens_lru_entry *e = &lens_lru.entries[i];
+      if (e->key == key && e->width_px == lens.width_px && e->height_px == lens.height_px &&
+            e->numplates == globe.numplates) {
+         return i;
+      }
+   }
+   return -1;
+}
+
+// make an entry the most recently used
+static void touch_lens_lru(int index)
+{
+   struct _lens_lru_entry e = lens_lru.entries[index];
+   memmove(lens_lru.entries+1, lens_lru.entries, index*sizeof(e));
+   lens_lru.entries[0] = e;
+}
+
+// drop the least recently used entries until they fit the budget
+static void trim_lens_lru(void)
+{
+   double budget = lens_lru_budget();
+   double total = 0;
+   int i;
+   for (i=0; i<lens_lru.count; ++i) {
+      struct _lens_lru_entry *e = &lens_lru.entries[i];
+      total += (double)e->width_px * e->height_px * sizeof(unsigned);
+      if (total > budget) {
+         break;
+      }
+   }
+   while (lens_lru.count > i) {
+      struct _lens_lru_entry *e = &lens_lru.entries[--lens_lru.count];
+      fmem_free(e->pixels);
+   }
+}
+
+// fill the lensmap from memory, returns false if it is not there
+static qboolean load_lens_lru(void)
+{
+   unsigned key;
+   if (!calc_lenscache_key(&key)) {
+      return false;
+   }
+
+   int index = find_lens_lru(key);
+   if (index < 0) {
+      return false;
+   }
+
+   int area = lens.width_px * lens.height_px;
+   struct _lens_lru_entry *e = &lens_lru.entries[index];
+   memcpy(lens.pixels, e->pixels, area*sizeof(unsigned));
+   int i;
+   for (i=0; i<globe.numplates; ++i) {
+      globe.plates[i].display = e->display[i];
+   }
+
+   touch_lens_lru(index);
+   return true;
+}
+
+// keep the finished lensmap in memory
+static void save_lens_lru(void)
+{
+   unsigned key;
+   if (!calc_lenscache_key(&key)) {
+      return;
+   }
+
+   int index = find_lens_lru(key);
+   if (index >= 0) {
+      touch_lens_lru(index);
+      return;
+   }
+
+   int area = lens.width_px * lens.height_px;
+   if ((double)area * sizeof(unsigned) > lens_lru_budget()) {
+      return;
+   }
+
+   // make room at the back, then move it to the front
+   if (lens_lru.count == MAX_LENS_LRU) {
+      struct _lens_lru_entry *e = &lens_lru.entries[--lens_lru.count];
+      fmem_free(e->pixels);
+   }
+
+   struct _lens_lru_entry *e = &lens_lru.entries[lens_lru.count];
+   e->pixels = fmem_alloc(FMEM_CACHE, area*sizeof(unsigned));
+   if (!e->pixels) {
+      return;
+   }
+
+   e->key = key;
+   e->width_px = lens.width_px;
+   e->height_px = lens.height_px;
+   e->numplates = globe.numplates;
+   memcpy(e->pixels, lens.pixels, area*sizeof(unsigned));
+   int i;
+   for (i=0; i<globe.numplates; ++i) {
+      e->display[i] = globe.plates[i].display;
+   }
+
+   touch_lens_lru(lens_lru.count++);
+   trim_lens_lru();
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           SCRIPT WATCHER                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// true if the script has new contents since it was last checked
+// (a script seen for the first time is only noted)
+static qboolean check_watched_script(struct _watched_script *script, const char *kind, const char *name)
+{
+   char filename[MAX_OSPATH];
+   struct stat st;
+   unsigned hash = 2166136261u;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/%s/%s.lua", com_basedir, kind, name);
+   if (!name[0] || stat(filename, &st)) {
+      return false;
+   }
+
+   // (saving a file without changing it leaves the lensmap alone)
+   qboolean seen = !strcmp(script->name, name);
+   if (seen && st.st_mtime == script->mtime) {
+      return false;
+   }
+   if (!hash_file(&hash, filename)) {
+      return false;
+   }
+   qboolean changed = seen && hash != script->hash;
+   snprintf(script->name, sizeof(script->name), "%s", name);
+   script->mtime = st.st_mtime;
+   script->hash = hash;
+   return changed;
+}
+
+// reload the lens or globe if its script has been edited (see script_watch)
+static void check_watched_scripts(void)
+{
+   double now = Sys_DoubleTime();
+   if (!script_watch.enabled || now < script_watch.next_check) {
+      return;
+   }
+   script_watch.next_check = now + SCRIPT_WATCH_INTERVAL;
+
+   // (a shortcut lens being prefetched is not the one in use)
+   if (lens_prefetch.working) {
+      return;
+   }
+
+   if (check_watched_script(&script_watch.globe, "globes", globe.name)) {
+      Con_Printf("f_hotreload: reloading globe %s\n", globe.name);
+      reload_globe();
+   }
+   if (check_watched_script(&script_watch.lens, "lenses", lens.name)) {
+      Con_Printf("f_hotreload: reloading lens %s\n", lens.name);
+      reload_lens();
+   }
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS PREFETCH                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// start building the next shortcut lens that is not the current one
+static void start_lens_prefetch(void)
+{
+   if (lens_prefetch.working || benchmark.active || !shortcutkeys_enabled || !lens_builder.swap ||
+         !lens_front.valid || lens_lru.budget_mb <= 0 || !lens.valid) {
+      return;
+   }
+
+   const char *name = NULL;
+   while (!name && lens_prefetch.next < NUM_SHORTCUT_LENSES) {
+      name = shortcut_lenses[lens_prefetch.next++];
+      if (!strcmp(name, lens.name)) {
+         name = NULL;
+      }
+   }
+   if (!name) {
+      return;
+   }
+
+   // swap the current lens out
+   int i;
+   lens_prefetch.working = true;
+   snprintf(lens_prefetch.active, sizeof(lens_prefetch.active), "%s", lens.name);
+   for (i=0; i<MAX_PLATES; ++i) {
+      lens_prefetch.sizes[i] = globe.plates[i].size;
+      set_plate_size(&globe.plates[i], globe.platesize);
+   }
+   lens_prefetch.ray_field_complete = ray_field.complete;
+   ray_field.complete = false;
+
+   // (a switch to the lens builds it with full size plates first)
+   snprintf(lens.name, sizeof(lens.name), "%s", name);
+   lens.valid = LUA_load_lens();
+   if (!lens.valid || !start_lensmap()) {
+      stop_lens_prefetch();
+   }
+}
+
+// put the current lens back
+static void stop_lens_prefetch(void)
+{
+   if (!lens_prefetch.working) {
+      return;
+   }
+
+   stop_lens_workers();
+   lens_builder.working = false;
+   lens_builder.failed = false;
+   lens_prefetch.working = false;
+
+   int i;
+   snprintf(lens.name, sizeof(lens.name), "%s", lens_prefetch.active);
+   for (i=0; i<MAX_PLATES; ++i) {
+      set_plate_size(&globe.plates[i], lens_prefetch.sizes[i]);
+   }
+   ray_field.complete = lens_prefetch.ray_field_complete;
+   ray_field.filling = false;
+
+   lens.valid = LUA_load_lens();
+   if (lens.valid) {
+      calc_zoom();
+   }
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENSMAP SPANS                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean add_lens_span(int kind, int x, int len, int stride, unsigned start)
+{
+   if (lens_spans.numspans == lens_spans.maxspans) {
+      int maxspans = lens_spans.maxspans ? lens_spans.maxspans*2 : 1024;
+      struct _lens_span *spans = fmem_realloc(FMEM_LENSMAP, lens_spans.spans, maxspans*sizeof(struct _lens_span));
+      if (!spans) {
+         return false;
+      }
+      lens_spans.spans = spans;
+      lens_spans.maxspans = maxspans;
+   }
+
+   struct _lens_span *span = &lens_spans.spans[lens_spans.numspans++];
+   span->kind = kind;
+   span->x = x;
+   span->len = len;
+   span->stride = stride;
+   span->start = start;
+   lens_spans.counts[kind] += len;
+   return true;
+}
+
+static qboolean add_lens_gap(int x, int len)
+{
+   if (lens_spans.numgaps == lens_spans.maxgaps) {
+      int maxgaps = lens_spans.maxgaps ? lens_spans.maxgaps*2 : 1024;
+      struct _lens_gap *gaps = fmem_realloc(FMEM_LENSMAP, lens_spans.gaps, maxgaps*sizeof(struct _lens_gap));
+      if (!gaps) {
+         return false;
+      }
+      lens_spans.gaps = gaps;
+      lens_spans.maxgaps = maxgaps;
+   }
+
+   struct _lens_gap *gap = &lens_spans.gaps[lens_spans.numgaps++];
+   gap->x = x;
+   gap->len = len;
+   lens_spans.gapcount += len;
+   return true;
+}
+
+// compress each row of the finished lensmap into spans
+static void build_lensmap_spans(void)
+{
+   int x,y;
+
+   lens_spans.ready = false;
+   lens_spans.numspans = 0;
+   lens_spans.numgaps = 0;
+   lens_spans.gapcount = 0;
+   memset(lens_spans.counts, 0, sizeof(lens_spans.counts));
+
+   fmem_free(lens_spans.rows);
+   fmem_free(lens_spans.gaprows);
+   lens_spans.rows = fmem_alloc(FMEM_LENSMAP, (lens.height_px+1)*sizeof(int));
+   lens_spans.gaprows = fmem_alloc(FMEM_LENSMAP, (lens.height_px+1)*sizeof(int));
+   if (!lens_spans.rows || !lens_spans.gaprows) {
+      return;
+   }
+
+   for (y=0; y<lens.height_px; ++y)
+   {
+      unsigned *row = LENSPIXEL(0,y);
+      lens_spans.rows[y] = lens_spans.numspans;
+
+      for (x=0; x<lens.width_px; )
+      {
+         if (row[x] == LENSPIXEL_NONE) {
+            ++x;
+            continue;
+         }
+
+         // measure how far the globe offsets keep a constant step from here
+         int len = 1;
+         int stride = 0;
+         if (x+1 < lens.width_px && row[x+1] != LENSPIXEL_NONE) {
+            stride = (int)(row[x+1] - row[x]);
+            for (len=2; x+len < lens.width_px; ++len) {
+               unsigned p = row[x+len];
+               if (p == LENSPIXEL_NONE || (int)(p - row[x+len-1]) != stride) {
+                  break;
+               }
+            }
+         }
+
+         if (len >= SPAN_MIN_RUN) {
+            if (!add_lens_span(stride == 1 ? SPAN_RUN : SPAN_STRIDED, x, len, stride, row[x])) {
+               return;
+            }
+            x += len;
+            continue;
+         }
+
+         // grow the scattered span we are in, or start a new one
+         struct _lens_span *last = lens_spans.numspans > lens_spans.rows[y] ?
+            &lens_spans.spans[lens_spans.numspans-1] : NULL;
+         if (last && last->kind == SPAN_SCATTERED && last->x + last->len == x) {
+            ++last->len;
+            ++lens_spans.counts[SPAN_SCATTERED];
+         }
+         else if (!add_lens_span(SPAN_SCATTERED, x, 1, 0, 0)) {
+            return;
+         }
+         ++x;
+      }
+
+      // the gaps are what the spans of the row leave
+      int s, end = 0;
+      lens_spans.gaprows[y] = lens_spans.numgaps;
+      for (s=lens_spans.rows[y]; s<lens_spans.numspans; ++s) {
+         struct _lens_span *span = &lens_spans.spans[s];
+         if (span->x > end && !add_lens_gap(end, span->x - end)) {
+            return;
+         }
+         end = span->x + span->len;
+      }
+      if (end < lens.width_px && !add_lens_gap(end, lens.width_px - end)) {
+         return;
+      }
+   }
+   lens_spans.rows[lens.height_px] = lens_spans.numspans;
+   lens_spans.gaprows[lens.height_px] = lens_spans.numgaps;
+   lens_spans.ready = true;
+
+   build_lens_tiles(lens.pixels);
+}
+
+static int compare_lens_tiles(const void *a, const void *b)
+{
+   unsigned ka = ((const struct _lens_tile *)a)->key;
+   unsigned kb = ((const struct _lens_tile *)b)->key;
+   return ka < kb ? -1 : ka > kb;
+}
+
+// cut the spans of the given lensmap into tiles of f_lenstiles pixels, and
+// sort the tiles by the plate pixels they read
+static void build_lens_tiles(const unsigned *pixels)
+{
+   int size = lens_tiles.size;
+   int x, y, c;
+
+   lens_tiles.ready = false;
+   lens_tiles.numtiles = 0;
+   if (size == 0 || !lens_spans.ready) {
+      return;
+   }
+
+   int numcols = (lens.width_px + size - 1) / size;
+   int numrows = (lens.height_px + size - 1) / size;
+
+   fmem_free(lens_tiles.tiles);
+   fmem_free(lens_tiles.starts);
+   lens_tiles.tiles = fmem_alloc(FMEM_LENSMAP, numcols*numrows*sizeof(struct _lens_tile));
+   lens_tiles.starts = fmem_alloc(FMEM_LENSMAP, numcols*lens.height_px*sizeof(int));
+   if (!lens_tiles.tiles || !lens_tiles.starts) {
+      return;
+   }
+   lens_tiles.numcols = numcols;
+
+   // spans are sorted by column, so each tile column starts at the first
+   // span of the row that ends past its left edge
+   for (y=0; y<lens.height_px; ++y) {
+      int s = lens_spans.rows[y];
+      int end = lens_spans.rows[y+1];
+      for (c=0; c<numcols; ++c) {
+         while (s < end && lens_spans.spans[s].x + lens_spans.spans[s].len <= c*size) {
+            ++s;
+         }
+         lens_tiles.starts[y*numcols + c] = s;
+      }
+   }
+
+   int ty, tx;
+   for (ty=0; ty<lens.height_px; ty+=size) {
+      for (tx=0; tx<lens.width_px; tx+=size) {
+         unsigned key = LENSPIXEL_NONE;
+         for (y=ty; y<ty+size && y<lens.height_px; ++y) {
+            const unsigned *row = pixels + y*lens.width_px;
+            for (x=tx; x<tx+size && x<lens.width_px; ++x) {
+               if (row[x] < key) {
+                  key = row[x];
+               }
+            }
+         }
+         if (key == LENSPIXEL_NONE) {
+            continue;
+         }
+         struct _lens_tile *tile = &lens_tiles.tiles[lens_tiles.numtiles++];
+         tile->x = tx;
+         tile->y = ty;
+         tile->key = key;
+      }
+   }
+
+   qsort(lens_tiles.tiles, lens_tiles.numtiles, sizeof(struct _lens_tile), compare_lens_tiles);
+   lens_tiles.ready = true;
+}
+
+// shrink each plate's scissor to the pixels that the finished lensmap reads
+static void calc_plate_scissors(void)
+{
+   int i;
+   int area = lens.width_px * lens.height_px;
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+   int x0[MAX_PLATES], y0[MAX_PLATES], x1[MAX_PLATES], y1[MAX_PLATES];
+
+   for (i=0; i<globe.numplates; ++i) {
+      x0[i] = y0[i] = platesize;
+      x1[i] = y1[i] = -1;
+   }
+
+   for (i=0; i<area; ++i) {
+      unsigned offset = lens.pixels[i];
+      if (offset == LENSPIXEL_NONE) {
+         continue;
+      }
+      int plate_index = offset / platearea;
+      int x = (offset % platearea) % platesize;
+      int y = (offset % platearea) / platesize;
+      if (x < x0[plate_index]) x0[plate_index] = x;
+      if (x > x1[plate_index]) x1[plate_index] = x;
+      if (y < y0[plate_index]) y0[plate_index] = y;
+      if (y > y1[plate_index]) y1[plate_index] = y;
+   }
+
+   for (i=0; i<globe.numplates; ++i) {
+      if (x1[i] >= x0[i]) {
+         globe.plates[i].scissor.x = x0[i];
+         globe.plates[i].scissor.y = y0[i];
+         globe.plates[i].scissor.width = x1[i] - x0[i] + 1;
+         globe.plates[i].scissor.height = y1[i] - y0[i] + 1;
+      }
+   }
+}
+
+// the average distance (in plate pixels) between the plate pixels read by
+// neighboring lens pixels, measured in blocks of this many lens pixels across
+#define DENSITY_BLOCK 8
+
+// plate sizes are rounded up to a multiple of this
+#define PLATESIZE_STEP 16
+
+// narrow the FOV of each plate the lens shows to the part of it the finished
+// lensmap reads, plus the margin, and give how much that stretches the plate
+// (narrowing a plate scales its pixel offsets from the center uniformly)
+// (returns true if any plate changed FOV)
+static qboolean fit_plate_fovs(double *stretch)
+{
+   int i;
+   qboolean changed = false;
+
+   for (i=0; i<MAX_PLATES; ++i) {
+      stretch[i] = 1;
+   }
+   if (!globe.quality.fit) {
+      return false;
+   }
+
+   for (i=0; i<globe.numplates; ++i) {
+      struct _plate *plate = &globe.plates[i];
+      vrect_t *rect = &plate->scissor;
+      if (!plate->display || rect->width <= 0 || rect->height <= 0) {
+         continue;
+      }
+
+      // farthest edge of the used pixels from the center, in plate widths or
+      // heights (the plate keeps its aspect, so it narrows as much up as across)
+      double extent = 0;
+      double edges[4] = {
+         (double)rect->x / plate->size, (double)(rect->x + rect->width) / plate->size,
+         (double)rect->y / plate->height, (double)(rect->y + rect->height) / plate->height };
+      int j;
+      for (j=0; j<4; ++j) {
+         double e = fabs(edges[j] - 0.5);
+         if (e > extent) extent = e;
+      }
+
+      // (a plate pixel at offset u from the center looks down tan = u/dist)
+      double tan_half = tan(plate->fov/2);
+      double fitted = 2 * extent * tan_half * (1 + globe.quality.fit_margin);
+      if (fitted <= 0 || fitted >= tan_half) {
+         continue;
+      }
+      plate->fov = 2*atan(fitted);
+      plate->dist = 0.5/fitted;
+      stretch[i] = tan_half / fitted;
+      changed = true;
+   }
+   return changed;
+}
+
+// choose the size of each plate from how densely the finished lensmap samples
+// it, so that one plate pixel covers about one lens pixel where it is densest
+// (stretch is how much fit_plate_fovs has magnified each plate since it was measured)
+// (returns true if any plate changed size)
+static qboolean calc_plate_sizes(const double *stretch)
+{
+   int i, x, y, bx, by;
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+
+   // smallest block average, and the average over the whole plate
+   // (for plates that are too thin to fill a block)
+   double min_step[MAX_PLATES];
+   double sum[MAX_PLATES];
+   int count[MAX_PLATES];
+   for (i=0; i<MAX_PLATES; ++i) {
+      min_step[i] = -1;
+      sum[i] = 0;
+      count[i] = 0;
+   }
+
+   for (by=0; by<lens.height_px; by+=DENSITY_BLOCK) {
+      for (bx=0; bx<lens.width_px; bx+=DENSITY_BLOCK) {
+         double block_sum[MAX_PLATES] = {0};
+         int block_count[MAX_PLATES] = {0};
+
+         for (y=by; y<by+DENSITY_BLOCK && y<lens.height_px; ++y) {
+            for (x=bx; x<bx+DENSITY_BLOCK && x<lens.width_px; ++x) {
+               unsigned a = *LENSPIXEL(x,y);
+               if (a == LENSPIXEL_NONE) {
+                  continue;
+               }
+               int plate_index = a / platearea;
+               int ax = (a % platearea) % platesize;
+               int ay = (a % platearea) / platesize;
+
+               // compare with the right and lower neighbors on the same plate
+               unsigned nb[2] = {
+                  x+1 < lens.width_px ? *LENSPIXEL(x+1,y) : LENSPIXEL_NONE,
+                  y+1 < lens.height_px ? *LENSPIXEL(x,y+1) : LENSPIXEL_NONE };
+               int j;
+               for (j=0; j<2; ++j) {
+                  unsigned b = nb[j];
+                  if (b == LENSPIXEL_NONE || (int)(b / platearea) != plate_index) {
+                     continue;
+                  }
+                  int dx = (int)((b % platearea) % platesize) - ax;
+                  int dy = (int)((b % platearea) / platesize) - ay;
+                  block_sum[plate_index] += sqrt(dx*dx + dy*dy);
+                  ++block_count[plate_index];
+               }
+            }
+         }
+
+         for (i=0; i<globe.numplates; ++i) {
+            sum[i] += block_sum[i];
+            count[i] += block_count[i];
+
+            // only trust blocks that lie mostly on this plate
+            if (block_count[i] >= DENSITY_BLOCK*DENSITY_BLOCK) {
+               double step = block_sum[i] / block_count[i];
+               if (min_step[i] < 0 || step < min_step[i]) {
+                  min_step[i] = step;
+               }
+            }
+         }
+      }
+   }
+
+   int max_size = globe.quality.max_size > 0 && globe.quality.max_size < platesize ?
+      globe.quality.max_size : platesize;
+   int min_size = globe.quality.min_size < max_size ? globe.quality.min_size : max_size;
+
+   qboolean changed = false;
+   for (i=0; i<globe.numplates; ++i) {
+      double step = min_step[i] >= 0 ? min_step[i] : count[i] ? sum[i] / count[i] : -1;
+      if (step < 0) {
+         continue;
+      }
+
+      // the plate was measured at its current size
+      int size = max_size;
+      if (step > 0) {
+         double wanted = globe.plates[i].size / (step * stretch[i]) * plate_quality_scale();
+         if (wanted < max_size) {
+            size = ((int)ceil(wanted) + PLATESIZE_STEP-1) / PLATESIZE_STEP * PLATESIZE_STEP;
+         }
+      }
+      if (size > max_size) size = max_size;
+      if (size < min_size) size = min_size;
+
+      if (size != globe.plates[i].size) {
+         set_plate_size(&globe.plates[i], size);
+         changed = true;
+      }
+   }
+   return changed;
+}
+
+// prepare a finished lensmap for rendering
+static void finalize_lensmap(void)
+{
+   calc_plate_scissors();
+   ray_field.current = lens.map_type == MAP_INVERSE && ray_field_matches();
+   capture.tiles.written = false;
+
+   // the first build of a lens tells us how big and wide its plates need to be
+   // (the lensmap shown until it is rebuilt keeps the plates it was built for)
+   if (!globe.sized) {
+      struct _plate measured[MAX_PLATES];
+      double stretch[MAX_PLATES];
+      memcpy(measured, globe.plates, sizeof(measured));
+      globe.sized = true;
+      qboolean fitted = fit_plate_fovs(stretch);
+      qboolean sized = plate_quality_scale() > 0 && calc_plate_sizes(stretch);
+      globe.resized = fitted || sized;
+
+      if (globe.resized) {
+         struct _plate wanted[MAX_PLATES];
+         memcpy(wanted, globe.plates, sizeof(wanted));
+         memcpy(globe.plates, measured, sizeof(measured));
+         show_lensmap();
+         memcpy(globe.plates, wanted, sizeof(wanted));
+         return;
+      }
+   }
+
+   show_lensmap();
+}
+
+// put the finished lensmap on screen, and take the old one back to build into
+static void show_lensmap(void)
+{
+   build_lensmap_spans();
+
+   unsigned *pixels = lens_front.pixels;
+   lens_front.pixels = lens.pixels;
+   lens.pixels = pixels;
+   rubix.tints_ready = false;
+   lens_filter.ready = false;
+
+   memcpy(lens_front.plates, globe.plates, sizeof(lens_front.plates));
+   lens_front.numplates = globe.numplates;
+   lens_front.valid = true;
+
+   // count how much of the lens each plate is seen in
+   int i;
+   int area = lens.width_px * lens.height_px;
+   int platearea = globe.platesize * globe.platesize;
+   memset(lens_front.coverage, 0, sizeof(lens_front.coverage));
+   for (i=0; i<area; ++i) {
+      if (lens_front.pixels[i] != LENSPIXEL_NONE) {
+         lens_front.coverage[lens_front.pixels[i] / platearea]++;
+      }
+   }
+
+   calc_plate_mipscales();
+
+   // the plates may now need parts that were not rendered before
+   refresh_all_plates();
+
+#ifdef GLQUAKE
+   if (!gl_globe.direct) {
+      build_gl_lens_grid(false);
+   }
+#endif
+}
+
+// find the mip scale of each plate on screen from its coverage
+// (a plate shrunk to n plate pixels per lens pixel skips texels sqrt(n)
+//  apart, so it can use mips that much smaller)
+static void calc_plate_mipscales(void)
+{
+   int i;
+   for (i=0; i<lens_front.numplates; ++i) {
+      vrect_t *rect = &lens_front.plates[i].scissor;
+      double density = lens_front.coverage[i] ? (double)rect->width*rect->height / lens_front.coverage[i] : 1;
+      double mipscale = density > 1 ? sqrt(density) : 1;
+      if (mipscale > globe.quality.max_mipscale) mipscale = globe.quality.max_mipscale;
+      lens_front.mipscale[i] = mipscale;
+   }
+}
+
+// stop showing the last finished lensmap
+// (until then it is still drawn instead of the lensmap being built)
+static void hide_lensmap(void)
+{
+   lens_front.valid = false;
+   lens_spans.ready = false;
+   lens_tiles.ready = false;
+#ifdef GLQUAKE
+   gl_globe.ready = false;
+#endif
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           GLOBE CHOOSER                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// the globes "f_globe auto" chooses from, cheapest first
+static const char *globe_choices[] = {
+   "tetra", "fast", "trism", "cube", "cube_edge", "cube_corner",
+};
+
+// lens pixels between the rays measured
+#define CHOICE_STEP 8
+
+// find how many plates the loaded globe shows the ray field on, and the
+// fewest full size plate pixels it gives any lens pixel
+static qboolean measure_globe(int *numplates, double *sampling)
+{
+   int x, y, i;
+   qboolean used[MAX_PLATES] = {false};
+   double least = -1;
+
+   for (y=0; y+CHOICE_STEP < ray_field.height; y+=CHOICE_STEP) {
+      for (x=0; x+CHOICE_STEP < ray_field.width; x+=CHOICE_STEP) {
+         unsigned *code = ray_field.rays + x + y*ray_field.width;
+         if (*code == RAYFIELD_NONE) {
+            continue;
+         }
+         vec3_t ray;
+         decode_ray(*code, ray);
+         int plate_index = ray_to_plate_index(ray);
+         if (plate_index < 0 || plate_index >= globe.numplates) {
+            continue;
+         }
+         used[plate_index] = true;
+
+         double u, v;
+         ray_to_plate_uv(plate_index, ray, &u, &v);
+
+         // compare with the right and lower neighbors, on the same plate
+         unsigned nb[2] = { code[CHOICE_STEP], code[CHOICE_STEP*ray_field.width] };
+         for (i=0; i<2; ++i) {
+            if (nb[i] == RAYFIELD_NONE) {
+               continue;
+            }
+            vec3_t nray;
+            double nu, nv;
+            decode_ray(nb[i], nray);
+            if (DotProduct(nray, globe.plates[plate_index].forward) <= 0) {
+               continue;
+            }
+            ray_to_plate_uv(plate_index, nray, &nu, &nv);
+            double dv = (nv-v) * globe.plates[plate_index].aspect;
+            double texels = sqrt((nu-u)*(nu-u) + dv*dv) * globe.platesize / CHOICE_STEP;
+            if (least < 0 || texels < least) {
+               least = texels;
+            }
+         }
+      }
+   }
+
+   *numplates = 0;
+   for (i=0; i<globe.numplates; ++i) {
+      *numplates += used[i];
+   }
+   *sampling = least;
+   return least >= 0;
+}
+
+// switch to the globe rendering the fewest plates for the current ray field
+// that still samples it above the floor (or the sharpest one if none does)
+static void choose_globe(void)
+{
+   char current[50];
+   int i;
+   int best = -1, sharpest = -1;
+   int best_plates = 0;
+   double best_sampling = 0, sharpest_sampling = 0;
+
+   stop_lens_prefetch();
+   stop_lens_workers();
+   strcpy(current, globe.name);
+
+   globe.choice.chosen = true;
+   globe.choice.key = ray_field.key;
+
+   for (i=0; i<(int)(sizeof(globe_choices)/sizeof(*globe_choices)); ++i) {
+      int numplates;
+      double sampling;
+      strcpy(globe.name, globe_choices[i]);
+      plate_lut.ready = false;
+      if (!LUA_load_globe() || !measure_globe(&numplates, &sampling)) {
+         continue;
+      }
+      if (sharpest < 0 || sampling > sharpest_sampling) {
+         sharpest = i;
+         sharpest_sampling = sampling;
+      }
+      if (sampling >= globe.choice.floor &&
+            (best < 0 || numplates < best_plates || (numplates == best_plates && sampling > best_sampling))) {
+         best = i;
+         best_plates = numplates;
+         best_sampling = sampling;
+      }
+   }
+   if (best < 0) {
+      best = sharpest;
+   }
+
+   // put back the chosen globe, or the current one if none could be measured
+   strcpy(globe.name, best < 0 ? current : globe_choices[best]);
+   plate_lut.ready = false;
+   globe.valid = LUA_load_globe();
+   if (!globe.valid) {
+      strcpy(globe.name,"");
+      return;
+   }
+   build_plate_lut();
+
+   if (strcmp(globe.name, current)) {
+      Con_Printf("f_globe auto: %s\n", globe.name);
+      globe.changed = true;
+   }
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           BENCHMARK                                          |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// split a comma separated list of names into the table
+static int split_benchmark_list(const char *arg, char names[][50], int max)
+{
+   char list[256];
+   int n = 0;
+   strncpy(list, arg, sizeof(list)-1);
+   list[sizeof(list)-1] = 0;
+
+   char *name = strtok(list, ",");
+   while (name && n < max) {
+      strncpy(names[n], name, 49);
+      names[n][49] = 0;
+      ++n;
+      name = strtok(NULL, ",");
+   }
+   return n;
+}
+
+// put back the lens, globe and zoom from before the benchmark
+static void end_benchmark(void)
+{
+   char command[128];
+
+   fclose(benchmark.file);
+   benchmark.file = NULL;
+   benchmark.active = false;
+
+   snprintf(command, sizeof(command), "f_lens %s", benchmark.saved.lens);
+   exec_command(command);
+   if (benchmark.saved.choice) {
+      snprintf(command, sizeof(command), "f_globe auto %f", benchmark.saved.floor);
+   }
+   else {
+      snprintf(command, sizeof(command), "f_globe %s", benchmark.saved.globe);
+   }
+   exec_command(command);
+
+   // (after the lens, whose onload may have zoomed)
+   clear_zoom();
+   zoom.type = benchmark.saved.zoom_type;
+   zoom.fov = benchmark.saved.zoom_fov;
+
+   Con_Printf("f_benchmark: wrote %s/benchmark.csv\n", com_gamedir);
+}
+
+static void write_benchmark_row(void)
+{
+   int ilens = benchmark.index / (benchmark.numglobes * benchmark.numfovs);
+   int iglobe = benchmark.index / benchmark.numfovs % benchmark.numglobes;
+   int ifov = benchmark.index % benchmark.numfovs;
+   int frames = benchmark.frame ? benchmark.frame : 1;
+
+   double plate_ms = benchmark.plate_renders ? 1000 * benchmark.plate_time / benchmark.plate_renders : 0;
+   double lensmap_ms = 1000 * benchmark.lensmap_time / frames;
+   double texels = (double)benchmark.texels / frames;
+
+   fprintf(benchmark.file, "%s,%s,%d,%d,%d,%d,%.1f,%d,%d,%d,%d,%.0f,%.3f,%.3f\n",
+      benchmark.lenses[ilens], benchmark.globes[iglobe], benchmark.fovs[ifov],
+      lens.width_px, lens.height_px, benchmark.valid, 1000 * benchmark.build_time,
+      benchmark.lua_calls[BENCH_INVERSE], benchmark.lua_calls[BENCH_FORWARD], benchmark.lua_calls[BENCH_GLOBE_PLATE],
+      benchmark.plates, texels, plate_ms, lensmap_ms);
+   fflush(benchmark.file);
+
+   Con_Printf("f_benchmark %s %s %d: built in %.0f ms, %.3f ms per frame\n",
+      benchmark.lenses[ilens], benchmark.globes[iglobe], benchmark.fovs[ifov],
+      1000 * benchmark.build_time, lensmap_ms + plate_ms * benchmark.plate_renders / frames);
+}
+
+// move the benchmark along (called at the start of each fisheye frame)
+static void step_benchmark(void)
+{
+   char command[128];
+   int i;
+
+   if (benchmark.phase == BENCH_APPLY) {
+      int ilens = benchmark.index / (benchmark.numglobes * benchmark.numfovs);
+      int iglobe = benchmark.index / benchmark.numfovs % benchmark.numglobes;
+      int ifov = benchmark.index % benchmark.numfovs;
+
+      snprintf(command, sizeof(command), "f_lens %s", benchmark.lenses[ilens]);
+      exec_command(command);
+      snprintf(command, sizeof(command), "f_globe %s", benchmark.globes[iglobe]);
+      exec_command(command);
+      snprintf(command, sizeof(command), "f_fov %d", benchmark.fovs[ifov]);
+      exec_command(command);
+
+      // build every lens from scratch
+      // (the rays of the previous build would otherwise be replayed)
+      ray_field.complete = false;
+
+      memset(benchmark.lua_calls, 0, sizeof(benchmark.lua_calls));
+      benchmark.plate_time = benchmark.lensmap_time = 0;
+      benchmark.plate_renders = benchmark.frame = 0;
+      benchmark.texels = 0;
+      benchmark.start = Sys_DoubleTime();
+      benchmark.phase = BENCH_BUILD;
+      return;
+   }
+
+   if (benchmark.phase == BENCH_BUILD) {
+      // (the build time includes the frames drawn while building, as the
+      //  builder only gets part of each frame on the main thread)
+      if (lens_builder.working || globe.resized || lens.changed || globe.changed || zoom.changed) {
+         return;
+      }
+      benchmark.build_time = Sys_DoubleTime() - benchmark.start;
+      benchmark.valid = lens.valid && globe.valid && lens_front.valid && !lens_builder.failed;
+
+      benchmark.plates = 0;
+#ifdef GLQUAKE
+      for (i=0; i<6; ++i) {
+         benchmark.plates += gl_globe.faces[i] != 0;
+      }
+#else
+      for (i=0; i<lens_front.numplates; ++i) {
+         benchmark.plates += lens_front.plates[i].display != 0;
+      }
+#endif
+      benchmark.phase = benchmark.valid ? BENCH_RENDER : BENCH_NEXT;
+   }
+
+   if (benchmark.phase == BENCH_RENDER && benchmark.frame < benchmark.frames) {
+      ++benchmark.frame;
+      return;
+   }
+
+   write_benchmark_row();
+   benchmark.phase = BENCH_APPLY;
+   if (++benchmark.index >= benchmark.numlenses * benchmark.numglobes * benchmark.numfovs) {
+      end_benchmark();
+   }
+}
+
+// a plate has been rendered in the timed frames
+static void time_benchmark_plate(double start, int texels)
+{
+   if (!benchmark.active || benchmark.phase != BENCH_RENDER) {
+      return;
+   }
+   benchmark.plate_time += Sys_DoubleTime() - start;
+   benchmark.plate_renders++;
+   benchmark.texels += texels;
+}
+
+// the lensmap has been drawn in the timed frames
+static void time_benchmark_lensmap(double start)
+{
+   if (!benchmark.active || benchmark.phase != BENCH_RENDER) {
+      return;
+   }
+   benchmark.lensmap_time += Sys_DoubleTime() - start;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           FRAME PROFILER                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// add the time since start to a stage of this frame, and return the time now
+static double add_speed(int stage, double start)
+{
+   double now = Sys_DoubleTime();
+   if (f_speeds.value) {
+      speeds.frame[stage] += now - start;
+      if (stage >= SPEED_PLATE0) {
+         speeds.frame[SPEED_PLATES] += now - start;
+      }
+   }
+   return now;
+}
+
+// keep the stage times of the finished frame
+static void end_speeds_frame(void)
+{
+   int i;
+   if (!f_speeds.value) {
+      speeds.count = 0;
+      return;
+   }
+   for (i=0; i<NUM_SPEEDS; ++i) {
+      speeds.samples[i][speeds.next] = speeds.frame[i];
+      speeds.frame[i] = 0;
+   }
+   speeds.next = (speeds.next + 1) % SPEED_FRAMES;
+   if (speeds.count < SPEED_FRAMES) {
+      speeds.count++;
+   }
+}
+
+static int compare_speeds(const void *a, const void *b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+// draw the average and 99th percentile of each stage over the last frames
+void F_DrawSpeeds(void)
+{
+   static const char *names[NUM_SPEEDS] = {
+      "lens build",
+#ifdef GLQUAKE
+      NULL,
+      "faces",
+      "face copy",
+      NULL,
+      "lens draw",
+#else
+      "scene setup",
+      "plates",
+      NULL, // (plates are rendered where the lensmap reads them)
+      "tile clear",
+      "lensmap",
+#endif
+   };
+   double sorted[SPEED_FRAMES];
+   char line[64];
+   int i, j;
+
+   if (!f_speeds.value || !speeds.count) {
+      return;
+   }
+
+   int y = 8;
+   Draw_String(8, y, "fisheye ms     avg    p99");
+   y += 8;
+   for (i=0; i<NUM_SPEEDS; ++i) {
+      double total = 0;
+      for (j=0; j<speeds.count; ++j) {
+         sorted[j] = speeds.samples[i][j];
+         total += sorted[j];
+      }
+
+      // (only the plates rendered lately)
+      if (i >= SPEED_PLATE0 && total <= 0) {
+         continue;
+      }
+      if (i >= SPEED_PLATE0) {
+         snprintf(line, sizeof(line), " plate %d", i - SPEED_PLATE0);
+      }
+      else if (names[i]) {
+         snprintf(line, sizeof(line), "%s", names[i]);
+      }
+      else {
+         continue;
+      }
+
+      qsort(sorted, speeds.count, sizeof(double), compare_speeds);
+      double p99 = sorted[(speeds.count - 1) * 99 / 100];
+      snprintf(line + strlen(line), sizeof(line) - strlen(line), "%*s%6.2f %6.2f",
+            (int)(14 - strlen(line)), "", 1000 * total / speeds.count, 1000 * p99);
+      Draw_String(8, y, line);
+      y += 8;
+   }
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           MEMORY ACCOUNTING                                  |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void fmem_count(int pool, long long size, int count)
+{
+   long long bytes = __sync_add_and_fetch(&fmem.bytes[pool], size);
+   long long total = __sync_add_and_fetch(&fmem.total, size);
+   __sync_fetch_and_add(&fmem.count[pool], count);
+
+   // (peaks may miss a race with another thread, they are only reported)
+   if (bytes > fmem.peak[pool]) fmem.peak[pool] = bytes;
+   if (total > fmem.peak_total) fmem.peak_total = total;
+}
+
+static void *fmem_alloc(int pool, size_t size)
+{
+   sys_largebuf_t large;
+   fmem_header_t *h;
+
+   if (size >= FMEM_LARGE) {
+      h = Sys_AllocLarge(sizeof(fmem_header_t) + size, &large);
+      if (h) {
+         __sync_add_and_fetch(&fmem.pages[large.pages], (long long)large.size);
+      }
+   } else {
+      h = malloc(sizeof(fmem_header_t) + size);
+      large.base = NULL;
+   }
+   if (!h) {
+      return NULL;
+   }
+   h->h.size = size;
+   h->h.pool = pool;
+   h->h.large = large;
+   fmem_count(pool, size, 1);
+   return h + 1;
+}
+
+static void *fmem_realloc(int pool, void *ptr, size_t size)
+{
+   if (!ptr) {
+      return fmem_alloc(pool, size);
+   }
+   fmem_header_t *h = (fmem_header_t *)ptr - 1;
+   size_t oldsize = h->h.size;
+   if (h->h.large.base || size >= FMEM_LARGE) {
+      void *n = fmem_alloc(h->h.pool, size);
+      if (!n) {
+         return NULL;
+      }
+      memcpy(n, ptr, size < oldsize ? size : oldsize);
+      fmem_free(ptr);
+      return n;
+   }
+   fmem_header_t *n = realloc(h, sizeof(fmem_header_t) + size);
+   if (!n) {
+      return NULL;
+   }
+   n->h.size = size;
+   fmem_count(n->h.pool, (long long)size - (long long)oldsize, 0);
+   return n + 1;
+}
+
+static void fmem_free(void *ptr)
+{
+   if (!ptr) {
+      return;
+   }
+   fmem_header_t *h = (fmem_header_t *)ptr - 1;
+   fmem_count(h->h.pool, -(long long)h->h.size, -1);
+   if (h->h.large.base) {
+      sys_largebuf_t large = h->h.large;
+      __sync_add_and_fetch(&fmem.pages[large.pages], -(long long)large.size);
+      Sys_FreeLarge(&large);
+   } else {
+      free(h);
+   }
+}
+
+// the ceiling in bytes (0 = none)
+static double fmem_limit(void)
+{
+   return fmem.limit_mb * 1024.0 * 1024.0;
+}
+
+// the largest plate size up to the wanted one whose plates and lensmaps fit
+// under the ceiling, or that could be allocated at all
+static int fit_platesize(int platesize, int area)
+{
+   if (fmem.failed_platesize > 0 && platesize > fmem.failed_platesize) {
+      platesize = fmem.failed_platesize;
+   }
+   double limit = fmem_limit();
+   if (limit <= 0) {
+      return platesize;
+   }
+
+   // the lens and the one on screen, the rays of the lens and the ones kept
+   // for resizing, and the staging lensmap of the workers
+   double lensmaps = 5.0 * area * sizeof(unsigned);
+   while (platesize > MIN_FIT_PLATESIZE) {
+      double plates = (double)platesize * platesize * (MAX_PLATES*sizeof(byte) + sizeof(short)) + GLOBE_PADDING;
+      if (plates + lensmaps <= limit) {
+         break;
+      }
+      // (shrink gently, the plate size is the sharpness of the view)
+      platesize = platesize * 7 / 8;
+   }
+   return platesize > MIN_FIT_PLATESIZE ? platesize : MIN_FIT_PLATESIZE;
+}
+
+// memory for cached lensmaps: f_lenscache_mb, or what the other buffers leave
+// under the ceiling if that is less
+static double lens_lru_budget(void)
+{
+   double budget = lens_lru.budget_mb * 1024.0 * 1024.0;
+   double limit = fmem_limit();
+   if (limit > 0) {
+      double left = limit - (double)(fmem.total - fmem.bytes[FMEM_CACHE]);
+      if (left < budget) {
+         budget = left > 0 ? left : 0;
+      }
+   }
+   return budget;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           DEMO CAPTURE                                       |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+#if defined(NQ_HACK) && !defined(GLQUAKE)
+
+static void write_capture_frame(struct _capture_slot *slot)
+{
+   char filename[MAX_OSPATH];
+   qboolean ok;
+
+   if (capture.format == CAPTURE_PIPE) {
+      ok = IMG_WritePPM(capture.pipe, slot->pixels, capture.width, capture.height, 1, slot->palette);
+   }
+   else {
+      snprintf(filename, sizeof(filename), "%s/%06d.%s", capture.path, slot->number,
+            capture.format == CAPTURE_PNG ? "png" : "ppm");
+      FILE *f = fopen(filename, "wb");
+      if (!f) {
+         ok = false;
+      }
+      else {
+         ok = capture.format == CAPTURE_PNG ?
+            IMG_WritePNG(f, slot->pixels, capture.width, capture.height, 1, slot->palette) :
+            IMG_WritePPM(f, slot->pixels, capture.width, capture.height, 1, slot->palette);
+         if (fclose(f)) {
+            ok = false;
+         }
+      }
+   }
+   if (!ok) {
+      capture.failed = true;
+   }
+}
+
+// write queued frames, oldest first, until the capture ends
+static void run_capture_writer(void)
+{
+   int i;
+   mutex_lock(&capture.lock);
+   for (;;) {
+      struct _capture_slot *slot = NULL;
+      for (i=0; i<capture.numslots; ++i) {
+         struct _capture_slot *s = &capture.slots[i];
+         if (s->state == SLOT_QUEUED && (!slot || s->number < slot->number)) {
+            slot = s;
+         }
+      }
+      if (!slot) {
+         if (capture.quit) {
+            break;
+         }
+         cond_wait(&capture.changed, &capture.lock);
+         continue;
+      }
+      slot->state = SLOT_WRITING;
+      mutex_unlock(&capture.lock);
+
+      write_capture_frame(slot);
+
+      mutex_lock(&capture.lock);
+      slot->state = SLOT_FREE;
+      cond_broadcast(&capture.changed);
+   }
+   mutex_unlock(&capture.lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI capture_writer_main(LPVOID arg)
+{
+   run_capture_writer();
+   return 0;
+}
+#else
+static void *capture_writer_main(void *arg)
+{
+   run_capture_writer();
+   return NULL;
+}
+#endif
+
+// hand the frame just drawn to the writers
+// (waits for a free slot if they have fallen behind, so the queue is bounded)
+static void queue_capture_frame(void)
+{
+   int i;
+   mutex_lock(&capture.lock);
+   for (;;) {
+      for (i=0; i<capture.numslots && capture.slots[i].state != SLOT_FREE; ++i);
+      if (i < capture.numslots) {
+         break;
+      }
+      cond_wait(&capture.changed, &capture.lock);
+   }
+   struct _capture_slot *slot = &capture.slots[i];
+   mutex_unlock(&capture.lock);
+
+   // (only the main thread claims free slots, so this one stays ours)
+   memcpy(slot->pixels, capture.pixels, capture.width*capture.height);
+   memcpy(slot->palette, host_basepal, 768);
+   slot->number = capture.frame++;
+
+   mutex_lock(&capture.lock);
+   slot->state = SLOT_QUEUED;
+   cond_broadcast(&capture.changed);
+   mutex_unlock(&capture.lock);
+}
+
+// get the ray of a pixel in a tiled capture frame
+// (1 = a ray, 0 = outside the lens, -1 = the lens failed)
+static int capture_pixel_to_ray(int cx, int cy, vec3_t ray)
+{
+   // (the proxy has the frame's shape, so only the scale differs)
+   double scale = lens.scale * lens.width_px / capture.width;
+   double x = (cx - capture.width/2) * scale;
+   double y = -(cy - capture.height/2) * scale;
+   if (radial_table.ready) {
+      return radial_pixel_to_ray(x,y,ray);
+   }
+   return map_lens_inverse(x,y,ray);
+}
+
+// find the globe offsets of a band of rows of a tiled capture frame
+static qboolean build_capture_band(int y0, int rows)
+{
+   int x,y;
+   for (y=0; y<rows; ++y) {
+      unsigned *map = capture.tiles.map + y*capture.width;
+      for (x=0; x<capture.width; ++x) {
+         // a lens without an inverse map can only be sampled at the proxy's pixels
+         if (lens.map_type != MAP_INVERSE) {
+            int lx = (int)((x + 0.5) * lens.width_px / capture.width);
+            int ly = (int)((y0 + y + 0.5) * lens.height_px / capture.height);
+            map[x] = lens_front.pixels[lx + ly*lens.width_px];
+            continue;
+         }
+
+         map[x] = LENSPIXEL_NONE;
+         vec3_t ray;
+         int status = capture_pixel_to_ray(x, y0+y, ray);
+         if (status == -1) {
+            return false;
+         }
+         if (status == 0) {
+            continue;
+         }
+
+         int plate_index = ray_to_plate_index(ray);
+         double u,v;
+         if (plate_index < 0 || !ray_to_plate_uv(plate_index, ray, &u, &v)) {
+            continue;
+         }
+         int px = (int)(u*globe.plates[plate_index].size);
+         int py = (int)(v*globe.plates[plate_index].height);
+         if (px >= 0 && px < globe.plates[plate_index].size && py >= 0 && py < globe.plates[plate_index].height) {
+            map[x] = GLOBEOFFSET(plate_index,px,py);
+         }
+      }
+   }
+   return true;
+}
+
+// draw a tiled capture frame a band at a time
+// (the bands of a new lensmap are found and written to the file on its first
+//  frame, and read back on the frames after it; without a file they are found
+//  again every frame)
+static qboolean render_capture_tiles(void)
+{
+   qboolean reading = capture.tiles.written;
+   if (!reading) {
+      if (capture.tiles.file) {
+         rewind(capture.tiles.file);
+      }
+      else {
+         capture.tiles.file = tmpfile();
+      }
+   }
+   else {
+      rewind(capture.tiles.file);
+   }
+
+   int y0;
+   for (y0=0; y0<capture.height; y0+=capture.tiles.rows) {
+      int rows = capture.tiles.rows;
+      if (y0 + rows > capture.height) {
+         rows = capture.height - y0;
+      }
+      size_t count = (size_t)rows*capture.width;
+
+      if (reading) {
+         if (fread(capture.tiles.map, sizeof(unsigned), count, capture.tiles.file) != count) {
+            // (start over from the lens)
+            capture.tiles.written = false;
+            return render_capture_tiles();
+         }
+      }
+      else {
+         if (!build_capture_band(y0, rows)) {
+            return false;
+         }
+         if (capture.tiles.file &&
+               fwrite(capture.tiles.map, sizeof(unsigned), count, capture.tiles.file) != count) {
+            fclose(capture.tiles.file);
+            capture.tiles.file = NULL;
+         }
+      }
+
+      size_t i;
+      const unsigned *map = capture.tiles.map;
+      byte *out = capture.pixels + y0*capture.width;
+      for (i=0; i<count; ++i) {
+         if (map[i] != LENSPIXEL_NONE) {
+            out[i] = globe.pixels[map[i]];
+         }
+      }
+   }
+
+   if (!reading && capture.tiles.file) {
+      fflush(capture.tiles.file);
+      capture.tiles.written = true;
+   }
+   return true;
+}
+
+// draw the lens into the capture frame instead of the screen
+static void render_capture_frame(qboolean latching)
+{
+   // (the demo is held while the lens is built, see CL_GetMessage)
+   if (cls.state != ca_active || !F_LensReady() || !lens_front.valid) {
+      return;
+   }
+
+   if (capture.tiled) {
+      memset(capture.pixels, 0, capture.width*capture.height);
+      if (!render_capture_tiles()) {
+         Con_Printf("f_capture: the lens could not map the frame\n");
+         F_StopCapture();
+         return;
+      }
+      queue_capture_frame();
+      return;
+   }
+
+   viddef_t screen = vid;
+   vrect_t rect = scr_vrect;
+   vid.buffer = capture.pixels;
+   vid.rowbytes = capture.width;
+   scr_vrect.x = scr_vrect.y = 0;
+   memset(capture.pixels, 0, capture.width*capture.height);
+
+   double m[3][3];
+   if (latching && latch_view_rotation(m)) {
+      render_lensmap_latched(m);
+   }
+   else {
+      render_lensmap();
+   }
+   vid = screen;
+   scr_vrect = rect;
+
+   queue_capture_frame();
+}
+
+static qboolean start_capture_writers(void)
+{
+   int i;
+   capture.numslots = capture.tiled ? 2 : CAPTURE_QUEUE;
+   for (i=0; i<capture.numslots; ++i) {
+      capture.slots[i].state = SLOT_FREE;
+      capture.slots[i].pixels = fmem_alloc(FMEM_CAPTURE, capture.width*capture.height);
+      if (!capture.slots[i].pixels) {
+         return false;
+      }
+   }
+   capture.pixels = fmem_alloc(FMEM_CAPTURE, capture.width*capture.height);
+   if (!capture.pixels) {
+      return false;
+   }
+   if (capture.tiled) {
+      // (bands of about a million pixels)
+      capture.tiles.rows = (1 << 20) / capture.width;
+      if (capture.tiles.rows < 1) capture.tiles.rows = 1;
+      capture.tiles.map = fmem_alloc(FMEM_CAPTURE, capture.tiles.rows*capture.width*sizeof(unsigned));
+      if (!capture.tiles.map) {
+         return false;
+      }
+      capture.tiles.file = NULL;
+      capture.tiles.written = false;
+   }
+
+   // (a pipe takes the frames in order, so it gets a single writer)
+   int count = capture.format == CAPTURE_PIPE ? 1 : MAX_CAPTURE_WRITERS;
+   capture.quit = false;
+   capture.numwriters = 0;
+   for (i=0; i<count; ++i) {
+#ifdef _WIN32
+      capture.writers[i] = CreateThread(NULL, 0, capture_writer_main, NULL, 0, NULL);
+      if (!capture.writers[i]) break;
+#else
+      if (pthread_create(&capture.writers[i], NULL, capture_writer_main, NULL)) break;
+#endif
+      capture.numwriters++;
+   }
+   return capture.numwriters > 0;
+}
+
+// finish writing and put the engine back as it was
+void F_StopCapture(void)
+{
+   int i;
+   if (!capture.active) {
+      return;
+   }
+
+   mutex_lock(&capture.lock);
+   capture.quit = true;
+   cond_broadcast(&capture.changed);
+   mutex_unlock(&capture.lock);
+   for (i=0; i<capture.numwriters; ++i) {
+#ifdef _WIN32
+      WaitForSingleObject(capture.writers[i], INFINITE);
+      CloseHandle(capture.writers[i]);
+#else
+      pthread_join(capture.writers[i], NULL);
+#endif
+   }
+   capture.numwriters = 0;
+
+   for (i=0; i<CAPTURE_QUEUE; ++i) {
+      fmem_free(capture.slots[i].pixels);
+      capture.slots[i].pixels = NULL;
+   }
+   fmem_free(capture.pixels);
+   capture.pixels = NULL;
+   fmem_free(capture.tiles.map);
+   capture.tiles.map = NULL;
+   if (capture.tiles.file) {
+      fclose(capture.tiles.file);
+      capture.tiles.file = NULL;
+   }
+   capture.tiled = false;
+   if (capture.pipe) {
+#ifdef _WIN32
+      _pclose(capture.pipe);
+#else
+      pclose(capture.pipe);
+#endif
+      capture.pipe = NULL;
+   }
+
+   capture.active = fisheye_capturing = false;
+   Cvar_SetValue("host_framerate", capture.saved_framerate);
+
+   Con_Printf("f_capture: %d frames%s\n", capture.frame, capture.failed ? ", some could not be written" : "");
+   if (capture.quit_after) {
+      Cbuf_AddText("quit\n");
+   }
+}
+
+static void cmd_capture(void)
+{
+   int i;
+
+   if (Cmd_Argc() >= 2 && !strcmp(Cmd_Argv(1), "stop")) {
+      F_StopCapture();
+      return;
+   }
+   if (Cmd_Argc() < 4) {
+      Con_Printf("f_capture <demo> <width> <height> [fps=30] [png|ppm|\"|command\"] [platesize] [tiled] [quit]\n");
+      Con_Printf("   play the demo at a fixed timestep, writing each frame of the lens\n");
+      Con_Printf("   (\"|command\" pipes ppm frames to an encoder, \"quit\" exits when done)\n");
+      Con_Printf("   (\"tiled\" draws frames of any size in bands, from the largest plates)\n");
+      Con_Printf("f_capture stop: end the capture early\n");
+      return;
+   }
+   if (capture.active) {
+      Con_Printf("f_capture is already running\n");
+      return;
+   }
+   if (!fisheye_enabled) {
+      Con_Printf("f_capture needs fisheye 1\n");
+      return;
+   }
+
+   capture.width = Q_atoi(Cmd_Argv(2));
+   capture.height = Q_atoi(Cmd_Argv(3));
+   if (capture.width <= 0 || capture.height <= 0) {
+      Con_Printf("f_capture: bad frame size\n");
+      return;
+   }
+   capture.fps = 30;
+   capture.platesize = 0;
+   capture.format = CAPTURE_PNG;
+   capture.quit_after = false;
+   capture.tiled = false;
+   int numbers = 0;
+   for (i=4; i<Cmd_Argc(); ++i) {
+      const char *arg = Cmd_Argv(i);
+      if (!strcmp(arg, "png")) {
+         capture.format = CAPTURE_PNG;
+      }
+      else if (!strcmp(arg, "ppm")) {
+         capture.format = CAPTURE_PPM;
+      }
+      else if (!strcmp(arg, "quit")) {
+         capture.quit_after = true;
+      }
+      else if (!strcmp(arg, "tiled")) {
+         capture.tiled = true;
+      }
+      else if (arg[0] == '|') {
+         capture.format = CAPTURE_PIPE;
+         snprintf(capture.path, sizeof(capture.path), "%s", arg+1);
+      }
+      else if (numbers++ == 0) {
+         capture.fps = Q_atof(arg);
+      }
+      else {
+         capture.platesize = Q_atoi(arg);
+      }
+   }
+   if (capture.fps <= 0) {
+      capture.fps = 30;
+   }
+   if (capture.tiled && lens.valid && lens.map_type != MAP_INVERSE) {
+      Con_Printf("f_capture: this lens has no inverse map, so tiled frames are only as sharp as the screen\n");
+   }
+
+   if (capture.format == CAPTURE_PIPE) {
+#ifdef _WIN32
+      capture.pipe = _popen(capture.path, "wb");
+#else
+      capture.pipe = popen(capture.path, "w");
+#endif
+      if (!capture.pipe) {
+         Con_Printf("f_capture: could not run %s\n", capture.path);
+         return;
+      }
+   }
+   else {
+      snprintf(capture.path, sizeof(capture.path), "%s/capture", com_gamedir);
+      Sys_mkdir(capture.path);
+   }
+
+   // (started before the capture, since it stops any demo playing, see
+   //  CL_StopPlayback)
+   char command[MAX_OSPATH + 16];
+   snprintf(command, sizeof(command), "playdemo %s", Cmd_Argv(1));
+   exec_command(command);
+
+   // a fixed timestep, with frames run as fast as they can be drawn
+   // (see Host_FilterTime)
+   capture.saved_framerate = Cvar_VariableValue("host_framerate");
+   Cvar_SetValue("host_framerate", 1.0 / capture.fps);
+
+   capture.frame = 0;
+   capture.failed = false;
+   capture.active = fisheye_capturing = true;
+   if (!cls.demoplayback) {
+      F_StopCapture();
+   }
+   else if (!start_capture_writers()) {
+      Con_Printf("f_capture: could not allocate enough memory\n");
+      F_StopCapture();
+   }
+}
+
+#else
+
+#ifndef GLQUAKE
+static void render_capture_frame(qboolean latching)
+{
+}
+#endif
+
+void F_StopCapture(void)
+{
+}
+
+static void cmd_capture(void)
+{
+   Con_Printf("f_capture is only supported in the NQ software renderer\n");
+}
+
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           PLATE SCHEDULER                                    |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// how many frames apart the plate is rendered
+static int plate_rate(int plate_index)
+{
+   int rate = plate_schedule.rate[plate_index];
+   if (rate > 0) {
+      return rate;
+   }
+   if (!lens_front.valid) {
+      return 1;
+   }
+
+   // halve the rate each time the plate is seen in half as much of the lens
+   int i;
+   int most = 0;
+   for (i=0; i<lens_front.numplates; ++i) {
+      if (lens_front.coverage[i] > most) {
+         most = lens_front.coverage[i];
+      }
+   }
+   int coverage = lens_front.coverage[plate_index];
+   for (rate=1; rate < PLATERATE_MAX_AUTO && coverage*rate*2 <= most; rate *= 2);
+   return rate;
+}
+
+// render every plate next frame
+static void refresh_all_plates(void)
+{
+   int i;
+   for (i=0; i<MAX_PLATES; ++i) {
+      plate_schedule.age[i] = -1;
+   }
+   plate_schedule.still = false;
+}
+
+// true while a model is still blending toward its last frame or position
+// (see R_AliasSetupLerp, which stops blending after a second)
+static qboolean is_entity_lerping(const entity_t *e)
+{
+   return cl.time - e->currentframetime < MIN(e->currentframetime - e->previousframetime, 1.0f) ||
+      cl.time - e->currentorigintime < MIN(e->currentorigintime - e->previousorigintime, 1.0f) ||
+      cl.time - e->currentanglestime < MIN(e->currentanglestime - e->previousanglestime, 1.0f);
+}
+
+// hash what the plates would show: the view, the entities, the light styles,
+// the dynamic lights and the particles
+static unsigned hash_scene(void)
+{
+   unsigned hash = 2166136261u;
+   int i, j;
+
+   hash = hash_bytes(hash, r_refdef.vieworg, sizeof(vec3_t));
+   hash = hash_bytes(hash, r_refdef.viewangles, sizeof(vec3_t));
+
+   for (i=0; i<=cl_numvisedicts; ++i) {
+      const entity_t *e = i < cl_numvisedicts ? &cl_visedicts[i] : &cl.viewent;
+      hash = hash_bytes(hash, e->origin, sizeof(vec3_t));
+      hash = hash_bytes(hash, e->angles, sizeof(vec3_t));
+      hash = hash_bytes(hash, &e->model, sizeof(e->model));
+      hash = hash_bytes(hash, &e->frame, sizeof(e->frame));
+      hash = hash_bytes(hash, &e->skinnum, sizeof(e->skinnum));
+      hash = hash_bytes(hash, &e->colormap, sizeof(e->colormap));
+      if (is_entity_lerping(e)) {
+         hash = hash_bytes(hash, &cl.time, sizeof(cl.time));
+      }
+   }
+
+   // (the light styles as R_AnimateLight will set them)
+   int frame = (int)(cl.time * 10);
+   for (i=0; i<MAX_LIGHTSTYLES; ++i) {
+      const lightstyle_t *style = &cl_lightstyle[i];
+      char c = style->length ? style->map[frame % style->length] : 0;
+      hash = hash_bytes(hash, &c, 1);
+   }
+
+   for (i=0; i<MAX_DLIGHTS; ++i) {
+      const dlight_t *dl = &cl_dlights[i];
+      if (dl->radius && dl->die >= cl.time) {
+         hash = hash_bytes(hash, dl->origin, sizeof(vec3_t));
+         hash = hash_bytes(hash, &dl->radius, sizeof(dl->radius));
+      }
+   }
+
+#ifndef GLQUAKE
+   // (the phase of the lens warp under water)
+   if (r_waterwarp.value && r_viewleaf && r_viewleaf->contents <= CONTENTS_WATER) {
+      frame = (int)(cl.time * TURB_SPEED) & (TURB_CYCLE - 1);
+      hash = hash_bytes(hash, &frame, sizeof(frame));
+   }
+#endif
+
+   for (i=0; i<pt_numtypes; ++i) {
+      const particlegroup_t *group = &r_particlegroups[i];
+      hash = hash_bytes(hash, &group->count, sizeof(group->count));
+      for (j=0; j<3; ++j) {
+         hash = hash_bytes(hash, group->org[j], group->count*sizeof(float));
+      }
+   }
+
+   return hash;
+}
+
+// true if nothing is moving on its own and the scene is the same as last
+// frame (the first such frame renders every plate, and the ones after can
+// reuse them while plate_schedule.still)
+static qboolean is_scene_still(qboolean latching)
+{
+   if (!(cl.paused || key_dest != key_game || cl.intermission) ||
+         latching || capture.active || globe.save.should || rubix.enabled || !lens_front.valid) {
+      plate_schedule.still = false;
+      return false;
+   }
+
+   unsigned scene = hash_scene();
+   if (scene != plate_schedule.scene) {
+      plate_schedule.scene = scene;
+      plate_schedule.still = false;
+      return false;
+   }
+   if (plate_schedule.still && Sys_DoubleTime() - plate_schedule.still_time > PLATERATE_STILL_REFRESH) {
+      plate_schedule.still = false;
+   }
+   return true;
+}
+
+#ifndef GLQUAKE
+// decide if the plate is due to be rendered this frame
+static qboolean should_render_plate(int plate_index)
+{
+   int i = plate_index;
+   qboolean due = plate_schedule.age[i] < 0 || ++plate_schedule.age[i] >= plate_rate(i) || globe.save.should;
+
+   // the view has turned or moved (teleported) too far
+   if (!due) {
+      int j;
+      for (j=0; j<3; ++j) {
+         double turn = fmod(fabs(r_refdef.viewangles[j] - plate_schedule.angles[i][j]), 360);
+         if (turn > 180) turn = 360 - turn;
+         if (turn > PLATERATE_MAX_TURN) {
+            due = true;
+         }
+      }
+      vec3_t move;
+      VectorSubtract(r_refdef.vieworg, plate_schedule.origin[i], move);
+      if (DotProduct(move, move) > PLATERATE_MAX_MOVE*PLATERATE_MAX_MOVE) {
+         due = true;
+      }
+   }
+
+   if (due) {
+      plate_schedule.age[i] = 0;
+      VectorCopy(r_refdef.viewangles, plate_schedule.angles[i]);
+      VectorCopy(r_refdef.vieworg, plate_schedule.origin[i]);
+      plate_schedule.renders++;
+   }
+   return due;
+}
+
+// keep the lens just drawn from freshly rendered plates of a still scene
+static void save_still_lens(void)
+{
+   int y;
+   if (!plate_schedule.still_pixels) {
+      plate_schedule.still_pixels = fmem_alloc(FMEM_LENSMAP, lens.width_px*lens.height_px);
+      if (!plate_schedule.still_pixels) {
+         return;
+      }
+   }
+   for (y=0; y<lens.height_px; ++y) {
+      memcpy(plate_schedule.still_pixels + y*lens.width_px, VBUFFER(scr_vrect.x, scr_vrect.y+y), lens.width_px);
+   }
+   plate_schedule.still = true;
+   plate_schedule.still_time = Sys_DoubleTime();
+}
+
+// draw the kept lens again, under this frame's 2D overlay
+static void restore_still_lens(void)
+{
+   int y;
+   for (y=0; y<lens.height_px; ++y) {
+      memcpy(VBUFFER(scr_vrect.x, scr_vrect.y+y), plate_schedule.still_pixels + y*lens.width_px, lens.width_px);
+   }
+}
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS DRAWERS                                       |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+#ifndef GLQUAKE
+
+static void run_lens_drawer(int slice)
+{
+   int generation = 0;
+   for (;;) {
+      mutex_lock(&lens_drawers.lock);
+      while (lens_drawers.generation == generation && !lens_drawers.quit) {
+         cond_wait(&lens_drawers.start, &lens_drawers.lock);
+      }
+      if (lens_drawers.quit) {
+         mutex_unlock(&lens_drawers.lock);
+         return;
+      }
+      generation = lens_drawers.generation;
+      mutex_unlock(&lens_drawers.lock);
+
+      lens_drawers.draw(slice, lens_drawers.numthreads + 1);
+
+      mutex_lock(&lens_drawers.lock);
+      if (++lens_drawers.numdone == lens_drawers.numthreads) {
+         cond_broadcast(&lens_drawers.done);
+      }
+      mutex_unlock(&lens_drawers.lock);
+   }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI lens_drawer_main(LPVOID arg)
+{
+   run_lens_drawer((int)(intptr_t)arg);
+   return 0;
+}
+#else
+static void *lens_drawer_main(void *arg)
+{
+   run_lens_drawer((int)(intptr_t)arg);
+   return NULL;
+}
+#endif
+
+// (slice 0 is drawn by the main thread)
+static void start_lens_drawers(void)
+{
+   int i;
+   lens_drawers.quit = false;
+   lens_drawers.generation = 0;
+   lens_drawers.numthreads = 0;
+   lens_drawers.started = true;
+   for (i=0; i<lens_drawers.count; ++i) {
+      void *arg = (void*)(intptr_t)(i+1);
+#ifdef _WIN32
+      lens_drawers.threads[i] = CreateThread(NULL, 0, lens_drawer_main, arg, 0, NULL);
+      if (!lens_drawers.threads[i]) break;
+#else
+      if (pthread_create(&lens_drawers.threads[i], NULL, lens_drawer_main, arg)) break;
+#endif
+      lens_drawers.numthreads++;
+   }
+}
+
+#endif
+
+static void stop_lens_drawers(void)
+{
+   int i;
+   mutex_lock(&lens_drawers.lock);
+   lens_drawers.quit = true;
+   cond_broadcast(&lens_drawers.start);
+   mutex_unlock(&lens_drawers.lock);
+
+   for (i=0; i<lens_drawers.numthreads; ++i) {
+#ifdef _WIN32
+      WaitForSingleObject(lens_drawers.threads[i], INFINITE);
+      CloseHandle(lens_drawers.threads[i]);
+#else
+      pthread_join(lens_drawers.threads[i], NULL);
+#endif
+   }
+   lens_drawers.numthreads = 0;
+   lens_drawers.started = false;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS RENDERERS                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// copy the src pixels at the given offsets
+static void gather_pixels_c(byte *out, const byte *src, const unsigned *offsets, int len)
+{
+   int i = 0;
+   for (; i+4 <= len; i += 4) {
+      out[i]   = src[offsets[i]];
+      out[i+1] = src[offsets[i+1]];
+      out[i+2] = src[offsets[i+2]];
+      out[i+3] = src[offsets[i+3]];
+   }
+   for (; i<len; ++i) {
+      out[i] = src[offsets[i]];
+   }
+}
+
+#ifdef FISHEYE_AVX2
+// same as gather_pixels_c, eight pixels at a time
+// (reads 4 bytes at each offset, hence GLOBE_PADDING)
+__attribute__((target("avx2")))
+static void gather_pixels_avx2(byte *out, const byte *src, const unsigned *offsets, int len)
+{
+   // keep the low byte of each gathered 32-bit word
+   const __m256i pack = _mm256_setr_epi8(
+      0,4,8,12, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1,
+      0,4,8,12, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1);
+   int i = 0;
+   for (; i+8 <= len; i += 8) {
+      __m256i idx = _mm256_loadu_si256((const __m256i *)(offsets + i));
+      __m256i v = _mm256_i32gather_epi32((const int *)src, idx, 1);
+      v = _mm256_shuffle_epi8(v, pack);
+      int lo = _mm256_extract_epi32(v, 0);
+      int hi = _mm256_extract_epi32(v, 4);
+      memcpy(out + i, &lo, 4);
+      memcpy(out + i + 4, &hi, 4);
+   }
+   gather_pixels_c(out + i, src, offsets + i, len - i);
+}
+#endif
+
+// the gather kernel for this cpu (chosen in F_Init)
+static void (*gather_pixels)(byte *out, const byte *src, const unsigned *offsets, int len) = gather_pixels_c;
+
+#ifndef GLQUAKE
+
+// draw all the rows of the lens with the drawers helping
+static void draw_lensmap_slices(void (*draw)(int first, int step))
+{
+   if (!lens_drawers.started) {
+      start_lens_drawers();
+   }
+   if (lens_drawers.numthreads == 0) {
+      draw(0, 1);
+      return;
+   }
+
+   mutex_lock(&lens_drawers.lock);
+   lens_drawers.draw = draw;
+   lens_drawers.numdone = 0;
+   lens_drawers.generation++;
+   cond_broadcast(&lens_drawers.start);
+   mutex_unlock(&lens_drawers.lock);
+
+   draw(0, lens_drawers.numthreads + 1);
+
+   mutex_lock(&lens_drawers.lock);
+   while (lens_drawers.numdone < lens_drawers.numthreads) {
+      cond_wait(&lens_drawers.done, &lens_drawers.lock);
+   }
+   mutex_unlock(&lens_drawers.lock);
+}
+
+// true if the pth row or column of a plate lies on the rubix grid lines
+static qboolean is_rubix_line(int p, int platesize)
+{
+   // a plate pixel is drawn with the palette of its plate, unless its row
+   // or column is on the grid, so that a grid is shown
+
+   // (This is a block)
+   //    |----|----|----|
+   //    |    |    |    |
+   //    |    |    |    |
+   //    |----|----|----|
+   //    |    |XXXXXXXXX|
+   //    |    |XXXXXXXXX|
+   //    |----|XXXXXXXXX|
+   //    |    |XXXXXXXXX|
+   //    |    |XXXXXXXXX|
+   //    |----|----|----|
+   double block_size = (rubix.pad_size + rubix.cell_size);
+
+   // (Total number of units across)
+   //    ---------------------------------------------------
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |    |    |    |    |    |    |    |    |    |    |
+   //    |----|----|----|----|----|----|----|----|----|----|
+   double num_units = rubix.numcells * block_size + rubix.pad_size;
+
+   // (the size of one unit)
+   double unit_size_px = (double)platesize / num_units;
+
+   // convert the pixel coordinate to units
+   double u = (double)p/unit_size_px;
+
+   return fmod(u,block_size) < rubix.pad_size;
+}
+
+// the rubix tint of a lens pixel, from the plate pixel it reads
+static byte get_lens_pixel_tint(unsigned pixel, const struct _plate *plates)
+{
+   if (pixel == LENSPIXEL_NONE) {
+      return 255;
+   }
+   int platearea = globe.platesize * globe.platesize;
+   int plate_index = pixel / platearea;
+   int px = (pixel % platearea) % globe.platesize;
+   int py = (pixel % platearea) / globe.platesize;
+   return is_rubix_line(px,plates[plate_index].size) || is_rubix_line(py,plates[plate_index].height) ? 255 : plate_index;
+}
+
+// make the tints of the lensmap on screen while f_rubix shows them, and free
+// them otherwise (the grid lines of each plate are found once, so each lens
+// pixel is only a pair of table lookups)
+static void update_rubix_tints(void)
+{
+   if (!rubix.enabled) {
+      fmem_free(lens_front.pixel_tints);
+      lens_front.pixel_tints = NULL;
+      rubix.tints_ready = false;
+      return;
+   }
+   if (rubix.tints_ready || !lens_front.valid) {
+      return;
+   }
+
+   int area = lens.width_px * lens.height_px;
+   if (!lens_front.pixel_tints) {
+      lens_front.pixel_tints = fmem_alloc(FMEM_LENSMAP, area);
+      if (!lens_front.pixel_tints) {
+         return;
+      }
+   }
+
+   static byte cols[MAX_PLATES][MAX_PLATESIZE];
+   static byte rows[MAX_PLATES][MAX_PLATESIZE];
+   int i, p;
+   for (i=0; i<lens_front.numplates; ++i) {
+      for (p=0; p<lens_front.plates[i].size; ++p) {
+         cols[i][p] = is_rubix_line(p, lens_front.plates[i].size);
+      }
+      for (p=0; p<lens_front.plates[i].height; ++p) {
+         rows[i][p] = is_rubix_line(p, lens_front.plates[i].height);
+      }
+   }
+
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+   for (i=0; i<area; ++i) {
+      unsigned pixel = lens_front.pixels[i];
+      if (pixel == LENSPIXEL_NONE) {
+         lens_front.pixel_tints[i] = 255;
+         continue;
+      }
+      int plate_index = pixel / platearea;
+      int offset = pixel % platearea;
+      lens_front.pixel_tints[i] = cols[plate_index][offset % platesize] | rows[plate_index][offset / platesize] ?
+         255 : plate_index;
+   }
+   rubix.tints_ready = true;
+}
+
+
+// fill the table of the palette colours between each pair of colours
+static void create_lens_filter_average(void)
+{
+   palsearch_t search;
+   int a, b;
+
+   Pal_InitSearch(&search, host_basepal, 3);
+   for (a=0; a<256; ++a) {
+      const byte *ca = host_basepal + a*3;
+      lens_filter.average[a][a] = a;
+      for (b=0; b<a; ++b) {
+         const byte *cb = host_basepal + b*3;
+         byte c = Pal_FindClosest(&search, (ca[0]+cb[0]+1)/2, (ca[1]+cb[1]+1)/2, (ca[2]+cb[2]+1)/2);
+         lens_filter.average[a][b] = lens_filter.average[b][a] = c;
+      }
+   }
+   lens_filter.average_ready = true;
+}
+
+// the step between plate pixels of a lens pixel and its neighbour (nx,ny),
+// in plate pixels (false if the neighbour is not on the same plate)
+static qboolean lens_filter_delta(unsigned pixel, int nx, int ny, int *du, int *dv)
+{
+   if (nx < 0 || nx >= lens.width_px || ny < 0 || ny >= lens.height_px) {
+      return false;
+   }
+   unsigned other = lens_front.pixels[nx + ny*lens.width_px];
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+   if (other == LENSPIXEL_NONE || other / platearea != pixel / platearea) {
+      return false;
+   }
+   int a = pixel % platearea, b = other % platearea;
+   *du = b % platesize - a % platesize;
+   *dv = b / platesize - a / platesize;
+   return true;
+}
+
+// a quarter of the span of a lens pixel along one axis, from its neighbours
+// on either side, in plate pixels
+static void lens_filter_axis(unsigned pixel, int x, int y, int sx, int sy, int *hu, int *hv)
+{
+   int du = 0, dv = 0;
+   if (!lens_filter_delta(pixel, x+sx, y+sy, &du, &dv) &&
+         lens_filter_delta(pixel, x-sx, y-sy, &du, &dv)) {
+      du = -du;
+      dv = -dv;
+   }
+   *hu = (int)floor(du / 4.0 + 0.5);
+   *hv = (int)floor(dv / 4.0 + 0.5);
+}
+
+// find the two tap steps of each lens pixel of the lensmap on screen while
+// f_lensfilter is on, and free them otherwise
+static void update_lens_filter(void)
+{
+   if (!lens_filter.enabled) {
+      fmem_free(lens_front.filter_steps);
+      lens_front.filter_steps = NULL;
+      lens_filter.ready = false;
+      return;
+   }
+   if (lens_filter.ready || !lens_front.valid) {
+      return;
+   }
+   if (!lens_filter.average_ready) {
+      create_lens_filter_average();
+   }
+
+   int area = lens.width_px * lens.height_px;
+   if (!lens_front.filter_steps) {
+      lens_front.filter_steps = fmem_alloc(FMEM_LENSMAP, area*sizeof(int[2]));
+      if (!lens_front.filter_steps) {
+         return;
+      }
+   }
+
+   int platesize = globe.platesize;
+   int platearea = platesize * platesize;
+   int x, y;
+   for (y=0; y<lens.height_px; ++y) {
+      for (x=0; x<lens.width_px; ++x) {
+         int i = x + y*lens.width_px;
+         int *steps = lens_front.filter_steps + 2*i;
+         unsigned pixel = lens_front.pixels[i];
+         steps[0] = steps[1] = 0;
+         if (pixel == LENSPIXEL_NONE) {
+            continue;
+         }
+
+         int xu, xv, yu, yv;
+         lens_filter_axis(pixel, x, y, 1, 0, &xu, &xv);
+         lens_filter_axis(pixel, x, y, 0, 1, &yu, &yv);
+
+         // the taps must be plate pixels that are rendered
+         const vrect_t *rect = &lens_front.plates[pixel / platearea].scissor;
+         int pu = pixel % platearea % platesize;
+         int pv = pixel % platearea / platesize;
+         int su = abs(xu) + abs(yu), sv = abs(xv) + abs(yv);
+         if (pu - su < rect->x || pu + su >= rect->x + rect->width ||
+               pv - sv < rect->y || pv + sv >= rect->y + rect->height) {
+            continue;
+         }
+
+         steps[0] = xu + xv*platesize;
+         steps[1] = yu + yv*platesize;
+      }
+   }
+   lens_filter.ready = true;
+}
+
+// copy the mean of the four taps of each pixel at the given offsets
+static void gather_pixels_filtered(byte *out, const byte *src, const unsigned *offsets, const int *steps, int len)
+{
+   byte (*average)[256] = lens_filter.average;
+   int i;
+   for (i=0; i<len; ++i, steps += 2) {
+      const byte *p = src + offsets[i];
+      int s = steps[0], t = steps[1];
+      out[i] = average[average[p[-s-t]][p[s-t]]][average[p[-s+t]][p[s+t]]];
+   }
+}
+
+// copy the src pixels at the given offsets, filtered by their rubix tints
+static void gather_pixels_tinted(byte *out, const byte *src, const unsigned *offsets, const byte *tints, const struct _plate *plates, int len)
+{
+   int i;
+   for (i=0; i<len; ++i) {
+      byte color = src[offsets[i]];
+      int t = tints[i];
+      out[i] = t != 255 ? plates[t].palette[color] : color;
+   }
+}
+
+// copy len src pixels that are stride apart
+static void stride_pixels(byte *out, const byte *src, int stride, int len)
+{
+   int i = 0;
+   for (; i+4 <= len; i += 4, src += 4*stride) {
+      out[i]   = src[0];
+      out[i+1] = src[stride];
+      out[i+2] = src[2*stride];
+      out[i+3] = src[3*stride];
+   }
+   for (; i<len; ++i, src += stride) {
+      out[i] = *src;
+   }
+}
+
+// clear the screen around the lens, and the lens pixels that render_lensmap
+// leaves alone (all of it until the spans are ready)
+static void clear_lensmap_gaps(void)
+{
+   if (!lens_front.valid || !lens_spans.ready) {
+      Draw_TileClear(0, 0, vid.width, vid.height);
+      return;
+   }
+
+   // (side by side stereo draws the lens twice across)
+   int eyes = stereo.mode == STEREO_SIDE && !capture.active ? 2 : 1;
+   int x0 = scr_vrect.x, y0 = scr_vrect.y;
+   int x1 = x0 + eyes*lens.width_px, y1 = y0 + lens.height_px;
+   Draw_TileClear(0, 0, vid.width, y0);
+   Draw_TileClear(0, y1, vid.width, vid.height - y1);
+   Draw_TileClear(0, y0, x0, y1 - y0);
+   Draw_TileClear(x1, y0, vid.width - x1, y1 - y0);
+
+   // (nothing more with a lens covering the screen)
+   int y;
+   for (y=0; y<lens.height_px; ++y) {
+      struct _lens_gap *gap = lens_spans.gaps + lens_spans.gaprows[y];
+      struct _lens_gap *end = lens_spans.gaps + lens_spans.gaprows[y+1];
+      for (; gap < end; ++gap) {
+         int e;
+         for (e=0; e<eyes; ++e) {
+            Draw_TileClear(x0 + e*lens.width_px + gap->x, y0 + y, gap->len, 1);
+         }
+      }
+   }
+}
+
+// draw the lensmap to the vidbuffer, a span at a time
+static void render_lensmap(void)
+{
+   // (a streamed lens has no lensmap, nor rubix tints or a filter)
+   if (lens_stream.active) {
+      if (lens_stream.ready) {
+         draw_lensmap_slices(render_lensmap_streamed_rows);
+      }
+      return;
+   }
+
+   update_rubix_tints();
+   update_lens_filter();
+
+   // the spans are only built once a lensmap is finished
+   if (!lens_front.valid || !lens_spans.ready) {
+      render_lensmap_pixels();
+      return;
+   }
+
+   // (tiles are drawn without the rubix tints or the filter)
+   if (lens_filter.ready && !rubix.enabled) {
+      draw_lensmap_slices(render_lensmap_filtered);
+   }
+   else if (lens_tiles.ready && !rubix.enabled) {
+      draw_lensmap_slices(render_lensmap_tiles);
+   }
+   else {
+      draw_lensmap_slices(render_lensmap_rows);
+   }
+}
+
+static void render_lensmap_rows(int first, int step)
+{
+   int y;
+   for (y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *lmap = lens_front.pixels + y*lens.width_px;
+      struct _lens_span *span = lens_spans.spans + lens_spans.rows[y];
+      struct _lens_span *end = lens_spans.spans + lens_spans.rows[y+1];
+
+      // the rubix tint is decided once per frame, not once per pixel
+      if (rubix.enabled && rubix.tints_ready) {
+         byte *pmap = lens_front.pixel_tints + y*lens.width_px;
+         for (; span < end; ++span) {
+            gather_pixels_tinted(vrow + span->x, globe.pixels, lmap + span->x, pmap + span->x, lens_front.plates, span->len);
+         }
+         continue;
+      }
+
+      for (; span < end; ++span)
+      {
+         byte *out = vrow + span->x;
+         switch (span->kind) {
+            case SPAN_RUN:
+               memcpy(out, globe.pixels + span->start, span->len);
+               break;
+            case SPAN_STRIDED:
+               stride_pixels(out, globe.pixels + span->start, span->stride, span->len);
+               break;
+            default:
+               gather_pixels(out, globe.pixels, lmap + span->x, span->len);
+               break;
+         }
+      }
+   }
+}
+
+static void render_lensmap_filtered(int first, int step)
+{
+   int y;
+   for (y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *lmap = lens_front.pixels + y*lens.width_px;
+      int *steps = lens_front.filter_steps + 2*y*lens.width_px;
+      struct _lens_span *span = lens_spans.spans + lens_spans.rows[y];
+      struct _lens_span *end = lens_spans.spans + lens_spans.rows[y+1];
+      for (; span < end; ++span) {
+         gather_pixels_filtered(vrow + span->x, globe.pixels, lmap + span->x, steps + 2*span->x, span->len);
+      }
+   }
+}
+
+// draw a run of consecutive tiles (the whole run, so that each drawer keeps
+// to one part of the plates)
+static void render_lensmap_tiles(int first, int step)
+{
+   int size = lens_tiles.size;
+   int from = (long long)lens_tiles.numtiles * first / step;
+   int to = (long long)lens_tiles.numtiles * (first+1) / step;
+   int t, y;
+
+   for (t=from; t<to; ++t)
+   {
+      const struct _lens_tile *tile = &lens_tiles.tiles[t];
+      int x0 = tile->x;
+      int x1 = x0 + size < lens.width_px ? x0 + size : lens.width_px;
+      int y1 = tile->y + size < lens.height_px ? tile->y + size : lens.height_px;
+      int col = x0 / size;
+
+      for (y=tile->y; y<y1; ++y)
+      {
+         byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+         unsigned *lmap = lens_front.pixels + y*lens.width_px;
+         struct _lens_span *span = lens_spans.spans + lens_tiles.starts[y*lens_tiles.numcols + col];
+         struct _lens_span *end = lens_spans.spans + lens_spans.rows[y+1];
+
+         // clip each span reaching into the tile to its columns
+         for (; span < end && span->x < x1; ++span)
+         {
+            int a = span->x > x0 ? span->x : x0;
+            int b = span->x + span->len < x1 ? span->x + span->len : x1;
+            int skip = a - span->x;
+            switch (span->kind) {
+               case SPAN_RUN:
+                  memcpy(vrow + a, globe.pixels + span->start + skip, b - a);
+                  break;
+               case SPAN_STRIDED:
+                  stride_pixels(vrow + a, globe.pixels + span->start + skip*span->stride, span->stride, b - a);
+                  break;
+               default:
+                  gather_pixels(vrow + a, globe.pixels, lmap + a, b - a);
+                  break;
+            }
+         }
+      }
+   }
+}
+
+// estimate the share of plate reads that miss a cache of the given size
+// (8 way, 64 byte lines, least recently used first out), reading the
+// lensmap on screen in rows or in the current tiles
+static double count_cache_misses(qboolean tiled, int kb)
+{
+   enum { WAYS = 8, LINE = 64 };
+   int numsets = kb * 1024 / (LINE * WAYS);
+   unsigned *tags = fmem_alloc(FMEM_OTHER, numsets * WAYS * sizeof(unsigned));
+   if (!tags) {
+      return 0;
+   }
+   memset(tags, 0xff, numsets * WAYS * sizeof(unsigned));
+
+   long long reads = 0, misses = 0;
+   int numtiles = tiled ? lens_tiles.numtiles : 1;
+   int size = lens_tiles.size;
+   int t, x, y, w;
+   for (t=0; t<numtiles; ++t)
+   {
+      int x0 = 0, y0 = 0, x1 = lens.width_px, y1 = lens.height_px;
+      if (tiled) {
+         x0 = lens_tiles.tiles[t].x;
+         y0 = lens_tiles.tiles[t].y;
+         if (x0 + size < x1) x1 = x0 + size;
+         if (y0 + size < y1) y1 = y0 + size;
+      }
+      for (y=y0; y<y1; ++y) {
+         const unsigned *row = lens_front.pixels + y*lens.width_px;
+         for (x=x0; x<x1; ++x) {
+            if (row[x] == LENSPIXEL_NONE) {
+               continue;
+            }
+            unsigned line = row[x] / LINE;
+            unsigned *set = tags + (line % numsets) * WAYS;
+            ++reads;
+            for (w=0; w<WAYS-1 && set[w] != line; ++w);
+            if (set[w] != line) {
+               ++misses;
+            }
+            // move the line to the front of its set
+            for (; w>0; --w) {
+               set[w] = set[w-1];
+            }
+            set[0] = line;
+         }
+      }
+   }
+   fmem_free(tags);
+
+   return reads ? (double)misses / reads : 0;
+}
+
+// milliseconds to draw the lensmap once, over a number of draws
+static double time_lensmap_draws(void (*draw)(int first, int step), int repeats)
+{
+   int i;
+   double start = Sys_DoubleTime();
+   for (i=0; i<repeats; ++i) {
+      draw_lensmap_slices(draw);
+   }
+   return (Sys_DoubleTime() - start) * 1000 / repeats;
+}
+
+// "f_lenstiles compare": draw the lensmap in rows and in tiles, and print how
+// long each takes, with the cache misses they are estimated to cause
+static void compare_lensmap_orders(void)
+{
+   int repeats = lens_tiles.compare;
+   int size = lens_tiles.size;
+   lens_tiles.compare = 0;
+
+   if (!lens_spans.ready || !lens_front.valid) {
+      return;
+   }
+
+   // compare against 32x32 tiles if they are not in use
+   if (size == 0) {
+      lens_tiles.size = 32;
+      build_lens_tiles(lens_front.pixels);
+   }
+   if (!lens_tiles.ready) {
+      Con_Printf("f_lenstiles: not enough memory for the tiles\n");
+      lens_tiles.size = size;
+      return;
+   }
+
+   double rows_ms = time_lensmap_draws(render_lensmap_rows, repeats);
+   double tiles_ms = time_lensmap_draws(render_lensmap_tiles, repeats);
+
+   Con_Printf("lensmap %dx%d, plates of %d, %d draws each\n", lens.width_px, lens.height_px, globe.platesize, repeats);
+   Con_Printf("         ms    misses 32K  misses 512K\n");
+   Con_Printf("rows   %6.2f   %8.1f%%   %8.1f%%\n", rows_ms,
+         100 * count_cache_misses(false, 32), 100 * count_cache_misses(false, 512));
+   Con_Printf("%3dx%-3d%6.2f   %8.1f%%   %8.1f%%\n", lens_tiles.size, lens_tiles.size, tiles_ms,
+         100 * count_cache_misses(true, 32), 100 * count_cache_misses(true, 512));
+
+   if (size == 0) {
+      lens_tiles.size = 0;
+      build_lens_tiles(lens_front.pixels);
+   }
+}
+
+// draw the lensmap to the vidbuffer, one pixel at a time
+// (used while the first lensmap is still being built)
+static void render_lensmap_pixels(void)
+{
+   int x, y;
+   for(y=0; y<lens.height_px; y++)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *lmap = LENSPIXEL(0,y);
+      if (rubix.enabled) {
+         for(x=0; x<lens.width_px; x++) {
+            if (lmap[x] != LENSPIXEL_NONE) {
+               byte tint = get_lens_pixel_tint(lmap[x], globe.plates);
+               gather_pixels_tinted(vrow + x, globe.pixels, lmap + x, &tint, globe.plates, 1);
+            }
+         }
+      }
+      else {
+         for(x=0; x<lens.width_px; x++) {
+            if (lmap[x] != LENSPIXEL_NONE) {
+               vrow[x] = globe.pixels[lmap[x]];
+            }
+         }
+      }
+   }
+}
+
+// read the mouse again, and find the rotation from the view that the plates
+// were rendered with to the new one (returns false if it has not turned)
+static qboolean latch_view_rotation(double m[3][3])
+{
+   if (cls.state != ca_active || cls.demoplayback || key_dest != key_game ||
+         cl.paused || cl.intermission || rubix.enabled || globe.save.should) {
+      return false;
+   }
+
+   Sys_SendKeyEvents();
+   IN_Move(&lens_latch.cmd);
+
+   vec3_t angles;
+   int i;
+   for (i=0; i<3; ++i) {
+      angles[i] = lens_latch.angles[i] + cl.viewangles[i] - lens_latch.base[i];
+   }
+   if (VectorCompare(angles, lens_latch.angles)) {
+      return false;
+   }
+   set_view_rotation(lens_latch.angles, angles, m);
+   return true;
+}
+
+// find the rotation that turns a ray in the view at angles "to" into the
+// same ray in the view at angles "from"
+static void set_view_rotation(vec3_t from, vec3_t to, double m[3][3])
+{
+   // each row is an old axis, each column is a new axis
+   vec3_t old[3], new[3];
+   int i, j;
+   AngleVectors(from, old[2], old[0], old[1]);
+   AngleVectors(to, new[2], new[0], new[1]);
+   for (i=0; i<3; ++i) {
+      for (j=0; j<3; ++j) {
+         m[i][j] = DotProduct(old[i], new[j]);
+      }
+   }
+}
+
+// get the tables to warp the lens with this frame
+// (returns false if the view is not under water)
+static qboolean update_lens_warp(void)
+{
+   if (!is_view_under_water() || !lens_front.valid || rubix.enabled) {
+      return false;
+   }
+
+   int w = lens.width_px;
+   int h = lens.height_px;
+   if (w != lens_warp.width || h != lens_warp.height) {
+      fmem_free(lens_warp.cols);
+      fmem_free(lens_warp.rows);
+      lens_warp.cols = fmem_alloc(FMEM_LENSMAP, (w + TURB_SCREEN_AMP*2)*sizeof(int));
+      lens_warp.rows = fmem_alloc(FMEM_LENSMAP, (h + TURB_SCREEN_AMP*2)*sizeof(int));
+      if (!lens_warp.cols || !lens_warp.rows) {
+         fmem_free(lens_warp.cols);
+         fmem_free(lens_warp.rows);
+         lens_warp.cols = lens_warp.rows = NULL;
+         lens_warp.width = lens_warp.height = 0;
+         return false;
+      }
+      lens_warp.width = w;
+      lens_warp.height = h;
+
+      int i;
+      for (i=0; i<w + TURB_SCREEN_AMP*2; ++i) {
+         lens_warp.cols[i] = (int)((float)i * w / (w + TURB_SCREEN_AMP*2));
+      }
+      for (i=0; i<h + TURB_SCREEN_AMP*2; ++i) {
+         lens_warp.rows[i] = (int)((float)i * h / (h + TURB_SCREEN_AMP*2)) * w;
+      }
+   }
+
+   lens_warp.turb = intsintable + ((int)(cl.time * TURB_SPEED) & (TURB_CYCLE - 1));
+   return true;
+}
+
+// draw the lensmap to the vidbuffer, each pixel read from its warped place
+static void render_lensmap_warped_rows(int first, int step)
+{
+   const int *turb = lens_warp.turb;
+   const unsigned *lmap = lens_front.pixels;
+   int x, y;
+   for (y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      const int *col = lens_warp.cols + turb[y & (TURB_CYCLE - 1)];
+      const int *row = lens_warp.rows + y;
+      for (x=0; x<lens.width_px; x++) {
+         unsigned pixel = lmap[row[turb[x & (TURB_CYCLE - 1)]] + col[x]];
+         if (pixel != LENSPIXEL_NONE) {
+            vrow[x] = globe.pixels[pixel];
+         }
+      }
+   }
+}
+
+// true if the view is in water, slime or lava and r_waterwarp is on
+static qboolean is_view_under_water(void)
+{
+   return r_waterwarp.value && r_viewleaf && r_viewleaf->contents <= CONTENTS_WATER;
+}
+
+// true if any plate on screen has sky for the lens to draw
+// (and gets the sky ready for get_sky_pixel)
+static qboolean lens_has_sky(void)
+{
+   int i;
+   for (i=0; i<lens_front.numplates; ++i) {
+      if (lens_front.plates[i].display && lens_sky.plate_has_sky[i]) {
+         break;
+      }
+   }
+   if (i == lens_front.numplates) {
+      return false;
+   }
+
+   if (!r_skymade) {
+      R_MakeSky();
+   }
+   lens_sky.scroll = skytime * skyspeed;
+   return true;
+}
+
+// the sky seen along a ray (right, up, forward from the view)
+static byte get_sky_pixel(vec3_t ray)
+{
+   vec3_t end;
+   int j;
+   for (j=0; j<3; ++j) {
+      end[j] = ray[0]*lens_sky.right[j] + ray[1]*lens_sky.up[j] + ray[2]*lens_sky.forward[j];
+   }
+   end[2] *= 3;
+   VectorNormalize(end);
+
+   fixed16_t s = (int)((lens_sky.scroll + 6 * (SKYSIZE / 2 - 1) * end[0]) * 0x10000);
+   fixed16_t t = (int)((lens_sky.scroll + 6 * (SKYSIZE / 2 - 1) * end[1]) * 0x10000);
+   return r_skysource[((t & R_SKY_TMASK) >> 8) + ((s & R_SKY_SMASK) >> 16)];
+}
+
+// draw the sky over the lens pixels whose plate pixels are marked as sky
+static void render_lens_sky_rows(int first, int step)
+{
+   int platearea = globe.platesize * globe.platesize;
+   int x, y;
+   for (y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *lmap = lens_front.pixels + y*lens.width_px;
+      for (x=0; x<lens.width_px; x++)
+      {
+         unsigned pixel = lmap[x];
+         if (pixel == LENSPIXEL_NONE || !globe.skymask[pixel]) {
+            continue;
+         }
+
+         // the lens ray if it is kept, else the ray of the plate pixel
+         vec3_t ray;
+         unsigned code = ray_field.current ? ray_field.rays[y*ray_field.width + x] : RAYFIELD_NONE;
+         if (code != RAYFIELD_NONE) {
+            decode_ray(code, ray);
+         }
+         else {
+            int plate_index = pixel / platearea;
+            int offset = pixel % platearea;
+            struct _plate *plate = &lens_front.plates[plate_index];
+            double u = (offset % globe.platesize + 0.5) / plate->size - 0.5;
+            double v = 0.5 - (offset / globe.platesize + 0.5) / plate->height;
+            int j;
+            for (j=0; j<3; ++j) {
+               ray[j] = plate->dist*plate->forward[j] + u*plate->right[j] + v*plate->aspect*plate->up[j];
+            }
+         }
+
+         vrow[x] = get_sky_pixel(ray);
+      }
+   }
+}
+
+// get the right eye's globe and the anaglyph table ready for a stereo frame
+// (returns false if there is not enough memory for the globe)
+static qboolean update_stereo(void)
+{
+   if (!stereo.pixels) {
+      stereo.pixels = fmem_alloc(FMEM_GLOBE, globe.platesize*globe.platesize*MAX_PLATES + GLOBE_PADDING);
+      if (!stereo.pixels) {
+         return false;
+      }
+      refresh_all_plates();
+   }
+
+   if (stereo.mode == STEREO_ANAGLYPH && !stereo.anaglyph_ready) {
+      palsearch_t search;
+      int a, b;
+      Pal_InitSearch(&search, host_basepal, 3);
+      for (a=0; a<256; ++a) {
+         for (b=0; b<256; ++b) {
+            const byte *ca = host_basepal + a*3, *cb = host_basepal + b*3;
+            stereo.anaglyph[a][b] = Pal_FindClosest(&search, ca[0], cb[1], cb[2]);
+         }
+      }
+      stereo.anaglyph_ready = true;
+   }
+   return true;
+}
+
+// render a plate for the left eye into the globe, then for the right eye
+// into the right eye's globe (eye = half the separation along the view's right)
+static void render_stereo_plate(int plate_index, const struct _plate *plate, vec3_t forward, vec3_t right, vec3_t up, vec3_t eye)
+{
+   vec3_t center;
+   byte *pixels = globe.pixels;
+   VectorCopy(r_refdef.vieworg, center);
+
+   VectorSubtract(center, eye, r_refdef.vieworg);
+   render_plate(plate_index, plate, forward, right, up);
+
+   VectorAdd(center, eye, r_refdef.vieworg);
+   globe.pixels = stereo.pixels;
+   render_plate(plate_index, plate, forward, right, up);
+
+   globe.pixels = pixels;
+   VectorCopy(center, r_refdef.vieworg);
+}
+
+// draw both eyes' globes through the lensmap, a span at a time
+static void render_stereo_rows(int first, int step)
+{
+   byte left[MAXWIDTH], right[MAXWIDTH];
+   int i, y;
+   for (y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *lmap = lens_front.pixels + y*lens.width_px;
+      struct _lens_span *span = lens_spans.spans + lens_spans.rows[y];
+      struct _lens_span *end = lens_spans.spans + lens_spans.rows[y+1];
+      for (; span < end; ++span)
+      {
+         byte *out = vrow + span->x;
+         if (stereo.mode == STEREO_SIDE) {
+            gather_pixels(out, globe.pixels, lmap + span->x, span->len);
+            gather_pixels(out + lens.width_px, stereo.pixels, lmap + span->x, span->len);
+            continue;
+         }
+
+         gather_pixels(left, globe.pixels, lmap + span->x, span->len);
+         gather_pixels(right, stereo.pixels, lmap + span->x, span->len);
+         for (i=0; i<span->len; ++i) {
+            out[i] = stereo.anaglyph[left[i]][right[i]];
+         }
+      }
+   }
+}
+
+// draw the lensmap to the vidbuffer, from its rays turned by m
+// (finding the plate pixel of every ray again, like set_lensmap_pixel_from_ray)
+static void render_lensmap_latched(double m[3][3])
+{
+   memcpy(lens_drawers.m, m, sizeof(lens_drawers.m));
+   draw_lensmap_slices(render_lensmap_latched_rows);
+}
+
+static void render_lensmap_latched_rows(int first, int step)
+{
+   double (*m)[3] = lens_drawers.m;
+   int x, y;
+   for(y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *code = ray_field.rays + y*ray_field.width;
+      for(x=0; x<lens.width_px; x++)
+      {
+         if (code[x] == RAYFIELD_NONE) {
+            continue;
+         }
+
+         vec3_t r, ray;
+         decode_ray(code[x], r);
+         ray[0] = m[0][0]*r[0] + m[0][1]*r[1] + m[0][2]*r[2];
+         ray[1] = m[1][0]*r[0] + m[1][1]*r[1] + m[1][2]*r[2];
+         ray[2] = m[2][0]*r[0] + m[2][1]*r[1] + m[2][2]*r[2];
+
+         double z;
+         unsigned pixel = find_globe_pixel(ray, &z);
+         if (pixel != LENSPIXEL_NONE) {
+            vrow[x] = globe.pixels[pixel];
+         }
+      }
+   }
+}
+
+// draw a streamed lens to the vidbuffer, evaluating its native inverse for
+// every pixel and finding the plate pixel each ray lands on, as the lensmap
+// builder would (see f_streamlens)
+static void render_lensmap_streamed_rows(int first, int step)
+{
+   int (*inverse)(double x, double y, vec3_t ray) = lens.native->inverse;
+   int x, y;
+   for(y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      double ly = -(y-lens.height_px/2) * lens.scale;
+      for(x=0; x<lens.width_px; x++)
+      {
+         vec3_t ray;
+         if (inverse((x-lens.width_px/2) * lens.scale, ly, ray) != 1) {
+            continue;
+         }
+
+         int plate_index = ray_to_plate_index(ray);
+         double u, v;
+         if (plate_index < 0 || !ray_to_plate_uv(plate_index, ray, &u, &v)) {
+            continue;
+         }
+         int px = (int)(u*globe.plates[plate_index].size);
+         int py = (int)(v*globe.plates[plate_index].height);
+         if (px < globe.plates[plate_index].size && py < globe.plates[plate_index].height) {
+            vrow[x] = globe.pixels[GLOBEOFFSET(plate_index,px,py)];
+         }
+      }
+   }
+}
+
+// find the globe pixel that a ray from the view the plates were rendered
+// with lands on, and how far the ray goes along its plate's forward axis
+// (returns LENSPIXEL_NONE if no plate on screen has it)
+static unsigned find_globe_pixel(vec3_t ray, double *z)
+{
+   int plate_index = ray_to_plate_index(ray);
+   if (plate_index < 0 || plate_index >= lens_front.numplates) {
+      return LENSPIXEL_NONE;
+   }
+
+   // (the plates on screen, which a prefetch may have resized since)
+   struct _plate *plate = &lens_front.plates[plate_index];
+   *z = DotProduct(plate->forward, ray);
+   if (*z <= 0) {
+      return LENSPIXEL_NONE;
+   }
+   double u = DotProduct(plate->right, ray)/ *z*plate->dist + 0.5;
+   double v = -DotProduct(plate->up, ray)/ *z*plate->dist/plate->aspect + 0.5;
+   int px = (int)(u*plate->size);
+   int py = (int)(v*plate->height);
+   if (px < 0 || px >= plate->size || py < 0 || py >= plate->height) {
+      return LENSPIXEL_NONE;
+   }
+   return GLOBEOFFSET(plate_index, px, py);
+}
+
+// decide if this frame is drawn from the last globe, and if so get the
+// rotation and move from the view it was rendered with
+// (otherwise the globe is rendered this frame, from this view)
+static qboolean reproject_globe(qboolean reprojecting)
+{
+   if (!reprojecting) {
+      lens_reproject.age = -1;
+      return false;
+   }
+
+   vec3_t move;
+   VectorSubtract(r_refdef.vieworg, lens_reproject.origin, move);
+   if (lens_reproject.age >= 0 && lens_reproject.age < lens_reproject.frames && globe.depth &&
+         DotProduct(move, move) <= REPROJECT_MAX_MOVE*REPROJECT_MAX_MOVE) {
+      ++lens_reproject.age;
+      vec3_t forward, right, up;
+      AngleVectors(lens_reproject.angles, forward, right, up);
+      lens_reproject.move[0] = DotProduct(move, right);
+      lens_reproject.move[1] = DotProduct(move, up);
+      lens_reproject.move[2] = DotProduct(move, forward);
+      set_view_rotation(lens_reproject.angles, r_refdef.viewangles, lens_reproject.m);
+      return true;
+   }
+
+   if (!globe.depth) {
+      globe.depth = fmem_alloc(FMEM_GLOBE, globe.platesize*globe.platesize*MAX_PLATES*sizeof(short));
+      if (!globe.depth) {
+         Con_Printf("Quake-Lenses: not enough memory for reprojection, turning it off\n");
+         lens_reproject.frames = 0;
+         lens_reproject.age = -1;
+         return false;
+      }
+   }
+   lens_reproject.age = 0;
+   VectorCopy(r_refdef.vieworg, lens_reproject.origin);
+   VectorCopy(r_refdef.viewangles, lens_reproject.angles);
+   return false;
+}
+
+// draw the lensmap to the vidbuffer, each ray moved and turned to the view of
+// this frame, finding the point it sees in the depth of the last globe
+static void render_lensmap_reprojected_rows(int first, int step)
+{
+   double (*m)[3] = lens_reproject.m;
+   const double *move = lens_reproject.move;
+   int x, y, i, k;
+   for(y=first; y<lens.height_px; y+=step)
+   {
+      byte *vrow = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      unsigned *code = ray_field.rays + y*ray_field.width;
+      for(x=0; x<lens.width_px; x++)
+      {
+         if (code[x] == RAYFIELD_NONE) {
+            continue;
+         }
+
+         // the ray of this frame, in the axes of the old view
+         vec3_t r, ray;
+         decode_ray(code[x], r);
+         for (i=0; i<3; ++i) {
+            ray[i] = m[i][0]*r[0] + m[i][1]*r[1] + m[i][2]*r[2];
+         }
+
+         // first guess that what it sees is far away, so in the same
+         // direction from the old view, then move the guess onto the point
+         // the globe saw there, at the same distance along the new ray
+         vec3_t dir;
+         VectorCopy(ray, dir);
+         unsigned pixel = LENSPIXEL_NONE;
+         for (k=0; k<REPROJECT_STEPS; ++k) {
+            double z;
+            unsigned p = find_globe_pixel(dir, &z);
+            if (p == LENSPIXEL_NONE) {
+               break;
+            }
+            pixel = p;
+
+            // (the z-buffer holds 0x8000/z, and sky is drawn with none)
+            int zi = globe.depth[p];
+            if (zi <= 0) {
+               break;
+            }
+            double scale = 0x8000 / (zi * z);
+            vec3_t seen;
+            for (i=0; i<3; ++i) {
+               seen[i] = dir[i]*scale - move[i];
+            }
+            double dist = sqrt(DotProduct(seen, seen));
+            for (i=0; i<3; ++i) {
+               dir[i] = move[i] + ray[i]*dist;
+            }
+         }
+         if (pixel != LENSPIXEL_NONE) {
+            vrow[x] = globe.pixels[pixel];
+         }
+      }
+   }
+}
+
+// The surface cache from the video mode is sized for one view of the screen,
+// but the plates of a frame see far more surfaces between them, so they get a
+// cache of their own sized for all the pixels they are rendered with.
+static struct {
+   byte *buffer;
+   int size;
+} plate_surfcache;
+
+static void set_plate_surfcache(const struct _plate *plates, int numplates)
+{
+   int i;
+   int pixels = 0;
+   for (i=0; i<numplates; ++i) {
+      if (plates[i].display) {
+         pixels += plates[i].size * plates[i].height;
+      }
+   }
+   int size = D_SurfaceCacheForRes(pixels, 1);
+
+   // (only reallocated when it is too small, or far too big)
+   if (size > plate_surfcache.size || size < plate_surfcache.size/2) {
+      D_SetCache(NULL, 0);
+      fmem_free(plate_surfcache.buffer);
+      plate_surfcache.buffer = fmem_alloc(FMEM_GLOBE, size);
+      plate_surfcache.size = plate_surfcache.buffer ? size : 0;
+   }
+   if (plate_surfcache.buffer) {
+      D_SetCache(plate_surfcache.buffer, plate_surfcache.size);
+   }
+}
+
+// go back to the video mode's surface cache
+static void free_plate_surfcache(void)
+{
+   D_SetCache(NULL, 0);
+   fmem_free(plate_surfcache.buffer);
+   plate_surfcache.buffer = NULL;
+   plate_surfcache.size = 0;
+}
+
+// sort the scene's entities and particles out between the plates once per frame
+// (each plate is a cone around its forward vector reaching out to its corners,
+//  seen from up to margin units off the view origin)
+static void bin_plate_scene(const struct _plate *plates, int numplates, vec3_t forward, vec3_t right, vec3_t up, float margin)
+{
+   vec3_t f[MAX_PLATES];
+   float halfangle[MAX_PLATES];
+   int i;
+   for (i=0; i<numplates; ++i) {
+      VectorScale(right, plates[i].forward[0], f[i]);
+      VectorMA(f[i], plates[i].forward[1], up, f[i]);
+      VectorMA(f[i], plates[i].forward[2], forward, f[i]);
+      halfangle[i] = atan(tan(plates[i].fov/2) * sqrt(1 + plates[i].aspect*plates[i].aspect));
+   }
+   R_BinScene(numplates, (const vec3_t *)f, halfangle, margin);
+}
+
+// walk the world once for all the plates about to be rendered, each of which
+// then only clips the surfaces listed for it
+static void cull_plate_scene(const struct _plate *plates, int numplates, const qboolean *due, vec3_t forward, vec3_t right, vec3_t up)
+{
+   sceneview_t views[MAX_PLATES];
+   unsigned viewbits = 0;
+   int i, j;
+   for (i=0; i<numplates; ++i) {
+      if (!due[i]) {
+         continue;
+      }
+      viewbits |= 1u << i;
+      for (j=0; j<3; ++j) {
+         views[i].forward[j] = plates[i].forward[0]*right[j] + plates[i].forward[1]*up[j] + plates[i].forward[2]*forward[j];
+         views[i].right[j] = plates[i].right[0]*right[j] + plates[i].right[1]*up[j] + plates[i].right[2]*forward[j];
+         views[i].up[j] = plates[i].up[0]*right[j] + plates[i].up[1]*up[j] + plates[i].up[2]*forward[j];
+      }
+      views[i].tanx = tan(plates[i].fov/2);
+      views[i].tany = views[i].tanx * plates[i].aspect;
+   }
+   R_CullScene(views, numplates, viewbits);
+}
+
+// render a specific plate
+// (straight into the globe, by pointing the renderer's view of the vid
+//  buffer at the plate for the duration)
+static void render_plate(int plate_index, const struct _plate *plate, vec3_t forward, vec3_t right, vec3_t up) 
+{
+   viddef_t screen = vid;
+   short *zbuffer = d_pzbuffer;
+
+   fisheye_plate_target = GLOBEPIXEL(plate_index, 0, 0);
+   vid.buffer = fisheye_plate_target;
+   vid.rowbytes = globe.platesize;
+   vid.width = plate->size;
+   vid.height = plate->height;
+   d_pzbuffer = globe.zbuffer;
+
+   // clear the plate's sky where it is about to be rendered, and leave any
+   // sky to the lens if it is drawing it
+   if (globe.skymask) {
+      const vrect_t *area = fisheye_plate_scissor;
+      vrect_t whole = { 0, 0, plate->size, plate->height };
+      int y;
+      if (!area) {
+         area = &whole;
+      }
+      byte *mask = globe.skymask + GLOBEOFFSET(plate_index, 0, 0);
+      for (y=area->y; y<area->y + area->height; ++y) {
+         memset(mask + area->x + y*globe.platesize, 0, area->width);
+      }
+      fisheye_sky_mask = lens_sky.active ? mask : NULL;
+      fisheye_sky_drawn = false;
+   }
+
+   // set view to the plate
+   vrect_t rect = { 0, 0, plate->size, plate->height };
+   R_ViewChanged(&rect, 0, 1);
+
+   // set camera orientation
+   VectorCopy(forward, r_refdef.forward);
+   VectorCopy(right, r_refdef.right);
+   VectorCopy(up, r_refdef.up);
+
+   // render view
+   // (the lights and visible entities are set up once for all plates, see R_BeginScene)
+   R_RenderView();
+
+   // keep the plate's depth for the frames reprojected from it
+   if (lens_reproject.storing && globe.depth) {
+      int y;
+      for (y=0; y<plate->height; ++y) {
+         memcpy(globe.depth + GLOBEOFFSET(plate_index, 0, y), globe.zbuffer + y*plate->size, plate->size*sizeof(short));
+      }
+   }
+
+   vid = screen;
+   d_pzbuffer = zbuffer;
+   fisheye_plate_target = NULL;
+   lens_sky.plate_has_sky[plate_index] = fisheye_sky_mask && fisheye_sky_drawn;
+   fisheye_sky_mask = NULL;
+}
+
+#else
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           OPENGL RENDERERS                                   |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+#ifndef GL_TEXTURE_CUBE_MAP_ARB
+#define GL_TEXTURE_CUBE_MAP_ARB 0x8513
+#define GL_TEXTURE_CUBE_MAP_POSITIVE_X_ARB 0x8515
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+// forward, right and up of each cubemap face (+x -x +y -y +z -z), as lens rays
+// (cubemap coordinates are lens rays with y flipped, see build_gl_lens_grid)
+static const vec3_t gl_cube_faces[6][3] = {
+   { { 1, 0, 0}, { 0, 0,-1}, { 0, 1, 0} },
+   { {-1, 0, 0}, { 0, 0, 1}, { 0, 1, 0} },
+   { { 0,-1, 0}, { 1, 0, 0}, { 0, 0, 1} },
+   { { 0, 1, 0}, { 1, 0, 0}, { 0, 0,-1} },
+   { { 0, 0, 1}, { 1, 0, 0}, { 0, 1, 0} },
+   { { 0, 0,-1}, {-1, 0, 0}, { 0, 1, 0} },
+};
+
+// find the ray through a plate pixel of the lensmap on screen
+static qboolean lensmap_pixel_to_ray(unsigned pixel, vec3_t ray)
+{
+   if (pixel == LENSPIXEL_NONE) {
+      return false;
+   }
+
+   int platearea = globe.platesize * globe.platesize;
+   int plate_index = pixel / platearea;
+   int px = (pixel % platearea) % globe.platesize;
+   int py = (pixel % platearea) / globe.platesize;
+   if (plate_index >= lens_front.numplates) {
+      return false;
+   }
+
+   // (the inverse of the projection in render_lensmap_latched)
+   struct _plate *plate = &lens_front.plates[plate_index];
+   double u = ((px + 0.5) / plate->size - 0.5) / plate->dist;
+   double v = ((py + 0.5) / plate->height - 0.5) * plate->aspect / plate->dist;
+   int i;
+   for (i=0; i<3; ++i) {
+      ray[i] = plate->forward[i] + u*plate->right[i] - v*plate->up[i];
+   }
+   VectorNormalize(ray);
+   return true;
+}
+
+// lay the grid over the lens, with rays from the lensmap that has just been
+// put on screen, or (direct) from the lens' inverse function at each vertex,
+// which only takes a call per vertex instead of a lensmap build
+// (returns false if the lens function fails)
+static qboolean build_gl_lens_grid(qboolean direct)
+{
+   int cols = (lens.width_px + GL_LENSGRID - 1) / GL_LENSGRID + 1;
+   int rows = (lens.height_px + GL_LENSGRID - 1) / GL_LENSGRID + 1;
+   if (cols != gl_globe.cols || rows != gl_globe.rows) {
+      fmem_free(gl_globe.verts);
+      fmem_free(gl_globe.rays);
+      fmem_free(gl_globe.indices);
+      gl_globe.cols = cols;
+      gl_globe.rows = rows;
+      gl_globe.verts = fmem_alloc(FMEM_GL, cols*rows*2*sizeof(float));
+      gl_globe.rays = fmem_alloc(FMEM_GL, cols*rows*3*sizeof(float));
+      gl_globe.indices = fmem_alloc(FMEM_GL, (cols-1)*(rows-1)*4*sizeof(GLuint));
+      if (!gl_globe.verts || !gl_globe.rays || !gl_globe.indices) {
+         Con_Printf("Quake-Lenses: not enough memory for the lens grid\n");
+         gl_globe.cols = gl_globe.rows = 0;
+         return false;
+      }
+   }
+
+   // a ray at each vertex, sampled from the nearest lens pixel
+   static byte *valid;
+   static int valid_size;
+   if (valid_size < cols*rows) {
+      fmem_free(valid);
+      valid_size = cols*rows;
+      valid = fmem_alloc(FMEM_GL, valid_size);
+      if (!valid) {
+         Con_Printf("Quake-Lenses: not enough memory for the lens grid\n");
+         valid_size = 0;
+         return false;
+      }
+   }
+   memset(gl_globe.faces, 0, sizeof(gl_globe.faces));
+   int i, j;
+   for (j=0; j<rows; ++j) {
+      for (i=0; i<cols; ++i) {
+         int k = j*cols + i;
+         int x = MIN(i*GL_LENSGRID, lens.width_px);
+         int y = MIN(j*GL_LENSGRID, lens.height_px);
+         gl_globe.verts[k*2] = scr_vrect.x + x;
+         gl_globe.verts[k*2+1] = scr_vrect.y + y;
+
+         vec3_t ray;
+         int lx = MIN(x, lens.width_px-1);
+         int ly = MIN(y, lens.height_px-1);
+         if (direct) {
+            int status = lens_pixel_to_ray(lx, ly, ray);
+            if (status == -1) {
+               gl_globe.ready = false;
+               return false;
+            }
+            valid[k] = status == 1;
+            if (valid[k]) {
+               VectorNormalize(ray);
+            }
+         }
+         else {
+            valid[k] = lensmap_pixel_to_ray(lens_front.pixels[ly*lens.width_px + lx], ray);
+         }
+         if (!valid[k]) {
+            continue;
+         }
+         float *c = gl_globe.rays + k*3;
+         c[0] = ray[0];
+         c[1] = -ray[1];
+         c[2] = ray[2];
+
+         // (the face of the major axis)
+         int axis = fabs(c[0]) >= fabs(c[1]) && fabs(c[0]) >= fabs(c[2]) ? 0 :
+            fabs(c[1]) >= fabs(c[2]) ? 1 : 2;
+         gl_globe.faces[axis*2 + (c[axis] < 0)] = true;
+      }
+   }
+
+   // only the quads that are inside the lens, and do not straddle a seam of it
+   // (corners turned more than 90 degrees apart)
+   gl_globe.numindices = 0;
+   for (j=0; j<rows-1; ++j) {
+      for (i=0; i<cols-1; ++i) {
+         GLuint q[4] = { j*cols + i, j*cols + i+1, (j+1)*cols + i+1, (j+1)*cols + i };
+         if (!valid[q[0]] || !valid[q[1]] || !valid[q[2]] || !valid[q[3]]) {
+            continue;
+         }
+         float *c0 = gl_globe.rays + q[0]*3, *c1 = gl_globe.rays + q[1]*3;
+         float *c2 = gl_globe.rays + q[2]*3, *c3 = gl_globe.rays + q[3]*3;
+         if (DotProduct(c0, c2) <= 0 || DotProduct(c1, c3) <= 0) {
+            continue;
+         }
+         memcpy(gl_globe.indices + gl_globe.numindices, q, sizeof(q));
+         gl_globe.numindices += 4;
+      }
+   }
+
+   gl_globe.ready = true;
+   return true;
+}
+
+// render the cubemap faces the lens looks into
+static void render_globe_gl(vec3_t forward, vec3_t right, vec3_t up)
+{
+   if (!gl_cubemapable || !gl_globe.ready) {
+      return;
+   }
+
+   // (faces are rendered in the back buffer, so they must fit in the window)
+   int size = MIN(globe.platesize, MIN(glwidth, glheight));
+   if (!gl_npotable) {
+      int pot = 1;
+      while (pot*2 <= size) pot *= 2;
+      size = pot;
+   }
+
+   int i, j;
+   if (!gl_globe.texture) {
+      glGenTextures(1, &gl_globe.texture);
+   }
+   glBindTexture(GL_TEXTURE_CUBE_MAP_ARB, gl_globe.texture);
+   if (size != gl_globe.size) {
+      gl_globe.size = size;
+      for (i=0; i<6; ++i) {
+         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X_ARB + i, 0, GL_RGB, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+      }
+      glTexParameteri(GL_TEXTURE_CUBE_MAP_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_CUBE_MAP_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_CUBE_MAP_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_CUBE_MAP_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   }
+
+   float fov_x = r_refdef.fov_x;
+   float fov_y = r_refdef.fov_y;
+   r_refdef.fov_x = r_refdef.fov_y = 90;
+   fisheye_plate_fov = M_PI / 2;
+   fisheye_plate_size = size;
+
+   // the face's lens ray vectors, in the world
+   // (right = x, up = y, forward = z, as for the plates)
+   sceneview_t views[6];
+   unsigned viewbits = 0;
+   for (i=0; i<6; ++i) {
+      float *v[3] = { views[i].forward, views[i].right, views[i].up };
+      for (j=0; j<3; ++j) {
+         VectorScale(right, gl_cube_faces[i][j][0], v[j]);
+         VectorMA(v[j], gl_cube_faces[i][j][1], up, v[j]);
+         VectorMA(v[j], gl_cube_faces[i][j][2], forward, v[j]);
+      }
+      views[i].tanx = views[i].tany = 1;
+      if (gl_globe.faces[i]) {
+         viewbits |= 1u << i;
+      }
+   }
+
+   // set up and walk the world once for all the faces
+   // (see R_BeginScene and R_CullScene)
+   double start = Sys_DoubleTime();
+   R_BeginScene();
+   R_CullScene(views, 6, viewbits);
+   add_speed(SPEED_SCENE, start);
+
+   for (i=0; i<6; ++i) {
+      if (!gl_globe.faces[i]) {
+         continue;
+      }
+      VectorCopy(views[i].forward, r_refdef.forward);
+      VectorCopy(views[i].right, r_refdef.right);
+      VectorCopy(views[i].up, r_refdef.up);
+      r_viewbits = 1u << i;
+
+      start = Sys_DoubleTime();
+      R_RenderView();
+      double copied = add_speed(SPEED_PLATE0 + i, start);
+
+      glBindTexture(GL_TEXTURE_CUBE_MAP_ARB, gl_globe.texture);
+      glCopyTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X_ARB + i, 0, 0, 0, glx, gly, size, size);
+      add_speed(SPEED_COPY, copied);
+      time_benchmark_plate(start, size*size);
+   }
+
+   R_EndScene();
+   fisheye_plate_size = 0;
+   r_refdef.fov_x = fov_x;
+   r_refdef.fov_y = fov_y;
+}
+
+// draw the lens grid over the screen, textured with the globe
+static void render_lens_gl(void)
+{
+   glViewport(glx, gly, glwidth, glheight);
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glOrtho(0, vid.width, vid.height, 0, -99999, 99999);
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+
+   glDisable(GL_DEPTH_TEST);
+   glDisable(GL_CULL_FACE);
+   glDisable(GL_BLEND);
+   glDisable(GL_ALPHA_TEST);
+
+   // black behind the lens (and over what the faces left in the back buffer)
+   glDisable(GL_TEXTURE_2D);
+   glColor3f(0, 0, 0);
+   glBegin(GL_QUADS);
+   glVertex2f(scr_vrect.x, scr_vrect.y);
+   glVertex2f(scr_vrect.x + scr_vrect.width, scr_vrect.y);
+   glVertex2f(scr_vrect.x + scr_vrect.width, scr_vrect.y + scr_vrect.height);
+   glVertex2f(scr_vrect.x, scr_vrect.y + scr_vrect.height);
+   glEnd();
+   glColor3f(1, 1, 1);
+
+   if (!gl_cubemapable) {
+      static qboolean warned;
+      if (!warned) {
+         Con_Printf("fisheye needs GL_ARB_texture_cube_map in GL\n");
+         warned = true;
+      }
+   }
+   else if (gl_globe.ready && gl_globe.size > 0) {
+      glEnable(GL_TEXTURE_CUBE_MAP_ARB);
+      glBindTexture(GL_TEXTURE_CUBE_MAP_ARB, gl_globe.texture);
+      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+      glEnableClientState(GL_VERTEX_ARRAY);
+      glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+      glVertexPointer(2, GL_FLOAT, 0, gl_globe.verts);
+      glTexCoordPointer(3, GL_FLOAT, 0, gl_globe.rays);
+      glDrawElements(GL_QUADS, gl_globe.numindices, GL_UNSIGNED_INT, gl_globe.indices);
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+      glDisableClientState(GL_VERTEX_ARRAY);
+
+      glDisable(GL_TEXTURE_CUBE_MAP_ARB);
+   }
+
+   glEnable(GL_TEXTURE_2D);
+}
+
+#endif
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                              TYR-BENCH HOOKS                                 |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// the lenses timed by F_Bench, each natively (if it has a native version) and in Lua
+static const char *bench_lenses[] = { "panini", "stereographic", "equirect" };
+
+// sizes of the lens grid and the synthetic cube globe
+#define BENCH_LENS_W 640
+#define BENCH_LENS_H 480
+#define BENCH_PLATESIZE 512
+#define BENCH_GATHER_REPEATS 20
+
+// the pixel a ray lands on in six plates laid out like a cube globe
+// (+x, -x, +y, -y, +z, -z)
+static unsigned bench_cube_offset(vec3_t ray)
+{
+   double ax = fabs(ray[0]), ay = fabs(ray[1]), az = fabs(ray[2]);
+   double u, v, m;
+   int face;
+
+   if (ax >= ay && ax >= az) {
+      face = ray[0] > 0 ? 0 : 1;
+      m = ax; u = ray[2]; v = ray[1];
+   }
+   else if (ay >= az) {
+      face = ray[1] > 0 ? 2 : 3;
+      m = ay; u = ray[0]; v = ray[2];
+   }
+   else {
+      face = ray[2] > 0 ? 4 : 5;
+      m = az; u = ray[0]; v = ray[1];
+   }
+
+   int px = (int)((u / m + 1) * 0.5 * (BENCH_PLATESIZE - 1));
+   int py = (int)((v / m + 1) * 0.5 * (BENCH_PLATESIZE - 1));
+   return (face * BENCH_PLATESIZE + py) * BENCH_PLATESIZE + px;
+}
+
+// the lens coordinates of grid pixel (i,j)
+// (the lens' own bounds if it has them, otherwise a fixed square)
+static void bench_lens_coords(int i, int j, double *x, double *y)
+{
+   double w = lens.width > 0 ? lens.width : 2;
+   double h = lens.height > 0 ? lens.height : w * BENCH_LENS_H / BENCH_LENS_W;
+   *x = (i + 0.5) / BENCH_LENS_W * w - w / 2;
+   *y = h / 2 - (j + 0.5) / BENCH_LENS_H * h;
+}
+
+// a ray on a grid over the forward hemisphere
+static void bench_ray(int i, int j, vec3_t ray)
+{
+   double lon = ((i + 0.5) / BENCH_LENS_W - 0.5) * M_PI * 0.9;
+   double lat = ((j + 0.5) / BENCH_LENS_H - 0.5) * M_PI * 0.8;
+   ray[0] = cos(lat) * sin(lon);
+   ray[1] = sin(lat);
+   ray[2] = cos(lat) * cos(lon);
+}
+
+static void bench_map_calls(const char *name, const char *how,
+      void (*report)(const char *name, int ops, double seconds))
+{
+   double start, x, y;
+   vec3_t ray;
+   int i, j;
+
+   start = Sys_DoubleTime();
+   for (j=0; j<BENCH_LENS_H; ++j) {
+      for (i=0; i<BENCH_LENS_W; ++i) {
+         bench_lens_coords(i, j, &x, &y);
+         map_lens_inverse(x, y, ray);
+      }
+   }
+   report(va("lens_inverse %s (%s)", name, how), BENCH_LENS_W*BENCH_LENS_H, Sys_DoubleTime() - start);
+
+   if (!has_lens_forward()) {
+      return;
+   }
+   start = Sys_DoubleTime();
+   for (j=0; j<BENCH_LENS_H; ++j) {
+      for (i=0; i<BENCH_LENS_W; ++i) {
+         bench_ray(i, j, ray);
+         map_lens_forward(ray, &x, &y);
+      }
+   }
+   report(va("lens_forward %s (%s)", name, how), BENCH_LENS_W*BENCH_LENS_H, Sys_DoubleTime() - start);
+}
+
+// the per-pixel copy of render_lensmap, from a lensmap made with the current lens
+static void bench_gather(void (*report)(const char *name, int ops, double seconds))
+{
+   int numpixels = BENCH_LENS_W * BENCH_LENS_H;
+   int platepixels = BENCH_PLATESIZE * BENCH_PLATESIZE * 6;
+   unsigned *offsets = malloc(numpixels * sizeof(*offsets));
+   byte *pixels = malloc(platepixels + GLOBE_PADDING);
+   byte *out = malloc(BENCH_LENS_W);
+   double start, x, y;
+   vec3_t ray;
+   int i, j, k;
+
+   if (!offsets || !pixels || !out) {
+      Con_Printf("F_Bench: not enough memory for the lensmap\n");
+      goto done;
+   }
+
+   for (i=0; i<platepixels + GLOBE_PADDING; ++i) {
+      pixels[i] = i * 2654435761u >> 24;
+   }
+   for (j=0; j<BENCH_LENS_H; ++j) {
+      for (i=0; i<BENCH_LENS_W; ++i) {
+         bench_lens_coords(i, j, &x, &y);
+         offsets[j*BENCH_LENS_W + i] = map_lens_inverse(x, y, ray) == 1 ? bench_cube_offset(ray) : 0;
+      }
+   }
+
+   start = Sys_DoubleTime();
+   for (k=0; k<BENCH_GATHER_REPEATS; ++k) {
+      for (j=0; j<BENCH_LENS_H; ++j) {
+         gather_pixels(out, pixels, offsets + j*BENCH_LENS_W, BENCH_LENS_W);
+      }
+   }
+   report("render_lensmap gather", numpixels * BENCH_GATHER_REPEATS, Sys_DoubleTime() - start);
+
+done:
+   free(offsets);
+   free(pixels);
+   free(out);
+}
+
+// Times the lens mapping functions and the lensmap gather, for tyr-bench.
+// Needs F_Init to have run; the current lens is put back afterwards.
+void F_Bench(void (*report)(const char *name, int ops, double seconds))
+{
+   char current[sizeof(lens.name)];
+   qboolean gathered = false;
+   int i;
+
+   strcpy(current, lens.name);
+   for (i=0; i<sizeof(bench_lenses)/sizeof(bench_lenses[0]); ++i) {
+      strcpy(lens.name, bench_lenses[i]);
+      if (!LUA_load_lens()) {
+         Con_Printf("F_Bench: could not load lens %s\n", lens.name);
+         continue;
+      }
+      if (lens.map_type == MAP_NONE) {
+         continue;
+      }
+
+      const native_lens_t *native = lens.native;
+      if (native && native->inverse) {
+         bench_map_calls(lens.name, "native", report);
+      }
+      if (lua_refs.lens_inverse != -1) {
+         lens.native = NULL;
+         bench_map_calls(lens.name, "lua", report);
+         lens.native = native;
+      }
+      if (!gathered) {
+         bench_gather(report);
+         gathered = true;
+      }
+   }
+
+   strcpy(lens.name, current);
+   lens.valid = current[0] && LUA_load_lens();
+}
+
+// Builds the lensmap of a lens on a globe, at the zoom the lens starts with,
+// for a view of the given size, and saves it to the lens cache, for
+// tyr-lensbake.  Both the lensmap measuring the plates and the one rebuilt on
+// the plates measured are saved, as a view of that size starting on the lens
+// looks for both.  Returns how many lensmaps were saved.
+int F_BakeLensmap(const char *lensname, const char *globename, int width, int height,
+      void (*saved)(const char *filename))
+{
+   lens_bake.active = true;
+   lens_bake.count = 0;
+   lens_bake.saved = saved;
+
+   exec_command(va("f_globe %s", globename));
+   clear_zoom();
+   exec_command(va("f_lens %s", lensname));
+
+   // (a lensmap made from the rays of another one is approximate)
+   ray_field.complete = false;
+
+   lens.width_px = width;
+   lens.height_px = height;
+   int platesize = globe.quality.max_size > 0 ? globe.quality.max_size : (width < height ? width : height);
+   if (platesize > MAX_PLATESIZE) {
+      platesize = MAX_PLATESIZE;
+   }
+
+   qboolean ok;
+   do {
+      ok = step_lens_builder(platesize);
+      lens.changed = globe.changed = zoom.changed = false;
+   } while (ok && (lens_builder.working || globe.resized));
+
+   lens_bake.active = false;
+   return lens_bake.count;
+}
+
+// vim: et:ts=3:sts=3:sw=3
@@ -112,7 +112,7 @@ Scrap_Init(void)
 
 /*
  * Scrap_AllocBlock
- *   Returns a scrap and the position inside it
+ *   Returns a scrap and the position inside it, or NULL if they're full
  */
 static scrap_t *
 Scrap_AllocBlock(int w, int h, int *x, int *y)
@@ -163,7 +163,7 @@ Scrap_AllocBlock(int w, int h, int *x, int *y)
 	return scrap;
     }
 
-    Sys_Error("%s: full", __func__);
+    return NULL;
 }
 
 
@@ -205,13 +205,46 @@ GL_LoadPicTexture(const qpic8_t *pic)
     return GL_LoadTexture_Alpha("", pic, false, 255);
 }
 
+/*
+ * Load little pics into the scrap, so the HUD and menus mostly draw from the
+ * one texture.  Returns false if the pic should get its own.
+ */
+static qboolean
+GL_LoadScrapPic(glpic_t *glpic)
+{
+    const qpic8_t *pic = &glpic->pic;
+    scrap_t *scrap;
+    int x, y;
+    int i, j, src;
+
+    if (pic->width >= 64 || pic->height >= 64)
+	return false;
+    scrap = Scrap_AllocBlock(pic->width, pic->height, &x, &y);
+    if (!scrap)
+	return false;
+
+    src = 0;
+    for (i = 0; i < pic->height; i++) {
+	for (j = 0; j < pic->width; j++, src++) {
+	    const int dst = (y + i) * BLOCK_WIDTH + x + j;
+	    scrap->texels[dst] = pic->pixels[src];
+	}
+    }
+    glpic->texnum = scrap->glnum;
+    glpic->sl = (x + 0.01) / (float)BLOCK_WIDTH;
+    glpic->sh = (x + pic->width - 0.01) / (float)BLOCK_WIDTH;
+    glpic->tl = (y + 0.01) / (float)BLOCK_WIDTH;
+    glpic->th = (y + pic->height - 0.01) / (float)BLOCK_WIDTH;
+
+    return true;
+}
+
 const qpic8_t *
 Draw_PicFromWad(const char *name)
 {
     qpic8_t *pic;
     dpic8_t *dpic;
     glpic_t *glpic;
-    scrap_t *scrap;
 
     glpic = Hunk_AllocName(sizeof(*glpic), "qpic8_t");
     dpic = W_GetLumpName(&host_gfx, name);
@@ -222,27 +255,8 @@ Draw_PicFromWad(const char *name)
     pic->height = dpic->height;
     pic->pixels = dpic->data;
 
-    /* load little ones into the scrap */
-    if (pic->width < 64 && pic->height < 64) {
-	int x, y;
-	int i, j, src;
-
-	scrap = Scrap_AllocBlock(pic->width, pic->height, &x, &y);
-	src = 0;
-	for (i = 0; i < pic->height; i++) {
-	    for (j = 0; j < pic->width; j++, src++) {
-		const int dst = (y + i) * BLOCK_WIDTH + x + j;
-		scrap->texels[dst] = pic->pixels[src];
-	    }
-	}
-	glpic->texnum = scrap->glnum;
-	glpic->sl = (x + 0.01) / (float)BLOCK_WIDTH;
-	glpic->sh = (x + pic->width - 0.01) / (float)BLOCK_WIDTH;
-	glpic->tl = (y + 0.01) / (float)BLOCK_WIDTH;
-	glpic->th = (y + pic->height - 0.01) / (float)BLOCK_WIDTH;
-
+    if (GL_LoadScrapPic(glpic))
 	return pic;
-    }
 
     glpic->texnum = GL_LoadPicTexture(pic);
     glpic->sl = 0;
@@ -306,11 +320,13 @@ Draw_CachePic(const char *path)
 	memcpy(menuplyr_pixels, pic->pixels, picsize);
     }
 
-    cachepic->glpic.texnum = GL_LoadPicTexture(pic);
-    cachepic->glpic.sl = 0;
-    cachepic->glpic.sh = 1;
-    cachepic->glpic.tl = 0;
-    cachepic->glpic.th = 1;
+    if (!GL_LoadScrapPic(&cachepic->glpic)) {
+	cachepic->glpic.texnum = GL_LoadPicTexture(pic);
+	cachepic->glpic.sl = 0;
+	cachepic->glpic.sh = 1;
+	cachepic->glpic.tl = 0;
+	cachepic->glpic.th = 1;
+    }
 
     Hunk_FreeToLowMark(mark);
 
@@ -447,6 +463,67 @@ Draw_Init(void)
     draw_backtile = Draw_PicFromWad("backtile");
 }
 
+/*
+ * The textured quads of the HUD, console text and menus are collected and
+ * drawn together until the texture changes, or something draws with other
+ * state (fills, fades, translucent console).  They are all drawn opaque white
+ * through the current texture, as they were one by one.
+ */
+#define MAX_DRAW_VERTS (4 * 1024)
+
+static struct {
+    GLuint texnum;
+    int numverts;
+    float verts[MAX_DRAW_VERTS][4];	/* x, y, s, t */
+} draw_batch;
+
+void
+Draw_FlushBatch(void)
+{
+    if (!draw_batch.numverts)
+	return;
+
+    glColor4f(1, 1, 1, 1);
+    GL_Bind(draw_batch.texnum);
+    glVertexPointer(2, GL_FLOAT, sizeof(draw_batch.verts[0]),
+		    &draw_batch.verts[0][0]);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(draw_batch.verts[0]),
+		      &draw_batch.verts[0][2]);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDrawArrays(GL_QUADS, 0, draw_batch.numverts);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    draw_batch.numverts = 0;
+}
+
+static void
+Draw_BatchVert(float x, float y, float s, float t)
+{
+    float *vert = draw_batch.verts[draw_batch.numverts++];
+
+    vert[0] = x;
+    vert[1] = y;
+    vert[2] = s;
+    vert[3] = t;
+}
+
+static void
+Draw_BatchQuad(GLuint texnum, float x, float y, float w, float h,
+	       float sl, float tl, float sh, float th)
+{
+    if (texnum != draw_batch.texnum
+	|| draw_batch.numverts + 4 > MAX_DRAW_VERTS) {
+	Draw_FlushBatch();
+	draw_batch.texnum = texnum;
+    }
+    Draw_BatchVert(x, y, sl, tl);
+    Draw_BatchVert(x + w, y, sh, tl);
+    Draw_BatchVert(x + w, y + h, sh, th);
+    Draw_BatchVert(x, y + h, sl, th);
+}
+
 /*
 ================
 Draw_Character
@@ -477,17 +554,8 @@ Draw_Character(int x, int y, int num)
     fcol = col * 0.0625;
     size = 0.0625;
 
-    GL_Bind(charset_texture);
-    glBegin(GL_QUADS);
-    glTexCoord2f(fcol, frow);
-    glVertex2f(x, y);
-    glTexCoord2f(fcol + size, frow);
-    glVertex2f(x + 8, y);
-    glTexCoord2f(fcol + size, frow + size);
-    glVertex2f(x + 8, y + 8);
-    glTexCoord2f(fcol, frow + size);
-    glVertex2f(x, y + 8);
-    glEnd();
+    Draw_BatchQuad(charset_texture, x, y, 8, 8,
+		   fcol, frow, fcol + size, frow + size);
 }
 
 /*
@@ -530,6 +598,7 @@ Draw_Crosshair(void)
 	x = scr_vrect.x + scr_vrect.width / 2 - 3 + cl_crossx.value;
 	y = scr_vrect.y + scr_vrect.height / 2 - 3 + cl_crossy.value;
 
+	Draw_FlushBatch();
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 	pColor = (unsigned char *)&d_8to24table[(byte)crosshaircolor.value];
 	glColor4ubv(pColor);
@@ -568,18 +637,8 @@ Draw_Pic(int x, int y, const qpic8_t *pic)
     glpic = const_container_of(pic, glpic_t, pic);
     Scrap_Flush(glpic->texnum);
 
-    glColor4f(1, 1, 1, 1);
-    GL_Bind(glpic->texnum);
-    glBegin(GL_QUADS);
-    glTexCoord2f(glpic->sl, glpic->tl);
-    glVertex2f(x, y);
-    glTexCoord2f(glpic->sh, glpic->tl);
-    glVertex2f(x + pic->width, y);
-    glTexCoord2f(glpic->sh, glpic->th);
-    glVertex2f(x + pic->width, y + pic->height);
-    glTexCoord2f(glpic->sl, glpic->th);
-    glVertex2f(x, y + pic->height);
-    glEnd();
+    Draw_BatchQuad(glpic->texnum, x, y, pic->width, pic->height,
+		   glpic->sl, glpic->tl, glpic->sh, glpic->th);
 }
 
 void
@@ -602,18 +661,8 @@ Draw_SubPic(int x, int y, const qpic8_t *pic, int srcx, int srcy, int width,
     newtl = glpic->tl + (srcy * oldglheight) / pic->height;
     newth = newtl + (height * oldglheight) / pic->height;
 
-    glColor4f(1, 1, 1, 1);
-    GL_Bind(glpic->texnum);
-    glBegin(GL_QUADS);
-    glTexCoord2f(newsl, newtl);
-    glVertex2f(x, y);
-    glTexCoord2f(newsh, newtl);
-    glVertex2f(x + width, y);
-    glTexCoord2f(newsh, newth);
-    glVertex2f(x + width, y + height);
-    glTexCoord2f(newsl, newth);
-    glVertex2f(x, y + height);
-    glEnd();
+    Draw_BatchQuad(glpic->texnum, x, y, width, height,
+		   newsl, newtl, newsh, newth);
 }
 
 /*
@@ -652,6 +701,7 @@ Draw_TransPicTranslate(int x, int y, const qpic8_t *pic, byte *translation)
     if (pic->width > 48 || pic->height > 56)
 	return;
 
+    Draw_FlushBatch();
     GL_Bind(translate_texture);
 
     dest = trans;
@@ -700,6 +750,7 @@ Draw_ConsolePic(int lines, float offset, const qpic8_t *pic, float alpha)
     glpic = const_container_of(pic, glpic_t, pic);
     Scrap_Flush(glpic->texnum);
 
+    Draw_FlushBatch();
     glDisable(GL_ALPHA_TEST);
     glEnable(GL_BLEND);
     glCullFace(GL_FRONT);
@@ -759,6 +810,20 @@ Draw_ConsoleBackground(int lines)
 #endif
 }
 
+/*
+================
+Draw_ConsoleLine
+================
+*/
+void
+Draw_ConsoleLine(int y, const char *text, int length)
+{
+    int x;
+
+    for (x = 0; x < length; x++)
+	Draw_Character((x + 1) << 3, y, text[x]);
+}
+
 
 /*
 =============
@@ -773,18 +838,8 @@ Draw_TileClear(int x, int y, int w, int h)
 {
     const glpic_t *glpic = const_container_of(draw_backtile, glpic_t, pic);
 
-    glColor3f(1, 1, 1);
-    GL_Bind(glpic->texnum);
-    glBegin(GL_QUADS);
-    glTexCoord2f(x / 64.0, y / 64.0);
-    glVertex2f(x, y);
-    glTexCoord2f((x + w) / 64.0, y / 64.0);
-    glVertex2f(x + w, y);
-    glTexCoord2f((x + w) / 64.0, (y + h) / 64.0);
-    glVertex2f(x + w, y + h);
-    glTexCoord2f(x / 64.0, (y + h) / 64.0);
-    glVertex2f(x, y + h);
-    glEnd();
+    Draw_BatchQuad(glpic->texnum, x, y, w, h,
+		   x / 64.0, y / 64.0, (x + w) / 64.0, (y + h) / 64.0);
 }
 
 
@@ -798,6 +853,7 @@ Fills a box of pixels with a single color
 void
 Draw_Fill(int x, int y, int w, int h, int c)
 {
+    Draw_FlushBatch();
     glDisable(GL_TEXTURE_2D);
     glColor3f(host_basepal[c * 3] / 255.0,
 	      host_basepal[c * 3 + 1] / 255.0,
@@ -826,6 +882,7 @@ Draw_FadeScreen
 void
 Draw_FadeScreen(void)
 {
+    Draw_FlushBatch();
     glEnable(GL_BLEND);
     glDisable(GL_TEXTURE_2D);
     glColor4f(0, 0, 0, 0.8);
@@ -859,8 +916,10 @@ Draw_BeginDisc(void)
 {
     if (!draw_disc)
 	return;
+    Draw_FlushBatch();
     glDrawBuffer(GL_FRONT);
     Draw_Pic(vid.width - 24, 0, draw_disc);
+    Draw_FlushBatch();
     glDrawBuffer(GL_BACK);
 }
 
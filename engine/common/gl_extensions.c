@@ -27,6 +27,53 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "qtypes.h"
 
 qboolean gl_npotable;
+qboolean gl_cubemapable;
+qboolean gl_vboable;
+qboolean gl_pboable;
+qboolean gl_glslable;
+qboolean gl_fragshaderable;
+qboolean gl_occlusionable;
+qboolean gl_genmipmapable;
+GLenum gl_compressed_format;
+GLenum gl_compressed_alpha_format;
+
+lpClientActiveTextureFUNC qglClientActiveTextureARB = NULL;
+lpGenBuffersFUNC qglGenBuffersARB = NULL;
+lpBindBufferFUNC qglBindBufferARB = NULL;
+lpBufferDataFUNC qglBufferDataARB = NULL;
+lpMapBufferFUNC qglMapBufferARB = NULL;
+lpUnmapBufferFUNC qglUnmapBufferARB = NULL;
+lpBufferSubDataFUNC qglBufferSubDataARB = NULL;
+lpDeleteBuffersFUNC qglDeleteBuffersARB = NULL;
+
+lpGenQueriesFUNC qglGenQueriesARB = NULL;
+lpBeginQueryFUNC qglBeginQueryARB = NULL;
+lpEndQueryFUNC qglEndQueryARB = NULL;
+lpGetQueryObjectuivFUNC qglGetQueryObjectuivARB = NULL;
+
+lpGenerateMipmapFUNC qglGenerateMipmap = NULL;
+lpCompressedTexImage2DFUNC qglCompressedTexImage2DARB = NULL;
+lpGetCompressedTexImageFUNC qglGetCompressedTexImageARB = NULL;
+
+lpCreateShaderFUNC qglCreateShader = NULL;
+lpShaderSourceFUNC qglShaderSource = NULL;
+lpCompileShaderFUNC qglCompileShader = NULL;
+lpGetShaderivFUNC qglGetShaderiv = NULL;
+lpDeleteShaderFUNC qglDeleteShader = NULL;
+lpCreateProgramFUNC qglCreateProgram = NULL;
+lpAttachShaderFUNC qglAttachShader = NULL;
+lpBindAttribLocationFUNC qglBindAttribLocation = NULL;
+lpLinkProgramFUNC qglLinkProgram = NULL;
+lpGetProgramivFUNC qglGetProgramiv = NULL;
+lpUseProgramFUNC qglUseProgram = NULL;
+lpGetUniformLocationFUNC qglGetUniformLocation = NULL;
+lpUniform1fFUNC qglUniform1f = NULL;
+lpUniform1fvFUNC qglUniform1fv = NULL;
+lpUniform1iFUNC qglUniform1i = NULL;
+lpUniform3fFUNC qglUniform3f = NULL;
+lpVertexAttribPointerFUNC qglVertexAttribPointer = NULL;
+lpEnableVertexAttribArrayFUNC qglEnableVertexAttribArray = NULL;
+lpDisableVertexAttribArrayFUNC qglDisableVertexAttribArray = NULL;
 cvar_t gl_npot = { "gl_npot", "1", false };
 
 static qboolean
@@ -66,3 +113,184 @@ GL_ExtensionCheck_NPoT(void)
     Con_DPrintf("Non-power-of-two textures available.\n");
     gl_npotable = true;
 }
+
+void
+GL_ExtensionCheck_CubeMap(void)
+{
+    gl_cubemapable = false;
+    if (!GL_ExtensionCheck("GL_ARB_texture_cube_map"))
+	return;
+
+    Con_DPrintf("Cube map textures available.\n");
+    gl_cubemapable = true;
+}
+
+/*
+ * The world is drawn from vertex arrays, which need glClientActiveTexture to
+ * give the lightmap unit its own coordinates, and kept in a vertex buffer
+ * object when there is one.  Lightmap updates are staged through pixel
+ * buffer objects, which use the same buffer entry points, and particles are
+ * streamed through a mapped vertex buffer.  Called after the
+ * multitexture check, with the driver's GetProcAddress.
+ */
+void
+GL_ExtensionCheck_VertexBuffers(void *(*getprocaddress)(const char *))
+{
+    qglClientActiveTextureARB = NULL;
+    if (gl_mtexable)
+	qglClientActiveTextureARB = getprocaddress("glClientActiveTextureARB");
+
+    gl_vboable = false;
+    gl_pboable = false;
+    if (COM_CheckParm("-novbo"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_vertex_buffer_object"))
+	return;
+
+    qglGenBuffersARB = getprocaddress("glGenBuffersARB");
+    qglBindBufferARB = getprocaddress("glBindBufferARB");
+    qglBufferDataARB = getprocaddress("glBufferDataARB");
+    qglBufferSubDataARB = getprocaddress("glBufferSubDataARB");
+    qglDeleteBuffersARB = getprocaddress("glDeleteBuffersARB");
+    qglMapBufferARB = getprocaddress("glMapBufferARB");
+    qglUnmapBufferARB = getprocaddress("glUnmapBufferARB");
+    if (!qglGenBuffersARB || !qglBindBufferARB || !qglBufferDataARB
+	|| !qglBufferSubDataARB || !qglDeleteBuffersARB
+	|| !qglMapBufferARB || !qglUnmapBufferARB)
+	return;
+
+    Con_DPrintf("Vertex buffer objects available.\n");
+    gl_vboable = true;
+
+    if (COM_CheckParm("-nopbo"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_pixel_buffer_object"))
+	return;
+
+    Con_DPrintf("Pixel buffer objects available.\n");
+    gl_pboable = true;
+}
+
+/*
+ * Alias model poses are blended and lit by a vertex shader, from vertex
+ * buffers.  Needs the OpenGL 2.0 entry points; called after the vertex
+ * buffer check.  Fragment shaders are used for the water and sky warps.
+ */
+void
+GL_ExtensionCheck_Shaders(void *(*getprocaddress)(const char *))
+{
+    gl_glslable = false;
+    gl_fragshaderable = false;
+    if (!gl_vboable || COM_CheckParm("-noglsl"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_vertex_shader"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_shading_language_100"))
+	return;
+
+    qglCreateShader = getprocaddress("glCreateShader");
+    qglShaderSource = getprocaddress("glShaderSource");
+    qglCompileShader = getprocaddress("glCompileShader");
+    qglGetShaderiv = getprocaddress("glGetShaderiv");
+    qglDeleteShader = getprocaddress("glDeleteShader");
+    qglCreateProgram = getprocaddress("glCreateProgram");
+    qglAttachShader = getprocaddress("glAttachShader");
+    qglBindAttribLocation = getprocaddress("glBindAttribLocation");
+    qglLinkProgram = getprocaddress("glLinkProgram");
+    qglGetProgramiv = getprocaddress("glGetProgramiv");
+    qglUseProgram = getprocaddress("glUseProgram");
+    qglGetUniformLocation = getprocaddress("glGetUniformLocation");
+    qglUniform1f = getprocaddress("glUniform1f");
+    qglUniform1fv = getprocaddress("glUniform1fv");
+    qglUniform1i = getprocaddress("glUniform1i");
+    qglUniform3f = getprocaddress("glUniform3f");
+    qglVertexAttribPointer = getprocaddress("glVertexAttribPointer");
+    qglEnableVertexAttribArray = getprocaddress("glEnableVertexAttribArray");
+    qglDisableVertexAttribArray = getprocaddress("glDisableVertexAttribArray");
+    if (!qglCreateShader || !qglShaderSource || !qglCompileShader
+	|| !qglGetShaderiv || !qglDeleteShader || !qglCreateProgram
+	|| !qglAttachShader || !qglBindAttribLocation || !qglLinkProgram
+	|| !qglGetProgramiv || !qglUseProgram || !qglGetUniformLocation
+	|| !qglUniform1f || !qglUniform1fv || !qglUniform1i
+	|| !qglUniform3f || !qglVertexAttribPointer
+	|| !qglEnableVertexAttribArray || !qglDisableVertexAttribArray)
+	return;
+
+    Con_DPrintf("GLSL vertex shaders available.\n");
+    gl_glslable = true;
+
+    if (!GL_ExtensionCheck("GL_ARB_fragment_shader"))
+	return;
+
+    Con_DPrintf("GLSL fragment shaders available.\n");
+    gl_fragshaderable = true;
+}
+
+/*
+ * Each frame's world leaves are drawn as boxes inside occlusion queries so
+ * that the next frame can skip the ones that turned out to be hidden.
+ */
+void
+GL_ExtensionCheck_OcclusionQuery(void *(*getprocaddress)(const char *))
+{
+    gl_occlusionable = false;
+    if (COM_CheckParm("-noocclusion"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_occlusion_query"))
+	return;
+
+    qglGenQueriesARB = getprocaddress("glGenQueriesARB");
+    qglBeginQueryARB = getprocaddress("glBeginQueryARB");
+    qglEndQueryARB = getprocaddress("glEndQueryARB");
+    qglGetQueryObjectuivARB = getprocaddress("glGetQueryObjectuivARB");
+    if (!qglGenQueriesARB || !qglBeginQueryARB || !qglEndQueryARB
+	|| !qglGetQueryObjectuivARB)
+	return;
+
+    Con_DPrintf("Occlusion queries available.\n");
+    gl_occlusionable = true;
+}
+
+/*
+ * Mipmaps are made by the driver when it has glGenerateMipmap, rather than
+ * level by level on the CPU.  With texture compression, the best format
+ * the driver offers is used for the texture cache: BPTC, else S3TC.
+ */
+void
+GL_ExtensionCheck_Textures(void *(*getprocaddress)(const char *))
+{
+    gl_genmipmapable = false;
+    if (!COM_CheckParm("-nogenmipmap")) {
+	qglGenerateMipmap = getprocaddress("glGenerateMipmap");
+	if (!qglGenerateMipmap
+	    && GL_ExtensionCheck("GL_EXT_framebuffer_object"))
+	    qglGenerateMipmap = getprocaddress("glGenerateMipmapEXT");
+	if (qglGenerateMipmap) {
+	    Con_DPrintf("Mipmap generation available.\n");
+	    gl_genmipmapable = true;
+	}
+    }
+
+    gl_compressed_format = 0;
+    gl_compressed_alpha_format = 0;
+    if (COM_CheckParm("-nocompress"))
+	return;
+    if (!GL_ExtensionCheck("GL_ARB_texture_compression"))
+	return;
+
+    qglCompressedTexImage2DARB = getprocaddress("glCompressedTexImage2DARB");
+    qglGetCompressedTexImageARB =
+	getprocaddress("glGetCompressedTexImageARB");
+    if (!qglCompressedTexImage2DARB || !qglGetCompressedTexImageARB)
+	return;
+
+    if (GL_ExtensionCheck("GL_ARB_texture_compression_bptc")) {
+	gl_compressed_format = GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+	gl_compressed_alpha_format = GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+	Con_DPrintf("BPTC texture compression available.\n");
+    } else if (GL_ExtensionCheck("GL_EXT_texture_compression_s3tc")) {
+	gl_compressed_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	gl_compressed_alpha_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	Con_DPrintf("S3TC texture compression available.\n");
+    }
+}
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "common.h"
 #include "console.h"
+#include "crc.h"
 #include "glquake.h"
 #include "model.h"
 #include "quakedef.h"
@@ -61,7 +62,7 @@ StripLength
 ================
 */
 static int
-StripLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
+StripLength(int numtris, int starttri, int startv, const mtriangle_t *tris)
 {
     const mtriangle_t *last, *check;
     int m1, m2;
@@ -85,7 +86,7 @@ StripLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
     // look for a matching triangle
   nexttri:
     for (j = starttri + 1, check = &tris[starttri + 1];
-	 j < hdr->numtris; j++, check++) {
+	 j < numtris; j++, check++) {
 	if (check->facesfront != last->facesfront)
 	    continue;
 	for (k = 0; k < 3; k++) {
@@ -117,7 +118,7 @@ StripLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
   done:
 
     // clear the temp used flags
-    for (j = starttri + 1; j < hdr->numtris; j++)
+    for (j = starttri + 1; j < numtris; j++)
 	if (used[j] == 2)
 	    used[j] = 0;
 
@@ -130,7 +131,7 @@ FanLength
 ===========
 */
 static int
-FanLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
+FanLength(int numtris, int starttri, int startv, const mtriangle_t *tris)
 {
     const mtriangle_t *last, *check;
     int m1, m2;
@@ -154,7 +155,7 @@ FanLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
     // look for a matching triangle
   nexttri:
     for (j = starttri + 1, check = &tris[starttri + 1];
-	 j < hdr->numtris; j++, check++) {
+	 j < numtris; j++, check++) {
 	if (check->facesfront != last->facesfront)
 	    continue;
 	for (k = 0; k < 3; k++) {
@@ -183,7 +184,7 @@ FanLength(aliashdr_t *hdr, int starttri, int startv, const mtriangle_t *tris)
   done:
 
     // clear the temp used flags
-    for (j = starttri + 1; j < hdr->numtris; j++)
+    for (j = starttri + 1; j < numtris; j++)
 	if (used[j] == 2)
 	    used[j] = 0;
 
@@ -200,7 +201,8 @@ for the model, which holds for all frames
 ================
 */
 static void
-BuildTris(aliashdr_t *hdr, const mtriangle_t *tris, const stvert_t *stverts)
+BuildTris(const aliashdr_t *hdr, int numtris, const mtriangle_t *tris,
+	  const stvert_t *stverts)
 {
     int i, j, k;
     int startv;
@@ -216,7 +218,7 @@ BuildTris(aliashdr_t *hdr, const mtriangle_t *tris, const stvert_t *stverts)
     numorder = 0;
     numcommands = 0;
     memset(used, 0, sizeof(used));
-    for (i = 0; i < hdr->numtris; i++) {
+    for (i = 0; i < numtris; i++) {
 	// pick an unused triangle and start the trifan
 	if (used[i])
 	    continue;
@@ -226,9 +228,9 @@ BuildTris(aliashdr_t *hdr, const mtriangle_t *tris, const stvert_t *stverts)
 	for (type = 0; type < 2; type++) {
 	    for (startv = 0; startv < 3; startv++) {
 		if (type == 1)
-		    len = StripLength(hdr, i, startv, tris);
+		    len = StripLength(numtris, i, startv, tris);
 		else
-		    len = FanLength(hdr, i, startv, tris);
+		    len = FanLength(numtris, i, startv, tris);
 		if (len > bestlen) {
 		    besttype = type;
 		    bestlen = len;
@@ -269,15 +271,253 @@ BuildTris(aliashdr_t *hdr, const mtriangle_t *tris, const stvert_t *stverts)
 
     commands[numcommands++].i = 0;	// end of list marker
 
-    Con_DPrintf("%3i tri %3i vert %3i cmd\n", hdr->numtris, numorder,
+    Con_DPrintf("%3i tri %3i vert %3i cmd\n", numtris, numorder,
 		numcommands);
 
     allverts += numorder;
-    alltris += hdr->numtris;
+    alltris += numtris;
 }
 
+/*
+ * The strips and fans are also turned into one indexed triangle list, for
+ * drawing from buffer objects.  The command list repeats a vertex in every
+ * strip it's in, so those copies are welded back together (same vertex, same
+ * s/t) and each triangle indexes the welded verts.  Each triangle keeps the
+ * winding and last vertex of the strip or fan it came from, so flat shading
+ * looks the same.
+ */
+static unsigned short meshindices[8192 * 3];
+static int numindices;
+static int weldorder[8192];	/* welded vert -> command list vert */
+static int numwelded;
+
 static void
-GL_MeshSwapCommands(void)
+BuildTriangleList(void)
+{
+    static int weldchain[8192], weldfirst[MAXALIASVERTS], stoffset[8192];
+    static unsigned short welded[8192];
+    const int *order;
+    const float *st, *check;
+    unsigned short *index;
+    int i, j, count, vertnum;
+
+    /* weld the command list verts */
+    for (i = 0; i < MAXALIASVERTS; i++)
+	weldfirst[i] = -1;
+    numwelded = 0;
+    order = &commands[0].i;
+    vertnum = 0;
+    while ((count = *order++)) {
+	if (count < 0)
+	    count = -count;
+	for (i = 0; i < count; i++, vertnum++, order += 2) {
+	    st = (const float *)order;
+	    stoffset[vertnum] = order - &commands[0].i;
+	    for (j = weldfirst[vertexorder[vertnum]]; j >= 0; j = weldchain[j]) {
+		check = &commands[stoffset[weldorder[j]]].f;
+		if (check[0] == st[0] && check[1] == st[1])
+		    break;
+	    }
+	    if (j < 0) {
+		j = numwelded++;
+		weldorder[j] = vertnum;
+		weldchain[j] = weldfirst[vertexorder[vertnum]];
+		weldfirst[vertexorder[vertnum]] = j;
+	    }
+	    welded[vertnum] = j;
+	}
+    }
+
+    index = meshindices;
+    order = &commands[0].i;
+    vertnum = 0;
+    while ((count = *order++)) {
+	const qboolean fan = count < 0;
+	if (fan)
+	    count = -count;
+	for (i = 2; i < count; i++) {
+	    if (fan) {
+		*index++ = welded[vertnum];
+		*index++ = welded[vertnum + i - 1];
+	    } else if (i & 1) {
+		*index++ = welded[vertnum + i - 1];
+		*index++ = welded[vertnum + i - 2];
+	    } else {
+		*index++ = welded[vertnum + i - 2];
+		*index++ = welded[vertnum + i - 1];
+	    }
+	    *index++ = welded[vertnum + i];
+	}
+	order += count * 2;
+	vertnum += count;
+    }
+    numindices = index - meshindices;
+}
+
+/*
+ * Reorder the triangle list for the post-transform vertex cache, after Tom
+ * Forsyth's "Linear-Speed Vertex Cache Optimisation".  Vertices score higher
+ * the more recently they were used and the fewer triangles they have left;
+ * the best scoring triangle using a vertex in the (modelled LRU) cache goes
+ * next.  Only the triangle order changes, never the vertices within one.
+ * The verts are then numbered in the order they are first used.
+ */
+#define VCACHE_SIZE 32
+
+typedef struct {
+    int firsttri;	/* into vertextris */
+    int numtris;	/* not yet emitted */
+    int cachepos;	/* -1 if not in the cache */
+    float score;
+} meshvert_t;
+
+static meshvert_t meshverts[8192];
+static int vertextris[8192 * 3];
+static float triscores[8192];
+static unsigned short sourceindices[8192 * 3];
+
+static float
+VertexScore(const meshvert_t *vert)
+{
+    float score;
+
+    if (!vert->numtris)
+	return -1.0f;
+
+    score = 0.0f;
+    if (vert->cachepos >= 0) {
+	if (vert->cachepos < 3) {
+	    /* the last triangle's verts; don't favour using them again */
+	    score = 0.75f;
+	} else {
+	    score = 1.0f - (vert->cachepos - 3) * (1.0f / (VCACHE_SIZE - 3));
+	    score = powf(score, 1.5f);
+	}
+    }
+
+    /* go for vertices with few triangles left, to clear them out */
+    return score + 2.0f / sqrtf(vert->numtris);
+}
+
+static void
+OptimizeTriangleList(void)
+{
+    const int numtris = numindices / 3;
+    static int renumber[8192], neworder[8192];
+    int cache[VCACHE_SIZE + 3], newcache[VCACHE_SIZE + 3];
+    int i, j, k, tri, best, emitted, cachesize, newsize;
+    unsigned short *out, *in;
+    meshvert_t *vert;
+    float bestscore;
+
+    if (numtris < 2)
+	return;
+
+    memcpy(sourceindices, meshindices, numindices * sizeof(meshindices[0]));
+    memset(meshverts, 0, numwelded * sizeof(meshverts[0]));
+    for (i = 0; i < numindices; i++)
+	meshverts[sourceindices[i]].numtris++;
+    for (i = 0, k = 0; i < numwelded; i++) {
+	meshverts[i].firsttri = k;
+	k += meshverts[i].numtris;
+	meshverts[i].numtris = 0;
+	meshverts[i].cachepos = -1;
+    }
+    for (i = 0; i < numindices; i++) {
+	vert = &meshverts[sourceindices[i]];
+	vertextris[vert->firsttri + vert->numtris++] = i / 3;
+    }
+    for (i = 0; i < numwelded; i++)
+	meshverts[i].score = VertexScore(&meshverts[i]);
+    for (i = 0; i < numtris; i++) {
+	in = &sourceindices[i * 3];
+	triscores[i] = meshverts[in[0]].score + meshverts[in[1]].score
+	    + meshverts[in[2]].score;
+    }
+
+    out = meshindices;
+    cachesize = 0;
+    best = -1;
+    for (emitted = 0; emitted < numtris; emitted++) {
+	if (best < 0) {
+	    /* nothing in the cache has triangles left; start afresh */
+	    bestscore = -1.0f;
+	    for (i = 0; i < numtris; i++) {
+		if (triscores[i] > bestscore) {
+		    bestscore = triscores[i];
+		    best = i;
+		}
+	    }
+	}
+
+	/* emit it and drop it from its vertices' lists */
+	in = &sourceindices[best * 3];
+	for (i = 0; i < 3; i++) {
+	    *out++ = in[i];
+	    vert = &meshverts[in[i]];
+	    for (j = 0; j < vert->numtris; j++) {
+		if (vertextris[vert->firsttri + j] == best) {
+		    vertextris[vert->firsttri + j] =
+			vertextris[vert->firsttri + vert->numtris - 1];
+		    break;
+		}
+	    }
+	    vert->numtris--;
+	}
+	triscores[best] = -1.0f;
+
+	/* its vertices go to the front of the cache */
+	newsize = 0;
+	for (i = 0; i < 3; i++)
+	    newcache[newsize++] = in[i];
+	for (i = 0; i < cachesize; i++) {
+	    if (cache[i] != in[0] && cache[i] != in[1] && cache[i] != in[2])
+		newcache[newsize++] = cache[i];
+	}
+	for (i = 0; i < newsize; i++) {
+	    vert = &meshverts[newcache[i]];
+	    vert->cachepos = (i < VCACHE_SIZE) ? i : -1;
+	    vert->score = VertexScore(vert);
+	}
+
+	/* rescore the triangles touched and pick the next one from them */
+	best = -1;
+	bestscore = -1.0f;
+	for (i = 0; i < newsize; i++) {
+	    vert = &meshverts[newcache[i]];
+	    for (j = 0; j < vert->numtris; j++) {
+		tri = vertextris[vert->firsttri + j];
+		in = &sourceindices[tri * 3];
+		triscores[tri] = meshverts[in[0]].score
+		    + meshverts[in[1]].score + meshverts[in[2]].score;
+		if (triscores[tri] > bestscore) {
+		    bestscore = triscores[tri];
+		    best = tri;
+		}
+	    }
+	}
+
+	cachesize = qmin(newsize, VCACHE_SIZE);
+	memcpy(cache, newcache, cachesize * sizeof(cache[0]));
+    }
+
+    /* renumber the verts in the order they are first used */
+    for (i = 0; i < numwelded; i++)
+	renumber[i] = -1;
+    k = 0;
+    for (i = 0; i < numindices; i++) {
+	if (renumber[meshindices[i]] < 0) {
+	    renumber[meshindices[i]] = k;
+	    neworder[k++] = weldorder[meshindices[i]];
+	}
+	meshindices[i] = renumber[meshindices[i]];
+    }
+    numwelded = k;
+    memcpy(weldorder, neworder, numwelded * sizeof(weldorder[0]));
+}
+
+static void
+GL_MeshSwapCommandList(void)
 {
     int i;
 
@@ -287,12 +527,24 @@ GL_MeshSwapCommands(void)
 	vertexorder[i] = LittleLong(vertexorder[i]);
 }
 
+static void
+GL_MeshSwapCommands(void)
+{
+    int i;
+
+    GL_MeshSwapCommandList();
+    for (i = 0; i < numwelded; i++)
+	weldorder[i] = LittleLong(weldorder[i]);
+    for (i = 0; i < numindices; i++)
+	meshindices[i] = LittleShort(meshindices[i]);
+}
+
 /*
  * Do minimal checks on any cached data loaded to at least ensure we
  * don't crash when trying to render the model.
  */
 static qboolean
-GL_MeshVerifyCommands(const aliashdr_t *hdr, const model_t *model)
+GL_MeshVerifyCommandList(const aliashdr_t *hdr)
 {
     int i, length, verts;
 
@@ -319,6 +571,528 @@ GL_MeshVerifyCommands(const aliashdr_t *hdr, const model_t *model)
     return true;
 }
 
+static qboolean
+GL_MeshVerifyCommands(const aliashdr_t *hdr, const model_t *model)
+{
+    int i;
+
+    if (!GL_MeshVerifyCommandList(hdr))
+	return false;
+    if (numwelded < 0 || numwelded > numorder)
+	return false;
+    if (numindices < 0 || numindices > numorder * 3 || numindices % 3)
+	return false;
+
+    for (i = 0; i < numwelded; i++)
+	if (weldorder[i] < 0 || weldorder[i] >= numorder)
+	    return false;
+    for (i = 0; i < numindices; i++)
+	if (meshindices[i] >= numwelded)
+	    return false;
+
+    return true;
+}
+
+/*
+ * The cache files are only good for the mesh they were built from, so they
+ * carry a CRC of everything BuildTris looks at.
+ */
+#define MESH_CACHE_ID (('1' << 24) + ('H' << 16) + ('S' << 8) + 'M')
+
+typedef struct {
+    int ident;
+    int crc;
+    int numcommands;
+    int numorder;
+    int numwelded;
+    int numindices;
+} meshcache_t;
+
+static void
+CRC_ProcessInt(unsigned short *crc, int value)
+{
+    CRC_ProcessByte(crc, value & 0xff);
+    CRC_ProcessByte(crc, (value >> 8) & 0xff);
+    CRC_ProcessByte(crc, (value >> 16) & 0xff);
+    CRC_ProcessByte(crc, (value >> 24) & 0xff);
+}
+
+static int
+GL_MeshCRC(const aliashdr_t *hdr, const alias_meshdata_t *meshdata)
+{
+    const mtriangle_t *triangle;
+    const stvert_t *stvert;
+    unsigned short crc;
+    int i;
+
+    CRC_Init(&crc);
+    CRC_ProcessInt(&crc, hdr->numverts);
+    CRC_ProcessInt(&crc, hdr->numtris);
+    CRC_ProcessInt(&crc, hdr->skinwidth);
+    CRC_ProcessInt(&crc, hdr->skinheight);
+    stvert = meshdata->stverts;
+    for (i = 0; i < hdr->numverts; i++, stvert++) {
+	CRC_ProcessInt(&crc, stvert->onseam);
+	CRC_ProcessInt(&crc, stvert->s);
+	CRC_ProcessInt(&crc, stvert->t);
+    }
+    triangle = meshdata->triangles;
+    for (i = 0; i < hdr->numtris; i++, triangle++) {
+	CRC_ProcessInt(&crc, triangle->facesfront);
+	CRC_ProcessInt(&crc, triangle->vertindex[0]);
+	CRC_ProcessInt(&crc, triangle->vertindex[1]);
+	CRC_ProcessInt(&crc, triangle->vertindex[2]);
+    }
+
+    return CRC_Value(crc);
+}
+
+static qboolean
+GL_MeshReadCache(FILE *f, const aliashdr_t *hdr, const model_t *model,
+		 int crc)
+{
+    meshcache_t header;
+
+    if (fread(&header, sizeof(header), 1, f) != 1)
+	return false;
+    if (LittleLong(header.ident) != MESH_CACHE_ID)
+	return false;
+    if (LittleLong(header.crc) != crc)
+	return false;
+
+    numcommands = LittleLong(header.numcommands);
+    numorder = LittleLong(header.numorder);
+    numwelded = LittleLong(header.numwelded);
+    numindices = LittleLong(header.numindices);
+    if (numcommands < 0 || numcommands > 8192)
+	return false;
+    if (numorder < 0 || numorder > 8192)
+	return false;
+    if (numwelded < 0 || numwelded > 8192)
+	return false;
+    if (numindices < 0 || numindices > 8192 * 3)
+	return false;
+
+    if (fread(&commands, sizeof(commands[0]), numcommands, f) != numcommands)
+	return false;
+    if (fread(&vertexorder, sizeof(vertexorder[0]), numorder, f) != numorder)
+	return false;
+    if (fread(&weldorder, sizeof(weldorder[0]), numwelded, f) != numwelded)
+	return false;
+    if (fread(&meshindices, sizeof(meshindices[0]), numindices, f)
+	!= numindices)
+	return false;
+    GL_MeshSwapCommands();
+
+    return GL_MeshVerifyCommands(hdr, model);
+}
+
+static void
+GL_MeshWriteCache(FILE *f, int crc)
+{
+    meshcache_t header;
+
+    header.ident = LittleLong(MESH_CACHE_ID);
+    header.crc = LittleLong(crc);
+    header.numcommands = LittleLong(numcommands);
+    header.numorder = LittleLong(numorder);
+    header.numwelded = LittleLong(numwelded);
+    header.numindices = LittleLong(numindices);
+    fwrite(&header, sizeof(header), 1, f);
+
+    GL_MeshSwapCommands();
+    fwrite(&commands, sizeof(commands[0]), numcommands, f);
+    fwrite(&vertexorder, sizeof(vertexorder[0]), numorder, f);
+    fwrite(&weldorder, sizeof(weldorder[0]), numwelded, f);
+    fwrite(&meshindices, sizeof(meshindices[0]), numindices, f);
+    GL_MeshSwapCommands();
+}
+
+/*
+ * The simplified meshes (see Mod_AliasSimplify) get their own strips and
+ * fans, cached in a file of their own beside the mesh cache.  For the
+ * buffers, their triangles index the welded verts of the full mesh, whose
+ * poses already hold every vertex they use, after the full mesh's indices.
+ */
+#define LOD_CACHE_ID (('1' << 24) + ('D' << 16) + ('O' << 8) + 'L')
+
+typedef struct {
+    int ident;
+    int crc;
+    int numlods;
+} lodcache_t;
+
+typedef struct {
+    int numtris;
+    int numcommands;
+    int numorder;
+} lodcachelevel_t;
+
+static unsigned short lodindices[8192 * 3];
+static int numlodindices;
+static int weldfront[MAXALIASVERTS], weldback[MAXALIASVERTS];
+
+/* Which welded vert has each vertex, front and back side of the skin */
+static void
+GL_MeshWeldSides(const aliashdr_t *hdr, const stvert_t *stverts)
+{
+    static int stoffset[8192];
+    const int *order;
+    const float *st;
+    int i, k, count, vertnum;
+    float s;
+
+    order = &commands[0].i;
+    vertnum = 0;
+    while ((count = *order++)) {
+	if (count < 0)
+	    count = -count;
+	for (; count; count--, order += 2)
+	    stoffset[vertnum++] = order - &commands[0].i;
+    }
+
+    for (i = 0; i < hdr->numverts; i++)
+	weldfront[i] = weldback[i] = -1;
+    for (i = 0; i < numwelded; i++) {
+	k = vertexorder[weldorder[i]];
+	st = &commands[stoffset[weldorder[i]]].f;
+	s = stverts[k].s;
+	s = (s + 0.5) / hdr->skinwidth;
+	if (!stverts[k].onseam)
+	    weldfront[k] = weldback[k] = i;
+	else if (st[0] == s)
+	    weldfront[k] = i;
+	else
+	    weldback[k] = i;
+    }
+}
+
+static void
+GL_MeshLodIndices(gl_aliasmesh_t *mesh, const mtriangle_t *tris, int numtris,
+		  const stvert_t *stverts)
+{
+    unsigned short *index;
+    int i, j, k, welded;
+
+    mesh->firstindex = numindices + numlodindices;
+    mesh->numindices = 0;
+    if (numlodindices + numtris * 3 > (int)ARRAY_SIZE(lodindices))
+	return;
+
+    index = lodindices + numlodindices;
+    for (i = 0; i < numtris; i++) {
+	for (j = 0; j < 3; j++) {
+	    k = tris[i].vertindex[j];
+	    welded = (tris[i].facesfront || !stverts[k].onseam)
+		? weldfront[k] : weldback[k];
+	    if (welded < 0)
+		return;		/* a side of the seam the full mesh lacks */
+	    *index++ = welded;
+	}
+    }
+    mesh->numindices = numtris * 3;
+    numlodindices += mesh->numindices;
+}
+
+/* Put the command list and its poses in the model */
+static void
+GL_StoreMesh(aliashdr_t *hdr, gl_aliasmesh_t *mesh, int numtris,
+	     const alias_posedata_t *posedata)
+{
+    trivertx_t *verts;
+    int *cmds;
+    int i, j;
+
+    mesh->numtris = numtris;
+    mesh->numverts = numorder;
+
+    cmds = Hunk_Alloc(numcommands * 4);
+    mesh->commands = (byte *)cmds - (byte *)hdr;
+    memcpy(cmds, commands, numcommands * 4);
+
+    verts = Hunk_Alloc(hdr->numposes * numorder * sizeof(trivertx_t));
+    mesh->posedata = (byte *)verts - (byte *)hdr;
+    for (i = 0; i < hdr->numposes; i++)
+	for (j = 0; j < numorder; j++)
+	    *verts++ = posedata->verts[i][vertexorder[j]];
+}
+
+static int
+GL_LodCRC(const aliashdr_t *hdr, const alias_meshdata_t *meshdata,
+	  const alias_posedata_t *posedata)
+{
+    const trivertx_t *vert;
+    unsigned short crc;
+    int i, j;
+
+    /* the edges are measured in the poses, so they count too */
+    CRC_Init(&crc);
+    CRC_ProcessInt(&crc, GL_MeshCRC(hdr, meshdata));
+    CRC_ProcessInt(&crc, posedata->numposes);
+    for (i = 0; i < posedata->numposes; i++) {
+	vert = posedata->verts[i];
+	for (j = 0; j < hdr->numverts; j++, vert++) {
+	    CRC_ProcessByte(&crc, vert->v[0]);
+	    CRC_ProcessByte(&crc, vert->v[1]);
+	    CRC_ProcessByte(&crc, vert->v[2]);
+	}
+    }
+
+    return CRC_Value(crc);
+}
+
+static void
+GL_LodSwapTriangles(mtriangle_t *tris, int numtris)
+{
+    int i;
+
+    for (i = 0; i < numtris; i++) {
+	tris[i].facesfront = LittleLong(tris[i].facesfront);
+	tris[i].vertindex[0] = LittleLong(tris[i].vertindex[0]);
+	tris[i].vertindex[1] = LittleLong(tris[i].vertindex[1]);
+	tris[i].vertindex[2] = LittleLong(tris[i].vertindex[2]);
+    }
+}
+
+static qboolean
+GL_LodReadCache(FILE *f, aliashdr_t *hdr, alias_meshdata_t *meshdata,
+		const alias_posedata_t *posedata, int crc)
+{
+    gl_aliashdr_t *glhdr = GL_Aliashdr(hdr);
+    lodcache_t header;
+    lodcachelevel_t level;
+    mtriangle_t *tris;
+    int i, j, k, numtris, total;
+
+    if (fread(&header, sizeof(header), 1, f) != 1)
+	return false;
+    if (LittleLong(header.ident) != LOD_CACHE_ID)
+	return false;
+    if (LittleLong(header.crc) != crc)
+	return false;
+    meshdata->numlods = LittleLong(header.numlods);
+    if (meshdata->numlods < 0 || meshdata->numlods > MAXALIASLODS)
+	return false;
+
+    tris = meshdata->lodtriangles[0];
+    total = 0;
+    for (i = 0; i < meshdata->numlods; i++) {
+	if (fread(&level, sizeof(level), 1, f) != 1)
+	    return false;
+	numtris = LittleLong(level.numtris);
+	numcommands = LittleLong(level.numcommands);
+	numorder = LittleLong(level.numorder);
+	if (numtris <= 0 || total + numtris > hdr->numtris * 2)
+	    return false;
+	if (numcommands < 0 || numcommands > 8192)
+	    return false;
+	if (numorder < 0 || numorder > 8192)
+	    return false;
+
+	if (fread(tris, sizeof(*tris), numtris, f) != numtris)
+	    return false;
+	if (fread(&commands, sizeof(commands[0]), numcommands, f)
+	    != numcommands)
+	    return false;
+	if (fread(&vertexorder, sizeof(vertexorder[0]), numorder, f)
+	    != numorder)
+	    return false;
+	GL_LodSwapTriangles(tris, numtris);
+	GL_MeshSwapCommandList();
+	if (!GL_MeshVerifyCommandList(hdr))
+	    return false;
+	for (j = 0; j < numtris; j++)
+	    for (k = 0; k < 3; k++)
+		if (tris[j].vertindex[k] < 0
+		    || tris[j].vertindex[k] >= hdr->numverts)
+		    return false;
+
+	meshdata->lodtriangles[i] = tris;
+	meshdata->lodnumtris[i] = numtris;
+	GL_StoreMesh(hdr, &glhdr->meshes[i + 1], numtris, posedata);
+	GL_MeshLodIndices(&glhdr->meshes[i + 1], tris, numtris,
+			  meshdata->stverts);
+	tris += numtris;
+	total += numtris;
+    }
+
+    return true;
+}
+
+static void
+GL_LodWriteLevel(FILE *f, mtriangle_t *tris, int numtris)
+{
+    lodcachelevel_t level;
+
+    level.numtris = LittleLong(numtris);
+    level.numcommands = LittleLong(numcommands);
+    level.numorder = LittleLong(numorder);
+    fwrite(&level, sizeof(level), 1, f);
+
+    GL_LodSwapTriangles(tris, numtris);
+    fwrite(tris, sizeof(*tris), numtris, f);
+    GL_LodSwapTriangles(tris, numtris);
+
+    GL_MeshSwapCommandList();
+    fwrite(&commands, sizeof(commands[0]), numcommands, f);
+    fwrite(&vertexorder, sizeof(vertexorder[0]), numorder, f);
+    GL_MeshSwapCommandList();
+}
+
+static FILE *
+GL_MeshCreateCache(const char *path)
+{
+    char gldir[MAX_OSPATH];
+    FILE *f;
+
+    f = fopen(path, "wb");
+    if (!f) {
+	/* Maybe the directory wasn't present, try again */
+	snprintf(gldir, sizeof(gldir), "%s/glquake", com_gamedir);
+	Sys_mkdir(gldir);
+	f = fopen(path, "wb");
+    }
+
+    return f;
+}
+
+/*
+ * Called with the full mesh's commands and welded verts still to hand, but
+ * before the model's vertex count is changed to the command list's.
+ */
+static void
+GL_LoadMeshLods(const model_t *model, aliashdr_t *hdr,
+		alias_meshdata_t *meshdata, const alias_posedata_t *posedata)
+{
+    gl_aliashdr_t *glhdr = GL_Aliashdr(hdr);
+    char cache[MAX_OSPATH];
+    lodcache_t header;
+    qboolean cached = false;
+    int i, err, crc, lowmark;
+    FILE *f;
+
+    GL_MeshWeldSides(hdr, meshdata->stverts);
+    numlodindices = 0;
+
+    err = snprintf(cache, sizeof(cache), "%s/glquake/%s", com_gamedir,
+		   COM_SkipPath(model->name)) >= sizeof(cache);
+    if (!err)
+	err = COM_DefaultExtension(cache, ".lod", cache, sizeof(cache));
+    if (err)
+	Sys_Error("%s: model pathname too long (%s)", __func__, model->name);
+
+    crc = GL_LodCRC(hdr, meshdata, posedata);
+    lowmark = Hunk_LowMark();
+    f = fopen(cache, "rb");
+    if (f) {
+	cached = GL_LodReadCache(f, hdr, meshdata, posedata, crc);
+	fclose(f);
+	if (!cached) {
+	    Con_DPrintf("stale cached lods for mesh %s\n", model->name);
+	    Hunk_FreeToLowMark(lowmark);
+	    numlodindices = 0;
+	}
+    }
+
+    if (!cached) {
+	Mod_AliasSimplify(hdr, meshdata, posedata);
+
+	f = GL_MeshCreateCache(cache);
+	if (f) {
+	    header.ident = LittleLong(LOD_CACHE_ID);
+	    header.crc = LittleLong(crc);
+	    header.numlods = LittleLong(meshdata->numlods);
+	    fwrite(&header, sizeof(header), 1, f);
+	}
+	for (i = 0; i < meshdata->numlods; i++) {
+	    BuildTris(hdr, meshdata->lodnumtris[i], meshdata->lodtriangles[i],
+		      meshdata->stverts);
+	    GL_StoreMesh(hdr, &glhdr->meshes[i + 1], meshdata->lodnumtris[i],
+			 posedata);
+	    GL_MeshLodIndices(&glhdr->meshes[i + 1], meshdata->lodtriangles[i],
+			      meshdata->lodnumtris[i], meshdata->stverts);
+	    if (f)
+		GL_LodWriteLevel(f, meshdata->lodtriangles[i],
+				 meshdata->lodnumtris[i]);
+	}
+	if (f)
+	    fclose(f);
+    }
+
+    hdr->numlods = meshdata->numlods;
+}
+
+/*
+ * With vertex shaders the welded verts of each pose go into a vertex buffer,
+ * followed by their s/t, and the triangle lists go into an index buffer.
+ * The buffers belong to the cached model and go with it.
+ */
+static void
+GL_BuildMeshBuffers(aliashdr_t *hdr)
+{
+    static float texcoords[8192 * 2];
+    static int stoffset[8192];
+    static trivertx_t pose[8192];
+    gl_aliashdr_t *glhdr = GL_Aliashdr(hdr);
+    const trivertx_t *verts;
+    const int *cmds, *order;
+    const float *st;
+    int i, j, count, vertnum, posesize;
+
+    glhdr->buffers[0] = glhdr->buffers[1] = 0;
+    glhdr->numbufferverts = 0;
+    for (i = 0; i <= hdr->numlods; i++)
+	glhdr->meshes[i].numindices = 0;
+    if (!gl_glslable)
+	return;
+
+    cmds = (const int *)((byte *)hdr + glhdr->meshes[0].commands);
+    order = cmds;
+    vertnum = 0;
+    while ((count = *order++)) {
+	if (count < 0)
+	    count = -count;
+	for (; count; count--, order += 2)
+	    stoffset[vertnum++] = order - cmds;
+    }
+    for (i = 0; i < numwelded; i++) {
+	st = (const float *)cmds + stoffset[weldorder[i]];
+	texcoords[i * 2] = st[0];
+	texcoords[i * 2 + 1] = st[1];
+    }
+
+    posesize = numwelded * sizeof(trivertx_t);
+    qglGenBuffersARB(2, glhdr->buffers);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, glhdr->buffers[0]);
+    qglBufferDataARB(GL_ARRAY_BUFFER_ARB,
+		     hdr->numposes * posesize + numwelded * 2 * sizeof(float),
+		     NULL, GL_STATIC_DRAW_ARB);
+    verts = (const trivertx_t *)((byte *)hdr + hdr->posedata);
+    for (i = 0; i < hdr->numposes; i++, verts += hdr->numverts) {
+	for (j = 0; j < numwelded; j++)
+	    pose[j] = verts[weldorder[j]];
+	qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, i * posesize, posesize, pose);
+    }
+    qglBufferSubDataARB(GL_ARRAY_BUFFER_ARB, hdr->numposes * posesize,
+			numwelded * 2 * sizeof(float), texcoords);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+    qglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, glhdr->buffers[1]);
+    qglBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB,
+		     (numindices + numlodindices) * sizeof(unsigned short),
+		     NULL, GL_STATIC_DRAW_ARB);
+    qglBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0,
+			numindices * sizeof(unsigned short), meshindices);
+    qglBufferSubDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB,
+			numindices * sizeof(unsigned short),
+			numlodindices * sizeof(unsigned short), lodindices);
+    qglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+
+    glhdr->meshes[0].firstindex = 0;
+    glhdr->meshes[0].numindices = numindices;
+    glhdr->numbufferverts = numwelded;
+}
+
 /*
 ================
 GL_MakeAliasModelDisplayLists
@@ -326,12 +1100,11 @@ GL_MakeAliasModelDisplayLists
 */
 void
 GL_LoadMeshData(const model_t *model, aliashdr_t *hdr,
-		const alias_meshdata_t *meshdata,
+		alias_meshdata_t *meshdata,
 		const alias_posedata_t *posedata)
 {
-    int i, j, tmp, err;
-    int *cmds;
-    trivertx_t *verts;
+    gl_aliashdr_t *glhdr = GL_Aliashdr(hdr);
+    int err, crc;
     char cache[MAX_OSPATH];
     FILE *f;
     qboolean cached = false;
@@ -340,71 +1113,52 @@ GL_LoadMeshData(const model_t *model, aliashdr_t *hdr,
     /* look for a cached version */
     name = COM_SkipPath(model->name);
     snprintf(cache, sizeof(cache), "%s/glquake/%s", com_gamedir, name);
-    err = COM_DefaultExtension(cache, ".ms2", cache, sizeof(cache));
+    err = COM_DefaultExtension(cache, ".ms3", cache, sizeof(cache));
     if (err)
 	Sys_Error("%s: model pathname too long (%s)", __func__, model->name);
 
+    crc = GL_MeshCRC(hdr, meshdata);
     f = fopen(cache, "rb");
     if (f) {
-	cached = true;
-	fread(&numcommands, 4, 1, f);
-	fread(&numorder, 4, 1, f);
-	numcommands = LittleLong(numcommands);
-	numorder = LittleLong(numorder);
-	if (numcommands < 0 || numcommands > 8192)
-	    cached = false;
-	if (numorder < 0 || numorder > 8192)
-	    cached = false;
-	if (cached) {
-	    fread(&commands, numcommands * sizeof(commands[0]), 1, f);
-	    fread(&vertexorder, numorder * sizeof(vertexorder[0]), 1, f);
-	    GL_MeshSwapCommands();
-	    cached = GL_MeshVerifyCommands(hdr, model);
-	}
+	cached = GL_MeshReadCache(f, hdr, model, crc);
 	fclose(f);
 	if (!cached)
-	    Con_DPrintf("bad cached commands for mesh %s\n", model->name);
+	    Con_DPrintf("stale cached commands for mesh %s\n", model->name);
     }
 
     if (!cached) {
 	/* build it from scratch */
 	Con_DPrintf("meshing %s...\n", model->name);
-	BuildTris(hdr, meshdata->triangles, meshdata->stverts);
+	BuildTris(hdr, hdr->numtris, meshdata->triangles, meshdata->stverts);
+	BuildTriangleList();
+	OptimizeTriangleList();
 
 	/* save out the cached version */
-	f = fopen(cache, "wb");
-	if (!f) {
-	    char gldir[MAX_OSPATH];
-
-	    /* Maybe the directory wasn't present, try again */
-	    snprintf(gldir, sizeof(gldir), "%s/glquake", com_gamedir);
-	    Sys_mkdir(gldir);
-	    f = fopen(cache, "wb");
-	}
-
+	f = GL_MeshCreateCache(cache);
 	if (f) {
-	    tmp = LittleLong(numcommands);
-	    fwrite(&tmp, 4, 1, f);
-	    tmp = LittleLong(numorder);
-	    fwrite(&tmp, 4, 1, f);
-	    GL_MeshSwapCommands();
-	    fwrite(&commands, numcommands * sizeof(commands[0]), 1, f);
-	    fwrite(&vertexorder, numorder * sizeof(vertexorder[0]), 1, f);
-	    GL_MeshSwapCommands();
+	    GL_MeshWriteCache(f, crc);
 	    fclose(f);
 	}
     }
 
     /* save the data out to the in-memory model */
-    hdr->numverts = numorder;
+    GL_StoreMesh(hdr, &glhdr->meshes[0], hdr->numtris, posedata);
+    GL_LoadMeshLods(model, hdr, meshdata, posedata);
+    hdr->numverts = glhdr->meshes[0].numverts;
+    hdr->posedata = glhdr->meshes[0].posedata;
 
-    cmds = Hunk_Alloc(numcommands * 4);
-    GL_Aliashdr(hdr)->commands = (byte *)cmds - (byte *)hdr;
-    memcpy(cmds, commands, numcommands * 4);
+    GL_BuildMeshBuffers(hdr);
+}
 
-    verts = Hunk_Alloc(hdr->numposes * hdr->numverts * sizeof(trivertx_t));
-    hdr->posedata = (byte *)verts - (byte *)hdr;
-    for (i = 0; i < hdr->numposes; i++)
-	for (j = 0; j < numorder; j++)
-	    *verts++ = posedata->verts[i][vertexorder[j]];
+/*
+ * Cache destructor for alias models, to release their buffer objects
+ */
+void
+GL_MeshFreeBuffers(cache_user_t *cache)
+{
+    gl_aliashdr_t *glhdr = GL_Aliashdr(cache->data);
+
+    if (glhdr->buffers[0])
+	qglDeleteBuffersARB(2, glhdr->buffers);
+    glhdr->buffers[0] = glhdr->buffers[1] = 0;
 }
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "screen.h"
 #include "sound.h"
 #include "sys.h"
+#include "trace.h"
 #include "vid.h"
 #include "view.h"
 
@@ -37,10 +38,13 @@ qboolean r_cache_thrash;	// compatability
 vec3_t r_entorigin;
 int r_visframecount;		// bumped when going to a new PVS
 int r_framecount;		// used for dlight push checking
+qboolean r_sharedscene;		// between R_BeginScene and R_EndScene
+unsigned r_viewbits;		// bit of the view being drawn, 0 = all
 
 static mplane_t frustum[4];
 
 int c_lightmaps_uploaded;
+int c_lightmap_bytes;
 int c_brush_polys;
 static int c_alias_polys;
 
@@ -122,6 +126,11 @@ cvar_t gl_flashblend = { "gl_flashblend", "1" };
 cvar_t gl_playermip = { "gl_playermip", "0" };
 cvar_t gl_nocolors = { "gl_nocolors", "0" };
 cvar_t gl_zfix = { "gl_zfix", "0" };
+cvar_t gl_batchsurfs = { "gl_batchsurfs", "1" };
+cvar_t gl_glslmodels = { "gl_glslmodels", "1" };
+cvar_t gl_glslwarp = { "gl_glslwarp", "1" };
+cvar_t gl_occlusion = { "gl_occlusion", "0" };
+cvar_t gl_mirrorclip = { "gl_mirrorclip", "1" };
 #ifdef NQ_HACK
 cvar_t gl_doubleeyes = { "gl_doubleeyes", "1" };
 #endif
@@ -137,6 +146,9 @@ cvar_t r_lerpmodels = { "r_lerpmodels", "0", false };
 cvar_t r_lerpmove = { "r_lerpmove", "0", false };
 #endif
 
+/* levels of detail to drop, beyond what the size on screen calls for */
+cvar_t r_lodbias = { "r_lodbias", "0", true };
+
 /*
 =================
 R_CullBox
@@ -411,7 +423,7 @@ static model_loader_t GL_Model_Loader = {
     .Aliashdr_Padding = GL_Aliashdr_Padding,
     .LoadSkinData = GL_LoadSkinData,
     .LoadMeshData = GL_LoadMeshData,
-    .CacheDestructor = NULL,
+    .CacheDestructor = GL_MeshFreeBuffers,
 };
 
 const model_loader_t *
@@ -420,6 +432,100 @@ R_ModelLoader(void)
     return &GL_Model_Loader;
 }
 
+/*
+ * With vertex shaders each model is one glDrawElements from its buffers
+ * (see gl_mesh.c).  The two poses are offsets into the vertex buffer; the
+ * shader blends them and looks up the shade of each vertex normal, the same
+ * way as the immediate mode loops below.
+ */
+static const char *alias_vertexshader =
+    "uniform float blend;\n"
+    "uniform float shadelight;\n"
+    "uniform float shadedots[" stringify(NUMVERTEXNORMALS) "];\n"
+    "attribute vec4 pose0;\n"
+    "attribute vec4 pose1;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 pose = (blend < 0.5) ? pose0 : pose1;\n"
+    "    int normal = int(min(pose.w, " stringify(NUMVERTEXNORMALS) ".0 - 1.0));\n"
+    "    float light = shadedots[normal] * shadelight;\n"
+    "    gl_FrontColor = vec4(light, light, light, 1.0);\n"
+    "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix\n"
+    "	* vec4(mix(pose0.xyz, pose1.xyz, blend), 1.0);\n"
+    "}\n";
+
+static struct {
+    GLuint program;
+    GLint blend;
+    GLint shadelight;
+    GLint shadedots;
+    qboolean failed;
+} alias_shader;
+
+static qboolean
+GL_AliasShaderInit(void)
+{
+    static const char *const attributes[] = { "pose0", "pose1", NULL };
+    GLuint program;
+
+    if (alias_shader.program)
+	return true;
+    if (alias_shader.failed)
+	return false;
+
+    program = GL_LoadProgram("Alias model", alias_vertexshader, NULL,
+			     attributes);
+    if (!program) {
+	alias_shader.failed = true;
+	return false;
+    }
+
+    alias_shader.program = program;
+    alias_shader.blend = qglGetUniformLocation(program, "blend");
+    alias_shader.shadelight = qglGetUniformLocation(program, "shadelight");
+    alias_shader.shadedots = qglGetUniformLocation(program, "shadedots");
+
+    return true;
+}
+
+static void
+GL_AliasDrawModelShader(aliashdr_t *aliashdr, const gl_aliasmesh_t *mesh,
+			int pose0, int pose1, float blend)
+{
+    const gl_aliashdr_t *glhdr = GL_Aliashdr(aliashdr);
+    const int posesize = glhdr->numbufferverts * sizeof(trivertx_t);
+    const byte *base = NULL;
+
+    qglUseProgram(alias_shader.program);
+    qglUniform1f(alias_shader.blend, blend);
+    qglUniform1f(alias_shader.shadelight,
+		 r_fullbright.value ? 255.0f : shadelight);
+    qglUniform1fv(alias_shader.shadedots, NUMVERTEXNORMALS, shadedots);
+
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, glhdr->buffers[0]);
+    qglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, glhdr->buffers[1]);
+    qglVertexAttribPointer(0, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0,
+			   base + pose0 * posesize);
+    qglVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_FALSE, 0,
+			   base + pose1 * posesize);
+    qglEnableVertexAttribArray(0);
+    qglEnableVertexAttribArray(1);
+    glTexCoordPointer(2, GL_FLOAT, 0,
+		      base + aliashdr->numposes * posesize);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    glDrawElements(GL_TRIANGLES, mesh->numindices, GL_UNSIGNED_SHORT,
+		   base + mesh->firstindex * sizeof(unsigned short));
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    qglDisableVertexAttribArray(1);
+    qglDisableVertexAttribArray(0);
+    qglBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    qglUseProgram(0);
+}
+
 /*
 =============
 GL_AliasDrawModel
@@ -429,6 +535,7 @@ static void
 GL_AliasDrawModel(const entity_t *entity, float blend)
 {
     aliashdr_t *aliashdr;
+    const gl_aliasmesh_t *mesh;
     const trivertx_t *vertbase, *verts1;
     const int *order;
     int count;
@@ -436,9 +543,24 @@ GL_AliasDrawModel(const entity_t *entity, float blend)
     lastposenum = entity->currentpose;
 
     aliashdr = Mod_Extradata(entity->model);
-    vertbase = (trivertx_t *)((byte *)aliashdr + aliashdr->posedata);
-    verts1 = vertbase + entity->currentpose * aliashdr->numverts;
-    order = (int *)((byte *)aliashdr + GL_Aliashdr(aliashdr)->commands);
+    mesh = &GL_Aliashdr(aliashdr)->meshes[entity->lod];
+    if (gl_glslmodels.value && GL_Aliashdr(aliashdr)->buffers[0]
+	&& GL_AliasShaderInit()) {
+	int pose0 = entity->currentpose;
+#ifdef NQ_HACK
+	if (r_lerpmodels.value && blend != 1.0f)
+	    pose0 = entity->previouspose;
+#endif
+	if (!mesh->numindices)
+	    mesh = &GL_Aliashdr(aliashdr)->meshes[0];
+	GL_AliasDrawModelShader(aliashdr, mesh, pose0, entity->currentpose,
+				blend);
+	return;
+    }
+
+    vertbase = (trivertx_t *)((byte *)aliashdr + mesh->posedata);
+    verts1 = vertbase + entity->currentpose * mesh->numverts;
+    order = (int *)((byte *)aliashdr + mesh->commands);
 
 #ifdef NQ_HACK
     if (r_lerpmodels.value && blend != 1.0f) {
@@ -446,7 +568,7 @@ GL_AliasDrawModel(const entity_t *entity, float blend)
 	const trivertx_t *verts0;
 	const float blend0 = 1.0f - blend;
 
-	verts0 = vertbase + entity->previouspose * aliashdr->numverts;
+	verts0 = vertbase + entity->previouspose * mesh->numverts;
 	lightvert = (blend < 0.5f) ? verts0 : verts1;
 
 	while (1) {
@@ -526,6 +648,7 @@ GL_AliasDrawShadow
 static void
 GL_AliasDrawShadow(const entity_t *entity, aliashdr_t *paliashdr, int posenum)
 {
+    const gl_aliasmesh_t *mesh = &GL_Aliashdr(paliashdr)->meshes[entity->lod];
     trivertx_t *verts;
     int *order;
     vec3_t point;
@@ -535,9 +658,9 @@ GL_AliasDrawShadow(const entity_t *entity, aliashdr_t *paliashdr, int posenum)
     lheight = entity->origin[2] - lightspot[2];
     height = -lheight + 1.0;
 
-    verts = (trivertx_t *)((byte *)paliashdr + paliashdr->posedata);
-    verts += posenum * paliashdr->numverts;
-    order = (int *)((byte *)paliashdr + GL_Aliashdr(paliashdr)->commands);
+    verts = (trivertx_t *)((byte *)paliashdr + mesh->posedata);
+    verts += posenum * mesh->numverts;
+    order = (int *)((byte *)paliashdr + mesh->commands);
 
     while (1) {
 	// get the vertex count and primitive type
@@ -823,6 +946,39 @@ R_AliasCalcLight(const entity_t *entity,
     VectorNormalize(shadevector);
 }
 
+/*
+ * Sizes the frame's box on screen by its longest side, at its distance
+ * along the view.
+ */
+static int
+R_AliasLOD(const aliashdr_t *aliashdr, const entity_t *entity,
+	   const vec3_t origin)
+{
+    const maliasframedesc_t *frame;
+    vec3_t extents, offset;
+    float distance, size;
+    int i;
+
+    if (!aliashdr->numlods)
+	return 0;
+
+    frame = &aliashdr->frames[0];
+    if (entity->frame >= 0 && entity->frame < aliashdr->numframes)
+	frame = &aliashdr->frames[entity->frame];
+    for (i = 0; i < 3; i++)
+	extents[i] = (frame->bboxmax.v[i] - frame->bboxmin.v[i])
+	    * aliashdr->scale[i];
+    VectorSubtract(origin, r_origin, offset);
+    distance = DotProduct(offset, vpn);
+    if (distance < 1.0f)
+	return 0;
+
+    size = qmax(qmax(extents[0], extents[1]), extents[2]);
+    size *= r_refdef.vrect.height * 0.5f / tan(r_refdef.fov_y * M_PI / 360.0);
+
+    return Mod_AliasLOD(aliashdr, size / distance, r_lodbias.value);
+}
+
 /*
 =================
 R_AliasDrawModel
@@ -841,15 +997,20 @@ R_AliasDrawModel(entity_t *entity)
     VectorAdd(origin, model->maxs, maxs);
     if (R_CullBox(mins, maxs))
 	return;
+    if (R_OccludedBox(mins, maxs))
+	return;
 
     /* Calculate lighting at the lerp origin */
     R_AliasCalcLight(entity, origin, angles);
 
     /* locate the proper data */
     aliashdr = Mod_Extradata(entity->model);
+    entity->lod = 0;
+    if (entity != &cl.viewent)
+	entity->lod = R_AliasLOD(aliashdr, entity, origin);
 
     /* draw all the triangles */
-    c_alias_polys += aliashdr->numtris;
+    c_alias_polys += GL_Aliashdr(aliashdr)->meshes[entity->lod].numtris;
     VectorCopy(origin, r_entorigin);
 
     GL_DisableMultitexture();
@@ -1012,6 +1173,33 @@ R_DrawEntitiesOnList(void)
     }
 }
 
+/*
+=============
+R_ViewModelCulled
+
+True if the view model is wholly outside the frustum, which under a fisheye
+lens it is for most of the plates
+=============
+*/
+static qboolean
+R_ViewModelCulled(const entity_t *e)
+{
+    vec3_t mins, maxs;
+    float radius;
+    int i;
+
+    if (e->model->type != mod_alias)
+	return false;
+
+    radius = Mod_AliasFrameRadius(Mod_Extradata(e->model), e->frame);
+    for (i = 0; i < 3; i++) {
+	mins[i] = e->origin[i] - radius;
+	maxs[i] = e->origin[i] + radius;
+    }
+
+    return R_CullBox(mins, maxs);
+}
+
 /*
 =============
 R_DrawViewModel
@@ -1054,7 +1242,7 @@ R_DrawViewModel(void)
 	return;
 
     e = &cl.viewent;
-    if (!e->model)
+    if (!e->model || R_ViewModelCulled(e))
 	return;
 
     j = R_LightPoint(e->origin);
@@ -1155,6 +1343,35 @@ R_PolyBlend(void)
     }
 }
 
+/*
+ * The part of the screen the mirror surfaces cover, in normalised device
+ * coords (left, right, bottom, top).  The mirrored view only needs the
+ * frustum through that rectangle, and only draws inside it.
+ */
+static float mirror_rect[4];
+static qboolean mirror_clipped;
+
+/*
+ * Frustum planes through the given rectangle of the view, in normalised
+ * device coords of the unflipped projection
+ */
+static void
+R_SetFrustumRect(float left, float right, float bottom, float top)
+{
+    float tanx, tany;
+    int i;
+
+    tany = tan(r_refdef.fov_y * M_PI / 360.0);
+    tanx = tany * r_refdef.vrect.width / r_refdef.vrect.height;
+
+    for (i = 0; i < 3; i++) {
+	frustum[0].normal[i] = vright[i] - left * tanx * vpn[i];
+	frustum[1].normal[i] = -vright[i] + right * tanx * vpn[i];
+	frustum[2].normal[i] = vup[i] - bottom * tany * vpn[i];
+	frustum[3].normal[i] = -vup[i] + top * tany * vpn[i];
+    }
+}
+
 static void
 R_SetFrustum(void)
 {
@@ -1164,7 +1381,15 @@ R_SetFrustum(void)
     if (r_lockfrustum.value)
 	return;
 
-    if (r_refdef.fov_x == 90) {
+    if (mirror && mirror_clipped) {
+	/* the mirrored projection is flipped, so is the rectangle */
+	if (mirror_plane->normal[2])
+	    R_SetFrustumRect(mirror_rect[0], mirror_rect[1],
+			     -mirror_rect[3], -mirror_rect[2]);
+	else
+	    R_SetFrustumRect(-mirror_rect[1], -mirror_rect[0],
+			     mirror_rect[2], mirror_rect[3]);
+    } else if (r_refdef.fov_x == 90) {
 	// front side is visible
 
 	VectorAdd(vpn, vright, frustum[0].normal);
@@ -1214,19 +1439,30 @@ R_SetupFrame(void)
 	r_wateralpha.value = 1;
 #endif
 
-    R_AnimateLight();
-
-    r_framecount++;
+    if (!r_sharedscene) {
+	R_AnimateLight();
+	r_framecount++;
+    }
 
 // build the transformation matrix for the given view angles
     VectorCopy(r_refdef.vieworg, r_origin);
 
-    AngleVectors(r_refdef.viewangles, vpn, vright, vup);
+    extern qboolean fisheye_enabled;
+    if (fisheye_enabled) {
+        VectorCopy(r_refdef.forward, vpn);
+        VectorCopy(r_refdef.right, vright);
+        VectorCopy(r_refdef.up, vup);
+    }
+    else {
+        AngleVectors(r_refdef.viewangles, vpn, vright, vup);
+    }
 
-// current viewleaf
-    r_oldviewleaf = r_viewleaf;
-    if (!r_viewleaf || !r_lockpvs.value)
-	r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+// current viewleaf (already found for a shared scene)
+    if (!r_sharedscene) {
+	r_oldviewleaf = r_viewleaf;
+	if (!r_viewleaf || !r_lockpvs.value)
+	    r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+    }
 
 // color shifting for water, etc.
     V_SetContentsColor(r_viewleaf->contents);
@@ -1239,6 +1475,7 @@ R_SetupFrame(void)
     c_brush_polys = 0;
     c_alias_polys = 0;
     c_lightmaps_uploaded = 0;
+    c_lightmap_bytes = 0;
 }
 
 
@@ -1300,8 +1537,19 @@ R_SetupGL(void)
 	w = h = 256;
     }
 
+    // fisheye plates are rendered square in the bottom left corner
+    extern qboolean fisheye_enabled;
+    extern int fisheye_plate_size;
+    qboolean fisheye_plate = fisheye_enabled && fisheye_plate_size > 0;
+    if (fisheye_plate) {
+	x = y2 = 0;
+	w = h = fisheye_plate_size;
+    }
+
     glViewport(glx + x, gly + y2, w, h);
     screenaspect = (float)r_refdef.vrect.width / r_refdef.vrect.height;
+    if (fisheye_plate)
+	screenaspect = 1;
 
     // FIXME - wtf is all this about?
     //yfov = 2*atan((float)r_refdef.vrect.height/r_refdef.vrect.width)*180/M_PI;
@@ -1326,11 +1574,22 @@ R_SetupGL(void)
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    glRotatef(-90, 1, 0, 0);	// put Z going up
-    glRotatef(90, 0, 0, 1);	// put Z going up
-    glRotatef(-r_refdef.viewangles[2], 1, 0, 0);
-    glRotatef(-r_refdef.viewangles[0], 0, 1, 0);
-    glRotatef(-r_refdef.viewangles[1], 0, 0, 1);
+    if (fisheye_plate) {
+	// straight from the plate's view vectors
+	GLfloat m[16] = {
+	    vright[0], vup[0], -vpn[0], 0,
+	    vright[1], vup[1], -vpn[1], 0,
+	    vright[2], vup[2], -vpn[2], 0,
+	    0, 0, 0, 1
+	};
+	glLoadMatrixf(m);
+    } else {
+	glRotatef(-90, 1, 0, 0);	// put Z going up
+	glRotatef(90, 0, 0, 1);	// put Z going up
+	glRotatef(-r_refdef.viewangles[2], 1, 0, 0);
+	glRotatef(-r_refdef.viewangles[0], 0, 1, 0);
+	glRotatef(-r_refdef.viewangles[1], 0, 0, 1);
+    }
     glTranslatef(-r_refdef.vieworg[0], -r_refdef.vieworg[1],
 		 -r_refdef.vieworg[2]);
 
@@ -1425,6 +1684,66 @@ R_Clear(void)
 }
 
 #ifdef NQ_HACK /* Mirrors disabled for now in QW */
+/*
+=============
+R_MirrorRect
+
+Finds the rectangle of the screen covered by the mirror surfaces, from the
+view just rendered.  Returns false if none of them are on screen.
+=============
+*/
+static qboolean
+R_MirrorRect(float rect[4])
+{
+    GLfloat projection[16];
+    const msurface_t *s;
+    const glpoly_t *p;
+    const float *v;
+    float eye[3], clip[4], x, y;
+    int i, j;
+
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+
+    rect[0] = rect[2] = 1;
+    rect[1] = rect[3] = -1;
+    s = cl.worldmodel->textures[mirrortexturenum]->texturechain;
+    for (; s; s = s->texturechain) {
+	for (p = s->polys; p; p = p->next) {
+	    v = p->verts[0];
+	    for (i = 0; i < p->numverts; i++, v += VERTEXSIZE) {
+		for (j = 0; j < 3; j++)
+		    eye[j] = r_world_matrix[j] * v[0]
+			+ r_world_matrix[4 + j] * v[1]
+			+ r_world_matrix[8 + j] * v[2]
+			+ r_world_matrix[12 + j];
+		for (j = 0; j < 4; j++)
+		    clip[j] = projection[j] * eye[0]
+			+ projection[4 + j] * eye[1]
+			+ projection[8 + j] * eye[2]
+			+ projection[12 + j];
+
+		/* crosses the eye plane, so could cover anything */
+		if (clip[3] < 1) {
+		    rect[0] = rect[2] = -1;
+		    rect[1] = rect[3] = 1;
+		    return true;
+		}
+		x = clip[0] / clip[3];
+		y = clip[1] / clip[3];
+		rect[0] = qmin(rect[0], x);
+		rect[1] = qmax(rect[1], x);
+		rect[2] = qmin(rect[2], y);
+		rect[3] = qmax(rect[3], y);
+	    }
+	}
+    }
+
+    for (i = 0; i < 4; i++)
+	rect[i] = qclamp(rect[i], -1.0f, 1.0f);
+
+    return rect[0] < rect[1] && rect[2] < rect[3];
+}
+
 /*
 =============
 R_Mirror
@@ -1436,10 +1755,30 @@ R_Mirror(void)
     float d;
     msurface_t *s;
     entity_t *ent;
+    GLint viewport[4];
+    int x, y, x2, y2;
 
     if (!mirror)
 	return;
 
+    mirror_clipped = false;
+    if (gl_mirrorclip.value) {
+	if (!R_MirrorRect(mirror_rect)) {
+	    cl.worldmodel->textures[mirrortexturenum]->texturechain = NULL;
+	    return;
+	}
+	mirror_clipped = true;
+
+	/* whole pixels around the rectangle */
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	x = viewport[0] + floor((mirror_rect[0] + 1) * 0.5 * viewport[2]) - 1;
+	x2 = viewport[0] + ceil((mirror_rect[1] + 1) * 0.5 * viewport[2]) + 1;
+	y = viewport[1] + floor((mirror_rect[2] + 1) * 0.5 * viewport[3]) - 1;
+	y2 = viewport[1] + ceil((mirror_rect[3] + 1) * 0.5 * viewport[3]) + 1;
+	glScissor(x, y, x2 - x, y2 - y);
+	glEnable(GL_SCISSOR_TEST);
+    }
+
     memcpy(r_base_world_matrix, r_world_matrix, sizeof(r_base_world_matrix));
 
     d = DotProduct(r_refdef.vieworg,
@@ -1493,9 +1832,49 @@ R_Mirror(void)
     cl.worldmodel->textures[mirrortexturenum]->texturechain = NULL;
     glDisable(GL_BLEND);
     glColor4f(1, 1, 1, 1);
+
+    if (mirror_clipped) {
+	glDisable(GL_SCISSOR_TEST);
+	mirror_clipped = false;
+    }
 }
 #endif
 
+/*
+================
+R_BeginScene
+
+Views rendered from the same r_refdef.vieworg (the fisheye cube faces) can
+share the setup that only depends on the origin: the dynamic lights,
+lightstyles, viewleaf and PVS, and with R_CullScene the walk of the world
+and the static entities it stores.  Call this once before rendering them
+with R_RenderView, then R_EndScene.
+================
+*/
+void
+R_BeginScene(void)
+{
+    R_PushDlights();
+    R_AnimateLight();
+    r_framecount++;
+
+    r_oldviewleaf = r_viewleaf;
+    if (!r_viewleaf || !r_lockpvs.value)
+	r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_refdef.vieworg);
+    R_MarkLeaves();
+
+    r_sharedscene = true;
+    r_sceneviews = 0;
+}
+
+void
+R_EndScene(void)
+{
+    r_sharedscene = false;
+    r_sceneviews = 0;
+    r_viewbits = 0;
+}
+
 /*
 ================
 R_RenderView
@@ -1522,6 +1901,7 @@ R_RenderView(void)
 	c_brush_polys = 0;
 	c_alias_polys = 0;
 	c_lightmaps_uploaded = 0;
+	c_lightmap_bytes = 0;
     }
 
     mirror = false;
@@ -1529,9 +1909,15 @@ R_RenderView(void)
     R_Clear();
 
     // render normal view
+    TR_Begin("R_RenderScene");
     R_RenderScene();
+    TR_End("R_RenderScene");
+    TR_Begin("R_DrawViewModel");
     R_DrawViewModel();
+    TR_End("R_DrawViewModel");
+    TR_Begin("R_DrawWaterSurfaces");
     R_DrawWaterSurfaces();
+    TR_End("R_DrawWaterSurfaces");
 
 #ifdef NQ_HACK /* Mirrors disabled for now in QW */
     // render mirror view
@@ -1543,8 +1929,9 @@ R_RenderView(void)
     if (r_speeds.value) {
 //              glFinish ();
 	time2 = Sys_DoubleTime();
-	Con_Printf("%3i ms  %4i wpoly %4i epoly %4i dlit\n",
+	Con_Printf("%3i ms  %4i wpoly %4i epoly %4i dlit (%iK)\n",
 		   (int)((time2 - time1) * 1000), c_brush_polys,
-		   c_alias_polys, c_lightmaps_uploaded);
+		   c_alias_polys, c_lightmaps_uploaded,
+		   (c_lightmap_bytes + 1023) / 1024);
     }
 }
@@ -178,6 +178,111 @@ cvar_t r_lockpvs = { "r_lockpvs", "0" };
 cvar_t r_lockfrustum = { "r_lockfrustum", "0" };
 cvar_t r_drawflat = { "r_drawflat", "0" };
 
+#ifdef QW_HACK
+/*
+ * Translated player skins are kept as textures, keyed by the skin, colors
+ * and size, so a player changing colors to ones already seen, or joining
+ * in a skin and colors someone else wears, only needs a texture bound.
+ * playertextures[] holds the texture each player is drawn with; those are
+ * never replaced, and with twice as many textures as players there's
+ * always one spare.
+ */
+#define PLAYER_SKIN_TEXTURES (MAX_CLIENTS * 2)
+
+static struct {
+    const byte *original;	// the skin's pixels, NULL if unused
+    unsigned serial;		// of the skin, 0 for the model's own
+    int top, bottom;
+    unsigned width, height;
+    unsigned lastused;
+    GLuint texture;
+} skintextures[PLAYER_SKIN_TEXTURES];
+static unsigned skintextures_used;
+
+static void
+R_InitPlayerSkinTextures(void)
+{
+    int i;
+
+    for (i = 0; i < PLAYER_SKIN_TEXTURES; i++) {
+	glGenTextures(1, &skintextures[i].texture);
+	skintextures[i].original = NULL;
+    }
+    for (i = 0; i < MAX_CLIENTS; i++)
+	playertextures[i] = skintextures[i].texture;
+}
+
+static void
+R_ClearPlayerSkinTextures(void)
+{
+    int i;
+
+    for (i = 0; i < PLAYER_SKIN_TEXTURES; i++)
+	skintextures[i].original = NULL;
+}
+
+static qboolean
+R_PlayerSkinTextureBound(GLuint texture)
+{
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+	if (playertextures[i] == texture)
+	    return true;
+
+    return false;
+}
+
+/*
+ * Returns the texture for the translation, and whether it's already been
+ * uploaded.  If not, the texture is the least recently used one no player
+ * is drawn with, and the caller uploads the translation to it.
+ */
+static GLuint
+R_PlayerSkinTexture(const byte *original, unsigned serial, int top,
+		    int bottom, unsigned width, unsigned height,
+		    qboolean *uploaded)
+{
+    int i, oldest = -1;
+
+    skintextures_used++;
+    for (i = 0; i < PLAYER_SKIN_TEXTURES; i++) {
+	if (skintextures[i].original == original
+	    && skintextures[i].serial == serial
+	    && skintextures[i].top == top
+	    && skintextures[i].bottom == bottom
+	    && skintextures[i].width == width
+	    && skintextures[i].height == height) {
+	    skintextures[i].lastused = skintextures_used;
+	    *uploaded = true;
+	    return skintextures[i].texture;
+	}
+    }
+
+    for (i = 0; i < PLAYER_SKIN_TEXTURES; i++) {
+	if (R_PlayerSkinTextureBound(skintextures[i].texture))
+	    continue;
+	if (!skintextures[i].original) {
+	    oldest = i;
+	    break;
+	}
+	if (oldest < 0 || skintextures[i].lastused < skintextures[oldest].lastused)
+	    oldest = i;
+    }
+
+    skintextures[oldest].original = original;
+    skintextures[oldest].serial = serial;
+    skintextures[oldest].top = top;
+    skintextures[oldest].bottom = bottom;
+    skintextures[oldest].width = width;
+    skintextures[oldest].height = height;
+    skintextures[oldest].lastused = skintextures_used;
+    *uploaded = false;
+
+    return skintextures[oldest].texture;
+}
+#endif
+
 /*
 ===============
 R_Init
@@ -199,6 +304,7 @@ R_Init(void)
     Cvar_RegisterVariable(&r_lerpmodels);
     Cvar_RegisterVariable(&r_lerpmove);
 #endif
+    Cvar_RegisterVariable(&r_lodbias);
     Cvar_RegisterVariable(&r_lockpvs);
     Cvar_RegisterVariable(&r_lockfrustum);
 
@@ -206,6 +312,7 @@ R_Init(void)
     Cvar_RegisterVariable(&r_lightmap);
     Cvar_RegisterVariable(&r_shadows);
     Cvar_RegisterVariable(&r_mirroralpha);
+    Cvar_RegisterVariable(&gl_mirrorclip);
     Cvar_RegisterVariable(&r_wateralpha);
     Cvar_RegisterVariable(&r_dynamic);
     Cvar_RegisterVariable(&r_novis);
@@ -226,6 +333,10 @@ R_Init(void)
     Cvar_RegisterVariable(&gl_playermip);
     Cvar_RegisterVariable(&gl_nocolors);
     Cvar_RegisterVariable(&gl_zfix);
+    Cvar_RegisterVariable(&gl_batchsurfs);
+    Cvar_RegisterVariable(&gl_glslmodels);
+    Cvar_RegisterVariable(&gl_glslwarp);
+    Cvar_RegisterVariable(&gl_occlusion);
 
     Cvar_RegisterVariable(&gl_keeptjunctions);
     Cvar_RegisterVariable(&gl_reporttjunctions);
@@ -244,8 +355,10 @@ R_Init(void)
 
 #ifdef QW_HACK
     glGenTextures(1, &netgraphtexture);
-#endif
+    R_InitPlayerSkinTextures();
+#else
     glGenTextures(MAX_CLIENTS, playertextures);
+#endif
 }
 
 
@@ -363,6 +476,8 @@ R_TranslatePlayerSkin(int playernum)
 #ifdef QW_HACK
     const char *skin_key;
     char skin[MAX_QPATH];
+    unsigned serial;
+    qboolean uploaded;
 #endif
 
     GL_DisableMultitexture();
@@ -444,18 +559,16 @@ R_TranslatePlayerSkin(int playernum)
     if ((original = Skin_Cache(player->skin)) != NULL) {
 	/* Skin data width for custom skins */
 	instride = 320;
+	serial = player->skin->serial;
     } else {
 	model_t *model = cl.model_precache[cl_playerindex];
 	const aliashdr_t *aliashdr = Mod_Extradata(model);
 	original = (const byte *)aliashdr + aliashdr->skindata;
 	instride = inwidth;
+	serial = 0;
     }
 #endif
 
-    // because this happens during gameplay, do it fast
-    // instead of sending it through gl_upload 8
-    GL_Bind(playertextures[playernum]);
-
     // allow users to crunch sizes down
     scaled_width = 512 >> (int)gl_playermip.value;
     scaled_height = 256 >> (int)gl_playermip.value;
@@ -464,6 +577,17 @@ R_TranslatePlayerSkin(int playernum)
     scaled_width = qmin((unsigned)gl_max_size.value, scaled_width);
     scaled_height = qmin((unsigned)gl_max_size.value, scaled_height);
 
+    // because this happens during gameplay, do it fast
+    // instead of sending it through gl_upload 8
+#ifdef QW_HACK
+    playertextures[playernum] =
+	R_PlayerSkinTexture(original, serial, top, bottom,
+			    scaled_width, scaled_height, &uploaded);
+    if (uploaded)
+	return;
+#endif
+    GL_Bind(playertextures[playernum]);
+
     ResampleXlate(original, inwidth, inheight, instride,
 		  pixels, scaled_width, scaled_height, translate);
     glTexImage2D(GL_TEXTURE_2D, 0, gl_solid_format, scaled_width,
@@ -499,6 +623,10 @@ R_NewMap(void)
 
     r_viewleaf = NULL;
     R_ClearParticles();
+    R_ClearLightPoints();
+#ifdef QW_HACK
+    R_ClearPlayerSkinTextures();
+#endif
 
     hunkbase = Hunk_AllocName(0, "gl_polys");
     GL_BuildLightmaps(hunkbase);
@@ -546,6 +674,79 @@ R_TimeRefresh_f(void)
     GL_EndRendering();
 }
 
+static GLuint
+GL_CompileShader(const char *name, GLenum type, const char *source)
+{
+    GLuint shader;
+    GLint status;
+
+    shader = qglCreateShader(type);
+    qglShaderSource(shader, 1, &source, NULL);
+    qglCompileShader(shader);
+    qglGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+	Con_Printf("%s %s shader failed to compile\n", name,
+		   type == GL_VERTEX_SHADER ? "vertex" : "fragment");
+	qglDeleteShader(shader);
+	return 0;
+    }
+
+    return shader;
+}
+
+/*
+==================
+GL_LoadProgram
+
+Compiles and links a shader program, binding the NULL terminated list of
+attribute names to locations 0, 1, ...  Either source may be NULL to keep
+the fixed function stage.  Returns 0 if the program can't be used.
+==================
+*/
+GLuint
+GL_LoadProgram(const char *name, const char *vertexsource,
+	       const char *fragmentsource, const char *const *attributes)
+{
+    GLuint vertexshader = 0, fragmentshader = 0, program;
+    GLint status;
+    int i;
+
+    if (vertexsource) {
+	vertexshader = GL_CompileShader(name, GL_VERTEX_SHADER, vertexsource);
+	if (!vertexshader)
+	    return 0;
+    }
+    if (fragmentsource) {
+	fragmentshader = GL_CompileShader(name, GL_FRAGMENT_SHADER,
+					  fragmentsource);
+	if (!fragmentshader) {
+	    if (vertexshader)
+		qglDeleteShader(vertexshader);
+	    return 0;
+	}
+    }
+
+    program = qglCreateProgram();
+    if (vertexshader)
+	qglAttachShader(program, vertexshader);
+    if (fragmentshader)
+	qglAttachShader(program, fragmentshader);
+    for (i = 0; attributes && attributes[i]; i++)
+	qglBindAttribLocation(program, i, attributes[i]);
+    qglLinkProgram(program);
+    if (vertexshader)
+	qglDeleteShader(vertexshader);
+    if (fragmentshader)
+	qglDeleteShader(fragmentshader);
+    qglGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+	Con_Printf("%s shader program failed to link\n", name);
+	return 0;
+    }
+
+    return program;
+}
+
 void
 D_FlushCaches(void)
 {
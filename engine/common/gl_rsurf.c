@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // gl_rsurf.c: surface-related refresh code
 
+#include <stdlib.h>
+
 #include "console.h"
 #include "glquake.h"
 #include "quakedef.h"
@@ -50,16 +52,20 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
     (r_waterwarp.value && ((surf)->flags & SURF_UNDERWATER))
 #endif
 
-#define	MAX_LM_BLOCKS	256
+/*
+ * Lightmap blocks are large so that a map needs few of them, and the world
+ * and R_BlendLightmaps rebind seldom; the same space as 256 blocks of 128.
+ */
+#define	MAX_LM_BLOCKS	64
 
 static int lightmap_bytes;		// 1, 2, or 4
 static int lightmap_textures_initialised = 0;
 
-#define	BLOCK_WIDTH	128
-#define	BLOCK_HEIGHT	128
+#define	BLOCK_WIDTH	256
+#define	BLOCK_HEIGHT	256
 
 typedef struct glRect_s {
-    unsigned char l, t, w, h;
+    unsigned short l, t, w, h;
 } glRect_t;
 
 typedef struct lm_block_s {
@@ -74,65 +80,55 @@ typedef struct lm_block_s {
 static lm_block_t lm_blocks[MAX_LM_BLOCKS];
 static int lm_used;
 
+/*
+ * GL_BuildLightmaps copies the verts of every solid brush poly into one
+ * array, kept in a vertex buffer object when there are those.  The visible
+ * polys of each texture and lightmap then go out as indexed triangles in a
+ * glDrawElements, instead of a glBegin/glEnd each.
+ */
+#define MAX_BATCH_INDICES (4096 * 3)
+
+static float *batch_verts;
+static int batch_numverts;
+static GLuint batch_buffer;
+static GLuint batch_indices[MAX_BATCH_INDICES];
+static int batch_numindices;
+
 /*
  * ===================
  * R_AddDynamicLights
  * ===================
- * Check all dynamic lights against this surface
+ * Add the lights from R_SurfaceDlights, each only over the samples it reaches
  */
 static void
-R_AddDynamicLights(msurface_t *surf, unsigned *blocklights)
+R_AddDynamicLights(msurface_t *surf, const surfdlight_t *lights,
+		   int numlights, unsigned *blocklights)
 {
-    int lnum;
+    const surfdlight_t *light;
     int sd, td;
-    float dist, rad, minlight;
-    vec3_t impact, local;
+    float dist;
     int s, t;
     int i;
-    int smax, tmax;
-    mtexinfo_t *tex;
-    dlight_t *dl;
+    int smax;
 
     smax = (surf->extents[0] >> 4) + 1;
-    tmax = (surf->extents[1] >> 4) + 1;
-    tex = surf->texinfo;
-
-    for (lnum = 0; lnum < MAX_DLIGHTS; lnum++) {
-	if (!(surf->dlightbits & (1U << lnum)))
-	    continue;		// not lit by this light
-
-	dl = &cl_dlights[lnum];
 
-	rad = dl->radius;
-	dist = DotProduct(dl->origin, surf->plane->normal) - surf->plane->dist;
-	rad -= fabs(dist);
-	minlight = dl->minlight;
-	if (rad < minlight)
-	    continue;
-	minlight = rad - minlight;
-
-	for (i = 0; i < 3; i++)
-	    impact[i] = dl->origin[i] -	surf->plane->normal[i] * dist;
-
-	local[0] = DotProduct(impact, tex->vecs[0]) + tex->vecs[0][3];
-	local[0] -= surf->texturemins[0];
-	local[1] = DotProduct(impact, tex->vecs[1]) + tex->vecs[1][3];
-	local[1] -= surf->texturemins[1];
-
-	for (t = 0; t < tmax; t++) {
-	    td = local[1] - t * 16;
+    for (i = 0; i < numlights; i++) {
+	light = &lights[i];
+	for (t = light->tmin; t <= light->tmax; t++) {
+	    td = light->local[1] - t * 16;
 	    if (td < 0)
 		td = -td;
-	    for (s = 0; s < smax; s++) {
-		sd = local[0] - s * 16;
+	    for (s = light->smin; s <= light->smax; s++) {
+		sd = light->local[0] - s * 16;
 		if (sd < 0)
 		    sd = -sd;
 		if (sd > td)
 		    dist = sd + (td >> 1);
 		else
 		    dist = td + (sd >> 1);
-		if (dist < minlight)
-		    blocklights[t * smax + s] += (rad - dist) * 256;
+		if (dist < light->minlight)
+		    blocklights[t * smax + s] += (light->rad - dist) * 256;
 	    }
 	}
     }
@@ -146,7 +142,8 @@ Combine and scale multiple lightmaps into the correct format in blocklights
 ===============
 */
 static void
-R_BuildLightMap(msurface_t *surf, byte *dest, int stride)
+R_BuildLightMap(msurface_t *surf, byte *dest, int stride,
+		const surfdlight_t *dlights, int numdlights, unsigned dlightkey)
 {
     int smax, tmax;
     int t;
@@ -157,7 +154,7 @@ R_BuildLightMap(msurface_t *surf, byte *dest, int stride)
     unsigned blocklights[18 * 18];
     unsigned *bl;
 
-    surf->cached_dlight = (surf->dlightframe == r_framecount);
+    surf->cached_dlight = dlightkey;
 
     smax = (surf->extents[0] >> 4) + 1;
     tmax = (surf->extents[1] >> 4) + 1;
@@ -186,8 +183,8 @@ R_BuildLightMap(msurface_t *surf, byte *dest, int stride)
     }
 
 // add all the dynamic lights
-    if (surf->dlightframe == r_framecount)
-	R_AddDynamicLights(surf, blocklights);
+    if (numdlights)
+	R_AddDynamicLights(surf, dlights, numdlights, blocklights);
 
 // bound, invert, and shift
   store:
@@ -368,6 +365,92 @@ DrawGLPoly_2Ply(glpoly_t *p)
     glEnd();
 }
 
+static qboolean
+R_BatchesEnabled(void)
+{
+    return batch_verts && gl_batchsurfs.value;
+}
+
+/* where the vertex array's values at the given float offset start */
+static const GLvoid *
+R_BatchArray(int offset)
+{
+    if (gl_vboable)
+	return (const GLvoid *)(offset * sizeof(float));
+    return batch_verts + offset;
+}
+
+/*
+ * Set up the vertex arrays, with the given vertex offsets as the coordinates
+ * for texture units 0 (and 1, unless it's negative)
+ */
+static void
+R_BeginBatches(int texcoords0, int texcoords1)
+{
+    const GLsizei stride = VERTEXSIZE * sizeof(float);
+
+    if (gl_vboable)
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, batch_buffer);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, R_BatchArray(0));
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride, R_BatchArray(texcoords0));
+    if (texcoords1 >= 0) {
+	qglClientActiveTextureARB(GL_TEXTURE1_ARB);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glTexCoordPointer(2, GL_FLOAT, stride, R_BatchArray(texcoords1));
+	qglClientActiveTextureARB(GL_TEXTURE0_ARB);
+    }
+}
+
+static void
+R_FlushBatch(void)
+{
+    if (!batch_numindices)
+	return;
+
+    glDrawElements(GL_TRIANGLES, batch_numindices, GL_UNSIGNED_INT,
+		   batch_indices);
+    batch_numindices = 0;
+}
+
+static void
+R_EndBatches(qboolean texcoords1)
+{
+    R_FlushBatch();
+
+    if (texcoords1) {
+	qglClientActiveTextureARB(GL_TEXTURE1_ARB);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	qglClientActiveTextureARB(GL_TEXTURE0_ARB);
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    if (gl_vboable)
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+}
+
+/* add the poly's triangle fan to the batch */
+static void
+R_BatchPoly(const glpoly_t *p)
+{
+    GLuint *index;
+    int i;
+
+    if (batch_numindices + (p->numverts - 2) * 3 > MAX_BATCH_INDICES)
+	R_FlushBatch();
+
+    index = batch_indices + batch_numindices;
+    for (i = 2; i < p->numverts; i++) {
+	*index++ = p->firstvert;
+	*index++ = p->firstvert + i - 1;
+	*index++ = p->firstvert + i;
+    }
+    batch_numindices = index - batch_indices;
+}
+
 static void
 WaterWarpCoord(vec3_t in, vec3_t out)
 {
@@ -468,12 +551,131 @@ R_UploadLMBlockUpdate(int blocknum)
 		    pixels);
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
+    c_lightmaps_uploaded++;
+    c_lightmap_bytes += rect->w * rect->h * lightmap_bytes;
+
     rect->l = BLOCK_WIDTH;
     rect->t = BLOCK_HEIGHT;
     rect->h = 0;
     rect->w = 0;
+}
 
-    c_lightmaps_uploaded++;
+/*
+ * All the modified lightmap rects for a frame go up together, before the
+ * polys using them are drawn.  With pixel buffer objects the rows are packed
+ * into the next buffer of a small ring, so the texture uploads read from
+ * memory the driver owns and don't stall on ours; a buffer is only written
+ * again a few frames later.  Rows are padded to the default unpack
+ * alignment.
+ */
+#define LM_UPLOAD_BUFFERS 3
+
+static GLuint lm_uploadbuffers[LM_UPLOAD_BUFFERS];
+static int lm_uploadbuffer;
+
+static int
+R_LightmapRowBytes(const glRect_t *rect)
+{
+    return (rect->w * lightmap_bytes + 3) & ~3;
+}
+
+static qboolean
+R_StageLightmaps(int size)
+{
+    byte *dest;
+    const byte *src;
+    const glRect_t *rect;
+    int i, row, rowbytes;
+    unsigned offset;
+
+    if (!lm_uploadbuffers[0])
+	qglGenBuffersARB(LM_UPLOAD_BUFFERS, lm_uploadbuffers);
+    lm_uploadbuffer = (lm_uploadbuffer + 1) % LM_UPLOAD_BUFFERS;
+    qglBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB,
+		     lm_uploadbuffers[lm_uploadbuffer]);
+
+    /* Orphan the old contents so the driver needn't wait on them */
+    qglBufferDataARB(GL_PIXEL_UNPACK_BUFFER_ARB, size, NULL,
+		     GL_STREAM_DRAW_ARB);
+    dest = qglMapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+    if (!dest) {
+	qglBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	return false;
+    }
+
+    for (i = 0; i < MAX_LM_BLOCKS; i++) {
+	if (!lm_blocks[i].modified)
+	    continue;
+	rect = &lm_blocks[i].rectchange;
+	rowbytes = R_LightmapRowBytes(rect);
+	offset = (BLOCK_WIDTH * rect->t + rect->l) * lightmap_bytes;
+	src = lm_blocks[i].data + offset;
+	for (row = 0; row < rect->h; row++) {
+	    memcpy(dest, src, rect->w * lightmap_bytes);
+	    dest += rowbytes;
+	    src += BLOCK_WIDTH * lightmap_bytes;
+	}
+    }
+
+    if (!qglUnmapBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB)) {
+	qglBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
+	return false;
+    }
+
+    return true;
+}
+
+static void
+R_UploadLightmaps(void)
+{
+    glRect_t *rect;
+    lm_block_t *block;
+    int i, size;
+    unsigned offset;
+
+    size = 0;
+    for (i = 0; i < MAX_LM_BLOCKS; i++)
+	if (lm_blocks[i].modified)
+	    size += R_LightmapRowBytes(&lm_blocks[i].rectchange)
+		* lm_blocks[i].rectchange.h;
+    if (!size)
+	return;
+
+    if (!gl_pboable || !R_StageLightmaps(size)) {
+	for (i = 0; i < MAX_LM_BLOCKS; i++) {
+	    block = &lm_blocks[i];
+	    if (!block->modified)
+		continue;
+	    GL_Bind(block->texture);
+	    R_UploadLMBlockUpdate(i);
+	    block->modified = false;
+	}
+	return;
+    }
+
+    /* The pixel pointers are offsets into the bound buffer */
+    offset = 0;
+    for (i = 0; i < MAX_LM_BLOCKS; i++) {
+	block = &lm_blocks[i];
+	if (!block->modified)
+	    continue;
+	rect = &block->rectchange;
+	GL_Bind(block->texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect->l, rect->t, rect->w, rect->h,
+			gl_lightmap_format, GL_UNSIGNED_BYTE,
+			(const byte *)NULL + offset);
+	offset += R_LightmapRowBytes(rect) * rect->h;
+
+	c_lightmaps_uploaded++;
+	c_lightmap_bytes += rect->w * rect->h * lightmap_bytes;
+
+	rect->l = BLOCK_WIDTH;
+	rect->t = BLOCK_HEIGHT;
+	rect->h = 0;
+	rect->w = 0;
+	block->modified = false;
+    }
+    qglBindBufferARB(GL_PIXEL_UNPACK_BUFFER_ARB, 0);
 }
 
 /*
@@ -486,6 +688,7 @@ R_BlendLightmaps(void)
 {
     int i;
     glpoly_t *p;
+    qboolean batched;
 
     if (r_drawflat.value)
 	return;
@@ -503,6 +706,12 @@ R_BlendLightmaps(void)
 	glEnable(GL_BLEND);
     }
 
+    R_UploadLightmaps();
+
+    batched = R_BatchesEnabled();
+    if (batched)
+	R_BeginBatches(5, -1);
+
     for (i = 0; i < MAX_LM_BLOCKS; i++) {
 	lm_block_t *block = &lm_blocks[i];
 	if (!block->polys)
@@ -515,11 +724,17 @@ R_BlendLightmaps(void)
 	for (p = block->polys; p; p = p->chain) {
 	    if (WATER_WARP_TEST(p))
 		DrawGLWaterPolyLightmap(p);
+	    else if (batched)
+		R_BatchPoly(p);
 	    else
 		DrawGLPolyLM(p);
 	}
+	R_FlushBatch();
     }
 
+    if (batched)
+	R_EndBatches(false);
+
     glDisable(GL_BLEND);
     if (gl_lightmap_format == GL_LUMINANCE)
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -541,20 +756,26 @@ R_UpdateLightmapBlockRect(msurface_t *fa)
     int smax, tmax;
     lm_block_t *block;
     glRect_t *rect;
+    surfdlight_t dlights[MAX_DLIGHTS];
+    int numdlights;
+    unsigned dlightkey;
 
     if (!r_dynamic.value)
 	return;
 
+    /* The dynamic lights that really reach the lightmap this frame */
+    numdlights = 0;
+    dlightkey = 0;
+    if (fa->dlightframe == r_framecount)
+	numdlights = R_SurfaceDlights(fa, dlights, &dlightkey);
+
     /* Check if any of this surface's lightmaps changed */
     foreach_surf_lightstyle(fa, map)
 	if (d_lightstylevalue[fa->styles[map]] != fa->cached_light[map])
 	    goto dynamic;
 
-    /*
-     * 	fa->dlightframe == r_framecount	=> dynamic this frame
-     *  fa->cached_dlight		=> dynamic previously
-     */
-    if (fa->dlightframe == r_framecount || fa->cached_dlight) {
+    /* Or the dynamic lights differ from the ones in the cache */
+    if (dlightkey != fa->cached_dlight) {
     dynamic:
 	/*
 	 * Record that the lightmap block for this surface has been
@@ -583,7 +804,8 @@ R_UpdateLightmapBlockRect(msurface_t *fa)
 	base = block->data;
 	base += fa->light_t * BLOCK_WIDTH * lightmap_bytes;
 	base += fa->light_s * lightmap_bytes;
-	R_BuildLightMap(fa, base, BLOCK_WIDTH * lightmap_bytes);
+	R_BuildLightMap(fa, base, BLOCK_WIDTH * lightmap_bytes, dlights,
+			numdlights, dlightkey);
     }
 }
 
@@ -716,6 +938,87 @@ R_DrawWaterSurfaces(void)
     }
 }
 
+/*
+================
+R_DrawTextureChainBatched
+
+The batched R_RenderBrushPoly for a whole chain of solid surfaces with one
+texture.  With multitexture, one draw for each lightmap block the chain
+uses; without, the lightmaps are chained up for R_BlendLightmaps.
+================
+*/
+static void
+R_DrawTextureChainBatched(const entity_t *e, msurface_t *chain)
+{
+    int blocks[MAX_LM_BLOCKS];
+    int i, numblocks;
+    lm_block_t *block;
+    msurface_t *s;
+    texture_t *t;
+    qboolean mtex;
+
+    mtex = gl_mtexable && qglClientActiveTextureARB && !r_fullbright.value;
+
+    if (gl_mtexable) {
+	GL_SelectTexture(GL_TEXTURE0_ARB);
+	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    }
+    t = R_TextureAnimation(e, chain->texinfo->texture);
+    GL_Bind(t->gl_texturenum);
+
+    if (!mtex) {
+	R_BeginBatches(3, -1);
+	for (s = chain; s; s = s->texturechain) {
+	    c_brush_polys++;
+	    if (r_fullbright.value) {
+		R_BatchPoly(s->polys);
+		continue;
+	    }
+	    if (WATER_WARP_TEST(s))
+		DrawGLWaterPoly(s->polys);
+	    else
+		R_BatchPoly(s->polys);
+
+	    /* add the poly to the proper lightmap chain */
+	    block = &lm_blocks[s->lightmaptexturenum];
+	    s->polys->chain = block->polys;
+	    block->polys = s->polys;
+
+	    R_UpdateLightmapBlockRect(s);
+	}
+	R_EndBatches(false);
+	return;
+    }
+
+    /* sort the polys onto their lightmap blocks, all up to date already */
+    numblocks = 0;
+    for (s = chain; s; s = s->texturechain) {
+	c_brush_polys++;
+	block = &lm_blocks[s->lightmaptexturenum];
+	if (!block->polys)
+	    blocks[numblocks++] = s->lightmaptexturenum;
+	s->polys->chain = block->polys;
+	block->polys = s->polys;
+    }
+
+    GL_EnableMultitexture();
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_BLEND);
+    R_BeginBatches(3, 5);
+    for (i = 0; i < numblocks; i++) {
+	block = &lm_blocks[blocks[i]];
+	GL_Bind(block->texture);
+	if (block->modified) {
+	    R_UploadLMBlockUpdate(blocks[i]);
+	    block->modified = false;
+	}
+	for (; block->polys; block->polys = block->polys->chain)
+	    R_BatchPoly(block->polys);
+	R_FlushBatch();
+    }
+    R_EndBatches(true);
+    GL_DisableMultitexture();
+}
+
 /*
 ================
 DrawTextureChains
@@ -747,6 +1050,7 @@ DrawTextureChains(const entity_t *e)
 	    for (; s; s = s->texturechain)
 		R_UpdateLightmapBlockRect(s);
 	}
+	R_UploadLightmaps();
     }
 
     for (i = 0; i < cl.worldmodel->numtextures; i++) {
@@ -764,8 +1068,12 @@ DrawTextureChains(const entity_t *e)
 	} else {
 	    if ((s->flags & SURF_DRAWTURB) && r_wateralpha.value != 1.0)
 		continue;	// draw translucent water later
-	    for (; s; s = s->texturechain)
-		R_RenderBrushPoly(e, s);
+	    if (!(s->flags & SURF_DRAWTURB) && R_BatchesEnabled()) {
+		R_DrawTextureChainBatched(e, s);
+	    } else {
+		for (; s; s = s->texturechain)
+		    R_RenderBrushPoly(e, s);
+	    }
 	}
 	t->texturechain = NULL;
     }
@@ -854,6 +1162,8 @@ R_DrawBrushModel(const entity_t *e)
 
     if (R_CullBox(mins, maxs))
 	return;
+    if (R_OccludedBox(mins, maxs))
+	return;
 
     VectorSubtract(r_refdef.vieworg, e->origin, bmodelorg);
     if (rotated) {
@@ -945,6 +1255,231 @@ R_DrawBrushModel(const entity_t *e)
 =============================================================
 */
 
+/*
+ * Occlusion queries.  Each frame the leaves that pass the frustum cull are
+ * listed, and after the world is drawn their bounding boxes are rendered
+ * inside queries against the finished depth buffer.  The next frame skips
+ * a leaf only if its query from the frame before has come back with no
+ * samples passed, so a leaf seen for the first time is always drawn and a
+ * leaf that comes into view shows up one frame late at worst.
+ */
+typedef struct {
+    GLuint query;
+    int queryframe;		// occlusion_framecount when last queried
+    int drawframe;		// r_framecount when last drawn
+} leafquery_t;
+
+static leafquery_t *leafqueries;
+static mleaf_t **queryleafs;
+static int numleafqueries;
+static int numqueryleafs;
+static int occlusion_framecount;
+static const brushmodel_t *leafquerymodel;
+static qboolean occlusion_active;	// set for the world pass of a frame
+
+/*
+================
+R_OcclusionSetup
+
+Makes room for a query per world leaf, forgetting the old results when the
+world model changes.  Returns false if the queries can't be used.
+================
+*/
+static qboolean
+R_OcclusionSetup(void)
+{
+    leafquery_t *queries;
+    mleaf_t **leafs;
+    int i, wanted;
+
+    wanted = cl.worldmodel->numleafs + 1;
+    if (wanted > numleafqueries) {
+	queries = realloc(leafqueries, wanted * sizeof(*queries));
+	if (queries)
+	    leafqueries = queries;
+	leafs = realloc(queryleafs, wanted * sizeof(*leafs));
+	if (leafs)
+	    queryleafs = leafs;
+	if (!queries || !leafs) {
+	    if (!leafqueries || !queryleafs)
+		Sys_Error("%s: out of memory for %d leafs", __func__, wanted);
+	    return false;
+	}
+	for (i = numleafqueries; i < wanted; i++)
+	    qglGenQueriesARB(1, &leafqueries[i].query);
+	numleafqueries = wanted;
+	leafquerymodel = NULL;
+    }
+
+    if (leafquerymodel != cl.worldmodel) {
+	for (i = 0; i < numleafqueries; i++) {
+	    leafqueries[i].queryframe = -1;
+	    leafqueries[i].drawframe = -1;
+	}
+	leafquerymodel = cl.worldmodel;
+    }
+    numqueryleafs = 0;
+
+    return true;
+}
+
+/*
+================
+R_LeafOccluded
+
+Returns true if the leaf's query from the last frame found it hidden, and
+lists the leaf to be queried again this frame
+================
+*/
+static qboolean
+R_LeafOccluded(mleaf_t *leaf)
+{
+    leafquery_t *leafquery;
+    GLuint available, samples;
+
+    leafquery = &leafqueries[leaf - cl.worldmodel->leafs];
+    queryleafs[numqueryleafs++] = leaf;
+
+    if (leafquery->queryframe == occlusion_framecount - 1) {
+	qglGetQueryObjectuivARB(leafquery->query,
+				GL_QUERY_RESULT_AVAILABLE_ARB, &available);
+	if (available) {
+	    qglGetQueryObjectuivARB(leafquery->query, GL_QUERY_RESULT_ARB,
+				    &samples);
+	    if (!samples)
+		return true;
+	}
+    }
+    leafquery->drawframe = r_framecount;
+
+    return false;
+}
+
+/*
+================
+R_IssueOcclusionQueries
+
+Draws the bounds of the leaves listed this frame inside their queries.
+Leaves with the eye in or right next to their bounds are not queried,
+because the near plane can clip the box away while the leaf is in view.
+================
+*/
+static void
+R_IssueOcclusionQueries(void)
+{
+    int i, j;
+    mleaf_t *leaf;
+    leafquery_t *leafquery;
+    vec3_t mins, maxs;
+
+    GL_DisableMultitexture();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_CULL_FACE);
+
+    for (i = 0; i < numqueryleafs; i++) {
+	leaf = queryleafs[i];
+	for (j = 0; j < 3; j++) {
+	    if (r_refdef.vieworg[j] < leaf->mins[j] - 8
+		|| r_refdef.vieworg[j] > leaf->maxs[j] + 8)
+		break;
+	}
+	if (j == 3)
+	    continue;
+
+	for (j = 0; j < 3; j++) {
+	    mins[j] = leaf->mins[j] - 2;
+	    maxs[j] = leaf->maxs[j] + 2;
+	}
+
+	leafquery = &leafqueries[leaf - cl.worldmodel->leafs];
+	leafquery->queryframe = occlusion_framecount;
+	qglBeginQueryARB(GL_SAMPLES_PASSED_ARB, leafquery->query);
+	glBegin(GL_QUADS);
+	glVertex3f(mins[0], mins[1], mins[2]);
+	glVertex3f(maxs[0], mins[1], mins[2]);
+	glVertex3f(maxs[0], maxs[1], mins[2]);
+	glVertex3f(mins[0], maxs[1], mins[2]);
+
+	glVertex3f(mins[0], mins[1], maxs[2]);
+	glVertex3f(mins[0], maxs[1], maxs[2]);
+	glVertex3f(maxs[0], maxs[1], maxs[2]);
+	glVertex3f(maxs[0], mins[1], maxs[2]);
+
+	glVertex3f(mins[0], mins[1], mins[2]);
+	glVertex3f(mins[0], mins[1], maxs[2]);
+	glVertex3f(maxs[0], mins[1], maxs[2]);
+	glVertex3f(maxs[0], mins[1], mins[2]);
+
+	glVertex3f(mins[0], maxs[1], mins[2]);
+	glVertex3f(maxs[0], maxs[1], mins[2]);
+	glVertex3f(maxs[0], maxs[1], maxs[2]);
+	glVertex3f(mins[0], maxs[1], maxs[2]);
+
+	glVertex3f(mins[0], mins[1], mins[2]);
+	glVertex3f(mins[0], maxs[1], mins[2]);
+	glVertex3f(mins[0], maxs[1], maxs[2]);
+	glVertex3f(mins[0], mins[1], maxs[2]);
+
+	glVertex3f(maxs[0], mins[1], mins[2]);
+	glVertex3f(maxs[0], mins[1], maxs[2]);
+	glVertex3f(maxs[0], maxs[1], maxs[2]);
+	glVertex3f(maxs[0], maxs[1], mins[2]);
+	glEnd();
+	qglEndQueryARB(GL_SAMPLES_PASSED_ARB);
+    }
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_TEXTURE_2D);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+/* Leaves outside the pvs or skipped this frame count as hidden */
+static qboolean
+R_OccludedNode(const mnode_t *node, const vec3_t mins, const vec3_t maxs)
+{
+    int sides;
+
+    while (1) {
+	if (node->contents == CONTENTS_SOLID)
+	    return true;
+	if (node->visframe != r_visframecount)
+	    return true;
+	if (node->contents < 0) {
+	    const mleaf_t *leaf = (const mleaf_t *)node;
+	    return leafqueries[leaf - cl.worldmodel->leafs].drawframe
+		!= r_framecount;
+	}
+	sides = BOX_ON_PLANE_SIDE(mins, maxs, node->plane);
+	if (sides == PSIDE_BOTH) {
+	    if (!R_OccludedNode(node->children[0], mins, maxs))
+		return false;
+	    node = node->children[1];
+	} else {
+	    node = node->children[sides == PSIDE_FRONT ? 0 : 1];
+	}
+    }
+}
+
+/*
+=================
+R_OccludedBox
+
+Returns true if every world leaf the box touches was skipped as hidden
+this frame
+=================
+*/
+qboolean
+R_OccludedBox(const vec3_t mins, const vec3_t maxs)
+{
+    if (!occlusion_active)
+	return false;
+
+    return R_OccludedNode(cl.worldmodel->nodes, mins, maxs);
+}
+
 /*
 ================
 R_RecursiveWorldNode
@@ -970,6 +1505,8 @@ R_RecursiveWorldNode(mnode_t *node)
 // if a leaf node, draw stuff
     if (node->contents < 0) {
 	pleaf = (mleaf_t *)node;
+	if (occlusion_active && R_LeafOccluded(pleaf))
+	    return;
 
 	mark = pleaf->firstmarksurface;
 	c = pleaf->nummarksurfaces;
@@ -1042,6 +1579,238 @@ R_RecursiveWorldNode(mnode_t *node)
 }
 
 
+/*
+==============================================================================
+
+SHARED SCENE CULLING
+
+The cube faces of the fisheye globe are rendered from the same origin, one
+after the other (see R_BeginScene), and each would walk the same nodes of
+the world in the same order.  R_CullScene walks the tree once for all of
+them, as the software renderer does: each node is clipped against the
+frustum of every face it may show in, keeping a bit for each, the leaves'
+surfaces are marked and their static entities stored once, and the surfaces
+each face may show are listed in walk order.  Each face's R_DrawWorld then
+only culls its own list against its frustum to build the texture chains.
+
+==============================================================================
+*/
+
+#define MAX_SCENEVIEWS 32
+
+int r_sceneviews;		// views listed by R_CullScene, 0 = none
+
+static struct {
+    mplane_t planes[MAX_SCENEVIEWS][4];
+    qboolean failed;		// out of memory for a list
+    struct {
+	msurface_t **surfs;
+	int count;
+	int size;
+    } lists[MAX_SCENEVIEWS];
+} r_scene;
+
+static void
+R_ListSceneSurf(int view, msurface_t *surf)
+{
+    msurface_t **surfs;
+    int size;
+
+    if (r_scene.lists[view].count == r_scene.lists[view].size) {
+	size = r_scene.lists[view].size ? r_scene.lists[view].size * 2 : 1024;
+	surfs = realloc(r_scene.lists[view].surfs, size * sizeof(*surfs));
+	if (!surfs) {
+	    r_scene.failed = true;
+	    return;
+	}
+	r_scene.lists[view].surfs = surfs;
+	r_scene.lists[view].size = size;
+    }
+    r_scene.lists[view].surfs[r_scene.lists[view].count++] = surf;
+}
+
+/*
+ * Clip a box against the frustum planes of a view still marked in clipflags,
+ * clearing those it is wholly in front of (false if it is behind one)
+ */
+static qboolean
+R_ClipSceneBox(const vec3_t mins, const vec3_t maxs, int view, byte *clipflags)
+{
+    int i, side;
+
+    for (i = 0; i < 4; i++) {
+	if (!(*clipflags & (1 << i)))
+	    continue;
+	side = BoxOnPlaneSide(mins, maxs, &r_scene.planes[view][i]);
+	if (side == PSIDE_BACK)
+	    return false;
+	if (side == PSIDE_FRONT)
+	    *clipflags &= ~(1 << i);
+    }
+
+    return true;
+}
+
+static void
+R_CullSceneNode(mnode_t *node, unsigned viewbits, const byte *parentflags)
+{
+    byte clipflags[MAX_SCENEVIEWS], surfflags;
+    msurface_t *surf, **mark;
+    mplane_t *plane;
+    mleaf_t *leaf;
+    unsigned bit;
+    int i, side, count;
+    double dot;
+
+    if (node->contents == CONTENTS_SOLID)
+	return;
+    if (node->visframe != r_visframecount)
+	return;
+
+    for (i = 0; i < r_sceneviews; i++) {
+	bit = 1U << i;
+	if (!(viewbits & bit))
+	    continue;
+	clipflags[i] = parentflags[i];
+	if (!R_ClipSceneBox(node->mins, node->maxs, i, &clipflags[i]))
+	    viewbits &= ~bit;
+    }
+    node->viewbits = viewbits;
+    if (!viewbits)
+	return;
+
+    if (node->contents < 0) {
+	leaf = (mleaf_t *)node;
+	mark = leaf->firstmarksurface;
+	for (count = leaf->nummarksurfaces; count; count--, mark++)
+	    (*mark)->visframe = r_framecount;
+	if (leaf->efrags)
+	    R_StoreEfrags(&leaf->efrags);
+	return;
+    }
+
+    plane = node->plane;
+    if (plane->type < 3)
+	dot = r_refdef.vieworg[plane->type] - plane->dist;
+    else
+	dot = DotProduct(r_refdef.vieworg, plane->normal) - plane->dist;
+    side = (dot >= 0) ? 0 : 1;
+
+    R_CullSceneNode(node->children[side], viewbits, clipflags);
+
+    surf = cl.worldmodel->surfaces + node->firstsurface;
+    for (count = node->numsurfaces; count; count--, surf++) {
+	if (surf->visframe != r_framecount)
+	    continue;
+
+	/* as in R_RecursiveWorldNode, for every view at once */
+	if (!WATER_WARP_TEST(surf)
+	    && ((dot < 0) ^ !!(surf->flags & SURF_PLANEBACK)))
+	    continue;
+
+	for (i = 0; i < r_sceneviews; i++) {
+	    if (!(viewbits & (1U << i)))
+		continue;
+	    surfflags = clipflags[i];
+	    if (R_ClipSceneBox(surf->mins, surf->maxs, i, &surfflags))
+		R_ListSceneSurf(i, surf);
+	}
+    }
+
+    R_CullSceneNode(node->children[!side], viewbits, clipflags);
+}
+
+/*
+================
+R_CullScene
+
+Cull the world once for the views of a shared scene marked in viewbits.
+View i looks down views[i].forward, and sees out to the tangents of its
+half-FOVs across and up.  Call after R_BeginScene, and render view i with
+r_viewbits set to (1 << i).
+================
+*/
+void
+R_CullScene(const sceneview_t *views, int numviews, unsigned viewbits)
+{
+    byte clipflags[MAX_SCENEVIEWS];
+    mplane_t *plane;
+    float tanx, tany;
+    int i, j;
+
+    r_sceneviews = 0;
+    if (numviews > MAX_SCENEVIEWS)
+	return;
+
+    /* a little wider than the views, to be sure of keeping all they show */
+    for (i = 0; i < numviews; i++) {
+	r_scene.lists[i].count = 0;
+	clipflags[i] = 15;
+	if (!(viewbits & (1U << i)))
+	    continue;
+	tanx = views[i].tanx * 1.02;
+	tany = views[i].tany * 1.02;
+	plane = r_scene.planes[i];
+	for (j = 0; j < 3; j++) {
+	    plane[0].normal[j] = tanx * views[i].forward[j] + views[i].right[j];
+	    plane[1].normal[j] = tanx * views[i].forward[j] - views[i].right[j];
+	    plane[2].normal[j] = tany * views[i].forward[j] + views[i].up[j];
+	    plane[3].normal[j] = tany * views[i].forward[j] - views[i].up[j];
+	}
+	for (j = 0; j < 4; j++) {
+	    VectorNormalize(plane[j].normal);
+	    plane[j].dist = DotProduct(r_refdef.vieworg, plane[j].normal);
+	    plane[j].type = PLANE_ANYZ;
+	    plane[j].signbits = SignbitsForPlane(&plane[j]);
+	}
+    }
+
+    r_sceneviews = numviews;
+    r_scene.failed = false;
+    R_CullSceneNode(cl.worldmodel->nodes, viewbits, clipflags);
+    if (r_scene.failed)
+	r_sceneviews = 0;
+}
+
+/*
+================
+R_SceneView
+
+The view of the shared scene being rendered, if R_CullScene listed it
+(else -1)
+================
+*/
+static int
+R_SceneView(void)
+{
+    int view;
+
+    if (!r_sharedscene || !r_sceneviews || !r_viewbits || mirror)
+	return -1;
+    view = __builtin_ctz(r_viewbits);
+    if (r_viewbits != (1U << view) || view >= r_sceneviews)
+	return -1;
+
+    return view;
+}
+
+/* Chain the surfaces R_CullScene listed for a view that are in its frustum */
+static void
+R_ChainSceneSurfs(int view)
+{
+    msurface_t **listed, **end, *surf;
+
+    listed = r_scene.lists[view].surfs;
+    end = listed + r_scene.lists[view].count;
+    for (; listed < end; listed++) {
+	surf = *listed;
+	if (R_CullBox(surf->mins, surf->maxs))
+	    continue;
+	surf->texturechain = surf->texinfo->texture->texturechain;
+	surf->texinfo->texture->texturechain = surf;
+    }
+}
+
 /*
 =============
 R_DrawWorld
@@ -1050,11 +1819,12 @@ R_DrawWorld
 void
 R_DrawWorld(void)
 {
-    int i;
+    int i, view;
     entity_t ent;
 
     memset(&ent, 0, sizeof(ent));
     ent.model = &cl.worldmodel->model;
+    occlusion_active = false;
 
     VectorCopy(r_refdef.vieworg, bmodelorg);
 
@@ -1083,7 +1853,14 @@ R_DrawWorld(void)
 	glEnable(GL_TEXTURE_2D);
 	glColor3f(1.0, 1.0, 1.0);
     } else {
-	R_RecursiveWorldNode(cl.worldmodel->nodes);
+	view = R_SceneView();
+	occlusion_active = view < 0 && gl_occlusionable && gl_occlusion.value
+	    && !mirror && R_OcclusionSetup();
+
+	if (view >= 0)
+	    R_ChainSceneSurfs(view);
+	else
+	    R_RecursiveWorldNode(cl.worldmodel->nodes);
 
 	if (r_drawflat.value) {
 	    DrawFlatTextureChains();
@@ -1091,7 +1868,14 @@ R_DrawWorld(void)
 	    DrawTextureChains(&ent);
 	    R_BlendLightmaps();
 	}
+
+	if (occlusion_active)
+	    R_IssueOcclusionQueries();
     }
+
+    /* results are only trusted from the frame just before */
+    if (!mirror)
+	occlusion_framecount++;
 }
 
 /*
@@ -1187,6 +1971,8 @@ BuildSurfaceDisplayList(brushmodel_t *brushmodel, msurface_t *surf,
     surf->polys = poly;
     poly->flags = surf->flags;
     poly->numverts = surf->numedges;
+    poly->firstvert = batch_numverts;
+    batch_numverts += poly->numverts;
 
     for (i = 0; i < surf->numedges; i++) {
 	const int edgenum = brushmodel->surfedges[surf->firstedge + i];
@@ -1248,10 +2034,60 @@ GL_CreateSurfaceLightmap(msurface_t *surf)
 	AllocBlock(smax, tmax, &surf->light_s, &surf->light_t);
     base = lm_blocks[surf->lightmaptexturenum].data;
     base += (surf->light_t * BLOCK_WIDTH + surf->light_s) * lightmap_bytes;
-    R_BuildLightMap(surf, base, BLOCK_WIDTH * lightmap_bytes);
+    R_BuildLightMap(surf, base, BLOCK_WIDTH * lightmap_bytes, NULL, 0, 0);
 }
 
 
+/*
+==================
+GL_BuildBatchVerts
+
+Copies the verts of the polys BuildSurfaceDisplayList made into the batch
+vertex array, in the hunk after them and uploaded to a buffer object
+==================
+*/
+static void
+GL_BuildBatchVerts(void *hunkbase)
+{
+    int i, j, size;
+    model_t *model;
+    brushmodel_t *brushmodel;
+    msurface_t *surf;
+    glpoly_t *poly;
+
+    size = batch_numverts * VERTEXSIZE * sizeof(float);
+    batch_verts = Hunk_AllocExtend(hunkbase, size);
+
+    for (j = 1; j < MAX_MODELS; j++) {
+	model = cl.model_precache[j];
+	if (!model)
+	    break;
+	if (model->name[0] == '*')
+	    continue;
+	if (model->type != mod_brush)
+	    continue;
+
+	brushmodel = BrushModel(model);
+	surf = brushmodel->surfaces;
+	for (i = 0; i < brushmodel->numsurfaces; i++, surf++) {
+	    if (surf->flags & (SURF_DRAWTURB | SURF_DRAWSKY))
+		continue;
+	    poly = surf->polys;
+	    memcpy(batch_verts + poly->firstvert * VERTEXSIZE, poly->verts,
+		   poly->numverts * sizeof(poly->verts[0]));
+	}
+    }
+
+    if (gl_vboable) {
+	if (!batch_buffer)
+	    qglGenBuffersARB(1, &batch_buffer);
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, batch_buffer);
+	qglBufferDataARB(GL_ARRAY_BUFFER_ARB, size, batch_verts,
+			 GL_STATIC_DRAW_ARB);
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    }
+}
+
 /*
 ==================
 GL_BuildLightmaps
@@ -1275,6 +2111,8 @@ GL_BuildLightmaps(void *hunkbase)
 
     lm_used = 0;
     alloc_block_time = 0;
+    batch_verts = NULL;
+    batch_numverts = 0;
 
     r_framecount = 1;		// no dlightcache
 
@@ -1338,6 +2176,8 @@ GL_BuildLightmaps(void *hunkbase)
 	}
     }
 
+    GL_BuildBatchVerts(hunkbase);
+
     t2 = Sys_DoubleTime();
     Con_DPrintf("Built LM blocks in %f seconds.(%i surfs).\n", t2 - t1, cnt);
     Con_DPrintf("AllocBlock time spent: %f seconds.\n", alloc_block_time);
@@ -35,22 +35,43 @@ cvar_t gl_max_size = { "gl_max_size", "1024" };
 
 static cvar_t gl_nobind = { "gl_nobind", "0" };
 static cvar_t gl_picmip = { "gl_picmip", "0" };
+static cvar_t gl_sharetextures = { "gl_sharetextures", "1" };
+static cvar_t gl_texcache = { "gl_texcache", "0", true };
 
 int gl_lightmap_format = GL_RGBA;	// 4
 int gl_solid_format = GL_RGB;	// 3
 int gl_alpha_format = GL_RGBA;	// 4
 
+/*
+ * Textures are found by name through a hash table.  A texture whose pixels
+ * and upload settings match one already uploaded under another name (the
+ * same wall texture in several BSPs, say) shares its texture object rather
+ * than being uploaded again, unless gl_sharetextures is 0.  The pixels are
+ * matched by size, CRC and an FNV-1a hash, which together won't collide in
+ * practice.
+ */
 typedef struct {
     GLuint texnum;
     char name[MAX_QPATH];
     int width, height;
     qboolean mipmap;
+    qboolean alpha;
+    byte alphabyte;
     unsigned short crc;		// CRC for texture cache matching
+    unsigned hash;		// ...and an FNV-1a hash of the pixels
+    int namenext;		// next in the name hash chain, or -1
+    int contentnext;		// next in the content hash chain, or -1
+    int owner;			// texture whose upload is shared, or -1
+    int sharers;		// textures sharing this one's upload
+    int bytes;			// uploaded size, 0 if shared
 } gltexture_t;
 
 #define	MAX_GLTEXTURES	4096
+#define	GLTEXTURE_HASH	1024	// a power of two
 static gltexture_t gltextures[MAX_GLTEXTURES];
 static int numgltextures;
+static int gltexture_names[GLTEXTURE_HASH];
+static int gltexture_contents[GLTEXTURE_HASH];
 
 void
 GL_Bind(int texnum)
@@ -146,49 +167,191 @@ GL_TextureMode_Arg_f(const char *arg)
 GL_FindTexture
 ================
 */
+static gltexture_t *
+GL_FindTextureByName(const char *name)
+{
+    gltexture_t *glt;
+    int i;
+
+    i = gltexture_names[COM_HashFileName(name) & (GLTEXTURE_HASH - 1)];
+    for (; i != -1; i = glt->namenext) {
+	glt = &gltextures[i];
+	if (!strcmp(name, glt->name))
+	    return glt;
+    }
+
+    return NULL;
+}
+
 int
 GL_FindTexture(const char *name)
 {
-    int i;
+    const gltexture_t *glt = GL_FindTextureByName(name);
+
+    return glt ? glt->texnum : -1;
+}
+
+static unsigned
+GL_Hash(const void *data, int size)
+{
+    const byte *pixel = data;
+    const byte *const end = pixel + size;
+    unsigned hash = 2166136261u;
+
+    while (pixel < end) {
+	hash ^= *pixel++;
+	hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static unsigned
+GL_HashPixels(const qpic8_t *pic)
+{
+    return GL_Hash(pic->pixels, pic->width * pic->height);
+}
+
+static unsigned
+GL_ContentBucket(unsigned hash)
+{
+    return hash & (GLTEXTURE_HASH - 1);
+}
+
+/* Finds an uploaded texture the same as the one described by match */
+static gltexture_t *
+GL_FindTextureByContent(const gltexture_t *match)
+{
     gltexture_t *glt;
+    int i;
 
-    for (i = 0, glt = gltextures; i < numgltextures; i++, glt++) {
-	if (!strcmp(name, glt->name))
-	    return gltextures[i].texnum;
+    i = gltexture_contents[GL_ContentBucket(match->hash)];
+    for (; i != -1; i = glt->contentnext) {
+	glt = &gltextures[i];
+	if (glt == match || glt->owner != -1)
+	    continue;
+	if (glt->hash != match->hash || glt->crc != match->crc)
+	    continue;
+	if (glt->width != match->width || glt->height != match->height)
+	    continue;
+	if (glt->mipmap != match->mipmap || glt->alpha != match->alpha)
+	    continue;
+	if (glt->alpha && glt->alphabyte != match->alphabyte)
+	    continue;
+	return glt;
     }
 
-    return -1;
+    return NULL;
+}
+
+static void
+GL_UnhashContent(gltexture_t *texture)
+{
+    int *link = &gltexture_contents[GL_ContentBucket(texture->hash)];
+    const int index = texture - gltextures;
+
+    while (*link != -1 && *link != index)
+	link = &gltextures[*link].contentnext;
+    if (*link == index)
+	*link = texture->contentnext;
+}
+
+static void
+GL_HashContent(gltexture_t *texture)
+{
+    int *bucket = &gltexture_contents[GL_ContentBucket(texture->hash)];
+
+    texture->contentnext = *bucket;
+    *bucket = texture - gltextures;
 }
 
 /*
-===============
-GL_Upload32
-===============
-*/
+ * The texture is about to get new pixels.  If its texture object is shared,
+ * it gets one of its own and the others keep the old one, with the first of
+ * them taking over the upload.
+ */
 static void
-GL_Upload32(qpic32_t *pic, qboolean mipmap, qboolean alpha)
+GL_UnshareTexture(gltexture_t *texture)
 {
-    const int format = alpha ? gl_alpha_format : gl_solid_format;
-    qpic32_t *scaled;
-    int width, height, mark;
+    const int index = texture - gltextures;
+    gltexture_t *glt, *heir;
+    int i;
+
+    GL_UnhashContent(texture);
+
+    if (texture->owner != -1) {
+	gltextures[texture->owner].sharers--;
+	texture->owner = -1;
+	glGenTextures(1, &texture->texnum);
+	return;
+    }
+    if (!texture->sharers)
+	return;
+
+    heir = NULL;
+    for (i = 0, glt = gltextures; i < numgltextures; i++, glt++) {
+	if (glt->owner != index)
+	    continue;
+	if (!heir) {
+	    heir = glt;
+	    heir->owner = -1;
+	    heir->bytes = texture->bytes;
+	    heir->sharers = texture->sharers - 1;
+	} else {
+	    glt->owner = heir - gltextures;
+	}
+    }
+    texture->sharers = 0;
+    glGenTextures(1, &texture->texnum);
+}
 
+/* The size a texture is uploaded at */
+static void
+GL_UploadSize(int picwidth, int picheight, int *width, int *height)
+{
     if (!gl_npotable || !gl_npot.value) {
 	/* find the next power-of-two size up */
-	width = 1;
-	while (width < pic->width)
-	    width <<= 1;
-	height = 1;
-	while (height < pic->height)
-	    height <<= 1;
+	*width = 1;
+	while (*width < picwidth)
+	    *width <<= 1;
+	*height = 1;
+	while (*height < picheight)
+	    *height <<= 1;
     } else {
-	width = pic->width;
-	height = pic->height;
+	*width = picwidth;
+	*height = picheight;
     }
 
-    width >>= (int)gl_picmip.value;
-    width = qclamp(width, 1, (int)gl_max_size.value);
-    height >>= (int)gl_picmip.value;
-    height = qclamp(height, 1, (int)gl_max_size.value);
+    *width >>= (int)gl_picmip.value;
+    *width = qclamp(*width, 1, (int)gl_max_size.value);
+    *height >>= (int)gl_picmip.value;
+    *height = qclamp(*height, 1, (int)gl_max_size.value);
+}
+
+static void
+GL_SetFilters(qboolean mipmap)
+{
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		    mipmap ? glmode->min_filter : glmode->mag_filter);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+		    glmode->mag_filter);
+}
+
+/*
+===============
+GL_Upload32
+
+Returns roughly how much texture memory the upload took.  The mipmaps are
+made by the driver if it can.
+===============
+*/
+static int
+GL_Upload32(qpic32_t *pic, qboolean mipmap, GLint format)
+{
+    qpic32_t *scaled;
+    int width, height, mark, bytes;
+
+    GL_UploadSize(pic->width, pic->height, &width, &height);
 
     mark = Hunk_LowMark();
 
@@ -199,33 +362,28 @@ GL_Upload32(qpic32_t *pic, qboolean mipmap, qboolean alpha)
 	scaled = pic;
     }
 
-    if (mipmap) {
+    glTexImage2D(GL_TEXTURE_2D, 0, format, scaled->width, scaled->height, 0,
+		 GL_RGBA, GL_UNSIGNED_BYTE, scaled->pixels);
+    bytes = scaled->width * scaled->height * 4;
+    if (mipmap && gl_genmipmapable) {
+	qglGenerateMipmap(GL_TEXTURE_2D);
+	bytes += bytes / 3;
+    } else if (mipmap) {
 	int miplevel = 0;
-	while (1) {
+	while (scaled->width > 1 || scaled->height > 1) {
+	    QPic32_MipMap(scaled);
+	    miplevel++;
 	    glTexImage2D(GL_TEXTURE_2D, miplevel, format,
 			 scaled->width, scaled->height, 0,
 			 GL_RGBA, GL_UNSIGNED_BYTE, scaled->pixels);
-	    if (scaled->width == 1 && scaled->height == 1)
-		break;
-
-	    QPic32_MipMap(scaled);
-	    miplevel++;
+	    bytes += scaled->width * scaled->height * 4;
 	}
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			glmode->min_filter);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-			glmode->mag_filter);
-    } else {
-	glTexImage2D(GL_TEXTURE_2D, 0, format,
-		     scaled->width, scaled->height, 0,
-		     GL_RGBA, GL_UNSIGNED_BYTE, scaled->pixels);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			glmode->mag_filter);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-			glmode->mag_filter);
     }
+    GL_SetFilters(mipmap);
 
     Hunk_FreeToLowMark(mark);
+
+    return bytes;
 }
 
 /*
@@ -233,19 +391,21 @@ GL_Upload32(qpic32_t *pic, qboolean mipmap, qboolean alpha)
 GL_Upload8
 ===============
 */
-void
+int
 GL_Upload8(const qpic8_t *pic, qboolean mipmap)
 {
     qpic32_t *pic32;
-    int mark;
+    int mark, bytes;
 
     mark = Hunk_LowMark();
 
     pic32 = QPic32_Alloc(pic->width, pic->height);
     QPic_8to32(pic, pic32);
-    GL_Upload32(pic32, mipmap, false);
+    bytes = GL_Upload32(pic32, mipmap, gl_solid_format);
 
     Hunk_FreeToLowMark(mark);
+
+    return bytes;
 }
 
 /*
@@ -253,19 +413,264 @@ GL_Upload8(const qpic8_t *pic, qboolean mipmap)
 GL_Upload8_Alpha
 ===============
 */
-void
+int
 GL_Upload8_Alpha(const qpic8_t *pic, qboolean mipmap, byte alpha)
 {
     qpic32_t *pic32;
-    int mark;
+    int mark, bytes;
 
     mark = Hunk_LowMark();
 
     pic32 = QPic32_Alloc(pic->width, pic->height);
     QPic_8to32_Alpha(pic, pic32, alpha);
-    GL_Upload32(pic32, mipmap, true);
+    bytes = GL_Upload32(pic32, mipmap, gl_alpha_format);
 
     Hunk_FreeToLowMark(mark);
+
+    return bytes;
+}
+
+/*
+==============================================================================
+
+TEXTURE CACHE
+
+With gl_texcache 1 and texture compression in the driver, textures are
+uploaded compressed and the driver's compressed images are saved under
+glquake/textures.  Later loads of the same pixels, with the same palette and
+upload settings, hand the saved images straight back to the driver instead
+of converting, scaling, mipmapping and compressing them again.  Compression
+is lossy, which is why the cache is off by default.
+
+==============================================================================
+*/
+
+typedef struct {
+    unsigned hash;		// of the 8-bit pixels
+    unsigned palette;		// ...and the palette they were converted with
+    int crc;
+    int width, height;
+    int upwidth, upheight;	// as uploaded
+    int mipmap;
+    int alpha, alphabyte;
+    int format;			// the compressed format
+} texcachekey_t;
+
+typedef struct {
+    char magic[4];
+    int levels;
+    texcachekey_t key;
+} texcacheheader_t;
+
+static const char texcache_magic[4] = { 'Q', 'T', 'X', '1' };
+
+static struct {
+    int loads;
+    int saves;
+} texcache_counts;
+
+static void
+GL_TexCacheKey(const gltexture_t *glt, GLenum format, texcachekey_t *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->hash = glt->hash;
+    key->palette = GL_Hash(d_8to24table, sizeof(d_8to24table));
+    key->crc = glt->crc;
+    key->width = glt->width;
+    key->height = glt->height;
+    GL_UploadSize(glt->width, glt->height, &key->upwidth, &key->upheight);
+    key->mipmap = glt->mipmap;
+    key->alpha = glt->alpha;
+    key->alphabyte = glt->alpha ? glt->alphabyte : 0;
+    key->format = format;
+}
+
+static qboolean
+GL_TexCachePath(const texcachekey_t *key, char *path, int length)
+{
+    return snprintf(path, length, "%s/glquake/textures/%08x%08x.tex",
+		    com_gamedir, key->hash, GL_Hash(key, sizeof(*key)))
+	< length;
+}
+
+static int
+GL_TexCacheLevels(const texcachekey_t *key)
+{
+    int levels = 1;
+    int size = qmax(key->upwidth, key->upheight);
+
+    if (!key->mipmap)
+	return 1;
+    while (size > 1) {
+	size >>= 1;
+	levels++;
+    }
+
+    return levels;
+}
+
+/* Returns the bytes uploaded, or 0 if the texture wasn't in the cache */
+static int
+GL_LoadCachedTexture(const texcachekey_t *key)
+{
+    char path[MAX_OSPATH];
+    texcacheheader_t header;
+    byte *data = NULL;
+    int level, width, height, size, maxsize, bytes;
+    FILE *f;
+
+    if (!GL_TexCachePath(key, path, sizeof(path)))
+	return 0;
+    f = fopen(path, "rb");
+    if (!f)
+	return 0;
+
+    bytes = 0;
+    if (fread(&header, sizeof(header), 1, f) != 1)
+	goto out;
+    if (memcmp(header.magic, texcache_magic, sizeof(header.magic)))
+	goto out;
+    if (memcmp(&header.key, key, sizeof(*key)))
+	goto out;
+    if (header.levels != GL_TexCacheLevels(key))
+	goto out;
+
+    width = key->upwidth;
+    height = key->upheight;
+    maxsize = 0;
+    for (level = 0; level < header.levels; level++) {
+	if (fread(&size, sizeof(size), 1, f) != 1 || size <= 0)
+	    goto error;
+	if (size > maxsize) {
+	    byte *grown = realloc(data, size);
+	    if (!grown)
+		goto error;
+	    data = grown;
+	    maxsize = size;
+	}
+	if (fread(data, 1, size, f) != size)
+	    goto error;
+	qglCompressedTexImage2DARB(GL_TEXTURE_2D, level, key->format, width,
+				   height, 0, size, data);
+	bytes += size;
+	width = qmax(width >> 1, 1);
+	height = qmax(height >> 1, 1);
+    }
+    GL_SetFilters(key->mipmap);
+    texcache_counts.loads++;
+    goto out;
+
+ error:
+    /* the caller uploads the texture again, over what was loaded */
+    Con_DPrintf("Bad texture cache file %s\n", path);
+    bytes = 0;
+ out:
+    free(data);
+    fclose(f);
+
+    return bytes;
+}
+
+/*
+ * Saves the compressed images of the texture just uploaded.  Returns their
+ * size, or 0 if the driver didn't compress it.
+ */
+static int
+GL_SaveCachedTexture(const texcachekey_t *key)
+{
+    char path[MAX_OSPATH];
+    texcacheheader_t header;
+    byte *data = NULL;
+    GLint compressed, size;
+    int level, maxsize, bytes;
+    qboolean failed;
+    FILE *f;
+
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED_ARB,
+			     &compressed);
+    if (!compressed)
+	return 0;
+
+    f = NULL;
+    if (GL_TexCachePath(key, path, sizeof(path))) {
+	COM_CreatePath(path);
+	f = fopen(path, "wb");
+    }
+
+    memcpy(header.magic, texcache_magic, sizeof(header.magic));
+    header.levels = GL_TexCacheLevels(key);
+    header.key = *key;
+    if (f)
+	fwrite(&header, sizeof(header), 1, f);
+
+    bytes = maxsize = 0;
+    failed = false;
+    for (level = 0; level < header.levels; level++) {
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+				 GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB, &size);
+	bytes += size;
+	if (!f || failed)
+	    continue;
+	if (size > maxsize) {
+	    byte *grown = realloc(data, size);
+	    if (!grown) {
+		failed = true;
+		continue;
+	    }
+	    data = grown;
+	    maxsize = size;
+	}
+	qglGetCompressedTexImageARB(GL_TEXTURE_2D, level, data);
+	fwrite(&size, sizeof(size), 1, f);
+	fwrite(data, 1, size, f);
+    }
+    free(data);
+
+    if (f) {
+	failed |= ferror(f);
+	fclose(f);
+	if (failed)
+	    remove(path);
+	else
+	    texcache_counts.saves++;
+    }
+
+    return bytes;
+}
+
+/* Uploads the texture, through the cache if it's on */
+static int
+GL_UploadTexture(const gltexture_t *glt, const qpic8_t *pic)
+{
+    texcachekey_t key;
+    qpic32_t *pic32;
+    GLenum format;
+    int mark, bytes, compressed;
+
+    format = glt->alpha ? gl_compressed_alpha_format : gl_compressed_format;
+    if (!gl_texcache.value || !format) {
+	if (glt->alpha)
+	    return GL_Upload8_Alpha(pic, glt->mipmap, glt->alphabyte);
+	return GL_Upload8(pic, glt->mipmap);
+    }
+
+    GL_TexCacheKey(glt, format, &key);
+    bytes = GL_LoadCachedTexture(&key);
+    if (bytes)
+	return bytes;
+
+    mark = Hunk_LowMark();
+    pic32 = QPic32_Alloc(pic->width, pic->height);
+    if (glt->alpha)
+	QPic_8to32_Alpha(pic, pic32, glt->alphabyte);
+    else
+	QPic_8to32(pic, pic32);
+    bytes = GL_Upload32(pic32, glt->mipmap, format);
+    Hunk_FreeToLowMark(mark);
+
+    compressed = GL_SaveCachedTexture(&key);
+
+    return compressed ? compressed : bytes;
 }
 
 /*
@@ -278,56 +683,74 @@ static int
 GL_LoadTexture_(const char *name, const qpic8_t *pic, qboolean mipmap,
 		qboolean alpha, byte alphabyte)
 {
-    int i;
-    gltexture_t *glt;
+    gltexture_t *glt, *shared;
+    qboolean added = false;
     unsigned short crc;
+    unsigned hash;
+    int *bucket;
 
     crc = CRC_Block(pic->pixels, pic->width * pic->height);
+    hash = GL_HashPixels(pic);
 
     // see if the texture is already present
-    if (name[0]) {
-	for (i = 0, glt = gltextures; i < numgltextures; i++, glt++) {
-	    if (!strcmp(name, glt->name)) {
-		if (crc != glt->crc)
-		    goto GL_LoadTexture_setup;
-		if (pic->width != glt->width || pic->height != glt->height)
-		    goto GL_LoadTexture_setup;
-		return glt->texnum;
-	    }
+    glt = name[0] ? GL_FindTextureByName(name) : NULL;
+    if (glt) {
+	if (crc == glt->crc && hash == glt->hash
+	    && pic->width == glt->width && pic->height == glt->height)
+	    return glt->texnum;
+	GL_UnshareTexture(glt);
+    } else {
+	if (numgltextures == MAX_GLTEXTURES)
+	    Sys_Error("numgltextures == MAX_GLTEXTURES");
+
+	glt = &gltextures[numgltextures];
+	numgltextures++;
+
+	strncpy(glt->name, name, sizeof(glt->name) - 1);
+	glt->name[sizeof(glt->name) - 1] = '\0';
+	glt->owner = -1;
+	glt->sharers = 0;
+	if (name[0]) {
+	    bucket = &gltexture_names[COM_HashFileName(name) & (GLTEXTURE_HASH - 1)];
+	    glt->namenext = *bucket;
+	    *bucket = glt - gltextures;
+	} else {
+	    glt->namenext = -1;
 	}
+	glGenTextures(1, &glt->texnum);
+	added = true;
     }
 
-    if (numgltextures == MAX_GLTEXTURES)
-	Sys_Error("numgltextures == MAX_GLTEXTURES");
-
-    glt = &gltextures[numgltextures];
-    numgltextures++;
-
-    strncpy(glt->name, name, sizeof(glt->name) - 1);
-    glt->name[sizeof(glt->name) - 1] = '\0';
-
-    glGenTextures(1, &glt->texnum);
-
-  GL_LoadTexture_setup:
     glt->crc = crc;
+    glt->hash = hash;
     glt->width = pic->width;
     glt->height = pic->height;
     glt->mipmap = mipmap;
+    glt->alpha = alpha;
+    glt->alphabyte = alphabyte;
+    glt->bytes = 0;
+
+    /* a texture loaded again under its name keeps its texnum */
+    shared = NULL;
+    if (added && gl_sharetextures.value)
+	shared = GL_FindTextureByContent(glt);
+    GL_HashContent(glt);
+    if (shared) {
+	glDeleteTextures(1, &glt->texnum);
+	glt->texnum = shared->texnum;
+	glt->owner = shared - gltextures;
+	shared->sharers++;
+	return glt->texnum;
+    }
 
 #ifdef NQ_HACK
     if (!isDedicated) {
 	GL_Bind(glt->texnum);
-	if (alpha)
-	    GL_Upload8_Alpha(pic, mipmap, alphabyte);
-	else
-	    GL_Upload8(pic, mipmap);
+	glt->bytes = GL_UploadTexture(glt, pic);
     }
 #else
     GL_Bind(glt->texnum);
-    if (alpha)
-	GL_Upload8_Alpha(pic, mipmap, alphabyte);
-    else
-	GL_Upload8(pic, mipmap);
+    glt->bytes = GL_UploadTexture(glt, pic);
 #endif
 
     return glt->texnum;
@@ -346,16 +769,52 @@ GL_LoadTexture_Alpha(const char *name, const qpic8_t *pic, qboolean mipmap,
     return GL_LoadTexture_(name, pic, mipmap, true, alpha);
 }
 
+/*
+================
+GL_TextureStats_f
+================
+*/
+static void
+GL_TextureStats_f(void)
+{
+    const gltexture_t *glt;
+    int i, uploads, shared, bytes, saved;
+
+    uploads = shared = bytes = saved = 0;
+    for (i = 0, glt = gltextures; i < numgltextures; i++, glt++) {
+	if (glt->owner == -1) {
+	    uploads++;
+	    bytes += glt->bytes;
+	} else {
+	    shared++;
+	    saved += gltextures[glt->owner].bytes;
+	}
+    }
+
+    Con_Printf("%d textures, %d uploads, %.1f MB\n", numgltextures, uploads,
+	       bytes / (1024.0f * 1024.0f));
+    Con_Printf("%d duplicates shared an upload, %.1f MB saved\n", shared,
+	       saved / (1024.0f * 1024.0f));
+    if (gl_texcache.value)
+	Con_Printf("texture cache: %d loaded, %d saved\n",
+		   texcache_counts.loads, texcache_counts.saves);
+}
+
 void
 GL_InitTextures(void)
 {
     GLint max_size;
+    int i;
 
     glmode = gl_texturemodes;
+    for (i = 0; i < GLTEXTURE_HASH; i++)
+	gltexture_names[i] = gltexture_contents[i] = -1;
 
     Cvar_RegisterVariable(&gl_nobind);
     Cvar_RegisterVariable(&gl_max_size);
     Cvar_RegisterVariable(&gl_picmip);
+    Cvar_RegisterVariable(&gl_sharetextures);
+    Cvar_RegisterVariable(&gl_texcache);
 
     // FIXME - could do better to check on each texture upload with
     //         GL_PROXY_TEXTURE_2D
@@ -368,4 +827,5 @@ GL_InitTextures(void)
 
     Cmd_AddCommand("gl_texturemode", GL_TextureMode_f);
     Cmd_SetCompletion("gl_texturemode", GL_TextureMode_Arg_f);
+    Cmd_AddCommand("gl_texturestats", GL_TextureStats_f);
 }
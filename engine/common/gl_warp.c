@@ -35,6 +35,116 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static float speedscale;	// for top sky and bottom sky
 static float speedscale2;	// for sky alpha layer using multitexture
 
+/*
+ * With fragment shaders the turbulence and the sky projection are worked
+ * out per pixel from the texture coords or the position, the same sums as
+ * the per vertex loops below, so the surfaces don't need to be subdivided
+ * and the sky is one pass over both layers.
+ */
+static const char *turb_vertexshader =
+    "varying vec2 st;\n"
+    "void main()\n"
+    "{\n"
+    "    st = gl_MultiTexCoord0.xy;\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+static const char *turb_fragmentshader =
+    "uniform sampler2D warptexture;\n"
+    "uniform float time;\n"
+    "varying vec2 st;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 warp = st + 8.0 * sin(st.ts * 0.125 + time);\n"
+    "    vec4 color = texture2D(warptexture, warp * (1.0 / 64.0));\n"
+    "    gl_FragColor = vec4(color.rgb, color.a * gl_Color.a);\n"
+    "}\n";
+
+static const char *sky_vertexshader =
+    "varying vec3 position;\n"
+    "void main()\n"
+    "{\n"
+    "    position = gl_Vertex.xyz;\n"
+    "    gl_Position = ftransform();\n"
+    "}\n";
+
+static const char *sky_fragmentshader =
+    "uniform sampler2D solidtexture;\n"
+    "uniform sampler2D alphatexture;\n"
+    "uniform vec3 origin;\n"
+    "uniform float solidscroll;\n"
+    "uniform float alphascroll;\n"
+    "varying vec3 position;\n"
+    "void main()\n"
+    "{\n"
+    "    vec3 dir = position - origin;\n"
+    "    dir.z *= 3.0;\n"	/* flatten the sphere */
+    "    vec2 st = dir.xy * (6.0 * 63.0 / length(dir));\n"
+    "    vec4 solid = texture2D(solidtexture, (st + solidscroll) / 128.0);\n"
+    "    vec4 alpha = texture2D(alphatexture, (st + alphascroll) / 128.0);\n"
+    "    gl_FragColor = vec4(mix(solid.rgb, alpha.rgb, alpha.a), 1.0);\n"
+    "}\n";
+
+static struct {
+    GLuint turb;
+    GLint turb_time;
+    GLuint sky;
+    GLint sky_origin;
+    GLint sky_solidscroll;
+    GLint sky_alphascroll;
+    qboolean failed;
+} warp_shaders;
+
+static qboolean
+R_WarpShaderInit(void)
+{
+    if (warp_shaders.turb)
+	return true;
+    if (warp_shaders.failed)
+	return false;
+
+    warp_shaders.turb = GL_LoadProgram("Water warp", turb_vertexshader,
+				       turb_fragmentshader, NULL);
+    warp_shaders.sky = GL_LoadProgram("Sky", sky_vertexshader,
+				      sky_fragmentshader, NULL);
+    if (!warp_shaders.turb || !warp_shaders.sky) {
+	warp_shaders.turb = warp_shaders.sky = 0;
+	warp_shaders.failed = true;
+	return false;
+    }
+
+    qglUseProgram(warp_shaders.turb);
+    qglUniform1i(qglGetUniformLocation(warp_shaders.turb, "warptexture"), 0);
+    warp_shaders.turb_time = qglGetUniformLocation(warp_shaders.turb, "time");
+
+    qglUseProgram(warp_shaders.sky);
+    qglUniform1i(qglGetUniformLocation(warp_shaders.sky, "solidtexture"), 0);
+    qglUniform1i(qglGetUniformLocation(warp_shaders.sky, "alphatexture"), 1);
+    warp_shaders.sky_origin =
+	qglGetUniformLocation(warp_shaders.sky, "origin");
+    warp_shaders.sky_solidscroll =
+	qglGetUniformLocation(warp_shaders.sky, "solidscroll");
+    warp_shaders.sky_alphascroll =
+	qglGetUniformLocation(warp_shaders.sky, "alphascroll");
+    qglUseProgram(0);
+
+    return true;
+}
+
+static qboolean
+R_WarpShaders(void)
+{
+    return gl_fragshaderable && gl_glslwarp.value && R_WarpShaderInit();
+}
+
+/* The sky shader reads both layers at once from two texture units */
+static qboolean
+R_SkyShaders(void)
+{
+    return gl_mtexable && R_WarpShaders();
+}
+
 static void
 BoundPoly(int numverts, float *verts, vec3_t mins, vec3_t maxs)
 {
@@ -55,7 +165,7 @@ BoundPoly(int numverts, float *verts, vec3_t mins, vec3_t maxs)
 
 static void
 SubdividePolygon(msurface_t *surf, int numverts, vec_t *verts,
-		 const char *hunkname)
+		 float subdivide, const char *hunkname)
 {
     int i, j, k, memsize;
     vec3_t mins, maxs;
@@ -73,10 +183,10 @@ SubdividePolygon(msurface_t *surf, int numverts, vec_t *verts,
 
     BoundPoly(numverts, verts, mins, maxs);
 
-    for (i = 0; i < 3; i++) {
+    for (i = 0; subdivide && i < 3; i++) {
 	m = (mins[i] + maxs[i]) * 0.5;
-	m = floor(m / gl_subdivide_size.value + 0.5);
-	m *= gl_subdivide_size.value;
+	m = floor(m / subdivide + 0.5);
+	m *= subdivide;
 	if (maxs[i] - m < 8)
 	    continue;
 	if (m - mins[i] < 8)
@@ -116,8 +226,8 @@ SubdividePolygon(msurface_t *surf, int numverts, vec_t *verts,
 	    }
 	}
 
-	SubdividePolygon(surf, front_count, front[0], hunkname);
-	SubdividePolygon(surf, back_count, back[0], hunkname);
+	SubdividePolygon(surf, front_count, front[0], subdivide, hunkname);
+	SubdividePolygon(surf, back_count, back[0], subdivide, hunkname);
 	return;
     }
 
@@ -141,7 +251,8 @@ GL_SubdivideSurface
 
 Breaks a polygon up along axial 64 unit
 boundaries so that turbulent and sky warps
-can be done reasonably.
+can be done reasonably.  Not needed when the
+warps are done per pixel by the shaders.
 ================
 */
 void
@@ -152,6 +263,7 @@ GL_SubdivideSurface(brushmodel_t *brushmodel, msurface_t *surf)
     vec3_t verts[64]; /* FIXME!!! */
     int i, edge, numverts;
     vec_t *vert;
+    float subdivide;
 
     COM_FileBase(model->name, hunkname, sizeof(hunkname));
 
@@ -168,7 +280,15 @@ GL_SubdivideSurface(brushmodel_t *brushmodel, msurface_t *surf)
 	VectorCopy(vert, verts[numverts]);
 	numverts++;
     }
-    SubdividePolygon(surf, numverts, verts[0], hunkname);
+
+    subdivide = gl_subdivide_size.value;
+    if (surf->flags & SURF_DRAWSKY) {
+	if (R_SkyShaders())
+	    subdivide = 0;
+    } else if (R_WarpShaders()) {
+	subdivide = 0;
+    }
+    SubdividePolygon(surf, numverts, verts[0], subdivide, hunkname);
 }
 
 //=========================================================
@@ -197,6 +317,22 @@ EmitWaterPolys(msurface_t *fa)
     int i;
     float s, t, os, ot;
 
+    if (R_WarpShaders()) {
+	qglUseProgram(warp_shaders.turb);
+	qglUniform1f(warp_shaders.turb_time, realtime);
+	for (p = fa->polys; p; p = p->next) {
+	    glBegin(GL_POLYGON);
+	    v = p->verts[0];
+	    for (i = 0; i < p->numverts; i++, v += VERTEXSIZE) {
+		glTexCoord2f(v[3], v[4]);
+		glVertex3fv(v);
+	    }
+	    glEnd();
+	}
+	qglUseProgram(0);
+	return;
+    }
+
     for (p = fa->polys; p; p = p->next) {
 	glBegin(GL_POLYGON);
 	for (i = 0, v = p->verts[0]; i < p->numverts; i++, v += VERTEXSIZE) {
@@ -298,6 +434,51 @@ EmitSkyPolysMtex(msurface_t *fa)
     }
 }
 
+/*
+=================
+EmitSkyChainShader
+
+Draws both sky layers in one pass, for the one surface or the whole chain
+=================
+*/
+static void
+EmitSkyChainShader(msurface_t *s, qboolean chain)
+{
+    texture_t *t = s->texinfo->texture;
+    glpoly_t *p;
+    float *v;
+    int i;
+
+    GL_DisableMultitexture();
+    GL_SelectTexture(GL_TEXTURE1_ARB);
+    GL_Bind(t->gl_texturenum_alpha);
+    GL_SelectTexture(GL_TEXTURE0_ARB);
+    GL_Bind(t->gl_texturenum);
+
+    speedscale = realtime * 8;
+    speedscale -= (int)speedscale & ~127;
+    speedscale2 = realtime * 16;
+    speedscale2 -= (int)speedscale2 & ~127;
+
+    qglUseProgram(warp_shaders.sky);
+    qglUniform3f(warp_shaders.sky_origin, r_origin[0], r_origin[1],
+		 r_origin[2]);
+    qglUniform1f(warp_shaders.sky_solidscroll, speedscale);
+    qglUniform1f(warp_shaders.sky_alphascroll, speedscale2);
+
+    for (; s; s = chain ? s->texturechain : NULL) {
+	for (p = s->polys; p; p = p->next) {
+	    glBegin(GL_POLYGON);
+	    v = p->verts[0];
+	    for (i = 0; i < p->numverts; i++, v += VERTEXSIZE)
+		glVertex3fv(v);
+	    glEnd();
+	}
+    }
+
+    qglUseProgram(0);
+}
+
 /*
 ===============
 EmitBothSkyLayers
@@ -312,6 +493,11 @@ EmitBothSkyLayers(msurface_t *fa)
 {
     texture_t *t = fa->texinfo->texture;
 
+    if (R_SkyShaders()) {
+	EmitSkyChainShader(fa, false);
+	return;
+    }
+
     GL_DisableMultitexture();
 
     GL_Bind(t->gl_texturenum);
@@ -341,6 +527,11 @@ R_DrawSkyChain(msurface_t *s)
     msurface_t *fa;
     texture_t *t = s->texinfo->texture;
 
+    if (R_SkyShaders()) {
+	EmitSkyChainShader(s, true);
+	return;
+    }
+
     if (gl_mtexable) {
 	GL_SelectTexture(GL_TEXTURE0_ARB);
 	GL_Bind(t->gl_texturenum);
@@ -0,0 +1,603 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// imgwrite.c -- image encoders, and a background thread to write them
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "client.h"
+#include "common.h"
+#include "console.h"
+#include "imgwrite.h"
+#include "quakedef.h"
+
+/*
+==============================================================================
+
+ENCODERS
+
+==============================================================================
+*/
+
+static unsigned crc_table[256];
+
+static unsigned
+IMG_UpdateCRC(unsigned crc, const byte *data, size_t len)
+{
+    unsigned n, c;
+    size_t i;
+    int k;
+
+    if (!crc_table[1]) {
+	for (n = 0; n < 256; n++) {
+	    c = n;
+	    for (k = 0; k < 8; k++)
+		c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+	    crc_table[n] = c;
+	}
+    }
+    for (i = 0; i < len; i++)
+	crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static void
+IMG_PutBigLong(byte *out, unsigned v)
+{
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+static void
+IMG_WritePNGChunk(FILE *f, const char *type, const byte *data, unsigned len)
+{
+    byte word[4];
+    unsigned crc;
+
+    IMG_PutBigLong(word, len);
+    fwrite(word, 1, 4, f);
+    fwrite(type, 1, 4, f);
+    if (len)
+	fwrite(data, 1, len, f);
+    crc = IMG_UpdateCRC(0xffffffffu, (const byte *)type, 4);
+    IMG_PutBigLong(word, IMG_UpdateCRC(crc, data, len) ^ 0xffffffffu);
+    fwrite(word, 1, 4, f);
+}
+
+/*
+==============
+IMG_WritePNG
+
+The image data is a zlib stream of stored blocks, each row behind a "none"
+filter byte.  Paletted images stay paletted, so they are still a third of
+the size of rgb.
+==============
+*/
+qboolean
+IMG_WritePNG(FILE *f, const byte *pixels, int width, int height, int bytes,
+	     const byte *palette)
+{
+    static const byte signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    byte header[13];
+    byte *data, *out;
+    size_t rowsize, raw, pos, len;
+    unsigned a, b, n, i;
+    int numblocks, x, y;
+    byte c;
+
+    rowsize = (size_t)width * bytes + 1;
+    raw = rowsize * height;
+    numblocks = (raw + 65534) / 65535;
+    len = 2 + raw + 5 * numblocks + 4;
+    data = malloc(len);
+    if (!data)
+	return false;
+
+    fwrite(signature, 1, 8, f);
+    IMG_PutBigLong(header, width);
+    IMG_PutBigLong(header + 4, height);
+    header[8] = 8;			// bits per sample
+    header[9] = bytes == 1 ? 3 : 2;	// paletted or rgb
+    header[10] = header[11] = header[12] = 0;
+    IMG_WritePNGChunk(f, "IHDR", header, 13);
+    if (bytes == 1)
+	IMG_WritePNGChunk(f, "PLTE", palette, 768);
+
+    out = data;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    a = 1;
+    b = 0;
+    pos = 0;
+    x = y = 0;
+    while (pos < raw) {
+	n = (raw - pos < 65535) ? raw - pos : 65535;
+	*out++ = (pos + n == raw);	// last block?
+	*out++ = n & 0xff;
+	*out++ = n >> 8;
+	*out++ = ~n & 0xff;
+	*out++ = (~n >> 8) & 0xff;
+	for (i = 0; i < n; i++, pos++) {
+	    c = x ? pixels[y * (rowsize - 1) + x - 1] : 0;
+	    if (++x == (int)rowsize) {
+		x = 0;
+		y++;
+	    }
+	    *out++ = c;
+	    a = (a + c) % 65521;
+	    b = (b + a) % 65521;
+	}
+    }
+    IMG_PutBigLong(out, (b << 16) | a);
+    IMG_WritePNGChunk(f, "IDAT", data, len);
+    IMG_WritePNGChunk(f, "IEND", NULL, 0);
+    free(data);
+
+    return !ferror(f);
+}
+
+/*
+==============
+IMG_WritePCX
+==============
+*/
+qboolean
+IMG_WritePCX(FILE *f, const byte *pixels, int width, int height,
+	     const byte *palette)
+{
+    int i, j, length;
+    pcx_t *pcx;
+    byte *pack;
+
+    pcx = malloc(width * height * 2 + 1000);
+    if (!pcx)
+	return false;
+
+    pcx->manufacturer = 0x0a;	// PCX id
+    pcx->version = 5;		// 256 color
+    pcx->encoding = 1;		// uncompressed
+    pcx->bits_per_pixel = 8;	// 256 color
+    pcx->xmin = 0;
+    pcx->ymin = 0;
+    pcx->xmax = LittleShort((short)(width - 1));
+    pcx->ymax = LittleShort((short)(height - 1));
+    pcx->hres = LittleShort((short)width);
+    pcx->vres = LittleShort((short)height);
+    memset(pcx->palette, 0, sizeof(pcx->palette));
+    pcx->color_planes = 1;	// chunky image
+    pcx->bytes_per_line = LittleShort((short)width);
+    pcx->palette_type = LittleShort(1);	// not a grey scale
+    memset(pcx->filler, 0, sizeof(pcx->filler));
+
+    // pack the image
+    pack = &pcx->data;
+    for (i = 0; i < height; i++) {
+	for (j = 0; j < width; j++) {
+	    if ((*pixels & 0xc0) == 0xc0)
+		*pack++ = 0xc1;
+	    *pack++ = *pixels++;
+	}
+    }
+
+    // write the palette
+    *pack++ = 0x0c;		// palette ID byte
+    memcpy(pack, palette, 768);
+    pack += 768;
+
+    length = pack - (byte *)pcx;
+    fwrite(pcx, 1, length, f);
+    free(pcx);
+
+    return !ferror(f);
+}
+
+/*
+==============
+IMG_WriteTGA
+
+Uncompressed 24 bit, from the top down
+==============
+*/
+qboolean
+IMG_WriteTGA(FILE *f, const byte *pixels, int width, int height, int bytes,
+	     const byte *palette)
+{
+    byte header[18];
+    byte *row;
+    const byte *rgb;
+    int x, y;
+
+    row = malloc(width * 3);
+    if (!row)
+	return false;
+
+    memset(header, 0, sizeof(header));
+    header[2] = 2;		// uncompressed type
+    header[12] = width & 255;
+    header[13] = width >> 8;
+    header[14] = height & 255;
+    header[15] = height >> 8;
+    header[16] = 24;		// pixel size
+    header[17] = 0x20;		// top left origin
+    fwrite(header, 1, sizeof(header), f);
+
+    for (y = 0; y < height; y++) {
+	for (x = 0; x < width; x++) {
+	    rgb = bytes == 1 ? palette + pixels[x] * 3 : pixels + x * 3;
+	    row[x * 3] = rgb[2];
+	    row[x * 3 + 1] = rgb[1];
+	    row[x * 3 + 2] = rgb[0];
+	}
+	fwrite(row, 1, width * 3, f);
+	pixels += width * bytes;
+    }
+    free(row);
+
+    return !ferror(f);
+}
+
+/*
+==============
+IMG_WritePPM
+
+Binary rgb, as read by most video encoders from a pipe
+==============
+*/
+qboolean
+IMG_WritePPM(FILE *f, const byte *pixels, int width, int height, int bytes,
+	     const byte *palette)
+{
+    byte *row;
+    int x, y;
+
+    row = malloc(width * 3);
+    if (!row)
+	return false;
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for (y = 0; y < height; y++) {
+	if (bytes == 1) {
+	    for (x = 0; x < width; x++)
+		memcpy(row + x * 3, palette + pixels[x] * 3, 3);
+	    fwrite(row, 1, width * 3, f);
+	} else {
+	    fwrite(pixels, 1, width * 3, f);
+	}
+	pixels += width * bytes;
+    }
+    free(row);
+
+    return !ferror(f);
+}
+
+const char *
+IMG_Extension(imgformat_t format)
+{
+    switch (format) {
+    case IMG_TGA:
+	return "tga";
+    case IMG_PNG:
+	return "png";
+    default:
+	return "pcx";
+    }
+}
+
+/*
+==============================================================================
+
+BACKGROUND WRITER
+
+Images are copied into a slot of a small pool (keeping their buffers for the
+next save) and encoded and written by one thread, so saving doesn't hold up
+the frame.  The main thread reports finished slots and frees them.
+
+==============================================================================
+*/
+
+#define IMG_SLOTS 8
+
+typedef enum { SLOT_FREE, SLOT_QUEUED, SLOT_WRITING, SLOT_DONE } slotstate_t;
+
+typedef struct {
+    slotstate_t state;
+    qboolean ok;
+    FILE *file;
+    char filename[MAX_OSPATH];
+    imgformat_t format;
+    int width, height, bytes;
+    byte *pixels;
+    int size;			// allocated size of pixels
+    byte palette[768];
+} imgslot_t;
+
+static struct {
+    qboolean started;
+    qboolean quit;
+    imgslot_t slots[IMG_SLOTS];
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} img_writer;
+
+#ifdef _WIN32
+#define IMG_Lock()	EnterCriticalSection(&img_writer.lock)
+#define IMG_Unlock()	LeaveCriticalSection(&img_writer.lock)
+#define IMG_Wait()	SleepConditionVariableCS(&img_writer.changed, &img_writer.lock, INFINITE)
+#define IMG_Signal()	WakeAllConditionVariable(&img_writer.changed)
+#else
+#define IMG_Lock()	pthread_mutex_lock(&img_writer.lock)
+#define IMG_Unlock()	pthread_mutex_unlock(&img_writer.lock)
+#define IMG_Wait()	pthread_cond_wait(&img_writer.changed, &img_writer.lock)
+#define IMG_Signal()	pthread_cond_broadcast(&img_writer.changed)
+#endif
+
+static void
+IMG_WriteSlot(imgslot_t *slot)
+{
+    switch (slot->format) {
+    case IMG_PNG:
+	slot->ok = IMG_WritePNG(slot->file, slot->pixels, slot->width,
+				slot->height, slot->bytes, slot->palette);
+	break;
+    case IMG_TGA:
+	slot->ok = IMG_WriteTGA(slot->file, slot->pixels, slot->width,
+				slot->height, slot->bytes, slot->palette);
+	break;
+    default:
+	slot->ok = IMG_WritePCX(slot->file, slot->pixels, slot->width,
+				slot->height, slot->palette);
+	break;
+    }
+    if (fclose(slot->file))
+	slot->ok = false;
+    slot->file = NULL;
+}
+
+static void
+IMG_RunWriter(void)
+{
+    imgslot_t *slot;
+    int i;
+
+    IMG_Lock();
+    for (;;) {
+	slot = NULL;
+	for (i = 0; i < IMG_SLOTS && !slot; i++)
+	    if (img_writer.slots[i].state == SLOT_QUEUED)
+		slot = &img_writer.slots[i];
+	if (!slot) {
+	    if (img_writer.quit)
+		break;
+	    IMG_Wait();
+	    continue;
+	}
+	slot->state = SLOT_WRITING;
+	IMG_Unlock();
+
+	IMG_WriteSlot(slot);
+
+	IMG_Lock();
+	slot->state = SLOT_DONE;
+	IMG_Signal();
+    }
+    IMG_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+IMG_WriterMain(LPVOID arg)
+{
+    IMG_RunWriter();
+    return 0;
+}
+#else
+static void *
+IMG_WriterMain(void *arg)
+{
+    IMG_RunWriter();
+    return NULL;
+}
+#endif
+
+static qboolean
+IMG_StartWriter(void)
+{
+    if (img_writer.started)
+	return true;
+
+    img_writer.quit = false;
+#ifdef _WIN32
+    InitializeCriticalSection(&img_writer.lock);
+    InitializeConditionVariable(&img_writer.changed);
+    img_writer.thread = CreateThread(NULL, 0, IMG_WriterMain, NULL, 0, NULL);
+    img_writer.started = img_writer.thread != NULL;
+#else
+    pthread_mutex_init(&img_writer.lock, NULL);
+    pthread_cond_init(&img_writer.changed, NULL);
+    img_writer.started =
+	!pthread_create(&img_writer.thread, NULL, IMG_WriterMain, NULL);
+#endif
+
+    return img_writer.started;
+}
+
+/* caller holds the lock */
+static void
+IMG_ReportDone(void)
+{
+    imgslot_t *slot;
+    int i;
+
+    for (i = 0; i < IMG_SLOTS; i++) {
+	slot = &img_writer.slots[i];
+	if (slot->state != SLOT_DONE)
+	    continue;
+	if (slot->ok)
+	    Con_Printf("Wrote %s\n", slot->filename);
+	else
+	    Con_Printf("ERROR: couldn't write %s\n", slot->filename);
+	slot->state = SLOT_FREE;
+    }
+}
+
+/*
+==============
+IMG_Poll
+==============
+*/
+void
+IMG_Poll(void)
+{
+    if (!img_writer.started)
+	return;
+
+    IMG_Lock();
+    IMG_ReportDone();
+    IMG_Unlock();
+}
+
+/*
+==============
+IMG_SaveAsync
+==============
+*/
+qboolean
+IMG_SaveAsync(const char *filename, imgformat_t format, const byte *pixels,
+	      int width, int height, int rowbytes, int bytes,
+	      const byte *palette, qboolean bottomup)
+{
+    char path[MAX_OSPATH];
+    imgslot_t *slot;
+    FILE *f;
+    int i, y, size;
+
+    if (format == IMG_PCX && bytes != 1)
+	format = IMG_TGA;
+
+    snprintf(path, sizeof(path), "%s/%s", com_gamedir, filename);
+    f = fopen(path, "wb");
+    if (!f) {
+	Con_Printf("ERROR: couldn't open %s\n", filename);
+	return false;
+    }
+
+    // wait for a free slot if the writer has fallen behind
+    slot = NULL;
+    if (IMG_StartWriter()) {
+	IMG_Lock();
+	for (;;) {
+	    IMG_ReportDone();
+	    for (i = 0; i < IMG_SLOTS && !slot; i++)
+		if (img_writer.slots[i].state == SLOT_FREE)
+		    slot = &img_writer.slots[i];
+	    if (slot)
+		break;
+	    IMG_Wait();
+	}
+	IMG_Unlock();
+    }
+    if (!slot) {
+	fclose(f);
+	Con_Printf("ERROR: couldn't start writing %s\n", filename);
+	return false;
+    }
+
+    // (only the main thread takes free slots, so this one stays ours)
+    size = width * height * bytes;
+    if (slot->size < size) {
+	free(slot->pixels);
+	slot->pixels = malloc(size);
+	slot->size = slot->pixels ? size : 0;
+	if (!slot->pixels) {
+	    fclose(f);
+	    Con_Printf("%s: not enough memory\n", __func__);
+	    return false;
+	}
+    }
+    for (y = 0; y < height; y++) {
+	const byte *row = pixels + (bottomup ? height - 1 - y : y) * rowbytes;
+	memcpy(slot->pixels + y * width * bytes, row, width * bytes);
+    }
+    if (palette)
+	memcpy(slot->palette, palette, 768);
+    slot->file = f;
+    slot->format = format;
+    slot->width = width;
+    slot->height = height;
+    slot->bytes = bytes;
+    snprintf(slot->filename, sizeof(slot->filename), "%s", filename);
+
+    IMG_Lock();
+    slot->state = SLOT_QUEUED;
+    IMG_Signal();
+    IMG_Unlock();
+
+    return true;
+}
+
+/*
+==============
+IMG_Shutdown
+==============
+*/
+void
+IMG_Shutdown(void)
+{
+    int i;
+
+    if (!img_writer.started)
+	return;
+
+    IMG_Lock();
+    img_writer.quit = true;
+    IMG_Signal();
+    IMG_Unlock();
+#ifdef _WIN32
+    WaitForSingleObject(img_writer.thread, INFINITE);
+    CloseHandle(img_writer.thread);
+#else
+    pthread_join(img_writer.thread, NULL);
+#endif
+    img_writer.started = false;
+    IMG_ReportDone();
+
+    for (i = 0; i < IMG_SLOTS; i++) {
+	free(img_writer.slots[i].pixels);
+	img_writer.slots[i].pixels = NULL;
+	img_writer.slots[i].size = 0;
+	img_writer.slots[i].state = SLOT_FREE;
+    }
+}
@@ -19,8 +19,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // in_null.c -- for systems without a mouse
 
+#include "input.h"
 #include "quakedef.h"
 
+cvar_t _windowed_mouse = { "_windowed_mouse", "0", true };
+
 void
 IN_Init(void)
 {
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "cdaudio.h"
 #include "client.h"
+#include "cmd.h"
 #include "common.h"
 #include "console.h"
 #include "cvar.h"
@@ -39,6 +40,88 @@ cvar_t in_snd_block = { "in_snd_block", "0" };
 static qboolean mouse_available;
 static int mouse_x, mouse_y;
 
+/*
+ * A high rate mouse can queue thousands of motion events a frame, so they
+ * are taken off SDL's queue in bulk and summed, rather than one at a time
+ * through the event loop.  IN_Move takes them again just before the move
+ * command is built, so the view turns by the latest motion there is.
+ *
+ * in_latency reports how long the oldest motion in each move waited.
+ */
+#define MOTION_BATCH 256
+
+static struct {
+    Uint32 oldest;	// timestamp of the first motion not yet applied
+    int pending;	// motion events not yet applied
+    int moves;		// moves that applied some motion
+    int events;
+    double total;	// msec waited by the oldest motion of each move
+    Uint32 worst;
+} in_motion;
+
+static void
+IN_AddMotion(const SDL_MouseMotionEvent *motion)
+{
+    mouse_x += motion->xrel;
+    mouse_y += motion->yrel;
+    if (!in_motion.pending++)
+	in_motion.oldest = motion->timestamp;
+}
+
+static void
+IN_DrainMotion(void)
+{
+    SDL_Event events[MOTION_BATCH];
+    SDL_bool grabbed;
+    int i, count;
+
+    SDL_PumpEvents();
+    grabbed = SDL_GetWindowGrab(sdl_window);
+    do {
+	count = SDL_PeepEvents(events, MOTION_BATCH, SDL_GETEVENT,
+			       SDL_MOUSEMOTION, SDL_MOUSEMOTION);
+	if (grabbed)
+	    for (i = 0; i < count; i++)
+		IN_AddMotion(&events[i].motion);
+    } while (count == MOTION_BATCH);
+}
+
+static void
+IN_MotionApplied(void)
+{
+    Uint32 wait;
+
+    if (!in_motion.pending)
+	return;
+
+    wait = SDL_GetTicks() - in_motion.oldest;
+    in_motion.moves++;
+    in_motion.events += in_motion.pending;
+    in_motion.total += wait;
+    if (wait > in_motion.worst)
+	in_motion.worst = wait;
+    in_motion.pending = 0;
+}
+
+static void
+IN_Latency_f(void)
+{
+    if (!in_motion.moves) {
+	Con_Printf("No mouse motion since the last check\n");
+	return;
+    }
+    Con_Printf("%d moves from %d motion events (%.1f per move)\n",
+	       in_motion.moves, in_motion.events,
+	       (double)in_motion.events / in_motion.moves);
+    Con_Printf("motion to move: %.1f ms average, %u ms worst\n",
+	       in_motion.total / in_motion.moves, (unsigned)in_motion.worst);
+
+    in_motion.moves = 0;
+    in_motion.events = 0;
+    in_motion.total = 0;
+    in_motion.worst = 0;
+}
+
 #if 0 /* FIXME! */
 static int have_focus = 1;
 
@@ -72,6 +155,7 @@ IN_ProcessEvents(void)
     SDL_Keycode keycode;
     int keystate, button, keynum;
 
+    IN_DrainMotion();
     while (SDL_PollEvent(&event)) {
 	switch (event.type) {
 #if 0 // ACTIVEEVENT disappeared??
@@ -565,10 +649,9 @@ IN_ProcessEvents(void)
 	    break;
 
 	case SDL_MOUSEMOTION:
-	    if (SDL_GetWindowGrab(sdl_window)) {
-		mouse_x += event.motion.xrel;
-		mouse_y += event.motion.yrel;
-	    }
+	    /* only what arrived since the drain above */
+	    if (SDL_GetWindowGrab(sdl_window))
+		IN_AddMotion(&event.motion);
 	    break;
 
 	case SDL_QUIT:
@@ -678,6 +761,7 @@ IN_Init(void)
     Cvar_RegisterVariable(&in_snd_block);
     Cvar_RegisterVariable(&m_filter);
     Cvar_RegisterVariable(&_windowed_mouse);
+    Cmd_AddCommand("in_latency", IN_Latency_f);
 }
 
 void
@@ -695,7 +779,9 @@ void IN_Accumulate(void) { }
 void IN_UpdateClipCursor(void) { }
 void IN_Move(usercmd_t *cmd)
 {
+    IN_DrainMotion();
     IN_MouseMove(cmd);
+    IN_MotionApplied();
     //IN_JoyMove(cmd);
 }
 
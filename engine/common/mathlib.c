@@ -335,7 +335,7 @@ AngleVectors(const vec3_t angles, vec3_t forward, vec3_t right, vec3_t up)
 }
 
 int
-VectorCompare(vec3_t v1, vec3_t v2)
+VectorCompare(const vec3_t v1, const vec3_t v2)
 {
     int i;
 
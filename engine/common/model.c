@@ -24,11 +24,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <float.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "cmd.h"
 #include "common.h"
 #include "console.h"
+#include "crc.h"
 #include "model.h"
+#include "trace.h"
 
 #ifdef GLQUAKE
 #include "glquake.h"
@@ -42,9 +45,6 @@ static texture_t r_notexture_mip_qwsv;
 #include "quakedef.h"
 #include "render.h"
 #include "sys.h"
-#ifdef QW_HACK
-#include "crc.h"
-#endif
 /* FIXME - quick hack to enable merging of NQ/QWSV shared code */
 #define SV_Error Sys_Error
 #endif
@@ -55,9 +55,25 @@ static model_t *Mod_LoadModel(const char *name, qboolean crash);
 static brushmodel_t *loaded_models;
 static model_t *loaded_sprites;
 
+/* The brush and sprite models, by name (alias models have their own) */
+#define MOD_HASH_SIZE 256	/* must be a power of two */
+static model_t *mod_hash[MOD_HASH_SIZE];
+
+static void
+Mod_HashModel(model_t *model)
+{
+    unsigned bucket = COM_HashFileName(model->name) & (MOD_HASH_SIZE - 1);
+
+    model->hashnext = mod_hash[bucket];
+    mod_hash[bucket] = model;
+}
+
 #ifdef GLQUAKE
 cvar_t gl_subdivide_size = { "gl_subdivide_size", "128", true };
 #endif
+static cvar_t mod_facecache = { "mod_facecache", "0" };
+static cvar_t pvscache_size = { "pvscache_size", "8" };
+static cvar_t pvscache_budget = { "pvscache_budget", "8" };	/* megabytes */
 
 static const model_loader_t *mod_loader;
 
@@ -73,6 +89,9 @@ Mod_Init(const model_loader_t *loader)
 #ifdef GLQUAKE
     Cvar_RegisterVariable(&gl_subdivide_size);
 #endif
+    Cvar_RegisterVariable(&mod_facecache);
+    Cvar_RegisterVariable(&pvscache_size);
+    Cvar_RegisterVariable(&pvscache_budget);
     Cmd_AddCommand("pvscache", PVSCache_f);
     mod_loader = loader;
 }
@@ -147,22 +166,44 @@ Mod_CountLeafBits(const leafbits_t *leafbits)
 #endif
 
 /*
- * Simple LRU cache for decompressed vis data
+ * LRU cache for decompressed vis data, pvscache_size entries.  If all the
+ * leafs of the world fit in pvscache_budget megabytes, they are decompressed
+ * once at load instead and Mod_LeafPVS is a table lookup.
  */
 typedef struct {
     const brushmodel_t *model;
     const mleaf_t *leaf;
     leafbits_t *leafbits;
 } pvscache_t;
-static pvscache_t pvscache[2];
+static pvscache_t *pvscache;
+static int pvscache_entries;
 static leafbits_t *fatpvs;
 static int pvscache_numleafs;
 static int pvscache_bytes;
 static int pvscache_blocks;
 
-static int c_cachehit, c_cachemiss;
+static struct {
+    const brushmodel_t *model;
+    int memsize;		/* of each leaf's leafbits_t */
+    byte *leafbits;		/* [numleafs + 1] */
+} pvsall;
+
+/*
+ * Recent fat PVS unions, keyed by the leafs the point touched (a point in
+ * just one leaf uses that leaf's PVS as it is).
+ */
+#define FATPVS_MAXLEAFS 8
+#define FATPVS_CACHE_SIZE 8
+typedef struct {
+    const brushmodel_t *model;
+    int numleafs;
+    const mleaf_t *leafs[FATPVS_MAXLEAFS];
+    leafbits_t *leafbits;
+} fatpvscache_t;
+static fatpvscache_t fatpvscache[FATPVS_CACHE_SIZE];
 
-#define PVSCACHE_SIZE ARRAY_SIZE(pvscache)
+static int c_cachehit, c_cachemiss;
+static int c_fathit, c_fatmiss, c_fatsingle;
 
 static void
 Mod_InitPVSCache(int numleafs)
@@ -177,10 +218,17 @@ Mod_InitPVSCache(int numleafs)
     memsize = Mod_LeafbitsSize(numleafs);
     fatpvs = Hunk_AllocName(memsize, "fatpvs");
 
-    memset(pvscache, 0, sizeof(pvscache));
-    leafmem = Hunk_AllocName(PVSCACHE_SIZE * memsize, "pvscache");
-    for (i = 0; i < PVSCACHE_SIZE; i++)
+    pvscache_entries = qmax((int)pvscache_size.value, 1);
+    pvscache = Hunk_AllocName(pvscache_entries * sizeof(*pvscache),
+			      "pvscache");
+    leafmem = Hunk_AllocName(pvscache_entries * memsize, "pvscache");
+    for (i = 0; i < pvscache_entries; i++)
 	pvscache[i].leafbits = (leafbits_t *)(leafmem + i * memsize);
+
+    memset(fatpvscache, 0, sizeof(fatpvscache));
+    leafmem = Hunk_AllocName(FATPVS_CACHE_SIZE * memsize, "fatpvs");
+    for (i = 0; i < FATPVS_CACHE_SIZE; i++)
+	fatpvscache[i].leafbits = (leafbits_t *)(leafmem + i * memsize);
 }
 
 /*
@@ -234,31 +282,66 @@ Mod_DecompressVis(const byte *in, const brushmodel_t *model, leafbits_t *dest)
     } while (num_out < dest->numleafs);
 }
 
+static void
+Mod_LeafPVSBits(const brushmodel_t *model, const mleaf_t *leaf,
+		leafbits_t *leafbits)
+{
+    if (leaf == model->leafs) {
+	/* return set with everything visible */
+	leafbits->numleafs = model->numleafs;
+	memset(leafbits->bits, 0xff, pvscache_bytes);
+    } else {
+	Mod_DecompressVis(leaf->compressed_vis, model, leafbits);
+    }
+}
+
+/*
+ * Decompress the PVS of every leaf of the world, if it's within budget
+ */
+static void
+Mod_PrecomputePVS(const brushmodel_t *model)
+{
+    int i, memsize;
+    size_t total;
+
+    memsize = Mod_LeafbitsSize(pvscache_numleafs);
+    total = (size_t)model->numleafs * memsize;
+    if (total > pvscache_budget.value * 1024 * 1024)
+	return;
+
+    pvsall.model = model;
+    pvsall.memsize = memsize;
+    pvsall.leafbits = Hunk_AllocName(total, "pvsall");
+    for (i = 0; i < model->numleafs; i++)
+	Mod_LeafPVSBits(model, model->leafs + i,
+			(leafbits_t *)(pvsall.leafbits + i * memsize));
+}
+
 const leafbits_t *
 Mod_LeafPVS(const brushmodel_t *model, const mleaf_t *leaf)
 {
     int slot;
     pvscache_t tmp;
 
-    for (slot = 0; slot < PVSCACHE_SIZE; slot++)
+    if (model == pvsall.model) {
+	c_cachehit++;
+	slot = leaf - model->leafs;
+	return (leafbits_t *)(pvsall.leafbits + slot * pvsall.memsize);
+    }
+
+    for (slot = 0; slot < pvscache_entries; slot++)
 	if (pvscache[slot].model == model && pvscache[slot].leaf == leaf) {
 	    c_cachehit++;
 	    break;
 	}
 
     if (slot) {
-	if (slot == PVSCACHE_SIZE) {
+	if (slot == pvscache_entries) {
 	    slot--;
 	    tmp.model = model;
 	    tmp.leaf = leaf;
 	    tmp.leafbits = pvscache[slot].leafbits;
-	    if (leaf == model->leafs) {
-		/* return set with everything visible */
-		tmp.leafbits->numleafs = model->numleafs;
-		memset(tmp.leafbits->bits, 0xff, pvscache_bytes);
-	    } else {
-		Mod_DecompressVis(leaf->compressed_vis, model, tmp.leafbits);
-	    }
+	    Mod_LeafPVSBits(model, leaf, tmp.leafbits);
 	    c_cachemiss++;
 	} else {
 	    tmp = pvscache[slot];
@@ -273,9 +356,22 @@ Mod_LeafPVS(const brushmodel_t *model, const mleaf_t *leaf)
 static void
 PVSCache_f(void)
 {
+    if (pvsall.model)
+	Con_Printf("PVSCache: all %d leafs decompressed (%d KB)\n",
+		   pvsall.model->numleafs + 1,
+		   (pvsall.model->numleafs + 1) * pvsall.memsize / 1024);
+    else
+	Con_Printf("PVSCache: %d entries\n", pvscache_entries);
     Con_Printf("PVSCache: %7d hits %7d misses\n", c_cachehit, c_cachemiss);
+    Con_Printf("FatPVS:   %7d hits %7d misses %7d single leaf\n",
+	       c_fathit, c_fatmiss, c_fatsingle);
 }
 
+typedef struct {
+    int numleafs;		/* may be more than FATPVS_MAXLEAFS */
+    const mleaf_t *leafs[FATPVS_MAXLEAFS];
+} fatleafs_t;
+
 static void
 Mod_AddToFatPVS(const brushmodel_t *model, const vec3_t point,
 		const mnode_t *node)
@@ -307,6 +403,38 @@ Mod_AddToFatPVS(const brushmodel_t *model, const vec3_t point,
     }
 }
 
+/*
+ * Find the leafs within 8 units of the point, without touching their PVS
+ */
+static void
+Mod_FindFatLeafs(const mnode_t *node, const vec3_t point, fatleafs_t *fatleafs)
+{
+    mplane_t *plane;
+    float d;
+
+    while (1) {
+	if (node->contents < 0) {
+	    if (node->contents != CONTENTS_SOLID) {
+		if (fatleafs->numleafs < FATPVS_MAXLEAFS)
+		    fatleafs->leafs[fatleafs->numleafs] = (const mleaf_t *)node;
+		fatleafs->numleafs++;
+	    }
+	    return;
+	}
+
+	plane = node->plane;
+	d = DotProduct(point, plane->normal) - plane->dist;
+	if (d > 8)
+	    node = node->children[0];
+	else if (d < -8)
+	    node = node->children[1];
+	else {
+	    Mod_FindFatLeafs(node->children[0], point, fatleafs);
+	    node = node->children[1];
+	}
+    }
+}
+
 /*
 =============
 Mod_FatPVS
@@ -323,11 +451,57 @@ crosses a waterline.
 const leafbits_t *
 Mod_FatPVS(const brushmodel_t *model, const vec3_t point)
 {
+    fatleafs_t fatleafs;
+    fatpvscache_t tmp;
+    int i, slot;
+
+    fatleafs.numleafs = 0;
+    Mod_FindFatLeafs(model->nodes, point, &fatleafs);
+
+    /* most of the time, the point is well inside one leaf */
+    if (fatleafs.numleafs == 1) {
+	c_fatsingle++;
+	return Mod_LeafPVS(model, fatleafs.leafs[0]);
+    }
+
     fatpvs->numleafs = model->numleafs;
     memset(fatpvs->bits, 0, pvscache_bytes);
-    Mod_AddToFatPVS(model, point, model->nodes);
+    if (fatleafs.numleafs > FATPVS_MAXLEAFS) {
+	c_fatmiss++;
+	Mod_AddToFatPVS(model, point, model->nodes);
+	return fatpvs;
+    }
+
+    for (slot = 0; slot < FATPVS_CACHE_SIZE; slot++) {
+	const fatpvscache_t *cache = &fatpvscache[slot];
+	if (cache->model != model || cache->numleafs != fatleafs.numleafs)
+	    continue;
+	for (i = 0; i < fatleafs.numleafs; i++)
+	    if (cache->leafs[i] != fatleafs.leafs[i])
+		break;
+	if (i == fatleafs.numleafs)
+	    break;
+    }
 
-    return fatpvs;
+    if (slot == FATPVS_CACHE_SIZE) {
+	c_fatmiss++;
+	slot--;
+	tmp.model = model;
+	tmp.numleafs = fatleafs.numleafs;
+	memcpy(tmp.leafs, fatleafs.leafs, sizeof(tmp.leafs));
+	tmp.leafbits = fatpvscache[slot].leafbits;
+	tmp.leafbits->numleafs = model->numleafs;
+	memset(tmp.leafbits->bits, 0, pvscache_bytes);
+	for (i = 0; i < fatleafs.numleafs; i++)
+	    Mod_AddLeafBits(tmp.leafbits, Mod_LeafPVS(model, fatleafs.leafs[i]));
+    } else {
+	c_fathit++;
+	tmp = fatpvscache[slot];
+    }
+    memmove(fatpvscache + 1, fatpvscache, slot * sizeof(fatpvscache_t));
+    fatpvscache[0] = tmp;
+
+    return fatpvscache[0].leafbits;
 }
 
 /*
@@ -338,13 +512,25 @@ Mod_ClearAll
 void
 Mod_ClearAll(void)
 {
+    brushmodel_t *brushmodel;
+
+    /* the lighting, visibility and entities may point into the views */
+    for (brushmodel = loaded_models; brushmodel; brushmodel = brushmodel->next)
+	Sys_UnmapFile(&brushmodel->mapping);
+
     loaded_models = NULL;
     loaded_sprites = NULL;
+    memset(mod_hash, 0, sizeof(mod_hash));
     fatpvs = NULL;
-    memset(pvscache, 0, sizeof(pvscache));
+    pvscache = NULL;
+    pvscache_entries = 0;
+    memset(&pvsall, 0, sizeof(pvsall));
+    memset(fatpvscache, 0, sizeof(fatpvscache));
     pvscache_numleafs = 0;
     pvscache_bytes = pvscache_blocks = 0;
     c_cachehit = c_cachemiss = 0;
+    c_fathit = c_fatmiss = c_fatsingle = 0;
+    Mod_ClearTraceCache();
 #ifndef SERVERONLY
     Mod_ClearAlias();
 #endif
@@ -359,33 +545,20 @@ Mod_FindName
 static model_t *
 Mod_FindName(const char *name)
 {
-    brushmodel_t *brushmodel;
     model_t *model;
+    unsigned bucket;
 
     if (!name[0])
 	SV_Error("%s: NULL name", __func__);
 
-    /* search the currently loaded models */
-    brushmodel = loaded_models;
-    while (brushmodel) {
-	if (!strcmp(brushmodel->model.name, name))
-	    break;
-	brushmodel = brushmodel->next;
-    }
-    model = brushmodel ? &brushmodel->model : NULL;
+    /* search the currently loaded brush and sprite models */
+    bucket = COM_HashFileName(name) & (MOD_HASH_SIZE - 1);
+    for (model = mod_hash[bucket]; model; model = model->hashnext)
+	if (!strcmp(model->name, name))
+	    return model;
 
 #ifndef SERVERONLY
-    /* Search the sprite and alias lists */
-    if (!model) {
-	model = loaded_sprites;
-	while (model) {
-	    if (!strcmp(model->name, name))
-		break;
-	    model = model->next;
-	}
-    }
-    if (!model)
-	model = Mod_FindAliasName(name);
+    model = Mod_FindAliasName(name);
 #endif
 
     return model;
@@ -415,10 +588,16 @@ Mod_LoadModel(const char *name, qboolean crash)
     unsigned *buf, header;
     brushmodel_t *brushmodel;
     model_t *model;
+    sys_mapping_t mapping;
     size_t size;
 
-    /* Load the file - use stack for tiny models to avoid dirtying heap */
-    buf = COM_LoadStackFile(name, stackbuf, sizeof(stackbuf), &size);
+    /*
+     * Map the file if it's in a pak, otherwise load it - use stack for
+     * tiny models to avoid dirtying heap
+     */
+    buf = COM_MapFile(name, &size, &mapping);
+    if (!buf)
+	buf = COM_LoadStackFile(name, stackbuf, sizeof(stackbuf), &size);
     if (!buf) {
 	if (crash)
 	    SV_Error("%s: %s not found", __func__, name);
@@ -430,9 +609,9 @@ Mod_LoadModel(const char *name, qboolean crash)
     switch (header) {
 #ifndef SERVERONLY
     case IDPOLYHEADER:
-	model = Mod_NewAliasModel();
-	snprintf(model->name, sizeof(model->name), "%s", name);
+	model = Mod_NewAliasModel(name);
 	Mod_LoadAliasModel(mod_loader, model, buf);
+	Sys_UnmapFile(&mapping);
 	break;
 
     case IDSPRITEHEADER:
@@ -440,15 +619,19 @@ Mod_LoadModel(const char *name, qboolean crash)
 	snprintf(model->name, sizeof(model->name), "%s", name);
 	model->next = loaded_sprites;
 	loaded_sprites = model;
+	Mod_HashModel(model);
 	Mod_LoadSpriteModel(model, buf);
+	Sys_UnmapFile(&mapping);
 	break;
 #endif
     default:
 	brushmodel = Mod_AllocName(sizeof(*brushmodel), name);
 	brushmodel->next = loaded_models;
 	loaded_models = brushmodel;
+	brushmodel->mapping = mapping; /* kept until Mod_ClearAll */
 	model = &brushmodel->model;
 	snprintf(model->name, sizeof(model->name), "%s", name);
+	Mod_HashModel(model);
 	Mod_LoadBrushModel(brushmodel, buf, size);
 	break;
     }
@@ -478,15 +661,18 @@ Mod_ForName(const char *name, qboolean crash)
 	if (Cache_Check(&model->cache))
 	    return model;
 
+	/* flushed from the cache, reload it into the same model */
 	buffer = COM_LoadTempFile(name);
-	model = Mod_NewAliasModel();
-	snprintf(model->name, sizeof(model->name), "%s", name);
 	Mod_LoadAliasModel(mod_loader, model, buffer);
 #endif
 	return model;
     }
 
-    return Mod_LoadModel(name, crash);
+    TR_Begin("Mod_LoadModel");
+    model = Mod_LoadModel(name, crash);
+    TR_End("Mod_LoadModel");
+
+    return model;
 }
 
 
@@ -662,7 +848,11 @@ Mod_LoadBytes(brushmodel_t *brushmodel, dheader_t *header, int lumpnum)
     if (!headerlump->filelen)
 	return NULL;
 
+    /* a mapped file stays around, so the lump can be used where it is */
     in = (byte *)header + headerlump->fileofs;
+    if (brushmodel->mapping.base)
+	return (byte *)in;
+
     out = Mod_AllocName(headerlump->filelen, model->name);
     memcpy(out, in, headerlump->filelen);
 
@@ -995,6 +1185,152 @@ Mod_ProcessSurface(brushmodel_t *brushmodel, msurface_t *surf)
     }
 }
 
+/*
+ * ===========================================================================
+ * FACE CACHE
+ *
+ * The extents and bounds of every surface are worked out from the vertexes,
+ * edges, surfedges and texinfo at each load.  With mod_facecache set, they
+ * are saved to cache/<model>.fce after the first load and read back while
+ * the length and CRC of each lump they came from still match.
+ * ===========================================================================
+ */
+
+#define FACECACHE_ID (('1' << 24) + ('E' << 16) + ('C' << 8) + 'F')
+
+static const int facecache_lumps[] = {
+    LUMP_VERTEXES, LUMP_EDGES, LUMP_SURFEDGES, LUMP_TEXINFO, LUMP_FACES
+};
+
+typedef struct {
+    int32_t id;
+    int32_t numsurfaces;
+    int32_t lumplen[ARRAY_SIZE(facecache_lumps)];
+    int32_t lumpcrc[ARRAY_SIZE(facecache_lumps)];
+} dfacecache_t;
+
+typedef struct {
+    int16_t texturemins[2];
+    int16_t extents[2];
+    float mins[3];
+    float maxs[3];
+} dfacecachesurf_t;
+
+#define FACECACHE_CHUNK 256
+
+static void
+Mod_FaceCachePath(const model_t *model, char *path, size_t pathsize)
+{
+    char name[MAX_QPATH];
+
+    COM_StripExtension(model->name, name, sizeof(name));
+    snprintf(path, pathsize, "cache/%s.fce", name);
+}
+
+/*
+ * Fills in the cache header for the brushmodel, which has already had its
+ * surfaces allocated.  Returns true if they were read from the cache.
+ */
+static qboolean
+Mod_ReadFaceCache(brushmodel_t *brushmodel, const dheader_t *header,
+		  dfacecache_t *facecache)
+{
+    dfacecachesurf_t in[FACECACHE_CHUNK];
+    dfacecache_t filecache;
+    const lump_t *lump;
+    msurface_t *surf;
+    char path[MAX_OSPATH];
+    int i, j, count, length;
+    FILE *f;
+
+    facecache->id = LittleLong(FACECACHE_ID);
+    facecache->numsurfaces = LittleLong(brushmodel->numsurfaces);
+    for (i = 0; i < ARRAY_SIZE(facecache_lumps); i++) {
+	lump = &header->lumps[facecache_lumps[i]];
+	facecache->lumplen[i] = LittleLong(lump->filelen);
+	facecache->lumpcrc[i] =
+	    LittleLong(CRC_Block((const byte *)header + lump->fileofs,
+				 lump->filelen));
+    }
+
+    Mod_FaceCachePath(&brushmodel->model, path, sizeof(path));
+    length = COM_FOpenFile(path, &f);
+    if (!f)
+	return false;
+    if (length != sizeof(filecache) + brushmodel->numsurfaces * sizeof(in[0]))
+	goto stale;
+    if (fread(&filecache, sizeof(filecache), 1, f) != 1)
+	goto stale;
+    if (memcmp(&filecache, facecache, sizeof(filecache)))
+	goto stale;
+
+    surf = brushmodel->surfaces;
+    for (i = 0; i < brushmodel->numsurfaces; i += count) {
+	count = qmin(brushmodel->numsurfaces - i, FACECACHE_CHUNK);
+	if (fread(in, sizeof(in[0]), count, f) != count)
+	    goto stale;
+	for (j = 0; j < count; j++, surf++) {
+	    surf->texturemins[0] = LittleShort(in[j].texturemins[0]);
+	    surf->texturemins[1] = LittleShort(in[j].texturemins[1]);
+	    surf->extents[0] = LittleShort(in[j].extents[0]);
+	    surf->extents[1] = LittleShort(in[j].extents[1]);
+	    surf->mins[0] = LittleFloat(in[j].mins[0]);
+	    surf->mins[1] = LittleFloat(in[j].mins[1]);
+	    surf->mins[2] = LittleFloat(in[j].mins[2]);
+	    surf->maxs[0] = LittleFloat(in[j].maxs[0]);
+	    surf->maxs[1] = LittleFloat(in[j].maxs[1]);
+	    surf->maxs[2] = LittleFloat(in[j].maxs[2]);
+	}
+    }
+    fclose(f);
+
+    return true;
+
+ stale:
+    fclose(f);
+    return false;
+}
+
+static void
+Mod_WriteFaceCache(const brushmodel_t *brushmodel,
+		   const dfacecache_t *facecache)
+{
+    dfacecachesurf_t out[FACECACHE_CHUNK];
+    const msurface_t *surf;
+    char path[MAX_OSPATH], name[MAX_OSPATH];
+    int i, j, count;
+    FILE *f;
+
+    Mod_FaceCachePath(&brushmodel->model, name, sizeof(name));
+    snprintf(path, sizeof(path), "%s/%s", com_gamedir, name);
+    COM_CreatePath(path);
+    f = fopen(path, "wb");
+    if (!f) {
+	Con_DPrintf("%s: couldn't write %s\n", __func__, path);
+	return;
+    }
+
+    fwrite(facecache, sizeof(*facecache), 1, f);
+    surf = brushmodel->surfaces;
+    for (i = 0; i < brushmodel->numsurfaces; i += count) {
+	count = qmin(brushmodel->numsurfaces - i, FACECACHE_CHUNK);
+	for (j = 0; j < count; j++, surf++) {
+	    out[j].texturemins[0] = LittleShort(surf->texturemins[0]);
+	    out[j].texturemins[1] = LittleShort(surf->texturemins[1]);
+	    out[j].extents[0] = LittleShort(surf->extents[0]);
+	    out[j].extents[1] = LittleShort(surf->extents[1]);
+	    out[j].mins[0] = LittleFloat(surf->mins[0]);
+	    out[j].mins[1] = LittleFloat(surf->mins[1]);
+	    out[j].mins[2] = LittleFloat(surf->mins[2]);
+	    out[j].maxs[0] = LittleFloat(surf->maxs[0]);
+	    out[j].maxs[1] = LittleFloat(surf->maxs[1]);
+	    out[j].maxs[2] = LittleFloat(surf->maxs[2]);
+	}
+	fwrite(out, sizeof(out[0]), count, f);
+    }
+    fclose(f);
+}
+
 /*
 =================
 Mod_LoadFaces
@@ -1006,6 +1342,8 @@ Mod_LoadFaces_BSP29(brushmodel_t *brushmodel, dheader_t *header)
 {
     const model_t *model = &brushmodel->model;
     const lump_t *headerlump = &header->lumps[LUMP_FACES];
+    dfacecache_t facecache;
+    qboolean cached = false;
     const bsp29_dface_t *in;
     msurface_t *out;
     int i, count, surfnum;
@@ -1019,6 +1357,8 @@ Mod_LoadFaces_BSP29(brushmodel_t *brushmodel, dheader_t *header)
 
     brushmodel->surfaces = out;
     brushmodel->numsurfaces = count;
+    if (mod_facecache.value)
+	cached = Mod_ReadFaceCache(brushmodel, header, &facecache);
 
     for (surfnum = 0; surfnum < count; surfnum++, in++, out++) {
 	out->firstedge = LittleLong(in->firstedge);
@@ -1038,8 +1378,10 @@ Mod_LoadFaces_BSP29(brushmodel_t *brushmodel, dheader_t *header)
 	out->plane = brushmodel->planes + planenum;
 	out->texinfo = brushmodel->texinfo + LittleShort(in->texinfo);
 
-	CalcSurfaceExtents(brushmodel, out);
-	CalcSurfaceBounds(brushmodel, out);
+	if (!cached) {
+	    CalcSurfaceExtents(brushmodel, out);
+	    CalcSurfaceBounds(brushmodel, out);
+	}
 
 	/* lighting info */
 	for (i = 0; i < MAXLIGHTMAPS; i++)
@@ -1052,6 +1394,9 @@ Mod_LoadFaces_BSP29(brushmodel_t *brushmodel, dheader_t *header)
 
 	Mod_ProcessSurface(brushmodel, out);
     }
+
+    if (mod_facecache.value && !cached)
+	Mod_WriteFaceCache(brushmodel, &facecache);
 }
 
 static void
@@ -1059,6 +1404,8 @@ Mod_LoadFaces_BSP2(brushmodel_t *brushmodel, dheader_t *header)
 {
     const model_t *model = &brushmodel->model;
     const lump_t *headerlump = &header->lumps[LUMP_FACES];
+    dfacecache_t facecache;
+    qboolean cached = false;
     const bsp2_dface_t *in;
     msurface_t *out;
     int i, count, surfnum;
@@ -1072,6 +1419,8 @@ Mod_LoadFaces_BSP2(brushmodel_t *brushmodel, dheader_t *header)
 
     brushmodel->surfaces = out;
     brushmodel->numsurfaces = count;
+    if (mod_facecache.value)
+	cached = Mod_ReadFaceCache(brushmodel, header, &facecache);
 
     for (surfnum = 0; surfnum < count; surfnum++, in++, out++) {
 	out->firstedge = LittleLong(in->firstedge);
@@ -1086,8 +1435,10 @@ Mod_LoadFaces_BSP2(brushmodel_t *brushmodel, dheader_t *header)
 	out->plane = brushmodel->planes + planenum;
 	out->texinfo = brushmodel->texinfo + LittleLong(in->texinfo);
 
-	CalcSurfaceExtents(brushmodel, out);
-	CalcSurfaceBounds(brushmodel, out);
+	if (!cached) {
+	    CalcSurfaceExtents(brushmodel, out);
+	    CalcSurfaceBounds(brushmodel, out);
+	}
 
 	/* lighting info */
 	for (i = 0; i < MAXLIGHTMAPS; i++)
@@ -1100,6 +1451,9 @@ Mod_LoadFaces_BSP2(brushmodel_t *brushmodel, dheader_t *header)
 
 	Mod_ProcessSurface(brushmodel, out);
     }
+
+    if (mod_facecache.value && !cached)
+	Mod_WriteFaceCache(brushmodel, &facecache);
 }
 
 /*
@@ -1157,8 +1511,6 @@ Mod_LoadNodes_BSP29(brushmodel_t *brushmodel, dheader_t *header)
 		out->children[j] = (mnode_t *)(brushmodel->leafs - nodenum - 1);
 	}
     }
-
-    Mod_SetParent(brushmodel->nodes, NULL);
 }
 
 static void
@@ -1195,8 +1547,6 @@ Mod_LoadNodes_BSP2rmq(brushmodel_t *brushmodel, dheader_t *header)
 		out->children[j] = (mnode_t *)(brushmodel->leafs - nodenum - 1);
 	}
     }
-
-    Mod_SetParent(brushmodel->nodes, NULL);
 }
 
 static void
@@ -1233,8 +1583,6 @@ Mod_LoadNodes_BSP2(brushmodel_t *brushmodel, dheader_t *header)
 		out->children[j] = (mnode_t *)(brushmodel->leafs - nodenum - 1);
 	}
     }
-
-    Mod_SetParent(brushmodel->nodes, NULL);
 }
 
 static void
@@ -1533,6 +1881,231 @@ Mod_MakeDrawHull(brushmodel_t *brushmodel)
     }
 }
 
+/*
+=================
+Mod_MakeHullNodes
+
+Pack the clipnodes of the hulls with their planes
+=================
+*/
+static void
+Mod_MakeHullNodes(brushmodel_t *brushmodel)
+{
+    const model_t *model = &brushmodel->model;
+    const mclipnode_t *in;
+    const mplane_t *plane;
+    mhullnode_t *nodes, *out;
+    int i, j, hullnum, count;
+
+    for (hullnum = 0; hullnum < 2; hullnum++) {
+	if (hullnum == 0) {
+	    in = brushmodel->hulls[0].clipnodes;
+	    count = brushmodel->numnodes;
+	} else {
+	    in = brushmodel->clipnodes;
+	    count = brushmodel->numclipnodes;
+	}
+	nodes = Mod_AllocName(count * sizeof(*nodes), model->name);
+	for (i = 0, out = nodes; i < count; i++, in++, out++) {
+	    plane = brushmodel->planes + in->planenum;
+	    VectorCopy(plane->normal, out->normal);
+	    out->dist = plane->dist;
+	    out->type = plane->type < 3 ? plane->type : 3;
+	    for (j = 0; j < 2; j++)
+		out->children[j] = in->children[j];
+	}
+	if (hullnum == 0) {
+	    brushmodel->hulls[0].nodes = nodes;
+	} else {
+	    brushmodel->hulls[1].nodes = nodes;
+	    brushmodel->hulls[2].nodes = nodes;
+	}
+    }
+}
+
+/*
+=================
+Mod_LayoutTree
+
+Work out a cache friendly order for the nodes of a tree, given the children
+of each (node numbers >= 0, anything else is a leaf or contents).  Each
+subtree gets a block of its top MOD_BLOCK_NODES nodes, breadth first, and
+the blocks below it follow depth first, so walking down the tree reads a few
+levels from one stretch of memory before jumping.  The tree of the first root
+comes first, making that root node 0.  Nodes no root reaches keep their order
+at the end.  Fills in remap with the new number of each node.
+=================
+*/
+#define MOD_BLOCK_LEVELS 3
+#define MOD_BLOCK_NODES ((1 << MOD_BLOCK_LEVELS) - 1)
+
+static void
+Mod_LayoutTree(const int (*children)[2], int numnodes,
+	       const int *roots, int numroots, int *remap)
+{
+    int block[MOD_BLOCK_NODES], frontier[MOD_BLOCK_NODES * 2];
+    int *stack;
+    int i, j, node, child, next, top, count, numfrontier;
+
+    for (i = 0; i < numnodes; i++)
+	remap[i] = -1;
+
+    /* each node is expanded once, so its children are pushed once */
+    stack = malloc((numroots + numnodes * 2) * sizeof(*stack));
+    next = 0;
+    if (!stack)
+	goto unreached;
+
+    top = 0;
+    for (i = numroots - 1; i >= 0; i--)
+	if (roots[i] >= 0 && roots[i] < numnodes)
+	    stack[top++] = roots[i];
+
+    while (top) {
+	node = stack[--top];
+	if (remap[node] >= 0)
+	    continue;
+
+	block[0] = node;
+	remap[node] = next++;
+	count = 1;
+	numfrontier = 0;
+	for (i = 0; i < count; i++) {
+	    for (j = 0; j < 2; j++) {
+		child = children[block[i]][j];
+		if (child < 0 || child >= numnodes || remap[child] >= 0)
+		    continue;
+		if (count < MOD_BLOCK_NODES) {
+		    block[count++] = child;
+		    remap[child] = next++;
+		} else {
+		    frontier[numfrontier++] = child;
+		}
+	    }
+	}
+
+	/* the leftmost subtree below the block is laid out next */
+	while (numfrontier)
+	    stack[top++] = frontier[--numfrontier];
+    }
+    free(stack);
+
+ unreached:
+    for (i = 0; i < numnodes; i++)
+	if (remap[i] < 0)
+	    remap[i] = next++;
+}
+
+/*
+=================
+Mod_SortNodes
+
+Lay the drawing nodes out with Mod_LayoutTree, keeping the world's head
+node as node 0.  Leaves the nodes in file order if out of memory.
+=================
+*/
+static void
+Mod_SortNodes(brushmodel_t *brushmodel)
+{
+    const int count = brushmodel->numnodes;
+    const int numroots = brushmodel->numsubmodels;
+    mnode_t *nodes = brushmodel->nodes;
+    mnode_t *copy, *out;
+    int (*children)[2];
+    int *remap, *roots;
+    int i, j;
+
+    copy = malloc(count * sizeof(*copy));
+    children = malloc(count * sizeof(*children));
+    remap = malloc((count + numroots) * sizeof(*remap));
+    if (!copy || !children || !remap)
+	goto out;
+
+    for (i = 0; i < count; i++) {
+	for (j = 0; j < 2; j++) {
+	    const mnode_t *child = nodes[i].children[j];
+	    children[i][j] = child->contents < 0 ? -1 : child - nodes;
+	}
+    }
+    roots = remap + count;
+    for (i = 0; i < numroots; i++)
+	roots[i] = brushmodel->submodels[i].headnode[0];
+    Mod_LayoutTree(children, count, roots, numroots, remap);
+
+    memcpy(copy, nodes, count * sizeof(*copy));
+    for (i = 0; i < count; i++) {
+	out = nodes + remap[i];
+	*out = copy[i];
+	for (j = 0; j < 2; j++)
+	    if (children[i][j] >= 0)
+		out->children[j] = nodes + remap[children[i][j]];
+    }
+    for (i = 0; i < numroots; i++) {
+	const int headnode = roots[i];
+	if (headnode >= 0 && headnode < count)
+	    brushmodel->submodels[i].headnode[0] = remap[headnode];
+    }
+
+ out:
+    free(remap);
+    free(children);
+    free(copy);
+}
+
+/*
+=================
+Mod_SortClipnodes
+
+As Mod_SortNodes, for the clipnodes shared by hulls 1 and 2
+=================
+*/
+static void
+Mod_SortClipnodes(brushmodel_t *brushmodel)
+{
+    const int count = brushmodel->numclipnodes;
+    const int numroots = brushmodel->numsubmodels * 2;
+    mclipnode_t *clipnodes = brushmodel->clipnodes;
+    mclipnode_t *copy, *out;
+    int (*children)[2];
+    int *remap, *roots;
+    int i, j, hullnum;
+
+    copy = malloc(count * sizeof(*copy));
+    children = malloc(count * sizeof(*children));
+    remap = malloc((count + numroots) * sizeof(*remap));
+    if (!copy || !children || !remap)
+	goto out;
+
+    for (i = 0; i < count; i++)
+	for (j = 0; j < 2; j++)
+	    children[i][j] = clipnodes[i].children[j];
+    roots = remap + count;
+    for (i = 0; i < brushmodel->numsubmodels; i++)
+	for (hullnum = 1; hullnum <= 2; hullnum++)
+	    roots[i * 2 + hullnum - 1] =
+		brushmodel->submodels[i].headnode[hullnum];
+    Mod_LayoutTree(children, count, roots, numroots, remap);
+
+    memcpy(copy, clipnodes, count * sizeof(*copy));
+    for (i = 0; i < count; i++) {
+	out = clipnodes + remap[i];
+	*out = copy[i];
+	for (j = 0; j < 2; j++)
+	    if (children[i][j] >= 0)
+		out->children[j] = remap[children[i][j]];
+    }
+    for (i = 0; i < numroots; i++) {
+	const int headnode = roots[i];
+	if (headnode >= 0 && headnode < count)
+	    brushmodel->submodels[i / 2].headnode[i % 2 + 1] = remap[headnode];
+    }
+
+ out:
+    free(remap);
+    free(children);
+    free(copy);
+}
+
 /*
 =================
 Mod_LoadMarksurfaces
@@ -1687,9 +2260,12 @@ Mod_SetupSubmodels(brushmodel_t *world)
 	    submodel = Hunk_AllocName(sizeof(*submodel), "submodel");
 	    model = &submodel->model;
 	    *submodel = *world; /* start with world info */
+	    submodel->mapping.base = NULL;
+	    submodel->mapping.size = 0;
 	    snprintf(model->name, sizeof(model->name), "*%d", i);
 	    submodel->next = loaded_models;
 	    loaded_models = submodel;
+	    Mod_HashModel(model);
 	}
 
 	dmodel = &world->submodels[i];
@@ -1794,28 +2370,33 @@ Mod_LoadBrushModel(brushmodel_t *brushmodel, void *buffer, size_t size)
     }
 
 #ifdef QW_HACK
-    brushmodel->checksum = 0;
-    brushmodel->checksum2 = 0;
-
-    /* checksum the map */
-    for (i = 0; i < HEADER_LUMPS; i++) {
-	unsigned int checksum;
-	const lump_t *headerlump = &header->lumps[i];
-	const byte *data = (byte *)header + headerlump->fileofs;
-
-	/* exclude entities from both checksums */
-	if (i == LUMP_ENTITIES)
-	    continue;
-	checksum = Com_BlockChecksum(data, headerlump->filelen);
-	brushmodel->checksum ^= checksum;
+    /* checksum the map, unless it's unchanged since it was last loaded */
+    if (!COM_GetFileChecksum(model->name, CHECKSUM_MAP, &brushmodel->checksum)
+	|| !COM_GetFileChecksum(model->name, CHECKSUM_MAP2,
+				&brushmodel->checksum2)) {
+	brushmodel->checksum = 0;
+	brushmodel->checksum2 = 0;
+	for (i = 0; i < HEADER_LUMPS; i++) {
+	    unsigned int checksum;
+	    const lump_t *headerlump = &header->lumps[i];
+	    const byte *data = (byte *)header + headerlump->fileofs;
+
+	    /* exclude entities from both checksums */
+	    if (i == LUMP_ENTITIES)
+		continue;
+	    checksum = Com_BlockChecksum(data, headerlump->filelen);
+	    brushmodel->checksum ^= checksum;
 
-	/* Exclude visibility, leafs and nodes from checksum2 */
-	if (i == LUMP_VISIBILITY || i == LUMP_LEAFS || i == LUMP_NODES)
-	    continue;
-	brushmodel->checksum2 ^= checksum;
+	    /* Exclude visibility, leafs and nodes from checksum2 */
+	    if (i == LUMP_VISIBILITY || i == LUMP_LEAFS || i == LUMP_NODES)
+		continue;
+	    brushmodel->checksum2 ^= checksum;
+	}
+	brushmodel->checksum = LittleLong(brushmodel->checksum);
+	brushmodel->checksum2 = LittleLong(brushmodel->checksum2);
+	COM_SetFileChecksum(model->name, CHECKSUM_MAP, brushmodel->checksum);
+	COM_SetFileChecksum(model->name, CHECKSUM_MAP2, brushmodel->checksum2);
     }
-    brushmodel->checksum = LittleLong(brushmodel->checksum);
-    brushmodel->checksum2 = LittleLong(brushmodel->checksum2);
 #endif
 
     /* load into heap */
@@ -1855,7 +2436,12 @@ Mod_LoadBrushModel(brushmodel_t *brushmodel, void *buffer, size_t size)
     Mod_LoadEntities(brushmodel, header);
     Mod_LoadSubmodels(brushmodel, header);
 
+    Mod_SortNodes(brushmodel);
+    Mod_SortClipnodes(brushmodel);
+    Mod_SetParent(brushmodel->nodes, NULL);
+
     Mod_MakeDrawHull(brushmodel);
+    Mod_MakeHullNodes(brushmodel);
 
     model->numframes = 2;		// regular and alternate animation
     model->flags = 0;
@@ -1866,11 +2452,12 @@ Mod_LoadBrushModel(brushmodel_t *brushmodel, void *buffer, size_t size)
      * - If any other model has more leafs, then we may be in trouble...
      */
     if (brushmodel->numleafs > pvscache_numleafs) {
-	if (pvscache[0].leafbits)
+	if (pvscache)
 	    SV_Error("%s: %d allocated for visdata, but model %s has %d leafs",
 		     __func__, pvscache_numleafs, model->name,
 		     brushmodel->numleafs);
 	Mod_InitPVSCache(brushmodel->numleafs);
+	Mod_PrecomputePVS(brushmodel);
     }
 
     Mod_SetupSubmodels(brushmodel);
@@ -1998,6 +2585,14 @@ static const boxhull_t boxhull_template = {
 	{ .normal = { 0, 1, 0 }, .dist = 0, .type = 1 },
 	{ .normal = { 0, 0, 1 }, .dist = 0, .type = 2 },
 	{ .normal = { 0, 0, 1 }, .dist = 0, .type = 2 }
+    },
+    .nodes = {
+	{ .normal = { 1, 0, 0 }, .type = 0, .children = { CONTENTS_EMPTY, 1 } },
+	{ .normal = { 1, 0, 0 }, .type = 0, .children = { 2, CONTENTS_EMPTY } },
+	{ .normal = { 0, 1, 0 }, .type = 1, .children = { CONTENTS_EMPTY, 3 } },
+	{ .normal = { 0, 1, 0 }, .type = 1, .children = { 4, CONTENTS_EMPTY } },
+	{ .normal = { 0, 0, 1 }, .type = 2, .children = { CONTENTS_EMPTY, 5 } },
+	{ .normal = { 0, 0, 1 }, .type = 2, .children = { CONTENTS_SOLID, CONTENTS_EMPTY } }
     }
 };
 
@@ -2015,12 +2610,13 @@ Mod_CreateBoxhull(const vec3_t mins, const vec3_t maxs, boxhull_t *boxhull)
     memcpy(boxhull, &boxhull_template, sizeof(boxhull_template));
 
     boxhull->hull.planes = boxhull->planes;
-    boxhull->planes[0].dist = maxs[0];
-    boxhull->planes[1].dist = mins[0];
-    boxhull->planes[2].dist = maxs[1];
-    boxhull->planes[3].dist = mins[1];
-    boxhull->planes[4].dist = maxs[2];
-    boxhull->planes[5].dist = mins[2];
+    boxhull->hull.nodes = boxhull->nodes;
+    boxhull->planes[0].dist = boxhull->nodes[0].dist = maxs[0];
+    boxhull->planes[1].dist = boxhull->nodes[1].dist = mins[0];
+    boxhull->planes[2].dist = boxhull->nodes[2].dist = maxs[1];
+    boxhull->planes[3].dist = boxhull->nodes[3].dist = mins[1];
+    boxhull->planes[4].dist = boxhull->nodes[4].dist = maxs[2];
+    boxhull->planes[5].dist = boxhull->nodes[5].dist = mins[2];
 }
 
 
@@ -2040,20 +2636,17 @@ int
 Mod_HullPointContents(const hull_t *hull, int nodenum, const vec3_t point)
 {
     float dist;
-    const mclipnode_t *node;
-    const mplane_t *plane;
+    const mhullnode_t *node;
 
     while (nodenum >= 0) {
 	if (nodenum < hull->firstclipnode || nodenum > hull->lastclipnode)
 	    SV_Error("%s: bad node number (%i)", __func__, nodenum);
 
-	node = hull->clipnodes + nodenum;
-	plane = hull->planes + node->planenum;
-
-	if (plane->type < 3)
-	    dist = point[plane->type] - plane->dist;
+	node = hull->nodes + nodenum;
+	if (node->type < 3)
+	    dist = point[node->type] - node->dist;
 	else
-	    dist = DotProduct(plane->normal, point) - plane->dist;
+	    dist = DotProduct(node->normal, point) - node->dist;
 	if (dist < 0)
 	    nodenum = node->children[1];
 	else
@@ -2064,6 +2657,9 @@ Mod_HullPointContents(const hull_t *hull, int nodenum, const vec3_t point)
 }
 #endif
 
+/* Set while traces run on several threads */
+static qboolean mod_tracethreaded;
+
 /* 1/32 epsilon to keep floating point happy */
 #define	DIST_EPSILON	(0.03125)
 
@@ -2077,8 +2673,7 @@ Mod_TraceHull_r(const hull_t *hull, int nodenum,
 		const float p1f, const float p2f,
 		const vec3_t p1, const vec3_t p2, trace_t *trace)
 {
-    const mclipnode_t *node;
-    const mplane_t *plane;
+    const mhullnode_t *node;
     vec3_t mid;
     vec_t dist1, dist2, frac, midf;
     int i, child, side, contents;
@@ -2101,14 +2696,13 @@ Mod_TraceHull_r(const hull_t *hull, int nodenum,
 	SV_Error("%s: bad node number", __func__);
 
     /* Find the point distances */
-    node = hull->clipnodes + nodenum;
-    plane = hull->planes + node->planenum;
-    if (plane->type < 3) {
-	dist1 = p1[plane->type] - plane->dist;
-	dist2 = p2[plane->type] - plane->dist;
+    node = hull->nodes + nodenum;
+    if (node->type < 3) {
+	dist1 = p1[node->type] - node->dist;
+	dist2 = p2[node->type] - node->dist;
     } else {
-	dist1 = DotProduct(plane->normal, p1) - plane->dist;
-	dist2 = DotProduct(plane->normal, p2) - plane->dist;
+	dist1 = DotProduct(node->normal, p1) - node->dist;
+	dist2 = DotProduct(node->normal, p2) - node->dist;
     }
 
 #if 1
@@ -2170,11 +2764,11 @@ Mod_TraceHull_r(const hull_t *hull, int nodenum,
 
     /* The other side of the node is solid, this is the impact point */
     if (!side) {
-	VectorCopy(plane->normal, trace->plane.normal);
-	trace->plane.dist = plane->dist;
+	VectorCopy(node->normal, trace->plane.normal);
+	trace->plane.dist = node->dist;
     } else {
-	VectorSubtract(vec3_origin, plane->normal, trace->plane.normal);
-	trace->plane.dist = -plane->dist;
+	VectorSubtract(vec3_origin, node->normal, trace->plane.normal);
+	trace->plane.dist = -node->dist;
     }
 
     /* shouldn't really happen, but does occasionally */
@@ -2184,7 +2778,8 @@ Mod_TraceHull_r(const hull_t *hull, int nodenum,
 	if (frac < 0) {
 	    trace->fraction = midf;
 	    VectorCopy(mid, trace->endpos);
-	    Con_DPrintf("backup past 0\n");
+	    if (!mod_tracethreaded)
+		Con_DPrintf("backup past 0\n");
 	    return false;
 	}
 	midf = p1f + (p2f - p1f) * frac;
@@ -2200,9 +2795,109 @@ Mod_TraceHull_r(const hull_t *hull, int nodenum,
     return false;
 }
 
+/*
+ * The traces through the map and brush model hulls depend on nothing but
+ * the hull and the two points, so the recent ones are kept.  Monsters and
+ * players trace the same short moves over and over; those get answered
+ * without walking the tree.  The box hulls are built on the stack for each
+ * trace and aren't worth keeping.
+ */
+#define TRACE_CACHE 256
+
+typedef struct {
+    const mhullnode_t *nodes;
+    int nodenum;
+    vec3_t p1, p2;
+    qboolean result;
+    trace_t trace;
+} tracecache_t;
+
+static tracecache_t tracecache[TRACE_CACHE];
+
+void
+Mod_ClearTraceCache(void)
+{
+    memset(tracecache, 0, sizeof(tracecache));
+}
+
+/*
+ * While the traces are threaded the cache is left alone and nothing is
+ * printed.  Set and cleared by the main thread with the workers idle.
+ */
+void
+Mod_SetTraceThreaded(qboolean threaded)
+{
+    mod_tracethreaded = threaded;
+}
+
+static unsigned
+Mod_TraceHash(const mhullnode_t *nodes, int nodenum,
+	      const vec3_t p1, const vec3_t p2)
+{
+    unsigned hash, bits;
+    int i;
+
+    hash = (unsigned)((uintptr_t)nodes >> 4) + nodenum * 0x9e3779b1u;
+    for (i = 0; i < 3; i++) {
+	memcpy(&bits, &p1[i], sizeof(bits));
+	hash = (hash ^ bits) * 0x01000193u;
+	memcpy(&bits, &p2[i], sizeof(bits));
+	hash = (hash ^ bits) * 0x01000193u;
+    }
+
+    return (hash ^ (hash >> 16)) & (TRACE_CACHE - 1);
+}
+
+/*
+ * The cached trace is the result of tracing with a default trace, which
+ * the recursion only ever clears allsolid from and sets the other flags
+ * on.  The impact is only written when it returns false without being all
+ * solid.
+ */
+static qboolean
+Mod_TraceFromCache(const tracecache_t *cache, trace_t *trace)
+{
+    const trace_t *cached = &cache->trace;
+
+    trace->allsolid = cached->allsolid;
+    trace->startsolid |= cached->startsolid;
+    trace->inopen |= cached->inopen;
+    trace->inwater |= cached->inwater;
+    if (!cache->result && !cached->allsolid) {
+	trace->fraction = cached->fraction;
+	VectorCopy(cached->endpos, trace->endpos);
+	trace->plane = cached->plane;
+    }
+
+    return cache->result;
+}
+
 qboolean
 Mod_TraceHull(const hull_t *hull, int nodenum,
 	      const vec3_t p1, const vec3_t p2, trace_t *trace)
 {
-    return Mod_TraceHull_r(hull, nodenum, 0, 1, p1, p2, trace);
+    tracecache_t *cache;
+
+    /* only the usual default trace is cached */
+    if (hull->clipnodes == box_clipnodes || !trace->allsolid
+	|| mod_tracethreaded)
+	return Mod_TraceHull_r(hull, nodenum, 0, 1, p1, p2, trace);
+
+    cache = &tracecache[Mod_TraceHash(hull->nodes, nodenum, p1, p2)];
+    if (cache->nodes == hull->nodes && cache->nodenum == nodenum
+	&& !memcmp(cache->p1, p1, sizeof(vec3_t))
+	&& !memcmp(cache->p2, p2, sizeof(vec3_t)))
+	return Mod_TraceFromCache(cache, trace);
+
+    memset(&cache->trace, 0, sizeof(cache->trace));
+    cache->trace.fraction = 1;
+    cache->trace.allsolid = true;
+    VectorCopy(p2, cache->trace.endpos);
+    cache->result = Mod_TraceHull_r(hull, nodenum, 0, 1, p1, p2, &cache->trace);
+    cache->nodes = hull->nodes;
+    cache->nodenum = nodenum;
+    VectorCopy(p1, cache->p1);
+    VectorCopy(p2, cache->p2);
+
+    return Mod_TraceFromCache(cache, trace);
 }
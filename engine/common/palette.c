@@ -0,0 +1,107 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// palette.c -- nearest colour searches in a palette
+
+#include "palette.h"
+
+void
+Pal_InitSearch(palsearch_t *search, const byte *palette, int stride)
+{
+    int i, j, count[256], start[256];
+    const byte *colour;
+
+    /* counting sort on red, keeping the palette order within each red */
+    for (i = 0; i < 256; i++)
+	count[i] = 0;
+    for (i = 0; i < 256; i++)
+	count[palette[i * stride]]++;
+    for (i = 0, j = 0; i < 256; i++) {
+	start[i] = j;
+	j += count[i];
+    }
+    for (i = 0; i < 256; i++) {
+	colour = palette + i * stride;
+	j = start[colour[0]]++;
+	search->rgb[j][0] = colour[0];
+	search->rgb[j][1] = colour[1];
+	search->rgb[j][2] = colour[2];
+	search->index[j] = i;
+    }
+}
+
+static inline void
+Pal_Check(const palsearch_t *search, int i, int r, int g, int b,
+	  int *best, int *bestdist)
+{
+    int dr = search->rgb[i][0] - r;
+    int dg = search->rgb[i][1] - g;
+    int db = search->rgb[i][2] - b;
+    int dist = dr * dr + dg * dg + db * db;
+
+    if (dist < *bestdist || (dist == *bestdist && search->index[i] < *best)) {
+	*bestdist = dist;
+	*best = search->index[i];
+    }
+}
+
+int
+Pal_FindClosest(const palsearch_t *search, int r, int g, int b)
+{
+    int lo, hi, mid, dr;
+    int best, bestdist;
+
+    /* the first entry with red >= r */
+    lo = 0;
+    hi = 256;
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (search->rgb[mid][0] < r)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    /*
+     * Work outwards from there.  A tie on distance can still go to a lower
+     * index, so only stop when red alone is strictly further than the best.
+     */
+    best = 256;
+    bestdist = 0x7fffffff;
+    hi = lo;
+    lo = lo - 1;
+    while (lo >= 0 || hi < 256) {
+	if (hi < 256) {
+	    dr = search->rgb[hi][0] - r;
+	    if (dr * dr > bestdist)
+		hi = 256;
+	    else
+		Pal_Check(search, hi++, r, g, b, &best, &bestdist);
+	}
+	if (lo >= 0) {
+	    dr = search->rgb[lo][0] - r;
+	    if (dr * dr > bestdist)
+		lo = -1;
+	    else
+		Pal_Check(search, lo--, r, g, b, &best, &bestdist);
+	}
+    }
+
+    return best;
+}
@@ -0,0 +1,655 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// parallel.c -- a pool of worker threads for loops and background jobs
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "console.h"
+#include "sys.h"
+
+/*
+==============================================================================
+
+WORKER THREADS
+
+COM_ParallelFor hands out the indices of a loop in chunks to the worker
+threads and the calling thread, and returns once they're all done.
+COM_AddJob queues a function for the workers to run whenever they're free;
+a counter tracks how many jobs of a batch are still outstanding, so the
+batch can be waited on, or given as what a later job has to wait for.  A
+job can also leave something for the main thread to finish, which is done
+by COM_RunFinishedJobs at the start of the next frame.
+
+The workers are started on first use, one per core besides the caller, and
+more are added if a loop asks for them.  A worker busy with a job joins a
+loop late or not at all; the caller picks up whatever is left.  Nothing a
+worker runs may touch the console, the hunk or anything else the main thread
+owns: COM_ThreadPrintf and the per-thread scratch memory are there instead.
+
+==============================================================================
+*/
+
+#define PARALLEL_MAXTHREADS 16
+#define PARALLEL_MAXJOBS 1024
+
+typedef struct job_s {
+    struct job_s *next;
+    void (*func)(void *data);
+    void (*finish)(void *data);	// run on the main thread afterwards
+    void *data;
+    const int *after;		// not started until this is zero
+    int *counter;
+} job_t;
+
+static struct {
+    int numworkers;		// started, not counting the caller
+    qboolean initialized;
+    qboolean quit;
+    unsigned loop;		// bumped for each loop
+    void (*func)(void *data, int index);
+    void *data;
+    int count, next, chunk;
+    int slots;			// workers the current loop still wants
+    int busy;			// workers still on the current loop
+
+    job_t jobs[PARALLEL_MAXJOBS];
+    job_t *free;
+    job_t *queued, **queuedtail;
+    job_t *finished, **finishedtail;
+    int running;		// jobs taken off the queue, not yet done
+#ifdef _WIN32
+    HANDLE threads[PARALLEL_MAXTHREADS];
+    DWORD mainthread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+    CONDITION_VARIABLE done;
+#else
+    pthread_t threads[PARALLEL_MAXTHREADS];
+    pthread_t mainthread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_cond_t done;
+#endif
+} workers;
+
+#ifdef _WIN32
+#define PAR_Lock()	EnterCriticalSection(&workers.lock)
+#define PAR_Unlock()	LeaveCriticalSection(&workers.lock)
+#define PAR_Wait(c)	SleepConditionVariableCS(&workers.c, &workers.lock, INFINITE)
+#define PAR_Signal(c)	WakeAllConditionVariable(&workers.c)
+#else
+#define PAR_Lock()	pthread_mutex_lock(&workers.lock)
+#define PAR_Unlock()	pthread_mutex_unlock(&workers.lock)
+#define PAR_Wait(c)	pthread_cond_wait(&workers.c, &workers.lock)
+#define PAR_Signal(c)	pthread_cond_broadcast(&workers.c)
+#endif
+
+/*
+ * Scratch memory, a stack of blocks per thread.  Whatever a job allocates is
+ * released when it returns.
+ */
+#define SCRATCH_BLOCK (256 * 1024)
+
+typedef struct scratchblock_s {
+    struct scratchblock_s *prev;
+    size_t start;		// mark at the start of the block
+    size_t size;
+    size_t used;
+} scratchblock_t;
+
+static __thread scratchblock_t *scratch;
+
+size_t
+COM_ScratchMark(void)
+{
+    return scratch ? scratch->start + scratch->used : 0;
+}
+
+/*
+==============
+COM_ScratchAlloc
+
+Returns NULL if out of memory.  Like Hunk_TempAlloc, but for any thread, and
+nothing is freed until COM_ScratchFree is given a mark from before it.
+==============
+*/
+void *
+COM_ScratchAlloc(size_t size)
+{
+    scratchblock_t *block = scratch;
+    size_t blocksize;
+    void *mem;
+
+    size = (size + 15) & ~(size_t)15;
+    if (!block || block->size - block->used < size) {
+	blocksize = qmax((size_t)SCRATCH_BLOCK, size);
+	block = malloc(sizeof(*block) + 15 + blocksize);
+	if (!block)
+	    return NULL;
+	block->prev = scratch;
+	block->start = COM_ScratchMark();
+	block->size = blocksize;
+	block->used = 0;
+	scratch = block;
+    }
+    mem = (byte *)(((uintptr_t)(block + 1) + 15) & ~(uintptr_t)15) + block->used;
+    block->used += size;
+
+    return mem;
+}
+
+void
+COM_ScratchFree(size_t mark)
+{
+    scratchblock_t *block;
+
+    /* keep the oldest block for next time */
+    while (scratch && scratch->prev && scratch->start >= mark) {
+	block = scratch;
+	scratch = block->prev;
+	free(block);
+    }
+    if (scratch)
+	scratch->used = mark > scratch->start ? mark - scratch->start : 0;
+}
+
+/* Called and returns with the lock held */
+static void
+PAR_RunChunks(void)
+{
+    int index, end;
+
+    while (workers.next < workers.count) {
+	index = workers.next;
+	end = index + workers.chunk;
+	if (end > workers.count)
+	    end = workers.count;
+	workers.next = end;
+	PAR_Unlock();
+
+	for (; index < end; index++)
+	    workers.func(workers.data, index);
+
+	PAR_Lock();
+    }
+}
+
+/* Called with the lock held; the first queued job that's free to start */
+static job_t *
+PAR_TakeJob(void)
+{
+    job_t **link, *job;
+
+    for (link = &workers.queued; (job = *link); link = &job->next) {
+	if (job->after && *job->after)
+	    continue;
+	*link = job->next;
+	if (!*link)
+	    workers.queuedtail = link;
+	workers.running++;
+	return job;
+    }
+
+    return NULL;
+}
+
+/* Called and returns with the lock held */
+static void
+PAR_RunJob(job_t *job)
+{
+    size_t mark;
+
+    PAR_Unlock();
+    mark = COM_ScratchMark();
+    job->func(job->data);
+    COM_ScratchFree(mark);
+    PAR_Lock();
+
+    workers.running--;
+    if (job->counter)
+	--*job->counter;
+    if (job->finish) {
+	job->next = NULL;
+	*workers.finishedtail = job;
+	workers.finishedtail = &job->next;
+    } else {
+	job->next = workers.free;
+	workers.free = job;
+    }
+    PAR_Signal(done);
+    if (job->counter && !*job->counter && workers.queued)
+	PAR_Signal(changed);	// something may have been waiting on it
+}
+
+static void
+PAR_RunWorker(void)
+{
+    unsigned loop = 0;		// the workers start before the first loop
+    job_t *job;
+
+    PAR_Lock();
+    for (;;) {
+	if (workers.loop != loop) {
+	    loop = workers.loop;
+	    if (workers.slots) {
+		workers.slots--;
+		PAR_RunChunks();
+		if (!--workers.busy)
+		    PAR_Signal(done);
+	    }
+	    continue;
+	}
+	if ((job = PAR_TakeJob())) {
+	    PAR_RunJob(job);
+	    continue;
+	}
+	if (workers.quit)
+	    break;
+	PAR_Wait(changed);
+    }
+    PAR_Unlock();
+
+    COM_ScratchFree(0);
+    free(scratch);
+    scratch = NULL;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+PAR_WorkerMain(LPVOID arg)
+{
+    PAR_RunWorker();
+    return 0;
+}
+#else
+static void *
+PAR_WorkerMain(void *arg)
+{
+    PAR_RunWorker();
+    return NULL;
+}
+#endif
+
+static void
+PAR_Initialize(void)
+{
+    int i;
+
+    workers.quit = false;
+    workers.loop = 0;
+    workers.free = NULL;
+    for (i = 0; i < PARALLEL_MAXJOBS; i++) {
+	workers.jobs[i].next = workers.free;
+	workers.free = &workers.jobs[i];
+    }
+    workers.queued = NULL;
+    workers.queuedtail = &workers.queued;
+    workers.finished = NULL;
+    workers.finishedtail = &workers.finished;
+    workers.running = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&workers.lock);
+    InitializeConditionVariable(&workers.changed);
+    InitializeConditionVariable(&workers.done);
+#else
+    pthread_mutex_init(&workers.lock, NULL);
+    pthread_cond_init(&workers.changed, NULL);
+    pthread_cond_init(&workers.done, NULL);
+#endif
+    workers.initialized = true;
+}
+
+/* Make sure there are at least this many workers */
+static void
+PAR_StartWorkers(int numworkers)
+{
+    int i;
+
+    if (!workers.initialized)
+	PAR_Initialize();
+    if (numworkers > PARALLEL_MAXTHREADS)
+	numworkers = PARALLEL_MAXTHREADS;
+
+    for (i = workers.numworkers; i < numworkers; i++) {
+#ifdef _WIN32
+	workers.threads[i] = CreateThread(NULL, 0, PAR_WorkerMain, NULL, 0, NULL);
+	if (!workers.threads[i])
+	    break;
+#else
+	if (pthread_create(&workers.threads[i], NULL, PAR_WorkerMain, NULL))
+	    break;
+#endif
+    }
+    workers.numworkers = i;
+}
+
+/*
+==============
+COM_NumCores
+==============
+*/
+int
+COM_NumCores(void)
+{
+    int cores;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    cores = info.dwNumberOfProcessors;
+#else
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return qmax(cores, 1);
+}
+
+/*
+==============
+COM_ParallelInit
+
+Notes which thread is the main one; called from COM_Init
+==============
+*/
+void
+COM_ParallelInit(void)
+{
+    if (!workers.initialized)
+	PAR_Initialize();
+#ifdef _WIN32
+    workers.mainthread = GetCurrentThreadId();
+#else
+    workers.mainthread = pthread_self();
+#endif
+}
+
+static qboolean
+PAR_IsMainThread(void)
+{
+#ifdef _WIN32
+    return GetCurrentThreadId() == workers.mainthread;
+#else
+    return pthread_equal(pthread_self(), workers.mainthread);
+#endif
+}
+
+/*
+==============
+COM_ParallelShutdown
+
+Stops the workers once they've run everything they can; anything left in
+the queue is waiting on a counter nothing will change, and is dropped.
+==============
+*/
+void
+COM_ParallelShutdown(void)
+{
+    job_t *job;
+    int i;
+
+    if (!workers.numworkers)
+	return;
+
+    PAR_Lock();
+    workers.quit = true;
+    PAR_Signal(changed);
+    PAR_Unlock();
+    for (i = 0; i < workers.numworkers; i++) {
+#ifdef _WIN32
+	WaitForSingleObject(workers.threads[i], INFINITE);
+	CloseHandle(workers.threads[i]);
+#else
+	pthread_join(workers.threads[i], NULL);
+#endif
+    }
+    workers.numworkers = 0;
+
+    PAR_Lock();
+    workers.quit = false;
+    while ((job = workers.queued)) {
+	workers.queued = job->next;
+	if (job->counter)
+	    --*job->counter;
+	job->next = workers.free;
+	workers.free = job;
+    }
+    workers.queuedtail = &workers.queued;
+    PAR_Unlock();
+
+    if (PAR_IsMainThread())
+	COM_RunFinishedJobs();
+}
+
+/*
+==============
+COM_ParallelFor
+
+Calls func(data, i) for each i from 0 to count - 1, on up to numthreads
+threads including this one.  The order of the calls isn't defined.
+==============
+*/
+void
+COM_ParallelFor(int numthreads, void (*func)(void *data, int index),
+		void *data, int count)
+{
+    int i;
+
+    if (numthreads > PARALLEL_MAXTHREADS + 1)
+	numthreads = PARALLEL_MAXTHREADS + 1;
+    if (numthreads < 2 || count < 2) {
+	for (i = 0; i < count; i++)
+	    func(data, i);
+	return;
+    }
+
+    if (workers.numworkers < numthreads - 1)
+	PAR_StartWorkers(qmax(numthreads, COM_NumCores()) - 1);
+
+    PAR_Lock();
+    workers.func = func;
+    workers.data = data;
+    workers.count = count;
+    workers.next = 0;
+    workers.chunk = count / (numthreads * 4);
+    if (workers.chunk < 1)
+	workers.chunk = 1;
+    workers.slots = qmin(numthreads - 1, workers.numworkers);
+    workers.busy = workers.slots;
+    workers.loop++;
+    PAR_Signal(changed);
+
+    PAR_RunChunks();
+    workers.busy -= workers.slots;	// nobody came for these in time
+    workers.slots = 0;
+    while (workers.busy)
+	PAR_Wait(done);
+    PAR_Unlock();
+}
+
+/*
+==============
+COM_AddJob
+
+Queues func(data) to run on a worker.  If counter isn't NULL it goes up by
+one now and back down when the job is done; if after isn't NULL, the job
+won't start until it reads zero.  Counters belong to the caller but must
+start at zero and only change here.  If finish isn't NULL, finish(data) is
+run on the main thread once the job is done.
+==============
+*/
+void
+COM_AddJob(void (*func)(void *data), void (*finish)(void *data), void *data,
+	   int *counter, const int *after)
+{
+    job_t *job;
+
+    if (!workers.numworkers)
+	PAR_StartWorkers(qmax(COM_NumCores() - 1, 1));
+
+    PAR_Lock();
+    while (!(job = workers.free)) {
+	/* queue full, lend a hand until there's room */
+	if ((job = PAR_TakeJob()))
+	    PAR_RunJob(job);
+	else
+	    PAR_Wait(done);
+    }
+    workers.free = job->next;
+
+    job->next = NULL;
+    job->func = func;
+    job->finish = finish;
+    job->data = data;
+    job->after = after;
+    job->counter = counter;
+    if (counter)
+	++*counter;
+    *workers.queuedtail = job;
+    workers.queuedtail = &job->next;
+
+    /* without workers it's up to whoever waits on it */
+    if (!workers.numworkers && (!after || !*after)) {
+	job = PAR_TakeJob();
+	PAR_RunJob(job);
+    }
+    PAR_Signal(changed);
+    PAR_Unlock();
+}
+
+/*
+==============
+COM_WaitJobs
+
+Returns once the counter is back to zero, running queued jobs meanwhile
+==============
+*/
+void
+COM_WaitJobs(const int *counter)
+{
+    job_t *job;
+
+    if (!workers.initialized)
+	return;
+
+    PAR_Lock();
+    while (*counter) {
+	if ((job = PAR_TakeJob()))
+	    PAR_RunJob(job);
+	else
+	    PAR_Wait(done);
+    }
+    PAR_Unlock();
+}
+
+/*
+==============
+COM_RunFinishedJobs
+
+Runs the main thread's part of any jobs done since the last call
+==============
+*/
+void
+COM_RunFinishedJobs(void)
+{
+    job_t *job, *finished, **tail;
+
+    if (!workers.initialized || !workers.finished)
+	return;
+
+    PAR_Lock();
+    finished = workers.finished;
+    tail = workers.finishedtail;
+    workers.finished = NULL;
+    workers.finishedtail = &workers.finished;
+    PAR_Unlock();
+
+    for (job = finished; job; job = job->next)
+	job->finish(job->data);
+
+    PAR_Lock();
+    *tail = workers.free;
+    workers.free = finished;
+    PAR_Signal(done);
+    PAR_Unlock();
+}
+
+static void
+PAR_PrintFinish(void *data)
+{
+    Con_Printf("%s", (char *)data);
+    free(data);
+}
+
+/*
+==============
+COM_ThreadPrintf
+
+Con_Printf for any thread.  Off the main thread the text is held until the
+next COM_RunFinishedJobs, and dropped if there's no room to hold it.
+==============
+*/
+void
+COM_ThreadPrintf(const char *fmt, ...)
+{
+    va_list argptr;
+    char msg[MAX_PRINTMSG];
+    job_t *job;
+    char *text;
+
+    va_start(argptr, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, argptr);
+    va_end(argptr);
+
+    if (!workers.initialized || PAR_IsMainThread()) {
+	Con_Printf("%s", msg);
+	return;
+    }
+
+    text = malloc(strlen(msg) + 1);
+    if (!text)
+	return;
+    strcpy(text, msg);
+
+    PAR_Lock();
+    job = workers.free;
+    if (job) {
+	workers.free = job->next;
+	job->next = NULL;
+	job->finish = PAR_PrintFinish;
+	job->data = text;
+	*workers.finishedtail = job;
+	workers.finishedtail = &job->next;
+    }
+    PAR_Unlock();
+    if (!job)
+	free(text);
+}
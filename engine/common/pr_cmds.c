@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include <float.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "cmd.h"
 #include "console.h"
@@ -630,7 +632,7 @@ PF_ambientsound(void)
     const char *samp;
     float *pos;
     float vol, attenuation;
-    int i, soundnum;
+    int soundnum;
 
     pos = G_VECTOR(OFS_PARM0);
     samp = G_STRING(OFS_PARM1);
@@ -657,8 +659,7 @@ PF_ambientsound(void)
 #ifdef QW_HACK
     MSG_WriteByte(&sv.signon, svc_spawnstaticsound);
 #endif
-    for (i = 0; i < 3; i++)
-	MSG_WriteCoord(&sv.signon, pos[i]);
+    MSG_WriteCoords3(&sv.signon, pos);
 
 #ifdef NQ_HACK
     PF_WriteSoundNum_Static(&sv.signon, soundnum);
@@ -769,6 +770,106 @@ PF_traceline(void)
     pr_global_struct->trace_ent = EDICT_TO_PROG(entity);
 }
 
+/*
+=================
+PF_tracelines
+
+Traces a fan of lines from one start, like the visibility probes of a bot,
+finding the edicts which could clip them just once for them all.  The ends
+are read from consecutive vector fields of the probes entity, and each is
+replaced with where its line stopped.  Returns the lines that were blocked
+as bits, the first line in the lowest.
+
+float tracelines(entity probes, .vector firstend, float count,
+		 vector start, float nomonsters, entity ignore) = #100
+=================
+*/
+#define MAX_TRACELINES 24	/* the result stays exact as a float */
+
+static void
+PF_tracelines(void)
+{
+    edict_t *probes;
+    const edict_t *ignore;
+    const float *start;
+    float *end;
+    movetype_t nomonsters;
+    int field, count, blocked, i, j;
+    vec3_t mins, maxs;
+    tracearea_t area;
+    trace_t trace;
+
+    probes = G_EDICT(OFS_PARM0);
+    field = G_INT(OFS_PARM1);
+    count = G_FLOAT(OFS_PARM2);
+    start = G_VECTOR(OFS_PARM3);
+    nomonsters = G_FLOAT(OFS_PARM4);
+    ignore = G_EDICT(OFS_PARM5);
+
+    if (probes == sv.edicts)
+	PR_RunError("tracelines: probes in the world entity");
+    if (count < 0 || count > MAX_TRACELINES)
+	PR_RunError("tracelines: bad count %i", count);
+    if (field < 0 || field + count * 3 > progs->entityfields)
+	PR_RunError("tracelines: fields out of range");
+
+    VectorCopy(start, mins);
+    VectorCopy(start, maxs);
+    for (i = 0; i < count; i++) {
+	end = E_VECTOR(probes, field + i * 3);
+	for (j = 0; j < 3; j++) {
+	    mins[j] = qmin(mins[j], end[j]);
+	    maxs[j] = qmax(maxs[j], end[j]);
+	}
+    }
+    for (j = 0; j < 3; j++) {
+	mins[j] -= 1;
+	maxs[j] += 1;
+    }
+    SV_InitTraceArea(&area, mins, maxs, nomonsters, ignore);
+
+    blocked = 0;
+    for (i = 0; i < count; i++) {
+	end = E_VECTOR(probes, field + i * 3);
+	SV_TraceAreaLine(&area, start, end, &trace);
+	if (trace.fraction < 1 || trace.startsolid)
+	    blocked |= 1 << i;
+	VectorCopy(trace.endpos, end);
+    }
+
+    G_FLOAT(OFS_RETURN) = blocked;
+}
+
+/*
+=================
+PF_checkextension
+
+Lets the progs find out which of the builtins beyond the original ones
+this engine has (when the "pr_checkextension" cvar says it can be asked)
+
+float checkextension(string name) = #99
+=================
+*/
+static const char *const pr_extensions[] = {
+    "TYR_QC_TRACELINES",	/* tracelines = #100 */
+};
+
+static void
+PF_checkextension(void)
+{
+    const char *name;
+    int i;
+
+    name = G_STRING(OFS_PARM0);
+    for (i = 0; i < ARRAY_SIZE(pr_extensions); i++) {
+	if (!strcasecmp(name, pr_extensions[i])) {
+	    G_FLOAT(OFS_RETURN) = 1;
+	    return;
+	}
+    }
+    G_FLOAT(OFS_RETURN) = 0;
+}
+
 //============================================================================
 
 static int
@@ -969,6 +1070,15 @@ PF_cvar_set(void)
     Cvar_Set(var, val);
 }
 
+static int
+PF_CompareEdicts(const void *a, const void *b)
+{
+    const edict_t *ed1 = *(const edict_t *const *)a;
+    const edict_t *ed2 = *(const edict_t *const *)b;
+
+    return (ed1 > ed2) - (ed1 < ed2);
+}
+
 /*
 =================
 PF_findradius
@@ -976,24 +1086,43 @@ PF_findradius
 Returns a chain of entities that have origins within a spherical area
 
 findradius (origin, radius)
+
+Only the edicts linked into the area nodes near the sphere are looked at,
+which are all those that aren't SOLID_NOT once their spawn functions have
+set them up.  The chain still runs from the highest numbered edict down.
 =================
 */
 static void
 PF_findradius(void)
 {
+    static edict_t **edicts;
+    static int maxedicts;
     edict_t *ent, *chain;
     float rad;
     float *org;
-    vec3_t eorg;
-    int i, j;
+    vec3_t eorg, mins, maxs;
+    int i, j, numedicts;
 
     chain = (edict_t *)sv.edicts;
 
     org = G_VECTOR(OFS_PARM0);
     rad = G_FLOAT(OFS_PARM1);
 
-    ent = NEXT_EDICT(sv.edicts);
-    for (i = 1; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent)) {
+    if (maxedicts < sv.max_edicts) {
+	edicts = realloc(edicts, sv.max_edicts * sizeof(*edicts));
+	if (!edicts)
+	    SV_Error("%s: out of memory", __func__);
+	maxedicts = sv.max_edicts;
+    }
+    for (i = 0; i < 3; i++) {
+	mins[i] = org[i] - rad;
+	maxs[i] = org[i] + rad;
+    }
+    numedicts = SV_AreaEdicts(mins, maxs, edicts, maxedicts);
+    qsort(edicts, numedicts, sizeof(*edicts), PF_CompareEdicts);
+
+    for (i = 0; i < numedicts; i++) {
+	ent = edicts[i];
 	if (ent->free)
 	    continue;
 	if (ent->v.solid == SOLID_NOT)
@@ -1037,7 +1166,7 @@ PF_ftos(void)
 	sprintf(pr_string_temp, "%d", (int)v);
     else
 	sprintf(pr_string_temp, "%5.1f", v);
-    G_INT(OFS_RETURN) = PR_SetString(pr_string_temp);
+    G_INT(OFS_RETURN) = PR_SetTempString(pr_string_temp);
 }
 
 static void
@@ -1054,7 +1183,7 @@ PF_vtos(void)
 {
     sprintf(pr_string_temp, "'%5.1f %5.1f %5.1f'", G_VECTOR(OFS_PARM0)[0],
 	    G_VECTOR(OFS_PARM0)[1], G_VECTOR(OFS_PARM0)[2]);
-    G_INT(OFS_RETURN) = PR_SetString(pr_string_temp);
+    G_INT(OFS_RETURN) = PR_SetTempString(pr_string_temp);
 }
 
 static void
@@ -1080,7 +1209,7 @@ PF_Remove(void)
 static void
 PF_Find(void)
 {
-    int e;
+    int e, found;
     int f;
     const char *s, *t;
     edict_t *ed;
@@ -1091,6 +1220,13 @@ PF_Find(void)
     if (!s)
 	PR_RunError("%s: bad search string", __func__);
 
+    /* classname, targetname and target are indexed */
+    found = ED_FindString(e, f, s);
+    if (found >= 0) {
+	RETURN_EDICT(EDICT_NUM(found));
+	return;
+    }
+
     for (e++; e < sv.num_edicts; e++) {
 	ed = EDICT_NUM(e);
 	if (ed->free)
@@ -1337,6 +1473,7 @@ PF_lightstyle(void)
 	    ClientReliableWrite_Char(client, style);
 	    ClientReliableWrite_String(client, val);
 	}
+    SV_DemoWriteString(svc_lightstyle, style, val);
 #endif
 }
 
@@ -1489,6 +1626,8 @@ PF_aim(void)
 
     check = NEXT_EDICT(sv.edicts);
     for (i = 1; i < sv.num_edicts; i++, check = NEXT_EDICT(check)) {
+	if (sv.edhot[i].free)
+	    continue;		// and so can't take damage
 	if (check->v.takedamage != DAMAGE_AIM)
 	    continue;
 	if (check == ent)
@@ -1945,7 +2084,8 @@ PF_infokey(void)
     } else
 	value = "";
 
-    RETURN_STRING(value);
+    /* the info values are in buffers that get reused */
+    G_INT(OFS_RETURN) = PR_SetTempString(value);
 }
 
 /*
@@ -2094,6 +2234,10 @@ builtin_t pr_builtin[] = {
     PF_stof,
     PF_multicast,
 #endif
+
+    /* extensions, numbered as other engines number them */
+    [99] = PF_checkextension,
+    [100] = PF_tracelines,
 };
 
 builtin_t *pr_builtins = pr_builtin;
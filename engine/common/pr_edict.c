@@ -19,6 +19,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // sv_edict.c -- entity dictionary
 
+#include <stddef.h>
+#include <stdlib.h>
+
 #include "cmd.h"
 #include "console.h"
 #include "crc.h"
@@ -31,6 +34,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #ifdef NQ_HACK
 #include "host.h"
+#include "protocol.h"
 #include "quakedef.h"
 #include "sys.h"
 
@@ -69,15 +73,22 @@ static int type_size[8] = {
 
 static qboolean ED_ParseEpair(void *base, ddef_t *key, const char *s);
 
-#define	MAX_FIELD_LEN	64
-#define GEFV_CACHESIZE	2
-
+/*
+ * Hash chains of the field, global and function names, built when the progs
+ * are loaded.  Each chain is in index order, so the first of several with
+ * the same name is found, as with a linear search.
+ */
 typedef struct {
-    ddef_t *pcache;
-    char field[MAX_FIELD_LEN];
-} gefv_cache;
+    int *buckets;
+    int *next;
+    unsigned mask;
+} prnamehash_t;
 
-static gefv_cache gefvCache[GEFV_CACHESIZE] = { {NULL, ""}, {NULL, ""} };
+static prnamehash_t pr_fieldhash;
+static prnamehash_t pr_globalhash;
+static prnamehash_t pr_functionhash;
+
+pr_extfields_t pr_extfields;
 
 #ifdef NQ_HACK
 unsigned short pr_crc;
@@ -111,6 +122,280 @@ ED_ClearEdict(edict_t *e)
 {
     memset(&e->v, 0, progs->entityfields * 4);
     e->free = false;
+    EDICT_HOT(e)->free = false;
+}
+
+/*
+ * Freed edicts wait in a ring in the order they were freed, so the one at
+ * the head has been free the longest and is the only one ED_Alloc needs to
+ * look at.  An entry goes stale if its edict is brought back some other way
+ * than ED_Alloc (loading a savegame), and is dropped when it comes up.
+ */
+static struct {
+    int *ring;
+    int head, count;
+    int active;			// edicts in use
+    int peak_active;
+    int reused;			// allocations taken from the ring
+} ed_free;
+
+static cvar_t sv_maxedicts = { "sv_maxedicts", stringify(MAX_EDICTS) };
+
+/* tells the progs that they can ask for extensions with checkextension */
+static cvar_t pr_checkextension = { "pr_checkextension", "1" };
+
+static int
+ED_FirstFree(void)
+{
+#ifdef NQ_HACK
+    return svs.maxclients + 1;
+#endif
+#if defined(QW_HACK) && defined(SERVERONLY)
+    return MAX_CLIENTS + 1;
+#endif
+}
+
+static void
+ED_PushFree(int num)
+{
+    if (num < ED_FirstFree() || ed_free.count == sv.max_edicts)
+	return;
+    ed_free.ring[(ed_free.head + ed_free.count++) % sv.max_edicts] = num;
+}
+
+/*
+ * find() on classname, targetname or target looks the string up in an index
+ * of the edicts holding each value, chained in order so that a loop over the
+ * matches takes one step per match.  A field's index is rebuilt the next time
+ * it's searched after anything stores to that field, which it is told of by
+ * ED_FieldStored.  Edicts are checked as they're found, so those freed or
+ * cleared since don't need to be taken out.  Native progs store to the fields
+ * without telling anyone, so they're always searched the old way.
+ */
+#define FIND_HASH	256
+
+unsigned ed_findgen[FIND_NUMFIELDS] = { 1, 1, 1 };
+
+static struct {
+    int *next[FIND_NUMFIELDS];	// next edict in the same bucket, 0 ends
+    unsigned *hash[FIND_NUMFIELDS];	// of the edict's value, 0 if not listed
+    int heads[FIND_NUMFIELDS][FIND_HASH];
+    unsigned built[FIND_NUMFIELDS];	// ed_findgen when last built
+    int numedicts[FIND_NUMFIELDS];	// sv.num_edicts then
+} ed_find;
+
+static const int ed_findofs[FIND_NUMFIELDS] = {
+    offsetof(entvars_t, classname) / 4,
+    offsetof(entvars_t, targetname) / 4,
+    offsetof(entvars_t, target) / 4,
+};
+
+void
+ED_FindChanged(void)
+{
+    int i;
+
+    for (i = 0; i < FIND_NUMFIELDS; i++)
+	ed_findgen[i]++;
+}
+
+static void
+ED_InitFind(void)
+{
+    int i;
+
+    for (i = 0; i < FIND_NUMFIELDS; i++) {
+	ed_find.next[i] = Hunk_AllocName(sv.max_edicts * sizeof(int),
+					 "edictfind");
+	ed_find.hash[i] = Hunk_AllocName(sv.max_edicts * sizeof(unsigned),
+					 "edictfind");
+	ed_find.built[i] = 0;
+    }
+}
+
+static unsigned
+ED_FindHash(const char *s)
+{
+    unsigned hash = COM_HashFileName(s);
+
+    return hash ? hash : 1;
+}
+
+static void
+ED_BuildFind(int field)
+{
+    int *next = ed_find.next[field];
+    unsigned *hash = ed_find.hash[field];
+    int *heads = ed_find.heads[field];
+    const edict_t *ed;
+    const char *s;
+    int e, bucket;
+
+    memset(heads, 0, sizeof(ed_find.heads[field]));
+    for (e = sv.num_edicts - 1; e > 0; e--) {
+	hash[e] = 0;
+	ed = EDICT_NUM(e);
+	if (ed->free)
+	    continue;
+	s = E_STRING(ed, ed_findofs[field]);
+	if (!s[0])
+	    continue;
+	hash[e] = ED_FindHash(s);
+	bucket = hash[e] % FIND_HASH;
+	next[e] = heads[bucket];
+	heads[bucket] = e;
+    }
+    ed_find.built[field] = ed_findgen[field];
+    ed_find.numedicts[field] = sv.num_edicts;
+}
+
+/*
+=================
+ED_FindString
+
+Returns the number of the first edict after start whose field at ofs holds the
+string, 0 if there are none, or -1 if the field isn't indexed
+=================
+*/
+int
+ED_FindString(int start, int ofs, const char *s)
+{
+    const int *next;
+    const unsigned *hash;
+    const edict_t *ed;
+    unsigned h;
+    int field, e;
+
+    if (PR_NativeLoaded() || !s[0])
+	return -1;
+    for (field = 0; field < FIND_NUMFIELDS; field++)
+	if (ed_findofs[field] == ofs)
+	    break;
+    if (field == FIND_NUMFIELDS)
+	return -1;
+
+    if (ed_find.built[field] != ed_findgen[field])
+	ED_BuildFind(field);
+    next = ed_find.next[field];
+    hash = ed_find.hash[field];
+
+    /* the last match is normally in the same bucket, so carry on from it */
+    h = ED_FindHash(s);
+    if (start > 0 && start < ed_find.numedicts[field] && hash[start]
+	&& hash[start] % FIND_HASH == h % FIND_HASH)
+	e = next[start];
+    else
+	e = ed_find.heads[field][h % FIND_HASH];
+
+    for (; e; e = next[e]) {
+	if (e <= start || e >= sv.num_edicts || hash[e] != h)
+	    continue;
+	ed = EDICT_NUM(e);
+	if (ed->free)
+	    continue;
+	if (!strcmp(E_STRING(ed, ofs), s))
+	    return e;
+    }
+
+    return 0;
+}
+
+/*
+=================
+ED_InitEdicts
+
+Allocates the edicts for a new map.  They can't be moved once the map is
+running, as the world links and the C code hold pointers to them, so the
+number is fixed here from sv_maxedicts, within what the protocol can send.
+=================
+*/
+void
+ED_InitEdicts(void)
+{
+    int max;
+
+    max = sv_maxedicts.value;
+#ifdef NQ_HACK
+    if (max > max_edicts(sv.protocol)) {
+	Con_Printf("%s: protocol %d allows %d edicts at most\n",
+		   sv_maxedicts.name, sv.protocol, max_edicts(sv.protocol));
+	max = max_edicts(sv.protocol);
+    }
+#endif
+#if defined(QW_HACK) && defined(SERVERONLY)
+    if (max > MAX_NET_EDICTS) {
+	Con_Printf("%s: the protocol allows %d edicts at most\n",
+		   sv_maxedicts.name, MAX_NET_EDICTS);
+	max = MAX_NET_EDICTS;
+    }
+#endif
+    if (max < MAX_EDICTS)
+	max = MAX_EDICTS;
+
+    sv.max_edicts = max;
+    sv.edicts = Hunk_AllocName(sv.max_edicts * pr_edict_size, "edicts");
+    sv.edhot = Hunk_AllocName(sv.max_edicts * sizeof(edhot_t), "edicthot");
+    ed_free.ring = Hunk_AllocName(sv.max_edicts * sizeof(int), "edictfree");
+    ed_free.head = ed_free.count = 0;
+    ed_free.active = ed_free.peak_active = 0;
+    ed_free.reused = 0;
+
+    ED_InitFind();
+}
+
+/*
+=================
+ED_ResetFreeList
+
+Rebuilds the free ring, the count of edicts in use and the hot copies after
+the edicts have been filled in directly, rather than through ED_Alloc and
+ED_Free.
+=================
+*/
+void
+ED_ResetFreeList(void)
+{
+    const edict_t *e;
+    edhot_t *hot;
+    int i;
+
+    ed_free.head = ed_free.count = 0;
+    ed_free.active = 0;
+    for (i = 0; i < sv.num_edicts; i++) {
+	e = EDICT_NUM(i);
+	hot = &sv.edhot[i];
+	hot->free = e->free;
+	hot->num_leafs = e->free ? 0 : e->num_leafs;
+	hot->leafnum = e->leafnums[0];
+	hot->freetime = e->freetime;
+	if (e->free)
+	    ED_PushFree(i);
+	else
+	    ed_free.active++;
+    }
+    if (ed_free.peak_active < ed_free.active)
+	ed_free.peak_active = ed_free.active;
+}
+
+/*
+ * Keep the client from thinking the entity morphed: the first couple seconds
+ * of server time can involve a lot of freeing and allocating, so relax the
+ * replacement policy then.
+ */
+static qboolean
+ED_CanReuse(const edhot_t *hot)
+{
+    return hot->free && (hot->freetime < 2 || sv.time - hot->freetime > 0.5);
+}
+
+static edict_t *
+ED_Allocated(edict_t *e)
+{
+    ED_ClearEdict(e);
+    if (++ed_free.active > ed_free.peak_active)
+	ed_free.peak_active = ed_free.active;
+
+    return e;
 }
 
 /*
@@ -130,42 +415,58 @@ ED_Alloc(void)
     int i;
     edict_t *e;
 
-#ifdef NQ_HACK
-    for (i = svs.maxclients + 1; i < sv.num_edicts; i++) {
-#endif
-#if defined(QW_HACK) && defined(SERVERONLY)
-    for (i = MAX_CLIENTS + 1; i < sv.num_edicts; i++) {
-#endif
-	e = EDICT_NUM(i);
-	// the first couple seconds of server time can involve a lot of
-	// freeing and allocating, so relax the replacement policy
-	if (e->free && (e->freetime < 2 || sv.time - e->freetime > 0.5)) {
-	    ED_ClearEdict(e);
-	    return e;
+    while (ed_free.count) {
+	i = ed_free.ring[ed_free.head];
+	if (sv.edhot[i].free && !ED_CanReuse(&sv.edhot[i]))
+	    break;		// nothing behind it was freed any earlier
+	ed_free.head = (ed_free.head + 1) % sv.max_edicts;
+	ed_free.count--;
+	if (sv.edhot[i].free) {
+	    e = EDICT_NUM(i);
+	    ed_free.reused++;
+	    return ED_Allocated(e);
 	}
     }
 
+    if (sv.num_edicts < sv.max_edicts) {
+	e = EDICT_NUM(sv.num_edicts++);
+	return ED_Allocated(e);
+    }
+
+    /* Out of room, so check for any free edicts the ring missed */
+    for (i = ED_FirstFree(); i < sv.num_edicts; i++) {
+	if (ED_CanReuse(&sv.edhot[i]))
+	    return ED_Allocated(EDICT_NUM(i));
+    }
+
 #ifdef NQ_HACK
-    if (i == MAX_EDICTS)
-	SV_Error("%s: no free edicts", __func__);
-    sv.num_edicts++;
+    SV_Error("%s: no free edicts", __func__);
 #endif
 #if defined(QW_HACK) && defined(SERVERONLY)
-    if (i == MAX_EDICTS) {
-	Con_Printf("WARNING: ED_Alloc: no free edicts\n");
-	i--;			// step on whatever is the last edict
-	e = EDICT_NUM(i);
-	SV_UnlinkEdict(e);
-    } else
-	sv.num_edicts++;
-#endif
-
-    e = EDICT_NUM(i);
+    Con_Printf("WARNING: ED_Alloc: no free edicts\n");
+    e = EDICT_NUM(sv.max_edicts - 1);	// step on whatever is the last edict
+    SV_UnlinkEdict(e);
+    if (e->free)
+	ed_free.active++;
     ED_ClearEdict(e);
+#endif
 
     return e;
 }
 
+/*
+=================
+ED_NumActive
+
+The number of edicts in use
+=================
+*/
+int
+ED_NumActive(void)
+{
+    return ed_free.active;
+}
+
 /*
 =================
 ED_Free
@@ -177,8 +478,15 @@ FIXME: walk all entities and NULL out references to this entity
 void
 ED_Free(edict_t *ed)
 {
+    edhot_t *hot = EDICT_HOT(ed);
+
     SV_UnlinkEdict(ed);		// unlink from world bsp
 
+    if (!ed->free) {
+	ed_free.active--;
+	ED_PushFree(NUM_FOR_EDICT(ed));
+    }
+
     ed->free = true;
     ed->v.model = 0;
     ed->v.takedamage = 0;
@@ -192,6 +500,9 @@ ED_Free(edict_t *ed)
     ed->v.solid = 0;
 
     ed->freetime = sv.time;
+    hot->free = true;
+    hot->num_leafs = 0;
+    hot->freetime = ed->freetime;
 }
 
 //===========================================================================
@@ -234,6 +545,56 @@ ED_FieldAtOfs(int ofs)
     return NULL;
 }
 
+static void
+PR_InitNameHash(prnamehash_t *hash, int count, const char *hunkname)
+{
+    unsigned size;
+    int i;
+
+    for (size = 64; size < count; size <<= 1)
+	;
+    hash->mask = size - 1;
+    hash->buckets = Hunk_AllocName(size * sizeof(int), hunkname);
+    hash->next = Hunk_AllocName(count * sizeof(int), hunkname);
+    for (i = 0; i < size; i++)
+	hash->buckets[i] = -1;
+}
+
+/* Add in reverse index order, to keep the chains in index order */
+static void
+PR_HashName(prnamehash_t *hash, int index, string_t name)
+{
+    unsigned bucket;
+
+    bucket = COM_HashFileName(PR_GetString(name)) & hash->mask;
+    hash->next[index] = hash->buckets[bucket];
+    hash->buckets[bucket] = index;
+}
+
+static int
+PR_FirstName(const prnamehash_t *hash, const char *name)
+{
+    return hash->buckets[COM_HashFileName(name) & hash->mask];
+}
+
+static void
+PR_InitNameHashes(void)
+{
+    int i;
+
+    PR_InitNameHash(&pr_fieldhash, progs->numfielddefs, "fieldhash");
+    for (i = progs->numfielddefs - 1; i >= 0; i--)
+	PR_HashName(&pr_fieldhash, i, pr_fielddefs[i].s_name);
+
+    PR_InitNameHash(&pr_globalhash, progs->numglobaldefs, "globalhash");
+    for (i = progs->numglobaldefs - 1; i >= 0; i--)
+	PR_HashName(&pr_globalhash, i, pr_globaldefs[i].s_name);
+
+    PR_InitNameHash(&pr_functionhash, progs->numfunctions, "funchash");
+    for (i = progs->numfunctions - 1; i >= 0; i--)
+	PR_HashName(&pr_functionhash, i, pr_functions[i].s_name);
+}
+
 /*
 ============
 ED_FindField
@@ -245,7 +606,8 @@ ED_FindField(const char *name)
     ddef_t *def;
     int i;
 
-    for (i = 0; i < progs->numfielddefs; i++) {
+    for (i = PR_FirstName(&pr_fieldhash, name); i >= 0;
+	 i = pr_fieldhash.next[i]) {
 	def = &pr_fielddefs[i];
 	if (!strcmp(PR_GetString(def->s_name), name))
 	    return def;
@@ -265,7 +627,8 @@ ED_FindGlobal(const char *name)
     ddef_t *def;
     int i;
 
-    for (i = 0; i < progs->numglobaldefs; i++) {
+    for (i = PR_FirstName(&pr_globalhash, name); i >= 0;
+	 i = pr_globalhash.next[i]) {
 	def = &pr_globaldefs[i];
 	if (!strcmp(PR_GetString(def->s_name), name))
 	    return def;
@@ -285,7 +648,8 @@ ED_FindFunction(const char *name)
     dfunction_t *func;
     int i;
 
-    for (i = 0; i < progs->numfunctions; i++) {
+    for (i = PR_FirstName(&pr_functionhash, name); i >= 0;
+	 i = pr_functionhash.next[i]) {
 	func = &pr_functions[i];
 	if (!strcmp(PR_GetString(func->s_name), name))
 	    return func;
@@ -296,32 +660,44 @@ ED_FindFunction(const char *name)
 eval_t *
 GetEdictFieldValue(edict_t *ed, const char *field)
 {
-    static int rep = 0;
-    ddef_t *def = NULL;
-    int i;
-
-    for (i = 0; i < GEFV_CACHESIZE; i++) {
-	if (!strcmp(field, gefvCache[i].field)) {
-	    def = gefvCache[i].pcache;
-	    goto Done;
-	}
-    }
+    ddef_t *def;
 
     def = ED_FindField(field);
-
-    if (strlen(field) < MAX_FIELD_LEN) {
-	gefvCache[rep].pcache = def;
-	strcpy(gefvCache[rep].field, field);
-	rep ^= 1;
-    }
-
-  Done:
     if (!def)
 	return NULL;
 
     return (eval_t *)((char *)&ed->v + def->ofs * 4);
 }
 
+static int
+PR_FindFieldOffset(const char *name)
+{
+    ddef_t *def;
+
+    def = ED_FindField(name);
+
+    return def ? def->ofs : -1;
+}
+
+/*
+============
+PR_FindGlobal
+
+Returns the progs global of that name and type, or NULL if there isn't one
+============
+*/
+eval_t *
+PR_FindGlobal(const char *name, etype_t type)
+{
+    ddef_t *def;
+
+    def = ED_FindGlobal(name);
+    if (!def || (def->type & ~DEF_SAVEGLOBAL) != type)
+	return NULL;
+
+    return (eval_t *)&pr_globals[def->ofs];
+}
+
 /*
 ============
 PR_ValueString
@@ -647,8 +1023,10 @@ ED_Count(void)
 	    step++;
     }
 
-    Con_Printf("num_edicts:%3i\n", sv.num_edicts);
-    Con_Printf("active    :%3i\n", active);
+    Con_Printf("num_edicts:%3i of %i\n", sv.num_edicts, sv.max_edicts);
+    Con_Printf("active    :%3i (peak %i)\n", active, ed_free.peak_active);
+    Con_Printf("free      :%3i waiting, %i reused\n", ed_free.count,
+	       ed_free.reused);
     Con_Printf("view      :%3i\n", models);
     Con_Printf("touch     :%3i\n", solid);
     Con_Printf("step      :%3i\n", step);
@@ -744,33 +1122,150 @@ ED_ParseGlobals(const char *data)
 //============================================================================
 
 
+/*
+ * Entity strings are unescaped straight from the entity text into blocks
+ * taken from the hunk, rather than one hunk allocation each, while a map's
+ * entities are being loaded.
+ */
+#define ED_STRINGBLOCK 0x10000
+
+static struct {
+    char *block;		// NULL when not loading a map
+    int left;
+} ed_strings;
+
+/* \n becomes a newline, and any other escaped character a backslash */
+static char *
+ED_CopyString(char *dest, const char *string, int length)
+{
+    char *p = dest;
+    int i;
+
+    for (i = 0; i < length; i++) {
+	if (string[i] == '\\') {
+	    i++;
+	    *p++ = (i < length && string[i] == 'n') ? '\n' : '\\';
+	} else
+	    *p++ = string[i];
+    }
+    *p = 0;
+
+    return dest;
+}
+
 /*
 =============
 ED_NewString
 =============
 */
 static char *
-ED_NewString(const char *string)
+ED_NewString(const char *string, int length)
 {
-    char *new, *new_p;
-    int i, l;
+    char *dest;
 
-    l = strlen(string) + 1;
-    new = Hunk_Alloc(l);
-    new_p = new;
+    if (!ed_strings.block || length >= ED_STRINGBLOCK / 4)
+	return ED_CopyString(Hunk_Alloc(length + 1), string, length);
 
-    for (i = 0; i < l; i++) {
-	if (string[i] == '\\' && i < l - 1) {
-	    i++;
-	    if (string[i] == 'n')
-		*new_p++ = '\n';
-	    else
-		*new_p++ = '\\';
-	} else
-	    *new_p++ = string[i];
+    if (ed_strings.left < length + 1) {
+	ed_strings.block = Hunk_AllocName(ED_STRINGBLOCK, "edstrings");
+	ed_strings.left = ED_STRINGBLOCK;
+    }
+    dest = ED_CopyString(ed_strings.block, string, length);
+    length = strlen(dest) + 1;
+    ed_strings.block += length;
+    ed_strings.left -= length;
+
+    return dest;
+}
+
+/*
+ * A token of entity text, pointing into the text itself.  Split the same way
+ * as with COM_Parse, including cutting tokens off at the same length.
+ */
+typedef struct {
+    const char *text;
+    int length;
+} edtoken_t;
+
+#define ED_MAXTOKEN 1023
+
+static qboolean
+ED_IsToken(const edtoken_t *token, char c)
+{
+    return token->length && token->text[0] == c;
+}
+
+/*
+=============
+ED_NextToken
+
+Returns false at the end of the text
+=============
+*/
+static qboolean
+ED_NextToken(const char **data, edtoken_t *token)
+{
+    const char *p = *data;
+    int c;
+
+    token->text = "";
+    token->length = 0;
+    if (!p)
+	return false;
+
+  skipwhite:
+    while ((c = *p) <= ' ') {
+	if (c == 0) {
+	    *data = NULL;
+	    return false;
+	}
+	p++;
+    }
+    if (c == '/' && p[1] == '/') {
+	while (*p && *p != '\n')
+	    p++;
+	goto skipwhite;
+    }
+    if (c == '/' && p[1] == '*') {
+	p += 2;
+	while (*p && !(*p == '*' && p[1] == '/'))
+	    p++;
+	if (*p)
+	    p += 2;
+	goto skipwhite;
+    }
+
+    if (c == '\"') {
+	token->text = ++p;
+	while (*p && *p != '\"')
+	    p++;
+	token->length = qmin((int)(p - token->text), ED_MAXTOKEN);
+	if (*p)
+	    p++;
+	*data = p;
+	return true;
     }
 
-    return new;
+    token->text = p;
+#ifdef NQ_HACK
+    if (strchr("{})(':", c)) {
+	token->length = 1;
+	*data = p + 1;
+	return true;
+    }
+#endif
+    do {
+	p++;
+	c = *p;
+#ifdef NQ_HACK
+	if (c && strchr("{})(':", c))
+	    break;
+#endif
+    } while (c > 32);
+    token->length = qmin((int)(p - token->text), ED_MAXTOKEN);
+    *data = p;
+
+    return true;
 }
 
 
@@ -796,7 +1291,7 @@ ED_ParseEpair(void *base, ddef_t *key, const char *s)
 
     switch (key->type & ~DEF_SAVEGLOBAL) {
     case ev_string:
-	*(string_t *)d = PR_SetString(ED_NewString(s));
+	*(string_t *)d = PR_SetString(ED_NewString(s, strlen(s)));
 	break;
 
     case ev_float:
@@ -859,8 +1354,9 @@ ED_ParseEdict(const char *data, edict_t *ent)
     ddef_t *key;
     qboolean anglehack;
     qboolean init, ok;
-    const char *keysource;
+    edtoken_t token;
     char keyname[256];
+    char value[ED_MAXTOKEN + 1];
     int n;
 
     init = false;
@@ -868,34 +1364,34 @@ ED_ParseEdict(const char *data, edict_t *ent)
 // clear it
     if (ent != sv.edicts)	// hack
 	memset(&ent->v, 0, progs->entityfields * 4);
+    ED_FindChanged();
 
 // go through all the dictionary pairs
     while (1) {
 	// parse key
-	data = COM_Parse(data);
-	if (com_token[0] == '}')
+	ED_NextToken(&data, &token);
+	if (ED_IsToken(&token, '}'))
 	    break;
 	if (!data)
 	    SV_Error("%s: EOF without closing brace", __func__);
 
 	anglehack = false;
-	if (!strcmp(com_token, "angle")) {
+	if (token.length == 5 && !strncmp(token.text, "angle", 5)) {
 	    /*
 	     * anglehack is to allow QuakeEd to write single scalar angles
 	     * and allow them to be turned into vectors. (FIXME...)
 	     */
-	    keysource = "angles";
+	    snprintf(keyname, sizeof(keyname), "angles");
 	    anglehack = true;
-	} else if (!strcmp(com_token, "light")) {
+	} else if (token.length == 5 && !strncmp(token.text, "light", 5)) {
 	    /*
 	     * hack for single light def
 	     * FIXME: change light to _light to get rid of this hack
 	     */
-	    keysource = "light_lev";
+	    snprintf(keyname, sizeof(keyname), "light_lev");
 	} else {
-	    keysource = com_token;
+	    snprintf(keyname, sizeof(keyname), "%.*s", token.length, token.text);
 	}
-	snprintf(keyname, sizeof(keyname), "%s", keysource);
 
 	/* another hack to fix keynames with trailing spaces */
 	n = strlen(keyname);
@@ -903,11 +1399,11 @@ ED_ParseEdict(const char *data, edict_t *ent)
 	    keyname[--n] = 0;
 
 	// parse value
-	data = COM_Parse(data);
+	ED_NextToken(&data, &token);
 	if (!data)
 	    SV_Error("%s: EOF without closing brace", __func__);
 
-	if (com_token[0] == '}')
+	if (ED_IsToken(&token, '}'))
 	    SV_Error("%s: closing brace without data", __func__);
 
 	init = true;
@@ -923,13 +1419,18 @@ ED_ParseEdict(const char *data, edict_t *ent)
 	    continue;
 	}
 
-	if (anglehack) {
-	    char temp[32];
-	    snprintf(temp, sizeof(temp), "0 %s 0", com_token);
-	    ok = ED_ParseEpair((void *)&ent->v, key, temp);
-	} else {
-	    ok = ED_ParseEpair((void *)&ent->v, key, com_token);
+	/* strings are copied once, straight out of the text */
+	if ((key->type & ~DEF_SAVEGLOBAL) == ev_string && !anglehack) {
+	    *(string_t *)((int *)&ent->v + key->ofs) =
+		PR_SetString(ED_NewString(token.text, token.length));
+	    continue;
 	}
+
+	if (anglehack)
+	    snprintf(value, sizeof(value), "0 %.*s 0", token.length, token.text);
+	else
+	    snprintf(value, sizeof(value), "%.*s", token.length, token.text);
+	ok = ED_ParseEpair((void *)&ent->v, key, value);
 	if (!ok)
 #ifdef NQ_HACK
 	    Host_Error("%s: parse error", __func__);
@@ -967,19 +1468,24 @@ ED_LoadFromFile(const char *data)
     edict_t *ent;
     int inhibit;
     dfunction_t *func;
+    edtoken_t token;
 
     ent = NULL;
     inhibit = 0;
     pr_global_struct->time = sv.time;
 
+    /* the strings go in blocks until the last entity is spawned */
+    ed_strings.block = Hunk_AllocName(ED_STRINGBLOCK, "edstrings");
+    ed_strings.left = ED_STRINGBLOCK;
+
 // parse ents
     while (1) {
 // parse the opening brace
-	data = COM_Parse(data);
-	if (!data)
+	if (!ED_NextToken(&data, &token))
 	    break;
-	if (com_token[0] != '{')
-	    SV_Error("%s: found %s when expecting {", __func__, com_token);
+	if (!ED_IsToken(&token, '{'))
+	    SV_Error("%s: found %.*s when expecting {", __func__,
+		     token.length, token.text);
 
 	if (!ent)
 	    ent = EDICT_NUM(0);
@@ -1036,9 +1542,564 @@ ED_LoadFromFile(const char *data)
 #endif
     }
 
+    ed_strings.block = NULL;
+    ed_strings.left = 0;
+
     Con_DPrintf("%i entities inhibited\n", inhibit);
+    ED_ResetFreeList();
+}
+
+#ifdef NQ_HACK
+/*
+==============================================================================
+
+BINARY SAVEGAMES
+
+The edicts are written out word for word as they are in memory, followed by
+the tables needed to make sense of the values that don't stay the same from
+one run to the next: the text of the strings, the size of an edict and the
+names of the fields and functions.  Loaded with the same progs, the edicts
+are copied back and only the strings and entity references are fixed up.
+With different progs the fields are matched up by name instead, as they are
+with text saves.
+
+==============================================================================
+*/
+
+static const char save_magic[4] = { 'Q', 'B', 'I', 'N' };
+
+typedef struct {
+    byte *data;
+    int cursize;
+    int maxsize;
+} savebuf_t;
+
+typedef struct {
+    const byte *data;
+    int cursize;
+    int readcount;
+    qboolean bad;
+} savereader_t;
+
+/* Maps string values from one run to the next */
+typedef struct {
+    int *keys;
+    int *values;
+    byte *used;
+    unsigned mask;
+    int count;
+} savemap_t;
+
+static void *
+SAV_GetSpace(savebuf_t *buf, int length)
+{
+    void *space;
+
+    if (buf->cursize + length > buf->maxsize) {
+	buf->maxsize = qmax(buf->maxsize * 2, buf->cursize + length);
+	buf->data = realloc(buf->data, buf->maxsize);
+	if (!buf->data)
+	    Sys_Error("%s: out of memory", __func__);
+    }
+    space = buf->data + buf->cursize;
+    buf->cursize += length;
+
+    return space;
+}
+
+static void
+SAV_WriteInt(savebuf_t *buf, int value)
+{
+    value = LittleLong(value);
+    memcpy(SAV_GetSpace(buf, 4), &value, 4);
+}
+
+static void
+SAV_WriteString(savebuf_t *buf, const char *string)
+{
+    int length = strlen(string) + 1;
+
+    SAV_WriteInt(buf, length);
+    memcpy(SAV_GetSpace(buf, length), string, length);
+}
+
+static int
+SAV_ReadInt(savereader_t *reader)
+{
+    int value;
+
+    if (reader->readcount + 4 > reader->cursize) {
+	reader->bad = true;
+	return 0;
+    }
+    memcpy(&value, reader->data + reader->readcount, 4);
+    reader->readcount += 4;
+
+    return LittleLong(value);
+}
+
+/* Points into the save data, which must stay around */
+static const char *
+SAV_ReadString(savereader_t *reader)
+{
+    const char *string;
+    int length;
+
+    length = SAV_ReadInt(reader);
+    if (length < 1 || length > reader->cursize - reader->readcount
+	|| reader->data[reader->readcount + length - 1]) {
+	reader->bad = true;
+	return "";
+    }
+    string = (const char *)reader->data + reader->readcount;
+    reader->readcount += length;
+
+    return string;
+}
+
+static void
+SAV_InitMap(savemap_t *map, int count)
+{
+    int size = 16;
+
+    while (size < count * 2)
+	size <<= 1;
+    map->keys = malloc(size * sizeof(int));
+    map->values = malloc(size * sizeof(int));
+    map->used = calloc(size, 1);
+    if (!map->keys || !map->values || !map->used)
+	Sys_Error("%s: out of memory", __func__);
+    map->mask = size - 1;
+    map->count = 0;
+}
+
+static void
+SAV_FreeMap(savemap_t *map)
+{
+    free(map->keys);
+    free(map->values);
+    free(map->used);
+}
+
+/* Returns the slot for the key; it's new if map->used[slot] isn't set */
+static unsigned
+SAV_MapSlot(const savemap_t *map, int key)
+{
+    unsigned slot = ((unsigned)key * 2654435761u) & map->mask;
+
+    while (map->used[slot] && map->keys[slot] != key)
+	slot = (slot + 1) & map->mask;
+
+    return slot;
+}
+
+static void
+SAV_AddString(savemap_t *map, int value)
+{
+    unsigned slot;
+
+    if (!value)
+	return;
+    slot = SAV_MapSlot(map, value);
+    if (map->used[slot])
+	return;
+    map->used[slot] = 1;
+    map->keys[slot] = value;
+    map->count++;
+}
+
+static int
+SAV_MapString(const savemap_t *map, int value)
+{
+    unsigned slot;
+
+    if (!value)
+	return 0;
+    slot = SAV_MapSlot(map, value);
+
+    return map->used[slot] ? map->values[slot] : 0;
 }
 
+static qboolean
+ED_SaveGlobal(const ddef_t *def)
+{
+    int type;
+
+    if (!(def->type & DEF_SAVEGLOBAL))
+	return false;
+    type = def->type & ~DEF_SAVEGLOBAL;
+
+    return type == ev_string || type == ev_float || type == ev_entity;
+}
+
+/*
+=============
+ED_SaveBinary
+
+Returns the header followed by the edicts and globals as a binary savegame,
+allocated with malloc
+=============
+*/
+void *
+ED_SaveBinary(const char *header, int *length)
+{
+    savebuf_t buf = { 0 };
+    savemap_t strings;
+    const ddef_t *def;
+    const int *fields;
+    const edict_t *ed;
+    int *stringofs;
+    int i, j, numstringofs, numglobals, slot;
+
+    memcpy(SAV_GetSpace(&buf, strlen(header)), header, strlen(header));
+    memcpy(SAV_GetSpace(&buf, sizeof(save_magic)), save_magic,
+	   sizeof(save_magic));
+    SAV_WriteInt(&buf, pr_crc);
+    SAV_WriteInt(&buf, progs->entityfields);
+    SAV_WriteInt(&buf, pr_edict_size);
+    SAV_WriteInt(&buf, sv.num_edicts);
+
+    /* find the strings in use */
+    stringofs = malloc(progs->numfielddefs * sizeof(int));
+    if (!stringofs)
+	Sys_Error("%s: out of memory", __func__);
+    numstringofs = 0;
+    for (i = 1; i < progs->numfielddefs; i++)
+	if ((pr_fielddefs[i].type & ~DEF_SAVEGLOBAL) == ev_string)
+	    stringofs[numstringofs++] = pr_fielddefs[i].ofs;
+
+    SAV_InitMap(&strings, numstringofs * sv.num_edicts
+		+ progs->numglobaldefs);
+    numglobals = 0;
+    for (i = 0; i < progs->numglobaldefs; i++) {
+	def = &pr_globaldefs[i];
+	if (!ED_SaveGlobal(def))
+	    continue;
+	numglobals++;
+	if ((def->type & ~DEF_SAVEGLOBAL) == ev_string)
+	    SAV_AddString(&strings, G_INT(def->ofs));
+    }
+    for (i = 0; i < sv.num_edicts; i++) {
+	ed = EDICT_NUM(i);
+	if (ed->free)
+	    continue;
+	fields = (const int *)&ed->v;
+	for (j = 0; j < numstringofs; j++)
+	    SAV_AddString(&strings, fields[stringofs[j]]);
+    }
+    free(stringofs);
+
+    SAV_WriteInt(&buf, strings.count);
+    for (slot = 0; slot <= strings.mask; slot++) {
+	if (!strings.used[slot])
+	    continue;
+	SAV_WriteInt(&buf, strings.keys[slot]);
+	SAV_WriteString(&buf, PR_GetString(strings.keys[slot]));
+    }
+    SAV_FreeMap(&strings);
+
+    SAV_WriteInt(&buf, progs->numfielddefs);
+    for (i = 0; i < progs->numfielddefs; i++) {
+	SAV_WriteInt(&buf, pr_fielddefs[i].type);
+	SAV_WriteInt(&buf, pr_fielddefs[i].ofs);
+	SAV_WriteString(&buf, PR_GetString(pr_fielddefs[i].s_name));
+    }
+
+    SAV_WriteInt(&buf, progs->numfunctions);
+    for (i = 0; i < progs->numfunctions; i++)
+	SAV_WriteString(&buf, PR_GetString(pr_functions[i].s_name));
+
+    SAV_WriteInt(&buf, numglobals);
+    for (i = 0; i < progs->numglobaldefs; i++) {
+	def = &pr_globaldefs[i];
+	if (!ED_SaveGlobal(def))
+	    continue;
+	SAV_WriteInt(&buf, def->type & ~DEF_SAVEGLOBAL);
+	SAV_WriteString(&buf, PR_GetString(def->s_name));
+	SAV_WriteInt(&buf, G_INT(def->ofs));
+    }
+
+    for (i = 0; i < sv.num_edicts; i++) {
+	ed = EDICT_NUM(i);
+	SAV_WriteInt(&buf, ed->free);
+	if (ed->free)
+	    continue;
+	fields = (const int *)&ed->v;
+	for (j = 0; j < progs->entityfields; j++)
+	    SAV_WriteInt(&buf, fields[j]);
+    }
+
+    *length = buf.cursize;
+
+    return buf.data;
+}
+
+typedef struct {
+    int type;
+    int ofs;
+    const char *name;
+} savefield_t;
+
+typedef struct {
+    savereader_t reader;
+    qboolean sameprogs;
+    int edictsize;
+    int num_edicts;
+    savemap_t strings;
+    savefield_t *fields;
+    int numfields;
+    const char **functions;
+    int numfunctions;
+} saveload_t;
+
+static int
+ED_LoadEntity(const saveload_t *load, int value)
+{
+    int num;
+
+    if (value % load->edictsize)
+	return 0;
+    num = value / load->edictsize;
+    if (num < 0 || num >= load->num_edicts)
+	return 0;
+
+    return num * pr_edict_size;
+}
+
+static int
+ED_LoadFunction(const saveload_t *load, int value)
+{
+    const dfunction_t *func;
+
+    if (load->sameprogs)
+	return value;
+    if (value <= 0 || value >= load->numfunctions)
+	return 0;
+    func = ED_FindFunction(load->functions[value]);
+
+    return func ? func - pr_functions : 0;
+}
+
+static int
+ED_LoadFieldOffset(const saveload_t *load, int value)
+{
+    const ddef_t *def;
+    int i;
+
+    if (load->sameprogs)
+	return value;
+    for (i = 1; i < load->numfields; i++) {
+	if (load->fields[i].ofs != value)
+	    continue;
+	def = ED_FindField(load->fields[i].name);
+	return def ? def->ofs : 0;
+    }
+
+    return 0;
+}
+
+/* Converts a saved value of the type for this run */
+static int
+ED_LoadValue(const saveload_t *load, int type, int value)
+{
+    switch (type & ~DEF_SAVEGLOBAL) {
+    case ev_string:
+	return SAV_MapString(&load->strings, value);
+    case ev_entity:
+	return ED_LoadEntity(load, value);
+    case ev_function:
+	return ED_LoadFunction(load, value);
+    case ev_field:
+	return ED_LoadFieldOffset(load, value);
+    case ev_pointer:
+	return load->sameprogs ? value : 0;
+    default:
+	return value;
+    }
+}
+
+static void
+ED_LoadGlobals(saveload_t *load)
+{
+    savereader_t *reader = &load->reader;
+    const char *name;
+    ddef_t *def;
+    int i, count, type, value;
+
+    count = SAV_ReadInt(reader);
+    for (i = 0; i < count && !reader->bad; i++) {
+	type = SAV_ReadInt(reader);
+	name = SAV_ReadString(reader);
+	value = SAV_ReadInt(reader);
+	def = ED_FindGlobal(name);
+	if (!def) {
+	    Con_Printf("'%s' is not a global\n", name);
+	    continue;
+	}
+	if ((def->type & ~DEF_SAVEGLOBAL) != type)
+	    continue;
+	G_INT(def->ofs) = ED_LoadValue(load, type, value);
+    }
+}
+
+static void
+ED_LoadEdictFields(saveload_t *load, edict_t *ent, const int *saved)
+{
+    int *fields = (int *)&ent->v;
+    const savefield_t *saveddef;
+    const ddef_t *def;
+    const char *name;
+    int i, j, type, size;
+
+    if (load->sameprogs) {
+	memcpy(fields, saved, progs->entityfields * 4);
+	for (i = 1; i < load->numfields; i++) {
+	    saveddef = &load->fields[i];
+	    type = saveddef->type & ~DEF_SAVEGLOBAL;
+	    if (type == ev_string || type == ev_entity)
+		fields[saveddef->ofs] =
+		    ED_LoadValue(load, type, saved[saveddef->ofs]);
+	}
+	return;
+    }
+
+    for (i = 1; i < load->numfields; i++) {
+	saveddef = &load->fields[i];
+	name = saveddef->name;
+	if (name[0] && name[strlen(name) - 2] == '_')
+	    continue;		// skip _x, _y, _z vars
+	def = ED_FindField(name);
+	if (!def || def->type != saveddef->type)
+	    continue;
+	type = def->type & ~DEF_SAVEGLOBAL;
+	size = type < ARRAY_SIZE(type_size) ? type_size[type] : 1;
+	for (j = 0; j < size; j++)
+	    fields[def->ofs + j] =
+		ED_LoadValue(load, type, saved[saveddef->ofs + j]);
+    }
+}
+
+/*
+=============
+ED_LoadBinary
+
+Fills in the globals and edicts from the binary part of a savegame, after
+the header.  Returns false if the data is bad.
+=============
+*/
+qboolean
+ED_LoadBinary(const void *data, int length)
+{
+    saveload_t load;
+    savereader_t *reader = &load.reader;
+    const char *text;
+    char *copy;
+    edict_t *ent;
+    savefield_t *field;
+    int *saved;
+    int i, j, crc, entityfields, count, value, size;
+    unsigned slot;
+
+    memset(&load, 0, sizeof(load));
+    reader->data = data;
+    reader->cursize = length;
+    if (length < sizeof(save_magic)
+	|| memcmp(data, save_magic, sizeof(save_magic)))
+	return false;
+    reader->readcount = sizeof(save_magic);
+
+    crc = SAV_ReadInt(reader);
+    entityfields = SAV_ReadInt(reader);
+    load.edictsize = SAV_ReadInt(reader);
+    load.num_edicts = SAV_ReadInt(reader);
+    if (reader->bad || entityfields < 1 || load.edictsize < 1
+	|| load.num_edicts < 1)
+	return false;
+    if (load.num_edicts > sv.max_edicts) {
+	Con_Printf("Savegame has %d edicts, more than the %d allowed\n",
+		   load.num_edicts, sv.max_edicts);
+	return false;
+    }
+    load.sameprogs = (crc == pr_crc && entityfields == progs->entityfields);
+    if (!load.sameprogs)
+	Con_Printf("Savegame is from different progs, matching fields by name\n");
+
+    count = SAV_ReadInt(reader);
+    if (count < 0 || count > length)
+	return false;
+    SAV_InitMap(&load.strings, count);
+    for (i = 0; i < count && !reader->bad; i++) {
+	value = SAV_ReadInt(reader);
+	text = SAV_ReadString(reader);
+	slot = SAV_MapSlot(&load.strings, value);
+	load.strings.used[slot] = 1;
+	load.strings.keys[slot] = value;
+	if (load.sameprogs && value >= 0) {
+	    load.strings.values[slot] = value;
+	} else {
+	    copy = Hunk_Alloc(strlen(text) + 1);
+	    strcpy(copy, text);
+	    load.strings.values[slot] = PR_SetString(copy);
+	}
+    }
+
+    load.numfields = SAV_ReadInt(reader);
+    if (load.numfields < 0 || load.numfields > length)
+	load.numfields = 0;
+    load.fields = malloc(load.numfields * sizeof(*load.fields) + 1);
+    if (!load.fields)
+	Sys_Error("%s: out of memory", __func__);
+    for (i = 0; i < load.numfields && !reader->bad; i++) {
+	field = &load.fields[i];
+	field->type = SAV_ReadInt(reader);
+	field->ofs = SAV_ReadInt(reader);
+	field->name = SAV_ReadString(reader);
+	size = (field->type & ~DEF_SAVEGLOBAL) == ev_vector ? 3 : 1;
+	if (field->ofs < 0 || field->ofs + size > entityfields)
+	    reader->bad = true;
+    }
+
+    load.numfunctions = SAV_ReadInt(reader);
+    if (load.numfunctions < 0 || load.numfunctions > length)
+	load.numfunctions = 0;
+    load.functions = malloc(load.numfunctions * sizeof(*load.functions) + 1);
+    if (!load.functions)
+	Sys_Error("%s: out of memory", __func__);
+    for (i = 0; i < load.numfunctions && !reader->bad; i++)
+	load.functions[i] = SAV_ReadString(reader);
+
+    if (!reader->bad)
+	ED_LoadGlobals(&load);
+
+    saved = malloc(entityfields * sizeof(int));
+    if (!saved)
+	Sys_Error("%s: out of memory", __func__);
+    ED_FindChanged();
+    for (i = 0; i < load.num_edicts && !reader->bad; i++) {
+	ent = EDICT_NUM(i);
+	memset(&ent->v, 0, progs->entityfields * 4);
+	ent->free = SAV_ReadInt(reader);
+	if (ent->free)
+	    continue;
+	for (j = 0; j < entityfields; j++)
+	    saved[j] = SAV_ReadInt(reader);
+	if (reader->bad)
+	    break;
+	ED_LoadEdictFields(&load, ent, saved);
+	SV_LinkEdict(ent, false);
+    }
+    if (!reader->bad)
+	sv.num_edicts = load.num_edicts;
+
+    free(saved);
+    free(load.functions);
+    free(load.fields);
+    SAV_FreeMap(&load.strings);
+
+    return !reader->bad;
+}
+#endif /* NQ_HACK */
+
 
 /*
 ===============
@@ -1049,33 +2110,40 @@ void
 PR_LoadProgs(void)
 {
     int i;
+    unsigned short crc;
+    unsigned checksum;
+    const char *progsname = "progs.dat";
 #if defined(QW_HACK) && defined(SERVERONLY)
     char num[32];
     dfunction_t *f;
 #endif
 
-// flush the non-C variable lookup cache
-    for (i = 0; i < GEFV_CACHESIZE; i++)
-	gefvCache[i].field[0] = 0;
-
 #ifdef NQ_HACK
-    progs = COM_LoadHunkFile("progs.dat");
+    progs = COM_LoadHunkFile(progsname);
 #endif
 #if defined(QW_HACK) && defined(SERVERONLY)
-    progs = COM_LoadHunkFile("qwprogs.dat");
-    if (!progs)
-	progs = COM_LoadHunkFile("progs.dat");
+    progsname = "qwprogs.dat";
+    progs = COM_LoadHunkFile(progsname);
+    if (!progs) {
+	progsname = "progs.dat";
+	progs = COM_LoadHunkFile(progsname);
+    }
 #endif
     if (!progs)
 	SV_Error("%s: couldn't load progs.dat", __func__);
     Con_DPrintf("Programs occupy %iK.\n", com_filesize / 1024);
 
+    if (!COM_GetFileChecksum(progsname, CHECKSUM_CRC, &checksum)) {
+	checksum = CRC_Block((byte *)progs, com_filesize);
+	COM_SetFileChecksum(progsname, CHECKSUM_CRC, checksum);
+    }
+    crc = checksum;
 #ifdef NQ_HACK
-    pr_crc = CRC_Block((byte *)progs, com_filesize);
+    pr_crc = crc;
 #endif
 #if defined(QW_HACK) && defined(SERVERONLY)
 // add prog crc to the serverinfo
-    sprintf(num, "%i", CRC_Block((byte *)progs, com_filesize));
+    sprintf(num, "%i", crc);
     Info_SetValueForStarKey(svs.info, "*progs", num, MAX_SERVERINFO_STRING);
 #endif
 
@@ -1106,6 +2174,8 @@ PR_LoadProgs(void)
 	SV_Error("progs.dat strings extend past end of file\n");
 #endif
     PR_InitStringTable();
+    ed_strings.block = NULL;	// went with the last map's hunk
+    ed_strings.left = 0;
 
     pr_globaldefs = (ddef_t *)((byte *)progs + progs->ofs_globaldefs);
     pr_fielddefs = (ddef_t *)((byte *)progs + progs->ofs_fielddefs);
@@ -1152,6 +2222,15 @@ PR_LoadProgs(void)
     for (i = 0; i < progs->numglobals; i++)
 	((int *)pr_globals)[i] = LittleLong(((int *)pr_globals)[i]);
 
+    PR_InitNameHashes();
+    pr_extfields.items2 = PR_FindFieldOffset("items2");
+    pr_extfields.gravity = PR_FindFieldOffset("gravity");
+    pr_extfields.maxspeed = PR_FindFieldOffset("maxspeed");
+
+    PR_DecodeStatements();
+    PR_ProfileLoad();
+    PR_LoadNative(crc);
+
 #if defined(QW_HACK) && defined(SERVERONLY)
     // Zoid, find the spectator functions
     SpectatorConnect = SpectatorThink = SpectatorDisconnect = 0;
@@ -1178,6 +2257,9 @@ PR_Init(void)
     Cmd_AddCommand("edicts", ED_PrintEdicts);
     Cmd_AddCommand("edictcount", ED_Count);
     Cmd_AddCommand("profile", PR_Profile_f);
+    Cvar_RegisterVariable(&sv_maxedicts);
+    Cvar_RegisterVariable(&pr_checkextension);
+    PR_ProfileInit();
 #ifdef NQ_HACK
     Cvar_RegisterVariable(&nomonsters);
     Cvar_RegisterVariable(&gamecfg);
@@ -1196,12 +2278,7 @@ PR_Init(void)
 edict_t *
 EDICT_NUM(int n)
 {
-#ifdef NQ_HACK
     if (n < 0 || n >= sv.max_edicts)
-#endif
-#if defined(QW_HACK) && defined(SERVERONLY)
-    if (n < 0 || n >= MAX_EDICTS)
-#endif
 	SV_Error("%s: bad number %i", __func__, n);
     return (edict_t *)((byte *)sv.edicts + (n) * pr_edict_size);
 }
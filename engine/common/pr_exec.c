@@ -18,6 +18,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "console.h"
 #include "pr_comp.h"
 #include "progs.h"
@@ -212,6 +216,7 @@ PR_StackTrace(void)
 ============
 PR_Profile_f
 
+Without arguments, lists the functions which ran the most statements
 ============
 */
 void
@@ -222,6 +227,9 @@ PR_Profile_f(void)
     int num;
     int i;
 
+    if (PR_ProfileCommand())
+	return;
+
     // FIXME - progs get unloaded? if so, check that progs gets zero'd
     if (!progs)
 	return;
@@ -327,6 +335,9 @@ PR_EnterFunction(dfunction_t *f)
     }
 
     pr_xfunction = f;
+    if (pr_profiling)
+	PR_ProfileEnter(f);
+
     return f->first_statement - 1;	// offset the s++
 }
 
@@ -358,6 +369,9 @@ PR_LeaveFunction(void)
 	((int *)pr_globals)[pr_xfunction->parm_start + i] =
 	    localstack[localstack_used + i];
 
+    if (pr_profiling)
+	PR_ProfileLeave();
+
 // up stack
     pr_depth--;
     pr_xfunction = pr_stack[pr_depth].f;
@@ -365,6 +379,239 @@ PR_LeaveFunction(void)
 }
 
 
+/*
+ * ===========================================================================
+ * PRE-DECODED STATEMENTS
+ *
+ * When the progs are loaded, each statement gets the addresses of its
+ * operands and one of the opcodes below.  The stores, loads and calls of
+ * each type share a single opcode.  A few common pairs, where the second
+ * statement takes the result of the first, get a fused opcode on the first
+ * statement which does the work of both and skips the second.  The second
+ * statement is left as it was, so a jump straight to it still works.
+ * ===========================================================================
+ */
+
+#define PX_OPS				\
+    PX_OP(BAD)				\
+    PX_OP(ADD_F) PX_OP(ADD_V)		\
+    PX_OP(SUB_F) PX_OP(SUB_V)		\
+    PX_OP(MUL_F) PX_OP(MUL_V) PX_OP(MUL_FV) PX_OP(MUL_VF)	\
+    PX_OP(DIV_F)			\
+    PX_OP(BITAND) PX_OP(BITOR)		\
+    PX_OP(GE) PX_OP(LE) PX_OP(GT) PX_OP(LT)	\
+    PX_OP(AND) PX_OP(OR)		\
+    PX_OP(NOT_F) PX_OP(NOT_V) PX_OP(NOT_S) PX_OP(NOT_FNC) PX_OP(NOT_ENT) \
+    PX_OP(EQ_F) PX_OP(EQ_V) PX_OP(EQ_S) PX_OP(EQ_I)	\
+    PX_OP(NE_F) PX_OP(NE_V) PX_OP(NE_S) PX_OP(NE_I)	\
+    PX_OP(STORE) PX_OP(STORE_V)		\
+    PX_OP(STOREP) PX_OP(STOREP_V) PX_OP(STOREP_S)	\
+    PX_OP(ADDRESS)			\
+    PX_OP(LOAD) PX_OP(LOAD_V)		\
+    PX_OP(IFNOT) PX_OP(IF) PX_OP(GOTO)	\
+    PX_OP(CALL) PX_OP(RETURN) PX_OP(STATE)	\
+    PX_OP(LOAD_STORE) PX_OP(LOAD_STORE_V)	\
+    PX_OP(LOAD_IFNOT) PX_OP(LOAD_IF)	\
+    PX_OP(ADDRESS_STOREP) PX_OP(ADDRESS_STOREP_V) PX_OP(ADDRESS_STOREP_S)
+
+#define PX_OP(name) PX_##name,
+typedef enum { PX_OPS PX_NUMOPS } pxop_t;
+#undef PX_OP
+
+typedef struct {
+    int op;			/* pxop_t */
+    int arg;			/* jump offset, argument count or bad opcode */
+    eval_t *a, *b, *c;
+} pxstatement_t;
+
+static pxstatement_t *pr_xstatements;
+
+static const byte pr_xopmap[OP_BITOR + 1] = {
+    [OP_DONE] = PX_RETURN,
+    [OP_MUL_F] = PX_MUL_F,
+    [OP_MUL_V] = PX_MUL_V,
+    [OP_MUL_FV] = PX_MUL_FV,
+    [OP_MUL_VF] = PX_MUL_VF,
+    [OP_DIV_F] = PX_DIV_F,
+    [OP_ADD_F] = PX_ADD_F,
+    [OP_ADD_V] = PX_ADD_V,
+    [OP_SUB_F] = PX_SUB_F,
+    [OP_SUB_V] = PX_SUB_V,
+    [OP_EQ_F] = PX_EQ_F,
+    [OP_EQ_V] = PX_EQ_V,
+    [OP_EQ_S] = PX_EQ_S,
+    [OP_EQ_E] = PX_EQ_I,
+    [OP_EQ_FNC] = PX_EQ_I,
+    [OP_NE_F] = PX_NE_F,
+    [OP_NE_V] = PX_NE_V,
+    [OP_NE_S] = PX_NE_S,
+    [OP_NE_E] = PX_NE_I,
+    [OP_NE_FNC] = PX_NE_I,
+    [OP_LE] = PX_LE,
+    [OP_GE] = PX_GE,
+    [OP_LT] = PX_LT,
+    [OP_GT] = PX_GT,
+    [OP_LOAD_F] = PX_LOAD,
+    [OP_LOAD_V] = PX_LOAD_V,
+    [OP_LOAD_S] = PX_LOAD,
+    [OP_LOAD_ENT] = PX_LOAD,
+    [OP_LOAD_FLD] = PX_LOAD,
+    [OP_LOAD_FNC] = PX_LOAD,
+    [OP_ADDRESS] = PX_ADDRESS,
+    [OP_STORE_F] = PX_STORE,
+    [OP_STORE_V] = PX_STORE_V,
+    [OP_STORE_S] = PX_STORE,
+    [OP_STORE_ENT] = PX_STORE,
+    [OP_STORE_FLD] = PX_STORE,
+    [OP_STORE_FNC] = PX_STORE,
+    [OP_STOREP_F] = PX_STOREP,
+    [OP_STOREP_V] = PX_STOREP_V,
+    [OP_STOREP_S] = PX_STOREP_S,
+    [OP_STOREP_ENT] = PX_STOREP,
+    [OP_STOREP_FLD] = PX_STOREP,
+    [OP_STOREP_FNC] = PX_STOREP,
+    [OP_RETURN] = PX_RETURN,
+    [OP_NOT_F] = PX_NOT_F,
+    [OP_NOT_V] = PX_NOT_V,
+    [OP_NOT_S] = PX_NOT_S,
+    [OP_NOT_ENT] = PX_NOT_ENT,
+    [OP_NOT_FNC] = PX_NOT_FNC,
+    [OP_IF] = PX_IF,
+    [OP_IFNOT] = PX_IFNOT,
+    [OP_CALL0] = PX_CALL,
+    [OP_CALL1] = PX_CALL,
+    [OP_CALL2] = PX_CALL,
+    [OP_CALL3] = PX_CALL,
+    [OP_CALL4] = PX_CALL,
+    [OP_CALL5] = PX_CALL,
+    [OP_CALL6] = PX_CALL,
+    [OP_CALL7] = PX_CALL,
+    [OP_CALL8] = PX_CALL,
+    [OP_STATE] = PX_STATE,
+    [OP_GOTO] = PX_GOTO,
+    [OP_AND] = PX_AND,
+    [OP_OR] = PX_OR,
+    [OP_BITAND] = PX_BITAND,
+    [OP_BITOR] = PX_BITOR,
+};
+
+/*
+====================
+PR_DecodeStatements
+
+Builds the pre-decoded statements for the loaded progs
+====================
+*/
+void
+PR_DecodeStatements(void)
+{
+    const dstatement_t *st;
+    pxstatement_t *px;
+    int i;
+
+    pr_xstatements = Hunk_AllocName(progs->numstatements * sizeof(*px),
+				    "progsx");
+
+    st = pr_statements;
+    px = pr_xstatements;
+    for (i = 0; i < progs->numstatements; i++, st++, px++) {
+	px->op = st->op < ARRAY_SIZE(pr_xopmap) ? pr_xopmap[st->op] : PX_BAD;
+	px->a = (eval_t *)&pr_globals[st->a];
+	px->b = (eval_t *)&pr_globals[st->b];
+	px->c = (eval_t *)&pr_globals[st->c];
+	switch (px->op) {
+	case PX_IF:
+	case PX_IFNOT:
+	    px->arg = st->b;
+	    break;
+	case PX_GOTO:
+	    px->arg = st->a;
+	    break;
+	case PX_CALL:
+	    px->arg = st->op - OP_CALL0;
+	    break;
+	case PX_BAD:
+	    px->arg = st->op;
+	    break;
+	default:
+	    px->arg = 0;
+	    break;
+	}
+    }
+
+    /* fuse the pairs */
+    px = pr_xstatements;
+    for (i = 0; i < progs->numstatements - 1; i++, px++) {
+	switch (px->op) {
+	case PX_LOAD:
+	    if (px[1].a != px->c)
+		break;
+	    if (px[1].op == PX_STORE)
+		px->op = PX_LOAD_STORE;
+	    else if (px[1].op == PX_IFNOT)
+		px->op = PX_LOAD_IFNOT;
+	    else if (px[1].op == PX_IF)
+		px->op = PX_LOAD_IF;
+	    break;
+	case PX_LOAD_V:
+	    if (px[1].a == px->c && px[1].op == PX_STORE_V)
+		px->op = PX_LOAD_STORE_V;
+	    break;
+	case PX_ADDRESS:
+	    if (px[1].b != px->c)
+		break;
+	    if (px[1].op == PX_STOREP)
+		px->op = PX_ADDRESS_STOREP;
+	    else if (px[1].op == PX_STOREP_V)
+		px->op = PX_ADDRESS_STOREP_V;
+	    else if (px[1].op == PX_STOREP_S)
+		px->op = PX_ADDRESS_STOREP_S;
+	    break;
+	}
+    }
+}
+
+/*
+ * With GCC, each opcode jumps straight to the next one through a table of
+ * label addresses; otherwise it goes back round the loop to the switch.
+ * The case labels are there either way, to enter the first statement.
+ */
+#ifdef __GNUC__
+#define PX_CASE(name)	case PX_##name: L_##name
+#define PX_NEXT()	do { s++; PX_FETCH(); goto *px_labels[st->op]; } while (0)
+#else
+#define PX_CASE(name)	case PX_##name
+#define PX_NEXT()	continue
+#endif
+
+#define PX_FETCH()				\
+    do {					\
+	st = &pr_xstatements[s];		\
+	a = st->a;				\
+	b = st->b;				\
+	c = st->c;				\
+	pr_xfunction->profile++;		\
+	pr_xstatement = s;			\
+	if (pr_trace)				\
+	    PR_PrintStatement(&pr_statements[s]);	\
+    } while (0)
+
+/*
+ * Jumps from statement s, by an offset from it.  Only a jump backwards (or
+ * to itself) can loop, so only those count against the runaway limit.
+ */
+#define PX_JUMP(offset)							\
+    do {								\
+	s += (offset) - 1;	/* offset the s++ */			\
+	if ((offset) <= 0) {						\
+	    if (!--runaway)						\
+		PR_RunError("runaway loop error");			\
+	    if (runaway <= 50000 && !(runaway % 5000))			\
+		Con_DPrintf("%s: progs execution running away (%i left)\n",	\
+			    __func__, runaway);				\
+	}								\
+    } while (0)
+
 /*
 ====================
 PR_ExecuteProgram
@@ -375,13 +622,18 @@ PR_ExecuteProgram(func_t fnum)
 {
     eval_t *a, *b, *c;
     int s;
-    dstatement_t *st;
+    const pxstatement_t *st;
     dfunction_t *f, *newf;
     int runaway;
     int i;
     edict_t *ed;
     int exitdepth;
     eval_t *ptr;
+#ifdef __GNUC__
+#define PX_OP(name) [PX_##name] = &&L_##name,
+    static const void *const px_labels[PX_NUMOPS] = { PX_OPS };
+#undef PX_OP
+#endif
 
     if (!fnum || fnum >= progs->numfunctions) {
 	if (pr_global_struct->self)
@@ -394,6 +646,12 @@ PR_ExecuteProgram(func_t fnum)
 #endif
     }
 
+    if (!pr_depth)
+	PR_ProfileStart();
+
+    if (PR_ExecuteNative(fnum))
+	return;
+
     f = &pr_functions[fnum];
 
     runaway = 1000000;
@@ -406,178 +664,153 @@ PR_ExecuteProgram(func_t fnum)
 
     while (1) {
 	s++;			// next statement
-
-	st = &pr_statements[s];
-	a = (eval_t *)&pr_globals[st->a];
-	b = (eval_t *)&pr_globals[st->b];
-	c = (eval_t *)&pr_globals[st->c];
-
-	if (!--runaway)
-	    PR_RunError("runaway loop error");
-	if (runaway <= 50000 && !(runaway % 5000))
-	    Con_DPrintf("%s: progs execution running away (%i left)\n",
-			__func__, runaway);
-
-	pr_xfunction->profile++;
-	pr_xstatement = s;
-
-	if (pr_trace)
-	    PR_PrintStatement(st);
+	PX_FETCH();
 
 	switch (st->op) {
-	case OP_ADD_F:
+	PX_CASE(ADD_F):
 	    c->_float = a->_float + b->_float;
-	    break;
-	case OP_ADD_V:
+	    PX_NEXT();
+	PX_CASE(ADD_V):
 	    c->vector[0] = a->vector[0] + b->vector[0];
 	    c->vector[1] = a->vector[1] + b->vector[1];
 	    c->vector[2] = a->vector[2] + b->vector[2];
-	    break;
+	    PX_NEXT();
 
-	case OP_SUB_F:
+	PX_CASE(SUB_F):
 	    c->_float = a->_float - b->_float;
-	    break;
-	case OP_SUB_V:
+	    PX_NEXT();
+	PX_CASE(SUB_V):
 	    c->vector[0] = a->vector[0] - b->vector[0];
 	    c->vector[1] = a->vector[1] - b->vector[1];
 	    c->vector[2] = a->vector[2] - b->vector[2];
-	    break;
+	    PX_NEXT();
 
-	case OP_MUL_F:
+	PX_CASE(MUL_F):
 	    c->_float = a->_float * b->_float;
-	    break;
-	case OP_MUL_V:
+	    PX_NEXT();
+	PX_CASE(MUL_V):
 	    c->_float = a->vector[0] * b->vector[0]
 		+ a->vector[1] * b->vector[1]
 		+ a->vector[2] * b->vector[2];
-	    break;
-	case OP_MUL_FV:
+	    PX_NEXT();
+	PX_CASE(MUL_FV):
 	    c->vector[0] = a->_float * b->vector[0];
 	    c->vector[1] = a->_float * b->vector[1];
 	    c->vector[2] = a->_float * b->vector[2];
-	    break;
-	case OP_MUL_VF:
+	    PX_NEXT();
+	PX_CASE(MUL_VF):
 	    c->vector[0] = b->_float * a->vector[0];
 	    c->vector[1] = b->_float * a->vector[1];
 	    c->vector[2] = b->_float * a->vector[2];
-	    break;
+	    PX_NEXT();
 
-	case OP_DIV_F:
+	PX_CASE(DIV_F):
 	    c->_float = a->_float / b->_float;
-	    break;
+	    PX_NEXT();
 
-	case OP_BITAND:
+	PX_CASE(BITAND):
 	    c->_float = (int)a->_float & (int)b->_float;
-	    break;
+	    PX_NEXT();
 
-	case OP_BITOR:
+	PX_CASE(BITOR):
 	    c->_float = (int)a->_float | (int)b->_float;
-	    break;
+	    PX_NEXT();
 
 
-	case OP_GE:
+	PX_CASE(GE):
 	    c->_float = a->_float >= b->_float;
-	    break;
-	case OP_LE:
+	    PX_NEXT();
+	PX_CASE(LE):
 	    c->_float = a->_float <= b->_float;
-	    break;
-	case OP_GT:
+	    PX_NEXT();
+	PX_CASE(GT):
 	    c->_float = a->_float > b->_float;
-	    break;
-	case OP_LT:
+	    PX_NEXT();
+	PX_CASE(LT):
 	    c->_float = a->_float < b->_float;
-	    break;
-	case OP_AND:
+	    PX_NEXT();
+	PX_CASE(AND):
 	    c->_float = a->_float && b->_float;
-	    break;
-	case OP_OR:
+	    PX_NEXT();
+	PX_CASE(OR):
 	    c->_float = a->_float || b->_float;
-	    break;
+	    PX_NEXT();
 
-	case OP_NOT_F:
+	PX_CASE(NOT_F):
 	    c->_float = !a->_float;
-	    break;
-	case OP_NOT_V:
+	    PX_NEXT();
+	PX_CASE(NOT_V):
 	    c->_float = !a->vector[0] && !a->vector[1] && !a->vector[2];
-	    break;
-	case OP_NOT_S:
+	    PX_NEXT();
+	PX_CASE(NOT_S):
 	    c->_float = !a->string || !*PR_GetString(a->string);
-	    break;
-	case OP_NOT_FNC:
+	    PX_NEXT();
+	PX_CASE(NOT_FNC):
 	    c->_float = !a->function;
-	    break;
-	case OP_NOT_ENT:
+	    PX_NEXT();
+	PX_CASE(NOT_ENT):
 	    c->_float = (PROG_TO_EDICT(a->edict) == sv.edicts);
-	    break;
+	    PX_NEXT();
 
-	case OP_EQ_F:
+	PX_CASE(EQ_F):
 	    c->_float = a->_float == b->_float;
-	    break;
-	case OP_EQ_V:
+	    PX_NEXT();
+	PX_CASE(EQ_V):
 	    c->_float = (a->vector[0] == b->vector[0]) &&
 		(a->vector[1] == b->vector[1]) &&
 		(a->vector[2] == b->vector[2]);
-	    break;
-	case OP_EQ_S:
+	    PX_NEXT();
+	PX_CASE(EQ_S):
 	    c->_float =
 		!strcmp(PR_GetString(a->string), PR_GetString(b->string));
-	    break;
-	case OP_EQ_E:
+	    PX_NEXT();
+	PX_CASE(EQ_I):		// entities and functions
 	    c->_float = a->_int == b->_int;
-	    break;
-	case OP_EQ_FNC:
-	    c->_float = a->function == b->function;
-	    break;
+	    PX_NEXT();
 
-	case OP_NE_F:
+	PX_CASE(NE_F):
 	    c->_float = a->_float != b->_float;
-	    break;
-	case OP_NE_V:
+	    PX_NEXT();
+	PX_CASE(NE_V):
 	    c->_float = (a->vector[0] != b->vector[0]) ||
 		(a->vector[1] != b->vector[1]) ||
 		(a->vector[2] != b->vector[2]);
-	    break;
-	case OP_NE_S:
+	    PX_NEXT();
+	PX_CASE(NE_S):
 	    c->_float =
 		strcmp(PR_GetString(a->string), PR_GetString(b->string));
-	    break;
-	case OP_NE_E:
+	    PX_NEXT();
+	PX_CASE(NE_I):		// entities and functions
 	    c->_float = a->_int != b->_int;
-	    break;
-	case OP_NE_FNC:
-	    c->_float = a->function != b->function;
-	    break;
+	    PX_NEXT();
 
 //==================
-	case OP_STORE_F:
-	case OP_STORE_ENT:
-	case OP_STORE_FLD:	// integers
-	case OP_STORE_S:
-	case OP_STORE_FNC:	// pointers
+	PX_CASE(STORE):		// floats, integers and pointers
 	    b->_int = a->_int;
-	    break;
-	case OP_STORE_V:
+	    PX_NEXT();
+	PX_CASE(STORE_V):
 	    b->vector[0] = a->vector[0];
 	    b->vector[1] = a->vector[1];
 	    b->vector[2] = a->vector[2];
-	    break;
+	    PX_NEXT();
 
-	case OP_STOREP_F:
-	case OP_STOREP_ENT:
-	case OP_STOREP_FLD:	// integers
-	case OP_STOREP_S:
-	case OP_STOREP_FNC:	// pointers
+	PX_CASE(STOREP):	// floats, integers and pointers
 	    ptr = (eval_t *)((byte *)sv.edicts + b->_int);
 	    ptr->_int = a->_int;
-	    break;
-	case OP_STOREP_V:
+	    PX_NEXT();
+	PX_CASE(STOREP_V):
 	    ptr = (eval_t *)((byte *)sv.edicts + b->_int);
 	    ptr->vector[0] = a->vector[0];
 	    ptr->vector[1] = a->vector[1];
 	    ptr->vector[2] = a->vector[2];
-	    break;
+	    PX_NEXT();
+	PX_CASE(STOREP_S):	// find() indexes some string fields
+	    ptr = (eval_t *)((byte *)sv.edicts + b->_int);
+	    ptr->_int = a->_int;
+	    ED_FieldStored((b->_int - offsetof(edict_t, v)) % pr_edict_size / 4);
+	    PX_NEXT();
 
-	case OP_ADDRESS:
+	PX_CASE(ADDRESS):
 	    ed = PROG_TO_EDICT(a->edict);
 #ifdef PARANOID
 	    NUM_FOR_EDICT(ed);	// make sure it's in range
@@ -585,22 +818,18 @@ PR_ExecuteProgram(func_t fnum)
 	    if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
 		PR_RunError("assignment to world entity");
 	    c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
-	    break;
+	    PX_NEXT();
 
-	case OP_LOAD_F:
-	case OP_LOAD_FLD:
-	case OP_LOAD_ENT:
-	case OP_LOAD_S:
-	case OP_LOAD_FNC:
+	PX_CASE(LOAD):		// floats, integers and pointers
 	    ed = PROG_TO_EDICT(a->edict);
 #ifdef PARANOID
 	    NUM_FOR_EDICT(ed);	// make sure it's in range
 #endif
 	    a = (eval_t *)((int *)&ed->v + b->_int);
 	    c->_int = a->_int;
-	    break;
+	    PX_NEXT();
 
-	case OP_LOAD_V:
+	PX_CASE(LOAD_V):
 	    ed = PROG_TO_EDICT(a->edict);
 #ifdef PARANOID
 	    NUM_FOR_EDICT(ed);	// make sure it's in range
@@ -609,34 +838,26 @@ PR_ExecuteProgram(func_t fnum)
 	    c->vector[0] = a->vector[0];
 	    c->vector[1] = a->vector[1];
 	    c->vector[2] = a->vector[2];
-	    break;
+	    PX_NEXT();
 
 //==================
 
-	case OP_IFNOT:
+	PX_CASE(IFNOT):
 	    if (!a->_int)
-		s += st->b - 1;	// offset the s++
-	    break;
+		PX_JUMP(st->arg);
+	    PX_NEXT();
 
-	case OP_IF:
+	PX_CASE(IF):
 	    if (a->_int)
-		s += st->b - 1;	// offset the s++
-	    break;
+		PX_JUMP(st->arg);
+	    PX_NEXT();
 
-	case OP_GOTO:
-	    s += st->a - 1;	// offset the s++
-	    break;
+	PX_CASE(GOTO):
+	    PX_JUMP(st->arg);
+	    PX_NEXT();
 
-	case OP_CALL0:
-	case OP_CALL1:
-	case OP_CALL2:
-	case OP_CALL3:
-	case OP_CALL4:
-	case OP_CALL5:
-	case OP_CALL6:
-	case OP_CALL7:
-	case OP_CALL8:
-	    pr_argc = st->op - OP_CALL0;
+	PX_CASE(CALL):
+	    pr_argc = st->arg;
 	    if (!a->function)
 		PR_RunError("NULL function");
 
@@ -645,57 +866,192 @@ PR_ExecuteProgram(func_t fnum)
 	    /* negative statements are built in functions */
 	    if (newf->first_statement < 0) {
 		i = -newf->first_statement;
-		if (i >= pr_numbuiltins)
+		if (i >= pr_numbuiltins || !pr_builtins[i])
 		    PR_RunError("Bad builtin call number");
-		pr_builtins[i] ();
-		break;
+		if (pr_profiling) {
+		    PR_ProfileEnter(newf);
+		    pr_builtins[i] ();
+		    PR_ProfileLeave();
+		} else {
+		    pr_builtins[i] ();
+		}
+		PX_NEXT();
 	    }
 
 	    s = PR_EnterFunction(newf);
-	    break;
+	    PX_NEXT();
 
-	case OP_DONE:
-	case OP_RETURN:
-	    pr_globals[OFS_RETURN] = pr_globals[st->a];
-	    pr_globals[OFS_RETURN + 1] = pr_globals[st->a + 1];
-	    pr_globals[OFS_RETURN + 2] = pr_globals[st->a + 2];
+	PX_CASE(RETURN):
+	    pr_globals[OFS_RETURN] = a->vector[0];
+	    pr_globals[OFS_RETURN + 1] = a->vector[1];
+	    pr_globals[OFS_RETURN + 2] = a->vector[2];
 
 	    s = PR_LeaveFunction();
 	    if (pr_depth == exitdepth)
 		return;		// all done
-	    break;
+	    PX_NEXT();
 
-	case OP_STATE:
+	PX_CASE(STATE):
 	    ed = PROG_TO_EDICT(pr_global_struct->self);
 	    ed->v.nextthink = pr_global_struct->time + 0.1;
 	    if (a->_float != ed->v.frame) {
 		ed->v.frame = a->_float;
 	    }
 	    ed->v.think = b->function;
-	    break;
+	    PX_NEXT();
+
+//==================
+// fused pairs: the second statement's operands are in st[1]
+
+	PX_CASE(LOAD_STORE):
+	    ed = PROG_TO_EDICT(a->edict);
+	    a = (eval_t *)((int *)&ed->v + b->_int);
+	    c->_int = a->_int;
+	    st[1].b->_int = c->_int;
+	    s++;
+	    PX_NEXT();
+
+	PX_CASE(LOAD_STORE_V):
+	    ed = PROG_TO_EDICT(a->edict);
+	    a = (eval_t *)((int *)&ed->v + b->_int);
+	    c->vector[0] = a->vector[0];
+	    c->vector[1] = a->vector[1];
+	    c->vector[2] = a->vector[2];
+	    b = st[1].b;
+	    b->vector[0] = c->vector[0];
+	    b->vector[1] = c->vector[1];
+	    b->vector[2] = c->vector[2];
+	    s++;
+	    PX_NEXT();
+
+	PX_CASE(LOAD_IFNOT):
+	    ed = PROG_TO_EDICT(a->edict);
+	    a = (eval_t *)((int *)&ed->v + b->_int);
+	    c->_int = a->_int;
+	    s++;
+	    if (!c->_int)
+		PX_JUMP(st[1].arg);
+	    PX_NEXT();
 
+	PX_CASE(LOAD_IF):
+	    ed = PROG_TO_EDICT(a->edict);
+	    a = (eval_t *)((int *)&ed->v + b->_int);
+	    c->_int = a->_int;
+	    s++;
+	    if (c->_int)
+		PX_JUMP(st[1].arg);
+	    PX_NEXT();
+
+	PX_CASE(ADDRESS_STOREP):
+	    ed = PROG_TO_EDICT(a->edict);
+	    if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		PR_RunError("assignment to world entity");
+	    c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
+	    ptr = (eval_t *)((byte *)sv.edicts + c->_int);
+	    ptr->_int = st[1].a->_int;
+	    s++;
+	    PX_NEXT();
+
+	PX_CASE(ADDRESS_STOREP_S):
+	    ed = PROG_TO_EDICT(a->edict);
+	    if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		PR_RunError("assignment to world entity");
+	    c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
+	    ptr = (eval_t *)((byte *)sv.edicts + c->_int);
+	    ptr->_int = st[1].a->_int;
+	    ED_FieldStored(b->_int);
+	    s++;
+	    PX_NEXT();
+
+	PX_CASE(ADDRESS_STOREP_V):
+	    ed = PROG_TO_EDICT(a->edict);
+	    if (ed == (edict_t *)sv.edicts && sv.state == ss_active)
+		PR_RunError("assignment to world entity");
+	    c->_int = (byte *)((int *)&ed->v + b->_int) - (byte *)sv.edicts;
+	    ptr = (eval_t *)((byte *)sv.edicts + c->_int);
+	    a = st[1].a;
+	    ptr->vector[0] = a->vector[0];
+	    ptr->vector[1] = a->vector[1];
+	    ptr->vector[2] = a->vector[2];
+	    s++;
+	    PX_NEXT();
+
+	PX_CASE(BAD):
 	default:
-	    PR_RunError("Bad opcode %i", st->op);
+	    PR_RunError("Bad opcode %i", st->arg);
 	}
     }
 }
 
 /*----------------------*/
 
+/*
+ * Strings outside the progs string block are handed to the progs as negative
+ * indices into pr_strtbl.  Engine strings are registered by pointer and keep
+ * their slot until the progs are reloaded.  Temp strings, like the results of
+ * ftos and vtos, are copied into the table and shared by contents; at the end
+ * of each server frame the slots of any no longer held in a global or an
+ * entity field are freed for reuse, once enough have piled up to be worth
+ * looking for.  Both kinds are found through one hash, chained through
+ * pr_strnext, so registering a string costs the same however big the table.
+ */
 #define PR_STRTBL_CHUNK 256
-static const char **pr_strtbl = NULL;
+#define PR_STRHASH_SIZE 4096	// a power of two
+#define PR_STRTEMP_SWEEP 1024	// new temp strings between collections
+
+typedef struct {
+    const char *string;
+    unsigned hash;
+    int next;			// chain or free list, -1 at the end
+    qboolean temp;		// string is a copy owned by the table
+} prstr_t;
+
+static prstr_t *pr_strtbl = NULL;
 static int pr_strtbl_size;
 static int num_prstr;
+static int pr_strhash[PR_STRHASH_SIZE];
+static int pr_strfree;		// first free slot, -1 if none
+static int pr_strtemp_new;	// temp strings added since the last collection
+static byte *pr_strmark;
+
+static unsigned
+PR_PointerHash(const char *s)
+{
+    uintptr_t p = (uintptr_t)s;
+
+    return (unsigned)(p ^ (p >> 15) ^ (p >> 31)) * 2654435761U;
+}
+
+static unsigned
+PR_ContentHash(const char *s)
+{
+    unsigned h = 2166136261U;
+
+    while (*s)
+	h = (h ^ (byte)*s++) * 16777619U;
+
+    return h;
+}
 
 void
 PR_InitStringTable(void)
 {
+    int i;
+
     if (pr_strtbl) {
-	Z_Free(pr_strtbl);
+	for (i = 0; i < num_prstr; i++)
+	    if (pr_strtbl[i].temp)
+		free((char *)pr_strtbl[i].string);
+	free(pr_strtbl);
+	free(pr_strmark);
 	pr_strtbl = NULL;
+	pr_strmark = NULL;
     }
     pr_strtbl_size = 0;
     num_prstr = 0;
+    pr_strfree = -1;
+    pr_strtemp_new = 0;
+    memset(pr_strhash, -1, sizeof(pr_strhash));
 }
 
 const char *
@@ -706,7 +1062,7 @@ PR_GetString(int num)
     if (num >= 0 && num < pr_strings_size - 1)
 	s = pr_strings + num;
     else if (num < 0 && num >= -num_prstr)
-	s = pr_strtbl[-num - 1];
+	s = pr_strtbl[-num - 1].string;
     else
 #ifdef NQ_HACK
 	Host_Error("%s: invalid string offset %d (%d to %d valid)\n",
@@ -720,24 +1076,138 @@ PR_GetString(int num)
     return s;
 }
 
-int
-PR_SetString(const char *s)
+static int
+PR_AddString(const char *s, unsigned hash, qboolean temp)
 {
+    prstr_t *str;
     int i;
 
-    if (s - pr_strings < 0 || s - pr_strings > pr_strings_size - 2) {
-	for (i = 0; i < num_prstr; i++)
-	    if (pr_strtbl[i] == s)
-		break;
-	if (i < num_prstr)
-	    return -i - 1;
+    if (pr_strfree >= 0) {
+	i = pr_strfree;
+	pr_strfree = pr_strtbl[i].next;
+    } else {
 	if (num_prstr == pr_strtbl_size) {
 	    pr_strtbl_size += PR_STRTBL_CHUNK;
-	    pr_strtbl = Z_Realloc(pr_strtbl, pr_strtbl_size * sizeof(char *));
+	    pr_strtbl = realloc(pr_strtbl, pr_strtbl_size * sizeof(*pr_strtbl));
+	    pr_strmark = realloc(pr_strmark, pr_strtbl_size);
+	    if (!pr_strtbl || !pr_strmark)
+		Sys_Error("%s: out of memory", __func__);
 	}
-	pr_strtbl[num_prstr] = s;
-	num_prstr++;
-	return -num_prstr;
+	i = num_prstr++;
+    }
+
+    str = &pr_strtbl[i];
+    str->string = s;
+    str->hash = hash;
+    str->temp = temp;
+    str->next = pr_strhash[hash & (PR_STRHASH_SIZE - 1)];
+    pr_strhash[hash & (PR_STRHASH_SIZE - 1)] = i;
+
+    return -i - 1;
+}
+
+int
+PR_SetString(const char *s)
+{
+    unsigned hash;
+    int i;
+
+    if (s - pr_strings < 0 || s - pr_strings > pr_strings_size - 2) {
+	hash = PR_PointerHash(s);
+	for (i = pr_strhash[hash & (PR_STRHASH_SIZE - 1)]; i >= 0;
+	     i = pr_strtbl[i].next)
+	    if (pr_strtbl[i].string == s && !pr_strtbl[i].temp)
+		return -i - 1;
+	return PR_AddString(s, hash, false);
     }
     return (int)(s - pr_strings);
 }
+
+/*
+============
+PR_SetTempString
+
+Returns the index of a copy of the string's current contents, which the
+caller is free to overwrite afterwards.  The copy lasts as long as the progs
+hold on to it.
+============
+*/
+int
+PR_SetTempString(const char *s)
+{
+    unsigned hash;
+    char *copy;
+    int i;
+
+    hash = PR_ContentHash(s);
+    for (i = pr_strhash[hash & (PR_STRHASH_SIZE - 1)]; i >= 0;
+	 i = pr_strtbl[i].next)
+	if (pr_strtbl[i].temp && pr_strtbl[i].hash == hash
+	    && !strcmp(pr_strtbl[i].string, s))
+	    return -i - 1;
+
+    copy = malloc(strlen(s) + 1);
+    if (!copy)
+	Sys_Error("%s: out of memory", __func__);
+    strcpy(copy, s);
+    pr_strtemp_new++;
+
+    return PR_AddString(copy, hash, true);
+}
+
+static void
+PR_MarkStrings(const int *values, int count)
+{
+    int i, num;
+
+    /* anything that looks like a table index keeps its string */
+    for (i = 0; i < count; i++) {
+	num = values[i];
+	if (num < 0 && num >= -num_prstr)
+	    pr_strmark[-num - 1] = 1;
+    }
+}
+
+/*
+============
+PR_CollectStrings
+
+Called between server frames, when no progs code is running, so every temp
+string still in use is held somewhere in the globals or the entities.
+============
+*/
+void
+PR_CollectStrings(void)
+{
+    prstr_t *str;
+    edict_t *ent;
+    int i, *link;
+
+    if (pr_strtemp_new < PR_STRTEMP_SWEEP)
+	return;
+    pr_strtemp_new = 0;
+
+    memset(pr_strmark, 0, num_prstr);
+    PR_MarkStrings((const int *)pr_globals, progs->numglobals);
+    ent = sv.edicts;
+    for (i = 0; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent))
+	PR_MarkStrings((const int *)&ent->v, progs->entityfields);
+
+    for (i = 0; i < num_prstr; i++) {
+	str = &pr_strtbl[i];
+	if (!str->temp || !str->string || pr_strmark[i])
+	    continue;
+
+	link = &pr_strhash[str->hash & (PR_STRHASH_SIZE - 1)];
+	while (*link != i)
+	    link = &pr_strtbl[*link].next;
+	*link = str->next;
+
+	free((char *)str->string);
+	str->string = "";
+	str->temp = false;
+	str->hash = 0;
+	str->next = pr_strfree;
+	pr_strfree = i;
+    }
+}
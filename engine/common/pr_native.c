@@ -0,0 +1,280 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_native.c -- running progs.dat compiled to native code by tyr-progs2c
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "common.h"
+#include "console.h"
+#include "pr_comp.h"
+#include "pr_native.h"
+#include "progs.h"
+#include "server.h"
+
+#ifdef NQ_HACK
+#include "quakedef.h"
+#endif
+#ifdef QW_HACK
+#include "qwsvdef.h"
+#endif
+
+/*
+==============================================================================
+
+NATIVE PROGS
+
+With -nativeprogs <file>, the shared object of that name in the game
+directory is loaded alongside the progs.  If it was built from the same
+progs.dat, PR_ExecuteProgram runs the native functions in its place.  The
+engine still does the function entry and exit, so the locals, pr_depth and
+the stack traces work as they do when interpreting.
+
+==============================================================================
+*/
+
+#define NATIVE_RUNAWAY 1000000
+
+static struct {
+#ifdef _WIN32
+    HMODULE library;
+#else
+    void *library;
+#endif
+    char path[MAX_OSPATH];
+    const prnativeprogs_t *progs;
+} native;
+
+static const prnativefunc_t *pr_nativefuncs;	// NULL when interpreting
+static prnative_t pr_native;
+static int pr_nativerunaway;
+
+static void
+PR_NativeCall(int fnum, int argc)
+{
+    dfunction_t *f;
+    int i;
+
+    if (!fnum)
+	PR_RunError("NULL function");
+    if (fnum < 0 || fnum >= progs->numfunctions)
+	PR_RunError("Bad function number %i", fnum);
+
+    f = &pr_functions[fnum];
+    pr_argc = argc;
+
+    /* negative statements are built in functions */
+    if (f->first_statement < 0) {
+	i = -f->first_statement;
+	if (i >= pr_numbuiltins || !pr_builtins[i])
+	    PR_RunError("Bad builtin call number");
+	if (pr_profiling) {
+	    PR_ProfileEnter(f);
+	    pr_builtins[i] ();
+	    PR_ProfileLeave();
+	} else {
+	    pr_builtins[i] ();
+	}
+	return;
+    }
+
+    if (!pr_nativefuncs[fnum]) {
+	PR_ExecuteProgram(fnum);
+	return;
+    }
+    PR_EnterFunction(f);
+    f->profile += pr_nativefuncs[fnum] ();
+    PR_LeaveFunction();
+}
+
+static void
+PR_NativeState(float frame, int think)
+{
+    edict_t *ed;
+
+    ed = PROG_TO_EDICT(pr_global_struct->self);
+    ed->v.nextthink = pr_global_struct->time + 0.1;
+    if (frame != ed->v.frame)
+	ed->v.frame = frame;
+    ed->v.think = think;
+}
+
+static void
+PR_NativeAssignWorld(void)
+{
+    if (sv.state == ss_active)
+	PR_RunError("assignment to world entity");
+}
+
+static void
+PR_NativeRunaway(void)
+{
+    if (pr_nativerunaway <= 0)
+	PR_RunError("runaway loop error");
+    if (!(pr_nativerunaway % 5000))
+	Con_DPrintf("%s: progs execution running away (%i left)\n",
+		    __func__, pr_nativerunaway);
+}
+
+static void
+PR_CloseNative(void)
+{
+    if (!native.library)
+	return;
+#ifdef _WIN32
+    FreeLibrary(native.library);
+#else
+    dlclose(native.library);
+#endif
+    native.library = NULL;
+    native.progs = NULL;
+    native.path[0] = 0;
+}
+
+static qboolean
+PR_OpenNative(const char *path)
+{
+    if (native.library && !strcmp(native.path, path))
+	return native.progs != NULL;
+
+    PR_CloseNative();
+#ifdef _WIN32
+    native.library = LoadLibrary(path);
+    if (!native.library) {
+	Con_Printf("Couldn't load native progs %s\n", path);
+	return false;
+    }
+    native.progs = (const prnativeprogs_t *)
+	GetProcAddress(native.library, PR_NATIVE_SYMBOL);
+#else
+    native.library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!native.library) {
+	Con_Printf("Couldn't load native progs: %s\n", dlerror());
+	return false;
+    }
+    native.progs = dlsym(native.library, PR_NATIVE_SYMBOL);
+#endif
+    snprintf(native.path, sizeof(native.path), "%s", path);
+    if (!native.progs)
+	Con_Printf("%s has no native progs\n", path);
+
+    return native.progs != NULL;
+}
+
+/*
+====================
+PR_LoadNative
+
+Called at the end of PR_LoadProgs, with the CRC of the progs.dat file
+====================
+*/
+void
+PR_LoadNative(unsigned short filecrc)
+{
+    const prnativeprogs_t *nprogs;
+    char path[MAX_OSPATH];
+    int i;
+
+    pr_nativefuncs = NULL;
+
+    i = COM_CheckParm("-nativeprogs");
+    if (!i || i >= com_argc - 1)
+	return;
+
+    snprintf(path, sizeof(path), "%s/%s", com_gamedir, com_argv[i + 1]);
+    if (!PR_OpenNative(path))
+	return;
+
+    nprogs = native.progs;
+    if (nprogs->version != PR_NATIVE_VERSION) {
+	Con_Printf("%s is native progs version %i, should be %i\n", path,
+		   nprogs->version, PR_NATIVE_VERSION);
+	return;
+    }
+    if (nprogs->crc != progs->crc || nprogs->filecrc != filecrc
+	|| nprogs->numfunctions != progs->numfunctions
+	|| nprogs->numstatements != progs->numstatements) {
+	Con_Printf("%s was built from a different progs.dat\n", path);
+	return;
+    }
+
+    pr_native.globals = (prnval_t *)pr_globals;
+    pr_native.entvars = offsetof(edict_t, v);
+    pr_native.xstatement = &pr_xstatement;
+    pr_native.runaway = &pr_nativerunaway;
+    pr_native.call = PR_NativeCall;
+    pr_native.state = PR_NativeState;
+    pr_native.assignworld = PR_NativeAssignWorld;
+    pr_native.runawaycheck = PR_NativeRunaway;
+    pr_native.runerror = PR_RunError;
+    pr_native.getstring = PR_GetString;
+    nprogs->init(&pr_native);
+
+    pr_nativefuncs = nprogs->functions;
+    Con_Printf("Running native progs from %s\n", path);
+}
+
+qboolean
+PR_NativeLoaded(void)
+{
+    return pr_nativefuncs != NULL;
+}
+
+/*
+====================
+PR_ExecuteNative
+
+Runs the function if it was compiled, returning false if not
+====================
+*/
+qboolean
+PR_ExecuteNative(func_t fnum)
+{
+    prnativefunc_t func;
+    dfunction_t *f;
+    int runaway;
+
+    if (!pr_nativefuncs)
+	return false;
+    func = pr_nativefuncs[fnum];
+    if (!func)
+	return false;
+
+    pr_trace = false;
+    runaway = pr_nativerunaway;
+    pr_nativerunaway = NATIVE_RUNAWAY;
+    pr_native.edicts = (char *)sv.edicts;
+
+    f = &pr_functions[fnum];
+    PR_EnterFunction(f);
+    f->profile += func();
+    PR_LeaveFunction();
+
+    pr_nativerunaway = runaway;
+
+    return true;
+}
@@ -0,0 +1,351 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// pr_profile.c -- timing of the QuakeC functions and builtins
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "pr_comp.h"
+#include "progs.h"
+#include "sys.h"
+#include "zone.h"
+
+#ifdef NQ_HACK
+#include "quakedef.h"
+#endif
+#ifdef QW_HACK
+#include "qwsvdef.h"
+#endif
+
+/*
+==============================================================================
+
+TIMING PROFILE
+
+With pr_profile 1, each entry to and exit from a QuakeC function or a
+builtin is timed.  Each function gets its number of calls, its total time
+(counted once through recursion) and its self time, which leaves out the
+functions and builtins it called.  The self time is also kept for each call
+stack, for "profile fold".
+
+==============================================================================
+*/
+
+#define PROF_MAXNODES	8192
+#define PROF_MAXDEPTH	128
+
+typedef struct {
+    int calls;
+    int active;			// frames on the stack
+    double total;
+    double self;
+} prprofile_t;
+
+/* The call tree, node 0 is the root */
+typedef struct {
+    int func;
+    int parent;
+    int child;
+    int sibling;
+    double self;
+} prprofnode_t;
+
+static cvar_t pr_profile = { "pr_profile", "0" };
+qboolean pr_profiling;		// latched at each top level call
+
+static prprofile_t *pr_profiles;
+static prprofnode_t pr_profnodes[PROF_MAXNODES];
+static int pr_numprofnodes;
+
+static struct {
+    int node;
+    double start;
+} pr_profstack[PROF_MAXDEPTH];
+static int pr_profdepth;
+static int pr_profoverflow;	// frames not pushed once the stack is full
+static double pr_proflast;	// time of the last entry or exit
+
+static void
+PR_ProfileClear(void)
+{
+    if (pr_profiles)
+	memset(pr_profiles, 0, progs->numfunctions * sizeof(*pr_profiles));
+    memset(&pr_profnodes[0], 0, sizeof(pr_profnodes[0]));
+    pr_profnodes[0].func = -1;
+    pr_profnodes[0].child = -1;
+    pr_numprofnodes = 1;
+    pr_profdepth = 0;
+    pr_profoverflow = 0;
+}
+
+void
+PR_ProfileInit(void)
+{
+    Cvar_RegisterVariable(&pr_profile);
+}
+
+/*
+====================
+PR_ProfileLoad
+
+Called when the progs are loaded
+====================
+*/
+void
+PR_ProfileLoad(void)
+{
+    pr_profiles = Hunk_AllocName(progs->numfunctions * sizeof(*pr_profiles),
+				 "prprof");
+    PR_ProfileClear();
+}
+
+/*
+====================
+PR_ProfileStart
+
+Called for each top level call into the progs
+====================
+*/
+void
+PR_ProfileStart(void)
+{
+    int node;
+
+    pr_profiling = pr_profile.value && pr_profiles;
+
+    /* anything left on the stack was aborted by PR_RunError */
+    while (pr_profdepth > 0) {
+	node = pr_profstack[--pr_profdepth].node;
+	pr_profiles[pr_profnodes[node].func].active = 0;
+    }
+    pr_profoverflow = 0;
+}
+
+static int
+PR_ProfileChild(int parent, int func)
+{
+    prprofnode_t *node;
+    int i;
+
+    for (i = pr_profnodes[parent].child; i >= 0; i = pr_profnodes[i].sibling)
+	if (pr_profnodes[i].func == func)
+	    return i;
+
+    if (pr_numprofnodes == PROF_MAXNODES)
+	return parent;
+
+    i = pr_numprofnodes++;
+    node = &pr_profnodes[i];
+    node->func = func;
+    node->parent = parent;
+    node->child = -1;
+    node->sibling = pr_profnodes[parent].child;
+    node->self = 0;
+    pr_profnodes[parent].child = i;
+
+    return i;
+}
+
+/* Charges the time since the last entry or exit to the running function */
+static double
+PR_ProfileCharge(void)
+{
+    double now;
+    int node;
+
+    now = Sys_DoubleTime();
+    if (pr_profdepth > 0) {
+	node = pr_profstack[pr_profdepth - 1].node;
+	pr_profnodes[node].self += now - pr_proflast;
+	pr_profiles[pr_profnodes[node].func].self += now - pr_proflast;
+    }
+    pr_proflast = now;
+
+    return now;
+}
+
+void
+PR_ProfileEnter(const dfunction_t *f)
+{
+    int func, parent;
+    double now;
+
+    if (pr_profdepth == PROF_MAXDEPTH) {
+	pr_profoverflow++;
+	return;
+    }
+
+    now = PR_ProfileCharge();
+    func = f - pr_functions;
+    parent = pr_profdepth ? pr_profstack[pr_profdepth - 1].node : 0;
+    pr_profstack[pr_profdepth].node = PR_ProfileChild(parent, func);
+    pr_profstack[pr_profdepth].start = now;
+    pr_profdepth++;
+
+    pr_profiles[func].calls++;
+    pr_profiles[func].active++;
+}
+
+void
+PR_ProfileLeave(void)
+{
+    prprofile_t *profile;
+    double now;
+    int node;
+
+    if (pr_profoverflow) {
+	pr_profoverflow--;
+	return;
+    }
+    if (!pr_profdepth)
+	return;
+
+    now = PR_ProfileCharge();
+    pr_profdepth--;
+    node = pr_profstack[pr_profdepth].node;
+    profile = &pr_profiles[pr_profnodes[node].func];
+    if (!--profile->active)
+	profile->total += now - pr_profstack[pr_profdepth].start;
+}
+
+static int
+PR_ProfileCompare(const void *a, const void *b)
+{
+    const prprofile_t *pa = &pr_profiles[*(const int *)a];
+    const prprofile_t *pb = &pr_profiles[*(const int *)b];
+
+    if (pa->self != pb->self)
+	return pa->self < pb->self ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static void
+PR_ProfileReport(int count)
+{
+    const dfunction_t *f;
+    const prprofile_t *p;
+    double total;
+    int *order;
+    int i, num;
+
+    order = Z_Malloc(progs->numfunctions * sizeof(int));
+    num = 0;
+    total = 0;
+    for (i = 0; i < progs->numfunctions; i++) {
+	if (pr_profiles[i].calls) {
+	    order[num++] = i;
+	    total += pr_profiles[i].self;
+	}
+    }
+    qsort(order, num, sizeof(int), PR_ProfileCompare);
+
+    Con_Printf("%7s %9s %9s %5s\n", "calls", "total ms", "self ms", "self");
+    for (i = 0; i < num && i < count; i++) {
+	f = &pr_functions[order[i]];
+	p = &pr_profiles[order[i]];
+	Con_Printf("%7i %9.2f %9.2f %4.1f%% %s%s\n", p->calls,
+		   p->total * 1000, p->self * 1000,
+		   total ? p->self * 100 / total : 0, PR_GetString(f->s_name),
+		   f->first_statement < 0 ? " (builtin)" : "");
+    }
+    Con_Printf("%.2f ms in %i functions\n", total * 1000, num);
+
+    Z_Free(order);
+}
+
+static void
+PR_ProfileWriteStack(FILE *f, int node)
+{
+    const prprofnode_t *p = &pr_profnodes[node];
+
+    if (p->parent)
+	PR_ProfileWriteStack(f, p->parent);
+    fprintf(f, "%s%s", p->parent ? ";" : "",
+	    PR_GetString(pr_functions[p->func].s_name));
+}
+
+/* One line for each call stack, with its self time in microseconds */
+static void
+PR_ProfileFold(const char *filename)
+{
+    char path[MAX_OSPATH];
+    FILE *f;
+    int i, lines;
+
+    snprintf(path, sizeof(path), "%s/%s", com_gamedir, filename);
+    f = fopen(path, "w");
+    if (!f) {
+	Con_Printf("Couldn't write %s\n", path);
+	return;
+    }
+
+    lines = 0;
+    for (i = 1; i < pr_numprofnodes; i++) {
+	if (pr_profnodes[i].self * 1e6 < 1)
+	    continue;
+	PR_ProfileWriteStack(f, i);
+	fprintf(f, " %.0f\n", pr_profnodes[i].self * 1e6);
+	lines++;
+    }
+    fclose(f);
+
+    Con_Printf("Wrote %i call stacks to %s%s\n", lines, path,
+	       pr_numprofnodes == PROF_MAXNODES ? " (some merged)" : "");
+}
+
+/*
+====================
+PR_ProfileCommand
+
+For the "profile" command, returns false if it isn't one of these
+====================
+*/
+qboolean
+PR_ProfileCommand(void)
+{
+    const char *cmd;
+
+    if (Cmd_Argc() < 2)
+	return false;
+    if (!pr_profiles) {
+	Con_Printf("No progs loaded\n");
+	return true;
+    }
+
+    cmd = Cmd_Argv(1);
+    if (!strcmp(cmd, "reset")) {
+	PR_ProfileClear();
+    } else if (!strcmp(cmd, "report")) {
+	PR_ProfileReport(Cmd_Argc() > 2 ? Q_atoi(Cmd_Argv(2)) : 20);
+    } else if (!strcmp(cmd, "fold")) {
+	PR_ProfileFold(Cmd_Argc() > 2 ? Cmd_Argv(2) : "progs.folded");
+    } else {
+	Con_Printf("Usage: profile [reset | report [count] | fold [file]]\n");
+    }
+    if (!pr_profile.value)
+	Con_Printf("Set pr_profile 1 to time the progs\n");
+
+    return true;
+}
@@ -0,0 +1,586 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// preload.c -- background threads to read files before they're loaded
+//              and to write files and streams out
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "common.h"
+#include "console.h"
+#include "mathlib.h"
+
+/*
+==============================================================================
+
+BACKGROUND READER
+
+The main thread finds where each file is (the search path is only safe to
+walk there) and queues the pak or loose file, offset and length.  One thread
+reads them and throws the data away; what's left is the OS file cache, so
+the loads at a map change find the data in memory rather than on disk.
+
+==============================================================================
+*/
+
+#define PRELOAD_QUEUE 64
+#define PRELOAD_CHUNK 0x10000
+
+typedef struct {
+    char path[MAX_OSPATH];
+    size_t offset;
+    size_t length;		// 0 is up to the end of the file
+} preload_t;
+
+static struct {
+    qboolean started;
+    qboolean quit;
+    preload_t queue[PRELOAD_QUEUE];
+    int head, tail;		// read from head, queued at tail
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} preloader;
+
+#ifdef _WIN32
+#define PRE_Lock()	EnterCriticalSection(&preloader.lock)
+#define PRE_Unlock()	LeaveCriticalSection(&preloader.lock)
+#define PRE_Wait()	SleepConditionVariableCS(&preloader.changed, &preloader.lock, INFINITE)
+#define PRE_Signal()	WakeAllConditionVariable(&preloader.changed)
+#else
+#define PRE_Lock()	pthread_mutex_lock(&preloader.lock)
+#define PRE_Unlock()	pthread_mutex_unlock(&preloader.lock)
+#define PRE_Wait()	pthread_cond_wait(&preloader.changed, &preloader.lock)
+#define PRE_Signal()	pthread_cond_broadcast(&preloader.changed)
+#endif
+
+static void
+PRE_Read(const preload_t *preload, byte *buffer)
+{
+    size_t left, count;
+    FILE *f;
+
+    f = fopen(preload->path, "rb");
+    if (!f)
+	return;
+    if (!fseek(f, preload->offset, SEEK_SET)) {
+	left = preload->length;
+	do {
+	    count = PRELOAD_CHUNK;
+	    if (preload->length && left < count)
+		count = left;
+	    count = fread(buffer, 1, count, f);
+	    left -= count;
+	} while (count == PRELOAD_CHUNK && !preloader.quit);
+    }
+    fclose(f);
+}
+
+static void
+PRE_RunReader(void)
+{
+    static byte buffer[PRELOAD_CHUNK];
+    preload_t preload;
+
+    PRE_Lock();
+    for (;;) {
+	if (preloader.quit)
+	    break;
+	if (preloader.head == preloader.tail) {
+	    PRE_Wait();
+	    continue;
+	}
+	preload = preloader.queue[preloader.head];
+	preloader.head = (preloader.head + 1) % PRELOAD_QUEUE;
+	PRE_Unlock();
+
+	PRE_Read(&preload, buffer);
+
+	PRE_Lock();
+    }
+    PRE_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+PRE_ReaderMain(LPVOID arg)
+{
+    PRE_RunReader();
+    return 0;
+}
+#else
+static void *
+PRE_ReaderMain(void *arg)
+{
+    PRE_RunReader();
+    return NULL;
+}
+#endif
+
+static qboolean
+PRE_StartReader(void)
+{
+    if (preloader.started)
+	return true;
+
+    preloader.quit = false;
+    preloader.head = preloader.tail = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&preloader.lock);
+    InitializeConditionVariable(&preloader.changed);
+    preloader.thread = CreateThread(NULL, 0, PRE_ReaderMain, NULL, 0, NULL);
+    preloader.started = preloader.thread != NULL;
+#else
+    pthread_mutex_init(&preloader.lock, NULL);
+    pthread_cond_init(&preloader.changed, NULL);
+    preloader.started =
+	!pthread_create(&preloader.thread, NULL, PRE_ReaderMain, NULL);
+#endif
+
+    return preloader.started;
+}
+
+/*
+==============
+COM_PreloadFile
+==============
+*/
+void
+COM_PreloadFile(const char *filename)
+{
+    preload_t *preload;
+    int next;
+
+    if (COM_CheckParm("-nopreload"))
+	return;
+    if (!PRE_StartReader())
+	return;
+
+    PRE_Lock();
+    next = (preloader.tail + 1) % PRELOAD_QUEUE;
+    if (next != preloader.head) {
+	preload = &preloader.queue[preloader.tail];
+	if (COM_FindFile(filename, preload->path, sizeof(preload->path),
+			 &preload->offset, &preload->length)) {
+	    Con_DPrintf("Preloading %s\n", filename);
+	    preloader.tail = next;
+	    PRE_Signal();
+	}
+    }
+    PRE_Unlock();
+}
+
+/*
+==============
+COM_PreloadShutdown
+==============
+*/
+void
+COM_PreloadShutdown(void)
+{
+    COM_FinishWrites();
+    COM_CloseStream();
+    if (!preloader.started)
+	return;
+
+    PRE_Lock();
+    preloader.quit = true;
+    PRE_Signal();
+    PRE_Unlock();
+#ifdef _WIN32
+    WaitForSingleObject(preloader.thread, INFINITE);
+    CloseHandle(preloader.thread);
+#else
+    pthread_join(preloader.thread, NULL);
+#endif
+    preloader.started = false;
+}
+
+/*
+==============================================================================
+
+BACKGROUND WRITER
+
+COM_WriteFileInBackground takes a buffer the caller is done with and writes
+it out on a thread of its own, freeing it after.  Only one write runs at a
+time; starting another, or COM_FinishWrites, waits for the last to finish.
+
+==============================================================================
+*/
+
+static struct {
+    qboolean busy;
+    qboolean failed;
+    char path[MAX_OSPATH];
+    void *data;
+    int length;
+#ifdef _WIN32
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+} writer;
+
+static void
+WRI_Write(void)
+{
+    FILE *f;
+
+    f = fopen(writer.path, "wb");
+    writer.failed = !f;
+    if (f) {
+	if (fwrite(writer.data, 1, writer.length, f) != writer.length)
+	    writer.failed = true;
+	if (fclose(f))
+	    writer.failed = true;
+    }
+    free(writer.data);
+    writer.data = NULL;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+WRI_WriterMain(LPVOID arg)
+{
+    WRI_Write();
+    return 0;
+}
+#else
+static void *
+WRI_WriterMain(void *arg)
+{
+    WRI_Write();
+    return NULL;
+}
+#endif
+
+/*
+==============
+COM_FinishWrites
+
+Waits for a background write and reports if it failed
+==============
+*/
+void
+COM_FinishWrites(void)
+{
+    if (!writer.busy)
+	return;
+
+#ifdef _WIN32
+    WaitForSingleObject(writer.thread, INFINITE);
+    CloseHandle(writer.thread);
+#else
+    pthread_join(writer.thread, NULL);
+#endif
+    writer.busy = false;
+    if (writer.failed)
+	Con_Printf("ERROR: couldn't write %s\n", writer.path);
+}
+
+/*
+==============
+COM_WriteFileInBackground
+
+The data must come from malloc, and is freed once written
+==============
+*/
+void
+COM_WriteFileInBackground(const char *path, void *data, int length)
+{
+    COM_FinishWrites();
+
+    snprintf(writer.path, sizeof(writer.path), "%s", path);
+    writer.data = data;
+    writer.length = length;
+#ifdef _WIN32
+    writer.thread = CreateThread(NULL, 0, WRI_WriterMain, NULL, 0, NULL);
+    writer.busy = writer.thread != NULL;
+#else
+    writer.busy = !pthread_create(&writer.thread, NULL, WRI_WriterMain, NULL);
+#endif
+    if (!writer.busy) {
+	WRI_Write();
+	if (writer.failed)
+	    Con_Printf("ERROR: couldn't write %s\n", writer.path);
+    }
+}
+
+/*
+==============================================================================
+
+STREAMED WRITER
+
+COM_OpenStream starts a file that is written out a piece at a time, like a
+demo being recorded.  COM_StreamWrite copies the data into a ring buffer and
+a thread of its own writes it to disk, gzip compressed if asked for and
+built with zlib, so the caller only waits on the disk when the ring fills.
+One stream can be open at a time.
+
+==============================================================================
+*/
+
+#define STREAM_RING 0x100000
+
+static struct {
+    qboolean open;
+    qboolean threaded;
+    qboolean quit;
+    qboolean failed;
+    char path[MAX_OSPATH];
+    FILE *file;
+#ifdef USE_ZLIB
+    gzFile gzfile;
+#endif
+    byte *ring;
+    int head, tail;		// written from head, added at tail
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} streamer;
+
+#ifdef _WIN32
+#define STR_Lock()	EnterCriticalSection(&streamer.lock)
+#define STR_Unlock()	LeaveCriticalSection(&streamer.lock)
+#define STR_Wait()	SleepConditionVariableCS(&streamer.changed, &streamer.lock, INFINITE)
+#define STR_Signal()	WakeAllConditionVariable(&streamer.changed)
+#else
+#define STR_Lock()	pthread_mutex_lock(&streamer.lock)
+#define STR_Unlock()	pthread_mutex_unlock(&streamer.lock)
+#define STR_Wait()	pthread_cond_wait(&streamer.changed, &streamer.lock)
+#define STR_Signal()	pthread_cond_broadcast(&streamer.changed)
+#endif
+
+static void
+STR_Write(const byte *data, int length)
+{
+#ifdef USE_ZLIB
+    if (streamer.gzfile) {
+	if (gzwrite(streamer.gzfile, data, length) != length)
+	    streamer.failed = true;
+	return;
+    }
+#endif
+    if (fwrite(data, 1, length, streamer.file) != length)
+	streamer.failed = true;
+}
+
+static void
+STR_RunWriter(void)
+{
+    int head, length;
+
+    STR_Lock();
+    for (;;) {
+	if (streamer.head == streamer.tail) {
+	    if (streamer.quit)
+		break;
+	    STR_Wait();
+	    continue;
+	}
+	head = streamer.head;
+	if (streamer.tail > head)
+	    length = streamer.tail - head;
+	else
+	    length = STREAM_RING - head;
+	STR_Unlock();
+
+	STR_Write(streamer.ring + head, length);
+
+	STR_Lock();
+	streamer.head = (head + length) % STREAM_RING;
+	STR_Signal();
+    }
+    STR_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+STR_WriterMain(LPVOID arg)
+{
+    STR_RunWriter();
+    return 0;
+}
+#else
+static void *
+STR_WriterMain(void *arg)
+{
+    STR_RunWriter();
+    return NULL;
+}
+#endif
+
+/*
+==============
+COM_OpenStream
+==============
+*/
+qboolean
+COM_OpenStream(const char *path, qboolean compress)
+{
+    COM_CloseStream();
+
+    snprintf(streamer.path, sizeof(streamer.path), "%s", path);
+    streamer.failed = false;
+#ifdef USE_ZLIB
+    streamer.gzfile = NULL;
+    if (compress) {
+	streamer.gzfile = gzopen(path, "wb");
+	if (!streamer.gzfile)
+	    return false;
+    } else
+#endif
+    {
+	streamer.file = fopen(path, "wb");
+	if (!streamer.file)
+	    return false;
+    }
+    streamer.open = true;
+
+    streamer.ring = malloc(STREAM_RING);
+    streamer.threaded = false;
+    if (!streamer.ring)
+	return true;
+
+    streamer.quit = false;
+    streamer.head = streamer.tail = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&streamer.lock);
+    InitializeConditionVariable(&streamer.changed);
+    streamer.thread = CreateThread(NULL, 0, STR_WriterMain, NULL, 0, NULL);
+    streamer.threaded = streamer.thread != NULL;
+#else
+    pthread_mutex_init(&streamer.lock, NULL);
+    pthread_cond_init(&streamer.changed, NULL);
+    streamer.threaded =
+	!pthread_create(&streamer.thread, NULL, STR_WriterMain, NULL);
+#endif
+
+    return true;
+}
+
+/*
+==============
+COM_StreamWrite
+==============
+*/
+void
+COM_StreamWrite(const void *data, int length)
+{
+    const byte *bytes = data;
+    int space, count;
+
+    if (!streamer.open)
+	return;
+    if (!streamer.threaded) {
+	STR_Write(bytes, length);
+	return;
+    }
+
+    STR_Lock();
+    while (length > 0) {
+	space = (streamer.head - streamer.tail - 1 + STREAM_RING) % STREAM_RING;
+	if (!space) {
+	    STR_Wait();
+	    continue;
+	}
+	count = qmin(space, STREAM_RING - streamer.tail);
+	count = qmin(count, length);
+	memcpy(streamer.ring + streamer.tail, bytes, count);
+	streamer.tail = (streamer.tail + count) % STREAM_RING;
+	bytes += count;
+	length -= count;
+	STR_Signal();
+    }
+    STR_Unlock();
+}
+
+/*
+==============
+COM_CloseStream
+
+Waits for everything to be written and reports if it failed
+==============
+*/
+void
+COM_CloseStream(void)
+{
+    if (!streamer.open)
+	return;
+
+    if (streamer.threaded) {
+	STR_Lock();
+	streamer.quit = true;
+	STR_Signal();
+	STR_Unlock();
+#ifdef _WIN32
+	WaitForSingleObject(streamer.thread, INFINITE);
+	CloseHandle(streamer.thread);
+	DeleteCriticalSection(&streamer.lock);
+#else
+	pthread_join(streamer.thread, NULL);
+	pthread_mutex_destroy(&streamer.lock);
+	pthread_cond_destroy(&streamer.changed);
+#endif
+	streamer.threaded = false;
+    }
+    free(streamer.ring);
+    streamer.ring = NULL;
+
+#ifdef USE_ZLIB
+    if (streamer.gzfile) {
+	if (gzclose(streamer.gzfile) != Z_OK)
+	    streamer.failed = true;
+	streamer.gzfile = NULL;
+    } else
+#endif
+    {
+	if (fclose(streamer.file))
+	    streamer.failed = true;
+	streamer.file = NULL;
+    }
+    streamer.open = false;
+
+    if (streamer.failed)
+	Con_Printf("ERROR: couldn't write %s\n", streamer.path);
+}
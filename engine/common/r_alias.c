@@ -68,6 +68,9 @@ cvar_t r_lerpmodels = { "r_lerpmodels", "0", false };
 cvar_t r_lerpmove = { "r_lerpmove", "0", false };
 #endif
 
+/* levels of detail to drop, beyond what the size on screen calls for */
+cvar_t r_lodbias = { "r_lodbias", "0", true };
+
 static aedge_t aedges[12] = {
     {0, 1}, {1, 2}, {2, 3}, {3, 0},
     {4, 5}, {5, 6}, {6, 7}, {7, 4},
@@ -122,7 +125,7 @@ SW_LoadSkinData(model_t *model, aliashdr_t *ahdr,
 
 static void
 SW_LoadMeshData(const model_t *model, aliashdr_t *hdr,
-		const alias_meshdata_t *meshdata,
+		alias_meshdata_t *meshdata,
 		const alias_posedata_t *posedata)
 {
     int i;
@@ -158,6 +161,20 @@ SW_LoadMeshData(const model_t *model, aliashdr_t *hdr,
     triangles = Hunk_Alloc(hdr->numtris * sizeof(*triangles));
     SW_Aliashdr(hdr)->triangles = (byte *)triangles - (byte *)hdr;
     memcpy(triangles, meshdata->triangles, hdr->numtris * sizeof(*triangles));
+
+    /*
+     * And the simplified meshes, which use the same verts
+     */
+    Mod_AliasSimplify(hdr, meshdata, posedata);
+    hdr->numlods = meshdata->numlods;
+    for (i = 0; i < hdr->numlods; i++) {
+	const int numtris = meshdata->lodnumtris[i];
+	triangles = Hunk_Alloc(numtris * sizeof(*triangles));
+	SW_Aliashdr(hdr)->lodtriangles[i] = (byte *)triangles - (byte *)hdr;
+	SW_Aliashdr(hdr)->lodnumtris[i] = numtris;
+	memcpy(triangles, meshdata->lodtriangles[i],
+	       numtris * sizeof(*triangles));
+    }
 }
 
 static model_loader_t SW_Model_Loader = {
@@ -184,6 +201,7 @@ R_AliasCheckBBox(entity_t *e)
     int i, flags, frame, numv;
     aliashdr_t *pahdr;
     float zi, basepts[8][3], v0, v1, frac;
+    float minv0, minv1, maxv0, maxv1;
     finalvert_t *pv0, *pv1, viewpts[16];
     auxvert_t *pa0, *pa1, viewaux[16];
     maliasframedesc_t *pframedesc;
@@ -194,6 +212,7 @@ R_AliasCheckBBox(entity_t *e)
 // expand, rotate, and translate points into worldspace
 
     e->trivial_accept = 0;
+    e->lod = 0;
     pmodel = e->model;
     pahdr = Mod_Extradata(pmodel);
 
@@ -280,6 +299,8 @@ R_AliasCheckBBox(entity_t *e)
 // project the vertices that remain after clipping
     anyclip = 0;
     allclip = ALIAS_XY_CLIP_MASK;
+    minv0 = minv1 = 99999;
+    maxv0 = maxv1 = -99999;
 
 // TODO: probably should do this loop in ASM, especially if we use floats
     for (i = 0; i < numv; i++) {
@@ -292,6 +313,10 @@ R_AliasCheckBBox(entity_t *e)
 	// FIXME: do with chop mode in ASM, or convert to float
 	v0 = (viewaux[i].fv[0] * xscale * zi) + xcenter;
 	v1 = (viewaux[i].fv[1] * yscale * zi) + ycenter;
+	minv0 = qmin(minv0, v0);
+	maxv0 = qmax(maxv0, v0);
+	minv1 = qmin(minv1, v1);
+	maxv1 = qmax(maxv1, v1);
 
 	flags = 0;
 
@@ -311,6 +336,21 @@ R_AliasCheckBBox(entity_t *e)
     if (allclip)
 	return false;		// trivial reject off one side
 
+    /* pick the detail level by the size of the frame's box on screen */
+    if (!zclipped)
+	e->lod = Mod_AliasLOD(pahdr, qmax(maxv0 - minv0, maxv1 - minv1),
+			      r_lodbias.value);
+
+    // nothing the frame's bbox covers gets past the world's z (not when
+    // lerping, as below)
+    if (!zclipped
+#ifdef NQ_HACK
+	&& !r_lerpmodels.value
+#endif
+	&& R_Occluded(floor(minv0) - 1, floor(minv1) - 1, ceil(maxv0) + 1,
+		      ceil(maxv1) + 1, minz))
+	return false;
+
 #ifdef NQ_HACK
     /*
      * FIXME - Trivial accept not safe while lerping unless we check
@@ -345,6 +385,34 @@ R_AliasTransformVector(const vec3_t in, vec3_t out)
 }
 
 
+/*
+================
+R_AliasSetupXform
+
+Copy the transform and lighting for the vertex kernels
+================
+*/
+static void
+R_AliasSetupXform(daliasxform_t *xform)
+{
+    memcpy(xform->transform, aliastransform, sizeof(xform->transform));
+    xform->xcenter = aliasxcenter;
+    xform->ycenter = aliasycenter;
+    xform->xscale = aliasxscale;
+    xform->yscale = aliasyscale;
+    xform->ziscale = ziscale;
+    xform->zclip = ALIAS_Z_CLIP_PLANE;
+    xform->vrect[0] = r_refdef.aliasvrect.x;
+    xform->vrect[1] = r_refdef.aliasvrect.y;
+    xform->vrect[2] = r_refdef.aliasvrectright;
+    xform->vrect[3] = r_refdef.aliasvrectbottom;
+    VectorCopy(r_plightvec, xform->lightvec);
+    xform->shadelight = r_shadelight;
+    xform->ambientlight = r_ambientlight;
+    xform->normals = (const float (*)[3])r_avertexnormals;
+}
+
+
 /*
 ================
 R_AliasPreparePoints
@@ -353,14 +421,13 @@ General clipped case
 ================
 */
 static void
-R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
-		     auxvert_t *pauxverts)
+R_AliasPreparePoints(aliashdr_t *pahdr, mtriangle_t *ptri, int numtris,
+		     finalvert_t *pfinalverts, auxvert_t *pauxverts)
 {
     int i;
     stvert_t *pstverts;
     finalvert_t *fv;
     auxvert_t *av;
-    mtriangle_t *ptri;
     finalvert_t *pfv[3];
 
     pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
@@ -368,20 +435,30 @@ R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
     fv = pfinalverts;
     av = pauxverts;
 
-    for (i = 0; i < r_anumverts; i++, fv++, av++, r_apverts++, pstverts++) {
-	R_AliasTransformFinalVert(fv, av, r_apverts, pstverts);
-	if (av->fv[2] < ALIAS_Z_CLIP_PLANE)
-	    fv->flags |= ALIAS_Z_CLIP;
-	else {
-	    R_AliasProjectFinalVert(fv, av);
-	    if (fv->v[0] < r_refdef.aliasvrect.x)
-		fv->flags |= ALIAS_LEFT_CLIP;
-	    if (fv->v[1] < r_refdef.aliasvrect.y)
-		fv->flags |= ALIAS_TOP_CLIP;
-	    if (fv->v[0] > r_refdef.aliasvrectright)
-		fv->flags |= ALIAS_RIGHT_CLIP;
-	    if (fv->v[1] > r_refdef.aliasvrectbottom)
-		fv->flags |= ALIAS_BOTTOM_CLIP;
+    if (d_simdkernels) {
+	daliasxform_t xform;
+
+	R_AliasSetupXform(&xform);
+	d_simdkernels->aliasverts(&xform, r_apverts, pstverts, pfinalverts,
+				  (float (*)[3])pauxverts, r_anumverts);
+	r_apverts += r_anumverts;
+    } else {
+	for (i = 0; i < r_anumverts;
+	     i++, fv++, av++, r_apverts++, pstverts++) {
+	    R_AliasTransformFinalVert(fv, av, r_apverts, pstverts);
+	    if (av->fv[2] < ALIAS_Z_CLIP_PLANE)
+		fv->flags |= ALIAS_Z_CLIP;
+	    else {
+		R_AliasProjectFinalVert(fv, av);
+		if (fv->v[0] < r_refdef.aliasvrect.x)
+		    fv->flags |= ALIAS_LEFT_CLIP;
+		if (fv->v[1] < r_refdef.aliasvrect.y)
+		    fv->flags |= ALIAS_TOP_CLIP;
+		if (fv->v[0] > r_refdef.aliasvrectright)
+		    fv->flags |= ALIAS_RIGHT_CLIP;
+		if (fv->v[1] > r_refdef.aliasvrectbottom)
+		    fv->flags |= ALIAS_BOTTOM_CLIP;
+	    }
 	}
     }
 
@@ -390,8 +467,7 @@ R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
 //
     r_affinetridesc.numtriangles = 1;
 
-    ptri = (mtriangle_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->triangles);
-    for (i = 0; i < pahdr->numtris; i++, ptri++) {
+    for (i = 0; i < numtris; i++, ptri++) {
 	pfv[0] = &pfinalverts[ptri->vertindex[0]];
 	pfv[1] = &pfinalverts[ptri->vertindex[1]];
 	pfv[2] = &pfinalverts[ptri->vertindex[2]];
@@ -568,6 +644,15 @@ R_AliasTransformAndProjectFinalVerts(finalvert_t *fv, stvert_t *pstverts)
 
     pverts = r_apverts;
 
+    if (d_simdkernels) {
+	daliasxform_t xform;
+
+	R_AliasSetupXform(&xform);
+	d_simdkernels->aliasverts(&xform, pverts, pstverts, fv, NULL,
+				  r_anumverts);
+	return;
+    }
+
     for (i = 0; i < r_anumverts; i++, fv++, pverts++, pstverts++) {
 	// transform and project
 	zi = 1.0 / (DotProduct(pverts->v, aliastransform[2]) +
@@ -634,7 +719,8 @@ R_AliasPrepareUnclippedPoints
 ================
 */
 static void
-R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, finalvert_t *pfinalverts)
+R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, mtriangle_t *ptri,
+			      int numtris, finalvert_t *pfinalverts)
 {
     stvert_t *pstverts;
 
@@ -647,9 +733,8 @@ R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, finalvert_t *pfinalverts)
 	D_PolysetDrawFinalVerts(pfinalverts, r_anumverts);
 
     r_affinetridesc.pfinalverts = pfinalverts;
-    r_affinetridesc.ptriangles = (mtriangle_t *)((byte *)pahdr +
-						 SW_Aliashdr(pahdr)->triangles);
-    r_affinetridesc.numtriangles = pahdr->numtris;
+    r_affinetridesc.ptriangles = ptri;
+    r_affinetridesc.numtriangles = numtris;
 
     D_PolysetDraw();
 }
@@ -755,7 +840,7 @@ R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr, float blend)
     trivertx_t *poseverts, *pv1, *pv2, *light;
     int i, blend0, blend1;
 
-#define SHIFT 22
+#define SHIFT D_POSEBLEND_SHIFT
     blend1 = blend * (1 << SHIFT);
     blend0 = (1 << SHIFT) - blend1;
 
@@ -765,6 +850,12 @@ R_AliasBlendPoseVerts(const entity_t *e, aliashdr_t *hdr, float blend)
     light = (blend < 0.5f) ? pv1 : pv2;
     poseverts = blendverts;
 
+    if (d_simdkernels) {
+	d_simdkernels->blendposes(blendverts, pv1, pv2, light, blend0, blend1,
+				  hdr->numverts);
+	return blendverts;
+    }
+
     for (i = 0; i < hdr->numverts; i++, poseverts++, pv1++, pv2++, light++) {
 	poseverts->v[0] = (pv1->v[0] * blend0 + pv2->v[0] * blend1) >> SHIFT;
 	poseverts->v[1] = (pv1->v[1] * blend0 + pv2->v[1] * blend1) >> SHIFT;
@@ -870,6 +961,8 @@ R_AliasDrawModel(entity_t *e, alight_t *plighting)
     finalvert_t finalverts[CACHE_PAD_ARRAY(MAXALIASVERTS, finalvert_t)];
     auxvert_t *pauxverts;
     auxvert_t auxverts[MAXALIASVERTS];
+    mtriangle_t *ptri;
+    int numtris;
 
     r_amodels_drawn++;
 
@@ -878,6 +971,14 @@ R_AliasDrawModel(entity_t *e, alight_t *plighting)
     pauxverts = &auxverts[0];
 
     pahdr = Mod_Extradata(e->model);
+    if (e->lod > 0 && e->lod <= pahdr->numlods) {
+	ptri = (mtriangle_t *)((byte *)pahdr
+			       + SW_Aliashdr(pahdr)->lodtriangles[e->lod - 1]);
+	numtris = SW_Aliashdr(pahdr)->lodnumtris[e->lod - 1];
+    } else {
+	ptri = (mtriangle_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->triangles);
+	numtris = pahdr->numtris;
+    }
 
     R_AliasSetupSkin(e, pahdr);
     R_AliasSetUpTransform(e, pahdr, e->trivial_accept);
@@ -906,7 +1007,7 @@ R_AliasDrawModel(entity_t *e, alight_t *plighting)
 	ziscale = ((float)0x8000) * ((float)0x10000) * 3.0;
 
     if (e->trivial_accept)
-	R_AliasPrepareUnclippedPoints(pahdr, pfinalverts);
+	R_AliasPrepareUnclippedPoints(pahdr, ptri, numtris, pfinalverts);
     else
-	R_AliasPreparePoints(pahdr, pfinalverts, pauxverts);
+	R_AliasPreparePoints(pahdr, ptri, numtris, pfinalverts, pauxverts);
 }
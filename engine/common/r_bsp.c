@@ -457,6 +457,278 @@ R_RecursiveWorldNode(const entity_t *e, mnode_t *node)
 
 
 
+/*
+==============================================================================
+
+SHARED SCENE CULLING
+
+The views of a shared scene (see R_BeginScene) all walk the world from the
+same origin, so they would each walk the same nodes in the same order.
+R_CullScene walks the tree once for all of them: each node is clipped
+against the frustum of every view it may show in, keeping a bit for each,
+and nothing under a node is walked once it has no bits left.  The surfaces
+each view may show are listed in the order and with the sequence keys the
+walk would have given them, so that each view's R_RenderWorld only has to
+clip its own list against its exact frustum (which may be scissored).
+
+==============================================================================
+*/
+
+#define MAX_SCENEVIEWS 32
+
+typedef struct {
+    msurface_t *surf;
+    int key;
+} scenesurf_t;
+
+int r_sceneviews;		// views listed by R_CullScene, 0 = none
+
+static struct {
+    mplane_t planes[MAX_SCENEVIEWS][4];
+    int key;			// the next key after the world's
+    qboolean failed;		// out of memory for a list
+    struct {
+	scenesurf_t *surfs;
+	int count;
+	int size;
+    } lists[MAX_SCENEVIEWS];
+} r_scene;
+
+static void
+R_ListSceneSurf(int view, msurface_t *surf, int key)
+{
+    scenesurf_t *surfs;
+    int size;
+
+    if (r_scene.lists[view].count == r_scene.lists[view].size) {
+	size = r_scene.lists[view].size ? r_scene.lists[view].size * 2 : 1024;
+	surfs = realloc(r_scene.lists[view].surfs, size * sizeof(*surfs));
+	if (!surfs) {
+	    r_scene.failed = true;
+	    return;
+	}
+	r_scene.lists[view].surfs = surfs;
+	r_scene.lists[view].size = size;
+    }
+    surfs = &r_scene.lists[view].surfs[r_scene.lists[view].count++];
+    surfs->surf = surf;
+    surfs->key = key;
+}
+
+/*
+ * Clip a box against the frustum planes of a view still marked in clipflags,
+ * clearing those it is wholly in front of (false if it is behind one)
+ */
+static qboolean
+R_ClipSceneBox(const vec3_t mins, const vec3_t maxs, int view, byte *clipflags)
+{
+    int i, side;
+
+    for (i = 0; i < 4; i++) {
+	if (!(*clipflags & (1 << i)))
+	    continue;
+	side = BoxOnPlaneSide(mins, maxs, &r_scene.planes[view][i]);
+	if (side == PSIDE_BACK)
+	    return false;
+	if (side == PSIDE_FRONT)
+	    *clipflags &= ~(1 << i);
+    }
+
+    return true;
+}
+
+static void
+R_CullSceneNode(mnode_t *node, unsigned viewbits, const byte *parentflags)
+{
+    byte clipflags[MAX_SCENEVIEWS], surfflags;
+    msurface_t *surf;
+    mplane_t *plane;
+    unsigned bit;
+    int i, side, count, key;
+    vec_t dot;
+
+    if (node->contents == CONTENTS_SOLID)
+	return;
+    if (node->visframe != r_visframecount)
+	return;
+
+    for (i = 0; i < r_sceneviews; i++) {
+	bit = 1U << i;
+	if (!(viewbits & bit))
+	    continue;
+	clipflags[i] = parentflags[i];
+	if (!R_ClipSceneBox(node->mins, node->maxs, i, &clipflags[i]))
+	    viewbits &= ~bit;
+    }
+    node->viewbits = viewbits;
+    if (!viewbits)
+	return;
+
+    if (node->contents < 0) {
+	((mleaf_t *)node)->key = r_scene.key++;
+	return;
+    }
+
+    plane = node->plane;
+    if (plane->type < 3)
+	dot = r_refdef.vieworg[plane->type] - plane->dist;
+    else
+	dot = DotProduct(r_refdef.vieworg, plane->normal) - plane->dist;
+    side = (dot >= 0) ? 0 : 1;
+
+    R_CullSceneNode(node->children[side], viewbits, clipflags);
+
+    surf = cl.worldmodel->surfaces + node->firstsurface;
+    for (count = node->numsurfaces; count; count--, surf++) {
+	if (surf->visframe != r_visframecount)
+	    continue;
+
+	/* Cull backward facing surfs, for every view at once */
+	if (surf->plane->type < 3)
+	    dot = r_refdef.vieworg[surf->plane->type] - surf->plane->dist;
+	else
+	    dot = DotProduct(r_refdef.vieworg, surf->plane->normal)
+		- surf->plane->dist;
+	if (surf->flags & SURF_PLANEBACK) {
+	    if (dot > -BACKFACE_EPSILON)
+		continue;
+	} else {
+	    if (dot < BACKFACE_EPSILON)
+		continue;
+	}
+
+	key = r_scene.key;
+	for (i = 0; i < r_sceneviews; i++) {
+	    if (!(viewbits & (1U << i)))
+		continue;
+	    surfflags = clipflags[i];
+	    if (R_ClipSceneBox(surf->mins, surf->maxs, i, &surfflags)) {
+		R_ListSceneSurf(i, surf, key);
+		r_scene.key = key + 1;
+	    }
+	}
+    }
+
+    /* (the node takes a number of its own, as in R_RecursiveWorldNode) */
+    r_scene.key++;
+
+    R_CullSceneNode(node->children[!side], viewbits, clipflags);
+}
+
+/*
+================
+R_CullScene
+
+Cull the world once for the views of a shared scene marked in viewbits.
+View i looks down views[i].forward, and sees out to the tangents of its
+half-FOVs across and up (the whole view, before any scissor).  Call after
+R_BeginScene, and render view i with r_viewbits set to (1 << i).
+================
+*/
+void
+R_CullScene(const sceneview_t *views, int numviews, unsigned viewbits)
+{
+    brushmodel_t *brushmodel = BrushModel(r_worldentity.model);
+    byte clipflags[MAX_SCENEVIEWS];
+    mplane_t *plane;
+    float tanx, tany;
+    int i, j;
+
+    r_sceneviews = 0;
+    if (numviews > MAX_SCENEVIEWS)
+	return;
+
+    /* a little wider than the views, to be sure of keeping all they show */
+    for (i = 0; i < numviews; i++) {
+	r_scene.lists[i].count = 0;
+	clipflags[i] = 15;
+	if (!(viewbits & (1U << i)))
+	    continue;
+	tanx = views[i].tanx * 1.02;
+	tany = views[i].tany * 1.02;
+	plane = r_scene.planes[i];
+	for (j = 0; j < 3; j++) {
+	    plane[0].normal[j] = tanx * views[i].forward[j] + views[i].right[j];
+	    plane[1].normal[j] = tanx * views[i].forward[j] - views[i].right[j];
+	    plane[2].normal[j] = tany * views[i].forward[j] + views[i].up[j];
+	    plane[3].normal[j] = tany * views[i].forward[j] - views[i].up[j];
+	}
+	for (j = 0; j < 4; j++) {
+	    VectorNormalize(plane[j].normal);
+	    plane[j].dist = DotProduct(r_refdef.vieworg, plane[j].normal);
+	    plane[j].type = PLANE_ANYZ;
+	    plane[j].signbits = SignbitsForPlane(&plane[j]);
+	}
+    }
+
+    r_sceneviews = numviews;
+    r_scene.key = r_draworder.value ? 1 : 0;
+    r_scene.failed = false;
+    R_CullSceneNode(brushmodel->nodes, viewbits, clipflags);
+    if (r_scene.failed)
+	r_sceneviews = 0;
+}
+
+/*
+================
+R_SceneView
+
+The view of the shared scene being rendered, if R_CullScene listed it
+(else -1)
+================
+*/
+int
+R_SceneView(void)
+{
+    int view;
+
+    if (!r_sharedscene || !r_sceneviews || !r_viewbits)
+	return -1;
+    view = __builtin_ctz(r_viewbits);
+    if (r_viewbits != (1U << view) || view >= r_sceneviews)
+	return -1;
+
+    return view;
+}
+
+/*
+================
+R_RenderSceneSurfs
+
+Render the surfaces R_CullScene listed for a view, clipped to its frustum
+================
+*/
+static void
+R_RenderSceneSurfs(int view)
+{
+    const scenesurf_t *listed, *end;
+    msurface_t *surf;
+    int i, side;
+
+    listed = r_scene.lists[view].surfs;
+    end = listed + r_scene.lists[view].count;
+    for (; listed < end; listed++) {
+	surf = listed->surf;
+	surf->clipflags = 15;
+	for (i = 0; i < 4; i++) {
+	    side = BoxOnPlaneSide(surf->mins, surf->maxs,
+				  &view_clipplanes[i].plane);
+	    if (side == PSIDE_BACK) {
+		surf->clipflags = BMODEL_FULLY_CLIPPED;
+		break;
+	    }
+	    if (side == PSIDE_FRONT)
+		surf->clipflags &= ~(1 << i);
+	}
+	if (i < 4)
+	    continue;
+
+	r_currentkey = listed->key;
+	R_RenderFace(&r_worldentity, surf, surf->clipflags);
+    }
+    r_currentkey = r_scene.key;
+}
+
 /*
 ================
 R_RenderWorld
@@ -466,7 +738,14 @@ void
 R_RenderWorld(void)
 {
     brushmodel_t *brushmodel = BrushModel(r_worldentity.model);
+    int view;
 
     VectorCopy(r_origin, modelorg);
+
+    view = R_SceneView();
+    if (view >= 0) {
+	R_RenderSceneSurfs(view);
+	return;
+    }
     R_RecursiveWorldNode(&r_worldentity, brushmodel->nodes);
 }
@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_edge.c
 
+#include <stdlib.h>
+
 #include "quakedef.h"
 #include "r_local.h"
 #include "sound.h"
@@ -36,7 +38,6 @@ extern int screenwidth;
 */
 #endif
 
-edge_t *auxedges;
 edge_t *r_edges, *edge_p, *edge_max;
 
 surf_t *surfaces, *surface_p, *surf_max;
@@ -51,6 +52,14 @@ edge_t *removeedges[MAXHEIGHT];
 espan_t *span_p;
 static espan_t *max_span_p;
 
+/*
+ * The span list holds MAXSPANS at 320x200 and grows with the view height, so
+ * taller views flush it no more often, and each D_DrawSurfaces call has
+ * plenty of rows to split between the band threads.
+ */
+static espan_t *r_spanbuffer;
+static int r_numspans;
+
 int r_currentkey;
 
 int current_iv;
@@ -576,6 +585,37 @@ R_GenerateSpansBackward(void)
 }
 
 
+/*
+==============
+R_SpanBuffer
+==============
+*/
+static espan_t *
+R_SpanBuffer(int *numspans)
+{
+    static espan_t basespans[CACHE_PAD_ARRAY(MAXSPANS, espan_t)];
+    espan_t *spans;
+    int wanted;
+
+    wanted = r_refdef.vrect.height * (MAXSPANS / 200);
+    if (wanted > r_numspans) {
+	spans = realloc(r_spanbuffer, CACHE_PAD_ARRAY(wanted, espan_t) *
+			sizeof(espan_t));
+	if (spans) {
+	    r_spanbuffer = spans;
+	    r_numspans = wanted;
+	}
+    }
+    if (r_numspans > MAXSPANS) {
+	*numspans = r_numspans;
+	return CACHE_ALIGN_PTR(r_spanbuffer);
+    }
+
+    *numspans = MAXSPANS;
+    return CACHE_ALIGN_PTR(basespans);
+}
+
+
 /*
 ==============
 R_ScanEdges
@@ -591,13 +631,12 @@ Each surface has a linked list of its visible spans
 void
 R_ScanEdges(void)
 {
-    int iv, bottom;
-    espan_t basespans[CACHE_PAD_ARRAY(MAXSPANS, espan_t)];
+    int iv, bottom, numspans;
     espan_t *basespan_p;
     surf_t *s;
 
-    basespan_p = CACHE_ALIGN_PTR(basespans);
-    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
+    basespan_p = R_SpanBuffer(&numspans);
+    max_span_p = &basespan_p[numspans - r_refdef.vrect.width];
 
     span_p = basespan_p;
 
@@ -166,7 +166,10 @@ R_SplitEntityOnNode2(mnode_t *node)
 
     if (node->visframe != r_visframecount)
 	return;
-    if (node->clipflags == BMODEL_FULLY_CLIPPED)
+    if (R_SceneView() >= 0) {
+	if (!(node->viewbits & r_viewbits))
+	    return;		// (culled for all the views, see R_CullScene)
+    } else if (node->clipflags == BMODEL_FULLY_CLIPPED)
 	return;
 
     if (node->contents < 0) {
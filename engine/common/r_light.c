@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // r_light.c
 
 #include <math.h>
+#include <string.h>
 
 #include "bspfile.h"
 #include "client.h"
@@ -133,6 +134,96 @@ R_PushDlights(void)
     }
 }
 
+static inline unsigned
+R_DlightHash(unsigned hash, const void *data, int size)
+{
+    const byte *bytes = data;
+
+    while (size--)
+	hash = (hash ^ *bytes++) * 16777619;
+
+    return hash;
+}
+
+/*
+=============
+R_SurfaceDlights
+
+R_MarkLights only goes by the distance to each node's plane, so many of the
+lights marked on a surface don't reach its lightmap at all.  Fills in the
+lights that do, and returns how many.  The key covers all their state, so a
+surface lit with the same key as last time doesn't need rebuilding; it is 0
+when no light reaches the surface.
+=============
+*/
+int
+R_SurfaceDlights(const msurface_t *surf, surfdlight_t *lights, unsigned *key)
+{
+    const mtexinfo_t *tex;
+    const dlight_t *dl;
+    surfdlight_t *light;
+    float dist, rad, minlight;
+    vec3_t impact;
+    int lnum, i, smax, tmax, numlights;
+    unsigned hash;
+
+    smax = (surf->extents[0] >> 4) + 1;
+    tmax = (surf->extents[1] >> 4) + 1;
+    tex = surf->texinfo;
+
+    numlights = 0;
+    hash = 2166136261U;
+    for (lnum = 0; lnum < MAX_DLIGHTS; lnum++) {
+	if (!(surf->dlightbits & (1U << lnum)))
+	    continue;		// not lit by this light
+
+	dl = &cl_dlights[lnum];
+	rad = dl->radius;
+	dist = DotProduct(dl->origin, surf->plane->normal) - surf->plane->dist;
+	rad -= fabs(dist);
+	minlight = dl->minlight;
+	if (rad < minlight)
+	    continue;
+	minlight = rad - minlight;
+	if (minlight <= 0)
+	    continue;
+
+	for (i = 0; i < 3; i++)
+	    impact[i] = dl->origin[i] - surf->plane->normal[i] * dist;
+
+	light = &lights[numlights];
+	light->rad = rad;
+	light->minlight = minlight;
+	light->local[0] = DotProduct(impact, tex->vecs[0]) + tex->vecs[0][3];
+	light->local[0] -= surf->texturemins[0];
+	light->local[1] = DotProduct(impact, tex->vecs[1]) + tex->vecs[1][3];
+	light->local[1] -= surf->texturemins[1];
+
+	/*
+	 * A sample is lit when its distance, truncated to an int, is below
+	 * minlight along both axes; the extra texel covers the truncation.
+	 */
+	light->smin = floorf((light->local[0] - minlight - 1) / 16);
+	light->smax = ceilf((light->local[0] + minlight + 1) / 16);
+	light->tmin = floorf((light->local[1] - minlight - 1) / 16);
+	light->tmax = ceilf((light->local[1] + minlight + 1) / 16);
+	light->smin = qmax(light->smin, 0);
+	light->smax = qmin(light->smax, smax - 1);
+	light->tmin = qmax(light->tmin, 0);
+	light->tmax = qmin(light->tmax, tmax - 1);
+	if (light->smin > light->smax || light->tmin > light->tmax)
+	    continue;
+
+	hash = R_DlightHash(hash, &lnum, sizeof(lnum));
+	hash = R_DlightHash(hash, light, sizeof(*light));
+	numlights++;
+    }
+
+    *key = numlights ? (hash ? hash : 1) : 0;
+
+    return numlights;
+}
+
 /* --------------------------------------------------------------------------*/
 /* Light Sampling                                                            */
 /* --------------------------------------------------------------------------*/
@@ -141,19 +232,48 @@ R_PushDlights(void)
 vec3_t lightspot;
 #endif
 
+/*
+ * The walk down the BSP only finds the lightmap sample under a point, which
+ * stays the same until the point moves, while the light at the sample
+ * changes with the lightstyles.  So the sample found for each point is kept
+ * in a small cache, and summed again with the current lightstyles whenever
+ * the point is looked up.  An entity is looked up at least once for every
+ * view it is drawn in (each fisheye plate, say), and from frame to frame
+ * while it stands still, so most lookups skip the walk.
+ */
+#define LIGHTCACHE_SIZE 512	// a power of two
+
+typedef struct {
+    vec3_t point;
+    const brushmodel_t *world;	// NULL = unused
+    const msurface_t *surf;	// NULL = nothing lit below the point
+    const byte *lightmap;	// NULL = the surface has no samples
+#ifdef GLQUAKE
+    vec3_t lightspot;
+#endif
+} lightsample_t;
+
+static lightsample_t r_lightcache[LIGHTCACHE_SIZE];
+
+void
+R_ClearLightPoints(void)
+{
+    memset(r_lightcache, 0, sizeof(r_lightcache));
+}
+
 __attribute__((noinline))
-static int
-R_LightSurfPoint(const mnode_t *node, const vec3_t surfpoint)
+static qboolean
+R_LightSurfPoint(const mnode_t *node, const vec3_t surfpoint,
+		 lightsample_t *sample)
 {
     const msurface_t *surf;
-    int i, maps;
+    int i;
 
     /* check for impact on this node */
     surf = cl.worldmodel->surfaces + node->firstsurface;
     for (i = 0; i < node->numsurfaces; i++, surf++) {
 	const mtexinfo_t *tex;
-	const byte *lightmap;
-	int s, t, ds, dt, lightlevel;
+	int s, t, ds, dt;
 
 	if (surf->flags & SURF_DRAWTILED)
 	    continue; /* no lightmaps */
@@ -169,39 +289,32 @@ R_LightSurfPoint(const mnode_t *node, const vec3_t surfpoint)
 	if (ds > surf->extents[0] || dt > surf->extents[1])
 	    continue;
 
-	if (!surf->samples)
-	    return 0;
-
-	ds >>= 4;
-	dt >>= 4;
-
-	/* FIXME: does this account properly for dynamic lights? e.g. rocket */
-	lightlevel = 0;
-	lightmap = surf->samples + dt * ((surf->extents[0] >> 4) + 1) + ds;
-	foreach_surf_lightstyle(surf, maps) {
-	    const short *size = surf->extents;
-	    const int surfbytes = ((size[0] >> 4) + 1) * ((size[1] >> 4) + 1);
-
-	    lightlevel += *lightmap * d_lightstylevalue[surf->styles[maps]];
-	    lightmap += surfbytes;
+	sample->surf = surf;
+	sample->lightmap = NULL;
+	if (surf->samples) {
+	    ds >>= 4;
+	    dt >>= 4;
+	    sample->lightmap = surf->samples
+		+ dt * ((surf->extents[0] >> 4) + 1) + ds;
 	}
-	return lightlevel >> 8;
+	return true;
     }
 
-    return -1;
+    return false;
 }
 
-static int
-RecursiveLightPoint(const mnode_t *node, const vec3_t start, const vec3_t end)
+static qboolean
+RecursiveLightPoint(const mnode_t *node, const vec3_t start, const vec3_t end,
+		    lightsample_t *sample)
 {
     const mplane_t *plane;
     float front, back, frac;
     vec3_t surfpoint;
-    int side, lightlevel;
+    int side;
 
  restart:
     if (node->contents < 0)
-	return -1; /* didn't hit anything */
+	return false; /* didn't hit anything */
 
     /* calculate surface intersection point */
     plane = node->plane;
@@ -231,23 +344,46 @@ RecursiveLightPoint(const mnode_t *node, const vec3_t start, const vec3_t end)
     surfpoint[2] = start[2] + (end[2] - start[2]) * frac;
 
     /* go down front side */
-    lightlevel = RecursiveLightPoint(node->children[side], start, surfpoint);
-    if (lightlevel >= 0)
-	return lightlevel; /* hit something */
+    if (RecursiveLightPoint(node->children[side], start, surfpoint, sample))
+	return true; /* hit something */
 
     if ((back < 0) == side)
-	return -1; /* didn't hit anything */
+	return false; /* didn't hit anything */
 
 #ifdef GLQUAKE
     VectorCopy(surfpoint, lightspot);
 #endif
 
-    lightlevel = R_LightSurfPoint(node, surfpoint);
-    if (lightlevel >= 0)
-	return lightlevel;
+    if (R_LightSurfPoint(node, surfpoint, sample))
+	return true;
 
     /* Go down back side */
-    return RecursiveLightPoint(node->children[!side], surfpoint, end);
+    return RecursiveLightPoint(node->children[!side], surfpoint, end, sample);
+}
+
+/*
+ * The light of a sample under the current lightstyles
+ */
+static int
+R_LightSampleLevel(const lightsample_t *sample)
+{
+    const msurface_t *surf = sample->surf;
+    const byte *lightmap = sample->lightmap;
+    int maps, lightlevel;
+
+    if (!lightmap)
+	return 0;
+
+    /* FIXME: does this account properly for dynamic lights? e.g. rocket */
+    lightlevel = 0;
+    foreach_surf_lightstyle(surf, maps) {
+	const short *size = surf->extents;
+	const int surfbytes = ((size[0] >> 4) + 1) * ((size[1] >> 4) + 1);
+
+	lightlevel += *lightmap * d_lightstylevalue[surf->styles[maps]];
+	lightmap += surfbytes;
+    }
+    return lightlevel >> 8;
 }
 
 /*
@@ -258,20 +394,33 @@ RecursiveLightPoint(const mnode_t *node, const vec3_t start, const vec3_t end)
 int
 R_LightPoint(const vec3_t point)
 {
+    lightsample_t *sample;
     vec3_t end;
     int lightlevel;
 
     if (!cl.worldmodel->lightdata)
 	return 255;
 
-    end[0] = point[0];
-    end[1] = point[1];
-    end[2] = point[2] - (8192 + 2); /* Max distance + error margin */
-
-    lightlevel = RecursiveLightPoint(cl.worldmodel->nodes, point, end);
+    sample = &r_lightcache[R_DlightHash(2166136261U, point, sizeof(vec3_t))
+			   & (LIGHTCACHE_SIZE - 1)];
+    if (sample->world != cl.worldmodel || !VectorCompare(sample->point, point)) {
+	end[0] = point[0];
+	end[1] = point[1];
+	end[2] = point[2] - (8192 + 2); /* Max distance + error margin */
+
+	sample->surf = NULL;
+	sample->lightmap = NULL;
+	RecursiveLightPoint(cl.worldmodel->nodes, point, end, sample);
+	VectorCopy(point, sample->point);
+	sample->world = cl.worldmodel;
+#ifdef GLQUAKE
+	VectorCopy(lightspot, sample->lightspot);
+    } else {
+	VectorCopy(sample->lightspot, lightspot);
+#endif
+    }
 
-    if (lightlevel == -1)
-	lightlevel = 0;
+    lightlevel = R_LightSampleLevel(sample);
 
 #ifndef GLQUAKE
     if (lightlevel < r_refdef.ambientlight)
@@ -23,11 +23,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "cmd.h"
 #include "console.h"
+#include "d_local.h"
 #include "quakedef.h"
 #include "r_local.h"
 #include "screen.h"
 #include "sound.h"
 #include "sys.h"
+#include "trace.h"
 #include "view.h"
 
 void *colormap;
@@ -45,12 +47,32 @@ static vec3_t viewlightvec;
 static alight_t r_viewlighting = { 128, 192, viewlightvec };
 
 qboolean r_dowarp, r_dowarpold, r_viewchanged;
+qboolean r_sharedscene;		// between R_BeginScene and R_EndScene
+unsigned r_viewbits;		// bit of the view being drawn (see R_BinScene)
+static unsigned r_edictbins[MAX_VISEDICTS];
 
 int c_surf;
 int r_maxsurfsseen, r_maxedgesseen;
 
-static int r_cnumsurfs;
-static qboolean r_surfsonstack;
+/*
+ * The edge and surface pools start out at r_maxedges/r_maxsurfs and are
+ * grown for the next view whenever one runs out, so high resolutions and
+ * busy maps only come up short for a frame.  A pool that stays under a
+ * quarter full for R_POOLSHRINKVIEWS views is cut back towards what was used.
+ */
+#define R_POOLSHRINKVIEWS 1024
+
+typedef struct {
+    const char *name;
+    void *buffer;		// as allocated, before the cache alignment
+    int size;			// elements
+    int wanted;			// size for the next view
+    int highwater;		// most used since the last shrink check
+} rpool_t;
+
+static rpool_t r_edgepool = { "edges" };
+static rpool_t r_surfpool = { "surfaces" };
+static int r_poolviews;
 
 byte *r_warpbuffer;
 
@@ -116,6 +138,8 @@ cvar_t r_ambient = { "r_ambient", "0" };
 cvar_t r_numsurfs = { "r_numsurfs", "0" };
 cvar_t r_numedges = { "r_numedges", "0" };
 
+static cvar_t r_occlusion = { "r_occlusion", "1" };
+
 cvar_t r_lockpvs = { "r_lockpvs", "0" };
 cvar_t r_lockfrustum = { "r_lockfrustum", "0" };
 
@@ -224,10 +248,12 @@ R_Init(void)
     Cvar_RegisterVariable(&r_ambient);
     Cvar_RegisterVariable(&r_numsurfs);
     Cvar_RegisterVariable(&r_numedges);
+    Cvar_RegisterVariable(&r_occlusion);
 #ifdef NQ_HACK
     Cvar_RegisterVariable(&r_lerpmodels);
     Cvar_RegisterVariable(&r_lerpmove);
 #endif
+    Cvar_RegisterVariable(&r_lodbias);
     Cvar_RegisterVariable(&r_lockpvs);
     Cvar_RegisterVariable(&r_lockfrustum);
 
@@ -248,8 +274,8 @@ R_Init(void)
     Cvar_RegisterVariable(&r_zgraph);
 #endif
 
-    Cvar_SetValue("r_maxedges", (float)NUMSTACKEDGES);
-    Cvar_SetValue("r_maxsurfs", (float)NUMSTACKSURFACES);
+    Cvar_SetValue("r_maxedges", (float)MINEDGES);
+    Cvar_SetValue("r_maxsurfs", (float)MINSURFACES);
 
     view_clipplanes[0].leftedge = true;
     view_clipplanes[1].rightedge = true;
@@ -291,40 +317,11 @@ R_NewMap(void)
 
     r_viewleaf = NULL;
     R_ClearParticles();
-
-    r_cnumsurfs = r_maxsurfs.value;
-
-    if (r_cnumsurfs <= MINSURFACES)
-	r_cnumsurfs = MINSURFACES;
-
-    if (r_cnumsurfs > NUMSTACKSURFACES) {
-	surfaces = Hunk_AllocName(r_cnumsurfs * sizeof(surf_t), "surfaces");
-	surface_p = surfaces;
-	surf_max = &surfaces[r_cnumsurfs];
-	r_surfsonstack = false;
-	// surface 0 doesn't really exist; it's just a dummy because index 0
-	// is used to indicate no edge attached to surface
-	surfaces--;
-	R_SurfacePatch();
-    } else {
-	r_surfsonstack = true;
-    }
+    R_ClearLightPoints();
 
     r_maxedgesseen = 0;
     r_maxsurfsseen = 0;
 
-    r_numallocatededges = r_maxedges.value;
-
-    if (r_numallocatededges < MINEDGES)
-	r_numallocatededges = MINEDGES;
-
-    if (r_numallocatededges <= NUMSTACKEDGES) {
-	auxedges = NULL;
-    } else {
-	auxedges = Hunk_AllocName(r_numallocatededges * sizeof(edge_t),
-				  "edges");
-    }
-
     r_dowarpold = false;
     r_viewchanged = false;
 }
@@ -386,6 +383,89 @@ R_SetVrect(const vrect_t *pvrectin, vrect_t *pvrect, int lineadj)
 }
 
 
+/*
+===============
+R_SetVrectBounds
+
+Derive the clipping bounds from r_refdef.vrect
+===============
+*/
+static void
+R_SetVrectBounds(void)
+{
+    r_refdef.fvrectx = (float)r_refdef.vrect.x;
+    r_refdef.fvrectx_adj = (float)r_refdef.vrect.x - 0.5;
+    r_refdef.vrect_x_adj_shift20 = (r_refdef.vrect.x << 20) + (1 << 19) - 1;
+    r_refdef.fvrecty = (float)r_refdef.vrect.y;
+    r_refdef.fvrecty_adj = (float)r_refdef.vrect.y - 0.5;
+    r_refdef.vrectright = r_refdef.vrect.x + r_refdef.vrect.width;
+    r_refdef.vrectright_adj_shift20 =
+	(r_refdef.vrectright << 20) + (1 << 19) - 1;
+    r_refdef.fvrectright = (float)r_refdef.vrectright;
+    r_refdef.fvrectright_adj = (float)r_refdef.vrectright - 0.5;
+    r_refdef.vrectrightedge = (float)r_refdef.vrectright - 0.99;
+    r_refdef.vrectbottom = r_refdef.vrect.y + r_refdef.vrect.height;
+    r_refdef.fvrectbottom = (float)r_refdef.vrectbottom;
+    r_refdef.fvrectbottom_adj = (float)r_refdef.vrectbottom - 0.5;
+
+    r_refdef.aliasvrect.x = (int)(r_refdef.vrect.x * r_aliasuvscale);
+    r_refdef.aliasvrect.y = (int)(r_refdef.vrect.y * r_aliasuvscale);
+    r_refdef.aliasvrect.width = (int)(r_refdef.vrect.width * r_aliasuvscale);
+    r_refdef.aliasvrect.height =
+	(int)(r_refdef.vrect.height * r_aliasuvscale);
+    r_refdef.aliasvrectright =
+	r_refdef.aliasvrect.x + r_refdef.aliasvrect.width;
+    r_refdef.aliasvrectbottom =
+	r_refdef.aliasvrect.y + r_refdef.aliasvrect.height;
+}
+
+/*
+===============
+R_SetScissor
+
+Clip rendering to a part of the view (given relative to the view), without
+changing the projection. Fisheye plates use this to skip the pixels that the
+lens never reads.
+===============
+*/
+static void
+R_SetScissor(const vrect_t *scissor)
+{
+    int i;
+    float left, right, top, bottom;
+
+    r_refdef.vrect.x += scissor->x;
+    r_refdef.vrect.y += scissor->y;
+    r_refdef.vrect.width = scissor->width;
+    r_refdef.vrect.height = scissor->height;
+    R_SetVrectBounds();
+
+// view space slopes of the scissor edges
+    left = (r_refdef.vrect.x - 0.5 - xcenter) * xscaleinv;
+    right = (r_refdef.vrectright - 0.5 - xcenter) * xscaleinv;
+    top = (ycenter - (r_refdef.vrect.y - 0.5)) * yscaleinv;
+    bottom = (ycenter - (r_refdef.vrectbottom - 0.5)) * yscaleinv;
+
+    screenedge[0].normal[0] = -1;
+    screenedge[0].normal[1] = 0;
+    screenedge[0].normal[2] = -left;
+
+    screenedge[1].normal[0] = 1;
+    screenedge[1].normal[1] = 0;
+    screenedge[1].normal[2] = right;
+
+    screenedge[2].normal[0] = 0;
+    screenedge[2].normal[1] = -1;
+    screenedge[2].normal[2] = top;
+
+    screenedge[3].normal[0] = 0;
+    screenedge[3].normal[1] = 1;
+    screenedge[3].normal[2] = -bottom;
+
+    for (i = 0; i < 4; i++)
+	VectorNormalize(screenedge[i].normal);
+}
+
 /*
 ===============
 R_ViewChanged
@@ -411,7 +491,20 @@ R_ViewChanged(vrect_t *pvrect, int lineadj, float aspect)
         int minsize = r_refdef.vrect.width;
         if (r_refdef.vrect.height < minsize)
            minsize = r_refdef.vrect.height;
+        // (plates may also be rendered smaller than the screen allows)
+        extern int fisheye_plate_size;
+        if (fisheye_plate_size > 0 && fisheye_plate_size < minsize)
+           minsize = fisheye_plate_size;
         r_refdef.vrect.width = r_refdef.vrect.height = minsize;
+        // (or rendered straight into the globe, at any size and shape)
+        extern byte *fisheye_plate_target;
+        extern int fisheye_plate_height;
+        if (fisheye_plate_target) {
+           r_refdef.vrect.x = r_refdef.vrect.y = 0;
+           r_refdef.vrect.width = fisheye_plate_size;
+           r_refdef.vrect.height = fisheye_plate_height > 0 ?
+              fisheye_plate_height : fisheye_plate_size;
+        }
 
         // set fov
         extern double fisheye_plate_fov;
@@ -421,33 +514,10 @@ R_ViewChanged(vrect_t *pvrect, int lineadj, float aspect)
         r_refdef.horizontalFieldOfView = 2.0 * tan(r_refdef.fov_x / 360 * M_PI);
     }
 
-    r_refdef.fvrectx = (float)r_refdef.vrect.x;
-    r_refdef.fvrectx_adj = (float)r_refdef.vrect.x - 0.5;
-    r_refdef.vrect_x_adj_shift20 = (r_refdef.vrect.x << 20) + (1 << 19) - 1;
-    r_refdef.fvrecty = (float)r_refdef.vrect.y;
-    r_refdef.fvrecty_adj = (float)r_refdef.vrect.y - 0.5;
-    r_refdef.vrectright = r_refdef.vrect.x + r_refdef.vrect.width;
-    r_refdef.vrectright_adj_shift20 =
-	(r_refdef.vrectright << 20) + (1 << 19) - 1;
-    r_refdef.fvrectright = (float)r_refdef.vrectright;
-    r_refdef.fvrectright_adj = (float)r_refdef.vrectright - 0.5;
-    r_refdef.vrectrightedge = (float)r_refdef.vrectright - 0.99;
-    r_refdef.vrectbottom = r_refdef.vrect.y + r_refdef.vrect.height;
-    r_refdef.fvrectbottom = (float)r_refdef.vrectbottom;
-    r_refdef.fvrectbottom_adj = (float)r_refdef.vrectbottom - 0.5;
-
-    r_refdef.aliasvrect.x = (int)(r_refdef.vrect.x * r_aliasuvscale);
-    r_refdef.aliasvrect.y = (int)(r_refdef.vrect.y * r_aliasuvscale);
-    r_refdef.aliasvrect.width = (int)(r_refdef.vrect.width * r_aliasuvscale);
-    r_refdef.aliasvrect.height =
-	(int)(r_refdef.vrect.height * r_aliasuvscale);
-    r_refdef.aliasvrectright =
-	r_refdef.aliasvrect.x + r_refdef.aliasvrect.width;
-    r_refdef.aliasvrectbottom =
-	r_refdef.aliasvrect.y + r_refdef.aliasvrect.height;
+    R_SetVrectBounds();
 
     if (fisheye_enabled) {
-        pixelAspect = (float)r_refdef.vrect.height / r_refdef.vrect.width;
+        pixelAspect = 1;	// (the plate's vertical fov follows from its shape)
     }
     else {
         pixelAspect = aspect;
@@ -534,6 +604,10 @@ R_ViewChanged(vrect_t *pvrect, int lineadj, float aspect)
 #endif
 
     D_ViewChanged();
+
+    extern vrect_t *fisheye_plate_scissor;
+    if (fisheye_enabled && fisheye_plate_scissor)
+	R_SetScissor(fisheye_plate_scissor);
 }
 
 
@@ -753,6 +827,155 @@ R_CullSubmodelSurfaces(const brushmodel_t *submodel, const vec3_t vieworg,
     }
 }
 
+/*
+ * Occlusion tiles: the farthest world depth (smallest 1/z) in each 8x8 block
+ * of the view after the edge drawing, then in each 2x2 of those blocks and
+ * so on up.  Models and sprites whose nearest point is farther than every
+ * tile they cover are hidden behind the world and not drawn at all.  The
+ * tiles are built the first time an entity asks in each view; anything drawn
+ * before then only brings the z-buffer nearer, so they stay conservative.
+ */
+#define OCCLUSION_SHIFT 3
+#define OCCLUSION_LEVELS 6
+#define OCCLUSION_TILES(size) (((size) >> OCCLUSION_SHIFT) + 1)
+
+typedef struct {
+    int width, height;
+    short *z;
+} occlusionlevel_t;
+
+// room for the rounded up sizes of the coarser levels too
+static short r_occlusiontiles[OCCLUSION_TILES(MAXWIDTH) *
+			      OCCLUSION_TILES(MAXHEIGHT) * 2];
+static occlusionlevel_t r_occlusionlevels[OCCLUSION_LEVELS];
+static qboolean r_occlusionbuilt;
+
+/*
+================
+R_BuildOcclusion
+================
+*/
+static void
+R_BuildOcclusion(void)
+{
+    const vrect_t *vrect = &r_refdef.vrect;
+    occlusionlevel_t *level, *prev;
+    const short *pz;
+    short *tile, *row;
+    int x, y, u, v, x1, y1, minz, fullwidth, l;
+
+    level = &r_occlusionlevels[0];
+    level->width = OCCLUSION_TILES(vrect->width - 1);
+    level->height = OCCLUSION_TILES(vrect->height - 1);
+    level->z = r_occlusiontiles;
+    fullwidth = vrect->width >> OCCLUSION_SHIFT;
+
+    for (v = 0; v < level->height; v++) {
+	row = level->z + v * level->width;
+	for (u = 0; u < level->width; u++)
+	    row[u] = 0x7fff;
+	y = vrect->y + (v << OCCLUSION_SHIFT);
+	y1 = qmin(y + (1 << OCCLUSION_SHIFT), r_refdef.vrectbottom);
+	for (; y < y1; y++) {
+	    pz = d_pzbuffer + d_zwidth * y + vrect->x;
+	    for (u = 0; u < fullwidth; u++, pz += 1 << OCCLUSION_SHIFT) {
+		minz = row[u];
+		for (x = 0; x < 1 << OCCLUSION_SHIFT; x++)
+		    minz = qmin(minz, (int)pz[x]);
+		row[u] = minz;
+	    }
+	    if (u < level->width) {
+		// the part tile at the right edge
+		minz = row[u];
+		for (x = 0; x < vrect->width - (u << OCCLUSION_SHIFT); x++)
+		    minz = qmin(minz, (int)pz[x]);
+		row[u] = minz;
+	    }
+	}
+    }
+
+    for (l = 1; l < OCCLUSION_LEVELS; l++) {
+	prev = level;
+	level++;
+	level->width = (prev->width + 1) >> 1;
+	level->height = (prev->height + 1) >> 1;
+	level->z = prev->z + prev->width * prev->height;
+	for (v = 0; v < level->height; v++) {
+	    y = v * 2;
+	    y1 = qmin(y + 1, prev->height - 1);
+	    tile = level->z + v * level->width;
+	    for (u = 0; u < level->width; u++) {
+		x = u * 2;
+		x1 = qmin(x + 1, prev->width - 1);
+		minz = qmin(prev->z[y * prev->width + x],
+			    prev->z[y * prev->width + x1]);
+		minz = qmin(minz, (int)prev->z[y1 * prev->width + x]);
+		minz = qmin(minz, (int)prev->z[y1 * prev->width + x1]);
+		tile[u] = minz;
+	    }
+	}
+    }
+
+    r_occlusionbuilt = true;
+}
+
+/*
+================
+R_Occluded
+
+True if the world hides everything in the screen rectangle (inclusive pixel
+coordinates) that is no nearer than nearz
+================
+*/
+qboolean
+R_Occluded(int left, int top, int right, int bottom, float nearz)
+{
+    const vrect_t *vrect = &r_refdef.vrect;
+    const occlusionlevel_t *level;
+    const short *row;
+    int u, v, u0, v0, u1, v1, izi, l;
+
+    if (!r_occlusion.value || nearz < 1)
+	return false;
+
+    left = qmax(left, vrect->x) - vrect->x;
+    top = qmax(top, vrect->y) - vrect->y;
+    right = qmin(right, r_refdef.vrectright - 1) - vrect->x;
+    bottom = qmin(bottom, r_refdef.vrectbottom - 1) - vrect->y;
+    if (left > right || top > bottom)
+	return false;
+
+    if (!r_occlusionbuilt)
+	R_BuildOcclusion();
+
+    // the most any pixel of it could write to the z-buffer
+    izi = (int)(0x8000 / nearz) + 1;
+
+    // the finest level with no more than 4x4 tiles to look at
+    u0 = left >> OCCLUSION_SHIFT;
+    v0 = top >> OCCLUSION_SHIFT;
+    u1 = right >> OCCLUSION_SHIFT;
+    v1 = bottom >> OCCLUSION_SHIFT;
+    for (l = 0; l < OCCLUSION_LEVELS - 1; l++) {
+	if (u1 - u0 < 4 && v1 - v0 < 4)
+	    break;
+	u0 >>= 1;
+	v0 >>= 1;
+	u1 >>= 1;
+	v1 >>= 1;
+    }
+
+    level = &r_occlusionlevels[l];
+    for (v = v0; v <= v1; v++) {
+	row = level->z + v * level->width;
+	for (u = u0; u <= u1; u++)
+	    if (row[u] <= izi)
+		return false;
+    }
+
+    return true;
+}
+
 /*
 =============
 R_DrawEntitiesOnList
@@ -780,6 +1003,8 @@ R_DrawEntitiesOnList(void)
 	if (e == &cl_entities[cl.viewentity])
 	    continue;		// don't draw the player
 #endif
+	if (r_viewbits && !(r_edictbins[i] & r_viewbits))
+	    continue;		// binned away from this view
 	switch (e->model->type) {
 	case mod_sprite:
 	    VectorCopy(e->origin, r_entorigin);
@@ -845,6 +1070,35 @@ R_DrawEntitiesOnList(void)
     }
 }
 
+/*
+=============
+R_ViewModelClipped
+
+True if the view model is wholly outside the view, which under a fisheye
+lens it is for most of the plates
+=============
+*/
+static qboolean
+R_ViewModelClipped(const entity_t *e)
+{
+    float radius;
+    vec_t dist;
+    int i;
+
+    if (e->model->type != mod_alias)
+	return false;
+
+    radius = Mod_AliasFrameRadius(Mod_Extradata(e->model), e->frame);
+    for (i = 0; i < 4; i++) {
+	dist = DotProduct(e->origin, view_clipplanes[i].plane.normal);
+	dist -= view_clipplanes[i].plane.dist;
+	if (dist <= -radius)
+	    return true;
+    }
+
+    return false;
+}
+
 /*
 =============
 R_DrawViewModel
@@ -878,7 +1132,7 @@ R_DrawViewModel(void)
 	return;
 
     e = &cl.viewent;
-    if (!e->model)
+    if (!e->model || R_ViewModelClipped(e))
 	return;
 
     VectorCopy(e->origin, r_entorigin);
@@ -980,7 +1234,8 @@ R_DrawBEntitiesOnList(void)
 	return;
 
     VectorCopy(modelorg, oldorigin);
-    r_dlightframecount = r_framecount;
+    if (!r_sharedscene)
+	r_dlightframecount = r_framecount;
 
     for (i = 0; i < cl_numvisedicts; i++) {
 	entity = &cl_visedicts[i];
@@ -1049,6 +1304,58 @@ R_DrawBEntitiesOnList(void)
 }
 
 
+/*
+================
+R_SizePool
+
+Resizes the pool to what the last views asked for, or at least the minimum
+================
+*/
+static void
+R_SizePool(rpool_t *pool, int minimum, size_t elementsize)
+{
+    void *buffer;
+    int wanted;
+
+    wanted = qmax(pool->wanted, minimum);
+    if (wanted == pool->size)
+	return;
+
+    // one spare in front for the dummy surface 0
+    buffer = realloc(pool->buffer, (wanted + 1) * elementsize + CACHE_SIZE);
+    if (buffer) {
+	pool->buffer = buffer;
+	pool->size = wanted;
+    } else if (!pool->buffer) {
+	Sys_Error("%s: out of memory for %d elements", __func__, wanted);
+    }
+    pool->wanted = pool->size;
+}
+
+/*
+================
+R_UpdatePool
+
+Grows the pool for the next view if this one ran short, or shrinks it again
+after a long run of views using little of it
+================
+*/
+static void
+R_UpdatePool(rpool_t *pool, int used, int shortfall, int minimum)
+{
+    if (shortfall) {
+	pool->wanted = qmax(pool->size * 2, (used + shortfall) * 5 / 4);
+	Con_DPrintf("Growing %s to %d\n", pool->name, pool->wanted);
+    }
+    pool->highwater = qmax(pool->highwater, used + shortfall);
+
+    if (!r_poolviews) {
+	if (pool->highwater < pool->size / 4)
+	    pool->wanted = qmax(pool->highwater * 2, minimum);
+	pool->highwater = 0;
+    }
+}
+
 /*
 ================
 R_EdgeDrawing
@@ -1058,23 +1365,22 @@ R_EdgeDrawing
 static void
 R_EdgeDrawing(void)
 {
-    edge_t ledges[CACHE_PAD_ARRAY(NUMSTACKEDGES, edge_t)];
-    surf_t lsurfs[CACHE_PAD_ARRAY(NUMSTACKSURFACES, surf_t)];
+    int minedges, minsurfs;
 
-    if (auxedges) {
-	r_edges = auxedges;
-    } else {
-	r_edges = CACHE_ALIGN_PTR(ledges);
-    }
+    minedges = qmax((int)r_maxedges.value, MINEDGES);
+    minsurfs = qmax((int)r_maxsurfs.value, MINSURFACES);
 
-    if (r_surfsonstack) {
-	surfaces = CACHE_ALIGN_PTR(lsurfs);
-	surf_max = &surfaces[r_cnumsurfs];
-	// surface 0 doesn't really exist; it's just a dummy because index 0
-	// is used to indicate no edge attached to surface
-	surfaces--;
-	R_SurfacePatch();
-    }
+    R_SizePool(&r_edgepool, minedges, sizeof(edge_t));
+    r_edges = CACHE_ALIGN_PTR((edge_t *)r_edgepool.buffer + 1);
+    r_numallocatededges = r_edgepool.size;
+
+    R_SizePool(&r_surfpool, minsurfs, sizeof(surf_t));
+    surfaces = CACHE_ALIGN_PTR((surf_t *)r_surfpool.buffer + 1);
+    surf_max = &surfaces[r_surfpool.size];
+    // surface 0 doesn't really exist; it's just a dummy because index 0
+    // is used to indicate no edge attached to surface
+    surfaces--;
+    R_SurfacePatch();
 
     R_BeginEdgeFrame();
 
@@ -1107,6 +1413,11 @@ R_EdgeDrawing(void)
     }
 
     R_ScanEdges();
+
+    r_poolviews = (r_poolviews + 1) % R_POOLSHRINKVIEWS;
+    R_UpdatePool(&r_edgepool, edge_p - r_edges, r_outofedges, minedges);
+    R_UpdatePool(&r_surfpool, surface_p - &surfaces[1], r_outofsurfaces,
+		 minsurfs);
 }
 
 
@@ -1127,9 +1438,15 @@ R_RenderView_(void)
     if (r_timegraph.value || r_speeds.value || r_dspeeds.value)
 	r_time1 = Sys_DoubleTime();
 
+    TR_Begin("R_SetupFrame");
     R_SetupFrame();
-    R_MarkSurfaces();		// done here so we know if we're in water
-    R_CullSurfaces(BrushModel(r_worldentity.model), r_refdef.vieworg);
+    TR_End("R_SetupFrame");
+    TR_Begin("R_MarkSurfaces");
+    if (!r_sharedscene)
+	R_MarkSurfaces();	// done here so we know if we're in water
+    if (R_SceneView() < 0)	// (else culled with the scene, see R_CullScene)
+	R_CullSurfaces(BrushModel(r_worldentity.model), r_refdef.vieworg);
+    TR_End("R_MarkSurfaces");
 
     // make FDIV fast. This reduces timing precision after we've been running
     // for a while, so we don't do it globally.  This also sets chop mode, and
@@ -1146,7 +1463,10 @@ R_RenderView_(void)
 	VID_LockBuffer();
     }
 
+    TR_Begin("R_EdgeDrawing");
     R_EdgeDrawing();
+    TR_End("R_EdgeDrawing");
+    r_occlusionbuilt = false;
 
     if (!r_dspeeds.value) {
 	VID_UnlockBuffer();
@@ -1159,27 +1479,36 @@ R_RenderView_(void)
 	de_time1 = se_time2;
     }
 
+    TR_Begin("R_DrawEntitiesOnList");
     R_DrawEntitiesOnList();
+    TR_End("R_DrawEntitiesOnList");
 
     if (r_dspeeds.value) {
 	de_time2 = Sys_DoubleTime();
 	dv_time1 = de_time2;
     }
 
+    TR_Begin("R_DrawViewModel");
     R_DrawViewModel();
+    TR_End("R_DrawViewModel");
 
     if (r_dspeeds.value) {
 	dv_time2 = Sys_DoubleTime();
 	dp_time1 = Sys_DoubleTime();
     }
 
+    TR_Begin("R_DrawParticles");
     R_DrawParticles();
+    TR_End("R_DrawParticles");
 
     if (r_dspeeds.value)
 	dp_time2 = Sys_DoubleTime();
 
-    if (r_dowarp)
+    if (r_dowarp) {
+	TR_Begin("D_WarpScreen");
 	D_WarpScreen();
+	TR_End("D_WarpScreen");
+    }
 
     V_SetContentsColor(r_viewleaf->contents);
 
@@ -1229,3 +1558,144 @@ R_RenderView(void)
 
     R_RenderView_();
 }
+
+/*
+================
+R_BeginScene
+
+Views rendered from the same r_refdef.vieworg (e.g. the fisheye plates)
+can share the setup that only depends on the origin: the dynamic lights,
+lightstyles, viewleaf, PVS and the entities stored from efrags.  Call
+this once before rendering them with R_RenderView, then R_EndScene.
+Views from a few units off the origin (e.g. stereo eyes) may share it
+too, with the leaf and PVS of the point between them.
+================
+*/
+void
+R_BeginScene(void)
+{
+    R_PushDlights();
+    R_AnimateLight();
+    r_framecount++;
+
+    r_oldviewleaf = r_viewleaf;
+    r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_refdef.vieworg);
+    R_MarkSurfaces();
+
+    r_sharedscene = true;
+    r_sceneviews = 0;
+}
+
+void
+R_EndScene(void)
+{
+    r_sharedscene = false;
+    r_sceneviews = 0;
+    r_viewbits = 0;
+}
+
+/*
+================
+R_ViewBins
+
+The views a sphere may show in, taking views as cones around their forward
+vectors
+================
+*/
+static unsigned
+R_ViewBins(const vec3_t org, float radius, int numviews,
+	   const vec3_t *forward, const float *halfangle)
+{
+    vec3_t delta;
+    float dist, angle;
+    unsigned bins;
+    int i;
+
+    VectorSubtract(org, r_refdef.vieworg, delta);
+    dist = Length(delta);
+    if (dist <= radius)
+	return ~0U;
+
+    bins = 0;
+    for (i = 0; i < numviews; i++) {
+	angle = halfangle[i] + asin(radius / dist);
+	if (angle >= M_PI || DotProduct(delta, forward[i]) >= dist * cos(angle))
+	    bins |= 1U << i;
+    }
+
+    return bins;
+}
+
+/*
+================
+R_BinScene
+
+Sort the alias models, sprites and particles of a shared scene out between
+its views once, so each view only walks the ones it may show.  View i looks
+down the unit vector forward[i] and sees nothing more than halfangle[i]
+radians off it, from no more than margin units off r_refdef.vieworg.  Call
+after R_BeginScene, then set r_viewbits to (1 << i) while rendering view i
+(R_EndScene goes back to drawing everything).
+================
+*/
+void
+R_BinScene(int numviews, const vec3_t *forward, const float *halfangle,
+	   float margin)
+{
+    entity_t *e;
+    particlegroup_t *group;
+    aliashdr_t *pahdr;
+    vec3_t mins, maxs;
+    float radius;
+    int i, j;
+
+    if (numviews > 32)
+	numviews = 32;
+
+    for (i = 0; i < cl_numvisedicts; i++) {
+	e = &cl_visedicts[i];
+	switch (e->model->type) {
+	case mod_alias:
+	    // any frame fits in the model's scaled byte range
+	    pahdr = Mod_Extradata(e->model);
+	    for (j = 0; j < 3; j++) {
+		mins[j] = pahdr->scale_origin[j];
+		maxs[j] = pahdr->scale_origin[j] + pahdr->scale[j] * 255;
+	    }
+	    break;
+	case mod_sprite:
+	    VectorCopy(e->model->mins, mins);
+	    VectorCopy(e->model->maxs, maxs);
+	    break;
+	default:
+	    r_edictbins[i] = ~0U;
+	    continue;
+	}
+
+	// the corner farthest from the origin bounds any rotation
+	for (j = 0; j < 3; j++)
+	    maxs[j] = qmax(fabs(mins[j]), fabs(maxs[j]));
+	radius = Length(maxs) + margin;
+#ifdef NQ_HACK
+	if (r_lerpmove.value) {
+	    // drawn somewhere between its last two origins
+	    VectorSubtract(e->currentorigin, e->previousorigin, mins);
+	    radius += Length(mins);
+	}
+#endif
+	r_edictbins[i] = R_ViewBins(e->origin, radius, numviews, forward,
+				    halfangle);
+    }
+
+    // particles are drawn a few units across up close
+    for (i = 0; i < pt_numtypes; i++) {
+	group = &r_particlegroups[i];
+	for (j = 0; j < group->count; j++) {
+	    mins[0] = group->org[0][j];
+	    mins[1] = group->org[1][j];
+	    mins[2] = group->org[2][j];
+	    group->viewbits[j] = R_ViewBins(mins, 4 + margin, numviews,
+					    forward, halfangle);
+	}
+    }
+}
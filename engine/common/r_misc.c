@@ -284,9 +284,12 @@ R_PrintTimes(void)
 
     ms = 1000 * (r_time2 - r_time1);
 
-    Con_Printf("%5.1f ms %3i/%3i/%3i poly %3i surf\n",
-	       ms, c_faceclip, r_polycount, r_drawnpolycount, c_surf);
+    Con_Printf("%5.1f ms %3i/%3i/%3i poly %3i surf %3i hit %3i evict\n",
+	       ms, c_faceclip, r_polycount, r_drawnpolycount, c_surf,
+	       c_surfhits, c_surfevicted);
     c_surf = 0;
+    c_surfhits = 0;
+    c_surfevicted = 0;
 }
 
 /*
@@ -475,7 +478,8 @@ R_SetupFrame(void)
 
     R_CheckVariables();
 
-    R_AnimateLight();
+    if (!r_sharedscene)
+	R_AnimateLight();
 
     r_framecount++;
 
@@ -503,13 +507,15 @@ R_SetupFrame(void)
         AngleVectors(r_refdef.viewangles, vpn, vright, vup);
     }
 
-// current viewleaf
-    r_oldviewleaf = r_viewleaf;
-    r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+// current viewleaf (already found for a shared scene)
+    if (!r_sharedscene) {
+	r_oldviewleaf = r_viewleaf;
+	r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+    }
 
     r_dowarpold = r_dowarp;
     if (fisheye_enabled) {
-        r_dowarp = 0;
+        r_dowarp = 0;	// (the fisheye lens is warped instead)
     }
     else {
         r_dowarp = r_waterwarp.value && (r_viewleaf->contents <= CONTENTS_WATER);
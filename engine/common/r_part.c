@@ -18,6 +18,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
 
+#include <string.h>
+
 #include "console.h"
 #include "model.h"
 #include "quakedef.h"
@@ -41,14 +43,97 @@ int ramp1[8] = { 0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61 };
 int ramp2[8] = { 0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66 };
 int ramp3[8] = { 0x6d, 0x6b, 6, 5, 4, 3 };
 
-particle_t *active_particles, *free_particles;
-
-particle_t *particles;
+/*
+ * The particles are kept in a group per type, so the simulation runs one
+ * tight loop per type over plain float arrays instead of a switch per
+ * particle, and the software driver projects each group as a batch.  Dead
+ * particles are squeezed out of the arrays once a frame.
+ */
+particlegroup_t r_particlegroups[pt_numtypes];
 int r_numparticles;
+static int r_numactiveparticles;
 
 vec3_t r_pright, r_pup, r_ppn;
 
 
+#ifdef GLQUAKE
+#define PARTICLE_FIELDS 9
+#else
+#define PARTICLE_FIELDS 10	// with the view bits
+#endif
+
+/*
+===============
+R_AllocParticleGroups
+
+Every group has room for all of the particles, so an effect never runs out
+of one type while there are free particles left
+===============
+*/
+static void
+R_AllocParticleGroups(void)
+{
+    particlegroup_t *group;
+    float *fields;
+    int i, j;
+
+    fields = Hunk_AllocName(pt_numtypes * PARTICLE_FIELDS * r_numparticles *
+			    sizeof(float), "particles");
+    for (i = 0; i < pt_numtypes; i++) {
+	group = &r_particlegroups[i];
+	group->count = 0;
+	for (j = 0; j < 3; j++) {
+	    group->org[j] = fields;
+	    fields += r_numparticles;
+	    group->vel[j] = fields;
+	    fields += r_numparticles;
+	}
+	group->color = fields;
+	fields += r_numparticles;
+	group->ramp = fields;
+	fields += r_numparticles;
+	group->die = fields;
+	fields += r_numparticles;
+#ifndef GLQUAKE
+	group->viewbits = (unsigned *)fields;
+	fields += r_numparticles;
+#endif
+    }
+}
+
+/*
+===============
+R_AddParticle
+
+Copy a new particle into its group; false once all of them are in use
+===============
+*/
+static qboolean
+R_AddParticle(const particle_t *p)
+{
+    particlegroup_t *group;
+    int i, n;
+
+    if (r_numactiveparticles >= r_numparticles)
+	return false;
+    r_numactiveparticles++;
+
+    group = &r_particlegroups[p->type];
+    n = group->count++;
+    for (i = 0; i < 3; i++) {
+	group->org[i][n] = p->org[i];
+	group->vel[i][n] = p->vel[i];
+    }
+    group->color[n] = p->color;
+    group->ramp[n] = p->ramp;
+    group->die[n] = p->die;
+#ifndef GLQUAKE
+    group->viewbits[n] = ~0U;
+#endif
+
+    return true;
+}
+
 /*
 ===============
 R_InitParticles
@@ -69,8 +154,7 @@ R_InitParticles(void)
 	r_numparticles = MAX_PARTICLES;
     }
 
-    particles = (particle_t *)
-	Hunk_AllocName(r_numparticles * sizeof(particle_t), "particles");
+    R_AllocParticleGroups();
 }
 
 #ifdef NQ_HACK
@@ -91,7 +175,7 @@ void
 R_EntityParticles(const entity_t *ent)
 {
     int i;
-    particle_t *p;
+    particle_t p;
     float angle;
     float sp, sy, cp, cy;
     vec3_t forward;
@@ -105,6 +189,7 @@ R_EntityParticles(const entity_t *ent)
 	}
     }
 
+    memset(&p, 0, sizeof(p));
     for (i = 0; i < NUMVERTEXNORMALS; i++) {
 	angle = cl.time * avelocities[i][0];
 	sy = sin(angle);
@@ -117,26 +202,21 @@ R_EntityParticles(const entity_t *ent)
 	forward[1] = cp * sy;
 	forward[2] = -sp;
 
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
+	p.die = cl.time + 0.01;
+	p.color = 0x6f;
+	p.type = pt_explode;
 
-	p->die = cl.time + 0.01;
-	p->color = 0x6f;
-	p->type = pt_explode;
-
-	p->org[0] =
+	p.org[0] =
 	    ent->origin[0] + r_avertexnormals[i][0] * dist +
 	    forward[0] * beamlength;
-	p->org[1] =
+	p.org[1] =
 	    ent->origin[1] + r_avertexnormals[i][1] * dist +
 	    forward[1] * beamlength;
-	p->org[2] =
+	p.org[2] =
 	    ent->origin[2] + r_avertexnormals[i][2] * dist +
 	    forward[2] * beamlength;
+	if (!R_AddParticle(&p))
+	    return;
     }
 }
 #endif /* NQ_HACK */
@@ -151,12 +231,9 @@ R_ClearParticles(void)
 {
     int i;
 
-    free_particles = &particles[0];
-    active_particles = NULL;
-
-    for (i = 0; i < r_numparticles; i++)
-	particles[i].next = &particles[i + 1];
-    particles[r_numparticles - 1].next = NULL;
+    for (i = 0; i < pt_numtypes; i++)
+	r_particlegroups[i].count = 0;
+    r_numactiveparticles = 0;
 }
 
 
@@ -167,7 +244,7 @@ R_ReadPointFile_f(void)
     vec3_t org;
     int r;
     int c;
-    particle_t *p;
+    particle_t p;
     char name[MAX_OSPATH];
 
 #ifdef NQ_HACK
@@ -185,6 +262,7 @@ R_ReadPointFile_f(void)
     }
 
     Con_Printf("Reading %s...\n", name);
+    memset(&p, 0, sizeof(p));
     c = 0;
     for (;;) {
 	r = fscanf(f, "%f %f %f\n", &org[0], &org[1], &org[2]);
@@ -192,20 +270,15 @@ R_ReadPointFile_f(void)
 	    break;
 	c++;
 
-	if (!free_particles) {
+	p.die = 99999;
+	p.color = (-c) & 15;
+	p.type = pt_static;
+	VectorCopy(vec3_origin, p.vel);
+	VectorCopy(org, p.org);
+	if (!R_AddParticle(&p)) {
 	    Con_Printf("Not enough free particles\n");
 	    break;
 	}
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = 99999;
-	p->color = (-c) & 15;
-	p->type = pt_static;
-	VectorCopy(vec3_origin, p->vel);
-	VectorCopy(org, p->org);
     }
 
     fclose(f);
@@ -226,8 +299,7 @@ R_ParseParticleEffect(void)
     vec3_t org, dir;
     int i, count, msgcount, color;
 
-    for (i = 0; i < 3; i++)
-	org[i] = MSG_ReadCoord();
+    MSG_ReadCoords3(org);
     for (i = 0; i < 3; i++)
 	dir[i] = MSG_ReadChar() * (1.0 / 16);
     msgcount = MSG_ReadByte();
@@ -252,32 +324,28 @@ void
 R_ParticleExplosion(vec3_t org)
 {
     int i, j;
-    particle_t *p;
+    particle_t p;
 
+    memset(&p, 0, sizeof(p));
     for (i = 0; i < 1024; i++) {
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = cl.time + 5;
-	p->color = ramp1[0];
-	p->ramp = rand() & 3;
+	p.die = cl.time + 5;
+	p.color = ramp1[0];
+	p.ramp = rand() & 3;
 	if (i & 1) {
-	    p->type = pt_explode;
+	    p.type = pt_explode;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		p.org[j] = org[j] + ((rand() % 32) - 16);
+		p.vel[j] = (rand() % 512) - 256;
 	    }
 	} else {
-	    p->type = pt_explode2;
+	    p.type = pt_explode2;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		p.org[j] = org[j] + ((rand() % 32) - 16);
+		p.vel[j] = (rand() % 512) - 256;
 	    }
 	}
+	if (!R_AddParticle(&p))
+	    return;
     }
 }
 
@@ -292,26 +360,22 @@ void
 R_ParticleExplosion2(vec3_t org, int colorStart, int colorLength)
 {
     int i, j;
-    particle_t *p;
+    particle_t p;
     int colorMod = 0;
 
+    memset(&p, 0, sizeof(p));
     for (i = 0; i < 512; i++) {
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = cl.time + 0.3;
-	p->color = colorStart + (colorMod % colorLength);
+	p.die = cl.time + 0.3;
+	p.color = colorStart + (colorMod % colorLength);
 	colorMod++;
 
-	p->type = pt_blob;
+	p.type = pt_blob;
 	for (j = 0; j < 3; j++) {
-	    p->org[j] = org[j] + ((rand() % 32) - 16);
-	    p->vel[j] = (rand() % 512) - 256;
+	    p.org[j] = org[j] + ((rand() % 32) - 16);
+	    p.vel[j] = (rand() % 512) - 256;
 	}
+	if (!R_AddParticle(&p))
+	    return;
     }
 }
 #endif
@@ -326,33 +390,29 @@ void
 R_BlobExplosion(vec3_t org)
 {
     int i, j;
-    particle_t *p;
+    particle_t p;
 
+    memset(&p, 0, sizeof(p));
     for (i = 0; i < 1024; i++) {
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = cl.time + 1 + (rand() & 8) * 0.05;
+	p.die = cl.time + 1 + (rand() & 8) * 0.05;
 
 	if (i & 1) {
-	    p->type = pt_blob;
-	    p->color = 66 + rand() % 6;
+	    p.type = pt_blob;
+	    p.color = 66 + rand() % 6;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		p.org[j] = org[j] + ((rand() % 32) - 16);
+		p.vel[j] = (rand() % 512) - 256;
 	    }
 	} else {
-	    p->type = pt_blob2;
-	    p->color = 150 + rand() % 6;
+	    p.type = pt_blob2;
+	    p.color = 150 + rand() % 6;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		p.org[j] = org[j] + ((rand() % 32) - 16);
+		p.vel[j] = (rand() % 512) - 256;
 	    }
 	}
+	if (!R_AddParticle(&p))
+	    return;
     }
 }
 
@@ -366,7 +426,7 @@ void
 R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 {
     int i, j;
-    particle_t *p;
+    particle_t p;
 #ifdef QW_HACK
     int scale;
 
@@ -378,51 +438,47 @@ R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 	scale = 1;
 #endif
 
+    memset(&p, 0, sizeof(p));
     for (i = 0; i < count; i++) {
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
 #ifdef NQ_HACK
 	if (count == 1024) {	// rocket explosion
-	    p->die = cl.time + 5;
-	    p->color = ramp1[0];
-	    p->ramp = rand() & 3;
+	    p.die = cl.time + 5;
+	    p.color = ramp1[0];
+	    p.ramp = rand() & 3;
 	    if (i & 1) {
-		p->type = pt_explode;
+		p.type = pt_explode;
 		for (j = 0; j < 3; j++) {
-		    p->org[j] = org[j] + ((rand() % 32) - 16);
-		    p->vel[j] = (rand() % 512) - 256;
+		    p.org[j] = org[j] + ((rand() % 32) - 16);
+		    p.vel[j] = (rand() % 512) - 256;
 		}
 	    } else {
-		p->type = pt_explode2;
+		p.type = pt_explode2;
 		for (j = 0; j < 3; j++) {
-		    p->org[j] = org[j] + ((rand() % 32) - 16);
-		    p->vel[j] = (rand() % 512) - 256;
+		    p.org[j] = org[j] + ((rand() % 32) - 16);
+		    p.vel[j] = (rand() % 512) - 256;
 		}
 	    }
 	} else {
-	    p->die = cl.time + 0.1 * (rand() % 5);
-	    p->color = (color & ~7) + (rand() & 7);
-	    p->type = pt_slowgrav;
+	    p.die = cl.time + 0.1 * (rand() % 5);
+	    p.color = (color & ~7) + (rand() & 7);
+	    p.type = pt_slowgrav;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() & 15) - 8);
-		p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+		p.org[j] = org[j] + ((rand() & 15) - 8);
+		p.vel[j] = dir[j] * 15;	// + (rand()%300)-150;
 	    }
 	}
 #endif
 #ifdef QW_HACK
-	p->die = cl.time + 0.1 * (rand() % 5);
-	p->color = (color & ~7) + (rand() & 7);
-	p->type = pt_grav;
+	p.die = cl.time + 0.1 * (rand() % 5);
+	p.color = (color & ~7) + (rand() & 7);
+	p.type = pt_grav;
 	for (j = 0; j < 3; j++) {
-	    p->org[j] = org[j] + scale * ((rand() & 15) - 8);
-	    p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+	    p.org[j] = org[j] + scale * ((rand() & 15) - 8);
+	    p.vel[j] = dir[j] * 15;	// + (rand()%300)-150;
 	}
 #endif
+	if (!R_AddParticle(&p))
+	    return;
     }
 }
 
@@ -437,35 +493,31 @@ void
 R_LavaSplash(vec3_t org)
 {
     int i, j, k;
-    particle_t *p;
+    particle_t p;
     float vel;
     vec3_t dir;
 
+    memset(&p, 0, sizeof(p));
     for (i = -16; i < 16; i++)
 	for (j = -16; j < 16; j++)
 	    for (k = 0; k < 1; k++) {
-		if (!free_particles)
-		    return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 2 + (rand() & 31) * 0.02;
-		p->color = 224 + (rand() & 7);
-		p->type = pt_grav;
+		p.die = cl.time + 2 + (rand() & 31) * 0.02;
+		p.color = 224 + (rand() & 7);
+		p.type = pt_grav;
 
 		dir[0] = j * 8 + (rand() & 7);
 		dir[1] = i * 8 + (rand() & 7);
 		dir[2] = 256;
 
-		p->org[0] = org[0] + dir[0];
-		p->org[1] = org[1] + dir[1];
-		p->org[2] = org[2] + (rand() & 63);
+		p.org[0] = org[0] + dir[0];
+		p.org[1] = org[1] + dir[1];
+		p.org[2] = org[2] + (rand() & 63);
 
 		VectorNormalize(dir);
 		vel = 50 + (rand() & 63);
-		VectorScale(dir, vel, p->vel);
+		VectorScale(dir, vel, p.vel);
+		if (!R_AddParticle(&p))
+		    return;
 	    }
 }
 
@@ -479,35 +531,31 @@ void
 R_TeleportSplash(vec3_t org)
 {
     int i, j, k;
-    particle_t *p;
+    particle_t p;
     float vel;
     vec3_t dir;
 
+    memset(&p, 0, sizeof(p));
     for (i = -16; i < 16; i += 4)
 	for (j = -16; j < 16; j += 4)
 	    for (k = -24; k < 32; k += 4) {
-		if (!free_particles)
-		    return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
-
-		p->die = cl.time + 0.2 + (rand() & 7) * 0.02;
-		p->color = 7 + (rand() & 7);
-		p->type = pt_grav;
+		p.die = cl.time + 0.2 + (rand() & 7) * 0.02;
+		p.color = 7 + (rand() & 7);
+		p.type = pt_grav;
 
 		dir[0] = j * 8;
 		dir[1] = i * 8;
 		dir[2] = k * 8;
 
-		p->org[0] = org[0] + i + (rand() & 3);
-		p->org[1] = org[1] + j + (rand() & 3);
-		p->org[2] = org[2] + k + (rand() & 3);
+		p.org[0] = org[0] + i + (rand() & 3);
+		p.org[1] = org[1] + j + (rand() & 3);
+		p.org[2] = org[2] + k + (rand() & 3);
 
 		VectorNormalize(dir);
 		vel = 50 + (rand() & 63);
-		VectorScale(dir, vel, p->vel);
+		VectorScale(dir, vel, p.vel);
+		if (!R_AddParticle(&p))
+		    return;
 	    }
 }
 
@@ -518,7 +566,7 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
     vec3_t vec;
     float len;
     int j;
-    particle_t *p;
+    particle_t p;
 #ifdef NQ_HACK
     int dec;
 #endif
@@ -534,6 +582,7 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
     }
 #endif
 
+    memset(&p, 0, sizeof(p));
     while (len > 0) {
 #ifdef NQ_HACK
 	len -= dec;
@@ -541,81 +590,113 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
 #ifdef QW_HACK
 	len -= 3;
 #endif
-	if (!free_particles)
-	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	VectorCopy(vec3_origin, p->vel);
-	p->die = cl.time + 2;
+	VectorCopy(vec3_origin, p.vel);
+	p.die = cl.time + 2;
 
 	switch (type) {
 	case 0:		// rocket trail
-	    p->ramp = (rand() & 3);
-	    p->color = ramp3[(int)p->ramp];
-	    p->type = pt_fire;
+	    p.ramp = (rand() & 3);
+	    p.color = ramp3[(int)p.ramp];
+	    p.type = pt_fire;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		p.org[j] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 1:		// smoke smoke
-	    p->ramp = (rand() & 3) + 2;
-	    p->color = ramp3[(int)p->ramp];
-	    p->type = pt_fire;
+	    p.ramp = (rand() & 3) + 2;
+	    p.color = ramp3[(int)p.ramp];
+	    p.type = pt_fire;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		p.org[j] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 2:		// blood
-	    p->type = pt_grav;
-	    p->color = 67 + (rand() & 3);
+	    p.type = pt_grav;
+	    p.color = 67 + (rand() & 3);
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		p.org[j] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 3:
 	case 5:		// tracer
-	    p->die = cl.time + 0.5;
-	    p->type = pt_static;
+	    p.die = cl.time + 0.5;
+	    p.type = pt_static;
 	    if (type == 3)
-		p->color = 52 + ((tracercount & 4) << 1);
+		p.color = 52 + ((tracercount & 4) << 1);
 	    else
-		p->color = 230 + ((tracercount & 4) << 1);
+		p.color = 230 + ((tracercount & 4) << 1);
 
 	    tracercount++;
-	    VectorCopy(start, p->org);
+	    VectorCopy(start, p.org);
 	    if (tracercount & 1) {
-		p->vel[0] = 30 * vec[1];
-		p->vel[1] = 30 * -vec[0];
+		p.vel[0] = 30 * vec[1];
+		p.vel[1] = 30 * -vec[0];
 	    } else {
-		p->vel[0] = 30 * -vec[1];
-		p->vel[1] = 30 * vec[0];
+		p.vel[0] = 30 * -vec[1];
+		p.vel[1] = 30 * vec[0];
 	    }
 	    break;
 
 	case 4:		// slight blood
-	    p->type = pt_grav;
-	    p->color = 67 + (rand() & 3);
+	    p.type = pt_grav;
+	    p.color = 67 + (rand() & 3);
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		p.org[j] = start[j] + ((rand() % 6) - 3);
 	    len -= 3;
 	    break;
 
 	case 6:		// voor trail
-	    p->color = 9 * 16 + 8 + (rand() & 3);
-	    p->type = pt_static;
-	    p->die = cl.time + 0.3;
+	    p.color = 9 * 16 + 8 + (rand() & 3);
+	    p.type = pt_static;
+	    p.die = cl.time + 0.3;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() & 15) - 8);
+		p.org[j] = start[j] + ((rand() & 15) - 8);
 	    break;
 	}
+	if (!R_AddParticle(&p))
+	    return;
 
 	VectorAdd(start, vec, start);
     }
 }
 
+/*
+===============
+R_CompactParticles
+
+Squeeze the particles that have died out of a group, keeping the rest in order
+===============
+*/
+static void
+R_CompactParticles(particlegroup_t *group)
+{
+    const float time = cl.time;
+    int i, j, k;
+
+    for (i = 0; i < group->count; i++)
+	if (group->die[i] < time)
+	    break;
+
+    for (j = i; i < group->count; i++) {
+	if (group->die[i] < time)
+	    continue;
+	for (k = 0; k < 3; k++) {
+	    group->org[k][j] = group->org[k][i];
+	    group->vel[k][j] = group->vel[k][i];
+	}
+	group->color[j] = group->color[i];
+	group->ramp[j] = group->ramp[i];
+	group->die[j] = group->die[i];
+#ifndef GLQUAKE
+	group->viewbits[j] = group->viewbits[i];
+#endif
+	j++;
+    }
+
+    r_numactiveparticles -= group->count - j;
+    group->count = j;
+}
+
 /*
 ===============
 CL_RunParticles
@@ -624,12 +705,14 @@ CL_RunParticles
 void
 CL_RunParticles(void)
 {
-    particle_t *p, *kill;
+    particlegroup_t *group;
     float grav;
     float time1, time2, time3;
     float frametime;
     float dvel;
-    int i;
+    float *ramp, *color, *die, *vel[3];
+    ptype_t type;
+    int i, j, count;
 
 #ifdef NQ_HACK
     frametime = cl.time - cl.oldtime;
@@ -644,87 +727,182 @@ CL_RunParticles(void)
     time1 = frametime * 5;
     dvel = 4 * frametime;
 
-    for (;;) {
-	kill = active_particles;
-	if (kill && kill->die < cl.time) {
-	    active_particles = kill->next;
-	    kill->next = free_particles;
-	    free_particles = kill;
-	    continue;
-	}
-	break;
-    }
+    for (type = 0; type < pt_numtypes; type++) {
+	group = &r_particlegroups[type];
+	R_CompactParticles(group);
 
-    for (p = active_particles; p; p = p->next) {
-	for (;;) {
-	    kill = p->next;
-	    if (kill && kill->die < cl.time) {
-		p->next = kill->next;
-		kill->next = free_particles;
-		free_particles = kill;
-		continue;
-	    }
-	    break;
-	}
+	count = group->count;
+	ramp = group->ramp;
+	color = group->color;
+	die = group->die;
+	for (j = 0; j < 3; j++) {
+	    float *org = group->org[j];
 
-	p->org[0] += p->vel[0] * frametime;
-	p->org[1] += p->vel[1] * frametime;
-	p->org[2] += p->vel[2] * frametime;
+	    vel[j] = group->vel[j];
+	    for (i = 0; i < count; i++)
+		org[i] += vel[j][i] * frametime;
+	}
 
-	switch (p->type) {
+	switch (type) {
 	case pt_static:
 	    break;
+
 	case pt_fire:
-	    p->ramp += time1;
-	    if (p->ramp >= 6)
-		p->die = -1;
-	    else
-		p->color = ramp3[(int)p->ramp];
-	    p->vel[2] += grav;
+	    for (i = 0; i < count; i++) {
+		ramp[i] += time1;
+		if (ramp[i] >= 6)
+		    die[i] = -1;
+		else
+		    color[i] = ramp3[(int)ramp[i]];
+		vel[2][i] += grav;
+	    }
 	    break;
 
 	case pt_explode:
-	    p->ramp += time2;
-	    if (p->ramp >= 8)
-		p->die = -1;
-	    else
-		p->color = ramp1[(int)p->ramp];
-	    for (i = 0; i < 3; i++)
-		p->vel[i] += p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+	    for (i = 0; i < count; i++) {
+		ramp[i] += time2;
+		if (ramp[i] >= 8)
+		    die[i] = -1;
+		else
+		    color[i] = ramp1[(int)ramp[i]];
+	    }
+	    for (j = 0; j < 3; j++)
+		for (i = 0; i < count; i++)
+		    vel[j][i] += vel[j][i] * dvel;
+	    for (i = 0; i < count; i++)
+		vel[2][i] -= grav;
 	    break;
 
 	case pt_explode2:
-	    p->ramp += time3;
-	    if (p->ramp >= 8)
-		p->die = -1;
-	    else
-		p->color = ramp2[(int)p->ramp];
-	    for (i = 0; i < 3; i++)
-		p->vel[i] -= p->vel[i] * frametime;
-	    p->vel[2] -= grav;
+	    for (i = 0; i < count; i++) {
+		ramp[i] += time3;
+		if (ramp[i] >= 8)
+		    die[i] = -1;
+		else
+		    color[i] = ramp2[(int)ramp[i]];
+	    }
+	    for (j = 0; j < 3; j++)
+		for (i = 0; i < count; i++)
+		    vel[j][i] -= vel[j][i] * frametime;
+	    for (i = 0; i < count; i++)
+		vel[2][i] -= grav;
 	    break;
 
 	case pt_blob:
-	    for (i = 0; i < 3; i++)
-		p->vel[i] += p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+	    for (j = 0; j < 3; j++)
+		for (i = 0; i < count; i++)
+		    vel[j][i] += vel[j][i] * dvel;
+	    for (i = 0; i < count; i++)
+		vel[2][i] -= grav;
 	    break;
 
 	case pt_blob2:
-	    for (i = 0; i < 2; i++)
-		p->vel[i] -= p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+	    for (j = 0; j < 2; j++)
+		for (i = 0; i < count; i++)
+		    vel[j][i] -= vel[j][i] * dvel;
+	    for (i = 0; i < count; i++)
+		vel[2][i] -= grav;
 	    break;
 
 	case pt_slowgrav:
 	case pt_grav:
-	    p->vel[2] -= grav;
+	    for (i = 0; i < count; i++)
+		vel[2][i] -= grav;
+	    break;
+
+	default:
 	    break;
 	}
     }
 }
 
+#ifdef GLQUAKE
+/*
+ * GL particles are written into a vertex array, a stream buffer object
+ * mapped each frame when there is one, and drawn with one glDrawArrays per
+ * batch of triangles instead of a glBegin/glEnd per particle.
+ */
+typedef struct {
+    float xyz[3];
+    float st[2];
+    byte color[4];
+} particlevert_t;
+
+#define PARTICLE_BATCH 4096	/* particles per draw call */
+
+static particlevert_t particle_verts[PARTICLE_BATCH * 3];
+static GLuint particle_buffer;
+static qboolean particle_mapped;
+
+static particlevert_t *
+R_MapParticleVerts(void)
+{
+    particlevert_t *verts;
+
+    if (gl_vboable) {
+	if (!particle_buffer)
+	    qglGenBuffersARB(1, &particle_buffer);
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, particle_buffer);
+	qglBufferDataARB(GL_ARRAY_BUFFER_ARB, sizeof(particle_verts), NULL,
+			 GL_STREAM_DRAW_ARB);
+	verts = qglMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	if (verts) {
+	    particle_mapped = true;
+	    return verts;
+	}
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+    }
+    particle_mapped = false;
+
+    return particle_verts;
+}
+
+static void
+R_DrawParticleVerts(int numverts)
+{
+    const byte *base = (const byte *)particle_verts;
+
+    if (particle_mapped) {
+	base = NULL;
+	if (!qglUnmapBufferARB(GL_ARRAY_BUFFER_ARB))
+	    numverts = 0;	/* contents were lost */
+    }
+
+    if (numverts) {
+	glVertexPointer(3, GL_FLOAT, sizeof(particlevert_t),
+			base + offsetof(particlevert_t, xyz));
+	glTexCoordPointer(2, GL_FLOAT, sizeof(particlevert_t),
+			  base + offsetof(particlevert_t, st));
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(particlevert_t),
+		       base + offsetof(particlevert_t, color));
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glDrawArrays(GL_TRIANGLES, 0, numverts);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    if (particle_mapped)
+	qglBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+}
+
+static particlevert_t *
+R_ParticleVert(particlevert_t *vert, const vec3_t org, const vec3_t offset,
+	       float scale, float s, float t, const byte *color)
+{
+    vert->xyz[0] = org[0] + offset[0] * scale;
+    vert->xyz[1] = org[1] + offset[1] * scale;
+    vert->xyz[2] = org[2] + offset[2] * scale;
+    vert->st[0] = s;
+    vert->st[1] = t;
+    memcpy(vert->color, color, 4);
+
+    return vert + 1;
+}
+#endif
+
 /*
 ===============
 R_DrawParticles
@@ -733,16 +911,19 @@ R_DrawParticles
 void
 R_DrawParticles(void)
 {
-    particle_t *p;
+    const particlegroup_t *group;
+    int type;
 
 #ifdef GLQUAKE
-#ifdef QW_HACK
-    unsigned char *at;
-    unsigned char theAlpha;
-#endif
+    particlevert_t *verts, *vert;
+    byte color[4];
     qboolean alphaTestEnabled;
-    vec3_t up, right;
+    vec3_t org, up, right;
     float scale;
+    int i, batched;
+
+    if (!r_numactiveparticles)
+	return;
 
 #ifdef NQ_HACK
     /*
@@ -761,10 +942,11 @@ R_DrawParticles(void)
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
     glDepthMask(GL_FALSE);
 
-    glBegin(GL_TRIANGLES);
-
     VectorScale(vup, 1.5, up);
     VectorScale(vright, 1.5, right);
+
+    verts = vert = R_MapParticleVerts();
+    batched = 0;
 #else
     D_StartParticles();
 
@@ -773,45 +955,47 @@ R_DrawParticles(void)
     VectorCopy(vpn, r_ppn);
 #endif
 
-    for (p = active_particles; p; p = p->next) {
-
+    for (type = 0; type < pt_numtypes; type++) {
+	group = &r_particlegroups[type];
 #ifdef GLQUAKE
-	// hack a scale up to keep particles from disapearing
-	scale =
-	    (p->org[0] - r_origin[0]) * vpn[0] + (p->org[1] -
-						  r_origin[1]) * vpn[1]
-	    + (p->org[2] - r_origin[2]) * vpn[2];
-	if (scale < 20)
-	    scale = 1;
-	else
-	    scale = 1 + scale * 0.004;
+	for (i = 0; i < group->count; i++) {
+	    org[0] = group->org[0][i];
+	    org[1] = group->org[1][i];
+	    org[2] = group->org[2][i];
+
+	    // hack a scale up to keep particles from disapearing
+	    scale =
+		(org[0] - r_origin[0]) * vpn[0] + (org[1] -
+						   r_origin[1]) * vpn[1]
+		+ (org[2] - r_origin[2]) * vpn[2];
+	    if (scale < 20)
+		scale = 1;
+	    else
+		scale = 1 + scale * 0.004;
+	    memcpy(color, &d_8to24table[(int)group->color[i]], 3);
+	    color[3] = 255;
 #ifdef QW_HACK
-	at = (byte *)&d_8to24table[(int)p->color];
-	if (p->type == pt_fire)
-	    theAlpha = 255 * (6 - p->ramp) / 6;
-	else
-	    theAlpha = 255;
-	glColor4ub(*at, *(at + 1), *(at + 2), theAlpha);
+	    if (type == pt_fire)
+		color[3] = 255 * (6 - group->ramp[i]) / 6;
 #endif
-#ifdef NQ_HACK
-	glColor3ubv((byte *)&d_8to24table[(int)p->color]);
-#endif
-	glTexCoord2f(0, 0);
-	glVertex3fv(p->org);
-	glTexCoord2f(1, 0);
-	glVertex3f(p->org[0] + up[0] * scale, p->org[1] + up[1] * scale,
-		   p->org[2] + up[2] * scale);
-	glTexCoord2f(0, 1);
-	glVertex3f(p->org[0] + right[0] * scale,
-		   p->org[1] + right[1] * scale,
-		   p->org[2] + right[2] * scale);
+	    vert = R_ParticleVert(vert, org, vec3_origin, 0, 0, 0, color);
+	    vert = R_ParticleVert(vert, org, up, scale, 1, 0, color);
+	    vert = R_ParticleVert(vert, org, right, scale, 0, 1, color);
+
+	    if (++batched == PARTICLE_BATCH) {
+		R_DrawParticleVerts(vert - verts);
+		verts = vert = R_MapParticleVerts();
+		batched = 0;
+	    }
+	}
 #else
-	D_DrawParticle(p);
+	D_DrawParticles(group);
 #endif
     }
 
 #ifdef GLQUAKE
-    glEnd();
+    R_DrawParticleVerts(vert - verts);
+    glColor4f(1, 1, 1, 1);
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
     if (alphaTestEnabled)
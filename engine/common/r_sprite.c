@@ -161,6 +161,7 @@ R_SetupAndDrawSprite()
 {
     int i, nump;
     float dot, scale, *pv;
+    float minu, minv, maxu, maxv;
     vec5_t *pverts;
     vec3_t left, up, right, down, transformed, local;
     emitpoint_t outverts[MAXWORKINGVERTS + 1], *pout;
@@ -218,6 +219,8 @@ R_SetupAndDrawSprite()
 // transform vertices into viewspace and project
     pv = &clip_verts[clip_current][0][0];
     r_spritedesc.nearzi = -999999;
+    minu = minv = 99999;
+    maxu = maxv = -99999;
 
     for (i = 0; i < nump; i++) {
 	VectorSubtract(pv, r_origin, local);
@@ -240,9 +243,19 @@ R_SetupAndDrawSprite()
 	scale = yscale * pout->zi;
 	pout->v = (ycenter - scale * transformed[1]);
 
+	minu = qmin(minu, pout->u);
+	maxu = qmax(maxu, pout->u);
+	minv = qmin(minv, pout->v);
+	maxv = qmax(maxv, pout->v);
+
 	pv += sizeof(vec5_t) / sizeof(*pv);
     }
 
+// skip it if the world is nearer everywhere it would be drawn
+    if (R_Occluded(floor(minu) - 1, floor(minv) - 1, ceil(maxu) + 1,
+		   ceil(maxv) + 1, 1.0 / r_spritedesc.nearzi))
+	return;
+
 // draw it
     r_spritedesc.nump = nump;
     r_spritedesc.pverts = outverts;
@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "r_local.h"
 #include "sys.h"
+#include "d_local.h"
 
 drawsurf_t r_drawsurf;
 
@@ -54,69 +55,46 @@ static void (*surfmiptable[4]) (void) = {
     R_DrawSurfaceBlock8_mip3
 };
 
+static void R_DrawSurfaceBlockSIMD_mip0(void);
+static void R_DrawSurfaceBlockSIMD_mip1(void);
+
 static unsigned blocklights[18 * 18];
 
 /*
 ===============
 R_AddDynamicLights
+
+Each light only over the lightmap samples it can reach
 ===============
 */
 static void
 R_AddDynamicLights(void)
 {
-    msurface_t *surf;
-    int lnum;
+    const surfdlight_t *light;
     int sd, td;
-    float dist, rad, minlight;
-    vec3_t impact, local;
+    float dist;
     int s, t;
     int i;
-    int smax, tmax;
-    mtexinfo_t *tex;
-
-    surf = r_drawsurf.surf;
-    smax = (surf->extents[0] >> 4) + 1;
-    tmax = (surf->extents[1] >> 4) + 1;
-    tex = surf->texinfo;
-
-    for (lnum = 0; lnum < MAX_DLIGHTS; lnum++) {
-	if (!(surf->dlightbits & (1 << lnum)))
-	    continue;		// not lit by this light
-
-	rad = cl_dlights[lnum].radius;
-	dist = DotProduct(cl_dlights[lnum].origin, surf->plane->normal) -
-	    surf->plane->dist;
-	rad -= fabs(dist);
-	minlight = cl_dlights[lnum].minlight;
-	if (rad < minlight)
-	    continue;
-	minlight = rad - minlight;
-
-	for (i = 0; i < 3; i++) {
-	    impact[i] = cl_dlights[lnum].origin[i] -
-		surf->plane->normal[i] * dist;
-	}
-
-	local[0] = DotProduct(impact, tex->vecs[0]) + tex->vecs[0][3];
-	local[1] = DotProduct(impact, tex->vecs[1]) + tex->vecs[1][3];
+    int smax;
 
-	local[0] -= surf->texturemins[0];
-	local[1] -= surf->texturemins[1];
+    smax = (r_drawsurf.surf->extents[0] >> 4) + 1;
 
-	for (t = 0; t < tmax; t++) {
-	    td = local[1] - t * 16;
+    for (i = 0; i < r_drawsurf.numdlights; i++) {
+	light = &r_drawsurf.dlights[i];
+	for (t = light->tmin; t <= light->tmax; t++) {
+	    td = light->local[1] - t * 16;
 	    if (td < 0)
 		td = -td;
-	    for (s = 0; s < smax; s++) {
-		sd = local[0] - s * 16;
+	    for (s = light->smin; s <= light->smax; s++) {
+		sd = light->local[0] - s * 16;
 		if (sd < 0)
 		    sd = -sd;
 		if (sd > td)
 		    dist = sd + (td >> 1);
 		else
 		    dist = td + (sd >> 1);
-		if (dist < minlight)
-		    blocklights[t * smax + s] += (rad - dist) * 256;
+		if (dist < light->minlight)
+		    blocklights[t * smax + s] += (light->rad - dist) * 256;
 	    }
 	}
     }
@@ -167,7 +145,7 @@ R_BuildLightMap(void)
 	    lightmap += size;	// skip to next lightmap
 	}
 // add all the dynamic lights
-    if (surf->dlightframe == r_framecount)
+    if (r_drawsurf.numdlights)
 	R_AddDynamicLights();
 
 // bound, invert, and shift
@@ -231,6 +209,7 @@ R_DrawSurface(void)
     int u;
     int soffset, basetoffset, texwidth;
     int horzblockstep;
+    int ublock, vblock, lastublock;
     unsigned char *pcolumndest;
     void (*pblockdrawer) (void);
     texture_t *mt;
@@ -258,10 +237,25 @@ R_DrawSurface(void)
     r_numhblocks = r_drawsurf.surfwidth >> blockdivshift;
     r_numvblocks = r_drawsurf.surfheight >> blockdivshift;
 
+    /*
+     * Each block is lit from the lightmap samples at its corners, so only
+     * the blocks touching the changed samples are drawn again.
+     */
+    ublock = qmax(r_drawsurf.lightrect[0] - 1, 0);
+    vblock = qmax(r_drawsurf.lightrect[1] - 1, 0);
+    lastublock = qmin(r_drawsurf.lightrect[2], r_numhblocks - 1);
+    r_numvblocks = qmin(r_drawsurf.lightrect[3], r_numvblocks - 1) - vblock + 1;
+    if (ublock > lastublock || r_numvblocks <= 0)
+	return;
+
 //==============================
 
     if (r_pixbytes == 1) {
 	pblockdrawer = surfmiptable[r_drawsurf.surfmip];
+	if (d_simdkernels && r_drawsurf.surfmip == 0)
+	    pblockdrawer = R_DrawSurfaceBlockSIMD_mip0;
+	else if (d_simdkernels && r_drawsurf.surfmip == 1)
+	    pblockdrawer = R_DrawSurfaceBlockSIMD_mip1;
 	// TODO: only needs to be set when there is a display settings change
 	horzblockstep = blocksize;
     } else {
@@ -282,14 +276,17 @@ R_DrawSurface(void)
     basetoffset = r_drawsurf.surf->texturemins[1];
 
 // << 16 components are to guarantee positive values for %
-    soffset = ((soffset >> r_drawsurf.surfmip) + (smax << 16)) % smax;
+    soffset = ((soffset >> r_drawsurf.surfmip) + ublock * blocksize
+	       + (smax << 16)) % smax;
     basetptr = &r_source[((((basetoffset >> r_drawsurf.surfmip)
-			    + (tmax << 16)) % tmax) * twidth)];
+			    + vblock * blocksize + (tmax << 16)) % tmax)
+			  * twidth)];
 
-    pcolumndest = r_drawsurf.surfdat;
+    pcolumndest = r_drawsurf.surfdat + vblock * blocksize * surfrowbytes
+	+ ublock * horzblockstep;
 
-    for (u = 0; u < r_numhblocks; u++) {
-	r_lightptr = blocklights + u;
+    for (u = ublock; u <= lastublock; u++) {
+	r_lightptr = blocklights + vblock * r_lightwidth + u;
 
 	prowdestbase = pcolumndest;
 
@@ -310,6 +307,59 @@ R_DrawSurface(void)
 
 #ifndef USE_X86_ASM
 
+#ifndef USE_X86_ASM
+
+/*
+================
+R_DrawSurfaceBlockSIMD
+
+The mip 0 and 1 blocks, a whole block at a time with the surfaceblock kernel
+================
+*/
+static inline void
+R_DrawSurfaceBlockSIMD(const int size, const int shift)
+{
+    dsurfblock_t block;
+    int v;
+
+    block.pdest = prowdestbase;
+    block.destrowbytes = surfrowbytes;
+    block.psource = pbasesource;
+    block.sourcerowbytes = sourcetstep;
+    block.colormap = vid.colormap;
+    block.size = size;
+    block.shift = shift;
+
+    for (v = 0; v < r_numvblocks; v++) {
+	block.lightleft = r_lightptr[0];
+	block.lightright = r_lightptr[1];
+	r_lightptr += r_lightwidth;
+	block.lightleftstep = (r_lightptr[0] - block.lightleft) >> shift;
+	block.lightrightstep = (r_lightptr[1] - block.lightright) >> shift;
+
+	d_simdkernels->surfaceblock(&block);
+
+	block.psource += sourcetstep * size;
+	block.pdest += surfrowbytes * size;
+	if (block.psource >= r_sourcemax)
+	    block.psource -= r_stepback;
+    }
+}
+
+static void
+R_DrawSurfaceBlockSIMD_mip0(void)
+{
+    R_DrawSurfaceBlockSIMD(16, 4);
+}
+
+static void
+R_DrawSurfaceBlockSIMD_mip1(void)
+{
+    R_DrawSurfaceBlockSIMD(8, 3);
+}
+
+#endif /* USE_X86_ASM */
+
 /*
 ================
 R_DrawSurfaceBlock8_mip0
@@ -25,8 +25,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "common.h"
 #include "console.h"
 #include "draw.h"
+#include "fisheye.h"
+#include "imgwrite.h"
 #include "keys.h"
 #include "menu.h"
+#include "palette.h"
 #include "quakedef.h"
 #include "sbar.h"
 #include "screen.h"
@@ -119,6 +122,12 @@ static cvar_t scr_showram = { "showram", "1" };
 static cvar_t scr_showturtle = { "showturtle", "0" };
 static cvar_t scr_showpause = { "showpause", "1" };
 static cvar_t show_fps = { "show_fps", "0" };	/* set for running times */
+static cvar_t show_cache = { "show_cache", "0" };
+#ifdef GLQUAKE
+static cvar_t scr_shotformat = { "scr_shotformat", "tga", true };
+#else
+static cvar_t scr_shotformat = { "scr_shotformat", "pcx", true };
+#endif
 #ifdef GLQUAKE
 static cvar_t gl_triplebuffer = { "gl_triplebuffer", "1", true };
 #else
@@ -242,6 +251,28 @@ SCR_DrawFPS(void)
     Draw_String(x, y, st);
 }
 
+static void
+SCR_DrawCacheStats(void)
+{
+    const cachestats_t *stats;
+    int i, x, y;
+    char st[80];
+
+    if (!show_cache.value)
+	return;
+
+    y = 8;
+    for (i = 0; i < CACHE_TYPES; i++) {
+	stats = &cache_stats[i];
+	snprintf(st, sizeof(st), "%s %d/%d/%d/%d", cache_typenames[i],
+		 stats->allocs, stats->evictions, stats->moves,
+		 stats->reloads);
+	x = vid.width - strlen(st) * 8 - 8;
+	Draw_String(x, y, st);
+	y += 8;
+    }
+}
+
 
 /*
 ==============
@@ -671,7 +702,7 @@ SCR_SizeDown_f(void)
 ==============================================================================
 */
 
-#if !defined(NQ_HACK) || !defined(GLQUAKE)
+#ifdef QW_HACK
 /*
 ==============
 WritePCXfile
@@ -756,40 +787,27 @@ WritePCXfile(const char *filename, const byte *data, int width, int height,
 
     COM_WriteFile(filename, pcx, length);
 }
-#endif /* !defined(NQ_HACK) && !defined(GLQUAKE) */
 
-
-#ifdef QW_HACK
 /*
 Find closest color in the palette for named color
 */
 static int
 MipColor(int r, int g, int b)
 {
-    int i;
-    float dist;
     int best;
-    float bestdist;
-    int r1, g1, b1;
     static int lr = -1, lg = -1, lb = -1;
     static int lastbest;
+    static palsearch_t search;
+    static qboolean searchinit;
 
     if (r == lr && g == lg && b == lb)
 	return lastbest;
 
-    bestdist = 256 * 256 * 3;
-
-    best = 0;			// FIXME - Uninitialised? Zero ok?
-    for (i = 0; i < 256; i++) {
-	r1 = host_basepal[i * 3] - r;
-	g1 = host_basepal[i * 3 + 1] - g;
-	b1 = host_basepal[i * 3 + 2] - b;
-	dist = r1 * r1 + g1 * g1 + b1 * b1;
-	if (dist < bestdist) {
-	    bestdist = dist;
-	    best = i;
-	}
+    if (!searchinit) {
+	Pal_InitSearch(&search, host_basepal, 3);
+	searchinit = true;
     }
+    best = Pal_FindClosest(&search, r, g, b);
     lr = r;
     lg = g;
     lb = b;
@@ -1052,6 +1070,27 @@ typedef struct _TargaHeader {
 int glx, gly, glwidth, glheight;
 #endif
 
+/*
+==================
+SCR_ShotFormat
+
+Format for screenshots and globe saves, from scr_shotformat
+==================
+*/
+imgformat_t
+SCR_ShotFormat(void)
+{
+    if (!strcasecmp(scr_shotformat.string, "png"))
+	return IMG_PNG;
+    if (!strcasecmp(scr_shotformat.string, "tga"))
+	return IMG_TGA;
+#ifdef GLQUAKE
+    return IMG_TGA;		/* there is no palette to write a pcx */
+#else
+    return IMG_PCX;
+#endif
+}
+
 /*
 ==================
 SCR_ScreenShot_f
@@ -1060,87 +1099,57 @@ SCR_ScreenShot_f
 static void
 SCR_ScreenShot_f(void)
 {
+    imgformat_t format;
+    char shotname[80];
+    char checkname[MAX_OSPATH];
+    int i;
 #ifdef GLQUAKE
     byte *buffer;
-    char tganame[80];
-    char checkname[MAX_OSPATH];
-    int i, c, temp;
+#endif
 
 //
 // find a file name to save it to
 //
-    strcpy(tganame, "quake00.tga");
+    format = SCR_ShotFormat();
+    snprintf(shotname, sizeof(shotname), "quake00.%s", IMG_Extension(format));
 
     for (i = 0; i <= 99; i++) {
-	tganame[5] = i / 10 + '0';
-	tganame[6] = i % 10 + '0';
-	sprintf(checkname, "%s/%s", com_gamedir, tganame);
+	shotname[5] = i / 10 + '0';
+	shotname[6] = i % 10 + '0';
+	sprintf(checkname, "%s/%s", com_gamedir, shotname);
 	if (Sys_FileTime(checkname) == -1)
 	    break;		// file doesn't exist
     }
     if (i == 100) {
-	Con_Printf("%s: Couldn't create a TGA file\n", __func__);
+	Con_Printf("%s: Couldn't create a %s file\n", __func__,
+		   IMG_Extension(format));
 	return;
     }
 
-    /* Construct the TGA header */
-    buffer = malloc(glwidth * glheight * 3 + 18);
-    memset(buffer, 0, 18);
-    buffer[2] = 2;		// uncompressed type
-    buffer[12] = glwidth & 255;
-    buffer[13] = glwidth >> 8;
-    buffer[14] = glheight & 255;
-    buffer[15] = glheight >> 8;
-    buffer[16] = 24;		// pixel size
-
-    glReadPixels(glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE,
-		 buffer + 18);
-
-    // swap rgb to bgr
-    c = 18 + glwidth * glheight * 3;
-    for (i = 18; i < c; i += 3) {
-	temp = buffer[i];
-	buffer[i] = buffer[i + 2];
-	buffer[i + 2] = temp;
-    }
-    COM_WriteFile(tganame, buffer, glwidth * glheight * 3 + 18);
-
-    free(buffer);
-    Con_Printf("Wrote %s\n", tganame);
-#else
-    int i;
-    char pcxname[80];
-    char checkname[MAX_OSPATH];
-
 //
-// find a file name to save it to
+// copy the screen and write it in the background ("Wrote" comes later)
 //
-    strcpy(pcxname, "quake00.pcx");
-
-    for (i = 0; i <= 99; i++) {
-	pcxname[5] = i / 10 + '0';
-	pcxname[6] = i % 10 + '0';
-	sprintf(checkname, "%s/%s", com_gamedir, pcxname);
-	if (Sys_FileTime(checkname) == -1)
-	    break;		// file doesn't exist
-    }
-    if (i == 100) {
-	Con_Printf("%s: Couldn't create a PCX file\n", __func__);
+#ifdef GLQUAKE
+    buffer = malloc(glwidth * glheight * 3);
+    if (!buffer) {
+	Con_Printf("%s: not enough memory\n", __func__);
 	return;
     }
-//
-// save the pcx file
-//
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(glx, gly, glwidth, glheight, GL_RGB, GL_UNSIGNED_BYTE,
+		 buffer);
+    IMG_SaveAsync(shotname, format, buffer, glwidth, glheight, glwidth * 3,
+		  3, NULL, true);
+    free(buffer);
+#else
     D_EnableBackBufferAccess();	// enable direct drawing of console to back
     //  buffer
 
-    WritePCXfile(pcxname, vid.buffer, vid.width, vid.height, vid.rowbytes,
-		 host_basepal, false);
+    IMG_SaveAsync(shotname, format, vid.buffer, vid.width, vid.height,
+		  vid.rowbytes, 1, host_basepal, false);
 
     D_DisableBackBufferAccess();	// for adapters that can't stay mapped in
     //  for linear writes all the time
-
-    Con_Printf("Wrote %s\n", pcxname);
 #endif
 }
 
@@ -1256,7 +1265,11 @@ SCR_UpdateScreen(void)
     static float old_viewsize, old_fov;
 #ifndef GLQUAKE
     vrect_t vrect;
+#endif
+
+    IMG_Poll();
 
+#ifndef GLQUAKE
     if (scr_skipupdate)
 	return;
 #endif
@@ -1406,6 +1419,9 @@ SCR_UpdateScreen(void)
 	SCR_DrawRam();
 	SCR_DrawNet();
 	SCR_DrawFPS();
+	SCR_DrawCacheStats();
+	if (fisheye_enabled)
+	    F_DrawSpeeds();
 	SCR_DrawTurtle();
 	SCR_DrawPause();
 	SCR_DrawCenterString();
@@ -1424,6 +1440,7 @@ SCR_UpdateScreen(void)
     V_UpdatePalette();
 
 #ifdef GLQUAKE
+    Draw_FlushBatch();
     GL_EndRendering();
 #else
     /*
@@ -1491,6 +1508,8 @@ SCR_Init(void)
     Cvar_RegisterVariable(&scr_centertime);
     Cvar_RegisterVariable(&scr_printspeed);
     Cvar_RegisterVariable(&show_fps);
+    Cvar_RegisterVariable(&show_cache);
+    Cvar_RegisterVariable(&scr_shotformat);
 #ifdef GLQUAKE
     Cvar_RegisterVariable(&gl_triplebuffer);
 #endif
@@ -22,6 +22,14 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  * snd_dma.c -- main control for any streaming sound output device
  */
 
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "bspfile.h"
 #include "client.h"
 #include "cmd.h"
@@ -37,12 +45,24 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "host.h"
 #endif
 
+/* as in snd_mix.c, for respatializing the channels four at a time */
+#if !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__x86_64__)
+#define SND_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__aarch64__)
+#define SND_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 /* FIXME - reorder to remove forward decls? */
 static void S_Play(void);
 static void S_PlayVol(void);
 static void S_SoundList(void);
 static void S_Update_();
 static void S_StopAllSoundsC(void);
+static void S_StartMixer(void);
+static void S_StopMixer(void);
+static qboolean S_OnMixerThread(void);
 
 /*
  * Internal sound data & structures
@@ -65,12 +85,57 @@ static vec3_t listener_right;
 static vec3_t listener_up;
 static vec_t sound_nominal_clip_dist = 1000.0;
 
+/* the listener as last posted, for spatializing on the mixing side */
+static struct {
+    vec3_t origin;
+    vec3_t right;
+    int viewentity;
+} mix_listener;
+
+/* the client's side of the ambient and static sounds */
+#define MAX_STATIC_SOUNDS (MAX_CHANNELS - MAX_DYNAMIC_CHANNELS - NUM_AMBIENTS)
+static int ambient_vol[NUM_AMBIENTS];	/* faded toward the leaf's levels */
+static sfx_t *static_sfx[MAX_STATIC_SOUNDS];
+static int num_static_sounds;
+static volatile int audible_channels;	/* for snd_show */
+
+/*
+ * The mixer thread, when there is one; see MIXER THREAD below.  Commands
+ * are read at head and posted at tail.
+ */
+#define SND_QUEUE 256		/* must be a power of two */
+
+struct sndcmd_s;
+
+static struct {
+    qboolean started;
+    volatile qboolean quit;
+    volatile qboolean restart;	/* the mixer lost the device */
+    struct sndcmd_s *queue;
+    volatile unsigned head, tail;
+#ifdef _WIN32
+    HANDLE thread;
+    DWORD threadid;
+    CRITICAL_SECTION lock;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+#endif
+} snd_mixer;
+
 static int soundtime;		/* sample PAIRS */
 int paintedtime;		/* sample PAIRS */
 
-#define	MAX_SFX 512
-static sfx_t *known_sfx;	/* hunk allocated [MAX_SFX] */
+/*
+ * Known sounds are allocated in blocks which are never moved or freed, since
+ * channels and the precache lists hold on to the sfx_t pointers.
+ */
+#define SFX_BLOCK	256
+#define SFX_HASH_SIZE	1024	/* must be a power of two */
+static sfx_t **known_sfx;	/* [num_sfx_blocks][SFX_BLOCK] */
+static int num_sfx_blocks;
 static int num_sfx;
+static sfx_t *sfx_hash[SFX_HASH_SIZE];
 
 static sfx_t *ambient_sfx[NUM_AMBIENTS];
 
@@ -129,6 +194,8 @@ S_SoundInfo_f(void)
     Con_Printf("%5d speed\n", shm->speed);
     Con_Printf("%p dma buffer\n", shm->buffer);
     Con_Printf("%5d total_channels\n", total_channels);
+    Con_Printf("mixing on the %s thread\n",
+	       snd_mixer.started ? "mixer" : "main");
 }
 
 /*
@@ -144,6 +211,8 @@ S_Startup(void)
 
     if (!snd_initialized)
 	return;
+    if (S_OnMixerThread())
+	return;			/* S_Shutdown asked for the restart */
     if (!fakedma) {
 	rc = SNDDMA_Init();
 	if (!rc) {
@@ -187,6 +256,7 @@ S_Init(void)
     Cvar_RegisterVariable(&snd_noextraupdate);
     Cvar_RegisterVariable(&snd_show);
     Cvar_RegisterVariable(&_snd_mixahead);
+    S_InitSoundCache();
 
     if (host_parms.memsize < 0x800000) {
 	Cvar_Set("loadas8bit", "1");
@@ -199,9 +269,6 @@ S_Init(void)
 
     SND_InitScaletable();
 
-    known_sfx = Hunk_AllocName(MAX_SFX * sizeof(sfx_t), "sfx_t");
-    num_sfx = 0;
-
     /* create a piece of DMA memory */
     if (fakedma) {
 	shm = (void *)Hunk_AllocName(sizeof(*shm), "shm");
@@ -227,6 +294,8 @@ S_Init(void)
     ambient_sfx[AMBIENT_SKY] = S_PrecacheSound("ambience/wind2.wav");
 
     S_StopAllSounds(true);
+
+    S_StartMixer();
 }
 
 
@@ -240,6 +309,16 @@ S_Shutdown(void)
     if (!sound_started)
 	return;
 
+    /*
+     * The mixer can't stop itself; it stops mixing and the main thread
+     * reopens the device in S_Update.
+     */
+    if (S_OnMixerThread()) {
+	snd_mixer.restart = true;
+	return;
+    }
+    S_StopMixer();
+
     shm = 0;
     sound_started = 0;
 
@@ -256,7 +335,7 @@ S_Shutdown(void)
 static sfx_t *
 S_FindName(const char *name)
 {
-    int i;
+    unsigned bucket;
     sfx_t *sfx;
 
     if (!name)
@@ -265,15 +344,26 @@ S_FindName(const char *name)
 	Sys_Error("%s: name too long: %s", __func__, name);
 
     /* see if already loaded */
-    for (i = 0; i < num_sfx; i++)
-	if (!strcmp(known_sfx[i].name, name))
-	    return &known_sfx[i];
-
-    if (num_sfx == MAX_SFX)
-	Sys_Error("%s: out of sfx_t", __func__);
+    bucket = COM_HashFileName(name) & (SFX_HASH_SIZE - 1);
+    for (sfx = sfx_hash[bucket]; sfx; sfx = sfx->hashnext)
+	if (!strcmp(sfx->name, name))
+	    return sfx;
+
+    if (num_sfx == num_sfx_blocks * SFX_BLOCK) {
+	known_sfx = realloc(known_sfx,
+			    (num_sfx_blocks + 1) * sizeof(*known_sfx));
+	if (!known_sfx)
+	    Sys_Error("%s: out of memory", __func__);
+	known_sfx[num_sfx_blocks] = calloc(SFX_BLOCK, sizeof(sfx_t));
+	if (!known_sfx[num_sfx_blocks])
+	    Sys_Error("%s: out of memory", __func__);
+	num_sfx_blocks++;
+    }
 
-    sfx = &known_sfx[i];
+    sfx = &known_sfx[num_sfx / SFX_BLOCK][num_sfx % SFX_BLOCK];
     strcpy(sfx->name, name);
+    sfx->hashnext = sfx_hash[bucket];
+    sfx_hash[bucket] = sfx;
 
     num_sfx++;
 
@@ -315,7 +405,7 @@ S_PrecacheSound(const char *name)
 
     /* cache it in */
     if (precache.value)
-	S_LoadSound(sfx);
+	S_PreloadSound(sfx);
 
     return sfx;
 }
@@ -348,16 +438,9 @@ SND_PickChannel(int entnum, int entchannel)
 	    break;
 	}
 	/* don't let monster sounds override player sounds */
-#ifdef NQ_HACK
-	if (channel->entnum == cl.viewentity
-	    && entnum != cl.viewentity && channel->sfx)
-	    continue;
-#endif
-#ifdef QW_HACK
-	if (channel->entnum == cl.playernum + 1
-	    && entnum != cl.playernum + 1 && channel->sfx)
+	if (channel->entnum == mix_listener.viewentity
+	    && entnum != mix_listener.viewentity && channel->sfx)
 	    continue;
-#endif
 	if (channel->end - paintedtime < life_left) {
 	    life_left = channel->end - paintedtime;
 	    first_to_die = channel;
@@ -369,6 +452,35 @@ SND_PickChannel(int entnum, int entchannel)
     return first_to_die;
 }
 
+/*
+ * Sets a channel's volumes from its distance (already scaled by dist_mult)
+ * and the dot product of the listener's right with the direction to it.
+ */
+static inline void
+SND_SetVolumes(channel_t *ch, vec_t dist, vec_t dot)
+{
+    vec_t lscale, rscale, scale;
+
+    if (shm->channels == 1) {
+	rscale = 1.0;
+	lscale = 1.0;
+    } else {
+	rscale = 1.0 + dot;
+	lscale = 1.0 - dot;
+    }
+
+    /* add in distance effect */
+    scale = (1.0 - dist) * rscale;
+    ch->rightvol = (int)(ch->master_vol * scale);
+    if (ch->rightvol < 0)
+	ch->rightvol = 0;
+
+    scale = (1.0 - dist) * lscale;
+    ch->leftvol = (int)(ch->master_vol * scale);
+    if (ch->leftvol < 0)
+	ch->leftvol = 0;
+}
+
 /*
  * =================
  * SND_Spatialize
@@ -379,54 +491,221 @@ SND_Spatialize(channel_t *ch)
 {
     vec_t dot;
     vec_t dist;
-    vec_t lscale, rscale, scale;
     vec3_t source_vec;
 
     /* anything coming from the view entity will always be full volume */
-#ifdef NQ_HACK
-    if (ch->entnum == cl.viewentity) {
+    if (ch->entnum == mix_listener.viewentity) {
 	ch->leftvol = ch->master_vol;
 	ch->rightvol = ch->master_vol;
 	return;
     }
-#endif
-#ifdef QW_HACK
-    if (ch->entnum == cl.playernum + 1) {
-	ch->leftvol = ch->master_vol;
-	ch->rightvol = ch->master_vol;
-	return;
-    }
-#endif
 
     /* calculate stereo seperation and distance attenuation */
-    VectorSubtract(ch->origin, listener_origin, source_vec);
+    VectorSubtract(ch->origin, mix_listener.origin, source_vec);
     dist = VectorNormalize(source_vec) * ch->dist_mult;
+    dot = DotProduct(mix_listener.right, source_vec);
 
-    if (shm->channels == 1) {
-	rscale = 1.0;
-	lscale = 1.0;
-    } else {
-	dot = DotProduct(listener_right, source_vec);
-	rscale = 1.0 + dot;
-	lscale = 1.0 - dot;
+    SND_SetVolumes(ch, dist, dot);
+}
+
+/*
+ * The channels being respatialized in a batch, as a structure of arrays:
+ * the offsets from the listener in, the scaled distances and the dot
+ * products out.
+ */
+static struct {
+    float x[MAX_CHANNELS];
+    float y[MAX_CHANNELS];
+    float z[MAX_CHANNELS];
+    float dist_mult[MAX_CHANNELS];
+    float dist[MAX_CHANNELS];
+    float dot[MAX_CHANNELS];
+    channel_t *ch[MAX_CHANNELS];
+} spatial;
+
+/*
+ * Works out whole vectors of the batch, returning how many were done; the
+ * C loop finishes off the rest.  Same sums in the same order as
+ * SND_Spatialize, a zero offset leaving a zero direction like
+ * VectorNormalize.
+ */
+static inline int
+SND_SpatializeVector(int count)
+{
+    int i = 0;
+#if defined(SND_SIMD_SSE2)
+    const __m128 rx = _mm_set1_ps(mix_listener.right[0]);
+    const __m128 ry = _mm_set1_ps(mix_listener.right[1]);
+    const __m128 rz = _mm_set1_ps(mix_listener.right[2]);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 x, y, z, length, ilength, dot;
+
+    for (; i + 4 <= count; i += 4) {
+	x = _mm_loadu_ps(spatial.x + i);
+	y = _mm_loadu_ps(spatial.y + i);
+	z = _mm_loadu_ps(spatial.z + i);
+	length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+			    _mm_mul_ps(z, z));
+	length = _mm_sqrt_ps(length);
+	ilength = _mm_and_ps(_mm_div_ps(one, length),
+			     _mm_cmpneq_ps(length, zero));
+	dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, _mm_mul_ps(x, ilength)),
+				    _mm_mul_ps(ry, _mm_mul_ps(y, ilength))),
+			 _mm_mul_ps(rz, _mm_mul_ps(z, ilength)));
+	_mm_storeu_ps(spatial.dist + i,
+		      _mm_mul_ps(length, _mm_loadu_ps(spatial.dist_mult + i)));
+	_mm_storeu_ps(spatial.dot + i, dot);
     }
+#elif defined(SND_SIMD_NEON)
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t x, y, z, length, ilength, dot;
+    uint32x4_t nonzero;
+
+    for (; i + 4 <= count; i += 4) {
+	x = vld1q_f32(spatial.x + i);
+	y = vld1q_f32(spatial.y + i);
+	z = vld1q_f32(spatial.z + i);
+	length = vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)),
+			   vmulq_f32(z, z));
+	length = vsqrtq_f32(length);
+	nonzero = vmvnq_u32(vceqq_f32(length, zero));
+	ilength = vreinterpretq_f32_u32(
+	    vandq_u32(vreinterpretq_u32_f32(vdivq_f32(one, length)), nonzero));
+	dot = vaddq_f32(vaddq_f32(
+		vmulq_n_f32(vmulq_f32(x, ilength), mix_listener.right[0]),
+		vmulq_n_f32(vmulq_f32(y, ilength), mix_listener.right[1])),
+		vmulq_n_f32(vmulq_f32(z, ilength), mix_listener.right[2]));
+	vst1q_f32(spatial.dist + i,
+		  vmulq_f32(length, vld1q_f32(spatial.dist_mult + i)));
+	vst1q_f32(spatial.dot + i, dot);
+    }
+#endif
+    return i;
+}
 
-    /* add in distance effect */
-    scale = (1.0 - dist) * rscale;
-    ch->rightvol = (int)(ch->master_vol * scale);
-    if (ch->rightvol < 0)
-	ch->rightvol = 0;
+/*
+ * =================
+ * SND_SpatializeChannels
+ *
+ * Respatializes a run of channels at once.  A cheap first pass sets the
+ * volumes of the view entity's channels and silences those out of range
+ * (a distance past 1 can only scale to nothing), leaving the rest to be
+ * worked out a vector at a time.
+ * =================
+ */
+static void
+SND_SpatializeChannels(channel_t *first, int numchannels)
+{
+    channel_t *ch;
+    vec3_t offset;
+    vec_t lengthsq, length, ilength;
+    int i, count;
 
-    scale = (1.0 - dist) * lscale;
-    ch->leftvol = (int)(ch->master_vol * scale);
-    if (ch->leftvol < 0)
-	ch->leftvol = 0;
+    count = 0;
+    for (i = 0, ch = first; i < numchannels; i++, ch++) {
+	if (!ch->sfx)
+	    continue;
+	if (ch->entnum == mix_listener.viewentity) {
+	    ch->leftvol = ch->master_vol;
+	    ch->rightvol = ch->master_vol;
+	    continue;
+	}
+	VectorSubtract(ch->origin, mix_listener.origin, offset);
+	lengthsq = DotProduct(offset, offset);
+	if (lengthsq * ch->dist_mult * ch->dist_mult >= 1) {
+	    ch->leftvol = ch->rightvol = 0;
+	    continue;
+	}
+	spatial.x[count] = offset[0];
+	spatial.y[count] = offset[1];
+	spatial.z[count] = offset[2];
+	spatial.dist_mult[count] = ch->dist_mult;
+	spatial.ch[count] = ch;
+	count++;
+    }
+
+    i = SND_SpatializeVector(count);
+    for (; i < count; i++) {
+	offset[0] = spatial.x[i];
+	offset[1] = spatial.y[i];
+	offset[2] = spatial.z[i];
+	length = sqrt(DotProduct(offset, offset));
+	ilength = length ? 1 / length : 0;
+	VectorScale(offset, ilength, offset);
+	spatial.dist[i] = length * spatial.dist_mult[i];
+	spatial.dot[i] = DotProduct(mix_listener.right, offset);
+    }
+
+    for (i = 0; i < count; i++)
+	SND_SetVolumes(spatial.ch[i], spatial.dist[i], spatial.dot[i]);
 }
 
+/*
+ * The channels that can be heard, for S_PaintChannels; found again after
+ * anything changes the channels.
+ */
+channel_t *active_channels[MAX_CHANNELS];
+int num_active_channels;
+static qboolean active_channels_changed;
 
-void
-S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
-	     float fvol, float attenuation)
+static void
+SND_FindActiveChannels(void)
+{
+    channel_t *ch;
+    int i;
+
+    num_active_channels = 0;
+    for (i = 0, ch = channels; i < total_channels; i++, ch++)
+	if (ch->sfx && (ch->leftvol || ch->rightvol))
+	    active_channels[num_active_channels++] = ch;
+    active_channels_changed = false;
+}
+
+
+/*
+ * Everything that changes the channels is a command, posted by the client
+ * and run wherever the mixing is done (see MIXER THREAD below).
+ */
+typedef enum {
+    SND_CMD_START,
+    SND_CMD_STATIC,
+    SND_CMD_STOP,
+    SND_CMD_STOPALL,
+    SND_CMD_LISTENER,
+} sndcmdtype_t;
+
+typedef struct sndcmd_s {
+    sndcmdtype_t type;
+    int entnum;			/* START, STOP */
+    int entchannel;		/* START, STOP */
+    sfx_t *sfx;			/* START, STATIC; loaded by the client */
+    vec3_t origin;		/* START, STATIC, LISTENER */
+    vec3_t right;		/* LISTENER */
+    float vol;			/* START, STATIC */
+    float attenuation;		/* START, STATIC */
+    int viewentity;		/* START, LISTENER */
+    qboolean ambients;		/* LISTENER: ambient_vol is set */
+    int ambient_vol[NUM_AMBIENTS];	/* LISTENER: < 0 is off */
+    qboolean clear;		/* STOPALL */
+} sndcmd_t;
+
+static void S_PostCommand(const sndcmd_t *cmd);
+
+static int
+S_ViewEntity(void)
+{
+#ifdef NQ_HACK
+    return cl.viewentity;
+#endif
+#ifdef QW_HACK
+    return cl.playernum + 1;
+#endif
+}
+
+static void
+SND_StartSound(const sndcmd_t *cmd)
 {
     channel_t *target_chan, *check;
     sfxcache_t *sc;
@@ -434,40 +713,34 @@ S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
     int ch_idx;
     int skip;
 
-    if (!sound_started)
-	return;
-    if (!sfx)
-	return;
-    if (nosound.value)
-	return;
-
-    vol = fvol * 255;
+    vol = cmd->vol * 255;
+    mix_listener.viewentity = cmd->viewentity;
 
     /* pick a channel to play on */
-    target_chan = SND_PickChannel(entnum, entchannel);
+    target_chan = SND_PickChannel(cmd->entnum, cmd->entchannel);
     if (!target_chan)
 	return;
 
     /* spatialize */
     memset(target_chan, 0, sizeof(*target_chan));
-    VectorCopy(origin, target_chan->origin);
-    target_chan->dist_mult = attenuation / sound_nominal_clip_dist;
+    VectorCopy(cmd->origin, target_chan->origin);
+    target_chan->dist_mult = cmd->attenuation / sound_nominal_clip_dist;
     target_chan->master_vol = vol;
-    target_chan->entnum = entnum;
-    target_chan->entchannel = entchannel;
+    target_chan->entnum = cmd->entnum;
+    target_chan->entchannel = cmd->entchannel;
     SND_Spatialize(target_chan);
 
     if (!target_chan->leftvol && !target_chan->rightvol)
 	return;			/* not audible at all */
 
     /* new channel */
-    sc = S_LoadSound(sfx);
+    sc = S_SfxData(cmd->sfx);
     if (!sc) {
 	target_chan->sfx = NULL;
 	return;			/* couldn't load the sound's data */
     }
 
-    target_chan->sfx = sfx;
+    target_chan->sfx = cmd->sfx;
     target_chan->pos = 0.0;
     target_chan->end = paintedtime + sc->length;
 
@@ -480,7 +753,7 @@ S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
 	 ch_idx++, check++) {
 	if (check == target_chan)
 	    continue;
-	if (check->sfx == sfx && !check->pos) {
+	if (check->sfx == cmd->sfx && !check->pos) {
 	    skip = rand() % (int)(0.1 * shm->speed);
 	    if (skip >= target_chan->end)
 		skip = target_chan->end - 1;
@@ -492,7 +765,35 @@ S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
 }
 
 void
-S_StopSound(int entnum, int entchannel)
+S_StartSound(int entnum, int entchannel, sfx_t *sfx, vec3_t origin,
+	     float fvol, float attenuation)
+{
+    sndcmd_t cmd;
+
+    if (!sound_started)
+	return;
+    if (!sfx)
+	return;
+    if (nosound.value)
+	return;
+
+    /* the mixing side can't load it */
+    if (!S_LoadSound(sfx))
+	return;			/* couldn't load the sound's data */
+
+    cmd.type = SND_CMD_START;
+    cmd.entnum = entnum;
+    cmd.entchannel = entchannel;
+    cmd.sfx = sfx;
+    VectorCopy(origin, cmd.origin);
+    cmd.vol = fvol;
+    cmd.attenuation = attenuation;
+    cmd.viewentity = S_ViewEntity();
+    S_PostCommand(&cmd);
+}
+
+static void
+SND_StopSound(int entnum, int entchannel)
 {
     int i;
 
@@ -507,13 +808,24 @@ S_StopSound(int entnum, int entchannel)
 }
 
 void
-S_StopAllSounds(qboolean clear)
+S_StopSound(int entnum, int entchannel)
 {
-    int i;
+    sndcmd_t cmd;
 
     if (!sound_started)
 	return;
 
+    cmd.type = SND_CMD_STOP;
+    cmd.entnum = entnum;
+    cmd.entchannel = entchannel;
+    S_PostCommand(&cmd);
+}
+
+static void
+SND_StopAllSounds(qboolean clear)
+{
+    int i;
+
     /* no statics */
     total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;
 
@@ -522,10 +834,27 @@ S_StopAllSounds(qboolean clear)
 	    channels[i].sfx = NULL;
 
     memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
+    active_channels_changed = true;
     if (clear)
 	S_ClearBuffer();
 }
 
+void
+S_StopAllSounds(qboolean clear)
+{
+    sndcmd_t cmd;
+
+    if (!sound_started)
+	return;
+
+    memset(ambient_vol, 0, sizeof(ambient_vol));
+    num_static_sounds = 0;
+
+    cmd.type = SND_CMD_STOPALL;
+    cmd.clear = clear;
+    S_PostCommand(&cmd);
+}
+
 static void
 S_StopAllSoundsC(void)
 {
@@ -541,8 +870,10 @@ S_ClearBuffer(void)
     if (!sound_started || !shm)
 	return;
 
+    S_LockMixer();
     err = SNDDMA_LockBuffer();
     if (err) {
+	S_UnlockMixer();
 	S_Shutdown();
 	return;
     }
@@ -550,6 +881,7 @@ S_ClearBuffer(void)
     clear = (shm->samplebits == 8) ? 0x80 : 0;
     memset(shm->buffer, clear, shm->samples * shm->samplebits / 8);
     SNDDMA_UnlockBuffer();
+    S_UnlockMixer();
 }
 
 
@@ -558,53 +890,80 @@ S_ClearBuffer(void)
  * S_StaticSound
  * =================
  */
-void
-S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
+static void
+SND_StaticSound(const sndcmd_t *cmd)
 {
     channel_t *ss;
     sfxcache_t *sc;
 
-    if (!sfx)
+    if (total_channels == MAX_CHANNELS)
 	return;
-    if (total_channels == MAX_CHANNELS) {
-	Con_Printf("total_channels == MAX_CHANNELS\n");
-	return;
-    }
 
     ss = &channels[total_channels];
     total_channels++;
 
-    sc = S_LoadSound(sfx);
+    if (!cmd->sfx)
+	return;
+    sc = S_SfxData(cmd->sfx);
     if (!sc)
 	return;
 
-    if (sc->loopstart == -1) {
-	Con_Printf("Sound %s not looped\n", sfx->name);
+    ss->sfx = cmd->sfx;
+    VectorCopy(cmd->origin, ss->origin);
+    ss->master_vol = cmd->vol;
+    ss->dist_mult = (cmd->attenuation / 64) / sound_nominal_clip_dist;
+    ss->end = paintedtime + sc->length;
+
+    SND_Spatialize(ss);
+}
+
+void
+S_StaticSound(sfx_t *sfx, vec3_t origin, float vol, float attenuation)
+{
+    sndcmd_t cmd;
+    sfxcache_t *sc;
+
+    if (!sound_started || !sfx)
+	return;
+    if (num_static_sounds == MAX_STATIC_SOUNDS) {
+	Con_Printf("total_channels == MAX_CHANNELS\n");
 	return;
     }
 
-    ss->sfx = sfx;
-    VectorCopy(origin, ss->origin);
-    ss->master_vol = vol;
-    ss->dist_mult = (attenuation / 64) / sound_nominal_clip_dist;
-    ss->end = paintedtime + sc->length;
+    /* the channel is used up even if the sound can't play */
+    cmd.type = SND_CMD_STATIC;
+    cmd.sfx = NULL;
+    VectorCopy(origin, cmd.origin);
+    cmd.vol = vol;
+    cmd.attenuation = attenuation;
 
-    SND_Spatialize(ss);
+    sc = S_LoadSound(sfx);
+    if (sc && sc->loopstart == -1)
+	Con_Printf("Sound %s not looped\n", sfx->name);
+    else if (sc)
+	cmd.sfx = sfx;
+
+    static_sfx[num_static_sounds++] = cmd.sfx;
+    S_PostCommand(&cmd);
 }
 
 
 /*
  * ===================
  * S_UpdateAmbientSounds
+ *
+ * Fades the ambient levels toward the listener's leaf; the mixing side gets
+ * them with the listener.
  * ===================
  */
 static void
-S_UpdateAmbientSounds(void)
+S_UpdateAmbientSounds(sndcmd_t *cmd)
 {
     mleaf_t *leaf;
     float vol;
     int ambient_channel;
-    channel_t *chan;
+
+    cmd->ambients = false;
 
     if (!snd_ambient)
 	return;
@@ -613,73 +972,90 @@ S_UpdateAmbientSounds(void)
     if (!cl.worldmodel)
 	return;
 
+    cmd->ambients = true;
+
     leaf = Mod_PointInLeaf(cl.worldmodel, listener_origin);
     if (!leaf || !ambient_level.value) {
 	for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS;
 	     ambient_channel++)
-	    channels[ambient_channel].sfx = NULL;
+	    cmd->ambient_vol[ambient_channel] = -1;
 	return;
     }
 
     for (ambient_channel = 0; ambient_channel < NUM_AMBIENTS;
 	 ambient_channel++) {
-	chan = &channels[ambient_channel];
-	chan->sfx = ambient_sfx[ambient_channel];
+	int *master_vol = &ambient_vol[ambient_channel];
 
 	vol = ambient_level.value * leaf->ambient_sound_level[ambient_channel];
 	if (vol < 8)
 	    vol = 0;
 
 	/* don't adjust volume too fast */
-	if (chan->master_vol < vol) {
-	    chan->master_vol += host_frametime * ambient_fade.value;
-	    if (chan->master_vol > vol)
-		chan->master_vol = vol;
-	} else if (chan->master_vol > vol) {
-	    chan->master_vol -= host_frametime * ambient_fade.value;
-	    if (chan->master_vol < vol)
-		chan->master_vol = vol;
+	if (*master_vol < vol) {
+	    *master_vol += host_frametime * ambient_fade.value;
+	    if (*master_vol > vol)
+		*master_vol = vol;
+	} else if (*master_vol > vol) {
+	    *master_vol -= host_frametime * ambient_fade.value;
+	    if (*master_vol < vol)
+		*master_vol = vol;
 	}
 
-	chan->leftvol = chan->rightvol = chan->master_vol;
+	cmd->ambient_vol[ambient_channel] = *master_vol;
     }
 }
 
-
 /*
- * ============
- * S_Update
- *
- * Called once each time through the main loop
- * ============
+ * Keeps the sounds that play for the whole level in memory, and reloads
+ * them if they were thrown out; the mixing side never loads anything.
  */
-void
-S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
+static void
+S_TouchLevelSounds(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_AMBIENTS; i++)
+	if (ambient_sfx[i])
+	    S_LoadSound(ambient_sfx[i]);
+    for (i = 0; i < num_static_sounds; i++)
+	if (static_sfx[i])
+	    S_LoadSound(static_sfx[i]);
+}
+
+static void
+SND_UpdateListener(const sndcmd_t *cmd)
 {
     int i, j;
-    int total;
     channel_t *ch;
     channel_t *combine;
 
-    if (!sound_started || (snd_blocked > 0))
-	return;
-
-    VectorCopy(origin, listener_origin);
-    VectorCopy(forward, listener_forward);
-    VectorCopy(right, listener_right);
-    VectorCopy(up, listener_up);
+    VectorCopy(cmd->origin, mix_listener.origin);
+    VectorCopy(cmd->right, mix_listener.right);
+    mix_listener.viewentity = cmd->viewentity;
 
     /* update general area ambient sound sources */
-    S_UpdateAmbientSounds();
-
-    combine = NULL;
+    if (cmd->ambients) {
+	for (i = 0; i < NUM_AMBIENTS; i++) {
+	    ch = &channels[i];
+	    if (cmd->ambient_vol[i] < 0) {
+		ch->sfx = NULL;
+		continue;
+	    }
+	    ch->sfx = ambient_sfx[i];
+	    ch->master_vol = cmd->ambient_vol[i];
+	    ch->leftvol = ch->rightvol = ch->master_vol;
+	}
+    }
 
     /* update spatialization for static and dynamic sounds */
+    SND_SpatializeChannels(channels + NUM_AMBIENTS,
+			   total_channels - NUM_AMBIENTS);
+
+    combine = NULL;
     ch = channels + NUM_AMBIENTS;
     for (i = NUM_AMBIENTS; i < total_channels; i++, ch++) {
 	if (!ch->sfx)
 	    continue;
-	SND_Spatialize(ch);	/* respatialize channel */
 	if (!ch->leftvol && !ch->rightvol)
 	    continue;
 
@@ -715,19 +1091,82 @@ S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
 	}
     }
 
+    /* for the snd_show debugging output */
+    SND_FindActiveChannels();
+    audible_channels = num_active_channels;
+}
+
+static void
+SND_RunCommand(const sndcmd_t *cmd)
+{
+    active_channels_changed = true;
+
+    switch (cmd->type) {
+    case SND_CMD_START:
+	SND_StartSound(cmd);
+	break;
+    case SND_CMD_STATIC:
+	SND_StaticSound(cmd);
+	break;
+    case SND_CMD_STOP:
+	SND_StopSound(cmd->entnum, cmd->entchannel);
+	break;
+    case SND_CMD_STOPALL:
+	SND_StopAllSounds(cmd->clear);
+	break;
+    case SND_CMD_LISTENER:
+	SND_UpdateListener(cmd);
+	break;
+    }
+}
+
+
+/*
+ * ============
+ * S_Update
+ *
+ * Called once each time through the main loop
+ * ============
+ */
+void
+S_Update(vec3_t origin, vec3_t forward, vec3_t right, vec3_t up)
+{
+    sndcmd_t cmd;
+
+    if (snd_mixer.restart) {
+	/* the mixer lost the device; reopen it here */
+	S_Shutdown();
+	S_Startup();
+	S_StartMixer();
+    }
+
+    if (!sound_started || (snd_blocked > 0))
+	return;
+
+    VectorCopy(origin, listener_origin);
+    VectorCopy(forward, listener_forward);
+    VectorCopy(right, listener_right);
+    VectorCopy(up, listener_up);
+
+    cmd.type = SND_CMD_LISTENER;
+    VectorCopy(origin, cmd.origin);
+    VectorCopy(right, cmd.right);
+    cmd.viewentity = S_ViewEntity();
+    S_UpdateAmbientSounds(&cmd);
+    S_PostCommand(&cmd);
+
+    S_UpdateSoundCache();
+    S_TouchLevelSounds();
+
     /*
      * debugging output
      */
-    if (snd_show.value) {
-	total = 0;
-	ch = channels;
-	for (i = 0; i < total_channels; i++, ch++)
-	    if (ch->sfx && (ch->leftvol || ch->rightvol))
-		total++;
-	Con_Printf("----(%i)----\n", total);
-    }
+    if (snd_show.value)
+	Con_Printf("----(%i)----\n", audible_channels);
+
     /* mix some sound */
-    S_Update_();
+    if (!snd_mixer.started)
+	S_Update_();
 }
 
 static void
@@ -754,7 +1193,7 @@ GetSoundtime(void)
 	if (paintedtime > 0x40000000) {
 	    buffers = 0;
 	    paintedtime = fullsamples;
-	    S_StopAllSounds(true);
+	    SND_StopAllSounds(true);
 	}
     }
     oldsamplepos = samplepos;
@@ -770,6 +1209,8 @@ S_ExtraUpdate(void)
 #endif
     if (snd_noextraupdate.value)
 	return;			/* don't pollute timings */
+    if (snd_mixer.started)
+	return;			/* the mixer keeps up by itself */
     S_Update_();
 }
 
@@ -798,6 +1239,8 @@ S_Update_(void)
     if (endtime - soundtime > samps)
 	endtime = soundtime + samps;
 
+    if (active_channels_changed)
+	SND_FindActiveChannels();
     S_PaintChannels(endtime);
     SNDDMA_Submit();
 }
@@ -863,8 +1306,9 @@ S_SoundList(void)
     int size, total;
 
     total = 0;
-    for (sfx = known_sfx, i = 0; i < num_sfx; i++, sfx++) {
-	sc = Cache_Check(&sfx->cache);
+    for (i = 0; i < num_sfx; i++) {
+	sfx = &known_sfx[i / SFX_BLOCK][i % SFX_BLOCK];
+	sc = S_SfxData(sfx);
 	if (!sc)
 	    continue;
 	size = sc->length * sc->width * (sc->stereo + 1);
@@ -873,9 +1317,11 @@ S_SoundList(void)
 	    Con_Printf("L");
 	else
 	    Con_Printf(" ");
-	Con_Printf("(%2db) %6i : %s\n", sc->width * 8, size, sfx->name);
+	Con_Printf("(%2db) %6i : %s%s\n", sc->width * 8, size, sfx->name,
+		   sfx->arena ? "" : " (cache)");
     }
     Con_Printf("Total resident: %i\n", total);
+    S_SoundCacheInfo();
 }
 
 
@@ -911,13 +1357,217 @@ S_ClearPrecache(void)
 }
 #endif
 
+
+
+/*
+===============================================================================
+
+MIXER THREAD
+
+The mixer thread owns the channels: it runs the commands, spatializes and
+paints, so a slow frame no longer holds up the mixing or lands on the frame
+time.  The client posts its commands on a single-producer, single-consumer
+ring and never waits for the mixer unless the ring is full.  The sound data
+is loaded by the client before it's posted; the mixer holds snd_mixer.lock
+while it mixes, and the cache takes the same lock to move or free data, so
+nothing goes away under it.
+
+Without the thread (-nosndthread, -simsound), the commands run as they are
+posted and S_Update mixes, as before.
+
+===============================================================================
+*/
+
+#ifdef _WIN32
+#define SND_Lock()	EnterCriticalSection(&snd_mixer.lock)
+#define SND_Unlock()	LeaveCriticalSection(&snd_mixer.lock)
+#else
+#define SND_Lock()	pthread_mutex_lock(&snd_mixer.lock)
+#define SND_Unlock()	pthread_mutex_unlock(&snd_mixer.lock)
+#endif
+
+/* how often the mixer wakes, in Sys_Sleep()s; well inside _snd_mixahead */
+#define SND_MIX_SLEEPS 4
+
 void
-S_BeginPrecaching(void)
+S_LockMixer(void)
 {
+    if (snd_mixer.started)
+	SND_Lock();
 }
 
-
 void
-S_EndPrecaching(void)
+S_UnlockMixer(void)
+{
+    if (snd_mixer.started)
+	SND_Unlock();
+}
+
+static qboolean
+S_OnMixerThread(void)
+{
+    if (!snd_mixer.started)
+	return false;
+#ifdef _WIN32
+    return GetCurrentThreadId() == snd_mixer.threadid;
+#else
+    return pthread_equal(pthread_self(), snd_mixer.thread);
+#endif
+}
+
+static void
+S_PostCommand(const sndcmd_t *cmd)
+{
+    unsigned tail;
+
+    if (!snd_mixer.started) {
+	SND_RunCommand(cmd);
+	return;
+    }
+
+    tail = snd_mixer.tail;
+    while (tail - snd_mixer.head == SND_QUEUE) {
+	if (snd_mixer.restart)
+	    return;		/* nothing is draining it */
+	Sys_Sleep();
+    }
+
+    snd_mixer.queue[tail & (SND_QUEUE - 1)] = *cmd;
+    __sync_synchronize();	/* written before it's posted */
+    snd_mixer.tail = tail + 1;
+}
+
+static void
+SND_RunCommands(void)
+{
+    unsigned head;
+
+    for (head = snd_mixer.head; head != snd_mixer.tail; head++) {
+	__sync_synchronize();	/* seen posted before it's read */
+	SND_RunCommand(&snd_mixer.queue[head & (SND_QUEUE - 1)]);
+	__sync_synchronize();	/* read before the slot is reused */
+	snd_mixer.head = head + 1;
+    }
+}
+
+static void
+SND_RunMixer(void)
+{
+    int i;
+
+    while (!snd_mixer.quit) {
+	if (!snd_mixer.restart) {
+	    SND_Lock();
+	    SND_RunCommands();
+	    S_Update_();
+	    SND_Unlock();
+	}
+	for (i = 0; i < SND_MIX_SLEEPS && !snd_mixer.quit; i++)
+	    Sys_Sleep();
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+SND_MixerMain(LPVOID arg)
+{
+    SND_RunMixer();
+    return 0;
+}
+#else
+static void *
+SND_MixerMain(void *arg)
+{
+    SND_RunMixer();
+    return NULL;
+}
+#endif
+
+static void
+S_LockCache(void)
 {
+    SND_Lock();
+}
+
+static void
+S_UnlockCache(void)
+{
+    SND_Unlock();
+}
+
+static void
+S_StartMixer(void)
+{
+#ifndef _WIN32
+    pthread_mutexattr_t attr;
+#endif
+
+    if (snd_mixer.started || !sound_started || fakedma)
+	return;
+    if (COM_CheckParm("-nosndthread"))
+	return;
+
+    if (!snd_mixer.queue) {
+	snd_mixer.queue = calloc(SND_QUEUE, sizeof(sndcmd_t));
+	if (!snd_mixer.queue)
+	    return;
+    }
+    snd_mixer.quit = false;
+    snd_mixer.restart = false;
+    snd_mixer.head = snd_mixer.tail = 0;
+
+    /* the cache guard takes it again inside S_LoadSound */
+#ifdef _WIN32
+    InitializeCriticalSection(&snd_mixer.lock);
+    snd_mixer.thread = CreateThread(NULL, 0, SND_MixerMain, NULL,
+				    CREATE_SUSPENDED, &snd_mixer.threadid);
+    if (!snd_mixer.thread)
+	return;
+    SetThreadPriority(snd_mixer.thread, THREAD_PRIORITY_ABOVE_NORMAL);
+    snd_mixer.started = true;
+    Cache_SetGuard(S_LockCache, S_UnlockCache);
+    ResumeThread(snd_mixer.thread);
+#else
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&snd_mixer.lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    /* started is set before the mixer can look at it */
+    SND_Lock();
+    if (pthread_create(&snd_mixer.thread, NULL, SND_MixerMain, NULL)) {
+	SND_Unlock();
+	pthread_mutex_destroy(&snd_mixer.lock);
+	return;
+    }
+    snd_mixer.started = true;
+    Cache_SetGuard(S_LockCache, S_UnlockCache);
+    SND_Unlock();
+#endif
+}
+
+static void
+S_StopMixer(void)
+{
+    if (!snd_mixer.started)
+	return;
+
+    snd_mixer.quit = true;
+#ifdef _WIN32
+    WaitForSingleObject(snd_mixer.thread, INFINITE);
+    CloseHandle(snd_mixer.thread);
+#else
+    pthread_join(snd_mixer.thread, NULL);
+#endif
+    Cache_SetGuard(NULL, NULL);
+    snd_mixer.started = false;
+
+    /* run what it didn't get to */
+    SND_RunCommands();
+
+#ifdef _WIN32
+    DeleteCriticalSection(&snd_mixer.lock);
+#else
+    pthread_mutex_destroy(&snd_mixer.lock);
+#endif
 }
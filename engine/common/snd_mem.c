@@ -19,6 +19,17 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // snd_mem.c: sound caching
 
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #include "common.h"
 #include "console.h"
 #include "quakedef.h"
@@ -34,7 +45,24 @@ typedef struct {
     int dataofs;		// chunk starts this many bytes from file start
 } wavinfo_t;
 
-static wavinfo_t *GetWavinfo(const char *name, const byte *wav, int wavlength);
+// the state of parsing one wav, so the decoder thread can do it too
+typedef struct {
+    const char *filename;
+    const byte *data_p;
+    const byte *iff_end;
+    const byte *last_chunk;
+    const byte *iff_data;
+    int iff_chunk_len;
+    char error[256];		// what went wrong, to print on the main thread
+    qboolean fatal;		// Sys_Error rather than skip it
+} wavparse_t;
+
+static void WavError(wavparse_t *parse, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+static qboolean GetWavinfo(wavparse_t *parse, const byte *wav, int wavlength,
+			   wavinfo_t *info);
+
+static cvar_t snd_arenasize = { "snd_arenasize", "16384", true };
 
 /*
 ================
@@ -42,28 +70,24 @@ ResampleSfx
 ================
 */
 static void
-ResampleSfx(sfx_t *sfx, int inrate, int inwidth, const byte *data)
+ResampleSfx(sfxcache_t *sc, int inrate, int inwidth, const byte *data,
+	    int speed, qboolean as8bit)
 {
     int outcount;
     int srcsample;
     float stepscale;
     int i;
     int sample, samplefrac, fracstep;
-    sfxcache_t *sc;
-
-    sc = Cache_Check(&sfx->cache);
-    if (!sc)
-	return;
 
-    stepscale = (float)inrate / shm->speed;	// this is usually 0.5, 1, or 2
+    stepscale = (float)inrate / speed;	// this is usually 0.5, 1, or 2
 
     outcount = sc->length / stepscale;
     sc->length = outcount;
     if (sc->loopstart != -1)
 	sc->loopstart = sc->loopstart / stepscale;
 
-    sc->speed = shm->speed;
-    if (loadas8bit.value)
+    sc->speed = speed;
+    if (as8bit)
 	sc->width = 1;
     else
 	sc->width = inwidth;
@@ -95,28 +119,416 @@ ResampleSfx(sfx_t *sfx, int inrate, int inwidth, const byte *data)
     }
 }
 
-//=============================================================================
+/*
+================
+DecodeSfx
+
+Parses a wav file and resamples it into a malloc'd sfxcache_t, setting
+*size to the size of that.  Touches nothing but the arguments, so it's safe
+on any thread; problems are left in parse for the main thread to print.
+================
+*/
+static sfxcache_t *
+DecodeSfx(wavparse_t *parse, const byte *data, size_t length, int speed,
+	  qboolean as8bit, int *size)
+{
+    wavinfo_t info;
+    float stepscale;
+    int len;
+    sfxcache_t *sc;
+
+    if (!GetWavinfo(parse, data, length, &info))
+	return NULL;
+    if (info.channels != 1) {
+	WavError(parse, "%s is a stereo sample\n", parse->filename);
+	return NULL;
+    }
+
+    stepscale = (float)info.rate / speed;
+    len = info.samples / stepscale;
+
+    len = len * info.width * info.channels;
+
+    *size = len + sizeof(sfxcache_t);
+    sc = malloc(*size);
+    if (!sc)
+	return NULL;
+
+    sc->length = info.samples;
+    sc->loopstart = info.loopstart;
+    sc->speed = info.rate;
+    sc->width = info.width;
+    sc->stereo = info.channels;
+
+    ResampleSfx(sc, sc->speed, sc->width, data + info.dataofs, speed, as8bit);
+
+    return sc;
+}
+
+/*
+===============================================================================
+
+SOUND ARENA
+
+Resampled sounds are kept in the arena, malloc'd outside the hunk, up to
+snd_arenasize kilobytes.  Nothing else competes for it, so a sound stays put
+for as long as the level that uses it; when room is needed, the sounds no
+level has used for longest go first.  The sounds every level uses (weapons,
+the player) are never loaded twice.  What doesn't fit goes in the cache,
+as before.
+
+===============================================================================
+*/
+
+static struct {
+    size_t used;
+    int level;			// bumped by S_BeginPrecaching
+    sfx_t *sounds;		// linked by arenanext
+} arena;
+
+static void
+S_ArenaFree(sfx_t *sfx)
+{
+    sfx_t **link;
+
+    for (link = &arena.sounds; *link; link = &(*link)->arenanext) {
+	if (*link == sfx) {
+	    *link = sfx->arenanext;
+	    break;
+	}
+    }
+    arena.used -= sfx->arenasize;
+
+    S_LockMixer();
+    free(sfx->arena);
+    sfx->arena = NULL;
+    S_UnlockMixer();
+
+    sfx->arenasize = 0;
+    sfx->arenanext = NULL;
+}
+
+static qboolean
+S_ArenaKeep(sfx_t *sfx, sfxcache_t *sc, int size)
+{
+    size_t limit;
+    sfx_t *check, *oldest;
+
+    limit = qmax(snd_arenasize.value, 0.0f) * 1024;
+    if (size > limit)
+	return false;
+
+    /* make room from the sounds the current level hasn't used */
+    while (arena.used + size > limit) {
+	oldest = NULL;
+	for (check = arena.sounds; check; check = check->arenanext)
+	    if (check->arenalevel != arena.level &&
+		(!oldest || check->arenalevel < oldest->arenalevel))
+		oldest = check;
+	if (!oldest)
+	    return false;
+	S_ArenaFree(oldest);
+    }
+
+    /* the mixer thread may look as soon as it's set */
+    S_LockMixer();
+    sfx->arena = sc;
+    S_UnlockMixer();
+
+    sfx->arenasize = size;
+    sfx->arenanext = arena.sounds;
+    arena.sounds = sfx;
+    arena.used += size;
+
+    return true;
+}
+
+/*
+ * Takes a decoded sound: into the arena if it fits, otherwise copied into
+ * the cache.  Returns the data it ended up in.
+ */
+static sfxcache_t *
+S_KeepSfx(sfx_t *sfx, sfxcache_t *sc, int size)
+{
+    sfxcache_t *cached;
+
+    if (S_ArenaKeep(sfx, sc, size))
+	return sc;
+
+    /* the mixer thread mustn't see it until it's all there */
+    S_LockMixer();
+    cached = Cache_Alloc(&sfx->cache, size, sfx->name);
+    if (cached)
+	memcpy(cached, sc, size);
+    S_UnlockMixer();
+    free(sc);
+
+    return cached;
+}
+
+/*
+===============================================================================
+
+BACKGROUND DECODER
+
+S_PrecacheSound queues each sound here.  The main thread finds where the
+file is (only it can walk the search path); a thread of our own reads,
+parses and resamples it, and the main thread takes the results, in order,
+each frame, at the end of precaching or when it needs a sound that's still
+being worked on.
+
+===============================================================================
+*/
+
+#define DECODE_JOBS 512
+
+typedef struct {
+    sfx_t *sfx;
+    char path[MAX_OSPATH];
+    size_t offset;
+    size_t length;		// 0 is up to the end of the file
+    int speed;
+    qboolean as8bit;
+    sfxcache_t *sc;		// the result, or NULL if it couldn't load
+    int size;
+    wavparse_t parse;
+} decodejob_t;
+
+static struct {
+    qboolean started;
+    qboolean quit;
+    decodejob_t jobs[DECODE_JOBS];
+    int head, next, tail;	// taken at head, decoded at next, queued at tail
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE changed;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} decoder;
+
+#ifdef _WIN32
+#define DEC_Lock()	EnterCriticalSection(&decoder.lock)
+#define DEC_Unlock()	LeaveCriticalSection(&decoder.lock)
+#define DEC_Wait()	SleepConditionVariableCS(&decoder.changed, &decoder.lock, INFINITE)
+#define DEC_Signal()	WakeAllConditionVariable(&decoder.changed)
+#else
+#define DEC_Lock()	pthread_mutex_lock(&decoder.lock)
+#define DEC_Unlock()	pthread_mutex_unlock(&decoder.lock)
+#define DEC_Wait()	pthread_cond_wait(&decoder.changed, &decoder.lock)
+#define DEC_Signal()	pthread_cond_broadcast(&decoder.changed)
+#endif
+
+static byte *
+DEC_ReadFile(const decodejob_t *job, size_t *length)
+{
+    FILE *f;
+    byte *data;
+    long end;
+
+    f = fopen(job->path, "rb");
+    if (!f)
+	return NULL;
+
+    *length = job->length;
+    if (!*length) {
+	if (fseek(f, 0, SEEK_END) || (end = ftell(f)) < 0) {
+	    fclose(f);
+	    return NULL;
+	}
+	*length = end;
+    }
+
+    data = malloc(*length ? *length : 1);
+    if (data && (fseek(f, job->offset, SEEK_SET) ||
+		 fread(data, 1, *length, f) != *length)) {
+	free(data);
+	data = NULL;
+    }
+    fclose(f);
+
+    return data;
+}
+
+static void
+DEC_Decode(decodejob_t *job)
+{
+    byte *data;
+    size_t length;
+
+    data = DEC_ReadFile(job, &length);
+    if (!data) {
+	WavError(&job->parse, "Couldn't load sound/%s\n", job->sfx->name);
+	return;
+    }
+    job->sc = DecodeSfx(&job->parse, data, length, job->speed, job->as8bit,
+			&job->size);
+    free(data);
+}
+
+static void
+DEC_RunDecoder(void)
+{
+    decodejob_t *job;
+
+    DEC_Lock();
+    for (;;) {
+	if (decoder.quit)
+	    break;
+	if (decoder.next == decoder.tail) {
+	    DEC_Wait();
+	    continue;
+	}
+	job = &decoder.jobs[decoder.next];
+	DEC_Unlock();
+
+	DEC_Decode(job);
+
+	DEC_Lock();
+	decoder.next = (decoder.next + 1) % DECODE_JOBS;
+	DEC_Signal();
+    }
+    DEC_Unlock();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+DEC_DecoderMain(LPVOID arg)
+{
+    DEC_RunDecoder();
+    return 0;
+}
+#else
+static void *
+DEC_DecoderMain(void *arg)
+{
+    DEC_RunDecoder();
+    return NULL;
+}
+#endif
+
+static qboolean
+DEC_StartDecoder(void)
+{
+    if (decoder.started)
+	return true;
+    if (COM_CheckParm("-nosnddecoder"))
+	return false;
+
+    decoder.quit = false;
+    decoder.head = decoder.next = decoder.tail = 0;
+#ifdef _WIN32
+    InitializeCriticalSection(&decoder.lock);
+    InitializeConditionVariable(&decoder.changed);
+    decoder.thread = CreateThread(NULL, 0, DEC_DecoderMain, NULL, 0, NULL);
+    decoder.started = decoder.thread != NULL;
+#else
+    pthread_mutex_init(&decoder.lock, NULL);
+    pthread_cond_init(&decoder.changed, NULL);
+    decoder.started =
+	!pthread_create(&decoder.thread, NULL, DEC_DecoderMain, NULL);
+#endif
+
+    return decoder.started;
+}
+
+/*
+ * Takes the decoded sounds, in order.  If wait is given, keeps going (and
+ * waiting for the decoder) until that sound is done.
+ */
+static void
+DEC_TakeDecoded(const sfx_t *wait)
+{
+    decodejob_t *job;
+
+    if (!decoder.started)
+	return;
+
+    DEC_Lock();
+    for (;;) {
+	if (decoder.head == decoder.next) {
+	    if (!wait || !wait->decoding)
+		break;
+	    DEC_Wait();
+	    continue;
+	}
+	job = &decoder.jobs[decoder.head];
+	DEC_Unlock();
+
+	job->sfx->decoding = false;
+	if (job->parse.error[0])
+	    Con_Printf("%s", job->parse.error);
+	if (job->parse.fatal)
+	    Sys_Error("Sound %s has a bad loop length", job->sfx->name);
+	if (job->sc)
+	    S_KeepSfx(job->sfx, job->sc, job->size);
+
+	DEC_Lock();
+	decoder.head = (decoder.head + 1) % DECODE_JOBS;
+    }
+    DEC_Unlock();
+}
 
 /*
 ==============
-S_LoadSound
+S_QueueSound
+
+Starts a sound loading in the background, if it isn't loaded already.
+Returns false if it can't be (no decoder thread, the queue is full or the
+file isn't there), when the caller should load it now.
 ==============
 */
-sfxcache_t *
-S_LoadSound(sfx_t *s)
+static qboolean
+S_QueueSound(sfx_t *s)
+{
+    decodejob_t *job;
+    int next;
+    qboolean queued;
+
+    if (s->decoding || s->arena || Cache_Check(&s->cache))
+	return true;
+    if (!DEC_StartDecoder())
+	return false;
+
+    queued = false;
+    DEC_Lock();
+    next = (decoder.tail + 1) % DECODE_JOBS;
+    if (next != decoder.head) {
+	job = &decoder.jobs[decoder.tail];
+	memset(job, 0, sizeof(*job));
+	if (COM_FindFile(va("sound/%s", s->name), job->path,
+			 sizeof(job->path), &job->offset, &job->length)) {
+	    job->sfx = s;
+	    job->speed = shm->speed;
+	    job->as8bit = loadas8bit.value != 0;
+	    job->parse.filename = s->name;
+	    s->decoding = true;
+	    decoder.tail = next;
+	    queued = true;
+	    DEC_Signal();
+	}
+    }
+    DEC_Unlock();
+
+    return queued;
+}
+
+//=============================================================================
+
+static sfxcache_t *
+S_LoadSfx(sfx_t *s)
 {
     char namebuffer[256];
     byte *data;
-    wavinfo_t *info;
-    int len;
-    float stepscale;
     sfxcache_t *sc;
     byte stackbuf[1024];	// avoid dirtying the cache heap
-
-// see if still in memory
-    sc = Cache_Check(&s->cache);
-    if (sc)
-	return sc;
+    sys_mapping_t mapping;
+    size_t size;
+    wavparse_t parse;
+    int length;
 
 //Con_Printf ("S_LoadSound: %x\n", (int)stackbuf);
 // load it in
@@ -125,37 +537,124 @@ S_LoadSound(sfx_t *s)
 
 //      Con_Printf ("loading %s\n",namebuffer);
 
-    data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf), NULL);
+    /* only needed until it's resampled, so map it if it's in a pak */
+    data = COM_MapFile(namebuffer, &size, &mapping);
+    if (!data)
+	data = COM_LoadStackFile(namebuffer, stackbuf, sizeof(stackbuf),
+				 &size);
 
     if (!data) {
 	Con_Printf("Couldn't load %s\n", namebuffer);
 	return NULL;
     }
 
-    info = GetWavinfo(s->name, data, com_filesize);
-    if (info->channels != 1) {
-	Con_Printf("%s is a stereo sample\n", s->name);
+    memset(&parse, 0, sizeof(parse));
+    parse.filename = s->name;
+    sc = DecodeSfx(&parse, data, size, shm->speed, loadas8bit.value != 0,
+		   &length);
+    Sys_UnmapFile(&mapping);
+    if (parse.error[0])
+	Con_Printf("%s", parse.error);
+    if (parse.fatal)
+	Sys_Error("Sound %s has a bad loop length", s->name);
+    if (!sc)
 	return NULL;
-    }
 
-    stepscale = (float)info->rate / shm->speed;
-    len = info->samples / stepscale;
+    return S_KeepSfx(s, sc, length);
+}
 
-    len = len * info->width * info->channels;
+/*
+==============
+S_LoadSound
+==============
+*/
+sfxcache_t *
+S_LoadSound(sfx_t *s)
+{
+    sfxcache_t *sc;
 
-    sc = Cache_Alloc(&s->cache, len + sizeof(sfxcache_t), s->name);
-    if (!sc)
-	return NULL;
+    if (s->decoding)
+	DEC_TakeDecoded(s);
 
-    sc->length = info->samples;
-    sc->loopstart = info->loopstart;
-    sc->speed = info->rate;
-    sc->width = info->width;
-    sc->stereo = info->channels;
+    s->arenalevel = arena.level;	// used by this level
 
-    ResampleSfx(s, sc->speed, sc->width, data + info->dataofs);
+// see if still in memory
+    if (s->arena)
+	return s->arena;
+    sc = Cache_Check(&s->cache);
+    if (sc)
+	return sc;
 
-    return sc;
+    return S_LoadSfx(s);
+}
+
+/*
+==============
+S_PreloadSound
+
+Precaching: in the background if it can be, or now.
+==============
+*/
+void
+S_PreloadSound(sfx_t *s)
+{
+    s->arenalevel = arena.level;
+    if (!S_QueueSound(s))
+	S_LoadSound(s);
+}
+
+/*
+==============
+S_UpdateSoundCache
+
+Takes whatever the decoder has finished, without waiting.
+==============
+*/
+void
+S_UpdateSoundCache(void)
+{
+    DEC_TakeDecoded(NULL);
+}
+
+/*
+==============
+S_BeginPrecaching / S_EndPrecaching
+==============
+*/
+void
+S_BeginPrecaching(void)
+{
+    arena.level++;
+}
+
+void
+S_EndPrecaching(void)
+{
+    S_UpdateSoundCache();
+}
+
+void
+S_InitSoundCache(void)
+{
+    Cvar_RegisterVariable(&snd_arenasize);
+}
+
+/*
+==============
+S_SoundCacheInfo
+==============
+*/
+void
+S_SoundCacheInfo(void)
+{
+    int count;
+    const sfx_t *sfx;
+
+    count = 0;
+    for (sfx = arena.sounds; sfx; sfx = sfx->arenanext)
+	count++;
+    Con_Printf("%d sounds, %d KB of %d in the sound arena\n", count,
+	       (int)(arena.used / 1024), (int)snd_arenasize.value);
 }
 
 
@@ -169,171 +668,161 @@ WAV loading
 */
 
 
-static const byte *data_p;
-static const byte *iff_end;
-static const byte *last_chunk;
-static const byte *iff_data;
-static int iff_chunk_len;
-
-
 static short
-GetLittleShort(void)
+GetLittleShort(wavparse_t *parse)
 {
     short val = 0;
 
-    val = *data_p;
-    val = val + (*(data_p + 1) << 8);
-    data_p += 2;
+    val = *parse->data_p;
+    val = val + (*(parse->data_p + 1) << 8);
+    parse->data_p += 2;
     return val;
 }
 
 static int
-GetLittleLong(void)
+GetLittleLong(wavparse_t *parse)
 {
     int val = 0;
 
-    val = *data_p;
-    val = val + (*(data_p + 1) << 8);
-    val = val + (*(data_p + 2) << 16);
-    val = val + (*(data_p + 3) << 24);
-    data_p += 4;
+    val = *parse->data_p;
+    val = val + (*(parse->data_p + 1) << 8);
+    val = val + (*(parse->data_p + 2) << 16);
+    val = val + (*(parse->data_p + 3) << 24);
+    parse->data_p += 4;
     return val;
 }
 
 static void
-FindNextChunk(const char *name, const char *filename)
+WavError(wavparse_t *parse, const char *fmt, ...)
+{
+    size_t len = strlen(parse->error);
+    va_list argptr;
+
+    va_start(argptr, fmt);
+    vsnprintf(parse->error + len, sizeof(parse->error) - len, fmt, argptr);
+    va_end(argptr);
+}
+
+static void
+FindNextChunk(wavparse_t *parse, const char *name)
 {
     while (1) {
 	/* Need at least 8 bytes for a chunk */
-	if (last_chunk + 8 >= iff_end) {
-	    data_p = NULL;
+	if (parse->last_chunk + 8 >= parse->iff_end) {
+	    parse->data_p = NULL;
 	    return;
 	}
 
-	data_p = last_chunk + 4;
-	iff_chunk_len = GetLittleLong();
-	if (iff_chunk_len < 0 || iff_chunk_len > iff_end - data_p) {
-	    Con_DPrintf("Bad \"%s\" chunk length (%d) in wav file %s\n",
-			name, iff_chunk_len, filename);
-	    data_p = NULL;
+	parse->data_p = parse->last_chunk + 4;
+	parse->iff_chunk_len = GetLittleLong(parse);
+	if (parse->iff_chunk_len < 0 ||
+	    parse->iff_chunk_len > parse->iff_end - parse->data_p) {
+	    WavError(parse, "Bad \"%s\" chunk length (%d) in wav file %s\n",
+		     name, parse->iff_chunk_len, parse->filename);
+	    parse->data_p = NULL;
 	    return;
 	}
-	last_chunk = data_p + ((iff_chunk_len + 1) & ~1);
-	data_p -= 8;
-	if (!strncmp((const char *)data_p, name, 4))
+	parse->last_chunk =
+	    parse->data_p + ((parse->iff_chunk_len + 1) & ~1);
+	parse->data_p -= 8;
+	if (!strncmp((const char *)parse->data_p, name, 4))
 	    return;
     }
 }
 
 static void
-FindChunk(const char *name, const char *filename)
+FindChunk(wavparse_t *parse, const char *name)
 {
-    last_chunk = iff_data;
-    FindNextChunk(name, filename);
+    parse->last_chunk = parse->iff_data;
+    FindNextChunk(parse, name);
 }
 
-#if 0
-static void
-DumpChunks(void)
-{
-    char str[5];
-
-    str[4] = 0;
-    data_p = iff_data;
-    do {
-	memcpy(str, data_p, 4);
-	data_p += 4;
-	iff_chunk_len = GetLittleLong();
-	Con_Printf("0x%x : %s (%d)\n", (int)(data_p - 4), str, iff_chunk_len);
-	data_p += (iff_chunk_len + 1) & ~1;
-    } while (data_p < iff_end);
-}
-#endif
-
 /*
 ============
 GetWavinfo
 ============
 */
-static wavinfo_t *
-GetWavinfo(const char *name, const byte *wav, int wavlength)
+static qboolean
+GetWavinfo(wavparse_t *parse, const byte *wav, int wavlength,
+	   wavinfo_t *info)
 {
-    static wavinfo_t info;
     int i;
     int format;
     int samples;
 
-    memset(&info, 0, sizeof(info));
+    memset(info, 0, sizeof(*info));
 
     if (!wav)
-	return &info;
+	return false;
 
-    iff_data = wav;
-    iff_end = wav + wavlength;
+    parse->iff_data = wav;
+    parse->iff_end = wav + wavlength;
 
 // find "RIFF" chunk
-    FindChunk("RIFF", name);
-    if (!(data_p && !strncmp((char *)data_p + 8, "WAVE", 4))) {
-	Con_Printf("Missing RIFF/WAVE chunks\n");
-	return &info;
+    FindChunk(parse, "RIFF");
+    if (!(parse->data_p &&
+	  !strncmp((const char *)parse->data_p + 8, "WAVE", 4))) {
+	WavError(parse, "Missing RIFF/WAVE chunks\n");
+	return false;
     }
 // get "fmt " chunk
-    iff_data = data_p + 12;
-// DumpChunks ();
+    parse->iff_data = parse->data_p + 12;
 
-    FindChunk("fmt ", name);
-    if (!data_p) {
-	Con_Printf("Missing fmt chunk\n");
-	return &info;
+    FindChunk(parse, "fmt ");
+    if (!parse->data_p) {
+	WavError(parse, "Missing fmt chunk\n");
+	return false;
     }
-    data_p += 8;
-    format = GetLittleShort();
+    parse->data_p += 8;
+    format = GetLittleShort(parse);
     if (format != 1) {
-	Con_Printf("Microsoft PCM format only\n");
-	return &info;
+	WavError(parse, "Microsoft PCM format only\n");
+	return false;
     }
 
-    info.channels = GetLittleShort();
-    info.rate = GetLittleLong();
-    data_p += 4 + 2;
-    info.width = GetLittleShort() / 8;
+    info->channels = GetLittleShort(parse);
+    info->rate = GetLittleLong(parse);
+    parse->data_p += 4 + 2;
+    info->width = GetLittleShort(parse) / 8;
 
 // get cue chunk
-    FindChunk("cue ", name);
-    if (data_p) {
-	data_p += 32;
-	info.loopstart = GetLittleLong();
+    FindChunk(parse, "cue ");
+    if (parse->data_p) {
+	parse->data_p += 32;
+	info->loopstart = GetLittleLong(parse);
 
 	// if the next chunk is a LIST chunk, look for a cue length marker
-	FindNextChunk("LIST", name);
-	if (data_p) {
+	FindNextChunk(parse, "LIST");
+	if (parse->data_p) {
 	    /* this is not a proper parse, but it works with cooledit... */
-	    if (!strncmp((char *)data_p + 28, "mark", 4)) {
-		data_p += 24;
-		i = GetLittleLong();	// samples in loop
-		info.samples = info.loopstart + i;
+	    if (!strncmp((const char *)parse->data_p + 28, "mark", 4)) {
+		parse->data_p += 24;
+		i = GetLittleLong(parse);	// samples in loop
+		info->samples = info->loopstart + i;
 	    }
 	}
     } else
-	info.loopstart = -1;
+	info->loopstart = -1;
 
 // find data chunk
-    FindChunk("data", name);
-    if (!data_p) {
-	Con_Printf("Missing data chunk\n");
-	return &info;
+    FindChunk(parse, "data");
+    if (!parse->data_p) {
+	WavError(parse, "Missing data chunk\n");
+	return false;
     }
 
-    data_p += 4;
-    samples = GetLittleLong() / info.width;
+    parse->data_p += 4;
+    samples = GetLittleLong(parse) / info->width;
 
-    if (info.samples) {
-	if (samples < info.samples)
-	    Sys_Error("Sound %s has a bad loop length", name);
+    if (info->samples) {
+	if (samples < info->samples) {
+	    parse->fatal = true;
+	    return false;
+	}
     } else
-	info.samples = samples;
+	info->samples = samples;
 
-    info.dataofs = data_p - wav;
+    info->dataofs = parse->data_p - wav;
 
-    return &info;
+    return true;
 }
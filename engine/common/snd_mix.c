@@ -24,6 +24,21 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "sound.h"
 
+/*
+ * SSE2 is always there on x86-64 and NEON on arm64, so those builds paint
+ * the channels and transfer the paint buffer eight or four samples at a
+ * time.  The kernels do the same integer sums as the C loops (the 8-bit
+ * scale table is just a signed sample times a multiple of 8), so the mix
+ * comes out the same to the bit.
+ */
+#if !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__x86_64__)
+#define SND_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__ARM_NEON)
+#define SND_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
 #define PAINTBUFFER_SIZE 512
 portable_samplepair_t paintbuffer[PAINTBUFFER_SIZE];
 int snd_scaletable[32][256];
@@ -33,13 +48,57 @@ short *snd_out;
 void Snd_WriteLinearBlastStereo16(void);
 
 #ifndef USE_X86_ASM
+
+/*
+ * Scales and clamps whole vectors of the paint buffer, returning how many
+ * samples were done.  The C loop finishes off the rest.
+ */
+static inline int
+Snd_WriteLinearBlastVector(short *out, const int *in, int vol, int count)
+{
+    int i = 0;
+#if defined(SND_SIMD_SSE2)
+    const __m128i scale = _mm_set1_epi32(vol);
+    __m128i a, b, even, odd;
+
+    for (; i + 8 <= count; i += 8) {
+	/* low 32 bits of each product, the same signed or unsigned */
+	a = _mm_loadu_si128((const __m128i *)(in + i));
+	even = _mm_mul_epu32(a, scale);
+	odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), scale);
+	a = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			       _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	b = _mm_loadu_si128((const __m128i *)(in + i + 4));
+	even = _mm_mul_epu32(b, scale);
+	odd = _mm_mul_epu32(_mm_srli_epi64(b, 32), scale);
+	b = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			       _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+
+	/* the saturating pack is the clamp */
+	a = _mm_srai_epi32(a, 8);
+	b = _mm_srai_epi32(b, 8);
+	_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(SND_SIMD_NEON)
+    int32x4_t a, b;
+
+    for (; i + 8 <= count; i += 8) {
+	a = vshrq_n_s32(vmulq_n_s32(vld1q_s32(in + i), vol), 8);
+	b = vshrq_n_s32(vmulq_n_s32(vld1q_s32(in + i + 4), vol), 8);
+	vst1q_s16(out + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+#endif
+    return i;
+}
+
 void
 Snd_WriteLinearBlastStereo16(void)
 {
     int i;
     int val;
 
-    for (i = 0; i < snd_linear_count; i += 2) {
+    i = Snd_WriteLinearBlastVector(snd_out, snd_p, snd_vol, snd_linear_count);
+    for (; i < snd_linear_count; i += 2) {
 	val = (snd_p[i] * snd_vol) >> 8;
 	if (val > 0x7fff)
 	    snd_out[i] = 0x7fff;
@@ -173,6 +232,11 @@ S_PaintChannels(int endtime)
     channel_t *ch;
     sfxcache_t *sc;
     int ltime, count;
+    static sfxcache_t *active_sfx[MAX_CHANNELS];
+
+    // nothing moves while we paint, so only look the data up once
+    for (i = 0; i < num_active_channels; i++)
+	active_sfx[i] = S_SfxData(active_channels[i]->sfx);
 
     while (paintedtime < endtime) {
 	// if paintbuffer is smaller than DMA buffer
@@ -184,14 +248,12 @@ S_PaintChannels(int endtime)
 	memset(paintbuffer, 0,
 	       (end - paintedtime) * sizeof(portable_samplepair_t));
 
-	// paint in the channels.
-	ch = channels;
-	for (i = 0; i < total_channels; i++, ch++) {
+	// paint in the channels that can be heard.
+	for (i = 0; i < num_active_channels; i++) {
+	    ch = active_channels[i];
 	    if (!ch->sfx)
 		continue;
-	    if (!ch->leftvol && !ch->rightvol)
-		continue;
-	    sc = S_LoadSound(ch->sfx);
+	    sc = active_sfx[i];
 	    if (!sc)
 		continue;
 
@@ -241,6 +303,104 @@ SND_InitScaletable(void)
 }
 
 
+/*
+ * The vector painting loops, each returning how many samples it painted.
+ * The 8-bit scales are at most 31 * 8, so the products fit in 16 bits; the
+ * 16-bit samples get full 32-bit products.
+ */
+static inline int
+SND_PaintVector8(portable_samplepair_t *out, const signed char *sfx,
+		 int lscale, int rscale, int count)
+{
+    int i = 0;
+#if defined(SND_SIMD_SSE2)
+    const __m128i scale = _mm_setr_epi16(lscale, rscale, lscale, rscale,
+					 lscale, rscale, lscale, rscale);
+    __m128i data, lo, hi, *pb;
+
+    for (; i + 8 <= count; i += 8) {
+	data = _mm_loadl_epi64((const __m128i *)(sfx + i));
+	data = _mm_srai_epi16(_mm_unpacklo_epi8(data, data), 8);
+	lo = _mm_mullo_epi16(_mm_unpacklo_epi16(data, data), scale);
+	hi = _mm_mullo_epi16(_mm_unpackhi_epi16(data, data), scale);
+
+	pb = (__m128i *)(out + i);
+	_mm_storeu_si128(pb, _mm_add_epi32(_mm_loadu_si128(pb),
+		_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)));
+	_mm_storeu_si128(pb + 1, _mm_add_epi32(_mm_loadu_si128(pb + 1),
+		_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)));
+	_mm_storeu_si128(pb + 2, _mm_add_epi32(_mm_loadu_si128(pb + 2),
+		_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)));
+	_mm_storeu_si128(pb + 3, _mm_add_epi32(_mm_loadu_si128(pb + 3),
+		_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)));
+    }
+#elif defined(SND_SIMD_NEON)
+    int16x8_t data;
+    int32x4x2_t pb;
+
+    for (; i + 8 <= count; i += 8) {
+	data = vmovl_s8(vld1_s8(sfx + i));
+	pb = vld2q_s32(&out[i].left);
+	pb.val[0] = vmlal_n_s16(pb.val[0], vget_low_s16(data), lscale);
+	pb.val[1] = vmlal_n_s16(pb.val[1], vget_low_s16(data), rscale);
+	vst2q_s32(&out[i].left, pb);
+	pb = vld2q_s32(&out[i + 4].left);
+	pb.val[0] = vmlal_n_s16(pb.val[0], vget_high_s16(data), lscale);
+	pb.val[1] = vmlal_n_s16(pb.val[1], vget_high_s16(data), rscale);
+	vst2q_s32(&out[i + 4].left, pb);
+    }
+#endif
+    return i;
+}
+
+static inline int
+SND_PaintVector16(portable_samplepair_t *out, const signed short *sfx,
+		  int leftvol, int rightvol, int count)
+{
+    int i = 0;
+#if defined(SND_SIMD_SSE2)
+    const __m128i vol = _mm_setr_epi16(leftvol, rightvol, leftvol, rightvol,
+				       leftvol, rightvol, leftvol, rightvol);
+    __m128i data, pairs, lo, hi, *pb;
+    int j;
+
+    for (; i + 8 <= count; i += 8) {
+	data = _mm_loadu_si128((const __m128i *)(sfx + i));
+	pb = (__m128i *)(out + i);
+	for (j = 0; j < 2; j++, pb += 2) {
+	    pairs = j ? _mm_unpackhi_epi16(data, data)
+		      : _mm_unpacklo_epi16(data, data);
+	    lo = _mm_mullo_epi16(pairs, vol);
+	    hi = _mm_mulhi_epi16(pairs, vol);
+	    _mm_storeu_si128(pb, _mm_add_epi32(_mm_loadu_si128(pb),
+		    _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 8)));
+	    _mm_storeu_si128(pb + 1, _mm_add_epi32(_mm_loadu_si128(pb + 1),
+		    _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 8)));
+	}
+    }
+#elif defined(SND_SIMD_NEON)
+    int16x8_t data;
+    int32x4x2_t pb;
+
+    for (; i + 8 <= count; i += 8) {
+	data = vld1q_s16(sfx + i);
+	pb = vld2q_s32(&out[i].left);
+	pb.val[0] = vaddq_s32(pb.val[0],
+			      vshrq_n_s32(vmull_n_s16(vget_low_s16(data), leftvol), 8));
+	pb.val[1] = vaddq_s32(pb.val[1],
+			      vshrq_n_s32(vmull_n_s16(vget_low_s16(data), rightvol), 8));
+	vst2q_s32(&out[i].left, pb);
+	pb = vld2q_s32(&out[i + 4].left);
+	pb.val[0] = vaddq_s32(pb.val[0],
+			      vshrq_n_s32(vmull_n_s16(vget_high_s16(data), leftvol), 8));
+	pb.val[1] = vaddq_s32(pb.val[1],
+			      vshrq_n_s32(vmull_n_s16(vget_high_s16(data), rightvol), 8));
+	vst2q_s32(&out[i + 4].left, pb);
+    }
+#endif
+    return i;
+}
+
 #ifndef USE_X86_ASM
 
 void
@@ -260,7 +420,9 @@ SND_PaintChannelFrom8(channel_t *ch, sfxcache_t *sc, int count)
     rscale = snd_scaletable[ch->rightvol >> 3];
     sfx = (unsigned char *)sc->data + ch->pos;
 
-    for (i = 0; i < count; i++) {
+    i = SND_PaintVector8(paintbuffer, (const signed char *)sfx,
+			 (ch->leftvol >> 3) * 8, (ch->rightvol >> 3) * 8, count);
+    for (; i < count; i++) {
 	data = sfx[i];
 	paintbuffer[i].left += lscale[data];
 	paintbuffer[i].right += rscale[data];
@@ -285,7 +447,8 @@ SND_PaintChannelFrom16(channel_t *ch, sfxcache_t *sc, int count)
     rightvol = ch->rightvol;
     sfx = (signed short *)sc->data + ch->pos;
 
-    for (i = 0; i < count; i++) {
+    i = SND_PaintVector16(paintbuffer, sfx, leftvol, rightvol, count);
+    for (; i < count; i++) {
 	data = sfx[i];
 	left = (data * leftvol) >> 8;
 	right = (data * rightvol) >> 8;
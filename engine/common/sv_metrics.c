@@ -0,0 +1,593 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_metrics.c -- server metrics for scraping, served by a thread
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "console.h"
+#include "cvar.h"
+#include "mathlib.h"
+#include "net.h"
+#include "progs.h"
+#include "server.h"
+#include "sv_metrics.h"
+#include "sv_profile.h"
+#include "zone.h"
+
+#ifdef NQ_HACK
+#include "quakedef.h"
+#endif
+#if defined(QW_HACK) && defined(SERVERONLY)
+#include "qwsvdef.h"
+#endif
+
+/*
+==============================================================================
+
+METRICS
+
+"sv_metrics_port <port>" listens for TCP connections on the port, and
+answers each one, HTTP or not, with the metrics in the Prometheus text
+format: frame time percentiles by phase over the last METRICS_WINDOW frames
+(from the frame profiler, which is kept timing while the port is open),
+QuakeC time, packets and bytes in and out, edicts, memory and each client's
+ping, and for QW their rate, choke and loss.
+
+The server frame only copies the figures into a snapshot under a lock.  The
+thread takes a copy of the snapshot, and sorts and prints it on its own
+time, one connection at a time.  Setting the port to 0 closes it again.
+
+==============================================================================
+*/
+
+#define METRICS_WINDOW		1024	// a power of two
+#define METRICS_MAXCLIENTS	32
+#define METRICS_WAIT_MSEC	250	// between checks for a quit
+#define METRICS_TIMEOUT		2	// seconds a scraper gets to talk
+#define METRICS_TEXT		65536
+
+static cvar_t sv_metrics_port = { "sv_metrics_port", "0" };
+
+typedef struct {
+    char name[32];
+    int slot;
+    float ping;			// seconds
+#if defined(QW_HACK) && defined(SERVERONLY)
+    int rate;			// bytes per second
+    int choked;			// frames choked since connecting
+    int loss;			// percent
+#endif
+} metricsclient_t;
+
+typedef struct {
+    char map[64];
+    unsigned frames;		// timed, since the port was opened
+    double seconds[SVP_NUMTIMES];	// spent in each, over those frames
+    netstats_t net;
+    memusage_t memory;
+    int edicts, active_edicts, max_edicts;
+    int numclients;
+    metricsclient_t clients[METRICS_MAXCLIENTS];
+
+    int next;			// of the frame times
+    int count;
+    float times[METRICS_WINDOW][SVP_NUMTIMES];	// msec
+} metricsstate_t;
+
+#ifdef _WIN32
+typedef SOCKET msocket_t;
+#define METRICS_NOSOCKET INVALID_SOCKET
+#define M_CloseSocket(s) closesocket(s)
+#else
+typedef int msocket_t;
+#define METRICS_NOSOCKET (-1)
+#define M_CloseSocket(s) close(s)
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define METRICS_SENDFLAGS MSG_NOSIGNAL
+#else
+#define METRICS_SENDFLAGS 0
+#endif
+
+static struct {
+    int port;			// last asked for, 0 for none
+    msocket_t socket;		// listening, if the port opened
+    qboolean started;
+    qboolean quit;
+    metricsstate_t shared;	// under the lock
+
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+#else
+    pthread_t thread;
+    pthread_mutex_t lock;
+#endif
+} metrics = { .socket = METRICS_NOSOCKET };
+
+#ifdef _WIN32
+#define M_Lock()	EnterCriticalSection(&metrics.lock)
+#define M_Unlock()	LeaveCriticalSection(&metrics.lock)
+#else
+#define M_Lock()	pthread_mutex_lock(&metrics.lock)
+#define M_Unlock()	pthread_mutex_unlock(&metrics.lock)
+#endif
+
+/* Owned by the thread */
+static metricsstate_t metrics_copy;
+static float metrics_sorted[METRICS_WINDOW];
+static struct {
+    char data[METRICS_TEXT];
+    int length;
+} metrics_text;
+
+/*
+==============================================================================
+
+THE SERVING THREAD
+
+==============================================================================
+*/
+
+static void
+M_Printf(const char *fmt, ...)
+{
+    va_list argptr;
+    int room, length;
+
+    room = sizeof(metrics_text.data) - metrics_text.length;
+    if (room <= 1)
+	return;
+    va_start(argptr, fmt);
+    length = vsnprintf(metrics_text.data + metrics_text.length, room, fmt,
+		       argptr);
+    va_end(argptr);
+    if (length > 0)
+	metrics_text.length += qmin(length, room - 1);
+}
+
+/* A label value, with the quotes and anything unprintable escaped */
+static const char *
+M_Label(const char *in)
+{
+    static char label[sizeof(((metricsclient_t *)0)->name) * 2];
+    char *out = label;
+    int c;
+
+    while (*in && out < label + sizeof(label) - 2) {
+	c = *in++ & 0x7f;	// no coloured text
+	if (c == '"' || c == '\\') {
+	    *out++ = '\\';
+	    *out++ = c;
+	} else {
+	    *out++ = c < 32 || c == 127 ? '?' : c;
+	}
+    }
+    *out = 0;
+
+    return label;
+}
+
+static int
+M_CompareTimes(const void *a, const void *b)
+{
+    float time1 = *(const float *)a;
+    float time2 = *(const float *)b;
+
+    return (time1 > time2) - (time1 < time2);
+}
+
+static void
+M_PrintFrameTimes(const metricsstate_t *state)
+{
+    static const int quantiles[] = { 50, 90, 99, 100 };
+    const char *name;
+    int i, j, count;
+
+    M_Printf("# HELP quake_frame_seconds Server frame time by phase\n");
+    M_Printf("# TYPE quake_frame_seconds summary\n");
+    count = state->count;
+    for (i = 0; i < SVP_NUMTIMES; i++) {
+	name = SV_ProfileTimeName(i);
+	for (j = 0; j < count; j++)
+	    metrics_sorted[j] = state->times[j][i];
+	qsort(metrics_sorted, count, sizeof(metrics_sorted[0]),
+	      M_CompareTimes);
+	for (j = 0; j < ARRAY_SIZE(quantiles) && count; j++)
+	    M_Printf("quake_frame_seconds{phase=\"%s\",quantile=\"%g\"} %g\n",
+		     name, quantiles[j] / 100.0,
+		     metrics_sorted[(count - 1) * quantiles[j] / 100] / 1000);
+	M_Printf("quake_frame_seconds_sum{phase=\"%s\"} %.6f\n", name,
+		 state->seconds[i]);
+	M_Printf("quake_frame_seconds_count{phase=\"%s\"} %u\n", name,
+		 state->frames);
+    }
+
+    M_Printf("# HELP quake_qc_seconds_total Time in QuakeC functions\n");
+    M_Printf("# TYPE quake_qc_seconds_total counter\n");
+    M_Printf("quake_qc_seconds_total %.6f\n",
+	     state->seconds[SVP_THINK] + state->seconds[SVP_TOUCH]);
+}
+
+static void
+M_PrintClients(const metricsstate_t *state)
+{
+    const metricsclient_t *client;
+    int i;
+
+    M_Printf("# TYPE quake_clients gauge\n");
+    M_Printf("quake_clients %d\n", state->numclients);
+
+    M_Printf("# TYPE quake_client_ping_seconds gauge\n");
+    for (i = 0, client = state->clients; i < state->numclients; i++, client++)
+	M_Printf("quake_client_ping_seconds{slot=\"%d\",name=\"%s\"} %.3f\n",
+		 client->slot, M_Label(client->name), client->ping);
+#if defined(QW_HACK) && defined(SERVERONLY)
+    M_Printf("# TYPE quake_client_rate_bytes gauge\n");
+    for (i = 0, client = state->clients; i < state->numclients; i++, client++)
+	M_Printf("quake_client_rate_bytes{slot=\"%d\",name=\"%s\"} %d\n",
+		 client->slot, M_Label(client->name), client->rate);
+    M_Printf("# TYPE quake_client_choked_total counter\n");
+    for (i = 0, client = state->clients; i < state->numclients; i++, client++)
+	M_Printf("quake_client_choked_total{slot=\"%d\",name=\"%s\"} %d\n",
+		 client->slot, M_Label(client->name), client->choked);
+    M_Printf("# TYPE quake_client_loss_ratio gauge\n");
+    for (i = 0, client = state->clients; i < state->numclients; i++, client++)
+	M_Printf("quake_client_loss_ratio{slot=\"%d\",name=\"%s\"} %.2f\n",
+		 client->slot, M_Label(client->name), client->loss / 100.0);
+#endif
+}
+
+static void
+M_PrintMetrics(const metricsstate_t *state)
+{
+    const memusage_t *memory = &state->memory;
+
+    metrics_text.length = 0;
+
+    M_Printf("# TYPE quake_map_info gauge\n");
+    M_Printf("quake_map_info{map=\"%s\"} 1\n", M_Label(state->map));
+    M_PrintFrameTimes(state);
+
+    M_Printf("# TYPE quake_net_packets_total counter\n");
+    M_Printf("quake_net_packets_total{direction=\"in\"} %llu\n",
+	     state->net.packets_in);
+    M_Printf("quake_net_packets_total{direction=\"out\"} %llu\n",
+	     state->net.packets_out);
+    M_Printf("# TYPE quake_net_bytes_total counter\n");
+    M_Printf("quake_net_bytes_total{direction=\"in\"} %llu\n",
+	     state->net.bytes_in);
+    M_Printf("quake_net_bytes_total{direction=\"out\"} %llu\n",
+	     state->net.bytes_out);
+
+    M_Printf("# TYPE quake_edicts gauge\n");
+    M_Printf("quake_edicts{state=\"active\"} %d\n", state->active_edicts);
+    M_Printf("quake_edicts{state=\"allocated\"} %d\n", state->edicts);
+    M_Printf("quake_edicts{state=\"max\"} %d\n", state->max_edicts);
+
+    M_Printf("# HELP quake_memory_bytes The cache is inside the hunk\n");
+    M_Printf("# TYPE quake_memory_bytes gauge\n");
+    M_Printf("quake_memory_bytes{pool=\"hunk\",use=\"size\"} %d\n",
+	     memory->hunk_size);
+    M_Printf("quake_memory_bytes{pool=\"hunk\",use=\"low\"} %d\n",
+	     memory->hunk_low);
+    M_Printf("quake_memory_bytes{pool=\"hunk\",use=\"high\"} %d\n",
+	     memory->hunk_high);
+    M_Printf("quake_memory_bytes{pool=\"cache\",use=\"used\"} %d\n",
+	     memory->cache_used);
+    M_Printf("quake_memory_bytes{pool=\"zone\",use=\"size\"} %d\n",
+	     memory->zone_size);
+    M_Printf("quake_memory_bytes{pool=\"zone\",use=\"used\"} %d\n",
+	     memory->zone_used);
+
+    M_PrintClients(state);
+}
+
+static void
+M_SetTimeout(msocket_t s)
+{
+#ifdef _WIN32
+    DWORD timeout = METRICS_TIMEOUT * 1000;
+#else
+    struct timeval timeout = { METRICS_TIMEOUT, 0 };
+#endif
+
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+	       sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+	       sizeof(timeout));
+}
+
+/* Waits for the socket to be readable, false if it wasn't in time */
+static qboolean
+M_Wait(msocket_t s, int msec)
+{
+    struct timeval timeout;
+    fd_set readable;
+
+    FD_ZERO(&readable);
+    FD_SET(s, &readable);
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
+
+    return select((int)s + 1, &readable, NULL, NULL, &timeout) > 0;
+}
+
+static void
+M_Serve(msocket_t client)
+{
+    char request[1024], header[160];
+    int length, sent, ret;
+
+    /* whatever was asked for, the answer is the same */
+    M_SetTimeout(client);
+    if (M_Wait(client, METRICS_TIMEOUT * 1000))
+	recv(client, request, sizeof(request), 0);
+
+    M_Lock();
+    memcpy(&metrics_copy, &metrics.shared, sizeof(metrics_copy));
+    M_Unlock();
+    M_PrintMetrics(&metrics_copy);
+
+    length = snprintf(header, sizeof(header),
+		      "HTTP/1.0 200 OK\r\n"
+		      "Content-Type: text/plain; version=0.0.4\r\n"
+		      "Content-Length: %d\r\n"
+		      "Connection: close\r\n\r\n", metrics_text.length);
+    if (send(client, header, length, METRICS_SENDFLAGS) != length)
+	return;
+    for (sent = 0; sent < metrics_text.length; sent += ret) {
+	ret = send(client, metrics_text.data + sent,
+		   metrics_text.length - sent, METRICS_SENDFLAGS);
+	if (ret <= 0)
+	    break;
+    }
+}
+
+static void
+M_RunServer(void)
+{
+    msocket_t client;
+    qboolean quit;
+
+    for (;;) {
+	M_Lock();
+	quit = metrics.quit;
+	M_Unlock();
+	if (quit)
+	    break;
+	if (!M_Wait(metrics.socket, METRICS_WAIT_MSEC))
+	    continue;
+	client = accept(metrics.socket, NULL, NULL);
+	if (client == METRICS_NOSOCKET)
+	    continue;
+	M_Serve(client);
+	M_CloseSocket(client);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+M_ServerMain(LPVOID arg)
+{
+    M_RunServer();
+    return 0;
+}
+#else
+static void *
+M_ServerMain(void *arg)
+{
+    M_RunServer();
+    return NULL;
+}
+#endif
+
+/*
+==============================================================================
+
+THE SERVER SIDE
+
+==============================================================================
+*/
+
+static void
+SV_MetricsClose(void)
+{
+    if (metrics.started) {
+	M_Lock();
+	metrics.quit = true;
+	M_Unlock();
+#ifdef _WIN32
+	WaitForSingleObject(metrics.thread, INFINITE);
+	CloseHandle(metrics.thread);
+#else
+	pthread_join(metrics.thread, NULL);
+#endif
+	metrics.started = false;
+    }
+    if (metrics.socket != METRICS_NOSOCKET) {
+	M_CloseSocket(metrics.socket);
+	metrics.socket = METRICS_NOSOCKET;
+    }
+    SV_ProfileRequire(false);
+}
+
+static void
+SV_MetricsOpen(int port)
+{
+    struct sockaddr_in address;
+    int reuse = 1;
+
+    metrics.socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (metrics.socket == METRICS_NOSOCKET) {
+	Con_Printf("%s: couldn't make a socket\n", sv_metrics_port.name);
+	return;
+    }
+    setsockopt(metrics.socket, SOL_SOCKET, SO_REUSEADDR,
+	       (const char *)&reuse, sizeof(reuse));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons((unsigned short)port);
+    if (bind(metrics.socket, (struct sockaddr *)&address, sizeof(address))
+	|| listen(metrics.socket, 4)) {
+	Con_Printf("%s: couldn't listen on port %d\n", sv_metrics_port.name,
+		   port);
+	M_CloseSocket(metrics.socket);
+	metrics.socket = METRICS_NOSOCKET;
+	return;
+    }
+
+    memset(&metrics.shared, 0, sizeof(metrics.shared));
+    metrics.quit = false;
+#ifdef _WIN32
+    metrics.thread = CreateThread(NULL, 0, M_ServerMain, NULL, 0, NULL);
+    metrics.started = metrics.thread != NULL;
+#else
+    metrics.started = !pthread_create(&metrics.thread, NULL, M_ServerMain,
+				      NULL);
+#endif
+    if (!metrics.started) {
+	Con_Printf("%s: couldn't start the thread\n", sv_metrics_port.name);
+	SV_MetricsClose();
+	return;
+    }
+
+    SV_ProfileRequire(true);
+    Con_Printf("Serving metrics on TCP port %d\n", port);
+}
+
+static void
+SV_MetricsClients(metricsstate_t *state)
+{
+    metricsclient_t *out;
+    const client_t *client;
+    int i;
+#ifdef NQ_HACK
+    int j;
+
+    state->numclients = 0;
+    client = svs.clients;
+    for (i = 0; i < svs.maxclients; i++, client++) {
+	if (!client->active || state->numclients == METRICS_MAXCLIENTS)
+	    continue;
+	out = &state->clients[state->numclients++];
+	snprintf(out->name, sizeof(out->name), "%s", client->name);
+	out->slot = i;
+	out->ping = 0;
+	for (j = 0; j < NUM_PING_TIMES; j++)
+	    out->ping += client->ping_times[j];
+	out->ping /= NUM_PING_TIMES;
+    }
+#endif
+#if defined(QW_HACK) && defined(SERVERONLY)
+    state->numclients = 0;
+    client = svs.clients;
+    for (i = 0; i < MAX_CLIENTS; i++, client++) {
+	if (client->state < cs_connected
+	    || state->numclients == METRICS_MAXCLIENTS)
+	    continue;
+	out = &state->clients[state->numclients++];
+	snprintf(out->name, sizeof(out->name), "%s", client->name);
+	out->slot = i;
+	out->ping = SV_CalcPing((client_t *)client) / 1000.0f;
+	out->rate = client->netchan.rate > 0
+	    ? (int)(1.0 / client->netchan.rate + 0.5) : 0;
+	out->choked = client->choketotal;
+	out->loss = client->lossage;
+    }
+#endif
+}
+
+/*
+==============
+SV_MetricsFrame
+
+Opens or closes the port if it was changed, and copies this frame's
+figures out for the thread.
+==============
+*/
+void
+SV_MetricsFrame(void)
+{
+    metricsstate_t *state = &metrics.shared;
+    const float *times;
+    int i;
+
+    if ((int)sv_metrics_port.value != metrics.port) {
+	SV_MetricsClose();
+	metrics.port = sv_metrics_port.value;
+	if (metrics.port > 0 && metrics.port < 65536)
+	    SV_MetricsOpen(metrics.port);
+    }
+    if (!metrics.started)
+	return;
+
+    M_Lock();
+
+    times = SV_ProfileLastFrame();
+    if (times) {
+	memcpy(state->times[state->next], times, sizeof(state->times[0]));
+	state->next = (state->next + 1) & (METRICS_WINDOW - 1);
+	if (state->count < METRICS_WINDOW)
+	    state->count++;
+	for (i = 0; i < SVP_NUMTIMES; i++)
+	    state->seconds[i] += times[i] / 1000;
+	state->frames++;
+    }
+
+    snprintf(state->map, sizeof(state->map), "%s", sv.name);
+    state->net = net_stats;
+    Memory_GetUsage(&state->memory);
+    state->edicts = sv.num_edicts;
+    state->active_edicts = sv.edicts ? ED_NumActive() : 0;
+    state->max_edicts = sv.max_edicts;
+    SV_MetricsClients(state);
+
+    M_Unlock();
+}
+
+void
+SV_MetricsInit(void)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&metrics.lock);
+#else
+    pthread_mutex_init(&metrics.lock, NULL);
+#endif
+    Cvar_RegisterVariable(&sv_metrics_port);
+}
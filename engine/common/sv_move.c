@@ -34,43 +34,61 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	STEPSIZE	18
 
 /*
-=============
-SV_CheckBottom
+ * The traces in SV_CheckBottom only hit the world and brush entities, so the
+ * answer for a box holds until one of those moves.  Monsters that are stuck
+ * or milling about ask about the same spots frame after frame, so the last
+ * answers are kept, keyed on the entity and its exact box.  An entity with
+ * an owner is left out, as the traces pass through its owner.
+ */
+#define	BOTTOM_CACHE	256
+
+typedef struct {
+    int entnum;			// 0 if unused
+    unsigned brushgen;		// sv_brushgen when checked
+    vec3_t mins, maxs;
+    qboolean result;
+} bottomcheck_t;
+
+static bottomcheck_t sv_bottomcache[BOTTOM_CACHE];
+
+static bottomcheck_t *
+SV_BottomCheck(int entnum, const vec3_t mins)
+{
+    const byte *bytes = (const byte *)mins;
+    unsigned hash = 2166136261u ^ entnum;
+    int i;
 
-Returns false if any part of the bottom of the entity is off an edge that
-is not a staircase.
+    for (i = 0; i < sizeof(vec3_t); i++) {
+	hash ^= bytes[i];
+	hash *= 16777619u;
+    }
 
-=============
-*/
-qboolean
-SV_CheckBottom(edict_t *ent)
+    return &sv_bottomcache[hash % BOTTOM_CACHE];
+}
+
+/*
+ * Checks it for real, with a line down from the middle and each corner.  The
+ * lines are all in one small box, so the area nodes are walked just once.
+ */
+static qboolean
+SV_CheckBottomTraces(edict_t *ent, const vec3_t mins, const vec3_t maxs)
 {
-    vec3_t mins, maxs, start, stop;
+    vec3_t start, stop, areamins, areamaxs;
+    tracearea_t area;
     trace_t trace;
     int x, y;
     float mid, bottom;
 
-    VectorAdd(ent->v.origin, ent->v.mins, mins);
-    VectorAdd(ent->v.origin, ent->v.maxs, maxs);
-
-// if all of the points under the corners are solid world, don't bother
-// with the tougher checks
-// the corners must be within 16 of the midpoint
-    start[2] = mins[2] - 1;
-    for (x = 0; x <= 1; x++) {
-	for (y = 0; y <= 1; y++) {
-	    start[0] = x ? maxs[0] : mins[0];
-	    start[1] = y ? maxs[1] : mins[1];
-	    if (SV_PointContents(start) != CONTENTS_SOLID)
-		goto realcheck;
-	}
+    VectorCopy(mins, areamins);
+    VectorCopy(maxs, areamaxs);
+    areamins[2] -= 2 * STEPSIZE;
+    areamaxs[2] = mins[2];
+    for (x = 0; x < 3; x++) {
+	areamins[x] -= 1;
+	areamaxs[x] += 1;
     }
-    return true;		// we got out easy
+    SV_InitTraceArea(&area, areamins, areamaxs, MOVE_NOMONSTERS, ent);
 
-  realcheck:
-//
-// check it for real...
-//
     start[2] = mins[2];
 
 // the midpoint must be within 16 of the bottom
@@ -78,7 +96,7 @@ SV_CheckBottom(edict_t *ent)
     start[1] = stop[1] = (mins[1] + maxs[1]) * 0.5;
     stop[2] = start[2] - 2 * STEPSIZE;
 
-    SV_TraceLine(start, stop, MOVE_NOMONSTERS, ent, &trace);
+    SV_TraceAreaLine(&area, start, stop, &trace);
     if (trace.fraction == 1.0)
 	return false;
     mid = bottom = trace.endpos[2];
@@ -89,7 +107,7 @@ SV_CheckBottom(edict_t *ent)
 	    start[0] = stop[0] = x ? maxs[0] : mins[0];
 	    start[1] = stop[1] = y ? maxs[1] : mins[1];
 
-	    SV_TraceLine(start, stop, MOVE_NOMONSTERS, ent, &trace);
+	    SV_TraceAreaLine(&area, start, stop, &trace);
 	    if (trace.fraction != 1.0 && trace.endpos[2] > bottom)
 		bottom = trace.endpos[2];
 	    if (trace.fraction == 1.0 || mid - trace.endpos[2] > STEPSIZE)
@@ -100,6 +118,58 @@ SV_CheckBottom(edict_t *ent)
     return true;
 }
 
+/*
+=============
+SV_CheckBottom
+
+Returns false if any part of the bottom of the entity is off an edge that
+is not a staircase.
+
+=============
+*/
+qboolean
+SV_CheckBottom(edict_t *ent)
+{
+    vec3_t mins, maxs, start;
+    bottomcheck_t *check;
+    int x, y, entnum;
+
+    VectorAdd(ent->v.origin, ent->v.mins, mins);
+    VectorAdd(ent->v.origin, ent->v.maxs, maxs);
+
+// if all of the points under the corners are solid world, don't bother
+// with the tougher checks
+// the corners must be within 16 of the midpoint
+    start[2] = mins[2] - 1;
+    for (x = 0; x <= 1; x++) {
+	for (y = 0; y <= 1; y++) {
+	    start[0] = x ? maxs[0] : mins[0];
+	    start[1] = y ? maxs[1] : mins[1];
+	    if (SV_PointContents(start) != CONTENTS_SOLID)
+		goto realcheck;
+	}
+    }
+    return true;		// we got out easy
+
+  realcheck:
+    if (ent->v.owner)
+	return SV_CheckBottomTraces(ent, mins, maxs);
+
+    entnum = NUM_FOR_EDICT(ent);
+    check = SV_BottomCheck(entnum, mins);
+    if (check->entnum == entnum && check->brushgen == sv_brushgen
+	&& VectorCompare(check->mins, mins) && VectorCompare(check->maxs, maxs))
+	return check->result;
+
+    check->entnum = entnum;
+    check->brushgen = sv_brushgen;
+    VectorCopy(mins, check->mins);
+    VectorCopy(maxs, check->maxs);
+    check->result = SV_CheckBottomTraces(ent, mins, maxs);
+
+    return check->result;
+}
+
 
 /*
 =============
@@ -19,9 +19,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // sv_phys.c
 
+#include <stdlib.h>
+
 #include "console.h"
 #include "progs.h"
 #include "server.h"
+#include "sv_profile.h"
+#include "trace.h"
 #include "world.h"
 
 #ifdef NQ_HACK
@@ -58,6 +62,7 @@ cvar_t sv_friction = { "sv_friction", "4" };
 cvar_t sv_gravity = { "sv_gravity", "800" };
 cvar_t sv_stopspeed = { "sv_stopspeed", "100" };
 cvar_t sv_maxvelocity = { "sv_maxvelocity", "2000" };
+cvar_t sv_physthreads = { "sv_physthreads", "0" };
 
 #ifdef NQ_HACK
 static void SV_Physics_Toss(edict_t *ent);
@@ -89,7 +94,7 @@ SV_CheckAllEnts(void)
 // see if any solid entities are inside the final position
     check = NEXT_EDICT(sv.edicts);
     for (i = 1; i < sv.num_edicts; i++, check = NEXT_EDICT(check)) {
-	if (check->free)
+	if (sv.edhot[i].free)
 	    continue;
 	if (check->v.movetype == MOVETYPE_PUSH
 	    || check->v.movetype == MOVETYPE_NONE
@@ -164,7 +169,9 @@ SV_RunThink(edict_t *ent)
     pr_global_struct->time = thinktime;
     pr_global_struct->self = EDICT_TO_PROG(ent);
     pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
+    SV_ProfileBegin(SVP_THINK);
     PR_ExecuteProgram(ent->v.think);
+    SV_ProfileEnd();
 
     if (ent->free)
 	return false;
@@ -195,13 +202,17 @@ SV_Impact(const edict_t *e1, const edict_t *e2)
     if (e1->v.touch && e1->v.solid != SOLID_NOT) {
 	pr_global_struct->self = EDICT_TO_PROG(e1);
 	pr_global_struct->other = EDICT_TO_PROG(e2);
+	SV_ProfileBegin(SVP_TOUCH);
 	PR_ExecuteProgram(e1->v.touch);
+	SV_ProfileEnd();
     }
 
     if (e2->v.touch && e2->v.solid != SOLID_NOT) {
 	pr_global_struct->self = EDICT_TO_PROG(e2);
 	pr_global_struct->other = EDICT_TO_PROG(e1);
+	SV_ProfileBegin(SVP_TOUCH);
 	PR_ExecuteProgram(e2->v.touch);
+	SV_ProfileEnd();
     }
 
     pr_global_struct->self = old_self;
@@ -400,22 +411,28 @@ SV_AddGravity
 
 ============
 */
-static void
-SV_AddGravity(edict_t *ent)
+static double
+SV_Gravity(edict_t *ent)
 {
 #ifdef NQ_HACK
     float scale;
     eval_t *val;
 
-    val = GetEdictFieldValue(ent, "gravity");
+    val = GetEdictField(ent, pr_extfields.gravity);
     scale = (val && val->_float) ? val->_float : 1.0;
-    ent->v.velocity[2] -= scale * sv_gravity.value * host_frametime;
+    return scale * sv_gravity.value * host_frametime;
 #endif
 #ifdef QW_HACK
-    ent->v.velocity[2] -= movevars.gravity * host_frametime;
+    return movevars.gravity * host_frametime;
 #endif
 }
 
+static void
+SV_AddGravity(edict_t *ent)
+{
+    ent->v.velocity[2] -= SV_Gravity(ent);
+}
+
 /*
 ===============================================================================
 
@@ -431,34 +448,91 @@ SV_PushEntity
 Does not change the entities velocity at all
 ============
 */
-static const edict_t *
-SV_PushEntity(edict_t *ent, const vec3_t push, trace_t *trace)
+static movetype_t
+SV_PushMoveType(const edict_t *ent)
 {
-    vec3_t end;
-    movetype_t movetype;
-    const edict_t *blocker;
-
-    VectorAdd(ent->v.origin, push, end);
-
     if (ent->v.movetype == MOVETYPE_FLYMISSILE)
-	movetype = MOVE_MISSILE;
-    else if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
+	return MOVE_MISSILE;
+    if (ent->v.solid == SOLID_TRIGGER || ent->v.solid == SOLID_NOT)
 	/* only clip against bmodels */
-	movetype = MOVE_NOMONSTERS;
-    else
-	movetype = MOVE_NORMAL;
+	return MOVE_NOMONSTERS;
+
+    return MOVE_NORMAL;
+}
 
-    blocker = SV_TraceMoveEntity(ent, ent->v.origin, end, movetype, trace);
+/* Moves the entity to the end of the trace and runs the touches */
+static void
+SV_PushEntityTo(edict_t *ent, const edict_t *blocker, const trace_t *trace)
+{
     VectorCopy(trace->endpos, ent->v.origin);
     SV_LinkEdict(ent, true);
 
     if (blocker)
 	SV_Impact(ent, blocker);
+}
+
+static const edict_t *
+SV_PushEntity(edict_t *ent, const vec3_t push, trace_t *trace)
+{
+    vec3_t end;
+    const edict_t *blocker;
+
+    VectorAdd(ent->v.origin, push, end);
+    blocker = SV_TraceMoveEntity(ent, ent->v.origin, end,
+				 SV_PushMoveType(ent), trace);
+    SV_PushEntityTo(ent, blocker, trace);
 
     return blocker;
 }
 
 
+/*
+ * The edicts a pusher might move are the ones linked anywhere in the box it
+ * sweeps through, riders included, as they touch its top.  The scratch
+ * space grows to the most candidates seen and is kept.
+ */
+static edict_t **push_check;
+static edict_t **moved_edict;
+static vec3_t *moved_from;
+static int max_check;
+
+static int
+SV_CompareEdicts(const void *a, const void *b)
+{
+    const edict_t *edict1 = *(const edict_t *const *)a;
+    const edict_t *edict2 = *(const edict_t *const *)b;
+
+    return (edict1 > edict2) - (edict1 < edict2);
+}
+
+/* Fills push_check with the edicts in the swept box, in edict order */
+static int
+SV_PushCandidates(const edict_t *pusher, const vec3_t move)
+{
+    vec3_t mins, maxs;
+    int i, num_check;
+
+    for (i = 0; i < 3; i++) {
+	mins[i] = pusher->v.absmin[i] + qmin(move[i], 0.0f);
+	maxs[i] = pusher->v.absmax[i] + qmax(move[i], 0.0f);
+    }
+
+    for (;;) {
+	num_check = SV_AreaPushEdicts(mins, maxs, push_check, max_check);
+	if (num_check < max_check)
+	    break;
+	max_check = max_check ? max_check * 2 : 64;
+	push_check = realloc(push_check, max_check * sizeof(*push_check));
+	moved_edict = realloc(moved_edict, max_check * sizeof(*moved_edict));
+	moved_from = realloc(moved_from, max_check * sizeof(*moved_from));
+	if (!push_check || !moved_edict || !moved_from)
+	    SV_Error("%s: out of memory", __func__);
+    }
+    qsort(push_check, num_check, sizeof(*push_check), SV_CompareEdicts);
+
+    return num_check;
+}
+
 /*
 ============
 SV_Push
@@ -467,17 +541,17 @@ SV_Push
 static qboolean
 SV_Push(edict_t *pusher, const vec3_t move)
 {
-    int i;
+    int i, j;
     edict_t *check, *block;
     vec3_t mins, maxs;
     vec3_t pushorig;
-    int num_moved;
-    edict_t *moved_edict[MAX_EDICTS];
-    vec3_t moved_from[MAX_EDICTS];
+    int num_check, num_moved;
 #ifdef NQ_HACK
     trace_t trace;
 #endif
 
+    num_check = SV_PushCandidates(pusher, move);
+
     for (i = 0; i < 3; i++) {
 	mins[i] = pusher->v.absmin[i] + move[i];
 	maxs[i] = pusher->v.absmax[i] + move[i];
@@ -490,8 +564,8 @@ SV_Push(edict_t *pusher, const vec3_t move)
 
     /* see if any solid entities are inside the final position */
     num_moved = 0;
-    check = NEXT_EDICT(sv.edicts);
-    for (i = 1; i < sv.num_edicts; i++, check = NEXT_EDICT(check)) {
+    for (j = 0; j < num_check; j++) {
+	check = push_check[j];
 	if (check->free)
 	    continue;
 	if (check->v.movetype == MOVETYPE_PUSH
@@ -580,7 +654,9 @@ SV_Push(edict_t *pusher, const vec3_t move)
 	if (pusher->v.blocked) {
 	    pr_global_struct->self = EDICT_TO_PROG(pusher);
 	    pr_global_struct->other = EDICT_TO_PROG(check);
+	    SV_ProfileBegin(SVP_TOUCH);
 	    PR_ExecuteProgram(pusher->v.blocked);
+	    SV_ProfileEnd();
 	}
 	/* move back any entities we already moved */
 	for (i = 0; i < num_moved; i++) {
@@ -657,7 +733,9 @@ SV_Physics_Pusher(edict_t *ent)
 	pr_global_struct->time = sv.time;
 	pr_global_struct->self = EDICT_TO_PROG(ent);
 	pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
+	SV_ProfileBegin(SVP_THINK);
 	PR_ExecuteProgram(ent->v.think);
+	SV_ProfileEnd();
 	if (ent->free)
 	    return;
 #ifdef QW_HACK
@@ -997,7 +1075,9 @@ SV_Physics_Client(edict_t *player, int playernum)
 //
     pr_global_struct->time = sv.time;
     pr_global_struct->self = EDICT_TO_PROG(player);
+    SV_ProfileBegin(SVP_THINK);
     PR_ExecuteProgram(pr_global_struct->PlayerPreThink);
+    SV_ProfileEnd();
 
 //
 // do a move
@@ -1051,7 +1131,9 @@ SV_Physics_Client(edict_t *player, int playernum)
 
     pr_global_struct->time = sv.time;
     pr_global_struct->self = EDICT_TO_PROG(player);
+    SV_ProfileBegin(SVP_THINK);
     PR_ExecuteProgram(pr_global_struct->PlayerPostThink);
+    SV_ProfileEnd();
 }
 
 //============================================================================
@@ -1136,6 +1218,44 @@ SV_CheckWaterTransition(edict_t *ent)
     }
 }
 
+/*
+=============
+SV_TossLanded
+
+Bounces or stops a toss object after it has been pushed
+=============
+*/
+static void
+SV_TossLanded(edict_t *ent, const edict_t *ground, const trace_t *trace)
+{
+    float backoff;
+
+    if (trace->fraction == 1)
+	return;
+    if (ent->free)
+	return;
+
+    if (ent->v.movetype == MOVETYPE_BOUNCE)
+	backoff = 1.5;
+    else
+	backoff = 1;
+
+    ClipVelocity(ent->v.velocity, trace->plane.normal, ent->v.velocity,
+		 backoff);
+
+    /* stop if on ground */
+    if (trace->plane.normal[2] > 0.7) {
+	if (ent->v.velocity[2] < 60 || ent->v.movetype != MOVETYPE_BOUNCE) {
+	    ent->v.flags = (int)ent->v.flags | FL_ONGROUND;
+	    ent->v.groundentity = EDICT_TO_PROG(ground);
+	    VectorCopy(vec3_origin, ent->v.velocity);
+	    VectorCopy(vec3_origin, ent->v.avelocity);
+	}
+    }
+    /* check for in water */
+    SV_CheckWaterTransition(ent);
+}
+
 /*
 =============
 SV_Physics_Toss
@@ -1149,7 +1269,6 @@ SV_Physics_Toss(edict_t *ent)
     const edict_t *ground;
     trace_t trace;
     vec3_t move;
-    float backoff;
 
     /* regular thinking */
     if (!SV_RunThink(ent))
@@ -1177,30 +1296,7 @@ SV_Physics_Toss(edict_t *ent)
     /* move origin */
     VectorScale(ent->v.velocity, host_frametime, move);
     ground = SV_PushEntity(ent, move, &trace);
-    if (trace.fraction == 1)
-	return;
-    if (ent->free)
-	return;
-
-    if (ent->v.movetype == MOVETYPE_BOUNCE)
-	backoff = 1.5;
-    else
-	backoff = 1;
-
-    ClipVelocity(ent->v.velocity, trace.plane.normal, ent->v.velocity,
-		 backoff);
-
-    /* stop if on ground */
-    if (trace.plane.normal[2] > 0.7) {
-	if (ent->v.velocity[2] < 60 || ent->v.movetype != MOVETYPE_BOUNCE) {
-	    ent->v.flags = (int)ent->v.flags | FL_ONGROUND;
-	    ent->v.groundentity = EDICT_TO_PROG(ground);
-	    VectorCopy(vec3_origin, ent->v.velocity);
-	    VectorCopy(vec3_origin, ent->v.avelocity);
-	}
-    }
-    /* check for in water */
-    SV_CheckWaterTransition(ent);
+    SV_TossLanded(ent, ground, &trace);
 }
 
 /*
@@ -1279,22 +1375,22 @@ SV_ProgStartFrame(void)
     pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
     pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
     pr_global_struct->time = sv.time;
+    SV_ProfileBegin(SVP_THINK);
     PR_ExecuteProgram(pr_global_struct->StartFrame);
+    SV_ProfileEnd();
 }
 
+#endif /* QW_HACK */
+
 /*
 ================
-SV_RunEntity
+SV_RunMovetype
 
 ================
 */
 static void
-SV_RunEntity(edict_t *ent)
+SV_RunMovetype(edict_t *ent)
 {
-    if (ent->v.lastruntime == (float)realtime)
-	return;
-    ent->v.lastruntime = (float)realtime;
-
     switch ((int)ent->v.movetype) {
     case MOVETYPE_PUSH:
 	SV_Physics_Pusher(ent);
@@ -1319,6 +1415,23 @@ SV_RunEntity(edict_t *ent)
     }
 }
 
+#ifdef QW_HACK
+/*
+================
+SV_RunEntity
+
+================
+*/
+static void
+SV_RunEntity(edict_t *ent)
+{
+    if (ent->v.lastruntime == (float)realtime)
+	return;
+    ent->v.lastruntime = (float)realtime;
+
+    SV_RunMovetype(ent);
+}
+
 /*
 ================
 SV_RunNewmis
@@ -1341,6 +1454,219 @@ SV_RunNewmis(void)
 
 #endif /* QW_HACK */
 
+/*
+ * The progs set nextmap as soon as the exit is touched, which is usually
+ * well before the intermission is over and the changelevel comes, so read
+ * the map ahead in the meantime.
+ */
+static void
+SV_PreloadNextMap(void)
+{
+    const char *mapname;
+
+    if (!sv.nextmap || sv.nextmap->string == sv.nextmap_read)
+	return;
+
+    sv.nextmap_read = sv.nextmap->string;
+    mapname = PR_GetString(sv.nextmap_read);
+    if (mapname[0] && strcmp(mapname, sv.name))
+	COM_PreloadFile(va("maps/%s.bsp", mapname));
+}
+
+/*
+==============================================================================
+
+PARALLEL TOSS MOVES
+
+With sv_physthreads above 1, toss, bounce and fly objects that aren't due to
+think are left out of the main pass over the edicts.  Once everything else
+has moved, the traces for their moves are worked out together across that
+many threads, then the moves are finished in edict order, linking them and
+running the touches and impacts as usual.  So they don't see each other move
+within a frame, and their touches come after the rest of the frame's
+thinking.  If anything run before its turn changes an object, or removes
+what it hit, the object is moved again from scratch.
+
+==============================================================================
+*/
+
+typedef struct {
+    edict_t *ent;
+    double frametime;
+    /* what the trace was worked out from */
+    vec3_t origin, velocity;
+    vec3_t mins, maxs;
+    float movetype, solid, flags, nextthink;
+    int owner;
+    /* the move */
+    vec3_t movevelocity;
+    const edict_t *blocker;
+    trace_t trace;
+} tossmove_t;
+
+static tossmove_t *sv_tossmoves;
+static int sv_numtossmoves;
+static int sv_maxtossmoves;
+
+/* The velocity a toss object moves with this frame, false if it's NaN */
+static qboolean
+SV_TossVelocity(edict_t *ent, vec3_t velocity)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	if (IS_NAN(ent->v.velocity[i]) || IS_NAN(ent->v.origin[i]))
+	    return false;
+	velocity[i] = ent->v.velocity[i];
+	if (velocity[i] > sv_maxvelocity.value)
+	    velocity[i] = sv_maxvelocity.value;
+	else if (velocity[i] < -sv_maxvelocity.value)
+	    velocity[i] = -sv_maxvelocity.value;
+    }
+    if (ent->v.movetype != MOVETYPE_FLY
+	&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+	velocity[2] -= SV_Gravity(ent);
+
+    return true;
+}
+
+/*
+ * Takes the entity out of the main pass if its move can be worked out with
+ * the others, returning false if it has to run as usual.
+ */
+static qboolean
+SV_DeferToss(edict_t *ent)
+{
+    tossmove_t *toss;
+    vec3_t velocity;
+    qboolean onground;
+
+    if (ent->v.movetype != MOVETYPE_TOSS
+	&& ent->v.movetype != MOVETYPE_BOUNCE
+	&& ent->v.movetype != MOVETYPE_FLY
+	&& ent->v.movetype != MOVETYPE_FLYMISSILE)
+	return false;
+    if (ent->v.nextthink > 0 && ent->v.nextthink <= sv.time + host_frametime)
+	return false;
+
+    onground = ((int)ent->v.flags & FL_ONGROUND) != 0;
+#ifdef QW_HACK
+    if (ent->v.velocity[2] > 0)
+	onground = false;
+#endif
+    if (onground)
+	return false;
+    if (!SV_TossVelocity(ent, velocity))
+	return false;
+
+    if (sv_numtossmoves == sv_maxtossmoves) {
+	sv_maxtossmoves = sv_maxtossmoves ? sv_maxtossmoves * 2 : 256;
+	sv_tossmoves = realloc(sv_tossmoves,
+			       sv_maxtossmoves * sizeof(*sv_tossmoves));
+	if (!sv_tossmoves)
+	    SV_Error("%s: out of memory", __func__);
+    }
+
+    toss = &sv_tossmoves[sv_numtossmoves++];
+    toss->ent = ent;
+    toss->frametime = host_frametime;
+    VectorCopy(ent->v.origin, toss->origin);
+    VectorCopy(ent->v.velocity, toss->velocity);
+    VectorCopy(ent->v.mins, toss->mins);
+    VectorCopy(ent->v.maxs, toss->maxs);
+    toss->movetype = ent->v.movetype;
+    toss->solid = ent->v.solid;
+    toss->flags = ent->v.flags;
+    toss->nextthink = ent->v.nextthink;
+    toss->owner = ent->v.owner;
+    VectorCopy(velocity, toss->movevelocity);
+
+    return true;
+}
+
+/* Run on the worker threads, so only reads the edicts and the world */
+static void
+SV_TossTrace(void *data, int index)
+{
+    tossmove_t *toss = (tossmove_t *)data + index;
+    vec3_t move, end;
+
+    VectorScale(toss->movevelocity, toss->frametime, move);
+    VectorAdd(toss->origin, move, end);
+    toss->blocker = SV_TraceMoveEntity(toss->ent, toss->origin, end,
+				       SV_PushMoveType(toss->ent),
+				       &toss->trace);
+}
+
+static qboolean
+SV_TossUnchanged(edict_t *ent, const tossmove_t *toss)
+{
+    vec3_t velocity;
+
+    if (toss->blocker && toss->blocker->free)
+	return false;
+    if (!VectorCompare(ent->v.origin, toss->origin)
+	|| !VectorCompare(ent->v.velocity, toss->velocity)
+	|| !VectorCompare(ent->v.mins, toss->mins)
+	|| !VectorCompare(ent->v.maxs, toss->maxs))
+	return false;
+    if (ent->v.movetype != toss->movetype || ent->v.solid != toss->solid
+	|| ent->v.flags != toss->flags || ent->v.nextthink != toss->nextthink
+	|| ent->v.owner != toss->owner)
+	return false;
+    if (!SV_TossVelocity(ent, velocity))
+	return false;
+
+    return VectorCompare(velocity, toss->movevelocity);
+}
+
+static void
+SV_FinishToss(const tossmove_t *toss)
+{
+    edict_t *ent = toss->ent;
+    trace_t trace;
+
+    if (ent->free)
+	return;
+
+    host_frametime = toss->frametime;
+    if (!SV_TossUnchanged(ent, toss)) {
+	SV_RunMovetype(ent);
+	return;
+    }
+
+#ifdef QW_HACK
+    if (ent->v.velocity[2] > 0)
+	ent->v.flags = (int)ent->v.flags & ~FL_ONGROUND;
+#endif
+    VectorCopy(toss->movevelocity, ent->v.velocity);
+    VectorMA(ent->v.angles, host_frametime, ent->v.avelocity, ent->v.angles);
+
+    trace = toss->trace;
+    SV_PushEntityTo(ent, toss->blocker, &trace);
+    SV_TossLanded(ent, toss->blocker, &trace);
+}
+
+static void
+SV_RunTossMoves(int numthreads)
+{
+    double frametime = host_frametime;
+    int i;
+
+    Mod_SetTraceThreaded(true);
+    COM_ParallelFor(numthreads, SV_TossTrace, sv_tossmoves, sv_numtossmoves);
+    Mod_SetTraceThreaded(false);
+
+    for (i = 0; i < sv_numtossmoves; i++) {
+	SV_FinishToss(&sv_tossmoves[i]);
+#ifdef QW_HACK
+	SV_RunNewmis();
+#endif
+    }
+    sv_numtossmoves = 0;
+    host_frametime = frametime;
+}
+
 /*
 ================
 SV_Physics
@@ -1353,7 +1679,7 @@ SV_Physics(void)
 #ifdef QW_HACK
     static double old_time;
 #endif
-    int i;
+    int i, numthreads;
     edict_t *ent;
 
 #ifdef NQ_HACK
@@ -1361,7 +1687,9 @@ SV_Physics(void)
     pr_global_struct->self = EDICT_TO_PROG(sv.edicts);
     pr_global_struct->other = EDICT_TO_PROG(sv.edicts);
     pr_global_struct->time = sv.time;
+    SV_ProfileBegin(SVP_THINK);
     PR_ExecuteProgram(pr_global_struct->StartFrame);
+    SV_ProfileEnd();
 #endif
 #ifdef QW_HACK
     /* don't bother running a frame if sys_ticrate seconds haven't passed */
@@ -1375,15 +1703,20 @@ SV_Physics(void)
     SV_ProgStartFrame();
 #endif
 
+    TR_Begin("SV_Physics");
+
     SV_CheckAllEnts();
 
+    numthreads = sv_physthreads.value;
+    sv_numtossmoves = 0;
+
     /*
      * Treat each object in turn.
      * Even the world gets a chance to think
      */
     ent = sv.edicts;
     for (i = 0; i < sv.num_edicts; i++, ent = NEXT_EDICT(ent)) {
-	if (ent->free)
+	if (sv.edhot[i].free)
 	    continue;
 
 	if (pr_global_struct->force_retouch)
@@ -1393,36 +1726,37 @@ SV_Physics(void)
 #ifdef NQ_HACK
 	if (i > 0 && i <= svs.maxclients)
 	    SV_Physics_Client(ent, i);
-	else if (ent->v.movetype == MOVETYPE_PUSH)
-	    SV_Physics_Pusher(ent);
-	else if (ent->v.movetype == MOVETYPE_NONE)
-	    SV_Physics_None(ent);
-	else if (ent->v.movetype == MOVETYPE_NOCLIP)
-	    SV_Physics_Noclip(ent);
-	else if (ent->v.movetype == MOVETYPE_STEP)
-	    SV_Physics_Step(ent);
-	else if (ent->v.movetype == MOVETYPE_TOSS
-		 || ent->v.movetype == MOVETYPE_BOUNCE
-		 || ent->v.movetype == MOVETYPE_FLY
-		 || ent->v.movetype == MOVETYPE_FLYMISSILE)
-	    SV_Physics_Toss(ent);
-	else
-	    Sys_Error("%s: bad movetype %i", __func__, (int)ent->v.movetype);
+	else if (numthreads < 2 || !SV_DeferToss(ent))
+	    SV_RunMovetype(ent);
 #endif
 #ifdef QW_HACK
 	/* clients are run directly from packets */
 	if (i > 0 && i <= MAX_CLIENTS)
 	    continue;
 
+	if (numthreads > 1 && ent->v.lastruntime != (float)realtime
+	    && SV_DeferToss(ent)) {
+	    ent->v.lastruntime = (float)realtime;
+	    continue;
+	}
 	SV_RunEntity(ent);
 	SV_RunNewmis();
 #endif
     }
 
+    if (sv_numtossmoves)
+	SV_RunTossMoves(numthreads);
+
     if (pr_global_struct->force_retouch)
 	pr_global_struct->force_retouch--;
 
+    SV_TouchStats();
+    SV_PreloadNextMap();
+    PR_CollectStrings();
+
 #ifdef NQ_HACK
     sv.time += host_frametime;
 #endif
+
+    TR_End("SV_Physics");
 }
@@ -0,0 +1,270 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// sv_profile.c -- timing of the phases of each server frame
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "mathlib.h"
+#include "sv_profile.h"
+#include "sys.h"
+
+/*
+==============================================================================
+
+FRAME PROFILE
+
+With sv_profile 1, each server frame is split into the phases listed in
+sv_profile.h.  The last SVPROF_WINDOW frames are kept so "svprofile" can
+show the spread of each phase as well as the mean, and "svprofile log"
+writes every frame to a CSV file in the game directory.  Nothing is timed
+while sv_profile is 0 and no log is open.
+
+==============================================================================
+*/
+
+#define SVPROF_WINDOW	1000
+#define SVPROF_MAXDEPTH	16
+#define SVPROF_OTHER	SVP_NUMPHASES		// the rest of the frame
+#define SVPROF_TOTAL	(SVP_NUMPHASES + 1)
+#define SVPROF_COLUMNS	SVP_NUMTIMES
+
+static const char *svprof_names[SVPROF_COLUMNS] = {
+    "read", "think", "move", "touch", "send", "entities", "netwrite",
+    "other", "total"
+};
+
+static cvar_t sv_profile = { "sv_profile", "0" };
+qboolean sv_profiling;
+static qboolean svprof_required;
+static const float *svprof_last;	// the times of the last frame
+
+/* The frame being timed */
+static struct {
+    double start;		// of the frame
+    double resumed;		// when the innermost phase last got the clock
+    int depth;
+    svphase_t stack[SVPROF_MAXDEPTH];
+    double phases[SVP_NUMPHASES];
+} svprof_frame;
+
+/* The last frames, in milliseconds */
+static struct {
+    float times[SVPROF_WINDOW][SVPROF_COLUMNS];
+    int next;
+    int count;
+    unsigned frames;		// since the last reset
+} svprof_window;
+
+static FILE *svprof_log;
+
+/* Charge the time since the last change to the innermost phase */
+static void
+SV_ProfileCharge(double now)
+{
+    int depth = qmin(svprof_frame.depth, SVPROF_MAXDEPTH);
+
+    if (depth)
+	svprof_frame.phases[svprof_frame.stack[depth - 1]] +=
+	    now - svprof_frame.resumed;
+    svprof_frame.resumed = now;
+}
+
+void
+SV_ProfilePush(svphase_t phase)
+{
+    SV_ProfileCharge(Sys_DoubleTime());
+
+    /* if too deep, the time stays with the phase outside */
+    if (svprof_frame.depth < SVPROF_MAXDEPTH)
+	svprof_frame.stack[svprof_frame.depth] = phase;
+    svprof_frame.depth++;
+}
+
+void
+SV_ProfilePop(void)
+{
+    if (!svprof_frame.depth)
+	return;
+    SV_ProfileCharge(Sys_DoubleTime());
+    svprof_frame.depth--;
+}
+
+void
+SV_ProfileStartFrame(void)
+{
+    svprof_last = NULL;
+    sv_profiling = sv_profile.value || svprof_log || svprof_required;
+    if (!sv_profiling)
+	return;
+
+    /* anything left open was cut short by an error */
+    memset(&svprof_frame, 0, sizeof(svprof_frame));
+    svprof_frame.start = Sys_DoubleTime();
+}
+
+void
+SV_ProfileEndFrame(void)
+{
+    float *times;
+    double total, rest;
+    int i;
+
+    if (!sv_profiling || !svprof_frame.start)
+	return;
+
+    total = Sys_DoubleTime() - svprof_frame.start;
+    svprof_frame.start = 0;
+
+    times = svprof_window.times[svprof_window.next];
+    rest = total;
+    for (i = 0; i < SVP_NUMPHASES; i++) {
+	times[i] = svprof_frame.phases[i] * 1000;
+	rest -= svprof_frame.phases[i];
+    }
+    times[SVPROF_OTHER] = qmax(rest, 0.0) * 1000;
+    times[SVPROF_TOTAL] = total * 1000;
+    svprof_last = times;
+
+    svprof_window.next = (svprof_window.next + 1) % SVPROF_WINDOW;
+    if (svprof_window.count < SVPROF_WINDOW)
+	svprof_window.count++;
+    svprof_window.frames++;
+
+    if (svprof_log) {
+	fprintf(svprof_log, "%u", svprof_window.frames);
+	for (i = 0; i < SVPROF_COLUMNS; i++)
+	    fprintf(svprof_log, ",%.4f", times[i]);
+	fprintf(svprof_log, "\n");
+    }
+}
+
+void
+SV_ProfileRequire(qboolean require)
+{
+    svprof_required = require;
+}
+
+const float *
+SV_ProfileLastFrame(void)
+{
+    return svprof_last;
+}
+
+const char *
+SV_ProfileTimeName(int time)
+{
+    return svprof_names[time];
+}
+
+static int
+SV_CompareTimes(const void *a, const void *b)
+{
+    float time1 = *(const float *)a;
+    float time2 = *(const float *)b;
+
+    return (time1 > time2) - (time1 < time2);
+}
+
+static void
+SV_ProfileLog(const char *name)
+{
+    char path[MAX_OSPATH];
+    int i;
+
+    if (svprof_log) {
+	fclose(svprof_log);
+	svprof_log = NULL;
+	Con_Printf("Stopped the server profile log\n");
+    }
+    if (!name || !strcmp(name, "off"))
+	return;
+
+    if (snprintf(path, sizeof(path), "%s/%s", com_gamedir, name)
+	>= sizeof(path)) {
+	Con_Printf("Log file name too long\n");
+	return;
+    }
+    COM_DefaultExtension(path, ".csv", path, sizeof(path));
+    svprof_log = fopen(path, "w");
+    if (!svprof_log) {
+	Con_Printf("Couldn't open %s\n", path);
+	return;
+    }
+
+    fprintf(svprof_log, "frame");
+    for (i = 0; i < SVPROF_COLUMNS; i++)
+	fprintf(svprof_log, ",%s", svprof_names[i]);
+    fprintf(svprof_log, "\n");
+    Con_Printf("Logging server frames to %s\n", path);
+}
+
+/*
+ * svprofile [reset | log <file> | log off]
+ * Prints the mean and percentiles of each phase over the recent frames
+ */
+static void
+SV_Profile_f(void)
+{
+    float sorted[SVPROF_WINDOW];
+    double sum;
+    int i, j, count;
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset")) {
+	memset(&svprof_window, 0, sizeof(svprof_window));
+	return;
+    }
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "log")) {
+	SV_ProfileLog(Cmd_Argc() > 2 ? Cmd_Argv(2) : NULL);
+	return;
+    }
+
+    count = svprof_window.count;
+    if (!count) {
+	Con_Printf("No frames profiled, set sv_profile 1\n");
+	return;
+    }
+
+    Con_Printf("last %d frames, in msec\n", count);
+    Con_Printf("phase      mean    50%%    95%%    99%%     max\n");
+    for (i = 0; i < SVPROF_COLUMNS; i++) {
+	sum = 0;
+	for (j = 0; j < count; j++) {
+	    sorted[j] = svprof_window.times[j][i];
+	    sum += sorted[j];
+	}
+	qsort(sorted, count, sizeof(sorted[0]), SV_CompareTimes);
+	Con_Printf("%-8s %6.2f %6.2f %6.2f %6.2f %7.2f\n", svprof_names[i],
+		   sum / count, sorted[count / 2], sorted[count * 95 / 100],
+		   sorted[count * 99 / 100], sorted[count - 1]);
+    }
+}
+
+void
+SV_ProfileInit(void)
+{
+    Cvar_RegisterVariable(&sv_profile);
+    Cmd_AddCommand("svprofile", SV_Profile_f);
+}
@@ -19,8 +19,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // sys_null.h -- null system driver to aid porting efforts
 
+#include <stdlib.h>
+
 #include "quakedef.h"
 #include "errno.h"
+#include "sys.h"
 
 /*
 ===============================================================================
@@ -44,6 +47,60 @@ Sys_FileTime(char *path)
     return -1;
 }
 
+void *
+Sys_MapFile(const char *path, size_t offset, size_t length,
+	    sys_mapping_t *mapping)
+{
+    mapping->base = NULL;
+    mapping->size = 0;
+
+    return NULL;
+}
+
+void
+Sys_UnmapFile(sys_mapping_t *mapping)
+{
+}
+
+void *
+Sys_ReserveMemory(size_t size)
+{
+    return NULL;
+}
+
+qboolean
+Sys_CommitMemory(void *addr, size_t size)
+{
+    return false;
+}
+
+void
+Sys_DecommitMemory(void *addr, size_t size)
+{
+}
+
+const char *sys_pagenames[SYS_NUMPAGES] = {
+    "normal pages", "transparent huge pages", "huge pages"
+};
+
+void *
+Sys_AllocLarge(size_t size, sys_largebuf_t *buf)
+{
+    buf->base = malloc(size);
+    buf->size = buf->base ? size : 0;
+    buf->pages = SYS_PAGES_NORMAL;
+
+    return buf->base;
+}
+
+void
+Sys_FreeLarge(sys_largebuf_t *buf)
+{
+    free(buf->base);
+    buf->base = NULL;
+    buf->size = 0;
+}
+
 void
 Sys_mkdir(char *path)
 {
@@ -21,9 +21,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -33,7 +35,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef SERVERONLY
 #include <signal.h>
 #include <sys/ipc.h>
-#include <sys/mman.h>
 #endif
 
 #include "common.h"
@@ -50,8 +51,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 
 #ifdef NQ_HACK
+#include <sys/ioctl.h>
 #include "client.h"
 #include "host.h"
+#include "net_udp.h"
+#include "server.h"
 qboolean isDedicated;
 #endif
 
@@ -61,9 +65,13 @@ static cvar_t sys_extrasleep = { "sys_extrasleep", "0" };
 static qboolean stdin_ready;
 static int do_stdin = 1;
 #else
+#ifdef BENCH
+static qboolean nostdout = true;	// stdout is for the benchmark results
+#else
 static qboolean noconinput = false;
 static qboolean nostdout = false;
 #endif
+#endif
 
 /*
  * ===========================================================================
@@ -168,6 +176,151 @@ Sys_FileTime(const char *path)
     return buf.st_mtime;
 }
 
+void *
+Sys_MapFile(const char *path, size_t offset, size_t length,
+	    sys_mapping_t *mapping)
+{
+    size_t pageoffset;
+    void *base;
+    int fd;
+
+    mapping->base = NULL;
+    mapping->size = 0;
+    if (!length)
+	return NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+	return NULL;
+
+    /* the mapping has to start on a page */
+    pageoffset = offset % sysconf(_SC_PAGESIZE);
+    base = mmap(NULL, length + pageoffset, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE, fd, offset - pageoffset);
+    close(fd);
+    if (base == MAP_FAILED)
+	return NULL;
+
+    mapping->base = base;
+    mapping->size = length + pageoffset;
+
+    return (byte *)base + pageoffset;
+}
+
+void
+Sys_UnmapFile(sys_mapping_t *mapping)
+{
+    if (mapping->base)
+	munmap(mapping->base, mapping->size);
+    mapping->base = NULL;
+    mapping->size = 0;
+}
+
+void *
+Sys_ReserveMemory(size_t size)
+{
+    void *base;
+
+    base = mmap(NULL, size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+	return NULL;
+#ifdef MADV_HUGEPAGE
+    /* the hunk holds the z-buffer, surface cache and other big buffers */
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+    return base;
+}
+
+qboolean
+Sys_CommitMemory(void *addr, size_t size)
+{
+    return !mprotect(addr, size, PROT_READ | PROT_WRITE);
+}
+
+void
+Sys_DecommitMemory(void *addr, size_t size)
+{
+    madvise(addr, size, MADV_DONTNEED);
+    mprotect(addr, size, PROT_NONE);
+}
+
+const char *sys_pagenames[SYS_NUMPAGES] = {
+    "normal pages", "transparent huge pages", "huge pages"
+};
+
+#define SYS_HUGEPAGE (2 << 20)
+
+void *
+Sys_AllocLarge(size_t size, sys_largebuf_t *buf)
+{
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t length;
+    byte *base, *aligned;
+
+    buf->base = NULL;
+    buf->size = 0;
+    buf->pages = SYS_PAGES_NORMAL;
+    if (!size)
+	return NULL;
+
+#ifdef MAP_HUGETLB
+    /* only if it's most of a huge page, nobody minds failing this */
+    if (size >= SYS_HUGEPAGE / 2) {
+	length = (size + SYS_HUGEPAGE - 1) & ~(size_t)(SYS_HUGEPAGE - 1);
+	base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (base != MAP_FAILED) {
+	    buf->base = base;
+	    buf->size = length;
+	    buf->pages = SYS_PAGES_HUGE;
+	    return base;
+	}
+    }
+#endif
+
+    length = (size + pagesize - 1) & ~(pagesize - 1);
+    if (length < SYS_HUGEPAGE) {
+	base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	    return NULL;
+	buf->base = base;
+	buf->size = length;
+	return base;
+    }
+
+    /* a huge page can only back an aligned stretch, so start on one */
+    base = mmap(NULL, length + SYS_HUGEPAGE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+	return NULL;
+    aligned = (byte *)(((uintptr_t)base + SYS_HUGEPAGE - 1)
+		       & ~(uintptr_t)(SYS_HUGEPAGE - 1));
+    if (aligned > base)
+	munmap(base, aligned - base);
+    munmap(aligned + length, base + SYS_HUGEPAGE - aligned);
+
+    buf->base = aligned;
+    buf->size = length;
+#ifdef MADV_HUGEPAGE
+    if (!madvise(aligned, length, MADV_HUGEPAGE))
+	buf->pages = SYS_PAGES_TRANSPARENT;
+#endif
+
+    return aligned;
+}
+
+void
+Sys_FreeLarge(sys_largebuf_t *buf)
+{
+    if (buf->base)
+	munmap(buf->base, buf->size);
+    buf->base = NULL;
+    buf->size = 0;
+}
+
 void
 Sys_mkdir(const char *path)
 {
@@ -247,6 +400,35 @@ Sys_ConsoleInput(void)
 }
 #endif /* NQ_HACK || SERVERONLY */
 
+#ifdef SERVERONLY
+/*
+================
+Sys_ForkInstances
+================
+*/
+int
+Sys_ForkInstances(int count)
+{
+    pid_t pid;
+    int i;
+
+    fflush(stdout);
+    for (i = 1; i < count; i++) {
+	pid = fork();
+	if (pid < 0) {
+	    Sys_Printf("Couldn't start instance %d: %s\n", i, strerror(errno));
+	    break;
+	}
+	if (!pid) {
+	    do_stdin = 0;	/* the console stays with the first instance */
+	    return i;
+	}
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef SERVERONLY
 void
 Sys_Sleep(void)
@@ -313,11 +495,57 @@ Sys_MakeCodeWriteable(void *start_addr, void *end_addr)
  * ===========================================================================
  */
 
+/* tyr-bench links the rest of this file, but has a main of its own */
+#ifndef BENCH
+
+#ifdef NQ_HACK
+/*
+ * A dedicated server with nobody on sleeps until a packet comes in on the
+ * socket clients connect to, a line is typed, or the time is up.
+ */
+static void
+Sys_IdleWait(double seconds)
+{
+    static qboolean stdin_eof;
+    struct timeval timeout;
+    fd_set fdset;
+    qboolean pending;
+    int socket, maxfd, available;
+
+    FD_ZERO(&fdset);
+    maxfd = -1;
+    socket = UDP_AcceptSocket(&pending);
+    if (pending)
+	return;
+    if (socket != -1) {
+	FD_SET(socket, &fdset);
+	maxfd = socket;
+    }
+    if (!noconinput && !stdin_eof) {
+	FD_SET(STDIN_FILENO, &fdset);
+	if (maxfd < STDIN_FILENO)
+	    maxfd = STDIN_FILENO;
+    }
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = (seconds - timeout.tv_sec) * 1000000;
+    if (select(maxfd + 1, &fdset, NULL, NULL, &timeout) <= 0)
+	return;
+
+    /* stdin stays readable once it's closed, so stop waiting on it */
+    if (FD_ISSET(STDIN_FILENO, &fdset)
+	&& !ioctl(STDIN_FILENO, FIONREAD, &available) && !available)
+	stdin_eof = true;
+}
+#endif
+
 int
 main(int argc, const char *argv[])
 {
     double time, oldtime, newtime;
     quakeparms_t parms;
+#if defined(NQ_HACK) || defined(SERVERONLY)
+    double idle;
+#endif
 #ifdef SERVERONLY
     fd_set fdset;
     struct timeval timeout;
@@ -334,7 +562,7 @@ main(int argc, const char *argv[])
     parms.argv = com_argv;
     parms.basedir = stringify(QBASEDIR);
     parms.memsize = Memory_GetSize();
-    parms.membase = malloc(parms.memsize);
+    parms.membase = Memory_Reserve(&parms.memsize);
     if (!parms.membase)
 	Sys_Error("Allocation of %d byte heap failed", parms.memsize);
 
@@ -380,14 +608,18 @@ main(int argc, const char *argv[])
 	 * select on the net socket and stdin
 	 * the only reason we have a timeout at all is so that if the last
 	 * connected client times out, the message would not otherwise
-	 * be printed until the next event.
+	 * be printed until the next event.  With nobody on and sv_idle set,
+	 * it's until the next heartbeat instead.
 	 */
 	FD_ZERO(&fdset);
 	if (do_stdin)
 	    FD_SET(0, &fdset);
 	FD_SET(net_socket, &fdset);
-	timeout.tv_sec = 1;
-	timeout.tv_usec = 0;
+	idle = SV_IdleTime();
+	if (idle < 1)
+	    idle = 1;
+	timeout.tv_sec = idle;
+	timeout.tv_usec = (idle - timeout.tv_sec) * 1000000;
 	if (select(net_socket + 1, &fdset, NULL, NULL, &timeout) == -1)
 	    continue;
 	stdin_ready = FD_ISSET(0, &fdset);
@@ -400,8 +632,18 @@ main(int argc, const char *argv[])
 #ifdef NQ_HACK
 	if (cls.state == ca_dedicated) {
 	    if (time < sys_ticrate.value) {
-		usleep(1);
-		continue;	// not time to run a server only tic yet
+		/*
+		 * not time to run a server only tic yet, sleep until it is,
+		 * or with nobody on, until there's something to run it for
+		 */
+		idle = SV_IdleTime();
+		if (idle > 0) {
+		    Sys_IdleWait(idle);
+		    oldtime = Sys_DoubleTime() - sys_ticrate.value;
+		} else {
+		    usleep((sys_ticrate.value - time) * 1000000);
+		}
+		continue;
 	    }
 	    time = sys_ticrate.value;
 	}
@@ -430,3 +672,4 @@ main(int argc, const char *argv[])
 
     return 0;
 }
+#endif /* !BENCH */
@@ -110,6 +110,122 @@ Sys_mkdir(const char *path)
     _mkdir(path);
 }
 
+void *
+Sys_MapFile(const char *path, size_t offset, size_t length,
+	    sys_mapping_t *mapping)
+{
+    SYSTEM_INFO info;
+    HANDLE file, filemapping;
+    size_t viewoffset, pageoffset;
+    void *base;
+
+    mapping->base = NULL;
+    mapping->size = 0;
+    if (!length)
+	return NULL;
+
+    file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+	return NULL;
+    filemapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!filemapping)
+	return NULL;
+
+    /* views start on the allocation granularity, not just a page */
+    GetSystemInfo(&info);
+    pageoffset = offset % info.dwAllocationGranularity;
+    viewoffset = offset - pageoffset;
+    base = MapViewOfFile(filemapping, FILE_MAP_COPY,
+			 (DWORD)((unsigned long long)viewoffset >> 32),
+			 (DWORD)viewoffset, length + pageoffset);
+    CloseHandle(filemapping);
+    if (!base)
+	return NULL;
+
+    mapping->base = base;
+    mapping->size = length + pageoffset;
+
+    return (byte *)base + pageoffset;
+}
+
+void
+Sys_UnmapFile(sys_mapping_t *mapping)
+{
+    if (mapping->base)
+	UnmapViewOfFile(mapping->base);
+    mapping->base = NULL;
+    mapping->size = 0;
+}
+
+void *
+Sys_ReserveMemory(size_t size)
+{
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+qboolean
+Sys_CommitMemory(void *addr, size_t size)
+{
+    return VirtualAlloc(addr, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+}
+
+void
+Sys_DecommitMemory(void *addr, size_t size)
+{
+    VirtualFree(addr, size, MEM_DECOMMIT);
+}
+
+const char *sys_pagenames[SYS_NUMPAGES] = {
+    "normal pages", "transparent huge pages", "large pages"
+};
+
+void *
+Sys_AllocLarge(size_t size, sys_largebuf_t *buf)
+{
+    SIZE_T largepage = GetLargePageMinimum();
+    size_t length;
+    void *base;
+
+    buf->base = NULL;
+    buf->size = 0;
+    buf->pages = SYS_PAGES_NORMAL;
+    if (!size)
+	return NULL;
+
+    /* needs the lock pages privilege, so this mostly fails */
+    if (largepage && size >= largepage / 2) {
+	length = (size + largepage - 1) & ~(size_t)(largepage - 1);
+	base = VirtualAlloc(NULL, length,
+			    MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+			    PAGE_READWRITE);
+	if (base) {
+	    buf->base = base;
+	    buf->size = length;
+	    buf->pages = SYS_PAGES_HUGE;
+	    return base;
+	}
+    }
+
+    base = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!base)
+	return NULL;
+    buf->base = base;
+    buf->size = size;
+
+    return base;
+}
+
+void
+Sys_FreeLarge(sys_largebuf_t *buf)
+{
+    if (buf->base)
+	VirtualFree(buf->base, 0, MEM_RELEASE);
+    buf->base = NULL;
+    buf->size = 0;
+}
+
 static void
 Sys_InitTimers(void)
 {
@@ -478,6 +594,15 @@ Sys_Init(void)
     Cvar_RegisterVariable(&sys_nostdout);
 }
 
+int
+Sys_ForkInstances(int count)
+{
+    if (count > 1)
+	Sys_Printf("Multiple instances aren't supported on Windows\n");
+
+    return 0;
+}
+
 /*
  * ==================
  * Server main()
@@ -497,7 +622,7 @@ main(int argc, const char **argv)
     parms.argv = com_argv;
     parms.basedir = ".";
     parms.memsize = Memory_GetSize();
-    parms.membase = malloc(parms.memsize);
+    parms.membase = Memory_Reserve(&parms.memsize);
     if (!parms.membase)
 	Sys_Error("Insufficient memory.");
 
@@ -725,7 +850,7 @@ WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine,
 #endif
 
     parms.memsize = Memory_GetSize();
-    parms.membase = malloc(parms.memsize);
+    parms.membase = Memory_Reserve(&parms.memsize);
     if (!parms.membase)
 	Sys_Error("Not enough memory free; check disk space");
 
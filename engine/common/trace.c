@@ -0,0 +1,236 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// trace.c -- scoped timing events, saved as a Chrome trace
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "sys.h"
+#include "trace.h"
+
+/*
+==============================================================================
+
+EVENT TRACE
+
+Between trace_start and trace_stop, each TR_Begin/TR_End pair becomes one
+complete event in a ring buffer belonging to the thread that ran it, so
+threads never wait on each other to record.  The buffers are allocated the
+first time a thread records something and kept for the next trace; when a
+ring fills up, the oldest events are dropped.  trace_stop writes all of them
+out in the Chrome trace JSON format, which Perfetto and chrome://tracing
+can open.  With no trace running, TR_Begin and TR_End only test a flag.
+
+==============================================================================
+*/
+
+#define TRACE_EVENTS	65536	// per thread, a power of two
+#define TRACE_MAXDEPTH	64
+
+typedef struct {
+    const char *name;
+    double start;
+    double duration;
+} traceevent_t;
+
+typedef struct tracebuf_s {
+    struct tracebuf_s *next;
+    int thread;
+    unsigned generation;	// the trace the events belong to
+    unsigned count;		// recorded, including those overwritten
+    int depth;
+    int overflow;		// begins past TRACE_MAXDEPTH, not kept
+    struct {
+	const char *name;
+	double start;
+    } stack[TRACE_MAXDEPTH];
+    traceevent_t events[TRACE_EVENTS];
+} tracebuf_t;
+
+qboolean trace_active;
+
+static struct {
+    tracebuf_t *buffers;
+    int numthreads;
+    volatile int lock;		// guards the list of buffers
+    unsigned generation;
+    double start;
+} trace;
+
+static __thread tracebuf_t *trace_buffer;
+
+static tracebuf_t *
+Trace_Buffer(void)
+{
+    tracebuf_t *buf = trace_buffer;
+
+    if (!buf) {
+	buf = malloc(sizeof(*buf));
+	if (!buf)
+	    return NULL;
+	memset(buf, 0, sizeof(*buf) - sizeof(buf->events));
+
+	while (__sync_lock_test_and_set(&trace.lock, 1))
+	    ;
+	buf->thread = ++trace.numthreads;
+	buf->next = trace.buffers;
+	trace.buffers = buf;
+	__sync_lock_release(&trace.lock);
+
+	trace_buffer = buf;
+    }
+    if (buf->generation != trace.generation) {
+	buf->generation = trace.generation;
+	buf->count = 0;
+	buf->depth = 0;
+	buf->overflow = 0;
+    }
+
+    return buf;
+}
+
+void
+Trace_Push(const char *name)
+{
+    tracebuf_t *buf = Trace_Buffer();
+
+    if (!buf)
+	return;
+    if (buf->depth == TRACE_MAXDEPTH) {
+	buf->overflow++;
+	return;
+    }
+    buf->stack[buf->depth].name = name;
+    buf->stack[buf->depth].start = Sys_DoubleTime();
+    buf->depth++;
+}
+
+void
+Trace_Pop(const char *name)
+{
+    tracebuf_t *buf = Trace_Buffer();
+    traceevent_t *event;
+    double now;
+    int depth;
+
+    if (!buf)
+	return;
+    if (buf->overflow) {
+	buf->overflow--;
+	return;
+    }
+
+    for (depth = buf->depth - 1; depth >= 0; depth--)
+	if (buf->stack[depth].name == name)
+	    break;
+    if (depth < 0)
+	return;		// begun before the trace started
+
+    now = Sys_DoubleTime();
+    while (buf->depth > depth) {
+	buf->depth--;
+	event = &buf->events[buf->count++ & (TRACE_EVENTS - 1)];
+	event->name = buf->stack[buf->depth].name;
+	event->start = buf->stack[buf->depth].start;
+	event->duration = now - event->start;
+    }
+}
+
+static void
+Trace_Start_f(void)
+{
+    trace_active = false;
+    trace.generation++;
+    trace.start = Sys_DoubleTime();
+    trace_active = true;
+    Con_Printf("Tracing started\n");
+}
+
+static void
+Trace_Write(FILE *f)
+{
+    const tracebuf_t *buf;
+    const traceevent_t *event;
+    unsigned i, first;
+    qboolean comma = false;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (buf = trace.buffers; buf; buf = buf->next) {
+	if (buf->generation != trace.generation)
+	    continue;
+	first = buf->count > TRACE_EVENTS ? buf->count - TRACE_EVENTS : 0;
+	for (i = first; i < buf->count; i++) {
+	    event = &buf->events[i & (TRACE_EVENTS - 1)];
+	    if (event->start < trace.start)
+		continue;
+	    fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+		    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+		    comma ? ",\n" : "", event->name, buf->thread,
+		    (event->start - trace.start) * 1000000,
+		    event->duration * 1000000);
+	    comma = true;
+	}
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+static void
+Trace_Stop_f(void)
+{
+    char path[MAX_OSPATH];
+    FILE *f;
+
+    if (!trace_active) {
+	Con_Printf("Not tracing\n");
+	return;
+    }
+    trace_active = false;
+
+    if (Cmd_Argc() != 2) {
+	Con_Printf("Tracing stopped, nothing written\n");
+	return;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", com_gamedir, Cmd_Argv(1))
+	>= sizeof(path)) {
+	Con_Printf("Trace file name too long\n");
+	return;
+    }
+    COM_DefaultExtension(path, ".json", path, sizeof(path));
+    f = fopen(path, "w");
+    if (!f) {
+	Con_Printf("Couldn't open %s\n", path);
+	return;
+    }
+    Trace_Write(f);
+    fclose(f);
+    Con_Printf("Wrote %s\n", path);
+}
+
+void
+Trace_Init(void)
+{
+    Cmd_AddCommand("trace_start", Trace_Start_f);
+    Cmd_AddCommand("trace_stop", Trace_Stop_f);
+}
@@ -35,6 +35,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "console.h"
 #include "glquake.h"
 #include "keys.h"
+#include "palette.h"
 #include "quakedef.h"
 #include "sys.h"
 #include "vid.h"
@@ -460,11 +461,9 @@ VID_SetPalette(const byte *palette)
     const byte *pal;
     unsigned r, g, b;
     unsigned v;
-    int r1, g1, b1;
-    int k;
     unsigned short i;
     unsigned *table;
-    int dist, bestdist;
+    palsearch_t search;
 
 //
 // 8 8 8 encoding
@@ -481,6 +480,7 @@ VID_SetPalette(const byte *palette)
 	*table++ = LittleLong(v);
     }
 
+    Pal_InitSearch(&search, palette, 3);
     for (i = 0; i < (1 << 15); i++) {
 	/*
 	 * Maps
@@ -492,18 +492,7 @@ VID_SetPalette(const byte *palette)
 	r = ((i & 0x1F) << 3) + 4;
 	g = ((i & 0x03E0) >> 2) + 4;
 	b = ((i & 0x7C00) >> 7) + 4;
-	pal = (unsigned char *)d_8to24table;
-	for (v = 0, k = 0, bestdist = 10000 * 10000; v < 256; v++, pal += 4) {
-	    r1 = (int)r - (int)pal[0];
-	    g1 = (int)g - (int)pal[1];
-	    b1 = (int)b - (int)pal[2];
-	    dist = (r1 * r1) + (g1 * g1) + (b1 * b1);
-	    if (dist < bestdist) {
-		k = v;
-		bestdist = dist;
-	    }
-	}
-	d_15to8table[i] = k;
+	d_15to8table[i] = Pal_FindClosest(&search, r, g, b);
     }
 }
 
@@ -593,6 +582,12 @@ Gamma_Init()
 	VID_SetGammaRamp = NULL;
 }
 
+static void *
+VID_GL_GetProcAddress(const char *name)
+{
+    return (void *)qglXGetProcAddress(name);
+}
+
 /*
 ===============
 GL_Init
@@ -613,6 +608,11 @@ GL_Init(void)
 
     CheckMultiTextureExtensions();
     GL_ExtensionCheck_NPoT();
+    GL_ExtensionCheck_CubeMap();
+    GL_ExtensionCheck_VertexBuffers(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_Shaders(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_OcclusionQuery(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_Textures(VID_GL_GetProcAddress);
 
     glClearColor(0.5, 0.5, 0.5, 0);
     glCullFace(GL_FRONT);
@@ -17,47 +17,79 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 */
-// vid_null.c -- null video driver to aid porting efforts
+// vid_null.c -- null video driver, for running without a window
+// (e.g. capturing demos with f_capture, -width and -height set the buffer)
 
-#include "quakedef.h"
+#include <stdlib.h>
+
+#include "common.h"
 #include "d_local.h"
+#include "host.h"
+#include "quakedef.h"
+#include "render.h"
+#include "sys.h"
+#include "vid.h"
+#include "zone.h"
 
 viddef_t vid;			// global video state
+int vid_modenum = VID_MODE_NONE;
 
 #define	BASEWIDTH	320
 #define	BASEHEIGHT	200
 
-byte vid_buffer[BASEWIDTH * BASEHEIGHT];
-short zbuffer[BASEWIDTH * BASEHEIGHT];
-byte surfcache[256 * 1024];
-
 unsigned short d_8to16table[256];
 unsigned d_8to24table[256];
 
 void
-VID_SetPalette(unsigned char *palette)
+VID_SetPalette(const byte *palette)
 {
+    int i;
+
+    for (i = 0; i < 256; i++, palette += 3)
+	d_8to24table[i] = palette[0] | (palette[1] << 8) | (palette[2] << 16);
 }
 
 void
-VID_ShiftPalette(unsigned char *palette)
+VID_ShiftPalette(const byte *palette)
 {
 }
 
 void
-VID_Init(unsigned char *palette)
+VID_Init(const byte *palette)
 {
-    vid.maxwarpwidth = vid.width = vid.conwidth = BASEWIDTH;
-    vid.maxwarpheight = vid.height = vid.conheight = BASEHEIGHT;
+    int width = BASEWIDTH;
+    int height = BASEHEIGHT;
+    int i, surfcachesize;
+    byte *surfcache;
+
+    i = COM_CheckParm("-width");
+    if (i && i < com_argc - 1)
+	width = Q_atoi(com_argv[i + 1]);
+    i = COM_CheckParm("-height");
+    if (i && i < com_argc - 1)
+	height = Q_atoi(com_argv[i + 1]);
+    if (width < BASEWIDTH)
+	width = BASEWIDTH;
+    if (height < BASEHEIGHT)
+	height = BASEHEIGHT;
+    if (height > MAXHEIGHT)
+	height = MAXHEIGHT;
+
+    vid.maxwarpwidth = vid.width = vid.conwidth = width;
+    vid.maxwarpheight = vid.height = vid.conheight = height;
     vid.aspect = 1.0;
     vid.numpages = 1;
     vid.colormap = host_colormap;
     vid.fullbright = 256 - LittleLong(*((int *)vid.colormap + 2048));
-    vid.buffer = vid.conbuffer = vid_buffer;
-    vid.rowbytes = vid.conrowbytes = BASEWIDTH;
+    vid.buffer = vid.conbuffer = Hunk_HighAllocName(width * height, "vidbuf");
+    vid.rowbytes = vid.conrowbytes = width;
+
+    surfcachesize = D_SurfaceCacheForRes(width, height);
+    d_pzbuffer = Hunk_HighAllocName(width * height * sizeof(*d_pzbuffer), "zbuffer");
+    surfcache = Hunk_HighAllocName(surfcachesize, "surfcache");
+    D_InitCaches(surfcache, surfcachesize);
 
-    d_pzbuffer = zbuffer;
-    D_InitCaches(surfcache, sizeof(surfcache));
+    VID_SetPalette(palette);
 }
 
 void
@@ -70,6 +102,39 @@ VID_Update(vrect_t *rects)
 {
 }
 
+qboolean
+VID_SetMode(const qvidmode_t *mode, const byte *palette)
+{
+    return true;
+}
+
+qboolean
+VID_CheckAdequateMem(int width, int height)
+{
+    return true;
+}
+
+qboolean
+VID_IsFullScreen(void)
+{
+    return false;
+}
+
+void
+VID_LockBuffer(void)
+{
+}
+
+void
+VID_UnlockBuffer(void)
+{
+}
+
+void
+Sys_SendKeyEvents(void)
+{
+}
+
 /*
 ================
 D_BeginDirectRect
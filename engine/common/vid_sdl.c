@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include <stdlib.h>
 
 #include "SDL.h"
+#define GL_GLEXT_PROTOTYPES	/* only for typeof, see gpu_palette below */
+#include "SDL_opengl.h"
 
 #include "cdaudio.h"
 #include "cmd.h"
@@ -61,10 +63,22 @@ qboolean DDActive = false;
 #endif
 
 static SDL_Renderer *renderer = NULL;
-static SDL_Texture *texture = NULL;
+static SDL_Texture *texture = NULL;	/* the one last presented */
 static SDL_PixelFormat *sdl_format = NULL;
 static SDL_PixelFormat *sdl_desktop_format = NULL;
 
+/*
+ * Frames are converted into two streaming textures in turn, so locking one
+ * doesn't have to wait for the renderer to finish with the one presented
+ * last.  Each frame also redoes the rects the other texture got last time.
+ */
+static SDL_Texture *textures[2];
+static int texturenum;
+
+#define MAX_LASTRECTS 8
+static vrect_t lastrects[MAX_LASTRECTS];
+static int numlastrects;	/* -1 for the whole screen */
+
 /* ------------------------------------------------------------------------- */
 
 static byte *vid_surfcache;
@@ -276,12 +290,213 @@ VID_IsFullScreen()
     return !!vid_modenum;
 }
 
+/* ------------------------------------------------------------------------- */
+
+/*
+ * With vid_gpupalette set the frame is uploaded as it is, one byte a pixel,
+ * and a fragment shader looks each pixel up in a 256x1 palette texture.  The
+ * CPU does no conversion at all and a palette change is a 1 KB upload.  The
+ * GL entry points come from SDL_GL_GetProcAddress so this build still
+ * doesn't link against GL; without GLSL we fall back to the SDL renderer.
+ */
+static void VID_GPUPalette_f(cvar_t *cvar);
+
+static cvar_t vid_gpupalette = {
+    .name = "vid_gpupalette",
+    .string = "0",
+    .archive = true,
+    .callback = VID_GPUPalette_f
+};
+
+#define GPU_FUNCS				\
+    GPU_FUNC(glActiveTexture)			\
+    GPU_FUNC(glAttachShader)			\
+    GPU_FUNC(glBegin)				\
+    GPU_FUNC(glBindTexture)			\
+    GPU_FUNC(glCompileShader)			\
+    GPU_FUNC(glCreateProgram)			\
+    GPU_FUNC(glCreateShader)			\
+    GPU_FUNC(glEnd)				\
+    GPU_FUNC(glGenTextures)			\
+    GPU_FUNC(glGetProgramiv)			\
+    GPU_FUNC(glGetShaderiv)			\
+    GPU_FUNC(glGetUniformLocation)		\
+    GPU_FUNC(glLinkProgram)			\
+    GPU_FUNC(glPixelStorei)			\
+    GPU_FUNC(glShaderSource)			\
+    GPU_FUNC(glTexCoord2f)			\
+    GPU_FUNC(glTexImage2D)			\
+    GPU_FUNC(glTexParameteri)			\
+    GPU_FUNC(glTexSubImage2D)			\
+    GPU_FUNC(glUniform1i)			\
+    GPU_FUNC(glUseProgram)			\
+    GPU_FUNC(glVertex2f)			\
+    GPU_FUNC(glViewport)
+
+#define GPU_FUNC(name) static typeof(name) *q##name;
+GPU_FUNCS
+#undef GPU_FUNC
+
+static struct {
+    SDL_GLContext context;	/* NULL when using the SDL renderer */
+    GLuint screen, palette;
+    byte rgba[256 * 4];
+    qboolean palettedirty;
+} gpu_palette;
+
+static const char *gpu_vertexshader =
+    "varying vec2 st;\n"
+    "void main() {\n"
+    "    st = gl_MultiTexCoord0.xy;\n"
+    "    gl_Position = gl_Vertex;\n"
+    "}\n";
+
+static const char *gpu_fragmentshader =
+    "uniform sampler2D screen, palette;\n"
+    "varying vec2 st;\n"
+    "void main() {\n"
+    "    float index = texture2D(screen, st).r * (255.0 / 256.0);\n"
+    "    gl_FragColor = texture2D(palette, vec2(index + 0.5 / 256.0, 0.5));\n"
+    "}\n";
+
+static void
+VID_GPUPalette_f(cvar_t *cvar)
+{
+    /* have VID_Update set the mode again, with or without GL */
+    vid_modenum = VID_MODE_NONE;
+}
+
+static GLuint
+VID_GPUShader(GLenum type, const char *source)
+{
+    GLuint shader;
+    GLint status;
+
+    shader = qglCreateShader(type);
+    qglShaderSource(shader, 1, &source, NULL);
+    qglCompileShader(shader);
+    qglGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+
+    return status ? shader : 0;
+}
+
+static GLuint
+VID_GPUTexture(GLenum format, int width, int height)
+{
+    GLuint texture;
+
+    qglGenTextures(1, &texture);
+    qglBindTexture(GL_TEXTURE_2D, texture);
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    qglTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    qglTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+		  GL_UNSIGNED_BYTE, NULL);
+
+    return texture;
+}
+
+/*
+ * Set up the GL context, shaders and textures for a freshly created window,
+ * or leave nothing behind and return false if any of it is missing.
+ */
+static qboolean
+VID_GPUInit(int width, int height)
+{
+    GLuint vertexshader, fragmentshader, program;
+    GLint status;
+
+    gpu_palette.context = SDL_GL_CreateContext(sdl_window);
+    if (!gpu_palette.context)
+	goto fail;
+    if (SDL_GL_MakeCurrent(sdl_window, gpu_palette.context))
+	goto fail;
+
+#define GPU_FUNC(name) \
+    if (!(q##name = SDL_GL_GetProcAddress(#name))) goto fail;
+    GPU_FUNCS
+#undef GPU_FUNC
+
+    vertexshader = VID_GPUShader(GL_VERTEX_SHADER, gpu_vertexshader);
+    fragmentshader = VID_GPUShader(GL_FRAGMENT_SHADER, gpu_fragmentshader);
+    if (!vertexshader || !fragmentshader)
+	goto fail;
+    program = qglCreateProgram();
+    qglAttachShader(program, vertexshader);
+    qglAttachShader(program, fragmentshader);
+    qglLinkProgram(program);
+    qglGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status)
+	goto fail;
+    qglUseProgram(program);
+    qglUniform1i(qglGetUniformLocation(program, "screen"), 0);
+    qglUniform1i(qglGetUniformLocation(program, "palette"), 1);
+
+    qglPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    qglActiveTexture(GL_TEXTURE1);
+    gpu_palette.palette = VID_GPUTexture(GL_RGBA, 256, 1);
+    qglActiveTexture(GL_TEXTURE0);
+    gpu_palette.screen = VID_GPUTexture(GL_LUMINANCE, width, height);
+    qglViewport(0, 0, width, height);
+
+    gpu_palette.palettedirty = true;
+
+    return true;
+
+ fail:
+    Con_Printf("vid_gpupalette: no GLSL (%s), using the SDL renderer\n",
+	       SDL_GetError());
+    if (gpu_palette.context)
+	SDL_GL_DeleteContext(gpu_palette.context);
+    gpu_palette.context = NULL;
+
+    return false;
+}
+
+/* upload part of an 8-bit image to the screen texture */
+static void
+VID_GPUUpload(int x, int y, int width, int height, const byte *src,
+	      int rowbytes)
+{
+    qglPixelStorei(GL_UNPACK_ROW_LENGTH, rowbytes);
+    qglTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_LUMINANCE,
+		     GL_UNSIGNED_BYTE, src);
+}
+
+static void
+VID_GPUPresent(void)
+{
+    if (gpu_palette.palettedirty) {
+	gpu_palette.palettedirty = false;
+	qglActiveTexture(GL_TEXTURE1);
+	qglPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	qglTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGBA,
+			 GL_UNSIGNED_BYTE, gpu_palette.rgba);
+	qglActiveTexture(GL_TEXTURE0);
+    }
+
+    qglBegin(GL_QUADS);
+    qglTexCoord2f(0, 0);
+    qglVertex2f(-1, 1);
+    qglTexCoord2f(1, 0);
+    qglVertex2f(1, 1);
+    qglTexCoord2f(1, 1);
+    qglVertex2f(1, -1);
+    qglTexCoord2f(0, 1);
+    qglVertex2f(-1, -1);
+    qglEnd();
+
+    SDL_GL_SwapWindow(sdl_window);
+}
+
 qboolean
 VID_SetMode(const qvidmode_t *mode, const byte *palette)
 {
     Uint32 flags;
     qboolean mouse_grab;
     const qvidformat_t *format;
+    int i;
 
     /* FIXME - hack to reset mouse grabs */
     mouse_grab = _windowed_mouse.value;
@@ -293,9 +508,19 @@ VID_SetMode(const qvidmode_t *mode, const byte *palette)
     flags = SDL_WINDOW_SHOWN;
     if (mode != modelist)
 	flags |= SDL_WINDOW_FULLSCREEN;
+    if (vid_gpupalette.value)
+	flags |= SDL_WINDOW_OPENGL;
 
-    if (renderer)
+    if (gpu_palette.context) {
+	SDL_GL_DeleteContext(gpu_palette.context);
+	gpu_palette.context = NULL;
+    }
+    if (renderer) {
+	/* takes the textures with it */
 	SDL_DestroyRenderer(renderer);
+	renderer = NULL;
+	texture = textures[0] = textures[1] = NULL;
+    }
     if (sdl_window)
 	SDL_DestroyWindow(sdl_window);
     if (sdl_format)
@@ -311,16 +536,26 @@ VID_SetMode(const qvidmode_t *mode, const byte *palette)
     if (!sdl_window)
 	Sys_Error("%s: Unable to create window: %s", __func__, SDL_GetError());
 
-    renderer = SDL_CreateRenderer(sdl_window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer)
-	Sys_Error("%s: Unable to create renderer: %s", __func__, SDL_GetError());
-
-    texture = SDL_CreateTexture(renderer,
-				format->format,
-				SDL_TEXTUREACCESS_STREAMING,
-				mode->width, mode->height);
-    if (!texture)
-	Sys_Error("%s: Unable to create texture: %s", __func__, SDL_GetError());
+    if (!vid_gpupalette.value || !VID_GPUInit(mode->width, mode->height)) {
+	renderer = SDL_CreateRenderer(sdl_window, -1,
+				      SDL_RENDERER_ACCELERATED);
+	if (!renderer)
+	    Sys_Error("%s: Unable to create renderer: %s", __func__,
+		      SDL_GetError());
+
+	for (i = 0; i < 2; i++) {
+	    textures[i] = SDL_CreateTexture(renderer,
+					    format->format,
+					    SDL_TEXTUREACCESS_STREAMING,
+					    mode->width, mode->height);
+	    if (!textures[i])
+		Sys_Error("%s: Unable to create texture: %s", __func__,
+			  SDL_GetError());
+	}
+	texturenum = 0;
+	texture = textures[0];
+	numlastrects = -1;
+    }
 
     //VID_InitGamma(palette);
     VID_SetPalette(palette);
@@ -386,6 +621,17 @@ VID_SetPalette(const byte *palette)
 {
     unsigned i, r, g, b;
 
+    for (i = 0; i < 256; i++) {
+	gpu_palette.rgba[i * 4 + 0] = palette[i * 3 + 0];
+	gpu_palette.rgba[i * 4 + 1] = palette[i * 3 + 1];
+	gpu_palette.rgba[i * 4 + 2] = palette[i * 3 + 2];
+	gpu_palette.rgba[i * 4 + 3] = 255;
+    }
+    if (gpu_palette.context) {
+	gpu_palette.palettedirty = true;
+	return;
+    }
+
     switch (SDL_PIXELTYPE(sdl_format->format)) {
     case SDL_PIXELTYPE_PACKED32:
 	for (i = 0; i < 256; i++) {
@@ -433,6 +679,7 @@ VID_Init(const byte *palette)
     Cvar_RegisterVariable(&block_switch);
     Cvar_RegisterVariable(&vid_window_x);
     Cvar_RegisterVariable(&vid_window_y);
+    Cvar_RegisterVariable(&vid_gpupalette);
 
     VID_InitModeCvars();
 
@@ -484,19 +731,65 @@ VID_Init(const byte *palette)
     vid_menukeyfn = VID_MenuKey;
 }
 
+static void
+VID_UpdateTextureRect(SDL_Texture *target, const vrect_t *rect)
+{
+    SDL_Rect subrect;
+    const byte *src;
+    void *dst;
+    Uint32 *dst32;
+    Uint16 *dst16;
+    int i, pitch, height, err;
+
+    subrect.x = rect->x;
+    subrect.y = rect->y;
+    subrect.w = rect->width;
+    subrect.h = rect->height;
+
+    err = SDL_LockTexture(target, &subrect, (void **)&dst, &pitch);
+    if (err)
+	Sys_Error("%s: unable to lock texture (%s)",
+		  __func__, SDL_GetError());
+    src = vid.buffer + rect->y * vid.width + rect->x;
+    height = subrect.h;
+    switch (SDL_PIXELTYPE(sdl_format->format)) {
+    case SDL_PIXELTYPE_PACKED32:
+	dst32 = dst;
+	while (height--) {
+	    if (d_simdkernels) {
+		d_simdkernels->palette32(dst32, src, d_8to24table,
+					 rect->width);
+	    } else {
+		for (i = 0; i < rect->width; i++)
+		    dst32[i] = d_8to24table[src[i]];
+	    }
+	    dst32 += pitch / sizeof(*dst32);
+	    src += vid.width;
+	}
+	break;
+    case SDL_PIXELTYPE_PACKED16:
+	dst16 = dst;
+	while (height--) {
+	    for (i = 0; i < rect->width; i++)
+		dst16[i] = d_8to16table[src[i]];
+	    dst16 += pitch / sizeof(*dst16);
+	    src += vid.width;
+	}
+	break;
+    default:
+	Sys_Error("%s: unsupported pixel format (%s)", __func__,
+		  SDL_GetPixelFormatName(sdl_format->format));
+    }
+    SDL_UnlockTexture(target);
+}
+
 void
 VID_Update(vrect_t *rects)
 {
-    SDL_Rect subrect;
     int i;
     vrect_t *rect;
     vrect_t fullrect;
-    byte *src;
-    void *dst;
-    Uint32 *dst32;
-    Uint16 *dst16;
-    int pitch;
-    int height;
+    SDL_Texture *target;
     int err;
     const qvidmode_t *mode;
 
@@ -510,60 +803,56 @@ VID_Update(vrect_t *rects)
 	return;
     }
 
+    fullrect.x = 0;
+    fullrect.y = 0;
+    fullrect.width = vid.width;
+    fullrect.height = vid.height;
+    fullrect.pnext = NULL;
+
+    if (gpu_palette.context) {
+	for (rect = rects; rect; rect = rect->pnext)
+	    VID_GPUUpload(rect->x, rect->y, rect->width, rect->height,
+			  vid.buffer + rect->y * vid.width + rect->x,
+			  vid.width);
+	VID_GPUPresent();
+	return;
+    }
+
     /*
      * If the palette changed, refresh the whole screen
      */
     if (palette_changed) {
 	palette_changed = false;
-	fullrect.x = 0;
-	fullrect.y = 0;
-	fullrect.width = vid.width;
-	fullrect.height = vid.height;
-	fullrect.pnext = NULL;
 	rects = &fullrect;
     }
 
-    for (rect = rects; rect; rect = rect->pnext) {
-	subrect.x = rect->x;
-	subrect.y = rect->y;
-	subrect.w = rect->width;
-	subrect.h = rect->height;
+    /*
+     * Bring the other texture up to date with the last frame too
+     */
+    texturenum ^= 1;
+    target = textures[texturenum];
+    if (rects != &fullrect) {
+	if (numlastrects < 0)
+	    VID_UpdateTextureRect(target, &fullrect);
+	for (i = 0; i < numlastrects; i++)
+	    VID_UpdateTextureRect(target, &lastrects[i]);
+    }
 
-	err = SDL_LockTexture(texture, &subrect, (void **)&dst, &pitch);
-	if (err)
-	    Sys_Error("%s: unable to lock texture (%s)",
-		      __func__, SDL_GetError());
-	src = vid.buffer + rect->y * vid.width + rect->x;
-	height = subrect.h;
-	switch (SDL_PIXELTYPE(sdl_format->format)) {
-	case SDL_PIXELTYPE_PACKED32:
-	    dst32 = dst;
-	    while (height--) {
-		for (i = 0; i < rect->width; i++)
-		    dst32[i] = d_8to24table[src[i]];
-		dst32 += pitch / sizeof(*dst32);
-		src += vid.width;
-	    }
-	    break;
-	case SDL_PIXELTYPE_PACKED16:
-	    dst16 = dst;
-	    while (height--) {
-		for (i = 0; i < rect->width; i++)
-		    dst16[i] = d_8to16table[src[i]];
-		dst16 += pitch / sizeof(*dst16);
-		src += vid.width;
-	    }
-	    break;
-	default:
-	    Sys_Error("%s: unsupported pixel format (%s)", __func__,
-		      SDL_GetPixelFormatName(sdl_format->format));
-	}
-	SDL_UnlockTexture(texture);
+    numlastrects = 0;
+    for (rect = rects; rect; rect = rect->pnext) {
+	VID_UpdateTextureRect(target, rect);
+	if (numlastrects >= 0 && numlastrects < MAX_LASTRECTS &&
+	    rect != &fullrect)
+	    lastrects[numlastrects++] = *rect;
+	else
+	    numlastrects = -1;
     }
-    err = SDL_RenderCopy(renderer, texture, NULL, NULL);
+
+    err = SDL_RenderCopy(renderer, target, NULL, NULL);
     if (err)
 	Sys_Error("%s: unable to render texture (%s)", __func__, SDL_GetError());
     SDL_RenderPresent(renderer);
+    texture = target;
 }
 
 void
@@ -575,6 +864,12 @@ D_BeginDirectRect(int x, int y, const byte *pbitmap, int width, int height)
     int pitch;
     SDL_Rect subrect;
 
+    if (gpu_palette.context) {
+	VID_GPUUpload((x < 0) ? vid.width + x - 1 : x, y, width, height,
+		      pbitmap, width);
+	VID_GPUPresent();
+	return;
+    }
     if (!texture || !renderer)
 	return;
 
@@ -610,6 +905,13 @@ D_EndDirectRect(int x, int y, int width, int height)
     int pitch;
     SDL_Rect subrect;
 
+    if (gpu_palette.context) {
+	x = (x < 0) ? vid.width + x - 1 : x;
+	VID_GPUUpload(x, y, width, height, vid.buffer + y * vid.width + x,
+		      vid.width);
+	VID_GPUPresent();
+	return;
+    }
     if (!texture || !renderer)
 	return;
 
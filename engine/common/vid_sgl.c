@@ -221,6 +221,11 @@ VID_InitGL(void)
     }
 
     GL_ExtensionCheck_NPoT();
+    GL_ExtensionCheck_CubeMap();
+    GL_ExtensionCheck_VertexBuffers(SDL_GL_GetProcAddress);
+    GL_ExtensionCheck_Shaders(SDL_GL_GetProcAddress);
+    GL_ExtensionCheck_OcclusionQuery(SDL_GL_GetProcAddress);
+    GL_ExtensionCheck_Textures(SDL_GL_GetProcAddress);
 
     glClearColor(0.5, 0.5, 0.5, 0);
     glCullFace(GL_FRONT);
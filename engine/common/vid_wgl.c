@@ -30,6 +30,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "input.h"
 #include "keys.h"
 #include "menu.h"
+#include "palette.h"
 #include "quakedef.h"
 #include "resource.h"
 #include "sbar.h"
@@ -492,6 +493,12 @@ CheckMultiTextureExtensions(void)
     gl_mtexable = true;
 }
 
+static void *
+VID_GL_GetProcAddress(const char *name)
+{
+    return (void *)wglGetProcAddress(name);
+}
+
 /*
 ===============
 GL_Init
@@ -512,6 +519,11 @@ GL_Init(void)
 
     CheckMultiTextureExtensions();
     GL_ExtensionCheck_NPoT();
+    GL_ExtensionCheck_CubeMap();
+    GL_ExtensionCheck_VertexBuffers(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_Shaders(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_OcclusionQuery(VID_GL_GetProcAddress);
+    GL_ExtensionCheck_Textures(VID_GL_GetProcAddress);
 
     //glClearColor(1, 0, 0, 0);
     glClearColor(0.5, 0.5, 0.5, 0);
@@ -589,10 +601,9 @@ VID_SetPalette(const byte *palette)
     const byte *pal;
     unsigned r, g, b;
     unsigned v;
-    int r1, g1, b1;
-    int j, k, l;
     unsigned short i;
     unsigned *table;
+    palsearch_t search;
 
 //
 // 8 8 8 encoding
@@ -608,8 +619,7 @@ VID_SetPalette(const byte *palette)
 	*table++ = v;
     }
 
-    // JACK: 3D distance calcs - k is last closest, l is the distance.
-    // FIXME: Precalculate this and cache to disk.
+    Pal_InitSearch(&search, palette, 3);
     for (i = 0; i < (1 << 15); i++) {
 	/* Maps
 	   000000000000000
@@ -620,18 +630,7 @@ VID_SetPalette(const byte *palette)
 	r = ((i & 0x1F) << 3) + 4;
 	g = ((i & 0x03E0) >> 2) + 4;
 	b = ((i & 0x7C00) >> 7) + 4;
-	pal = (const byte *)d_8to24table;
-	for (v = 0, k = 0, l = 10000 * 10000; v < 256; v++, pal += 4) {
-	    r1 = r - pal[0];
-	    g1 = g - pal[1];
-	    b1 = b - pal[2];
-	    j = (r1 * r1) + (g1 * g1) + (b1 * b1);
-	    if (j < l) {
-		k = v;
-		l = j;
-	    }
-	}
-	d_15to8table[i] = k;
+	d_15to8table[i] = Pal_FindClosest(&search, r, g, b);
     }
 }
 
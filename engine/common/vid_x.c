@@ -77,12 +77,19 @@ static Visual *x_vis;
 static XVisualInfo *x_visinfo;
 
 static int x_shmeventtype;
-static qboolean oktodraw = false;
 
 static int current_framebuffer;
 static XImage *x_framebuffer[2] = { 0, 0 };
 static XShmSegmentInfo x_shminfo[2];
 
+/*
+ * XShmPutImage requests the server hasn't finished reading from each frame
+ * buffer yet.  A buffer can't be drawn into again until its completion events
+ * have all come back; while one is on its way to the screen, the other is
+ * being drawn and converted.
+ */
+static int x_shmpending[2];
+
 static int verbose = 0;
 
 static byte current_palette[768];
@@ -189,101 +196,83 @@ xlib_rgb24(int r, int g, int b)
     return p;
 }
 
+/*
+ * The 8-bit view is drawn at the start of each image row and widened in
+ * place, from the right end back, so the wider pixels only ever land on
+ * indices that have already been read.  Four indices come in with one load
+ * and go out as whole words; the palette lookups are the only work left
+ * per pixel.
+ */
 static void
 st2_fixup(XImage *framebuf, int x, int y, int width, int height)
 {
-    int yi;
-    unsigned char *src;
+    int yi, xi;
+    const byte *src;
     PIXEL16 *dest;
-    register int count, n;
+    byte in[4];
+    PIXEL16 out[4];
 
     if ((x < 0) || (y < 0))
 	return;
 
     for (yi = y; yi < (y + height); yi++) {
-	src = (unsigned char *)&framebuf->data[yi * framebuf->bytes_per_line];
-
-	// Duff's Device
-	count = width;
-	n = (count + 7) / 8;
-	dest = ((PIXEL16 *)src) + x + width - 1;
-	src += x + width - 1;
-
-	switch (count % 8) {
-	case 0:
-	    do {
-		*dest-- = st2d_8to16table[*src--];
-	case 7:
-		*dest-- = st2d_8to16table[*src--];
-	case 6:
-		*dest-- = st2d_8to16table[*src--];
-	case 5:
-		*dest-- = st2d_8to16table[*src--];
-	case 4:
-		*dest-- = st2d_8to16table[*src--];
-	case 3:
-		*dest-- = st2d_8to16table[*src--];
-	case 2:
-		*dest-- = st2d_8to16table[*src--];
-	case 1:
-		*dest-- = st2d_8to16table[*src--];
-	    } while (--n > 0);
+	src = (const byte *)&framebuf->data[yi * framebuf->bytes_per_line];
+	dest = (PIXEL16 *)src;
+	src += x;
+	dest += x;
+
+	xi = width;
+	while (xi & 3) {
+	    xi--;
+	    dest[xi] = st2d_8to16table[src[xi]];
+	}
+	while (xi) {
+	    xi -= 4;
+	    memcpy(in, src + xi, sizeof(in));
+	    out[0] = st2d_8to16table[in[0]];
+	    out[1] = st2d_8to16table[in[1]];
+	    out[2] = st2d_8to16table[in[2]];
+	    out[3] = st2d_8to16table[in[3]];
+	    memcpy(dest + xi, out, sizeof(out));
 	}
-
-	//for (xi = (x + width - 1); xi >= x; xi--) {
-	//    dest[xi] = st2d_8to16table[src[xi]];
-	//}
     }
 }
 
 static void
-st3_fixup(XImage * framebuf, int x, int y, int width, int height)
+st3_fixup(XImage *framebuf, int x, int y, int width, int height)
 {
-    int yi;
-    unsigned char *src;
+    int yi, xi;
+    const byte *src;
     PIXEL24 *dest;
-    register int count, n;
+    byte in[4];
+    PIXEL24 out[4];
 
     if ((x < 0) || (y < 0))
 	return;
 
     for (yi = y; yi < (y + height); yi++) {
-	src = (unsigned char *)&framebuf->data[yi * framebuf->bytes_per_line];
-
-	// Duff's Device
-	count = width;
-	n = (count + 7) / 8;
-	dest = ((PIXEL24 *)src) + x + width - 1;
-	src += x + width - 1;
-
-	switch (count % 8) {
-	case 0:
-	    do {
-		*dest-- = st2d_8to24table[*src--];
-	case 7:
-		*dest-- = st2d_8to24table[*src--];
-	case 6:
-		*dest-- = st2d_8to24table[*src--];
-	case 5:
-		*dest-- = st2d_8to24table[*src--];
-	case 4:
-		*dest-- = st2d_8to24table[*src--];
-	case 3:
-		*dest-- = st2d_8to24table[*src--];
-	case 2:
-		*dest-- = st2d_8to24table[*src--];
-	case 1:
-		*dest-- = st2d_8to24table[*src--];
-	    } while (--n > 0);
+	src = (const byte *)&framebuf->data[yi * framebuf->bytes_per_line];
+	dest = (PIXEL24 *)src;
+	src += x;
+	dest += x;
+
+	xi = width;
+	while (xi & 3) {
+	    xi--;
+	    dest[xi] = st2d_8to24table[src[xi]];
+	}
+	while (xi) {
+	    xi -= 4;
+	    memcpy(in, src + xi, sizeof(in));
+	    out[0] = st2d_8to24table[in[0]];
+	    out[1] = st2d_8to24table[in[1]];
+	    out[2] = st2d_8to24table[in[2]];
+	    out[3] = st2d_8to24table[in[3]];
+	    memcpy(dest + xi, out, sizeof(out));
 	}
-
-//              for(xi = (x+width-1); xi >= x; xi--) {
-//                      dest[xi] = st2d_8to16table[src[xi]];
-//              }
     }
 }
 
-
 // ========================================================================
 // Tragic death handler
 // ========================================================================
@@ -350,6 +339,24 @@ ResetFrameBuffer(void)
     vid.conbuffer = vid.buffer;
 }
 
+static void HandleEvents(void);
+
+/*
+ * Blocks until the server is done with any puts from the given frame buffer
+ */
+static void
+WaitForFrameBuffer(int frm)
+{
+    XEvent x_event;
+
+    if (x_shmpending[frm])
+	XFlush(x_disp);
+    while (x_shmpending[frm]) {
+	XPeekEvent(x_disp, &x_event);
+	HandleEvents();
+    }
+}
+
 static void
 ResetSharedFrameBuffers(void)
 {
@@ -386,6 +393,7 @@ ResetSharedFrameBuffers(void)
 
 	// free up old frame buffer memory
 	if (x_framebuffer[frm]) {
+	    WaitForFrameBuffer(frm);
 	    XShmDetach(x_disp, &x_shminfo[frm]);
 	    free(x_framebuffer[frm]);
 	    shmdt(x_shminfo[frm].shmaddr);
@@ -570,7 +578,6 @@ VID_SetMode(const qvidmode_t *mode, const byte *palette)
 	do {
 	    XNextEvent(x_disp, &event);
 	} while (event.type != Expose || event.xexpose.count);
-	oktodraw = true;
     }
 
     /* even if MITSHM is available, make sure it's a local connection */
@@ -781,6 +788,10 @@ void
 VID_Shutdown(void)
 {
     Con_Printf("VID_Shutdown\n");
+    if (doShm) {
+	WaitForFrameBuffer(0);
+	WaitForFrameBuffer(1);
+    }
     VID_restore_vidmode();
     XAutoRepeatOn(x_disp);
     XCloseDisplay(x_disp);
@@ -1078,8 +1089,15 @@ HandleEvents(void)
 	    break;
 
 	default:
-	    if (doShm && x_event.type == x_shmeventtype)
-		oktodraw = true;
+	    if (doShm && x_event.type == x_shmeventtype) {
+		const XShmCompletionEvent *done = (XShmCompletionEvent *)&x_event;
+		int frm;
+
+		for (frm = 0; frm < 2; frm++)
+		    if (done->shmseg == x_shminfo[frm].shmseg
+			&& x_shmpending[frm] > 0)
+			x_shmpending[frm]--;
+	    }
 	}
     }
 
@@ -1119,7 +1137,10 @@ VID_Update(vrect_t *rects)
 	scr_fullupdate = 0;
 
     if (doShm) {
-
+	/*
+	 * Queue the puts and move on without waiting; the next frame is drawn
+	 * into the other buffer once the server has let go of it.
+	 */
 	while (rects) {
 	    if (x_visinfo->depth == 16) {
 		st2_fixup(x_framebuffer[current_framebuffer],
@@ -1133,15 +1154,14 @@ VID_Update(vrect_t *rects)
 			      rects->y, rects->x, rects->y, rects->width,
 			      rects->height, True))
 		Sys_Error("VID_Update: XShmPutImage failed");
-	    oktodraw = false;
-	    while (!oktodraw)
-		HandleEvents();
+	    x_shmpending[current_framebuffer]++;
 	    rects = rects->pnext;
 	}
+	XFlush(x_disp);
 	current_framebuffer = !current_framebuffer;
+	WaitForFrameBuffer(current_framebuffer);
 	vid.buffer = (byte *)x_framebuffer[current_framebuffer]->data;
 	vid.conbuffer = vid.buffer;
-	XSync(x_disp, False);
     } else {
 	while (rects) {
 	    if (x_visinfo->depth == 16)
@@ -69,7 +69,10 @@ W_LoadWadFile(wad_t *wad, const char *filename)
     unsigned i;
     int infotableofs;
 
-    wad->base = COM_LoadHunkFile(filename);
+    /* the wad is kept for good, so map it straight from the pak if we can */
+    wad->base = COM_MapFile(filename, NULL, &wad->mapping);
+    if (!wad->base)
+	wad->base = COM_LoadHunkFile(filename);
     if (!wad->base)
 	Sys_Error("%s: couldn't load %s", __func__, filename);
 
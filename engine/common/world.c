@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "model.h"
 #include "progs.h"
 #include "server.h"
+#include "sv_profile.h"
 #include "world.h"
 
 #ifdef NQ_HACK
@@ -122,21 +123,182 @@ ENTITY AREA CHECKING
 ===============================================================================
 */
 
+/*
+ * The tree starts as it always did, splitting the world bounds down to
+ * AREA_DEPTH, and leaves holding more than AREA_SPLIT edicts are split
+ * further as they fill up.  The tree is loose: a child takes the edicts
+ * reaching up to AREA_LOOSE units past its side of the split, so small
+ * edicts near a split go down the tree instead of staying at the node.
+ * SOLID_NOT edicts are kept in lists of their own, so pushers can find the
+ * corpses and gibs riding them; nothing else looks at those.
+ */
 typedef struct areanode_s {
     int axis;			// -1 = leaf node
     float dist;
     struct areanode_s *children[2];
     link_t trigger_edicts;
     link_t solid_edicts;
+    link_t notsolid_edicts;
+    vec3_t mins, maxs;
+    int depth;
+    int numedicts;
 } areanode_t;
 
 #define	AREA_DEPTH	4
-#define	AREA_NODES	32
+#define	AREA_NODES	1024
+#define	AREA_SPLIT	16
+#define	AREA_MINSIZE	128
+#define	AREA_LOOSE	32
 
 static areanode_t sv_areanodes[AREA_NODES];
 static int sv_numareanodes;
+static int sv_areatouching;	// no splits while the triggers are touched
+
+/*
+ * Each entity keeps the triggers it found near itself the last time it
+ * touched triggers, and the box it looked in.  Until it leaves that box, or
+ * a trigger is linked or unlinked anywhere, it checks just those instead of
+ * walking the area nodes again.  The touches still run every time it's
+ * linked, as the progs expect.
+ */
+#define	TOUCH_MARGIN	16
+
+cvar_t sv_touchstats = { "sv_touchstats", "0" };
+
+static unsigned sv_touchgen = 1;
+
+/* Bumped whenever the world or a brush entity may have moved */
+unsigned sv_brushgen;
+static struct {
+    int relinks;		// links that touched triggers
+    int walks;			// ...and had to walk the area nodes
+    int touches;		// calls to the progs
+    int frames;
+    float time;
+} sv_touchcounts;
+
+static void
+SV_TriggersChanged(void)
+{
+    if (!++sv_touchgen)
+	sv_touchgen = 1;	// zero is never valid
+}
 
 #if defined(QW_HACK) && defined(SERVERONLY)
+/*
+ * Each player keeps the solid edicts found in a box PHYSENT_MARGIN units
+ * bigger than the one its moves look in.  Until the player's box leaves it,
+ * or an edict is linked into it from outside, the physents for each move
+ * are picked from that list instead of walking the area nodes again.
+ * Edicts already in the list may move, change solid or be unlinked freely,
+ * as each one is checked again for every move.
+ */
+#define	PHYSENT_MARGIN		64
+#define	PHYSENT_CANDIDATES	256
+
+cvar_t sv_physentstats = { "sv_physentstats", "0" };
+
+typedef struct {
+    qboolean valid;
+    vec3_t mins, maxs;
+    int numedicts;
+    const edict_t *edicts[PHYSENT_CANDIDATES];
+} physentcache_t;
+
+static physentcache_t sv_physentcache[MAX_CLIENTS];
+
+static struct {
+    int cmds;
+    int walks;			// cmds that had to walk the area nodes
+    int checked;		// edicts looked at
+    int physents;		// ...and added
+    int frames;
+    float time;
+} sv_physentcounts;
+
+static qboolean
+SV_BoxesOverlap(const vec3_t mins1, const vec3_t maxs1,
+		const vec3_t mins2, const vec3_t maxs2)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+	if (mins1[i] > maxs2[i] || maxs1[i] < mins2[i])
+	    return false;
+
+    return true;
+}
+
+static qboolean
+SV_InSolidList(const edict_t *ent)
+{
+    return ent->arealist && ent->arealist == &ent->areanode->solid_edicts;
+}
+
+/*
+ * Called when an edict is linked into a solid list.  Caches it could have
+ * been missing from are dropped; if it was linked inside one before, it's
+ * already there.
+ */
+static void
+SV_PhysentsLinked(const edict_t *ent, qboolean waslinked,
+		  const vec3_t oldmins, const vec3_t oldmaxs)
+{
+    physentcache_t *cache;
+    int i;
+
+    for (i = 0, cache = sv_physentcache; i < MAX_CLIENTS; i++, cache++) {
+	if (!cache->valid)
+	    continue;
+	if (!SV_BoxesOverlap(ent->v.absmin, ent->v.absmax,
+			     cache->mins, cache->maxs))
+	    continue;
+	if (waslinked
+	    && SV_BoxesOverlap(oldmins, oldmaxs, cache->mins, cache->maxs))
+	    continue;
+	cache->valid = false;
+    }
+}
+
+/* Returns false once the stack is full */
+static qboolean
+SV_AddPhysent(const edict_t *check, const edict_t *player,
+	      const vec3_t mins, const vec3_t maxs, physent_stack_t *pestack)
+{
+    physent_t *physent;
+
+    sv_physentcounts.checked++;
+
+    /* player's own missile */
+    if (check->v.owner == EDICT_TO_PROG(player))
+	return true;
+    if (check->v.solid != SOLID_BSP
+	&& check->v.solid != SOLID_BBOX
+	&& check->v.solid != SOLID_SLIDEBOX)
+	return true;
+    if (check == player)
+	return true;
+    if (!SV_BoxesOverlap(check->v.absmin, check->v.absmax, mins, maxs))
+	return true;
+    if (pestack->numphysent == MAX_PHYSENTS)
+	return false;
+
+    physent = &pestack->physents[pestack->numphysent++];
+    VectorCopy(check->v.origin, physent->origin);
+    physent->entitynum = NUM_FOR_EDICT(check);
+    if (check->v.solid == SOLID_BSP) {
+	const model_t *model = sv.models[(int)(check->v.modelindex)];
+	physent->brushmodel = ConstBrushModel(model);
+    } else {
+	physent->brushmodel = NULL;
+	VectorCopy(check->v.mins, physent->mins);
+	VectorCopy(check->v.maxs, physent->maxs);
+    }
+    sv_physentcounts.physents++;
+
+    return true;
+}
+
 /*
 ====================
 AddLinksToPhysents
@@ -151,79 +313,234 @@ SV_AddLinksToPhysents_r(const areanode_t *node, const edict_t *player,
     const link_t *link, *next;
     const link_t *const solids = &node->solid_edicts;
     const edict_t *check;
-    int i, playernum;
-    physent_t *physent;
-
-    playernum = EDICT_TO_PROG(player);
-    physent = &pestack->physents[pestack->numphysent];
 
     /* touch linked edicts */
     for (link = solids->next; link != solids; link = next) {
 	next = link->next;
 	check = const_container_of(link, edict_t, area);
-
-	/* player's own missile */
-	if (check->v.owner == playernum)
-	    continue;
-	if (check->v.solid == SOLID_BSP
-	    || check->v.solid == SOLID_BBOX
-	    || check->v.solid == SOLID_SLIDEBOX) {
-	    if (check == player)
-		continue;
-	    for (i = 0; i < 3; i++)
-		if (check->v.absmin[i] > maxs[i]
-		    || check->v.absmax[i] < mins[i])
-		    break;
-	    if (i != 3)
-		continue;
-	    if (pestack->numphysent == MAX_PHYSENTS)
-		return;
-
-	    VectorCopy(check->v.origin, physent->origin);
-	    physent->entitynum = NUM_FOR_EDICT(check);
-	    if (check->v.solid == SOLID_BSP) {
-		const model_t *model = sv.models[(int)(check->v.modelindex)];
-		physent->brushmodel = ConstBrushModel(model);
-	    } else {
-		physent->brushmodel = NULL;
-		VectorCopy(check->v.mins, physent->mins);
-		VectorCopy(check->v.maxs, physent->maxs);
-	    }
-	    physent++;
-	    pestack->numphysent++;
-	}
+	if (!SV_AddPhysent(check, player, mins, maxs, pestack))
+	    return;
     }
 
     /* recurse down both sides */
     if (node->axis == -1)
 	return;
 
-    if (maxs[node->axis] > node->dist)
+    if (maxs[node->axis] > node->dist - AREA_LOOSE)
 	SV_AddLinksToPhysents_r(node->children[0], player, mins, maxs, pestack);
-    if (mins[node->axis] < node->dist)
+    if (mins[node->axis] < node->dist + AREA_LOOSE)
 	SV_AddLinksToPhysents_r(node->children[1], player, mins, maxs, pestack);
 }
 
+/* Returns false if there are too many to keep */
+static qboolean
+SV_FindPhysentCandidates_r(const areanode_t *node, const edict_t *player,
+			   physentcache_t *cache)
+{
+    const link_t *link;
+    const link_t *const solids = &node->solid_edicts;
+    const edict_t *check;
+
+    for (link = solids->next; link != solids; link = link->next) {
+	check = const_container_of(link, edict_t, area);
+	if (check == player)
+	    continue;
+	if (!SV_BoxesOverlap(check->v.absmin, check->v.absmax,
+			     cache->mins, cache->maxs))
+	    continue;
+	if (cache->numedicts == PHYSENT_CANDIDATES)
+	    return false;
+	cache->edicts[cache->numedicts++] = check;
+    }
+
+    if (node->axis == -1)
+	return true;
+
+    if (cache->maxs[node->axis] > node->dist - AREA_LOOSE)
+	if (!SV_FindPhysentCandidates_r(node->children[0], player, cache))
+	    return false;
+    if (cache->mins[node->axis] < node->dist + AREA_LOOSE)
+	if (!SV_FindPhysentCandidates_r(node->children[1], player, cache))
+	    return false;
+
+    return true;
+}
+
+static qboolean
+SV_PhysentCacheValid(const physentcache_t *cache, const vec3_t mins,
+		     const vec3_t maxs)
+{
+    int i;
+
+    if (!cache->valid)
+	return false;
+    for (i = 0; i < 3; i++)
+	if (mins[i] < cache->mins[i] || maxs[i] > cache->maxs[i])
+	    return false;
+
+    return true;
+}
+
 void
 SV_AddLinksToPhysents(const edict_t *player, const vec3_t mins,
 		      const vec3_t maxs, physent_stack_t *pestack)
 {
-    SV_AddLinksToPhysents_r(sv_areanodes, player, mins, maxs, pestack);
+    physentcache_t *cache = NULL;
+    const edict_t *check;
+    int i, playernum;
+
+    sv_physentcounts.cmds++;
+
+    playernum = NUM_FOR_EDICT(player) - 1;
+    if (playernum >= 0 && playernum < MAX_CLIENTS)
+	cache = &sv_physentcache[playernum];
+
+    if (cache && !SV_PhysentCacheValid(cache, mins, maxs)) {
+	sv_physentcounts.walks++;
+	for (i = 0; i < 3; i++) {
+	    cache->mins[i] = mins[i] - PHYSENT_MARGIN;
+	    cache->maxs[i] = maxs[i] + PHYSENT_MARGIN;
+	}
+	cache->numedicts = 0;
+	cache->valid = SV_FindPhysentCandidates_r(sv_areanodes, player, cache);
+    }
+    if (!cache || !cache->valid) {
+	SV_AddLinksToPhysents_r(sv_areanodes, player, mins, maxs, pestack);
+	return;
+    }
+
+    for (i = 0; i < cache->numedicts; i++) {
+	check = cache->edicts[i];
+	if (!SV_InSolidList(check))
+	    continue;		// unlinked since
+	if (!SV_AddPhysent(check, player, mins, maxs, pestack))
+	    break;
+    }
+}
+
+/*
+====================
+SV_PhysentStats
+
+Called at the end of each server frame, prints the player move physent
+stats once a second if sv_physentstats is set
+====================
+*/
+void
+SV_PhysentStats(void)
+{
+    int cmds;
+
+    if (!sv_physentstats.value) {
+	memset(&sv_physentcounts, 0, sizeof(sv_physentcounts));
+	return;
+    }
+
+    sv_physentcounts.frames++;
+    if (sv.time - sv_physentcounts.time < 1)
+	return;
+
+    cmds = qmax(sv_physentcounts.cmds, 1);
+    Con_Printf("physents: %.1f cmds, %.1f walks per frame, "
+	       "%.1f checked, %.1f physents per cmd\n",
+	       (float)sv_physentcounts.cmds / sv_physentcounts.frames,
+	       (float)sv_physentcounts.walks / sv_physentcounts.frames,
+	       (float)sv_physentcounts.checked / cmds,
+	       (float)sv_physentcounts.physents / cmds);
+    memset(&sv_physentcounts, 0, sizeof(sv_physentcounts));
+    sv_physentcounts.time = sv.time;
 }
 #endif
 
+static void
+SV_AreaListEdicts(link_t *list, const vec3_t mins, const vec3_t maxs,
+		  edict_t **edicts, int *numedicts, int maxedicts)
+{
+    link_t *link;
+    edict_t *check;
+    int i;
+
+    for (link = list->next; link != list; link = link->next) {
+	check = container_of(link, edict_t, area);
+	for (i = 0; i < 3; i++)
+	    if (check->v.absmin[i] > maxs[i] || check->v.absmax[i] < mins[i])
+		break;
+	if (i != 3)
+	    continue;
+	if (*numedicts == maxedicts)
+	    return;
+	edicts[(*numedicts)++] = check;
+    }
+}
+
+static void
+SV_AreaNodeEdicts_r(areanode_t *node, const vec3_t mins,
+		    const vec3_t maxs, edict_t **edicts, int *numedicts,
+		    int maxedicts, qboolean notsolid)
+{
+    SV_AreaListEdicts(&node->trigger_edicts, mins, maxs, edicts, numedicts,
+		      maxedicts);
+    SV_AreaListEdicts(&node->solid_edicts, mins, maxs, edicts, numedicts,
+		      maxedicts);
+    if (notsolid)
+	SV_AreaListEdicts(&node->notsolid_edicts, mins, maxs, edicts,
+			  numedicts, maxedicts);
+
+    if (node->axis == -1)
+	return;
+    if (maxs[node->axis] > node->dist - AREA_LOOSE)
+	SV_AreaNodeEdicts_r(node->children[0], mins, maxs, edicts, numedicts,
+			    maxedicts, notsolid);
+    if (mins[node->axis] < node->dist + AREA_LOOSE)
+	SV_AreaNodeEdicts_r(node->children[1], mins, maxs, edicts, numedicts,
+			    maxedicts, notsolid);
+}
+
 /*
-===============
-SV_CreateAreaNode
+====================
+SV_AreaEdicts
 
-===============
+Fills in the linked edicts, triggers and solids alike, whose abs boxes touch
+the given box, up to maxedicts of them.  Returns how many there were.
+====================
 */
+int
+SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **edicts,
+	      int maxedicts)
+{
+    int numedicts = 0;
+
+    if (sv_numareanodes)
+	SV_AreaNodeEdicts_r(sv_areanodes, mins, maxs, edicts, &numedicts,
+			    maxedicts, false);
+
+    return numedicts;
+}
+
+/*
+====================
+SV_AreaPushEdicts
+
+As SV_AreaEdicts, but the SOLID_NOT edicts are included
+====================
+*/
+int
+SV_AreaPushEdicts(const vec3_t mins, const vec3_t maxs, edict_t **edicts,
+		  int maxedicts)
+{
+    int numedicts = 0;
+
+    if (sv_numareanodes)
+	SV_AreaNodeEdicts_r(sv_areanodes, mins, maxs, edicts, &numedicts,
+			    maxedicts, true);
+
+    return numedicts;
+}
+
 static areanode_t *
-SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
+SV_AllocAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
 {
     areanode_t *anode;
-    vec3_t size;
-    vec3_t mins1, maxs1, mins2, maxs2;
 
     if (sv_numareanodes == AREA_NODES)
 	SV_Error("%s: sv_numareanodes == AREA_NODES", __func__);
@@ -233,31 +550,94 @@ SV_CreateAreaNode(int depth, const vec3_t mins, const vec3_t maxs)
 
     ClearLink(&anode->trigger_edicts);
     ClearLink(&anode->solid_edicts);
+    ClearLink(&anode->notsolid_edicts);
+    anode->axis = -1;
+    anode->children[0] = anode->children[1] = NULL;
+    VectorCopy(mins, anode->mins);
+    VectorCopy(maxs, anode->maxs);
+    anode->depth = depth;
+    anode->numedicts = 0;
 
-    if (depth == AREA_DEPTH) {
-	anode->axis = -1;
-	anode->children[0] = anode->children[1] = NULL;
-	return anode;
-    }
+    return anode;
+}
 
-    VectorSubtract(maxs, mins, size);
+/*
+ * Gives a leaf two children, split across its longest side.  Returns false
+ * if it's too small or there are no nodes left.
+ */
+static qboolean
+SV_SplitAreaNode(areanode_t *anode, qboolean vertical)
+{
+    vec3_t size;
+    vec3_t mins1, maxs1, mins2, maxs2;
+    int axis;
+
+    if (sv_numareanodes > AREA_NODES - 2)
+	return false;
+
+    VectorSubtract(anode->maxs, anode->mins, size);
     if (size[0] > size[1])
-	anode->axis = 0;
+	axis = 0;
     else
-	anode->axis = 1;
+	axis = 1;
+    if (vertical && size[2] > size[axis])
+	axis = 2;
+    if (size[axis] < 2 * AREA_MINSIZE)
+	return false;
 
-    anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-    VectorCopy(mins, mins1);
-    VectorCopy(mins, mins2);
-    VectorCopy(maxs, maxs1);
-    VectorCopy(maxs, maxs2);
+    anode->axis = axis;
+    anode->dist = 0.5 * (anode->maxs[axis] + anode->mins[axis]);
+    VectorCopy(anode->mins, mins1);
+    VectorCopy(anode->mins, mins2);
+    VectorCopy(anode->maxs, maxs1);
+    VectorCopy(anode->maxs, maxs2);
 
-    maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+    maxs1[axis] = mins2[axis] = anode->dist;
 
-    anode->children[0] = SV_CreateAreaNode(depth + 1, mins2, maxs2);
-    anode->children[1] = SV_CreateAreaNode(depth + 1, mins1, maxs1);
+    anode->children[0] = SV_AllocAreaNode(anode->depth + 1, mins2, maxs2);
+    anode->children[1] = SV_AllocAreaNode(anode->depth + 1, mins1, maxs1);
 
-    return anode;
+    return true;
+}
+
+/*
+===============
+SV_CreateAreaNode
+
+===============
+*/
+static void
+SV_CreateAreaNode(areanode_t *anode)
+{
+    if (anode->depth == AREA_DEPTH)
+	return;
+    if (!SV_SplitAreaNode(anode, false))
+	return;
+
+    SV_CreateAreaNode(anode->children[0]);
+    SV_CreateAreaNode(anode->children[1]);
+}
+
+/*
+ * The child of the node that takes the box, or NULL if it crosses the
+ * split.  Boxes small enough for either child go by their centre.
+ */
+static areanode_t *
+SV_AreaChild(const areanode_t *node, const vec3_t mins, const vec3_t maxs)
+{
+    const float min = mins[node->axis];
+    const float max = maxs[node->axis];
+    const qboolean front = min > node->dist - AREA_LOOSE;
+    const qboolean back = max < node->dist + AREA_LOOSE;
+
+    if (front && back)
+	return node->children[(min + max) * 0.5f > node->dist ? 0 : 1];
+    if (front)
+	return node->children[0];
+    if (back)
+	return node->children[1];
+
+    return NULL;
 }
 
 /*
@@ -273,7 +653,105 @@ SV_ClearWorld(void)
 
     memset(sv_areanodes, 0, sizeof(sv_areanodes));
     sv_numareanodes = 0;
-    SV_CreateAreaNode(0, model->mins, model->maxs);
+    SV_TriggersChanged();
+    sv_brushgen++;
+    sv_touchcounts.time = 0;
+#if defined(QW_HACK) && defined(SERVERONLY)
+    memset(sv_physentcache, 0, sizeof(sv_physentcache));
+    sv_physentcounts.time = 0;
+#endif
+    SV_CreateAreaNode(SV_AllocAreaNode(0, model->mins, model->maxs));
+}
+
+/*
+ * Splits a leaf that has filled up and moves down the edicts which fit in
+ * one of the new children.
+ */
+static void
+SV_RefineAreaNode(areanode_t *node)
+{
+    link_t *lists[3], *link, *next;
+    areanode_t *child;
+    edict_t *ent;
+    int i;
+
+    if (!SV_SplitAreaNode(node, true))
+	return;
+    SV_TriggersChanged();
+
+    lists[0] = &node->trigger_edicts;
+    lists[1] = &node->solid_edicts;
+    lists[2] = &node->notsolid_edicts;
+    for (i = 0; i < 3; i++) {
+	for (link = lists[i]->next; link != lists[i]; link = next) {
+	    next = link->next;
+	    ent = container_of(link, edict_t, area);
+	    child = SV_AreaChild(node, ent->v.absmin, ent->v.absmax);
+	    if (!child)
+		continue;
+	    RemoveLink(&ent->area);
+	    if (i == 0)
+		ent->arealist = &child->trigger_edicts;
+	    else if (i == 1)
+		ent->arealist = &child->solid_edicts;
+	    else
+		ent->arealist = &child->notsolid_edicts;
+	    InsertLinkBefore(&ent->area, ent->arealist);
+	    ent->areanode = child;
+	    node->numedicts--;
+	    child->numedicts++;
+	}
+    }
+}
+
+static void
+SV_AreaStats_r(const areanode_t *node, int *leafs, int *maxdepth,
+	       int *atleafs, const areanode_t **busiest)
+{
+    if (node->depth > *maxdepth)
+	*maxdepth = node->depth;
+    if (!*busiest || node->numedicts > (*busiest)->numedicts)
+	*busiest = node;
+    if (node->axis == -1) {
+	(*leafs)++;
+	*atleafs += node->numedicts;
+	return;
+    }
+    SV_AreaStats_r(node->children[0], leafs, maxdepth, atleafs, busiest);
+    SV_AreaStats_r(node->children[1], leafs, maxdepth, atleafs, busiest);
+}
+
+/*
+===============
+SV_AreaStats_f
+
+Prints the occupancy of the area nodes
+===============
+*/
+void
+SV_AreaStats_f(void)
+{
+    const areanode_t *busiest = NULL;
+    int i, total, leafs, maxdepth, atleafs;
+
+    if (!sv.worldmodel || !sv_numareanodes) {
+	Con_Printf("No world loaded\n");
+	return;
+    }
+
+    total = 0;
+    for (i = 0; i < sv_numareanodes; i++)
+	total += sv_areanodes[i].numedicts;
+    leafs = maxdepth = atleafs = 0;
+    SV_AreaStats_r(sv_areanodes, &leafs, &maxdepth, &atleafs, &busiest);
+
+    Con_Printf("%i/%i area nodes, %i leafs, depth %i\n", sv_numareanodes,
+	       AREA_NODES, leafs, maxdepth);
+    Con_Printf("%i edicts linked, %i in leafs, %.1f per leaf\n", total,
+	       atleafs, leafs ? (float)atleafs / leafs : 0);
+    Con_Printf("busiest node: %i edicts at depth %i (%s)\n",
+	       busiest->numedicts, busiest->depth,
+	       busiest->axis == -1 ? "leaf" : "split");
 }
 
 static link_t **sv_link_next;
@@ -290,7 +768,14 @@ SV_UnlinkEdict(edict_t *ent)
 {
     if (!ent->area.prev)
 	return;			// not linked in anywhere
+    if (ent->arealist == &ent->areanode->trigger_edicts)
+	SV_TriggersChanged();
+    if (ent->v.movetype == MOVETYPE_PUSH)
+	sv_brushgen++;		// only pushers can be SOLID_BSP
     RemoveLink(&ent->area);
+    ent->areanode->numedicts--;
+    ent->areanode = NULL;
+    ent->arealist = NULL;
     if (sv_link_next && *sv_link_next == &ent->area)
 	*sv_link_next = ent->area.next;
     if (sv_link_prev && *sv_link_prev == &ent->area)
@@ -299,6 +784,45 @@ SV_UnlinkEdict(edict_t *ent)
 }
 
 
+/*
+====================
+SV_TouchEdict
+
+Runs the trigger's touch function if the entity is inside it
+====================
+*/
+static void
+SV_TouchEdict(edict_t *ent, edict_t *touch)
+{
+    int old_self, old_other;
+
+    if (touch == ent)
+	return;
+    if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+	return;
+    if (ent->v.absmin[0] > touch->v.absmax[0]
+	|| ent->v.absmin[1] > touch->v.absmax[1]
+	|| ent->v.absmin[2] > touch->v.absmax[2]
+	|| ent->v.absmax[0] < touch->v.absmin[0]
+	|| ent->v.absmax[1] < touch->v.absmin[1]
+	|| ent->v.absmax[2] < touch->v.absmin[2])
+	return;
+
+    old_self = pr_global_struct->self;
+    old_other = pr_global_struct->other;
+
+    pr_global_struct->self = EDICT_TO_PROG(touch);
+    pr_global_struct->other = EDICT_TO_PROG(ent);
+    pr_global_struct->time = sv.time;
+    SV_ProfileBegin(SVP_TOUCH);
+    PR_ExecuteProgram(touch->v.touch);
+    SV_ProfileEnd();
+    sv_touchcounts.touches++;
+
+    pr_global_struct->self = old_self;
+    pr_global_struct->other = old_other;
+}
+
 /*
 ====================
 SV_TouchLinks
@@ -310,7 +834,6 @@ SV_TouchLinks(edict_t *ent, const areanode_t *node)
     link_t *link, *next;
     const link_t *const triggers = &node->trigger_edicts;
     edict_t *touch;
-    int old_self, old_other;
 
     /* touch linked edicts */
     for (link = triggers->next; link != triggers; link = next) {
@@ -326,40 +849,139 @@ SV_TouchLinks(edict_t *ent, const areanode_t *node)
 
 	next = link->next;
 	touch = container_of(link, edict_t, area);
+	SV_TouchEdict(ent, touch);
+    }
+
+    sv_link_next = NULL;
+
+    /* recurse down both sides */
+    if (node->axis == -1)
+	return;
+
+    if (ent->v.absmax[node->axis] > node->dist - AREA_LOOSE)
+	SV_TouchLinks(ent, node->children[0]);
+    if (ent->v.absmin[node->axis] < node->dist + AREA_LOOSE)
+	SV_TouchLinks(ent, node->children[1]);
+}
+
+/*
+ * Notes the triggers linked near the entity's touch box, in the same order
+ * SV_TouchLinks would reach them.  Returns false if there are too many.
+ */
+static qboolean
+SV_FindTouches_r(edict_t *ent, const areanode_t *node)
+{
+    const link_t *link;
+    const link_t *const triggers = &node->trigger_edicts;
+    const edict_t *touch;
+
+    for (link = triggers->next; link != triggers; link = link->next) {
+	touch = const_container_of(link, edict_t, area);
 	if (touch == ent)
 	    continue;
-	if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
-	    continue;
-	if (ent->v.absmin[0] > touch->v.absmax[0]
-	    || ent->v.absmin[1] > touch->v.absmax[1]
-	    || ent->v.absmin[2] > touch->v.absmax[2]
-	    || ent->v.absmax[0] < touch->v.absmin[0]
-	    || ent->v.absmax[1] < touch->v.absmin[1]
-	    || ent->v.absmax[2] < touch->v.absmin[2])
+	if (ent->touchmins[0] > touch->v.absmax[0]
+	    || ent->touchmins[1] > touch->v.absmax[1]
+	    || ent->touchmins[2] > touch->v.absmax[2]
+	    || ent->touchmaxs[0] < touch->v.absmin[0]
+	    || ent->touchmaxs[1] < touch->v.absmin[1]
+	    || ent->touchmaxs[2] < touch->v.absmin[2])
 	    continue;
+	if (ent->num_touches == MAX_ENT_TOUCHES)
+	    return false;
+	ent->touchnums[ent->num_touches++] = NUM_FOR_EDICT(touch);
+    }
 
-	old_self = pr_global_struct->self;
-	old_other = pr_global_struct->other;
+    if (node->axis == -1)
+	return true;
+
+    if (ent->touchmaxs[node->axis] > node->dist - AREA_LOOSE)
+	if (!SV_FindTouches_r(ent, node->children[0]))
+	    return false;
+    if (ent->touchmins[node->axis] < node->dist + AREA_LOOSE)
+	if (!SV_FindTouches_r(ent, node->children[1]))
+	    return false;
 
-	pr_global_struct->self = EDICT_TO_PROG(touch);
-	pr_global_struct->other = EDICT_TO_PROG(ent);
-	pr_global_struct->time = sv.time;
-	PR_ExecuteProgram(touch->v.touch);
+    return true;
+}
 
-	pr_global_struct->self = old_self;
-	pr_global_struct->other = old_other;
+static qboolean
+SV_TouchesValid(const edict_t *ent)
+{
+    int i;
+
+    if (ent->touchgen != sv_touchgen)
+	return false;
+    for (i = 0; i < 3; i++)
+	if (ent->v.absmin[i] < ent->touchmins[i]
+	    || ent->v.absmax[i] > ent->touchmaxs[i])
+	    return false;
+
+    return true;
+}
+
+/*
+====================
+SV_TouchTriggers
+
+Touches the triggers the entity is inside
+====================
+*/
+static void
+SV_TouchTriggers(edict_t *ent)
+{
+    int touchnums[MAX_ENT_TOUCHES];
+    int i, num_touches;
+
+    sv_touchcounts.relinks++;
+    if (!SV_TouchesValid(ent)) {
+	sv_touchcounts.walks++;
+	for (i = 0; i < 3; i++) {
+	    ent->touchmins[i] = ent->v.absmin[i] - TOUCH_MARGIN;
+	    ent->touchmaxs[i] = ent->v.absmax[i] + TOUCH_MARGIN;
+	}
+	ent->num_touches = 0;
+	if (!SV_FindTouches_r(ent, sv_areanodes))
+	    ent->num_touches = -1;	// too many, walk each time
+	ent->touchgen = sv_touchgen;
+    }
+    if (ent->num_touches < 0) {
+	SV_TouchLinks(ent, sv_areanodes);
+	return;
     }
 
-    sv_link_next = NULL;
+    /* the touches can link the entity again, so keep a copy */
+    num_touches = ent->num_touches;
+    memcpy(touchnums, ent->touchnums, num_touches * sizeof(touchnums[0]));
+    for (i = 0; i < num_touches; i++)
+	SV_TouchEdict(ent, EDICT_NUM(touchnums[i]));
+}
 
-    /* recurse down both sides */
-    if (node->axis == -1)
+/*
+====================
+SV_TouchStats
+
+Called at the end of each server frame, prints the trigger touching stats
+once a second if sv_touchstats is set
+====================
+*/
+void
+SV_TouchStats(void)
+{
+    if (!sv_touchstats.value) {
+	memset(&sv_touchcounts, 0, sizeof(sv_touchcounts));
+	return;
+    }
+
+    sv_touchcounts.frames++;
+    if (sv.time - sv_touchcounts.time < 1)
 	return;
 
-    if (ent->v.absmax[node->axis] > node->dist)
-	SV_TouchLinks(ent, node->children[0]);
-    if (ent->v.absmin[node->axis] < node->dist)
-	SV_TouchLinks(ent, node->children[1]);
+    Con_Printf("touch: %.1f links, %.1f walks, %.1f touches per frame\n",
+	       (float)sv_touchcounts.relinks / sv_touchcounts.frames,
+	       (float)sv_touchcounts.walks / sv_touchcounts.frames,
+	       (float)sv_touchcounts.touches / sv_touchcounts.frames);
+    memset(&sv_touchcounts, 0, sizeof(sv_touchcounts));
+    sv_touchcounts.time = sv.time;
 }
 
 
@@ -410,16 +1032,21 @@ SV_LinkEdict
 void
 SV_LinkEdict(edict_t *ent, qboolean touch_triggers)
 {
-    areanode_t *node;
-
-    if (ent->area.prev)
-	SV_UnlinkEdict(ent);	// unlink from old position
+    areanode_t *node, *child;
+    link_t *list;
+    edhot_t *hot;
+#if defined(QW_HACK) && defined(SERVERONLY)
+    const qboolean waslinked = SV_InSolidList(ent);
+    vec3_t oldmins, oldmaxs;
 
-    if (ent == sv.edicts)
-	return;			// don't add the world
+    VectorCopy(ent->v.absmin, oldmins);
+    VectorCopy(ent->v.absmax, oldmaxs);
+#endif
 
-    if (ent->free)
+    if (ent == sv.edicts || ent->free) {
+	SV_UnlinkEdict(ent);	// don't add the world
 	return;
+    }
 
     /* set the abs box */
     VectorAdd(ent->v.origin, ent->v.mins, ent->v.absmin);
@@ -451,32 +1078,53 @@ SV_LinkEdict(edict_t *ent, qboolean touch_triggers)
     ent->num_leafs = 0;
     if (ent->v.modelindex)
 	SV_FindTouchedLeafs(ent, sv.worldmodel->nodes);
-
-    if (ent->v.solid == SOLID_NOT)
-	return;
+    hot = EDICT_HOT(ent);
+    hot->num_leafs = ent->num_leafs;
+    hot->leafnum = ent->leafnums[0];
 
     /* find the first node that the ent's box crosses */
     node = sv_areanodes;
-    while (1) {
-	if (node->axis == -1)
-	    break;
-	if (ent->v.absmin[node->axis] > node->dist)
-	    node = node->children[0];
-	else if (ent->v.absmax[node->axis] < node->dist)
-	    node = node->children[1];
-	else
+    while (node->axis != -1) {
+	child = SV_AreaChild(node, ent->v.absmin, ent->v.absmax);
+	if (!child)
 	    break;		// crosses the node
+	node = child;
     }
 
-    /* link it in */
+    /* link it in, unless it's already there */
     if (ent->v.solid == SOLID_TRIGGER)
-	InsertLinkBefore(&ent->area, &node->trigger_edicts);
+	list = &node->trigger_edicts;
+    else if (ent->v.solid == SOLID_NOT)
+	list = &node->notsolid_edicts;
     else
-	InsertLinkBefore(&ent->area, &node->solid_edicts);
+	list = &node->solid_edicts;
+    if (ent->arealist != list) {
+	SV_UnlinkEdict(ent);
+	InsertLinkBefore(&ent->area, list);
+	ent->areanode = node;
+	ent->arealist = list;
+	node->numedicts++;
+	if (node->axis == -1 && node->numedicts > AREA_SPLIT
+	    && !sv_areatouching)
+	    SV_RefineAreaNode(node);
+    }
+    if (ent->v.solid == SOLID_NOT)
+	return;			// can't touch triggers or block anything
 
-    if (touch_triggers)
-	/* touch all entities at this node and decend for more */
-	SV_TouchLinks(ent, sv_areanodes);
+    if (ent->v.solid == SOLID_TRIGGER)
+	SV_TriggersChanged();
+    else if (ent->v.solid == SOLID_BSP)
+	sv_brushgen++;
+#if defined(QW_HACK) && defined(SERVERONLY)
+    if (ent->v.solid != SOLID_TRIGGER)
+	SV_PhysentsLinked(ent, waslinked, oldmins, oldmaxs);
+#endif
+
+    if (touch_triggers) {
+	sv_areatouching++;
+	SV_TouchTriggers(ent);
+	sv_areatouching--;
+    }
 }
 
 /*
@@ -564,6 +1212,78 @@ SV_ClipToEntity(const edict_t *ent, const vec3_t start, const vec3_t mins,
 
 //===========================================================================
 
+/*
+ * Whether the move could be clipped by the edict at all, wherever it is.
+ * Once a trace is allsolid nothing else changes it, so these can be tested
+ * in any order with the box checks.
+ */
+static qboolean
+SV_MoveClipsEdict(const moveclip_t *clip, const edict_t *touch)
+{
+    if (touch->v.solid == SOLID_NOT)
+	return false;
+    if (touch == clip->passedict)
+	return false;
+    if (touch->v.solid == SOLID_TRIGGER)
+	SV_Error("Trigger in clipping list");
+
+    if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+	return false;
+
+    if (clip->passedict) {
+	if (clip->passedict->v.size[0] && !touch->v.size[0])
+	    return false;	// points never interact
+	/* don't clip against own missiles */
+	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+	    return false;
+	/* don't clip against owner */
+	if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+	    return false;
+    }
+
+    return true;
+}
+
+static qboolean
+SV_BoundsTouchEdict(const bounds_t *bounds, const edict_t *touch)
+{
+    return !(bounds->mins[0] > touch->v.absmax[0]
+	     || bounds->mins[1] > touch->v.absmax[1]
+	     || bounds->mins[2] > touch->v.absmax[2]
+	     || bounds->maxs[0] < touch->v.absmin[0]
+	     || bounds->maxs[1] < touch->v.absmin[1]
+	     || bounds->maxs[2] < touch->v.absmin[2]);
+}
+
+/* Clips the move to an edict that passed the tests, keeping the nearest */
+static const edict_t *
+SV_ClipMoveToEdict(const edict_t *clipent, const edict_t *touch,
+		   const moveclip_t *clip, trace_t *trace)
+{
+    trace_t stacktrace;
+    const bounds_t *clipbounds;
+
+    if ((int)touch->v.flags & FL_MONSTER)
+	clipbounds = &clip->monster;
+    else
+	clipbounds = &clip->object;
+    SV_ClipToEntity(touch, clip->start, clipbounds->mins, clipbounds->maxs,
+		    clip->end, &stacktrace);
+
+    if (stacktrace.allsolid || stacktrace.startsolid
+	|| stacktrace.fraction < trace->fraction) {
+	clipent = touch;
+	if (trace->startsolid) {
+	    *trace = stacktrace;
+	    trace->startsolid = true;
+	} else
+	    *trace = stacktrace;
+    } else if (stacktrace.startsolid)
+	trace->startsolid = true;
+
+    return clipent;
+}
+
 /*
 ====================
 SV_ClipToLinks
@@ -579,73 +1299,29 @@ SV_ClipToLinks_r(const edict_t *clipent, const areanode_t *node,
     link_t *link, *next;
     const link_t *const solids = &node->solid_edicts;
     edict_t *touch;
-    trace_t stacktrace;
-    const bounds_t *clipbounds;
 
     /* touch linked edicts */
     for (link = solids->next; link != solids; link = next) {
 	next = link->next;
 	touch = container_of(link, edict_t, area);
-	if (touch->v.solid == SOLID_NOT)
-	    continue;
-	if (touch == clip->passedict)
+	if (!SV_MoveClipsEdict(clip, touch))
 	    continue;
-	if (touch->v.solid == SOLID_TRIGGER)
-	    SV_Error("Trigger in clipping list");
-
-	if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+	if (!SV_BoundsTouchEdict(&clip->move, touch))
 	    continue;
 
-	if (clip->move.mins[0] > touch->v.absmax[0]
-	    || clip->move.mins[1] > touch->v.absmax[1]
-	    || clip->move.mins[2] > touch->v.absmax[2]
-	    || clip->move.maxs[0] < touch->v.absmin[0]
-	    || clip->move.maxs[1] < touch->v.absmin[1]
-	    || clip->move.maxs[2] < touch->v.absmin[2])
-	    continue;
-
-	if (clip->passedict && clip->passedict->v.size[0]
-	    && !touch->v.size[0])
-	    continue;		// points never interact
-
 	/* might intersect, so do an exact clip */
 	if (trace->allsolid)
 	    return clipent;
-	if (clip->passedict) {
-	    /* don't clip against own missiles */
-	    if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
-		continue;
-	    /* don't clip against owner */
-	    if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
-		continue;
-	}
-
-	if ((int)touch->v.flags & FL_MONSTER)
-	    clipbounds = &clip->monster;
-	else
-	    clipbounds = &clip->object;
-	SV_ClipToEntity(touch, clip->start, clipbounds->mins, clipbounds->maxs,
-			clip->end, &stacktrace);
-
-	if (stacktrace.allsolid || stacktrace.startsolid
-	    || stacktrace.fraction < trace->fraction) {
-	    clipent = touch;
-	    if (trace->startsolid) {
-		*trace = stacktrace;
-		trace->startsolid = true;
-	    } else
-		*trace = stacktrace;
-	} else if (stacktrace.startsolid)
-	    trace->startsolid = true;
+	clipent = SV_ClipMoveToEdict(clipent, touch, clip, trace);
     }
 
     /* recurse down both sides */
     if (node->axis == -1)
 	return clipent;
 
-    if (clip->move.maxs[node->axis] > node->dist)
+    if (clip->move.maxs[node->axis] > node->dist - AREA_LOOSE)
 	clipent = SV_ClipToLinks_r(clipent, node->children[0], clip, trace);
-    if (clip->move.mins[node->axis] < node->dist)
+    if (clip->move.mins[node->axis] < node->dist + AREA_LOOSE)
 	clipent = SV_ClipToLinks_r(clipent, node->children[1], clip, trace);
 
     return clipent;
@@ -731,3 +1407,118 @@ SV_TraceMove(const vec3_t start, const vec3_t mins, const vec3_t maxs,
 
     return clipent;
 }
+
+/*
+ * A trace area holds the edicts that could clip lines traced inside a box,
+ * found with one walk of the area nodes, so several probes close together
+ * don't each walk them.  The edicts are kept in the order SV_ClipToLinks
+ * would come to them, so each line comes out as it would from SV_TraceLine.
+ */
+static void
+SV_TraceAreaEdicts_r(tracearea_t *area, const moveclip_t *clip,
+		     const areanode_t *node)
+{
+    const link_t *link;
+    const link_t *const solids = &node->solid_edicts;
+    const edict_t *touch;
+
+    for (link = solids->next; link != solids; link = link->next) {
+	touch = const_container_of(link, edict_t, area);
+	if (!SV_MoveClipsEdict(clip, touch))
+	    continue;
+	if (!SV_BoundsTouchEdict(&clip->move, touch))
+	    continue;
+	if (area->numedicts == TRACEAREA_EDICTS) {
+	    area->numedicts = -1;
+	    return;
+	}
+	area->edicts[area->numedicts++] = touch;
+    }
+
+    if (node->axis == -1)
+	return;
+
+    if (clip->move.maxs[node->axis] > node->dist - AREA_LOOSE)
+	SV_TraceAreaEdicts_r(area, clip, node->children[0]);
+    if (area->numedicts < 0)
+	return;
+    if (clip->move.mins[node->axis] < node->dist + AREA_LOOSE)
+	SV_TraceAreaEdicts_r(area, clip, node->children[1]);
+}
+
+/*
+==================
+SV_InitTraceArea
+
+Finds the edicts which could clip lines traced within the box
+==================
+*/
+void
+SV_InitTraceArea(tracearea_t *area, const vec3_t mins, const vec3_t maxs,
+		 movetype_t type, const edict_t *passedict)
+{
+    moveclip_t clip;
+
+    memset(&clip, 0, sizeof(clip));
+    VectorCopy(mins, clip.move.mins);
+    VectorCopy(maxs, clip.move.maxs);
+    clip.type = type;
+    clip.passedict = passedict;
+
+    VectorCopy(mins, area->mins);
+    VectorCopy(maxs, area->maxs);
+    area->type = type;
+    area->passedict = passedict;
+    area->numedicts = 0;
+    if (type != MOVE_MISSILE)
+	SV_TraceAreaEdicts_r(area, &clip, sv_areanodes);
+    else
+	area->numedicts = -1;	// the monster box isn't a line
+}
+
+/*
+==================
+SV_TraceAreaLine
+
+SV_TraceLine for a line inside the trace area's box
+==================
+*/
+const edict_t *
+SV_TraceAreaLine(const tracearea_t *area, const vec3_t start,
+		 const vec3_t end, trace_t *trace)
+{
+    const edict_t *clipent, *touch;
+    qboolean clipworld;
+    moveclip_t clip;
+    int i;
+
+    memset(&clip, 0, sizeof(moveclip_t));
+    VectorCopy(start, clip.start);
+    VectorCopy(end, clip.end);
+    clip.type = area->type;
+    clip.passedict = area->passedict;
+    SV_MoveBounds(&clip.monster, start, end, &clip.move);
+
+    for (i = 0; i < 3; i++)
+	if (clip.move.mins[i] < area->mins[i]
+	    || clip.move.maxs[i] > area->maxs[i])
+	    break;
+    if (i < 3 || area->numedicts < 0)
+	return SV_TraceLine(start, end, area->type, area->passedict, trace);
+
+    /* clip to world */
+    SV_ClipToEntity(sv.edicts, start, vec3_origin, vec3_origin, end, trace);
+    clipworld = (trace->fraction < 1 || trace->startsolid);
+
+    /* clip to entities */
+    clipent = NULL;
+    for (i = 0; i < area->numedicts && !trace->allsolid; i++) {
+	touch = area->edicts[i];
+	if (SV_BoundsTouchEdict(&clip.move, touch))
+	    clipent = SV_ClipMoveToEdict(clipent, touch, &clip, trace);
+    }
+    if (!clipent && clipworld)
+	clipent = sv.edicts;
+
+    return clipent;
+}
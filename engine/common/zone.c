@@ -21,25 +21,32 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cmd.h"
 #include "common.h"
 #include "console.h"
+#include "cvar.h"
 #include "mathlib.h"
 #include "quakedef.h"
 #include "sys.h"
 #include "zone.h"
 
+#ifdef NQ_HACK
+#include "host.h"
+#endif
+
 #define	DYNAMIC_SIZE	0x40000		/* 256k */
 #define	ZONEID		0x1d4a11
+#define	SLABID		0x51ab1d
 #define MINFRAGMENT	64
 
 typedef struct memblock_s {
+    struct memblock_s *next, *prev;
     int size;		/* including the header and possibly tiny fragments */
     int tag;		/* a tag of 0 is a free block */
-    int id;		/* should be ZONEID */
-    struct memblock_s *next, *prev;
     int pad;		/* pad to 64 bit boundary */
+    int id;		/* should be ZONEID, last before the data (see SLABID) */
 } memblock_t;
 
 typedef struct {
     int size;			/* total bytes malloced, including header */
+    int used;			/* bytes in allocated blocks, headers too */
     memblock_t blocklist;	/* start/end cap for linked list */
     memblock_t *rover;
 } memzone_t;
@@ -47,6 +54,7 @@ typedef struct {
 static void Cache_FreeLow(int new_low_hunk);
 static void Cache_FreeHigh(int new_high_hunk);
 static void Cache_Dealloc(cache_user_t *c);
+static void Hunk_Trim(void);
 
 /*
  * ============================================================================
@@ -66,6 +74,8 @@ static void Cache_Dealloc(cache_user_t *c);
 static memzone_t *mainzone;
 
 static void Z_ClearZone(memzone_t *zone, int size);
+static void Z_SlabFree(const void *ptr);
+static int Z_SlabSize(const void *ptr);
 
 
 /*
@@ -88,6 +98,7 @@ Z_ClearZone(memzone_t *zone, int size)
     zone->blocklist.size = 0;
     zone->rover = block;
     zone->size = size;
+    zone->used = 0;
 
     block->prev = block->next = &zone->blocklist;
     block->tag = 0;		/* free block */
@@ -109,6 +120,11 @@ Z_Free(const void *ptr)
     if (!ptr)
 	Sys_Error("%s: NULL pointer", __func__);
 
+    if (((const int *)ptr)[-1] == SLABID) {
+	Z_SlabFree(ptr);
+	return;
+    }
+
     block = (memblock_t *)((const byte *)ptr - sizeof(memblock_t));
     if (block->id != ZONEID)
 	Sys_Error("%s: freed a pointer without ZONEID", __func__);
@@ -116,6 +132,7 @@ Z_Free(const void *ptr)
 	Sys_Error("%s: freed a freed pointer", __func__);
 
     block->tag = 0;		/* mark as free */
+    mainzone->used -= block->size;
 
     other = block->prev;
     if (!other->tag) {		/* merge with previous free block */
@@ -213,6 +230,7 @@ Z_TagMalloc(int size, int tag)
 
     base->tag = tag;		   /* no longer a free block */
     mainzone->rover = base->next;  /* next allocation starts looking here */
+    mainzone->used += base->size;
 
     base->id = ZONEID;
 
@@ -224,6 +242,189 @@ Z_TagMalloc(int size, int tag)
 }
 
 
+/*
+ * ============================================================================
+ *
+ * SLABS
+ *
+ * Small allocations come from slabs of one size class each, so they don't
+ * search, split or merge the block list at all.  Each slab is a zone block,
+ * given back once none of its objects are in use (except the last one of a
+ * class with space, so a class doesn't allocate and free a slab over and
+ * over).  The word before an object is SLABID where a block has ZONEID,
+ * which tells Z_Free which one it has.
+ * ============================================================================
+ */
+
+#define SLABTAG		2
+#define SLAB_SIZE	4096
+#define SLAB_MINSIZE	16
+#define SLAB_CLASSES	6	/* 16 to 512 bytes */
+
+typedef struct {
+    int offset;		/* from the start of its slab */
+    int tag;		/* a tag of 0 is a free object */
+    int pad;
+    int id;		/* should be SLABID */
+} zslabobj_t;
+
+typedef struct zslab_s {
+    struct zslab_s *next, *prev;	/* slabs of this class with space */
+    zslabobj_t *free;	/* chained through the first bytes of the data */
+    int sizeclass;
+    int used;
+} zslab_t;
+
+typedef struct {
+    zslab_t *partial;	/* slabs with free objects */
+    int slabs;
+    int used;		/* objects */
+} zslabclass_t;
+
+static zslabclass_t slabclasses[SLAB_CLASSES];
+
+#define SLAB_NEXTFREE(obj) (*(zslabobj_t **)((obj) + 1))
+
+static int
+Z_SlabClass(int size)
+{
+    int sizeclass;
+
+    for (sizeclass = 0; sizeclass < SLAB_CLASSES; sizeclass++)
+	if (size <= SLAB_MINSIZE << sizeclass)
+	    return sizeclass;
+
+    return -1;
+}
+
+static int
+Z_SlabObjects(int sizeclass)
+{
+    int objsize = sizeof(zslabobj_t) + (SLAB_MINSIZE << sizeclass);
+
+    return (SLAB_SIZE - sizeof(zslab_t)) / objsize;
+}
+
+static void
+Z_SlabUnlink(zslabclass_t *class, zslab_t *slab)
+{
+    if (slab->prev)
+	slab->prev->next = slab->next;
+    else
+	class->partial = slab->next;
+    if (slab->next)
+	slab->next->prev = slab->prev;
+}
+
+static void
+Z_SlabLink(zslabclass_t *class, zslab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = class->partial;
+    if (slab->next)
+	slab->next->prev = slab;
+    class->partial = slab;
+}
+
+static zslab_t *
+Z_NewSlab(int sizeclass)
+{
+    int i, count, objsize;
+    zslabobj_t *obj;
+    zslab_t *slab;
+
+    slab = Z_TagMalloc(SLAB_SIZE, SLABTAG);
+    if (!slab)
+	return NULL;
+
+    slab->sizeclass = sizeclass;
+    slab->used = 0;
+    slab->free = NULL;
+
+    /* chain the objects backwards, so they're used in address order */
+    objsize = sizeof(zslabobj_t) + (SLAB_MINSIZE << sizeclass);
+    count = Z_SlabObjects(sizeclass);
+    for (i = count - 1; i >= 0; i--) {
+	obj = (zslabobj_t *)((byte *)(slab + 1) + i * objsize);
+	obj->offset = (byte *)obj - (byte *)slab;
+	obj->tag = 0;
+	obj->id = SLABID;
+	SLAB_NEXTFREE(obj) = slab->free;
+	slab->free = obj;
+    }
+    slabclasses[sizeclass].slabs++;
+    Z_SlabLink(&slabclasses[sizeclass], slab);
+
+    return slab;
+}
+
+/* returns zeroed memory for the whole size class, or NULL */
+static void *
+Z_SlabMalloc(int sizeclass)
+{
+    zslabclass_t *class = &slabclasses[sizeclass];
+    zslabobj_t *obj;
+    zslab_t *slab;
+
+    slab = class->partial;
+    if (!slab)
+	slab = Z_NewSlab(sizeclass);
+    if (!slab)
+	return NULL;
+
+    obj = slab->free;
+    slab->free = SLAB_NEXTFREE(obj);
+    if (!slab->free)
+	Z_SlabUnlink(class, slab);
+    slab->used++;
+    class->used++;
+
+    obj->tag = 1;
+    memset(obj + 1, 0, SLAB_MINSIZE << sizeclass);
+
+    return obj + 1;
+}
+
+static zslab_t *
+Z_SlabOf(const void *ptr, const char *caller)
+{
+    const zslabobj_t *obj = (const zslabobj_t *)ptr - 1;
+
+    if (!obj->tag)
+	Sys_Error("%s: used a freed pointer", caller);
+
+    return (zslab_t *)((byte *)obj - obj->offset);
+}
+
+static void
+Z_SlabFree(const void *ptr)
+{
+    zslabobj_t *obj = (zslabobj_t *)ptr - 1;
+    zslab_t *slab = Z_SlabOf(ptr, "Z_Free");
+    zslabclass_t *class = &slabclasses[slab->sizeclass];
+
+    obj->tag = 0;
+    if (!slab->free)
+	Z_SlabLink(class, slab);
+    SLAB_NEXTFREE(obj) = slab->free;
+    slab->free = obj;
+    slab->used--;
+    class->used--;
+
+    if (!slab->used && (slab->prev || slab->next)) {
+	Z_SlabUnlink(class, slab);
+	class->slabs--;
+	Z_Free(slab);
+    }
+}
+
+static int
+Z_SlabSize(const void *ptr)
+{
+    return SLAB_MINSIZE << Z_SlabOf(ptr, "Z_Realloc")->sizeclass;
+}
+
+
 /*
  * ========================
  * Z_Malloc
@@ -232,9 +433,16 @@ Z_TagMalloc(int size, int tag)
 void *
 Z_Malloc(int size)
 {
+    int sizeclass;
     void *buf;
 
     Z_CheckHeap();		/* DEBUG */
+    sizeclass = Z_SlabClass(size);
+    if (sizeclass >= 0) {
+	buf = Z_SlabMalloc(sizeclass);
+	if (buf)
+	    return buf;
+    }
     buf = Z_TagMalloc(size, 1);
     if (!buf)
 	Sys_Error("%s: failed on allocation of %i bytes", __func__, size);
@@ -258,6 +466,17 @@ Z_Realloc(const void *ptr, int size)
     if (!ptr)
 	return Z_Malloc(size);
 
+    /* slab objects only move if they outgrow their size class */
+    if (((const int *)ptr)[-1] == SLABID) {
+	orig_size = Z_SlabSize(ptr);
+	if (size <= orig_size)
+	    return (void *)ptr;
+	ret = Z_Malloc(size);
+	memcpy(ret, ptr, orig_size);
+	Z_Free(ptr);
+	return ret;
+    }
+
     block = (memblock_t *)((byte *)ptr - sizeof(memblock_t));
     if (block->id != ZONEID)
 	Sys_Error("%s: realloced a pointer without ZONEID", __func__);
@@ -288,8 +507,10 @@ static void
 Z_Print(const memzone_t *zone, qboolean detailed)
 {
     const memblock_t *block;
+    const zslab_t *slab;
     unsigned free_blocks = 0, used_blocks = 0;
     size_t free_size = 0, used_size = 0;
+    int i;
 
     block = zone->blocklist.next;
     while (block) {
@@ -323,6 +544,22 @@ Z_Print(const memzone_t *zone, qboolean detailed)
 	       (unsigned long)used_size, used_blocks);
     Con_Printf("  %7lu bytes available in %d blocks\n",
 	       (unsigned long)free_size, free_blocks);
+
+    /* the slabs are counted as used blocks above */
+    for (i = 0; i < SLAB_CLASSES; i++) {
+	const zslabclass_t *class = &slabclasses[i];
+	int objects, partial = 0;
+
+	if (!class->slabs)
+	    continue;
+	for (slab = class->partial; slab; slab = slab->next)
+	    partial++;
+	objects = class->slabs * Z_SlabObjects(i);
+	Con_Printf("  %3d byte slabs: %5d of %5d used (%3d%% free)"
+		   " in %d slabs, %d with space\n", SLAB_MINSIZE << i,
+		   class->used, objects, (objects - class->used) * 100 / objects,
+		   class->slabs, partial);
+    }
 }
 
 static void
@@ -360,6 +597,47 @@ static struct {
     int tempmark;
 } hunkstate;
 
+/*
+ * If the hunk's address space was only reserved (see Memory_Reserve), it is
+ * committed a chunk at a time as the low hunk, the high hunk or the cache
+ * reach into it.  After a big free, the chunks nothing is using any more
+ * are decommitted again.
+ */
+#define HUNK_CHUNK_SHIFT	20
+#define HUNK_CHUNK_SIZE		(1 << HUNK_CHUNK_SHIFT)
+#define HUNK_MAX_CHUNKS		(1 << (31 - HUNK_CHUNK_SHIFT))
+#define HUNK_TRIM_SIZE		(8 << 20)
+
+static struct {
+    void *reserved;		/* base of the reservation, if any */
+    int chunks;			/* committed */
+    byte committed[HUNK_MAX_CHUNKS];
+} hunkcommit;
+
+/* make sure the bytes from start up to end are committed */
+static void
+Hunk_Commit(int start, int end)
+{
+    int chunk, last, length;
+
+    if (hunkstate.base != hunkcommit.reserved || start >= end)
+	return;
+
+    last = (end - 1) >> HUNK_CHUNK_SHIFT;
+    for (chunk = start >> HUNK_CHUNK_SHIFT; chunk <= last; chunk++) {
+	if (hunkcommit.committed[chunk])
+	    continue;
+	length = hunkstate.size - (chunk << HUNK_CHUNK_SHIFT);
+	length = qmin(length, HUNK_CHUNK_SIZE);
+	if (!Sys_CommitMemory(hunkstate.base + (chunk << HUNK_CHUNK_SHIFT),
+			      length))
+	    Sys_Error("%s: out of memory committing %d bytes of the hunk",
+		      __func__, length);
+	hunkcommit.committed[chunk] = 1;
+	hunkcommit.chunks++;
+    }
+}
+
 /*
  * ==============
  * Hunk_Check
@@ -418,6 +696,9 @@ Hunk_Print(qboolean all)
     starthigh = (hunk_t *)((byte *)endhigh - hunkstate.highbytes);
 
     Con_Printf("%*s :%10i total hunk size\n", pwidth, "", hunkstate.size);
+    if (hunkstate.base == hunkcommit.reserved)
+	Con_Printf("%*s :%10i committed\n", pwidth, "",
+		   qmin(hunkcommit.chunks << HUNK_CHUNK_SHIFT, hunkstate.size));
     Con_Printf("-------------------------\n");
 
     next = (hunk_t *)hunkstate.base;
@@ -538,6 +819,7 @@ Hunk_AllocName(int size, const char *name)
     hunkstate.lowbytes += size;
 
     Cache_FreeLow(hunkstate.lowbytes);
+    Hunk_Commit(hunkstate.lowbytes - size, hunkstate.lowbytes);
 
     memset(hunk, 0, size);
 
@@ -589,6 +871,7 @@ Hunk_AllocExtend(const void *base, int size)
 
     hunkstate.lowbytes += size;
     Cache_FreeLow(hunkstate.lowbytes);
+    Hunk_Commit(hunkstate.lowbytes - size, hunkstate.lowbytes);
 
     memptr = (byte *)hunk + hunk->size;
     memset(memptr, 0, size);
@@ -617,10 +900,15 @@ Hunk_LowMark(void)
 void
 Hunk_FreeToLowMark(int mark)
 {
+    int freed;
+
     if (mark < 0 || mark > hunkstate.lowbytes)
 	Sys_Error("%s: bad mark %i", __func__, mark);
-    memset(hunkstate.base + mark, 0, hunkstate.lowbytes - mark);
+    freed = hunkstate.lowbytes - mark;
+    memset(hunkstate.base + mark, 0, freed);
     hunkstate.lowbytes = mark;
+    if (freed >= HUNK_TRIM_SIZE)
+	Hunk_Trim();
 }
 
 int
@@ -639,6 +927,7 @@ void
 Hunk_FreeToHighMark(int mark)
 {
     byte *base;
+    int freed;
 
     if (hunkstate.tempmark) {
 	const int tempmark = hunkstate.tempmark;
@@ -648,9 +937,12 @@ Hunk_FreeToHighMark(int mark)
     if (mark < 0 || mark > hunkstate.highbytes)
 	Sys_Error("%s: bad mark %i", __func__, mark);
 
+    freed = hunkstate.highbytes - mark;
     base = hunkstate.base + hunkstate.size - hunkstate.highbytes;
-    memset(base, 0, hunkstate.highbytes - mark);
+    memset(base, 0, freed);
     hunkstate.highbytes = mark;
+    if (freed >= HUNK_TRIM_SIZE)
+	Hunk_Trim();
 }
 
 
@@ -685,6 +977,8 @@ Hunk_HighAllocName(int size, const char *name)
 
     hunkstate.highbytes += size;
     Cache_FreeHigh(hunkstate.highbytes);
+    Hunk_Commit(hunkstate.size - hunkstate.highbytes,
+		hunkstate.size - hunkstate.highbytes + size);
 
     hunk = (hunk_t *)(hunkstate.base + hunkstate.size - hunkstate.highbytes);
 
@@ -755,6 +1049,8 @@ Hunk_TempAllocExtend(int size)
 
     hunkstate.highbytes += size;
     Cache_FreeHigh(hunkstate.highbytes);
+    Hunk_Commit(hunkstate.size - hunkstate.highbytes,
+		hunkstate.size - hunkstate.highbytes + size);
 
     new = (hunk_t *)(hunkstate.base + hunkstate.size - hunkstate.highbytes);
     memmove(new, old, sizeof(hunk_t));
@@ -779,11 +1075,73 @@ typedef struct cache_system_s {
     char name[CACHE_NAMELEN];
     struct cache_system_s *prev, *next;
     struct cache_system_s *lru_prev, *lru_next;	/* for LRU flushing */
+    cachetype_t type;
+    double used;		/* realtime of the last Cache_Check */
 } cache_system_t;
 
+/*
+ * Anything used in the last cache_pintime seconds is pinned: when it's in
+ * the way of the hunk and there's no free space to move it to, colder data
+ * is thrown out to make the space, rather than it.
+ */
+static cvar_t cache_pintime = { "cache_pintime", "5" };
+
+const char *const cache_typenames[CACHE_TYPES] = { "sound", "model", "other" };
+cachestats_t cache_stats[CACHE_TYPES];
+
+static cachetype_t
+Cache_Type(const char *name)
+{
+    if (COM_CheckExtension(name, ".wav"))
+	return CACHE_SOUND;
+    if (COM_CheckExtension(name, ".mdl"))
+	return CACHE_MODEL;
+    return CACHE_OTHER;
+}
+
+static qboolean
+Cache_Pinned(const cache_system_t *cs)
+{
+    return realtime - cs->used < cache_pintime.value;
+}
+
+static void
+Cache_Evict(cache_system_t *cs)
+{
+    cache_user_t *user = cs->user;
+
+    cache_stats[cs->type].evictions++;
+    Cache_Free(user);
+    user->evicted = true;
+}
+
 static cache_system_t cache_head;
 static cache_system_t *Cache_TryAlloc(int size, qboolean nobottom);
 
+static void (*cache_lock)(void);
+static void (*cache_unlock)(void);
+
+void
+Cache_SetGuard(void (*lock)(void), void (*unlock)(void))
+{
+    cache_lock = lock;
+    cache_unlock = unlock;
+}
+
+static inline void
+Cache_Lock(void)
+{
+    if (cache_lock)
+	cache_lock();
+}
+
+static inline void
+Cache_Unlock(void)
+{
+    if (cache_unlock)
+	cache_unlock();
+}
+
 static inline cache_system_t *
 Cache_System(const cache_user_t *c)
 {
@@ -830,18 +1188,37 @@ Cache_Move(cache_system_t *old_cs)
 {
     cache_system_t *new_cs;
 
+    Cache_Lock();
+
     /* we are clearing up space at the bottom, so only allocate it late */
     new_cs = Cache_TryAlloc(old_cs->size, true);
+
+    /* make space for pinned data by throwing out the coldest */
+    while (!new_cs && Cache_Pinned(old_cs)) {
+	cache_system_t *cold = cache_head.lru_prev;
+	if (cold == old_cs)
+	    cold = cold->lru_prev;
+	if (cold == &cache_head || Cache_Pinned(cold))
+	    break;
+	Cache_Evict(cold);
+	new_cs = Cache_TryAlloc(old_cs->size, true);
+    }
+
     if (new_cs) {
 	memcpy(new_cs + 1, old_cs + 1, old_cs->size - sizeof(cache_system_t));
 	new_cs->user = old_cs->user;
 	memcpy(new_cs->name, old_cs->name, sizeof(new_cs->name));
+	new_cs->type = old_cs->type;
+	new_cs->used = old_cs->used;
 	Cache_Dealloc(old_cs->user);
 	new_cs->user->data = Cache_Data(new_cs);
+	cache_stats[new_cs->type].moves++;
     } else {
 	/* tough luck... */
-	Cache_Free(old_cs->user);
+	Cache_Evict(old_cs);
     }
+
+    Cache_Unlock();
 }
 
 /*
@@ -886,7 +1263,7 @@ Cache_FreeHigh(int new_high_hunk)
 	if ((byte *)c + c->size <= hunkstate.base + hunkstate.size - new_high_hunk)
 	    return;		/* there is space to grow the hunk */
 	if (c == prev)
-	    Cache_Free(c->user);	/* didn't move out of the way */
+	    Cache_Evict(c);	/* didn't move out of the way */
 	else {
 	    Cache_Move(c);	/* try to move it */
 	    prev = c;
@@ -937,6 +1314,8 @@ Cache_TryAlloc(int size, qboolean nobottom)
 	    Sys_Error("%s: %i is greater than free hunk", __func__, size);
 
 	new = (cache_system_t *)(hunkstate.base + hunkstate.lowbytes);
+	Hunk_Commit((byte *)new - hunkstate.base,
+		    (byte *)new - hunkstate.base + size);
 	memset(new, 0, sizeof(*new));
 	new->size = size;
 
@@ -954,6 +1333,8 @@ Cache_TryAlloc(int size, qboolean nobottom)
     do {
 	if (!nobottom || cs != cache_head.next) {
 	    if ((byte *)cs - (byte *)new >= size) {	/* found space */
+		Hunk_Commit((byte *)new - hunkstate.base,
+			    (byte *)new - hunkstate.base + size);
 		memset(new, 0, sizeof(*new));
 		new->size = size;
 
@@ -976,6 +1357,8 @@ Cache_TryAlloc(int size, qboolean nobottom)
 
     /* try to allocate one at the very end */
     if (hunkstate.base + hunkstate.size - hunkstate.highbytes - (byte *)new >= size) {
+	Hunk_Commit((byte *)new - hunkstate.base,
+		    (byte *)new - hunkstate.base + size);
 	memset(new, 0, sizeof(*new));
 	new->size = size;
 
@@ -992,6 +1375,56 @@ Cache_TryAlloc(int size, qboolean nobottom)
     return NULL;		/* couldn't allocate */
 }
 
+/*
+ * ============
+ * Hunk_Trim
+ *
+ * Decommit the chunks of a reserved hunk that nothing is using
+ * ============
+ */
+static void
+Hunk_MarkUsed(byte *used, int start, int end)
+{
+    int chunk;
+
+    if (start >= end)
+	return;
+    for (chunk = start >> HUNK_CHUNK_SHIFT;
+	 chunk <= (end - 1) >> HUNK_CHUNK_SHIFT; chunk++)
+	used[chunk] = 1;
+}
+
+static void
+Hunk_Trim(void)
+{
+    byte used[HUNK_MAX_CHUNKS];
+    const cache_system_t *cs;
+    int chunk, numchunks, offset, length;
+
+    if (hunkstate.base != hunkcommit.reserved)
+	return;
+
+    numchunks = (hunkstate.size + HUNK_CHUNK_SIZE - 1) >> HUNK_CHUNK_SHIFT;
+    memset(used, 0, numchunks);
+    Hunk_MarkUsed(used, 0, hunkstate.lowbytes);
+    Hunk_MarkUsed(used, hunkstate.size - hunkstate.highbytes, hunkstate.size);
+    for (cs = cache_head.next; cs != &cache_head; cs = cs->next) {
+	offset = (byte *)cs - hunkstate.base;
+	Hunk_MarkUsed(used, offset, offset + cs->size);
+    }
+
+    for (chunk = 0; chunk < numchunks; chunk++) {
+	if (!hunkcommit.committed[chunk] || used[chunk])
+	    continue;
+	length = hunkstate.size - (chunk << HUNK_CHUNK_SHIFT);
+	length = qmin(length, HUNK_CHUNK_SIZE);
+	Sys_DecommitMemory(hunkstate.base + (chunk << HUNK_CHUNK_SHIFT),
+			   length);
+	hunkcommit.committed[chunk] = 0;
+	hunkcommit.chunks--;
+    }
+}
+
 /*
  * ============
  * Cache_Flush
@@ -1026,12 +1459,27 @@ Cache_Print(void)
  * Cache_Report
  * ============
  */
+static void
+Cache_PrintStats(void (*print)(const char *fmt, ...))
+{
+    const cachestats_t *stats;
+    int i;
+
+    print("         allocs evicted  moved reloads\n");
+    for (i = 0; i < CACHE_TYPES; i++) {
+	stats = &cache_stats[i];
+	print("%-6s %8d %7d %6d %7d\n", cache_typenames[i], stats->allocs,
+	      stats->evictions, stats->moves, stats->reloads);
+    }
+}
+
 void
 Cache_Report(void)
 {
     Con_DPrintf("%4.1f megabyte data cache\n",
 		(hunkstate.size - hunkstate.highbytes -
 		 hunkstate.lowbytes) / (float)(1024 * 1024));
+    Cache_PrintStats(Con_DPrintf);
 }
 
 
@@ -1093,6 +1541,8 @@ Cache_Dealloc(cache_user_t *c)
 void
 Cache_Free(cache_user_t *c)
 {
+    Cache_Lock();
+
     /* Cleanup the user data */
     if (c->destructor) {
 	c->destructor(c);
@@ -1103,6 +1553,8 @@ Cache_Free(cache_user_t *c)
 
     c->pad = 0;
     c->data = NULL;
+
+    Cache_Unlock();
 }
 
 /*
@@ -1119,6 +1571,7 @@ Cache_Check(const cache_user_t *c)
 	return NULL;
 
     cs = Cache_System(c);
+    cs->used = realtime;
 
     /* move to head of LRU */
     Cache_UnlinkLRU(cs);
@@ -1163,6 +1616,7 @@ Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name)
 	if (cs) {
 	    strncpy(cs->name, name, sizeof(cs->name) - 1);
 	    cs->user = c;
+	    cs->type = Cache_Type(name);
 	    c->pad = pad;
 	    c->data = Cache_Data(cs);
 	    c->destructor = NULL;
@@ -1172,7 +1626,13 @@ Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name)
 	if (cache_head.lru_prev == &cache_head)
 	    Sys_Error("%s: out of memory", __func__);
 	/* not enough memory at all */
-	Cache_Free(cache_head.lru_prev->user);
+	Cache_Evict(cache_head.lru_prev);
+    }
+
+    cache_stats[cs->type].allocs++;
+    if (c->evicted) {
+	cache_stats[cs->type].reloads++;
+	c->evicted = false;
     }
 
     return Cache_Check(c);
@@ -1190,12 +1650,38 @@ Cache_f(void)
 	    Cache_Flush();
 	    return;
 	}
+	if (!strcmp(Cmd_Argv(1), "stats")) {
+	    Cache_PrintStats(Con_Printf);
+	    return;
+	}
     }
-    Con_Printf("Usage: cache print|flush\n");
+    Con_Printf("Usage: cache print|flush|stats\n");
 }
 
 /* ========================================================================= */
 
+/*
+ * ========================
+ * Memory_GetUsage
+ *
+ * The cache is walked, but it's only ever a few hundred entries
+ * ========================
+ */
+void
+Memory_GetUsage(memusage_t *usage)
+{
+    const cache_system_t *cs;
+
+    usage->hunk_size = hunkstate.size;
+    usage->hunk_low = hunkstate.lowbytes;
+    usage->hunk_high = hunkstate.highbytes;
+    usage->cache_used = 0;
+    for (cs = cache_head.next; cs && cs != &cache_head; cs = cs->next)
+	usage->cache_used += cs->size;
+    usage->zone_size = mainzone->size;
+    usage->zone_used = mainzone->used;
+}
+
 size_t
 Memory_GetSize(void)
 {
@@ -1215,6 +1701,36 @@ Memory_GetSize(void)
     return (size_t)128 << 20;
 }
 
+/*
+ * ========================
+ * Memory_Reserve
+ *
+ * Only reserve the address space for the hunk where we can, since it's
+ * committed as it's used.  Without a -mem or -heapsize it can then be much
+ * bigger than the old default, which is what gets malloced otherwise.
+ * ========================
+ */
+#define HUNK_RESERVE_SIZE	((sizeof(void *) > 4 ? 1024 : 256) << 20)
+
+void *
+Memory_Reserve(int *size)
+{
+    int reserve = *size;
+    void *base;
+
+    if (!COM_CheckParm("-mem") && !COM_CheckParm("-heapsize"))
+	reserve = qmax(reserve, HUNK_RESERVE_SIZE);
+
+    base = Sys_ReserveMemory(reserve);
+    if (base) {
+	hunkcommit.reserved = base;
+	*size = reserve;
+	return base;
+    }
+
+    return malloc(*size);
+}
+
 /*
  * ========================
  * Memory_Init
@@ -1249,4 +1765,5 @@ Memory_Init(void *buf, int size)
     Cmd_AddCommand("hunk", Hunk_f);
     Cmd_AddCommand("zone", Z_Zone_f);
     Cmd_AddCommand("cache", Cache_f);
+    Cvar_RegisterVariable(&cache_pintime);
 }
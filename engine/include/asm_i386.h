@@ -51,7 +51,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	hu_lastclipnode		12
 #define	hu_clip_mins		16
 #define	hu_clip_maxs		28
-#define hu_size  		40
+#define	hu_nodes		40
+#define hu_size  		44
 
 // mclipnode_t structure
 // !!! if this is changed, it must be changed in bspfile.h too !!!
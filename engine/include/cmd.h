@@ -65,6 +65,10 @@ void Cbuf_Execute(void);
 // Normally called once per frame, but may be explicitly invoked.
 // Do not call inside a command function!
 
+qboolean Cbuf_Pending(void);
+
+// true while a wait has left commands in the buffer for the next frame
+
 //===========================================================================
 
 /*
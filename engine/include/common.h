@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -131,7 +132,88 @@ void MSG_WriteDeltaUsercmd(sizebuf_t *sb, const struct usercmd_s *from,
 #ifdef NQ_HACK
 void MSG_WriteControlHeader(sizebuf_t *sb);
 #endif
+void MSG_WriteCoords3(sizebuf_t *sb, const float *v);
 
+/*
+ * Field groups: MSG_BeginGroup makes room for the most a group of fields can
+ * take with one capacity check, the MSG_Put* helpers store the fields straight
+ * into it and MSG_EndGroup keeps what was put.  A group that doesn't fit is
+ * put aside and written out by MSG_EndGroup the same way SZ_Write would, so
+ * overflow is still only found in sb->overflowed, once the caller is done.
+ */
+#define MSG_MAXGROUP 64		// most bytes in a group, read or written
+
+byte *MSG_SpillGroup(void);
+
+static inline byte *
+MSG_BeginGroup(sizebuf_t *sb, int maxlength)
+{
+    if (sb->cursize + maxlength <= sb->maxsize)
+	return sb->data + sb->cursize;
+    return MSG_SpillGroup();
+}
+
+static inline void
+MSG_EndGroup(sizebuf_t *sb, const byte *start, const byte *end)
+{
+    if (start == sb->data + sb->cursize)
+	sb->cursize += end - start;
+    else
+	SZ_Write(sb, start, end - start);
+}
+
+static inline byte *
+MSG_PutByte(byte *p, int c)
+{
+    p[0] = c;
+    return p + 1;
+}
+
+static inline byte *
+MSG_PutShort(byte *p, int c)
+{
+    p[0] = c & 0xff;
+    p[1] = c >> 8;
+    return p + 2;
+}
+
+static inline byte *
+MSG_PutLong(byte *p, int c)
+{
+    p[0] = c & 0xff;
+    p[1] = (c >> 8) & 0xff;
+    p[2] = (c >> 16) & 0xff;
+    p[3] = c >> 24;
+    return p + 4;
+}
+
+static inline byte *
+MSG_PutCoord(byte *p, float f)
+{
+    return MSG_PutShort(p, (int)(f * (1 << 3)));
+}
+
+static inline byte *
+MSG_PutAngle(byte *p, float f)
+{
+    return MSG_PutByte(p, (int)floorf((f * 256 / 360) + 0.5f) & 255);
+}
+
+static inline byte *
+MSG_PutAngle16(byte *p, float f)
+{
+    return MSG_PutShort(p, (int)floorf((f * 65536 / 360) + 0.5f) & 65535);
+}
+
+static inline byte *
+MSG_PutCoords3(byte *p, const float *v)
+{
+    p = MSG_PutCoord(p, v[0]);
+    p = MSG_PutCoord(p, v[1]);
+    return MSG_PutCoord(p, v[2]);
+}
+
+extern sizebuf_t net_message;
 extern int msg_readcount;
 extern qboolean msg_badread;	// set if a read goes beyond end of message
 
@@ -139,19 +221,131 @@ void MSG_BeginReading(void);
 #ifdef QW_HACK
 int MSG_GetReadCount(void);
 #endif
-int MSG_ReadChar(void);
-int MSG_ReadByte(void);
-int MSG_ReadShort(void);
-int MSG_ReadLong(void);
 float MSG_ReadFloat(void);
 char *MSG_ReadString(void);
 #ifdef QW_HACK
 char *MSG_ReadStringLine(void);
 #endif
 
-float MSG_ReadCoord(void);
-float MSG_ReadAngle(void);
-float MSG_ReadAngle16(void);
+/*
+ * Reading a group takes all of its bytes at once.  If the message is short,
+ * msg_badread is set and the group reads as zeros.
+ */
+const byte *MSG_ReadShortGroup(int length);
+
+static inline const byte *
+MSG_ReadGroup(int length)
+{
+    const byte *p;
+
+    if (msg_readcount + length > net_message.cursize)
+	return MSG_ReadShortGroup(length);
+    p = net_message.data + msg_readcount;
+    msg_readcount += length;
+
+    return p;
+}
+
+static inline int
+MSG_GetChar(const byte *p)
+{
+    return (signed char)p[0];
+}
+
+static inline int
+MSG_GetShort(const byte *p)
+{
+    return (short)(p[0] + (p[1] << 8));
+}
+
+static inline float
+MSG_GetCoord(const byte *p)
+{
+    return MSG_GetShort(p) * (1.0 / (1 << 3));
+}
+
+/* the single field reads return -1 if there are no more bytes */
+static inline int
+MSG_ReadChar(void)
+{
+    if (msg_readcount + 1 > net_message.cursize) {
+	msg_badread = true;
+	return -1;
+    }
+    return (signed char)net_message.data[msg_readcount++];
+}
+
+static inline int
+MSG_ReadByte(void)
+{
+    if (msg_readcount + 1 > net_message.cursize) {
+	msg_badread = true;
+	return -1;
+    }
+    return net_message.data[msg_readcount++];
+}
+
+static inline int
+MSG_ReadShort(void)
+{
+    const byte *p;
+
+    if (msg_readcount + 2 > net_message.cursize) {
+	msg_badread = true;
+	return -1;
+    }
+    p = net_message.data + msg_readcount;
+    msg_readcount += 2;
+
+    return MSG_GetShort(p);
+}
+
+static inline int
+MSG_ReadLong(void)
+{
+    const byte *p;
+
+    if (msg_readcount + 4 > net_message.cursize) {
+	msg_badread = true;
+	return -1;
+    }
+    p = net_message.data + msg_readcount;
+    msg_readcount += 4;
+
+    return p[0] + (p[1] << 8) + (p[2] << 16) + (p[3] << 24);
+}
+
+static inline float
+MSG_ReadCoord(void)
+{
+    /*
+     * Co-ords are send as shorts, with the low 3 bits being the fractional
+     * component
+     */
+    return MSG_ReadShort() * (1.0 / (1 << 3));
+}
+
+static inline float
+MSG_ReadAngle(void)
+{
+    return MSG_ReadChar() * (360.0 / 256);
+}
+
+static inline float
+MSG_ReadAngle16(void)
+{
+    return MSG_ReadShort() * (360.0 / 65536);
+}
+
+static inline void
+MSG_ReadCoords3(float *v)
+{
+    const byte *p = MSG_ReadGroup(6);
+
+    v[0] = MSG_GetCoord(p);
+    v[1] = MSG_GetCoord(p + 2);
+    v[2] = MSG_GetCoord(p + 4);
+}
 #ifdef QW_HACK
 void MSG_ReadDeltaUsercmd(const struct usercmd_s *from, struct usercmd_s *cmd);
 #endif
@@ -175,6 +369,7 @@ extern unsigned com_argc;
 extern const char **com_argv;
 
 unsigned COM_CheckParm(const char *parm);
+void COM_StartTrace(const char *phase);
 #ifdef QW_HACK
 void COM_AddParm(const char *parm);
 #endif
@@ -188,6 +383,7 @@ void COM_FileBase(const char *in, char *out, size_t buflen);
 int COM_DefaultExtension(const char *path, const char *extension,
 			 char *out, size_t buflen);
 int COM_CheckExtension(const char *path, const char *extn);
+unsigned COM_HashFileName(const char *name);
 
 char *va(const char *format, ...) __attribute__((format(printf,1,2)));
 
@@ -197,12 +393,14 @@ char *va(const char *format, ...) __attribute__((format(printf,1,2)));
 
 extern int com_filesize;
 struct cache_user_s;
+struct sys_mapping_s;
 
 extern char com_basedir[MAX_OSPATH];
 extern char com_gamedir[MAX_OSPATH];
 
 void COM_WriteFile(const char *filename, const void *data, int len);
 int COM_FOpenFile(const char *filename, FILE **file);
+FILE *COM_Uncompress(FILE *file, int length);
 void COM_ScanDir(struct stree_root *root, const char *path,
 		 const char *pfx, const char *ext, qboolean stripext);
 
@@ -211,8 +409,63 @@ void *COM_LoadStackFile(const char *path, void *buffer, int bufsize,
 void *COM_LoadTempFile(const char *path);
 void *COM_LoadHunkFile(const char *path);
 void COM_LoadCacheFile(const char *path, struct cache_user_s *cu);
-#ifdef QW_HACK
+void *COM_MapFile(const char *path, size_t *size,
+		  struct sys_mapping_s *mapping);
+qboolean COM_FindFile(const char *filename, char *path, size_t pathsize,
+		      size_t *offset, size_t *length);
+
+/*
+ * Checksums of whole files, kept for the session by where the file's data is
+ * (the pak or loose file, offset, length and modification time), so loading
+ * an unchanged file again after a map restart or reconnect doesn't compute
+ * them again.
+ */
+typedef enum {
+    CHECKSUM_CRC,	/* CRC_Block of the file */
+    CHECKSUM_MAP,	/* a brush model's checksum */
+    CHECKSUM_MAP2,	/* and checksum2 */
+} checksumkind_t;
+
+qboolean COM_GetFileChecksum(const char *filename, checksumkind_t kind,
+			     unsigned *checksum);
+void COM_SetFileChecksum(const char *filename, checksumkind_t kind,
+			 unsigned checksum);
+
+/*
+ * Read a file ahead on a background thread (preload.c), so the OS has it
+ * cached by the time it's loaded.  Only a hint: nothing is kept, and the
+ * request is dropped if the file can't be found or the queue is full.
+ */
+void COM_PreloadFile(const char *filename);
+void COM_PreloadShutdown(void);
+
+/* Write out a malloc'd buffer on a background thread (preload.c) */
+void COM_WriteFileInBackground(const char *path, void *data, int length);
+void COM_FinishWrites(void);
+
+/* Write a file out a piece at a time on a background thread (preload.c) */
+qboolean COM_OpenStream(const char *path, qboolean compress);
+void COM_StreamWrite(const void *data, int length);
+void COM_CloseStream(void);
+
+/* Worker threads for loops and background jobs (parallel.c) */
+void COM_ParallelInit(void);
+void COM_ParallelShutdown(void);
+int COM_NumCores(void);
+void COM_ParallelFor(int numthreads, void (*func)(void *data, int index),
+		     void *data, int count);
+void COM_AddJob(void (*func)(void *data), void (*finish)(void *data),
+		void *data, int *counter, const int *after);
+void COM_WaitJobs(const int *counter);
+void COM_RunFinishedJobs(void);
+void COM_ThreadPrintf(const char *fmt, ...) __attribute__((format(printf,1,2)));
+
+/* Temporary memory for any thread, freed back to a mark (parallel.c) */
+size_t COM_ScratchMark(void);
+void *COM_ScratchAlloc(size_t size);
+void COM_ScratchFree(size_t mark);
 void COM_CreatePath(const char *path);
+#ifdef QW_HACK
 void COM_Gamedir(const char *dir);
 #endif
 
@@ -0,0 +1,37 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef CONLOG_H
+#define CONLOG_H
+
+#include "qtypes.h"
+
+/*
+ * A log file written by a thread of its own.  Log_Print only queues the text,
+ * dropping it if the queue is full, so printing never waits on the disk.
+ * Log_Close writes out whatever is still queued.
+ */
+typedef struct conlog_s conlog_t;
+
+conlog_t *Log_Open(const char *path, qboolean append);
+void Log_Print(conlog_t *log, const char *msg);
+void Log_Close(conlog_t *log);
+
+#endif /* CONLOG_H */
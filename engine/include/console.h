@@ -46,11 +46,20 @@ extern qboolean con_initialized;
 void Con_DrawCharacter(int cx, int line, int num);
 void Con_CheckResize(void);
 void Con_Init(void);
+void Con_Shutdown(void);
 void Con_DrawConsole(int lines);
 void Con_Print(const char *txt);
 void Con_Printf(const char *fmt, ...) __attribute__((format(printf,1,2)));
 void Con_DPrintf(const char *fmt, ...) __attribute__((format(printf,1,2)));
 void Con_SafePrintf(const char *fmt, ...) __attribute__((format(printf,1,2)));
+
+/*
+ * Prints from a thread of the caller's that isn't the main one are held
+ * back until Con_FlushDeferred prints them on the main thread.  Only one
+ * thread at a time may defer.
+ */
+void Con_DeferPrints(qboolean defer);
+void Con_FlushDeferred(void);
 void Con_Clear_f(void);
 void Con_DrawNotify(void);
 void Con_ClearNotify(void);
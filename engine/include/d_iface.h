@@ -47,22 +47,33 @@ typedef struct {
 
 typedef enum {
     pt_static, pt_grav, pt_slowgrav, pt_fire, pt_explode, pt_explode2,
-    pt_blob, pt_blob2
+    pt_blob, pt_blob2, pt_numtypes
 } ptype_t;
 
+// one particle, as the effects set it up before R_AddParticle
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s {
+typedef struct {
 // driver-usable fields
     vec3_t org;
     float color;
 // drivers never touch the following fields
-    struct particle_s *next;
     vec3_t vel;
     float ramp;
     float die;
     ptype_t type;
 } particle_t;
 
+// the live particles of one type, each field in an array of its own
+typedef struct {
+    int count;
+    float *org[3];
+    float *vel[3];
+    float *color;
+    float *ramp;
+    float *die;
+    unsigned *viewbits;		// views it may show in (see R_BinScene)
+} particlegroup_t;
+
 #define PARTICLE_Z_CLIP	8.0
 
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
@@ -135,6 +146,7 @@ void D_EndDirectRect(int x, int y, int width, int height);
 void D_PolysetDraw(void);
 void D_PolysetDrawFinalVerts(finalvert_t *fv, int numverts);
 void D_DrawParticle(particle_t *pparticle);
+void D_DrawParticles(const particlegroup_t *group);
 void D_DrawSprite(void);
 void D_DrawSurfaces(void);
 void D_EnableBackBufferAccess(void);
@@ -183,6 +195,10 @@ typedef struct {
     int surfmip;		// mipmapped ratio surface texels/world pixels
     int surfwidth;		// in mipmapped texels
     int surfheight;		// in mipmapped texels
+    int numdlights;		// dynamic lights reaching the surface
+    const surfdlight_t *dlights;
+    int lightrect[4];		// lightmap samples to draw (left, top, right,
+				//  bottom), or the whole surface
 } drawsurf_t;
 
 extern drawsurf_t r_drawsurf;
@@ -206,6 +222,7 @@ extern float skyspeed, skyspeed2;
 extern float skytime;
 
 extern int c_surf;
+extern int c_surfhits, c_surfevicted;
 extern vrect_t scr_vrect;
 
 extern byte *r_warpbuffer;
@@ -43,7 +43,9 @@ typedef struct surfcache_s {
     struct surfcache_s *next;
     struct surfcache_s **owner;	// NULL is an empty chunk of memory
     int lightadj[MAXLIGHTMAPS];	// checked for strobe flush
-    int dlight;
+    unsigned dlightkey;		// R_SurfaceDlights() key when built
+    int dlightrect[4];		// lightmap samples the dlights reached
+    int dlightframe;		// r_dlightframecount when built
     int size;			// including header
     unsigned width;
     unsigned height;		// DEBUG only needed for debug
@@ -61,18 +63,22 @@ extern float scale_for_mip;
 
 extern qboolean d_roverwrapped;
 extern surfcache_t *sc_rover;
+extern int sc_size;
+extern unsigned sc_allocated;
 extern surfcache_t *d_initial_rover;
 
-extern float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern D_THREADVAR float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern D_THREADVAR float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern D_THREADVAR float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-fixed16_t sadjust, tadjust;
-fixed16_t bbextents, bbextentt;
+extern D_THREADVAR fixed16_t sadjust, tadjust;
+extern D_THREADVAR fixed16_t bbextents, bbextentt;
 
 
 void D_DrawSpans8(espan_t *pspans);
 void D_DrawSpans16(espan_t *pspans);
+void D_DrawSpansSIMD8(espan_t *pspans);
+void D_DrawSpansSIMD16(espan_t *pspans);
 extern void (*D_DrawSpans)(espan_t *pspan);
 
 void D_DrawZSpans(espan_t *pspans);
@@ -80,8 +86,91 @@ void Turbulent8(espan_t *pspan);
 void D_SpriteDrawSpans(sspan_t * pspan);
 
 void D_DrawSkyScans8(espan_t *pspan);
+void D_DrawSkyMask(espan_t *pspan, byte *mask);
 void D_DrawSkyScans16(espan_t *pspan);
 
+/*
+ * Vector pixel loops for the C drawers (d_simd.c).  The drawers set up each
+ * span as usual and pass the pixels to these; d_simdkernels is NULL when
+ * the plain C loops are used (d_simd 0, or no kernels for this cpu).
+ */
+#if !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__x86_64__)
+#define D_SIMD_X86
+#elif !defined(USE_X86_ASM) && defined(__GNUC__) && defined(__ARM_NEON)
+#define D_SIMD_NEON
+#endif
+
+typedef struct {
+    fixed16_t s, t, sstep, tstep;
+    int count;
+} dsubspan_t;
+
+typedef struct {
+    byte *pdest;
+    short *pz;
+    const byte *ptex;
+    const byte *colormap;
+    int count;
+    int sfrac, tfrac, light, zi;
+    int zistep, lightstep, ststepwhole, sstepfrac, tstepfrac;
+    int skinwidth;
+} dpolypixels_t;
+
+typedef struct {
+    byte *pdest;
+    int destrowbytes;
+    const byte *psource;
+    int sourcerowbytes;
+    const byte *colormap;
+    int lightleft, lightright;
+    int lightleftstep, lightrightstep;
+    int size, shift;		// 16 and 4 or 8 and 3
+} dsurfblock_t;
+
+/*
+ * Everything the alias vertex kernels need from r_alias.c.  The projection
+ * and clip fields are only used for models that may need clipping, which
+ * also get their view space points back in the aux array.
+ */
+typedef struct {
+    float transform[3][4];
+    float xcenter, ycenter;
+    float xscale, yscale, ziscale;
+    float zclip;		// nearer points get ALIAS_Z_CLIP
+    int vrect[4];		// left, top, right, bottom
+    float lightvec[3];
+    float shadelight;
+    int ambientlight;
+    const float (*normals)[3];
+} daliasxform_t;
+
+#define D_POSEBLEND_SHIFT 22	// fraction bits of the pose blend weights
+
+typedef struct {
+    const char *name;
+    void (*spanpixels)(byte *pdest, const byte *pbase, int cachewidth,
+		       const dsubspan_t *sub, int numsub);
+    void (*zspan)(short *pdest, int izi, int izistep, int count);
+    void (*polysetpixels)(const dpolypixels_t *pixels);
+    void (*surfaceblock)(const dsurfblock_t *block);
+    void (*aliasverts)(const daliasxform_t *xform, const trivertx_t *verts,
+		       const stvert_t *stverts, finalvert_t *fv,
+		       float (*aux)[3], int numverts);
+    void (*blendposes)(trivertx_t *out, const trivertx_t *pose0,
+		       const trivertx_t *pose1, const trivertx_t *normals,
+		       int blend0, int blend1, int numverts);
+    void (*palette32)(unsigned *dest, const byte *src,
+		      const unsigned *palette, int count);
+} dsimdkernels_t;
+
+extern const dsimdkernels_t *d_simdkernels;
+const dsimdkernels_t *D_SIMDKernels(void);
+
+void D_InitBands(void);
+void D_SetupBands(void);
+int D_BandThreads(void);
+void D_DrawBands(void (*draw)(int band), int numbands);
+
 void R_ShowSubDiv(void);
 void (*prealspandrawer) (void);
 surfcache_t *D_CacheSurface(const entity_t *e, msurface_t *surface,
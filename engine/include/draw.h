@@ -37,6 +37,7 @@ void Draw_TransPic(int x, int y, const qpic8_t *pic);
 void Draw_TransPicTranslate(int x, int y, const qpic8_t *pic,
 			    byte *translation);
 void Draw_ConsoleBackground(int lines);
+void Draw_ConsoleLine(int y, const char *text, int length);
 void Draw_BeginDisc(void);
 void Draw_EndDisc(void);
 void Draw_TileClear(int x, int y, int w, int h);
@@ -1,11 +1,21 @@
 #ifndef FISHEYE_H_
 #define FISHEYE_H_
 
+#include "client.h"
+
 extern qboolean fisheye_enabled;
+extern qboolean fisheye_capturing;
 
 void F_Init(void);
 void F_Shutdown(void);
 void F_RenderView(void);
 void F_WriteConfig(FILE *f);
+void F_AddLateMove(usercmd_t *cmd);
+void F_DrawSpeeds(void);
+qboolean F_LensReady(void);
+void F_StopCapture(void);
+void F_Bench(void (*report)(const char *name, int ops, double seconds));
+int F_BakeLensmap(const char *lensname, const char *globename, int width, int height,
+      void (*saved)(const char *filename));
 
 #endif
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef GLQUAKE_H
 #define GLQUAKE_H
 
+#include <stddef.h>
+
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -57,11 +59,43 @@ extern unsigned char d_15to8table[65536];
 #ifndef GL_VERSION_1_3
 #define GL_MAX_TEXTURE_UNITS GL_MAX_TEXTURE_UNITS_ARB
 #endif
+#ifndef GL_ARB_vertex_buffer_object
+#define GL_ARRAY_BUFFER_ARB 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER_ARB 0x8893
+#define GL_STATIC_DRAW_ARB 0x88E4
+#define GL_STREAM_DRAW_ARB 0x88E0
+#define GL_WRITE_ONLY_ARB 0x88B9
+#endif
+#ifndef GL_ARB_pixel_buffer_object
+#define GL_PIXEL_UNPACK_BUFFER_ARB 0x88EC
+#endif
+#ifndef GL_ARB_occlusion_query
+#define GL_SAMPLES_PASSED_ARB 0x8914
+#define GL_QUERY_RESULT_ARB 0x8866
+#define GL_QUERY_RESULT_AVAILABLE_ARB 0x8867
+#endif
+#ifndef GL_ARB_texture_compression
+#define GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB 0x86A0
+#define GL_TEXTURE_COMPRESSED_ARB 0x86A1
+#endif
+#ifndef GL_EXT_texture_compression_s3tc
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_ARB_texture_compression_bptc
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_ARB 0x8E8C
+#endif
+#ifndef GL_VERSION_2_0
+#define GL_FRAGMENT_SHADER 0x8B30
+#define GL_VERTEX_SHADER 0x8B31
+#define GL_COMPILE_STATUS 0x8B81
+#define GL_LINK_STATUS 0x8B82
+#endif
 
 extern float gldepthmin, gldepthmax;
 
-void GL_Upload8(const qpic8_t *pic, qboolean mipmap);
-void GL_Upload8_Alpha(const qpic8_t *pic, qboolean mipmap, byte alpha);
+int GL_Upload8(const qpic8_t *pic, qboolean mipmap);
+int GL_Upload8_Alpha(const qpic8_t *pic, qboolean mipmap, byte alpha);
 int GL_LoadTexture(const char *name, const qpic8_t *pic, qboolean mipmap);
 int GL_LoadTexture_Alpha(const char *name, const qpic8_t *pic, qboolean mipmap,
 			 byte alpha);
@@ -116,22 +150,31 @@ typedef struct {
 
 typedef enum {
     pt_static, pt_grav, pt_slowgrav, pt_fire, pt_explode, pt_explode2,
-    pt_blob, pt_blob2
+    pt_blob, pt_blob2, pt_numtypes
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s {
-// driver-usable fields
+// one particle, as the effects set it up before R_AddParticle
+typedef struct {
     vec3_t org;
     float color;
-// drivers never touch the following fields
-    struct particle_s *next;
     vec3_t vel;
     float ramp;
     float die;
     ptype_t type;
 } particle_t;
 
+// the live particles of one type, each field in an array of its own
+typedef struct {
+    int count;
+    float *org[3];
+    float *vel[3];
+    float *color;
+    float *ramp;
+    float *die;
+} particlegroup_t;
+
+extern particlegroup_t r_particlegroups[pt_numtypes];
+
 
 //====================================================
 
@@ -143,6 +186,7 @@ extern int r_visframecount;	// ??? what difs?
 extern int r_framecount;
 extern int c_brush_polys;
 extern int c_lightmaps_uploaded;
+extern int c_lightmap_bytes;
 
 //
 // view origin
@@ -157,6 +201,8 @@ extern vec3_t r_origin;
 //
 extern refdef_t r_refdef;
 extern mleaf_t *r_viewleaf, *r_oldviewleaf;
+extern qboolean r_sharedscene;	// between R_BeginScene and R_EndScene
+extern int r_sceneviews;
 extern texture_t *r_notexture_mip;
 extern int d_lightstylevalue[256];	// 8.8 fraction of base light value
 
@@ -192,6 +238,11 @@ extern cvar_t gl_reporttjunctions;
 extern cvar_t gl_flashblend;
 extern cvar_t gl_nocolors;
 extern cvar_t gl_zfix;
+extern cvar_t gl_batchsurfs;
+extern cvar_t gl_glslmodels;
+extern cvar_t gl_glslwarp;
+extern cvar_t gl_occlusion;
+extern cvar_t gl_mirrorclip;
 extern cvar_t gl_finish;
 extern cvar_t gl_subdivide_size;
 
@@ -238,10 +289,111 @@ typedef void (APIENTRY *lpActiveTextureFUNC) (GLenum);
 extern lpMultiTexFUNC qglMultiTexCoord2fARB;
 extern lpActiveTextureFUNC qglActiveTextureARB;
 
+// Vertex array and ARB vertex buffer object function pointers
+typedef void (APIENTRY *lpClientActiveTextureFUNC) (GLenum);
+typedef void (APIENTRY *lpGenBuffersFUNC) (GLsizei, GLuint *);
+typedef void (APIENTRY *lpBindBufferFUNC) (GLenum, GLuint);
+typedef void (APIENTRY *lpBufferDataFUNC) (GLenum, ptrdiff_t, const GLvoid *,
+					   GLenum);
+typedef GLvoid *(APIENTRY *lpMapBufferFUNC) (GLenum, GLenum);
+typedef GLboolean (APIENTRY *lpUnmapBufferFUNC) (GLenum);
+typedef void (APIENTRY *lpBufferSubDataFUNC) (GLenum, ptrdiff_t, ptrdiff_t,
+					      const GLvoid *);
+typedef void (APIENTRY *lpDeleteBuffersFUNC) (GLsizei, const GLuint *);
+
+extern lpClientActiveTextureFUNC qglClientActiveTextureARB;
+extern lpGenBuffersFUNC qglGenBuffersARB;
+extern lpBindBufferFUNC qglBindBufferARB;
+extern lpBufferDataFUNC qglBufferDataARB;
+extern lpMapBufferFUNC qglMapBufferARB;
+extern lpUnmapBufferFUNC qglUnmapBufferARB;
+extern lpBufferSubDataFUNC qglBufferSubDataARB;
+extern lpDeleteBuffersFUNC qglDeleteBuffersARB;
+
+// ARB occlusion query function pointers
+typedef void (APIENTRY *lpGenQueriesFUNC) (GLsizei, GLuint *);
+typedef void (APIENTRY *lpBeginQueryFUNC) (GLenum, GLuint);
+typedef void (APIENTRY *lpEndQueryFUNC) (GLenum);
+typedef void (APIENTRY *lpGetQueryObjectuivFUNC) (GLuint, GLenum, GLuint *);
+
+extern lpGenQueriesFUNC qglGenQueriesARB;
+extern lpBeginQueryFUNC qglBeginQueryARB;
+extern lpEndQueryFUNC qglEndQueryARB;
+extern lpGetQueryObjectuivFUNC qglGetQueryObjectuivARB;
+
+typedef void (APIENTRY *lpGenerateMipmapFUNC) (GLenum);
+typedef void (APIENTRY *lpCompressedTexImage2DFUNC) (GLenum, GLint, GLenum,
+						     GLsizei, GLsizei, GLint,
+						     GLsizei, const GLvoid *);
+typedef void (APIENTRY *lpGetCompressedTexImageFUNC) (GLenum, GLint, GLvoid *);
+
+extern lpGenerateMipmapFUNC qglGenerateMipmap;
+extern lpCompressedTexImage2DFUNC qglCompressedTexImage2DARB;
+extern lpGetCompressedTexImageFUNC qglGetCompressedTexImageARB;
+
+// OpenGL 2.0 shader function pointers
+typedef GLuint (APIENTRY *lpCreateShaderFUNC) (GLenum);
+typedef void (APIENTRY *lpShaderSourceFUNC) (GLuint, GLsizei, const char **,
+					     const GLint *);
+typedef void (APIENTRY *lpCompileShaderFUNC) (GLuint);
+typedef void (APIENTRY *lpGetShaderivFUNC) (GLuint, GLenum, GLint *);
+typedef void (APIENTRY *lpDeleteShaderFUNC) (GLuint);
+typedef GLuint (APIENTRY *lpCreateProgramFUNC) (void);
+typedef void (APIENTRY *lpAttachShaderFUNC) (GLuint, GLuint);
+typedef void (APIENTRY *lpBindAttribLocationFUNC) (GLuint, GLuint,
+						   const char *);
+typedef void (APIENTRY *lpLinkProgramFUNC) (GLuint);
+typedef void (APIENTRY *lpGetProgramivFUNC) (GLuint, GLenum, GLint *);
+typedef void (APIENTRY *lpUseProgramFUNC) (GLuint);
+typedef GLint (APIENTRY *lpGetUniformLocationFUNC) (GLuint, const char *);
+typedef void (APIENTRY *lpUniform1fFUNC) (GLint, GLfloat);
+typedef void (APIENTRY *lpUniform1fvFUNC) (GLint, GLsizei, const GLfloat *);
+typedef void (APIENTRY *lpUniform1iFUNC) (GLint, GLint);
+typedef void (APIENTRY *lpUniform3fFUNC) (GLint, GLfloat, GLfloat, GLfloat);
+typedef void (APIENTRY *lpVertexAttribPointerFUNC) (GLuint, GLint, GLenum,
+						    GLboolean, GLsizei,
+						    const GLvoid *);
+typedef void (APIENTRY *lpEnableVertexAttribArrayFUNC) (GLuint);
+typedef void (APIENTRY *lpDisableVertexAttribArrayFUNC) (GLuint);
+
+extern lpCreateShaderFUNC qglCreateShader;
+extern lpShaderSourceFUNC qglShaderSource;
+extern lpCompileShaderFUNC qglCompileShader;
+extern lpGetShaderivFUNC qglGetShaderiv;
+extern lpDeleteShaderFUNC qglDeleteShader;
+extern lpCreateProgramFUNC qglCreateProgram;
+extern lpAttachShaderFUNC qglAttachShader;
+extern lpBindAttribLocationFUNC qglBindAttribLocation;
+extern lpLinkProgramFUNC qglLinkProgram;
+extern lpGetProgramivFUNC qglGetProgramiv;
+extern lpUseProgramFUNC qglUseProgram;
+extern lpGetUniformLocationFUNC qglGetUniformLocation;
+extern lpUniform1fFUNC qglUniform1f;
+extern lpUniform1fvFUNC qglUniform1fv;
+extern lpUniform1iFUNC qglUniform1i;
+extern lpUniform3fFUNC qglUniform3f;
+extern lpVertexAttribPointerFUNC qglVertexAttribPointer;
+extern lpEnableVertexAttribArrayFUNC qglEnableVertexAttribArray;
+extern lpDisableVertexAttribArrayFUNC qglDisableVertexAttribArray;
+
 extern qboolean gl_mtexable;
 extern qboolean gl_npotable;
+extern qboolean gl_cubemapable;
+extern qboolean gl_vboable;
+extern qboolean gl_pboable;
+extern qboolean gl_glslable;
+extern qboolean gl_fragshaderable;
+extern qboolean gl_occlusionable;
+extern qboolean gl_genmipmapable;
+extern GLenum gl_compressed_format;	// 0 if there's no compression
+extern GLenum gl_compressed_alpha_format;
 
 void GL_ExtensionCheck_NPoT(void);
+void GL_ExtensionCheck_CubeMap(void);
+void GL_ExtensionCheck_VertexBuffers(void *(*getprocaddress)(const char *));
+void GL_ExtensionCheck_Shaders(void *(*getprocaddress)(const char *));
+void GL_ExtensionCheck_OcclusionQuery(void *(*getprocaddress)(const char *));
+void GL_ExtensionCheck_Textures(void *(*getprocaddress)(const char *));
 void GL_DisableMultitexture(void);
 void GL_EnableMultitexture(void);
 
@@ -258,11 +410,13 @@ void R_DrawSkyChain(msurface_t *s);
 // gl_draw.c
 //
 void GL_Set2D(void);
+void Draw_FlushBatch(void);
 
 //
 // gl_rmain.c
 //
 qboolean R_CullBox(const vec3_t mins, const vec3_t maxs);
+qboolean R_OccludedBox(const vec3_t mins, const vec3_t maxs);
 void R_RotateForEntity(const vec3_t origin, const vec3_t angles);
 
 /*
@@ -274,9 +428,12 @@ const model_loader_t *R_ModelLoader(void);
 // gl_rlight.c
 //
 void R_MarkLights(dlight_t *light, int bit, mnode_t *node);
+int R_SurfaceDlights(const msurface_t *surf, surfdlight_t *lights,
+		     unsigned *key);
 void R_AnimateLight(void);
 void R_RenderDlights(void);
 int R_LightPoint(const vec3_t point);
+void R_ClearLightPoints(void);
 
 //
 // gl_refrag.c
@@ -287,13 +444,16 @@ void R_StoreEfrags(efrag_t **ppefrag);
 // gl_mesh.c
 //
 void GL_LoadMeshData(const model_t *m, aliashdr_t *hdr,
-		     const alias_meshdata_t *meshdata,
+		     alias_meshdata_t *meshdata,
 		     const alias_posedata_t *posedata);
+void GL_MeshFreeBuffers(cache_user_t *cache);
 
 //
 // gl_rmisc.c
 //
 void R_InitBubble(void);
+GLuint GL_LoadProgram(const char *name, const char *vertexsource,
+		      const char *fragmentsource, const char *const *attributes);
 
 //
 // gl_rsurf.c
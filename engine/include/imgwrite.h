@@ -0,0 +1,62 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef IMGWRITE_H
+#define IMGWRITE_H
+
+#include <stdio.h>
+
+#include "qtypes.h"
+
+// imgwrite.h -- image encoders, and a background thread to write them
+
+typedef enum { IMG_PCX, IMG_TGA, IMG_PNG } imgformat_t;
+
+/*
+ * Encoders for images of one byte per pixel (palette indexes, with a 768
+ * byte palette) or three (rgb), in rows from the top down.  They only write
+ * to the open file, so they may run on any thread.  PCX is for paletted
+ * images only; PNG is stored without compression (there is no zlib).
+ */
+qboolean IMG_WritePCX(FILE *f, const byte *pixels, int width, int height,
+		      const byte *palette);
+qboolean IMG_WriteTGA(FILE *f, const byte *pixels, int width, int height,
+		      int bytes, const byte *palette);
+qboolean IMG_WritePNG(FILE *f, const byte *pixels, int width, int height,
+		      int bytes, const byte *palette);
+qboolean IMG_WritePPM(FILE *f, const byte *pixels, int width, int height,
+		      int bytes, const byte *palette);
+
+const char *IMG_Extension(imgformat_t format);
+
+/*
+ * Copy the image and write it to the gamedir in the background, printing
+ * "Wrote <filename>" once done (see IMG_Poll).  The file is created before
+ * returning, so a name that is not taken stays taken.  Rows are rowbytes
+ * apart, and bottomup is for images read back from GL.
+ */
+qboolean IMG_SaveAsync(const char *filename, imgformat_t format,
+		       const byte *pixels, int width, int height, int rowbytes,
+		       int bytes, const byte *palette, qboolean bottomup);
+
+void IMG_Poll(void);		// report finished writes, once a frame
+void IMG_Shutdown(void);	// finish the pending writes
+
+#endif /* IMGWRITE_H */
@@ -41,6 +41,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "bspfile.h"
 #include "modelgen.h"
 #include "spritegn.h"
+#include "sys.h"
 #include "zone.h"
 
 #ifdef NQ_HACK
@@ -131,6 +132,7 @@ typedef struct glpoly_s {
     struct glpoly_s *chain;
     int numverts;
     int flags;			// for SURF_UNDERWATER
+    int firstvert;		// in the batch vertex array (gl_rsurf.c)
     float verts[0][VERTEXSIZE];	// variable sized (xyz s1t1 s2t2)
 } glpoly_t;
 #endif
@@ -152,7 +154,7 @@ typedef struct msurface_s {
     int light_t;
     int lightmaptexturenum;
     int cached_light[MAXLIGHTMAPS];	// values currently used in lightmap
-    qboolean cached_dlight;	// true if dynamic light in cache
+    unsigned cached_dlight;	// key of the dynamic lights in cache, 0 if none
     glpoly_t *polys;	// multiple if warped
     struct msurface_s *texturechain;
 #else
@@ -173,6 +175,18 @@ typedef struct msurface_s {
     byte *samples;		// [numstyles*surfsize]
 } msurface_t;
 
+/*
+ * A dynamic light that reaches a surface's lightmap this frame, as worked
+ * out by R_SurfaceDlights().  Only the samples between smin/tmin and
+ * smax/tmax (inclusive) can pick up any of its light.
+ */
+typedef struct {
+    float rad;			// radius left at the surface
+    float minlight;		// reach across the surface
+    float local[2];		// impact point in lightmap texels
+    int smin, tmin, smax, tmax;
+} surfdlight_t;
+
 /*
  * foreach_surf_lightstyle()
  *   Iterator for lightmaps on a surface
@@ -187,6 +201,7 @@ typedef struct mnode_s {
     int contents;		// 0, to differentiate from leafs
     int visframe;		// node needs to be traversed if current
     int clipflags;		// frustum plane clip flags
+    unsigned viewbits;		// views of a shared scene it shows in
 
     vec3_t mins;		// for bounding box culling
     vec3_t maxs;
@@ -210,6 +225,7 @@ typedef struct mleaf_s {
     int contents;		// wil be a negative contents number
     int visframe;		// node needs to be traversed if current
     int clipflags;		// frustum plane clip flags
+    unsigned viewbits;		// views of a shared scene it shows in
 
     vec3_t mins;		// for bounding box culling
     vec3_t maxs;
@@ -226,6 +242,17 @@ typedef struct mleaf_s {
     byte ambient_sound_level[NUM_AMBIENTS];
 } mleaf_t;
 
+/*
+ * A clipnode with its plane copied in, so the traces walk a single array.
+ * The type is 0-2 for the axial planes, 3 for the rest.
+ */
+typedef struct {
+    vec3_t normal;
+    float dist;
+    int type;
+    int children[2];
+} mhullnode_t;
+
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct {
     const mclipnode_t *clipnodes;
@@ -234,6 +261,7 @@ typedef struct {
     int lastclipnode;
     vec3_t clip_mins;
     vec3_t clip_maxs;
+    const mhullnode_t *nodes;	// the clipnodes and planes packed together
 } hull_t;
 
 /*
@@ -334,14 +362,28 @@ typedef struct {
     int numposes;
     int poseintervals;
     int posedata;	// (numposes * numverts) trivertx_t
+    int numlods;	/* simplified meshes, for drawing at a distance */
     maliasframedesc_t frames[];	// variable sized
 } aliashdr_t;
 
+#define MAXALIASLODS	3	/* simplified meshes, each half the last */
+
 #ifdef GLQUAKE
 
 typedef struct {
+    int numtris;
+    int numverts;	/* per pose, in command list order */
     int commands;	// gl command list with embedded s/t
+    int posedata;	/* (numposes * numverts) trivertx_t */
+    int firstindex;	/* triangle list drawn from the buffers */
+    int numindices;
+} gl_aliasmesh_t;
+
+typedef struct {
     int textures;	/* Offset to GLuint texture names */
+    GLuint buffers[2];	/* vertex and index buffer objects, or zero */
+    int numbufferverts;	/* verts per pose in the vertex buffer */
+    gl_aliasmesh_t meshes[MAXALIASLODS + 1];	/* full mesh, then lods */
     aliashdr_t ahdr;
 } gl_aliashdr_t;
 
@@ -356,6 +398,8 @@ GL_Aliashdr(aliashdr_t *h)
 typedef struct {
     int stverts;
     int triangles;
+    int lodtriangles[MAXALIASLODS];	/* simplified meshes */
+    int lodnumtris[MAXALIASLODS];
     aliashdr_t ahdr;
 } sw_aliashdr_t;
 
@@ -391,6 +435,7 @@ typedef enum { mod_brush, mod_sprite, mod_alias } modtype_t;
 typedef struct model_s {
     char name[MAX_QPATH];
     struct model_s *next;
+    struct model_s *hashnext;	// next in the Mod_FindName hash chain
 
     modtype_t type;
     int numframes;
@@ -467,6 +512,8 @@ typedef struct brushmodel_s {
     byte *visdata;
     byte *lightdata;
     char *entities;
+
+    sys_mapping_t mapping;	// the file, if mapped; owned by the world only
 } brushmodel_t;
 
 static inline const brushmodel_t *
@@ -487,6 +534,9 @@ BrushModel(model_t *model)
 typedef struct {
     mtriangle_t *triangles;
     stvert_t *stverts;
+    int numlods;	/* filled in by Mod_AliasSimplify */
+    int lodnumtris[MAXALIASLODS];
+    mtriangle_t *lodtriangles[MAXALIASLODS];
 } alias_meshdata_t;
 
 typedef struct {
@@ -503,7 +553,7 @@ typedef struct model_loader {
     int (*Aliashdr_Padding)(void);
     void (*LoadSkinData)(model_t *, aliashdr_t *, const alias_skindata_t *);
     void (*LoadMeshData)(const model_t *, aliashdr_t *hdr,
-			 const alias_meshdata_t *, const alias_posedata_t *);
+			 alias_meshdata_t *, const alias_posedata_t *);
     void (*CacheDestructor)(cache_user_t *);
 } model_loader_t;
 
@@ -514,7 +564,7 @@ void *Mod_AllocName(int size, const char *name); /* Internal helper */
 #ifndef SERVERONLY
 void Mod_InitAliasCache(void);
 void Mod_ClearAlias(void);
-model_t *Mod_NewAliasModel(void);
+model_t *Mod_NewAliasModel(const char *name);
 model_t *Mod_FindAliasName(const char *name);
 const model_t *Mod_AliasCache(void);
 const model_t *Mod_AliasOverflow(void);
@@ -604,6 +654,17 @@ void Mod_LoadAliasModel(const model_loader_t *loader, model_t *model,
 			void *buffer);
 void Mod_LoadSpriteModel(model_t *model, const void *buffer);
 
+/*
+ * The simplified meshes are made on request by the driver's LoadMeshData,
+ * into space set aside with the mesh data.  Mod_AliasLOD picks the level to
+ * draw for a model covering about the given number of pixels on screen.
+ * Mod_AliasFrameRadius bounds a frame about the origin, for culling.
+ */
+void Mod_AliasSimplify(const aliashdr_t *hdr, alias_meshdata_t *meshdata,
+		       const alias_posedata_t *posedata);
+int Mod_AliasLOD(const aliashdr_t *hdr, float pixels, float bias);
+float Mod_AliasFrameRadius(const aliashdr_t *hdr, int frame);
+
 const mspriteframe_t *Mod_GetSpriteFrame(const struct entity_s *entity,
 					 const msprite_t *sprite, float time);
 
@@ -615,6 +676,7 @@ int Mod_FindInterval(const float *intervals, int numintervals, float time);
 typedef struct {
     hull_t hull;
     mplane_t planes[6];
+    mhullnode_t nodes[6];
 } boxhull_t;
 
 void Mod_CreateBoxhull(const vec3_t mins, const vec3_t maxs,
@@ -636,5 +698,7 @@ typedef struct {
 qboolean Mod_TraceHull(const hull_t *hull, int nodenum,
 		       const vec3_t p1, const vec3_t p2,
 		       trace_t *trace);
+void Mod_ClearTraceCache(void);
+void Mod_SetTraceThreaded(qboolean threaded);
 
 #endif /* MODEL_H */
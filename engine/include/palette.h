@@ -0,0 +1,43 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include "qtypes.h"
+
+// palette.h -- nearest colour searches in a palette
+
+/*
+ * The palette sorted on red, so a search for the closest colour starts at
+ * the nearest red and stops once red alone is further away than the best
+ * match.  The answer is the same as a scan of all 256 entries, down to the
+ * lowest index winning a tie.  The stride is the bytes between the colours
+ * of the palette (3 for rgb or 4 for d_8to24table).
+ */
+typedef struct {
+    byte rgb[256][3];
+    byte index[256];
+} palsearch_t;
+
+void Pal_InitSearch(palsearch_t *search, const byte *palette, int stride);
+int Pal_FindClosest(const palsearch_t *search, int r, int g, int b);
+
+#endif /* PALETTE_H */
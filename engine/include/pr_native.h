@@ -0,0 +1,74 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef PR_NATIVE_H
+#define PR_NATIVE_H
+
+/*
+ * The interface between the engine and progs.dat compiled to native code by
+ * tyr-progs2c.  The generated C includes only this header, so nothing here
+ * may depend on the rest of the engine.
+ */
+
+#define PR_NATIVE_VERSION	1
+#define PR_NATIVE_SYMBOL	"pr_nativeprogs"
+
+typedef union {
+    float f;
+    int i;
+} prnval_t;
+
+/*
+ * What the engine gives the native code.  The pointers stay valid while the
+ * progs are loaded, except edicts which is set on each entry to the progs.
+ */
+typedef struct {
+    prnval_t *globals;
+    char *edicts;		// sv.edicts
+    int entvars;		// offset of the entvars in an edict
+    int *xstatement;		// statement for error reports, set before calls
+    int *runaway;		// counted down on each backwards jump
+
+    void (*call)(int fnum, int argc);
+    void (*state)(float frame, int think);
+    void (*assignworld)(void);	// errors if the world can't be changed
+    void (*runawaycheck)(void);	// called once runaway gets low
+    void (*runerror)(const char *error, ...);
+    const char *(*getstring)(int num);
+} prnative_t;
+
+/*
+ * Each function returns the number of statements it ran, for the profile.
+ * Builtins and functions which couldn't be compiled are NULL.
+ */
+typedef int (*prnativefunc_t)(void);
+
+/* What the native code exports, as PR_NATIVE_SYMBOL */
+typedef struct {
+    int version;		// PR_NATIVE_VERSION
+    int crc;			// progs->crc
+    unsigned short filecrc;	// CRC of the whole progs.dat
+    int numfunctions;
+    int numstatements;
+    void (*init)(const prnative_t *pr);
+    const prnativefunc_t *functions;
+} prnativeprogs_t;
+
+#endif /* PR_NATIVE_H */
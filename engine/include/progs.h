@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifndef PROGS_H
 #define PROGS_H
 
+#include <stddef.h>
+
 #include "pr_comp.h"		// defs shared with qcc
 #include "progdefs.h"		// generated by program cdefs
 #include "common.h"
@@ -35,13 +37,21 @@ typedef union eval_s {
 } eval_t;
 
 #define	MAX_ENT_LEAFS	16
+#define	MAX_ENT_TOUCHES	8
 typedef struct edict_s {
     qboolean free;
     link_t area;		// linked to a division node or leaf
+    struct areanode_s *areanode;	// the node it's linked to
+    link_t *arealist;		// and which of its lists
 
     int num_leafs;
     short leafnums[MAX_ENT_LEAFS];
 
+    unsigned touchgen;		// sv_touchgen when the triggers were found
+    vec3_t touchmins, touchmaxs;	// the box they were looked for in
+    int num_touches;		// -1 if there were too many to keep
+    int touchnums[MAX_ENT_TOUCHES];	// triggers near the entity
+
     entity_state_t baseline;
 
     float freetime;		// sv.time when the object was freed
@@ -49,6 +59,20 @@ typedef struct edict_s {
 // other fields from progs come immediately after
 } edict_t;
 
+/*
+ * The little the loops over every edict look at first, kept apart in
+ * sv.edhot so they can pass over free and unseen edicts without pulling each
+ * whole edict into the cache.  The engine is the only writer of these:
+ * ED_ClearEdict and ED_Free keep the free state, SV_LinkEdict the leafs, and
+ * ED_ResetFreeList copies it all again after a load.
+ */
+typedef struct {
+    byte free;
+    short num_leafs;		// 0 once freed
+    short leafnum;		// the first of the leafs
+    float freetime;
+} edhot_t;
+
 //============================================================================
 
 extern dprograms_t *progs;
@@ -67,11 +91,52 @@ void PR_Init(void);
 
 void PR_ExecuteProgram(func_t fnum);
 void PR_LoadProgs(void);
+void PR_DecodeStatements(void);
+int PR_EnterFunction(dfunction_t *f);
+int PR_LeaveFunction(void);
+
+// pr_native.c
+void PR_LoadNative(unsigned short filecrc);
+qboolean PR_ExecuteNative(func_t fnum);
+qboolean PR_NativeLoaded(void);
+
+// pr_profile.c
+extern qboolean pr_profiling;
+void PR_ProfileInit(void);
+void PR_ProfileLoad(void);
+void PR_ProfileStart(void);
+void PR_ProfileEnter(const dfunction_t *f);
+void PR_ProfileLeave(void);
+qboolean PR_ProfileCommand(void);
 
 void PR_Profile_f(void);
 
+void ED_InitEdicts(void);
+void ED_ResetFreeList(void);
 edict_t *ED_Alloc(void);
 void ED_Free(edict_t *ed);
+int ED_NumActive(void);
+
+/*
+ * find() indexes these fields; anything storing a string to one of them has
+ * to call ED_FieldStored, or ED_FindChanged if it can't say which.
+ */
+enum { FIND_CLASSNAME, FIND_TARGETNAME, FIND_TARGET, FIND_NUMFIELDS };
+extern unsigned ed_findgen[FIND_NUMFIELDS];
+
+void ED_FindChanged(void);
+int ED_FindString(int start, int ofs, const char *s);
+
+static inline void
+ED_FieldStored(int ofs)
+{
+    if (ofs == offsetof(entvars_t, classname) / 4)
+	ed_findgen[FIND_CLASSNAME]++;
+    else if (ofs == offsetof(entvars_t, targetname) / 4)
+	ed_findgen[FIND_TARGETNAME]++;
+    else if (ofs == offsetof(entvars_t, target) / 4)
+	ed_findgen[FIND_TARGET]++;
+}
 
 // returns a copy of the string allocated from the server's string heap
 
@@ -84,6 +149,11 @@ void ED_ParseGlobals(const char *data);
 
 void ED_LoadFromFile(const char *data);
 
+#ifdef NQ_HACK
+void *ED_SaveBinary(const char *header, int *length);
+qboolean ED_LoadBinary(const void *data, int length);
+#endif
+
 edict_t *EDICT_NUM(int n);
 int NUM_FOR_EDICT(const edict_t *e);
 
@@ -100,6 +170,10 @@ int NUM_FOR_EDICT(const edict_t *e);
 
 #define PROG_TO_EDICT(e) ((edict_t *)((byte *)sv.edicts + e))
 
+#define EDICT_HOT(e) ({					\
+	CHECK_EDICT_PTR(e);					\
+	&sv.edhot[((const byte *)e - (const byte *)sv.edicts) / pr_edict_size]; })
+
 //============================================================================
 
 #define	G_FLOAT(o) (pr_globals[o])
@@ -141,12 +215,33 @@ void ED_PrintNum(int ent);
 
 eval_t *GetEdictFieldValue(edict_t *ed, const char *field);
 
+/*
+ * Offsets of the fields which only some progs have, found when the progs
+ * are loaded.  -1 if the progs don't have the field.
+ */
+typedef struct {
+    int items2;
+    int gravity;
+    int maxspeed;
+} pr_extfields_t;
+
+extern pr_extfields_t pr_extfields;
+
+static inline eval_t *
+GetEdictField(edict_t *ed, int ofs)
+{
+    return ofs < 0 ? NULL : (eval_t *)((int *)&ed->v + ofs);
+}
+eval_t *PR_FindGlobal(const char *name, etype_t type);
+
 /*
  * PR Strings stuff
  */
 void PR_InitStringTable(void);
 const char *PR_GetString(int num);
 int PR_SetString(const char *s);
+int PR_SetTempString(const char *s);
+void PR_CollectStrings(void);
 
 /*
  * Somehow, I don't think this should be exposed - but better to have it here
@@ -164,8 +164,8 @@ extern int r_polycount;
 
 extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern D_THREADVAR fixed16_t sadjust, tadjust;
+extern D_THREADVAR fixed16_t bbextents, bbextentt;
 
 #define MAXBVERTINDEXES	1000	// new clipped vertices when clipping bmodels
 				// to the world BSP
@@ -191,6 +191,7 @@ extern int r_acliptype;
 extern float r_avertexnormals[][3];
 
 qboolean R_AliasCheckBBox(entity_t *e);
+qboolean R_Occluded(int left, int top, int right, int bottom, float nearz);
 
 //=========================================================
 // turbulence stuff
@@ -208,8 +209,9 @@ void R_ClearParticles(void);
 void R_ReadPointFile_f(void);
 void R_SurfacePatch(void);
 
+extern particlegroup_t r_particlegroups[pt_numtypes];
+
 extern int r_amodels_drawn;
-extern edge_t *auxedges;
 extern int r_numallocatededges;
 extern edge_t *r_edges, *edge_p, *edge_max;
 
@@ -244,6 +246,9 @@ extern float se_time1, se_time2, de_time1, de_time2, dv_time1, dv_time2;
 extern int r_maxsurfsseen, r_maxedgesseen;
 extern cshift_t cshift_water;
 extern qboolean r_dowarpold, r_viewchanged;
+extern qboolean r_sharedscene;
+extern int r_sceneviews;
+int R_SceneView(void);
 
 extern mleaf_t *r_viewleaf, *r_oldviewleaf;
 
@@ -260,11 +265,14 @@ void R_PrintTimes(void);
 void R_PrintDSpeeds(void);
 void R_AnimateLight(void);
 int R_LightPoint(const vec3_t point);
+void R_ClearLightPoints(void);
 void R_SetupFrame(void);
 void R_cshift_f(void);
 void R_EmitEdge(mvertex_t *pv0, mvertex_t *pv1);
 void R_ClipEdge(mvertex_t *pv0, mvertex_t *pv1, clipplane_t *clip);
 void R_SplitEntityOnNode2(mnode_t *node);
 void R_MarkLights(dlight_t *light, int bit, mnode_t *node);
+int R_SurfaceDlights(const msurface_t *surf, surfdlight_t *lights,
+		     unsigned *key);
 
 #endif /* R_LOCAL_H */
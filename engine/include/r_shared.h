@@ -47,8 +47,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //===================================================================
 
-extern int cachewidth;
-extern pixel_t *cacheblock;
+/*
+ * The span drawing state is per thread, so that the span lists can be drawn
+ * in screen bands on several threads (see d_band.c).  The assembly drawers
+ * address it as plain globals, so it stays shared with USE_X86_ASM.
+ */
+#ifdef USE_X86_ASM
+#define D_THREADVAR
+#else
+#define D_THREADVAR __thread
+#endif
+
+extern D_THREADVAR int cachewidth;
+extern D_THREADVAR pixel_t *cacheblock;
 extern int screenwidth;
 
 extern float pixelAspect;
@@ -65,11 +76,9 @@ extern vec3_t vup, base_vup;
 extern vec3_t vpn, base_vpn;
 extern vec3_t vright, base_vright;
 
-// FIXME - reasoning behind number choice?
-#define NUMSTACKEDGES		3000
-#define	MINEDGES		NUMSTACKEDGES
-#define NUMSTACKSURFACES	1500
-#define MINSURFACES		NUMSTACKSURFACES
+// starting sizes of the edge and surface pools, which grow as needed
+#define	MINEDGES		3000
+#define MINSURFACES		1500
 #define	MAXSPANS		3000
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
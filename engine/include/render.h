@@ -86,6 +86,7 @@ typedef struct entity_s {
 
 // FIXME: could turn these into a union
     int trivial_accept;
+    int lod;			// alias model detail level, 0 is full
     struct mnode_s *topnode;	// for bmodels, first world node
 				//  that splits bmodel, or NULL if
 				//  not split
@@ -108,6 +109,7 @@ typedef struct entity_s {
 } entity_t;
 
 extern cvar_t r_lerpmodels;
+extern cvar_t r_lodbias;
 extern cvar_t r_lerpmove;
 
 // !!! if this is changed, it must be changed in asm_draw.h too !!!
@@ -160,6 +162,18 @@ void R_Init(void);
 void R_InitTextures(void);
 void R_InitEfrags(void);
 void R_RenderView(void);	// must set r_refdef first
+void R_BeginScene(void);	// share setup between views from one origin
+void R_EndScene(void);
+void R_BinScene(int numviews, const vec3_t *forward, const float *halfangle,
+		float margin);
+
+typedef struct {
+    vec3_t forward, right, up;
+    float tanx, tany;		// tangents of the half-FOVs across and up
+} sceneview_t;
+
+void R_CullScene(const sceneview_t *views, int numviews, unsigned viewbits);
+extern unsigned r_viewbits;	// bit of the view being drawn, 0 = all
 void R_ViewChanged(vrect_t *pvrect, int lineadj, float aspect);
 				// called whenever r_refdef or vid change
 
@@ -208,6 +222,7 @@ int D_SurfaceCacheForRes(int width, int height);
 void D_FlushCaches(void);
 void D_DeleteSurfaceCache(void);
 void D_InitCaches(void *buffer, int size);
+void D_SetCache(void *buffer, int size);
 void R_SetVrect(const vrect_t *pvrectin, vrect_t *pvrect, int lineadj);
 
 #endif /* RENDER_H */
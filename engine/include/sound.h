@@ -50,10 +50,16 @@ typedef struct {
 typedef struct sfx_s {
     char name[MAX_QPATH];
     cache_user_t cache;
+    struct sfx_s *hashnext;	// next in the S_FindName hash chain
+    struct sfxcache_s *arena;	// in the sound arena rather than the cache
+    int arenasize;
+    int arenalevel;		// the last level to use it
+    struct sfx_s *arenanext;
+    qboolean decoding;		// queued for the background decoder
 } sfx_t;
 
 // !!! if this is changed, it much be changed in asm_i386.h too !!!
-typedef struct {
+typedef struct sfxcache_s {
     int length;
     int loopstart;
     int speed;
@@ -134,6 +140,10 @@ extern channel_t channels[MAX_CHANNELS];
 
 extern int total_channels;
 
+// the channels that can be heard, which S_PaintChannels mixes
+extern channel_t *active_channels[MAX_CHANNELS];
+extern int num_active_channels;
+
 extern int paintedtime;
 extern volatile dma_t *shm;
 extern volatile dma_t sn;
@@ -146,6 +156,22 @@ extern int snd_blocked;
 
 void S_LocalSound(const char *s);
 sfxcache_t *S_LoadSound(sfx_t *s);
+void S_PreloadSound(sfx_t *s);
+void S_UpdateSoundCache(void);
+void S_InitSoundCache(void);
+void S_SoundCacheInfo(void);
+
+// a sound's data, if it's in memory; never loads anything
+static inline sfxcache_t *
+S_SfxData(const sfx_t *s)
+{
+    return s->arena ? s->arena : (sfxcache_t *)s->cache.data;
+}
+
+// held by the mixer thread while it mixes; no-ops without the thread
+void S_LockMixer(void);
+void S_UnlockMixer(void);
+
 
 void SND_InitScaletable(void);
 void SNDDMA_Submit(void);
@@ -0,0 +1,75 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef SV_PROFILE_H
+#define SV_PROFILE_H
+
+#include "qtypes.h"
+
+/*
+ * The parts of a server frame timed by sv_profile.  Phases nest, and each
+ * one is charged only for the time not spent in the phases inside it.
+ */
+typedef enum {
+    SVP_READ,		// reading client packets and running their moves
+    SVP_THINK,		// QuakeC think, prethink and postthink functions
+    SVP_MOVE,		// SV_Physics, not counting the functions it calls
+    SVP_TOUCH,		// QuakeC touch and blocked functions
+    SVP_SEND,		// SV_SendClientMessages, less the two below
+    SVP_ENTITIES,	// building the entity updates for each client
+    SVP_NETWRITE,	// handing the messages to the network
+    SVP_NUMPHASES
+} svphase_t;
+
+/* A frame's times are those of each phase, then the rest, then the total */
+#define SVP_NUMTIMES (SVP_NUMPHASES + 2)
+
+extern qboolean sv_profiling;	// latched at the start of each frame
+
+void SV_ProfileInit(void);
+void SV_ProfileStartFrame(void);
+void SV_ProfileEndFrame(void);
+void SV_ProfilePush(svphase_t phase);
+void SV_ProfilePop(void);
+
+/*
+ * For sv_metrics: keep timing frames while anything requires it, whatever
+ * sv_profile is.  The last frame's times are in msec, NULL if it wasn't
+ * timed.
+ */
+void SV_ProfileRequire(qboolean require);
+const float *SV_ProfileLastFrame(void);
+const char *SV_ProfileTimeName(int time);
+
+static inline void
+SV_ProfileBegin(svphase_t phase)
+{
+    if (sv_profiling)
+	SV_ProfilePush(phase);
+}
+
+static inline void
+SV_ProfileEnd(void)
+{
+    if (sv_profiling)
+	SV_ProfilePop();
+}
+
+#endif /* SV_PROFILE_H */
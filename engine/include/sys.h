@@ -25,10 +25,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // sys.h -- non-portable functions
 
+#include <stddef.h>
+
+#include "qtypes.h"
+
 // FIXME - don't want win only stuff in header
 //         minimized could be useful on other systems anyway...
 #ifdef _WIN32
-#include "qtypes.h"
 //extern qboolean Minimized;
 extern qboolean window_visible(void);
 #endif
@@ -39,6 +42,52 @@ extern qboolean window_visible(void);
 int Sys_FileTime(const char *path);
 void Sys_mkdir(const char *path);
 
+//
+// file mapping
+//  maps length bytes of a file from offset as a private, copy on write view
+//  (writes never reach the file) and returns a pointer to the first byte, or
+//  NULL if it can't be mapped.  Unmap with Sys_UnmapFile.
+typedef struct sys_mapping_s {
+    void *base;
+    size_t size;
+} sys_mapping_t;
+
+void *Sys_MapFile(const char *path, size_t offset, size_t length,
+		  sys_mapping_t *mapping);
+void Sys_UnmapFile(sys_mapping_t *mapping);
+
+//
+// address space
+//  reserves address space without any memory behind it (NULL if that isn't
+//  possible), commits pages of it as read/write memory (false when out of
+//  memory) and decommits them again, discarding their contents.
+void *Sys_ReserveMemory(size_t size);
+qboolean Sys_CommitMemory(void *addr, size_t size);
+void Sys_DecommitMemory(void *addr, size_t size);
+
+//
+// large buffers
+//  allocates memory for a big, heavily used buffer, aligned to at least a
+//  page and backed by huge pages where the system will give them, to spare
+//  the TLB.  Returns NULL when out of memory.  Free with Sys_FreeLarge.
+typedef enum {
+    SYS_PAGES_NORMAL,
+    SYS_PAGES_TRANSPARENT,	// the kernel was asked to use huge pages
+    SYS_PAGES_HUGE,		// explicitly reserved huge/large pages
+    SYS_NUMPAGES
+} sys_pages_t;
+
+typedef struct sys_largebuf_s {
+    void *base;
+    size_t size;
+    sys_pages_t pages;
+} sys_largebuf_t;
+
+extern const char *sys_pagenames[SYS_NUMPAGES];
+
+void *Sys_AllocLarge(size_t size, sys_largebuf_t *buf);
+void Sys_FreeLarge(sys_largebuf_t *buf);
+
 //
 // memory protection
 //  changes protection from start_addr, up to but not including end_addr
@@ -80,4 +129,11 @@ void Sys_SetFPCW(void);
 
 void Sys_Init(void);
 
+#ifdef SERVERONLY
+// splits the process into count copies sharing everything loaded so far,
+// returning which copy this is (0 for the original).  Only the original is
+// left if that isn't possible.
+int Sys_ForkInstances(int count);
+#endif
+
 #endif /* SYS_H */
@@ -0,0 +1,52 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "qtypes.h"
+
+/*
+ * Scoped events for trace_start/trace_stop, written out as a Chrome trace.
+ * Names must be string constants; only the pointer is kept.  An end closes
+ * the most recent begin with the same name, along with anything left open
+ * inside it (e.g. by a longjmp out of a Host_Error).
+ */
+extern qboolean trace_active;
+
+void Trace_Init(void);
+void Trace_Push(const char *name);
+void Trace_Pop(const char *name);
+
+static inline void
+TR_Begin(const char *name)
+{
+    if (trace_active)
+	Trace_Push(name);
+}
+
+static inline void
+TR_End(const char *name)
+{
+    if (trace_active)
+	Trace_Pop(name);
+}
+
+#endif /* TRACE_H */
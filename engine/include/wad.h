@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define WAD_H
 
 #include "qtypes.h"
+#include "sys.h"
 
 //===============
 //   TYPES
@@ -66,6 +67,7 @@ typedef struct {
     int numlumps;
     lumpinfo_t *lumps;
     byte *base;
+    sys_mapping_t mapping;	// base is in here, if the wad was mapped
 } wad_t;
 
 void W_LoadWadFile(wad_t *wad, const char *filename);
@@ -36,6 +36,13 @@ void SV_ClearWorld(void);
 
 // called after the world model has been loaded, before linking any entities
 
+void SV_AreaStats_f(void);
+void SV_TouchStats(void);
+
+extern unsigned sv_brushgen;
+
+// changes whenever the world or a brush entity may have moved
+
 void SV_UnlinkEdict(edict_t *ent);
 
 // call before removing an entity, and before trying to move one,
@@ -56,6 +63,17 @@ int SV_PointContents(const vec3_t point);
 
 edict_t *SV_TestEntityPosition(const edict_t *ent);
 
+int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **edicts,
+		  int maxedicts);
+
+// fills in the linked edicts whose abs boxes touch the box, returning how many
+// SOLID_NOT edicts aren't included
+
+int SV_AreaPushEdicts(const vec3_t mins, const vec3_t maxs, edict_t **edicts,
+		      int maxedicts);
+
+// the same, with the SOLID_NOT edicts as well, for finding what a pusher moves
+
 /*
  * SV_Move
  * - mins and maxs are reletive
@@ -88,10 +106,31 @@ SV_TraceLine(const vec3_t start, const vec3_t end, movetype_t type,
 			trace);
 }
 
+/*
+ * For several lines traced close together, e.g. the probes under a monster:
+ * the edicts which could clip them are found once for a box around them all.
+ * Lines leaving the box, or too many edicts, fall back to SV_TraceLine.
+ */
+#define TRACEAREA_EDICTS 32
+
+typedef struct {
+    vec3_t mins, maxs;
+    movetype_t type;
+    const edict_t *passedict;
+    int numedicts;		// -1 if there were too many
+    const edict_t *edicts[TRACEAREA_EDICTS];
+} tracearea_t;
+
+void SV_InitTraceArea(tracearea_t *area, const vec3_t mins, const vec3_t maxs,
+		      movetype_t type, const edict_t *passedict);
+const edict_t *SV_TraceAreaLine(const tracearea_t *area, const vec3_t start,
+				const vec3_t end, trace_t *trace);
+
 #if defined(QW_HACK) && defined(SERVERONLY)
 #include "pmove.h"
 void SV_AddLinksToPhysents(const edict_t *player, const vec3_t mins,
 			   const vec3_t maxs, physent_stack_t *pestack);
+void SV_PhysentStats(void);
 #endif
 
 #endif /* WORLD_H */
@@ -43,7 +43,8 @@ server allocations when changing to a higher video mode.
 
 Z_??? Zone memory functions used for small, dynamic allocations like text
 strings from command input.  There is only about 48K for it, allocated at
-the very bottom of the hunk.
+the very bottom of the hunk.  Allocations of up to 512 bytes come from
+slabs of a few size classes inside the zone.
 
 Cache_??? Cache memory is for objects that can be dynamically loaded and
 can usefully stay persistant between levels.  The size of the cache
@@ -90,8 +91,18 @@ Zone block
 */
 
 size_t Memory_GetSize(void);
+void *Memory_Reserve(int *size);	// only commits memory as it's used
 void Memory_Init(void *buf, int size);
 
+/* in bytes; the cache lives in the hunk, between the low and high parts */
+typedef struct {
+    int hunk_size, hunk_low, hunk_high;
+    int cache_used;
+    int zone_size, zone_used;
+} memusage_t;
+
+void Memory_GetUsage(memusage_t *usage);
+
 void Z_Free(const void *ptr);
 void *Z_Malloc(int size);	// returns 0 filled memory
 void *Z_Realloc(const void *ptr, int size);
@@ -118,6 +129,7 @@ typedef struct cache_user_s {
     void (*destructor)(struct cache_user_s *self);
     void *data;
     int pad;
+    qboolean evicted;		// thrown out to make room, not freed by us
 } cache_user_t;
 
 void Cache_Flush(void);
@@ -147,8 +159,33 @@ void *Cache_AllocPadded(cache_user_t *c, int pad, int size, const char *name);
 
 void Cache_Free(cache_user_t *c);
 
+/*
+ * Cache_SetGuard
+ * - lock is taken, and unlock released, around anything that moves or
+ *   frees cached data, for a thread which reads the data without going
+ *   through Cache_Check (the sound mixer).  The lock must be recursive.
+ */
+void Cache_SetGuard(void (*lock)(void), void (*unlock)(void));
+
 void Cache_Report(void);
 
+/*
+ * Cache statistics, by the kind of data (from the name it was cached as)
+ */
+typedef enum {
+    CACHE_SOUND, CACHE_MODEL, CACHE_OTHER, CACHE_TYPES
+} cachetype_t;
+
+typedef struct {
+    int allocs;
+    int evictions;		// thrown out to make room
+    int moves;			// moved out of the way of the hunk
+    int reloads;		// allocated again after an eviction
+} cachestats_t;
+
+extern const char *const cache_typenames[CACHE_TYPES];
+extern cachestats_t cache_stats[CACHE_TYPES];
+
 /* For debugging - Walk the links to check for data corruption */
 #ifdef DEBUG
 void Cache_CheckLinks(void);
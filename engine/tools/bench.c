@@ -0,0 +1,621 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/*
+ * bench.c -- time the engine's hot paths outside of the game
+ *
+ *	make bench
+ *	bin/tyr-bench -basedir ../game [-runs <n>] [-bench <name>]
+ *
+ * Links the objects of tyr-quake, without its main, and runs each hot path
+ * on fixed inputs: made up from a fixed random seed, or taken from the
+ * game data (progs.dat, a map, the palette and the lens scripts) where the
+ * real thing matters.  Benchmarks needing data that isn't found are
+ * skipped.  Each is run a few times and the fastest run is reported, in
+ * nanoseconds for each operation, so that changes can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "d_local.h"
+#include "fisheye.h"
+#include "host.h"
+#include "mathlib.h"
+#include "model.h"
+#include "net.h"
+#include "progs.h"
+#include "quakedef.h"
+#include "r_local.h"
+#include "sound.h"
+#include "sys.h"
+#include "zone.h"
+
+/* the r_surf.c functions and globals shared with the asm */
+void R_DrawSurfaceBlock8_mip0(void);
+void R_DrawSurfaceBlock8_mip1(void);
+void R_DrawSurfaceBlock8_mip2(void);
+void R_DrawSurfaceBlock8_mip3(void);
+extern int sourcetstep, surfrowbytes, r_numvblocks, r_lightwidth, r_stepback;
+extern unsigned *r_lightptr;
+extern void *prowdestbase;
+extern unsigned char *pbasesource, *r_sourcemax;
+
+#define BENCH_SEED	0x1d2c3b4a
+#define MAX_RESULTS	64
+
+typedef struct {
+    char name[64];
+    int ops;
+    double best;		// the fastest run, in seconds
+} benchresult_t;
+
+static benchresult_t results[MAX_RESULTS];
+static int numresults;
+static unsigned bench_random;
+static const char *bench_only;
+
+static unsigned
+Bench_Random(void)
+{
+    bench_random = bench_random * 1664525 + 1013904223;
+    return bench_random >> 8;
+}
+
+static float
+Bench_RandomFloat(float min, float max)
+{
+    return min + (max - min) * (Bench_Random() & 0xffff) / 65535.0f;
+}
+
+static qboolean
+Bench_HaveFile(const char *name)
+{
+    FILE *f;
+
+    if (COM_FOpenFile(name, &f) < 0)
+	return false;
+    fclose(f);
+    return true;
+}
+
+static void
+Bench_Report(const char *name, int ops, double seconds)
+{
+    benchresult_t *result;
+    int i;
+
+    for (i = 0; i < numresults; i++)
+	if (!strcmp(results[i].name, name))
+	    break;
+    result = &results[i];
+    if (i == numresults) {
+	if (numresults == MAX_RESULTS)
+	    return;
+	numresults++;
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	result->ops = ops;
+	result->best = seconds;
+    } else if (seconds < result->best) {
+	result->best = seconds;
+    }
+}
+
+/*
+ * ===========================================================================
+ * MSG_*
+ * ===========================================================================
+ */
+#define MSG_COUNT 100000
+
+static void
+Bench_WriteUpdate(sizebuf_t *msg, int i)
+{
+    MSG_WriteByte(msg, i & 0xff);
+    MSG_WriteShort(msg, i & 0x7fff);
+    MSG_WriteLong(msg, i * 2654435761u);
+    MSG_WriteCoord(msg, (i & 1023) * 0.5f);
+    MSG_WriteCoord(msg, (i & 511) * -0.25f);
+    MSG_WriteCoord(msg, (i & 255) * 2.0f);
+    MSG_WriteAngle(msg, (i & 359));
+    MSG_WriteAngle(msg, 360 - (i & 359));
+    MSG_WriteFloat(msg, i * 0.1f);
+    MSG_WriteString(msg, "progs/player.mdl");
+}
+
+static void
+Bench_Messages(void)
+{
+    static byte data[MAX_MSGLEN];
+    sizebuf_t msg;
+    double start;
+    int i, count, size;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.data = data;
+    msg.maxsize = sizeof(data);
+
+    /* as many updates as will fit, written again and again */
+    Bench_WriteUpdate(&msg, 0);
+    size = msg.cursize;
+    count = msg.maxsize / size;
+
+    start = Sys_DoubleTime();
+    for (i = 0; i < MSG_COUNT; i++) {
+	if (!(i % count))
+	    SZ_Clear(&msg);
+	Bench_WriteUpdate(&msg, i);
+    }
+    Bench_Report("MSG_Write* update", MSG_COUNT, Sys_DoubleTime() - start);
+
+    SZ_Clear(&msg);
+    for (i = 0; i < count; i++)
+	Bench_WriteUpdate(&msg, i);
+    memcpy(net_message.data, msg.data, msg.cursize);
+    net_message.cursize = msg.cursize;
+
+    start = Sys_DoubleTime();
+    for (i = 0; i < MSG_COUNT; i++) {
+	if (!(i % count))
+	    MSG_BeginReading();
+	MSG_ReadByte();
+	MSG_ReadShort();
+	MSG_ReadLong();
+	MSG_ReadCoord();
+	MSG_ReadCoord();
+	MSG_ReadCoord();
+	MSG_ReadAngle();
+	MSG_ReadAngle();
+	MSG_ReadFloat();
+	MSG_ReadString();
+    }
+    Bench_Report("MSG_Read* update", MSG_COUNT, Sys_DoubleTime() - start);
+}
+
+/*
+ * ===========================================================================
+ * COM_FOpenFile
+ * ===========================================================================
+ */
+#define FOPEN_COUNT 2000
+
+static const char *fopen_hits[] = {
+    "progs.dat", "gfx/palette.lmp", "maps/e1m1.bsp", "progs/player.mdl",
+    "sound/weapons/rocket1i.wav", "gfx.wad",
+};
+
+static const char *fopen_misses[] = {
+    "progs/missing.mdl", "maps/missing.bsp", "sound/missing.wav",
+    "textures/missing.tga",
+};
+
+static void
+Bench_FileLookups(const char **names, int numnames, const char *name)
+{
+    FILE *f;
+    double start;
+    int i;
+
+    start = Sys_DoubleTime();
+    for (i = 0; i < FOPEN_COUNT; i++) {
+	if (COM_FOpenFile(names[i % numnames], &f) >= 0 && f)
+	    fclose(f);
+    }
+    Bench_Report(name, FOPEN_COUNT, Sys_DoubleTime() - start);
+}
+
+static void
+Bench_Files(void)
+{
+    Bench_FileLookups(fopen_hits, ARRAY_SIZE(fopen_hits),
+		      "COM_FOpenFile hit");
+    Bench_FileLookups(fopen_misses, ARRAY_SIZE(fopen_misses),
+		      "COM_FOpenFile miss");
+}
+
+/*
+ * ===========================================================================
+ * D_DrawSpans8
+ * ===========================================================================
+ */
+#define SPAN_WIDTH	640
+#define SPAN_HEIGHT	480
+#define SPAN_TEXSIZE	256
+#define SPAN_REPEATS	20
+
+static void
+Bench_Spans(void)
+{
+    static espan_t spans[SPAN_HEIGHT];
+    byte *texture, *view;
+    double start;
+    int i;
+
+    texture = malloc(SPAN_TEXSIZE * SPAN_TEXSIZE);
+    view = malloc(SPAN_WIDTH * SPAN_HEIGHT);
+    if (!texture || !view)
+	goto done;
+    for (i = 0; i < SPAN_TEXSIZE * SPAN_TEXSIZE; i++)
+	texture[i] = Bench_Random();
+
+    /* one span per row, on a floor receding into the distance */
+    for (i = 0; i < SPAN_HEIGHT; i++) {
+	spans[i].u = 0;
+	spans[i].v = i;
+	spans[i].count = SPAN_WIDTH;
+	spans[i].pnext = i < SPAN_HEIGHT - 1 ? &spans[i + 1] : NULL;
+    }
+    cacheblock = texture;
+    cachewidth = SPAN_TEXSIZE;
+    d_viewbuffer = view;
+    screenwidth = SPAN_WIDTH;
+    d_ziorigin = 1.0f / 1024;
+    d_zistepu = 0;
+    d_zistepv = 1.0f / (1024 * 64);
+    d_sdivzorigin = -SPAN_WIDTH / 2 * 0.25f * d_ziorigin;
+    d_sdivzstepu = 0.25f * d_ziorigin;
+    d_sdivzstepv = 0;
+    d_tdivzorigin = 0;
+    d_tdivzstepu = 0;
+    d_tdivzstepv = 0.25f * d_ziorigin;
+    sadjust = SPAN_TEXSIZE / 2 << 16;
+    tadjust = 0;
+    bbextents = (SPAN_TEXSIZE << 16) - 1;
+    bbextentt = (SPAN_TEXSIZE << 16) - 1;
+
+    start = Sys_DoubleTime();
+    for (i = 0; i < SPAN_REPEATS; i++)
+	D_DrawSpans8(spans);
+    Bench_Report("D_DrawSpans8", SPAN_WIDTH * SPAN_HEIGHT * SPAN_REPEATS,
+		 Sys_DoubleTime() - start);
+
+ done:
+    free(texture);
+    free(view);
+}
+
+/*
+ * ===========================================================================
+ * R_DrawSurfaceBlock8_*
+ * ===========================================================================
+ */
+#define SURF_SIZE	256	// of the surface at mip 0
+#define SURF_TEXSIZE	64
+#define SURF_REPEATS	20
+
+static void
+Bench_SurfaceBlocks(void)
+{
+    static void (*blockfuncs[4])(void) = {
+	R_DrawSurfaceBlock8_mip0, R_DrawSurfaceBlock8_mip1,
+	R_DrawSurfaceBlock8_mip2, R_DrawSurfaceBlock8_mip3
+    };
+    static unsigned lights[(SURF_SIZE / 16 + 1) * (SURF_SIZE / 16 + 1)];
+    byte *texture, *surface, *colormap;
+    double start;
+    int mip, size, blocksize, blocks, i, h, repeat;
+
+    texture = malloc(SURF_TEXSIZE * SURF_TEXSIZE);
+    surface = malloc(SURF_SIZE * SURF_SIZE);
+    colormap = malloc(256 * VID_GRADES);
+    if (!texture || !surface || !colormap)
+	goto done;
+    for (i = 0; i < SURF_TEXSIZE * SURF_TEXSIZE; i++)
+	texture[i] = Bench_Random();
+    for (i = 0; i < 256 * VID_GRADES; i++)
+	colormap[i] = Bench_Random();
+    for (i = 0; i < ARRAY_SIZE(lights); i++)
+	lights[i] = Bench_Random() % ((VID_GRADES - 1) << 8);
+    vid.colormap = host_colormap ? host_colormap : colormap;
+
+    /* one surface, built the way R_DrawSurface goes down each column */
+    for (mip = 0; mip < 4; mip++) {
+	size = SURF_SIZE >> mip;
+	blocksize = 16 >> mip;
+	blocks = SURF_SIZE / 16;
+
+	start = Sys_DoubleTime();
+	for (repeat = 0; repeat < SURF_REPEATS; repeat++) {
+	    for (h = 0; h < blocks; h++) {
+		sourcetstep = SURF_TEXSIZE;
+		surfrowbytes = size;
+		r_lightwidth = blocks + 1;
+		r_lightptr = lights + h;
+		r_numvblocks = blocks;
+		r_stepback = SURF_TEXSIZE * SURF_TEXSIZE;
+		r_sourcemax = texture + r_stepback;
+		pbasesource = texture + (h * blocksize) % SURF_TEXSIZE;
+		prowdestbase = surface + h * blocksize;
+		blockfuncs[mip] ();
+	    }
+	}
+	Bench_Report(va("R_DrawSurfaceBlock8_mip%d", mip),
+		     size * size * SURF_REPEATS, Sys_DoubleTime() - start);
+    }
+
+ done:
+    free(texture);
+    free(surface);
+    free(colormap);
+}
+
+/*
+ * ===========================================================================
+ * S_PaintChannels
+ * ===========================================================================
+ */
+#define PAINT_CHANNELS	16
+#define PAINT_SAMPLES	11025	// of each sound, one second
+#define PAINT_DMA	16384	// sample pairs in the dma buffer
+#define PAINT_SECONDS	10
+
+static void
+Bench_Paint(void)
+{
+    static sfx_t sfx[2];
+    static volatile dma_t dma;
+    sfxcache_t *sounds[2];
+    short *samples16;
+    signed char *samples8;
+    double start;
+    int i, end;
+
+    sounds[0] = malloc(sizeof(sfxcache_t) + PAINT_SAMPLES);
+    sounds[1] = malloc(sizeof(sfxcache_t) + PAINT_SAMPLES * 2);
+    dma.buffer = malloc(PAINT_DMA * 2 * sizeof(short));
+    if (!sounds[0] || !sounds[1] || !dma.buffer)
+	goto done;
+
+    /* one 8-bit and one 16-bit looping sound */
+    samples8 = (signed char *)sounds[0]->data;
+    samples16 = (short *)sounds[1]->data;
+    for (i = 0; i < PAINT_SAMPLES; i++) {
+	samples8[i] = Bench_Random();
+	samples16[i] = Bench_Random();
+    }
+    for (i = 0; i < 2; i++) {
+	sounds[i]->length = PAINT_SAMPLES;
+	sounds[i]->loopstart = 0;
+	sounds[i]->speed = 11025;
+	sounds[i]->width = i + 1;
+	sounds[i]->stereo = 0;
+	sfx[i].arena = sounds[i];
+    }
+
+    dma.channels = 2;
+    dma.samplebits = 16;
+    dma.speed = 11025;
+    dma.samples = PAINT_DMA * 2;
+    shm = &dma;
+    SND_InitScaletable();
+
+    paintedtime = 0;
+    num_active_channels = PAINT_CHANNELS;
+    for (i = 0; i < PAINT_CHANNELS; i++) {
+	memset(&channels[i], 0, sizeof(channels[i]));
+	channels[i].sfx = &sfx[i & 1];
+	channels[i].leftvol = 32 + Bench_Random() % 224;
+	channels[i].rightvol = 32 + Bench_Random() % 224;
+	channels[i].pos = Bench_Random() % PAINT_SAMPLES;
+	channels[i].end = PAINT_SAMPLES - channels[i].pos;
+	active_channels[i] = &channels[i];
+    }
+
+    /* a frame's worth at a time, as S_Update would */
+    start = Sys_DoubleTime();
+    for (end = 0; end < dma.speed * PAINT_SECONDS; ) {
+	end += dma.speed / 72;
+	S_PaintChannels(end);
+    }
+    Bench_Report(va("S_PaintChannels (%d channels)", PAINT_CHANNELS), end,
+		 Sys_DoubleTime() - start);
+
+    num_active_channels = 0;
+    shm = NULL;
+
+ done:
+    free(sounds[0]);
+    free(sounds[1]);
+    free(dma.buffer);
+}
+
+/*
+ * ===========================================================================
+ * PR_ExecuteProgram
+ * ===========================================================================
+ */
+#define PROGS_COUNT 20000
+
+static void
+Bench_Progs(void)
+{
+    double start;
+    func_t anglemod;
+    int i;
+
+    if (!Bench_HaveFile("progs.dat")) {
+	printf("No progs.dat, skipping PR_ExecuteProgram\n");
+	return;
+    }
+    if (!progs)
+	PR_LoadProgs();
+
+    /* anglemod is a loop of plain arithmetic, needing no entities */
+    for (anglemod = 1; anglemod < progs->numfunctions; anglemod++)
+	if (!strcmp(PR_GetString(pr_functions[anglemod].s_name), "anglemod"))
+	    break;
+    if (anglemod == progs->numfunctions) {
+	printf("No anglemod in progs.dat, skipping PR_ExecuteProgram\n");
+	return;
+    }
+
+    start = Sys_DoubleTime();
+    for (i = 0; i < PROGS_COUNT; i++) {
+	G_FLOAT(OFS_PARM0) = 360 * 50 + i % 360;
+	PR_ExecuteProgram(anglemod);
+    }
+    Bench_Report("PR_ExecuteProgram anglemod", PROGS_COUNT,
+		 Sys_DoubleTime() - start);
+}
+
+/*
+ * ===========================================================================
+ * Mod_TraceHull
+ * ===========================================================================
+ */
+#define TRACE_SEGMENTS	4096	// more than the trace cache holds
+#define TRACE_COUNT	200000
+#define TRACE_MAP	"maps/e1m1.bsp"
+
+static void
+Bench_Traces(void)
+{
+    static vec3_t starts[TRACE_SEGMENTS], ends[TRACE_SEGMENTS];
+    const model_t *world;
+    const brushmodel_t *brushmodel;
+    const hull_t *hull;
+    trace_t trace;
+    double start;
+    int i, j;
+
+    if (!Bench_HaveFile(TRACE_MAP)) {
+	printf("No %s, skipping Mod_TraceHull\n", TRACE_MAP);
+	return;
+    }
+    world = Mod_ForName(TRACE_MAP, true);
+
+    /* player sized moves of up to 128 units, anywhere in the map */
+    for (i = 0; i < TRACE_SEGMENTS; i++) {
+	for (j = 0; j < 3; j++) {
+	    starts[i][j] = Bench_RandomFloat(world->mins[j], world->maxs[j]);
+	    ends[i][j] = starts[i][j] + Bench_RandomFloat(-128, 128);
+	}
+    }
+
+    brushmodel = ConstBrushModel(world);
+    hull = &brushmodel->hulls[1];
+    start = Sys_DoubleTime();
+    for (i = 0; i < TRACE_COUNT; i++) {
+	j = i % TRACE_SEGMENTS;
+	memset(&trace, 0, sizeof(trace));
+	trace.fraction = 1;
+	trace.allsolid = true;
+	VectorCopy(ends[j], trace.endpos);
+	Mod_TraceHull(hull, hull->firstclipnode, starts[j], ends[j], &trace);
+    }
+    Bench_Report("Mod_TraceHull " TRACE_MAP, TRACE_COUNT,
+		 Sys_DoubleTime() - start);
+}
+
+/*
+ * ===========================================================================
+ * Lenses
+ * ===========================================================================
+ */
+static void
+Bench_Lenses(void)
+{
+    if (!host_basepal) {
+	printf("No gfx/palette.lmp, skipping the lenses\n");
+	return;
+    }
+    F_Init();
+    F_Bench(Bench_Report);
+}
+
+/*
+ * ===========================================================================
+ * Main
+ * ===========================================================================
+ */
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} benchmark_t;
+
+static const benchmark_t benchmarks[] = {
+    { "msg", Bench_Messages },
+    { "files", Bench_Files },
+    { "spans", Bench_Spans },
+    { "surface", Bench_SurfaceBlocks },
+    { "paint", Bench_Paint },
+    { "progs", Bench_Progs },
+    { "trace", Bench_Traces },
+    { "lens", Bench_Lenses },
+};
+
+int
+main(int argc, const char *argv[])
+{
+    quakeparms_t parms;
+    int i, run, runs;
+
+    memset(&parms, 0, sizeof(parms));
+    COM_InitArgv(argc, argv);
+    parms.argc = com_argc;
+    parms.argv = com_argv;
+    parms.basedir = stringify(QBASEDIR);
+    parms.memsize = Memory_GetSize();
+    parms.membase = Memory_Reserve(&parms.memsize);
+    if (!parms.membase)
+	Sys_Error("Allocation of %d byte heap failed", parms.memsize);
+    host_parms = parms;
+
+    i = COM_CheckParm("-runs");
+    runs = i && i < com_argc - 1 ? Q_atoi(com_argv[i + 1]) : 5;
+    runs = qmax(runs, 1);
+    i = COM_CheckParm("-bench");
+    bench_only = i && i < com_argc - 1 ? com_argv[i + 1] : NULL;
+
+    Sys_Init();
+    Memory_Init(parms.membase, parms.memsize);
+    Cbuf_Init();
+    Cmd_Init();
+    COM_Init();
+    PR_Init();
+    Mod_Init(R_ModelLoader());
+    R_InitTextures();
+    net_message.data = Hunk_AllocName(NET_MAXMESSAGE, "bench");
+    net_message.maxsize = NET_MAXMESSAGE;
+    host_basepal = COM_LoadHunkFile("gfx/palette.lmp");
+    host_colormap = COM_LoadHunkFile("gfx/colormap.lmp");
+
+    /* the lens setup only needs doing once, so it has one run */
+    for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+	if (bench_only && strcmp(bench_only, benchmarks[i].name))
+	    continue;
+	for (run = 0; run < runs; run++) {
+	    bench_random = BENCH_SEED;
+	    benchmarks[i].run();
+	    if (benchmarks[i].run == Bench_Lenses)
+		break;
+	}
+    }
+
+    printf("%-40s %12s %10s\n", "benchmark", "ns/op", "ops");
+    for (i = 0; i < numresults; i++)
+	printf("%-40s %12.2f %10d\n", results[i].name,
+	       results[i].best * 1e9 / results[i].ops, results[i].ops);
+
+    return 0;
+}
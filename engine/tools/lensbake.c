@@ -0,0 +1,261 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/*
+ * lensbake.c -- build the lensmaps of the shipped lenses ahead of time
+ *
+ *	make lensbake
+ *	bin/tyr-lensbake -basedir ../game [-size <w>x<h>]... [-lens <name>]
+ *			 [-globe <name>] [-out <pak>]
+ *
+ * Links the objects of tyr-quake, without its main, and builds the lensmap
+ * of every lens in lua-scripts/lenses on every globe in lua-scripts/globes,
+ * at the zoom each lens starts with, for each view size.  They are written
+ * to the lens cache as the game would, then packed into
+ * lua-scripts/lenscache.pak, which the game searches after everything else,
+ * so a lens is on screen at once the first time it's used.
+ *
+ * The view size is that of the 3D view, so the default sizes only match a
+ * screen of that size with no status bar (viewsize 120).  A lensmap is only
+ * found again by the exact lens and globe scripts it was built from.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "fisheye.h"
+#include "host.h"
+#include "model.h"
+#include "quakedef.h"
+#include "r_local.h"
+#include "sys.h"
+#include "zone.h"
+
+#define MAX_NAMES	64
+#define MAX_SIZES	16
+#define MAX_BAKED	4096
+
+/* the pak format, as read by COM_LoadPackFile */
+#define PAK_NAME	56
+typedef struct {
+    char name[PAK_NAME];
+    int filepos, filelen;
+} pakfile_t;
+
+typedef struct {
+    char id[4];
+    int dirofs;
+    int dirlen;
+} pakheader_t;
+
+static const int default_sizes[][2] = {
+    { 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+};
+
+static char names[2][MAX_NAMES][MAX_QPATH];
+static int numnames[2];
+static char baked[MAX_BAKED][MAX_OSPATH];
+static int numbaked;
+
+static int
+Bake_CompareNames(const void *a, const void *b)
+{
+    return strcmp(a, b);
+}
+
+/* the script names in a directory under lua-scripts, in order */
+static int
+Bake_ScanScripts(const char *dir, char list[MAX_NAMES][MAX_QPATH])
+{
+    char path[MAX_OSPATH];
+    struct dirent *entry;
+    DIR *d;
+    int count = 0;
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s/lua-scripts/%s", com_basedir, dir);
+    d = opendir(path);
+    if (!d)
+	Sys_Error("Couldn't read %s", path);
+    while ((entry = readdir(d)) && count < MAX_NAMES) {
+	len = strlen(entry->d_name);
+	if (len < 5 || len - 4 >= MAX_QPATH
+	    || strcmp(entry->d_name + len - 4, ".lua"))
+	    continue;
+	memcpy(list[count], entry->d_name, len - 4);
+	list[count][len - 4] = 0;
+	count++;
+    }
+    closedir(d);
+    qsort(list, count, MAX_QPATH, Bake_CompareNames);
+
+    return count;
+}
+
+static void
+Bake_Saved(const char *filename)
+{
+    int i;
+
+    for (i = 0; i < numbaked; i++)
+	if (!strcmp(baked[i], filename))
+	    return;
+    if (numbaked == MAX_BAKED)
+	Sys_Error("More than %d lensmaps", MAX_BAKED);
+    snprintf(baked[numbaked++], MAX_OSPATH, "%s", filename);
+}
+
+static void
+Bake_WritePak(const char *pakname)
+{
+    static pakfile_t directory[MAX_BAKED];
+    static byte buffer[65536];
+    pakheader_t header;
+    const char *base;
+    FILE *pak, *f;
+    size_t len;
+    int i, pos;
+
+    pak = fopen(pakname, "wb");
+    if (!pak)
+	Sys_Error("Couldn't write %s", pakname);
+
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, pak);
+    pos = sizeof(header);
+
+    memset(directory, 0, sizeof(directory));
+    for (i = 0; i < numbaked; i++) {
+	f = fopen(baked[i], "rb");
+	if (!f)
+	    Sys_Error("Couldn't read %s", baked[i]);
+	base = strrchr(baked[i], '/');
+	base = base ? base + 1 : baked[i];
+	snprintf(directory[i].name, PAK_NAME, "lenscache/%s", base);
+	directory[i].filepos = LittleLong(pos);
+	while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+	    fwrite(buffer, 1, len, pak);
+	    pos += len;
+	}
+	directory[i].filelen = LittleLong(pos - LittleLong(directory[i].filepos));
+	fclose(f);
+    }
+
+    memcpy(header.id, "PACK", 4);
+    header.dirofs = LittleLong(pos);
+    header.dirlen = LittleLong(numbaked * sizeof(pakfile_t));
+    fwrite(directory, sizeof(pakfile_t), numbaked, pak);
+    fseek(pak, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, pak);
+    if (fclose(pak))
+	Sys_Error("Couldn't write %s", pakname);
+
+    printf("%s: %d lensmaps, %d bytes\n", pakname, numbaked,
+	   pos + numbaked * (int)sizeof(pakfile_t));
+}
+
+int
+main(int argc, const char *argv[])
+{
+    quakeparms_t parms;
+    int sizes[MAX_SIZES][2];
+    int numsizes = 0;
+    const char *only[2];
+    char pakname[MAX_OSPATH];
+    int i, lens, globe, size, count;
+
+    memset(&parms, 0, sizeof(parms));
+    COM_InitArgv(argc, argv);
+    parms.argc = com_argc;
+    parms.argv = com_argv;
+    parms.basedir = stringify(QBASEDIR);
+    parms.memsize = Memory_GetSize();
+    parms.membase = Memory_Reserve(&parms.memsize);
+    if (!parms.membase)
+	Sys_Error("Allocation of %d byte heap failed", parms.memsize);
+    host_parms = parms;
+
+    for (i = 1; i < com_argc - 1; i++) {
+	if (strcmp(com_argv[i], "-size") || numsizes == MAX_SIZES)
+	    continue;
+	if (sscanf(com_argv[i + 1], "%dx%d", &sizes[numsizes][0],
+		   &sizes[numsizes][1]) == 2
+	    && sizes[numsizes][0] > 0 && sizes[numsizes][1] > 0)
+	    numsizes++;
+    }
+    if (!numsizes) {
+	numsizes = ARRAY_SIZE(default_sizes);
+	memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+    i = COM_CheckParm("-lens");
+    only[0] = i && i < com_argc - 1 ? com_argv[i + 1] : NULL;
+    i = COM_CheckParm("-globe");
+    only[1] = i && i < com_argc - 1 ? com_argv[i + 1] : NULL;
+
+    Sys_Init();
+    Memory_Init(parms.membase, parms.memsize);
+    Cbuf_Init();
+    Cmd_Init();
+    COM_Init();
+    Mod_Init(R_ModelLoader());
+    R_InitTextures();
+    host_basepal = COM_LoadHunkFile("gfx/palette.lmp");
+    host_colormap = COM_LoadHunkFile("gfx/colormap.lmp");
+    if (!host_basepal)
+	Sys_Error("Couldn't load gfx/palette.lmp");
+
+    i = COM_CheckParm("-out");
+    if (i && i < com_argc - 1)
+	snprintf(pakname, sizeof(pakname), "%s", com_argv[i + 1]);
+    else
+	snprintf(pakname, sizeof(pakname), "%s/lua-scripts/lenscache.pak",
+		 com_basedir);
+
+    numnames[0] = Bake_ScanScripts("lenses", names[0]);
+    numnames[1] = Bake_ScanScripts("globes", names[1]);
+
+    F_Init();
+    for (lens = 0; lens < numnames[0]; lens++) {
+	if (only[0] && strcmp(only[0], names[0][lens]))
+	    continue;
+	for (globe = 0; globe < numnames[1]; globe++) {
+	    if (only[1] && strcmp(only[1], names[1][globe]))
+		continue;
+	    for (size = 0; size < numsizes; size++) {
+		count = F_BakeLensmap(names[0][lens], names[1][globe],
+				      sizes[size][0], sizes[size][1],
+				      Bake_Saved);
+		printf("%s on %s at %dx%d: %s\n", names[0][lens],
+		       names[1][globe], sizes[size][0], sizes[size][1],
+		       count ? "baked" : "not supported");
+	    }
+	}
+    }
+
+    if (!numbaked)
+	Sys_Error("No lensmaps were baked");
+    Bake_WritePak(pakname);
+
+    return 0;
+}
@@ -0,0 +1,772 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/*
+ * mvdpov.c -- pick one player's view out of a server demo
+ *
+ *	tyr-mvdpov game.qwm game.qwd <playernum>
+ *
+ * qwsv's mvdrecord keeps every player in one .qwm (see protocol.h).  This
+ * writes a .qwd the client plays back as if that player had recorded it:
+ * the signon goes through with the player number patched in, and each frame
+ * becomes one packet with the player's stats, every player's playerinfo and
+ * the entities around the player.
+ *
+ * The server demo doesn't say what each player could see, so the entities
+ * sent are the brush models and then the nearest of the rest, as many as
+ * fit in a packet (and at most MAX_PACKET_ENTITIES, like the server).
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "protocol.h"
+
+/* the client demo blocks, as in cl_demo.c */
+#define dem_cmd		0
+#define dem_read	1
+#define dem_set		2
+
+#define MAX_DEMO_ENTS	512
+#define PACKET_DATA	(MAX_MSGLEN - 8)	// after the sequence numbers
+#define MAX_DELTA	17			// most an entity update takes
+
+typedef struct {
+    const byte *p, *end;
+} reader_t;
+
+typedef struct {
+    int flags;
+    vec3_t origin;
+    int frame;
+    usercmd_t cmd;
+    int velocity[3];
+    int modelindex, skinnum, effects, weaponframe;
+} player_t;
+
+typedef struct {
+    byte data[PACKET_DATA];
+    int length;
+} packet_t;
+
+static FILE *out;
+static int pov;
+static int outgoing = 1;	// the next client frame
+static vec3_t viewangles;
+static vec3_t vieworg;
+static float lastframetime;
+static qboolean seen;		// the view player was in a frame
+
+static qboolean brushmodel[256];
+static entity_state_t baselines[MAX_DEMO_ENTS];
+static entity_state_t states[MAX_DEMO_ENTS];
+static qboolean active[MAX_DEMO_ENTS];
+
+static packet_t pending;	// messages for everyone, not yet written
+
+static void
+Error(const char *error, ...)
+{
+    va_list argptr;
+
+    fprintf(stderr, "tyr-mvdpov: ");
+    va_start(argptr, error);
+    vfprintf(stderr, error, argptr);
+    va_end(argptr);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*
+ * ===========================================================================
+ * READING
+ * ===========================================================================
+ */
+
+static const byte *
+Need(reader_t *r, int length)
+{
+    const byte *p = r->p;
+
+    if (r->end - r->p < length)
+	Error("demo is truncated or corrupt");
+    r->p += length;
+
+    return p;
+}
+
+static int
+ReadByte(reader_t *r)
+{
+    return *Need(r, 1);
+}
+
+static int
+ReadShort(reader_t *r)
+{
+    return MSG_GetShort(Need(r, 2));
+}
+
+static int
+ReadLong(reader_t *r)
+{
+    const byte *p = Need(r, 4);
+
+    return p[0] + (p[1] << 8) + (p[2] << 16) + ((unsigned)p[3] << 24);
+}
+
+static float
+ReadFloat(reader_t *r)
+{
+    union {
+	float f;
+	int l;
+    } u;
+
+    u.l = ReadLong(r);
+    return u.f;
+}
+
+static float
+ReadCoord(reader_t *r)
+{
+    return MSG_GetCoord(Need(r, 2));
+}
+
+static float
+ReadAngle(reader_t *r)
+{
+    return MSG_GetChar(Need(r, 1)) * (360.0 / 256);
+}
+
+static float
+ReadAngle16(reader_t *r)
+{
+    return ReadShort(r) * (360.0 / 65536);
+}
+
+static const char *
+ReadString(reader_t *r)
+{
+    const byte *s = r->p;
+
+    while (*Need(r, 1))
+	;
+    return (const char *)s;
+}
+
+/* as MSG_ReadDeltaUsercmd, from the null command */
+static void
+ReadUsercmd(reader_t *r, usercmd_t *cmd)
+{
+    int bits;
+
+    memset(cmd, 0, sizeof(*cmd));
+    bits = ReadByte(r);
+    if (bits & CM_ANGLE1)
+	cmd->angles[0] = ReadAngle16(r);
+    if (bits & CM_ANGLE2)
+	cmd->angles[1] = ReadAngle16(r);
+    if (bits & CM_ANGLE3)
+	cmd->angles[2] = ReadAngle16(r);
+    if (bits & CM_FORWARD)
+	cmd->forwardmove = ReadShort(r);
+    if (bits & CM_SIDE)
+	cmd->sidemove = ReadShort(r);
+    if (bits & CM_UP)
+	cmd->upmove = ReadShort(r);
+    if (bits & CM_BUTTONS)
+	cmd->buttons = ReadByte(r);
+    if (bits & CM_IMPULSE)
+	cmd->impulse = ReadByte(r);
+    cmd->msec = ReadByte(r);
+}
+
+/* as CL_ParseDelta */
+static void
+ReadDelta(reader_t *r, const entity_state_t *from, entity_state_t *to,
+	  int bits)
+{
+    *to = *from;
+    to->number = bits & 511;
+    bits &= ~511;
+    if (bits & U_MOREBITS)
+	bits |= ReadByte(r);
+    to->flags = bits;
+
+    if (bits & U_MODEL)
+	to->modelindex = ReadByte(r);
+    if (bits & U_FRAME)
+	to->frame = ReadByte(r);
+    if (bits & U_COLORMAP)
+	to->colormap = ReadByte(r);
+    if (bits & U_SKIN)
+	to->skinnum = ReadByte(r);
+    if (bits & U_EFFECTS)
+	to->effects = ReadByte(r);
+    if (bits & U_ORIGIN1)
+	to->origin[0] = ReadCoord(r);
+    if (bits & U_ANGLE1)
+	to->angles[0] = ReadAngle(r);
+    if (bits & U_ORIGIN2)
+	to->origin[1] = ReadCoord(r);
+    if (bits & U_ANGLE2)
+	to->angles[1] = ReadAngle(r);
+    if (bits & U_ORIGIN3)
+	to->origin[2] = ReadCoord(r);
+    if (bits & U_ANGLE3)
+	to->angles[2] = ReadAngle(r);
+}
+
+static void
+ReadPlayerInfo(reader_t *r, player_t *player)
+{
+    int i;
+
+    memset(player, 0, sizeof(*player));
+    player->flags = ReadShort(r) & 0xffff;
+    for (i = 0; i < 3; i++)
+	player->origin[i] = ReadCoord(r);
+    player->frame = ReadByte(r);
+    if (player->flags & PF_MSEC)
+	ReadByte(r);
+    if (player->flags & PF_COMMAND)
+	ReadUsercmd(r, &player->cmd);
+    for (i = 0; i < 3; i++)
+	if (player->flags & (PF_VELOCITY1 << i))
+	    player->velocity[i] = ReadShort(r);
+    if (player->flags & PF_MODEL)
+	player->modelindex = ReadByte(r);
+    if (player->flags & PF_SKINNUM)
+	player->skinnum = ReadByte(r);
+    if (player->flags & PF_EFFECTS)
+	player->effects = ReadByte(r);
+    if (player->flags & PF_WEAPONFRAME)
+	player->weaponframe = ReadByte(r);
+}
+
+/*
+ * ===========================================================================
+ * WRITING
+ * ===========================================================================
+ */
+
+static void
+Write(const void *data, int length)
+{
+    if (fwrite(data, 1, length, out) != length)
+	Error("error writing the demo");
+}
+
+static void
+WriteHeader(float time, int command)
+{
+    union {
+	float f;
+	int l;
+    } u;
+    byte header[5];
+
+    u.f = time;
+    MSG_PutByte(MSG_PutLong(header, u.l), command);
+    Write(header, sizeof(header));
+}
+
+static void
+WriteSet(float time)
+{
+    byte set[8];
+
+    WriteHeader(time, dem_set);
+    MSG_PutLong(MSG_PutLong(set, outgoing), outgoing - 1);
+    Write(set, sizeof(set));
+}
+
+/* the client reads the command back as a raw usercmd_t */
+static void
+WriteCmd(float time, int msec)
+{
+    usercmd_t cmd;
+    byte angles[12], *p;
+    union {
+	float f;
+	int l;
+    } u;
+    int i;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.msec = msec;
+    VectorCopy(viewangles, cmd.angles);
+
+    WriteHeader(time, dem_cmd);
+    Write(&cmd, sizeof(cmd));
+    for (i = 0, p = angles; i < 3; i++) {
+	u.f = viewangles[i];
+	p = MSG_PutLong(p, u.l);
+    }
+    Write(angles, sizeof(angles));
+}
+
+static void
+WriteRead(float time, int sequence, const void *data, int length)
+{
+    byte header[12];
+
+    WriteHeader(time, dem_read);
+    MSG_PutLong(MSG_PutLong(MSG_PutLong(header, length + 8), sequence),
+		sequence);
+    Write(header, sizeof(header));
+    Write(data, length);
+}
+
+/* a packet the client takes as the reply to a command of its own */
+static void
+WriteFrame(float time, int msec, const void *data, int length)
+{
+    WriteCmd(time, msec);
+    WriteRead(time, outgoing++, data, length);
+}
+
+static void
+FlushPending(float time)
+{
+    if (pending.length) {
+	WriteFrame(time, 0, pending.data, pending.length);
+	pending.length = 0;
+    }
+}
+
+/* as SV_WriteDelta, always forced */
+static byte *
+PutDelta(byte *p, const entity_state_t *from, const entity_state_t *to)
+{
+    float miss;
+    int bits, i;
+
+    bits = 0;
+    for (i = 0; i < 3; i++) {
+	miss = to->origin[i] - from->origin[i];
+	if (miss < -0.1 || miss > 0.1)
+	    bits |= U_ORIGIN1 << i;
+    }
+    if (to->angles[0] != from->angles[0])
+	bits |= U_ANGLE1;
+    if (to->angles[1] != from->angles[1])
+	bits |= U_ANGLE2;
+    if (to->angles[2] != from->angles[2])
+	bits |= U_ANGLE3;
+    if (to->colormap != from->colormap)
+	bits |= U_COLORMAP;
+    if (to->skinnum != from->skinnum)
+	bits |= U_SKIN;
+    if (to->frame != from->frame)
+	bits |= U_FRAME;
+    if (to->effects != from->effects)
+	bits |= U_EFFECTS;
+    if (to->modelindex != from->modelindex)
+	bits |= U_MODEL;
+    if (bits & 511)
+	bits |= U_MOREBITS;
+    if (to->flags & U_SOLID)
+	bits |= U_SOLID;
+
+    p = MSG_PutShort(p, to->number | (bits & ~511));
+    if (bits & U_MOREBITS)
+	p = MSG_PutByte(p, bits & 255);
+    if (bits & U_MODEL)
+	p = MSG_PutByte(p, to->modelindex);
+    if (bits & U_FRAME)
+	p = MSG_PutByte(p, to->frame);
+    if (bits & U_COLORMAP)
+	p = MSG_PutByte(p, to->colormap);
+    if (bits & U_SKIN)
+	p = MSG_PutByte(p, to->skinnum);
+    if (bits & U_EFFECTS)
+	p = MSG_PutByte(p, to->effects);
+    if (bits & U_ORIGIN1)
+	p = MSG_PutCoord(p, to->origin[0]);
+    if (bits & U_ANGLE1)
+	p = MSG_PutAngle(p, to->angles[0]);
+    if (bits & U_ORIGIN2)
+	p = MSG_PutCoord(p, to->origin[1]);
+    if (bits & U_ANGLE2)
+	p = MSG_PutAngle(p, to->angles[1]);
+    if (bits & U_ORIGIN3)
+	p = MSG_PutCoord(p, to->origin[2]);
+    if (bits & U_ANGLE3)
+	p = MSG_PutAngle(p, to->angles[2]);
+
+    return p;
+}
+
+/* the view player, as the server sends a player itself */
+static byte *
+PutPlayerInfo(byte *p, const player_t *player)
+{
+    int i, flags;
+
+    flags = player->flags & ~(PF_MSEC | PF_COMMAND);
+    p = MSG_PutByte(p, svc_playerinfo);
+    p = MSG_PutByte(p, pov);
+    p = MSG_PutShort(p, flags);
+    p = MSG_PutCoords3(p, player->origin);
+    p = MSG_PutByte(p, player->frame);
+    for (i = 0; i < 3; i++)
+	if (flags & (PF_VELOCITY1 << i))
+	    p = MSG_PutShort(p, player->velocity[i]);
+    if (flags & PF_MODEL)
+	p = MSG_PutByte(p, player->modelindex);
+    if (flags & PF_SKINNUM)
+	p = MSG_PutByte(p, player->skinnum);
+    if (flags & PF_EFFECTS)
+	p = MSG_PutByte(p, player->effects);
+    if (flags & PF_WEAPONFRAME)
+	p = MSG_PutByte(p, player->weaponframe);
+
+    return p;
+}
+
+/*
+ * ===========================================================================
+ * BLOCKS
+ * ===========================================================================
+ */
+
+static void
+ParseModellist(reader_t *r)
+{
+    const char *name;
+    int i;
+
+    ReadByte(r);
+    i = ReadByte(r) + 1;
+    while (*(name = ReadString(r))) {
+	if (i < 256)
+	    brushmodel[i] = name[0] == '*';
+	i++;
+    }
+}
+
+static void
+ParseSignon(float time, const byte *data, int length)
+{
+    reader_t r = { data, data + length };
+    byte *buf;
+
+    if (length > PACKET_DATA)
+	Error("signon block too long (%d bytes)", length);
+
+    FlushPending(time);
+    buf = malloc(length ? length : 1);
+    if (!buf)
+	Error("out of memory");
+    memcpy(buf, data, length);
+
+    if (length && data[0] == svc_serverdata) {
+	/* playernum follows the protocol, spawncount and gamedir */
+	Need(&r, 9);
+	ReadString(&r);
+	Need(&r, 1);
+	buf[r.p - 1 - data] = pov;
+
+	memset(brushmodel, 0, sizeof(brushmodel));
+	memset(baselines, 0, sizeof(baselines));
+	memset(active, 0, sizeof(active));
+    } else if (length && data[0] == svc_modellist) {
+	ParseModellist(&r);
+    }
+
+    WriteRead(time, outgoing++, buf, length);
+    WriteSet(time);
+    free(buf);
+}
+
+static void
+ParseBaselines(const byte *data, int length)
+{
+    reader_t r = { data, data + length };
+    entity_state_t *base;
+    int i, num;
+
+    while (r.p < r.end) {
+	num = ReadShort(&r);
+	if (num < 0 || num >= MAX_DEMO_ENTS)
+	    Error("bad baseline number %d", num);
+	base = &baselines[num];
+	base->number = num;
+	base->modelindex = ReadByte(&r);
+	base->frame = ReadByte(&r);
+	base->colormap = ReadByte(&r);
+	base->skinnum = ReadByte(&r);
+	for (i = 0; i < 3; i++) {
+	    base->origin[i] = ReadCoord(&r);
+	    base->angles[i] = ReadAngle(&r);
+	}
+    }
+}
+
+static void
+ParseAll(float time, const byte *data, int length)
+{
+    if (length > PACKET_DATA)
+	Error("message block too long (%d bytes)", length);
+    if (pending.length + length > PACKET_DATA)
+	FlushPending(time);
+    memcpy(pending.data + pending.length, data, length);
+    pending.length += length;
+}
+
+typedef struct {
+    int number;
+    float distance;
+} nearby_t;
+
+static int
+NearbyCmp(const void *a, const void *b)
+{
+    const nearby_t *na = a, *nb = b;
+
+    if (na->distance != nb->distance)
+	return na->distance < nb->distance ? -1 : 1;
+    return na->number - nb->number;
+}
+
+static int
+NumberCmp(const void *a, const void *b)
+{
+    return ((const nearby_t *)a)->number - ((const nearby_t *)b)->number;
+}
+
+static void
+ParseFrame(float time, const byte *data, int length)
+{
+    reader_t r = { data, data + length };
+    static packet_t frame;
+    static nearby_t nearby[MAX_DEMO_ENTS];
+    player_t player;
+    vec3_t delta;
+    const byte *start;
+    byte update[MAX_DELTA], *p, *end;
+    unsigned changed;
+    int i, j, count, num, bits, numnearby, room, msec;
+
+    p = frame.data;
+    end = frame.data + sizeof(frame.data) - 3;
+
+    /* players, kept as they are but for the view player */
+    count = ReadByte(&r);
+    for (i = 0; i < count; i++) {
+	start = r.p;
+	if (ReadByte(&r) != svc_playerinfo)
+	    Error("bad frame");
+	num = ReadByte(&r);
+	ReadPlayerInfo(&r, &player);
+	if (p + (r.p - start) > end)
+	    Error("too many players in a frame");
+	if (num != pov) {
+	    memcpy(p, start, r.p - start);
+	    p += r.p - start;
+	    continue;
+	}
+	p = PutPlayerInfo(p, &player);
+	VectorCopy(player.origin, vieworg);
+	if (player.flags & PF_COMMAND)
+	    VectorCopy(player.cmd.angles, viewangles);
+	seen = true;
+    }
+
+    /* stats, only the view player's go to the client */
+    count = ReadByte(&r);
+    for (i = 0; i < count; i++) {
+	num = ReadByte(&r);
+	changed = ReadLong(&r);
+	for (j = 0; j < MAX_CL_STATS; j++) {
+	    if (!(changed & (1U << j)))
+		continue;
+	    bits = ReadLong(&r);
+	    if (num != pov)
+		continue;
+	    if (p + 6 > end)
+		Error("too many stats in a frame");
+	    p = MSG_PutByte(p, svc_updatestatlong);
+	    p = MSG_PutByte(p, j);
+	    p = MSG_PutLong(p, bits);
+	}
+    }
+
+    /* entities */
+    for (;;) {
+	bits = ReadShort(&r) & 0xffff;
+	if (!bits)
+	    break;
+	num = bits & 511;
+	if (bits & U_REMOVE) {
+	    active[num] = false;
+	    continue;
+	}
+	ReadDelta(&r, active[num] ? &states[num] : &baselines[num],
+		  &states[num], bits);
+	active[num] = true;
+    }
+
+    numnearby = 0;
+    for (i = 0; i < MAX_DEMO_ENTS; i++) {
+	if (!active[i])
+	    continue;
+	nearby[numnearby].number = i;
+	if (brushmodel[states[i].modelindex]) {
+	    nearby[numnearby].distance = -1;
+	} else {
+	    VectorSubtract(states[i].origin, vieworg, delta);
+	    nearby[numnearby].distance = DotProduct(delta, delta);
+	}
+	numnearby++;
+    }
+    qsort(nearby, numnearby, sizeof(nearby[0]), NearbyCmp);
+
+    room = end - p;
+    for (i = 0, count = 0; i < numnearby && count < MAX_PACKET_ENTITIES; i++) {
+	num = nearby[i].number;
+	bits = PutDelta(update, &baselines[num], &states[num]) - update;
+	if (bits > room)
+	    continue;
+	room -= bits;
+	nearby[count++] = nearby[i];
+    }
+    qsort(nearby, count, sizeof(nearby[0]), NumberCmp);
+
+    p = MSG_PutByte(p, svc_packetentities);
+    for (i = 0; i < count; i++) {
+	num = nearby[i].number;
+	p = PutDelta(p, &baselines[num], &states[num]);
+    }
+    p = MSG_PutShort(p, 0);
+    frame.length = p - frame.data;
+
+    msec = (time - lastframetime) * 1000;
+    msec = msec < 0 ? 0 : msec > 255 ? 255 : msec;
+    lastframetime = time;
+
+    if (pending.length + frame.length <= PACKET_DATA) {
+	memcpy(pending.data + pending.length, frame.data, frame.length);
+	pending.length += frame.length;
+	WriteFrame(time, msec, pending.data, pending.length);
+	pending.length = 0;
+    } else {
+	FlushPending(time);
+	WriteFrame(time, msec, frame.data, frame.length);
+    }
+}
+
+static byte *
+LoadFile(const char *path, int *length)
+{
+    FILE *f;
+    byte *data;
+    long size;
+
+    f = fopen(path, "rb");
+    if (!f)
+	Error("couldn't open %s", path);
+    if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0)
+	Error("couldn't read %s", path);
+    rewind(f);
+    data = malloc(size ? size : 1);
+    if (!data)
+	Error("out of memory");
+    if (fread(data, 1, size, f) != size)
+	Error("couldn't read %s", path);
+    fclose(f);
+
+    *length = size;
+    return data;
+}
+
+int
+main(int argc, char **argv)
+{
+    reader_t r;
+    byte *data;
+    const byte *block;
+    float time;
+    int length, type, blocklength, frames;
+
+    if (argc != 4) {
+	fprintf(stderr, "usage: tyr-mvdpov <demo.qwm> <demo.qwd> <player>\n");
+	return 1;
+    }
+    pov = atoi(argv[3]);
+    if (pov < 0 || pov >= MAX_CLIENTS)
+	Error("player must be from 0 to %d", MAX_CLIENTS - 1);
+
+    data = LoadFile(argv[1], &length);
+    r.p = data;
+    r.end = data + length;
+    if (memcmp(Need(&r, 4), MVD_MAGIC, 4))
+	Error("%s is not a server demo", argv[1]);
+    if (ReadLong(&r) != MVD_VERSION)
+	Error("%s is an unknown version of server demo", argv[1]);
+
+    out = fopen(argv[2], "wb");
+    if (!out)
+	Error("couldn't open %s", argv[2]);
+
+    frames = 0;
+    time = 0;
+    while (r.p < r.end) {
+	time = ReadFloat(&r);
+	type = ReadByte(&r);
+	blocklength = ReadLong(&r);
+	if (blocklength < 0)
+	    Error("demo is corrupt");
+	block = Need(&r, blocklength);
+
+	switch (type) {
+	case mvd_signon:
+	    ParseSignon(time, block, blocklength);
+	    break;
+	case mvd_baselines:
+	    ParseBaselines(block, blocklength);
+	    break;
+	case mvd_all:
+	    ParseAll(time, block, blocklength);
+	    break;
+	case mvd_frame:
+	    ParseFrame(time, block, blocklength);
+	    frames++;
+	    break;
+	default:
+	    Error("unknown block type %d", type);
+	}
+    }
+    FlushPending(time);
+
+    if (fclose(out))
+	Error("error writing %s", argv[2]);
+    free(data);
+
+    if (!seen)
+	fprintf(stderr, "tyr-mvdpov: player %d isn't in the demo\n", pov);
+    printf("%d frames\n", frames);
+
+    return 0;
+}
@@ -0,0 +1,543 @@
+/*
+Copyright (C) 1996-1997 Id Software, Inc.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+/*
+ * progs2c.c -- translate a progs.dat into C for the engine to load
+ *
+ *	tyr-progs2c progs.dat progs.c
+ *	cc -O2 -shared -fPIC -I engine/include -o progs.so progs.c
+ *
+ * Put progs.so in the game directory and start the server with
+ * -nativeprogs progs.so.  The engine only uses it with the progs.dat it was
+ * built from, and interprets the progs as usual otherwise.
+ *
+ * Each QuakeC function becomes a C function with a label on each statement
+ * that is jumped to.  Calls, builtins and the function entry and exit go
+ * back through the engine (see pr_native.h).
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pr_comp.h"
+#include "pr_native.h"
+
+static void
+Error(const char *error, ...)
+{
+    va_list argptr;
+
+    fprintf(stderr, "tyr-progs2c: ");
+    va_start(argptr, error);
+    vfprintf(stderr, error, argptr);
+    va_end(argptr);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*
+ * ===========================================================================
+ * LOADING
+ * ===========================================================================
+ */
+
+static byte *file;
+static long filesize;
+
+static int32_t
+GetLong(long offset)
+{
+    const byte *p;
+
+    if (offset < 0 || offset + 4 > filesize)
+	Error("progs.dat is truncated");
+    p = file + offset;
+
+    return (int32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static int16_t
+GetShort(long offset)
+{
+    if (offset < 0 || offset + 2 > filesize)
+	Error("progs.dat is truncated");
+
+    return (int16_t)(file[offset] | (file[offset + 1] << 8));
+}
+
+static dprograms_t progs;
+static dstatement_t *statements;
+static dfunction_t *functions;
+
+/* same as CRC_Block in the engine (CCITT, as used by XMODEM) */
+static unsigned short
+FileCRC(void)
+{
+    unsigned short crc;
+    long i;
+    int bit;
+
+    crc = 0xffff;
+    for (i = 0; i < filesize; i++) {
+	crc ^= file[i] << 8;
+	for (bit = 0; bit < 8; bit++)
+	    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+static void
+LoadProgs(const char *filename)
+{
+    FILE *f;
+    long ofs;
+    int i, j;
+
+    f = fopen(filename, "rb");
+    if (!f)
+	Error("couldn't open %s", filename);
+    fseek(f, 0, SEEK_END);
+    filesize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file = malloc(filesize ? filesize : 1);
+    if (!file || fread(file, 1, filesize, f) != (size_t)filesize)
+	Error("couldn't read %s", filename);
+    fclose(f);
+
+    for (i = 0; i < sizeof(progs) / 4; i++)
+	((int32_t *)&progs)[i] = GetLong(i * 4);
+    if (progs.version != PROG_VERSION)
+	Error("%s has wrong version number (%i should be %i)", filename,
+	      progs.version, PROG_VERSION);
+    if (progs.numstatements <= 0 || progs.numfunctions <= 0)
+	Error("%s has no code", filename);
+
+    statements = calloc(progs.numstatements, sizeof(*statements));
+    functions = calloc(progs.numfunctions, sizeof(*functions));
+    if (!statements || !functions)
+	Error("out of memory");
+
+    ofs = progs.ofs_statements;
+    for (i = 0; i < progs.numstatements; i++, ofs += 8) {
+	statements[i].op = (uint16_t)GetShort(ofs);
+	statements[i].a = GetShort(ofs + 2);
+	statements[i].b = GetShort(ofs + 4);
+	statements[i].c = GetShort(ofs + 6);
+    }
+
+    ofs = progs.ofs_functions;
+    for (i = 0; i < progs.numfunctions; i++, ofs += sizeof(dfunction_t)) {
+	functions[i].first_statement = GetLong(ofs);
+	functions[i].s_name = GetLong(ofs + 16);
+	functions[i].s_file = GetLong(ofs + 20);
+	for (j = 0; j < MAX_PARMS; j++)
+	    functions[i].parm_size[j] = file[ofs + 28 + j];
+    }
+}
+
+static const char *
+GetString(int num)
+{
+    const char *s;
+    long ofs;
+
+    ofs = (long)progs.ofs_strings + num;
+    if (num < 0 || num >= progs.strings_size || ofs >= filesize)
+	return "?";
+    s = (const char *)file + ofs;
+
+    /* no way out of the comment */
+    return strstr(s, "*/") ? "?" : s;
+}
+
+/*
+ * ===========================================================================
+ * TRANSLATION
+ * ===========================================================================
+ */
+
+static FILE *out;
+static byte *jumptarget;
+
+/* The end of the statements belonging to function fnum */
+static int
+FunctionEnd(int fnum)
+{
+    int i, first, end;
+
+    first = functions[fnum].first_statement;
+    end = progs.numstatements;
+    for (i = 1; i < progs.numfunctions; i++) {
+	int s = functions[i].first_statement;
+	if (s > first && s < end)
+	    end = s;
+    }
+
+    return end;
+}
+
+static int
+JumpTarget(int s, int offset, int first, int end)
+{
+    int target = s + offset;
+
+    return (target >= first && target < end) ? target : -1;
+}
+
+static void
+WriteJump(int s, int target)
+{
+    if (target < 0) {
+	fprintf(out, "{ *x = %d; pr->runerror(\"jump out of function\");"
+		" return n; }\n", s);
+	return;
+    }
+    if (target <= s)
+	fprintf(out, "{ RUNAWAY(%d); goto s%d; }\n", s, target);
+    else
+	fprintf(out, "goto s%d;\n", target);
+}
+
+#define A	st->a
+#define B	st->b
+#define C	st->c
+
+static void
+WriteStatement(int s, int first, int end)
+{
+    const dstatement_t *st = &statements[s];
+    int i, target;
+
+    if (jumptarget[s - first])
+	fprintf(out, "s%d:\n", s);
+    fprintf(out, "    n++; ");
+
+    switch (st->op) {
+    case OP_ADD_F:
+	fprintf(out, "g[%d].f = g[%d].f + g[%d].f;\n", C, A, B);
+	break;
+    case OP_SUB_F:
+	fprintf(out, "g[%d].f = g[%d].f - g[%d].f;\n", C, A, B);
+	break;
+    case OP_MUL_F:
+	fprintf(out, "g[%d].f = g[%d].f * g[%d].f;\n", C, A, B);
+	break;
+    case OP_DIV_F:
+	fprintf(out, "g[%d].f = g[%d].f / g[%d].f;\n", C, A, B);
+	break;
+    case OP_ADD_V:
+    case OP_SUB_V:
+	for (i = 0; i < 3; i++)
+	    fprintf(out, "g[%d].f = g[%d].f %c g[%d].f; ", C + i, A + i,
+		    st->op == OP_ADD_V ? '+' : '-', B + i);
+	fprintf(out, "\n");
+	break;
+    case OP_MUL_V:
+	fprintf(out, "g[%d].f = g[%d].f * g[%d].f + g[%d].f * g[%d].f"
+		" + g[%d].f * g[%d].f;\n", C, A, B, A + 1, B + 1, A + 2, B + 2);
+	break;
+    case OP_MUL_FV:
+	for (i = 0; i < 3; i++)
+	    fprintf(out, "g[%d].f = g[%d].f * g[%d].f; ", C + i, A, B + i);
+	fprintf(out, "\n");
+	break;
+    case OP_MUL_VF:
+	for (i = 0; i < 3; i++)
+	    fprintf(out, "g[%d].f = g[%d].f * g[%d].f; ", C + i, B, A + i);
+	fprintf(out, "\n");
+	break;
+    case OP_BITAND:
+	fprintf(out, "g[%d].f = (int)g[%d].f & (int)g[%d].f;\n", C, A, B);
+	break;
+    case OP_BITOR:
+	fprintf(out, "g[%d].f = (int)g[%d].f | (int)g[%d].f;\n", C, A, B);
+	break;
+    case OP_GE:
+	fprintf(out, "g[%d].f = g[%d].f >= g[%d].f;\n", C, A, B);
+	break;
+    case OP_LE:
+	fprintf(out, "g[%d].f = g[%d].f <= g[%d].f;\n", C, A, B);
+	break;
+    case OP_GT:
+	fprintf(out, "g[%d].f = g[%d].f > g[%d].f;\n", C, A, B);
+	break;
+    case OP_LT:
+	fprintf(out, "g[%d].f = g[%d].f < g[%d].f;\n", C, A, B);
+	break;
+    case OP_AND:
+	fprintf(out, "g[%d].f = g[%d].f && g[%d].f;\n", C, A, B);
+	break;
+    case OP_OR:
+	fprintf(out, "g[%d].f = g[%d].f || g[%d].f;\n", C, A, B);
+	break;
+    case OP_NOT_F:
+	fprintf(out, "g[%d].f = !g[%d].f;\n", C, A);
+	break;
+    case OP_NOT_V:
+	fprintf(out, "g[%d].f = !g[%d].f && !g[%d].f && !g[%d].f;\n",
+		C, A, A + 1, A + 2);
+	break;
+    case OP_NOT_S:
+	fprintf(out, "g[%d].f = !g[%d].i || !*pr->getstring(g[%d].i);\n",
+		C, A, A);
+	break;
+    case OP_NOT_FNC:
+    case OP_NOT_ENT:
+	fprintf(out, "g[%d].f = !g[%d].i;\n", C, A);
+	break;
+    case OP_EQ_F:
+	fprintf(out, "g[%d].f = g[%d].f == g[%d].f;\n", C, A, B);
+	break;
+    case OP_NE_F:
+	fprintf(out, "g[%d].f = g[%d].f != g[%d].f;\n", C, A, B);
+	break;
+    case OP_EQ_V:
+	fprintf(out, "g[%d].f = g[%d].f == g[%d].f && g[%d].f == g[%d].f"
+		" && g[%d].f == g[%d].f;\n", C, A, B, A + 1, B + 1, A + 2, B + 2);
+	break;
+    case OP_NE_V:
+	fprintf(out, "g[%d].f = g[%d].f != g[%d].f || g[%d].f != g[%d].f"
+		" || g[%d].f != g[%d].f;\n", C, A, B, A + 1, B + 1, A + 2, B + 2);
+	break;
+    case OP_EQ_S:
+	fprintf(out, "g[%d].f = !strcmp(pr->getstring(g[%d].i),"
+		" pr->getstring(g[%d].i));\n", C, A, B);
+	break;
+    case OP_NE_S:
+	fprintf(out, "g[%d].f = strcmp(pr->getstring(g[%d].i),"
+		" pr->getstring(g[%d].i)) != 0;\n", C, A, B);
+	break;
+    case OP_EQ_E:
+    case OP_EQ_FNC:
+	fprintf(out, "g[%d].f = g[%d].i == g[%d].i;\n", C, A, B);
+	break;
+    case OP_NE_E:
+    case OP_NE_FNC:
+	fprintf(out, "g[%d].f = g[%d].i != g[%d].i;\n", C, A, B);
+	break;
+
+    case OP_STORE_F:
+    case OP_STORE_ENT:
+    case OP_STORE_FLD:
+    case OP_STORE_S:
+    case OP_STORE_FNC:
+	fprintf(out, "g[%d].i = g[%d].i;\n", B, A);
+	break;
+    case OP_STORE_V:
+	fprintf(out, "g[%d].i = g[%d].i; g[%d].i = g[%d].i;"
+		" g[%d].i = g[%d].i;\n", B, A, B + 1, A + 1, B + 2, A + 2);
+	break;
+    case OP_STOREP_F:
+    case OP_STOREP_ENT:
+    case OP_STOREP_FLD:
+    case OP_STOREP_S:
+    case OP_STOREP_FNC:
+	fprintf(out, "POINTER(%d)[0].i = g[%d].i;\n", B, A);
+	break;
+    case OP_STOREP_V:
+	fprintf(out, "p = POINTER(%d); p[0].i = g[%d].i; p[1].i = g[%d].i;"
+		" p[2].i = g[%d].i;\n", B, A, A + 1, A + 2);
+	break;
+    case OP_ADDRESS:
+	fprintf(out, "if (!g[%d].i) { *x = %d; pr->assignworld(); } "
+		"g[%d].i = v + g[%d].i + g[%d].i * 4;\n", A, s, C, A, B);
+	break;
+    case OP_LOAD_F:
+    case OP_LOAD_FLD:
+    case OP_LOAD_ENT:
+    case OP_LOAD_S:
+    case OP_LOAD_FNC:
+	fprintf(out, "g[%d].i = FIELD(%d, %d)[0].i;\n", C, A, B);
+	break;
+    case OP_LOAD_V:
+	fprintf(out, "p = FIELD(%d, %d); g[%d].i = p[0].i; g[%d].i = p[1].i;"
+		" g[%d].i = p[2].i;\n", A, B, C, C + 1, C + 2);
+	break;
+
+    case OP_IFNOT:
+	target = JumpTarget(s, B, first, end);
+	fprintf(out, "if (!g[%d].i) ", A);
+	WriteJump(s, target);
+	break;
+    case OP_IF:
+	target = JumpTarget(s, B, first, end);
+	fprintf(out, "if (g[%d].i) ", A);
+	WriteJump(s, target);
+	break;
+    case OP_GOTO:
+	WriteJump(s, JumpTarget(s, A, first, end));
+	break;
+
+    case OP_CALL0:
+    case OP_CALL1:
+    case OP_CALL2:
+    case OP_CALL3:
+    case OP_CALL4:
+    case OP_CALL5:
+    case OP_CALL6:
+    case OP_CALL7:
+    case OP_CALL8:
+	fprintf(out, "*x = %d; pr->call(g[%d].i, %d);\n", s, A,
+		st->op - OP_CALL0);
+	break;
+    case OP_DONE:
+    case OP_RETURN:
+	fprintf(out, "g[%d].i = g[%d].i; g[%d].i = g[%d].i; g[%d].i = g[%d].i;"
+		" return n;\n", OFS_RETURN, A, OFS_RETURN + 1, A + 1,
+		OFS_RETURN + 2, A + 2);
+	break;
+    case OP_STATE:
+	fprintf(out, "pr->state(g[%d].f, g[%d].i);\n", A, B);
+	break;
+
+    default:
+	fprintf(out, "*x = %d; pr->runerror(\"Bad opcode %%i\", %d); "
+		"return n;\n", s, st->op);
+	break;
+    }
+}
+
+#undef A
+#undef B
+#undef C
+
+static void
+WriteFunction(int fnum)
+{
+    const dfunction_t *f = &functions[fnum];
+    const dstatement_t *st;
+    int s, first, end, target;
+
+    first = f->first_statement;
+    end = FunctionEnd(fnum);
+
+    /* find the statements that are jumped to */
+    memset(jumptarget, 0, end - first);
+    for (s = first; s < end; s++) {
+	st = &statements[s];
+	switch (st->op) {
+	case OP_IF:
+	case OP_IFNOT:
+	    target = JumpTarget(s, st->b, first, end);
+	    break;
+	case OP_GOTO:
+	    target = JumpTarget(s, st->a, first, end);
+	    break;
+	default:
+	    target = -1;
+	    break;
+	}
+	if (target >= 0)
+	    jumptarget[target - first] = 1;
+    }
+
+    fprintf(out, "\n/* %s (%s) */\n", GetString(f->s_name),
+	    GetString(f->s_file));
+    fprintf(out, "static int\nF%d(void)\n{\n", fnum);
+    fprintf(out, "    prnval_t *const g = pr->globals;\n");
+    fprintf(out, "    char *const e = pr->edicts;\n");
+    fprintf(out, "    const int v = pr->entvars;\n");
+    fprintf(out, "    int *const x = pr->xstatement;\n");
+    fprintf(out, "    prnval_t *p;\n");
+    fprintf(out, "    int n = 0;\n\n");
+    fprintf(out, "    (void)e; (void)v; (void)p;\n");
+
+    for (s = first; s < end; s++)
+	WriteStatement(s, first, end);
+
+    fprintf(out, "    *x = %d; pr->runerror(\"ran off the end of the function\");\n",
+	    end - 1);
+    fprintf(out, "    return n;\n}\n");
+}
+
+static qboolean
+Compiled(int fnum)
+{
+    return fnum > 0 && functions[fnum].first_statement > 0
+	&& functions[fnum].first_statement < progs.numstatements;
+}
+
+static void
+WriteProgs(const char *infile, const char *outfile)
+{
+    int i;
+
+    out = fopen(outfile, "w");
+    if (!out)
+	Error("couldn't open %s", outfile);
+
+    jumptarget = malloc(progs.numstatements);
+    if (!jumptarget)
+	Error("out of memory");
+
+    fprintf(out, "/* Generated by tyr-progs2c from %s - do not edit */\n\n",
+	    infile);
+    fprintf(out, "#include <string.h>\n\n");
+    fprintf(out, "#include \"pr_native.h\"\n\n");
+    fprintf(out, "static const prnative_t *pr;\n\n");
+    fprintf(out, "#define FIELD(ent, fld) "
+	    "((prnval_t *)(e + v + g[ent].i) + g[fld].i)\n");
+    fprintf(out, "#define POINTER(ptr) ((prnval_t *)(e + g[ptr].i))\n");
+    fprintf(out, "#define RUNAWAY(s) "
+	    "do { if (--*pr->runaway <= 50000) "
+	    "{ *x = s; pr->runawaycheck(); } } while (0)\n");
+
+    for (i = 0; i < progs.numfunctions; i++)
+	if (Compiled(i))
+	    WriteFunction(i);
+
+    fprintf(out, "\nstatic const prnativefunc_t functions[%d] = {\n",
+	    progs.numfunctions);
+    for (i = 0; i < progs.numfunctions; i++) {
+	if (Compiled(i))
+	    fprintf(out, "    F%d,\n", i);
+	else
+	    fprintf(out, "    0,\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static void\ninit(const prnative_t *p)\n{\n");
+    fprintf(out, "    pr = p;\n}\n\n");
+
+    fprintf(out, "#ifdef _WIN32\n__declspec(dllexport)\n#endif\n");
+    fprintf(out, "const prnativeprogs_t " PR_NATIVE_SYMBOL " = {\n");
+    fprintf(out, "    PR_NATIVE_VERSION, %d, %u, %d, %d, init, functions\n",
+	    progs.crc, FileCRC(), progs.numfunctions, progs.numstatements);
+    fprintf(out, "};\n");
+
+    if (fclose(out))
+	Error("couldn't write %s", outfile);
+}
+
+int
+main(int argc, const char *argv[])
+{
+    if (argc != 3) {
+	fprintf(stderr, "usage: tyr-progs2c <progs.dat> <output.c>\n");
+	return 1;
+    }
+
+    LoadProgs(argv[1]);
+    WriteProgs(argv[1], argv[2]);
+
+    return 0;
+}
@@ -0,0 +1,10 @@
+-- three wide plates around the horizon, for panoramic lenses
+-- (no top or bottom; a plate reaches 45 degrees up and down at its center,
+--  and about 26 degrees where it meets the next one)
+
+plates = {
+   -- forward                     up         fov  vfov
+   { { 0, 0, 1 },                 { 0, 1, 0 }, 120, 90 }, -- front
+   { { cos(pi/6), 0, -sin(pi/6) }, { 0, 1, 0 }, 120, 90 }, -- back right
+   { { -cos(pi/6), 0, -sin(pi/6) }, { 0, 1, 0 }, 120, 90 }, -- back left
+}
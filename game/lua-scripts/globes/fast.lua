@@ -2,6 +2,8 @@ small = 0
 big = 1
 big_fov = 160
 
+native = "fast"
+
 plates = {
 { {0,0,1}, {0,1,0}, 90 },
 { {0,0,1}, {0,1,0}, big_fov}
@@ -1,3 +1,6 @@
+native = "cylinder"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -42,11 +42,14 @@ end
 local t = solveTheta(pi*0.5)
 maxy = 2*sqrt(pi/(4+pi))*sin(t)
 
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
 t = solveTheta(0)
 lens_width = 2/sqrt(pi*(4+pi))*pi*(1+cos(t))*2
 lens_height = 2*maxy
+outline = "search"
 
 onload = "f_contain"
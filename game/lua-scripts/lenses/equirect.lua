@@ -1,3 +1,6 @@
+native = "equirect"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -1,6 +1,8 @@
 XR = 0.819152 * pi
 YR = 1.819152
 
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -17,6 +19,13 @@ function lens_forward(x,y,z)
    return x,y
 end
 
+function lens_outline(y)
+   if abs(y) >= YR then
+      return nil
+   end
+   return XR*sqrt(1 - y*y/(YR*YR))
+end
+
 function lens_inverse(x,y)
    if x*x/(XR*XR) + y*y/(YR*YR) >= 1 then
       return nil
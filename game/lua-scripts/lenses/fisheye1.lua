@@ -1,3 +1,6 @@
+native = "fisheye1"
+symmetry = "radial"
+
 max_fov = 360
 max_vfov = 360
 
@@ -6,6 +9,13 @@ lens_height = 2*pi
 
 onload = "f_contain"
 
+function lens_outline(y)
+   if abs(y) > pi then
+      return nil
+   end
+   return sqrt(pi*pi - y*y)
+end
+
 function lens_inverse(x,y)
    local r = sqrt(x*x+y*y)
 
@@ -1,5 +1,8 @@
 maxr = 2*sin(pi*0.5)
 
+native = "fisheye2"
+symmetry = "radial"
+
 max_fov = 360
 max_vfov = 360
 
@@ -8,6 +11,13 @@ lens_height = maxr*2
 
 onload = "f_contain"
 
+function lens_outline(y)
+   if abs(y) > maxr then
+      return nil
+   end
+   return sqrt(maxr*maxr - y*y)
+end
+
 function lens_inverse(x,y)
    local r = sqrt(x*x+y*y)
    if r > maxr then
@@ -6,6 +6,8 @@ RXF = 1.41421356237309504880
 maxx = XF * pi
 maxy = YF * tan(0.5*pi/2)
 
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -2,6 +2,8 @@ d = 1
 gumbyScale = 0.75
 gumbyScaleInv = 1.0/gumbyScale
 
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -1,3 +1,6 @@
+native = "hammer"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -6,6 +9,13 @@ lens_height = sqrt(2)*2
 
 onload = "f_contain"
 
+function lens_outline(y)
+   if y*y/2 > 1 then
+      return nil
+   end
+   return sqrt(8*(1 - y*y/2))
+end
+
 function lens_inverse(x,y)
    if x*x/8+y*y/2 > 1 then 
       return nil
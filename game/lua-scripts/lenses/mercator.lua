@@ -1,5 +1,8 @@
 -- Mercator Projection
 
+native = "mercator"
+symmetry = "xy"
+
 -- FOV bounds
 max_fov = 360
 max_vfov = 180
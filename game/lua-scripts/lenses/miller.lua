@@ -1,5 +1,8 @@
 maxy = 1.25*log(tan(0.25*pi+0.4*pi*0.5))
 
+native = "miller"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -1,5 +1,8 @@
 root2 = sqrt(2)
 
+native = "mollweide"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
@@ -18,6 +21,13 @@ function solveTheta(lat)
    return t/2
 end
 
+function lens_outline(y)
+   if y*y/2 > 1 then
+      return nil
+   end
+   return sqrt(8*(1 - y*y/2))
+end
+
 function lens_inverse(x,y)
    if x*x/8 + y*y/2 > 1 then
       return nil
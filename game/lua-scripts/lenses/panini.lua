@@ -1,5 +1,8 @@
 d = 1
 
+native = "panini"
+symmetry = "xy"
+
 max_fov = 360
 max_vfov = 180
 
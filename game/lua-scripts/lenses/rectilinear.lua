@@ -1,3 +1,6 @@
+native = "rectilinear"
+symmetry = "radial"
+
 max_fov = 180
 max_vfov = 180
 
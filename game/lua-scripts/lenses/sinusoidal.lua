@@ -1,4 +1,6 @@
 
+native = "sinusoidal"
+
 max_fov = 360
 max_vfov = 180
 
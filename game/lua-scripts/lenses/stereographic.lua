@@ -1,5 +1,8 @@
 angleScale = 0.5
 
+native = "stereographic"
+symmetry = "radial"
+
 max_fov = 360
 max_vfov = 360
 
@@ -109,3 +109,10 @@ end
 maxr = lens_forward(latlon_to_ray(0,pi))
 lens_height = 2*maxr
 lens_width = 2*maxr
+
+function lens_outline(y)
+   if abs(y) > maxr then
+      return nil
+   end
+   return sqrt(maxr*maxr - y*y)
+end